@@ -546,6 +546,58 @@ b24_char_conv (int set, unsigned char c1, unsigned char c2, uint32_t *out)
   {									      \
     uint32_t ch = *inptr;						      \
 									      \
+    /* Most of the text is made of runs of graphic chars, with no control */ \
+    /* code, shift or escape sequence in between. Convert them here.     */  \
+    if (st.mode == NORMAL && st.ss == 0 && (ch & 0x60)			      \
+	&& (ch & 0x7f) != 0x20 && (ch & 0x7f) != 0x7f)			      \
+      {									      \
+	const unsigned char *runptr = inptr;				      \
+	uint32_t out[MAX_NEEDED_OUTPUT / 4];				      \
+	unsigned char c1, c2;						      \
+	int set, n, i, len;						      \
+									      \
+	while (runptr < inend)						      \
+	  {								      \
+	    c1 = *runptr;						      \
+	    if (!(c1 & 0x60) || (c1 & 0x7f) == 0x20 || (c1 & 0x7f) == 0x7f)   \
+	      break;							      \
+	    set = st.g[(c1 & 0x80) ? st.gr : st.gl];			      \
+	    if (set == DRCS0_set || set == KANJI_set || set == JISX0213_1_set \
+		|| set == JISX0213_2_set || set == EXTRA_SYMBOLS_set)	      \
+	      {								      \
+		/* leave split or invalid pairs to the code below */	      \
+		if (runptr + 1 >= inend)				      \
+		  break;						      \
+		c2 = runptr[1];						      \
+		if (!(c2 & 0x60) || (c2 & 0x80) != (c1 & 0x80))		      \
+		  break;						      \
+		n = 2;							      \
+	      }								      \
+	    else							      \
+	      {								      \
+		c2 = 0;							      \
+		n = 1;							      \
+	      }								      \
+	    len = b24_char_conv (set, c1 & 0x7f, c2 & 0x7f, out);	      \
+	    if (len == 0 || outptr + 4 * len > outend)			      \
+	      break;							      \
+	    for (i = 0; i < len; i++)					      \
+	      {								      \
+		if (irreversible					      \
+		    && __builtin_expect (out[i] == __UNKNOWN_10646_CHAR, 0))  \
+		  ++ *irreversible;					      \
+		put32 (outptr, out[i]);					      \
+		outptr += 4;						      \
+	      }								      \
+	    runptr += n;						      \
+	  }								      \
+	if (runptr != inptr)						      \
+	  {								      \
+	    inptr = runptr;						      \
+	    continue;							      \
+	  }								      \
+      }									      \
+									      \
     if (ch == 0)							      \
       {									      \
 	st.mode = NORMAL;						      \
@@ -989,67 +1041,7 @@ static const uint32_t ucs4_to_nonsp_kanji[][2] = {
 
 static const uint32_t ucs4_to_extsym[][2] = {
   {0x00b2, 0x7c55}, {0x00b3, 0x7c56}, {0x00bc, 0x7d54}, {0x00bd, 0x7d50},
-  {0x00be, 0x7d55}, {0x0fd6, 0x7b2d}, {0x203c, 0x7d6e}, {0x2049, 0x7d6f},
-  {0x2113, 0x7d47}, {0x2116, 0x7d2d}, {0x2121, 0x7d2e}, {0x213b, 0x7c7b},
-  {0x2150, 0x7d5c}, {0x2151, 0x7d5e}, {0x2152, 0x7d5f}, {0x2153, 0x7d52},
-  {0x2154, 0x7d53}, {0x2155, 0x7d56}, {0x2156, 0x7d57}, {0x2157, 0x7d58},
-  {0x2158, 0x7d59}, {0x2159, 0x7d5a}, {0x215a, 0x7d5b}, {0x215b, 0x7d5d},
-  {0x2160, 0x7e21}, {0x2161, 0x7e22}, {0x2162, 0x7e23}, {0x2163, 0x7e24},
-  {0x2164, 0x7e25}, {0x2165, 0x7e26}, {0x2166, 0x7e27}, {0x2167, 0x7e28},
-  {0x2168, 0x7e29}, {0x2169, 0x7e2a}, {0x216a, 0x7e2b}, {0x216b, 0x7e2c},
-  {0x2189, 0x7d51}, {0x2460, 0x7e61}, {0x2461, 0x7e62}, {0x2462, 0x7e63},
-  {0x2463, 0x7e64}, {0x2464, 0x7e65}, {0x2465, 0x7e66}, {0x2466, 0x7e67},
-  {0x2467, 0x7e68}, {0x2468, 0x7e69}, {0x2469, 0x7e6a}, {0x246a, 0x7e6b},
-  {0x246b, 0x7e6c}, {0x246c, 0x7e6d}, {0x246d, 0x7e6e}, {0x246e, 0x7e6f},
-  {0x246f, 0x7e70}, {0x2470, 0x7e2d}, {0x2471, 0x7e2e}, {0x2472, 0x7e2f},
-  {0x2473, 0x7e30}, {0x2474, 0x7e31}, {0x2475, 0x7e32}, {0x2476, 0x7e33},
-  {0x2477, 0x7e34}, {0x2478, 0x7e35}, {0x2479, 0x7e36}, {0x247a, 0x7e37},
-  {0x247b, 0x7e38}, {0x247c, 0x7e39}, {0x247d, 0x7e3a}, {0x247e, 0x7e3b},
-  {0x247f, 0x7e3c}, {0x2488, 0x7c31}, {0x2489, 0x7c32}, {0x248a, 0x7c33},
-  {0x248b, 0x7c34}, {0x248c, 0x7c35}, {0x248d, 0x7c36}, {0x248e, 0x7c37},
-  {0x248f, 0x7c38}, {0x2490, 0x7c39}, {0x2491, 0x7a4d}, {0x2492, 0x7a4e},
-  {0x2493, 0x7a4f}, {0x24b9, 0x7b3e}, {0x24c8, 0x7b3f}, {0x24eb, 0x7e7b},
-  {0x24ec, 0x7e7c}, {0x25b6, 0x7c50}, {0x25c0, 0x7c51}, {0x2600, 0x7d60},
-  {0x2601, 0x7d61}, {0x2602, 0x7d62}, {0x2603, 0x7d73}, {0x260e, 0x7b4b},
-  {0x260e, 0x7d7b}, {0x2613, 0x7b26}, {0x2614, 0x7d71}, {0x2616, 0x7d64},
-  {0x2617, 0x7d65}, {0x2660, 0x7d6b}, {0x2663, 0x7d6a}, {0x2665, 0x7d69},
-  {0x2666, 0x7d68}, {0x2668, 0x7b31}, {0x266c, 0x7d7a}, {0x2693, 0x7b35},
-  {0x269e, 0x7d78}, {0x269f, 0x7d79}, {0x26a1, 0x7d75}, {0x26be, 0x7d30},
-  {0x26bf, 0x7a67}, {0x26c4, 0x7d63}, {0x26c5, 0x7d70}, {0x26c6, 0x7d72},
-  {0x26c7, 0x7d74}, {0x26c8, 0x7d76}, {0x26c9, 0x7d66}, {0x26ca, 0x7d67},
-  {0x26cb, 0x7d6c}, {0x26cc, 0x7a21}, {0x26cd, 0x7a22}, {0x26cf, 0x7a24},
-  {0x26d0, 0x7a25}, {0x26d1, 0x7a26}, {0x26d2, 0x7a28}, {0x26d3, 0x7a2a},
-  {0x26d4, 0x7a2b}, {0x26d5, 0x7a29}, {0x26d6, 0x7a34}, {0x26d7, 0x7a35},
-  {0x26d8, 0x7a36}, {0x26d9, 0x7a37}, {0x26da, 0x7a38}, {0x26db, 0x7a39},
-  {0x26dc, 0x7a3a}, {0x26dd, 0x7a3b}, {0x26de, 0x7a3c}, {0x26df, 0x7a3d},
-  {0x26e0, 0x7a3e}, {0x26e1, 0x7a3f}, {0x26e3, 0x7b21}, {0x26e8, 0x7b29},
-  {0x26e9, 0x7b2c}, {0x26ea, 0x7b2e}, {0x26eb, 0x7b2f}, {0x26ec, 0x7b30},
-  {0x26ed, 0x7b32}, {0x26ee, 0x7b33}, {0x26ef, 0x7b34}, {0x26f0, 0x7b37},
-  {0x26f1, 0x7b38}, {0x26f2, 0x7b39}, {0x26f3, 0x7b3a}, {0x26f4, 0x7b3b},
-  {0x26f5, 0x7b3c}, {0x26f6, 0x7b40}, {0x26f7, 0x7b46}, {0x26f8, 0x7b47},
-  {0x26f9, 0x7b48}, {0x26fa, 0x7b49}, {0x26fb, 0x7b4c}, {0x26fc, 0x7b4d},
-  {0x26fd, 0x7b4e}, {0x26fe, 0x7b4f}, {0x26ff, 0x7b51}, {0x2762, 0x7a23},
-  {0x2776, 0x7e71}, {0x2777, 0x7e72}, {0x2778, 0x7e73}, {0x2779, 0x7e74},
-  {0x277a, 0x7e75}, {0x277b, 0x7e76}, {0x277c, 0x7e77}, {0x277d, 0x7e78},
-  {0x277e, 0x7e79}, {0x277f, 0x7e7a}, {0x27a1, 0x7c21}, {0x27d0, 0x7c54},
-  {0x2a00, 0x7d6d}, {0x2b05, 0x7c22}, {0x2b06, 0x7c23}, {0x2b07, 0x7c24},
-  {0x2b1b, 0x7a60}, {0x2b24, 0x7a61}, {0x2b2e, 0x7c26}, {0x2b2f, 0x7c25},
-  {0x2b55, 0x7a40}, {0x2b56, 0x7b22}, {0x2b57, 0x7b23}, {0x2b58, 0x7b24},
-  {0x2b59, 0x7b25}, {0x3012, 0x7b28}, {0x3016, 0x7c52}, {0x3017, 0x7c53},
-  {0x3036, 0x7d2f}, {0x322a, 0x7d21}, {0x322b, 0x7d22}, {0x322c, 0x7d23},
-  {0x322d, 0x7d24}, {0x322e, 0x7d25}, {0x322f, 0x7d26}, {0x3230, 0x7d27},
-  {0x3231, 0x7c4d}, {0x3232, 0x7c4c}, {0x3233, 0x7c4a}, {0x3236, 0x7c4b},
-  {0x3237, 0x7d28}, {0x3239, 0x7c4e}, {0x3244, 0x7c4f}, {0x3245, 0x7b2b},
-  {0x3246, 0x7b2a}, {0x3247, 0x7c78}, {0x3248, 0x7a41}, {0x3249, 0x7a42},
-  {0x324a, 0x7a43}, {0x324b, 0x7a44}, {0x324c, 0x7a45}, {0x324d, 0x7a46},
-  {0x324e, 0x7a47}, {0x324f, 0x7a48}, {0x3251, 0x7e3d}, {0x3252, 0x7e3e},
-  {0x3253, 0x7e3f}, {0x3254, 0x7e40}, {0x3255, 0x7e5b}, {0x3256, 0x7e5c},
-  {0x3257, 0x7e5d}, {0x3258, 0x7e5e}, {0x3259, 0x7e5f}, {0x325a, 0x7e60},
-  {0x325b, 0x7e7d}, {0x328b, 0x7b27}, {0x3299, 0x7a73}, {0x3371, 0x7d4d},
-  {0x337b, 0x7d2c}, {0x337c, 0x7d2b}, {0x337d, 0x7d2a}, {0x337e, 0x7d29},
-  {0x338f, 0x7d48}, {0x3390, 0x7d49}, {0x339d, 0x7c2d}, {0x339e, 0x7d4b},
-  {0x33a0, 0x7c2e}, {0x33a1, 0x7c2b}, {0x33a2, 0x7d4c}, {0x33a4, 0x7c2f},
-  {0x33a5, 0x7c2c}, {0x33ca, 0x7d4a}, {0x3402, 0x7521}, {0x351f, 0x752a},
+  {0x00be, 0x7d55}, {0x0fd6, 0x7b2d}, {0x3402, 0x7521}, {0x351f, 0x752a},
   {0x37e2, 0x7541}, {0x3eda, 0x7574}, {0x4093, 0x7578}, {0x4103, 0x757e},
   {0x4264, 0x7626}, {0x4efd, 0x7523}, {0x4eff, 0x7524}, {0x4f9a, 0x7525},
   {0x4fc9, 0x7526}, {0x509c, 0x7527}, {0x511e, 0x7528}, {0x5186, 0x7c2a},
@@ -1083,35 +1075,194 @@ static const uint32_t ucs4_to_extsym[][2] = {
   {0x9eb4, 0x764a}, {0x9eb5, 0x764b}, {0x9fc4, 0x754f}, {0x9fc5, 0x7621},
   {0x9fc6, 0x757d}, {0xfa10, 0x753a}, {0xfa11, 0x7540}, {0xfa45, 0x755b},
   {0xfa46, 0x755f}, {0xfa4a, 0x756e}, {0xfa6b, 0x7547}, {0xfa6c, 0x7563},
-  {0xfa6d, 0x762b}, {0x1f100, 0x7c30}, {0x1f101, 0x7c40}, {0x1f102, 0x7c41},
-  {0x1f103, 0x7c42}, {0x1f104, 0x7c43}, {0x1f105, 0x7c44}, {0x1f106, 0x7c45},
-  {0x1f107, 0x7c46}, {0x1f108, 0x7c47}, {0x1f109, 0x7c48}, {0x1f10a, 0x7c49},
-  {0x1f110, 0x7e41}, {0x1f111, 0x7e42}, {0x1f112, 0x7e43}, {0x1f113, 0x7e44},
-  {0x1f114, 0x7e45}, {0x1f115, 0x7e46}, {0x1f116, 0x7e47}, {0x1f117, 0x7e48},
-  {0x1f118, 0x7e49}, {0x1f119, 0x7e4a}, {0x1f11a, 0x7e4b}, {0x1f11b, 0x7e4c},
-  {0x1f11c, 0x7e4d}, {0x1f11d, 0x7e4e}, {0x1f11e, 0x7e4f}, {0x1f11f, 0x7e50},
-  {0x1f120, 0x7e51}, {0x1f121, 0x7e52}, {0x1f122, 0x7e53}, {0x1f123, 0x7e54},
-  {0x1f124, 0x7e55}, {0x1f125, 0x7e56}, {0x1f126, 0x7e57}, {0x1f127, 0x7e58},
-  {0x1f128, 0x7e59}, {0x1f129, 0x7e5a}, {0x1f12a, 0x7d3a}, {0x1f12b, 0x7c77},
-  {0x1f12c, 0x7c76}, {0x1f12d, 0x7c57}, {0x1f131, 0x7a5e}, {0x1f13d, 0x7a5f},
-  {0x1f13f, 0x7a52}, {0x1f142, 0x7a59}, {0x1f146, 0x7a53}, {0x1f14a, 0x7a50},
-  {0x1f14b, 0x7a54}, {0x1f14c, 0x7a51}, {0x1f14d, 0x7a5d}, {0x1f14e, 0x7a72},
-  {0x1f157, 0x7b3d}, {0x1f15f, 0x7b41}, {0x1f179, 0x7b45}, {0x1f17b, 0x7b4a},
-  {0x1f17c, 0x7b50}, {0x1f17f, 0x7a30}, {0x1f18a, 0x7a31}, {0x1f18b, 0x7b42},
-  {0x1f18c, 0x7b44}, {0x1f18d, 0x7b43}, {0x1f190, 0x7c79}, {0x1f200, 0x7a74},
-  {0x1f210, 0x7a55}, {0x1f211, 0x7a56}, {0x1f212, 0x7a57}, {0x1f213, 0x7a58},
-  {0x1f214, 0x7a5a}, {0x1f214, 0x7d3e}, {0x1f215, 0x7a5b}, {0x1f216, 0x7a5c},
-  {0x1f217, 0x7a62}, {0x1f218, 0x7a63}, {0x1f219, 0x7a64}, {0x1f21a, 0x7a65},
-  {0x1f21b, 0x7a66}, {0x1f21c, 0x7a68}, {0x1f21d, 0x7a69}, {0x1f21e, 0x7a6a},
-  {0x1f21f, 0x7a6b}, {0x1f220, 0x7a6c}, {0x1f221, 0x7a6d}, {0x1f222, 0x7a6e},
-  {0x1f223, 0x7a6f}, {0x1f224, 0x7a70}, {0x1f225, 0x7a71}, {0x1f226, 0x7c7a},
-  {0x1f227, 0x7d3b}, {0x1f228, 0x7d3c}, {0x1f229, 0x7d3d}, {0x1f22a, 0x7d3f},
-  {0x1f22b, 0x7d40}, {0x1f22c, 0x7d41}, {0x1f22d, 0x7d42}, {0x1f22e, 0x7d43},
-  {0x1f22f, 0x7d44}, {0x1f230, 0x7d45}, {0x1f231, 0x7d46}, {0x1f240, 0x7d31},
-  {0x1f241, 0x7d32}, {0x1f242, 0x7d33}, {0x1f243, 0x7d34}, {0x1f244, 0x7d35},
-  {0x1f245, 0x7d36}, {0x1f246, 0x7d37}, {0x1f247, 0x7d38}, {0x1f248, 0x7d39},
-  {0x1f6e7, 0x7b36}, {0x20158, 0x7522}, {0x20bb7, 0x752f}, {0x233cc, 0x7555},
-  {0x233fe, 0x7556}, {0x235c4, 0x7557}, {0x242ee, 0x7564}
+  {0xfa6d, 0x762b}, {0x1f6e7, 0x7b36}, {0x20158, 0x7522}, {0x20bb7, 0x752f},
+  {0x233cc, 0x7555}, {0x233fe, 0x7556}, {0x235c4, 0x7557}, {0x242ee, 0x7564}
+};
+
+/*
+ * Most of the extra symbols are in two ranges of UCS, where they are
+ * looked up directly instead of with bsearch().
+ */
+#define EXTSYM_BMP_MIN 0x2000
+#define EXTSYM_SMP_MIN 0x1f100
+
+static const uint16_t ucs4_to_extsym_bmp[] = {
+  [0x203c - EXTSYM_BMP_MIN] = 0x7d6e, [0x2049 - EXTSYM_BMP_MIN] = 0x7d6f,
+  [0x2113 - EXTSYM_BMP_MIN] = 0x7d47, [0x2116 - EXTSYM_BMP_MIN] = 0x7d2d,
+  [0x2121 - EXTSYM_BMP_MIN] = 0x7d2e, [0x213b - EXTSYM_BMP_MIN] = 0x7c7b,
+  [0x2150 - EXTSYM_BMP_MIN] = 0x7d5c, [0x2151 - EXTSYM_BMP_MIN] = 0x7d5e,
+  [0x2152 - EXTSYM_BMP_MIN] = 0x7d5f, [0x2153 - EXTSYM_BMP_MIN] = 0x7d52,
+  [0x2154 - EXTSYM_BMP_MIN] = 0x7d53, [0x2155 - EXTSYM_BMP_MIN] = 0x7d56,
+  [0x2156 - EXTSYM_BMP_MIN] = 0x7d57, [0x2157 - EXTSYM_BMP_MIN] = 0x7d58,
+  [0x2158 - EXTSYM_BMP_MIN] = 0x7d59, [0x2159 - EXTSYM_BMP_MIN] = 0x7d5a,
+  [0x215a - EXTSYM_BMP_MIN] = 0x7d5b, [0x215b - EXTSYM_BMP_MIN] = 0x7d5d,
+  [0x2160 - EXTSYM_BMP_MIN] = 0x7e21, [0x2161 - EXTSYM_BMP_MIN] = 0x7e22,
+  [0x2162 - EXTSYM_BMP_MIN] = 0x7e23, [0x2163 - EXTSYM_BMP_MIN] = 0x7e24,
+  [0x2164 - EXTSYM_BMP_MIN] = 0x7e25, [0x2165 - EXTSYM_BMP_MIN] = 0x7e26,
+  [0x2166 - EXTSYM_BMP_MIN] = 0x7e27, [0x2167 - EXTSYM_BMP_MIN] = 0x7e28,
+  [0x2168 - EXTSYM_BMP_MIN] = 0x7e29, [0x2169 - EXTSYM_BMP_MIN] = 0x7e2a,
+  [0x216a - EXTSYM_BMP_MIN] = 0x7e2b, [0x216b - EXTSYM_BMP_MIN] = 0x7e2c,
+  [0x2189 - EXTSYM_BMP_MIN] = 0x7d51, [0x2460 - EXTSYM_BMP_MIN] = 0x7e61,
+  [0x2461 - EXTSYM_BMP_MIN] = 0x7e62, [0x2462 - EXTSYM_BMP_MIN] = 0x7e63,
+  [0x2463 - EXTSYM_BMP_MIN] = 0x7e64, [0x2464 - EXTSYM_BMP_MIN] = 0x7e65,
+  [0x2465 - EXTSYM_BMP_MIN] = 0x7e66, [0x2466 - EXTSYM_BMP_MIN] = 0x7e67,
+  [0x2467 - EXTSYM_BMP_MIN] = 0x7e68, [0x2468 - EXTSYM_BMP_MIN] = 0x7e69,
+  [0x2469 - EXTSYM_BMP_MIN] = 0x7e6a, [0x246a - EXTSYM_BMP_MIN] = 0x7e6b,
+  [0x246b - EXTSYM_BMP_MIN] = 0x7e6c, [0x246c - EXTSYM_BMP_MIN] = 0x7e6d,
+  [0x246d - EXTSYM_BMP_MIN] = 0x7e6e, [0x246e - EXTSYM_BMP_MIN] = 0x7e6f,
+  [0x246f - EXTSYM_BMP_MIN] = 0x7e70, [0x2470 - EXTSYM_BMP_MIN] = 0x7e2d,
+  [0x2471 - EXTSYM_BMP_MIN] = 0x7e2e, [0x2472 - EXTSYM_BMP_MIN] = 0x7e2f,
+  [0x2473 - EXTSYM_BMP_MIN] = 0x7e30, [0x2474 - EXTSYM_BMP_MIN] = 0x7e31,
+  [0x2475 - EXTSYM_BMP_MIN] = 0x7e32, [0x2476 - EXTSYM_BMP_MIN] = 0x7e33,
+  [0x2477 - EXTSYM_BMP_MIN] = 0x7e34, [0x2478 - EXTSYM_BMP_MIN] = 0x7e35,
+  [0x2479 - EXTSYM_BMP_MIN] = 0x7e36, [0x247a - EXTSYM_BMP_MIN] = 0x7e37,
+  [0x247b - EXTSYM_BMP_MIN] = 0x7e38, [0x247c - EXTSYM_BMP_MIN] = 0x7e39,
+  [0x247d - EXTSYM_BMP_MIN] = 0x7e3a, [0x247e - EXTSYM_BMP_MIN] = 0x7e3b,
+  [0x247f - EXTSYM_BMP_MIN] = 0x7e3c, [0x2488 - EXTSYM_BMP_MIN] = 0x7c31,
+  [0x2489 - EXTSYM_BMP_MIN] = 0x7c32, [0x248a - EXTSYM_BMP_MIN] = 0x7c33,
+  [0x248b - EXTSYM_BMP_MIN] = 0x7c34, [0x248c - EXTSYM_BMP_MIN] = 0x7c35,
+  [0x248d - EXTSYM_BMP_MIN] = 0x7c36, [0x248e - EXTSYM_BMP_MIN] = 0x7c37,
+  [0x248f - EXTSYM_BMP_MIN] = 0x7c38, [0x2490 - EXTSYM_BMP_MIN] = 0x7c39,
+  [0x2491 - EXTSYM_BMP_MIN] = 0x7a4d, [0x2492 - EXTSYM_BMP_MIN] = 0x7a4e,
+  [0x2493 - EXTSYM_BMP_MIN] = 0x7a4f, [0x24b9 - EXTSYM_BMP_MIN] = 0x7b3e,
+  [0x24c8 - EXTSYM_BMP_MIN] = 0x7b3f, [0x24eb - EXTSYM_BMP_MIN] = 0x7e7b,
+  [0x24ec - EXTSYM_BMP_MIN] = 0x7e7c, [0x25b6 - EXTSYM_BMP_MIN] = 0x7c50,
+  [0x25c0 - EXTSYM_BMP_MIN] = 0x7c51, [0x2600 - EXTSYM_BMP_MIN] = 0x7d60,
+  [0x2601 - EXTSYM_BMP_MIN] = 0x7d61, [0x2602 - EXTSYM_BMP_MIN] = 0x7d62,
+  [0x2603 - EXTSYM_BMP_MIN] = 0x7d73, [0x260e - EXTSYM_BMP_MIN] = 0x7d7b,
+  [0x2613 - EXTSYM_BMP_MIN] = 0x7b26, [0x2614 - EXTSYM_BMP_MIN] = 0x7d71,
+  [0x2616 - EXTSYM_BMP_MIN] = 0x7d64, [0x2617 - EXTSYM_BMP_MIN] = 0x7d65,
+  [0x2660 - EXTSYM_BMP_MIN] = 0x7d6b, [0x2663 - EXTSYM_BMP_MIN] = 0x7d6a,
+  [0x2665 - EXTSYM_BMP_MIN] = 0x7d69, [0x2666 - EXTSYM_BMP_MIN] = 0x7d68,
+  [0x2668 - EXTSYM_BMP_MIN] = 0x7b31, [0x266c - EXTSYM_BMP_MIN] = 0x7d7a,
+  [0x2693 - EXTSYM_BMP_MIN] = 0x7b35, [0x269e - EXTSYM_BMP_MIN] = 0x7d78,
+  [0x269f - EXTSYM_BMP_MIN] = 0x7d79, [0x26a1 - EXTSYM_BMP_MIN] = 0x7d75,
+  [0x26be - EXTSYM_BMP_MIN] = 0x7d30, [0x26bf - EXTSYM_BMP_MIN] = 0x7a67,
+  [0x26c4 - EXTSYM_BMP_MIN] = 0x7d63, [0x26c5 - EXTSYM_BMP_MIN] = 0x7d70,
+  [0x26c6 - EXTSYM_BMP_MIN] = 0x7d72, [0x26c7 - EXTSYM_BMP_MIN] = 0x7d74,
+  [0x26c8 - EXTSYM_BMP_MIN] = 0x7d76, [0x26c9 - EXTSYM_BMP_MIN] = 0x7d66,
+  [0x26ca - EXTSYM_BMP_MIN] = 0x7d67, [0x26cb - EXTSYM_BMP_MIN] = 0x7d6c,
+  [0x26cc - EXTSYM_BMP_MIN] = 0x7a21, [0x26cd - EXTSYM_BMP_MIN] = 0x7a22,
+  [0x26cf - EXTSYM_BMP_MIN] = 0x7a24, [0x26d0 - EXTSYM_BMP_MIN] = 0x7a25,
+  [0x26d1 - EXTSYM_BMP_MIN] = 0x7a26, [0x26d2 - EXTSYM_BMP_MIN] = 0x7a28,
+  [0x26d3 - EXTSYM_BMP_MIN] = 0x7a2a, [0x26d4 - EXTSYM_BMP_MIN] = 0x7a2b,
+  [0x26d5 - EXTSYM_BMP_MIN] = 0x7a29, [0x26d6 - EXTSYM_BMP_MIN] = 0x7a34,
+  [0x26d7 - EXTSYM_BMP_MIN] = 0x7a35, [0x26d8 - EXTSYM_BMP_MIN] = 0x7a36,
+  [0x26d9 - EXTSYM_BMP_MIN] = 0x7a37, [0x26da - EXTSYM_BMP_MIN] = 0x7a38,
+  [0x26db - EXTSYM_BMP_MIN] = 0x7a39, [0x26dc - EXTSYM_BMP_MIN] = 0x7a3a,
+  [0x26dd - EXTSYM_BMP_MIN] = 0x7a3b, [0x26de - EXTSYM_BMP_MIN] = 0x7a3c,
+  [0x26df - EXTSYM_BMP_MIN] = 0x7a3d, [0x26e0 - EXTSYM_BMP_MIN] = 0x7a3e,
+  [0x26e1 - EXTSYM_BMP_MIN] = 0x7a3f, [0x26e3 - EXTSYM_BMP_MIN] = 0x7b21,
+  [0x26e8 - EXTSYM_BMP_MIN] = 0x7b29, [0x26e9 - EXTSYM_BMP_MIN] = 0x7b2c,
+  [0x26ea - EXTSYM_BMP_MIN] = 0x7b2e, [0x26eb - EXTSYM_BMP_MIN] = 0x7b2f,
+  [0x26ec - EXTSYM_BMP_MIN] = 0x7b30, [0x26ed - EXTSYM_BMP_MIN] = 0x7b32,
+  [0x26ee - EXTSYM_BMP_MIN] = 0x7b33, [0x26ef - EXTSYM_BMP_MIN] = 0x7b34,
+  [0x26f0 - EXTSYM_BMP_MIN] = 0x7b37, [0x26f1 - EXTSYM_BMP_MIN] = 0x7b38,
+  [0x26f2 - EXTSYM_BMP_MIN] = 0x7b39, [0x26f3 - EXTSYM_BMP_MIN] = 0x7b3a,
+  [0x26f4 - EXTSYM_BMP_MIN] = 0x7b3b, [0x26f5 - EXTSYM_BMP_MIN] = 0x7b3c,
+  [0x26f6 - EXTSYM_BMP_MIN] = 0x7b40, [0x26f7 - EXTSYM_BMP_MIN] = 0x7b46,
+  [0x26f8 - EXTSYM_BMP_MIN] = 0x7b47, [0x26f9 - EXTSYM_BMP_MIN] = 0x7b48,
+  [0x26fa - EXTSYM_BMP_MIN] = 0x7b49, [0x26fb - EXTSYM_BMP_MIN] = 0x7b4c,
+  [0x26fc - EXTSYM_BMP_MIN] = 0x7b4d, [0x26fd - EXTSYM_BMP_MIN] = 0x7b4e,
+  [0x26fe - EXTSYM_BMP_MIN] = 0x7b4f, [0x26ff - EXTSYM_BMP_MIN] = 0x7b51,
+  [0x2762 - EXTSYM_BMP_MIN] = 0x7a23, [0x2776 - EXTSYM_BMP_MIN] = 0x7e71,
+  [0x2777 - EXTSYM_BMP_MIN] = 0x7e72, [0x2778 - EXTSYM_BMP_MIN] = 0x7e73,
+  [0x2779 - EXTSYM_BMP_MIN] = 0x7e74, [0x277a - EXTSYM_BMP_MIN] = 0x7e75,
+  [0x277b - EXTSYM_BMP_MIN] = 0x7e76, [0x277c - EXTSYM_BMP_MIN] = 0x7e77,
+  [0x277d - EXTSYM_BMP_MIN] = 0x7e78, [0x277e - EXTSYM_BMP_MIN] = 0x7e79,
+  [0x277f - EXTSYM_BMP_MIN] = 0x7e7a, [0x27a1 - EXTSYM_BMP_MIN] = 0x7c21,
+  [0x27d0 - EXTSYM_BMP_MIN] = 0x7c54, [0x2a00 - EXTSYM_BMP_MIN] = 0x7d6d,
+  [0x2b05 - EXTSYM_BMP_MIN] = 0x7c22, [0x2b06 - EXTSYM_BMP_MIN] = 0x7c23,
+  [0x2b07 - EXTSYM_BMP_MIN] = 0x7c24, [0x2b1b - EXTSYM_BMP_MIN] = 0x7a60,
+  [0x2b24 - EXTSYM_BMP_MIN] = 0x7a61, [0x2b2e - EXTSYM_BMP_MIN] = 0x7c26,
+  [0x2b2f - EXTSYM_BMP_MIN] = 0x7c25, [0x2b55 - EXTSYM_BMP_MIN] = 0x7a40,
+  [0x2b56 - EXTSYM_BMP_MIN] = 0x7b22, [0x2b57 - EXTSYM_BMP_MIN] = 0x7b23,
+  [0x2b58 - EXTSYM_BMP_MIN] = 0x7b24, [0x2b59 - EXTSYM_BMP_MIN] = 0x7b25,
+  [0x3012 - EXTSYM_BMP_MIN] = 0x7b28, [0x3016 - EXTSYM_BMP_MIN] = 0x7c52,
+  [0x3017 - EXTSYM_BMP_MIN] = 0x7c53, [0x3036 - EXTSYM_BMP_MIN] = 0x7d2f,
+  [0x322a - EXTSYM_BMP_MIN] = 0x7d21, [0x322b - EXTSYM_BMP_MIN] = 0x7d22,
+  [0x322c - EXTSYM_BMP_MIN] = 0x7d23, [0x322d - EXTSYM_BMP_MIN] = 0x7d24,
+  [0x322e - EXTSYM_BMP_MIN] = 0x7d25, [0x322f - EXTSYM_BMP_MIN] = 0x7d26,
+  [0x3230 - EXTSYM_BMP_MIN] = 0x7d27, [0x3231 - EXTSYM_BMP_MIN] = 0x7c4d,
+  [0x3232 - EXTSYM_BMP_MIN] = 0x7c4c, [0x3233 - EXTSYM_BMP_MIN] = 0x7c4a,
+  [0x3236 - EXTSYM_BMP_MIN] = 0x7c4b, [0x3237 - EXTSYM_BMP_MIN] = 0x7d28,
+  [0x3239 - EXTSYM_BMP_MIN] = 0x7c4e, [0x3244 - EXTSYM_BMP_MIN] = 0x7c4f,
+  [0x3245 - EXTSYM_BMP_MIN] = 0x7b2b, [0x3246 - EXTSYM_BMP_MIN] = 0x7b2a,
+  [0x3247 - EXTSYM_BMP_MIN] = 0x7c78, [0x3248 - EXTSYM_BMP_MIN] = 0x7a41,
+  [0x3249 - EXTSYM_BMP_MIN] = 0x7a42, [0x324a - EXTSYM_BMP_MIN] = 0x7a43,
+  [0x324b - EXTSYM_BMP_MIN] = 0x7a44, [0x324c - EXTSYM_BMP_MIN] = 0x7a45,
+  [0x324d - EXTSYM_BMP_MIN] = 0x7a46, [0x324e - EXTSYM_BMP_MIN] = 0x7a47,
+  [0x324f - EXTSYM_BMP_MIN] = 0x7a48, [0x3251 - EXTSYM_BMP_MIN] = 0x7e3d,
+  [0x3252 - EXTSYM_BMP_MIN] = 0x7e3e, [0x3253 - EXTSYM_BMP_MIN] = 0x7e3f,
+  [0x3254 - EXTSYM_BMP_MIN] = 0x7e40, [0x3255 - EXTSYM_BMP_MIN] = 0x7e5b,
+  [0x3256 - EXTSYM_BMP_MIN] = 0x7e5c, [0x3257 - EXTSYM_BMP_MIN] = 0x7e5d,
+  [0x3258 - EXTSYM_BMP_MIN] = 0x7e5e, [0x3259 - EXTSYM_BMP_MIN] = 0x7e5f,
+  [0x325a - EXTSYM_BMP_MIN] = 0x7e60, [0x325b - EXTSYM_BMP_MIN] = 0x7e7d,
+  [0x328b - EXTSYM_BMP_MIN] = 0x7b27, [0x3299 - EXTSYM_BMP_MIN] = 0x7a73,
+  [0x3371 - EXTSYM_BMP_MIN] = 0x7d4d, [0x337b - EXTSYM_BMP_MIN] = 0x7d2c,
+  [0x337c - EXTSYM_BMP_MIN] = 0x7d2b, [0x337d - EXTSYM_BMP_MIN] = 0x7d2a,
+  [0x337e - EXTSYM_BMP_MIN] = 0x7d29, [0x338f - EXTSYM_BMP_MIN] = 0x7d48,
+  [0x3390 - EXTSYM_BMP_MIN] = 0x7d49, [0x339d - EXTSYM_BMP_MIN] = 0x7c2d,
+  [0x339e - EXTSYM_BMP_MIN] = 0x7d4b, [0x33a0 - EXTSYM_BMP_MIN] = 0x7c2e,
+  [0x33a1 - EXTSYM_BMP_MIN] = 0x7c2b, [0x33a2 - EXTSYM_BMP_MIN] = 0x7d4c,
+  [0x33a4 - EXTSYM_BMP_MIN] = 0x7c2f, [0x33a5 - EXTSYM_BMP_MIN] = 0x7c2c,
+  [0x33ca - EXTSYM_BMP_MIN] = 0x7d4a
+};
+
+static const uint16_t ucs4_to_extsym_smp[] = {
+  [0x1f100 - EXTSYM_SMP_MIN] = 0x7c30, [0x1f101 - EXTSYM_SMP_MIN] = 0x7c40,
+  [0x1f102 - EXTSYM_SMP_MIN] = 0x7c41, [0x1f103 - EXTSYM_SMP_MIN] = 0x7c42,
+  [0x1f104 - EXTSYM_SMP_MIN] = 0x7c43, [0x1f105 - EXTSYM_SMP_MIN] = 0x7c44,
+  [0x1f106 - EXTSYM_SMP_MIN] = 0x7c45, [0x1f107 - EXTSYM_SMP_MIN] = 0x7c46,
+  [0x1f108 - EXTSYM_SMP_MIN] = 0x7c47, [0x1f109 - EXTSYM_SMP_MIN] = 0x7c48,
+  [0x1f10a - EXTSYM_SMP_MIN] = 0x7c49, [0x1f110 - EXTSYM_SMP_MIN] = 0x7e41,
+  [0x1f111 - EXTSYM_SMP_MIN] = 0x7e42, [0x1f112 - EXTSYM_SMP_MIN] = 0x7e43,
+  [0x1f113 - EXTSYM_SMP_MIN] = 0x7e44, [0x1f114 - EXTSYM_SMP_MIN] = 0x7e45,
+  [0x1f115 - EXTSYM_SMP_MIN] = 0x7e46, [0x1f116 - EXTSYM_SMP_MIN] = 0x7e47,
+  [0x1f117 - EXTSYM_SMP_MIN] = 0x7e48, [0x1f118 - EXTSYM_SMP_MIN] = 0x7e49,
+  [0x1f119 - EXTSYM_SMP_MIN] = 0x7e4a, [0x1f11a - EXTSYM_SMP_MIN] = 0x7e4b,
+  [0x1f11b - EXTSYM_SMP_MIN] = 0x7e4c, [0x1f11c - EXTSYM_SMP_MIN] = 0x7e4d,
+  [0x1f11d - EXTSYM_SMP_MIN] = 0x7e4e, [0x1f11e - EXTSYM_SMP_MIN] = 0x7e4f,
+  [0x1f11f - EXTSYM_SMP_MIN] = 0x7e50, [0x1f120 - EXTSYM_SMP_MIN] = 0x7e51,
+  [0x1f121 - EXTSYM_SMP_MIN] = 0x7e52, [0x1f122 - EXTSYM_SMP_MIN] = 0x7e53,
+  [0x1f123 - EXTSYM_SMP_MIN] = 0x7e54, [0x1f124 - EXTSYM_SMP_MIN] = 0x7e55,
+  [0x1f125 - EXTSYM_SMP_MIN] = 0x7e56, [0x1f126 - EXTSYM_SMP_MIN] = 0x7e57,
+  [0x1f127 - EXTSYM_SMP_MIN] = 0x7e58, [0x1f128 - EXTSYM_SMP_MIN] = 0x7e59,
+  [0x1f129 - EXTSYM_SMP_MIN] = 0x7e5a, [0x1f12a - EXTSYM_SMP_MIN] = 0x7d3a,
+  [0x1f12b - EXTSYM_SMP_MIN] = 0x7c77, [0x1f12c - EXTSYM_SMP_MIN] = 0x7c76,
+  [0x1f12d - EXTSYM_SMP_MIN] = 0x7c57, [0x1f131 - EXTSYM_SMP_MIN] = 0x7a5e,
+  [0x1f13d - EXTSYM_SMP_MIN] = 0x7a5f, [0x1f13f - EXTSYM_SMP_MIN] = 0x7a52,
+  [0x1f142 - EXTSYM_SMP_MIN] = 0x7a59, [0x1f146 - EXTSYM_SMP_MIN] = 0x7a53,
+  [0x1f14a - EXTSYM_SMP_MIN] = 0x7a50, [0x1f14b - EXTSYM_SMP_MIN] = 0x7a54,
+  [0x1f14c - EXTSYM_SMP_MIN] = 0x7a51, [0x1f14d - EXTSYM_SMP_MIN] = 0x7a5d,
+  [0x1f14e - EXTSYM_SMP_MIN] = 0x7a72, [0x1f157 - EXTSYM_SMP_MIN] = 0x7b3d,
+  [0x1f15f - EXTSYM_SMP_MIN] = 0x7b41, [0x1f179 - EXTSYM_SMP_MIN] = 0x7b45,
+  [0x1f17b - EXTSYM_SMP_MIN] = 0x7b4a, [0x1f17c - EXTSYM_SMP_MIN] = 0x7b50,
+  [0x1f17f - EXTSYM_SMP_MIN] = 0x7a30, [0x1f18a - EXTSYM_SMP_MIN] = 0x7a31,
+  [0x1f18b - EXTSYM_SMP_MIN] = 0x7b42, [0x1f18c - EXTSYM_SMP_MIN] = 0x7b44,
+  [0x1f18d - EXTSYM_SMP_MIN] = 0x7b43, [0x1f190 - EXTSYM_SMP_MIN] = 0x7c79,
+  [0x1f200 - EXTSYM_SMP_MIN] = 0x7a74, [0x1f210 - EXTSYM_SMP_MIN] = 0x7a55,
+  [0x1f211 - EXTSYM_SMP_MIN] = 0x7a56, [0x1f212 - EXTSYM_SMP_MIN] = 0x7a57,
+  [0x1f213 - EXTSYM_SMP_MIN] = 0x7a58, [0x1f214 - EXTSYM_SMP_MIN] = 0x7d3e,
+  [0x1f215 - EXTSYM_SMP_MIN] = 0x7a5b, [0x1f216 - EXTSYM_SMP_MIN] = 0x7a5c,
+  [0x1f217 - EXTSYM_SMP_MIN] = 0x7a62, [0x1f218 - EXTSYM_SMP_MIN] = 0x7a63,
+  [0x1f219 - EXTSYM_SMP_MIN] = 0x7a64, [0x1f21a - EXTSYM_SMP_MIN] = 0x7a65,
+  [0x1f21b - EXTSYM_SMP_MIN] = 0x7a66, [0x1f21c - EXTSYM_SMP_MIN] = 0x7a68,
+  [0x1f21d - EXTSYM_SMP_MIN] = 0x7a69, [0x1f21e - EXTSYM_SMP_MIN] = 0x7a6a,
+  [0x1f21f - EXTSYM_SMP_MIN] = 0x7a6b, [0x1f220 - EXTSYM_SMP_MIN] = 0x7a6c,
+  [0x1f221 - EXTSYM_SMP_MIN] = 0x7a6d, [0x1f222 - EXTSYM_SMP_MIN] = 0x7a6e,
+  [0x1f223 - EXTSYM_SMP_MIN] = 0x7a6f, [0x1f224 - EXTSYM_SMP_MIN] = 0x7a70,
+  [0x1f225 - EXTSYM_SMP_MIN] = 0x7a71, [0x1f226 - EXTSYM_SMP_MIN] = 0x7c7a,
+  [0x1f227 - EXTSYM_SMP_MIN] = 0x7d3b, [0x1f228 - EXTSYM_SMP_MIN] = 0x7d3c,
+  [0x1f229 - EXTSYM_SMP_MIN] = 0x7d3d, [0x1f22a - EXTSYM_SMP_MIN] = 0x7d3f,
+  [0x1f22b - EXTSYM_SMP_MIN] = 0x7d40, [0x1f22c - EXTSYM_SMP_MIN] = 0x7d41,
+  [0x1f22d - EXTSYM_SMP_MIN] = 0x7d42, [0x1f22e - EXTSYM_SMP_MIN] = 0x7d43,
+  [0x1f22f - EXTSYM_SMP_MIN] = 0x7d44, [0x1f230 - EXTSYM_SMP_MIN] = 0x7d45,
+  [0x1f231 - EXTSYM_SMP_MIN] = 0x7d46, [0x1f240 - EXTSYM_SMP_MIN] = 0x7d31,
+  [0x1f241 - EXTSYM_SMP_MIN] = 0x7d32, [0x1f242 - EXTSYM_SMP_MIN] = 0x7d33,
+  [0x1f243 - EXTSYM_SMP_MIN] = 0x7d34, [0x1f244 - EXTSYM_SMP_MIN] = 0x7d35,
+  [0x1f245 - EXTSYM_SMP_MIN] = 0x7d36, [0x1f246 - EXTSYM_SMP_MIN] = 0x7d37,
+  [0x1f247 - EXTSYM_SMP_MIN] = 0x7d38, [0x1f248 - EXTSYM_SMP_MIN] = 0x7d39
 };
 
 static int
@@ -1412,14 +1563,20 @@ cmp_u32 (const void *a, const void *b)
   return *(const uint32_t *)a - *(const uint32_t *)b;
 }
 
-static int
-find_extsym_idx (uint32_t ch)
+/* returns the EXTRA_SYMBOLS code of ch, or 0 */
+static uint32_t
+find_extsym (uint32_t ch)
 {
   const uint32_t (*p)[2];
 
+  if (ch - EXTSYM_BMP_MIN < NELEMS (ucs4_to_extsym_bmp))
+    return ucs4_to_extsym_bmp[ch - EXTSYM_BMP_MIN];
+  if (ch - EXTSYM_SMP_MIN < NELEMS (ucs4_to_extsym_smp))
+    return ucs4_to_extsym_smp[ch - EXTSYM_SMP_MIN];
+
   p = bsearch (&ch, ucs4_to_extsym,
 	       NELEMS (ucs4_to_extsym), sizeof (ucs4_to_extsym[0]), cmp_u32);
-  return p ? (p - ucs4_to_extsym) : -1;
+  return p ? (*p)[1] : 0;
 }
 
 #define BODY \
@@ -1555,11 +1712,10 @@ find_extsym_idx (uint32_t ch)
       }									      \
 									      \
     /* KANJI shares some chars with EXTRA_SYMBOLS, but prefer extra symbols*/ \
-    r = find_extsym_idx (ch);						      \
-    if (r >= 0)								      \
+    r = find_extsym (ch);						      \
+    if (r != 0)								      \
       {									      \
-	ch = ucs4_to_extsym[r][1];					      \
-	r = out_extsym (&st, ch, &outptr, outend);			      \
+	r = out_extsym (&st, r, &outptr, outend);			      \
 	goto next;							      \
       }									      \
 									      \
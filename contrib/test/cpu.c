@@ -0,0 +1 @@
+../../utils/common/cpu.c
\ No newline at end of file
@@ -0,0 +1,845 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * dvb-parser-bench: measure the speed of the libdvbv5 table parsers
+ *
+ * Replays a corpus of MPEG-TS sections through the table parsers of
+ * lib/libdvbv5/tables, and a sample of each descriptor handled by
+ * libdvbv5 through dvb_desc_parse(). For each parser, it reports the
+ * sections (or descriptors) parsed per second, and the number of
+ * malloc(), calloc() and realloc() calls per section. The peak RSS of
+ * the whole run is reported at the end. The CRC32 used to validate the
+ * sections is measured over the same corpus.
+ *
+ * The PAT, CAT, PMT, NIT, SDT, EIT, MGT, VCT and ATSC EIT sections are
+ * extracted from the MPEG-TS files given at the command line, following
+ * the PAT to the PMTs and the MGT to the ATSC EITs. Without files, a
+ * synthetic corpus is used, with a few sections of each table carrying
+ * all the descriptors below, and texts that need a charset conversion.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <libdvbv5/atsc_eit.h>
+#include <libdvbv5/cat.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/dvb-ts-demux.h>
+#include <libdvbv5/eit.h>
+#include <libdvbv5/mgt.h>
+#include <libdvbv5/nit.h>
+#include <libdvbv5/pat.h>
+#include <libdvbv5/pmt.h>
+#include <libdvbv5/sdt.h>
+#include <libdvbv5/vct.h>
+
+#define NUM_PIDS		0x2000
+
+/*
+ * glibc allows replacing malloc() and friends, and its own functions,
+ * like strdup() and iconv_open(), call the replacements too.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long num_allocs;
+
+void *malloc(size_t size)
+{
+	num_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	num_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	num_allocs++;
+	return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT	1
+#else
+static unsigned long num_allocs;
+#define HAVE_ALLOC_COUNT	0
+#endif
+
+struct section {
+	uint8_t *data;
+	size_t len;
+};
+
+struct corpus {
+	struct section *s;
+	unsigned num, size;
+	size_t bytes;
+};
+
+typedef ssize_t (*parse_func)(struct dvb_v5_fe_parms *parms,
+			      const uint8_t *buf, ssize_t len);
+
+/* The parsers are given the section without the CRC, as at dvb-scan.c */
+#define PARSER(name, type)						\
+static ssize_t parse_##name(struct dvb_v5_fe_parms *parms,		\
+			    const uint8_t *buf, ssize_t len)		\
+{									\
+	struct type *table = NULL;					\
+	ssize_t ret;							\
+									\
+	ret = name##_init(parms, buf, len - DVB_CRC_SIZE, &table);	\
+	if (table)							\
+		name##_free(table);					\
+	return ret;							\
+}
+
+PARSER(dvb_table_pat, dvb_table_pat)
+PARSER(dvb_table_cat, dvb_table_cat)
+PARSER(dvb_table_pmt, dvb_table_pmt)
+PARSER(dvb_table_nit, dvb_table_nit)
+PARSER(dvb_table_sdt, dvb_table_sdt)
+PARSER(dvb_table_eit, dvb_table_eit)
+PARSER(atsc_table_mgt, atsc_table_mgt)
+PARSER(atsc_table_vct, atsc_table_vct)
+PARSER(atsc_table_eit, atsc_table_eit)
+
+enum bench_table {
+	TABLE_PAT,
+	TABLE_CAT,
+	TABLE_PMT,
+	TABLE_NIT,
+	TABLE_SDT,
+	TABLE_EIT,
+	TABLE_MGT,
+	TABLE_VCT,
+	TABLE_ATSC_EIT,
+	NUM_TABLES
+};
+
+static const struct bench_parser {
+	const char *name;
+	parse_func parse;
+} parsers[NUM_TABLES] = {
+	[TABLE_PAT]	 = { "PAT",	 parse_dvb_table_pat },
+	[TABLE_CAT]	 = { "CAT",	 parse_dvb_table_cat },
+	[TABLE_PMT]	 = { "PMT",	 parse_dvb_table_pmt },
+	[TABLE_NIT]	 = { "NIT",	 parse_dvb_table_nit },
+	[TABLE_SDT]	 = { "SDT",	 parse_dvb_table_sdt },
+	[TABLE_EIT]	 = { "EIT",	 parse_dvb_table_eit },
+	[TABLE_MGT]	 = { "MGT",	 parse_atsc_table_mgt },
+	[TABLE_VCT]	 = { "VCT",	 parse_atsc_table_vct },
+	[TABLE_ATSC_EIT] = { "ATSC EIT", parse_atsc_table_eit },
+};
+
+static struct corpus corpora[NUM_TABLES];
+static double min_time = 0.2;
+static const char *only;
+
+/* Used while timing, as the errors were already reported once */
+static void quiet_log(int level, const char *fmt, ...)
+{
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int table_of(uint8_t table_id)
+{
+	switch (table_id) {
+	case DVB_TABLE_PAT:
+		return TABLE_PAT;
+	case DVB_TABLE_CAT:
+		return TABLE_CAT;
+	case DVB_TABLE_PMT:
+		return TABLE_PMT;
+	case DVB_TABLE_NIT:
+	case DVB_TABLE_NIT2:
+		return TABLE_NIT;
+	case DVB_TABLE_SDT:
+	case DVB_TABLE_SDT2:
+		return TABLE_SDT;
+	case ATSC_TABLE_MGT:
+		return TABLE_MGT;
+	case ATSC_TABLE_TVCT:
+	case ATSC_TABLE_CVCT:
+		return TABLE_VCT;
+	case ATSC_TABLE_EIT:
+		return TABLE_ATSC_EIT;
+	}
+	if (table_id >= DVB_TABLE_EIT && table_id <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0x0f)
+		return TABLE_EIT;
+	return -1;
+}
+
+static int corpus_add(const uint8_t *buf, size_t len)
+{
+	struct corpus *c;
+	int t = table_of(buf[0]);
+
+	if (t < 0)
+		return -1;
+	c = &corpora[t];
+	if (c->num == c->size) {
+		struct section *s;
+
+		s = realloc(c->s, (c->size * 2 + 64) * sizeof(*s));
+		if (!s)
+			return -ENOMEM;
+		c->s = s;
+		c->size = c->size * 2 + 64;
+	}
+	c->s[c->num].data = malloc(len);
+	if (!c->s[c->num].data)
+		return -ENOMEM;
+	memcpy(c->s[c->num].data, buf, len);
+	c->s[c->num].len = len;
+	c->num++;
+	c->bytes += len;
+
+	return t;
+}
+
+/*
+ * Extraction of the sections from MPEG-TS files
+ */
+
+struct extract {
+	uint8_t wanted[NUM_PIDS];	/* 1: to filter, 2: already filtered */
+	unsigned new_pids;
+};
+
+static void want_pid(struct extract *ex, unsigned pid)
+{
+	if (pid < NUM_PIDS && !ex->wanted[pid]) {
+		ex->wanted[pid] = 1;
+		ex->new_pids++;
+	}
+}
+
+static void extract_section(void *priv, uint16_t pid, const uint8_t *buf,
+			    size_t len)
+{
+	struct extract *ex = priv;
+	const uint8_t *p, *end;
+	unsigned n;
+
+	if (len < 12 || corpus_add(buf, len) < 0)
+		return;
+
+	end = buf + len - 4;
+	switch (buf[0]) {
+	case DVB_TABLE_PAT:
+		/* Follow the programs to their PMTs */
+		for (p = buf + 8; p + 4 <= end; p += 4) {
+			if (p[0] || p[1])
+				want_pid(ex, (p[2] & 0x1f) << 8 | p[3]);
+		}
+		break;
+	case ATSC_TABLE_MGT:
+		/* Follow the table types 0x0100 to 0x017f: the ATSC EITs */
+		n = buf[9] << 8 | buf[10];
+		for (p = buf + 11; n-- && p + 11 <= end;
+		     p += 11 + ((p[9] & 0x0f) << 8 | p[10])) {
+			if (p[0] == 0x01 && p[1] < 0x80)
+				want_pid(ex, (p[2] & 0x1f) << 8 | p[3]);
+		}
+		break;
+	}
+}
+
+static int extract_file(const char *fname)
+{
+	struct extract *ex;
+	struct dvb_ts_demux *dmx;
+	unsigned pid;
+	ssize_t ret;
+	int fd, err = 0;
+
+	ex = calloc(1, sizeof(*ex));
+	if (!ex)
+		return -ENOMEM;
+
+	want_pid(ex, 0x0000);		/* PAT */
+	want_pid(ex, 0x0001);		/* CAT */
+	want_pid(ex, 0x0010);		/* NIT */
+	want_pid(ex, 0x0011);		/* SDT */
+	want_pid(ex, 0x0012);		/* EIT */
+	want_pid(ex, ATSC_BASE_PID);	/* MGT, VCT */
+
+	/* Each pass filters the program IDs found at the previous one */
+	while (ex->new_pids && !err) {
+		fd = open(fname, O_RDONLY);
+		if (fd < 0) {
+			err = -errno;
+			break;
+		}
+		dmx = dvb_ts_demux_alloc(NULL);
+		if (!dmx) {
+			close(fd);
+			err = -ENOMEM;
+			break;
+		}
+		ex->new_pids = 0;
+		for (pid = 0; pid < NUM_PIDS && !err; pid++) {
+			if (ex->wanted[pid] != 1)
+				continue;
+			ex->wanted[pid] = 2;
+			err = dvb_ts_demux_add_filter(dmx, pid,
+						      DVB_TS_FILTER_SECTION,
+						      extract_section, ex);
+		}
+		do {
+			ret = dvb_ts_demux_read(dmx, fd);
+		} while (ret > 0 && !err);
+		if (ret < 0 && !err)
+			err = -errno;
+		dvb_ts_demux_free(dmx);
+		close(fd);
+	}
+	free(ex);
+
+	return err;
+}
+
+/*
+ * Synthetic corpus
+ */
+
+struct builder {
+	uint8_t buf[4096];
+	size_t len;
+};
+
+static void put8(struct builder *b, unsigned v)
+{
+	b->buf[b->len++] = v;
+}
+
+static void put16(struct builder *b, unsigned v)
+{
+	put8(b, v >> 8);
+	put8(b, v);
+}
+
+static void put32(struct builder *b, uint32_t v)
+{
+	put16(b, v >> 16);
+	put16(b, v);
+}
+
+static void put_mem(struct builder *b, const void *p, size_t len)
+{
+	memcpy(b->buf + b->len, p, len);
+	b->len += len;
+}
+
+/* Reserves a 12 bits length field, filled by end_len12() */
+static size_t begin_len12(struct builder *b)
+{
+	b->len += 2;
+	return b->len;
+}
+
+static void end_len12(struct builder *b, size_t pos)
+{
+	size_t len = b->len - pos;
+
+	b->buf[pos - 2] = 0xf0 | len >> 8;
+	b->buf[pos - 1] = len;
+}
+
+static void begin_section(struct builder *b, uint8_t table_id, uint16_t id)
+{
+	b->len = 0;
+	put8(b, table_id);
+	put16(b, 0);		/* section length, filled by end_section() */
+	put16(b, id);
+	put8(b, 0xc1);		/* version 0, current */
+	put8(b, 0);		/* section number */
+	put8(b, 0);		/* last section number */
+}
+
+static void end_section(struct builder *b)
+{
+	size_t len = b->len + 4 - 3;
+	uint32_t crc;
+
+	b->buf[1] = 0xb0 | len >> 8;
+	b->buf[2] = len;
+	crc = dvb_crc32(b->buf, b->len, 0xffffffff);
+	put32(b, crc);
+	corpus_add(b->buf, b->len);
+}
+
+#define D(...)	(const uint8_t []){ __VA_ARGS__ }, sizeof((const uint8_t []){ __VA_ARGS__ })
+
+/* A sample of each descriptor with a parser */
+static const struct sample_desc {
+	uint8_t tag;
+	const uint8_t *data;
+	size_t len;
+} sample_descs[] = {
+	{ hierarchy_descriptor, D(0xf1, 0xc0, 0xc1, 0xc0) },
+	{ registration_descriptor, D('C', 'U', 'E', 'I') },
+	{ conditional_access_descriptor, D(0x0b, 0x00, 0xe1, 0x50, 0x01, 0x02) },
+	{ iso639_language_descriptor, D('e', 'n', 'g', 0x00) },
+	{ network_name_descriptor,
+	  D('B', 'e', 'n', 'c', 'h', ' ', 'R', 0xe9, 's', 'e', 'a', 'u') },
+	{ satellite_delivery_system_descriptor,
+	  D(0x01, 0x17, 0x50, 0x00, 0x01, 0x92, 0x81, 0x02, 0x75, 0x00, 0x03) },
+	{ cable_delivery_system_descriptor,
+	  D(0x03, 0x46, 0x00, 0x00, 0xff, 0xf2, 0x05, 0x00, 0x69, 0x00, 0x0f) },
+	{ service_descriptor,
+	  D(0x01, 4, 'P', 'r', 'o', 'v', 11, 'B', 'e', 'n', 'c', 'h', ' ',
+	    'T', 0xe9, 'l', 0xe9, '1') },
+	{ short_event_descriptor,
+	  D('f', 'r', 'a', 9, 'L', 'e', ' ', 'J', 'o', 'u', 'r', 'n', 'a',
+	    24, 'L', 'e', 's', ' ', 'n', 'o', 'u', 'v', 'e', 'l', 'l', 'e',
+	    's', ' ', 'd', 'u', ' ', 'j', 'o', 'u', 'r', ' ', 0xe0, '.') },
+	{ extended_event_descriptor,
+	  D(0x00, 'f', 'r', 'a', 15, 8, 'D', 'i', 'r', 'e', 'c', 't', 'o',
+	    'r', 5, 'S', 'm', 'i', 't', 'h', 16, 'U', 'n', 'e', ' ', 's', 0xe9,
+	    'r', 'i', 'e', ' ', 'c', 'o', 'm', 'i', 'q', 'u') },
+	{ CA_identifier_descriptor, D(0x0b, 0x00, 0x01, 0x00) },
+	{ terrestrial_delivery_system_descriptor,
+	  D(0x02, 0xd3, 0x4a, 0x80, 0x1f, 0x91, 0x44, 0xff, 0xff, 0xff, 0xff) },
+	{ frequency_list_descriptor,
+	  D(0xff, 0x02, 0xd3, 0x4a, 0x80, 0x02, 0xe2, 0x8c, 0xc0,
+	    0x02, 0xf1, 0xcf, 0x00) },
+	{ extension_descriptor,
+	  D(0x04, 0x00, 0x00, 0x01, 0x00, 0x00,
+	    0x00, 0x01, 0x02, 0xd3, 0x4a, 0x80, 0x00,
+	    0x00, 0x02, 0x02, 0xe2, 0x8c, 0xc0, 0x00) },
+	{ logical_channel_number_descriptor,
+	  D(0x00, 0x01, 0xfc, 0x01, 0x00, 0x02, 0xfc, 0x02) },
+	{ TS_Information_descriptior,
+	  D(0x01, 5 << 2 | 1, 'B', 'e', 'n', 'c', 'h', 0x0f, 0x02,
+	    0x00, 0x01, 0x00, 0x02) },
+	{ ISDBT_delivery_system_descriptor,
+	  D(0x01, 0x2a, 0x0f, 0x5a, 0x10, 0x0c) },
+	{ partial_reception_descriptor, D(0x00, 0x01, 0x00, 0x02) },
+	{ atsc_service_location_descriptor,
+	  D(0xe1, 0x01, 2, 0x02, 0xe1, 0x01, 0, 0, 0,
+	    0x81, 0xe1, 0x02, 'e', 'n', 'g') },
+};
+
+static void put_desc(struct builder *b, uint8_t tag)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(sample_descs); i++) {
+		if (sample_descs[i].tag != tag)
+			continue;
+		put8(b, tag);
+		put8(b, sample_descs[i].len);
+		put_mem(b, sample_descs[i].data, sample_descs[i].len);
+		return;
+	}
+}
+
+static void build_corpus(void)
+{
+	struct builder b;
+	size_t pos, pos2;
+	unsigned i, j;
+
+	begin_section(&b, DVB_TABLE_PAT, 1);
+	put16(&b, 0x0000);
+	put16(&b, 0xe010);
+	for (i = 1; i <= 16; i++) {
+		put16(&b, i);
+		put16(&b, 0xe000 | (0x100 + i));
+	}
+	end_section(&b);
+
+	begin_section(&b, DVB_TABLE_CAT, 0xffff);
+	put_desc(&b, conditional_access_descriptor);
+	put_desc(&b, conditional_access_descriptor);
+	end_section(&b);
+
+	for (i = 1; i <= 16; i++) {
+		begin_section(&b, DVB_TABLE_PMT, i);
+		put16(&b, 0xe000 | (0x1000 + i * 16));
+		pos = begin_len12(&b);
+		put_desc(&b, conditional_access_descriptor);
+		end_len12(&b, pos);
+		for (j = 0; j < 4; j++) {
+			put8(&b, j ? 0x03 : 0x1b);
+			put16(&b, 0xe000 | (0x1000 + i * 16 + j));
+			pos = begin_len12(&b);
+			put_desc(&b, iso639_language_descriptor);
+			put_desc(&b, registration_descriptor);
+			put_desc(&b, hierarchy_descriptor);
+			end_len12(&b, pos);
+		}
+		end_section(&b);
+	}
+
+	begin_section(&b, DVB_TABLE_NIT, 0x3001);
+	pos = begin_len12(&b);
+	put_desc(&b, network_name_descriptor);
+	end_len12(&b, pos);
+	pos = begin_len12(&b);
+	for (i = 1; i <= 4; i++) {
+		put16(&b, i);
+		put16(&b, 0x2000);
+		pos2 = begin_len12(&b);
+		switch (i) {
+		case 1:
+			put_desc(&b, terrestrial_delivery_system_descriptor);
+			put_desc(&b, frequency_list_descriptor);
+			put_desc(&b, logical_channel_number_descriptor);
+			put_desc(&b, extension_descriptor);
+			break;
+		case 2:
+			put_desc(&b, cable_delivery_system_descriptor);
+			break;
+		case 3:
+			put_desc(&b, satellite_delivery_system_descriptor);
+			break;
+		case 4:
+			put_desc(&b, ISDBT_delivery_system_descriptor);
+			put_desc(&b, TS_Information_descriptior);
+			put_desc(&b, partial_reception_descriptor);
+			break;
+		}
+		end_len12(&b, pos2);
+	}
+	end_len12(&b, pos);
+	end_section(&b);
+
+	begin_section(&b, DVB_TABLE_SDT, 1);
+	put16(&b, 0x2000);
+	put8(&b, 0xff);
+	for (i = 1; i <= 16; i++) {
+		put16(&b, i);
+		put8(&b, 0xff);
+		pos = begin_len12(&b);
+		put_desc(&b, service_descriptor);
+		put_desc(&b, CA_identifier_descriptor);
+		end_len12(&b, pos);
+		/* running, not scrambled */
+		b.buf[pos - 2] = (b.buf[pos - 2] & 0x0f) | 0x80;
+	}
+	end_section(&b);
+
+	for (i = 0; i < 64; i++) {
+		begin_section(&b, DVB_TABLE_EIT_SCHEDULE + i / 16, 1 + i % 16);
+		put16(&b, 1);
+		put16(&b, 0x2000);
+		put8(&b, 0);
+		put8(&b, DVB_TABLE_EIT_SCHEDULE + 3);
+		for (j = 0; j < 8; j++) {
+			put16(&b, i * 8 + j);
+			put16(&b, 0xe9b6);		/* 2022-09-01 */
+			put8(&b, 0x10 + j);		/* 1j:00:00 */
+			put16(&b, 0x0000);
+			put8(&b, 0x00);			/* lasts 00:30:00 */
+			put16(&b, 0x3000);
+			pos = begin_len12(&b);
+			put_desc(&b, short_event_descriptor);
+			put_desc(&b, extended_event_descriptor);
+			end_len12(&b, pos);
+			b.buf[pos - 2] = (b.buf[pos - 2] & 0x0f) | 0x80;
+		}
+		end_section(&b);
+	}
+
+	begin_section(&b, ATSC_TABLE_MGT, 0);
+	put8(&b, 0);				/* protocol version */
+	put16(&b, 4);
+	for (i = 0; i < 4; i++) {
+		put16(&b, i < 2 ? i : 0x100 + i - 2);
+		put16(&b, 0xe000 | (i < 2 ? ATSC_BASE_PID : 0x1d00 + i));
+		put8(&b, 0xe0);
+		put32(&b, 1024);
+		pos = begin_len12(&b);
+		end_len12(&b, pos);
+	}
+	pos = begin_len12(&b);
+	end_len12(&b, pos);
+	end_section(&b);
+
+	begin_section(&b, ATSC_TABLE_TVCT, 1);
+	put8(&b, 0);				/* protocol version */
+	put8(&b, 4);
+	for (i = 1; i <= 4; i++) {
+		static const char name[] = "BENCH-";
+
+		for (j = 0; j < 7; j++)
+			put16(&b, j < 6 ? name[j] : '0' + i);
+		put32(&b, 0xf0000000 | 7 << 18 | i << 8 | 0x04);
+		put32(&b, 0);
+		put16(&b, 1);
+		put16(&b, i);
+		put16(&b, 0x0dc2);
+		put16(&b, i);
+		pos = begin_len12(&b);
+		put_desc(&b, atsc_service_location_descriptor);
+		end_len12(&b, pos);
+		b.buf[pos - 2] |= 0xfc;
+	}
+	pos = begin_len12(&b);
+	end_len12(&b, pos);
+	b.buf[pos - 2] |= 0xfc;
+	end_section(&b);
+
+	for (i = 0; i < 16; i++) {
+		static const char title[] = "Bench event";
+
+		begin_section(&b, ATSC_TABLE_EIT, 1 + i % 4);
+		put8(&b, 0);			/* protocol version */
+		put8(&b, 8);
+		for (j = 0; j < 8; j++) {
+			put16(&b, 0xc000 | (i * 8 + j));
+			put32(&b, 1346025600 + (i / 4 * 8 + j) * 1800);
+			/* no ETM, lasts 30 minutes */
+			put32(&b, 0xc0000000 | 1800 << 8 |
+			      (8 + sizeof(title) - 1));
+			/* multiple string structure: one uncompressed string */
+			put8(&b, 1);
+			put_mem(&b, "eng", 3);
+			put8(&b, 1);
+			put8(&b, 0x00);
+			put8(&b, 0x00);
+			put8(&b, sizeof(title) - 1);
+			put_mem(&b, title, sizeof(title) - 1);
+			pos = begin_len12(&b);
+			put_desc(&b, iso639_language_descriptor);
+			end_len12(&b, pos);
+		}
+		end_section(&b);
+	}
+}
+
+/*
+ * Benchmark
+ */
+
+static void report(const char *name, const char *unit, unsigned long count,
+		   size_t bytes, unsigned long allocs, double elapsed)
+{
+	printf("%-44s %9.0f %s/s %8.1f MB/s", name, count / elapsed, unit,
+	       bytes / elapsed / 1e6);
+	if (HAVE_ALLOC_COUNT)
+		printf(" %6.1f allocs/%s", (double)allocs / count, unit);
+	printf("\n");
+}
+
+static void bench_table(struct dvb_v5_fe_parms *parms, enum bench_table t)
+{
+	const struct corpus *c = &corpora[t];
+	unsigned long count = 0, allocs, errors = 0;
+	size_t bytes = 0;
+	double start, elapsed;
+	unsigned i;
+
+	if (!c->num)
+		return;
+
+	/* The first pass also warns about the broken sections, once */
+	for (i = 0; i < c->num; i++)
+		if (parsers[t].parse(parms, c->s[i].data, c->s[i].len) < 0)
+			errors++;
+	if (errors)
+		printf("%s: %lu of %u sections failed to parse\n",
+		       parsers[t].name, errors, c->num);
+
+	parms->logfunc = quiet_log;
+	allocs = num_allocs;
+	start = now();
+	do {
+		for (i = 0; i < c->num; i++)
+			parsers[t].parse(parms, c->s[i].data, c->s[i].len);
+		count += c->num;
+		bytes += c->bytes;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+	allocs = num_allocs - allocs;
+
+	report(parsers[t].name, "section", count, bytes, allocs, elapsed);
+}
+
+static void bench_crc(void)
+{
+	unsigned long count = 0;
+	size_t bytes = 0;
+	double start, elapsed;
+	unsigned i, t;
+	uint32_t crc = 0;
+
+	start = now();
+	do {
+		for (t = 0; t < NUM_TABLES; t++) {
+			for (i = 0; i < corpora[t].num; i++)
+				crc |= dvb_crc32(corpora[t].s[i].data,
+						 corpora[t].s[i].len,
+						 0xffffffff);
+			count += corpora[t].num;
+			bytes += corpora[t].bytes;
+		}
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+
+	if (crc)
+		printf("CRC32: some sections have a wrong CRC\n");
+	printf("%-44s %9.0f section/s %8.1f MB/s\n", "CRC32", count / elapsed,
+	       bytes / elapsed / 1e6);
+}
+
+static void bench_desc(struct dvb_v5_fe_parms *parms,
+		       const struct sample_desc *d)
+{
+	struct dvb_desc *list;
+	unsigned long count = 0, allocs;
+	uint8_t buf[2 + 255];
+	double start, elapsed;
+	char name[64];
+	unsigned i;
+
+	buf[0] = d->tag;
+	buf[1] = d->len;
+	memcpy(buf + 2, d->data, d->len);
+
+	if (dvb_desc_parse(parms, buf, d->len + 2, &list) || !list) {
+		printf("%s: failed to parse\n", dvb_descriptors[d->tag].name);
+		dvb_desc_free(&list);
+		return;
+	}
+	dvb_desc_free(&list);
+
+	parms->logfunc = quiet_log;
+	allocs = num_allocs;
+	start = now();
+	do {
+		for (i = 0; i < 1000; i++) {
+			dvb_desc_parse(parms, buf, d->len + 2, &list);
+			dvb_desc_free(&list);
+		}
+		count += 1000;
+		elapsed = now() - start;
+	} while (elapsed < min_time);
+	allocs = num_allocs - allocs;
+
+	snprintf(name, sizeof(name), "desc %s", dvb_descriptors[d->tag].name);
+	report(name, "desc", count, count * (d->len + 2), allocs, elapsed);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] [file.ts...]\n"
+		"  -p, --parser=<name>     only benchmark this parser, like PMT\n"
+		"                          or desc (all descriptors)\n"
+		"  -t, --time=<seconds>    minimum time per parser (default 0.2)\n"
+		"  -h, --help              show this help\n"
+		"\n"
+		"Without files, a synthetic corpus is used.\n", prog);
+}
+
+static const struct option long_options[] = {
+	{ "parser", required_argument, NULL, 'p' },
+	{ "time", required_argument, NULL, 't' },
+	{ "help", no_argument, NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	struct dvb_v5_fe_parms *parms;
+	dvb_logfunc logfunc;
+	struct rusage ru;
+	unsigned i, t;
+	int c, ret;
+
+	while ((c = getopt_long(argc, argv, "p:t:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 'p':
+			only = optarg;
+			break;
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	parms = dvb_fe_dummy();
+	if (!parms) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	logfunc = parms->logfunc;
+
+	if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			ret = extract_file(argv[i]);
+			if (ret < 0) {
+				fprintf(stderr, "%s: %s\n", argv[i],
+					strerror(-ret));
+				return 1;
+			}
+		}
+	} else {
+		build_corpus();
+	}
+
+	for (t = 0; t < NUM_TABLES; t++)
+		printf("%-8s %7u sections %10zu bytes\n", parsers[t].name,
+		       corpora[t].num, corpora[t].bytes);
+	if (!HAVE_ALLOC_COUNT)
+		printf("malloc() can't be replaced, not counting allocations\n");
+	printf("\n");
+
+	for (t = 0; t < NUM_TABLES; t++) {
+		if (only && strcasecmp(only, parsers[t].name))
+			continue;
+		parms->logfunc = logfunc;
+		bench_table(parms, t);
+	}
+	if (!only || !strcasecmp(only, "CRC32"))
+		bench_crc();
+	for (i = 0; i < ARRAY_SIZE(sample_descs); i++) {
+		if (only && strcasecmp(only, "desc"))
+			continue;
+		parms->logfunc = logfunc;
+		bench_desc(parms, &sample_descs[i]);
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("\npeak RSS: %ld KiB\n", ru.ru_maxrss);
+
+	for (t = 0; t < NUM_TABLES; t++) {
+		for (i = 0; i < corpora[t].num; i++)
+			free(corpora[t].s[i].data);
+		free(corpora[t].s);
+	}
+	dvb_fe_close(parms);
+
+	return 0;
+}
@@ -0,0 +1,1153 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * ir-bpf-bench: test and measure the BPF IR decoders
+ *
+ * Runs one of the decoders of utils/keytable/bpf_protocols on recorded
+ * or synthetic pulse/space streams, and reports the scancodes decoded,
+ * the decoded frames which don't match the expected scancode, and the
+ * time and number of BPF instructions per sample.
+ *
+ * The kernel doesn't support BPF_PROG_TEST_RUN for lirc_mode2
+ * programs, so the decoder is run by a small eBPF interpreter, with
+ * the maps and the rc helpers emulated in user space. The decoder
+ * parameters are patched in the same way as ir-keytable does, taking
+ * the values from the keymap given with -k, or from -p.
+ *
+ * With a keymap, each of its scancodes is encoded with the ir-ctl
+ * encoder for the protocol (pulse_distance, pulse_length and
+ * manchester), or taken from its raw entries, and the decoder must
+ * report the same scancode. The durations can be randomly moved by
+ * the -j jitter, to check the margins. The captures given at the
+ * command line, in any of the ir-ctl -r formats, are decoded as well.
+ *
+ * The interpreter doesn't verify the program like the kernel does,
+ * and it is much slower than the JIT. The number of instructions per
+ * sample is what should be compared against the IR sample rate.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <argp.h>
+
+#include <linux/bpf.h>
+#include <linux/lirc.h>
+
+#include "keymap.h"
+#include "bpf_encoder.h"
+
+#ifndef EM_BPF
+#define EM_BPF			247
+#endif
+
+#define MAX_MAPS		32
+#define MAX_CALL_DEPTH		8
+#define STACK_SIZE		512
+#define MAX_INSNS_PER_RUN	(1 << 20)
+#define MAX_FRAME		1024
+#define DEFAULT_TIMEOUT		125000
+
+struct vm_map {
+	char name[64];
+	size_t elf_offset;
+	uint32_t type;
+	uint32_t key_size;
+	uint32_t value_size;
+	uint32_t max_entries;
+	bool raw;
+	uint8_t *data;
+};
+
+struct decoder {
+	char name[128];
+	struct bpf_insn *insns;
+	unsigned int num_insns;
+	struct vm_map maps[MAX_MAPS];
+	unsigned int nr_maps;
+};
+
+// This should match the struct in the raw BPF decoder
+struct raw_pattern {
+	unsigned int scancode;
+	unsigned short raw[0];
+};
+
+struct event {
+	uint64_t scancode;
+	uint32_t protocol;
+	uint32_t toggle;
+	bool repeat;
+	bool pointer;
+	int rel_x, rel_y;
+};
+
+struct samples {
+	uint32_t *buf;
+	unsigned int len;
+	unsigned int size;
+};
+
+/* what the rc helpers were called with since the last reset */
+static struct event events[16];
+static unsigned int num_events;
+static unsigned long total_events;
+
+static unsigned long insns_run;
+static unsigned int max_insns;
+static int verbose;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-k keymap] [-p name=value]... [-j jitter] [-t timeout]\n"
+		"       [-n passes] [-v] decoder.o [capture]...\n"
+		"  -k keymap  toml keymap with the protocol parameters and the\n"
+		"             scancodes to encode and check\n"
+		"  -p         override a decoder parameter, the frames are still\n"
+		"             encoded with the keymap ones\n"
+		"  -j jitter  move each duration by up to +/- jitter us\n"
+		"  -t timeout timeout added after each frame (default %u us)\n"
+		"  -n passes  passes over the samples for the benchmark (default 1000)\n"
+		"  -v         show the decoded events\n",
+		prog, DEFAULT_TIMEOUT);
+}
+
+/*
+ * ELF loading, mirroring load_bpf_file() of ir-keytable
+ */
+
+static int param_value(struct protocol_param *param, const char *name, int *value)
+{
+	for (; param; param = param->next) {
+		if (!strcmp(param->name, name)) {
+			*value = param->value;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int cmp_maps(const void *l, const void *r)
+{
+	const struct vm_map *lm = l, *rm = r;
+
+	if (lm->elf_offset < rm->elf_offset)
+		return -1;
+	return lm->elf_offset > rm->elf_offset;
+}
+
+static int build_raw_map(struct vm_map *map, struct raw_entry *raw,
+			 int *max_length, int *trail_space)
+{
+	struct raw_pattern *p;
+	struct raw_entry *e;
+	unsigned int n = 0, i;
+
+	*max_length = 0;
+	*trail_space = 0;
+	for (e = raw; e; e = e->next) {
+		if ((int)e->raw_length > *max_length)
+			*max_length = e->raw_length;
+		n++;
+	}
+	if (!n)
+		return 0;
+
+	// pattern needs a trailing 0 to mark the end of the pattern
+	(*max_length)++;
+
+	map->value_size = sizeof(struct raw_pattern) + *max_length * sizeof(short);
+	map->max_entries = n;
+	map->data = calloc(n, map->value_size);
+	if (!map->data)
+		return -1;
+
+	p = (struct raw_pattern *)map->data;
+	for (e = raw; e; e = e->next) {
+		p->scancode = e->scancode;
+		for (i = 0; i < e->raw_length; i++) {
+			p->raw[i] = e->raw[i];
+			if (i % 2 && (int)e->raw[i] > *trail_space)
+				*trail_space = e->raw[i];
+		}
+		p = (struct raw_pattern *)((uint8_t *)p + map->value_size);
+	}
+
+	// 1ms extra for trailing space, as ir-keytable does
+	*trail_space += 1000;
+	return 0;
+}
+
+static int load_decoder(const char *path, struct decoder *d,
+			struct protocol_param *param, struct raw_entry *raw)
+{
+	int maps_idx = -1, data_idx = -1, bss_idx = -1, prog_idx = -1;
+	int max_length = 0, trail_space = 0;
+	Elf64_Shdr *shdr, *symtab = NULL;
+	const char *shstrtab, *strtab;
+	unsigned int i, j, num_syms;
+	Elf64_Ehdr *ehdr;
+	Elf64_Sym *syms;
+	struct stat st;
+	uint8_t *elf;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		return -1;
+	}
+	elf = malloc(st.st_size);
+	if (!elf || read(fd, elf, st.st_size) != st.st_size) {
+		perror(path);
+		close(fd);
+		free(elf);
+		return -1;
+	}
+	close(fd);
+
+	ehdr = (Elf64_Ehdr *)elf;
+	if (st.st_size < (off_t)sizeof(*ehdr) ||
+	    memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+	    ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+	    ehdr->e_machine != EM_BPF ||
+	    ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(*shdr) > (uint64_t)st.st_size ||
+	    ehdr->e_shstrndx >= ehdr->e_shnum) {
+		fprintf(stderr, "%s: not a little endian BPF object\n", path);
+		goto done;
+	}
+
+	shdr = (Elf64_Shdr *)(elf + ehdr->e_shoff);
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		if (shdr[i].sh_type != SHT_NOBITS &&
+		    shdr[i].sh_offset + shdr[i].sh_size > (uint64_t)st.st_size) {
+			fprintf(stderr, "%s: section %u out of the file\n", path, i);
+			goto done;
+		}
+	}
+	shstrtab = (const char *)elf + shdr[ehdr->e_shstrndx].sh_offset;
+
+	for (i = 1; i < ehdr->e_shnum; i++) {
+		const char *shname = shstrtab + shdr[i].sh_name;
+
+		if (!strcmp(shname, "lirc_mode2/maps") || !strcmp(shname, "maps"))
+			maps_idx = i;
+		else if (!strcmp(shname, ".data"))
+			data_idx = i;
+		else if (!strcmp(shname, ".bss"))
+			bss_idx = i;
+		else if (shdr[i].sh_type == SHT_SYMTAB)
+			symtab = &shdr[i];
+		else if (shdr[i].sh_type == SHT_PROGBITS &&
+			 (shdr[i].sh_flags & SHF_EXECINSTR) && shdr[i].sh_size &&
+			 prog_idx < 0)
+			prog_idx = i;
+	}
+
+	if (!symtab) {
+		fprintf(stderr, "%s: missing SHT_SYMTAB section\n", path);
+		goto done;
+	}
+	if (prog_idx < 0) {
+		fprintf(stderr, "%s: no program found\n", path);
+		goto done;
+	}
+
+	syms = (Elf64_Sym *)(elf + symtab->sh_offset);
+	num_syms = symtab->sh_size / sizeof(*syms);
+	strtab = (const char *)elf + shdr[symtab->sh_link].sh_offset;
+
+	if (!strncmp(shstrtab + shdr[prog_idx].sh_name, "lirc_mode2/", 11))
+		strncpy(d->name, shstrtab + shdr[prog_idx].sh_name + 11, sizeof(d->name) - 1);
+	else
+		strncpy(d->name, shstrtab + shdr[prog_idx].sh_name, sizeof(d->name) - 1);
+
+	d->num_insns = shdr[prog_idx].sh_size / sizeof(struct bpf_insn);
+	d->insns = malloc(shdr[prog_idx].sh_size);
+	if (!d->insns)
+		goto done;
+	memcpy(d->insns, elf + shdr[prog_idx].sh_offset, shdr[prog_idx].sh_size);
+
+	if (maps_idx >= 0) {
+		size_t def_size;
+
+		for (i = 0; i < num_syms; i++) {
+			struct vm_map *m = &d->maps[d->nr_maps];
+
+			if (syms[i].st_shndx != maps_idx)
+				continue;
+			if (d->nr_maps == MAX_MAPS) {
+				fprintf(stderr, "%s: too many maps\n", path);
+				goto done;
+			}
+			strncpy(m->name, strtab + syms[i].st_name, sizeof(m->name) - 1);
+			m->elf_offset = syms[i].st_value;
+			d->nr_maps++;
+		}
+		if (!d->nr_maps) {
+			fprintf(stderr, "%s: no symbols for the maps\n", path);
+			goto done;
+		}
+
+		qsort(d->maps, d->nr_maps, sizeof(d->maps[0]), cmp_maps);
+
+		// All struct bpf_map_def have the same size, see bpf_load.c
+		def_size = shdr[maps_idx].sh_size / d->nr_maps;
+		if (def_size < 4 * sizeof(uint32_t)) {
+			fprintf(stderr, "%s: maps section too small\n", path);
+			goto done;
+		}
+
+		for (i = 0; i < d->nr_maps; i++) {
+			struct vm_map *m = &d->maps[i];
+			uint32_t def[4];
+
+			memcpy(def, elf + shdr[maps_idx].sh_offset + m->elf_offset, sizeof(def));
+			m->type = def[0];
+			m->key_size = def[1];
+			m->value_size = def[2];
+			m->max_entries = def[3];
+
+			if (m->type != BPF_MAP_TYPE_ARRAY || m->key_size != sizeof(uint32_t)) {
+				fprintf(stderr, "%s: map %s: only array maps are supported\n",
+					path, m->name);
+				goto done;
+			}
+
+			if (!strcmp(m->name, "raw_map")) {
+				m->raw = true;
+				if (build_raw_map(m, raw, &max_length, &trail_space))
+					goto done;
+				continue;
+			}
+
+			m->data = calloc(m->max_entries, m->value_size);
+			if (!m->data)
+				goto done;
+		}
+	}
+
+	for (i = 1; i < ehdr->e_shnum; i++) {
+		Elf64_Rel *rel;
+		unsigned int nrels;
+
+		if (shdr[i].sh_type != SHT_REL || shdr[i].sh_info != (unsigned int)prog_idx)
+			continue;
+
+		rel = (Elf64_Rel *)(elf + shdr[i].sh_offset);
+		nrels = shdr[i].sh_size / sizeof(*rel);
+
+		for (j = 0; j < nrels; j++) {
+			unsigned int insn_idx = rel[j].r_offset / sizeof(struct bpf_insn);
+			unsigned int sym_idx = ELF64_R_SYM(rel[j].r_info);
+			struct bpf_insn *insn;
+			const char *sym_name;
+			Elf64_Sym *sym;
+			int value = 0;
+			unsigned int m;
+
+			if (sym_idx >= num_syms || insn_idx + 1 >= d->num_insns) {
+				fprintf(stderr, "%s: invalid relocation %u\n", path, j);
+				goto done;
+			}
+			sym = &syms[sym_idx];
+			sym_name = strtab + sym->st_name;
+			insn = &d->insns[insn_idx];
+
+			if (insn->code != (BPF_LD | BPF_IMM | BPF_DW)) {
+				fprintf(stderr, "%s: invalid relo for insn[%u].code 0x%x\n",
+					path, insn_idx, insn->code);
+				goto done;
+			}
+
+			if (maps_idx >= 0 && sym->st_shndx == maps_idx) {
+				for (m = 0; m < d->nr_maps; m++)
+					if (d->maps[m].elf_offset == sym->st_value)
+						break;
+				if (m == d->nr_maps) {
+					fprintf(stderr, "%s: invalid relo for insn[%u] no map match\n",
+						path, insn_idx);
+					goto done;
+				}
+				insn->src_reg = BPF_PSEUDO_MAP_FD;
+				insn->imm = m;
+				continue;
+			}
+
+			if ((data_idx < 0 || sym->st_shndx != data_idx) &&
+			    (bss_idx < 0 || sym->st_shndx != bss_idx)) {
+				fprintf(stderr, "%s: symbol %s has unknown section %d\n",
+					path, sym_name, sym->st_shndx);
+				goto done;
+			}
+
+			if (!param_value(param, sym_name, &value)) {
+				// overridden by the keymap or -p
+			} else if (!strcmp(sym_name, "max_length") && max_length) {
+				value = max_length;
+			} else if (!strcmp(sym_name, "trail_space") && trail_space) {
+				value = trail_space;
+			} else if (sym->st_shndx == data_idx) {
+				if (sym->st_value + sizeof(int) > shdr[data_idx].sh_size) {
+					fprintf(stderr, "%s: symbol %s out of .data\n", path, sym_name);
+					goto done;
+				}
+				memcpy(&value, elf + shdr[data_idx].sh_offset + sym->st_value,
+				       sizeof(value));
+			}
+
+			if (verbose > 1)
+				printf("patching insn[%u] with immediate %d for symbol %s\n",
+				       insn_idx, value, sym_name);
+
+			// the value is used as an int, see BPF_PARAM()
+			insn->imm = value;
+			insn[1].imm = 0;
+		}
+	}
+	ret = 0;
+
+done:
+	free(elf);
+	return ret;
+}
+
+static void free_decoder(struct decoder *d)
+{
+	unsigned int i;
+
+	free(d->insns);
+	for (i = 0; i < d->nr_maps; i++)
+		free(d->maps[i].data);
+	memset(d, 0, sizeof(*d));
+}
+
+static void reset_decoder(struct decoder *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->nr_maps; i++)
+		if (!d->maps[i].raw)
+			memset(d->maps[i].data, 0,
+			       (size_t)d->maps[i].max_entries * d->maps[i].value_size);
+}
+
+/*
+ * The interpreter
+ */
+
+static void add_event(const struct event *ev)
+{
+	total_events++;
+	if (num_events < sizeof(events) / sizeof(events[0]))
+		events[num_events++] = *ev;
+}
+
+static int call_helper(struct decoder *d, int32_t func, uint64_t *reg)
+{
+	struct event ev = {};
+	struct vm_map *map;
+	uint32_t key;
+
+	switch (func) {
+	case BPF_FUNC_map_lookup_elem:
+		map = (struct vm_map *)(uintptr_t)reg[1];
+		if (map < d->maps || map >= d->maps + d->nr_maps)
+			return -1;
+		memcpy(&key, (void *)(uintptr_t)reg[2], sizeof(key));
+		if (key >= map->max_entries)
+			reg[0] = 0;
+		else
+			reg[0] = (uintptr_t)(map->data + (size_t)key * map->value_size);
+		return 0;
+	case BPF_FUNC_ktime_get_ns: {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		reg[0] = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		return 0;
+	}
+	case BPF_FUNC_trace_printk:
+		if (verbose > 1)
+			printf("trace_printk: %.*s\n", (int)reg[2],
+			       (const char *)(uintptr_t)reg[1]);
+		reg[0] = 0;
+		return 0;
+	case BPF_FUNC_rc_repeat:
+		ev.repeat = true;
+		add_event(&ev);
+		reg[0] = 0;
+		return 0;
+	case BPF_FUNC_rc_keydown:
+		ev.protocol = reg[2];
+		ev.scancode = reg[3];
+		ev.toggle = reg[4];
+		add_event(&ev);
+		reg[0] = 0;
+		return 0;
+	case BPF_FUNC_rc_pointer_rel:
+		ev.pointer = true;
+		ev.rel_x = reg[2];
+		ev.rel_y = reg[3];
+		add_event(&ev);
+		reg[0] = 0;
+		return 0;
+	}
+
+	fprintf(stderr, "%s: unsupported helper %d\n", d->name, func);
+	return -1;
+}
+
+#define ALU_OPS(r, dst, src)						\
+	case BPF_ADD: r = dst + src; break;				\
+	case BPF_SUB: r = dst - src; break;				\
+	case BPF_MUL: r = dst * src; break;				\
+	case BPF_DIV: r = src ? dst / src : 0; break;			\
+	case BPF_MOD: r = src ? dst % src : dst; break;			\
+	case BPF_OR:  r = dst | src; break;				\
+	case BPF_AND: r = dst & src; break;				\
+	case BPF_XOR: r = dst ^ src; break;				\
+	case BPF_MOV: r = src; break;					\
+	case BPF_NEG: r = -dst; break;
+
+static bool jmp_cond(uint8_t op, uint64_t a, uint64_t b, int64_t sa, int64_t sb)
+{
+	switch (op) {
+	case BPF_JEQ:  return a == b;
+	case BPF_JNE:  return a != b;
+	case BPF_JGT:  return a > b;
+	case BPF_JGE:  return a >= b;
+	case BPF_JLT:  return a < b;
+	case BPF_JLE:  return a <= b;
+	case BPF_JSET: return a & b;
+	case BPF_JSGT: return sa > sb;
+	case BPF_JSGE: return sa >= sb;
+	case BPF_JSLT: return sa < sb;
+	case BPF_JSLE: return sa <= sb;
+	}
+	return false;
+}
+
+/*
+ * Run the decoder on a sample. The program was accepted by the kernel
+ * verifier when it was built for ir-keytable, so the memory accesses
+ * aren't checked, but the instructions and the helpers are.
+ */
+static int run_decoder(struct decoder *d, uint32_t *sample)
+{
+	static uint8_t stack[MAX_CALL_DEPTH][STACK_SIZE];
+	struct {
+		unsigned int ret_pc;
+		uint64_t saved[4];
+	} frames[MAX_CALL_DEPTH];
+	unsigned int pc = 0, cur = 0, depth = 0, count = 0;
+	uint64_t reg[11] = {};
+
+	reg[1] = (uintptr_t)sample;
+	reg[10] = (uintptr_t)stack[0] + STACK_SIZE;
+
+	while (pc < d->num_insns) {
+		const struct bpf_insn *insn = &d->insns[pc];
+		uint64_t dst, src;
+		uint8_t *addr;
+		uint32_t r32;
+		uint64_t r;
+
+		cur = pc++;
+
+		if (++count > MAX_INSNS_PER_RUN) {
+			fprintf(stderr, "%s: no exit after %u instructions\n",
+				d->name, count - 1);
+			return -1;
+		}
+		if (insn->dst_reg > 10 || insn->src_reg > 10)
+			goto invalid;
+
+		dst = reg[insn->dst_reg];
+		switch (BPF_CLASS(insn->code)) {
+		case BPF_ALU:
+		case BPF_ALU64:
+		case BPF_JMP:
+		case BPF_JMP32:
+			src = BPF_SRC(insn->code) == BPF_X ?
+				reg[insn->src_reg] : (uint64_t)(int64_t)insn->imm;
+			break;
+		case BPF_STX:
+			src = reg[insn->src_reg];
+			break;
+		default:
+			src = (uint64_t)(int64_t)insn->imm;
+			break;
+		}
+
+		switch (BPF_CLASS(insn->code)) {
+		case BPF_ALU64:
+			if (insn->off)
+				goto invalid;
+			switch (BPF_OP(insn->code)) {
+			ALU_OPS(r, dst, src)
+			case BPF_LSH: r = dst << (src & 63); break;
+			case BPF_RSH: r = dst >> (src & 63); break;
+			case BPF_ARSH: r = (int64_t)dst >> (src & 63); break;
+			default:
+				goto invalid;
+			}
+			reg[insn->dst_reg] = r;
+			break;
+		case BPF_ALU:
+			if (insn->off)
+				goto invalid;
+			if (BPF_OP(insn->code) == BPF_END) {
+				switch (insn->imm) {
+				case 16:
+					r = BPF_SRC(insn->code) == BPF_TO_BE ?
+						__builtin_bswap16(dst) : (uint16_t)dst;
+					break;
+				case 32:
+					r = BPF_SRC(insn->code) == BPF_TO_BE ?
+						__builtin_bswap32(dst) : (uint32_t)dst;
+					break;
+				case 64:
+					r = BPF_SRC(insn->code) == BPF_TO_BE ?
+						__builtin_bswap64(dst) : dst;
+					break;
+				default:
+					goto invalid;
+				}
+				reg[insn->dst_reg] = r;
+				break;
+			}
+			switch (BPF_OP(insn->code)) {
+			ALU_OPS(r32, (uint32_t)dst, (uint32_t)src)
+			case BPF_LSH: r32 = (uint32_t)dst << (src & 31); break;
+			case BPF_RSH: r32 = (uint32_t)dst >> (src & 31); break;
+			case BPF_ARSH: r32 = (int32_t)dst >> (src & 31); break;
+			default:
+				goto invalid;
+			}
+			reg[insn->dst_reg] = r32;
+			break;
+		case BPF_JMP:
+		case BPF_JMP32:
+			switch (BPF_OP(insn->code)) {
+			case BPF_JA:
+				if (BPF_CLASS(insn->code) != BPF_JMP)
+					goto invalid;
+				pc += insn->off;
+				break;
+			case BPF_CALL:
+				if (insn->src_reg == BPF_PSEUDO_CALL) {
+					if (depth + 1 == MAX_CALL_DEPTH)
+						goto invalid;
+					frames[depth].ret_pc = pc;
+					memcpy(frames[depth].saved, &reg[6], sizeof(frames[depth].saved));
+					depth++;
+					reg[10] = (uintptr_t)stack[depth] + STACK_SIZE;
+					pc += insn->imm;
+					break;
+				}
+				if (call_helper(d, insn->imm, reg))
+					return -1;
+				break;
+			case BPF_EXIT:
+				if (!depth)
+					goto out;
+				depth--;
+				pc = frames[depth].ret_pc;
+				memcpy(&reg[6], frames[depth].saved, sizeof(frames[depth].saved));
+				reg[10] = (uintptr_t)stack[depth] + STACK_SIZE;
+				break;
+			default:
+				if (BPF_OP(insn->code) > BPF_JSLE)
+					goto invalid;
+				if (BPF_CLASS(insn->code) == BPF_JMP32 ?
+				    jmp_cond(BPF_OP(insn->code), (uint32_t)dst, (uint32_t)src,
+					     (int32_t)dst, (int32_t)src) :
+				    jmp_cond(BPF_OP(insn->code), dst, src, dst, src))
+					pc += insn->off;
+				break;
+			}
+			break;
+		case BPF_LD:
+			if (insn->code != (BPF_LD | BPF_IMM | BPF_DW) || pc >= d->num_insns)
+				goto invalid;
+			if (insn->src_reg == BPF_PSEUDO_MAP_FD) {
+				if ((uint32_t)insn->imm >= d->nr_maps)
+					goto invalid;
+				reg[insn->dst_reg] = (uintptr_t)&d->maps[insn->imm];
+			} else {
+				reg[insn->dst_reg] = (uint32_t)insn->imm |
+					(uint64_t)(uint32_t)insn[1].imm << 32;
+			}
+			pc++;
+			break;
+		case BPF_LDX:
+			if (BPF_MODE(insn->code) != BPF_MEM)
+				goto invalid;
+			addr = (uint8_t *)(uintptr_t)(reg[insn->src_reg] + insn->off);
+			switch (BPF_SIZE(insn->code)) {
+			case BPF_B:  r = *(uint8_t *)addr; break;
+			case BPF_H:  r = *(uint16_t *)addr; break;
+			case BPF_W:  r = *(uint32_t *)addr; break;
+			default:     r = *(uint64_t *)addr; break;
+			}
+			reg[insn->dst_reg] = r;
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			addr = (uint8_t *)(uintptr_t)(dst + insn->off);
+			if (BPF_MODE(insn->code) == BPF_ATOMIC &&
+			    BPF_CLASS(insn->code) == BPF_STX && insn->imm == BPF_ADD) {
+				if (BPF_SIZE(insn->code) == BPF_W)
+					*(uint32_t *)addr += src;
+				else if (BPF_SIZE(insn->code) == BPF_DW)
+					*(uint64_t *)addr += src;
+				else
+					goto invalid;
+				break;
+			}
+			if (BPF_MODE(insn->code) != BPF_MEM)
+				goto invalid;
+			switch (BPF_SIZE(insn->code)) {
+			case BPF_B:  *(uint8_t *)addr = src; break;
+			case BPF_H:  *(uint16_t *)addr = src; break;
+			case BPF_W:  *(uint32_t *)addr = src; break;
+			default:     *(uint64_t *)addr = src; break;
+			}
+			break;
+		}
+	}
+
+	fprintf(stderr, "%s: jump out of the program at %u\n", d->name, cur);
+	return -1;
+
+invalid:
+	fprintf(stderr, "%s: unsupported instruction 0x%02x at %u\n",
+		d->name, d->insns[cur].code, cur);
+	return -1;
+
+out:
+	insns_run += count;
+	if (count > max_insns)
+		max_insns = count;
+	return 0;
+}
+
+/*
+ * Sample streams
+ */
+
+static void add_sample(struct samples *s, uint32_t sample)
+{
+	if (s->len == s->size) {
+		s->size = s->size ? s->size * 2 : 4096;
+		s->buf = realloc(s->buf, s->size * sizeof(*s->buf));
+		if (!s->buf) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->buf[s->len++] = sample;
+}
+
+static unsigned int jittered(unsigned int duration, int jitter)
+{
+	int d = duration;
+
+	if (jitter)
+		d += rand() % (2 * jitter + 1) - jitter;
+
+	return d < 1 ? 1 : d;
+}
+
+static void add_frame(struct samples *s, const int *buf, unsigned int len,
+		      int jitter, unsigned int timeout)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		unsigned int d = jittered(buf[i], jitter);
+
+		add_sample(s, i % 2 ? LIRC_SPACE(d) : LIRC_PULSE(d));
+	}
+	add_sample(s, LIRC_TIMEOUT(timeout));
+}
+
+/*
+ * Read a capture written by ir-ctl -r, with or without --mode2, or
+ * the raw samples written with --binary.
+ */
+static int read_capture(const char *fname, struct samples *s)
+{
+	char *line = NULL, *p, *end;
+	size_t n = 0;
+	uint32_t sample;
+	FILE *f;
+	int c;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		perror(fname);
+		return -1;
+	}
+
+	c = fgetc(f);
+	if (c != EOF && c != '+' && c != '-' && c != '#' && c != '\n' &&
+	    !(c >= 'a' && c <= 'z')) {
+		rewind(f);
+		while (fread(&sample, sizeof(sample), 1, f) == 1)
+			add_sample(s, sample);
+		fclose(f);
+		return 0;
+	}
+	rewind(f);
+
+	while (getline(&line, &n, f) > 0) {
+		char *hash = strchr(line, '#');
+
+		if (hash)
+			*hash = '\0';
+
+		if (!strncmp(line, "pulse ", 6) || !strncmp(line, "space ", 6) ||
+		    !strncmp(line, "timeout ", 8)) {
+			unsigned long v = strtoul(strchr(line, ' ') + 1, NULL, 10);
+
+			if (line[0] == 'p')
+				add_sample(s, LIRC_PULSE(v));
+			else if (line[0] == 's')
+				add_sample(s, LIRC_SPACE(v));
+			else
+				add_sample(s, LIRC_TIMEOUT(v));
+			continue;
+		}
+
+		for (p = line; *p; p = end) {
+			unsigned long v;
+			char sign;
+
+			while (*p == ' ' || *p == '\t' || *p == '\n')
+				p++;
+			if (*p != '+' && *p != '-')
+				break;
+			sign = *p;
+			v = strtoul(p + 1, &end, 10);
+			if (end == p + 1)
+				break;
+			while (*end == ' ' || *end == '\t')
+				end++;
+
+			// ir-ctl writes the timeout as the last space of the line
+			if (sign == '+')
+				add_sample(s, LIRC_PULSE(v));
+			else if (*end == '\n' || !*end)
+				add_sample(s, LIRC_TIMEOUT(v));
+			else
+				add_sample(s, LIRC_SPACE(v));
+		}
+	}
+
+	free(line);
+	fclose(f);
+	return 0;
+}
+
+static void show_event(const char *prefix, const struct event *ev)
+{
+	if (ev->repeat)
+		printf("%srepeat\n", prefix);
+	else if (ev->pointer)
+		printf("%spointer rel_x %d rel_y %d\n", prefix, ev->rel_x, ev->rel_y);
+	else
+		printf("%sscancode 0x%llx protocol %u toggle %u\n", prefix,
+		       (unsigned long long)ev->scancode, ev->protocol, ev->toggle);
+}
+
+static int run_samples(struct decoder *d, const struct samples *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->len; i++) {
+		uint32_t sample = s->buf[i];
+
+		if (run_decoder(d, &sample))
+			return -1;
+	}
+
+	return 0;
+}
+
+static bool known_scancode(struct keymap *map, uint64_t scancode)
+{
+	struct scancode_entry *se;
+	struct raw_entry *re;
+
+	for (se = map->scancode; se; se = se->next)
+		if (se->scancode == scancode)
+			return true;
+	for (re = map->raw; re; re = re->next)
+		if (re->scancode == scancode)
+			return true;
+
+	return false;
+}
+
+/*
+ * Decode one frame from a clean state, and check that it gives one
+ * keydown with the expected scancode.
+ */
+static int check_frame(struct decoder *d, struct keymap *map, uint64_t scancode,
+		       const int *buf, unsigned int len, int jitter,
+		       unsigned int timeout, struct samples *all)
+{
+	struct samples s = {};
+	unsigned int i;
+	bool ok;
+
+	add_frame(&s, buf, len, jitter, timeout);
+	for (i = 0; i < s.len; i++)
+		add_sample(all, s.buf[i]);
+
+	reset_decoder(d);
+	num_events = 0;
+	if (run_samples(d, &s)) {
+		free(s.buf);
+		return -1;
+	}
+	free(s.buf);
+
+	ok = num_events == 1 && !events[0].repeat && !events[0].pointer &&
+	     events[0].scancode == scancode;
+	if (!ok) {
+		printf("%s: scancode 0x%llx (%s) not decoded:", d->name,
+		       (unsigned long long)scancode, map->name);
+		if (!num_events)
+			printf(" no event\n");
+		else
+			printf("\n");
+		for (i = 0; i < num_events; i++)
+			show_event("\tgot ", &events[i]);
+	} else if (verbose) {
+		show_event("\t", &events[0]);
+	}
+
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	struct protocol_param *extra = NULL, *param = NULL;
+	struct samples all = {};
+	struct keymap *keymap = NULL, *map = NULL;
+	struct decoder d = {};
+	unsigned int timeout = DEFAULT_TIMEOUT, passes = 1000, i;
+	unsigned int checked = 0, passed = 0;
+	struct timespec start, stop;
+	const char *keymap_file = NULL;
+	unsigned long pass_insns;
+	int jitter = 0, c, ret = 0;
+	double ns;
+
+	while ((c = getopt(argc, argv, "k:p:j:t:n:vh")) != -1) {
+		switch (c) {
+		case 'k':
+			keymap_file = optarg;
+			break;
+		case 'p': {
+			struct protocol_param *p = calloc(1, sizeof(*p));
+			char *eq = strchr(optarg, '=');
+
+			if (!p || !eq) {
+				usage(argv[0]);
+				return 1;
+			}
+			*eq = '\0';
+			p->name = optarg;
+			p->value = strtol(eq + 1, NULL, 0);
+			p->next = extra;
+			extra = p;
+			break;
+		}
+		case 'j':
+			jitter = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			passes = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage(argv[0]);
+			return c != 'h';
+		}
+	}
+
+	if (optind >= argc || jitter < 0 || !passes || timeout > LIRC_VALUE_MASK) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (keymap_file) {
+		if (parse_keymap((char *)keymap_file, &keymap, verbose > 1))
+			return 1;
+	}
+
+	// Peek at the program name, to find its protocol in the keymap
+	if (load_decoder(argv[optind], &d, NULL, NULL) && !keymap)
+		return 1;
+	for (map = keymap; map; map = map->next)
+		if (map->protocol && !strcmp(map->protocol, d.name))
+			break;
+	if (!map)
+		map = keymap;
+	if (map && map->protocol && strcmp(map->protocol, d.name))
+		fprintf(stderr, "warning: keymap %s is for %s, not %s\n",
+			map->name, map->protocol, d.name);
+
+	// -p parameters go first, so they override the keymap ones
+	if (extra) {
+		struct protocol_param *p = extra;
+
+		while (p->next)
+			p = p->next;
+		p->next = map ? map->param : NULL;
+		param = extra;
+	} else if (map) {
+		param = map->param;
+	}
+
+	free_decoder(&d);
+	if (load_decoder(argv[optind], &d, param, map ? map->raw : NULL))
+		return 1;
+	for (i = 0; i < d.nr_maps; i++) {
+		if (d.maps[i].raw && !d.maps[i].max_entries) {
+			fprintf(stderr, "%s: needs a keymap with raw entries\n", d.name);
+			return 1;
+		}
+	}
+
+	printf("%s: %u instructions, %u maps\n", d.name, d.num_insns, d.nr_maps);
+
+	// A fixed seed, so that the runs can be compared
+	srand(1);
+
+	if (map) {
+		struct scancode_entry *se;
+		struct raw_entry *re;
+		int buf[MAX_FRAME], len;
+		bool can_encode = map->protocol &&
+			encode_bpf_protocol(map, 0, buf, &len);
+
+		if (!can_encode && map->scancode)
+			printf("%s: no encoder for %s, scancodes not checked\n",
+			       d.name, map->protocol ? map->protocol : "(none)");
+
+		for (se = map->scancode; can_encode && se; se = se->next) {
+			encode_bpf_protocol(map, se->scancode, buf, &len);
+			ret = check_frame(&d, map, se->scancode, buf, len, jitter,
+					  timeout, &all);
+			if (ret < 0)
+				return 1;
+			checked++;
+			passed += ret;
+		}
+
+		for (re = map->raw; re; re = re->next) {
+			len = re->raw_length < MAX_FRAME ? re->raw_length : MAX_FRAME;
+			for (i = 0; i < (unsigned int)len; i++)
+				buf[i] = re->raw[i];
+			ret = check_frame(&d, map, re->scancode, buf, len, jitter,
+					  timeout, &all);
+			if (ret < 0)
+				return 1;
+			checked++;
+			passed += ret;
+		}
+		ret = 0;
+
+		if (checked)
+			printf("%s: %u of %u frames decoded correctly%s\n", d.name,
+			       passed, checked, jitter ? " with jitter" : "");
+		if (passed != checked)
+			ret = 1;
+	}
+
+	for (i = optind + 1; i < (unsigned int)argc; i++) {
+		struct samples s = {};
+		unsigned int j, unknown = 0;
+		unsigned long first_event = total_events;
+
+		if (read_capture(argv[i], &s))
+			return 1;
+
+		reset_decoder(&d);
+		num_events = 0;
+		for (j = 0; j < s.len; j++) {
+			uint32_t sample = s.buf[j];
+
+			add_sample(&all, sample);
+			if (run_decoder(&d, &sample))
+				return 1;
+			if (num_events) {
+				if (verbose)
+					show_event("\t", &events[0]);
+				if (map && !events[0].repeat && !events[0].pointer &&
+				    !known_scancode(map, events[0].scancode))
+					unknown++;
+				num_events = 0;
+			}
+		}
+		printf("%s: %s: %u samples, %lu events", d.name, argv[i], s.len,
+		       total_events - first_event);
+		if (map)
+			printf(", %u not in the keymap", unknown);
+		printf("\n");
+		free(s.buf);
+	}
+
+	if (!all.len) {
+		printf("%s: no samples to measure, give a keymap or a capture\n", d.name);
+		return ret;
+	}
+
+	reset_decoder(&d);
+	insns_run = 0;
+	max_insns = 0;
+	run_samples(&d, &all);
+	pass_insns = insns_run;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < passes; i++) {
+		num_events = 0;
+		if (run_samples(&d, &all))
+			return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	ns = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+	printf("%s: %u samples x %u: %.1f ns/sample, %.2f Msamples/s, "
+	       "%.1f insns/sample (max %u)\n",
+	       d.name, all.len, passes, ns / ((double)all.len * passes),
+	       (double)all.len * passes * 1e3 / ns,
+	       (double)pass_insns / all.len, max_insns);
+
+	free(all.buf);
+	free_decoder(&d);
+	free_keymap(keymap);
+	return ret;
+}
@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * mplane-bench: measure the per frame overhead of the libv4l-mplane plugin
+ *
+ * Times the QBUF / DQBUF ioctls of a single planar app going through the
+ * plugin, which turns them into multi planar ioctls, against doing the
+ * multi planar ioctls directly. By default the ioctls are done on /dev/null,
+ * where they fail right away, so that the difference between the two is not
+ * buried in the cost of the driver. Use -d to time them on a real device.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include <libv4l-plugin.h>
+
+#ifndef MPLANE_PLUGIN
+#define MPLANE_PLUGIN "libv4l-mplane.so"
+#endif
+
+#define BENCH_RUNS 5
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double bench_plugin(const struct libv4l_dev_ops *ops, int fd,
+			   unsigned long cmd, unsigned int iterations)
+{
+	struct v4l2_buffer buf;
+	uint64_t start;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i & 3;
+		ops->ioctl(NULL, fd, cmd, &buf);
+	}
+
+	return (double)(now_ns() - start) / iterations;
+}
+
+static double bench_direct(int fd, unsigned long cmd, unsigned int iterations)
+{
+	struct v4l2_plane plane;
+	struct v4l2_buffer buf;
+	uint64_t start;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memset(&buf, 0, sizeof(buf));
+		memset(&plane, 0, sizeof(plane));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i & 3;
+		buf.m.planes = &plane;
+		buf.length = 1;
+		ioctl(fd, cmd, &buf);
+	}
+
+	return (double)(now_ns() - start) / iterations;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-p plugin] [-n iterations]\n"
+		"  -d device      do the ioctls on this device (default /dev/null)\n"
+		"  -p plugin      the plugin to load (default %s)\n"
+		"  -n iterations  ioctls per measurement (default 1000000)\n",
+		prog, MPLANE_PLUGIN);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = "/dev/null", *plugin_path = MPLANE_PLUGIN;
+	static const struct {
+		const char *name;
+		unsigned long cmd;
+	} cmds[] = {
+		{ "QBUF", VIDIOC_QBUF },
+		{ "DQBUF", VIDIOC_DQBUF },
+	};
+	const struct libv4l_dev_ops *ops;
+	unsigned int iterations = 1000000;
+	void *plugin;
+	unsigned int i;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "d:p:n:h")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'p':
+			plugin_path = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+	if (!iterations)
+		iterations = 1;
+
+	plugin = dlopen(plugin_path, RTLD_NOW);
+	if (!plugin) {
+		fprintf(stderr, "cannot load %s: %s\n", plugin_path, dlerror());
+		return 1;
+	}
+	ops = dlsym(plugin, "libv4l2_plugin");
+	if (!ops) {
+		fprintf(stderr, "%s is not a libv4l2 plugin\n", plugin_path);
+		return 1;
+	}
+
+	fd = open(device, O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", device, strerror(errno));
+		return 1;
+	}
+
+	printf("%-6s %12s %12s %12s\n", "ioctl", "direct ns", "plugin ns",
+	       "overhead ns");
+	for (i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+		double direct, via_plugin;
+
+		unsigned int run;
+
+		/* Warm up, then keep the best of a few runs, the difference
+		   is small compared to the noise of the syscall itself */
+		bench_direct(fd, cmds[i].cmd, iterations / 10 + 1);
+		direct = via_plugin = 1e9;
+		for (run = 0; run < BENCH_RUNS; run++) {
+			double t;
+
+			t = bench_direct(fd, cmds[i].cmd, iterations);
+			if (t < direct)
+				direct = t;
+			t = bench_plugin(ops, fd, cmds[i].cmd, iterations);
+			if (t < via_plugin)
+				via_plugin = t;
+		}
+		printf("%-6s %12.1f %12.1f %12.1f\n", cmds[i].name, direct,
+		       via_plugin, via_plugin - direct);
+	}
+
+	close(fd);
+	dlclose(plugin);
+
+	return 0;
+}
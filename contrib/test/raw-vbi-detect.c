@@ -0,0 +1,163 @@
+/*
+    Raw vbi slicing demonstration utility
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ */
+
+/* This utility slices the raw VBI of one or more devices in software and
+   shows which VBI types are transmitted on each field/line, like
+   sliced-vbi-detect does for devices that slice VBI themselves. All
+   devices are captured at the same time.
+
+   Usage: raw-vbi-detect [device...]
+   Without a device name as argument it will fallback to /dev/vbi0.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+#include <linux/videodev2.h>
+
+#include "vbi-slicer.h"
+
+#define MAX_DEVICES	16
+#define FRAMES		25
+
+struct device {
+	const char *name;
+	int fh;
+	struct vbi_slicer slicer;
+	unsigned char *raw;
+	unsigned size;
+	unsigned frames;
+	unsigned service_lines[2][24];
+};
+
+static void v2s(int id)
+{
+	switch (id) {
+		case V4L2_SLICED_TELETEXT_B: printf(" TELETEXT"); break;
+		case V4L2_SLICED_CAPTION_525: printf(" CC"); break;
+		case V4L2_SLICED_WSS_625: printf(" WSS"); break;
+		case V4L2_SLICED_VPS: printf(" VPS"); break;
+		default: printf(" UNKNOWN %x", id); break;
+	}
+}
+
+static int open_device(struct device *dev)
+{
+	struct v4l2_format fmt;
+
+	dev->fh = open(dev->name, O_RDONLY | O_NONBLOCK);
+	if (dev->fh == -1) {
+		fprintf(stderr, "cannot open %s\n", dev->name);
+		return -1;
+	}
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VBI_CAPTURE;
+	if (ioctl(dev->fh, VIDIOC_G_FMT, &fmt) < 0) {
+		perror("VIDIOC_G_FMT");
+		return -1;
+	}
+	if (vbi_slicer_init(&dev->slicer, &fmt.fmt.vbi, VBI_SLICER_SERVICES)) {
+		fprintf(stderr, "%s: unsupported raw VBI format\n", dev->name);
+		return -1;
+	}
+	dev->size = (fmt.fmt.vbi.count[0] + fmt.fmt.vbi.count[1]) *
+		    fmt.fmt.vbi.samples_per_line;
+	dev->raw = malloc(dev->size);
+	return dev->raw ? 0 : -1;
+}
+
+static void slice(struct device *dev)
+{
+	struct v4l2_sliced_vbi_data sliced[128];
+	int size = read(dev->fh, dev->raw, dev->size);
+	unsigned i, n;
+
+	if (size < 0 && errno == EAGAIN)
+		return;
+	if (size < (int)dev->size) {
+		printf("%s: size = %d\n", dev->name, size);
+		dev->frames = FRAMES;
+		return;
+	}
+	/* The first frame may be from before the format was set */
+	if (dev->frames++ == 0)
+		return;
+	n = vbi_slicer_decode(&dev->slicer, dev->raw, sliced, 128);
+	for (i = 0; i < n; i++) {
+		if (sliced[i].line >= 24) {
+			printf("line %d out of range\n", sliced[i].line);
+			continue;
+		}
+		dev->service_lines[sliced[i].field][sliced[i].line] |= sliced[i].id;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct device devs[MAX_DEVICES];
+	struct pollfd pfds[MAX_DEVICES];
+	unsigned num = 0, busy;
+	unsigned d;
+	int f, i, b;
+
+	if (argc == 1)
+		devs[num++].name = "/dev/vbi0";
+	for (i = 1; i < argc && num < MAX_DEVICES; i++)
+		devs[num++].name = argv[i];
+	for (d = 0; d < num; d++)
+		if (open_device(&devs[d]))
+			return 1;
+
+	do {
+		busy = 0;
+		for (d = 0; d < num; d++) {
+			if (devs[d].frames >= FRAMES)
+				continue;
+			pfds[busy].fd = devs[d].fh;
+			pfds[busy].events = POLLIN;
+			busy++;
+		}
+		if (!busy || poll(pfds, busy, 1000) <= 0)
+			break;
+		for (d = 0; d < num; d++)
+			if (devs[d].frames < FRAMES)
+				slice(&devs[d]);
+	} while (1);
+
+	for (d = 0; d < num; d++) {
+		close(devs[d].fh);
+		free(devs[d].raw);
+		printf("%s:\n", devs[d].name);
+		for (f = 0; f < 2; f++) {
+			printf("Field %d:\n", f);
+			for (i = 6; i < 24; i++) {
+				unsigned set = devs[d].service_lines[f][i];
+
+				printf("  Line %2d:", i);
+				for (b = 0; b < 16; b++) {
+					if (set & (1 << b))
+						v2s(1 << b);
+				}
+				printf("\n");
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1 @@
+../../utils/common/v4l2-tpg-core.c
\ No newline at end of file
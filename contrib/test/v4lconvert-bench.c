@@ -0,0 +1,556 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * v4lconvert-bench: measure the speed of libv4lconvert
+ *
+ * Converts synthetic frames in every source format libv4lconvert supports
+ * to each of its destination formats at several resolutions, and reports
+ * the throughput in MPix/s and, when the CPU cycle counter is available,
+ * in cycles per pixel.
+ *
+ * The frames are generated with the test pattern generator (the same one
+ * used by v4l2-ctl and vivid) when it knows the format, with libjpeg for
+ * the JPEG formats and filled with pseudo random data for the other
+ * uncompressed formats. The sn9c10x, sn9c2028, mr97310a and pac207
+ * decoders accept any bit sequence, so they are fed pseudo random
+ * bitstreams (with valid pac207 row headers). The other vendor specific
+ * compressed formats are skipped, as random data does not decode.
+ *
+ * The LIBV4LCONVERT_NO_SIMD and LIBV4LCONVERT_THREADS environment variables
+ * are honoured as usual, which allows comparing the different code paths.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#include <libv4lconvert.h>
+#include <libv4l-plugin.h>
+
+#include "v4l2-tpg.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+enum bench_src {
+	SRC_RAW,	/* TPG if it knows the format, else random data */
+	SRC_JPEG,	/* TPG RGB24 encoded with libjpeg */
+	SRC_BITS,	/* compressed, every bitstream decodes */
+	SRC_NONE,	/* compressed, no way to generate a valid frame */
+};
+
+struct bench_fmt {
+	uint32_t fourcc;
+	/* bytesperline = width * bpl_num / bpl_den */
+	unsigned char bpl_num, bpl_den;
+	/* sizeimage = bytesperline * height * size_num / size_den */
+	unsigned char size_num, size_den;
+	enum bench_src src;
+};
+
+/* This mirrors supported_src_pixfmts[] in libv4lconvert.c */
+static const struct bench_fmt src_fmts[] = {
+	{ V4L2_PIX_FMT_RGB24,		3, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_BGR24,		3, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_YUV420,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_YVU420,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_RGB565,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_BGR32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_RGB32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_XBGR32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_XRGB32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_ABGR32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_ARGB32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_YUYV,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_YVYU,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_UYVY,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_NV16,		1, 1, 2, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_NV61,		1, 1, 2, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SPCA501,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_SPCA505,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_SPCA508,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_KONICA420,	1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_M420,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_NV12_16L16,	1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_NV12,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_NV21,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_CPIA1,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_MJPEG,		1, 1, 1, 1, SRC_JPEG },
+	{ V4L2_PIX_FMT_JPEG,		1, 1, 1, 1, SRC_JPEG },
+	{ V4L2_PIX_FMT_PJPG,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_JPGL,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_OV511,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_OV518,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_SBGGR8,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGBRG8,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGRBG8,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SRGGB8,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_STV0680,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SBGGR10P,	5, 4, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGBRG10P,	5, 4, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGRBG10P,	5, 4, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SRGGB10P,	5, 4, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SBGGR10,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGBRG10,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGRBG10,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SRGGB10,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SBGGR12,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGBRG12,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGRBG12,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SRGGB12,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SBGGR16,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGBRG16,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SGRBG16,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SRGGB16,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_SPCA561,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_SN9C10X,		1, 1, 1, 1, SRC_BITS },
+	{ V4L2_PIX_FMT_SN9C2028,	1, 1, 1, 1, SRC_BITS },
+	{ V4L2_PIX_FMT_PAC207,		1, 1, 1, 1, SRC_BITS },
+	{ V4L2_PIX_FMT_MR97310A,	1, 1, 1, 1, SRC_BITS },
+	{ V4L2_PIX_FMT_JL2005BCD,	1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_SQ905C,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_SE401,		1, 1, 1, 1, SRC_NONE },
+	{ V4L2_PIX_FMT_GREY,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_Y4,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_Y6,		1, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_Y10BPACK,	5, 4, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_Y10P,		5, 4, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_Y16,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_Y16_BE,		2, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_HSV32,		4, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_HSV24,		3, 1, 1, 1, SRC_RAW },
+};
+
+static const struct bench_fmt dst_fmts[] = {
+	{ V4L2_PIX_FMT_RGB24,		3, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_BGR24,		3, 1, 1, 1, SRC_RAW },
+	{ V4L2_PIX_FMT_YUV420,		1, 1, 3, 2, SRC_RAW },
+	{ V4L2_PIX_FMT_YVU420,		1, 1, 3, 2, SRC_RAW },
+};
+
+struct bench_size {
+	unsigned width, height;
+};
+
+static const struct bench_size default_sizes[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+};
+
+#define MAX_SIZES 16
+
+static struct bench_size sizes[MAX_SIZES];
+static unsigned num_sizes;
+static uint32_t only_src, only_dst;
+static double min_time = 0.2;
+static int cycles_fd = -1;
+
+/* libv4lconvert only needs QUERYCAP to succeed, there is no real device */
+static int bench_ioctl(void *priv, int fd, unsigned long cmd, void *arg)
+{
+	if (cmd == VIDIOC_QUERYCAP) {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "v4lconvert-bench");
+		strcpy((char *)cap->card, "v4lconvert-bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static void *bench_init(int fd)
+{
+	return NULL;
+}
+
+static void bench_close(void *priv)
+{
+}
+
+static ssize_t bench_read(void *priv, int fd, void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static ssize_t bench_write(void *priv, int fd, const void *buf, size_t len)
+{
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops bench_dev_ops = {
+	.init = bench_init,
+	.close = bench_close,
+	.ioctl = bench_ioctl,
+	.read = bench_read,
+	.write = bench_write,
+};
+
+static const char *fcc2s(uint32_t fourcc, char *s)
+{
+	s[0] = fourcc & 0xff;
+	s[1] = (fourcc >> 8) & 0xff;
+	s[2] = (fourcc >> 16) & 0xff;
+	s[3] = (fourcc >> 24) & 0x7f;
+	s[4] = '\0';
+	if (fourcc & (1U << 31))
+		strcat(s, "-BE");
+	return s;
+}
+
+static uint32_t s2fcc(const char *s)
+{
+	char c[4] = { ' ', ' ', ' ', ' ' };
+	unsigned i;
+
+	for (i = 0; i < 4 && s[i]; i++)
+		c[i] = s[i];
+	return v4l2_fourcc(c[0], c[1], c[2], c[3]);
+}
+
+static void fill_fmt(struct v4l2_format *fmt, const struct bench_fmt *f,
+		     unsigned width, unsigned height)
+{
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt->fmt.pix.width = width;
+	fmt->fmt.pix.height = height;
+	fmt->fmt.pix.pixelformat = f->fourcc;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = width * f->bpl_num / f->bpl_den;
+	fmt->fmt.pix.sizeimage = fmt->fmt.pix.bytesperline * height *
+				 f->size_num / f->size_den;
+}
+
+static void fill_random(unsigned char *buf, size_t size)
+{
+	uint32_t seed = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/*
+ * Fill buf with a pseudo random bitstream for one of the SRC_BITS formats.
+ * The pac207 rows get a header selecting the 5 bit step size, and only use
+ * the 2 bit codes, so the length of each row is known without decoding it.
+ */
+static void fill_bits(unsigned char *buf, size_t size, uint32_t fourcc,
+		      unsigned width, unsigned height)
+{
+	unsigned row_size = 2 * ((32 + 2 * (width - 2) + 15) / 16);
+	unsigned row, i;
+
+	fill_random(buf, size);
+	if (fourcc != V4L2_PIX_FMT_PAC207)
+		return;
+
+	for (row = 0; row < height && (row + 1) * row_size <= size; row++) {
+		unsigned char *p = buf + row * row_size;
+
+		p[0] = 0x1e;
+		p[1] = 0xe1;
+		/* Turn the 11 prefixes of the longer codes into 10 */
+		for (i = 4; i < row_size; i++)
+			p[i] &= ~((p[i] >> 1) & 0x55);
+	}
+}
+
+/* Fill buf with a test pattern, returns 0 if the TPG does not know the format */
+static int fill_tpg(unsigned char *buf, uint32_t fourcc,
+		    unsigned width, unsigned height)
+{
+	struct tpg_data tpg;
+	int ret = 0;
+
+	tpg_init(&tpg, width, height);
+	if (tpg_alloc(&tpg, width))
+		return 0;
+	if (tpg_s_fourcc(&tpg, fourcc) && tpg_g_buffers(&tpg) == 1) {
+		tpg_reset_source(&tpg, width, height, V4L2_FIELD_NONE);
+		tpg_s_pattern(&tpg, TPG_PAT_75_COLORBAR);
+		tpg_s_bytesperline(&tpg, 0,
+				   width * tpg_g_twopixelsize(&tpg, 0) / 2);
+		/* With a single buffer this fills all planes */
+		tpg_fillbuffer(&tpg, 0, 0, buf);
+		ret = 1;
+	}
+	tpg_free(&tpg);
+
+	return ret;
+}
+
+#ifdef HAVE_JPEG
+/* Returns the size of the JPEG image or 0 on error */
+static size_t fill_jpeg(unsigned char *buf, size_t size,
+			unsigned width, unsigned height)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *rgb, *out = NULL;
+	unsigned long out_size = 0;
+	JSAMPROW row;
+
+	rgb = malloc(width * height * 3);
+	if (!rgb || !fill_tpg(rgb, V4L2_PIX_FMT_RGB24, width, height)) {
+		free(rgb);
+		return 0;
+	}
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &out, &out_size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 85, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < height) {
+		row = rgb + cinfo.next_scanline * width * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(rgb);
+
+	if (out_size > size)
+		out_size = 0;
+	else
+		memcpy(buf, out, out_size);
+	free(out);
+
+	return out_size;
+}
+#endif
+
+static void open_cycles_counter(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_cycles(void)
+{
+	uint64_t cycles;
+
+	if (cycles_fd < 0 || read(cycles_fd, &cycles, sizeof(cycles)) !=
+			sizeof(cycles))
+		return 0;
+	return cycles;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_one(const struct bench_fmt *src, const struct bench_fmt *dst,
+		      const struct bench_size *size)
+{
+	struct v4lconvert_data *data = NULL;
+	struct v4l2_format src_fmt, dst_fmt;
+	unsigned char *src_buf, *dst_buf;
+	size_t src_size;
+	unsigned frames = 0;
+	uint64_t cycles;
+	double start, elapsed, pixels;
+	char src_s[8], dst_s[8];
+
+	printf("%-7s -> %-4s %5ux%-5u ", fcc2s(src->fourcc, src_s),
+	       fcc2s(dst->fourcc, dst_s), size->width, size->height);
+
+	fill_fmt(&src_fmt, src, size->width, size->height);
+	fill_fmt(&dst_fmt, dst, size->width, size->height);
+	src_size = src_fmt.fmt.pix.sizeimage;
+
+	src_buf = malloc(src_size);
+	dst_buf = malloc(dst_fmt.fmt.pix.sizeimage);
+	if (!src_buf || !dst_buf) {
+		printf("out of memory\n");
+		goto out;
+	}
+
+	switch (src->src) {
+	case SRC_RAW:
+		if (!fill_tpg(src_buf, src->fourcc, size->width, size->height))
+			fill_random(src_buf, src_size);
+		break;
+	case SRC_BITS:
+		fill_bits(src_buf, src_size, src->fourcc, size->width,
+			  size->height);
+		break;
+	case SRC_JPEG:
+#ifdef HAVE_JPEG
+		src_size = fill_jpeg(src_buf, src_size, size->width,
+				     size->height);
+		if (src_size)
+			break;
+#endif
+		/* fall through */
+	case SRC_NONE:
+		printf("skipped, no test frame\n");
+		goto out;
+	}
+
+	/* Use a new converter for each run, so that no state (f.e. of the
+	   JPEG decoder after an error) carries over from the previous one */
+	data = v4lconvert_create_with_dev_ops(-1, NULL, &bench_dev_ops);
+	if (!data) {
+		printf("v4lconvert_create_with_dev_ops failed\n");
+		goto out;
+	}
+
+	/* The first conversion allocates the intermediate buffers */
+	if (v4lconvert_convert(data, &src_fmt, &dst_fmt, src_buf, src_size,
+			       dst_buf, dst_fmt.fmt.pix.sizeimage) < 0) {
+		printf("error: %s\n", v4lconvert_get_error_message(data));
+		goto out;
+	}
+
+	cycles = read_cycles();
+	start = now();
+	do {
+		v4lconvert_convert(data, &src_fmt, &dst_fmt, src_buf, src_size,
+				   dst_buf, dst_fmt.fmt.pix.sizeimage);
+		frames++;
+		elapsed = now() - start;
+	} while (elapsed < min_time || frames < 3);
+	cycles = read_cycles() - cycles;
+
+	pixels = (double)size->width * size->height * frames;
+	printf("%9.1f MPix/s", pixels / elapsed / 1e6);
+	if (cycles_fd >= 0)
+		printf(" %8.2f cycles/pixel", cycles / pixels);
+	printf("\n");
+
+out:
+	v4lconvert_destroy(data);
+	free(src_buf);
+	free(dst_buf);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s, --size=<w>x<h>      benchmark this resolution, may be given\n"
+		"                          several times (default 640x480, 1280x720\n"
+		"                          and 1920x1080)\n"
+		"  -f, --src=<fourcc>      only benchmark this source format\n"
+		"  -d, --dst=<fourcc>      only benchmark this destination format\n"
+		"  -t, --time=<seconds>    minimum time per conversion (default 0.2)\n"
+		"  -h, --help              show this help\n"
+		"\n"
+		"The cycles/pixel are those of the calling thread only, so with\n"
+		"LIBV4LCONVERT_THREADS the work done by the helper threads is not\n"
+		"included.\n", prog);
+}
+
+static const struct option long_options[] = {
+	{ "size", required_argument, NULL, 's' },
+	{ "src", required_argument, NULL, 'f' },
+	{ "dst", required_argument, NULL, 'd' },
+	{ "time", required_argument, NULL, 't' },
+	{ "help", no_argument, NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned i, j, k;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "s:f:d:t:h", long_options,
+				NULL)) != -1) {
+		switch (c) {
+		case 's':
+			if (num_sizes == MAX_SIZES ||
+			    sscanf(optarg, "%ux%u", &sizes[num_sizes].width,
+				   &sizes[num_sizes].height) != 2 ||
+			    !sizes[num_sizes].width ||
+			    !sizes[num_sizes].height) {
+				usage(argv[0]);
+				return 1;
+			}
+			/* The 4:2:0 and bayer formats need even sizes */
+			sizes[num_sizes].width &= ~1;
+			sizes[num_sizes].height &= ~1;
+			num_sizes++;
+			break;
+		case 'f':
+			only_src = s2fcc(optarg);
+			break;
+		case 'd':
+			only_dst = s2fcc(optarg);
+			break;
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!num_sizes) {
+		memcpy(sizes, default_sizes, sizeof(default_sizes));
+		num_sizes = ARRAY_SIZE(default_sizes);
+	}
+
+	open_cycles_counter();
+	if (cycles_fd < 0)
+		printf("CPU cycle counter not available, only reporting MPix/s\n");
+
+	for (i = 0; i < ARRAY_SIZE(src_fmts); i++) {
+		if (only_src && src_fmts[i].fourcc != only_src)
+			continue;
+		for (j = 0; j < ARRAY_SIZE(dst_fmts); j++) {
+			if (only_dst && dst_fmts[j].fourcc != only_dst)
+				continue;
+			for (k = 0; k < num_sizes; k++)
+				bench_one(&src_fmts[i], &dst_fmts[j],
+					  &sizes[k]);
+		}
+	}
+
+	if (cycles_fd >= 0)
+		close(cycles_fd);
+
+	return 0;
+}
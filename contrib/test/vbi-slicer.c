@@ -0,0 +1 @@
+../../utils/common/vbi-slicer.c
\ No newline at end of file
@@ -65,6 +65,9 @@
  * @param next		pointer to struct atsc_table_eit_event
  * @param start		event start (in struct tm format)
  * @param source_id	source id (obtained from ATSC header)
+ * @param title		title, converted to the output charset, or NULL.
+ *			Only the first string of the title_text, without
+ *			the compressed segments, is converted.
  *
  * This structure is used to store the original ATSC EIT event table,
  * converting the integer fields to the CPU endianness, and converting the
@@ -101,6 +104,7 @@ struct atsc_table_eit_event {
 	struct atsc_table_eit_event *next;
 	struct tm start;
 	uint16_t source_id;
+	char *title;
 } __attribute__((packed));
 
 /**
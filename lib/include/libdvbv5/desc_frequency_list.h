@@ -87,8 +87,6 @@ extern "C" {
  * This function initializes and makes sure that all fields will follow the CPU
  * endianness. Due to that, the content of the buffer may change.
  *
- * Currently, no memory is allocated internally.
- *
  * @return On success, it returns the size of the allocated struct.
  *	   A negative value indicates an error.
  */
@@ -105,6 +103,14 @@ int dvb_desc_frequency_list_init(struct dvb_v5_fe_parms *parms,
 void dvb_desc_frequency_list_print(struct dvb_v5_fe_parms *parms,
 				   const struct dvb_desc *desc);
 
+/**
+ * @brief Frees all data allocated by the frequency list descriptor
+ * @ingroup descriptors
+ *
+ * @param desc pointer to struct dvb_desc to be freed
+ */
+void dvb_desc_frequency_list_free(struct dvb_desc *desc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -174,6 +174,10 @@ void dvb_hexdump(struct dvb_v5_fe_parms *parms, const char *prefix,
  * On success, head_desc will be allocated and filled with a linked list
  * with the descriptors found inside the buffer.
  *
+ * All descriptors found inside the buffer share a single memory block, so
+ * they can't be freed one by one, nor removed from the list. The list
+ * can only be freed as a whole, with dvb_desc_free().
+ *
  * This function is used by the several MPEG-TS table handlers to parse
  * the entire table that got read by dvb_read_sessions and other similar
  * functions.
@@ -188,6 +192,11 @@ int  dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
  * @ingroup dvb_table
  *
  * @param list	struct dvb_desc pointer.
+ *
+ * The list should be one filled by dvb_desc_parse(), or several of them
+ * linked one after the other, with all the descriptors they got, in the
+ * same order. Freeing, unlinking or re-ordering any of its descriptors
+ * before corrupts the heap.
  */
 void dvb_desc_free (struct dvb_desc **list);
 
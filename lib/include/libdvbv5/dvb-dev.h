@@ -128,6 +128,26 @@ typedef int (*dvb_dev_change_t)(char *sysname,
  */
 struct dvb_open_descriptor;
 
+/**
+ * @struct dvb_dev_buffer
+ * @ingroup dvb_device
+ * @brief Describes a buffer filled by a demux or dvr device, when
+ *	  streaming with dvb_dev_mmap_start()
+ *
+ * @param data		Start of the data, at the memory mapped buffer
+ * @param bytesused	Number of bytes filled at the buffer
+ * @param index		Index of the buffer
+ * @param flags		DMX_BUFFER_* flags, as defined at linux/dvb/dmx.h
+ * @param count		Monotonic counter of the filled buffers
+ */
+struct dvb_dev_buffer {
+	void *data;
+	unsigned int bytesused;
+	unsigned int index;
+	unsigned int flags;
+	unsigned int count;
+};
+
 /**
  * @struct dvb_device
  *	@brief Digital TV list of devices
@@ -190,6 +210,22 @@ void dvb_dev_free(struct dvb_device *dvb);
 int dvb_dev_find(struct dvb_device *dvb, dvb_dev_change_t handler,
 		 void *user_priv);
 
+/**
+ * @brief Find the Digital TV devices of a single adapter
+ * @ingroup dvb_device
+ *
+ * @param dvb		pointer to struct dvb_device to be used
+ * @param adapter	Adapter number, as defined internally at the Kernel.
+ *
+ * Works like dvb_dev_find() in normal mode, but for local devices it only
+ * reads the udev data of the devices of the given adapter. That is faster
+ * on machines with many adapters, when an application only uses one.
+ * For remote and file devices, it is the same as dvb_dev_find().
+ *
+ * @return returns 0 on success, a negative value otherwise.
+ */
+int dvb_dev_find_adapter(struct dvb_device *dvb, unsigned int adapter);
+
 /**
  * @brief Find a device that matches the search criteria given by this
  *	functions's parameters.
@@ -336,6 +372,91 @@ int dvb_dev_get_fd(struct dvb_open_descriptor *open_dev);
 ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count);
 
+/**
+ * @brief moves data from a dvb demux or dvr file to a file descriptor
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param fd		file descriptor where the data will be written,
+ *			like a file or a socket
+ * @param count		maximum number of bytes to move
+ *
+ * Unlike dvb_dev_read() followed by write(), the data is not copied to
+ * userspace.
+ *
+ * @return On success, returns the number of bytes moved. On error,
+ * returns a negative error code. -EOPNOTSUPP means that this is not
+ * supported by the device or by remote access: dvb_dev_read() should be
+ * used instead.
+ */
+ssize_t dvb_dev_splice(struct dvb_open_descriptor *open_dev,
+		       int fd, size_t count);
+
+/**
+ * @brief starts streaming from a dvb demux or dvr file with memory mapped
+ *	  buffers
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param size		size of each buffer, in bytes
+ * @param count		number of buffers
+ *
+ * Allocates the buffers at the Kernel with DMX_REQBUFS, maps them and
+ * queues all of them. From then on, the data should be taken with
+ * dvb_dev_dqbuf() and dvb_dev_qbuf(), as dvb_dev_read() won't return it
+ * anymore. The buffers are unmapped by dvb_dev_mmap_stop() or when the
+ * device is closed.
+ *
+ * @return On success, returns the number of buffers, which may be
+ * different than @a count. On error, returns a negative error code.
+ * -EOPNOTSUPP means that this is not supported by the device or by remote
+ * access: dvb_dev_read() should be used instead.
+ */
+int dvb_dev_mmap_start(struct dvb_open_descriptor *open_dev,
+		       unsigned int size, unsigned int count);
+
+/**
+ * @brief waits for a buffer filled by a dvb demux or dvr device
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param buf		Points to a struct dvb_dev_buffer, filled with the
+ *			dequeued buffer
+ *
+ * The data at @a buf->data stays valid until the buffer is given back to
+ * the Kernel with dvb_dev_qbuf(). This is a wrapper for DMX_DQBUF.
+ *
+ * @return Returns zero on success, or a negative error code.
+ */
+int dvb_dev_dqbuf(struct dvb_open_descriptor *open_dev,
+		  struct dvb_dev_buffer *buf);
+
+/**
+ * @brief gives back a buffer returned by dvb_dev_dqbuf() to the Kernel
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param buf		Points to the struct dvb_dev_buffer to queue.
+ *			Only @a buf->index is used.
+ *
+ * This is a wrapper for DMX_QBUF.
+ *
+ * @return Returns zero on success, or a negative error code.
+ */
+int dvb_dev_qbuf(struct dvb_open_descriptor *open_dev,
+		 struct dvb_dev_buffer *buf);
+
+/**
+ * @brief stops the streaming started by dvb_dev_mmap_start()
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ *
+ * Unmaps and frees the buffers. Reading from the device with
+ * dvb_dev_read() may not work again until it is re-opened.
+ */
+void dvb_dev_mmap_stop(struct dvb_open_descriptor *open_dev);
+
 /**
  * @brief Stops the demux filter for a given file descriptor
  * @ingroup dvb_device
@@ -471,6 +592,26 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 					unsigned other_nit,
 					unsigned timeout_multiply);
 
+/* From dvb-dev-file.c */
+
+/**
+ * @brief initialize the dvb-dev to read a recorded MPEG-TS file, instead
+ *	of using the DVB devices.
+ *
+ * @param dvb		pointer to struct dvb_device to be used
+ * @param fname		name of the MPEG-TS file
+ *
+ * After that, dvb_dev_find() finds a single adapter, whose frontend is
+ * always locked and accepts any delivery system and parameters. Each read
+ * from the dvr device returns the next data from the file. Each demux
+ * device filters the file from its beginning, each time a filter is set,
+ * so dvb_get_ts_tables(), dvb_dev_scan() and dvb_epg_collect() parse the
+ * file as fast as it can be read. When the file ends, reads return 0.
+ *
+ * At success, returns 0. Otherwise, returns a negative error code.
+ */
+int dvb_dev_file_init(struct dvb_device *dvb, const char *fname);
+
 /* From dvb-dev-remote.c */
 
 #ifdef HAVE_DVBV5_REMOTE
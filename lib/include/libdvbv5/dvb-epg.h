@@ -0,0 +1,222 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-epg.h
+ * @ingroup frontend_scan
+ * @brief Collects the Electronic Program Guide of a transport stream.
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * Reads the DVB EIT present/following and schedule tables, or the ATSC
+ * EIT tables announced by the MGT, keeping one section filter per table
+ * group open until all of its tables are complete, and stores the events
+ * by service and start time.
+ *
+ * @par Relevant specs
+ * ETSI EN 300 468, ETSI TS 101 211 and ATSC A/65:2009
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_EPG_H
+#define _DVB_EPG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h> /* ssize_t */
+
+#include <libdvbv5/descriptors.h>
+
+/**
+ * @def DVB_EPG_PRESENT_FOLLOWING
+ *	@brief Collects the DVB present/following tables (table ID 0x4e)
+ * @def DVB_EPG_SCHEDULE
+ *	@brief Collects the DVB schedule tables (table IDs 0x50 to 0x5f)
+ * @ingroup frontend_scan
+ *
+ * Flags for dvb_epg_alloc(). They're ignored for ATSC, where all EIT
+ * tables listed at the MGT are collected.
+ */
+#define DVB_EPG_PRESENT_FOLLOWING	(1 << 0)
+#define DVB_EPG_SCHEDULE		(1 << 1)
+
+/**
+ * @struct dvb_epg_event
+ * @brief An event of the program guide
+ * @ingroup frontend_scan
+ *
+ * @param service_id	DVB service ID, or ATSC source ID
+ * @param event_id	event ID
+ * @param start		start time, in UTC
+ * @param duration	duration, in seconds
+ * @param running_status DVB running status (see dvb_eit_running_status_name).
+ *			Always 0 for ATSC.
+ * @param descriptor	pointer to struct dvb_desc, with the event
+ *			descriptors, like the short and extended event ones
+ * @param title		ATSC event title, converted to the output charset,
+ *			or NULL. Always NULL for DVB, where the title is at
+ *			the short event descriptor.
+ */
+struct dvb_epg_event {
+	uint16_t service_id;
+	uint16_t event_id;
+	time_t start;
+	uint32_t duration;
+	uint8_t running_status;
+	struct dvb_desc *descriptor;
+	char *title;
+};
+
+/**
+ * @struct dvb_epg
+ * @brief Program guide collector and event store
+ * @ingroup frontend_scan
+ *
+ * Opaque struct, allocated with dvb_epg_alloc().
+ */
+struct dvb_epg;
+
+struct dvb_v5_fe_parms;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief allocates a struct dvb_epg
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param flags		DVB_EPG_PRESENT_FOLLOWING and/or DVB_EPG_SCHEDULE
+ *
+ * At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms, unsigned flags);
+
+/**
+ * @brief frees a struct dvb_epg and all its events
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide to be freed
+ */
+void dvb_epg_free(struct dvb_epg *epg);
+
+/**
+ * @brief adds a service whose program guide should be collected
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide
+ * @param service_id	DVB service ID, or ATSC source ID
+ *
+ * Collection is complete when the tables of all added services are
+ * complete. If no service is added, dvb_epg_collect() adds the ones
+ * announced with EIT information at the SDT, or all the ones at the VCT,
+ * for ATSC.
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int dvb_epg_add_service(struct dvb_epg *epg, uint16_t service_id);
+
+/**
+ * @brief reads the program guide from the demux
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide
+ * @param dmx_fd	an opened demux file descriptor
+ * @param timeout	limit, in seconds, for the whole collection
+ *
+ * Each group of tables (DVB present/following, DVB schedule, or each
+ * ATSC EIT PID) uses its own section filter: besides dmx_fd, other file
+ * descriptors of the same demux are opened, and all of them are waited
+ * for with a single poll(). Repeated sections are dropped before being
+ * parsed. A filter is stopped as soon as the tables it carries are
+ * complete for all services.
+ *
+ * If the application wants to abort the collection, it can change the
+ * value of parms->p.abort to 1. This function may be called again, to
+ * update the guide.
+ *
+ * Returns 0 if the guide is complete, 1 if the timeout expired or the
+ * collection was aborted before that, or a negative error code.
+ */
+int dvb_epg_collect(struct dvb_epg *epg, int dmx_fd, unsigned timeout);
+
+/**
+ * @brief feeds an EIT section to the program guide
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide
+ * @param pid		program ID where the section was read
+ * @param buf		buffer with a complete section, including its CRC
+ * @param buf_length	size of the section
+ *
+ * This is meant for applications that read the demux themselves, for
+ * example with the software demux at dvb-ts-demux.h. Returns 0 if the
+ * section was dropped, 1 if it was parsed, or a negative error code.
+ */
+int dvb_epg_section(struct dvb_epg *epg, uint16_t pid,
+		    const uint8_t *buf, ssize_t buf_length);
+
+/**
+ * @brief checks if the program guide of all services was received
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide
+ *
+ * Returns 1 if complete, 0 otherwise.
+ */
+int dvb_epg_is_complete(struct dvb_epg *epg);
+
+/**
+ * @brief gets all the events of a service
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide
+ * @param service_id	DVB service ID, or ATSC source ID
+ * @param num		filled with the number of events
+ *
+ * Returns an array of events, sorted by start time, or NULL if there's
+ * no event for the service. The array belongs to the program guide, and
+ * it is valid until the next call to dvb_epg_collect(),
+ * dvb_epg_section() or dvb_epg_free().
+ */
+const struct dvb_epg_event *dvb_epg_get_events(struct dvb_epg *epg,
+					       uint16_t service_id,
+					       unsigned *num);
+
+/**
+ * @brief finds the event of a service that is on air at a given time
+ * @ingroup frontend_scan
+ *
+ * @param epg		program guide
+ * @param service_id	DVB service ID, or ATSC source ID
+ * @param when		the time, in UTC
+ *
+ * Returns the event, or NULL if none. The event has the same lifetime as
+ * the ones returned by dvb_epg_get_events().
+ */
+const struct dvb_epg_event *dvb_epg_find_event(struct dvb_epg *epg,
+					       uint16_t service_id,
+					       time_t when);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
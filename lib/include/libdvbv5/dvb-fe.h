@@ -469,6 +469,51 @@ int dvb_fe_retrieve_stats(struct dvb_v5_fe_parms *parms,
  */
 int dvb_fe_get_stats(struct dvb_v5_fe_parms *parms);
 
+/**
+ * @brief Selects which stats are read by dvb_fe_get_stats()
+ * @ingroup frontend
+ *
+ * @param parms	struct dvb_v5_fe_parms pointer to the opened device
+ * @param cmds	array of DTV_STAT_* properties, or of the stats calculated
+ *		by libdvbv5, like DTV_BER and DTV_QUALITY
+ * @param num	number of elements at cmds. Zero selects all stats.
+ *
+ * By default, all stats provided by the Kernel are read. Applications that
+ * monitor just a few of them at a high rate can use this to read only
+ * those, in a single ioctl. The counters needed by the calculated stats
+ * are selected as well. Other stats are reported as not available.
+ *
+ * DTV_STATUS is always read. For remote frontends, all stats are read.
+ *
+ * @return It returns 0 if success or -EINVAL if some property is not a
+ * stats property.
+ */
+int dvb_fe_select_stats(struct dvb_v5_fe_parms *parms, const uint32_t *cmds,
+			unsigned int num);
+
+/**
+ * @brief Asks a remote frontend to send its stats, instead of polling it
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param interval_ms	maximum time between two updates, in milliseconds.
+ *			Zero cancels the subscription.
+ *
+ * When the frontend is accessed via dvbv5-daemon, each dvb_fe_get_stats()
+ * call costs a round trip to the server. After this call, the daemon sends
+ * the stats by itself every interval_ms, or earlier if the lock status or
+ * the signal quality changes, and dvb_fe_get_stats() just returns the last
+ * stats received.
+ *
+ * For local frontends, it does nothing.
+ *
+ * @return It returns 0 if success or a negative error code otherwise.
+ * -EOPNOTSUPP means that the daemon doesn't support it, and
+ * dvb_fe_get_stats() keeps asking for the stats.
+ */
+int dvb_fe_subscribe_stats(struct dvb_v5_fe_parms *parms,
+			   unsigned int interval_ms);
+
 /**
  * @brief Retrieve the BER stats from cache
  * @ingroup frontend
@@ -602,6 +647,27 @@ int dvb_fe_snprintf_eng(char *buf, int len, float val);
  */
 int dvb_fe_get_event(struct dvb_v5_fe_parms *parms);
 
+/**
+ * @brief Waits for the frontend to lock
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param timeout_ms	maximum time to wait, in milliseconds
+ *
+ * Instead of reading the status at fixed intervals, this function sleeps
+ * in poll() until the Kernel reports a frontend status change, so it returns
+ * as soon as FE_HAS_LOCK is set. The stats are read with dvb_fe_get_stats()
+ * before returning, so they can be shown by the caller, also on timeout.
+ *
+ * Frontends accessed via dvbv5-daemon can't be polled. For them, the status
+ * is read every 20 ms, which is cheap after dvb_fe_subscribe_stats().
+ *
+ * @return It returns 0 if the frontend is locked, -ETIMEDOUT if it didn't
+ * lock within timeout_ms, -EINTR if parms->abort was set, or another
+ * negative error code otherwise.
+ */
+int dvb_fe_wait_lock(struct dvb_v5_fe_parms *parms, unsigned int timeout_ms);
+
 /*
  * Other functions, associated to SEC/LNB/DISEqC
  *
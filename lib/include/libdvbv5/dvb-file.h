@@ -239,6 +239,17 @@ enum dvb_file_formats {
 
 struct dvb_v5_descriptors;
 
+/**
+ * @struct dvb_file_index
+ * @brief  Opaque struct with indexes for the entries of a struct dvb_file
+ * @ingroup file
+ *
+ * Seeking for a channel at struct dvb_file requires to walk through all
+ * its entries. For big files, like satellite channel lists, an index
+ * makes such lookups faster.
+ */
+struct dvb_file_index;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -513,6 +524,91 @@ int dvb_write_format_oneline(const char *fname,
 int dvb_write_format_vdr(const char *fname,
 			 struct dvb_file *dvb_file);
 
+/**
+ * @brief Creates the indexes for the entries of a struct dvb_file
+ * @ingroup file
+ *
+ * @param dvb_file	contents of a file. If NULL, an empty index is
+ *			created, to be filled with dvb_file_index_add().
+ *
+ * The channel names, the service IDs and the frequencies are indexed.
+ * Entries added to dvb_file later on are not seen, except if added to
+ * the index with dvb_file_index_add().
+ *
+ * @return It returns a pointer to the index, or NULL if no memory.
+ */
+struct dvb_file_index *dvb_file_index_alloc(struct dvb_file *dvb_file);
+
+/**
+ * @brief Adds an entry to an index
+ * @ingroup file
+ *
+ * @param index		index allocated with dvb_file_index_alloc()
+ * @param entry		entry to add. It should not be freed while the
+ *			index is in use.
+ *
+ * @return It returns zero if success, or -ENOMEM.
+ */
+int dvb_file_index_add(struct dvb_file_index *index, struct dvb_entry *entry);
+
+/**
+ * @brief Frees an index allocated with dvb_file_index_alloc()
+ * @ingroup file
+ *
+ * @param index		index to be freed. The entries aren't touched.
+ */
+void dvb_file_index_free(struct dvb_file_index *index);
+
+/**
+ * @brief Seeks for a channel by its name
+ * @ingroup file
+ *
+ * @param index		index allocated with dvb_file_index_alloc()
+ * @param name		channel or virtual channel name
+ *
+ * If no entry matches exactly, a case insensitive match of the channel
+ * name is tried.
+ *
+ * @return It returns the first entry with that name, or NULL.
+ */
+struct dvb_entry *dvb_file_find_channel(struct dvb_file_index *index,
+					const char *name);
+
+/**
+ * @brief Seeks for a channel by its service ID
+ * @ingroup file
+ *
+ * @param index		index allocated with dvb_file_index_alloc()
+ * @param service_id	service ID
+ * @param transport_id	transport ID. If zero, any transport matches.
+ *
+ * @return It returns the first entry for that service, or NULL.
+ */
+struct dvb_entry *dvb_file_find_service(struct dvb_file_index *index,
+					uint16_t service_id,
+					uint16_t transport_id);
+
+/**
+ * @brief Seeks for an entry by its frequency
+ * @ingroup file
+ *
+ * @param index		index allocated with dvb_file_index_alloc()
+ * @param freq		frequency
+ * @param shift		tolerance for the frequency, as returned by
+ *			dvb_estimate_freq_shift()
+ * @param pol		polarization. POLARIZATION_OFF matches any.
+ * @param stream_id	stream ID. NO_STREAM_ID_FILTER or 0 match any.
+ *
+ * This is a faster replacement for dvb_new_entry_is_needed(), for
+ * files with lots of entries.
+ *
+ * @return It returns an entry with a matching frequency, or NULL.
+ */
+struct dvb_entry *dvb_file_find_freq(struct dvb_file_index *index,
+				     uint32_t freq, uint32_t shift,
+				     enum dvb_sat_polarization pol,
+				     uint32_t stream_id);
+
 #ifdef __cplusplus
 }
 #endif
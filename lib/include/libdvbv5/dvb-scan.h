@@ -226,6 +226,129 @@ int dvb_read_sections(struct dvb_v5_fe_parms *parms, int dmx_fd,
 			     struct dvb_table_filter *sect,
 			     unsigned timeout);
 
+/**
+ * @brief read several MPEG-TS tables at the same time
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param dmx_fd	an opened demux file descriptor
+ * @param sects		array of num section filters
+ * @param rc		array of num return codes, filled with 0 or a negative
+ *			error code for each table, as dvb_read_sections() does
+ * @param timeout	array of num limits, in seconds, to read each table
+ * @param num		number of tables to read
+ *
+ * This is a variant of dvb_read_sections() that reads the tables
+ * concurrently. Each table uses its own section filter: besides dmx_fd,
+ * up to 15 more file descriptors of the same demux are opened, and all of
+ * them are waited for with a single poll(). If the demux has fewer section
+ * filters, the remaining tables are read as soon as a filter is done.
+ *
+ * Returns 0 on success or a negative error code if the tables could not
+ * be read at all. The result of each table is stored at rc.
+ */
+int dvb_read_sections_multi(struct dvb_v5_fe_parms *parms, int dmx_fd,
+			    struct dvb_table_filter *sects, int *rc,
+			    const unsigned *timeout, unsigned num);
+
+/**
+ * @struct dvb_table_cache
+ * @brief Remembers the sections already seen, for table monitoring
+ * @ingroup frontend_scan
+ *
+ * Opaque struct, allocated with dvb_table_cache_alloc(). For each PID,
+ * table ID and table ID extension, it stores the version and the CRC of
+ * each section, so repeated sections are dropped without being parsed.
+ */
+struct dvb_table_cache;
+
+/**
+ * @brief callback called by the table cache when a table changes
+ * @ingroup frontend_scan
+ *
+ * @param priv		private data given to dvb_table_cache_alloc()
+ * @param pid		program ID where the table was found
+ * @param table_id	table ID
+ * @param id		table ID extension (for example, the service ID
+ *			of an EIT table)
+ * @param table		the parsed table, like the ones returned by
+ *			dvb_read_section(). It should be freed by the
+ *			callback, with the free function of its table type.
+ */
+typedef void (*dvb_table_changed_func)(void *priv, uint16_t pid,
+				       uint8_t table_id, uint16_t id,
+				       void *table);
+
+/**
+ * @brief allocates a struct dvb_table_cache
+ * @ingroup frontend_scan
+ *
+ * @param changed	function called each time a table is first
+ *			completely received, or after its version changes
+ * @param priv		private data passed to the changed callback
+ *
+ * At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_table_cache *dvb_table_cache_alloc(dvb_table_changed_func changed,
+					      void *priv);
+
+/**
+ * @brief frees a struct dvb_table_cache and any partially received table
+ * @ingroup frontend_scan
+ *
+ * @param cache		table cache to be freed
+ */
+void dvb_table_cache_free(struct dvb_table_cache *cache);
+
+/**
+ * @brief feeds a section to the table cache
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param cache		table cache
+ * @param pid		program ID where the section was read
+ * @param buf		buffer with a complete section, including its CRC
+ * @param buf_length	size of the section
+ *
+ * Sections with the same version and CRC as an already seen one are
+ * dropped before being parsed or having their CRC checked. The others are
+ * parsed into a table per PID, table ID and table ID extension. When all
+ * sections of that table are received, the changed callback is called.
+ *
+ * This is meant for applications that read the demux themselves. Returns
+ * 0 if the section was dropped, 1 if it was parsed, or a negative error
+ * code.
+ */
+int dvb_table_cache_section(struct dvb_v5_fe_parms *parms,
+			    struct dvb_table_cache *cache, uint16_t pid,
+			    const uint8_t *buf, ssize_t buf_length);
+
+/**
+ * @brief monitors the MPEG-TS tables on a PID for changes
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param dmx_fd	an opened demux file descriptor
+ * @param cache		table cache
+ * @param pid		program ID to monitor
+ * @param tid		table ID to monitor
+ * @param tid_mask	mask applied to the table IDs before comparing with
+ *			tid. 0xff monitors a single table ID; 0xf0 together
+ *			with 0x50 monitors all EIT schedule tables.
+ * @param timeout	limit, in seconds, to wait for a new section
+ *
+ * Reads sections continuously, passing them to dvb_table_cache_section().
+ * Returns 0 when parms->abort is set, or a negative error code if no
+ * section arrives during the timeout or reading fails. The cache keeps
+ * its state, so this function can be called again afterwards.
+ */
+int dvb_table_cache_monitor(struct dvb_v5_fe_parms *parms, int dmx_fd,
+			    struct dvb_table_cache *cache, uint16_t pid,
+			    uint8_t tid, uint8_t tid_mask, unsigned timeout);
+
 /**
  * @brief allocates a struct dvb_v5_descriptors
  * @ingroup frontend_scan
@@ -270,6 +393,79 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *parms, int
 					  unsigned other_nit,
 					  unsigned timeout_multiply);
 
+/**
+ * @enum dvb_scan_tables
+ *	@brief Tables read by dvb_get_ts_tables_profile()
+ * @ingroup frontend_scan
+ *
+ * @param DVB_SCAN_PMT		the PMT of each program. The PAT is always read
+ * @param DVB_SCAN_VCT		the VCT, on ATSC and DVB-C annex B
+ * @param DVB_SCAN_NIT		the NIT
+ * @param DVB_SCAN_SDT		the SDT. On ATSC, only with DVB_SCAN_OTHER
+ * @param DVB_SCAN_OTHER	the NIT and SDT of the other transport
+ *				streams as well
+ * @param DVB_SCAN_UNTIL_SEEN	stop waiting for the NIT and the SDT once
+ *				the PMT of every program was read and the SDT
+ *				has an entry for each of them
+ * @param DVB_SCAN_FULL		the tables read by dvb_get_ts_tables()
+ * @param DVB_SCAN_QUICK	what is needed to list the services with their
+ *				names, without waiting for the NIT
+ * @param DVB_SCAN_ZAP		just the PAT and PMTs, e.g. to refresh the
+ *				PIDs of the services of a channel list
+ */
+enum dvb_scan_tables {
+	DVB_SCAN_PMT		= 1 << 0,
+	DVB_SCAN_VCT		= 1 << 1,
+	DVB_SCAN_NIT		= 1 << 2,
+	DVB_SCAN_SDT		= 1 << 3,
+	DVB_SCAN_OTHER		= 1 << 4,
+	DVB_SCAN_UNTIL_SEEN	= 1 << 5,
+
+	DVB_SCAN_FULL		= DVB_SCAN_PMT | DVB_SCAN_VCT |
+				  DVB_SCAN_NIT | DVB_SCAN_SDT,
+	DVB_SCAN_QUICK		= DVB_SCAN_PMT | DVB_SCAN_VCT |
+				  DVB_SCAN_SDT | DVB_SCAN_UNTIL_SEEN,
+	DVB_SCAN_ZAP		= DVB_SCAN_PMT,
+};
+
+/**
+ * @brief Scans a DVB stream, reading only the given tables
+ * @ingroup frontend_scan
+ *
+ * @param parms			pointer to struct dvb_v5_fe_parms created when
+ *				the frontend is opened
+ * @param dmx_fd		an opened demux file descriptor
+ * @param delivery_system	delivery system to be scanned
+ * @param tables		bitmask of enum dvb_scan_tables
+ * @param timeout_multiply	improves the timeout for each table reception
+ * 				by using a value that will multiply the wait
+ *				time.
+ *
+ * Same as dvb_get_ts_tables(), but only the tables given by @a tables are
+ * read, so that no time is spent waiting for tables that are not needed,
+ * or not broadcast at all. The PMT, NIT and SDT are read at the same time,
+ * and so are the NIT and SDT of the other transport streams.
+ */
+struct dvb_v5_descriptors *dvb_get_ts_tables_profile(struct dvb_v5_fe_parms *parms,
+						     int dmx_fd,
+						     uint32_t delivery_system,
+						     unsigned tables,
+						     unsigned timeout_multiply);
+
+/**
+ * @brief Selects the tables read by dvb_get_ts_tables()
+ * @ingroup frontend_scan
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms created when the
+ *			frontend is opened
+ * @param tables	bitmask of enum dvb_scan_tables, or 0 for the
+ *			default DVB_SCAN_FULL
+ *
+ * This also applies to dvb_scan_transponder() and dvb_dev_scan(), which
+ * call dvb_get_ts_tables(). Their other_nit argument adds DVB_SCAN_OTHER.
+ */
+void dvb_scan_set_tables(struct dvb_v5_fe_parms *parms, unsigned tables);
+
 /**
  * @brief frees a struct dvb_v5_descriptors
  * @ingroup frontend_scan
@@ -302,7 +498,9 @@ typedef int (check_frontend_t)(void *args, struct dvb_v5_fe_parms *parms);
  * 			tuned
  * @param dmx_fd		an opened demux file descriptor
  * @param check_frontend	a pointer to a function that will show the frontend
- *			status while tuning into a transponder
+ *			status while tuning into a transponder. If NULL,
+ *			dvb_fe_wait_lock() waits up to timeout_multiply * 4
+ *			seconds for the lock.
  * @param args		a pointer, opaque to libdvbv5, that will be used when
  *			calling check_frontend. It should contain any parameters
  *			that could be needed by check_frontend.
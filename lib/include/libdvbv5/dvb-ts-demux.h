@@ -0,0 +1,200 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-ts-demux.h
+ * @ingroup demux
+ * @brief Provides a software demux for a full MPEG-TS stream.
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ *
+ * The kernel demux needs a file descriptor, and a read() call, per
+ * filtered PID. When lots of PIDs are needed, it is cheaper to read the
+ * whole transport stream once from the DVR device, by setting a PES
+ * filter for PID 0x2000 with DMX_OUT_TS_TAP output (see
+ * dvb_set_pesfilter()), and to split it with the functions below.
+ *
+ * @par Relevant specs
+ * ISO/IEC 13818-1
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_TS_DEMUX_H
+#define _DVB_TS_DEMUX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h> /* ssize_t */
+
+/**
+ * @enum dvb_ts_filter_type
+ * @brief What a software demux filter delivers
+ * @ingroup demux
+ *
+ * @var DVB_TS_FILTER_TS
+ *	@brief Each 188 bytes MPEG-TS packet, as received
+ * @var DVB_TS_FILTER_SECTION
+ *	@brief Complete PSI/SI sections. The ones with the section syntax
+ *	indicator set are only delivered if their CRC is valid.
+ * @var DVB_TS_FILTER_PES
+ *	@brief Complete PES packets. The ones with an unbounded length are
+ *	delivered when the next one starts.
+ */
+enum dvb_ts_filter_type {
+	DVB_TS_FILTER_TS,
+	DVB_TS_FILTER_SECTION,
+	DVB_TS_FILTER_PES,
+};
+
+/**
+ * @struct dvb_ts_demux_stats
+ * @brief Error counters of a software demux
+ * @ingroup demux
+ *
+ * @param packets	number of MPEG-TS packets received
+ * @param sync_losses	number of times the sync byte was not where expected
+ * @param tei_errors	packets with the transport error indicator set
+ * @param cc_errors	packets lost, according with the continuity counter
+ *			of the filtered PIDs
+ * @param crc_errors	sections dropped due to a CRC error
+ */
+struct dvb_ts_demux_stats {
+	unsigned long long packets;
+	unsigned long sync_losses;
+	unsigned long tei_errors;
+	unsigned long cc_errors;
+	unsigned long crc_errors;
+};
+
+/**
+ * @struct dvb_ts_demux
+ * @brief Opaque struct with the software demux state
+ * @ingroup demux
+ */
+struct dvb_ts_demux;
+
+struct dvb_v5_fe_parms;
+
+/**
+ * @brief callback called by the software demux
+ * @ingroup demux
+ *
+ * @param priv		private data given to dvb_ts_demux_add_filter()
+ * @param pid		program ID of the data
+ * @param buf		a TS packet, a section or a PES packet, depending
+ *			on the filter type. Only valid during the call.
+ * @param len		size of the data at buf
+ */
+typedef void (*dvb_ts_demux_func)(void *priv, uint16_t pid,
+				  const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief allocates a software demux
+ * @ingroup demux
+ *
+ * @param parms		struct dvb_v5_fe_parms for log functions. May be NULL.
+ *
+ * At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_ts_demux *dvb_ts_demux_alloc(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief frees a software demux and all of its filters
+ * @ingroup demux
+ *
+ * @param dmx		software demux
+ */
+void dvb_ts_demux_free(struct dvb_ts_demux *dmx);
+
+/**
+ * @brief adds a filter for a PID
+ * @ingroup demux
+ *
+ * @param dmx		software demux
+ * @param pid		program ID to filter
+ * @param type		what should be delivered to the callback
+ * @param func		callback
+ * @param priv		private data passed to the callback
+ *
+ * A PID may have several filters. Returns 0 on success, or a negative
+ * error code.
+ *
+ * @note Filters can't be added or removed from a callback.
+ */
+int dvb_ts_demux_add_filter(struct dvb_ts_demux *dmx, uint16_t pid,
+			    enum dvb_ts_filter_type type,
+			    dvb_ts_demux_func func, void *priv);
+
+/**
+ * @brief removes the filters of a PID with the given callback and data
+ * @ingroup demux
+ *
+ * @param dmx		software demux
+ * @param pid		program ID
+ * @param func		callback given to dvb_ts_demux_add_filter()
+ * @param priv		private data given to dvb_ts_demux_add_filter()
+ */
+void dvb_ts_demux_remove_filter(struct dvb_ts_demux *dmx, uint16_t pid,
+				dvb_ts_demux_func func, void *priv);
+
+/**
+ * @brief demultiplexes a chunk of a MPEG-TS stream
+ * @ingroup demux
+ *
+ * @param dmx		software demux
+ * @param buf		stream data
+ * @param len		size of the data. It doesn't need to be a multiple of
+ *			the packet size: a packet split between two calls is
+ *			kept until the next one.
+ *
+ * The filter callbacks are called before it returns.
+ */
+void dvb_ts_demux_feed(struct dvb_ts_demux *dmx, const uint8_t *buf,
+		       size_t len);
+
+/**
+ * @brief reads a MPEG-TS stream from a file descriptor and demultiplexes it
+ * @ingroup demux
+ *
+ * @param dmx		software demux
+ * @param fd		file descriptor, usually the DVR device
+ *
+ * Does a single read() of up to 64 KiB, and passes the data to
+ * dvb_ts_demux_feed(). Returns what read() returned.
+ */
+ssize_t dvb_ts_demux_read(struct dvb_ts_demux *dmx, int fd);
+
+/**
+ * @brief gets the error counters of a software demux
+ * @ingroup demux
+ *
+ * @param dmx		software demux
+ * @param stats		filled with the counters since dvb_ts_demux_alloc()
+ */
+void dvb_ts_demux_get_stats(struct dvb_ts_demux *dmx,
+			    struct dvb_ts_demux_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
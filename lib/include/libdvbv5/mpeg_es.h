@@ -37,6 +37,7 @@
  * Please submit bug reports and patches to linux-media@vger.kernel.org
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h> /* ssize_t */
 
@@ -177,6 +178,87 @@ enum dvb_mpeg_es_frame_t
  */
 extern const char *dvb_mpeg_es_frame_names[5];
 
+/**
+ * @enum dvb_mpeg_es_event_type
+ * @brief Events reported by the incremental ES parser
+ * @ingroup dvb_table
+ *
+ * @var DVB_MPEG_ES_EVENT_PES
+ *	@brief	A PES header was parsed
+ * @var DVB_MPEG_ES_EVENT_SEQ_START
+ *	@brief	A MPEG-1/2 video sequence header was found
+ * @var DVB_MPEG_ES_EVENT_PIC_START
+ *	@brief	A MPEG-1/2 video picture header was found
+ */
+enum dvb_mpeg_es_event_type {
+	DVB_MPEG_ES_EVENT_PES,
+	DVB_MPEG_ES_EVENT_SEQ_START,
+	DVB_MPEG_ES_EVENT_PIC_START,
+};
+
+/**
+ * @struct dvb_mpeg_es_event
+ * @brief Event reported by the incremental ES parser
+ * @ingroup dvb_table
+ *
+ * @param type		kind of event (enum dvb_mpeg_es_event_type)
+ * @param pid		program ID of the stream
+ * @param stream_id	PES stream ID
+ * @param has_pts	pts is valid
+ * @param has_dts	dts is valid
+ * @param discontinuity	data was lost before this PES packet. Only
+ *			for DVB_MPEG_ES_EVENT_PES.
+ * @param pts		PES PTS timestamp, in 90 kHz units
+ * @param dts		PES DTS timestamp, in 90 kHz units
+ * @param coding_type	Frame type (enum dvb_mpeg_es_frame_t). Only for
+ *			DVB_MPEG_ES_EVENT_PIC_START.
+ * @param temporal_ref	Temporal sequence number. Only for
+ *			DVB_MPEG_ES_EVENT_PIC_START.
+ * @param width		Width. Only for DVB_MPEG_ES_EVENT_SEQ_START.
+ * @param height	Height. Only for DVB_MPEG_ES_EVENT_SEQ_START.
+ * @param aspect	Aspect ratio code. Only for
+ *			DVB_MPEG_ES_EVENT_SEQ_START.
+ * @param framerate	Frame rate code. Only for
+ *			DVB_MPEG_ES_EVENT_SEQ_START.
+ *
+ * A DVB_MPEG_ES_EVENT_PIC_START event carries the PTS and DTS of the PES
+ * packet when it is the first picture that starts on it, as the PES
+ * timestamps refer to that picture.
+ */
+struct dvb_mpeg_es_event {
+	enum dvb_mpeg_es_event_type type;
+	uint16_t pid;
+	uint8_t stream_id;
+	unsigned has_pts:1;
+	unsigned has_dts:1;
+	unsigned discontinuity:1;
+	uint64_t pts;
+	uint64_t dts;
+	enum dvb_mpeg_es_frame_t coding_type;
+	uint16_t temporal_ref;
+	uint16_t width;
+	uint16_t height;
+	uint8_t aspect;
+	uint8_t framerate;
+};
+
+/**
+ * @struct dvb_mpeg_es_parser
+ * @brief Opaque struct with the incremental ES parser state
+ * @ingroup dvb_table
+ */
+struct dvb_mpeg_es_parser;
+
+/**
+ * @brief callback called by the incremental ES parser
+ * @ingroup dvb_table
+ *
+ * @param priv		private data given to dvb_mpeg_es_parser_alloc()
+ * @param ev		the event. Only valid during the call.
+ */
+typedef void (*dvb_mpeg_es_parser_func)(void *priv,
+					const struct dvb_mpeg_es_event *ev);
+
 struct dvb_v5_fe_parms;
 
 #ifdef __cplusplus
@@ -241,6 +323,59 @@ int  dvb_mpeg_es_pic_start_init (const uint8_t *buf, ssize_t buflen,
 void dvb_mpeg_es_pic_start_print(struct dvb_v5_fe_parms *parms,
 		struct dvb_mpeg_es_pic_start *pic_start);
 
+/**
+ * @brief allocates an incremental ES parser, for a single PID
+ * @ingroup dvb_table
+ *
+ * @param func		callback for the parsed events
+ * @param priv		private data passed to the callback
+ *
+ * The parser takes the MPEG-TS packets of an elementary stream, joins the
+ * PES headers split between packets and reports their timestamps. On
+ * video streams, it also looks for the MPEG-1/2 sequence and picture
+ * headers, which may also be split between packets. Other video codecs
+ * only get the PES events. At success, returns a pointer. NULL otherwise.
+ */
+struct dvb_mpeg_es_parser *dvb_mpeg_es_parser_alloc(dvb_mpeg_es_parser_func func,
+						    void *priv);
+
+/**
+ * @brief frees an incremental ES parser
+ * @ingroup dvb_table
+ *
+ * @param p		ES parser
+ */
+void dvb_mpeg_es_parser_free(struct dvb_mpeg_es_parser *p);
+
+/**
+ * @brief discards the state of an incremental ES parser
+ * @ingroup dvb_table
+ *
+ * @param p		ES parser
+ *
+ * Should be called when the stream changes, for example after a new
+ * tune. Nothing is reported until the next PES packet starts.
+ */
+void dvb_mpeg_es_parser_reset(struct dvb_mpeg_es_parser *p);
+
+/**
+ * @brief feeds a MPEG-TS packet to an incremental ES parser
+ * @ingroup dvb_table
+ *
+ * @param priv		ES parser, as returned by dvb_mpeg_es_parser_alloc()
+ * @param pid		program ID of the packet
+ * @param buf		a 188 bytes MPEG-TS packet
+ * @param len		size of the packet
+ *
+ * The events found on the packet are reported before it returns. Lost,
+ * scrambled or errored packets make the parser wait for the next PES
+ * packet. Its prototype matches dvb_ts_demux_func, so it can be given to
+ * dvb_ts_demux_add_filter() with DVB_TS_FILTER_TS, with the parser as
+ * the private data.
+ */
+void dvb_mpeg_es_parser_feed_ts(void *priv, uint16_t pid, const uint8_t *buf,
+				size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * USDT (sys/sdt.h) static probe points of libv4l2, libv4lconvert and
+ * libdvbv5. This header is private to the libraries and not installed.
+ *
+ * The probes only get compiled in when meson found sys/sdt.h (the usdt
+ * feature), otherwise all of the macros below compile to nothing. Each
+ * probe has a semaphore, which the tracer increments while it is attached,
+ * so the timestamps for the durations passed to the *_return probes are
+ * only taken while somebody listens. Probe names and the meaning of their
+ * arguments are an ABI, see README.libv4l.
+ *
+ * Every probe used in a file needs a V4L_PROBE_SEMAPHORE() at file scope.
+ */
+
+#ifndef __LIBV4L_PROBES_H
+#define __LIBV4L_PROBES_H
+
+#include <stdint.h>
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <time.h>
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define V4L_PROBE_SEMAPHORE(provider, name) \
+	__extension__ unsigned short provider##_##name##_semaphore \
+	__attribute__((unused)) __attribute__((section(".probes")))
+
+#define V4L_PROBE_ENABLED(provider, name) \
+	__builtin_expect(provider##_##name##_semaphore, 0)
+
+#define V4L_PROBE(provider, name, ...) \
+	STAP_PROBEV(provider, name, ##__VA_ARGS__)
+
+static inline uint64_t v4l_probe_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Start timestamp for the duration argument of the given probe, 0 when
+   it isn't attached */
+#define V4L_PROBE_START(provider, name) \
+	(V4L_PROBE_ENABLED(provider, name) ? v4l_probe_now() : 0)
+
+/* Nanoseconds since V4L_PROBE_START(), 0 if the probe got attached later */
+#define V4L_PROBE_NS(start) \
+	((start) ? v4l_probe_now() - (start) : 0)
+
+#else
+
+static inline void v4l_probe_unused(int dummy, ...)
+{
+}
+
+#define V4L_PROBE_SEMAPHORE(provider, name) \
+	extern int v4l_probe_unused_##provider##_##name
+#define V4L_PROBE_ENABLED(provider, name) 0
+/* Still "use" the arguments, which might only be computed for the probe */
+#define V4L_PROBE(provider, name, ...) \
+	do { if (0) v4l_probe_unused(0, ##__VA_ARGS__); } while (0)
+#define V4L_PROBE_START(provider, name) ((uint64_t)0)
+#define V4L_PROBE_NS(start) ((uint64_t)0 * (start))
+
+#endif
+
+#endif
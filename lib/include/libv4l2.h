@@ -48,6 +48,11 @@ LIBV4L_PUBLIC extern FILE *v4l2_log_file;
    Another difference is that you can make v4l2_read() calls even on devices
    which do not support the regular read() method.
 
+   When converting, buffers can be requested with V4L2_MEMORY_USERPTR or
+   V4L2_MEMORY_DMABUF even if the driver only supports V4L2_MEMORY_MMAP. The
+   converted frames then get written straight into the buffers (or dmabufs)
+   passed to VIDIOC_QBUF, instead of into libv4l2's own buffers.
+
    Note the device name passed to v4l2_open must be of a video4linux2 device,
    if it is anything else (including a video4linux1 device), v4l2_open will
    fail.
@@ -86,6 +91,73 @@ LIBV4L_PUBLIC int v4l2_set_control(int fd, int cid, int value);
    accessed -1 is returned. */
 LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 
+/* This function sets how many frames libv4l2 may convert ahead of the frame
+   returned by the next DQBUF. If this is non 0 up to depth + 1 frames are
+   converted in parallel (each on its own thread) and frames are still
+   returned in order, at the price of up to depth frames of added latency.
+   This is useful with formats which are expensive to decode, like MJPEG,
+   at high resolutions and frame rates. The default is 0 (no added latency),
+   unless set through the LIBV4L2_PIPELINE_DEPTH environment variable. The
+   maximum depth is 7, and it can not be changed while frames are in flight.
+
+   Returns 0 on success, -1 on error. */
+LIBV4L_PUBLIC int v4l2_set_pipeline_depth(int fd, int depth);
+
+/* Per frame latency statistics. The driver stage is from the driver
+   timestamp of a frame until the driver's DQBUF returned it, the libv4l2
+   stage from there until libv4l2 handed the (converted) frame to the app
+   through DQBUF or read(), the total stage is both together. The driver and
+   total stages are only known for drivers with monotonic timestamps. */
+enum v4l2_latency_stage {
+	V4L2_LATENCY_DRIVER,
+	V4L2_LATENCY_LIBV4L2,
+	V4L2_LATENCY_TOTAL,
+	V4L2_LATENCY_STAGE_COUNT
+};
+
+struct v4l2_latency_stage_stats {
+	uint64_t count;		/* number of frames */
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t mean_ns;
+	uint64_t p50_ns;	/* percentiles, accurate to about 6% */
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+};
+
+struct v4l2_latency_stats {
+	struct v4l2_latency_stage_stats stage[V4L2_LATENCY_STAGE_COUNT];
+};
+
+/* Enable / disable gathering latency statistics for fd, this is disabled by
+   default, unless a log file is set or the LIBV4L2_LATENCY_STATS environment
+   variable is set. Enabling it resets the statistics.
+
+   Returns 0 on success, -1 on error. */
+LIBV4L_PUBLIC int v4l2_enable_latency_stats(int fd, int enable);
+
+/* Get the latency statistics gathered since they were enabled, returns 0 on
+   success, -1 if gathering statistics is not enabled for fd. */
+LIBV4L_PUBLIC int v4l2_get_latency_stats(int fd,
+		struct v4l2_latency_stats *stats);
+
+/* The times of the last frame libv4l2 handed to the app, to follow frames
+   through a pipeline. All times are CLOCK_MONOTONIC ns, captured_ns is 0
+   for drivers without monotonic timestamps. */
+struct v4l2_frame_times {
+	uint32_t sequence;	/* the driver's sequence number */
+	uint64_t captured_ns;	/* the driver timestamp */
+	uint64_t dequeued_ns;	/* the driver's DQBUF returned the frame */
+	uint64_t returned_ns;	/* libv4l2 handed the (converted) frame over */
+};
+
+/* Get the times of the last frame returned by DQBUF or read(), this needs
+   the latency statistics to be enabled, see v4l2_enable_latency_stats().
+   Returns 0 on success, -1 if they are not enabled or there is no frame
+   yet. */
+LIBV4L_PUBLIC int v4l2_get_frame_times(int fd, struct v4l2_frame_times *times);
+
 
 /* "low level" access functions, these functions allow somewhat lower level
    access to libv4l2 (currently there only is v4l2_fd_open here) */
@@ -100,6 +172,19 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* Dequeue and convert frames on a libv4l2 thread as soon as the driver has
+   them, so that DQBUF normally returns an already converted frame right
+   away, instead of converting it in the app's thread. The frames go through
+   the conversion pipeline, see v4l2_set_pipeline_depth(), with a depth of
+   at least 1. An app using poll() / select() on a non blocking fd may see
+   the fd become readable while the frame is still being converted, DQBUF
+   then fails with EAGAIN. Can also be enabled through the
+   LIBV4L2_CONVERT_AHEAD environment variable. */
+#define V4L2_CONVERT_AHEAD 0x04
+/* Let a read() with room for several frames return all frames which have
+   already been captured, instead of only one. Can also be enabled through
+   the LIBV4L2_READ_MULTIPLE_FRAMES environment variable. */
+#define V4L2_READ_MULTIPLE_FRAMES 0x08
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
@@ -260,6 +260,17 @@ struct v4l2_rds_tmc {
 	struct v4l2_tmc_tuning tuning;
 };
 
+/* struct to describe one decoded RDS group that updated fields,
+ * as logged by v4l2_rds_add_batch() */
+struct v4l2_rds_change {
+	uint32_t block;			/* index of the last block of the group
+					 * in the batch */
+	uint32_t updated_fields;	/* bitmask of the fields updated by
+					 * the group */
+	uint8_t group_id;		/* group number (0..15) */
+	char group_version;		/* group version ('A' / 'B') */
+};
+
 /* struct to encapsulate state and RDS information for current decoding process */
 /* This is the structure that will be used by external applications, to
  * communicate with the library and get access to RDS data */
@@ -321,6 +332,22 @@ LIBV4L_PUBLIC void v4l2_rds_reset(struct v4l2_rds *handle, bool reset_statistics
  * 				on RDS capable V4L2 devices */
 LIBV4L_PUBLIC uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data);
 
+/* adds an array of raw RDS blocks, e.g. as returned by one large read(),
+ * and decodes them in one pass
+ * @return:	bitmask of all fields updated by the blocks
+ * @rds_data:	array of raw RDS blocks
+ * @num_blocks:	number of blocks in @rds_data
+ * @changes:	optional change log, one entry for each decoded group that
+ *		updated fields, in order of reception. Can be NULL
+ * @num_changes: in: number of entries @changes can hold,
+ *		out: number of entries stored. Groups that don't fit are
+ *		only reported in the return value
+ * The handle holds the state after the last block, so values updated
+ * several times in the batch (e.g. TMC messages) only show the last one */
+LIBV4L_PUBLIC uint32_t v4l2_rds_add_batch(struct v4l2_rds *handle,
+		const struct v4l2_rds_data *rds_data, unsigned int num_blocks,
+		struct v4l2_rds_change *changes, unsigned int *num_changes);
+
 /*
  * group of functions to translate numerical RDS data into strings
  *
@@ -36,6 +36,8 @@
 
 /* end broken header workaround includes */
 
+#include <stdint.h>
+
 #if defined(__OpenBSD__)
 #include <sys/videoio.h>
 #else
@@ -54,6 +56,7 @@ extern "C" {
 
 struct libv4l_dev_ops;
 struct v4lconvert_data;
+struct v4lconvert_ctx;
 
 LIBV4L_PUBLIC const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops();
 
@@ -110,6 +113,10 @@ LIBV4L_PUBLIC int v4lconvert_needs_conversion(struct v4lconvert_data *data,
     - be called only once per frame
    Otherwise this may result in unintended double conversions !
 
+   src and dest may be the same buffer (in place conversion), when the source
+   and destination format are the same this only costs a copy of the frame if
+   one of the processing / flipping / rotating steps is active.
+
    Returns the amount of bytes written to dest and -1 on error */
 LIBV4L_PUBLIC int v4lconvert_convert(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
@@ -119,6 +126,37 @@ LIBV4L_PUBLIC int v4lconvert_convert(struct v4lconvert_data *data,
 /* get a string describing the last error */
 LIBV4L_PUBLIC const char *v4lconvert_get_error_message(struct v4lconvert_data *data);
 
+/* A conversion context holds the scratch buffers and decoder state for
+   converting frames of a v4lconvert instance, so that several threads can
+   each convert frames of the same device with their own context, without
+   locking. The formats and controls of the instance are shared, so it must
+   not be reconfigured (v4lconvert_try_format() etc.) while a context is
+   converting; v4lconvert_convert() on the instance itself can be used at
+   the same time. Frames which go through the software processing (auto
+   gain / white balance) are converted one at a time, as the processing
+   has per device state.
+
+   Decoders which depend on the previous frame (e.g. cpia1) keep it per
+   context, so all frames of such a stream should go through one context.
+   A context does not use the worker threads, mem2mem device and EGL of
+   the instance, nor does it gather statistics.
+
+   Create returns NULL on error. All contexts must be destroyed before the
+   instance. */
+LIBV4L_PUBLIC struct v4lconvert_ctx *v4lconvert_ctx_create(
+		struct v4lconvert_data *data);
+LIBV4L_PUBLIC void v4lconvert_ctx_destroy(struct v4lconvert_ctx *ctx);
+
+/* Same as v4lconvert_convert(), with the scratch state of ctx */
+LIBV4L_PUBLIC int v4lconvert_convert_ctx(struct v4lconvert_ctx *ctx,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
+
+/* get a string describing the last error of v4lconvert_convert_ctx() */
+LIBV4L_PUBLIC const char *v4lconvert_ctx_get_error_message(
+		struct v4lconvert_ctx *ctx);
+
 /* Just like VIDIOC_ENUM_FRAMESIZE, except that the framesizes of emulated
    formats can be enumerated as well. */
 LIBV4L_PUBLIC int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
@@ -143,17 +181,91 @@ LIBV4L_PUBLIC int v4lconvert_vidioc_try_ext_ctrls(struct v4lconvert_data *data,
 LIBV4L_PUBLIC int v4lconvert_vidioc_s_ext_ctrls(struct v4lconvert_data *data,
 		void *arg);
 
+/* Pass calls to (un)subscribe to and dequeue events to the libv4lcontrol
+   class. Query results and values of controls for which V4L2_EVENT_CTRL is
+   subscribed get cached by the above functions, these keep the cache in
+   sync with the events. */
+LIBV4L_PUBLIC int v4lconvert_vidioc_subscribe_event(
+		struct v4lconvert_data *data, void *arg);
+LIBV4L_PUBLIC int v4lconvert_vidioc_unsubscribe_event(
+		struct v4lconvert_data *data, void *arg);
+LIBV4L_PUBLIC int v4lconvert_vidioc_dqevent(struct v4lconvert_data *data,
+		void *arg);
+
 /* Is the passed in pixelformat supported as destination format? */
 LIBV4L_PUBLIC int v4lconvert_supported_dst_format(unsigned int pixelformat);
 
+/* Is the passed in destination format one the cam has natively, and which is
+   thus passed through like a format v4lconvert can not convert to? This is
+   the case for NV12, YUYV, RGBA32 and ABGR32 unless flipping / processing is
+   needed, see v4lconvert_supported_dst_fmt_only(). */
+LIBV4L_PUBLIC int v4lconvert_passthrough_format(struct v4lconvert_data *data,
+		unsigned int pixelformat);
+
 /* Get/set the no fps libv4lconvert uses to decide if a compressed format
    must be used as src fmt to stay within the bus bandwidth */
 LIBV4L_PUBLIC int v4lconvert_get_fps(struct v4lconvert_data *data);
 LIBV4L_PUBLIC void v4lconvert_set_fps(struct v4lconvert_data *data, int fps);
 
+/* Get/set the number of threads v4lconvert_convert uses to convert a frame,
+   1 disables multi-threaded conversion. The default can be set through the
+   LIBV4LCONVERT_THREADS environment variable. Note this does not change the
+   rules for using a single v4lconvert instance from multiple threads, see
+   README.lib-multi-threading. set returns 0 on success, -1 on error. */
+LIBV4L_PUBLIC int v4lconvert_get_threads(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_threads(struct v4lconvert_data *data,
+		int threads);
+
 /* Fixup bytesperline and sizeimage for supported destination formats */
 LIBV4L_PUBLIC void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
+/* Conversion statistics, v4lconvert_convert() splits its work into these
+   stages, decode is converting from a compressed source format. */
+enum v4lconvert_stage {
+	V4LCONVERT_STAGE_DECODE,
+	V4LCONVERT_STAGE_CONVERT,
+	V4LCONVERT_STAGE_PROCESSING,
+	V4LCONVERT_STAGE_ROTATE,
+	V4LCONVERT_STAGE_FLIP,
+	V4LCONVERT_STAGE_CROP,
+	V4LCONVERT_STAGE_COUNT
+};
+
+struct v4lconvert_stage_stats {
+	uint64_t count;		/* number of times the stage was run */
+	uint64_t ns;		/* cumulative wall clock time spent */
+	uint64_t bytes_in;	/* cumulative bytes read */
+	uint64_t bytes_out;	/* cumulative bytes written */
+};
+
+struct v4lconvert_stats {
+	struct v4lconvert_stage_stats stage[V4LCONVERT_STAGE_COUNT];
+};
+
+/* Enable / disable gathering conversion statistics, this is disabled by
+   default. Enabling it resets the statistics. */
+LIBV4L_PUBLIC void v4lconvert_enable_stats(struct v4lconvert_data *data,
+		int enable);
+
+/* Get the statistics gathered since they were enabled, returns 0 on
+   success, -1 if gathering statistics is not enabled. */
+LIBV4L_PUBLIC int v4lconvert_get_stats(struct v4lconvert_data *data,
+		struct v4lconvert_stats *stats);
+
+/* Get a short name for a stage, NULL for an unknown stage */
+LIBV4L_PUBLIC const char *v4lconvert_get_stage_name(int stage);
+
+/* Enable / disable skipping the conversion of frames which are identical to
+   the previous frame, v4lconvert_convert() then copies the previous output to
+   dest instead. This is disabled by default, unless the
+   LIBV4LCONVERT_SKIP_UNCHANGED environment variable is set. */
+LIBV4L_PUBLIC void v4lconvert_enable_skip_unchanged(
+		struct v4lconvert_data *data, int enable);
+
+/* Returns 1 if the last v4lconvert_convert() call copied the previous output
+   because the frame was unchanged, 0 otherwise */
+LIBV4L_PUBLIC int v4lconvert_frame_unchanged(struct v4lconvert_data *data);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -20,7 +20,16 @@
 
 #include <libdvbv5/crc32.h>
 
-static uint32_t crctab[256] = {
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_CRC32_PCLMUL
+#endif
+
+#define CRC32_POLY	0x04c11db7
+
+static const uint32_t crctab[256] = {
   0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
   0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
   0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd, 0x4c11db70, 0x48d0c6c7,
@@ -66,10 +75,162 @@ static uint32_t crctab[256] = {
   0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-inline uint32_t dvb_crc32(uint8_t *data, size_t len, uint32_t crc)
+/*
+ * Slicing-by-8: crctab_slice[n][b] is the crc of byte b followed by n + 1
+ * zero bytes, so eight bytes can be folded into the crc at once.
+ */
+static uint32_t crctab_slice[7][256];
+
+static uint32_t crc32_bytes(const uint8_t *data, size_t len, uint32_t crc)
 {
-  while(len--)
+  while (len--)
     crc = (crc << 8) ^ crctab[((crc >> 24) ^ *data++) & 0xff];
   return crc;
 }
 
+static uint32_t crc32_slice8(const uint8_t *data, size_t len, uint32_t crc)
+{
+  const uint32_t *t1 = crctab_slice[0], *t2 = crctab_slice[1],
+		 *t3 = crctab_slice[2], *t4 = crctab_slice[3],
+		 *t5 = crctab_slice[4], *t6 = crctab_slice[5],
+		 *t7 = crctab_slice[6];
+  uint32_t one, two;
+
+  while (len >= 8) {
+    one = crc ^ ((uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+		 (uint32_t)data[2] << 8 | data[3]);
+    two = (uint32_t)data[4] << 24 | (uint32_t)data[5] << 16 |
+	  (uint32_t)data[6] << 8 | data[7];
+    crc = t7[one >> 24] ^ t6[(one >> 16) & 0xff] ^
+	  t5[(one >> 8) & 0xff] ^ t4[one & 0xff] ^
+	  t3[two >> 24] ^ t2[(two >> 16) & 0xff] ^
+	  t1[(two >> 8) & 0xff] ^ crctab[two & 0xff];
+    data += 8;
+    len -= 8;
+  }
+  return crc32_bytes(data, len, crc);
+}
+
+#ifdef HAVE_CRC32_PCLMUL
+/* x^n mod P, used as the folding constants */
+static uint64_t xpow_mod(unsigned n)
+{
+  uint32_t r = 1;
+
+  while (n--)
+    r = (r << 1) ^ ((r & 0x80000000) ? CRC32_POLY : 0);
+  return r;
+}
+
+static __m128i fold_k[2];
+
+__attribute__((target("pclmul,ssse3")))
+static void crc32_pclmul_init(void)
+{
+  fold_k[0] = _mm_set_epi64x(xpow_mod(128 + 64), xpow_mod(128));
+  fold_k[1] = _mm_set_epi64x(xpow_mod(512 + 64), xpow_mod(512));
+}
+
+/*
+ * Carry-less multiply folding, as described by Intel at "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * As the MPEG-2 crc is not bit-reflected, each 16 bytes block is byte
+ * swapped, so its first bit becomes the highest degree coefficient.
+ * The accumulator x is then multiplied by x^n through
+ * (hi * (x^(n+64) mod P)) ^ (lo * (x^n mod P)), which keeps it congruent
+ * to the data folded so far, modulo P.
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i fold(__m128i x, __m128i k, __m128i data)
+{
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+				     _mm_clmulepi64_si128(x, k, 0x00)),
+		       data);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_pclmul(const uint8_t *data, size_t len, uint32_t crc)
+{
+  const __m128i bswap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+				      7, 6, 5, 4, 3, 2, 1, 0);
+  __m128i x0, x1, x2, x3;
+  uint8_t buf[16];
+  int i;
+
+  /* Less than 4 blocks are faster to do with the tables */
+  if (len < 64)
+    return crc32_slice8(data, len, crc);
+
+#define LOAD(n) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data + (n)), bswap)
+
+  /* The initial crc is added to the first 32 bits of the message */
+  x0 = _mm_xor_si128(LOAD(0), _mm_set_epi32(crc, 0, 0, 0));
+  x1 = LOAD(1);
+  x2 = LOAD(2);
+  x3 = LOAD(3);
+  data += 64;
+  len -= 64;
+
+  while (len >= 64) {
+    x0 = fold(x0, fold_k[1], LOAD(0));
+    x1 = fold(x1, fold_k[1], LOAD(1));
+    x2 = fold(x2, fold_k[1], LOAD(2));
+    x3 = fold(x3, fold_k[1], LOAD(3));
+    data += 64;
+    len -= 64;
+  }
+
+  x0 = fold(x0, fold_k[0], x1);
+  x0 = fold(x0, fold_k[0], x2);
+  x0 = fold(x0, fold_k[0], x3);
+
+  while (len >= 16) {
+    x0 = fold(x0, fold_k[0], LOAD(0));
+    data += 16;
+    len -= 16;
+  }
+#undef LOAD
+
+  /*
+   * The crc of the 128 bits accumulator is the crc of the data folded
+   * into it. The tail is then handled with the tables.
+   */
+  _mm_storeu_si128((__m128i *)buf, _mm_shuffle_epi8(x0, bswap));
+  for (i = 0, crc = 0; i < 16; i++)
+    crc = (crc << 8) ^ crctab[((crc >> 24) ^ buf[i]) & 0xff];
+
+  return crc32_slice8(data, len, crc);
+}
+#endif
+
+static uint32_t (*crc32_impl)(const uint8_t *data, size_t len, uint32_t crc);
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void)
+{
+  int i, n;
+
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = crctab[i];
+
+    for (n = 0; n < 7; n++) {
+      crc = (crc << 8) ^ crctab[crc >> 24];
+      crctab_slice[n][i] = crc;
+    }
+  }
+  crc32_impl = crc32_slice8;
+
+#ifdef HAVE_CRC32_PCLMUL
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+    crc32_pclmul_init();
+    crc32_impl = crc32_pclmul;
+  }
+#endif
+}
+
+uint32_t dvb_crc32(uint8_t *data, size_t len, uint32_t crc)
+{
+  pthread_once(&crc32_once, crc32_init);
+  return crc32_impl(data, len, crc);
+}
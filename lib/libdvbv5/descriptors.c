@@ -132,15 +132,68 @@ const dvb_table_init_func dvb_table_initializers[256] = {
 	[DVB_TABLE_EIT_SCHEDULE_OTHER + 0x0f]	= TABLE_INIT(dvb_table_eit),
 };
 
+/*
+ * All descriptors of a descriptor loop are stored on a single allocation,
+ * after this header, as EIT schedules have lots of small descriptors.
+ * Tables append the loops of each section to the same list, so
+ * dvb_desc_free() uses the count to find where each block starts.
+ */
+struct dvb_desc_block {
+	unsigned count;
+} __attribute__((aligned(16)));
+
+#define DESC_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+static size_t dvb_desc_size(uint8_t desc_type, uint8_t desc_len)
+{
+	if (!dvb_descriptors[desc_type].init)
+		return sizeof(struct dvb_desc) + desc_len;
+	return dvb_descriptors[desc_type].size;
+}
+
+static void dvb_desc_block_done(struct dvb_desc_block *block, unsigned count)
+{
+	if (!block)
+		return;
+	if (!count)
+		free(block);
+	else
+		block->count = count;
+}
+
 int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			   uint16_t buflen, struct dvb_desc **head_desc)
 {
 	const uint8_t *ptr = buf, *endbuf = buf + buflen;
 	struct dvb_desc *current = NULL;
 	struct dvb_desc *last = NULL;
+	struct dvb_desc_block *block = NULL;
+	size_t total = 0, offset = 0;
+	unsigned count = 0;
 
 	*head_desc = NULL;
 
+	/* Find the space needed by the descriptors that can be parsed */
+	while (ptr + 2 <= endbuf) {
+		size_t size;
+
+		if (ptr[0] == 0xff || ptr + 2 + ptr[1] > endbuf)
+			break;
+		size = dvb_desc_size(ptr[0], ptr[1]);
+		if (!size)
+			break;
+		total += DESC_ALIGN(size);
+		ptr += 2 + ptr[1];
+	}
+	if (total) {
+		block = calloc(1, sizeof(*block) + total);
+		if (!block) {
+			dvb_logerr("%s: out of memory", __func__);
+			return -3;
+		}
+	}
+
+	ptr = buf;
 	while (ptr + 2 <= endbuf ) {
 		uint8_t desc_type = ptr[0];
 		uint8_t desc_len  = ptr[1];
@@ -148,6 +201,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 
 		if (desc_type == 0xff ) {
 			dvb_logwarn("%s: stopping at invalid descriptor 0xff", __func__);
+			dvb_desc_block_done(block, count);
 			return 0;
 		}
 
@@ -156,6 +210,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		if (ptr + desc_len > endbuf) {
 			dvb_logerr("%s: short read of %zd/%d bytes parsing descriptor %#02x",
 				   __func__, endbuf - ptr, desc_len, desc_type);
+			dvb_desc_block_done(block, count);
 			return -1;
 		}
 
@@ -175,22 +230,17 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		}
 
 		dvb_desc_init_func init = dvb_descriptors[desc_type].init;
-		if (!init) {
+		if (!init)
 			init = dvb_desc_default_init;
-			size = sizeof(struct dvb_desc) + desc_len;
-		} else {
-			size = dvb_descriptors[desc_type].size;
-		}
+		size = dvb_desc_size(desc_type, desc_len);
 		if (!size) {
 			dvb_logerr("descriptor type 0x%02x has no size defined", desc_type);
+			dvb_desc_block_done(block, count);
 			return -2;
 		}
 
-		current = calloc(1, size);
-		if (!current) {
-			dvb_logerr("%s: out of memory", __func__);
-			return -3;
-		}
+		current = (struct dvb_desc *)((uint8_t *)(block + 1) + offset);
+		offset += DESC_ALIGN(size);
 		dvb_desc_init(desc_type, desc_len, current); /* initialize the standard header */
 		if (init(parms, ptr, current) != 0) {
 			dvb_logwarn("Couldn't handle descriptor type 0x%02x (%s?), size %d",
@@ -198,7 +248,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			if (parms->verbose)
 				dvb_hexdump(parms, "content: ", ptr, desc_len);
 
-			free(current);
+			dvb_desc_block_done(block, count);
 			return -4;
 		}
 		if (!*head_desc)
@@ -206,8 +256,10 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		if (last)
 			last->next = current;
 		last = current;
+		count++;
 		ptr += current->length;     /* standard descriptor header plus descriptor length */
 	}
+	dvb_desc_block_done(block, count);
 	return 0;
 }
 
@@ -226,12 +278,20 @@ void dvb_desc_print(struct dvb_v5_fe_parms *parms, struct dvb_desc *desc)
 void dvb_desc_free(struct dvb_desc **list)
 {
 	struct dvb_desc *desc = *list;
+	struct dvb_desc_block *block = NULL;
+	unsigned left = 0;
+
 	while (desc) {
 		struct dvb_desc *tmp = desc;
 		desc = desc->next;
+		if (!left) {
+			block = (struct dvb_desc_block *)tmp - 1;
+			left = block->count;
+		}
 		if (dvb_descriptors[tmp->type].free)
 			dvb_descriptors[tmp->type].free(tmp);
-		free(tmp);
+		if (!--left)
+			free(block);
 	}
 	*list = NULL;
 }
@@ -731,7 +791,7 @@ const struct dvb_descriptor dvb_descriptors[] = {
 		.name  = "frequency_list_descriptor",
 		.init  = dvb_desc_frequency_list_init,
 		.print = dvb_desc_frequency_list_print,
-		.free  = NULL,
+		.free  = dvb_desc_frequency_list_free,
 		.size  = sizeof(struct dvb_desc_frequency_list),
 	},
 	[partial_transport_stream_descriptor] = {
@@ -70,3 +70,9 @@ void dvb_desc_frequency_list_print(struct dvb_v5_fe_parms *parms, const struct d
 	}
 }
 
+void dvb_desc_frequency_list_free(struct dvb_desc *desc)
+{
+	struct dvb_desc_frequency_list *d = (struct dvb_desc_frequency_list *) desc;
+
+	free(d->frequency);
+}
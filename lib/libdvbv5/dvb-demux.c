@@ -38,6 +38,8 @@
 #include <fcntl.h>
 #include <stdlib.h> /* free */
 
+#include "dvb-fe-priv.h"
+#include "dvb-dev-priv.h"
 #include <libdvbv5/dvb-demux.h>
 #include <libdvbv5/dvb-dev.h>
 
@@ -64,6 +66,19 @@
 	__rc;								\
 })
 
+/*
+ * The demuxes of dvb_dev_file_init() are sockets, where the ioctls fail
+ * with ENOTTY. dvb-dev-file.c emulates them.
+ */
+static int dmx_ioctl(int fd, unsigned long request, void *arg)
+{
+	if (xioctl(fd, request, arg) != -1)
+		return 0;
+	if (errno != ENOTTY)
+		return -1;
+	return dvb_file_dmx_ioctl(fd, request, arg);
+}
+
 int dvb_dmx_open(int adapter, int demux)
 {
 	int fd_demux;
@@ -85,13 +100,13 @@ int dvb_dmx_open(int adapter, int demux)
 
 void dvb_dmx_close(int dmx_fd)
 {
-	(void)xioctl(dmx_fd, DMX_STOP);
+	(void)dmx_ioctl(dmx_fd, DMX_STOP, NULL);
 	close(dmx_fd);
 }
 
 void dvb_dmx_stop(int dmx_fd)
 {
-	(void)xioctl(dmx_fd, DMX_STOP);
+	(void)dmx_ioctl(dmx_fd, DMX_STOP, NULL);
 }
 
 int dvb_set_pesfilter(int dmxfd, int pid, dmx_pes_type_t type,
@@ -100,7 +115,8 @@ int dvb_set_pesfilter(int dmxfd, int pid, dmx_pes_type_t type,
 	struct dmx_pes_filter_params pesfilter;
 
 	if (buffersize) {
-		if (xioctl(dmxfd, DMX_SET_BUFFER_SIZE, buffersize) == -1)
+		if (dmx_ioctl(dmxfd, DMX_SET_BUFFER_SIZE,
+			      (void *)(long)buffersize) == -1)
 			perror("DMX_SET_BUFFER_SIZE failed");
 	}
 
@@ -112,7 +128,7 @@ int dvb_set_pesfilter(int dmxfd, int pid, dmx_pes_type_t type,
 	pesfilter.pes_type = type;
 	pesfilter.flags = DMX_IMMEDIATE_START;
 
-	if (xioctl(dmxfd, DMX_SET_PES_FILTER, &pesfilter) == -1) {
+	if (dmx_ioctl(dmxfd, DMX_SET_PES_FILTER, &pesfilter) == -1) {
 		fprintf(stderr, "DMX_SET_PES_FILTER failed "
 		"(PID = 0x%04x): %d %m\n", pid, errno);
 		return -1;
@@ -145,7 +161,7 @@ int dvb_set_section_filter(int dmxfd, int pid, unsigned filtsize,
 
 	sctfilter.flags = flags;
 
-	if (xioctl(dmxfd, DMX_SET_FILTER, &sctfilter) == -1) {
+	if (dmx_ioctl(dmxfd, DMX_SET_FILTER, &sctfilter) == -1) {
 		fprintf(stderr, "DMX_SET_FILTER failed (PID = 0x%04x): %d %m\n",
 			pid, errno);
 		return -1;
@@ -171,7 +187,7 @@ int dvb_get_pmt_pid(int patfd, int sid)
 	f.timeout = 0;
 	f.flags = DMX_IMMEDIATE_START | DMX_CHECK_CRC;
 
-	if (xioctl(patfd, DMX_SET_FILTER, &f) == -1) {
+	if (dmx_ioctl(patfd, DMX_SET_FILTER, &f) == -1) {
 		perror("ioctl DMX_SET_FILTER failed");
 		return -1;
 	}
@@ -180,7 +196,7 @@ int dvb_get_pmt_pid(int patfd, int sid)
 		if (((count = read(patfd, buf, sizeof(buft))) < 0) && errno == EOVERFLOW)
 			count = read(patfd, buf, sizeof(buft));
 
-		if (count < 0) {
+		if (count <= 0) {
 			perror("read_sections: read error");
 			return -1;
 		}
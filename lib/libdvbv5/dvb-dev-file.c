@@ -0,0 +1,786 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+/*
+ * Backend that takes the data from a recorded MPEG-TS file, instead of
+ * from the DVB devices, in order to parse it as fast as it can be read.
+ *
+ * There's a single adapter, with a frontend that is always locked, a
+ * dvr device that returns the whole file and demux devices. Each open
+ * demux is a SOCK_SEQPACKET socket, where a thread sends each section or
+ * PES packet that matches its filter, as a separate message, just like a
+ * read() of the Kernel demux returns them. When the file ends, the socket
+ * is shut down, so the reader sees a 0 sized read. The demux ioctls
+ * fail with ENOTTY on sockets, so dvb-demux.c emulates them with
+ * dvb_file_dmx_ioctl(), and the code that uses a demux file descriptor,
+ * like dvb_get_ts_tables() and dvb_epg_collect(), works unchanged.
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE_SOURCE 1
+#define _LARGEFILE64_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "dvb-fe-priv.h"
+#include "dvb-dev-priv.h"
+#include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-ts-demux.h>
+#include <libdvbv5/dvb-v5-std.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+#else
+# define _(string) string
+#endif
+
+/* taken from glibc unistd.h */
+#ifndef TEMP_FAILURE_RETRY
+#define TEMP_FAILURE_RETRY(expression) \
+    ({ long int __result;                                                     \
+       do __result = (long int) (expression);                                 \
+       while (__result == -1L && errno == EINTR);                             \
+       __result; })
+#endif
+
+#define FILE_FEED_SIZE		(188 * 1024)	/* fed to the demux at once */
+#define FILE_SEND_POLL_MS	100		/* to notice a stop request */
+#define FILE_ALL_PIDS		0x2000
+
+/* Delivery systems accepted by the frontend, as the file has no tuning */
+static const fe_delivery_system_t file_systems[] = {
+	SYS_DVBT, SYS_DVBT2, SYS_DVBC_ANNEX_A, SYS_DVBC_ANNEX_C,
+	SYS_DVBS, SYS_DVBS2, SYS_ISDBT, SYS_ATSC, SYS_DVBC_ANNEX_B,
+	SYS_DTMB,
+};
+
+struct dvb_dev_file_priv {
+	char *fname;
+	const uint8_t *data;
+	size_t size;
+};
+
+struct dvb_file_dmx {
+	struct dvb_open_descriptor open_dev;	/* open_dev.fd is sock[0] */
+	struct dvb_file_dmx *next;		/* see file_dmx_list */
+	struct dvb_dev_file_priv *file;
+	int sock[2];
+
+	pthread_t thread;
+	int running, stop;
+
+	/* Filter set by DMX_SET_FILTER or DMX_SET_PES_FILTER */
+	enum dvb_ts_filter_type type;
+	uint16_t pid;
+	uint8_t filter[DMX_FILTER_SIZE], mask[DMX_FILTER_SIZE];
+	uint8_t mode[DMX_FILTER_SIZE];
+};
+
+/* Open demuxes, to find them by file descriptor at dvb_file_dmx_ioctl() */
+static struct dvb_file_dmx *file_dmx_list;
+static pthread_mutex_t file_dmx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Sends a message to the reader, waiting if the socket is full, but
+ * giving up if the demux is stopped.
+ */
+static int file_dmx_send(struct dvb_file_dmx *dmx, const uint8_t *buf,
+			 size_t len)
+{
+	struct pollfd fds = { .fd = dmx->sock[1], .events = POLLOUT };
+
+	while (!dmx->stop) {
+		if (send(dmx->sock[1], buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+			return 0;
+		if (errno != EAGAIN && errno != EINTR)
+			return -errno;
+		poll(&fds, 1, FILE_SEND_POLL_MS);
+	}
+	return -EINTR;
+}
+
+/*
+ * Section filters work like the Kernel ones: the first byte of the
+ * filter is for the table ID, and the next ones for the bytes after the
+ * section length. The bits set on mode should not match.
+ */
+static int file_dmx_match(struct dvb_file_dmx *dmx, const uint8_t *buf,
+			  size_t len)
+{
+	int i, pos, has_neg = 0, neq = 0;
+	uint8_t diff;
+
+	for (i = 0; i < DMX_FILTER_SIZE; i++) {
+		if (!dmx->mask[i])
+			continue;
+		pos = i ? i + 2 : 0;
+		if (pos >= len)
+			return 0;
+		diff = (buf[pos] ^ dmx->filter[i]) & dmx->mask[i];
+		if (diff & ~dmx->mode[i])
+			return 0;
+		if (dmx->mask[i] & dmx->mode[i]) {
+			has_neg = 1;
+			if (diff & dmx->mode[i])
+				neq = 1;
+		}
+	}
+	return !has_neg || neq;
+}
+
+static void file_dmx_deliver(void *priv, uint16_t pid, const uint8_t *buf,
+			     size_t len)
+{
+	struct dvb_file_dmx *dmx = priv;
+
+	if (dmx->type == DVB_TS_FILTER_SECTION && !file_dmx_match(dmx, buf, len))
+		return;
+	file_dmx_send(dmx, buf, len);
+}
+
+static void *file_dmx_thread(void *priv)
+{
+	struct dvb_file_dmx *dmx = priv;
+	struct dvb_dev_file_priv *file = dmx->file;
+	struct dvb_ts_demux *ts;
+	size_t pos, n;
+	int pid, ret = 0;
+
+	ts = dvb_ts_demux_alloc(NULL);
+	if (!ts)
+		goto eof;
+
+	if (dmx->pid == FILE_ALL_PIDS) {
+		for (pid = 0; pid < FILE_ALL_PIDS && !ret; pid++)
+			ret = dvb_ts_demux_add_filter(ts, pid, dmx->type,
+						      file_dmx_deliver, dmx);
+	} else {
+		ret = dvb_ts_demux_add_filter(ts, dmx->pid, dmx->type,
+					      file_dmx_deliver, dmx);
+	}
+
+	for (pos = 0; !ret && pos < file->size && !dmx->stop; pos += n) {
+		n = file->size - pos;
+		if (n > FILE_FEED_SIZE)
+			n = FILE_FEED_SIZE;
+		dvb_ts_demux_feed(ts, file->data + pos, n);
+	}
+	dvb_ts_demux_free(ts);
+
+eof:
+	/* From now on, read() returns 0 */
+	shutdown(dmx->sock[1], SHUT_WR);
+	return NULL;
+}
+
+/*
+ * Replaces the socket pair under the same file descriptor, discarding
+ * what was not read, as the Kernel does.
+ */
+static int file_dmx_reset(struct dvb_file_dmx *dmx)
+{
+	int sock[2], flags;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock) < 0)
+		return -errno;
+
+	flags = fcntl(dmx->sock[0], F_GETFL);
+	if (flags >= 0 && (flags & O_NONBLOCK))
+		fcntl(sock[0], F_SETFL, O_NONBLOCK);
+
+	if (dup3(sock[0], dmx->sock[0], O_CLOEXEC) < 0) {
+		close(sock[0]);
+		close(sock[1]);
+		return -errno;
+	}
+	close(sock[0]);
+	close(dmx->sock[1]);
+	dmx->sock[1] = sock[1];
+
+	return 0;
+}
+
+static void file_dmx_stop(struct dvb_file_dmx *dmx)
+{
+	if (!dmx->running)
+		return;
+
+	dmx->stop = 1;
+	pthread_join(dmx->thread, NULL);
+	dmx->running = 0;
+	dmx->stop = 0;
+
+	file_dmx_reset(dmx);
+}
+
+static int file_dmx_start(struct dvb_file_dmx *dmx)
+{
+	int ret;
+
+	file_dmx_stop(dmx);
+
+	ret = pthread_create(&dmx->thread, NULL, file_dmx_thread, dmx);
+	if (ret)
+		return -ret;
+	dmx->running = 1;
+
+	return 0;
+}
+
+int dvb_file_dmx_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct dmx_sct_filter_params *sct = arg;
+	struct dmx_pes_filter_params *pes = arg;
+	struct dvb_file_dmx *dmx;
+	int ret = 0;
+
+	pthread_mutex_lock(&file_dmx_lock);
+	for (dmx = file_dmx_list; dmx; dmx = dmx->next)
+		if (dmx->open_dev.fd == fd)
+			break;
+	pthread_mutex_unlock(&file_dmx_lock);
+	if (!dmx) {
+		errno = ENOTTY;
+		return -1;
+	}
+
+	switch (request) {
+	case DMX_SET_FILTER:
+		file_dmx_stop(dmx);
+		dmx->type = DVB_TS_FILTER_SECTION;
+		dmx->pid = sct->pid;
+		memcpy(dmx->filter, sct->filter.filter, DMX_FILTER_SIZE);
+		memcpy(dmx->mask, sct->filter.mask, DMX_FILTER_SIZE);
+		memcpy(dmx->mode, sct->filter.mode, DMX_FILTER_SIZE);
+		if (sct->flags & DMX_IMMEDIATE_START)
+			ret = file_dmx_start(dmx);
+		break;
+	case DMX_SET_PES_FILTER:
+		file_dmx_stop(dmx);
+		switch (pes->output) {
+		case DMX_OUT_TAP:
+			dmx->type = DVB_TS_FILTER_PES;
+			break;
+		case DMX_OUT_TSDEMUX_TAP:
+			dmx->type = DVB_TS_FILTER_TS;
+			break;
+		case DMX_OUT_TS_TAP:
+			/* The dvr device already returns the whole file */
+			return 0;
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		if (ret)
+			break;
+		dmx->pid = pes->pid;
+		memset(dmx->mask, 0, DMX_FILTER_SIZE);
+		if (pes->flags & DMX_IMMEDIATE_START)
+			ret = file_dmx_start(dmx);
+		break;
+	case DMX_START:
+		ret = file_dmx_start(dmx);
+		break;
+	case DMX_STOP:
+		file_dmx_stop(dmx);
+		break;
+	case DMX_SET_BUFFER_SIZE:
+		break;
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+static int dvb_file_find(struct dvb_device_priv *dvb,
+			 dvb_dev_change_t handler, void *user_priv)
+{
+	static const enum dvb_dev_type types[] = {
+		DVB_DEVICE_FRONTEND, DVB_DEVICE_DEMUX, DVB_DEVICE_DVR,
+	};
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_dev_list *dev;
+	int i;
+
+	if (dvb->d.num_devices)
+		dvb_dev_free_devices(dvb);
+
+	dvb->d.devices = calloc(ARRAY_SIZE(types), sizeof(*dvb->d.devices));
+	if (!dvb->d.devices)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(types); i++) {
+		dev = &dvb->d.devices[dvb->d.num_devices++];
+		dev->dvb_type = types[i];
+		if (asprintf(&dev->sysname, "dvb0.%s0",
+			     dev_type_names[types[i]]) < 0) {
+			dev->sysname = NULL;
+			dvb_dev_free_devices(dvb);
+			return -ENOMEM;
+		}
+		dev->path = strdup(priv->fname);
+		dev->bus_addr = strdup("file");
+		if (!dev->path || !dev->bus_addr) {
+			dvb_dev_free_devices(dvb);
+			return -ENOMEM;
+		}
+		if (handler)
+			handler(strdup(dev->sysname), DVB_DEV_ADD, user_priv);
+	}
+
+	return 0;
+}
+
+static struct dvb_dev_list *dvb_file_get_dev_info(struct dvb_device_priv *dvb,
+						  const char *sysname)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	int i;
+
+	if (!sysname) {
+		dvb_logerr(_("Device not specified"));
+		return NULL;
+	}
+
+	for (i = 0; i < dvb->d.num_devices; i++) {
+		if (!strcmp(sysname, dvb->d.devices[i].sysname))
+			return &dvb->d.devices[i];
+	}
+
+	dvb_logerr(_("Can't find device %s"), sysname);
+	return NULL;
+}
+
+static struct dvb_dev_list *dvb_file_seek_by_adapter(struct dvb_device_priv *dvb,
+						     unsigned int adapter,
+						     unsigned int num,
+						     enum dvb_dev_type type)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	int i;
+
+	if (adapter || num) {
+		dvb_logwarn(_("device dvb%d.%s%d not found"), adapter,
+			    dev_type_names[type], num);
+		return NULL;
+	}
+
+	for (i = 0; i < dvb->d.num_devices; i++) {
+		if (dvb->d.devices[i].dvb_type == type) {
+			dvb_dev_dump_device(_("Selected dvb %s device: %s"),
+					    parms, &dvb->d.devices[i]);
+			return &dvb->d.devices[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void dvb_file_fe_open(struct dvb_v5_fe_parms_priv *parms)
+{
+	int i;
+
+	memset(&parms->p.info, 0, sizeof(parms->p.info));
+	snprintf(parms->p.info.name, sizeof(parms->p.info.name),
+		 "MPEG-TS file");
+	parms->p.info.frequency_max = UINT32_MAX;
+	parms->p.info.symbol_rate_max = UINT32_MAX;
+	parms->p.info.caps = FE_CAN_INVERSION_AUTO | FE_CAN_FEC_AUTO |
+			     FE_CAN_QAM_AUTO | FE_CAN_TRANSMISSION_MODE_AUTO |
+			     FE_CAN_GUARD_INTERVAL_AUTO |
+			     FE_CAN_HIERARCHY_AUTO | FE_CAN_2G_MODULATION |
+			     FE_CAN_MULTISTREAM;
+
+	parms->p.version = 0x50a;	/* DVBv5.10 */
+	parms->p.has_v5_stats = 0;
+	parms->p.num_systems = ARRAY_SIZE(file_systems);
+	for (i = 0; i < ARRAY_SIZE(file_systems); i++)
+		parms->p.systems[i] = file_systems[i];
+	parms->p.current_sys = file_systems[0];
+	parms->n_props = dvb_add_parms_for_sys(&parms->p, parms->p.current_sys);
+	parms->n_last_props = 0;
+	dvb_fe_prepare_stats(parms);
+}
+
+static struct dvb_open_descriptor *dvb_file_open(struct dvb_device_priv *dvb,
+						 const char *sysname, int flags)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *open_dev, *cur;
+	struct dvb_file_dmx *dmx = NULL;
+	struct dvb_dev_list *dev;
+
+	dev = dvb_file_get_dev_info(dvb, sysname);
+	if (!dev)
+		return NULL;
+
+	switch (dev->dvb_type) {
+	case DVB_DEVICE_DEMUX:
+		dmx = calloc(1, sizeof(*dmx));
+		if (!dmx)
+			return NULL;
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+			       dmx->sock) < 0) {
+			dvb_perror("socketpair()");
+			free(dmx);
+			return NULL;
+		}
+		if (flags & O_NONBLOCK)
+			fcntl(dmx->sock[0], F_SETFL, O_NONBLOCK);
+		dmx->file = priv;
+		open_dev = &dmx->open_dev;
+		open_dev->fd = dmx->sock[0];
+		break;
+	case DVB_DEVICE_DVR:
+		open_dev = calloc(1, sizeof(*open_dev));
+		if (!open_dev)
+			return NULL;
+		open_dev->fd = open(priv->fname, O_RDONLY | O_CLOEXEC |
+					(flags & O_NONBLOCK));
+		if (open_dev->fd < 0) {
+			dvb_logerr(_("Can't open %s: %m"), priv->fname);
+			free(open_dev);
+			return NULL;
+		}
+		break;
+	default:
+		open_dev = calloc(1, sizeof(*open_dev));
+		if (!open_dev)
+			return NULL;
+		open_dev->fd = -1;
+		dvb_file_fe_open(parms);
+		break;
+	}
+
+	open_dev->pipe_fd[0] = -1;
+	open_dev->pipe_fd[1] = -1;
+	open_dev->dev = dev;
+	open_dev->dvb = dvb;
+
+	if (dmx) {
+		pthread_mutex_lock(&file_dmx_lock);
+		dmx->next = file_dmx_list;
+		file_dmx_list = dmx;
+		pthread_mutex_unlock(&file_dmx_lock);
+	}
+
+	cur = &dvb->open_list;
+	while (cur->next)
+		cur = cur->next;
+	cur->next = open_dev;
+
+	return open_dev;
+}
+
+static int dvb_file_close(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_file_dmx *dmx = NULL, **p;
+	struct dvb_open_descriptor *cur;
+
+	switch (open_dev->dev->dvb_type) {
+	case DVB_DEVICE_DEMUX:
+		dmx = (struct dvb_file_dmx *)open_dev;
+		file_dmx_stop(dmx);
+
+		pthread_mutex_lock(&file_dmx_lock);
+		for (p = &file_dmx_list; *p; p = &(*p)->next) {
+			if (*p == dmx) {
+				*p = dmx->next;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&file_dmx_lock);
+
+		close(dmx->sock[0]);
+		close(dmx->sock[1]);
+		break;
+	case DVB_DEVICE_DVR:
+		close(open_dev->fd);
+		break;
+	default:
+		break;
+	}
+
+	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
+		if (cur->next == open_dev) {
+			cur->next = open_dev->next;
+			free(open_dev);
+			return 0;
+		}
+	}
+
+	/* Should never happen */
+	dvb_logerr(_("Couldn't free device\n"));
+
+	return -ENODEV;
+}
+
+static int dvb_file_dmx_stop(struct dvb_open_descriptor *open_dev)
+{
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	file_dmx_stop((struct dvb_file_dmx *)open_dev);
+	return 0;
+}
+
+static int dvb_file_set_bufsize(struct dvb_open_descriptor *open_dev,
+				int buffersize)
+{
+	return 0;
+}
+
+static ssize_t dvb_file_read(struct dvb_open_descriptor *open_dev,
+			     void *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = TEMP_FAILURE_RETRY(read(open_dev->fd, buf, count));
+	if (ret == -1)
+		return -errno;
+
+	return ret;
+}
+
+static int dvb_file_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
+				      int pid, dmx_pes_type_t type,
+				      dmx_output_t output, int bufsize)
+{
+	struct dmx_pes_filter_params pes = {
+		.pid = pid,
+		.input = DMX_IN_FRONTEND,
+		.output = output,
+		.pes_type = type,
+		.flags = DMX_IMMEDIATE_START,
+	};
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	if (dvb_file_dmx_ioctl(open_dev->fd, DMX_SET_PES_FILTER, &pes) == -1)
+		return -errno;
+
+	return 0;
+}
+
+static int dvb_file_dmx_set_section_filter(struct dvb_open_descriptor *open_dev,
+					   int pid, unsigned filtsize,
+					   unsigned char *filter,
+					   unsigned char *mask,
+					   unsigned char *mode,
+					   unsigned int flags)
+{
+	struct dmx_sct_filter_params sct = {
+		.pid = pid,
+		.flags = flags,
+	};
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	if (filtsize > DMX_FILTER_SIZE)
+		filtsize = DMX_FILTER_SIZE;
+	if (filter)
+		memcpy(sct.filter.filter, filter, filtsize);
+	if (mask)
+		memcpy(sct.filter.mask, mask, filtsize);
+	if (mode)
+		memcpy(sct.filter.mode, mode, filtsize);
+
+	if (dvb_file_dmx_ioctl(open_dev->fd, DMX_SET_FILTER, &sct) == -1)
+		return -errno;
+
+	return 0;
+}
+
+static int dvb_file_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev,
+				    int sid)
+{
+	/* dvb-demux.c emulates the ioctls for the file demuxes */
+	return dvb_get_pmt_pid(open_dev->fd, sid);
+}
+
+static struct dvb_v5_descriptors *dvb_file_scan(struct dvb_open_descriptor *open_dev,
+						struct dvb_entry *entry,
+						check_frontend_t *check_frontend,
+						void *args,
+						unsigned other_nit,
+						unsigned timeout_multiply)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX) {
+		dvb_logerr(_("dvb_dev_scan: expecting a demux descriptor"));
+		return NULL;
+	}
+
+	return dvb_scan_transponder(dvb->d.fe_parms, entry, open_dev->fd,
+				    check_frontend, args, other_nit,
+				    timeout_multiply);
+}
+
+static int dvb_file_fe_set_sys(struct dvb_v5_fe_parms *p,
+			       fe_delivery_system_t sys)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	int rc;
+
+	rc = dvb_add_parms_for_sys(&parms->p, sys);
+	if (rc < 0)
+		return -EINVAL;
+
+	parms->p.current_sys = sys;
+	parms->n_props = rc;
+
+	return 0;
+}
+
+static int dvb_file_fe_get_parms(struct dvb_v5_fe_parms *p)
+{
+	return 0;
+}
+
+/* The tuning parameters are kept, as they're the ones of the recording */
+static int dvb_file_fe_set_parms(struct dvb_v5_fe_parms *p)
+{
+	return 0;
+}
+
+static int dvb_file_fe_get_stats(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+
+	dvb_fe_store_stats(parms, DTV_STATUS, FE_SCALE_RELATIVE, 0,
+			   FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI |
+			   FE_HAS_SYNC | FE_HAS_LOCK);
+	return 0;
+}
+
+static void dvb_dev_file_free(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_file_priv *priv = dvb->priv;
+
+	if (!priv)
+		return;
+	if (priv->data)
+		munmap((void *)priv->data, priv->size);
+	free(priv->fname);
+	free(priv);
+	dvb->priv = NULL;
+}
+
+static int dvb_file_get_fd(struct dvb_open_descriptor *open_dev)
+{
+	return open_dev->fd;
+}
+
+int dvb_dev_file_init(struct dvb_device *d, const char *fname)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_file_priv *priv;
+	struct stat st;
+	int fd, ret;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+		dvb_logerr(_("Can't open %s: %m"), fname);
+		return ret;
+	}
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		ret = st.st_size ? -errno : -EINVAL;
+		dvb_logerr(_("%s is empty or can't be read"), fname);
+		close(fd);
+		return ret;
+	}
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		close(fd);
+		return -ENOMEM;
+	}
+	priv->size = st.st_size;
+	priv->fname = strdup(fname);
+	priv->data = mmap(NULL, priv->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (priv->data == MAP_FAILED) {
+		ret = -errno;
+		dvb_perror("mmap()");
+		free(priv->fname);
+		free(priv);
+		return ret;
+	}
+	/* Each demux filter reads it from the start */
+	madvise((void *)priv->data, priv->size, MADV_SEQUENTIAL);
+
+	/* Call an implementation-specific free method, if defined */
+	if (ops->free)
+		ops->free(dvb);
+	if (dvb->d.num_devices)
+		dvb_dev_free_devices(dvb);
+
+	memset(ops, 0, sizeof(*ops));
+	dvb->priv = priv;
+
+	ops->find = dvb_file_find;
+	ops->seek_by_adapter = dvb_file_seek_by_adapter;
+	ops->get_dev_info = dvb_file_get_dev_info;
+	ops->open = dvb_file_open;
+	ops->close = dvb_file_close;
+	ops->get_fd = dvb_file_get_fd;
+
+	ops->dmx_stop = dvb_file_dmx_stop;
+	ops->set_bufsize = dvb_file_set_bufsize;
+	ops->read = dvb_file_read;
+	ops->dmx_set_pesfilter = dvb_file_dmx_set_pesfilter;
+	ops->dmx_set_section_filter = dvb_file_dmx_set_section_filter;
+	ops->dmx_get_pmt_pid = dvb_file_dmx_get_pmt_pid;
+
+	ops->scan = dvb_file_scan;
+
+	ops->fe_set_sys = dvb_file_fe_set_sys;
+	ops->fe_get_parms = dvb_file_fe_get_parms;
+	ops->fe_set_parms = dvb_file_fe_set_parms;
+	ops->fe_get_stats = dvb_file_fe_get_stats;
+
+	ops->free = dvb_dev_file_free;
+
+	return 0;
+}
@@ -26,6 +26,8 @@
 #include <locale.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #ifdef HAVE_PTHREAD
 #  include <pthread.h>
@@ -65,8 +67,103 @@ struct dvb_dev_local_priv {
 
 	/* private user data, used by event notifier*/
 	void *user_priv;
+
+	/*
+	 * Hash table of dvb->d.devices by sysname, which also encodes the
+	 * adapter, device type and number. Each slot holds the index of a
+	 * device plus one, or 0 if the slot is free.
+	 */
+	unsigned int *index;
+	unsigned int index_size;
 };
 
+static unsigned int dev_index_hash(const char *sysname)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*sysname)
+		hash = (hash ^ (unsigned char)*sysname++) * 16777619u;
+	return hash;
+}
+
+static void dev_index_insert(struct dvb_dev_local_priv *priv,
+			     const char *sysname, unsigned int i)
+{
+	unsigned int slot = dev_index_hash(sysname) & (priv->index_size - 1);
+
+	while (priv->index[slot])
+		slot = (slot + 1) & (priv->index_size - 1);
+	priv->index[slot] = i + 1;
+}
+
+/*
+ * Rebuild the index from scratch, keeping it at most half full. Called
+ * when a device is removed, as that moves the devices after it.
+ */
+static void dev_index_rebuild(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_local_priv *priv = dvb->priv;
+	unsigned int size = 16;
+	int i;
+
+	while (size < 2 * dvb->d.num_devices)
+		size *= 2;
+
+	if (size != priv->index_size) {
+		unsigned int *index = realloc(priv->index, size * sizeof(*index));
+
+		if (!index) {
+			/* Lookups fall back to a linear search */
+			free(priv->index);
+			priv->index = NULL;
+			priv->index_size = 0;
+			return;
+		}
+		priv->index = index;
+		priv->index_size = size;
+	}
+	memset(priv->index, 0, priv->index_size * sizeof(*priv->index));
+
+	for (i = 0; i < dvb->d.num_devices; i++)
+		dev_index_insert(priv, dvb->d.devices[i].sysname, i);
+}
+
+/* Add the last device of dvb->d.devices to the index */
+static void dev_index_add(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_local_priv *priv = dvb->priv;
+	int i = dvb->d.num_devices - 1;
+
+	if (!priv->index || priv->index_size < 2 * dvb->d.num_devices)
+		dev_index_rebuild(dvb);
+	else
+		dev_index_insert(priv, dvb->d.devices[i].sysname, i);
+}
+
+static struct dvb_dev_list *dev_index_find(struct dvb_device_priv *dvb,
+					   const char *sysname)
+{
+	struct dvb_dev_local_priv *priv = dvb->priv;
+	unsigned int slot;
+	int i;
+
+	if (!priv->index) {
+		for (i = 0; i < dvb->d.num_devices; i++)
+			if (!strcmp(sysname, dvb->d.devices[i].sysname))
+				return &dvb->d.devices[i];
+		return NULL;
+	}
+
+	slot = dev_index_hash(sysname) & (priv->index_size - 1);
+	for (; priv->index[slot]; slot = (slot + 1) & (priv->index_size - 1)) {
+		i = priv->index[slot] - 1;
+		if (i < dvb->d.num_devices &&
+		    !strcmp(sysname, dvb->d.devices[i].sysname))
+			return &dvb->d.devices[i];
+	}
+	return NULL;
+}
+
 static int handle_device_change(struct dvb_device_priv *dvb,
 				struct udev_device *dev,
 				const char *syspath,
@@ -92,26 +189,27 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 			return -ENODEV;
 		}
 
-		for (i = 0; i < dvb->d.num_devices; i++) {
-			if (!strcmp(sysname, dvb->d.devices[i].sysname)) {
-				memmove(&dvb->d.devices[i],
-					&dvb->d.devices[i + 1],
-					sizeof(*dvb->d.devices) * (dvb->d.num_devices - i));
-				dvb->d.num_devices--;
-
-				if (!dvb->d.num_devices) {
-					free(dvb->d.devices);
-					dvb->d.devices = NULL;
-				} else {
-					d = realloc(dvb->d.devices,
-						    sizeof(*dvb->d.devices) * dvb->d.num_devices);
-					if (!d) {
-						dvb_logerr(_("Can't remove a device from the list of DVB devices"));
-						return -ENODEV;
-					}
+		d = dev_index_find(dvb, sysname);
+		if (d) {
+			i = d - dvb->d.devices;
+			memmove(&dvb->d.devices[i],
+				&dvb->d.devices[i + 1],
+				sizeof(*dvb->d.devices) * (dvb->d.num_devices - i - 1));
+			dvb->d.num_devices--;
+
+			if (!dvb->d.num_devices) {
+				free(dvb->d.devices);
+				dvb->d.devices = NULL;
+			} else {
+				d = realloc(dvb->d.devices,
+					    sizeof(*dvb->d.devices) * dvb->d.num_devices);
+				if (d)
 					dvb->d.devices = d;
-				}
-				break;
+			}
+			dev_index_rebuild(dvb);
+			if (dvb->d.num_devices && !d) {
+				dvb_logerr(_("Can't remove a device from the list of DVB devices"));
+				return -ENODEV;
 			}
 		}
 
@@ -205,6 +303,7 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 	dvb->d.devices = dvb_dev;
 	dvb->d.devices[dvb->d.num_devices - 1] = dev_list;
 	dvb_dev = &dvb->d.devices[dvb->d.num_devices - 1];
+	dev_index_add(dvb);
 
 	/* Get optional per-bus fields associated with the device parent */
 	if (!strcmp(bus_type, "pci")) {
@@ -295,8 +394,14 @@ static void *monitor_device_changes(void *privdata)
 }
 #endif
 
-static int dvb_local_find(struct dvb_device_priv *dvb,
-			  dvb_dev_change_t handler, void *user_priv)
+/*
+ * Enumerate the devices in the 'dvb' subsystem. If sysname_match is not
+ * NULL, only the devices whose sysname matches that glob pattern are
+ * looked at, which saves reading the udev properties of all others.
+ */
+static int dvb_local_enumerate(struct dvb_device_priv *dvb,
+			       dvb_dev_change_t handler, void *user_priv,
+			       const char *sysname_match)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct dvb_dev_local_priv *priv = dvb->priv;
@@ -307,6 +412,7 @@ static int dvb_local_find(struct dvb_device_priv *dvb,
 	/* Free a previous list of devices */
 	if (dvb->d.num_devices)
 		dvb_dev_free_devices(dvb);
+	dev_index_rebuild(dvb);
 
 	/* Create the udev object */
 	priv->udev = udev_new();
@@ -333,6 +439,8 @@ static int dvb_local_find(struct dvb_device_priv *dvb,
 	/* Create a list of the devices in the 'dvb' subsystem. */
 	enumerate = udev_enumerate_new(priv->udev);
 	udev_enumerate_add_match_subsystem(enumerate, "dvb");
+	if (sysname_match)
+		udev_enumerate_add_match_sysname(enumerate, sysname_match);
 	udev_enumerate_scan_devices(enumerate);
 	devices = udev_enumerate_get_list_entry(enumerate);
 
@@ -370,6 +478,21 @@ static int dvb_local_find(struct dvb_device_priv *dvb,
 	return 0;
 }
 
+static int dvb_local_find(struct dvb_device_priv *dvb,
+			  dvb_dev_change_t handler, void *user_priv)
+{
+	return dvb_local_enumerate(dvb, handler, user_priv, NULL);
+}
+
+static int dvb_local_find_adapter(struct dvb_device_priv *dvb,
+				  unsigned int adapter)
+{
+	char match[32];
+
+	snprintf(match, sizeof(match), "dvb%u.*", adapter);
+	return dvb_local_enumerate(dvb, NULL, NULL, match);
+}
+
 static int dvb_local_stop_monitor(struct dvb_device_priv *dvb)
 {
 #ifdef HAVE_PTHREAD
@@ -390,7 +513,8 @@ struct dvb_dev_list *dvb_local_seek_by_adapter(struct dvb_device_priv *dvb,
 					       enum dvb_dev_type type)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	int ret, i;
+	struct dvb_dev_list *dev;
+	int ret;
 	char *p;
 
 	if (type > dev_type_names_size){
@@ -404,13 +528,12 @@ struct dvb_dev_list *dvb_local_seek_by_adapter(struct dvb_device_priv *dvb,
 			   errno);
 		return NULL;
 	}
-	for (i = 0; i < dvb->d.num_devices; i++) {
-		if (!strcmp(p, dvb->d.devices[i].sysname)) {
-			free(p);
-			dvb_dev_dump_device(_("Selected dvb %s device: %s"),
-					    parms, &dvb->d.devices[i]);
-			return &dvb->d.devices[i];
-		}
+	dev = dev_index_find(dvb, p);
+	if (dev) {
+		free(p);
+		dvb_dev_dump_device(_("Selected dvb %s device: %s"),
+				    parms, dev);
+		return dev;
 	}
 
 	dvb_logwarn(_("device %s not found"), p);
@@ -421,18 +544,16 @@ struct dvb_dev_list *dvb_local_get_dev_info(struct dvb_device_priv *dvb,
 					    const char *sysname)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	int i;
+	struct dvb_dev_list *dev;
 
 	if (!sysname) {
 		dvb_logerr(_("Device not specified"));
 		return NULL;
 	}
 
-	for (i = 0; i < dvb->d.num_devices; i++) {
-		if (!strcmp(sysname, dvb->d.devices[i].sysname)) {
-			return &dvb->d.devices[i];
-		}
-	}
+	dev = dev_index_find(dvb, sysname);
+	if (dev)
+		return dev;
 
 	dvb_logerr(_("Can't find device %s"), sysname);
 	return NULL;
@@ -493,6 +614,8 @@ static struct dvb_open_descriptor
 
 	/* Add the fd to the open descriptor's list */
 	open_dev->fd = ret;
+	open_dev->pipe_fd[0] = -1;
+	open_dev->pipe_fd[1] = -1;
 	open_dev->dev = dev;
 	open_dev->dvb = dvb;
 
@@ -517,7 +640,12 @@ static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 		if (dev->dvb_type == DVB_DEVICE_DEMUX)
 			dvb_dev_dmx_stop(open_dev);
 
+		dvb_dev_mmap_stop(open_dev);
 		close(open_dev->fd);
+		if (open_dev->pipe_fd[0] >= 0) {
+			close(open_dev->pipe_fd[0]);
+			close(open_dev->pipe_fd[1]);
+		}
 	}
 
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
@@ -640,6 +768,214 @@ static ssize_t dvb_local_read(struct dvb_open_descriptor *open_dev,
 	return ret;
 }
 
+/*
+ * Moves data from the device to fd through a pipe, with splice(), in
+ * order to avoid copying it to userspace and back. Returns -EOPNOTSUPP
+ * if the device driver doesn't support it, as the caller is expected to
+ * fall back to read() and write().
+ */
+static ssize_t dvb_local_splice(struct dvb_open_descriptor *open_dev,
+				int out_fd, size_t count)
+{
+	struct dvb_dev_list *dev = open_dev->dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	int fd = open_dev->fd;
+	ssize_t ret, left, w;
+
+	if (dev->dvb_type != DVB_DEVICE_DEMUX && dev->dvb_type != DVB_DEVICE_DVR) {
+		dvb_logerr("Trying to read from an invalid device type on fd #%d", fd);
+		return -EINVAL;
+	}
+
+	/* dvbloopback is opened on non-blocking mode. See dvb_local_read() */
+	if (!strcmp(dev->bus_addr, "platform:dvbloopback"))
+		return -EOPNOTSUPP;
+
+	if (open_dev->pipe_fd[0] < 0) {
+		if (pipe2(open_dev->pipe_fd, O_CLOEXEC) == -1) {
+			dvb_perror("pipe2()");
+			return -errno;
+		}
+		/* Not fatal: the pipe will just move less data per call */
+		fcntl(open_dev->pipe_fd[1], F_SETPIPE_SZ, (int)count);
+	}
+
+	ret = TEMP_FAILURE_RETRY(splice(fd, NULL, open_dev->pipe_fd[1], NULL,
+					count, SPLICE_F_MOVE));
+	if (ret == -1) {
+		if (errno == EINVAL || errno == ENOSYS)
+			return -EOPNOTSUPP;
+		if (errno != EOVERFLOW && errno != EAGAIN)
+			dvb_perror("splice()");
+		return -errno;
+	}
+
+	for (left = ret; left > 0; left -= w) {
+		w = TEMP_FAILURE_RETRY(splice(open_dev->pipe_fd[0], NULL,
+					      out_fd, NULL, left,
+					      SPLICE_F_MOVE | SPLICE_F_MORE));
+		if (w <= 0) {
+			if (w == 0)
+				errno = EIO;
+			dvb_perror("splice()");
+			return -errno;
+		}
+	}
+
+	return ret;
+}
+
+static void dvb_local_mmap_stop(struct dvb_open_descriptor *open_dev)
+{
+	struct dmx_requestbuffers req = {};
+	unsigned int i;
+
+	if (!open_dev->bufs)
+		return;
+
+	for (i = 0; i < open_dev->n_bufs; i++) {
+		if (open_dev->bufs[i].start)
+			munmap(open_dev->bufs[i].start, open_dev->bufs[i].length);
+	}
+	free(open_dev->bufs);
+	open_dev->bufs = NULL;
+	open_dev->n_bufs = 0;
+
+	/* Frees the buffers at the Kernel. Harmless if it fails */
+	ioctl(open_dev->fd, DMX_REQBUFS, &req);
+}
+
+/*
+ * Streaming with memory mapped buffers, filled by the Kernel without
+ * copying the data to userspace. The Kernel starts streaming when the
+ * first buffer is queued.
+ */
+static int dvb_local_mmap_start(struct dvb_open_descriptor *open_dev,
+				unsigned int size, unsigned int count)
+{
+	struct dvb_dev_list *dev = open_dev->dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_requestbuffers req = {
+		.count = count,
+		.size = size,
+	};
+	struct dmx_buffer b;
+	int fd = open_dev->fd;
+	unsigned int i;
+
+	if (dev->dvb_type != DVB_DEVICE_DEMUX && dev->dvb_type != DVB_DEVICE_DVR) {
+		dvb_logerr("Trying to stream from an invalid device type on fd #%d", fd);
+		return -EINVAL;
+	}
+
+	/* dvbloopback is opened on non-blocking mode. See dvb_local_read() */
+	if (!strcmp(dev->bus_addr, "platform:dvbloopback"))
+		return -EOPNOTSUPP;
+
+	if (open_dev->bufs)
+		return -EBUSY;
+
+	if (xioctl(fd, DMX_REQBUFS, &req) == -1) {
+		/* Kernels without CONFIG_DVB_MMAP */
+		if (errno == ENOTTY || errno == EINVAL)
+			return -EOPNOTSUPP;
+		dvb_perror(_("DMX_REQBUFS failed"));
+		return -errno;
+	}
+	if (!req.count)
+		return -ENOMEM;
+
+	open_dev->bufs = calloc(req.count, sizeof(*open_dev->bufs));
+	if (!open_dev->bufs) {
+		req.count = 0;
+		ioctl(fd, DMX_REQBUFS, &req);
+		return -ENOMEM;
+	}
+	open_dev->n_bufs = req.count;
+
+	for (i = 0; i < req.count; i++) {
+		memset(&b, 0, sizeof(b));
+		b.index = i;
+		if (xioctl(fd, DMX_QUERYBUF, &b) == -1) {
+			dvb_perror(_("DMX_QUERYBUF failed"));
+			goto error;
+		}
+		open_dev->bufs[i].start = mmap(NULL, b.length, PROT_READ,
+					       MAP_SHARED, fd, b.offset);
+		if (open_dev->bufs[i].start == MAP_FAILED) {
+			open_dev->bufs[i].start = NULL;
+			dvb_perror("mmap()");
+			goto error;
+		}
+		open_dev->bufs[i].length = b.length;
+	}
+
+	for (i = 0; i < req.count; i++) {
+		memset(&b, 0, sizeof(b));
+		b.index = i;
+		if (xioctl(fd, DMX_QBUF, &b) == -1) {
+			dvb_perror(_("DMX_QBUF failed"));
+			goto error;
+		}
+	}
+
+	return req.count;
+
+error:
+	i = errno;
+	dvb_local_mmap_stop(open_dev);
+	return -i;
+}
+
+static int dvb_local_dqbuf(struct dvb_open_descriptor *open_dev,
+			   struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_buffer b = {};
+
+	if (!open_dev->bufs)
+		return -EINVAL;
+
+	if (TEMP_FAILURE_RETRY(ioctl(open_dev->fd, DMX_DQBUF, &b)) == -1) {
+		if (errno != EAGAIN)
+			dvb_perror(_("DMX_DQBUF failed"));
+		return -errno;
+	}
+	if (b.index >= open_dev->n_bufs || b.bytesused > open_dev->bufs[b.index].length)
+		return -EIO;
+
+	buf->data = open_dev->bufs[b.index].start;
+	buf->bytesused = b.bytesused;
+	buf->index = b.index;
+	buf->flags = b.flags;
+	buf->count = b.count;
+
+	return 0;
+}
+
+static int dvb_local_qbuf(struct dvb_open_descriptor *open_dev,
+			  struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_buffer b = {
+		.index = buf->index,
+	};
+
+	if (!open_dev->bufs || buf->index >= open_dev->n_bufs)
+		return -EINVAL;
+
+	if (xioctl(open_dev->fd, DMX_QBUF, &b) == -1) {
+		dvb_perror(_("DMX_QBUF failed"));
+		return -errno;
+	}
+
+	return 0;
+}
+
 static int dvb_local_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
@@ -828,6 +1164,7 @@ static void dvb_dev_local_free(struct dvb_device_priv *dvb)
 
 	dvb_local_stop_monitor(dvb);
 
+	free(priv->index);
 	free(priv);
 }
 
@@ -844,6 +1181,7 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	dvb->priv = calloc(1, sizeof(struct dvb_dev_local_priv));
 
 	ops->find = dvb_local_find;
+	ops->find_adapter = dvb_local_find_adapter;
 	ops->seek_by_adapter = dvb_local_seek_by_adapter;
 	ops->get_dev_info = dvb_local_get_dev_info;
 	ops->stop_monitor = dvb_local_stop_monitor;
@@ -854,6 +1192,11 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->dmx_stop = dvb_local_dmx_stop;
 	ops->set_bufsize = dvb_local_set_bufsize;
 	ops->read = dvb_local_read;
+	ops->splice = dvb_local_splice;
+	ops->mmap_start = dvb_local_mmap_start;
+	ops->dqbuf = dvb_local_dqbuf;
+	ops->qbuf = dvb_local_qbuf;
+	ops->mmap_stop = dvb_local_mmap_stop;
 	ops->dmx_set_pesfilter = dvb_local_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_local_dmx_set_section_filter;
 	ops->dmx_get_pmt_pid = dvb_local_dmx_get_pmt_pid;
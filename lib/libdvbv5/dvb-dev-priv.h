@@ -24,8 +24,37 @@
 
 struct dvb_device_priv;
 
+/*
+ * Remote access protocol versions. The daemon tells the highest one it
+ * supports after its version string, on the daemon_get_version reply,
+ * and the client selects one with the daemon_set_protocol command:
+ *
+ * 1: all messages have a 32-bit size, followed by fields encoded by
+ *    prepare_data(), including data_read messages with demux/dvr data.
+ * 2: besides that, demux/dvr data is sent as binary frames: a 32-bit
+ *    size with REMOTE_DATA_FRAME set, the 32-bit uid and read() return
+ *    code, and up to REMOTE_DATA_SIZE bytes of data. All fields are
+ *    big endian. The size includes the uid and return code.
+ * 3: adds the fe_subscribe_stats command. After it, the daemon sends
+ *    fe_stats messages by itself, with the same contents as the
+ *    fe_get_stats reply.
+ */
+#define REMOTE_PROTOCOL_VERSION	3
+#define REMOTE_DATA_FRAME	0x80000000
+#define REMOTE_DATA_HDR_SIZE	8
+#define REMOTE_DATA_SIZE	(188 * 512)
+
+/* A buffer mapped by dvb_dev_mmap_start() */
+struct dvb_mmap_buf {
+	void *start;
+	size_t length;
+};
+
 struct dvb_open_descriptor {
 	int fd;
+	int pipe_fd[2];		/* used by dvb_dev_splice(). -1 if not open */
+	struct dvb_mmap_buf *bufs;	/* used by dvb_dev_mmap_start() */
+	unsigned int n_bufs;
 	struct dvb_dev_list *dev;
 	struct dvb_device_priv *dvb;
 	struct dvb_open_descriptor *next;
@@ -34,6 +63,7 @@ struct dvb_open_descriptor {
 struct dvb_dev_ops {
 	int (*find)(struct dvb_device_priv *dvb, dvb_dev_change_t handler,
 		    void *user_priv);
+	int (*find_adapter)(struct dvb_device_priv *dvb, unsigned int adapter);
 	struct dvb_dev_list * (*seek_by_adapter)(struct dvb_device_priv *dvb,
 						 unsigned int adapter,
 						 unsigned int num,
@@ -49,6 +79,15 @@ struct dvb_dev_ops {
 			   int buffersize);
 	ssize_t (*read)(struct dvb_open_descriptor *open_dev,
 			void *buf, size_t count);
+	ssize_t (*splice)(struct dvb_open_descriptor *open_dev,
+			  int fd, size_t count);
+	int (*mmap_start)(struct dvb_open_descriptor *open_dev,
+			  unsigned int size, unsigned int count);
+	int (*dqbuf)(struct dvb_open_descriptor *open_dev,
+		     struct dvb_dev_buffer *buf);
+	int (*qbuf)(struct dvb_open_descriptor *open_dev,
+		    struct dvb_dev_buffer *buf);
+	void (*mmap_stop)(struct dvb_open_descriptor *open_dev);
 	int (*dmx_set_pesfilter)(struct dvb_open_descriptor *open_dev,
 				 int pid, dmx_pes_type_t type,
 				 dmx_output_t output, int bufsize);
@@ -70,6 +109,8 @@ struct dvb_dev_ops {
 	int (*fe_get_parms)(struct dvb_v5_fe_parms *p);
 	int (*fe_set_parms)(struct dvb_v5_fe_parms *p);
 	int (*fe_get_stats)(struct dvb_v5_fe_parms *p);
+	int (*fe_subscribe_stats)(struct dvb_v5_fe_parms *p,
+				  unsigned int interval_ms);
 
 	void (*free)(struct dvb_device_priv *dvb);
 	int (*get_fd)(struct dvb_open_descriptor *dvb);
@@ -95,6 +136,9 @@ void dvb_dev_dump_device(char *msg,
 void free_dvb_dev(struct dvb_dev_list *dvb_dev);
 void dvb_dev_free_devices(struct dvb_device_priv *dvb);
 
+/* From dvb-dev-file.c */
+int dvb_file_dmx_ioctl(int fd, unsigned long request, void *arg);
+
 /* From dvb-dev-local.c */
 void dvb_dev_local_init(struct dvb_device_priv *dvb);
 
@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <resolv.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
 #include "dvb-fe-priv.h"
@@ -63,7 +64,21 @@ const char *daemon_version = "dvbv5-daemon version " V4L_UTILS_VERSION;
  * Internal data structures
  */
 
-#define RINGBUF_SIZE (REMOTE_BUF_SIZE * 32)
+/*
+ * The data received for each open device is stored on a single producer,
+ * single consumer ring: the receive thread writes to it, and
+ * dvb_dev_read() reads from it. Each counter is changed only by its
+ * owner, so no locks are needed. The reader sleeps on an eventfd while
+ * there's not enough data.
+ */
+
+#define RINGBUF_SIZE (512 * 1024)	/* Minimal size. A power of 2 */
+
+struct ringbuf_data {
+	size_t size;
+	size_t read, write;		/* Free running counters */
+	char buf[];
+};
 
 struct ringbuffer {
 	/* Should be the first member of struct */
@@ -71,9 +86,12 @@ struct ringbuffer {
 
 	/* ringbuffer handling */
 	int rc;
-	ssize_t read, write;
-	char buf[RINGBUF_SIZE];
-	pthread_mutex_t lock;
+	struct ringbuf_data *data;	/* Changed only by the receive thread */
+	struct ringbuf_data *pending;	/* Bigger ring, to replace data */
+	struct ringbuf_data *cur;	/* Ring in use by the reader */
+
+	int waiting;			/* The reader is sleeping on efd */
+	int efd;
 };
 
 #define CMD_SIZE	80
@@ -95,13 +113,19 @@ struct dvb_dev_remote_priv {
 	int fd;
 	struct sockaddr_in addr;
 
-	int seq, disconnected;
+	int seq, disconnected, protocol;
 
 	dvb_dev_change_t notify_dev_change;
 
 	pthread_t recv_id;
 	pthread_mutex_t lock_io;
 
+	/* Stats pushed by the daemon, after dvb_fe_subscribe_stats() */
+	pthread_mutex_t lock_stats;
+	struct dvb_v5_stats stats;
+	unsigned int stats_interval;
+	int has_stats;
+
 	char output_charset[256];
 	char default_charset[256];
 
@@ -517,16 +541,32 @@ static ssize_t scan_data(struct dvb_v5_fe_parms_priv *parms, char *buf,
 	return p - buf;
 }
 
-static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
+static void wake_ringbuffer(struct ringbuffer *ringbuf)
 {
+	uint64_t val = 1;
+
+	if (!__atomic_load_n(&ringbuf->waiting, __ATOMIC_SEQ_CST))
+		return;
+
+	if (write(ringbuf->efd, &val, sizeof(val)) < 0)
+		return;	/* Nothing to do: the reader will wait forever */
+}
+
+static void dvb_dev_remote_disconnect(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *cur;
 	struct queued_msg *msg;
 
-	priv->disconnected = 1;
+	__atomic_store_n(&priv->disconnected, 1, __ATOMIC_SEQ_CST);
 
 	for (msg = &priv->msgs; msg; msg = msg->next) {
 		msg->retval = -ENODEV;
 		pthread_cond_signal(&msg->cond);
 	}
+
+	for (cur = dvb->open_list.next; cur; cur = cur->next)
+		wake_ringbuffer((struct ringbuffer *)cur);
 	/* Close the socket */
 	if (priv->fd > 0) {
 		close(priv->fd);
@@ -534,70 +574,186 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 	}
 }
 
+static struct ringbuf_data *alloc_ringbuf_data(size_t size)
+{
+	struct ringbuf_data *data;
+	size_t len = RINGBUF_SIZE;
+
+	while (len < size)
+		len <<= 1;
+
+	data = calloc(1, sizeof(*data) + len);
+	if (data)
+		data->size = len;
+	return data;
+}
+
+/*
+ * Returns the ring where the receive thread should write "size" bytes,
+ * or NULL on buffer overflows.
+ */
+static struct ringbuf_data *get_write_ringbuf(struct ringbuffer *ringbuf,
+					      size_t size)
+{
+	struct ringbuf_data *data;
+	size_t read;
+
+	/* Switch to a new ring, if dvb_dev_set_bufsize() allocated one */
+	data = __atomic_exchange_n(&ringbuf->pending, NULL, __ATOMIC_ACQUIRE);
+	if (data)
+		__atomic_store_n(&ringbuf->data, data, __ATOMIC_RELEASE);
+	else
+		data = ringbuf->data;
+
+	/* On buffer overflows, discard the new data, as the Kernel does */
+	read = __atomic_load_n(&data->read, __ATOMIC_ACQUIRE);
+	if (data->size - (data->write - read) < size) {
+		__atomic_store_n(&ringbuf->rc, -EOVERFLOW, __ATOMIC_SEQ_CST);
+		wake_ringbuffer(ringbuf);
+		return NULL;
+	}
+	return data;
+}
+
 static void write_ringbuffer(struct dvb_open_descriptor *open_dev,
 			    ssize_t size, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t len = size, split;
+	struct ringbuf_data *data;
+	size_t pos, split;
+
+	data = get_write_ringbuf(ringbuf, size);
+	if (!data)
+		return;
 
-	pthread_mutex_lock(&ringbuf->lock);
+	pos = data->write & (data->size - 1);
+	split = data->size - pos;
+	if (split > size)
+		split = size;
 
-	split = (ringbuf->write + size > RINGBUF_SIZE) ?
-		 RINGBUF_SIZE - ringbuf->write : 0;
+	memcpy(&data->buf[pos], buf, split);
+	memcpy(data->buf, buf + split, size - split);
+
+	__atomic_store_n(&data->write, data->write + size, __ATOMIC_SEQ_CST);
+	wake_ringbuffer(ringbuf);
+}
 
-	if (split > 0) {
-		memcpy(&ringbuf->buf[ringbuf->write], buf, split);
-		buf += split;
-		len -= split;
-		ringbuf->write = 0;
+static int recv_discard(int fd, size_t size)
+{
+	char buf[4096];
+	size_t len;
+
+	while (size) {
+		len = size < sizeof(buf) ? size : sizeof(buf);
+		if (recv(fd, buf, len, MSG_WAITALL) != len)
+			return -1;
+		size -= len;
 	}
+	return 0;
+}
 
-	memcpy(&ringbuf->buf[ringbuf->write], buf, len);
-	ringbuf->write = (ringbuf->write + len) % RINGBUF_SIZE;
+/*
+ * Like write_ringbuffer(), but receiving the data directly from the
+ * socket into the ring, without an intermediate buffer.
+ */
+static int recv_ringbuffer(struct ringbuffer *ringbuf, int fd, size_t size)
+{
+	struct ringbuf_data *data;
+	size_t pos, split;
 
-	/* Detect buffer overflows */
-	if ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < size)
-		ringbuf->rc = -EOVERFLOW;
+	data = get_write_ringbuf(ringbuf, size);
+	if (!data)
+		return recv_discard(fd, size);
 
-	pthread_mutex_unlock(&ringbuf->lock);
+	pos = data->write & (data->size - 1);
+	split = data->size - pos;
+	if (split > size)
+		split = size;
+
+	if (recv(fd, &data->buf[pos], split, MSG_WAITALL) != split)
+		return -1;
+	if (size > split &&
+	    recv(fd, data->buf, size - split, MSG_WAITALL) != size - split)
+		return -1;
+
+	__atomic_store_n(&data->write, data->write + size, __ATOMIC_SEQ_CST);
+	wake_ringbuffer(ringbuf);
+	return 0;
 }
 
-static void read_ringbuffer(struct dvb_open_descriptor *open_dev,
-			    size_t *len, char *buf)
+static ssize_t read_ringbuffer(struct dvb_open_descriptor *open_dev,
+			       size_t len, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t size, split;
+	struct dvb_dev_remote_priv *priv = open_dev->dvb->priv;
+	struct ringbuf_data *data;
+	size_t pos, split;
+	uint64_t val;
+	int rc;
 
 	/* Sets the read size */
-	if (*len > REMOTE_BUF_SIZE)
-		*len = REMOTE_BUF_SIZE;
+	if (priv->protocol >= 2) {
+		if (len > REMOTE_DATA_SIZE)
+			len = REMOTE_DATA_SIZE;
+	} else if (len > REMOTE_BUF_SIZE) {
+		len = REMOTE_BUF_SIZE;
+	}
 
 	/* Wait for data to arrive */
-	pthread_mutex_lock(&ringbuf->lock);
-	while ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < *len) {
-		pthread_mutex_unlock(&ringbuf->lock);
-		usleep(1);
-		pthread_mutex_lock(&ringbuf->lock);
+	while (1) {
+		rc = __atomic_exchange_n(&ringbuf->rc, 0, __ATOMIC_SEQ_CST);
+		if (rc)
+			return rc;
+		if (__atomic_load_n(&priv->disconnected, __ATOMIC_SEQ_CST))
+			return -ENODEV;
+
+		/* The data of the old ring is lost when it is replaced */
+		data = __atomic_load_n(&ringbuf->data, __ATOMIC_ACQUIRE);
+		if (data != ringbuf->cur) {
+			free(ringbuf->cur);
+			ringbuf->cur = data;
+		}
+
+		if (__atomic_load_n(&data->write, __ATOMIC_SEQ_CST) - data->read >= len)
+			break;
+
+		/*
+		 * Tell the receive thread that it should wake us, then check
+		 * again, as it could have written before seeing it.
+		 */
+		__atomic_store_n(&ringbuf->waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&data->write, __ATOMIC_SEQ_CST) - data->read < len &&
+		    !__atomic_load_n(&ringbuf->rc, __ATOMIC_SEQ_CST) &&
+		    !__atomic_load_n(&priv->disconnected, __ATOMIC_SEQ_CST) &&
+		    read(ringbuf->efd, &val, sizeof(val)) < 0 && errno != EINTR) {
+			__atomic_store_n(&ringbuf->waiting, 0, __ATOMIC_SEQ_CST);
+			return -errno;
+		}
+		__atomic_store_n(&ringbuf->waiting, 0, __ATOMIC_SEQ_CST);
 	}
 
-	size = *len;
+	pos = data->read & (data->size - 1);
+	split = data->size - pos;
+	if (split > len)
+		split = len;
 
-	*len = 0;
-	split = (ringbuf->read + size > RINGBUF_SIZE) ? RINGBUF_SIZE - ringbuf->read : 0;
-	if (split > 0) {
+	memcpy(buf, &data->buf[pos], split);
+	memcpy(buf + split, data->buf, len - split);
 
-		memcpy(buf, &ringbuf->buf[ringbuf->read], split);
-		buf += split;
-		size -= split;
-		*len += split;
-		ringbuf->read = 0;
-	}
-	memcpy(buf, &ringbuf->buf[ringbuf->read], size);
-	*len += size;
+	__atomic_store_n(&data->read, data->read + len, __ATOMIC_RELEASE);
 
-	ringbuf->read = (ringbuf->read + size) % RINGBUF_SIZE;
+	return len;
+}
 
-	pthread_mutex_unlock(&ringbuf->lock);
+static void free_ringbuffer(struct ringbuffer *ringbuf)
+{
+	if (ringbuf->cur != ringbuf->data)
+		free(ringbuf->cur);
+	free(ringbuf->data);
+	free(ringbuf->pending);
+	if (ringbuf->efd >= 0)
+		close(ringbuf->efd);
+	free(ringbuf);
 }
 
 static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
@@ -628,6 +784,109 @@ static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
 	}
 }
 
+/* Handles a protocol version 2 data frame */
+static int receive_data_frame(struct dvb_device_priv *dvb, size_t size)
+{
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_open_descriptor *cur;
+	struct ringbuffer *ringbuf;
+	unsigned char hdr[REMOTE_DATA_HDR_SIZE];
+	int uid, retval;
+
+	if (size < sizeof(hdr) || size > sizeof(hdr) + REMOTE_DATA_SIZE) {
+		dvb_logerr("invalid data frame with size %zd", size);
+		return -1;
+	}
+	if (recv(priv->fd, hdr, sizeof(hdr), MSG_WAITALL) != sizeof(hdr))
+		return -1;
+	size -= sizeof(hdr);
+
+	uid = hdr[0] << 24 | hdr[1] << 16 | hdr[2] << 8 | hdr[3];
+	retval = hdr[4] << 24 | hdr[5] << 16 | hdr[6] << 8 | hdr[7];
+
+	for (cur = dvb->open_list.next; cur; cur = cur->next) {
+		if (cur->fd != uid)
+			continue;
+
+		ringbuf = (struct ringbuffer *)cur;
+		if (retval < 0) {
+			__atomic_store_n(&ringbuf->rc, retval, __ATOMIC_SEQ_CST);
+			wake_ringbuffer(ringbuf);
+			return recv_discard(priv->fd, size);
+		}
+		return recv_ringbuffer(ringbuf, priv->fd, size);
+	}
+
+	dvb_logerr("received data for unknown ID %d", uid);
+	return recv_discard(priv->fd, size);
+}
+
+/* Parses the stats, as sent by the daemon's fe_get_stats */
+static int scan_stats(struct dvb_v5_fe_parms_priv *parms, char *p,
+		      size_t size, struct dvb_v5_stats *st)
+{
+	int ret, status, i;
+
+	ret = scan_data(parms, p, size, "%i", &status);
+	if (ret < 0)
+		return ret;
+
+	st->prev_status = status;
+
+	p += ret;
+	size -= ret;
+
+	for (i = 0; i < DTV_NUM_STATS_PROPS; i++) {
+		ret = scan_data(parms, p, size, "%i%i",
+				&st->prop[i].cmd,
+				&st->prop[i].u.data);
+		if (ret < 0)
+			return ret;
+
+		p += ret;
+		size -= ret;
+	}
+	for (i = 0; i < MAX_DTV_STATS; i++) {
+		struct dvb_v5_counters *prev = st->prev;
+		struct dvb_v5_counters *cur = st->cur;
+
+		ret = scan_data(parms, p, size, "%i%i%i",
+				&st->has_post_ber[i],
+				&st->has_pre_ber[i],
+				&st->has_per[i]);
+		if (ret < 0)
+			return ret;
+
+		p += ret;
+		size -= ret;
+
+		ret = scan_data(parms, p, size,
+				"%" SCNu64 "%" SCNu64 "%" SCNu64 "%" SCNu64
+				"%" SCNu64 "%" SCNu64 "%" SCNu64 "%" SCNu64
+				"%" SCNu64 "%" SCNu64 "%" SCNu64 "%" SCNu64,
+				&prev->pre_bit_count,
+				&prev->pre_bit_error,
+				&prev->post_bit_count,
+				&prev->post_bit_error,
+				&prev->block_count,
+				&prev->block_error,
+				&cur->pre_bit_count,
+				&cur->pre_bit_error,
+				&cur->post_bit_count,
+				&cur->post_bit_error,
+				&cur->block_count,
+				&cur->block_error);
+		if (ret < 0)
+			return ret;
+
+		p += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
 static void *receive_data(void *privdata)
 {
 	struct dvb_device_priv *dvb = privdata;
@@ -646,18 +905,33 @@ static void *receive_data(void *privdata)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
-			dvb_dev_remote_disconnect(priv);
+			dvb_dev_remote_disconnect(dvb);
+			return NULL;
+		}
+		size = (uint32_t)(unsigned char)buf[0] << 24 |
+		       (uint32_t)(unsigned char)buf[1] << 16 |
+		       (uint32_t)(unsigned char)buf[2] << 8 |
+		       (uint32_t)(unsigned char)buf[3];
+		if (size & REMOTE_DATA_FRAME) {
+			if (receive_data_frame(dvb, size & ~REMOTE_DATA_FRAME) < 0) {
+				dvb_logerr("remote end disconnected");
+				dvb_dev_remote_disconnect(dvb);
+				return NULL;
+			}
+			continue;
+		}
+		if (size > sizeof(buf)) {
+			dvb_logerr("message too big: %zd bytes", size);
+			dvb_dev_remote_disconnect(dvb);
 			return NULL;
 		}
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
 		ret = recv(priv->fd, buf, size, MSG_WAITALL);
 		if (ret != size) {
 			if (size < 0)
 				dvb_perror("recv");
 			else
 				dvb_logerr("remote end disconnected");
-			dvb_dev_remote_disconnect(priv);
+			dvb_dev_remote_disconnect(dvb);
 			return NULL;
 		}
 
@@ -718,7 +992,9 @@ static void *receive_data(void *privdata)
 
 						found = 1;
 						if (retval < 0) {
-							ringbuf->rc = retval;
+							__atomic_store_n(&ringbuf->rc, retval,
+									 __ATOMIC_SEQ_CST);
+							wake_ringbuffer(ringbuf);
 							continue;
 						}
 						write_ringbuffer(cur, args_size, args);
@@ -729,6 +1005,14 @@ static void *receive_data(void *privdata)
 					dvb_logerr("received data for unknown ID %d", uid);
 				args += args_size;
 				args_size = 0;
+			} else if (!strcmp(cmd, "fe_stats")) {
+				pthread_mutex_lock(&priv->lock_stats);
+				if (retval >= 0 &&
+				    !scan_stats(parms, args, args_size, &priv->stats))
+					priv->has_stats = 1;
+				pthread_mutex_unlock(&priv->lock_stats);
+				args += args_size;
+				args_size = 0;
 			} else {
 				dvb_logerr("unexpected message type: %s", cmd);
 				ret = -1;
@@ -777,6 +1061,46 @@ static void *receive_data(void *privdata)
 /*
  * Function handlers
  */
+
+/*
+ * Asks for the binary data frames of the protocol version 2, if
+ * the daemon supports it.
+ */
+static int dvb_remote_set_protocol(struct dvb_device_priv *dvb)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	int ret;
+
+	if (priv->protocol < 2) {
+		priv->protocol = 1;
+		return 1;
+	}
+	priv->protocol = 1;
+
+	msg = send_fmt(dvb, priv->fd, "daemon_set_protocol", "%i",
+		       REMOTE_PROTOCOL_VERSION);
+	if (!msg)
+		return -1;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
+
+	ret = msg->retval;
+	if (ret > 1)
+		priv->protocol = ret;
+
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
 static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
@@ -814,6 +1138,12 @@ static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 		goto error;
 	}
 
+	/* Newer daemons also tell the highest protocol version they support */
+	priv->protocol = 1;
+	if (scan_data(parms, msg->args, msg->args_size, "%s%i",
+		      version, &priv->protocol) < 0)
+		priv->protocol = 1;
+
 	/* version matches */
 	ret = 1;
 
@@ -1054,9 +1384,19 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	}
 	open_dev = &ringbuf->open_dev;
 
+	/* Initialize ringbuffer data*/
+	ringbuf->data = alloc_ringbuf_data(RINGBUF_SIZE);
+	ringbuf->cur = ringbuf->data;
+	ringbuf->efd = eventfd(0, EFD_CLOEXEC);
+	if (!ringbuf->data || ringbuf->efd < 0) {
+		dvb_perror("Can't create file descriptor");
+		free_ringbuffer(ringbuf);
+		return NULL;
+	}
+
 	msg = send_fmt(dvb, priv->fd, "dev_open", "%s%i", sysname, flags);
 	if (!msg) {
-		free(ringbuf);
+		free_ringbuffer(ringbuf);
 		return NULL;
 	}
 
@@ -1074,9 +1414,6 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 	open_dev->dev = NULL;
 	open_dev->dvb = dvb;
 
-	/* Initialize ringbuffer data*/
-	pthread_mutex_init(&ringbuf->lock, NULL);
-
 	cur = &dvb->open_list;
 	while (cur->next)
 		cur = cur->next;
@@ -1093,7 +1430,7 @@ error:
 	pthread_mutex_unlock(&msg->lock);
 
 	free_msg(dvb, msg);
-	free(ringbuf);
+	free_ringbuffer(ringbuf);
 	return NULL;
 }
 
@@ -1132,8 +1469,7 @@ error:
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
 		if (cur->next == open_dev) {
 			cur->next = open_dev->next;
-			pthread_mutex_destroy(&ringbuffer->lock);
-			free(ringbuffer);
+			free_ringbuffer(ringbuffer);
 			goto ret;
 		}
 	}
@@ -1184,6 +1520,8 @@ error:
 static int dvb_remote_set_bufsize(struct dvb_open_descriptor *open_dev,
 			int bufsize)
 {
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+	struct ringbuf_data *data;
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
@@ -1193,6 +1531,18 @@ static int dvb_remote_set_bufsize(struct dvb_open_descriptor *open_dev,
 	if (priv->disconnected)
 		return -ENODEV;
 
+	/*
+	 * The local ring should also be able to store the whole Kernel
+	 * buffer. The receive thread switches to the new ring and, as
+	 * the Kernel does, the buffered data is lost.
+	 */
+	if (bufsize > 0 && (size_t)bufsize > ringbuf->cur->size) {
+		data = alloc_ringbuf_data(bufsize);
+		if (data)
+			free(__atomic_exchange_n(&ringbuf->pending, data,
+						 __ATOMIC_ACQ_REL));
+	}
+
 	msg = send_fmt(dvb, priv->fd, "dev_set_bufsize", "%i%i",
 		       open_dev->fd, bufsize);
 	if (!msg)
@@ -1217,23 +1567,13 @@ error:
 static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count)
 {
-	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
-	int ret;
 
 	if (priv->disconnected)
 		return -ENODEV;
 
-	if (ringbuf->rc) {
-		ret = ringbuf->rc;
-		ringbuf->rc = 0;
-		return ret;
-	}
-
-	read_ringbuffer(open_dev, &count, buf);
-
-	return count;
+	return read_ringbuffer(open_dev, count, buf);
 }
 
 static int dvb_remote_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
@@ -1564,13 +1904,22 @@ int dvb_remote_fe_get_stats(struct dvb_v5_fe_parms *par)
 	struct dvb_device_priv *dvb = parms->dvb;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	struct queued_msg *msg;
-	int ret, status, i;
-	char *p;
-	size_t size;
+	int ret;
 
 	if (priv->disconnected)
 		return -ENODEV;
 
+	/* When subscribed, use the last stats pushed by the daemon */
+	if (priv->stats_interval) {
+		pthread_mutex_lock(&priv->lock_stats);
+		if (priv->has_stats) {
+			*st = priv->stats;
+			pthread_mutex_unlock(&priv->lock_stats);
+			return 0;
+		}
+		pthread_mutex_unlock(&priv->lock_stats);
+	}
+
 	msg = send_fmt(dvb, priv->fd, "fe_get_stats", "-");
 	if (!msg)
 		return -1;
@@ -1586,71 +1935,57 @@ int dvb_remote_fe_get_stats(struct dvb_v5_fe_parms *par)
 		goto error;
 	}
 
-	p = msg->args;
-	size = msg->args_size;
+	scan_stats(parms, msg->args, msg->args_size, st);
 
-	ret = scan_data(parms, p, size, "%i", &status);
-	if (ret < 0)
-		goto error;
+error:
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
 
-	st->prev_status = status;
+	free_msg(dvb, msg);
+	return 0;
+}
 
-	p += ret;
-	size -= ret;
+static int dvb_remote_fe_subscribe_stats(struct dvb_v5_fe_parms *par,
+					 unsigned int interval_ms)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)par;
+	struct dvb_device_priv *dvb = parms->dvb;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	int ret;
 
-	for (i = 0; i < DTV_NUM_STATS_PROPS; i++) {
-		ret = scan_data(parms, p, size, "%i%i",
-				&st->prop[i].cmd,
-				&st->prop[i].u.data);
-		if (ret < 0)
-			goto error;
+	if (priv->disconnected)
+		return -ENODEV;
 
-		p += ret;
-		size -= ret;
-	}
-	for (i = 0; i < MAX_DTV_STATS; i++) {
-		struct dvb_v5_counters *prev = st->prev;
-		struct dvb_v5_counters *cur = st->cur;
+	/* Older daemons only reply to fe_get_stats */
+	if (priv->protocol < 3)
+		return -EOPNOTSUPP;
 
-		ret = scan_data(parms, p, size, "%i%i%i",
-				&st->has_post_ber[i],
-				&st->has_pre_ber[i],
-				&st->has_per[i]);
-		if (ret < 0)
-			goto error;
+	msg = send_fmt(dvb, priv->fd, "fe_subscribe_stats", "%i", interval_ms);
+	if (!msg)
+		return -1;
 
-		p += ret;
-		size -= ret;
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0) {
+		dvb_logerr("error waiting for %s response", msg->cmd);
+		goto error;
+	}
 
-		ret = scan_data(parms, p, size,
-				"%" SCNu64 "%" SCNu64 "%" SCNu64 "%" SCNu64
-				"%" SCNu64 "%" SCNu64 "%" SCNu64 "%" SCNu64
-				"%" SCNu64 "%" SCNu64 "%" SCNu64 "%" SCNu64,
-				&prev->pre_bit_count,
-				&prev->pre_bit_error,
-				&prev->post_bit_count,
-				&prev->post_bit_error,
-				&prev->block_count,
-				&prev->block_error,
-				&cur->pre_bit_count,
-				&cur->pre_bit_error,
-				&cur->post_bit_count,
-				&cur->post_bit_error,
-				&cur->block_count,
-				&cur->block_error);
-		if (ret < 0)
-			goto error;
+	ret = msg->retval;
+	if (ret < 0)
+		goto error;
 
-		p += ret;
-		size -= ret;
-	}
+	pthread_mutex_lock(&priv->lock_stats);
+	priv->stats_interval = interval_ms;
+	priv->has_stats = 0;
+	pthread_mutex_unlock(&priv->lock_stats);
 
 error:
 	msg->seq = 0; /* Avoids any risk of a recursive call */
 	pthread_mutex_unlock(&msg->lock);
 
 	free_msg(dvb, msg);
-	return 0;
+	return ret;
 }
 
 static struct dvb_v5_descriptors *dvb_remote_scan(struct dvb_open_descriptor *open_dev,
@@ -1679,7 +2014,7 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 	pthread_cancel(priv->recv_id);
 
 	/* Cancel any pending messages */
-	dvb_dev_remote_disconnect(priv);
+	dvb_dev_remote_disconnect(dvb);
 
 	/* Give some time any pending message to be handled */
 	do {
@@ -1696,6 +2031,7 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 	}
 
 	pthread_mutex_destroy(&priv->lock_io);
+	pthread_mutex_destroy(&priv->lock_stats);
 
 	/* Close the socket */
 	if (priv->fd > 0) {
@@ -1759,10 +2095,12 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 
 	/* Start receiving messsages from the server */
 	pthread_mutex_init(&priv->lock_io, NULL);
+	pthread_mutex_init(&priv->lock_stats, NULL);
 	ret = pthread_create(&priv->recv_id, NULL, receive_data, dvb);
 	if (ret < 0) {
 		dvb_perror("pthread_create");
 		pthread_mutex_destroy(&priv->lock_io);
+		pthread_mutex_destroy(&priv->lock_stats);
 		return -1;
 	}
 
@@ -1771,6 +2109,8 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	if (ret <= 0) {
 		pthread_mutex_destroy(&priv->lock_io);
 		pthread_cancel(priv->recv_id);
+	} else {
+		dvb_remote_set_protocol(dvb);
 	}
 
 	/* Everything is OK, initialize data structs */
@@ -1794,6 +2134,7 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	ops->fe_get_parms = dvb_remote_fe_get_parms;
 	ops->fe_set_parms = dvb_remote_fe_set_parms;
 	ops->fe_get_stats = dvb_remote_fe_get_stats;
+	ops->fe_subscribe_stats = dvb_remote_fe_subscribe_stats;
 
 	ops->free = dvb_dev_remote_free;
 
@@ -17,14 +17,19 @@
  */
 
 #include <libudev.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <locale.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
 
 #include "dvb-fe-priv.h"
 #include "dvb-dev-priv.h"
+#include "libv4l-probes.h"
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -34,6 +39,9 @@
 # define _(string) string
 #endif
 
+V4L_PROBE_SEMAPHORE(libdvbv5, dev_read_entry);
+V4L_PROBE_SEMAPHORE(libdvbv5, dev_read_return);
+
 const char * const dev_type_names[] = {
         "frontend", "demux", "dvr", "net", "ca", "sec", "video", "audio"
 };
@@ -196,6 +204,17 @@ int dvb_dev_find(struct dvb_device *d, dvb_dev_change_t handler, void *user_priv
 	return ops->find(dvb, handler, user_priv);
 }
 
+int dvb_dev_find_adapter(struct dvb_device *d, unsigned int adapter)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->find_adapter)
+		return dvb_dev_find(d, NULL, NULL);
+
+	return ops->find_adapter(dvb, adapter);
+}
+
 void dvb_dev_stop_monitor(struct dvb_device *d)
 {
 	struct dvb_device_priv *dvb = (void *)d;
@@ -275,11 +294,76 @@ ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 {
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_ops *ops = &dvb->ops;
+	uint64_t start;
+	ssize_t ret;
 
 	if (!ops->read)
 		return -1;
 
-	return ops->read(open_dev, buf, count);
+	start = V4L_PROBE_START(libdvbv5, dev_read_return);
+	V4L_PROBE(libdvbv5, dev_read_entry, open_dev->fd, count);
+	ret = ops->read(open_dev, buf, count);
+	V4L_PROBE(libdvbv5, dev_read_return, open_dev->fd, count, ret,
+		  V4L_PROBE_NS(start));
+
+	return ret;
+}
+
+ssize_t dvb_dev_splice(struct dvb_open_descriptor *open_dev,
+		       int fd, size_t count)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->splice)
+		return -EOPNOTSUPP;
+
+	return ops->splice(open_dev, fd, count);
+}
+
+int dvb_dev_mmap_start(struct dvb_open_descriptor *open_dev,
+		       unsigned int size, unsigned int count)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->mmap_start)
+		return -EOPNOTSUPP;
+
+	return ops->mmap_start(open_dev, size, count);
+}
+
+int dvb_dev_dqbuf(struct dvb_open_descriptor *open_dev,
+		  struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->dqbuf)
+		return -EOPNOTSUPP;
+
+	return ops->dqbuf(open_dev, buf);
+}
+
+int dvb_dev_qbuf(struct dvb_open_descriptor *open_dev,
+		 struct dvb_dev_buffer *buf)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->qbuf)
+		return -EOPNOTSUPP;
+
+	return ops->qbuf(open_dev, buf);
+}
+
+void dvb_dev_mmap_stop(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (ops->mmap_stop)
+		ops->mmap_stop(open_dev);
 }
 
 int dvb_dev_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
@@ -385,3 +469,87 @@ int dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 
 	return dvb->ops.fe_get_stats(p);
 }
+
+/*
+ * Without an event, the status is read again after this time anyway, for
+ * drivers that don't queue events and to notice parms->abort. Remote
+ * frontends have no fd to poll, so their status is just read more often.
+ */
+#define WAIT_LOCK_POLL_MS		100
+#define WAIT_LOCK_REMOTE_POLL_MS	20
+
+static uint64_t dvb_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+int dvb_fe_wait_lock(struct dvb_v5_fe_parms *p, unsigned int timeout_ms)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_device_priv *dvb = parms->dvb;
+	int remote = parms->fd < 0 && dvb && dvb->ops.fe_get_stats;
+	uint64_t now, deadline = dvb_time_ms() + timeout_ms;
+	struct pollfd fds = { .fd = parms->fd, .events = POLLPRI };
+	struct dvb_frontend_event event;
+	uint32_t status;
+	int rc, i, wait_ms;
+
+	if (!remote && parms->fd < 0)
+		return -EBADF;
+
+	for (;;) {
+		rc = dvb_fe_get_stats(p);
+		if (rc)
+			return rc;
+		if (!dvb_fe_retrieve_stats(p, DTV_STATUS, &status) &&
+		    (status & FE_HAS_LOCK))
+			return 0;
+		if (p->abort)
+			return -EINTR;
+
+		now = dvb_time_ms();
+		if (now >= deadline)
+			return -ETIMEDOUT;
+		wait_ms = deadline - now;
+
+		if (remote) {
+			if (wait_ms > WAIT_LOCK_REMOTE_POLL_MS)
+				wait_ms = WAIT_LOCK_REMOTE_POLL_MS;
+			usleep(wait_ms * 1000);
+			continue;
+		}
+
+		if (wait_ms > WAIT_LOCK_POLL_MS)
+			wait_ms = WAIT_LOCK_POLL_MS;
+		rc = poll(&fds, 1, wait_ms);
+		if (rc < 0 && errno != EINTR)
+			return -errno;
+
+		/*
+		 * The status changed. Empty the event queue, so that poll()
+		 * only wakes up on the next change, and read the status again.
+		 * The queue holds at most 8 events, plus an overflow report.
+		 */
+		for (i = 0; rc > 0 && i < 16; i++) {
+			if (ioctl(parms->fd, FE_GET_EVENT, &event) == -1 &&
+			    errno != EOVERFLOW)
+				break;
+			rc = poll(&fds, 1, 0);
+		}
+	}
+}
+
+int dvb_fe_subscribe_stats(struct dvb_v5_fe_parms *p, unsigned int interval_ms)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_device_priv *dvb = parms->dvb;
+
+	/* Getting the stats of a local frontend is already cheap */
+	if (!dvb || !dvb->ops.fe_subscribe_stats)
+		return 0;
+
+	return dvb->ops.fe_subscribe_stats(p, interval_ms);
+}
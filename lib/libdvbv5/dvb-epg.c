@@ -0,0 +1,780 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/******************************************************************************
+ * Electronic Program Guide collector
+ * According with:
+ *	ETSI EN 300 468 V1.11.1 (2010-04), section 5.2.4
+ *	ETSI TS 101 211 V1.11.1 (2012-04), section 4.1.4
+ *	ATSC A/65:2009, sections 6.2 and 6.5
+ *****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-log.h>
+#include <libdvbv5/eit.h>
+#include <libdvbv5/atsc_eit.h>
+#include <libdvbv5/sdt.h>
+#include <libdvbv5/vct.h>
+#include <libdvbv5/mgt.h>
+#include <libdvbv5/mpeg_ts.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+#define DVB_EPG_HASH_SIZE	256
+#define DVB_EPG_MAX_FILTERS	16	/* section filters used at once */
+#define DVB_EPG_MAX_ATSC_EIT	32	/* EIT-0 to EIT-31: 4 days */
+#define DVB_EPG_TABLE_TIMEOUT	5	/* for the SDT, VCT and MGT */
+
+/* Seconds from the Unix epoch to MJD 0 and to the GPS epoch */
+#define MJD_UNIX_EPOCH		40587
+#define GPS_UNIX_EPOCH		315964800
+
+struct dvb_epg_service {
+	struct dvb_epg_service *next;
+	uint16_t id;
+	unsigned want;		/* DVB_EPG_* flags. 0 if not waited for */
+
+	int pf_done;
+	int last_table_id;	/* -1 until a schedule table is received */
+	uint16_t sched_done;	/* bit n: table 0x50 + n is complete */
+	uint32_t atsc_done;	/* bit n: the EIT at atsc_pid[n] is complete */
+
+	struct dvb_epg_event *events;	/* sorted by start time */
+	unsigned n_events, size;
+};
+
+struct dvb_epg {
+	struct dvb_v5_fe_parms_priv *parms;
+	unsigned flags;
+	int atsc;
+	struct dvb_table_cache *cache;
+
+	struct dvb_epg_service *hash[DVB_EPG_HASH_SIZE];
+	unsigned n_wanted;
+
+	/* ATSC EIT PIDs, as listed at the MGT */
+	uint16_t atsc_pid[DVB_EPG_MAX_ATSC_EIT];
+	unsigned n_atsc_pids;
+};
+
+/* A group of tables read by a single section filter */
+struct dvb_epg_filter {
+	uint16_t pid;
+	uint8_t tid, mask;
+	unsigned group;		/* DVB_EPG_* flags, for DVB */
+	int atsc_index;		/* index at atsc_pid[], or -1 for DVB */
+};
+
+struct dvb_epg_slot {
+	int fd;
+	int own_fd;
+	int filter;		/* -1 if idle */
+};
+
+static void dvb_epg_table_changed(void *priv, uint16_t pid, uint8_t table_id,
+				  uint16_t id, void *table);
+
+static struct dvb_epg_service *dvb_epg_get_service(struct dvb_epg *epg,
+						   uint16_t id, int create)
+{
+	struct dvb_epg_service **head, *svc;
+
+	head = &epg->hash[id % DVB_EPG_HASH_SIZE];
+	for (svc = *head; svc; svc = svc->next)
+		if (svc->id == id)
+			return svc;
+	if (!create)
+		return NULL;
+
+	svc = calloc(sizeof(*svc), 1);
+	if (!svc)
+		return NULL;
+	svc->id = id;
+	svc->last_table_id = -1;
+	svc->next = *head;
+	*head = svc;
+
+	return svc;
+}
+
+static int dvb_epg_want_service(struct dvb_epg *epg, uint16_t id,
+				unsigned want)
+{
+	struct dvb_epg_service *svc;
+
+	svc = dvb_epg_get_service(epg, id, 1);
+	if (!svc)
+		return -ENOMEM;
+	if (!svc->want && want)
+		epg->n_wanted++;
+	svc->want |= want;
+
+	return 0;
+}
+
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *p, unsigned flags)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_epg *epg;
+
+	epg = calloc(sizeof(*epg), 1);
+	if (!epg)
+		return NULL;
+	epg->parms = parms;
+	epg->flags = flags & (DVB_EPG_PRESENT_FOLLOWING | DVB_EPG_SCHEDULE);
+	epg->atsc = parms->p.current_sys == SYS_ATSC ||
+		    parms->p.current_sys == SYS_DVBC_ANNEX_B;
+	epg->cache = dvb_table_cache_alloc(dvb_epg_table_changed, epg);
+	if (!epg->cache) {
+		free(epg);
+		return NULL;
+	}
+
+	return epg;
+}
+
+static void dvb_epg_free_event(struct dvb_epg_event *event)
+{
+	dvb_desc_free(&event->descriptor);
+	free(event->title);
+}
+
+static void dvb_epg_free_events(struct dvb_epg_service *svc)
+{
+	unsigned i;
+
+	for (i = 0; i < svc->n_events; i++)
+		dvb_epg_free_event(&svc->events[i]);
+	free(svc->events);
+}
+
+void dvb_epg_free(struct dvb_epg *epg)
+{
+	struct dvb_epg_service *svc, *next;
+	int i;
+
+	if (!epg)
+		return;
+	for (i = 0; i < DVB_EPG_HASH_SIZE; i++) {
+		for (svc = epg->hash[i]; svc; svc = next) {
+			next = svc->next;
+			dvb_epg_free_events(svc);
+			free(svc);
+		}
+	}
+	dvb_table_cache_free(epg->cache);
+	free(epg);
+}
+
+int dvb_epg_add_service(struct dvb_epg *epg, uint16_t service_id)
+{
+	return dvb_epg_want_service(epg, service_id,
+				    epg->atsc ? 1 : epg->flags);
+}
+
+/*
+ * Event store. An event replaces the one with the same event ID, or
+ * the one starting at the same time, as broadcasters renumber events.
+ */
+static unsigned dvb_epg_lower_bound(struct dvb_epg_service *svc,
+				    time_t start)
+{
+	unsigned lo = 0, hi = svc->n_events, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (svc->events[mid].start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int dvb_epg_store_event(struct dvb_epg_service *svc,
+			       struct dvb_epg_event *event)
+{
+	struct dvb_epg_event *events;
+	unsigned i, pos;
+
+	for (i = 0; i < svc->n_events; i++) {
+		if (svc->events[i].event_id != event->event_id)
+			continue;
+		dvb_epg_free_event(&svc->events[i]);
+		memmove(&svc->events[i], &svc->events[i + 1],
+			(svc->n_events - i - 1) * sizeof(*svc->events));
+		svc->n_events--;
+		break;
+	}
+
+	pos = dvb_epg_lower_bound(svc, event->start);
+	if (pos < svc->n_events && svc->events[pos].start == event->start) {
+		dvb_epg_free_event(&svc->events[pos]);
+		svc->events[pos] = *event;
+		return 0;
+	}
+
+	if (svc->n_events == svc->size) {
+		unsigned size = svc->size ? 2 * svc->size : 32;
+
+		events = realloc(svc->events, size * sizeof(*events));
+		if (!events)
+			return -ENOMEM;
+		svc->events = events;
+		svc->size = size;
+	}
+	memmove(&svc->events[pos + 1], &svc->events[pos],
+		(svc->n_events - pos) * sizeof(*svc->events));
+	svc->events[pos] = *event;
+	svc->n_events++;
+
+	return 0;
+}
+
+static void dvb_epg_store_dvb(struct dvb_epg *epg, struct dvb_epg_service *svc,
+			      struct dvb_table_eit *eit)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_epg_event ev;
+
+	dvb_eit_event_foreach(event, eit) {
+		/* The table parser leaves the MJD in host order */
+		uint16_t mjd = *(uint16_t *)event->dvbstart;
+
+		ev.service_id = svc->id;
+		ev.event_id = event->event_id;
+		ev.start = (time_t)(mjd - MJD_UNIX_EPOCH) * 86400 +
+			   dvb_bcd(event->dvbstart[2]) * 3600 +
+			   dvb_bcd(event->dvbstart[3]) * 60 +
+			   dvb_bcd(event->dvbstart[4]);
+		ev.duration = event->duration;
+		ev.running_status = event->running_status;
+		ev.descriptor = event->descriptor;
+		ev.title = NULL;
+
+		if (dvb_epg_store_event(svc, &ev) < 0) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return;
+		}
+		event->descriptor = NULL;
+	}
+}
+
+static void dvb_epg_store_atsc(struct dvb_epg *epg, struct dvb_epg_service *svc,
+			       struct atsc_table_eit *eit)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_epg_event ev;
+
+	atsc_eit_event_foreach(event, eit) {
+		ev.service_id = svc->id;
+		ev.event_id = event->event_id;
+		/* GPS time: the leap seconds given by the STT are ignored */
+		ev.start = (time_t)GPS_UNIX_EPOCH + event->start_time;
+		ev.duration = event->duration;
+		ev.running_status = 0;
+		ev.descriptor = event->descriptor;
+		ev.title = event->title;
+
+		if (dvb_epg_store_event(svc, &ev) < 0) {
+			dvb_logerr(_("%s: out of memory"), __func__);
+			return;
+		}
+		event->descriptor = NULL;
+		event->title = NULL;
+	}
+}
+
+static int dvb_epg_atsc_index(struct dvb_epg *epg, uint16_t pid)
+{
+	unsigned i;
+
+	for (i = 0; i < epg->n_atsc_pids; i++)
+		if (epg->atsc_pid[i] == pid)
+			return i;
+	return -1;
+}
+
+/* Called by the table cache, once a table is complete or has changed */
+static void dvb_epg_table_changed(void *priv, uint16_t pid, uint8_t table_id,
+				  uint16_t id, void *table)
+{
+	struct dvb_epg *epg = priv;
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_epg_service *svc;
+	int i;
+
+	svc = dvb_epg_get_service(epg, id, 1);
+	if (!svc) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		if (table_id == ATSC_TABLE_EIT)
+			atsc_table_eit_free(table);
+		else
+			dvb_table_eit_free(table);
+		return;
+	}
+
+	if (table_id == ATSC_TABLE_EIT) {
+		dvb_epg_store_atsc(epg, svc, table);
+		atsc_table_eit_free(table);
+
+		i = dvb_epg_atsc_index(epg, pid);
+		if (i >= 0)
+			svc->atsc_done |= 1u << i;
+		return;
+	}
+
+	dvb_epg_store_dvb(epg, svc, table);
+	if (table_id == DVB_TABLE_EIT) {
+		svc->pf_done = 1;
+	} else {
+		svc->last_table_id = ((struct dvb_table_eit *)table)->last_table_id;
+		svc->sched_done |= 1 << (table_id - DVB_TABLE_EIT_SCHEDULE);
+	}
+	dvb_table_eit_free(table);
+}
+
+int dvb_epg_section(struct dvb_epg *epg, uint16_t pid,
+		    const uint8_t *buf, ssize_t buf_length)
+{
+	uint8_t tid;
+
+	if (buf_length < 1)
+		return -1;
+
+	/* Only EIT actual: other tables may share the PID */
+	tid = buf[0];
+	if (epg->atsc ? tid != ATSC_TABLE_EIT :
+			(tid != DVB_TABLE_EIT &&
+			 (tid & 0xf0) != DVB_TABLE_EIT_SCHEDULE))
+		return 0;
+
+	return dvb_table_cache_section(&epg->parms->p, epg->cache, pid,
+				       buf, buf_length);
+}
+
+/* Checks if a service has all the tables carried by a filter */
+static int dvb_epg_service_done(struct dvb_epg *epg,
+				struct dvb_epg_service *svc,
+				struct dvb_epg_filter *f)
+{
+	unsigned mask;
+
+	if (!svc->want)
+		return 1;
+
+	if (f->atsc_index >= 0)
+		return !!(svc->atsc_done & (1u << f->atsc_index));
+
+	if ((f->group & svc->want & DVB_EPG_PRESENT_FOLLOWING) &&
+	    !svc->pf_done)
+		return 0;
+
+	if (f->group & svc->want & DVB_EPG_SCHEDULE) {
+		if (svc->last_table_id < DVB_TABLE_EIT_SCHEDULE)
+			return 0;
+		mask = (2u << (svc->last_table_id & 0x0f)) - 1;
+		if ((svc->sched_done & mask) != mask)
+			return 0;
+	}
+	return 1;
+}
+
+static int dvb_epg_filter_done(struct dvb_epg *epg, struct dvb_epg_filter *f)
+{
+	struct dvb_epg_service *svc;
+	int i;
+
+	/* Without a service list, there's no way to know when it ends */
+	if (!epg->n_wanted)
+		return 0;
+
+	for (i = 0; i < DVB_EPG_HASH_SIZE; i++)
+		for (svc = epg->hash[i]; svc; svc = svc->next)
+			if (!dvb_epg_service_done(epg, svc, f))
+				return 0;
+	return 1;
+}
+
+static unsigned dvb_epg_get_filters(struct dvb_epg *epg,
+				    struct dvb_epg_filter *f)
+{
+	unsigned i, n = 0;
+
+	if (epg->atsc) {
+		for (i = 0; i < epg->n_atsc_pids; i++, n++) {
+			f[n].pid = epg->atsc_pid[i];
+			f[n].tid = ATSC_TABLE_EIT;
+			f[n].mask = 0xff;
+			f[n].group = 0;
+			f[n].atsc_index = i;
+		}
+		return n;
+	}
+
+	if (epg->flags & DVB_EPG_PRESENT_FOLLOWING) {
+		f[n].pid = DVB_TABLE_EIT_PID;
+		f[n].tid = DVB_TABLE_EIT;
+		f[n].mask = 0xff;
+		f[n].group = DVB_EPG_PRESENT_FOLLOWING;
+		f[n++].atsc_index = -1;
+	}
+	if (epg->flags & DVB_EPG_SCHEDULE) {
+		f[n].pid = DVB_TABLE_EIT_PID;
+		f[n].tid = DVB_TABLE_EIT_SCHEDULE;
+		f[n].mask = 0xf0;
+		f[n].group = DVB_EPG_SCHEDULE;
+		f[n++].atsc_index = -1;
+	}
+	return n;
+}
+
+int dvb_epg_is_complete(struct dvb_epg *epg)
+{
+	struct dvb_epg_filter f[DVB_EPG_MAX_ATSC_EIT];
+	unsigned i, n;
+
+	n = dvb_epg_get_filters(epg, f);
+	if (!n)
+		return 0;
+	for (i = 0; i < n; i++)
+		if (!dvb_epg_filter_done(epg, &f[i]))
+			return 0;
+	return 1;
+}
+
+/* Discovers the services with a program guide, from the SDT or the VCT */
+static void dvb_epg_read_services(struct dvb_epg *epg, int dmx_fd,
+				  unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_table_sdt *sdt = NULL;
+	struct atsc_table_vct *vct = NULL;
+	unsigned want;
+	int rc;
+
+	if (epg->atsc) {
+		rc = dvb_read_section(&parms->p, dmx_fd,
+				      parms->p.current_sys == SYS_ATSC ?
+				      ATSC_TABLE_TVCT : ATSC_TABLE_CVCT,
+				      ATSC_TABLE_VCT_PID, (void **)&vct,
+				      timeout);
+		if (rc < 0)
+			dvb_logwarn(_("%s: no VCT: reading the guide until the timeout"),
+				    __func__);
+		atsc_vct_channel_foreach(channel, vct)
+			dvb_epg_want_service(epg, channel->source_id, 1);
+		if (vct)
+			atsc_table_vct_free(vct);
+		return;
+	}
+
+	rc = dvb_read_section(&parms->p, dmx_fd, DVB_TABLE_SDT,
+			      DVB_TABLE_SDT_PID, (void **)&sdt, timeout);
+	if (rc < 0)
+		dvb_logwarn(_("%s: no SDT: reading the guide until the timeout"),
+			    __func__);
+	dvb_sdt_service_foreach(service, sdt) {
+		want = 0;
+		if (service->EIT_present_following)
+			want |= DVB_EPG_PRESENT_FOLLOWING;
+		if (service->EIT_schedule)
+			want |= DVB_EPG_SCHEDULE;
+		want &= epg->flags;
+		if (want)
+			dvb_epg_want_service(epg, service->service_id, want);
+	}
+	if (sdt)
+		dvb_table_sdt_free(sdt);
+}
+
+/* Gets the PIDs of the ATSC EIT-0 to EIT-31 tables from the MGT */
+static int dvb_epg_read_atsc_pids(struct dvb_epg *epg, int dmx_fd,
+				  unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct atsc_table_mgt *mgt = NULL;
+	int rc;
+
+	rc = dvb_read_section(&parms->p, dmx_fd, ATSC_TABLE_MGT,
+			      ATSC_BASE_PID, (void **)&mgt, timeout);
+	if (rc < 0) {
+		dvb_logerr(_("%s: error while waiting for MGT table"),
+			   __func__);
+		if (mgt)
+			atsc_table_mgt_free(mgt);
+		return rc;
+	}
+
+	atsc_mgt_table_foreach(table, mgt) {
+		if (table->type < 0x0100 ||
+		    table->type >= 0x0100 + DVB_EPG_MAX_ATSC_EIT)
+			continue;
+		if (dvb_epg_atsc_index(epg, table->pid) >= 0)
+			continue;
+		epg->atsc_pid[epg->n_atsc_pids++] = table->pid;
+	}
+	atsc_table_mgt_free(mgt);
+
+	return 0;
+}
+
+static int dvb_open_dmx_clone(int dmx_fd)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", dmx_fd);
+	return open(path, O_RDWR | O_NONBLOCK);
+}
+
+static int dvb_epg_start_filter(struct dvb_epg *epg, struct dvb_epg_slot *slot,
+				struct dvb_epg_filter *f)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+
+	if (dvb_set_section_filter(slot->fd, f->pid, 1, &f->tid, &f->mask,
+				   NULL, DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		dvb_dmx_stop(slot->fd);
+		return -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: reading table ID 0x%02x/0x%02x, program ID 0x%02x"),
+			__func__, f->tid, f->mask, f->pid);
+	return 0;
+}
+
+int dvb_epg_collect(struct dvb_epg *epg, int dmx_fd, unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_epg_filter f[DVB_EPG_MAX_ATSC_EIT];
+	struct dvb_epg_slot slot[DVB_EPG_MAX_FILTERS];
+	struct pollfd fds[DVB_EPG_MAX_FILTERS];
+	unsigned num, num_slots = 1, next = 0, running = 0, i;
+	unsigned table_timeout;
+	struct timeval deadline, now;
+	uint8_t *buf;
+	int ret = 0;
+
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += timeout;
+	table_timeout = timeout < DVB_EPG_TABLE_TIMEOUT ?
+			timeout : DVB_EPG_TABLE_TIMEOUT;
+
+	if (!epg->n_wanted)
+		dvb_epg_read_services(epg, dmx_fd, table_timeout);
+	if (epg->atsc && !epg->n_atsc_pids) {
+		ret = dvb_epg_read_atsc_pids(epg, dmx_fd, table_timeout);
+		if (ret < 0)
+			return ret;
+	}
+
+	num = dvb_epg_get_filters(epg, f);
+	if (!num)
+		return 0;
+
+	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return -1;
+	}
+
+	slot[0].fd = dmx_fd;
+	slot[0].own_fd = 0;
+	slot[0].filter = -1;
+	while (num_slots < num && num_slots < DVB_EPG_MAX_FILTERS) {
+		int fd = dvb_open_dmx_clone(dmx_fd);
+
+		if (fd < 0)
+			break;
+		slot[num_slots].fd = fd;
+		slot[num_slots].own_fd = 1;
+		slot[num_slots].filter = -1;
+		num_slots++;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: reading %u table groups using %u section filters"),
+			__func__, num, num_slots);
+
+	while (!parms->p.abort) {
+		long ms;
+		int available;
+		unsigned nfds = 0;
+
+		/* Start the next table groups on the idle filters */
+		for (i = 0; i < num_slots && next < num; i++) {
+			if (slot[i].filter >= 0)
+				continue;
+			if (dvb_epg_filter_done(epg, &f[next])) {
+				next++;
+				i--;
+				continue;
+			}
+			if (dvb_epg_start_filter(epg, &slot[i], &f[next]) < 0) {
+				/*
+				 * Out of hardware section filters: wait for
+				 * a filter that is already in use.
+				 */
+				if (slot[i].own_fd && num_slots > 1) {
+					close(slot[i].fd);
+					slot[i--] = slot[--num_slots];
+					continue;
+				}
+				dvb_logerr(_("%s: can't filter program ID 0x%02x"),
+					   __func__, f[next].pid);
+				next++;
+				continue;
+			}
+			slot[i].filter = next++;
+			running++;
+		}
+		if (!running)
+			break;
+
+		gettimeofday(&now, NULL);
+		ms = (deadline.tv_sec - now.tv_sec) * 1000 +
+		     (deadline.tv_usec - now.tv_usec) / 1000;
+		if (ms <= 0)
+			break;
+
+		for (i = 0; i < num_slots; i++) {
+			if (slot[i].filter < 0)
+				continue;
+			fds[nfds].fd = slot[i].fd;
+			fds[nfds].events = POLLIN | POLLPRI;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+
+		available = poll(fds, nfds, ms);
+		if (available < 0 && errno != EINTR) {
+			dvb_perror(_("dvb_epg_collect: poll error"));
+			ret = -1;
+			break;
+		}
+		if (available <= 0)
+			continue;
+
+		for (i = 0, nfds = 0; i < num_slots; i++) {
+			ssize_t buf_length;
+			int n = slot[i].filter;
+
+			if (n < 0)
+				continue;
+			if (!fds[nfds++].revents)
+				continue;
+
+			buf_length = read(slot[i].fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+			if (buf_length < 0 &&
+			    (errno == EAGAIN || errno == EOVERFLOW))
+				continue;
+			if (!buf_length) {
+				/* End of a recorded file: see dvb_dev_file_init() */
+				dvb_dmx_stop(slot[i].fd);
+				slot[i].filter = -1;
+				running--;
+				continue;
+			}
+			if (buf_length < 0) {
+				dvb_perror(_("dvb_epg_collect: read error"));
+				ret = -2;
+				break;
+			}
+
+			/* A broken section doesn't stop the collection */
+			dvb_epg_section(epg, f[n].pid, buf, buf_length);
+
+			if (!dvb_epg_filter_done(epg, &f[n]))
+				continue;
+			if (parms->p.verbose)
+				dvb_log(_("%s: table ID 0x%02x/0x%02x, program ID 0x%02x: done"),
+					__func__, f[n].tid, f[n].mask, f[n].pid);
+			dvb_dmx_stop(slot[i].fd);
+			slot[i].filter = -1;
+			running--;
+		}
+		if (ret < 0)
+			break;
+	}
+
+	for (i = 0; i < num_slots; i++) {
+		if (slot[i].filter >= 0)
+			dvb_dmx_stop(slot[i].fd);
+		if (slot[i].own_fd)
+			close(slot[i].fd);
+	}
+	free(buf);
+
+	if (ret < 0)
+		return ret;
+	return dvb_epg_is_complete(epg) ? 0 : 1;
+}
+
+const struct dvb_epg_event *dvb_epg_get_events(struct dvb_epg *epg,
+					       uint16_t service_id,
+					       unsigned *num)
+{
+	struct dvb_epg_service *svc;
+
+	svc = dvb_epg_get_service(epg, service_id, 0);
+	if (!svc || !svc->n_events) {
+		*num = 0;
+		return NULL;
+	}
+	*num = svc->n_events;
+	return svc->events;
+}
+
+const struct dvb_epg_event *dvb_epg_find_event(struct dvb_epg *epg,
+					       uint16_t service_id,
+					       time_t when)
+{
+	struct dvb_epg_service *svc;
+	struct dvb_epg_event *event;
+	unsigned pos;
+
+	svc = dvb_epg_get_service(epg, service_id, 0);
+	if (!svc)
+		return NULL;
+
+	/* The last event starting at or before when */
+	pos = dvb_epg_lower_bound(svc, when + 1);
+	if (!pos)
+		return NULL;
+	event = &svc->events[pos - 1];
+	if (when >= event->start + (time_t)event->duration)
+		return NULL;
+	return event;
+}
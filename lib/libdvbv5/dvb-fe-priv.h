@@ -54,7 +54,24 @@ struct dvb_v5_stats {
 
 };
 
+/*
+ * SEC state last applied to the frontend, used by dvb-sat.c to skip the
+ * commands and the settle delays that wouldn't change anything.
+ */
+struct dvb_v5_sec_state {
+	int				voltage;	/* fe_sec_voltage_t, -1 if unknown */
+	int				tone;		/* fe_sec_tone_mode_t, -1 if unknown */
+
+	/* Switch input selected by the last DiSEqC command, if diseqc_valid */
+	int				diseqc_valid;
+	int				high_band;
+	int				pol_v;
+	int				sat_number;
+	uint16_t			t;
+};
+
 struct dvb_device_priv;
+struct dvb_iconv_cache;
 
 struct dvb_v5_fe_parms_priv {
 	/* dvbv_v4_fe_parms should be the first element on this struct */
@@ -69,15 +86,33 @@ struct dvb_v5_fe_parms_priv {
 	struct dtv_property		dvb_prop[DTV_MAX_COMMAND];
 	struct dvb_v5_stats		stats;
 
+	/*
+	 * What the last successful FE_SET_PROPERTY sent, as the Kernel
+	 * keeps it at its cache. n_last_props = 0 sends all properties.
+	 */
+	int				n_last_props;
+	struct dtv_property		last_prop[DTV_MAX_COMMAND];
+	int				last_lna;
+
+	/* Kernel stats read by dvb_fe_get_stats(). 0 means all of them */
+	unsigned int			stats_mask;
+
+	/* enum dvb_scan_tables used by dvb_get_ts_tables(). 0 means all */
+	unsigned			scan_tables;
+
 	/* country variant of the delivery system */
 	enum dvb_country_t		country;
 
 	/* Satellite specific stuff */
 	int				high_band;
 	unsigned			freq_offset;
+	struct dvb_v5_sec_state		sec;
 
 	dvb_logfunc_priv		logfunc_priv;
 	void				*logpriv;
+
+	/* iconv descriptors opened by dvb_parse_string(), see parse_string.c */
+	struct dvb_iconv_cache		*iconv_cache;
 };
 
 /* Functions used internally by dvb-dev.c. Aren't part of the API */
@@ -85,6 +120,12 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 		      int flags);
 void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms);
 void __dvb_fe_close(struct dvb_v5_fe_parms_priv *parms);
+void dvb_fe_prepare_stats(struct dvb_v5_fe_parms_priv *parms);
+struct dtv_stats *dvb_fe_store_stats(struct dvb_v5_fe_parms_priv *parms,
+				     unsigned cmd,
+				     enum fecap_scale_params scale,
+				     unsigned layer,
+				     uint32_t value);
 
 /* Functions that can be overriden to be executed remotely */
 int __dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys);
@@ -19,6 +19,7 @@
 
 #include "dvb-fe-priv.h"
 #include "dvb-v5.h"
+#include "parse_string.h"
 #include <libdvbv5/dvb-dev.h>
 #include <libdvbv5/countries.h>
 #include <libdvbv5/dvb-v5-std.h>
@@ -78,11 +79,20 @@ static void libdvbv5_initialize(void)
 #endif
 }
 
+/* Nothing is known about the SEC until something is sent to it */
+static void dvb_fe_sec_reset(struct dvb_v5_fe_parms_priv *parms)
+{
+	parms->sec.voltage = -1;
+	parms->sec.tone = -1;
+	parms->sec.diseqc_valid = 0;
+}
+
 void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms)
 {
 	if (parms->fname)
 		free(parms->fname);
 
+	dvb_iconv_cache_free(parms);
 	free(parms);
 }
 
@@ -103,6 +113,7 @@ struct dvb_v5_fe_parms *dvb_fe_dummy(void)
 	parms->p.sat_number = -1;
 	parms->p.abort = 0;
 	parms->country = COUNTRY_UNKNOWN;
+	dvb_fe_sec_reset(parms);
 
 	return &parms->p;
 }
@@ -225,6 +236,9 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 	parms->fname = fname;
 	parms->fd = fd;
 	parms->fe_flags = flags;
+	parms->n_last_props = 0;
+	parms->last_lna = LNA_AUTO;
+	dvb_fe_sec_reset(parms);
 	parms->dvb_prop[0].cmd = DTV_API_VERSION;
 	parms->dvb_prop[1].cmd = DTV_DELIVERY_SYSTEM;
 
@@ -383,6 +397,13 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 		}
 	}
 
+	dvb_fe_prepare_stats(parms);
+
+	return 0;
+}
+
+void dvb_fe_prepare_stats(struct dvb_v5_fe_parms_priv *parms)
+{
 	/*
 	 * Prepare the status struct - DVBv5.10 parameters should
 	 * come first, as they'll be read together.
@@ -402,8 +423,6 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 	parms->stats.prop[10].cmd = DTV_PER;
 	parms->stats.prop[11].cmd = DTV_QUALITY;
 	parms->stats.prop[12].cmd = DTV_PRE_BER;
-
-	return 0;
 }
 
 
@@ -507,6 +526,9 @@ int __dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys)
 		prop.num = 1;
 		prop.props = dvb_prop;
 
+		/* The properties at the Kernel cache are for the old one */
+		parms->n_last_props = 0;
+
 		if (xioctl(parms->fd, FE_SET_PROPERTY, &prop) == -1) {
 			dvb_perror(_("Set delivery system"));
 			return -errno;
@@ -871,6 +893,41 @@ static void dvb_setup_delsys_default(struct dvb_v5_fe_parms *p)
 	}
 }
 
+/*
+ * Copies to fe_prop only the properties that changed since the last
+ * successful FE_SET_PROPERTY, as the Kernel keeps the other ones at its
+ * cache. Everything is copied if the list of properties changed, which
+ * also happens when the delivery system changes. DTV_FREQUENCY is always
+ * copied, as the Kernel may change it at its cache while zig-zagging.
+ */
+static int dvb_fe_changed_props(struct dvb_v5_fe_parms_priv *parms,
+				struct dtv_property *props, int n,
+				struct dtv_property *fe_prop)
+{
+	int i, j = 0;
+	int all = (n != parms->n_last_props);
+
+	for (i = 0; i < n && !all; i++) {
+		if (props[i].cmd != parms->last_prop[i].cmd)
+			all = 1;
+		else if (props[i].cmd == DTV_DELIVERY_SYSTEM &&
+			 props[i].u.data != parms->last_prop[i].u.data)
+			all = 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!all && props[i].cmd != DTV_FREQUENCY &&
+		    props[i].u.data == parms->last_prop[i].u.data)
+			continue;
+		fe_prop[j++] = props[i];
+	}
+
+	if (parms->p.verbose > 1 && !all)
+		dvb_logdbg(_("Sending %d of %d properties"), j, n);
+
+	return j;
+}
+
 int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
@@ -879,10 +936,12 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 	struct dvb_v5_fe_parms_priv tmp_parms = *parms;
 
 	struct dtv_properties prop;
+	struct dtv_property fe_prop[DTV_MAX_COMMAND];
 	struct dvb_frontend_parameters v3_parms;
 	uint32_t bw;
 
-	if (parms->p.lna != LNA_AUTO && !parms->p.legacy_fe) {
+	if (parms->p.lna != LNA_AUTO && parms->p.lna != parms->last_lna &&
+	    !parms->p.legacy_fe) {
 		struct dvb_v5_fe_parms_priv tmp_lna_parms;
 
 		memset(&prop, 0, sizeof(prop));
@@ -894,8 +953,11 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 		if (xioctl(parms->fd, FE_SET_PROPERTY, &prop) == -1) {
 			dvb_perror(_("Setting LNA"));
 			parms->p.lna = LNA_AUTO;
-		} else if (parms->p.lna != LNA_AUTO && parms->p.verbose)
-			dvb_logdbg(_("LNA is %s"), parms->p.lna ? _("ON") : _("OFF"));
+		} else {
+			parms->last_lna = parms->p.lna;
+			if (parms->p.verbose)
+				dvb_logdbg(_("LNA is %s"), parms->p.lna ? _("ON") : _("OFF"));
+		}
 	}
 
 	if (dvb_fe_is_satellite(tmp_parms.p.current_sys)) {
@@ -910,6 +972,7 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 		 * indirectly from check_frontend() via dvb_fe_get_stats().
 		 */
 		parms->freq_offset = tmp_parms.freq_offset;
+		parms->sec = tmp_parms.sec;
 	}
 
 	dvb_setup_delsys_default(p);
@@ -919,19 +982,24 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 					      tmp_parms.n_props,
 					      tmp_parms.dvb_prop);
 
-	memset(&prop, 0, sizeof(prop));
-	prop.props = tmp_parms.dvb_prop;
-	prop.num = tmp_parms.n_props;
-	prop.props[prop.num].cmd = DTV_TUNE;
-	prop.num++;
-
 	if (!parms->p.legacy_fe) {
+		memset(&prop, 0, sizeof(prop));
+		prop.props = fe_prop;
+		prop.num = dvb_fe_changed_props(parms, tmp_parms.dvb_prop,
+						tmp_parms.n_props, fe_prop);
+		prop.props[prop.num].cmd = DTV_TUNE;
+		prop.num++;
+
 		if (xioctl(parms->fd, FE_SET_PROPERTY, &prop) == -1) {
 			dvb_perror("FE_SET_PROPERTY");
 			if (parms->p.verbose)
 				dvb_fe_prt_parms(&parms->p);
+			parms->n_last_props = 0;
 			return -errno;
 		}
+		memcpy(parms->last_prop, tmp_parms.dvb_prop,
+		       tmp_parms.n_props * sizeof(*parms->last_prop));
+		parms->n_last_props = tmp_parms.n_props;
 		return 0;
 	}
 	/* DVBv3 call */
@@ -978,7 +1046,7 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 	return 0;
 }
 
-static struct dtv_stats *dvb_fe_store_stats(struct dvb_v5_fe_parms_priv *parms,
+struct dtv_stats *dvb_fe_store_stats(struct dvb_v5_fe_parms_priv *parms,
 			      unsigned cmd,
 			      enum fecap_scale_params scale,
 			      unsigned layer,
@@ -1437,6 +1505,17 @@ static void dvb_fe_update_counters(struct dvb_v5_fe_parms_priv *parms)
 	}
 }
 
+static unsigned int dvb_fe_stats_bit(struct dvb_v5_fe_parms_priv *parms,
+				     uint32_t cmd)
+{
+	int i;
+
+	for (i = 0; i < DTV_NUM_KERNEL_STATS; i++)
+		if (parms->stats.prop[i].cmd == cmd)
+			return 1 << i;
+	return 0;
+}
+
 int __dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
@@ -1462,9 +1541,20 @@ int __dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 
 	if (parms->p.has_v5_stats) {
 		struct dtv_properties props;
+		struct dtv_property fe_prop[DTV_NUM_KERNEL_STATS];
+		int n = 0;
+
+		/* Read just the selected stats, in a single call */
+		for (i = 0; i < DTV_NUM_KERNEL_STATS; i++) {
+			if (parms->stats_mask && !(parms->stats_mask & (1 << i)))
+				continue;
+			fe_prop[n].cmd = parms->stats.prop[i].cmd;
+			fe_prop[n].u.st.len = 0;
+			n++;
+		}
 
-		props.num = DTV_NUM_KERNEL_STATS;
-		props.props = parms->stats.prop;
+		props.num = n;
+		props.props = fe_prop;
 
 		/* Do a DVBv5.10 stats call */
 		if (ioctl(parms->fd, FE_GET_PROPERTY, &props) == -1) {
@@ -1477,12 +1567,20 @@ int __dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 		 * All props with len=0 mean that this device doesn't have any
 		 * dvbv5 stats. Try the legacy stats instead.
 		 */
-		for (i = 0; i < props.num; i++)
-			if (parms->stats.prop[i].u.st.len)
+		for (i = 0; i < n; i++)
+			if (fe_prop[i].u.st.len)
 				break;
-		if (i == props.num)
+		if (i == n)
 			goto dvbv3_fallback;
 
+		/* Stats that weren't read are reported as not available */
+		for (i = 0, n = 0; i < DTV_NUM_KERNEL_STATS; i++) {
+			if (parms->stats_mask && !(parms->stats_mask & (1 << i)))
+				parms->stats.prop[i].u.st.len = 0;
+			else
+				parms->stats.prop[i] = fe_prop[n++];
+		}
+
 		dvb_fe_update_counters(parms);
 
 		return 0;
@@ -1535,6 +1633,56 @@ dvbv3_fallback:
 }
 
 
+int dvb_fe_select_stats(struct dvb_v5_fe_parms *p, const uint32_t *cmds,
+			unsigned int num)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	unsigned int mask = 0, i, j;
+	uint32_t cmd;
+
+	for (i = 0; i < num; i++) {
+		cmd = cmds[i];
+
+		/* Calculated stats need the counters they're based on */
+		switch (cmd) {
+		case DTV_STATUS:
+			continue;
+		case DTV_BER:
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_POST_ERROR_BIT_COUNT);
+			cmd = DTV_STAT_POST_TOTAL_BIT_COUNT;
+			break;
+		case DTV_PRE_BER:
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_PRE_ERROR_BIT_COUNT);
+			cmd = DTV_STAT_PRE_TOTAL_BIT_COUNT;
+			break;
+		case DTV_PER:
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_ERROR_BLOCK_COUNT);
+			cmd = DTV_STAT_TOTAL_BLOCK_COUNT;
+			break;
+		case DTV_QUALITY:
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_ERROR_BLOCK_COUNT);
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_TOTAL_BLOCK_COUNT);
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_POST_ERROR_BIT_COUNT);
+			mask |= dvb_fe_stats_bit(parms, DTV_STAT_POST_TOTAL_BIT_COUNT);
+			cmd = DTV_STAT_CNR;
+			break;
+		}
+
+		for (j = 0; j < DTV_NUM_KERNEL_STATS; j++)
+			if (parms->stats.prop[j].cmd == cmd)
+				break;
+		if (j == DTV_NUM_KERNEL_STATS) {
+			dvb_logerr(_("%s is not a stats property"),
+				   dvb_cmd_name(cmds[i]));
+			return -EINVAL;
+		}
+		mask |= 1 << j;
+	}
+
+	parms->stats_mask = mask;
+	return 0;
+}
+
 int dvb_fe_get_event(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
@@ -1864,6 +2012,7 @@ int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 	}
 	rc = xioctl(parms->fd, FE_SET_VOLTAGE, v);
 	if (rc == -1) {
+		parms->sec.voltage = -1;
 		if (errno == ENOTSUP) {
 			dvb_logerr("FE_SET_VOLTAGE: driver doesn't support it!");
 		} else {
@@ -1871,6 +2020,10 @@ int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 		}
 		return -errno;
 	}
+	parms->sec.voltage = v;
+	/* Switches may forget the selected input without power */
+	if (v == SEC_VOLTAGE_OFF)
+		parms->sec.diseqc_valid = 0;
 	return rc;
 }
 
@@ -1882,9 +2035,11 @@ int dvb_fe_sec_tone(struct dvb_v5_fe_parms *p, fe_sec_tone_mode_t tone)
 		dvb_log( _("DiSEqC TONE: %s"), fe_tone_name[tone] );
 	rc = xioctl(parms->fd, FE_SET_TONE, tone);
 	if (rc == -1) {
+		parms->sec.tone = -1;
 		dvb_perror("FE_SET_TONE");
 		return -errno;
 	}
+	parms->sec.tone = tone;
 	return rc;
 }
 
@@ -1911,6 +2066,7 @@ int dvb_fe_diseqc_burst(struct dvb_v5_fe_parms *p, int mini_b)
 	int rc;
 
 	mini = mini_b ? SEC_MINI_B : SEC_MINI_A;
+	parms->sec.diseqc_valid = 0;
 
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC BURST: %s"), mini_b ? "SEC_MINI_B" : "SEC_MINI_A" );
@@ -1932,6 +2088,8 @@ int dvb_fe_diseqc_cmd(struct dvb_v5_fe_parms *p, const unsigned len,
 	if (len > 6)
 		return -EINVAL;
 
+	/* dvb-sat.c sets it again once its whole sequence was sent */
+	parms->sec.diseqc_valid = 0;
 	msg.msg_len = len;
 	memcpy(msg.msg, buf, len);
 
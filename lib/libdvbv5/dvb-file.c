@@ -17,11 +17,15 @@
  *
  */
 
+#include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "dvb-fe-priv.h"
 #include <libdvbv5/dvb-file.h>
@@ -220,18 +224,100 @@ static void adjust_delsys(struct dvb_entry *entry)
  * Generic parse function for all formats each channel is contained into
  * just one line.
  */
+/*
+ * Channel files are read line by line. Regular files are mapped on a
+ * private copy-on-write mapping, and each line is split and tokenized in
+ * place, without copying it. Other files (like pipes) use getline().
+ */
+struct dvb_file_reader {
+	FILE *fp;
+	char *map;
+	size_t map_size, pos;
+	char *buf;
+	size_t size;
+};
+
+static int dvb_file_reader_open(struct dvb_file_reader *r, const char *fname)
+{
+	struct stat st;
+	int fd;
+
+	memset(r, 0, sizeof(*r));
+	r->map = MAP_FAILED;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    (size_t)st.st_size == st.st_size) {
+		r->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE, fd, 0);
+		if (r->map != MAP_FAILED) {
+			r->map_size = st.st_size;
+			madvise(r->map, r->map_size, MADV_SEQUENTIAL);
+			close(fd);
+			return 0;
+		}
+	}
+
+	r->fp = fdopen(fd, "r");
+	if (!r->fp) {
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+static char *dvb_file_reader_getline(struct dvb_file_reader *r)
+{
+	char *line, *end;
+	size_t len;
+
+	if (r->fp) {
+		if (getline(&r->buf, &r->size, r->fp) <= 0)
+			return NULL;
+		return r->buf;
+	}
+
+	if (r->pos >= r->map_size)
+		return NULL;
+
+	line = r->map + r->pos;
+	len = r->map_size - r->pos;
+	end = memchr(line, '\n', len);
+	if (end) {
+		*end = '\0';
+		r->pos += end - line + 1;
+		return line;
+	}
+
+	/* Last line without a newline: there's no room to terminate it */
+	r->pos = r->map_size;
+	free(r->buf);
+	r->buf = strndup(line, len);
+	return r->buf;
+}
+
+static void dvb_file_reader_close(struct dvb_file_reader *r)
+{
+	if (r->fp)
+		fclose(r->fp);
+	if (r->map != MAP_FAILED)
+		munmap(r->map, r->map_size);
+	free(r->buf);
+}
+
 struct dvb_file *dvb_parse_format_oneline(const char *fname,
 					  uint32_t delsys,
 					  const struct dvb_parse_file *parse_file)
 {
 	const char *delimiter = parse_file->delimiter;
 	const struct dvb_parse_struct *formats = parse_file->formats;
-	char *buf = NULL, *p;
-	size_t size = 0;
-	int len = 0;
+	struct dvb_file_reader r;
+	char *p;
 	int i, j, line = 0;
 	struct dvb_file *dvb_file;
-	FILE *fd;
 	const struct dvb_parse_struct *fmt;
 	struct dvb_entry *entry = NULL;
 	const struct dvb_parse_table *table;
@@ -244,20 +330,18 @@ struct dvb_file *dvb_parse_format_oneline(const char *fname,
 		return NULL;
 	}
 
-	fd = fopen(fname, "r");
-	if (!fd) {
+	if (dvb_file_reader_open(&r, fname) < 0) {
 		perror(fname);
 		free(dvb_file);
 		return NULL;
 	}
 
 	do {
-		len = getline(&buf, &size, fd);
-		if (len <= 0)
+		p = dvb_file_reader_getline(&r);
+		if (!p)
 			break;
 		line++;
 
-		p = buf;
 		while (*p == ' ')
 			p++;
 		if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
@@ -376,18 +460,14 @@ struct dvb_file *dvb_parse_format_oneline(const char *fname,
 		}
 		adjust_delsys(entry);
 	} while (1);
-	fclose(fd);
-	if (buf)
-		free(buf);
+	dvb_file_reader_close(&r);
 	return dvb_file;
 
 error:
 	fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
 		 err_msg, line, fname);
 	dvb_file_free(dvb_file);
-	fclose(fd);
-	if (buf)
-		free(buf);
+	dvb_file_reader_close(&r);
 	return NULL;
 }
 
@@ -579,10 +659,15 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 	int is_video = 0, is_audio = 0, n_prop;
 	uint16_t *pid = NULL;
 	char *p;
+	char c = toupper((unsigned char)*key);
 
-	/* Handle the DVBv5 DTV_foo properties */
+	/*
+	 * Handle the DVBv5 DTV_foo properties. The names are all in
+	 * uppercase: checking the first letter before strcasecmp() avoids
+	 * most of the compares, as this runs for every key of the file.
+	 */
 	for (i = 0; i < ARRAY_SIZE(dvb_v5_name); i++) {
-		if (!dvb_v5_name[i])
+		if (!dvb_v5_name[i] || dvb_v5_name[i][0] != c)
 			continue;
 		if (!strcasecmp(key, dvb_v5_name[i]))
 			break;
@@ -692,6 +777,8 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 		for (i = 0; i < DTV_USER_NAME_SIZE; i++) {
 			cmd = i + DTV_USER_COMMAND_START;
 
+			if (!dvb_user_name[i] || dvb_user_name[i][0] != c)
+				continue;
 			if (!strcasecmp(key, dvb_user_name[i]))
 				break;
 		}
@@ -742,12 +829,10 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 
 struct dvb_file *dvb_read_file(const char *fname)
 {
-	char *buf = NULL, *p, *key, *value;
-	size_t size = 0;
-	int len = 0;
+	struct dvb_file_reader r;
+	char *p, *key, *value;
 	int line = 0, rc;
 	struct dvb_file *dvb_file;
-	FILE *fd;
 	struct dvb_entry *entry = NULL;
 	char err_msg[80];
 
@@ -757,19 +842,17 @@ struct dvb_file *dvb_read_file(const char *fname)
 		return NULL;
 	}
 
-	fd = fopen(fname, "r");
-	if (!fd) {
+	if (dvb_file_reader_open(&r, fname) < 0) {
 		perror(fname);
 		free(dvb_file);
 		return NULL;
 	}
 
 	do {
-		len = getline(&buf, &size, fd);
-		if (len <= 0)
+		p = dvb_file_reader_getline(&r);
+		if (!p)
 			break;
 		line++;
-		p = buf;
 		while (*p == ' ' || *p == '\t')
 			p++;
 		if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
@@ -830,20 +913,16 @@ struct dvb_file *dvb_read_file(const char *fname)
 			}
 		}
 	} while (1);
-	if (buf)
-		free(buf);
 	if (entry)
 		adjust_delsys(entry);
-	fclose(fd);
+	dvb_file_reader_close(&r);
 	return dvb_file;
 
 error:
 	fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
 		 err_msg, line, fname);
-	if (buf)
-		free(buf);
 	dvb_file_free(dvb_file);
-	fclose(fd);
+	dvb_file_reader_close(&r);
 	return NULL;
 };
 
@@ -1611,3 +1690,327 @@ int dvb_write_file_format(const char *fname,
 
 	return ret;
 }
+
+/*
+ * Indexes for big channel lists: hash tables for the channel names and
+ * for the service IDs, and an array sorted by frequency, as frequencies
+ * are searched with a tolerance.
+ */
+
+#define DVB_FILE_MIN_HASH_SIZE	256
+
+struct dvb_file_hnode {
+	uint32_t hash;
+	struct dvb_entry *entry;
+	struct dvb_file_hnode *next;
+};
+
+struct dvb_file_freq {
+	uint32_t freq;
+	struct dvb_entry *entry;
+};
+
+struct dvb_file_index {
+	unsigned int hash_size, n_entries;
+	struct dvb_file_hnode **names;
+	struct dvb_file_hnode **services;
+
+	unsigned int n_freqs, freqs_size;
+	struct dvb_file_freq *freqs;
+};
+
+/* FNV-1a hash of the name, case insensitive */
+static uint32_t dvb_file_hash_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	while (*name) {
+		hash ^= (unsigned char)tolower((unsigned char)*name++);
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static uint32_t dvb_file_hash_service(uint16_t service_id)
+{
+	return service_id * 2654435761U;
+}
+
+/* Appends the node, so the first entry of the file is found first */
+static void dvb_file_hash_append(struct dvb_file_hnode **table,
+				 unsigned int size,
+				 struct dvb_file_hnode *node)
+{
+	struct dvb_file_hnode **p;
+
+	node->next = NULL;
+	for (p = &table[node->hash & (size - 1)]; *p; p = &(*p)->next);
+	*p = node;
+}
+
+static int dvb_file_hash_add(struct dvb_file_hnode **table, unsigned int size,
+			     uint32_t hash, struct dvb_entry *entry)
+{
+	struct dvb_file_hnode *node;
+
+	node = malloc(sizeof(*node));
+	if (!node)
+		return -ENOMEM;
+	node->hash = hash;
+	node->entry = entry;
+	dvb_file_hash_append(table, size, node);
+
+	return 0;
+}
+
+static void dvb_file_hash_free(struct dvb_file_hnode **table, unsigned int size)
+{
+	struct dvb_file_hnode *node, *next;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		for (node = table[i]; node; node = next) {
+			next = node->next;
+			free(node);
+		}
+	}
+	free(table);
+}
+
+/* Moves all nodes to a table with the double of the size */
+static struct dvb_file_hnode **dvb_file_hash_grow(struct dvb_file_hnode **table,
+						  unsigned int size)
+{
+	struct dvb_file_hnode **new_table, *node, *next;
+	unsigned int i;
+
+	new_table = calloc(size * 2, sizeof(*new_table));
+	if (!new_table)
+		return NULL;
+
+	for (i = 0; i < size; i++) {
+		for (node = table[i]; node; node = next) {
+			next = node->next;
+			dvb_file_hash_append(new_table, size * 2, node);
+		}
+	}
+	free(table);
+
+	return new_table;
+}
+
+static int dvb_file_index_freq(struct dvb_file_index *index,
+			       struct dvb_entry *entry)
+{
+	struct dvb_file_freq *freqs;
+	unsigned int lo, hi, mid;
+	uint32_t freq;
+
+	if (dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq))
+		return 0;
+
+	if (index->n_freqs == index->freqs_size) {
+		freqs = realloc(index->freqs, 2 * index->freqs_size *
+					      sizeof(*freqs));
+		if (!freqs)
+			return -ENOMEM;
+		index->freqs = freqs;
+		index->freqs_size *= 2;
+	}
+
+	/* Insert it after the entries with the same frequency */
+	lo = 0;
+	hi = index->n_freqs;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (index->freqs[mid].freq <= freq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memmove(&index->freqs[lo + 1], &index->freqs[lo],
+		(index->n_freqs - lo) * sizeof(*index->freqs));
+	index->freqs[lo].freq = freq;
+	index->freqs[lo].entry = entry;
+	index->n_freqs++;
+
+	return 0;
+}
+
+int dvb_file_index_add(struct dvb_file_index *index, struct dvb_entry *entry)
+{
+	struct dvb_file_hnode **table;
+	int ret = 0;
+
+	/* Keep the chains short */
+	if (index->n_entries >= index->hash_size) {
+		table = dvb_file_hash_grow(index->names, index->hash_size);
+		if (!table)
+			return -ENOMEM;
+		index->names = table;
+
+		table = dvb_file_hash_grow(index->services, index->hash_size);
+		if (!table)
+			return -ENOMEM;
+		index->services = table;
+
+		index->hash_size *= 2;
+	}
+
+	if (entry->channel)
+		ret = dvb_file_hash_add(index->names, index->hash_size,
+					dvb_file_hash_name(entry->channel),
+					entry);
+	if (!ret && entry->vchannel)
+		ret = dvb_file_hash_add(index->names, index->hash_size,
+					dvb_file_hash_name(entry->vchannel),
+					entry);
+	if (!ret)
+		ret = dvb_file_hash_add(index->services, index->hash_size,
+					dvb_file_hash_service(entry->service_id),
+					entry);
+	if (!ret)
+		ret = dvb_file_index_freq(index, entry);
+	if (!ret)
+		index->n_entries++;
+
+	return ret;
+}
+
+void dvb_file_index_free(struct dvb_file_index *index)
+{
+	if (!index)
+		return;
+
+	dvb_file_hash_free(index->names, index->hash_size);
+	dvb_file_hash_free(index->services, index->hash_size);
+	free(index->freqs);
+	free(index);
+}
+
+struct dvb_file_index *dvb_file_index_alloc(struct dvb_file *dvb_file)
+{
+	struct dvb_file_index *index;
+	struct dvb_entry *entry;
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+
+	index->hash_size = DVB_FILE_MIN_HASH_SIZE;
+	index->freqs_size = DVB_FILE_MIN_HASH_SIZE;
+	index->names = calloc(index->hash_size, sizeof(*index->names));
+	index->services = calloc(index->hash_size, sizeof(*index->services));
+	index->freqs = calloc(index->freqs_size, sizeof(*index->freqs));
+	if (!index->names || !index->services || !index->freqs)
+		goto error;
+
+	if (!dvb_file)
+		return index;
+
+	for (entry = dvb_file->first_entry; entry; entry = entry->next)
+		if (dvb_file_index_add(index, entry) < 0)
+			goto error;
+
+	return index;
+
+error:
+	dvb_file_index_free(index);
+	return NULL;
+}
+
+struct dvb_entry *dvb_file_find_channel(struct dvb_file_index *index,
+					const char *name)
+{
+	uint32_t hash = dvb_file_hash_name(name);
+	struct dvb_file_hnode *node;
+	struct dvb_entry *entry;
+
+	node = index->names[hash & (index->hash_size - 1)];
+	for (; node; node = node->next) {
+		entry = node->entry;
+		if (node->hash != hash)
+			continue;
+		if (entry->channel && !strcmp(entry->channel, name))
+			return entry;
+		if (entry->vchannel && !strcmp(entry->vchannel, name))
+			return entry;
+	}
+
+	/* Give a second shot, using a case insensitive seek */
+	node = index->names[hash & (index->hash_size - 1)];
+	for (; node; node = node->next) {
+		entry = node->entry;
+		if (node->hash != hash)
+			continue;
+		if (entry->channel && !strcasecmp(entry->channel, name))
+			return entry;
+	}
+
+	return NULL;
+}
+
+struct dvb_entry *dvb_file_find_service(struct dvb_file_index *index,
+					uint16_t service_id,
+					uint16_t transport_id)
+{
+	uint32_t hash = dvb_file_hash_service(service_id);
+	struct dvb_file_hnode *node;
+
+	node = index->services[hash & (index->hash_size - 1)];
+	for (; node; node = node->next) {
+		if (node->entry->service_id != service_id)
+			continue;
+		if (transport_id && node->entry->transport_id != transport_id)
+			continue;
+		return node->entry;
+	}
+
+	return NULL;
+}
+
+struct dvb_entry *dvb_file_find_freq(struct dvb_file_index *index,
+				     uint32_t freq, uint32_t shift,
+				     enum dvb_sat_polarization pol,
+				     uint32_t stream_id)
+{
+	uint32_t min = freq > shift ? freq - shift : 0;
+	struct dvb_entry *entry;
+	unsigned int lo, hi, mid;
+	uint32_t data;
+
+	/* Seek for the first entry with frequency >= min */
+	lo = 0;
+	hi = index->n_freqs;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (index->freqs[mid].freq < min)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < index->n_freqs; lo++) {
+		if (index->freqs[lo].freq > freq &&
+		    index->freqs[lo].freq - freq > shift)
+			break;
+
+		entry = index->freqs[lo].entry;
+		if (pol != POLARIZATION_OFF &&
+		    !dvb_retrieve_entry_prop(entry, DTV_POLARIZATION, &data) &&
+		    data != pol)
+			continue;
+		/*
+		 * NO_STREAM_ID_FILTER: stream_id is not used.
+		 * 0: unspecified/auto. libdvbv5 default value.
+		 */
+		if (stream_id != NO_STREAM_ID_FILTER && stream_id != 0 &&
+		    !dvb_retrieve_entry_prop(entry, DTV_STREAM_ID, &data) &&
+		    data != stream_id)
+			continue;
+
+		return entry;
+	}
+
+	return NULL;
+}
@@ -520,6 +520,10 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 	int tone_on = 0;
 	struct diseqc_cmd cmd;
 	const struct dvb_sat_lnb_priv *lnb = (void *)parms->p.lnb;
+	struct dvb_v5_sec_state *sec = &parms->sec;
+	fe_sec_voltage_t voltage;
+	fe_sec_tone_mode_t tone;
+	int settle = 0;
 
 	if (sat_number < 0 && t) {
 		dvb_logwarn(_("DiSEqC disabled. Can't tune using SCR/Unicable."));
@@ -546,18 +550,41 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 			tone_on = high_band;
 		}
 	}
+	voltage = vol_high ? SEC_VOLTAGE_18 : SEC_VOLTAGE_13;
+	tone = tone_on ? SEC_TONE_ON : SEC_TONE_OFF;
+
+	/*
+	 * Skip what wouldn't change since the last tune, together with its
+	 * settle delays, e. g. when zapping within the same band and
+	 * polarization.
+	 */
+	if (sec->voltage == voltage && sec->tone == tone &&
+	    (sat_number < 0 ||
+	     (sec->diseqc_valid && sec->high_band == high_band &&
+	      sec->pol_v == pol_v && sec->sat_number == sat_number &&
+	      sec->t == t))) {
+		if (parms->p.verbose > 1)
+			dvb_log(_("SEC: already set"));
+		return 0;
+	}
 
-	rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
-	if (rc)
-		return rc;
-
-	rc = dvb_fe_sec_tone(&parms->p, SEC_TONE_OFF);
-	if (rc)
-		return rc;
+	if (sec->voltage != voltage) {
+		rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
+		if (rc)
+			return rc;
+		settle = 1;
+	}
 
 	if (sat_number >= 0) {
 		/* DiSEqC is enabled. Send DiSEqC commands */
-		usleep(15 * 1000);
+		if (sec->tone != SEC_TONE_OFF) {
+			rc = dvb_fe_sec_tone(&parms->p, SEC_TONE_OFF);
+			if (rc)
+				return rc;
+			settle = 1;
+		}
+		if (settle)
+			usleep(15 * 1000);
 
 		if (!t)
 			rc = dvbsat_diseqc_write_to_port_group(parms, &cmd, high_band,
@@ -581,9 +608,21 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 		usleep(15 * 1000);
 	}
 
-	rc = dvb_fe_sec_tone(&parms->p, tone_on ? SEC_TONE_ON : SEC_TONE_OFF);
+	if (sec->tone != tone) {
+		rc = dvb_fe_sec_tone(&parms->p, tone);
+		if (rc)
+			return rc;
+	}
 
-	return rc;
+	if (sat_number >= 0) {
+		sec->diseqc_valid = 1;
+		sec->high_band = high_band;
+		sec->pol_v = pol_v;
+		sec->sat_number = sat_number;
+		sec->t = t;
+	}
+
+	return 0;
 }
 
 int dvb_sat_real_freq(struct dvb_v5_fe_parms *p, int freq)
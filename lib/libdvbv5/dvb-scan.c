@@ -27,6 +27,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -38,6 +39,7 @@
 #include <sys/time.h>
 
 #include "dvb-fe-priv.h"
+#include "libv4l-probes.h"
 #include <libdvbv5/dvb-scan.h>
 #include <libdvbv5/dvb-frontend.h>
 #include <libdvbv5/descriptors.h>
@@ -53,6 +55,10 @@
 #include <libdvbv5/nit.h>
 #include <libdvbv5/sdt.h>
 #include <libdvbv5/vct.h>
+#include <libdvbv5/cat.h>
+#include <libdvbv5/eit.h>
+#include <libdvbv5/mgt.h>
+#include <libdvbv5/atsc_eit.h>
 #include <libdvbv5/desc_extension.h>
 #include <libdvbv5/desc_cable_delivery.h>
 #include <libdvbv5/desc_isdbt_delivery.h>
@@ -72,6 +78,10 @@
 
 # define N_(string) string
 
+V4L_PROBE_SEMAPHORE(libdvbv5, read_sections_entry);
+V4L_PROBE_SEMAPHORE(libdvbv5, read_sections_return);
+V4L_PROBE_SEMAPHORE(libdvbv5, section);
+
 static int dvb_poll(struct dvb_v5_fe_parms_priv *parms, int fd, unsigned int seconds)
 {
 	fd_set set;
@@ -309,11 +319,10 @@ ret:
 	return 1;
 }
 
-int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
-			     struct dvb_table_filter *sect,
-			     unsigned timeout)
+static int dvb_do_read_sections(struct dvb_v5_fe_parms_priv *parms,
+				int dmx_fd, struct dvb_table_filter *sect,
+				unsigned timeout)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
 	int ret;
 	uint8_t *buf = NULL;
 	uint8_t mask = 0xff;
@@ -360,6 +369,8 @@ int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
 			break;
 		}
 		buf_length = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+		V4L_PROBE(libdvbv5, section, dmx_fd, sect->tid, sect->pid,
+			  buf_length);
 
 		if (!buf_length) {
 			dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
@@ -391,6 +402,24 @@ int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
 	return ret;
 }
 
+int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
+			     struct dvb_table_filter *sect,
+			     unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	uint64_t start = V4L_PROBE_START(libdvbv5, read_sections_return);
+	unsigned char tid = sect->tid;
+	uint16_t pid = sect->pid;
+	int ret;
+
+	V4L_PROBE(libdvbv5, read_sections_entry, dmx_fd, tid, pid, timeout);
+	ret = dvb_do_read_sections(parms, dmx_fd, sect, timeout);
+	V4L_PROBE(libdvbv5, read_sections_return, dmx_fd, tid, pid, ret,
+		  V4L_PROBE_NS(start));
+
+	return ret;
+}
+
 int dvb_read_section_with_id(struct dvb_v5_fe_parms *parms, int dmx_fd,
 			     unsigned char tid, uint16_t pid,
 			     int ts_id,
@@ -407,6 +436,586 @@ int dvb_read_section_with_id(struct dvb_v5_fe_parms *parms, int dmx_fd,
 	return dvb_read_sections(parms, dmx_fd, &tab, timeout);
 }
 
+/*
+ * Concurrent section acquisition: each table gets its own section filter.
+ * The first one uses dmx_fd, the others use new opens of the same demux
+ * device, so the filters run in parallel and are multiplexed by a single
+ * poll() loop. If the demux runs out of filters, the remaining tables wait
+ * for a free one.
+ */
+#define DVB_MAX_SECTION_FILTERS	16
+
+struct dvb_section_slot {
+	int fd;
+	int own_fd;
+	int table;
+	struct timeval deadline;
+};
+
+static int dvb_open_dmx_clone(int dmx_fd)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", dmx_fd);
+	return open(path, O_RDWR | O_NONBLOCK);
+}
+
+static int dvb_start_section(struct dvb_v5_fe_parms_priv *parms,
+			     struct dvb_section_slot *slot,
+			     struct dvb_table_filter *sect,
+			     unsigned timeout)
+{
+	uint8_t mask = 0xff;
+	int ret;
+
+	ret = dvb_parse_section_alloc(parms, sect);
+	if (ret < 0)
+		return ret;
+
+	if (dvb_set_section_filter(slot->fd, sect->pid, 1,
+				   &sect->tid, &mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		dvb_dmx_stop(slot->fd);
+		dvb_table_filter_free(sect);
+		return -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
+			__func__, sect->tid, sect->pid);
+
+	gettimeofday(&slot->deadline, NULL);
+	slot->deadline.tv_sec += timeout;
+	return 0;
+}
+
+static void dvb_stop_section(struct dvb_section_slot *slot,
+			     struct dvb_table_filter *sect)
+{
+	dvb_dmx_stop(slot->fd);
+	dvb_table_filter_free(sect);
+	slot->table = -1;
+}
+
+/*
+ * Called by dvb_do_read_sections_multi() while tables are still pending.
+ * done[i] is set once table i was read or failed. Returning 1 stops the
+ * pending tables, their rc is set to DVB_SECTIONS_SKIPPED.
+ */
+typedef int (*dvb_sections_enough_func)(void *priv, const int *rc,
+					const char *done);
+
+#define DVB_SECTIONS_SKIPPED	1
+
+static int dvb_do_read_sections_multi(struct dvb_v5_fe_parms_priv *parms,
+				      int dmx_fd,
+				      struct dvb_table_filter *sects, int *rc,
+				      const unsigned *timeout, unsigned num,
+				      dvb_sections_enough_func enough,
+				      void *priv)
+{
+	struct dvb_section_slot slot[DVB_MAX_SECTION_FILTERS];
+	struct pollfd fds[DVB_MAX_SECTION_FILTERS];
+	unsigned num_slots = 1, next = 0, pending = num;
+	uint8_t *buf;
+	char *done;
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < num; i++)
+		rc[i] = -1;
+	if (!num)
+		return 0;
+
+	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+	done = calloc(num, 1);
+	if (!buf || !done) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		free(buf);
+		free(done);
+		return -1;
+	}
+
+	slot[0].fd = dmx_fd;
+	slot[0].own_fd = 0;
+	slot[0].table = -1;
+	while (num_slots < num && num_slots < DVB_MAX_SECTION_FILTERS) {
+		int fd = dvb_open_dmx_clone(dmx_fd);
+
+		if (fd < 0)
+			break;
+		slot[num_slots].fd = fd;
+		slot[num_slots].own_fd = 1;
+		slot[num_slots].table = -1;
+		num_slots++;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: reading %u tables using %u section filters"),
+			__func__, num, num_slots);
+
+	while (pending && !parms->p.abort) {
+		struct timeval now;
+		int poll_timeout = -1, available;
+		unsigned nfds = 0;
+
+		/* Start the next tables on the idle filters */
+		for (i = 0; i < num_slots && next < num; i++) {
+			if (slot[i].table >= 0)
+				continue;
+			rc[next] = dvb_start_section(parms, &slot[i], &sects[next],
+						     timeout[next]);
+			if (!rc[next]) {
+				slot[i].table = next++;
+				continue;
+			}
+			/*
+			 * Out of hardware section filters: retry this table
+			 * on a filter that is already in use.
+			 */
+			if (slot[i].own_fd && num_slots > 1) {
+				close(slot[i].fd);
+				slot[i--] = slot[--num_slots];
+				continue;
+			}
+			done[next++] = 1;
+			pending--;
+		}
+
+		gettimeofday(&now, NULL);
+		for (i = 0; i < num_slots; i++) {
+			int t = slot[i].table;
+			long ms;
+
+			if (t < 0)
+				continue;
+			ms = (slot[i].deadline.tv_sec - now.tv_sec) * 1000 +
+			     (slot[i].deadline.tv_usec - now.tv_usec) / 1000;
+			if (ms <= 0) {
+				dvb_logerr(_("%s: no data read on section filter for table ID 0x%02x, program ID 0x%02x"),
+					   __func__, sects[t].tid, sects[t].pid);
+				rc[t] = -1;
+				dvb_stop_section(&slot[i], &sects[t]);
+				done[t] = 1;
+				pending--;
+				continue;
+			}
+			if (poll_timeout < 0 || ms < poll_timeout)
+				poll_timeout = ms;
+			fds[nfds].fd = slot[i].fd;
+			fds[nfds].events = POLLIN | POLLPRI;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+		if (!nfds)
+			continue;
+
+		available = poll(fds, nfds, poll_timeout);
+		if (available < 0 && errno != EINTR) {
+			dvb_perror(_("dvb_read_sections_multi: poll error"));
+			ret = -1;
+			break;
+		}
+		if (available <= 0)
+			continue;
+
+		for (i = 0, nfds = 0; i < num_slots; i++) {
+			int t = slot[i].table;
+			ssize_t buf_length;
+			uint32_t crc;
+
+			if (t < 0)
+				continue;
+			if (!fds[nfds++].revents)
+				continue;
+
+			buf_length = read(slot[i].fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+			V4L_PROBE(libdvbv5, section, slot[i].fd, sects[t].tid,
+				  sects[t].pid, buf_length);
+			if (buf_length < 0 && (errno == EAGAIN || errno == EOVERFLOW))
+				continue;
+			if (!buf_length) {
+				dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
+				rc[t] = -1;
+			} else if (buf_length < 0) {
+				dvb_perror(_("dvb_read_sections_multi: read error"));
+				rc[t] = -2;
+			} else {
+				crc = dvb_crc32(buf, buf_length, 0xFFFFFFFF);
+				if (crc != 0) {
+					dvb_logerr(_("%s: crc error"), __func__);
+					rc[t] = -3;
+				} else {
+					rc[t] = dvb_parse_section(parms, &sects[t], buf,
+								  buf_length);
+				}
+			}
+			if (!rc[t]) {
+				/* Restart the timeout, as dvb_read_sections() does */
+				gettimeofday(&slot[i].deadline, NULL);
+				slot[i].deadline.tv_sec += timeout[t];
+				continue;
+			}
+			if (rc[t] > 0)
+				rc[t] = 0;
+			dvb_stop_section(&slot[i], &sects[t]);
+			done[t] = 1;
+			pending--;
+		}
+
+		if (pending && enough && enough(priv, rc, done)) {
+			if (parms->p.verbose)
+				dvb_log(_("%s: not waiting for the %u remaining tables"),
+					__func__, pending);
+			for (i = 0; i < num_slots; i++) {
+				if (slot[i].table < 0)
+					continue;
+				rc[slot[i].table] = DVB_SECTIONS_SKIPPED;
+				dvb_stop_section(&slot[i], &sects[slot[i].table]);
+			}
+			for (i = next; i < num; i++)
+				rc[i] = DVB_SECTIONS_SKIPPED;
+			pending = 0;
+		}
+	}
+
+	for (i = 0; i < num_slots; i++) {
+		if (slot[i].table >= 0) {
+			rc[slot[i].table] = parms->p.abort ? 0 : -1;
+			dvb_stop_section(&slot[i], &sects[slot[i].table]);
+		}
+		if (slot[i].own_fd)
+			close(slot[i].fd);
+	}
+	free(buf);
+	free(done);
+
+	return ret;
+}
+
+int dvb_read_sections_multi(struct dvb_v5_fe_parms *__p, int dmx_fd,
+			    struct dvb_table_filter *sects, int *rc,
+			    const unsigned *timeout, unsigned num)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	return dvb_do_read_sections_multi(parms, dmx_fd, sects, rc, timeout,
+					  num, NULL, NULL);
+}
+
+/*
+ * Table cache: drops the sections that were already seen, based on their
+ * version and CRC, and assembles a table per PID, table ID and table ID
+ * extension, reporting it only when it is new or has changed.
+ */
+#define DVB_TABLE_CACHE_HASH_BITS	10
+
+struct dvb_table_cache_entry {
+	struct dvb_table_cache_entry *next;
+	uint16_t pid;
+	uint8_t tid;
+	uint16_t id;
+
+	int version;
+	int last_section;
+	unsigned long is_read_bits[BITS_TO_LONGS(256)];
+	uint32_t crc[256];
+
+	/* EIT schedules: last section number of each segment of 8 sections */
+	uint32_t segment_seen;
+	uint8_t segment_last[32];
+
+	void *table;
+};
+
+struct dvb_table_cache {
+	dvb_table_changed_func changed;
+	void *priv;
+	struct dvb_table_cache_entry *hash[1 << DVB_TABLE_CACHE_HASH_BITS];
+};
+
+static int is_eit(uint8_t tid)
+{
+	return tid >= DVB_TABLE_EIT &&
+	       tid <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0x0f;
+}
+
+static void dvb_table_free_by_id(uint8_t tid, void *table)
+{
+	if (!table)
+		return;
+	if (is_eit(tid)) {
+		dvb_table_eit_free(table);
+		return;
+	}
+	switch (tid) {
+	case DVB_TABLE_PAT:
+		dvb_table_pat_free(table);
+		break;
+	case DVB_TABLE_CAT:
+		dvb_table_cat_free(table);
+		break;
+	case DVB_TABLE_PMT:
+		dvb_table_pmt_free(table);
+		break;
+	case DVB_TABLE_NIT:
+	case DVB_TABLE_NIT2:
+		dvb_table_nit_free(table);
+		break;
+	case DVB_TABLE_SDT:
+	case DVB_TABLE_SDT2:
+		dvb_table_sdt_free(table);
+		break;
+	case ATSC_TABLE_MGT:
+		atsc_table_mgt_free(table);
+		break;
+	case ATSC_TABLE_TVCT:
+	case ATSC_TABLE_CVCT:
+		atsc_table_vct_free(table);
+		break;
+	case ATSC_TABLE_EIT:
+		atsc_table_eit_free(table);
+		break;
+	}
+}
+
+struct dvb_table_cache *dvb_table_cache_alloc(dvb_table_changed_func changed,
+					      void *priv)
+{
+	struct dvb_table_cache *cache;
+
+	cache = calloc(sizeof(*cache), 1);
+	if (!cache)
+		return NULL;
+	cache->changed = changed;
+	cache->priv = priv;
+
+	return cache;
+}
+
+void dvb_table_cache_free(struct dvb_table_cache *cache)
+{
+	struct dvb_table_cache_entry *entry, *next;
+	int i;
+
+	if (!cache)
+		return;
+	for (i = 0; i < 1 << DVB_TABLE_CACHE_HASH_BITS; i++) {
+		for (entry = cache->hash[i]; entry; entry = next) {
+			next = entry->next;
+			dvb_table_free_by_id(entry->tid, entry->table);
+			free(entry);
+		}
+	}
+	free(cache);
+}
+
+static struct dvb_table_cache_entry *
+dvb_table_cache_get(struct dvb_table_cache *cache, uint16_t pid,
+		    uint8_t tid, uint16_t id)
+{
+	struct dvb_table_cache_entry **head, *entry;
+	uint32_t key = ((uint32_t)pid << 24) ^ ((uint32_t)tid << 16) ^ id;
+
+	key = (key * 2654435761u) >> (32 - DVB_TABLE_CACHE_HASH_BITS);
+	head = &cache->hash[key];
+	for (entry = *head; entry; entry = entry->next) {
+		if (entry->pid == pid && entry->tid == tid && entry->id == id)
+			return entry;
+	}
+
+	entry = calloc(sizeof(*entry), 1);
+	if (!entry)
+		return NULL;
+	entry->pid = pid;
+	entry->tid = tid;
+	entry->id = id;
+	entry->version = -1;
+	entry->next = *head;
+	*head = entry;
+
+	return entry;
+}
+
+static void dvb_table_cache_reset(struct dvb_table_cache_entry *entry,
+				  int version, int last_section)
+{
+	dvb_table_free_by_id(entry->tid, entry->table);
+	entry->table = NULL;
+	entry->version = version;
+	entry->last_section = last_section;
+	entry->segment_seen = 0;
+	memset(entry->is_read_bits, 0, sizeof(entry->is_read_bits));
+}
+
+static int dvb_table_cache_is_complete(struct dvb_table_cache_entry *entry)
+{
+	int i, seg;
+
+	if (!is_eit(entry->tid)) {
+		for (i = 0; i <= entry->last_section; i++)
+			if (!test_bit(i, entry->is_read_bits))
+				return 0;
+		return 1;
+	}
+
+	/*
+	 * EIT sections are grouped on segments of 8 sections, and each
+	 * segment may use less of them. See ETSI EN 300 468 5.2.4.
+	 */
+	for (seg = 0; seg <= entry->last_section / 8; seg++) {
+		if (!(entry->segment_seen & (1u << seg)))
+			return 0;
+		for (i = seg * 8; i <= entry->segment_last[seg]; i++)
+			if (!test_bit(i, entry->is_read_bits))
+				return 0;
+	}
+	return 1;
+}
+
+int dvb_table_cache_section(struct dvb_v5_fe_parms *__p,
+			    struct dvb_table_cache *cache, uint16_t pid,
+			    const uint8_t *buf, ssize_t buf_length)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	struct dvb_table_cache_entry *entry;
+	struct dvb_table_header h;
+	uint32_t crc;
+
+	if (buf_length < (ssize_t)sizeof(h) + DVB_CRC_SIZE) {
+		dvb_logerr(_("%s: short section: %zd bytes"), __func__,
+			   buf_length);
+		return -1;
+	}
+
+	memcpy(&h, buf, sizeof(h));
+	dvb_table_header_init(&h);
+
+	/* Sections that will only be valid later, or without a version */
+	if (!h.syntax || !h.current_next)
+		return 0;
+
+	entry = dvb_table_cache_get(cache, pid, h.table_id, h.id);
+	if (!entry) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		return -1;
+	}
+
+	crc = (uint32_t)buf[buf_length - 4] << 24 |
+	      (uint32_t)buf[buf_length - 3] << 16 |
+	      (uint32_t)buf[buf_length - 2] << 8 | buf[buf_length - 1];
+
+	if (entry->version == h.version && test_bit(h.section_id, entry->is_read_bits)) {
+		if (entry->crc[h.section_id] == crc)
+			return 0;
+
+		/* Same version, but different contents: start over */
+		if (parms->p.verbose)
+			dvb_log(_("%s: table 0x%02x, extension ID 0x%04x, section %d changed without a new version"),
+				__func__, h.table_id, h.id, h.section_id);
+		dvb_table_cache_reset(entry, h.version, h.last_section);
+	} else if (entry->version != h.version) {
+		if (parms->p.verbose && entry->version >= 0)
+			dvb_log(_("%s: table 0x%02x, extension ID 0x%04x: version %d -> %d"),
+				__func__, h.table_id, h.id, entry->version,
+				h.version);
+		dvb_table_cache_reset(entry, h.version, h.last_section);
+	}
+
+	if (dvb_crc32((uint8_t *)buf, buf_length, 0xFFFFFFFF) != 0) {
+		dvb_logerr(_("%s: crc error"), __func__);
+		return -3;
+	}
+
+	if (!dvb_table_initializers[h.table_id]) {
+		dvb_logerr(_("%s: no initializer for table %d"),
+			   __func__, h.table_id);
+		return -1;
+	}
+
+	set_bit(h.section_id, entry->is_read_bits);
+	entry->crc[h.section_id] = crc;
+	if (is_eit(h.table_id) && buf_length > 12 + DVB_CRC_SIZE) {
+		int seg = h.section_id / 8;
+
+		entry->segment_seen |= 1u << seg;
+		entry->segment_last[seg] = buf[12];
+	}
+
+	dvb_table_initializers[h.table_id](&parms->p, buf,
+					   buf_length - DVB_CRC_SIZE,
+					   &entry->table);
+
+	if (dvb_table_cache_is_complete(entry)) {
+		if (parms->p.verbose)
+			dvb_log(_("%s: table 0x%02x, extension ID 0x%04x, version %d: done"),
+				__func__, h.table_id, h.id, h.version);
+		if (cache->changed)
+			cache->changed(cache->priv, pid, h.table_id, h.id,
+				       entry->table);
+		else
+			dvb_table_free_by_id(h.table_id, entry->table);
+		entry->table = NULL;
+	}
+
+	return 1;
+}
+
+int dvb_table_cache_monitor(struct dvb_v5_fe_parms *__p, int dmx_fd,
+			    struct dvb_table_cache *cache, uint16_t pid,
+			    uint8_t tid, uint8_t tid_mask, unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	uint8_t *buf;
+	int ret = 0;
+
+	if (dvb_set_section_filter(dmx_fd, pid, 1, &tid, &tid_mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		dvb_dmx_stop(dmx_fd);
+		return -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: monitoring table ID 0x%02x/0x%02x, program ID 0x%02x"),
+			__func__, tid, tid_mask, pid);
+
+	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		dvb_dmx_stop(dmx_fd);
+		return -1;
+	}
+
+	while (!parms->p.abort) {
+		ssize_t buf_length;
+		int available;
+
+		do {
+			available = dvb_poll(parms, dmx_fd, timeout);
+		} while (available < 0 && errno == EOVERFLOW);
+
+		if (parms->p.abort)
+			break;
+		if (available <= 0) {
+			dvb_logerr(_("%s: no data read on section filter"), __func__);
+			ret = -1;
+			break;
+		}
+		buf_length = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+		if (buf_length < 0 && errno == EOVERFLOW)
+			continue;
+		if (buf_length <= 0) {
+			dvb_perror(_("dvb_table_cache_monitor: read error"));
+			ret = -2;
+			break;
+		}
+
+		/* A broken section doesn't stop the monitoring */
+		dvb_table_cache_section(&parms->p, cache, pid, buf, buf_length);
+	}
+	free(buf);
+	dvb_dmx_stop(dmx_fd);
+
+	return ret;
+}
+
 struct dvb_v5_descriptors *dvb_scan_alloc_handler_table(uint32_t delivery_system)
 {
 	struct dvb_v5_descriptors *dvb_scan_handler;
@@ -445,17 +1054,67 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler)
 	free(dvb_scan_handler);
 }
 
-struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
-					     int dmx_fd,
-					     uint32_t delivery_system,
-					     unsigned other_nit,
-					     unsigned timeout_multiply)
+/* State of dvb_scan_all_seen() */
+struct dvb_scan_seen {
+	struct dvb_v5_descriptors *desc;
+	const int *pmt_sect;
+	int sdt_sect;
+};
+
+/*
+ * For DVB_SCAN_UNTIL_SEEN: true once the PMT of every program of the PAT
+ * was read and, if the SDT is read, the SDT has an entry for each of them,
+ * so the other tables are not needed to list the services.
+ */
+static int dvb_scan_all_seen(void *priv, const int *rc, const char *done)
+{
+	struct dvb_scan_seen *seen = priv;
+	struct dvb_v5_descriptors *desc = seen->desc;
+	unsigned i;
+
+	for (i = 0; i < desc->num_program; i++) {
+		int n = seen->pmt_sect[i];
+
+		if (n >= 0 && (!done[n] || rc[n] < 0))
+			return 0;
+	}
+	if (seen->sdt_sect < 0)
+		return 1;
+
+	for (i = 0; i < desc->num_program; i++) {
+		uint16_t service_id = desc->program[i].pat_pgm->service_id;
+		int found = 0;
+
+		if (!service_id)
+			continue;
+		dvb_sdt_service_foreach(service, desc->sdt) {
+			if (service->service_id == service_id) {
+				found = 1;
+				break;
+			}
+		}
+		if (!found)
+			return 0;
+	}
+	return 1;
+}
+
+struct dvb_v5_descriptors *dvb_get_ts_tables_profile(struct dvb_v5_fe_parms *__p,
+						     int dmx_fd,
+						     uint32_t delivery_system,
+						     unsigned tables,
+						     unsigned timeout_multiply)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
 	int rc;
 	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
 	int atsc_filter = 0;
-	unsigned num_pmt = 0;
+	unsigned num_pmt = 0, num_sects = 0, i;
+	int nit_sect = -1, sdt_sect = -1;
+	struct dvb_table_filter *sects;
+	unsigned *sect_timeout;
+	int *sect_rc, *pmt_sect;
+	struct dvb_scan_seen seen;
 
 	struct dvb_v5_descriptors *dvb_scan_handler;
 
@@ -525,7 +1184,7 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		dvb_table_pat_print(&parms->p, dvb_scan_handler->pat);
 
 	/* ATSC-specific VCT table */
-	if (atsc_filter) {
+	if (atsc_filter && (tables & DVB_SCAN_VCT)) {
 		rc = dvb_read_section(&parms->p, dmx_fd,
 				      atsc_filter, ATSC_TABLE_VCT_PID,
 				      (void **)&dvb_scan_handler->vct,
@@ -538,12 +1197,30 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
 	}
 
-	/* PMT tables */
-	dvb_scan_handler->program = calloc(dvb_scan_handler->pat->programs,
+	/*
+	 * PMT, NIT and SDT tables. They are on different PIDs, so they are
+	 * read at the same time, each one on its own section filter.
+	 */
+	dvb_scan_handler->program = calloc(dvb_scan_handler->pat->programs + 1,
 					   sizeof(*dvb_scan_handler->program));
+	sects = calloc(dvb_scan_handler->pat->programs + 2, sizeof(*sects));
+	sect_rc = calloc(dvb_scan_handler->pat->programs + 2, sizeof(*sect_rc));
+	sect_timeout = calloc(dvb_scan_handler->pat->programs + 2, sizeof(*sect_timeout));
+	pmt_sect = calloc(dvb_scan_handler->pat->programs + 1, sizeof(*pmt_sect));
+	if (!dvb_scan_handler->program || !sects || !sect_rc ||
+	    !sect_timeout || !pmt_sect) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		free(sects);
+		free(sect_rc);
+		free(sect_timeout);
+		free(pmt_sect);
+		dvb_scan_free_handler_table(dvb_scan_handler);
+		return NULL;
+	}
 
 	dvb_pat_program_foreach(program, dvb_scan_handler->pat) {
 		dvb_scan_handler->program[num_pmt].pat_pgm = program;
+		pmt_sect[num_pmt] = -1;
 
 		if (!program->service_id) {
 			if (parms->p.verbose)
@@ -555,83 +1232,167 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		if (parms->p.verbose)
 			dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
 				num_pmt, program->pid, program->service_id);
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_PMT, program->pid,
-				      (void **)&dvb_scan_handler->program[num_pmt].pmt,
-				      pat_pmt_time * timeout_multiply);
-		if (parms->p.abort) {
-			dvb_scan_handler->num_program = num_pmt + 1;
-			return dvb_scan_handler;
-		}
-		if (rc < 0) {
-			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
-				   program->service_id);
-			dvb_scan_handler->program[num_pmt].pmt = NULL;
-		} else {
-			if (parms->p.verbose)
-				dvb_table_pmt_print(&parms->p,
-						    dvb_scan_handler->program[num_pmt].pmt);
+		if (!(tables & DVB_SCAN_PMT)) {
+			num_pmt++;
+			continue;
 		}
+		pmt_sect[num_pmt] = num_sects;
+		sects[num_sects].tid = DVB_TABLE_PMT;
+		sects[num_sects].pid = program->pid;
+		sects[num_sects].ts_id = -1;
+		sects[num_sects].table = (void **)&dvb_scan_handler->program[num_pmt].pmt;
+		num_sects++;
 		num_pmt++;
 	}
 	dvb_scan_handler->num_program = num_pmt;
 
-	/* NIT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
-			      (void **)&dvb_scan_handler->nit,
-			      nit_time * timeout_multiply);
-	if (parms->p.abort)
+	if (tables & DVB_SCAN_NIT) {
+		nit_sect = num_sects;
+		sects[num_sects].tid = DVB_TABLE_NIT;
+		sects[num_sects].pid = DVB_TABLE_NIT_PID;
+		sects[num_sects].ts_id = -1;
+		sects[num_sects].table = (void **)&dvb_scan_handler->nit;
+		num_sects++;
+	}
+
+	if ((tables & DVB_SCAN_SDT) &&
+	    (!dvb_scan_handler->vct || (tables & DVB_SCAN_OTHER))) {
+		sdt_sect = num_sects;
+		sects[num_sects].tid = DVB_TABLE_SDT;
+		sects[num_sects].pid = DVB_TABLE_SDT_PID;
+		sects[num_sects].ts_id = -1;
+		sects[num_sects].table = (void **)&dvb_scan_handler->sdt;
+		num_sects++;
+	}
+
+	for (i = 0; i < num_sects; i++)
+		sect_timeout[i] = pat_pmt_time * timeout_multiply;
+	if (nit_sect >= 0)
+		sect_timeout[nit_sect] = nit_time * timeout_multiply;
+	if (sdt_sect >= 0)
+		sect_timeout[sdt_sect] = sdt_time * timeout_multiply;
+
+	seen.desc = dvb_scan_handler;
+	seen.pmt_sect = pmt_sect;
+	seen.sdt_sect = sdt_sect;
+	dvb_do_read_sections_multi(parms, dmx_fd, sects, sect_rc,
+				   sect_timeout, num_sects,
+				   (tables & DVB_SCAN_UNTIL_SEEN) ?
+					dvb_scan_all_seen : NULL,
+				   &seen);
+	free(sects);
+	free(sect_timeout);
+	if (parms->p.abort) {
+		free(sect_rc);
+		free(pmt_sect);
 		return dvb_scan_handler;
-	if (rc < 0)
-		dvb_logerr(_("error while reading the NIT table"));
-	else if (parms->p.verbose)
-		dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+	}
 
-	/* SDT table */
-	if (!dvb_scan_handler->vct || other_nit) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
+	for (i = 0; i < num_pmt; i++) {
+		int n = pmt_sect[i];
+
+		if (n < 0)
+			continue;
+		if (sect_rc[n] < 0) {
+			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
+				   dvb_scan_handler->program[i].pat_pgm->service_id);
+			if (dvb_scan_handler->program[i].pmt)
+				dvb_table_pmt_free(dvb_scan_handler->program[i].pmt);
+			dvb_scan_handler->program[i].pmt = NULL;
+		} else if (parms->p.verbose) {
+			dvb_table_pmt_print(&parms->p,
+					    dvb_scan_handler->program[i].pmt);
+		}
+	}
+
+	/* Skipped by DVB_SCAN_UNTIL_SEEN isn't an error */
+	if (nit_sect >= 0) {
+		if (sect_rc[nit_sect] < 0)
+			dvb_logerr(_("error while reading the NIT table"));
+		else if (parms->p.verbose && dvb_scan_handler->nit)
+			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+	}
+
+	if (sdt_sect >= 0) {
+		if (sect_rc[sdt_sect] < 0)
 			dvb_logerr(_("error while reading the SDT table"));
-		else if (parms->p.verbose)
+		else if (parms->p.verbose && dvb_scan_handler->sdt)
 			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
 	}
+	free(sect_rc);
+	free(pmt_sect);
+
+	/* NIT/SDT other tables, read at the same time as well */
+	if (tables & DVB_SCAN_OTHER) {
+		struct dvb_table_filter other[2];
+		unsigned other_timeout[2];
+		int other_rc[2];
 
-	/* NIT/SDT other tables */
-	if (other_nit) {
 		if (parms->p.verbose)
 			dvb_log(_("Parsing other NIT/SDT"));
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
-				      (void **)&dvb_scan_handler->nit,
-				      nit_time * timeout_multiply);
-		if (parms->p.abort)
-			return dvb_scan_handler;
-		if (rc < 0)
-			dvb_logerr(_("error while reading the NIT table"));
-		else if (parms->p.verbose)
-			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
 
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
+		memset(other, 0, sizeof(other));
+		num_sects = 0;
+		if (tables & DVB_SCAN_NIT) {
+			other[num_sects].tid = DVB_TABLE_NIT2;
+			other[num_sects].pid = DVB_TABLE_NIT_PID;
+			other[num_sects].ts_id = -1;
+			other[num_sects].table = (void **)&dvb_scan_handler->nit;
+			other_timeout[num_sects++] = nit_time * timeout_multiply;
+		}
+		if (tables & DVB_SCAN_SDT) {
+			other[num_sects].tid = DVB_TABLE_SDT2;
+			other[num_sects].pid = DVB_TABLE_SDT_PID;
+			other[num_sects].ts_id = -1;
+			other[num_sects].table = (void **)&dvb_scan_handler->sdt;
+			other_timeout[num_sects++] = sdt_time * timeout_multiply;
+		}
+
+		dvb_do_read_sections_multi(parms, dmx_fd, other, other_rc,
+					   other_timeout, num_sects, NULL, NULL);
 		if (parms->p.abort)
 			return dvb_scan_handler;
-		if (rc < 0)
-			dvb_logerr(_("error while reading the SDT table"));
-		else if (parms->p.verbose)
-			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+
+		for (i = 0; i < num_sects; i++) {
+			int is_nit = other[i].tid == DVB_TABLE_NIT2;
+
+			if (other_rc[i] < 0)
+				dvb_logerr(is_nit ?
+					   _("error while reading the NIT table") :
+					   _("error while reading the SDT table"));
+			else if (parms->p.verbose && is_nit)
+				dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+			else if (parms->p.verbose)
+				dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+		}
 	}
 
 	return dvb_scan_handler;
 }
 
+struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
+					     int dmx_fd,
+					     uint32_t delivery_system,
+					     unsigned other_nit,
+					     unsigned timeout_multiply)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	unsigned tables = parms->scan_tables ? parms->scan_tables : DVB_SCAN_FULL;
+
+	if (other_nit)
+		tables |= DVB_SCAN_OTHER;
+
+	return dvb_get_ts_tables_profile(__p, dmx_fd, delivery_system,
+					 tables, timeout_multiply);
+}
+
+void dvb_scan_set_tables(struct dvb_v5_fe_parms *__p, unsigned tables)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	parms->scan_tables = tables;
+}
+
 struct dvb_v5_descriptors *dvb_scan_transponder(struct dvb_v5_fe_parms *__p,
 					        struct dvb_entry *entry,
 						int dmx_fd,
@@ -681,7 +1442,11 @@ struct dvb_v5_descriptors *dvb_scan_transponder(struct dvb_v5_fe_parms *__p,
 	if (parms->p.verbose)
 		dvb_fe_prt_parms(&parms->p);
 
-	rc = check_frontend(args, &parms->p);
+	if (check_frontend)
+		rc = check_frontend(args, &parms->p);
+	else
+		rc = dvb_fe_wait_lock(&parms->p,
+				      (timeout_multiply ? timeout_multiply : 1) * 4000);
 	if (rc < 0)
 		return NULL;
 
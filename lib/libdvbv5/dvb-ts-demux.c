@@ -0,0 +1,446 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/******************************************************************************
+ * Software demux for a full MPEG-TS stream
+ * According with:
+ *	ISO/IEC 13818-1:2007
+ *****************************************************************************/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libdvbv5/dvb-ts-demux.h>
+#include <libdvbv5/mpeg_ts.h>
+#include <libdvbv5/crc32.h>
+
+#define DVB_TS_NUM_PIDS		8192
+#define DVB_TS_READ_SIZE	(DVB_MPEG_TS_PACKET_SIZE * 348)
+
+struct dvb_ts_filter {
+	struct dvb_ts_filter *next;
+	enum dvb_ts_filter_type type;
+	dvb_ts_demux_func func;
+	void *priv;
+
+	/* Section and PES reassembly. size is 0 while unknown */
+	uint8_t *buf;
+	size_t len, size, alloc;
+};
+
+struct dvb_ts_pid {
+	struct dvb_ts_filter *filters;
+	int last_cc;		/* -1 before the first packet with payload */
+};
+
+struct dvb_ts_demux {
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_ts_pid *pid[DVB_TS_NUM_PIDS];
+
+	/* A packet split between two dvb_ts_demux_feed() calls */
+	uint8_t partial[DVB_MPEG_TS_PACKET_SIZE];
+	size_t partial_len;
+	int synced;
+
+	uint8_t *read_buf;
+	struct dvb_ts_demux_stats stats;
+};
+
+struct dvb_ts_demux *dvb_ts_demux_alloc(struct dvb_v5_fe_parms *parms)
+{
+	struct dvb_ts_demux *dmx;
+
+	dmx = calloc(sizeof(*dmx), 1);
+	if (!dmx)
+		return NULL;
+	dmx->parms = parms;
+	dmx->read_buf = malloc(DVB_TS_READ_SIZE);
+	if (!dmx->read_buf) {
+		free(dmx);
+		return NULL;
+	}
+
+	return dmx;
+}
+
+void dvb_ts_demux_free(struct dvb_ts_demux *dmx)
+{
+	struct dvb_ts_filter *f, *next;
+	int i;
+
+	if (!dmx)
+		return;
+	for (i = 0; i < DVB_TS_NUM_PIDS; i++) {
+		if (!dmx->pid[i])
+			continue;
+		for (f = dmx->pid[i]->filters; f; f = next) {
+			next = f->next;
+			free(f->buf);
+			free(f);
+		}
+		free(dmx->pid[i]);
+	}
+	free(dmx->read_buf);
+	free(dmx);
+}
+
+int dvb_ts_demux_add_filter(struct dvb_ts_demux *dmx, uint16_t pid,
+			    enum dvb_ts_filter_type type,
+			    dvb_ts_demux_func func, void *priv)
+{
+	struct dvb_ts_filter *f, **tail;
+
+	if (pid >= DVB_TS_NUM_PIDS || !func)
+		return -EINVAL;
+
+	if (!dmx->pid[pid]) {
+		dmx->pid[pid] = calloc(sizeof(*dmx->pid[pid]), 1);
+		if (!dmx->pid[pid])
+			return -ENOMEM;
+		dmx->pid[pid]->last_cc = -1;
+	}
+
+	f = calloc(sizeof(*f), 1);
+	if (!f)
+		return -ENOMEM;
+	f->type = type;
+	f->func = func;
+	f->priv = priv;
+
+	for (tail = &dmx->pid[pid]->filters; *tail; tail = &(*tail)->next);
+	*tail = f;
+
+	return 0;
+}
+
+void dvb_ts_demux_remove_filter(struct dvb_ts_demux *dmx, uint16_t pid,
+				dvb_ts_demux_func func, void *priv)
+{
+	struct dvb_ts_filter **prev, *f;
+
+	if (pid >= DVB_TS_NUM_PIDS || !dmx->pid[pid])
+		return;
+
+	prev = &dmx->pid[pid]->filters;
+	while ((f = *prev)) {
+		if (f->func == func && f->priv == priv) {
+			*prev = f->next;
+			free(f->buf);
+			free(f);
+		} else {
+			prev = &f->next;
+		}
+	}
+	if (!dmx->pid[pid]->filters) {
+		free(dmx->pid[pid]);
+		dmx->pid[pid] = NULL;
+	}
+}
+
+static int ts_append(struct dvb_ts_filter *f, const uint8_t *p, size_t len)
+{
+	if (f->len + len > f->alloc) {
+		size_t alloc = f->alloc ? f->alloc : 4096;
+		uint8_t *buf;
+
+		while (alloc < f->len + len)
+			alloc *= 2;
+		buf = realloc(f->buf, alloc);
+		if (!buf)
+			return -ENOMEM;
+		f->buf = buf;
+		f->alloc = alloc;
+	}
+	memcpy(f->buf + f->len, p, len);
+	f->len += len;
+
+	return 0;
+}
+
+static void ts_reset(struct dvb_ts_filter *f)
+{
+	f->len = 0;
+	f->size = 0;
+}
+
+static void ts_section_done(struct dvb_ts_demux *dmx, uint16_t pid,
+			    struct dvb_ts_filter *f, const uint8_t *buf,
+			    size_t len)
+{
+	/* Sections with the syntax indicator end with a CRC */
+	if ((buf[1] & 0x80) && dvb_crc32((uint8_t *)buf, len, 0xFFFFFFFF)) {
+		dmx->stats.crc_errors++;
+		return;
+	}
+	f->func(f->priv, pid, buf, len);
+}
+
+/*
+ * Adds data to the section being assembled. Sections that fit entirely
+ * on the packet payload are delivered from it, without copies.
+ */
+static void ts_section_add(struct dvb_ts_demux *dmx, uint16_t pid,
+			   struct dvb_ts_filter *f, const uint8_t *p,
+			   size_t len)
+{
+	size_t n;
+
+	while (len) {
+		if (!f->len && len >= 3) {
+			if (p[0] == 0xff)	/* stuffing up to the packet end */
+				return;
+			n = 3 + (((p[1] & 0x0f) << 8) | p[2]);
+			if (n <= len) {
+				ts_section_done(dmx, pid, f, p, n);
+				p += n;
+				len -= n;
+				continue;
+			}
+		}
+
+		if (!f->size) {
+			/* The section size comes on its first 3 bytes */
+			n = 3 - f->len;
+			if (n > len)
+				n = len;
+			if (ts_append(f, p, n) < 0) {
+				ts_reset(f);
+				return;
+			}
+			p += n;
+			len -= n;
+			if (f->len < 3)
+				return;
+			if (f->buf[0] == 0xff) {
+				ts_reset(f);
+				return;
+			}
+			f->size = 3 + (((f->buf[1] & 0x0f) << 8) | f->buf[2]);
+			continue;
+		}
+
+		n = f->size - f->len;
+		if (n > len)
+			n = len;
+		if (ts_append(f, p, n) < 0) {
+			ts_reset(f);
+			return;
+		}
+		p += n;
+		len -= n;
+		if (f->len == f->size) {
+			ts_section_done(dmx, pid, f, f->buf, f->size);
+			ts_reset(f);
+		}
+	}
+}
+
+static void ts_section(struct dvb_ts_demux *dmx, uint16_t pid,
+		       struct dvb_ts_filter *f, const uint8_t *p, size_t len,
+		       int payload_start)
+{
+	size_t pointer;
+
+	if (!payload_start) {
+		/* Only continues a section that was already started */
+		if (f->len)
+			ts_section_add(dmx, pid, f, p, len);
+		return;
+	}
+
+	pointer = p[0];
+	p++;
+	len--;
+	if (pointer > len) {
+		ts_reset(f);
+		return;
+	}
+	if (f->len)
+		ts_section_add(dmx, pid, f, p, pointer);
+	ts_reset(f);
+	ts_section_add(dmx, pid, f, p + pointer, len - pointer);
+}
+
+static void ts_pes(struct dvb_ts_demux *dmx, uint16_t pid,
+		   struct dvb_ts_filter *f, const uint8_t *p, size_t len,
+		   int payload_start)
+{
+	if (payload_start) {
+		/* Unbounded PES packets end when the next one starts */
+		if (f->len && !f->size)
+			f->func(f->priv, pid, f->buf, f->len);
+		ts_reset(f);
+		if (len < 6 || p[0] || p[1] || p[2] != 1)
+			return;
+		f->size = (p[4] << 8) | p[5];
+		if (f->size)
+			f->size += 6;
+	} else if (!f->len) {
+		return;
+	}
+
+	if (f->size && f->len + len > f->size)
+		len = f->size - f->len;
+	if (ts_append(f, p, len) < 0) {
+		ts_reset(f);
+		return;
+	}
+	if (f->size && f->len == f->size) {
+		f->func(f->priv, pid, f->buf, f->len);
+		ts_reset(f);
+	}
+}
+
+static void ts_packet(struct dvb_ts_demux *dmx, const uint8_t *pkt)
+{
+	uint8_t hdr[sizeof(struct dvb_mpeg_ts) +
+		    sizeof(struct dvb_mpeg_ts_adaption)];
+	struct dvb_mpeg_ts *ts = (struct dvb_mpeg_ts *)hdr;
+	struct dvb_ts_filter *f;
+	struct dvb_ts_pid *pid;
+	ssize_t hdr_len;
+	int discontinuity = 0;
+
+	dmx->stats.packets++;
+
+	/* Most packets are from PIDs nobody wants */
+	pid = dmx->pid[((pkt[1] & 0x1f) << 8) | pkt[2]];
+	if (!pid)
+		return;
+
+	dvb_mpeg_ts_init(dmx->parms, pkt, DVB_MPEG_TS_PACKET_SIZE, hdr, &hdr_len);
+
+	for (f = pid->filters; f; f = f->next)
+		if (f->type == DVB_TS_FILTER_TS)
+			f->func(f->priv, ts->pid, pkt, DVB_MPEG_TS_PACKET_SIZE);
+
+	if (ts->tei) {
+		dmx->stats.tei_errors++;
+		return;
+	}
+	if (ts->adaptation_field && ts->adaption->length)
+		discontinuity = ts->adaption->discontinued;
+	if (!ts->payload || hdr_len >= DVB_MPEG_TS_PACKET_SIZE)
+		return;
+
+	if (pid->last_cc >= 0 && !discontinuity) {
+		/* A single repeated packet is allowed, and should be ignored */
+		if (ts->continuity_counter == pid->last_cc)
+			return;
+		if (ts->continuity_counter != ((pid->last_cc + 1) & 0x0f)) {
+			dmx->stats.cc_errors++;
+			for (f = pid->filters; f; f = f->next)
+				ts_reset(f);
+		}
+	}
+	pid->last_cc = ts->continuity_counter;
+
+	/* Scrambled payloads can't be parsed */
+	if (ts->scrambling)
+		return;
+
+	for (f = pid->filters; f; f = f->next) {
+		switch (f->type) {
+		case DVB_TS_FILTER_SECTION:
+			ts_section(dmx, ts->pid, f, pkt + hdr_len,
+				   DVB_MPEG_TS_PACKET_SIZE - hdr_len,
+				   ts->payload_start);
+			break;
+		case DVB_TS_FILTER_PES:
+			ts_pes(dmx, ts->pid, f, pkt + hdr_len,
+			       DVB_MPEG_TS_PACKET_SIZE - hdr_len,
+			       ts->payload_start);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void dvb_ts_demux_feed(struct dvb_ts_demux *dmx, const uint8_t *buf,
+		       size_t len)
+{
+	const uint8_t *end = buf + len, *p;
+	size_t n;
+
+	if (dmx->partial_len) {
+		n = DVB_MPEG_TS_PACKET_SIZE - dmx->partial_len;
+		if (n > len)
+			n = len;
+		memcpy(dmx->partial + dmx->partial_len, buf, n);
+		dmx->partial_len += n;
+		buf += n;
+		if (dmx->partial_len < DVB_MPEG_TS_PACKET_SIZE)
+			return;
+		ts_packet(dmx, dmx->partial);
+		dmx->partial_len = 0;
+	}
+
+	while (end - buf >= DVB_MPEG_TS_PACKET_SIZE) {
+		/*
+		 * When in sync, each packet starts with the sync byte.
+		 * Otherwise, look for a sync byte followed by another one
+		 * a packet later. memchr() is vectorized by the C library.
+		 */
+		if (buf[0] == DVB_MPEG_TS &&
+		    (dmx->synced || end - buf <= DVB_MPEG_TS_PACKET_SIZE ||
+		     buf[DVB_MPEG_TS_PACKET_SIZE] == DVB_MPEG_TS)) {
+			dmx->synced = 1;
+			ts_packet(dmx, buf);
+			buf += DVB_MPEG_TS_PACKET_SIZE;
+			continue;
+		}
+		if (dmx->synced) {
+			dmx->synced = 0;
+			dmx->stats.sync_losses++;
+		}
+		p = memchr(buf + 1, DVB_MPEG_TS, end - buf - 1);
+		if (!p) {
+			buf = end;
+			break;
+		}
+		buf = p;
+	}
+
+	/* Keep a partial packet for the next call */
+	if (buf < end && buf[0] == DVB_MPEG_TS) {
+		dmx->partial_len = end - buf;
+		memcpy(dmx->partial, buf, dmx->partial_len);
+	}
+}
+
+ssize_t dvb_ts_demux_read(struct dvb_ts_demux *dmx, int fd)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(fd, dmx->read_buf, DVB_TS_READ_SIZE);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0)
+		dvb_ts_demux_feed(dmx, dmx->read_buf, ret);
+
+	return ret;
+}
+
+void dvb_ts_demux_get_stats(struct dvb_ts_demux *dmx,
+			    struct dvb_ts_demux_stats *stats)
+{
+	*stats = dmx->stats;
+}
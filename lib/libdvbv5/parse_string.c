@@ -28,6 +28,7 @@
 #include <strings.h> /* strcasecmp */
 
 #include <parse_string.h>
+#include "dvb-fe-priv.h"
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-fe.h>
 
@@ -298,31 +299,122 @@ static struct charset_conv en300468_latin_00_to_utf8[256] = {
 	[0xff] = { 2, {0xc2, 0xad, } },
 };
 
-void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
+/*
+ * iconv_open() is expensive compared with converting a service name or an
+ * event title, so keep the descriptors open for the lifetime of parms.
+ */
+struct dvb_iconv_cache {
+	struct dvb_iconv_cache *next;
+	char *input_charset;
+	char *output_charset;
+	iconv_t cd;
+};
+
+static iconv_t dvb_iconv_open(struct dvb_v5_fe_parms_priv *parms,
+			      char *input_charset, char *output_charset)
+{
+	struct dvb_iconv_cache *cache;
+	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
+	iconv_t cd;
+
+	for (cache = parms->iconv_cache; cache; cache = cache->next) {
+		if (!strcasecmp(cache->input_charset, input_charset) &&
+		    !strcasecmp(cache->output_charset, output_charset)) {
+			/* Reset the shift state left by the last conversion */
+			iconv(cache->cd, NULL, NULL, NULL, NULL);
+			return cache->cd;
+		}
+	}
+
+	strcpy(out_cs, output_charset);
+	strcat(out_cs, CS_OPTIONS);
+
+	cd = iconv_open(out_cs, input_charset);
+	if (cd == (iconv_t)(-1))
+		return cd;
+
+	cache = calloc(sizeof(*cache), 1);
+	if (cache) {
+		cache->input_charset = strdup(input_charset);
+		cache->output_charset = strdup(output_charset);
+	}
+	if (!cache || !cache->input_charset || !cache->output_charset) {
+		if (cache) {
+			free(cache->input_charset);
+			free(cache->output_charset);
+			free(cache);
+		}
+		iconv_close(cd);
+		return (iconv_t)(-1);
+	}
+	cache->cd = cd;
+	cache->next = parms->iconv_cache;
+	parms->iconv_cache = cache;
+
+	return cd;
+}
+
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms_priv *parms)
+{
+	struct dvb_iconv_cache *cache, *next;
+
+	for (cache = parms->iconv_cache; cache; cache = next) {
+		next = cache->next;
+		iconv_close(cache->cd);
+		free(cache->input_charset);
+		free(cache->output_charset);
+		free(cache);
+	}
+	parms->iconv_cache = NULL;
+}
+
+/* Charsets whose bytes below 0x80 are the same as in ASCII */
+static int is_ascii_superset(const char *charset)
+{
+	return !strncasecmp(charset, "ISO-8859", 8) ||
+	       !strcasecmp(charset, "UTF-8") ||
+	       !strcasecmp(charset, "ISO-10646/UTF-8");
+}
+
+static int is_ascii(const unsigned char *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (src[i] & 0x80)
+			return 0;
+	return 1;
+}
+
+void dvb_iconv_to_charset(struct dvb_v5_fe_parms *p,
 			  char *dest,
 			  size_t destlen,
 			  const unsigned char *src,
 			  size_t len,
 			  char *input_charset, char *output_charset)
 {
-	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
-	char *p = dest;
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	char *p_dest = dest;
 
-	strcpy(out_cs, output_charset);
-	strcat(out_cs, CS_OPTIONS);
+	/* Most strings are plain ASCII, which needs no conversion */
+	if (len <= destlen && is_ascii_superset(input_charset) &&
+	    is_ascii_superset(output_charset) && is_ascii(src, len)) {
+		memcpy(dest, src, len);
+		dest[len] = '\0';
+		return;
+	}
 
-	iconv_t cd = iconv_open(out_cs, input_charset);
+	iconv_t cd = dvb_iconv_open(parms, input_charset, output_charset);
 	if (cd == (iconv_t)(-1)) {
-		memcpy(p, src, len);
-		p[len] = '\0';
+		memcpy(p_dest, src, len);
+		p_dest[len] = '\0';
 		dvb_logerr("Conversion from %s to %s not supported\n",
 				input_charset, output_charset);
 		if (!strcasecmp(input_charset, "ARIB-STD-B24"))
 			dvb_log("Try setting GCONV_PATH to the bundled gconv dir.\n");
 	} else {
-		iconv(cd, (ICONV_CONST char **)&src, &len, &p, &destlen);
-		iconv_close(cd);
-		*p = '\0';
+		iconv(cd, (ICONV_CONST char **)&src, &len, &p_dest, &destlen);
+		*p_dest = '\0';
 	}
 }
 
@@ -21,6 +21,7 @@
 #endif
 
 struct dvb_v5_fe_parms;
+struct dvb_v5_fe_parms_priv;
 
 void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
 			  char *dest,
@@ -32,6 +33,8 @@ void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
 void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 		      const unsigned char *src, size_t len);
 
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms_priv *parms);
+
 #if HAVE_VISIBILITY
 #pragma GCC visibility pop
 #endif
@@ -20,11 +20,68 @@
 #include <libdvbv5/atsc_eit.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <parse_string.h>
+
+/* event_id, start_time, ETM_location, length_in_seconds and title_length */
+#define ATSC_EIT_EVENT_SIZE	10
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
 #endif
 
+/*
+ * Converts the first string of the title, a multiple string structure
+ * (A/65:2009 section 6.10), to the output charset. Only uncompressed
+ * segments are handled: the ones with a Unicode page as mode are turned
+ * into UTF-16, the ones in UTF-16 are copied, the others are skipped.
+ */
+static char *atsc_eit_title(struct dvb_v5_fe_parms *parms,
+			    const uint8_t *p, size_t len)
+{
+	const uint8_t *endbuf = p + len;
+	uint8_t utf16[2 * 255];
+	size_t n = 0, size;
+	unsigned segments;
+	char *title;
+
+	/* number_strings, ISO_639_language_code and number_segments */
+	if (len < 5 || !p[0])
+		return NULL;
+	segments = p[4];
+	p += 5;
+
+	while (segments-- && p + 3 <= endbuf) {
+		uint8_t compression = p[0], mode = p[1];
+		const uint8_t *s = p + 3;
+
+		size = p[2];
+		p = s + size;
+		if (p > endbuf)
+			break;
+		if (compression)
+			continue;
+		if (mode <= 0x33) {
+			while (size--) {
+				utf16[n++] = mode;
+				utf16[n++] = *s++;
+			}
+		} else if (mode == 0x3f) {
+			memcpy(utf16 + n, s, size & ~1);
+			n += size & ~1;
+		}
+	}
+	if (!n)
+		return NULL;
+
+	size = 3 * n / 2;
+	title = malloc(size + 1);
+	if (!title)
+		return NULL;
+	dvb_iconv_to_charset(parms, title, size, utf16, n, "UTF-16BE",
+			     parms->output_charset);
+	return title;
+}
+
 ssize_t atsc_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		ssize_t buflen, struct atsc_table_eit **table)
 {
@@ -68,13 +125,18 @@ ssize_t atsc_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		struct atsc_table_eit_event *event;
                 union atsc_table_eit_desc_length dl;
 
-		size = offsetof(struct atsc_table_eit_event, descriptor);
+		/*
+		 * The bit fields of struct atsc_table_eit_event have 2 reserved
+		 * bits too many, so it is one byte longer than the event header
+		 * at the table. Only copy the header, not the first title byte.
+		 */
+		size = ATSC_EIT_EVENT_SIZE;
 		if (p + size > endbuf) {
 			dvb_logerr("%s: short read %zd/%zd bytes", __func__,
 				   endbuf - p, size);
 			return -4;
 		}
-		event = (struct atsc_table_eit_event *) malloc(sizeof(struct atsc_table_eit_event));
+		event = calloc(sizeof(struct atsc_table_eit_event), 1);
 		if (!event) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
@@ -93,14 +155,14 @@ ssize_t atsc_table_eit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		*head = event;
 		head = &(*head)->next;
 
-		size = event->title_length - 1;
+		size = event->title_length;
 		if (p + size > endbuf) {
 			dvb_logerr("%s: short read %zd/%zd bytes", __func__,
 				   endbuf - p, size);
 			return -6;
 		}
-                /* TODO: parse title */
-                p += size;
+		event->title = atsc_eit_title(parms, p, size);
+		p += size;
 
 		/* get the descriptors for each program */
 		size = sizeof(union atsc_table_eit_desc_length);
@@ -138,6 +200,7 @@ void atsc_table_eit_free(struct atsc_table_eit *eit)
 		struct atsc_table_eit_event *tmp = event;
 
 		dvb_desc_free((struct dvb_desc **) &event->descriptor);
+		free(event->title);
 		event = event->next;
 		free(tmp);
 	}
@@ -162,6 +225,8 @@ void atsc_table_eit_print(struct dvb_v5_fe_parms *parms, struct atsc_table_eit *
 		dvb_loginfo("|   Duration              %dh %dm %ds", event->duration / 3600, (event->duration % 3600) / 60, event->duration % 60);
 		dvb_loginfo("|   ETM                   %d", event->etm);
 		dvb_loginfo("|   title length          %d", event->title_length);
+		if (event->title)
+			dvb_loginfo("|   title                 %s", event->title);
 		dvb_desc_print(parms, event->descriptor);
 		event = event->next;
 		events++;
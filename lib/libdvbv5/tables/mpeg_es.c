@@ -18,9 +18,14 @@
  */
 
 #include <libdvbv5/mpeg_es.h>
+#include <libdvbv5/mpeg_pes.h>
+#include <libdvbv5/mpeg_ts.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
 #endif
@@ -76,3 +81,342 @@ void dvb_mpeg_es_pic_start_print(struct dvb_v5_fe_parms *parms, struct dvb_mpeg_
         dvb_loginfo(" - coding_type  %d (%s-frame)", pic_start->coding_type, dvb_mpeg_es_frame_names[pic_start->coding_type]);
         dvb_loginfo(" - vbv_delay    %d", pic_start->vbv_delay);
 }
+
+struct dvb_mpeg_es_parser {
+	dvb_mpeg_es_parser_func func;
+	void *priv;
+
+	uint16_t pid;
+	int last_cc;		/* -1 before the first packet with payload */
+	int synced;		/* a PES header was seen since the last loss */
+	int discontinuity;	/* data was lost before the current PES */
+	int video;		/* the current PES has a video stream ID */
+
+	/* PES header, while it is split between TS packets */
+	uint8_t hdr[9 + 255];
+	unsigned hdr_len, hdr_need;
+
+	/* PTS/DTS to be reported with the next picture */
+	int pic_ts;
+	struct dvb_mpeg_es_event ts;
+
+	/* Start code scanner */
+	unsigned zeros;		/* trailing zero bytes, up to 2 */
+	uint8_t sc[5];		/* start code value and the header after it */
+	unsigned sc_len, sc_need;
+};
+
+struct dvb_mpeg_es_parser *dvb_mpeg_es_parser_alloc(dvb_mpeg_es_parser_func func,
+						    void *priv)
+{
+	struct dvb_mpeg_es_parser *p;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	p->func = func;
+	p->priv = priv;
+	dvb_mpeg_es_parser_reset(p);
+	return p;
+}
+
+void dvb_mpeg_es_parser_free(struct dvb_mpeg_es_parser *p)
+{
+	free(p);
+}
+
+void dvb_mpeg_es_parser_reset(struct dvb_mpeg_es_parser *p)
+{
+	p->last_cc = -1;
+	p->synced = 0;
+	p->discontinuity = 0;
+	p->video = 0;
+	p->hdr_len = p->hdr_need = 0;
+	p->pic_ts = 0;
+	p->zeros = 0;
+	p->sc_len = p->sc_need = 0;
+}
+
+static uint64_t es_parse_ts(const uint8_t *b)
+{
+	return ((uint64_t)(b[0] & 0x0e) << 29) | (b[1] << 22) |
+	       ((b[2] & 0xfe) << 14) | (b[3] << 7) | (b[4] >> 1);
+}
+
+static int es_has_pes_optional(uint8_t stream_id)
+{
+	switch (stream_id) {
+	case DVB_MPEG_STREAM_MAP:
+	case DVB_MPEG_STREAM_PADDING:
+	case 0xbf:	/* private_stream_2 */
+	case 0xf0:	/* ECM */
+	case 0xf1:	/* EMM */
+	case DVB_MPEG_STREAM_DIRECTORY:
+	case 0xf2:	/* DSMCC */
+	case DVB_MPEG_STREAM_H222E:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+static void es_start_code(struct dvb_mpeg_es_parser *p)
+{
+	struct dvb_mpeg_es_event ev;
+	const uint8_t *b = p->sc + 1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.pid = p->pid;
+	ev.stream_id = p->ts.stream_id;
+
+	switch (p->sc[0]) {
+	case DVB_MPEG_ES_SEQ_START:
+		ev.type = DVB_MPEG_ES_EVENT_SEQ_START;
+		ev.width = (b[0] << 4) | (b[1] >> 4);
+		ev.height = ((b[1] & 0x0f) << 8) | b[2];
+		ev.aspect = b[3] >> 4;
+		ev.framerate = b[3] & 0x0f;
+		break;
+	case DVB_MPEG_ES_PIC_START:
+		ev.type = DVB_MPEG_ES_EVENT_PIC_START;
+		ev.temporal_ref = (b[0] << 2) | (b[1] >> 6);
+		ev.coding_type = (b[1] >> 3) & 0x07;
+		if (ev.coding_type > DVB_MPEG_ES_FRAME_D)
+			ev.coding_type = DVB_MPEG_ES_FRAME_UNKNOWN;
+		if (p->pic_ts) {
+			ev.has_pts = p->ts.has_pts;
+			ev.has_dts = p->ts.has_dts;
+			ev.pts = p->ts.pts;
+			ev.dts = p->ts.dts;
+			p->pic_ts = 0;
+		}
+		break;
+	default:
+		return;
+	}
+	p->func(p->priv, &ev);
+}
+
+/*
+ * Stores the bytes that follow a start code, until there are enough of
+ * them to parse its header. Returns how many bytes were used.
+ */
+static size_t es_collect(struct dvb_mpeg_es_parser *p, const uint8_t *buf,
+			 size_t len)
+{
+	size_t n, used = 0;
+
+	while (p->sc_need && used < len) {
+		n = p->sc_need - p->sc_len;
+		if (n > len - used)
+			n = len - used;
+		memcpy(p->sc + p->sc_len, buf + used, n);
+		p->sc_len += n;
+		used += n;
+		if (p->sc_len < p->sc_need)
+			break;
+
+		if (p->sc_len == 1) {
+			/* Just got the start code value */
+			switch (p->sc[0]) {
+			case DVB_MPEG_ES_SEQ_START:
+				p->sc_need = 5;
+				continue;
+			case DVB_MPEG_ES_PIC_START:
+				p->sc_need = 3;
+				continue;
+			}
+			p->sc_need = 0;
+			break;
+		}
+		p->sc_need = 0;
+		es_start_code(p);
+	}
+	return used;
+}
+
+/*
+ * Looks for 0x000001 start codes on a chunk of the elementary stream.
+ * Scanning for the 0x01 byte with memchr(), which the C library
+ * vectorizes, skips the bulk of the coded data at memory speed: most of
+ * the 0x01 bytes it stops at aren't preceded by two zeros.
+ */
+static void es_scan(struct dvb_mpeg_es_parser *p, const uint8_t *buf,
+		    size_t len)
+{
+	const uint8_t *end = buf + len, *s = buf;
+	size_t i;
+	int found;
+
+	if (!len)
+		return;
+
+	es_collect(p, buf, len);
+
+	while ((s = memchr(s, 0x01, end - s))) {
+		i = s - buf;
+		if (i >= 2)
+			found = !s[-1] && !s[-2];
+		else if (i == 1)
+			found = !buf[0] && p->zeros >= 1;
+		else
+			found = p->zeros >= 2;
+		s++;
+		if (!found)
+			continue;
+		p->sc_len = 0;
+		p->sc_need = 1;
+		s += es_collect(p, s, end - s);
+		if (s == end)
+			break;
+	}
+
+	if (len >= 2)
+		p->zeros = !end[-1] ? (!end[-2] ? 2 : 1) : 0;
+	else if (!buf[0])
+		p->zeros = p->zeros < 2 ? p->zeros + 1 : 2;
+	else
+		p->zeros = 0;
+}
+
+/*
+ * Gathers the PES header. Returns how many bytes of buf belong to it, or
+ * -1 if the data isn't a valid PES packet.
+ */
+static ssize_t es_pes_header(struct dvb_mpeg_es_parser *p, const uint8_t *buf,
+			     size_t len)
+{
+	struct dvb_mpeg_es_event *ev = &p->ts;
+	size_t n, used = 0;
+	uint8_t *h = p->hdr;
+
+	while (used < len) {
+		n = p->hdr_need - p->hdr_len;
+		if (n > len - used)
+			n = len - used;
+		memcpy(h + p->hdr_len, buf + used, n);
+		p->hdr_len += n;
+		used += n;
+		if (p->hdr_len < p->hdr_need)
+			return used;
+
+		if (p->hdr_len == 6) {
+			if (h[0] || h[1] || h[2] != 0x01)
+				return -1;
+			if (es_has_pes_optional(h[3])) {
+				p->hdr_need = 9;
+				continue;
+			}
+		} else if (p->hdr_len == 9) {
+			if ((h[6] & 0xc0) != 0x80)
+				return -1;
+			p->hdr_need = 9 + h[8];
+			if (h[8])
+				continue;
+		}
+		break;
+	}
+
+	memset(ev, 0, sizeof(*ev));
+	ev->type = DVB_MPEG_ES_EVENT_PES;
+	ev->pid = p->pid;
+	ev->stream_id = h[3];
+	ev->discontinuity = p->discontinuity;
+	if (p->hdr_len >= 9) {
+		/* PTS_DTS_flags 10 or 11, then the header must fit them */
+		if ((h[7] & 0x80) && h[8] >= 5) {
+			ev->has_pts = 1;
+			ev->pts = es_parse_ts(h + 9);
+		}
+		if ((h[7] & 0xc0) == 0xc0 && h[8] >= 10) {
+			ev->has_dts = 1;
+			ev->dts = es_parse_ts(h + 14);
+		}
+	}
+	p->hdr_need = 0;
+	p->discontinuity = 0;
+	p->video = (h[3] & 0xf0) == 0xe0;
+	p->pic_ts = ev->has_pts;
+
+	return used;
+}
+
+void dvb_mpeg_es_parser_feed_ts(void *priv, uint16_t pid, const uint8_t *buf,
+				size_t len)
+{
+	struct dvb_mpeg_es_parser *p = priv;
+	unsigned afc, cc, off = 4;
+	int pusi;
+	ssize_t used;
+
+	if (len < DVB_MPEG_TS_PACKET_SIZE || buf[0] != DVB_MPEG_TS)
+		return;
+
+	/* Transport error: the payload can't be trusted */
+	if (buf[1] & 0x80)
+		goto lost;
+
+	pusi = buf[1] & 0x40;
+	afc = (buf[3] >> 4) & 0x03;
+	cc = buf[3] & 0x0f;
+	if (afc & 0x02) {
+		off += 1 + buf[4];
+		/* discontinuity_indicator: the counter may jump */
+		if (buf[4] && (buf[5] & 0x80))
+			p->last_cc = -1;
+	}
+	if (!(afc & 0x01) || off >= DVB_MPEG_TS_PACKET_SIZE)
+		return;
+
+	if (p->last_cc >= 0) {
+		/* A single repeated packet is allowed, and should be ignored */
+		if (cc == p->last_cc)
+			return;
+		if (cc != ((p->last_cc + 1) & 0x0f)) {
+			p->last_cc = cc;
+			goto lost;
+		}
+	}
+	p->last_cc = cc;
+
+	/* Scrambled payloads can't be parsed */
+	if (buf[3] & 0xc0)
+		return;
+
+	buf += off;
+	len = DVB_MPEG_TS_PACKET_SIZE - off;
+
+	if (pusi) {
+		/* A new PES starts here */
+		p->synced = 1;
+		p->pid = pid;
+		p->hdr_len = 0;
+		p->hdr_need = 6;
+	} else if (!p->synced) {
+		return;
+	}
+
+	if (p->hdr_need) {
+		used = es_pes_header(p, buf, len);
+		if (used < 0)
+			goto lost;
+		if (p->hdr_need)
+			return;
+		p->func(p->priv, &p->ts);
+		buf += used;
+		len -= used;
+	}
+
+	if (p->video)
+		es_scan(p, buf, len);
+	return;
+
+lost:
+	/* Wait for the next PES, and don't glue the stream across the gap */
+	p->synced = 0;
+	p->discontinuity = 1;
+	p->hdr_need = 0;
+	p->pic_ts = 0;
+	p->zeros = 0;
+	p->sc_len = p->sc_need = 0;
+}
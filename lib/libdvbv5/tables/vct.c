@@ -132,18 +132,22 @@ ssize_t atsc_table_vct_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	/* Get extra descriptors */
 	size = sizeof(union atsc_table_vct_descriptor_length);
 	while (p + size <= endbuf) {
-		union atsc_table_vct_descriptor_length *d = (void *)p;
-		bswap16(d->descriptor_length);
+		union atsc_table_vct_descriptor_length d;
+
+		/* Don't swap it in place: the buffer belongs to the caller */
+		memcpy(&d, p, size);
+		bswap16(d.bitfield);
 		p += size;
-		if (endbuf - p < d->descriptor_length) {
+		if (endbuf - p < d.descriptor_length) {
 			dvb_logerr("%s: short read %d/%zd bytes", __func__,
-				   d->descriptor_length, endbuf - p);
+				   d.descriptor_length, endbuf - p);
 			return -7;
 		}
-		if (dvb_desc_parse(parms, p, d->descriptor_length,
+		if (dvb_desc_parse(parms, p, d.descriptor_length,
 				      &vct->descriptor) != 0) {
 			return -8;
 		}
+		p += d.descriptor_length;
 	}
 	if (endbuf - p)
 		dvb_logwarn("%s: %zu spurious bytes at the end",
@@ -366,40 +366,38 @@ static int get_fmt_ioctl(int fd, unsigned long int cmd, struct v4l2_format *arg)
 	return ret;
 }
 
+/*
+ * QBUF / DQBUF are done for every frame, so instead of building a new
+ * struct v4l2_buffer, the app's one gets turned into a single plane mplane
+ * buffer and back. Only the m union and length differ between the two.
+ */
 static int buf_ioctl(int fd, unsigned long int cmd, struct v4l2_buffer *arg)
 {
-	struct v4l2_buffer buf = *arg;
 	struct v4l2_plane plane = { 0 };
+	uint32_t type = arg->type;
 	int ret;
 
-	if (arg->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
-	    arg->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+	if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
+	    type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	buf.type = convert_type(arg->type);
+	arg->type = convert_type(type);
 
-	if (buf.type == arg->type)
-		return SYS_IOCTL(fd, cmd, &buf);
+	if (arg->type == type)
+		return SYS_IOCTL(fd, cmd, arg);
 
 	memcpy(&plane.m, &arg->m, sizeof(plane.m));
 	plane.length = arg->length;
 	plane.bytesused = arg->bytesused;
-	
-	buf.m.planes = &plane;
-	buf.length = 1;
 
-	ret = SYS_IOCTL(fd, cmd, &buf);
+	arg->m.planes = &plane;
+	arg->length = 1;
 
-	arg->index = buf.index;
-	arg->memory = buf.memory;
-	arg->flags = buf.flags;
-	arg->field = buf.field;
-	arg->timestamp = buf.timestamp;
-	arg->timecode = buf.timecode;
-	arg->sequence = buf.sequence;
+	ret = SYS_IOCTL(fd, cmd, arg);
 
+	arg->type = type;
 	arg->length = plane.length;
 	arg->bytesused = plane.bytesused;
 	memcpy(&arg->m, &plane.m, sizeof(arg->m));
@@ -72,6 +72,8 @@ struct v4l1_dev_info {
 	unsigned int min_width, min_height, max_width, max_height;
 	unsigned int width, height;
 	unsigned char *v4l1_frame_pointer;
+	unsigned int frames_queued; /* Bitmasks of the v4l1 frames queued to */
+	unsigned int frames_done;   /* libv4l2 and dequeued but not synced */
 };
 
 /* From log.c */
@@ -70,6 +70,8 @@
 #define V4L1_SUPPORTS_ENUMSTD   0x02
 #define V4L1_PIX_FMT_TOUCHED    0x04
 #define V4L1_PIX_SIZE_TOUCHED   0x08
+#define V4L1_STREAMING          0x10
+#define V4L1_NO_STREAMING       0x20
 
 static pthread_mutex_t v4l1_open_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct v4l1_dev_info devices[V4L1_MAX_DEVICES] = {
@@ -158,6 +160,113 @@ static int count_inputs(int fd)
 	return i;
 }
 
+/* VIDIOCMCAPTURE / VIDIOCSYNC get emulated by streaming into the v4l1 frames
+   as USERPTR buffers, so that libv4l2 converts straight into them, or the
+   driver captures straight into them when no conversion is needed. When
+   that is not possible we fall back to v4l2_read() at VIDIOCSYNC time. */
+static int v4l1_start_streaming(int index)
+{
+	int saved_err;
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	struct v4l2_requestbuffers req = {
+		.count = V4L1_NO_FRAMES,
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_USERPTR,
+	};
+
+	if (v4l2_ioctl(devices[index].fd, VIDIOC_REQBUFS, &req))
+		goto fail;
+
+	if (req.count != V4L1_NO_FRAMES ||
+	    v4l2_ioctl(devices[index].fd, VIDIOC_STREAMON, &type)) {
+		saved_err = errno;
+		req.count = 0;
+		v4l2_ioctl(devices[index].fd, VIDIOC_REQBUFS, &req);
+		errno = saved_err;
+		goto fail;
+	}
+
+	devices[index].flags |= V4L1_STREAMING;
+	devices[index].frames_queued = 0;
+	devices[index].frames_done = 0;
+	V4L1_LOG("capturing into the v4l1 buffer through USERPTR streaming\n");
+	return 0;
+
+fail:
+	V4L1_LOG("USERPTR streaming not available (%s), using read()\n",
+			strerror(errno));
+	devices[index].flags |= V4L1_NO_STREAMING;
+	return -1;
+}
+
+static void v4l1_stop_streaming(int index)
+{
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	struct v4l2_requestbuffers req = {
+		.count = 0,
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_USERPTR,
+	};
+
+	if (!(devices[index].flags & V4L1_STREAMING))
+		return;
+
+	v4l2_ioctl(devices[index].fd, VIDIOC_STREAMOFF, &type);
+	v4l2_ioctl(devices[index].fd, VIDIOC_REQBUFS, &req);
+	devices[index].flags &= ~V4L1_STREAMING;
+	devices[index].frames_queued = 0;
+	devices[index].frames_done = 0;
+}
+
+static int v4l1_queue_frame(int index, int frame)
+{
+	struct v4l2_buffer buf = {
+		.index = frame,
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_USERPTR,
+		.length = V4L1_FRAME_BUF_SIZE,
+	};
+
+	if (devices[index].frames_queued & (1u << frame))
+		return 0;
+
+	buf.m.userptr = (unsigned long)(devices[index].v4l1_frame_pointer +
+			frame * V4L1_FRAME_BUF_SIZE);
+	if (v4l2_ioctl(devices[index].fd, VIDIOC_QBUF, &buf))
+		return -1;
+
+	devices[index].frames_done &= ~(1u << frame);
+	devices[index].frames_queued |= 1u << frame;
+	return 0;
+}
+
+static int v4l1_sync_frame(int index, int frame)
+{
+	struct v4l2_buffer buf;
+
+	/* Frames may get dequeued in another order than they are synced */
+	while (!(devices[index].frames_done & (1u << frame))) {
+		if (!(devices[index].frames_queued & (1u << frame))) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_USERPTR;
+		if (v4l2_ioctl(devices[index].fd, VIDIOC_DQBUF, &buf))
+			return -1;
+
+		if (buf.index < V4L1_NO_FRAMES) {
+			devices[index].frames_queued &= ~(1u << buf.index);
+			devices[index].frames_done |= 1u << buf.index;
+		}
+	}
+
+	devices[index].frames_done &= ~(1u << frame);
+	return 0;
+}
+
 static int v4l1_set_format(int index, unsigned int width,
 		unsigned int height, int v4l1_pal, int width_height_may_differ)
 {
@@ -222,6 +331,11 @@ static int v4l1_set_format(int index, unsigned int width,
 		return 0;
 	}
 
+	/* The buffers must be freed before changing the format, with the new
+	   format USERPTR streaming may work (or not) */
+	v4l1_stop_streaming(index);
+	devices[index].flags &= ~V4L1_NO_STREAMING;
+
 	result = v4l2_ioctl(devices[index].fd, VIDIOC_S_FMT, &fmt2);
 	if (result) {
 		int saved_err = errno;
@@ -382,6 +496,8 @@ int v4l1_open(const char *file, int oflag, ...)
 	devices[index].flags = 0;
 	devices[index].open_count = 1;
 	devices[index].v4l1_frame_buf_map_count = 0;
+	devices[index].frames_queued = 0;
+	devices[index].frames_done = 0;
 	devices[index].v4l1_frame_pointer = MAP_FAILED;
 	devices[index].width  = fmt2.fmt.pix.width;
 	devices[index].height = fmt2.fmt.pix.height;
@@ -444,6 +560,10 @@ int v4l1_close(int fd)
 		return v4l2_close(fd);
 
 	/* Free resources */
+	pthread_mutex_lock(&devices[index].stream_lock);
+	v4l1_stop_streaming(index);
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
 	if (devices[index].v4l1_frame_pointer != MAP_FAILED) {
 		if (devices[index].v4l1_frame_buf_map_count)
 			V4L1_LOG("v4l1 capture buffer still mapped: %d times on close()\n",
@@ -774,6 +894,17 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 
 		result = v4l1_set_format(index, map->width, map->height,
 				map->format, 0);
+		if (result ||
+		    devices[index].v4l1_frame_pointer == MAP_FAILED ||
+		    map->frame < 0 || map->frame >= V4L1_NO_FRAMES)
+			break;
+
+		if (!(devices[index].flags &
+		      (V4L1_STREAMING | V4L1_NO_STREAMING)))
+			v4l1_start_streaming(index);
+
+		if (devices[index].flags & V4L1_STREAMING)
+			result = v4l1_queue_frame(index, map->frame);
 		break;
 	}
 
@@ -787,6 +918,11 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 			break;
 		}
 
+		if (devices[index].flags & V4L1_STREAMING) {
+			result = v4l1_sync_frame(index, *frame_index);
+			break;
+		}
+
 		result = v4l2_read(devices[index].fd,
 				devices[index].v4l1_frame_pointer +
 				*frame_index * V4L1_FRAME_BUF_SIZE,
@@ -1200,6 +1336,7 @@ ssize_t v4l1_read(int fd, void *buffer, size_t n)
 		return SYS_READ(fd, buffer, n);
 
 	pthread_mutex_lock(&devices[index].stream_lock);
+	v4l1_stop_streaming(index);
 	result = v4l2_read(fd, buffer, n);
 	pthread_mutex_unlock(&devices[index].stream_lock);
 
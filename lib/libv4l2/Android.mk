@@ -5,6 +5,7 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
     log.c \
     libv4l2.c \
+    pipeline.c \
     v4l2convert.c \
     v4l2-plugin-android.c
 
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Per frame latency statistics.
+ *
+ * For every frame the driver timestamp, the time the driver DQBUF returned
+ * and the time the (converted) frame got handed to the app are recorded,
+ * see enum v4l2_latency_stage for the resulting latencies. Each of these
+ * goes into a log-linear (HDR style) histogram: the values are bucketed
+ * per power of 2, each of which is split into 16 linear sub-buckets. This
+ * keeps the relative error of the percentiles below 1 / 16 over the whole
+ * range, from nanoseconds up to a minute, in a few kB per histogram.
+ * The times of the last frame are kept as well, for tracing frames.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libv4l2.h"
+#include "libv4l2-priv.h"
+
+#define V4L2_LATENCY_SUB_BITS 4
+#define V4L2_LATENCY_SUB_BUCKETS (1 << V4L2_LATENCY_SUB_BITS)
+/* Latencies are clamped to 2^36 ns (about 68 s) */
+#define V4L2_LATENCY_MAX_BITS 36
+#define V4L2_LATENCY_BUCKETS \
+	((V4L2_LATENCY_MAX_BITS - V4L2_LATENCY_SUB_BITS + 2) * \
+	 V4L2_LATENCY_SUB_BUCKETS)
+
+struct v4l2_latency_histogram {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint32_t buckets[V4L2_LATENCY_BUCKETS];
+};
+
+struct v4l2_latency {
+	/* When the driver DQBUF returned, per buffer, 0 when unknown */
+	uint64_t dequeued_ns[V4L2_MAX_NO_FRAMES];
+	struct v4l2_latency_histogram hist[V4L2_LATENCY_STAGE_COUNT];
+	/* The last frame handed to the app, returned_ns is 0 before that */
+	struct v4l2_frame_times last;
+};
+
+static uint64_t v4l2_latency_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* The driver timestamp in ns on our clock, 0 if it is on another clock */
+static uint64_t v4l2_latency_captured(const struct v4l2_buffer *buf)
+{
+	if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return 0;
+
+	return (uint64_t)buf->timestamp.tv_sec * 1000000000ull +
+		(uint64_t)buf->timestamp.tv_usec * 1000;
+}
+
+static int v4l2_latency_bucket(uint64_t ns)
+{
+	int shift;
+
+	if (ns >= (1ull << V4L2_LATENCY_MAX_BITS))
+		ns = (1ull << V4L2_LATENCY_MAX_BITS) - 1;
+	if (ns < V4L2_LATENCY_SUB_BUCKETS)
+		return ns;
+
+	shift = 63 - __builtin_clzll(ns) - V4L2_LATENCY_SUB_BITS;
+	return (shift + 1) * V4L2_LATENCY_SUB_BUCKETS +
+		(int)(ns >> shift) - V4L2_LATENCY_SUB_BUCKETS;
+}
+
+/* The middle of the range of values counted in a bucket */
+static uint64_t v4l2_latency_bucket_value(int bucket)
+{
+	int shift = bucket / V4L2_LATENCY_SUB_BUCKETS - 1;
+	uint64_t low;
+
+	if (shift < 0)
+		return bucket;
+
+	low = (uint64_t)(V4L2_LATENCY_SUB_BUCKETS +
+			 bucket % V4L2_LATENCY_SUB_BUCKETS) << shift;
+	return low + ((1ull << shift) >> 1);
+}
+
+static void v4l2_latency_add(struct v4l2_latency_histogram *hist,
+		uint64_t ns)
+{
+	if (!hist->count || ns < hist->min_ns)
+		hist->min_ns = ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+	hist->count++;
+	hist->sum_ns += ns;
+	hist->buckets[v4l2_latency_bucket(ns)]++;
+}
+
+static uint64_t v4l2_latency_percentile(
+		const struct v4l2_latency_histogram *hist, unsigned int permille)
+{
+	uint64_t rank, value, seen = 0;
+	int i;
+
+	/* The value of the rank-th smallest sample, ranks start at 1 */
+	rank = (hist->count * permille + 999) / 1000;
+	if (!rank)
+		rank = 1;
+
+	for (i = 0; i < V4L2_LATENCY_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == V4L2_LATENCY_BUCKETS)
+		return hist->max_ns;
+
+	/* Do not report values outside of what was actually seen */
+	value = v4l2_latency_bucket_value(i);
+	if (value < hist->min_ns)
+		value = hist->min_ns;
+	return MIN(value, hist->max_ns);
+}
+
+struct v4l2_latency *v4l2_latency_create(void)
+{
+	return calloc(1, sizeof(struct v4l2_latency));
+}
+
+void v4l2_latency_destroy(struct v4l2_latency *latency)
+{
+	free(latency);
+}
+
+/* The driver DQBUF for buf just returned */
+void v4l2_latency_dequeued(struct v4l2_latency *latency,
+		const struct v4l2_buffer *buf)
+{
+	uint64_t now, captured;
+
+	if (!latency || buf->index >= V4L2_MAX_NO_FRAMES)
+		return;
+
+	now = v4l2_latency_now();
+	latency->dequeued_ns[buf->index] = now;
+
+	captured = v4l2_latency_captured(buf);
+	if (captured && captured <= now)
+		v4l2_latency_add(&latency->hist[V4L2_LATENCY_DRIVER],
+				 now - captured);
+}
+
+/* The frame in buf is handed to the app */
+void v4l2_latency_returned(struct v4l2_latency *latency,
+		const struct v4l2_buffer *buf)
+{
+	uint64_t now, captured, dequeued;
+
+	if (!latency || buf->index >= V4L2_MAX_NO_FRAMES)
+		return;
+
+	now = v4l2_latency_now();
+	dequeued = latency->dequeued_ns[buf->index];
+	latency->dequeued_ns[buf->index] = 0;
+	if (dequeued && dequeued <= now)
+		v4l2_latency_add(&latency->hist[V4L2_LATENCY_LIBV4L2],
+				 now - dequeued);
+
+	captured = v4l2_latency_captured(buf);
+	if (captured && captured <= now)
+		v4l2_latency_add(&latency->hist[V4L2_LATENCY_TOTAL],
+				 now - captured);
+
+	latency->last.sequence = buf->sequence;
+	latency->last.captured_ns = captured;
+	latency->last.dequeued_ns = dequeued;
+	latency->last.returned_ns = now;
+}
+
+void v4l2_latency_get_stats(const struct v4l2_latency *latency,
+		struct v4l2_latency_stats *stats)
+{
+	const struct v4l2_latency_histogram *hist;
+	struct v4l2_latency_stage_stats *stage;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < V4L2_LATENCY_STAGE_COUNT; i++) {
+		hist = &latency->hist[i];
+		stage = &stats->stage[i];
+		if (!hist->count)
+			continue;
+
+		stage->count = hist->count;
+		stage->min_ns = hist->min_ns;
+		stage->max_ns = hist->max_ns;
+		stage->mean_ns = hist->sum_ns / hist->count;
+		stage->p50_ns = v4l2_latency_percentile(hist, 500);
+		stage->p90_ns = v4l2_latency_percentile(hist, 900);
+		stage->p99_ns = v4l2_latency_percentile(hist, 990);
+		stage->p999_ns = v4l2_latency_percentile(hist, 999);
+	}
+}
+
+int v4l2_latency_get_frame_times(const struct v4l2_latency *latency,
+		struct v4l2_frame_times *times)
+{
+	if (!latency->last.returned_ns)
+		return -1;
+
+	*times = latency->last;
+	return 0;
+}
+
+const char *v4l2_latency_stage_name(int stage)
+{
+	static const char *names[V4L2_LATENCY_STAGE_COUNT] = {
+		[V4L2_LATENCY_DRIVER] = "driver",
+		[V4L2_LATENCY_LIBV4L2] = "libv4l2",
+		[V4L2_LATENCY_TOTAL] = "total",
+	};
+
+	if (stage < 0 || stage >= V4L2_LATENCY_STAGE_COUNT)
+		return NULL;
+
+	return names[stage];
+}
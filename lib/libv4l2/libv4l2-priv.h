@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/types.h>
 #include <libv4lconvert.h> /* includes videodev2.h for us */
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
@@ -33,6 +34,7 @@
 #define V4L2_DEFAULT_NREADBUFFERS 4
 #define V4L2_IGNORE_FIRST_FRAME_ERRORS 3
 #define V4L2_DEFAULT_FPS 30
+#define V4L2_MAX_PIPELINE_DEPTH 7
 
 #define V4L2_LOG_ERR(...) 			\
 	do { 					\
@@ -82,14 +84,42 @@ struct v4l2_dev_info {
 	/* fmt as seen by the application (iow after conversion) */
 	struct v4l2_format dest_fmt;
 	pthread_mutex_t stream_lock;
+	/* Held while converting a frame without the stream_lock, and by the
+	   requests changing the stream, see v4l2_convert_unlocked() */
+	pthread_mutex_t convert_lock;
 	unsigned int no_frames;
 	unsigned int nreadbuffers;
 	int fps;
 	int first_frame;
 	struct v4lconvert_data *convert;
+	/* Frames converted ahead, in parallel, see pipeline.c */
+	int pipeline_depth;
+	struct v4l2_pipeline *pipeline;
+	/* Conversion statistics of destroyed pipelines, when logging */
+	struct v4lconvert_stats pipeline_stats;
+	/* Per frame latency histograms, NULL when not enabled */
+	struct v4l2_latency *latency;
+	/* Convert ahead mode, the feeder thread dequeues frames into the
+	   pipeline as soon as the driver has them, see v4l2_feeder() */
+	int convert_ahead;
+	int feeder_state;
+	int feeder_exit;
+	int feeder_error;
+	int feeder_wake[2];
+	pthread_t feeder;
+	pthread_cond_t feeder_cond;
 	unsigned char *convert_mmap_buf;
 	size_t convert_mmap_buf_size;
 	size_t convert_mmap_frame_size;
+	/* Memory type of the buffers as seen by the app. When converting the
+	   driver always gets MMAP buffers, for USERPTR and DMABUF buffers the
+	   frames get converted straight into the app's buffers. */
+	unsigned int dest_memory;
+	unsigned char *dest_pointers[V4L2_MAX_NO_FRAMES];
+	size_t dest_sizes[V4L2_MAX_NO_FRAMES];
+	/* For DMABUF, the dmabuf mapped at dest_pointers, else -1 */
+	int dest_dmabuf_fds[V4L2_MAX_NO_FRAMES];
+	ino_t dest_dmabuf_inos[V4L2_MAX_NO_FRAMES];
 	/* Frame bookkeeping is only done when in read or mmap-conversion mode */
 	unsigned char *frame_pointers[V4L2_MAX_NO_FRAMES];
 	int frame_sizes[V4L2_MAX_NO_FRAMES];
@@ -97,6 +127,9 @@ struct v4l2_dev_info {
 	int frame_info_generation;
 	/* mapping tracking of our fake (converting mmap) frame buffers */
 	unsigned char frame_map_count[V4L2_MAX_NO_FRAMES];
+	/* When the app uses the cam's own format, the driver buffers as mapped
+	   for the app in place of the fake ones, see v4l2_mmap() */
+	unsigned char *passthrough_pointers[V4L2_MAX_NO_FRAMES];
 	/* buffer when doing conversion and using read() for read() */
 	int readbuf_size;
 	unsigned char *readbuf;
@@ -126,8 +159,43 @@ static inline void v4l2_plugin_cleanup(void *plugin_lib, void *plugin_priv,
 }
 #endif /* WITH_V4L_PLUGINS */
 
+/* From pipeline.c */
+struct v4l2_pipeline *v4l2_pipeline_create(int fd, void *dev_ops_priv,
+		const struct libv4l_dev_ops *dev_ops, int depth);
+void v4l2_pipeline_destroy(struct v4l2_pipeline *pipeline);
+int v4l2_pipeline_in_flight(struct v4l2_pipeline *pipeline);
+int v4l2_pipeline_depth(struct v4l2_pipeline *pipeline);
+void v4l2_pipeline_submit(struct v4l2_pipeline *pipeline,
+		const struct v4l2_buffer *buf, const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, unsigned char *src,
+		unsigned char *dest, int dest_size);
+int v4l2_pipeline_wait(struct v4l2_pipeline *pipeline, struct v4l2_buffer *buf);
+const char *v4l2_pipeline_get_error_message(struct v4l2_pipeline *pipeline);
+void v4l2_pipeline_set_feeding(struct v4l2_pipeline *pipeline, int feeding);
+int v4l2_pipeline_ready(struct v4l2_pipeline *pipeline);
+void v4l2_pipeline_flush(struct v4l2_pipeline *pipeline);
+void v4l2_pipeline_add_stats(struct v4l2_pipeline *pipeline,
+		struct v4lconvert_stats *stats);
+
+/* From latency.c */
+struct v4l2_latency *v4l2_latency_create(void);
+void v4l2_latency_destroy(struct v4l2_latency *latency);
+void v4l2_latency_dequeued(struct v4l2_latency *latency,
+		const struct v4l2_buffer *buf);
+void v4l2_latency_returned(struct v4l2_latency *latency,
+		const struct v4l2_buffer *buf);
+void v4l2_latency_get_stats(const struct v4l2_latency *latency,
+		struct v4l2_latency_stats *stats);
+int v4l2_latency_get_frame_times(const struct v4l2_latency *latency,
+		struct v4l2_frame_times *times);
+const char *v4l2_latency_stage_name(int stage);
+
 /* From log.c */
 extern const char *v4l2_ioctls[];
 void v4l2_log_ioctl(unsigned long int request, void *arg, int result);
+void v4l2_log_add_stats(struct v4lconvert_stats *sum,
+		const struct v4lconvert_stats *stats);
+void v4l2_log_stats(int fd, const struct v4lconvert_stats *stats);
+void v4l2_log_latency_stats(int fd, const struct v4l2_latency_stats *stats);
 
 #endif
@@ -56,7 +56,9 @@
    preserved.
  */
 #include <errno.h>
+#include <poll.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -65,9 +67,11 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <linux/dma-buf.h>
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
+#include "libv4l-probes.h"
 
 /* Note these flags are stored together with the flags passed to v4l2_fd_open()
    in v4l2_dev_info's flags member, so care should be taken that the do not
@@ -82,7 +86,16 @@
 
 #define V4L2_MMAP_OFFSET_MAGIC      0xABCDEF00u
 
+V4L_PROBE_SEMAPHORE(libv4l2, dequeue_entry);
+V4L_PROBE_SEMAPHORE(libv4l2, dequeue_return);
+
+/* v4l2_dev_info's feeder_state */
+#define V4L2_FEEDER_NONE		0
+#define V4L2_FEEDER_RUNNING		1
+#define V4L2_FEEDER_STOPPED		2 /* exited, waiting to get joined */
+
 static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
+static void v4l2_stop_feeder(int index);
 static void v4l2_set_src_and_dest_format(int index,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
 
@@ -95,6 +108,23 @@ static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
 };
 static int devices_used;
 
+/* fd -> index + 1 into devices[] (0 when the fd is not ours), so that the
+   calls on fds which are not ours, which with the LD_PRELOAD wrapper are
+   most calls, do not need to scan devices[]. Entries only get written with
+   v4l2_open_mutex held and read without any locking, see v4l2_get_index().
+   Devices with a larger fd are looked up by scanning devices[]. */
+#define V4L2_FD_TABLE_SIZE 1024
+static unsigned char v4l2_fd_table[V4L2_FD_TABLE_SIZE];
+
+static void v4l2_fd_table_set(int fd, int index)
+{
+	if (fd >= 0 && fd < V4L2_FD_TABLE_SIZE)
+		/* Release, so that a reader finding the index also sees all
+		   the device info filled in before */
+		__atomic_store_n(&v4l2_fd_table[fd], index + 1,
+				 __ATOMIC_RELEASE);
+}
+
 static int v4l2_ensure_convert_mmap_buf(int index)
 {
 	if (devices[index].convert_mmap_buf != MAP_FAILED) {
@@ -122,6 +152,119 @@ static int v4l2_ensure_convert_mmap_buf(int index)
 	return 0;
 }
 
+/* Unmap the dmabufs of the app's DMABUF buffers and forget about the app's
+   USERPTR / DMABUF buffers */
+static void v4l2_release_dest_buffers(int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
+		if (devices[index].dest_dmabuf_fds[i] != -1)
+			SYS_MUNMAP(devices[index].dest_pointers[i],
+					devices[index].dest_sizes[i]);
+		devices[index].dest_pointers[i] = NULL;
+		devices[index].dest_sizes[i] = 0;
+		devices[index].dest_dmabuf_fds[i] = -1;
+	}
+}
+
+/* Remember the app's buffer passed to QBUF as destination for the frame
+   which will get dequeued into the matching driver buffer */
+static int v4l2_set_dest_buffer(int index, struct v4l2_buffer *buf)
+{
+	unsigned int i = buf->index;
+	size_t needed = devices[index].dest_fmt.fmt.pix.sizeimage;
+	struct stat st;
+	void *p;
+	off_t size;
+
+	if (buf->memory != devices[index].dest_memory ||
+	    i >= devices[index].no_frames) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (buf->memory == V4L2_MEMORY_USERPTR) {
+		if (!buf->m.userptr || buf->length < needed) {
+			V4L2_LOG_ERR("userptr buffer %u too small\n", i);
+			errno = EINVAL;
+			return -1;
+		}
+		devices[index].dest_pointers[i] = (unsigned char *)buf->m.userptr;
+		devices[index].dest_sizes[i] = buf->length;
+		return 0;
+	}
+
+	/* Keep the dmabuf mapped as long as the app keeps using it for
+	   this buffer */
+	if (fstat(buf->m.fd, &st)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (devices[index].dest_dmabuf_fds[i] == buf->m.fd &&
+	    devices[index].dest_dmabuf_inos[i] == st.st_ino)
+		return 0;
+
+	size = lseek(buf->m.fd, 0, SEEK_END);
+	if (size < 0 || (size_t)size < needed) {
+		V4L2_LOG_ERR("dmabuf for buffer %u too small\n", i);
+		errno = EINVAL;
+		return -1;
+	}
+
+	p = (void *)SYS_MMAP(NULL, (size_t)size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, buf->m.fd, 0);
+	if (p == MAP_FAILED) {
+		int saved_err = errno;
+
+		V4L2_PERROR("mmapping dmabuf for buffer %u", i);
+		errno = saved_err;
+		return -1;
+	}
+
+	if (devices[index].dest_dmabuf_fds[i] != -1)
+		SYS_MUNMAP(devices[index].dest_pointers[i],
+				devices[index].dest_sizes[i]);
+	devices[index].dest_pointers[i] = p;
+	devices[index].dest_sizes[i] = size;
+	devices[index].dest_dmabuf_fds[i] = buf->m.fd;
+	devices[index].dest_dmabuf_inos[i] = st.st_ino;
+	return 0;
+}
+
+/* Bracket the cpu writes to a dmabuf destination buffer */
+static void v4l2_sync_dest_buffer(int index, unsigned int buf_index, int end)
+{
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_WRITE |
+			 (end ? DMA_BUF_SYNC_END : DMA_BUF_SYNC_START),
+	};
+
+	if (buf_index < V4L2_MAX_NO_FRAMES &&
+	    devices[index].dest_dmabuf_fds[buf_index] != -1)
+		SYS_IOCTL(devices[index].dest_dmabuf_fds[buf_index],
+			  DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/* Where to convert the frame dequeued into driver buffer buf_index to when
+   the caller did not ask for a specific destination */
+static unsigned char *v4l2_get_dest_buffer(int index, unsigned int buf_index,
+		int *size)
+{
+	if (devices[index].dest_memory != V4L2_MEMORY_MMAP) {
+		*size = devices[index].dest_sizes[buf_index];
+		return devices[index].dest_pointers[buf_index];
+	}
+
+	*size = devices[index].convert_mmap_frame_size;
+	/* The app sees the driver buffer itself, convert in place */
+	if (devices[index].passthrough_pointers[buf_index] != MAP_FAILED)
+		return devices[index].frame_pointers[buf_index];
+
+	return devices[index].convert_mmap_buf +
+		buf_index * devices[index].convert_mmap_frame_size;
+}
+
 static int v4l2_request_read_buffers(int index)
 {
 	int result;
@@ -261,6 +404,7 @@ static int v4l2_streamoff(int index)
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
 	if (devices[index].flags & V4L2_STREAMON) {
+		v4l2_stop_feeder(index);
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				devices[index].fd, VIDIOC_STREAMOFF, &type);
@@ -275,6 +419,13 @@ static int v4l2_streamoff(int index)
 
 		/* Stream off also dequeues all our buffers! */
 		devices[index].frame_queued = 0;
+
+		/* Drop the frames in flight and let a DQBUF waiting for one of
+		   them know */
+		if (devices[index].pipeline) {
+			devices[index].frame_info_generation++;
+			v4l2_pipeline_flush(devices[index].pipeline);
+		}
 	}
 
 	return 0;
@@ -306,47 +457,362 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 	return 0;
 }
 
-static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
-		unsigned char *dest, int dest_size)
+static struct v4l2_pipeline *v4l2_get_pipeline(int index)
 {
-	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
-	int result, tries = max_tries, frame_info_gen;
+	if (!devices[index].pipeline_depth)
+		return NULL;
+
+	if (!devices[index].pipeline) {
+		devices[index].pipeline = v4l2_pipeline_create(
+				devices[index].fd, devices[index].dev_ops_priv,
+				devices[index].dev_ops,
+				devices[index].pipeline_depth);
+		if (!devices[index].pipeline) {
+			V4L2_LOG_WARN("could not create conversion pipeline: %s\n",
+				      strerror(errno));
+			devices[index].pipeline_depth = 0;
+		}
+	}
 
-	/* Make sure we have the real v4l2 buffers mapped */
-	result = v4l2_map_buffers(index);
+	return devices[index].pipeline;
+}
+
+static void v4l2_release_pipeline(int index)
+{
+	/* Keep the statistics of its converters for the log on close */
+	if (v4l2_log_file)
+		v4l2_pipeline_add_stats(devices[index].pipeline,
+					&devices[index].pipeline_stats);
+	v4l2_pipeline_destroy(devices[index].pipeline);
+	devices[index].pipeline = NULL;
+}
+
+/* Dequeue a frame from the driver (as described by buf) and start
+   converting it. Called with the stream_lock held, which gets dropped while
+   waiting for the frame. */
+static int v4l2_pipeline_feed(int index, struct v4l2_pipeline *pipeline,
+		const struct v4l2_buffer *buf)
+{
+	struct v4l2_buffer dqbuf = *buf;
+	unsigned char *dest;
+	int result, frame_info_gen, dest_size;
+
+	frame_info_gen = devices[index].frame_info_generation;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	result = devices[index].dev_ops->ioctl(
+			devices[index].dev_ops_priv,
+			devices[index].fd, VIDIOC_DQBUF, &dqbuf);
+	pthread_mutex_lock(&devices[index].stream_lock);
 	if (result)
 		return result;
 
-	do {
-		frame_info_gen = devices[index].frame_info_generation;
+	v4l2_latency_dequeued(devices[index].latency, &dqbuf);
+	devices[index].frame_queued &= ~(1 << dqbuf.index);
+
+	if (frame_info_gen != devices[index].frame_info_generation) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dest = v4l2_get_dest_buffer(index, dqbuf.index, &dest_size);
+	if (!dest) {
+		V4L2_LOG_ERR("no destination buffer for buffer %u\n",
+			     dqbuf.index);
+		v4l2_queue_read_buffer(index, dqbuf.index);
+		errno = EINVAL;
+		return -1;
+	}
+	v4l2_sync_dest_buffer(index, dqbuf.index, 0);
+	v4l2_pipeline_submit(pipeline, &dqbuf,
+			&devices[index].src_fmt, &devices[index].dest_fmt,
+			devices[index].frame_pointers[dqbuf.index],
+			dest, dest_size);
+
+	return 0;
+}
+
+/* At most this many frames are in the pipeline, this always leaves a buffer
+   for the app and one queued at the driver */
+static int v4l2_pipeline_max_in_flight(int index,
+		struct v4l2_pipeline *pipeline)
+{
+	return MIN(v4l2_pipeline_depth(pipeline) + 1,
+		   (int)devices[index].no_frames - 1);
+}
+
+/* The convert ahead feeder thread, keeps the pipeline filled with frames
+   as soon as the driver has them, so that the app's DQBUF normally finds
+   an already converted frame. It runs from the first DQBUF after STREAMON
+   until v4l2_stop_feeder(). */
+static void *v4l2_feeder(void *arg)
+{
+	int index = (intptr_t)arg;
+	struct v4l2_pipeline *pipeline = devices[index].pipeline;
+	struct v4l2_buffer buf;
+	struct pollfd pfd[2];
+	int result;
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	while (!devices[index].feeder_exit) {
+		if (v4l2_pipeline_in_flight(pipeline) >=
+		    v4l2_pipeline_max_in_flight(index, pipeline)) {
+			pthread_cond_wait(&devices[index].feeder_cond,
+					  &devices[index].stream_lock);
+			continue;
+		}
+
+		/* Wait for a frame without blocking in DQBUF, so that
+		   v4l2_stop_feeder() can wake us up */
+		pfd[0].fd = devices[index].fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = devices[index].feeder_wake[0];
+		pfd[1].events = POLLIN;
 		pthread_mutex_unlock(&devices[index].stream_lock);
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_DQBUF, buf);
+		result = poll(pfd, 2, -1);
 		pthread_mutex_lock(&devices[index].stream_lock);
+		if (devices[index].feeder_exit || !pfd[0].revents)
+			continue;
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		result = v4l2_pipeline_feed(index, pipeline, &buf);
+		if (result && errno != EAGAIN) {
+			int saved_err = errno;
+
+			V4L2_PERROR("dequeuing buf");
+			/* Let DQBUF return the error once the frames in flight
+			   have been handed out */
+			devices[index].feeder_error = saved_err;
+			break;
+		}
+	}
+	devices[index].feeder_state = V4L2_FEEDER_STOPPED;
+	v4l2_pipeline_set_feeding(pipeline, 0);
+	pthread_cond_broadcast(&devices[index].feeder_cond);
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return NULL;
+}
+
+static void v4l2_start_feeder(int index)
+{
+	if (pipe(devices[index].feeder_wake))
+		return;
+
+	devices[index].feeder_exit = 0;
+	devices[index].feeder_error = 0;
+	v4l2_pipeline_set_feeding(devices[index].pipeline, 1);
+	if (pthread_create(&devices[index].feeder, NULL, v4l2_feeder,
+			   (void *)(intptr_t)index)) {
+		V4L2_LOG_WARN("could not start the convert ahead thread\n");
+		v4l2_pipeline_set_feeding(devices[index].pipeline, 0);
+		SYS_CLOSE(devices[index].feeder_wake[0]);
+		SYS_CLOSE(devices[index].feeder_wake[1]);
+		devices[index].convert_ahead = 0;
+		return;
+	}
+	devices[index].feeder_state = V4L2_FEEDER_RUNNING;
+}
+
+/* Called with the stream_lock held, frames the feeder already dequeued stay
+   in the pipeline */
+static void v4l2_stop_feeder(int index)
+{
+	if (devices[index].feeder_state == V4L2_FEEDER_NONE)
+		return;
+
+	if (devices[index].feeder_state == V4L2_FEEDER_RUNNING) {
+		devices[index].feeder_exit = 1;
+		SYS_WRITE(devices[index].feeder_wake[1], "", 1);
+		pthread_cond_broadcast(&devices[index].feeder_cond);
+		while (devices[index].feeder_state == V4L2_FEEDER_RUNNING)
+			pthread_cond_wait(&devices[index].feeder_cond,
+					  &devices[index].stream_lock);
+	}
+
+	/* It no longer touches the stream_lock, so this does not block */
+	pthread_join(devices[index].feeder, NULL);
+	SYS_CLOSE(devices[index].feeder_wake[0]);
+	SYS_CLOSE(devices[index].feeder_wake[1]);
+	devices[index].feeder_state = V4L2_FEEDER_NONE;
+}
+
+/* Keep the pipeline filled with newly dequeued frames and get the oldest
+   frame from it once it has been converted. Returns -1 if no frame could be
+   dequeued, otherwise 0 with the conversion result stored in convert_result
+   (and errno set when the conversion failed). */
+static int v4l2_pipeline_dequeue(int index, struct v4l2_pipeline *pipeline,
+		struct v4l2_buffer *buf, int *convert_result)
+{
+	int result, saved_err, frame_info_gen;
+
+	if (devices[index].convert_ahead) {
+		if (devices[index].feeder_state == V4L2_FEEDER_NONE &&
+		    (devices[index].flags & V4L2_STREAMON))
+			v4l2_start_feeder(index);
+
+		if (devices[index].feeder_state == V4L2_FEEDER_STOPPED &&
+		    !v4l2_pipeline_in_flight(pipeline)) {
+			saved_err = devices[index].feeder_error;
+			/* Try again on the next DQBUF */
+			v4l2_stop_feeder(index);
+			errno = saved_err ? saved_err : EINVAL;
+			return -1;
+		}
+
+		if ((fcntl(devices[index].fd, F_GETFL) & O_NONBLOCK) &&
+		    !v4l2_pipeline_ready(pipeline)) {
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	while (devices[index].feeder_state == V4L2_FEEDER_NONE &&
+	       v4l2_pipeline_in_flight(pipeline) <
+	       v4l2_pipeline_max_in_flight(index, pipeline)) {
+		result = v4l2_pipeline_feed(index, pipeline, buf);
 		if (result) {
+			/* Non blocking, return what we already have */
+			if (errno == EAGAIN && v4l2_pipeline_in_flight(pipeline))
+				break;
 			if (errno != EAGAIN) {
-				int saved_err = errno;
-
+				saved_err = errno;
 				V4L2_PERROR("dequeuing buf");
 				errno = saved_err;
 			}
 			return result;
 		}
+	}
 
-		devices[index].frame_queued &= ~(1 << buf->index);
+	frame_info_gen = devices[index].frame_info_generation;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	result = v4l2_pipeline_wait(pipeline, buf);
+	saved_err = errno;
+	pthread_mutex_lock(&devices[index].stream_lock);
+	v4l2_sync_dest_buffer(index, buf->index, 1);
+	/* Room for the feeder to dequeue another frame */
+	pthread_cond_broadcast(&devices[index].feeder_cond);
 
-		if (frame_info_gen != devices[index].frame_info_generation) {
-			errno = -EINVAL;
-			return -1;
-		}
+	/* The pipeline gets flushed on a stream or format change */
+	if (frame_info_gen != devices[index].frame_info_generation) {
+		errno = EINVAL;
+		return -1;
+	}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].frame_pointers[buf->index],
-				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
-					buf->index * devices[index].convert_mmap_frame_size),
-				dest_size);
+	*convert_result = result;
+	errno = saved_err;
+	return 0;
+}
+
+/* Convert a dequeued frame with the stream_lock dropped, so that other
+   threads doing QBUF, G_FMT, mmap(), etc. do not have to wait for the whole
+   conversion. Requests which change the stream (S_FMT, REQBUFS, ...) take
+   the convert_lock as well, so the formats and buffers used here stay put.
+   Called with the stream_lock held, returns with it held again. */
+static int v4l2_convert_unlocked(int index, unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size)
+{
+	int result, saved_err;
+
+	pthread_mutex_lock(&devices[index].convert_lock);
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	result = v4lconvert_convert(devices[index].convert,
+			&devices[index].src_fmt, &devices[index].dest_fmt,
+			src, src_size, dest, dest_size);
+	saved_err = errno;
+	/* Never wait for the stream_lock with the convert_lock held, that
+	   is the other way around from v4l2_ioctl() */
+	pthread_mutex_unlock(&devices[index].convert_lock);
+	pthread_mutex_lock(&devices[index].stream_lock);
+	errno = saved_err;
+
+	return result;
+}
+
+static int v4l2_do_dequeue_and_convert(int index, struct v4l2_buffer *buf,
+		unsigned char *dest, int dest_size)
+{
+	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
+	int result, tries = max_tries, frame_info_gen, frame_dest_size, saved_err;
+	struct v4l2_pipeline *pipeline = NULL;
+	unsigned char *frame_dest;
+	const char *error_msg;
+
+	/* Make sure we have the real v4l2 buffers mapped */
+	result = v4l2_map_buffers(index);
+	if (result)
+		return result;
+
+	/* Only frames converted to our own mmap buffers can be pipelined, and
+	   only when there are enough buffers to have one in flight */
+	if (!dest) {
+		pipeline = v4l2_get_pipeline(index);
+		if (pipeline && v4l2_pipeline_max_in_flight(index, pipeline) < 1)
+			pipeline = NULL;
+	}
+
+	do {
+		if (pipeline) {
+			if (v4l2_pipeline_dequeue(index, pipeline, buf,
+						  &result))
+				return -1;
+			error_msg = v4l2_pipeline_get_error_message(pipeline);
+		} else {
+			frame_info_gen = devices[index].frame_info_generation;
+			pthread_mutex_unlock(&devices[index].stream_lock);
+			result = devices[index].dev_ops->ioctl(
+					devices[index].dev_ops_priv,
+					devices[index].fd, VIDIOC_DQBUF, buf);
+			pthread_mutex_lock(&devices[index].stream_lock);
+			if (result) {
+				if (errno != EAGAIN) {
+					int saved_err = errno;
+
+					V4L2_PERROR("dequeuing buf");
+					errno = saved_err;
+				}
+				return result;
+			}
+
+			v4l2_latency_dequeued(devices[index].latency, buf);
+			devices[index].frame_queued &= ~(1 << buf->index);
+
+			if (frame_info_gen != devices[index].frame_info_generation) {
+				errno = -EINVAL;
+				return -1;
+			}
+
+			if (dest) {
+				frame_dest = dest;
+				frame_dest_size = dest_size;
+			} else {
+				frame_dest = v4l2_get_dest_buffer(index,
+						buf->index, &frame_dest_size);
+				if (!frame_dest) {
+					V4L2_LOG_ERR("no destination buffer for buffer %u\n",
+						     buf->index);
+					v4l2_queue_read_buffer(index, buf->index);
+					errno = EINVAL;
+					return -1;
+				}
+			}
+
+			if (!dest)
+				v4l2_sync_dest_buffer(index, buf->index, 0);
+			result = v4l2_convert_unlocked(index,
+					devices[index].frame_pointers[buf->index],
+					buf->bytesused, frame_dest, frame_dest_size);
+			saved_err = errno;
+			if (!dest)
+				v4l2_sync_dest_buffer(index, buf->index, 1);
+			if (frame_info_gen != devices[index].frame_info_generation) {
+				errno = EINVAL;
+				return -1;
+			}
+			errno = saved_err;
+			error_msg = v4lconvert_get_error_message(devices[index].convert);
+		}
 
 		if (devices[index].first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
@@ -362,10 +828,10 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						error_msg);
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						error_msg);
 
 			/*
 			 * If this is the last try, and the frame is short
@@ -381,7 +847,7 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, error_msg);
 		errno = EIO;
 	}
 
@@ -392,6 +858,25 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		errno = 0;
 	}
 
+	if (result >= 0)
+		v4l2_latency_returned(devices[index].latency, buf);
+
+	return result;
+}
+
+static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
+		unsigned char *dest, int dest_size)
+{
+	uint64_t start = V4L_PROBE_START(libv4l2, dequeue_return);
+	int result;
+
+	V4L_PROBE(libv4l2, dequeue_entry, devices[index].fd, buf->type);
+	result = v4l2_do_dequeue_and_convert(index, buf, dest, dest_size);
+	V4L_PROBE(libv4l2, dequeue_return, devices[index].fd, buf->index,
+		  buf->sequence, result,
+		  devices[index].dest_fmt.fmt.pix.pixelformat,
+		  V4L_PROBE_NS(start));
+
 	return result;
 }
 
@@ -554,6 +1039,21 @@ static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 	if (buf->index >= devices[index].no_frames)
 		buf->index = 0;
 
+	if (devices[index].dest_memory != V4L2_MEMORY_MMAP) {
+		unsigned int i = buf->index;
+
+		buf->memory = devices[index].dest_memory;
+		buf->length = devices[index].dest_sizes[i] ?
+			devices[index].dest_sizes[i] :
+			devices[index].convert_mmap_frame_size;
+		if (buf->memory == V4L2_MEMORY_USERPTR)
+			buf->m.userptr = (unsigned long)devices[index].dest_pointers[i];
+		else
+			buf->m.fd = devices[index].dest_dmabuf_fds[i];
+		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
+		return;
+	}
+
 	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
 	buf->length = devices[index].convert_mmap_frame_size;
 	if (devices[index].frame_map_count[buf->index])
@@ -721,9 +1221,19 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 			errno = saved_err;
 			return -1;
 		}
+		if (v4l2_log_file)
+			v4lconvert_enable_stats(convert, 1);
 	}
 
 no_capture:
+	/* Without a plugin, libv4lconvert or a log file libv4l2 would only pass
+	   all calls through to the kernel, so do not register the fd at all.
+	   Later calls then go straight to the syscalls, and the fd does not
+	   take up one of our V4L2_MAX_DEVICES slots */
+	if (!plugin_library && !convert && !v4l2_log_file &&
+	    !getenv("LIBV4L2_LATENCY_STATS"))
+		return fd;
+
 	/* So we have a v4l2 capture device, register it in our devices array */
 	pthread_mutex_lock(&v4l2_open_mutex);
 	for (index = 0; index < V4L2_MAX_DEVICES; index++) {
@@ -759,28 +1269,71 @@ no_capture:
 		devices[index].flags |= V4L2_SUPPORTS_TIMEPERFRAME;
 	devices[index].open_count = 1;
 	devices[index].page_size = page_size;
+	devices[index].convert = convert;
 	devices[index].src_fmt  = fmt;
 	devices[index].dest_fmt = fmt;
 	v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
 				     &devices[index].dest_fmt);
 
 	pthread_mutex_init(&devices[index].stream_lock, NULL);
+	pthread_mutex_init(&devices[index].convert_lock, NULL);
+	pthread_cond_init(&devices[index].feeder_cond, NULL);
 
 	devices[index].no_frames = 0;
 	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
-	devices[index].convert = convert;
+	if (getenv("LIBV4L2_READ_BUFFERS")) {
+		int nreadbuffers = atoi(getenv("LIBV4L2_READ_BUFFERS"));
+
+		/* read() keeps one buffer to convert from */
+		if (nreadbuffers >= 2)
+			devices[index].nreadbuffers =
+				MIN(nreadbuffers, V4L2_MAX_NO_FRAMES);
+	}
+	if (getenv("LIBV4L2_READ_MULTIPLE_FRAMES"))
+		devices[index].flags |= V4L2_READ_MULTIPLE_FRAMES;
+	devices[index].pipeline_depth = 0;
+	devices[index].pipeline = NULL;
+	memset(&devices[index].pipeline_stats, 0,
+	       sizeof(devices[index].pipeline_stats));
+	devices[index].latency = NULL;
+	if (v4l2_log_file || getenv("LIBV4L2_LATENCY_STATS"))
+		devices[index].latency = v4l2_latency_create();
+	if (convert) {
+		char *depth = getenv("LIBV4L2_PIPELINE_DEPTH");
+
+		if (depth)
+			devices[index].pipeline_depth =
+				MIN(atoi(depth), V4L2_MAX_PIPELINE_DEPTH);
+		if (devices[index].pipeline_depth < 0)
+			devices[index].pipeline_depth = 0;
+	}
+	devices[index].convert_ahead = convert &&
+		((v4l2_flags & V4L2_CONVERT_AHEAD) ||
+		 getenv("LIBV4L2_CONVERT_AHEAD"));
+	/* Converting ahead is done by the pipeline */
+	if (devices[index].convert_ahead && !devices[index].pipeline_depth)
+		devices[index].pipeline_depth = 1;
+	devices[index].feeder_state = V4L2_FEEDER_NONE;
 	devices[index].convert_mmap_buf = MAP_FAILED;
 	devices[index].convert_mmap_buf_size = 0;
+	devices[index].dest_memory = V4L2_MEMORY_MMAP;
 	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
 		devices[index].frame_pointers[i] = MAP_FAILED;
 		devices[index].frame_map_count[i] = 0;
+		devices[index].passthrough_pointers[i] = MAP_FAILED;
+		devices[index].dest_pointers[i] = NULL;
+		devices[index].dest_sizes[i] = 0;
+		devices[index].dest_dmabuf_fds[i] = -1;
 	}
 	devices[index].frame_queued = 0;
 	devices[index].readbuf = NULL;
 	devices[index].readbuf_size = 0;
 
+	pthread_mutex_lock(&v4l2_open_mutex);
 	if (index >= devices_used)
 		devices_used = index + 1;
+	v4l2_fd_table_set(fd, index);
+	pthread_mutex_unlock(&v4l2_open_mutex);
 
 	/* Note we always tell v4lconvert to optimize src fmt selection for
 	   our default fps, the only exception is the app explicitly selecting
@@ -803,6 +1356,9 @@ static int v4l2_get_index(int fd)
 	if (fd == -1)
 		return -1;
 
+	if (fd >= 0 && fd < V4L2_FD_TABLE_SIZE)
+		return __atomic_load_n(&v4l2_fd_table[fd], __ATOMIC_ACQUIRE) - 1;
+
 	for (index = 0; index < devices_used; index++)
 		if (devices[index].fd == fd)
 			break;
@@ -832,12 +1388,37 @@ int v4l2_close(int fd)
 	if (result)
 		return 0;
 
+	/* Let a conversion still running in another thread finish */
+	pthread_mutex_lock(&devices[index].convert_lock);
+	pthread_mutex_unlock(&devices[index].convert_lock);
+
 	v4l2_plugin_cleanup(devices[index].plugin_library,
 			devices[index].dev_ops_priv,
 			devices[index].dev_ops);
 
 	/* Free resources */
+	pthread_mutex_lock(&devices[index].stream_lock);
+	v4l2_stop_feeder(index);
+	pthread_mutex_unlock(&devices[index].stream_lock);
+	v4l2_release_pipeline(index);
+	if (v4l2_log_file && devices[index].convert) {
+		struct v4lconvert_stats stats;
+
+		if (v4lconvert_get_stats(devices[index].convert, &stats) == 0) {
+			v4l2_log_add_stats(&stats, &devices[index].pipeline_stats);
+			v4l2_log_stats(fd, &stats);
+		}
+	}
+	if (devices[index].latency) {
+		struct v4l2_latency_stats stats;
+
+		v4l2_latency_get_stats(devices[index].latency, &stats);
+		v4l2_log_latency_stats(fd, &stats);
+		v4l2_latency_destroy(devices[index].latency);
+		devices[index].latency = NULL;
+	}
 	v4l2_unmap_buffers(index);
+	v4l2_release_dest_buffers(index);
 	if (devices[index].convert_mmap_buf != MAP_FAILED) {
 		if (v4l2_buffers_mapped(index)) {
 			if (!devices[index].gone)
@@ -857,7 +1438,10 @@ int v4l2_close(int fd)
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
+	pthread_mutex_lock(&v4l2_open_mutex);
+	v4l2_fd_table_set(fd, -1);
 	devices[index].fd = -1;
+	pthread_mutex_unlock(&v4l2_open_mutex);
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
 	   redo the close in case it was interrupted */
@@ -904,6 +1488,7 @@ static int v4l2_check_buffer_change_ok(int index)
 			devices[index].convert_mmap_buf_size);
 	devices[index].convert_mmap_buf = MAP_FAILED;
 	devices[index].convert_mmap_buf_size = 0;
+	v4l2_release_dest_buffers(index);
 
 	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
@@ -944,7 +1529,10 @@ static void v4l2_set_src_and_dest_format(int index,
 	 * set without having gone through libv4lconvert_try_fmt, so that a
 	 * try_fmt on the result of a get_fmt always returns the same result.
 	 */
-	if (v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat)) {
+	if (v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat) &&
+	    !(devices[index].convert &&
+	      v4lconvert_passthrough_format(devices[index].convert,
+					    dest_fmt->fmt.pix.pixelformat))) {
 		dest_fmt->fmt.pix.width &= ~7;
 		dest_fmt->fmt.pix.height &= ~1;
 	}
@@ -1057,6 +1645,7 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	va_list ap;
 	int result, index, saved_err;
 	int is_capture_request = 0, stream_needs_locking = 0;
+	int convert_needs_locking = 0;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
@@ -1083,6 +1672,9 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOC_G_EXT_CTRLS:
 	case VIDIOC_TRY_EXT_CTRLS:
 	case VIDIOC_S_EXT_CTRLS:
+	case VIDIOC_SUBSCRIBE_EVENT:
+	case VIDIOC_UNSUBSCRIBE_EVENT:
+	case VIDIOC_DQEVENT:
 	case VIDIOC_ENUM_FRAMESIZES:
 	case VIDIOC_ENUM_FRAMEINTERVALS:
 		is_capture_request = 1;
@@ -1175,6 +1767,19 @@ no_capture_request:
 			V4L2_LOG("Done setting pixelformat (supported_dst_fmt_only)");
 		}
 		devices[index].flags |= V4L2_STREAM_TOUCHED;
+
+		/* Only requests changing the stream need to wait for a
+		   conversion, see v4l2_convert_unlocked() */
+		switch (request) {
+		case VIDIOC_G_FMT:
+		case VIDIOC_QUERYBUF:
+		case VIDIOC_QBUF:
+		case VIDIOC_DQBUF:
+			break;
+		default:
+			pthread_mutex_lock(&devices[index].convert_lock);
+			convert_needs_locking = 1;
+		}
 	}
 
 	switch (request) {
@@ -1202,6 +1807,20 @@ no_capture_request:
 		result = v4lconvert_vidioc_s_ext_ctrls(devices[index].convert, arg);
 		break;
 
+	case VIDIOC_SUBSCRIBE_EVENT:
+		result = v4lconvert_vidioc_subscribe_event(devices[index].convert,
+							   arg);
+		break;
+
+	case VIDIOC_UNSUBSCRIBE_EVENT:
+		result = v4lconvert_vidioc_unsubscribe_event(
+				devices[index].convert, arg);
+		break;
+
+	case VIDIOC_DQEVENT:
+		result = v4lconvert_vidioc_dqevent(devices[index].convert, arg);
+		break;
+
 	case VIDIOC_QUERYCAP: {
 		struct v4l2_capability *cap = arg;
 
@@ -1299,8 +1918,11 @@ no_capture_request:
 	case VIDIOC_REQBUFS: {
 		struct v4l2_requestbuffers *req = arg;
 
-		/* IMPROVEME (maybe?) add support for userptr's? */
-		if (req->memory != V4L2_MEMORY_MMAP) {
+		unsigned int memory = req->memory;
+
+		if (memory != V4L2_MEMORY_MMAP &&
+		    memory != V4L2_MEMORY_USERPTR &&
+		    memory != V4L2_MEMORY_DMABUF) {
 			errno = EINVAL;
 			result = -1;
 			break;
@@ -1314,14 +1936,25 @@ no_capture_request:
 		if (req->count > V4L2_MAX_NO_FRAMES)
 			req->count = V4L2_MAX_NO_FRAMES;
 
+		/* When converting we need mmap buffers to convert from, with
+		   USERPTR / DMABUF buffers we convert into the app's buffers */
+		if (v4l2_needs_conversion(index))
+			req->memory = V4L2_MEMORY_MMAP;
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				fd, VIDIOC_REQBUFS, req);
+		req->memory = memory;
 		if (result < 0)
 			break;
 		result = 0; /* some drivers return the number of buffers on success */
 
+		if (v4l2_needs_conversion(index))
+			req->capabilities |= V4L2_BUF_CAP_SUPPORTS_MMAP |
+					     V4L2_BUF_CAP_SUPPORTS_USERPTR |
+					     V4L2_BUF_CAP_SUPPORTS_DMABUF;
+
 		devices[index].no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
+		devices[index].dest_memory = memory;
 		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
 		break;
 	}
@@ -1337,6 +1970,8 @@ no_capture_request:
 
 		/* Do a real query even when converting to let the driver fill in
 		   things like buf->field */
+		if (v4l2_needs_conversion(index))
+			buf->memory = V4L2_MEMORY_MMAP;
 		result = devices[index].dev_ops->ioctl(
 				devices[index].dev_ops_priv,
 				fd, VIDIOC_QUERYBUF, buf);
@@ -1359,6 +1994,13 @@ no_capture_request:
 			result = v4l2_map_buffers(index);
 			if (result)
 				break;
+
+			if (devices[index].dest_memory != V4L2_MEMORY_MMAP) {
+				result = v4l2_set_dest_buffer(index, buf);
+				if (result)
+					break;
+				buf->memory = V4L2_MEMORY_MMAP;
+			}
 		}
 
 		result = devices[index].dev_ops->ioctl(
@@ -1388,19 +2030,24 @@ no_capture_request:
 				saved_err = errno;
 				V4L2_PERROR("dequeuing buf");
 				errno = saved_err;
+				break;
 			}
+			v4l2_latency_dequeued(devices[index].latency, buf);
+			v4l2_latency_returned(devices[index].latency, buf);
 			break;
 		}
 
 		/* An application can do a DQBUF before mmap-ing in the buffer,
 		   but we need the buffer _now_ to write our converted data
 		   to it! */
-		result = v4l2_ensure_convert_mmap_buf(index);
-		if (result)
-			break;
+		if (devices[index].dest_memory == V4L2_MEMORY_MMAP) {
+			result = v4l2_ensure_convert_mmap_buf(index);
+			if (result)
+				break;
+		}
 
-		result = v4l2_dequeue_and_convert(index, buf, 0,
-				devices[index].convert_mmap_frame_size);
+		buf->memory = V4L2_MEMORY_MMAP;
+		result = v4l2_dequeue_and_convert(index, buf, 0, 0);
 		if (result >= 0) {
 			buf->bytesused = result;
 			result = 0;
@@ -1454,6 +2101,8 @@ no_capture_request:
 		break;
 	}
 
+	if (convert_needs_locking)
+		pthread_mutex_unlock(&devices[index].convert_lock);
 	if (stream_needs_locking)
 		pthread_mutex_unlock(&devices[index].stream_lock);
 
@@ -1531,6 +2180,36 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 		V4L2_LOG_ERR("dest fmt different after restoring src fmt");
 }
 
+/* Add the frames which have already been captured to a read(), as long as
+   they fit in it. Each buffer gets queued again as soon as it has been
+   converted. */
+static size_t v4l2_read_more_frames(int index, unsigned char *dest, size_t n)
+{
+	size_t frame_size = devices[index].dest_fmt.fmt.pix.sizeimage;
+	struct pollfd pfd = { .fd = devices[index].fd, .events = POLLIN };
+	struct v4l2_buffer buf;
+	int saved_err = errno;
+	size_t done = 0;
+	int result;
+
+	while (frame_size && n - done >= frame_size &&
+	       poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN)) {
+		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		result = v4l2_dequeue_and_convert(index, &buf, dest + done,
+						  n - done);
+		if (result < 0)
+			break;
+
+		v4l2_queue_read_buffer(index, buf.index);
+		done += result;
+	}
+
+	/* Errors are for the next read() to report */
+	errno = saved_err;
+	return done;
+}
+
 ssize_t v4l2_read(int fd, void *dest, size_t n)
 {
 	ssize_t result;
@@ -1586,8 +2265,13 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 		buf.memory = V4L2_MEMORY_MMAP;
 		result = v4l2_dequeue_and_convert(index, &buf, dest, n);
 
-		if (result >= 0)
+		if (result >= 0) {
 			v4l2_queue_read_buffer(index, buf.index);
+			if (devices[index].flags & V4L2_READ_MULTIPLE_FRAMES)
+				result += v4l2_read_more_frames(index,
+						(unsigned char *)dest + result,
+						n - result);
+		}
 	}
 
 leave:
@@ -1614,6 +2298,67 @@ ssize_t v4l2_write(int fd, const void *buffer, size_t n)
 			devices[index].dev_ops_priv, fd, buffer, n);
 }
 
+/* When the app asked for the format the cam delivers, conversion mode only
+   gets entered for the software processing / flipping, which often is not
+   active. Then map the driver buffer itself for the app, instead of a fake
+   buffer, so that such frames do not get copied at all and the others get
+   processed in place. */
+static void *v4l2_map_passthrough_buffer(int index, unsigned int buffer_index)
+{
+	struct v4l2_buffer buf;
+	void *result;
+
+	if (devices[index].passthrough_pointers[buffer_index] != MAP_FAILED)
+		return devices[index].passthrough_pointers[buffer_index];
+
+	/* Already mapped as a fake buffer, stick with that */
+	if (devices[index].frame_map_count[buffer_index] ||
+	    !v4l2_pix_fmt_identical(&devices[index].src_fmt,
+				    &devices[index].dest_fmt))
+		return MAP_FAILED;
+
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = buffer_index;
+	buf.reserved = buf.reserved2 = 0;
+	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
+			devices[index].fd, VIDIOC_QUERYBUF, &buf) ||
+	    buf.length < devices[index].convert_mmap_frame_size)
+		return MAP_FAILED;
+
+	/* Map exactly the size the app expects, so that its munmap() also
+	   does the right thing once we have forgotten about the buffer */
+	result = (void *)SYS_MMAP(NULL, devices[index].convert_mmap_frame_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED, devices[index].fd,
+			buf.m.offset);
+	if (result != MAP_FAILED)
+		devices[index].passthrough_pointers[buffer_index] = result;
+
+	return result;
+}
+
+/* Returns the index of the buffer the app mapped at start, or -1 if start
+   is not one of ours */
+static int v4l2_mapped_buffer_index(int index, unsigned char *start,
+		size_t length)
+{
+	unsigned char *buf = devices[index].convert_mmap_buf;
+	unsigned int i;
+
+	if (length != devices[index].convert_mmap_frame_size)
+		return -1;
+
+	if (buf != MAP_FAILED && start >= buf && (start - buf) % length == 0 &&
+	    (start - buf) / length < devices[index].no_frames)
+		return (start - buf) / length;
+
+	for (i = 0; i < devices[index].no_frames; i++)
+		if (devices[index].passthrough_pointers[i] == start)
+			return i;
+
+	return -1;
+}
+
 void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		int64_t offset)
 {
@@ -1650,6 +2395,14 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		goto leave;
 	}
 
+	result = v4l2_map_passthrough_buffer(index, buffer_index);
+	if (result != MAP_FAILED) {
+		devices[index].frame_map_count[buffer_index]++;
+		V4L2_LOG("Passthrough mmap buf %u, seen by app at: %p\n",
+				buffer_index, result);
+		goto leave;
+	}
+
 	if (v4l2_ensure_convert_mmap_buf(index)) {
 		errno = EINVAL;
 		result = MAP_FAILED;
@@ -1672,18 +2425,14 @@ leave:
 
 int v4l2_munmap(void *_start, size_t length)
 {
-	int index;
-	unsigned int buffer_index;
+	int index, buffer_index;
 	unsigned char *start = _start;
 
 	/* Is this memory ours? */
 	if (start != MAP_FAILED) {
 		for (index = 0; index < devices_used; index++)
 			if (devices[index].fd != -1 &&
-					devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0)
+			    v4l2_mapped_buffer_index(index, start, length) != -1)
 				break;
 
 		if (index != devices_used) {
@@ -1691,16 +2440,16 @@ int v4l2_munmap(void *_start, size_t length)
 
 			pthread_mutex_lock(&devices[index].stream_lock);
 
-			buffer_index = (start - devices[index].convert_mmap_buf) / length;
-
 			/* Re-do our checks now that we have the lock, things may have changed */
-			if (devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0 &&
-					buffer_index < devices[index].no_frames) {
+			buffer_index = v4l2_mapped_buffer_index(index, start, length);
+			if (buffer_index != -1) {
 				if (devices[index].frame_map_count[buffer_index] > 0)
 					devices[index].frame_map_count[buffer_index]--;
+				if (!devices[index].frame_map_count[buffer_index] &&
+				    devices[index].passthrough_pointers[buffer_index] == start) {
+					SYS_MUNMAP(start, length);
+					devices[index].passthrough_pointers[buffer_index] = MAP_FAILED;
+				}
 				unmapped = 1;
 			}
 
@@ -1777,3 +2526,109 @@ int v4l2_get_control(int fd, int cid)
 			(qctrl.maximum - qctrl.minimum) / 2) /
 		(qctrl.maximum - qctrl.minimum);
 }
+
+int v4l2_set_pipeline_depth(int fd, int depth)
+{
+	int index = v4l2_get_index(fd);
+	int result = 0;
+
+	if (index == -1 || devices[index].convert == NULL) {
+		V4L2_LOG_ERR("v4l2_set_pipeline_depth called with invalid fd: %d\n",
+			     fd);
+		errno = EBADF;
+		return -1;
+	}
+
+	if (depth < 0 || depth > V4L2_MAX_PIPELINE_DEPTH) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	if (devices[index].feeder_state != V4L2_FEEDER_NONE ||
+	    v4l2_pipeline_in_flight(devices[index].pipeline)) {
+		errno = EBUSY;
+		result = -1;
+	} else if (depth != devices[index].pipeline_depth) {
+		/* (Re)created with the new depth on the next DQBUF */
+		v4l2_release_pipeline(index);
+		devices[index].pipeline_depth = depth;
+	}
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return result;
+}
+
+int v4l2_enable_latency_stats(int fd, int enable)
+{
+	int index = v4l2_get_index(fd);
+	int result = 0;
+
+	if (index == -1) {
+		V4L2_LOG_ERR("v4l2_enable_latency_stats called with invalid fd: %d\n",
+			     fd);
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	v4l2_latency_destroy(devices[index].latency);
+	devices[index].latency = NULL;
+	if (enable) {
+		devices[index].latency = v4l2_latency_create();
+		if (!devices[index].latency) {
+			errno = ENOMEM;
+			result = -1;
+		}
+	}
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return result;
+}
+
+int v4l2_get_latency_stats(int fd, struct v4l2_latency_stats *stats)
+{
+	int index = v4l2_get_index(fd);
+	int result = 0;
+
+	if (index == -1) {
+		V4L2_LOG_ERR("v4l2_get_latency_stats called with invalid fd: %d\n",
+			     fd);
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	if (devices[index].latency) {
+		v4l2_latency_get_stats(devices[index].latency, stats);
+	} else {
+		errno = EINVAL;
+		result = -1;
+	}
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return result;
+}
+
+int v4l2_get_frame_times(int fd, struct v4l2_frame_times *times)
+{
+	int index = v4l2_get_index(fd);
+	int result = -1;
+
+	if (index == -1) {
+		V4L2_LOG_ERR("v4l2_get_frame_times called with invalid fd: %d\n",
+			     fd);
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&devices[index].stream_lock);
+	if (devices[index].latency)
+		result = v4l2_latency_get_frame_times(devices[index].latency,
+						      times);
+	if (result)
+		errno = EINVAL;
+	pthread_mutex_unlock(&devices[index].stream_lock);
+
+	return result;
+}
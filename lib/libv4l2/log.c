@@ -256,3 +256,69 @@ void v4l2_log_ioctl(unsigned long int request, void *arg, int result)
 
 	fflush(v4l2_log_file);
 }
+
+void v4l2_log_add_stats(struct v4lconvert_stats *sum,
+		const struct v4lconvert_stats *stats)
+{
+	int i;
+
+	for (i = 0; i < V4LCONVERT_STAGE_COUNT; i++) {
+		sum->stage[i].count += stats->stage[i].count;
+		sum->stage[i].ns += stats->stage[i].ns;
+		sum->stage[i].bytes_in += stats->stage[i].bytes_in;
+		sum->stage[i].bytes_out += stats->stage[i].bytes_out;
+	}
+}
+
+void v4l2_log_stats(int fd, const struct v4lconvert_stats *stats)
+{
+	const struct v4lconvert_stage_stats *stage;
+	int i;
+
+	if (!v4l2_log_file)
+		return;
+
+	fprintf(v4l2_log_file, "libv4l2: conversion statistics for fd %d:\n", fd);
+	for (i = 0; i < V4LCONVERT_STAGE_COUNT; i++) {
+		stage = &stats->stage[i];
+		if (!stage->count)
+			continue;
+		fprintf(v4l2_log_file,
+			"  %-10s count: %llu time: %llu us (avg %llu us) in: %llu bytes out: %llu bytes\n",
+			v4lconvert_get_stage_name(i),
+			(unsigned long long)stage->count,
+			(unsigned long long)(stage->ns / 1000),
+			(unsigned long long)(stage->ns / 1000 / stage->count),
+			(unsigned long long)stage->bytes_in,
+			(unsigned long long)stage->bytes_out);
+	}
+	fflush(v4l2_log_file);
+}
+
+void v4l2_log_latency_stats(int fd, const struct v4l2_latency_stats *stats)
+{
+	const struct v4l2_latency_stage_stats *stage;
+	int i;
+
+	if (!v4l2_log_file)
+		return;
+
+	fprintf(v4l2_log_file, "libv4l2: latency statistics for fd %d:\n", fd);
+	for (i = 0; i < V4L2_LATENCY_STAGE_COUNT; i++) {
+		stage = &stats->stage[i];
+		if (!stage->count)
+			continue;
+		fprintf(v4l2_log_file,
+			"  %-10s count: %llu min: %llu us avg: %llu us p50: %llu us p90: %llu us p99: %llu us p99.9: %llu us max: %llu us\n",
+			v4l2_latency_stage_name(i),
+			(unsigned long long)stage->count,
+			(unsigned long long)(stage->min_ns / 1000),
+			(unsigned long long)(stage->mean_ns / 1000),
+			(unsigned long long)(stage->p50_ns / 1000),
+			(unsigned long long)(stage->p90_ns / 1000),
+			(unsigned long long)(stage->p99_ns / 1000),
+			(unsigned long long)(stage->p999_ns / 1000),
+			(unsigned long long)(stage->max_ns / 1000));
+	}
+	fflush(v4l2_log_file);
+}
@@ -0,0 +1,290 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Frame level conversion pipeline.
+ *
+ * When converting / decoding a frame takes longer than the frame interval
+ * (f.e. MJPEG at high resolutions and frame rates), a single thread cannot
+ * keep up. The pipeline converts up to depth + 1 frames at the same time,
+ * each on its own worker thread with its own v4lconvert instance (and thus
+ * its own jpeg decompressor). Frames are handed back in the order in which
+ * they were submitted, so the added latency is bounded by depth frames.
+ *
+ * Normally frames get submitted from the app's DQBUF call. In convert ahead
+ * mode a feeder thread in libv4l2.c submits them as soon as the driver has
+ * them, and DQBUF waits for a submission when nothing is in flight.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libv4l2.h"
+#include "libv4l2-priv.h"
+
+enum v4l2_pipeline_job_state {
+	V4L2_PIPELINE_JOB_IDLE,
+	V4L2_PIPELINE_JOB_PENDING,
+	V4L2_PIPELINE_JOB_DONE,
+};
+
+struct v4l2_pipeline_job {
+	struct v4l2_pipeline *pipeline;
+	enum v4l2_pipeline_job_state state;
+	pthread_t thread;
+	pthread_cond_t cond;
+	struct v4lconvert_data *convert;
+	struct v4l2_buffer buf;
+	struct v4l2_format src_fmt;
+	struct v4l2_format dest_fmt;
+	unsigned char *src;
+	unsigned char *dest;
+	int dest_size;
+	int result;
+	int error;
+};
+
+struct v4l2_pipeline {
+	int depth;
+	int started;
+	int exit;
+	/* Frames are submitted by a feeder thread, see v4l2_pipeline_wait() */
+	int feeding;
+	pthread_mutex_t lock;
+	pthread_cond_t done_cond;
+	/* Oldest in flight job and number of jobs in flight */
+	int tail;
+	int in_flight;
+	struct v4l2_pipeline_job jobs[V4L2_MAX_PIPELINE_DEPTH + 1];
+};
+
+static void *v4l2_pipeline_worker(void *arg)
+{
+	struct v4l2_pipeline_job *job = arg;
+	struct v4l2_pipeline *pipeline = job->pipeline;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (1) {
+		while (!pipeline->exit && job->state != V4L2_PIPELINE_JOB_PENDING)
+			pthread_cond_wait(&job->cond, &pipeline->lock);
+		if (pipeline->exit)
+			break;
+		pthread_mutex_unlock(&pipeline->lock);
+
+		job->result = v4lconvert_convert(job->convert, &job->src_fmt,
+				&job->dest_fmt, job->src, job->buf.bytesused,
+				job->dest, job->dest_size);
+		job->error = errno;
+
+		pthread_mutex_lock(&pipeline->lock);
+		job->state = V4L2_PIPELINE_JOB_DONE;
+		pthread_cond_broadcast(&pipeline->done_cond);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return NULL;
+}
+
+struct v4l2_pipeline *v4l2_pipeline_create(int fd, void *dev_ops_priv,
+		const struct libv4l_dev_ops *dev_ops, int depth)
+{
+	struct v4l2_pipeline *pipeline;
+	int i;
+
+	if (depth < 1 || depth > V4L2_MAX_PIPELINE_DEPTH) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pipeline = calloc(1, sizeof(*pipeline));
+	if (!pipeline)
+		return NULL;
+
+	pipeline->depth = depth;
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->done_cond, NULL);
+
+	for (i = 0; i <= depth; i++) {
+		struct v4l2_pipeline_job *job = &pipeline->jobs[i];
+
+		job->pipeline = pipeline;
+		job->convert = v4lconvert_create_with_dev_ops(fd, dev_ops_priv,
+							      dev_ops);
+		if (!job->convert)
+			break;
+		if (v4l2_log_file)
+			v4lconvert_enable_stats(job->convert, 1);
+
+		pthread_cond_init(&job->cond, NULL);
+		if (pthread_create(&job->thread, NULL, v4l2_pipeline_worker,
+				   job)) {
+			pthread_cond_destroy(&job->cond);
+			v4lconvert_destroy(job->convert);
+			job->convert = NULL;
+			break;
+		}
+		pipeline->started++;
+	}
+
+	if (pipeline->started != depth + 1) {
+		v4l2_pipeline_destroy(pipeline);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return pipeline;
+}
+
+void v4l2_pipeline_destroy(struct v4l2_pipeline *pipeline)
+{
+	int i;
+
+	if (!pipeline)
+		return;
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->exit = 1;
+	for (i = 0; i < pipeline->started; i++)
+		pthread_cond_signal(&pipeline->jobs[i].cond);
+	pthread_mutex_unlock(&pipeline->lock);
+
+	for (i = 0; i < pipeline->started; i++) {
+		pthread_join(pipeline->jobs[i].thread, NULL);
+		pthread_cond_destroy(&pipeline->jobs[i].cond);
+		v4lconvert_destroy(pipeline->jobs[i].convert);
+	}
+
+	pthread_cond_destroy(&pipeline->done_cond);
+	pthread_mutex_destroy(&pipeline->lock);
+	free(pipeline);
+}
+
+int v4l2_pipeline_in_flight(struct v4l2_pipeline *pipeline)
+{
+	return pipeline ? pipeline->in_flight : 0;
+}
+
+int v4l2_pipeline_depth(struct v4l2_pipeline *pipeline)
+{
+	return pipeline ? pipeline->depth : 0;
+}
+
+/* Start converting a frame, the caller must make sure that fewer than
+   depth + 1 frames are in flight */
+void v4l2_pipeline_submit(struct v4l2_pipeline *pipeline,
+		const struct v4l2_buffer *buf, const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, unsigned char *src,
+		unsigned char *dest, int dest_size)
+{
+	struct v4l2_pipeline_job *job;
+
+	pthread_mutex_lock(&pipeline->lock);
+	job = &pipeline->jobs[(pipeline->tail + pipeline->in_flight) %
+			      (pipeline->depth + 1)];
+	job->buf = *buf;
+	job->src_fmt = *src_fmt;
+	job->dest_fmt = *dest_fmt;
+	job->src = src;
+	job->dest = dest;
+	job->dest_size = dest_size;
+	job->state = V4L2_PIPELINE_JOB_PENDING;
+	pipeline->in_flight++;
+	pthread_cond_signal(&job->cond);
+	if (pipeline->feeding)
+		pthread_cond_broadcast(&pipeline->done_cond);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* While feeding, v4l2_pipeline_wait() waits for a frame to get submitted
+   instead of failing when none are in flight */
+void v4l2_pipeline_set_feeding(struct v4l2_pipeline *pipeline, int feeding)
+{
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->feeding = feeding;
+	pthread_cond_broadcast(&pipeline->done_cond);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* Has the oldest frame in flight been converted? */
+int v4l2_pipeline_ready(struct v4l2_pipeline *pipeline)
+{
+	int ready;
+
+	pthread_mutex_lock(&pipeline->lock);
+	ready = pipeline->in_flight &&
+		pipeline->jobs[pipeline->tail].state == V4L2_PIPELINE_JOB_DONE;
+	pthread_mutex_unlock(&pipeline->lock);
+
+	return ready;
+}
+
+/* Wait for the oldest frame in flight to be converted, store its buffer in
+   buf and return the v4lconvert_convert() result for it. Error messages
+   for it are available through v4l2_pipeline_get_error_message() until the
+   next call. */
+int v4l2_pipeline_wait(struct v4l2_pipeline *pipeline, struct v4l2_buffer *buf)
+{
+	struct v4l2_pipeline_job *job;
+	int result, error;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (1) {
+		if (!pipeline->in_flight && pipeline->feeding) {
+			pthread_cond_wait(&pipeline->done_cond, &pipeline->lock);
+			continue;
+		}
+		if (!pipeline->in_flight) {
+			pthread_mutex_unlock(&pipeline->lock);
+			errno = EINVAL;
+			return -1;
+		}
+		job = &pipeline->jobs[pipeline->tail];
+		if (job->state == V4L2_PIPELINE_JOB_DONE)
+			break;
+		pthread_cond_wait(&pipeline->done_cond, &pipeline->lock);
+	}
+	*buf = job->buf;
+	result = job->result;
+	error = job->error;
+	job->state = V4L2_PIPELINE_JOB_IDLE;
+	pipeline->tail = (pipeline->tail + 1) % (pipeline->depth + 1);
+	pipeline->in_flight--;
+	pthread_mutex_unlock(&pipeline->lock);
+
+	errno = error;
+	return result;
+}
+
+const char *v4l2_pipeline_get_error_message(struct v4l2_pipeline *pipeline)
+{
+	int last = (pipeline->tail + pipeline->depth) % (pipeline->depth + 1);
+
+	return v4lconvert_get_error_message(pipeline->jobs[last].convert);
+}
+
+/* Wait for and drop all frames in flight */
+void v4l2_pipeline_flush(struct v4l2_pipeline *pipeline)
+{
+	struct v4l2_buffer buf;
+	int saved_err = errno;
+
+	while (v4l2_pipeline_in_flight(pipeline))
+		v4l2_pipeline_wait(pipeline, &buf);
+
+	errno = saved_err;
+}
+
+/* Add the conversion statistics of all jobs to stats */
+void v4l2_pipeline_add_stats(struct v4l2_pipeline *pipeline,
+		struct v4lconvert_stats *stats)
+{
+	struct v4lconvert_stats job_stats;
+	int i;
+
+	if (!pipeline)
+		return;
+
+	v4l2_pipeline_flush(pipeline);
+	for (i = 0; i < pipeline->started; i++) {
+		if (v4lconvert_get_stats(pipeline->jobs[i].convert, &job_stats) == 0)
+			v4l2_log_add_stats(stats, &job_stats);
+	}
+}
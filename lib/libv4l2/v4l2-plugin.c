@@ -17,6 +17,7 @@
 */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <glob.h>
@@ -47,19 +48,27 @@
 
 #define PLUGINS_PATTERN LIBV4L2_PLUGIN_DIR "/*.so"
 
-void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
-		      const struct libv4l_dev_ops **dev_ops_ret)
+/* The plugins get loaded once, on the first open, and then stay loaded, so
+   that opening many devices does not dlopen() and dlclose() all plugins for
+   each of them */
+struct v4l2_plugin {
+	void *library;
+	const struct libv4l_dev_ops *dev_ops;
+};
+
+static pthread_once_t v4l2_plugins_once = PTHREAD_ONCE_INIT;
+static struct v4l2_plugin *v4l2_plugins;
+static int v4l2_plugins_count;
+
+static void v4l2_plugins_load(void)
 {
 	char *error;
 	int glob_ret, i;
 	void *plugin_library = NULL;
 	const struct libv4l_dev_ops *libv4l2_plugin = NULL;
+	struct v4l2_plugin *plugins;
 	glob_t globbuf;
 
-	*dev_ops_ret = v4lconvert_get_default_dev_ops();
-	*plugin_lib_ret = NULL;
-	*plugin_priv_ret = NULL;
-
 	glob_ret = glob(PLUGINS_PATTERN, 0, NULL, &globbuf);
 
 	if (glob_ret == GLOB_NOSPACE)
@@ -68,6 +77,10 @@ void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
 	if (glob_ret == GLOB_ABORTED || glob_ret == GLOB_NOMATCH)
 		goto leave;
 
+	plugins = calloc(globbuf.gl_pathc, sizeof(*plugins));
+	if (!plugins)
+		goto leave;
+
 	for (i = 0; i < globbuf.gl_pathc; i++) {
 		V4L2_LOG("PLUGIN: dlopen(%s);\n", globbuf.gl_pathv[i]);
 
@@ -93,27 +106,44 @@ void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
 			continue;
 		}
 
-		*plugin_priv_ret = libv4l2_plugin->init(fd);
+		plugins[v4l2_plugins_count].library = plugin_library;
+		plugins[v4l2_plugins_count].dev_ops = libv4l2_plugin;
+		v4l2_plugins_count++;
+	}
+	v4l2_plugins = plugins;
+
+leave:
+	globfree(&globbuf);
+}
+
+void v4l2_plugin_init(int fd, void **plugin_lib_ret, void **plugin_priv_ret,
+		      const struct libv4l_dev_ops **dev_ops_ret)
+{
+	int i;
+
+	*dev_ops_ret = v4lconvert_get_default_dev_ops();
+	*plugin_lib_ret = NULL;
+	*plugin_priv_ret = NULL;
+
+	pthread_once(&v4l2_plugins_once, v4l2_plugins_load);
+
+	for (i = 0; i < v4l2_plugins_count; i++) {
+		*plugin_priv_ret = v4l2_plugins[i].dev_ops->init(fd);
 		if (!*plugin_priv_ret) {
 			V4L2_LOG("PLUGIN: plugin open() returned NULL\n");
-			dlclose(plugin_library);
 			continue;
 		}
 
-		*plugin_lib_ret = plugin_library;
-		*dev_ops_ret = libv4l2_plugin;
+		*plugin_lib_ret = v4l2_plugins[i].library;
+		*dev_ops_ret = v4l2_plugins[i].dev_ops;
 		break;
 	}
-
-leave:
-	globfree(&globbuf);
 }
 
 void v4l2_plugin_cleanup(void *plugin_lib, void *plugin_priv,
 			 const struct libv4l_dev_ops *dev_ops)
 {
-	if (plugin_lib) {
+	/* The library stays loaded for the next open */
+	if (plugin_lib)
 		dev_ops->close(plugin_priv);
-		dlclose(plugin_lib);
-	}
 }
@@ -21,6 +21,26 @@
 
 #include "../include/libv4l2rds.h"
 
+/* bitsets of the AF codes (1..204) in an AF list, one per band, to check
+ * for duplicates without scanning the list */
+struct rds_af_bits {
+	uint32_t vhf[7];
+	uint32_t lf_mf[7];
+};
+
+/* index of a table with PI keys (EON, TMC stations), to find the entry of
+ * a PI without scanning the table. The entries are chained per hash bucket,
+ * slots are stored + 1 so that 0 marks the end of a chain */
+#define RDS_PI_HASH_SIZE 16
+#define RDS_PI_INDEX_SIZE (MAX_TMC_ALT_STATIONS > MAX_EON_CNT ? \
+			   MAX_TMC_ALT_STATIONS : MAX_EON_CNT)
+
+struct rds_pi_index {
+	uint8_t bucket[RDS_PI_HASH_SIZE];
+	uint8_t next[RDS_PI_INDEX_SIZE];
+	uint16_t pi[RDS_PI_INDEX_SIZE];
+};
+
 /* struct to encapsulate the private state information of the decoding process */
 /* the fields (except for handle) are for internal use only - new information
  * is decoded and stored in them until it can be verified and copied to the
@@ -72,6 +92,12 @@ struct rds_private_state {
 	 * be done */
 	struct v4l2_rds_group rds_group;
 	struct v4l2_rds_data rds_data_raw[4];
+
+	/* lookup structures for the AF, EON and TMC station tables */
+	struct rds_af_bits af_bits;
+	struct rds_af_bits eon_af_bits[MAX_EON_CNT];
+	struct rds_pi_index eon_index;
+	struct rds_pi_index tmc_station_index;
 };
 
 /* states of the RDS block into group decoding state machine */
@@ -87,6 +113,40 @@ static inline uint8_t set_bit(uint8_t input, uint8_t bitmask, bool bitvalue)
 	return bitvalue ? input | bitmask : input & ~bitmask;
 }
 
+static inline unsigned int rds_pi_hash(uint16_t pi)
+{
+	/* the lower bits hold the program reference number */
+	return (pi ^ (pi >> 4) ^ (pi >> 8)) % RDS_PI_HASH_SIZE;
+}
+
+/* returns the slot of the given PI, or -1 if it is not in the table */
+static int rds_pi_find(const struct rds_pi_index *index, uint16_t pi)
+{
+	for (uint8_t slot = index->bucket[rds_pi_hash(pi)]; slot;
+	     slot = index->next[slot - 1])
+		if (index->pi[slot - 1] == pi)
+			return slot - 1;
+	return -1;
+}
+
+/* stores the PI of a slot, replacing the old one if the slot was in use */
+static void rds_pi_store(struct rds_pi_index *index, uint8_t slot,
+			 uint16_t pi, bool in_use)
+{
+	uint8_t *link;
+
+	if (in_use) {
+		link = &index->bucket[rds_pi_hash(index->pi[slot])];
+		while (*link != slot + 1)
+			link = &index->next[*link - 1];
+		*link = index->next[slot];
+	}
+	link = &index->bucket[rds_pi_hash(pi)];
+	index->pi[slot] = pi;
+	index->next[slot] = *link;
+	*link = slot + 1;
+}
+
 /* rds_decode_a-d(..): group of functions to decode different RDS blocks
  * into the RDS group that's currently being received
  *
@@ -241,15 +301,15 @@ static int rds_add_tmc_station(struct rds_private_state *priv_state, uint16_t pi
 	struct v4l2_tmc_tuning *tuning = &priv_state->handle.tmc.tuning;
 	uint8_t index = tuning->index;
 	uint8_t size = tuning->station_cnt;
+	int slot;
 
 	/* check if there's an entry for the given PI key */
-	for (int i = 0; i < tuning->station_cnt; i++) {
-		if (tuning->station[i].pi == pi) {
-			return i;
-		}
-	}
+	slot = rds_pi_find(&priv_state->tmc_station_index, pi);
+	if (slot >= 0)
+		return slot;
 	/* if the the maximum table size is reached, overwrite old
 	 * entries, starting at the oldest one = 0 */
+	rds_pi_store(&priv_state->tmc_station_index, index, pi, index < size);
 	tuning->station[index].pi = pi;
 	tuning->index = (index+1 < MAX_TMC_ALT_STATIONS) ? (index+1) : 0;
 	tuning->station_cnt = (size+1 <= MAX_TMC_ALT_STATIONS) ? (size+1) : MAX_TMC_ALT_STATIONS;
@@ -623,10 +683,12 @@ static bool rds_add_oda(struct rds_private_state *priv_state, struct v4l2_rds_od
 }
 
 /* add a new AF to the list, if it doesn't exist yet */
-static bool rds_add_af_to_list(struct v4l2_rds_af_set *af_set, uint8_t af, bool is_vhf)
+static bool rds_add_af_to_list(struct v4l2_rds_af_set *af_set, struct rds_af_bits *af_bits,
+			       uint8_t af, bool is_vhf)
 {
 	/* convert the frequency to Hz, skip on errors */
 	uint32_t freq = rds_decode_af(af, is_vhf);
+	uint32_t *bits = is_vhf ? af_bits->vhf : af_bits->lf_mf;
 
 	if (freq == 0) 
 		return false;
@@ -635,11 +697,10 @@ static bool rds_add_af_to_list(struct v4l2_rds_af_set *af_set, uint8_t af, bool
 	if (af_set->size >= MAX_AF_CNT || af_set->size >= af_set->announced_af)
 		return false;
 	/* check if AF already exists */
-	for (int i = 0; i < af_set->size; i++) {
-		if (af_set->af[i] == freq)
-			return false;
-	}
+	if (bits[af / 32] & (1U << (af % 32)))
+		return false;
 	/* it's a new AF, add it to the list */
+	bits[af / 32] |= 1U << (af % 32);
 	af_set->af[af_set->size++] = freq;
 	return true;
 }
@@ -663,7 +724,7 @@ static bool rds_add_af(struct rds_private_state *priv_state)
 
 	/* 250: LF / MF frequency follows */
 	if (c_msb == 250) {
-		if (rds_add_af_to_list(af_set, c_lsb, false))
+		if (rds_add_af_to_list(af_set, &priv_state->af_bits, c_lsb, false))
 			updated_af = true;
 		c_lsb = 0; /* invalidate */
 	}
@@ -672,16 +733,17 @@ static bool rds_add_af(struct rds_private_state *priv_state)
 		if (af_set->announced_af != c_msb - 224) {
 			updated_af = true;
 			af_set->size = 0;
+			memset(&priv_state->af_bits, 0, sizeof(priv_state->af_bits));
 		}
 		af_set->announced_af = c_msb - 224;
 	}
 	/* check if the data represents an AF (for 1 <= val <= 204 the
 	 * value represents an AF) */
 	if (c_msb < 205)
-		if (rds_add_af_to_list(af_set, c_msb, true))
+		if (rds_add_af_to_list(af_set, &priv_state->af_bits, c_msb, true))
 			updated_af = true;
 	if (c_lsb < 205)
-		if (rds_add_af_to_list(af_set, c_lsb, true))
+		if (rds_add_af_to_list(af_set, &priv_state->af_bits, c_lsb, true))
 			updated_af = true;
 	/* did we receive all announced AFs? */
 	if (af_set->size >= af_set->announced_af && af_set->announced_af != 0)
@@ -720,15 +782,15 @@ static uint8_t rds_add_eon_entry(struct rds_private_state *priv_state, uint16_t
 	struct v4l2_rds *handle = &priv_state->handle;
 	uint8_t index = handle->rds_eon.index;
 	uint8_t size = handle->rds_eon.size;
+	int slot;
 
 	/* check if there's an entry for the given PI key */
-	for (int i = 0; i < handle->rds_eon.size; i++) {
-		if (handle->rds_eon.eon[i].pi == pi) {
-			return i;
-		}
-	}
+	slot = rds_pi_find(&priv_state->eon_index, pi);
+	if (slot >= 0)
+		return slot;
 	/* if the the maximum table size is reached, overwrite old
 	 * entries, starting at the oldest one = 0 */
+	rds_pi_store(&priv_state->eon_index, index, pi, index < size);
 	handle->rds_eon.eon[index].pi = pi;
 	handle->rds_eon.eon[index].valid_fields |= V4L2_RDS_PI;
 	handle->rds_eon.index = (index+1 < MAX_EON_CNT) ? (index+1) : 0;
@@ -739,15 +801,7 @@ static uint8_t rds_add_eon_entry(struct rds_private_state *priv_state, uint16_t
 /* checks if an entry for the given PI already exists */
 static bool rds_check_eon_entry(struct rds_private_state *priv_state, uint16_t pi)
 {
-	struct v4l2_rds *handle = &priv_state->handle;
-
-	/* check if there's an entry for the given PI key */
-	for (int i = 0; i <= handle->rds_eon.size; i++) {
-		if (handle->rds_eon.eon[i].pi == pi) {
-			return true;
-		}
-	}
-	return false;
+	return rds_pi_find(&priv_state->eon_index, pi) >= 0;
 }
 
 /* group of functions to decode successfully received RDS groups into
@@ -1255,9 +1309,11 @@ static uint32_t rds_decode_group14(struct rds_private_state* priv_state)
 		 * value represents an AF) */
 		if (c_msb < 205)
 			new_a = rds_add_af_to_list(&eon_entry->af,
+					&priv_state->eon_af_bits[eon_index],
 					grp->data_c_msb, true);
 		if (c_lsb < 205)
 			new_b = rds_add_af_to_list(&eon_entry->af,
+					&priv_state->eon_af_bits[eon_index],
 					grp->data_c_lsb, true);
 		/* check if one of the frequencies was previously unknown */
 		if (new_a || new_b) {
@@ -1365,7 +1421,7 @@ void v4l2_rds_reset(struct v4l2_rds *handle, bool reset_statistics)
  * Decoding is only done once a complete group was received. This is slower compared
  * to decoding the group type independent information up front, but adds a barrier
  * against corrupted data (happens regularly when reception is weak) */
-uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
+static uint32_t rds_add_block(struct v4l2_rds *handle, const struct v4l2_rds_data *rds_data)
 {
 	struct rds_private_state *priv_state = (struct rds_private_state *) handle;
 	struct v4l2_rds_data *rds_data_raw = priv_state->rds_data_raw;
@@ -1450,6 +1506,39 @@ uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
 	return 0;
 }
 
+uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
+{
+	return rds_add_block(handle, rds_data);
+}
+
+uint32_t v4l2_rds_add_batch(struct v4l2_rds *handle,
+		const struct v4l2_rds_data *rds_data, unsigned int num_blocks,
+		struct v4l2_rds_change *changes, unsigned int *num_changes)
+{
+	struct rds_private_state *priv_state = (struct rds_private_state *) handle;
+	unsigned int max_changes = (changes && num_changes) ? *num_changes : 0;
+	unsigned int n = 0;
+	uint32_t all_fields = 0;
+
+	for (unsigned int i = 0; i < num_blocks; i++) {
+		uint32_t updated_fields = rds_add_block(handle, &rds_data[i]);
+
+		if (!updated_fields)
+			continue;
+		all_fields |= updated_fields;
+		if (n < max_changes) {
+			changes[n].block = i;
+			changes[n].updated_fields = updated_fields;
+			changes[n].group_id = priv_state->rds_group.group_id;
+			changes[n].group_version = priv_state->rds_group.group_version;
+			n++;
+		}
+	}
+	if (num_changes)
+		*num_changes = n;
+	return all_fields;
+}
+
 const char *v4l2_rds_get_pty_str(const struct v4l2_rds *handle)
 {
 	const uint8_t pty = handle->pty;
@@ -4,20 +4,34 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     bayer.c \
+    bayer-simd.c \
     cpia1.c \
+    cpu.c \
     crop.c \
+    detile.c \
+    detile-simd.c \
     flip.c \
+    flip-simd.c \
+    hash.c \
+    hash-simd.c \
     helper.c \
     nv12_16l16.c \
-    jidctflt.c \
+    jidctint.c \
+    jidctint-simd.c \
     jl2005bcd.c \
     jpeg.c \
     jpeg_memsrcdest.c \
     jpgl.c \
     libv4lconvert.c \
+    m2m.c \
     mr97310a.c \
     pac207.c \
+    pack.c \
+    pack-simd.c \
     rgbyuv.c \
+    rgbyuv-simd.c \
+    scale.c \
+    scale-simd.c \
     se401.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
@@ -26,11 +40,13 @@ LOCAL_SRC_FILES := \
     spca561-decompress.c \
     sq905c.c \
     stv0680.c \
+    threads.c \
     tinyjpeg.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
     processing/gamma.c \
     processing/libv4lprocessing.c  \
+    processing/stats-simd.c \
     processing/whitebalance.c \
 
 LOCAL_CFLAGS += -Wno-missing-field-initializers
@@ -0,0 +1,647 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels for the bayer demosaic code in bayer.c
+ *
+ * The demosaic kernels handle the pixel pairs in the middle of a line, see
+ * bayer_line_to_rgbbgr24() and bayer_line_to_y(). They get a pointer to the
+ * line above the line being rendered, with the first pixel of a pair being
+ * a red or blue pixel at bayer[stride + 1] and the second one a green pixel
+ * at bayer[stride + 2]. All kernels produce results which are bit-exact with
+ * the C code, do as many pairs as fit in whole SIMD blocks and return the
+ * number of pairs done.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/* The neighbourhood of 8 pixel pairs, as 16 bit values */
+struct bayer_pairs_sse2 {
+	__m128i c;	/* center of the first pixel */
+	__m128i cross;	/* sum of its 4 horizontal + vertical neighbours */
+	__m128i diag;	/* sum of its 4 diagonal neighbours */
+	__m128i g;	/* the second (green) pixel */
+	__m128i h;	/* its left + right neighbour */
+	__m128i v;	/* its top + bottom neighbour */
+};
+
+static inline SSE2 __m128i bayer_select_sse2(__m128i mask, __m128i a,
+		__m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline SSE2 void bayer_load_sse2(const unsigned char *bayer,
+		unsigned int stride, int edge_aware, struct bayer_pairs_sse2 *p)
+{
+	const __m128i lo8 = _mm_set1_epi16(0x00ff);
+	__m128i a0 = _mm_loadu_si128((const __m128i *)bayer);
+	__m128i b0 = _mm_loadu_si128((const __m128i *)(bayer + 2));
+	__m128i a1 = _mm_loadu_si128((const __m128i *)(bayer + stride));
+	__m128i b1 = _mm_loadu_si128((const __m128i *)(bayer + stride + 2));
+	__m128i a2 = _mm_loadu_si128((const __m128i *)(bayer + 2 * stride));
+	__m128i b2 = _mm_loadu_si128((const __m128i *)(bayer + 2 * stride + 2));
+	__m128i e0 = _mm_and_si128(a0, lo8), e0n = _mm_and_si128(b0, lo8);
+	__m128i e1 = _mm_and_si128(a1, lo8), e1n = _mm_and_si128(b1, lo8);
+	__m128i e2 = _mm_and_si128(a2, lo8), e2n = _mm_and_si128(b2, lo8);
+	__m128i o0 = _mm_srli_epi16(a0, 8), o2 = _mm_srli_epi16(a2, 8);
+	__m128i ch = _mm_add_epi16(e1, e1n), cv = _mm_add_epi16(o0, o2);
+
+	p->c = _mm_srli_epi16(a1, 8);
+	p->cross = _mm_add_epi16(ch, cv);
+	p->diag = _mm_add_epi16(_mm_add_epi16(e0, e0n), _mm_add_epi16(e2, e2n));
+	p->g = e1n;
+	p->h = _mm_add_epi16(p->c, _mm_srli_epi16(b1, 8));
+	p->v = _mm_add_epi16(e0n, e2n);
+
+	if (edge_aware) {
+		/* Interpolate green along the edge, if there is one */
+		__m128i dh = _mm_sub_epi16(_mm_max_epi16(e1, e1n), _mm_min_epi16(e1, e1n));
+		__m128i dv = _mm_sub_epi16(_mm_max_epi16(o0, o2), _mm_min_epi16(o0, o2));
+		__m128i horiz = _mm_cmpgt_epi16(dv, dh);
+		__m128i vert = _mm_cmpgt_epi16(dh, dv);
+
+		p->cross = bayer_select_sse2(horiz, _mm_add_epi16(ch, ch), p->cross);
+		p->cross = bayer_select_sse2(vert, _mm_add_epi16(cv, cv), p->cross);
+	}
+}
+
+/* Combine the values for the first and the second pixels of 8 pairs */
+static inline SSE2 __m128i bayer_pack_pairs_sse2(__m128i first, __m128i second)
+{
+	return _mm_or_si128(first, _mm_slli_epi16(second, 8));
+}
+
+static inline SSE2 void bayer_rgb_sse2(const struct bayer_pairs_sse2 *p,
+		int blue_line, __m128i *c0, __m128i *c1, __m128i *c2)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i two = _mm_set1_epi16(2);
+	__m128i t0, t1, t0v, t1h;
+
+	t0 = _mm_srli_epi16(_mm_add_epi16(p->diag, two), 2);
+	t1 = _mm_srli_epi16(_mm_add_epi16(p->cross, two), 2);
+	t0v = _mm_srli_epi16(_mm_add_epi16(p->v, one), 1);
+	t1h = _mm_srli_epi16(_mm_add_epi16(p->h, one), 1);
+
+	*c1 = bayer_pack_pairs_sse2(t1, p->g);
+	if (blue_line) {
+		*c0 = bayer_pack_pairs_sse2(t0, t0v);
+		*c2 = bayer_pack_pairs_sse2(p->c, t1h);
+	} else {
+		*c0 = bayer_pack_pairs_sse2(p->c, t1h);
+		*c2 = bayer_pack_pairs_sse2(t0, t0v);
+	}
+}
+
+static SSE2 int bayer_to_rgb24_row_sse2(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware, int ssse3)
+{
+	int j;
+
+	for (j = 0; j + 8 <= pairs; j += 8) {
+		struct bayer_pairs_sse2 p;
+		__m128i c0, c1, c2;
+
+		bayer_load_sse2(bayer, stride, edge_aware, &p);
+		bayer_rgb_sse2(&p, blue_line, &c0, &c1, &c2);
+		if (ssse3)
+			store_rgb24_ssse3(dest, c0, c1, c2);
+		else
+			store_rgb24_sse2(dest, c0, c1, c2);
+		bayer += 16;
+		dest += 48;
+	}
+
+	return j;
+}
+
+static SSSE3 int bayer_to_rgb24_row_ssse3(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+	return bayer_to_rgb24_row_sse2(bayer, stride, dest, pairs, blue_line,
+				       edge_aware, 1);
+}
+
+/* (k0 * a + k1 * b + k2 * c + 524288) >> 15 for 8 16 bit values */
+static inline SSE2 __m128i bayer_y_sum_sse2(__m128i a, __m128i b, __m128i c,
+		int k0, int k1, int k2)
+{
+	const __m128i kab = _mm_set1_epi32((k1 << 16) | k0);
+	const __m128i kc = _mm_set1_epi32((16384 << 16) | k2);
+	const __m128i c32 = _mm_set1_epi16(32);
+	__m128i lo, hi;
+
+	/* The rounding constant is added as 32 * 16384 */
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), kab),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(c, c32), kc));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), kab),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(c, c32), kc));
+
+	return _mm_packs_epi32(_mm_srli_epi32(lo, 15), _mm_srli_epi32(hi, 15));
+}
+
+static SSE2 int bayer_to_y_row_sse2(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+	int j;
+
+	for (j = 0; j + 8 <= pairs; j += 8) {
+		struct bayer_pairs_sse2 p;
+		__m128i y0, y1;
+
+		bayer_load_sse2(bayer, stride, edge_aware, &p);
+		if (blue_line) {
+			y0 = bayer_y_sum_sse2(p.c, p.cross, p.diag, 8453, 4148, 806);
+			y1 = bayer_y_sum_sse2(p.h, p.g, p.v, 4226, 16594, 1611);
+		} else {
+			y0 = bayer_y_sum_sse2(p.diag, p.cross, p.c, 2113, 4148, 3223);
+			y1 = bayer_y_sum_sse2(p.v, p.g, p.h, 4226, 16594, 1611);
+		}
+		_mm_storeu_si128((__m128i *)dest, bayer_pack_pairs_sse2(y0, y1));
+		bayer += 16;
+		dest += 16;
+	}
+
+	return j;
+}
+
+/* AVX2 versions, these work on 16 pairs, 8 per 128 bit lane */
+struct bayer_pairs_avx2 {
+	__m256i c, cross, diag, g, h, v;
+};
+
+static inline AVX2 __m256i bayer_select_avx2(__m256i mask, __m256i a,
+		__m256i b)
+{
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+static inline AVX2 void bayer_load_avx2(const unsigned char *bayer,
+		unsigned int stride, int edge_aware, struct bayer_pairs_avx2 *p)
+{
+	const __m256i lo8 = _mm256_set1_epi16(0x00ff);
+	__m256i a0 = _mm256_loadu_si256((const __m256i *)bayer);
+	__m256i b0 = _mm256_loadu_si256((const __m256i *)(bayer + 2));
+	__m256i a1 = _mm256_loadu_si256((const __m256i *)(bayer + stride));
+	__m256i b1 = _mm256_loadu_si256((const __m256i *)(bayer + stride + 2));
+	__m256i a2 = _mm256_loadu_si256((const __m256i *)(bayer + 2 * stride));
+	__m256i b2 = _mm256_loadu_si256((const __m256i *)(bayer + 2 * stride + 2));
+	__m256i e0 = _mm256_and_si256(a0, lo8), e0n = _mm256_and_si256(b0, lo8);
+	__m256i e1 = _mm256_and_si256(a1, lo8), e1n = _mm256_and_si256(b1, lo8);
+	__m256i e2 = _mm256_and_si256(a2, lo8), e2n = _mm256_and_si256(b2, lo8);
+	__m256i o0 = _mm256_srli_epi16(a0, 8), o2 = _mm256_srli_epi16(a2, 8);
+	__m256i ch = _mm256_add_epi16(e1, e1n), cv = _mm256_add_epi16(o0, o2);
+
+	p->c = _mm256_srli_epi16(a1, 8);
+	p->cross = _mm256_add_epi16(ch, cv);
+	p->diag = _mm256_add_epi16(_mm256_add_epi16(e0, e0n), _mm256_add_epi16(e2, e2n));
+	p->g = e1n;
+	p->h = _mm256_add_epi16(p->c, _mm256_srli_epi16(b1, 8));
+	p->v = _mm256_add_epi16(e0n, e2n);
+
+	if (edge_aware) {
+		__m256i dh = _mm256_abs_epi16(_mm256_sub_epi16(e1, e1n));
+		__m256i dv = _mm256_abs_epi16(_mm256_sub_epi16(o0, o2));
+		__m256i horiz = _mm256_cmpgt_epi16(dv, dh);
+		__m256i vert = _mm256_cmpgt_epi16(dh, dv);
+
+		p->cross = bayer_select_avx2(horiz, _mm256_add_epi16(ch, ch), p->cross);
+		p->cross = bayer_select_avx2(vert, _mm256_add_epi16(cv, cv), p->cross);
+	}
+}
+
+static inline AVX2 __m256i bayer_pack_pairs_avx2(__m256i first, __m256i second)
+{
+	return _mm256_or_si256(first, _mm256_slli_epi16(second, 8));
+}
+
+static AVX2 int bayer_to_rgb24_row_avx2(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i two = _mm256_set1_epi16(2);
+	int j;
+
+	for (j = 0; j + 16 <= pairs; j += 16) {
+		struct bayer_pairs_avx2 p;
+		__m256i t0, t1, t0v, t1h, c0, c1, c2;
+
+		bayer_load_avx2(bayer, stride, edge_aware, &p);
+		t0 = _mm256_srli_epi16(_mm256_add_epi16(p.diag, two), 2);
+		t1 = _mm256_srli_epi16(_mm256_add_epi16(p.cross, two), 2);
+		t0v = _mm256_srli_epi16(_mm256_add_epi16(p.v, one), 1);
+		t1h = _mm256_srli_epi16(_mm256_add_epi16(p.h, one), 1);
+
+		c1 = bayer_pack_pairs_avx2(t1, p.g);
+		if (blue_line) {
+			c0 = bayer_pack_pairs_avx2(t0, t0v);
+			c2 = bayer_pack_pairs_avx2(p.c, t1h);
+		} else {
+			c0 = bayer_pack_pairs_avx2(p.c, t1h);
+			c2 = bayer_pack_pairs_avx2(t0, t0v);
+		}
+
+		/* Each lane holds 16 consecutive pixels */
+		store_rgb24_ssse3(dest, _mm256_castsi256_si128(c0),
+				  _mm256_castsi256_si128(c1),
+				  _mm256_castsi256_si128(c2));
+		store_rgb24_ssse3(dest + 48, _mm256_extracti128_si256(c0, 1),
+				  _mm256_extracti128_si256(c1, 1),
+				  _mm256_extracti128_si256(c2, 1));
+		bayer += 32;
+		dest += 96;
+	}
+
+	return j;
+}
+
+/* 16 bit to 8 bit samples, for 10, 12 and 16 bit bayer data */
+static SSE2 int bayer16_to_bayer8_row_sse2(const uint16_t *src,
+		unsigned char *dest, int width, int shift)
+{
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	const __m128i lo8 = _mm_set1_epi16(0x00ff);
+	int j;
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 8));
+
+		/* Mask instead of saturating, like the C code does */
+		a = _mm_and_si128(_mm_srl_epi16(a, count), lo8);
+		b = _mm_and_si128(_mm_srl_epi16(b, count), lo8);
+		_mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(a, b));
+		src += 16;
+		dest += 16;
+	}
+
+	return j;
+}
+
+static AVX2 int bayer16_to_bayer8_row_avx2(const uint16_t *src,
+		unsigned char *dest, int width, int shift)
+{
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	const __m256i lo8 = _mm256_set1_epi16(0x00ff);
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)src);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + 16));
+
+		a = _mm256_and_si256(_mm256_srl_epi16(a, count), lo8);
+		b = _mm256_and_si256(_mm256_srl_epi16(b, count), lo8);
+		_mm256_storeu_si256((__m256i *)dest,
+			_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+		src += 32;
+		dest += 32;
+	}
+
+	return j;
+}
+
+/* 10 bit packed (MIPI RAW10) to 8 bit samples: every 5 bytes hold the 8 msb
+   of 4 pixels followed by their 2 lsb, which get dropped */
+static SSSE3 int raw10_to_8_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m128i lo = _mm_setr_epi8(0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, -1, -1, -1, -1);
+	const __m128i hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11, 12, 13, 14);
+	int j;
+
+	/* 16 pixels from 20 bytes, without reading past them */
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 4));
+
+		_mm_storeu_si128((__m128i *)dest, _mm_or_si128(
+			_mm_shuffle_epi8(a, lo), _mm_shuffle_epi8(b, hi)));
+		src += 20;
+		dest += 16;
+	}
+
+	return j;
+}
+
+static AVX2 int raw10_to_8_row_avx2(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m256i lo = _mm256_setr_epi8(0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, -1, -1, -1, -1,
+					    0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, -1, -1, -1, -1);
+	const __m256i hi = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11, 12, 13, 14,
+					    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11, 12, 13, 14);
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)src)),
+				_mm_loadu_si128((const __m128i *)(src + 20)), 1);
+		__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)(src + 4))),
+				_mm_loadu_si128((const __m128i *)(src + 24)), 1);
+
+		_mm256_storeu_si256((__m256i *)dest, _mm256_or_si256(
+			_mm256_shuffle_epi8(a, lo), _mm256_shuffle_epi8(b, hi)));
+		src += 40;
+		dest += 32;
+	}
+
+	return j;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+/* The neighbourhood of 16 pixel pairs, the sums as 16 bit values */
+struct bayer_pairs_neon {
+	uint8x16_t c, g, top, bottom, left, right;
+	uint16x8_t cross[2], diag[2];
+};
+
+static inline void bayer_load_neon(const unsigned char *bayer,
+		unsigned int stride, int edge_aware, struct bayer_pairs_neon *p)
+{
+	uint8x16x2_t a0 = vld2q_u8(bayer);
+	uint8x16x2_t b0 = vld2q_u8(bayer + 2);
+	uint8x16x2_t a1 = vld2q_u8(bayer + stride);
+	uint8x16x2_t b1 = vld2q_u8(bayer + stride + 2);
+	uint8x16x2_t a2 = vld2q_u8(bayer + 2 * stride);
+	uint8x16x2_t b2 = vld2q_u8(bayer + 2 * stride + 2);
+	uint16x8_t ch[2], cv[2];
+	int i;
+
+	p->c = a1.val[1];
+	p->g = b1.val[0];
+	p->top = b0.val[0];
+	p->bottom = b2.val[0];
+	p->left = a1.val[1];
+	p->right = b1.val[1];
+
+	ch[0] = vaddl_u8(vget_low_u8(a1.val[0]), vget_low_u8(b1.val[0]));
+	ch[1] = vaddl_u8(vget_high_u8(a1.val[0]), vget_high_u8(b1.val[0]));
+	cv[0] = vaddl_u8(vget_low_u8(a0.val[1]), vget_low_u8(a2.val[1]));
+	cv[1] = vaddl_u8(vget_high_u8(a0.val[1]), vget_high_u8(a2.val[1]));
+	p->diag[0] = vaddq_u16(vaddl_u8(vget_low_u8(a0.val[0]), vget_low_u8(b0.val[0])),
+			       vaddl_u8(vget_low_u8(a2.val[0]), vget_low_u8(b2.val[0])));
+	p->diag[1] = vaddq_u16(vaddl_u8(vget_high_u8(a0.val[0]), vget_high_u8(b0.val[0])),
+			       vaddl_u8(vget_high_u8(a2.val[0]), vget_high_u8(b2.val[0])));
+
+	for (i = 0; i < 2; i++)
+		p->cross[i] = vaddq_u16(ch[i], cv[i]);
+
+	if (edge_aware) {
+		uint8x16_t dh = vabdq_u8(a1.val[0], b1.val[0]);
+		uint8x16_t dv = vabdq_u8(a0.val[1], a2.val[1]);
+		uint8x16_t horiz = vcltq_u8(dh, dv);
+		uint8x16_t vert = vcltq_u8(dv, dh);
+		uint16x8_t mh[2], mv[2];
+
+		mh[0] = vmovl_u8(vget_low_u8(horiz));
+		mh[1] = vmovl_u8(vget_high_u8(horiz));
+		mv[0] = vmovl_u8(vget_low_u8(vert));
+		mv[1] = vmovl_u8(vget_high_u8(vert));
+		for (i = 0; i < 2; i++) {
+			/* Widen the 0xff masks to 0xffff */
+			mh[i] = vorrq_u16(mh[i], vshlq_n_u16(mh[i], 8));
+			mv[i] = vorrq_u16(mv[i], vshlq_n_u16(mv[i], 8));
+			p->cross[i] = vbslq_u16(mh[i], vshlq_n_u16(ch[i], 1), p->cross[i]);
+			p->cross[i] = vbslq_u16(mv[i], vshlq_n_u16(cv[i], 1), p->cross[i]);
+		}
+	}
+}
+
+static int bayer_to_rgb24_row_neon(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+	int j;
+
+	for (j = 0; j + 16 <= pairs; j += 16) {
+		struct bayer_pairs_neon p;
+		uint8x16_t t0, t1, t0v, t1h;
+		uint8x16x2_t c0, c1, c2;
+		uint8x16x3_t rgb;
+
+		bayer_load_neon(bayer, stride, edge_aware, &p);
+		/* Rounding shifts / halving adds, just like the C code */
+		t0 = vcombine_u8(vrshrn_n_u16(p.diag[0], 2), vrshrn_n_u16(p.diag[1], 2));
+		t1 = vcombine_u8(vrshrn_n_u16(p.cross[0], 2), vrshrn_n_u16(p.cross[1], 2));
+		t0v = vrhaddq_u8(p.top, p.bottom);
+		t1h = vrhaddq_u8(p.left, p.right);
+
+		c1 = vzipq_u8(t1, p.g);
+		if (blue_line) {
+			c0 = vzipq_u8(t0, t0v);
+			c2 = vzipq_u8(p.c, t1h);
+		} else {
+			c0 = vzipq_u8(p.c, t1h);
+			c2 = vzipq_u8(t0, t0v);
+		}
+
+		rgb.val[0] = c0.val[0];
+		rgb.val[1] = c1.val[0];
+		rgb.val[2] = c2.val[0];
+		vst3q_u8(dest, rgb);
+		rgb.val[0] = c0.val[1];
+		rgb.val[1] = c1.val[1];
+		rgb.val[2] = c2.val[1];
+		vst3q_u8(dest + 48, rgb);
+		bayer += 32;
+		dest += 96;
+	}
+
+	return j;
+}
+
+/* (k0 * a + k1 * b + k2 * c + 524288) >> 15 for 8 16 bit values */
+static inline uint8x8_t bayer_y_sum_neon(uint16x8_t a, uint16x8_t b,
+		uint16x8_t c, int k0, int k1, int k2)
+{
+	uint32x4_t lo, hi;
+
+	lo = vmlal_n_u16(vdupq_n_u32(524288), vget_low_u16(a), k0);
+	lo = vmlal_n_u16(lo, vget_low_u16(b), k1);
+	lo = vmlal_n_u16(lo, vget_low_u16(c), k2);
+	hi = vmlal_n_u16(vdupq_n_u32(524288), vget_high_u16(a), k0);
+	hi = vmlal_n_u16(hi, vget_high_u16(b), k1);
+	hi = vmlal_n_u16(hi, vget_high_u16(c), k2);
+
+	return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 15), vshrn_n_u32(hi, 15)));
+}
+
+static int bayer_to_y_row_neon(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+	int i, j;
+
+	for (j = 0; j + 16 <= pairs; j += 16) {
+		struct bayer_pairs_neon p;
+		uint16x8_t c[2], g[2], h[2], v[2];
+		uint8x8_t y0[2], y1[2];
+		uint8x16x2_t y;
+
+		bayer_load_neon(bayer, stride, edge_aware, &p);
+		c[0] = vmovl_u8(vget_low_u8(p.c));
+		c[1] = vmovl_u8(vget_high_u8(p.c));
+		g[0] = vmovl_u8(vget_low_u8(p.g));
+		g[1] = vmovl_u8(vget_high_u8(p.g));
+		h[0] = vaddl_u8(vget_low_u8(p.left), vget_low_u8(p.right));
+		h[1] = vaddl_u8(vget_high_u8(p.left), vget_high_u8(p.right));
+		v[0] = vaddl_u8(vget_low_u8(p.top), vget_low_u8(p.bottom));
+		v[1] = vaddl_u8(vget_high_u8(p.top), vget_high_u8(p.bottom));
+
+		for (i = 0; i < 2; i++) {
+			if (blue_line) {
+				y0[i] = bayer_y_sum_neon(c[i], p.cross[i], p.diag[i], 8453, 4148, 806);
+				y1[i] = bayer_y_sum_neon(h[i], g[i], v[i], 4226, 16594, 1611);
+			} else {
+				y0[i] = bayer_y_sum_neon(p.diag[i], p.cross[i], c[i], 2113, 4148, 3223);
+				y1[i] = bayer_y_sum_neon(v[i], g[i], h[i], 4226, 16594, 1611);
+			}
+		}
+
+		y.val[0] = vcombine_u8(y0[0], y0[1]);
+		y.val[1] = vcombine_u8(y1[0], y1[1]);
+		vst2q_u8(dest, y);
+		bayer += 32;
+		dest += 32;
+	}
+
+	return j;
+}
+
+static int bayer16_to_bayer8_row_neon(const uint16_t *src,
+		unsigned char *dest, int width, int shift)
+{
+	const int16x8_t count = vdupq_n_s16(-shift);
+	int j;
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		uint16x8_t a = vshlq_u16(vld1q_u16(src), count);
+		uint16x8_t b = vshlq_u16(vld1q_u16(src + 8), count);
+
+		vst1q_u8(dest, vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+		src += 16;
+		dest += 16;
+	}
+
+	return j;
+}
+
+static int raw10_to_8_row_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	static const uint8_t idx[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+	const uint8x8_t tbl = vld1_u8(idx);
+	int j;
+
+	/* 8 pixels from each 10 bytes, the loads read 6 bytes more, so stop
+	   8 pixels early */
+	for (j = 0; j + 24 <= width; j += 16) {
+		uint8x8x2_t a = { { vld1_u8(src), vld1_u8(src + 8) } };
+		uint8x8x2_t b = { { vld1_u8(src + 10), vld1_u8(src + 18) } };
+
+		vst1q_u8(dest, vcombine_u8(vtbl2_u8(a, tbl), vtbl2_u8(b, tbl)));
+		src += 20;
+		dest += 16;
+	}
+
+	return j;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_bayer_to_rgb24_row(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return bayer_to_rgb24_row_avx2(bayer, stride, dest, pairs,
+					       blue_line, edge_aware);
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return bayer_to_rgb24_row_ssse3(bayer, stride, dest, pairs,
+						blue_line, edge_aware);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return bayer_to_rgb24_row_sse2(bayer, stride, dest, pairs,
+					       blue_line, edge_aware, 0);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return bayer_to_rgb24_row_neon(bayer, stride, dest, pairs,
+					       blue_line, edge_aware);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_bayer_to_y_row(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return bayer_to_y_row_sse2(bayer, stride, dest, pairs,
+					   blue_line, edge_aware);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return bayer_to_y_row_neon(bayer, stride, dest, pairs,
+					   blue_line, edge_aware);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_bayer16_to_bayer8_row(const uint16_t *src,
+		unsigned char *dest, int width, int shift)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return bayer16_to_bayer8_row_avx2(src, dest, width, shift);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return bayer16_to_bayer8_row_sse2(src, dest, width, shift);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return bayer16_to_bayer8_row_neon(src, dest, width, shift);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_raw10_to_8_row(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return raw10_to_8_row_avx2(src, dest, width);
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return raw10_to_8_row_ssse3(src, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return raw10_to_8_row_neon(src, dest, width);
+#endif
+	return 0;
+}
@@ -29,6 +29,7 @@
  * see bayer.c from libdc1394 for all supported algorithms
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
@@ -162,172 +163,224 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer_to_rgbbgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
-		int start_with_green, int blue_line)
+
+/* Sum of the 4 green neighbours of the red or blue pixel at bayer[stride + 1].
+   In edge aware mode, when the pixel is on a horizontal or vertical edge only
+   the 2 neighbours along the edge are used (and counted twice), so that green
+   does not get interpolated across the edge. */
+static inline int bayer_green_sum(const unsigned char *bayer,
+		const unsigned int stride, int edge_aware)
 {
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
-
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
-
-			t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
-			/* Write first pixel */
-			t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride];
-			} else {
-				*bgr++ = bayer[stride];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-
-			/* Write second pixel */
-			t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-			} else {
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t0;
-			}
-			bayer++;
+	int h = bayer[stride] + bayer[stride + 2];
+	int v = bayer[1] + bayer[stride * 2 + 1];
+
+	if (edge_aware) {
+		int dh = abs(bayer[stride] - bayer[stride + 2]);
+		int dv = abs(bayer[1] - bayer[stride * 2 + 1]);
+
+		if (dh < dv)
+			return 2 * h;
+		if (dv < dh)
+			return 2 * v;
+	}
+
+	return h + v;
+}
+
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding.
+   Renders the line below the one bayer points to, which must not be the
+   first or last line of the frame. */
+static void bayer_line_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int width, const unsigned int stride,
+		int start_with_green, int blue_line, int edge_aware)
+{
+	int t0, t1, pairs;
+	/* (width - 2) because of the border */
+	const unsigned char *bayer_end = bayer + (width - 2);
+
+	if (start_with_green) {
+
+		t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
+		/* Write first pixel */
+		t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride];
 		} else {
-			/* Write first pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride];
-				*bgr++ = t0;
-			}
+			*bgr++ = bayer[stride];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
 
+		/* Write second pixel */
+		t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
 		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t1;
-			}
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
 		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t0;
 		}
+		bayer++;
+	} else {
+		/* Write first pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride];
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = bayer[stride];
+			*bgr++ = t0;
+		}
+	}
 
-		if (bayer < bayer_end) {
-			/* write second to last pixel */
+	pairs = (bayer_end - bayer) / 2;
+	if (pairs > 0) {
+		pairs = v4lconvert_simd_bayer_to_rgb24_row(bayer, stride, bgr,
+				pairs, blue_line, edge_aware);
+		bayer += 2 * pairs;
+		bgr += 6 * pairs;
+	}
+
+	if (blue_line) {
+		for (; bayer <= bayer_end - 2; bayer += 2) {
 			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
 				bayer[stride * 2 + 2] + 2) >> 2;
-			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-				bayer[stride * 2 + 1] + 2) >> 2;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-			/* write last pixel */
+			t1 = (bayer_green_sum(bayer, stride, edge_aware) + 2) >> 2;
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+
 			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t1;
+		}
+	} else {
+		for (; bayer <= bayer_end - 2; bayer += 2) {
+			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+				bayer[stride * 2 + 2] + 2) >> 2;
+			t1 = (bayer_green_sum(bayer, stride, edge_aware) + 2) >> 2;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
 
-			bayer++;
+			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+			t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+	}
 
+	if (bayer < bayer_end) {
+		/* write second to last pixel */
+		t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+			bayer[stride * 2 + 2] + 2) >> 2;
+		t1 = (bayer_green_sum(bayer, stride, edge_aware) + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
 		} else {
-			/* write last pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
+		/* write last pixel */
+		t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+	} else {
+		/* write last pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+	}
+}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
-
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+/* Render lines first till last of the frame, bayer points to line first of
+   the bayer data and bgr to the start of the destination frame.
+   start_with_green and blue_line are for the first line of the frame, only
+   the lines directly above and below the rendered lines are accessed. */
+static void bayer_lines_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		int start_with_green, int blue_line, int edge_aware,
+		int first, int last)
+{
+	int y;
+
+	bgr += first * width * 3;
+	for (y = first; y < last; y++) {
+		int odd = y & 1;
+
+		if (y == 0)
+			v4lconvert_border_bayer_line_to_bgr24(bayer,
+					bayer + stride, bgr, width,
+					start_with_green, blue_line);
+		else if (y == height - 1)
+			v4lconvert_border_bayer_line_to_bgr24(bayer,
+					bayer - stride, bgr, width,
+					start_with_green ^ odd, blue_line ^ odd);
+		else
+			bayer_line_to_rgbbgr24(bayer - stride, bgr, width,
+					stride, !(start_with_green ^ odd),
+					!(blue_line ^ odd), edge_aware);
+		bayer += stride;
+		bgr += width * 3;
 	}
+}
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+/* Does the first line of the frame start with a green pixel */
+static int bayer_start_with_green(unsigned int pixfmt)
+{
+	return pixfmt == V4L2_PIX_FMT_SGBRG8 || pixfmt == V4L2_PIX_FMT_SGRBG8;
+}
+
+/* Is the first line of the frame a blue / green line */
+static int bayer_blue_line(unsigned int pixfmt)
+{
+	return pixfmt == V4L2_PIX_FMT_SBGGR8 || pixfmt == V4L2_PIX_FMT_SGBRG8;
 }
 
 void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int edge_aware)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+	/* For rgb24 the blue and red lines swap roles */
+	bayer_lines_to_rgbbgr24(bayer, bgr, width, height, stride,
+			bayer_start_with_green(pixfmt), !bayer_blue_line(pixfmt),
+			edge_aware, 0, height);
 }
 
 void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int edge_aware)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
+	bayer_lines_to_rgbbgr24(bayer, bgr, width, height, stride,
+			bayer_start_with_green(pixfmt), bayer_blue_line(pixfmt),
+			edge_aware, 0, height);
 }
 
 static void v4lconvert_border_bayer_line_to_y(
@@ -429,245 +482,363 @@ static void v4lconvert_border_bayer_line_to_y(
 	}
 }
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+/* Renders the Y values of the line below the one bayer points to, which must
+   not be the first or last line of the frame */
+static void bayer_line_to_y(const unsigned char *bayer, unsigned char *ydst,
+		int width, const unsigned int stride, int start_with_green,
+		int blue_line, int edge_aware)
 {
-	int blue_line = 0, start_with_green = 0, x, y;
-	unsigned char *ydst = yuv;
-	unsigned char *udst, *vdst;
+	int t0, t1, pairs;
+	/* (width - 2) because of the border */
+	const unsigned char *bayer_end = bayer + (width - 2);
 
-	if (yvu) {
-		vdst = yuv + width * height;
-		udst = vdst + width * height / 4;
+	if (start_with_green) {
+		t0 = bayer[1] + bayer[stride * 2 + 1];
+		/* Write first pixel */
+		t1 = bayer[0] + bayer[stride * 2] + bayer[stride + 1];
+		if (blue_line)
+			*ydst++ = (8453 * bayer[stride] + 5516 * t1 +
+					1661 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 5516 * t1 +
+					3223 * bayer[stride] + 524288) >> 15;
+
+		/* Write second pixel */
+		t1 = bayer[stride] + bayer[stride + 2];
+		if (blue_line)
+			*ydst++ = (4226 * t1 + 16594 * bayer[stride + 1] +
+					1611 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride + 1] +
+					1611 * t1 + 524288) >> 15;
+		bayer++;
 	} else {
-		udst = yuv + width * height;
-		vdst = udst + width * height / 4;
+		/* Write first pixel */
+		t0 = bayer[0] + bayer[stride * 2];
+		if (blue_line) {
+			*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride] +
+					1661 * t0 + 524288) >> 15;
+		} else {
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride] +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+		}
 	}
 
-	/* First calculate the u and v planes 2x2 pixels at a time */
-	switch (src_pixfmt) {
-	case V4L2_PIX_FMT_SBGGR8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				b  = bayer[x];
-				g  = bayer[x + 1];
-				g += bayer[x + stride];
-				r  = bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
-		}
-		blue_line = 1;
-		break;
+	pairs = (bayer_end - bayer) / 2;
+	if (pairs > 0) {
+		pairs = v4lconvert_simd_bayer_to_y_row(bayer, stride, ydst,
+				pairs, blue_line, edge_aware);
+		bayer += 2 * pairs;
+		ydst += 2 * pairs;
+	}
 
-	case V4L2_PIX_FMT_SRGGB8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				r  = bayer[x];
-				g  = bayer[x + 1];
-				g += bayer[x + stride];
-				b  = bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
-		}
-		break;
+	if (blue_line) {
+		for (; bayer <= bayer_end - 2; bayer += 2) {
+			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
+			t1 = bayer_green_sum(bayer, stride, edge_aware);
+			*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
+					806 * t0 + 524288) >> 15;
 
-	case V4L2_PIX_FMT_SGBRG8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				g  = bayer[x];
-				b  = bayer[x + 1];
-				r  = bayer[x + stride];
-				g += bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
+			t0 = bayer[2] + bayer[stride * 2 + 2];
+			t1 = bayer[stride + 1] + bayer[stride + 3];
+			*ydst++ = (4226 * t1 + 16594 * bayer[stride + 2] +
+					1611 * t0 + 524288) >> 15;
 		}
-		blue_line = 1;
-		start_with_green = 1;
-		break;
+	} else {
+		for (; bayer <= bayer_end - 2; bayer += 2) {
+			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
+			t1 = bayer_green_sum(bayer, stride, edge_aware);
+			*ydst++ = (2113 * t0 + 4148 * t1 +
+					3223 * bayer[stride + 1] + 524288) >> 15;
 
-	case V4L2_PIX_FMT_SGRBG8:
-		for (y = 0; y < height; y += 2) {
-			for (x = 0; x < width; x += 2) {
-				int b, g, r;
-
-				g  = bayer[x];
-				r  = bayer[x + 1];
-				b  = bayer[x + stride];
-				g += bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
-			}
-			bayer += 2 * stride;
+			t0 = bayer[2] + bayer[stride * 2 + 2];
+			t1 = bayer[stride + 1] + bayer[stride + 3];
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
+					1611 * t1 + 524288) >> 15;
 		}
-		start_with_green = 1;
-		break;
 	}
 
-	/* Point bayer back to start of frame */
-	bayer -= stride * height;
-
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_y(bayer, bayer + stride, ydst, width,
-			start_with_green, blue_line);
-	ydst += width;
-
-	/* reduce height by 2 because of the border */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
-			t0 = bayer[1] + bayer[stride * 2 + 1];
-			/* Write first pixel */
-			t1 = bayer[0] + bayer[stride * 2] + bayer[stride + 1];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride] + 5516 * t1 +
-						1661 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 5516 * t1 +
-						3223 * bayer[stride] + 524288) >> 15;
-
-			/* Write second pixel */
-			t1 = bayer[stride] + bayer[stride + 2];
-			if (blue_line)
-				*ydst++ = (4226 * t1 + 16594 * bayer[stride + 1] +
-						1611 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 1] +
-						1611 * t1 + 524288) >> 15;
-			bayer++;
-		} else {
-			/* Write first pixel */
-			t0 = bayer[0] + bayer[stride * 2];
-			if (blue_line) {
-				*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride] +
-						1661 * t0 + 524288) >> 15;
-			} else {
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride] +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-			}
-		}
+	if (bayer < bayer_end) {
+		/* Write second to last pixel */
+		t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
+		t1 = bayer_green_sum(bayer, stride, edge_aware);
+		if (blue_line)
+			*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
+					806 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (2113 * t0 + 4148 * t1 +
+					3223 * bayer[stride + 1] + 524288) >> 15;
 
+		/* write last pixel */
+		t0 = bayer[2] + bayer[stride * 2 + 2];
 		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-				t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-				*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
-						806 * t0 + 524288) >> 15;
-
-				t0 = bayer[2] + bayer[stride * 2 + 2];
-				t1 = bayer[stride + 1] + bayer[stride + 3];
-				*ydst++ = (4226 * t1 + 16594 * bayer[stride + 2] +
-						1611 * t0 + 524288) >> 15;
-			}
+			*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride + 2] +
+					1661 * t0 + 524288) >> 15;
 		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-				t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-				*ydst++ = (2113 * t0 + 4148 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-
-				t0 = bayer[2] + bayer[stride * 2 + 2];
-				t1 = bayer[stride + 1] + bayer[stride + 3];
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
-						1611 * t1 + 524288) >> 15;
-			}
+			*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
+					3223 * bayer[stride + 1] + 524288) >> 15;
 		}
+	} else {
+		/* write last pixel */
+		t0 = bayer[0] + bayer[stride * 2];
+		t1 = bayer[1] + bayer[stride * 2 + 1] + bayer[stride];
+		if (blue_line)
+			*ydst++ = (8453 * bayer[stride + 1] + 5516 * t1 +
+					1661 * t0 + 524288) >> 15;
+		else
+			*ydst++ = (4226 * t0 + 5516 * t1 +
+					3223 * bayer[stride + 1] + 524288) >> 15;
+	}
+}
 
-		if (bayer < bayer_end) {
-			/* Write second to last pixel */
-			t0 = bayer[0] + bayer[2] + bayer[stride * 2] + bayer[stride * 2 + 2];
-			t1 = bayer[1] + bayer[stride] + bayer[stride + 2] + bayer[stride * 2 + 1];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride + 1] + 4148 * t1 +
-						806 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (2113 * t0 + 4148 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-
-			/* write last pixel */
-			t0 = bayer[2] + bayer[stride * 2 + 2];
-			if (blue_line) {
-				*ydst++ = (8453 * bayer[stride + 1] + 16594 * bayer[stride + 2] +
-						1661 * t0 + 524288) >> 15;
-			} else {
-				*ydst++ = (4226 * t0 + 16594 * bayer[stride + 2] +
-						3223 * bayer[stride + 1] + 524288) >> 15;
-			}
-			bayer++;
-		} else {
-			/* write last pixel */
-			t0 = bayer[0] + bayer[stride * 2];
-			t1 = bayer[1] + bayer[stride * 2 + 1] + bayer[stride];
-			if (blue_line)
-				*ydst++ = (8453 * bayer[stride + 1] + 5516 * t1 +
-						1661 * t0 + 524288) >> 15;
-			else
-				*ydst++ = (4226 * t0 + 5516 * t1 +
-						3223 * bayer[stride + 1] + 524288) >> 15;
+/* Calculate the u and v values for lines / 2 lines, 2x2 pixels at a time */
+static void bayer_lines_to_uv(const unsigned char *bayer, unsigned char *udst,
+		unsigned char *vdst, int width, int lines, const unsigned int stride,
+		unsigned int src_pixfmt)
+{
+	/* Offsets of the pixels of each color in a 2x2 block */
+	int r_off, g0_off, g1_off, b_off;
+	int x, y;
+
+	switch (src_pixfmt) {
+	case V4L2_PIX_FMT_SBGGR8:
+		b_off = 0;
+		g0_off = 1;
+		g1_off = stride;
+		r_off = stride + 1;
+		break;
+	case V4L2_PIX_FMT_SRGGB8:
+		r_off = 0;
+		g0_off = 1;
+		g1_off = stride;
+		b_off = stride + 1;
+		break;
+	case V4L2_PIX_FMT_SGBRG8:
+		g0_off = 0;
+		b_off = 1;
+		r_off = stride;
+		g1_off = stride + 1;
+		break;
+	default: /* V4L2_PIX_FMT_SGRBG8 */
+		g0_off = 0;
+		r_off = 1;
+		b_off = stride;
+		g1_off = stride + 1;
+		break;
+	}
+
+	for (y = 0; y < lines; y += 2) {
+		for (x = 0; x < width; x += 2) {
+			int b, g, r;
+
+			b  = bayer[x + b_off];
+			g  = bayer[x + g0_off];
+			g += bayer[x + g1_off];
+			r  = bayer[x + r_off];
+			*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
+			*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
 		}
+		bayer += 2 * stride;
+	}
+}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+/* Like bayer_lines_to_rgbbgr24, but to yuv420 / yvu420, first must be even */
+static void bayer_lines_to_yuv420(const unsigned char *bayer,
+		unsigned char *yuv, int width, int height, const unsigned int stride,
+		unsigned int src_pixfmt, int yvu, int edge_aware, int first, int last)
+{
+	int start_with_green = bayer_start_with_green(src_pixfmt);
+	int blue_line = bayer_blue_line(src_pixfmt);
+	unsigned char *ydst = yuv + first * width;
+	unsigned char *udst, *vdst;
+	int y;
 
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+	if (yvu) {
+		vdst = yuv + width * height;
+		udst = vdst + width * height / 4;
+	} else {
+		udst = yuv + width * height;
+		vdst = udst + width * height / 4;
+	}
+	udst += first / 2 * width / 2;
+	vdst += first / 2 * width / 2;
+
+	bayer_lines_to_uv(bayer, udst, vdst, width, last - first, stride,
+			  src_pixfmt);
+
+	for (y = first; y < last; y++) {
+		int odd = y & 1;
+
+		if (y == 0)
+			v4lconvert_border_bayer_line_to_y(bayer, bayer + stride,
+					ydst, width, start_with_green, blue_line);
+		else if (y == height - 1)
+			v4lconvert_border_bayer_line_to_y(bayer, bayer - stride,
+					ydst, width, start_with_green ^ odd,
+					blue_line ^ odd);
+		else
+			bayer_line_to_y(bayer - stride, ydst, width, stride,
+					!(start_with_green ^ odd),
+					!(blue_line ^ odd), edge_aware);
+		bayer += stride;
+		ydst += width;
 	}
+}
+
+void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt,
+		int yvu, int edge_aware)
+{
+	bayer_lines_to_yuv420(bayer, yuv, width, height, stride, src_pixfmt,
+			      yvu, edge_aware, 0, height);
+}
+
+void v4lconvert_raw10_line_to_8bit(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int i;
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_y(bayer + stride, bayer, ydst, width,
-			!start_with_green, !blue_line);
+	/* 4 pixels in 5 bytes, the 5th byte holds the 2 lsb of each pixel */
+	i = v4lconvert_simd_raw10_to_8_row(src, dest, width);
+	src += i / 4 * 5;
+	for (; i + 4 <= width; i += 4) {
+		dest[i] = src[0];
+		dest[i + 1] = src[1];
+		dest[i + 2] = src[2];
+		dest[i + 3] = src[3];
+		src += 5;
+	}
+	for (; i < width; i++)
+		dest[i] = *src++;
 }
 
-void v4lconvert_bayer10_to_bayer8(void *bayer10,
-		unsigned char *bayer8, int width, int height)
+/* Unpack a line of 10 bit packed, 10, 12 or 16 bit bayer data to 8 bit */
+static void bayer_deep_line_to_bayer8(const unsigned char *src,
+		unsigned char *dest, int width, int shift)
 {
+	const uint16_t *src16 = (const uint16_t *)src;
 	int i;
-	uint16_t *src = bayer10;
 
-	for (i = 0; i < width * height; i++)
-		bayer8[i] = src[i] >> 2;
+	if (!shift) {
+		v4lconvert_raw10_line_to_8bit(src, dest, width);
+		return;
+	}
+
+	i = v4lconvert_simd_bayer16_to_bayer8_row(src16, dest, width, shift);
+	for (; i < width; i++)
+		dest[i] = src16[i] >> shift;
 }
 
-void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
-		unsigned char *bayer8, int width, int height)
+/* The 8 bit format for a deep bayer format, the bits to shift its samples
+   right by (0 for the 10 bit packed formats) and the length of a line */
+static unsigned int bayer_deep_layout(unsigned int pixfmt, int width,
+		int *shift, int *line_size)
 {
-	unsigned long i;
-	unsigned long len = width * height;
-
-	for (i = 0; i < len ; i += 4) {
-		/*
-		 * Do not use a second loop, hoping that
-		 * a clever compiler with understand the
-		 * pattern and will optimize it.
-		 */
-		bayer8[0] = bayer10p[0];
-		bayer8[1] = bayer10p[1];
-		bayer8[2] = bayer10p[2];
-		bayer8[3] = bayer10p[3];
-		bayer10p += 5;
-		bayer8 += 4;
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		*shift = 0;
+		*line_size = (width * 10 + 7) / 8;
+		break;
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+		*shift = 2;
+		*line_size = width * 2;
+		break;
+	case V4L2_PIX_FMT_SBGGR12:
+	case V4L2_PIX_FMT_SGBRG12:
+	case V4L2_PIX_FMT_SGRBG12:
+	case V4L2_PIX_FMT_SRGGB12:
+		*shift = 4;
+		*line_size = width * 2;
+		break;
+	default: /* 16 bit */
+		*shift = 8;
+		*line_size = width * 2;
+		break;
+	}
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SBGGR12:
+	case V4L2_PIX_FMT_SBGGR16:
+		return V4L2_PIX_FMT_SBGGR8;
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGBRG12:
+	case V4L2_PIX_FMT_SGBRG16:
+		return V4L2_PIX_FMT_SGBRG8;
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SGRBG12:
+	case V4L2_PIX_FMT_SGRBG16:
+		return V4L2_PIX_FMT_SGRBG8;
+	default:
+		return V4L2_PIX_FMT_SRGGB8;
 	}
 }
 
-void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
-		unsigned char *bayer8, int width, int height)
+int v4lconvert_bayer_deep_line_size(unsigned int pixfmt, int width)
 {
-	int i;
+	int shift, line_size;
+
+	bayer_deep_layout(pixfmt, width, &shift, &line_size);
 
-	for (i = 0; i < width * height; i++)
-		bayer8[i] = bayer16[2*i+1];
+	return line_size;
+}
+
+/* Demosaic 10 bit packed, 10, 12 or 16 bit bayer data. Instead of first
+   converting the whole frame to 8 bit, the frame is done in bands of
+   V4LCONVERT_BAYER_BAND_LINES lines, which get unpacked (together with the
+   line above and below them) into scratch while still hot in the cache. */
+void v4lconvert_bayer_deep_convert(const unsigned char *src,
+		unsigned char *scratch, unsigned char *dest, int width,
+		int height, const unsigned int stride, unsigned int src_pixfmt,
+		unsigned int dest_pixfmt, int edge_aware)
+{
+	unsigned int pixfmt8;
+	int shift, line_size, first, last, y, y0, y1;
+
+	pixfmt8 = bayer_deep_layout(src_pixfmt, width, &shift, &line_size);
+
+	for (first = 0; first < height; first = last) {
+		last = first + V4LCONVERT_BAYER_BAND_LINES;
+		if (last > height)
+			last = height;
+
+		y0 = first ? first - 1 : 0;
+		y1 = last < height ? last + 1 : height;
+		for (y = y0; y < y1; y++)
+			bayer_deep_line_to_bayer8(src + y * stride,
+					scratch + (y - y0) * width, width, shift);
+
+		switch (dest_pixfmt) {
+		case V4L2_PIX_FMT_RGB24:
+			bayer_lines_to_rgbbgr24(scratch + (first - y0) * width,
+					dest, width, height, width,
+					bayer_start_with_green(pixfmt8),
+					!bayer_blue_line(pixfmt8),
+					edge_aware, first, last);
+			break;
+		case V4L2_PIX_FMT_BGR24:
+			bayer_lines_to_rgbbgr24(scratch + (first - y0) * width,
+					dest, width, height, width,
+					bayer_start_with_green(pixfmt8),
+					bayer_blue_line(pixfmt8),
+					edge_aware, first, last);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			bayer_lines_to_yuv420(scratch + (first - y0) * width,
+					dest, width, height, width, pixfmt8,
+					dest_pixfmt == V4L2_PIX_FMT_YVU420,
+					edge_aware, first, last);
+			break;
+		}
+	}
 }
@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * MSB first bitstream reader shared by the vendor specific decompressors
+ * (sn9c10x.c, sn9c2028-decomp.c, pac207.c, mr97310a.c).
+ *
+ * The next bits of the stream are kept left aligned in a 64 bit buffer,
+ * which is refilled with a single unaligned 8 byte load, so a refill
+ * provides at least 56 bits. Reads past the end of the input return zero
+ * bits instead of touching memory beyond it.
+ */
+
+#ifndef __LIBV4LCONVERT_BITSTREAM_H
+#define __LIBV4LCONVERT_BITSTREAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+struct v4lconvert_bits {
+	const unsigned char *start;
+	size_t size;
+	/* offset of the first byte not yet loaded into buf */
+	size_t offset;
+	/* the next count bits of the stream, starting at bit 63 */
+	uint64_t buf;
+	unsigned int count;
+};
+
+static inline void v4lconvert_bits_init(struct v4lconvert_bits *bits,
+		const unsigned char *start, size_t size)
+{
+	bits->start = start;
+	bits->size = size;
+	bits->offset = 0;
+	bits->buf = 0;
+	bits->count = 0;
+}
+
+static inline uint64_t v4lconvert_bits_load_be64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/* Make sure at least 56 bits are available */
+static inline void v4lconvert_bits_refill(struct v4lconvert_bits *bits)
+{
+	if (bits->count > 56)
+		return;
+
+	if (bits->offset + 8 <= bits->size) {
+		/*
+		 * Bits below count that were already loaded are loaded
+		 * again with the same value, so they can simply be or-ed.
+		 */
+		bits->buf |= v4lconvert_bits_load_be64(bits->start +
+				bits->offset) >> bits->count;
+		bits->offset += (63 - bits->count) >> 3;
+		bits->count |= 56;
+		return;
+	}
+
+	/* Near the end of the input, pad with zero bytes */
+	while (bits->count <= 56) {
+		if (bits->offset < bits->size)
+			bits->buf |= (uint64_t)bits->start[bits->offset] <<
+				     (56 - bits->count);
+		bits->offset++;
+		bits->count += 8;
+	}
+}
+
+/* Refill if fewer than n bits are available, n must be <= 56 */
+static inline void v4lconvert_bits_need(struct v4lconvert_bits *bits,
+		unsigned int n)
+{
+	if (bits->count < n)
+		v4lconvert_bits_refill(bits);
+}
+
+/* Return the next n (1 - 32) bits without consuming them */
+static inline unsigned int v4lconvert_bits_peek(const struct v4lconvert_bits *bits,
+		unsigned int n)
+{
+	return bits->buf >> (64 - n);
+}
+
+static inline void v4lconvert_bits_skip(struct v4lconvert_bits *bits,
+		unsigned int n)
+{
+	bits->buf <<= n;
+	bits->count -= n;
+}
+
+static inline unsigned int v4lconvert_bits_get(struct v4lconvert_bits *bits,
+		unsigned int n)
+{
+	unsigned int v;
+
+	v4lconvert_bits_need(bits, n);
+	v = v4lconvert_bits_peek(bits, n);
+	v4lconvert_bits_skip(bits, n);
+	return v;
+}
+
+/* The number of bits consumed since v4lconvert_bits_init() */
+static inline size_t v4lconvert_bits_pos(const struct v4lconvert_bits *bits)
+{
+	return bits->offset * 8 - bits->count;
+}
+
+#endif
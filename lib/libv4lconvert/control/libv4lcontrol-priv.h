@@ -22,6 +22,14 @@
 #ifndef __LIBV4LCONTROL_PRIV_H
 #define __LIBV4LCONTROL_PRIV_H
 
+#include <pthread.h>
+#include <stdint.h>
+#include "../libv4lsyscall-priv.h"
+#if defined(__OpenBSD__)
+#include <sys/videoio.h>
+#else
+#include <linux/videodev2.h>
+#endif
 #include "libv4l-plugin.h"
 
 #define V4LCONTROL_SHM_SIZE 4096
@@ -31,6 +39,16 @@
 
 struct v4lcontrol_flags_info;
 
+/* Cached state of a control the application subscribed to V4L2_EVENT_CTRL
+   for, see the comment above v4lcontrol_cache_events_pending() */
+struct v4lcontrol_cache_entry {
+	uint32_t id;
+	int have_query;
+	int have_value;
+	struct v4l2_queryctrl query;
+	int32_t value;
+};
+
 struct v4lcontrol_data {
 	int fd;                   /* Device fd */
 	int bandwidth;            /* Connection bandwidth (0 = unknown) */
@@ -42,6 +60,12 @@ struct v4lcontrol_data {
 	const struct v4lcontrol_flags_info *flags_info;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
+	/* control cache */
+	pthread_mutex_t cache_lock;
+	struct v4lcontrol_cache_entry *cache;
+	int cache_count;
+	int cache_alloc;
+	unsigned int cache_gen;   /* bumped on every invalidation */
 };
 
 struct v4lcontrol_flags_info {
@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <pwd.h>
+#include <poll.h>
 #include "libv4lcontrol.h"
 #include "libv4lcontrol-priv.h"
 #include "../libv4lsyscall-priv.h"
@@ -589,6 +590,7 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 	data->fd = fd;
 	data->dev_ops = dev_ops;
 	data->dev_ops_priv = dev_ops_priv;
+	pthread_mutex_init(&data->cache_lock, NULL);
 
 	/* Check if the driver has indicated some form of flipping is needed */
 	if ((data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
@@ -775,6 +777,7 @@ struct v4lcontrol_data *v4lcontrol_create(int fd, void *dev_ops_priv,
 	return data;
 
 error:
+	pthread_mutex_destroy(&data->cache_lock);
 	free(data);
 	return NULL;
 }
@@ -787,6 +790,8 @@ void v4lcontrol_destroy(struct v4lcontrol_data *data)
 		else
 			munmap(data->shm_values, V4LCONTROL_SHM_SIZE);
 	}
+	pthread_mutex_destroy(&data->cache_lock);
+	free(data->cache);
 	free(data);
 }
 
@@ -864,12 +869,235 @@ static void v4lcontrol_copy_queryctrl(struct v4lcontrol_data *data,
 		ctrl->default_value = data->flags_info->default_gamma;
 }
 
+/*
+ * Control cache
+ *
+ * Every VIDIOC_QUERYCTRL / VIDIOC_G_CTRL is a USB control transfer on UVC
+ * devices, and control panels re-read all controls on every refresh. So we
+ * cache the VIDIOC_QUERYCTRL result and the value of the controls for which
+ * the application has subscribed to V4L2_EVENT_CTRL: the kernel reports
+ * every change of such a control (its value, flags or range) made through
+ * another fd or by the driver itself with an event, and dequeuing that event
+ * drops our copy. Events which have not been dequeued yet are detected by
+ * polling for POLLPRI, and the cache is not used while there are any.
+ *
+ * Changes made through our own fd are not reported back to us, and setting
+ * one control of a cluster may change the others, so setting any control
+ * drops the whole cache. Values of volatile, write only and non 32 bit
+ * controls are never cached.
+ */
+
+static int v4lcontrol_cache_events_pending(struct v4lcontrol_data *data)
+{
+	/* Only ask for POLLPRI, asking for POLLIN may start read() emulation */
+	struct pollfd pfd = { .fd = data->fd, .events = POLLPRI };
+
+	return poll(&pfd, 1, 0) != 0;
+}
+
+/* Must be called with the cache_lock held */
+static struct v4lcontrol_cache_entry *v4lcontrol_cache_find(
+		struct v4lcontrol_data *data, uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < data->cache_count; i++)
+		if (data->cache[i].id == id)
+			return &data->cache[i];
+
+	return NULL;
+}
+
+/* Drop entry, or all entries when entry is NULL. Must be called with the
+   cache_lock held */
+static void v4lcontrol_cache_invalidate(struct v4lcontrol_data *data,
+		struct v4lcontrol_cache_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < data->cache_count; i++)
+		if (!entry || entry == &data->cache[i]) {
+			data->cache[i].have_query = 0;
+			data->cache[i].have_value = 0;
+		}
+	data->cache_gen++;
+}
+
+static int v4lcontrol_cache_value_ok(const struct v4l2_queryctrl *query)
+{
+	if (query->flags & (V4L2_CTRL_FLAG_VOLATILE | V4L2_CTRL_FLAG_WRITE_ONLY))
+		return 0;
+
+	switch (query->type) {
+	case V4L2_CTRL_TYPE_INTEGER:
+	case V4L2_CTRL_TYPE_BOOLEAN:
+	case V4L2_CTRL_TYPE_MENU:
+	case V4L2_CTRL_TYPE_INTEGER_MENU:
+	case V4L2_CTRL_TYPE_BITMASK:
+		return 1;
+	}
+	return 0;
+}
+
+/* Returns 0 and fills in ctrl on a cache hit. gen must be passed to
+   v4lcontrol_cache_put_query() when storing the driver's answer. */
+static int v4lcontrol_cache_get_query(struct v4lcontrol_data *data,
+		struct v4l2_queryctrl *ctrl, unsigned int *gen)
+{
+	struct v4lcontrol_cache_entry *entry;
+	int res = -1;
+
+	pthread_mutex_lock(&data->cache_lock);
+	*gen = data->cache_gen;
+	entry = v4lcontrol_cache_find(data, ctrl->id);
+	if (entry && entry->have_query &&
+			!v4lcontrol_cache_events_pending(data)) {
+		*ctrl = entry->query;
+		res = 0;
+	}
+	pthread_mutex_unlock(&data->cache_lock);
+
+	return res;
+}
+
+/* Store ctrl unless the cache has been invalidated since gen was taken, as
+   ctrl may be older than the invalidation then */
+static void v4lcontrol_cache_put_query(struct v4lcontrol_data *data,
+		const struct v4l2_queryctrl *ctrl, unsigned int gen)
+{
+	struct v4lcontrol_cache_entry *entry;
+
+	pthread_mutex_lock(&data->cache_lock);
+	entry = v4lcontrol_cache_find(data, ctrl->id);
+	if (entry && gen == data->cache_gen) {
+		entry->query = *ctrl;
+		entry->have_query = 1;
+	}
+	pthread_mutex_unlock(&data->cache_lock);
+}
+
+static int v4lcontrol_cache_get_value(struct v4lcontrol_data *data,
+		uint32_t id, int32_t *value, unsigned int *gen)
+{
+	struct v4lcontrol_cache_entry *entry;
+	int res = -1;
+
+	pthread_mutex_lock(&data->cache_lock);
+	*gen = data->cache_gen;
+	entry = v4lcontrol_cache_find(data, id);
+	if (entry && entry->have_value &&
+			!v4lcontrol_cache_events_pending(data)) {
+		*value = entry->value;
+		res = 0;
+	}
+	pthread_mutex_unlock(&data->cache_lock);
+
+	return res;
+}
+
+/* Values are only stored once we know (from the cached query result) that
+   the control is not volatile and has a 32 bit value */
+static void v4lcontrol_cache_put_value(struct v4lcontrol_data *data,
+		uint32_t id, int32_t value, unsigned int gen)
+{
+	struct v4lcontrol_cache_entry *entry;
+
+	pthread_mutex_lock(&data->cache_lock);
+	entry = v4lcontrol_cache_find(data, id);
+	if (entry && gen == data->cache_gen && entry->have_query &&
+			v4lcontrol_cache_value_ok(&entry->query)) {
+		entry->value = value;
+		entry->have_value = 1;
+	}
+	pthread_mutex_unlock(&data->cache_lock);
+}
+
+static int v4lcontrol_is_fake_ctrl(struct v4lcontrol_data *data, uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < V4LCONTROL_COUNT; i++)
+		if ((data->controls & (1 << i)) && id == fake_controls[i].id)
+			return 1;
+
+	return 0;
+}
+
+/* Fill in all non fake controls of ctrls from the cache, only succeeds if
+   all of them are cached */
+static int v4lcontrol_cache_get_ext_values(struct v4lcontrol_data *data,
+		struct v4l2_ext_controls *ctrls, unsigned int *gen)
+{
+	struct v4lcontrol_cache_entry *entry;
+	unsigned int i;
+	int res = -1;
+
+	pthread_mutex_lock(&data->cache_lock);
+	*gen = data->cache_gen;
+	if (data->cache_count == 0 || ctrls->count == 0 ||
+			ctrls->which == V4L2_CTRL_WHICH_DEF_VAL ||
+			ctrls->which == V4L2_CTRL_WHICH_REQUEST_VAL)
+		goto leave;
+
+	for (i = 0; i < ctrls->count; i++) {
+		uint32_t id = ctrls->controls[i].id;
+
+		if (v4lcontrol_is_fake_ctrl(data, id))
+			continue;
+		/* The driver checks the controls belong to the class */
+		if (ctrls->which != V4L2_CTRL_WHICH_CUR_VAL &&
+				V4L2_CTRL_ID2WHICH(id) != ctrls->which)
+			goto leave;
+		entry = v4lcontrol_cache_find(data, id);
+		if (!entry || !entry->have_value)
+			goto leave;
+	}
+	if (v4lcontrol_cache_events_pending(data))
+		goto leave;
+
+	for (i = 0; i < ctrls->count; i++) {
+		entry = v4lcontrol_cache_find(data, ctrls->controls[i].id);
+		if (entry)
+			ctrls->controls[i].value = entry->value;
+	}
+	ctrls->error_idx = ctrls->count;
+	res = 0;
+leave:
+	pthread_mutex_unlock(&data->cache_lock);
+
+	return res;
+}
+
+static void v4lcontrol_cache_put_ext_values(struct v4lcontrol_data *data,
+		const struct v4l2_ext_controls *ctrls, unsigned int gen)
+{
+	unsigned int i;
+
+	if (ctrls->which == V4L2_CTRL_WHICH_DEF_VAL ||
+			ctrls->which == V4L2_CTRL_WHICH_REQUEST_VAL)
+		return;
+
+	for (i = 0; i < ctrls->count; i++)
+		v4lcontrol_cache_put_value(data, ctrls->controls[i].id,
+					   ctrls->controls[i].value, gen);
+}
+
+/* Called after (trying to) set controls */
+static void v4lcontrol_cache_drop(struct v4lcontrol_data *data)
+{
+	pthread_mutex_lock(&data->cache_lock);
+	if (data->cache_count)
+		v4lcontrol_cache_invalidate(data, NULL);
+	pthread_mutex_unlock(&data->cache_lock);
+}
+
 int v4lcontrol_vidioc_queryctrl(struct v4lcontrol_data *data, void *arg)
 {
 	int i;
 	struct v4l2_queryctrl *ctrl = arg;
 	int retval;
 	uint32_t orig_id = ctrl->id;
+	unsigned int gen;
 
 	/* if we have an exact match return it */
 	for (i = 0; i < V4LCONTROL_COUNT; i++)
@@ -879,10 +1107,18 @@ int v4lcontrol_vidioc_queryctrl(struct v4lcontrol_data *data, void *arg)
 			return 0;
 		}
 
+	/* Never hits when enumerating, as no control has the NEXT_CTRL flag */
+	if (v4lcontrol_cache_get_query(data, ctrl, &gen) == 0)
+		return 0;
+
 	/* find out what the kernel driver would respond. */
 	retval = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
 			VIDIOC_QUERYCTRL, arg);
 
+	/* This also fills the cache while enumerating the controls */
+	if (retval == 0)
+		v4lcontrol_cache_put_query(data, ctrl, gen);
+
 	if ((data->priv_flags & V4LCONTROL_SUPPORTS_NEXT_CTRL) &&
 			(orig_id & V4L2_CTRL_FLAG_NEXT_CTRL)) {
 		/* If the hardware has no more controls check if we still have any
@@ -910,6 +1146,8 @@ int v4lcontrol_vidioc_g_ctrl(struct v4lcontrol_data *data, void *arg)
 {
 	int i;
 	struct v4l2_control *ctrl = arg;
+	unsigned int gen;
+	int res;
 
 	for (i = 0; i < V4LCONTROL_COUNT; i++)
 		if ((data->controls & (1 << i)) &&
@@ -918,8 +1156,14 @@ int v4lcontrol_vidioc_g_ctrl(struct v4lcontrol_data *data, void *arg)
 			return 0;
 		}
 
-	return data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+	if (v4lcontrol_cache_get_value(data, ctrl->id, &ctrl->value, &gen) == 0)
+		return 0;
+
+	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
 			VIDIOC_G_CTRL, arg);
+	if (res == 0)
+		v4lcontrol_cache_put_value(data, ctrl->id, ctrl->value, gen);
+	return res;
 }
 
 static void v4lcontrol_alloc_valid_controls(struct v4lcontrol_data *data,
@@ -976,15 +1220,20 @@ int v4lcontrol_vidioc_g_ext_ctrls(struct v4lcontrol_data *data, void *arg)
 {
 	struct v4l2_ext_controls *ctrls = arg;
 	struct v4l2_ext_controls dst;
+	unsigned int gen;
 	int i, j;
 	int res;
 
-	v4lcontrol_alloc_valid_controls(data, ctrls, &dst);
-	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
-			VIDIOC_G_EXT_CTRLS, &dst);
-	v4lcontrol_free_valid_controls(data, ctrls, &dst);
-	if (res)
-		return res;
+	if (v4lcontrol_cache_get_ext_values(data, ctrls, &gen)) {
+		v4lcontrol_alloc_valid_controls(data, ctrls, &dst);
+		res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+				VIDIOC_G_EXT_CTRLS, &dst);
+		v4lcontrol_free_valid_controls(data, ctrls, &dst);
+		if (res)
+			return res;
+
+		v4lcontrol_cache_put_ext_values(data, ctrls, gen);
+	}
 
 	for (i = 0; i < ctrls->count; i++) {
 		for (j = 0; j < V4LCONTROL_COUNT; j++)
@@ -999,7 +1248,7 @@ int v4lcontrol_vidioc_g_ext_ctrls(struct v4lcontrol_data *data, void *arg)
 
 int v4lcontrol_vidioc_s_ctrl(struct v4lcontrol_data *data, void *arg)
 {
-	int i;
+	int i, res;
 	struct v4l2_control *ctrl = arg;
 
 	for (i = 0; i < V4LCONTROL_COUNT; i++)
@@ -1015,8 +1264,10 @@ int v4lcontrol_vidioc_s_ctrl(struct v4lcontrol_data *data, void *arg)
 			return 0;
 		}
 
-	return data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
 			VIDIOC_S_CTRL, arg);
+	v4lcontrol_cache_drop(data);
+	return res;
 }
 
 static int v4lcontrol_validate_ext_ctrls(struct v4lcontrol_data *data,
@@ -1071,6 +1322,7 @@ int v4lcontrol_vidioc_s_ext_ctrls(struct v4lcontrol_data *data, void *arg)
 	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
 			VIDIOC_S_EXT_CTRLS, &dst);
 	v4lcontrol_free_valid_controls(data, ctrls, &dst);
+	v4lcontrol_cache_drop(data);
 	if (res)
 		return res;
 
@@ -1085,6 +1337,88 @@ int v4lcontrol_vidioc_s_ext_ctrls(struct v4lcontrol_data *data, void *arg)
 	return 0;
 }
 
+int v4lcontrol_vidioc_subscribe_event(struct v4lcontrol_data *data, void *arg)
+{
+	struct v4l2_event_subscription *sub = arg;
+	struct v4lcontrol_cache_entry *entry;
+	int res;
+
+	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+			VIDIOC_SUBSCRIBE_EVENT, arg);
+	if (res || sub->type != V4L2_EVENT_CTRL)
+		return res;
+
+	pthread_mutex_lock(&data->cache_lock);
+	if (!v4lcontrol_cache_find(data, sub->id)) {
+		if (data->cache_count == data->cache_alloc) {
+			int alloc = data->cache_alloc ? 2 * data->cache_alloc : 32;
+
+			entry = realloc(data->cache, alloc * sizeof(*entry));
+			/* Not fatal, the control just does not get cached */
+			if (entry) {
+				data->cache = entry;
+				data->cache_alloc = alloc;
+			}
+		}
+		if (data->cache_count < data->cache_alloc) {
+			entry = &data->cache[data->cache_count++];
+			memset(entry, 0, sizeof(*entry));
+			entry->id = sub->id;
+		}
+	}
+	pthread_mutex_unlock(&data->cache_lock);
+
+	return 0;
+}
+
+int v4lcontrol_vidioc_unsubscribe_event(struct v4lcontrol_data *data,
+		void *arg)
+{
+	struct v4l2_event_subscription *sub = arg;
+	struct v4lcontrol_cache_entry *entry;
+	int res;
+
+	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+			VIDIOC_UNSUBSCRIBE_EVENT, arg);
+	if (res)
+		return res;
+
+	pthread_mutex_lock(&data->cache_lock);
+	if (sub->type == V4L2_EVENT_ALL) {
+		data->cache_count = 0;
+		data->cache_gen++;
+	} else if (sub->type == V4L2_EVENT_CTRL) {
+		entry = v4lcontrol_cache_find(data, sub->id);
+		if (entry) {
+			*entry = data->cache[--data->cache_count];
+			data->cache_gen++;
+		}
+	}
+	pthread_mutex_unlock(&data->cache_lock);
+
+	return 0;
+}
+
+int v4lcontrol_vidioc_dqevent(struct v4lcontrol_data *data, void *arg)
+{
+	struct v4l2_event *ev = arg;
+	struct v4lcontrol_cache_entry *entry;
+	int res;
+
+	res = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
+			VIDIOC_DQEVENT, arg);
+	if (res || ev->type != V4L2_EVENT_CTRL)
+		return res;
+
+	pthread_mutex_lock(&data->cache_lock);
+	entry = v4lcontrol_cache_find(data, ev->id);
+	if (entry)
+		v4lcontrol_cache_invalidate(data, entry);
+	pthread_mutex_unlock(&data->cache_lock);
+
+	return 0;
+}
+
 int v4lcontrol_get_bandwidth(struct v4lcontrol_data *data)
 {
 	return data->bandwidth;
@@ -75,5 +75,9 @@ int v4lcontrol_vidioc_s_ctrl(struct v4lcontrol_data *data, void *arg);
 int v4lcontrol_vidioc_g_ext_ctrls(struct v4lcontrol_data *data, void *arg);
 int v4lcontrol_vidioc_try_ext_ctrls(struct v4lcontrol_data *data, void *arg);
 int v4lcontrol_vidioc_s_ext_ctrls(struct v4lcontrol_data *data, void *arg);
+int v4lcontrol_vidioc_subscribe_event(struct v4lcontrol_data *data, void *arg);
+int v4lcontrol_vidioc_unsubscribe_event(struct v4lcontrol_data *data,
+		void *arg);
+int v4lcontrol_vidioc_dqevent(struct v4lcontrol_data *data, void *arg);
 
 #endif
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Runtime CPU feature detection for the SIMD conversion paths.
+ *
+ * The SIMD kernels are built with per-function target attributes, so a
+ * generic build of the library still runs on any CPU of the architecture,
+ * the fastest usable kernel is selected at runtime based on the flags
+ * returned here.
+ */
+
+#include <stdlib.h>
+#include "libv4lconvert-priv.h"
+
+static unsigned int cpu_flags;
+static pthread_once_t cpu_flags_once = PTHREAD_ONCE_INIT;
+
+static void v4lconvert_init_cpu_flags(void)
+{
+	unsigned int flags = 0;
+
+	/* Allow disabling the SIMD paths, f.e. to compare against the C code */
+	if (!getenv("LIBV4LCONVERT_NO_SIMD")) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			flags |= V4LCONVERT_CPU_SSE2;
+		if (__builtin_cpu_supports("ssse3"))
+			flags |= V4LCONVERT_CPU_SSSE3;
+		if (__builtin_cpu_supports("avx2"))
+			flags |= V4LCONVERT_CPU_AVX2;
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+		flags |= V4LCONVERT_CPU_NEON;
+#endif
+	}
+
+	cpu_flags = flags;
+}
+
+unsigned int v4lconvert_get_cpu_flags(void)
+{
+	pthread_once(&cpu_flags_once, v4lconvert_init_cpu_flags);
+	return cpu_flags;
+}
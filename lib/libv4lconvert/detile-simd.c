@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels for detiling in detile.c
+ *
+ * They gather one line from consecutive tiles tile_size bytes apart, for
+ * tile widths which are a multiple of 16 bytes. They do as many whole tiles
+ * as fit in width and return the number of bytes (chroma pairs for the uv
+ * kernels) done, the C code does the remainder.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+static SSE2 int detile_row_sse2(const unsigned char *src, int tile_size,
+		unsigned char *dest, int width, int tile_width)
+{
+	int x, i;
+
+	for (x = 0; x + tile_width <= width; x += tile_width) {
+		for (i = 0; i < tile_width; i += 16)
+			_mm_storeu_si128((__m128i *)(dest + x + i),
+				_mm_loadu_si128((const __m128i *)(src + i)));
+		src += tile_size;
+	}
+
+	return x;
+}
+
+static AVX2 int detile_row_avx2(const unsigned char *src, int tile_size,
+		unsigned char *dest, int width, int tile_width)
+{
+	int x, i;
+
+	for (x = 0; x + tile_width <= width; x += tile_width) {
+		for (i = 0; i < tile_width; i += 32)
+			_mm256_storeu_si256((__m256i *)(dest + x + i),
+				_mm256_loadu_si256((const __m256i *)(src + i)));
+		src += tile_size;
+	}
+
+	return x;
+}
+
+static SSE2 int detile_uv_row_sse2(const unsigned char *src, int tile_size,
+		unsigned char *udest, unsigned char *vdest, int width,
+		int tile_width)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	const __m128i zero = _mm_setzero_si128();
+	int pairs = tile_width / 2;
+	int x, i;
+
+	for (x = 0; x + pairs <= width; x += pairs) {
+		for (i = 0; i < tile_width; i += 16) {
+			__m128i uv = _mm_loadu_si128((const __m128i *)(src + i));
+
+			_mm_storel_epi64((__m128i *)(udest + x + i / 2),
+				_mm_packus_epi16(_mm_and_si128(uv, mask), zero));
+			_mm_storel_epi64((__m128i *)(vdest + x + i / 2),
+				_mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+		}
+		src += tile_size;
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+static int detile_row_neon(const unsigned char *src, int tile_size,
+		unsigned char *dest, int width, int tile_width)
+{
+	int x, i;
+
+	for (x = 0; x + tile_width <= width; x += tile_width) {
+		for (i = 0; i < tile_width; i += 16)
+			vst1q_u8(dest + x + i, vld1q_u8(src + i));
+		src += tile_size;
+	}
+
+	return x;
+}
+
+static int detile_uv_row_neon(const unsigned char *src, int tile_size,
+		unsigned char *udest, unsigned char *vdest, int width,
+		int tile_width)
+{
+	int pairs = tile_width / 2;
+	int x, i;
+
+	for (x = 0; x + pairs <= width; x += pairs) {
+		for (i = 0; i < tile_width; i += 16) {
+			uint8x8x2_t uv = vld2_u8(src + i);
+
+			vst1_u8(udest + x + i / 2, uv.val[0]);
+			vst1_u8(vdest + x + i / 2, uv.val[1]);
+		}
+		src += tile_size;
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_detile_row(const unsigned char *src, int tile_size,
+		unsigned char *dest, int width, int tile_width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+	if (tile_width % 16)
+		return 0;
+
+#ifdef V4LCONVERT_SIMD_X86
+	if ((flags & V4LCONVERT_CPU_AVX2) && !(tile_width % 32))
+		return detile_row_avx2(src, tile_size, dest, width, tile_width);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return detile_row_sse2(src, tile_size, dest, width, tile_width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return detile_row_neon(src, tile_size, dest, width, tile_width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_detile_uv_row(const unsigned char *src, int tile_size,
+		unsigned char *udest, unsigned char *vdest, int width,
+		int tile_width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+	if (tile_width % 16)
+		return 0;
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return detile_uv_row_sse2(src, tile_size, udest, vdest, width,
+					  tile_width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return detile_uv_row_neon(src, tile_size, udest, vdest, width,
+					  tile_width);
+#endif
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Detiling of tiled semi planar Y'CbCr 4:2:0 formats
+ *
+ * Both planes of these formats consist of tiles of tile_width bytes by
+ * tile_height lines, with the lines of a tile stored consecutively and the
+ * tiles in raster order. A row of tiles takes stride * tile_height bytes.
+ *
+ * Detiling walks the destination line by line, copying tile_width bytes from
+ * each tile of the current row of tiles. The source lines of a row of tiles
+ * stay in the cache while walking it, so this reads and writes memory
+ * sequentially. The SIMD kernels in detile-simd.c move whole tile lines.
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+/* Detile a plane of width x height bytes into lines of width bytes */
+static void v4lconvert_detile_plane(const unsigned char *src,
+		unsigned char *dest, int width, int height,
+		const struct v4lconvert_tiling *t)
+{
+	int tile_size = t->tile_width * t->tile_height;
+	int y, x;
+
+	for (y = 0; y < height; y++) {
+		const unsigned char *s = src + (y / t->tile_height) * t->stride *
+					 t->tile_height +
+					 (y % t->tile_height) * t->tile_width;
+
+		x = v4lconvert_simd_detile_row(s, tile_size, dest, width,
+					       t->tile_width);
+		for (s += (x / t->tile_width) * tile_size; x < width;
+		     s += tile_size) {
+			int n = width - x < t->tile_width ?
+				width - x : t->tile_width;
+
+			memcpy(dest + x, s, n);
+			x += n;
+		}
+		dest += width;
+	}
+}
+
+/* Detile a plane of width interleaved chroma pairs x height lines into
+   separate U and V planes */
+static void v4lconvert_detile_uv_plane(const unsigned char *src,
+		unsigned char *udest, unsigned char *vdest, int width,
+		int height, const struct v4lconvert_tiling *t)
+{
+	int tile_size = t->tile_width * t->tile_height;
+	int pairs = t->tile_width / 2;
+	int y, x, i;
+
+	for (y = 0; y < height; y++) {
+		const unsigned char *s = src + (y / t->tile_height) * t->stride *
+					 t->tile_height +
+					 (y % t->tile_height) * t->tile_width;
+
+		x = v4lconvert_simd_detile_uv_row(s, tile_size, udest, vdest,
+						  width, t->tile_width);
+		for (s += (x / pairs) * tile_size; x < width; s += tile_size)
+			for (i = 0; i < pairs && x < width; i++, x++) {
+				udest[x] = s[2 * i];
+				vdest[x] = s[2 * i + 1];
+			}
+		udest += width;
+		vdest += width;
+	}
+}
+
+void v4lconvert_tiled_nv12_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height,
+		const struct v4lconvert_tiling *t, int uv_offset, int yvu)
+{
+	unsigned char *udest = dest + width * height;
+	unsigned char *vdest = udest + width * height / 4;
+
+	v4lconvert_detile_plane(src, dest, width, height, t);
+	if (yvu)
+		v4lconvert_detile_uv_plane(src + uv_offset, vdest, udest,
+					   width / 2, height / 2, t);
+	else
+		v4lconvert_detile_uv_plane(src + uv_offset, udest, vdest,
+					   width / 2, height / 2, t);
+}
+
+int v4lconvert_nv12_32l32_to_yuv420(const unsigned char *src, int src_size,
+		unsigned char *dest, int width, int height, int stride, int yvu)
+{
+	static const int tile = 32;
+	const struct v4lconvert_tiling t = { tile, tile, stride };
+	int uv_offset = stride * ((height + tile - 1) / tile * tile);
+	int uv_size = stride * ((height / 2 + tile - 1) / tile * tile);
+
+	if (stride < width || stride % tile || src_size < uv_offset + uv_size)
+		return -1;
+
+	v4lconvert_tiled_nv12_to_yuv420(src, dest, width, height, &t,
+					uv_offset, yvu);
+	return 0;
+}
@@ -0,0 +1,435 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Headless EGL / OpenGL ES 3 conversion backend, which renders the frames
+ * into an offscreen framebuffer with the fragment shader qvidcap uses to
+ * display them (v4l2-convert.glsl).
+ *
+ * This is only used when the LIBV4LCONVERT_EGL environment variable is set.
+ * The results are close to, but not the same as, those of the software
+ * conversion. When EGL can not be set up, or for formats the shader does
+ * not handle, libv4lconvert does the conversion in software.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+#include "libv4lconvert-priv.h"
+#include "v4l2-convert-defines.h"
+
+static const char *v4l2_convert_glsl =
+#include "v4l2-convert.h"
+;
+
+static const char *vertex_shader =
+	"#version 300 es\n"
+	"layout(location = 0) in vec2 position;\n"
+	"layout(location = 1) in vec2 texCoord;\n"
+	"out vec2 vs_TexCoord;\n"
+	"void main() {\n"
+	"	gl_Position = vec4(position, 0.0, 1.0);\n"
+	"	vs_TexCoord = texCoord;\n"
+	"}\n";
+
+/* Texture coordinate 0, 0 (the first line of the frame) is drawn at the
+   bottom, which is where glReadPixels() starts reading */
+static const GLfloat quad_pos[] = { -1, -1,  1, -1,  1, 1,  -1, 1 };
+static const GLfloat quad_tex[] = {  0,  0,  1,  0,  1, 1,   0, 1 };
+
+struct v4lconvert_egl_cfg {
+	unsigned int pixfmt;
+	unsigned int width;
+	unsigned int height;
+	unsigned int ycbcr_enc;
+	unsigned int quantization;
+};
+
+struct v4lconvert_egl {
+	int initialized;
+	int failed;
+	EGLDisplay display;
+	EGLContext context;
+	GLuint program;
+	GLuint tex[3];
+	GLuint fbo;
+	GLuint rbo;
+	struct v4lconvert_egl_cfg cfg;
+	struct v4lconvert_egl_cfg failed_cfg;
+	unsigned char *rgba;
+	int rgba_size;
+};
+
+static EGLDisplay egl_get_display(void)
+{
+	const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+	PFNEGLQUERYDEVICESEXTPROC query_devices;
+	EGLDeviceEXT device;
+	EGLint n;
+
+	get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+		eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (!exts || !get_platform_display)
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (strstr(exts, "EGL_MESA_platform_surfaceless"))
+		return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+					    EGL_DEFAULT_DISPLAY, NULL);
+
+	query_devices = (PFNEGLQUERYDEVICESEXTPROC)
+		eglGetProcAddress("eglQueryDevicesEXT");
+	if (strstr(exts, "EGL_EXT_platform_device") && query_devices &&
+	    query_devices(1, &device, &n) && n == 1)
+		return get_platform_display(EGL_PLATFORM_DEVICE_EXT, device,
+					    NULL);
+
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static int egl_init(struct v4lconvert_egl *egl)
+{
+	static const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+		EGL_NONE
+	};
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 3,
+		EGL_NONE
+	};
+	const char *exts;
+	EGLConfig config = NULL;
+	EGLint n;
+
+	egl->display = egl_get_display();
+	if (egl->display == EGL_NO_DISPLAY ||
+	    !eglInitialize(egl->display, NULL, NULL))
+		return -1;
+
+	exts = eglQueryString(egl->display, EGL_EXTENSIONS);
+	if (!exts || !strstr(exts, "EGL_KHR_surfaceless_context") ||
+	    !eglBindAPI(EGL_OPENGL_ES_API))
+		goto error;
+
+	if (!strstr(exts, "EGL_KHR_no_config_context") &&
+	    (!eglChooseConfig(egl->display, config_attribs, &config, 1, &n) ||
+	     n != 1))
+		goto error;
+
+	egl->context = eglCreateContext(egl->display, config, EGL_NO_CONTEXT,
+					context_attribs);
+	if (egl->context == EGL_NO_CONTEXT)
+		goto error;
+
+	if (!eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			    egl->context))
+		goto error_destroy_context;
+
+	glGenTextures(3, egl->tex);
+	glGenFramebuffers(1, &egl->fbo);
+	glGenRenderbuffers(1, &egl->rbo);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, quad_pos);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, quad_tex);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	return 0;
+
+error_destroy_context:
+	eglDestroyContext(egl->display, egl->context);
+error:
+	eglTerminate(egl->display);
+	return -1;
+}
+
+static GLuint egl_compile_shader(GLenum type, const char *src)
+{
+	GLuint shader = glCreateShader(type);
+	GLint ok;
+
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+/* Build the shader program for cfg, the result is 0 on success */
+static int egl_build_program(struct v4lconvert_egl *egl,
+		const struct v4lconvert_egl_cfg *cfg)
+{
+	static const char *samplers[] = { "ytex", "uvtex", "utex", "vtex" };
+	GLuint vs, fs, program;
+	char *src, *p;
+	size_t size;
+	GLint ok;
+	int i;
+
+	size = 1024 + strlen(v4l2_convert_glsl);
+#define V4L2_CONVERT_DEFINE(c) size += sizeof("#define " #c " 4294967295u\n");
+	V4L2_CONVERT_DEFINES
+#undef V4L2_CONVERT_DEFINE
+	src = p = malloc(size);
+	if (!src)
+		return -1;
+
+	p += sprintf(p,
+		"#version 300 es\n"
+		"precision highp float;\n"
+		"const float tex_w = %u.0;\n"
+		"const float tex_h = %u.0;\n"
+		"#define FIELD %uu\n"
+		"#define IS_RGB 0\n"
+		"#define IS_HSV 0\n"
+		"#define HSVENC 0u\n"
+		"#define PIXFMT %uu\n"
+		"#define COLSP 0u\n"
+		"#define XFERFUNC 0u\n"
+		"#define YCBCRENC %uu\n"
+		"#define QUANT %uu\n"
+		"#define KEEP_COLORSPACE 1\n",
+		cfg->width, cfg->height, V4L2_FIELD_NONE, cfg->pixfmt,
+		cfg->ycbcr_enc, cfg->quantization);
+#define V4L2_CONVERT_DEFINE(c) p += sprintf(p, "#define " #c " %uu\n", (unsigned int)(c));
+	V4L2_CONVERT_DEFINES
+#undef V4L2_CONVERT_DEFINE
+	strcpy(p, "#line 1\n");
+	strcat(p, v4l2_convert_glsl);
+
+	vs = egl_compile_shader(GL_VERTEX_SHADER, vertex_shader);
+	fs = egl_compile_shader(GL_FRAGMENT_SHADER, src);
+	free(src);
+	if (!vs || !fs) {
+		glDeleteShader(vs);
+		glDeleteShader(fs);
+		return -1;
+	}
+
+	program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glLinkProgram(program);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		glDeleteProgram(program);
+		return -1;
+	}
+
+	if (egl->program)
+		glDeleteProgram(egl->program);
+	egl->program = program;
+	glUseProgram(program);
+
+	/* ytex (or tex for packed formats) uses texture unit 0 */
+	glUniform1i(glGetUniformLocation(program, "tex"), 0);
+	for (i = 0; i < ARRAY_SIZE(samplers); i++)
+		glUniform1i(glGetUniformLocation(program, samplers[i]),
+			    i < 2 ? i : i - 1);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, egl->rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, cfg->width,
+			      cfg->height);
+	glBindFramebuffer(GL_FRAMEBUFFER, egl->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				  GL_RENDERBUFFER, egl->rbo);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+	    GL_FRAMEBUFFER_COMPLETE)
+		return -1;
+
+	glViewport(0, 0, cfg->width, cfg->height);
+	egl->cfg = *cfg;
+
+	return 0;
+}
+
+static void egl_upload(GLuint tex, int unit, GLenum internal, GLenum format,
+		int width, int height, int row_length, const unsigned char *data)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format,
+		     GL_UNSIGNED_BYTE, data);
+}
+
+/* Upload the frame into the textures the shader samples, returns the size
+   of the frame, or 0 if the shader does not handle the format */
+static int egl_upload_frame(struct v4lconvert_egl *egl,
+		const unsigned char *src, const struct v4l2_format *fmt)
+{
+	unsigned int width = fmt->fmt.pix.width;
+	unsigned int height = fmt->fmt.pix.height;
+	unsigned int bpl = fmt->fmt.pix.bytesperline;
+	const unsigned char *usrc, *vsrc;
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		/* One RGBA texel per pixel pair */
+		if (bpl % 4)
+			return 0;
+		egl_upload(egl->tex[0], 0, GL_RGBA8, GL_RGBA, width / 2,
+			   height, bpl / 4, src);
+		return bpl * height;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		egl_upload(egl->tex[0], 0, GL_R8, GL_RED, width, height, bpl,
+			   src);
+		egl_upload(egl->tex[1], 1, GL_R8, GL_RED, width, height / 2,
+			   bpl, src + bpl * height);
+		return bpl * height * 3 / 2;
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV61:
+		egl_upload(egl->tex[0], 0, GL_R8, GL_RED, width, height, bpl,
+			   src);
+		egl_upload(egl->tex[1], 1, GL_R8, GL_RED, width, height, bpl,
+			   src + bpl * height);
+		return bpl * height * 2;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		usrc = src + bpl * height;
+		vsrc = usrc + bpl * height / 4;
+		if (fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_YVU420) {
+			vsrc = usrc;
+			usrc = vsrc + bpl * height / 4;
+		}
+		egl_upload(egl->tex[0], 0, GL_R8, GL_RED, width, height, bpl,
+			   src);
+		egl_upload(egl->tex[1], 1, GL_R8, GL_RED, width / 2,
+			   height / 2, bpl / 2, usrc);
+		egl_upload(egl->tex[2], 2, GL_R8, GL_RED, width / 2,
+			   height / 2, bpl / 2, vsrc);
+		return bpl * height * 3 / 2;
+	}
+
+	return 0;
+}
+
+struct v4lconvert_egl *v4lconvert_egl_create(void)
+{
+	return calloc(1, sizeof(struct v4lconvert_egl));
+}
+
+void v4lconvert_egl_destroy(struct v4lconvert_egl *egl)
+{
+	if (!egl)
+		return;
+
+	if (egl->initialized) {
+		eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			       egl->context);
+		if (egl->program)
+			glDeleteProgram(egl->program);
+		glDeleteTextures(3, egl->tex);
+		glDeleteFramebuffers(1, &egl->fbo);
+		glDeleteRenderbuffers(1, &egl->rbo);
+		eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			       EGL_NO_CONTEXT);
+		eglDestroyContext(egl->display, egl->context);
+		eglTerminate(egl->display);
+	}
+	free(egl->rgba);
+	free(egl);
+}
+
+int v4lconvert_egl_convert(struct v4lconvert_egl *egl,
+		const unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size,
+		const struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_egl_cfg cfg;
+	unsigned int width = fmt->fmt.pix.width;
+	unsigned int height = fmt->fmt.pix.height;
+	int i, n, result = 0, bgr = dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+
+	if (egl->failed || (dest_pix_fmt != V4L2_PIX_FMT_RGB24 && !bgr) ||
+	    (width & 1) || (height & 1) ||
+	    dest_size < (int)(width * height * 3))
+		return 0;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.pixfmt = fmt->fmt.pix.pixelformat;
+	cfg.width = width;
+	cfg.height = height;
+	cfg.ycbcr_enc = fmt->fmt.pix.ycbcr_enc;
+	if (cfg.ycbcr_enc == V4L2_YCBCR_ENC_DEFAULT)
+		cfg.ycbcr_enc =
+			V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->fmt.pix.colorspace);
+	cfg.quantization = fmt->fmt.pix.quantization;
+	if (cfg.quantization == V4L2_QUANTIZATION_DEFAULT)
+		cfg.quantization = V4L2_MAP_QUANTIZATION_DEFAULT(0,
+				fmt->fmt.pix.colorspace, cfg.ycbcr_enc);
+	if (!memcmp(&cfg, &egl->failed_cfg, sizeof(cfg)))
+		return 0;
+
+	if (!egl->initialized) {
+		if (egl_init(egl)) {
+			fprintf(stderr, "libv4lconvert: warning: could not set up EGL, converting in software\n");
+			egl->failed = 1;
+			return 0;
+		}
+		egl->initialized = 1;
+	} else if (!eglMakeCurrent(egl->display, EGL_NO_SURFACE,
+				   EGL_NO_SURFACE, egl->context)) {
+		return 0;
+	}
+
+	if (width * height * 4 > egl->rgba_size) {
+		free(egl->rgba);
+		egl->rgba_size = width * height * 4;
+		egl->rgba = malloc(egl->rgba_size);
+		if (!egl->rgba) {
+			egl->rgba_size = 0;
+			goto leave;
+		}
+	}
+
+	if (memcmp(&cfg, &egl->cfg, sizeof(cfg)) &&
+	    egl_build_program(egl, &cfg)) {
+		egl->failed_cfg = cfg;
+		memset(&egl->cfg, 0, sizeof(egl->cfg));
+		goto leave;
+	}
+
+	n = egl_upload_frame(egl, src, fmt);
+	if (!n || src_size < n) {
+		if (!n)
+			egl->failed_cfg = cfg;
+		goto leave;
+	}
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+		     egl->rgba);
+	if (glGetError() != GL_NO_ERROR)
+		goto leave;
+
+	for (i = 0; i < width * height; i++) {
+		dest[3 * i] = egl->rgba[4 * i + (bgr ? 2 : 0)];
+		dest[3 * i + 1] = egl->rgba[4 * i + 1];
+		dest[3 * i + 2] = egl->rgba[4 * i + (bgr ? 0 : 2)];
+	}
+	result = 1;
+
+leave:
+	/* The next conversion may be done by another thread */
+	eglMakeCurrent(egl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		       EGL_NO_CONTEXT);
+	return result;
+}
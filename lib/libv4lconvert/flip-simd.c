@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels for the flip and rotate code in flip.c
+ *
+ * The transpose kernels do a single tile of 16x16 8 bit or 8x8 24 bit pixels,
+ * the strides may be negative to also mirror the tile. They return 1 when
+ * they did the tile and 0 when there is no SIMD support, in which case the
+ * C code does it. The hflip kernels mirror as many pixels of a line as fit in
+ * whole SIMD blocks and return the number of pixels done.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/* 4 rounds of interleaving row i with row i + 8 transposes 16x16 bytes */
+static SSE2 int transpose16x16_8_sse2(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	__m128i r[16], t[16];
+	int i, round;
+
+	for (i = 0; i < 16; i++)
+		r[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+
+	for (round = 0; round < 4; round++) {
+		for (i = 0; i < 8; i++) {
+			t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + 8]);
+			t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + 8]);
+		}
+		for (i = 0; i < 16; i++)
+			r[i] = t[i];
+	}
+
+	for (i = 0; i < 16; i++)
+		_mm_storeu_si128((__m128i *)(dst + i * dst_stride), r[i]);
+
+	return 1;
+}
+
+static inline SSE2 void transpose4x4_32_sse2(__m128i *a, __m128i *b,
+		__m128i *c, __m128i *d)
+{
+	__m128i ab0 = _mm_unpacklo_epi32(*a, *b), ab1 = _mm_unpackhi_epi32(*a, *b);
+	__m128i cd0 = _mm_unpacklo_epi32(*c, *d), cd1 = _mm_unpackhi_epi32(*c, *d);
+
+	*a = _mm_unpacklo_epi64(ab0, cd0);
+	*b = _mm_unpackhi_epi64(ab0, cd0);
+	*c = _mm_unpacklo_epi64(ab1, cd1);
+	*d = _mm_unpackhi_epi64(ab1, cd1);
+}
+
+/* The 24 bit pixels get padded to 32 bit, transposed as 4 4x4 blocks and
+   packed again */
+static SSSE3 int transpose8x8_24_ssse3(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	const __m128i pad_lo = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i pad_hi = _mm_setr_epi8(4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	__m128i lo[8], hi[8], t;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		const unsigned char *s = src + i * src_stride;
+
+		/* Pixels 4 - 7 are loaded from byte 8, to not read past them */
+		lo[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)s), pad_lo);
+		hi[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s + 8)), pad_hi);
+	}
+
+	transpose4x4_32_sse2(&lo[0], &lo[1], &lo[2], &lo[3]);
+	transpose4x4_32_sse2(&lo[4], &lo[5], &lo[6], &lo[7]);
+	transpose4x4_32_sse2(&hi[0], &hi[1], &hi[2], &hi[3]);
+	transpose4x4_32_sse2(&hi[4], &hi[5], &hi[6], &hi[7]);
+	for (i = 0; i < 4; i++) {
+		t = hi[i];
+		hi[i] = lo[i + 4];
+		lo[i + 4] = t;
+	}
+
+	for (i = 0; i < 8; i++) {
+		unsigned char *d = dst + i * dst_stride;
+		__m128i a = _mm_shuffle_epi8(lo[i], pack);
+		__m128i b = _mm_shuffle_epi8(hi[i], pack);
+
+		_mm_storeu_si128((__m128i *)d, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storel_epi64((__m128i *)(d + 16), _mm_srli_si128(b, 4));
+	}
+
+	return 1;
+}
+
+static SSSE3 int hflip_row_8_ssse3(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m128i rev = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	int j;
+
+	src += width;
+	for (j = 0; j + 16 <= width; j += 16) {
+		src -= 16;
+		_mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)src), rev));
+		dest += 16;
+	}
+
+	return j;
+}
+
+static AVX2 int hflip_row_8_avx2(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+					     15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	int j;
+
+	src += width;
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i v;
+
+		src -= 32;
+		v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), rev);
+		_mm256_storeu_si256((__m256i *)dest, _mm256_permute4x64_epi64(v, 0x4e));
+		dest += 32;
+	}
+
+	return j;
+}
+
+/* 4 pixels at a time, the loads start 4 bytes before them and the stores
+   write 4 bytes past them, so stay 2 pixels away from both line ends */
+static SSSE3 int hflip_row_24_ssse3(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m128i rev = _mm_setr_epi8(13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, -1, -1, -1, -1);
+	int j;
+
+	src += width * 3;
+	for (j = 0; j + 6 <= width; j += 4) {
+		src -= 12;
+		_mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)(src - 4)), rev));
+		dest += 12;
+	}
+
+	return j;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+static inline void transpose8x8_8_neon(uint8x8_t r[8])
+{
+	uint8x8x2_t b0 = vtrn_u8(r[0], r[1]), b1 = vtrn_u8(r[2], r[3]);
+	uint8x8x2_t b2 = vtrn_u8(r[4], r[5]), b3 = vtrn_u8(r[6], r[7]);
+	uint16x4x2_t h0 = vtrn_u16(vreinterpret_u16_u8(b0.val[0]), vreinterpret_u16_u8(b1.val[0]));
+	uint16x4x2_t h1 = vtrn_u16(vreinterpret_u16_u8(b0.val[1]), vreinterpret_u16_u8(b1.val[1]));
+	uint16x4x2_t h2 = vtrn_u16(vreinterpret_u16_u8(b2.val[0]), vreinterpret_u16_u8(b3.val[0]));
+	uint16x4x2_t h3 = vtrn_u16(vreinterpret_u16_u8(b2.val[1]), vreinterpret_u16_u8(b3.val[1]));
+	uint32x2x2_t w0 = vtrn_u32(vreinterpret_u32_u16(h0.val[0]), vreinterpret_u32_u16(h2.val[0]));
+	uint32x2x2_t w1 = vtrn_u32(vreinterpret_u32_u16(h1.val[0]), vreinterpret_u32_u16(h3.val[0]));
+	uint32x2x2_t w2 = vtrn_u32(vreinterpret_u32_u16(h0.val[1]), vreinterpret_u32_u16(h2.val[1]));
+	uint32x2x2_t w3 = vtrn_u32(vreinterpret_u32_u16(h1.val[1]), vreinterpret_u32_u16(h3.val[1]));
+
+	r[0] = vreinterpret_u8_u32(w0.val[0]);
+	r[1] = vreinterpret_u8_u32(w1.val[0]);
+	r[2] = vreinterpret_u8_u32(w2.val[0]);
+	r[3] = vreinterpret_u8_u32(w3.val[0]);
+	r[4] = vreinterpret_u8_u32(w0.val[1]);
+	r[5] = vreinterpret_u8_u32(w1.val[1]);
+	r[6] = vreinterpret_u8_u32(w2.val[1]);
+	r[7] = vreinterpret_u8_u32(w3.val[1]);
+}
+
+static int transpose16x16_8_neon(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	uint8x8_t r[8];
+	int i, bx, by;
+
+	for (by = 0; by < 16; by += 8)
+		for (bx = 0; bx < 16; bx += 8) {
+			for (i = 0; i < 8; i++)
+				r[i] = vld1_u8(src + (by + i) * src_stride + bx);
+			transpose8x8_8_neon(r);
+			for (i = 0; i < 8; i++)
+				vst1_u8(dst + (bx + i) * dst_stride + by, r[i]);
+		}
+
+	return 1;
+}
+
+/* vld3 splits the pixels in 3 planes, which get transposed separately */
+static int transpose8x8_24_neon(const unsigned char *src,
+		int src_stride, unsigned char *dst, int dst_stride)
+{
+	uint8x8x3_t rows[8];
+	uint8x8_t r[8];
+	int c, i;
+
+	for (i = 0; i < 8; i++)
+		rows[i] = vld3_u8(src + i * src_stride);
+
+	for (c = 0; c < 3; c++) {
+		for (i = 0; i < 8; i++)
+			r[i] = rows[i].val[c];
+		transpose8x8_8_neon(r);
+		for (i = 0; i < 8; i++)
+			rows[i].val[c] = r[i];
+	}
+
+	for (i = 0; i < 8; i++)
+		vst3_u8(dst + i * dst_stride, rows[i]);
+
+	return 1;
+}
+
+static inline uint8x16_t reverse16_neon(uint8x16_t v)
+{
+	v = vrev64q_u8(v);
+	return vextq_u8(v, v, 8);
+}
+
+static int hflip_row_8_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int j;
+
+	src += width;
+	for (j = 0; j + 16 <= width; j += 16) {
+		src -= 16;
+		vst1q_u8(dest, reverse16_neon(vld1q_u8(src)));
+		dest += 16;
+	}
+
+	return j;
+}
+
+static int hflip_row_24_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int c, j;
+
+	src += width * 3;
+	for (j = 0; j + 16 <= width; j += 16) {
+		uint8x16x3_t v;
+
+		src -= 48;
+		v = vld3q_u8(src);
+		for (c = 0; c < 3; c++)
+			v.val[c] = reverse16_neon(v.val[c]);
+		vst3q_u8(dest, v);
+		dest += 48;
+	}
+
+	return j;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_transpose_tile(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride, int bpp)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (bpp == 1 && (flags & V4LCONVERT_CPU_SSE2))
+		return transpose16x16_8_sse2(src, src_stride, dst, dst_stride);
+	if (bpp == 3 && (flags & V4LCONVERT_CPU_SSSE3))
+		return transpose8x8_24_ssse3(src, src_stride, dst, dst_stride);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (bpp == 1 && (flags & V4LCONVERT_CPU_NEON))
+		return transpose16x16_8_neon(src, src_stride, dst, dst_stride);
+	if (bpp == 3 && (flags & V4LCONVERT_CPU_NEON))
+		return transpose8x8_24_neon(src, src_stride, dst, dst_stride);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_hflip_row(const unsigned char *src, unsigned char *dest,
+		int width, int bpp)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (bpp == 1 && (flags & V4LCONVERT_CPU_AVX2))
+		return hflip_row_8_avx2(src, dest, width);
+	if (bpp == 1 && (flags & V4LCONVERT_CPU_SSSE3))
+		return hflip_row_8_ssse3(src, dest, width);
+	if (bpp == 3 && (flags & V4LCONVERT_CPU_SSSE3))
+		return hflip_row_24_ssse3(src, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (bpp == 1 && (flags & V4LCONVERT_CPU_NEON))
+		return hflip_row_8_neon(src, dest, width);
+	if (bpp == 3 && (flags & V4LCONVERT_CPU_NEON))
+		return hflip_row_24_neon(src, dest, width);
+#endif
+	return 0;
+}
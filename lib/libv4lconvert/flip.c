@@ -66,136 +66,154 @@ static void v4lconvert_vflip_yuv420(unsigned char *src, unsigned char *dest,
 	}
 }
 
+/* Mirror a line of width pixels of bpp bytes */
+static void v4lconvert_hflip_line(const unsigned char *src,
+		unsigned char *dest, int width, int bpp)
+{
+	int x;
+
+	x = v4lconvert_simd_hflip_row(src, dest, width, bpp);
+	dest += x * bpp;
+	src += (width - x) * bpp;
+	for (; x < width; x++) {
+		src -= bpp;
+		memcpy(dest, src, bpp);
+		dest += bpp;
+	}
+}
+
 static void v4lconvert_hflip_rgbbgr24(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt)
 {
-	int x, y;
+	int y;
 
 	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width * 3;
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			src -= 3;
-			dest[0] = src[0];
-			dest[1] = src[1];
-			dest[2] = src[2];
-			dest += 3;
-		}
+		v4lconvert_hflip_line(src, dest, fmt->fmt.pix.width, 3);
 		src += fmt->fmt.pix.bytesperline;
+		dest += fmt->fmt.pix.width * 3;
 	}
 }
 
 static void v4lconvert_hflip_yuv420(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt)
 {
-	int x, y;
+	int y;
 
 	/* First flip the Y plane */
 	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x++)
-			*dest++ = *--src;
+		v4lconvert_hflip_line(src, dest, fmt->fmt.pix.width, 1);
 		src += fmt->fmt.pix.bytesperline;
+		dest += fmt->fmt.pix.width;
 	}
 
 	/* Now flip the U plane */
 	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
+		v4lconvert_hflip_line(src, dest, fmt->fmt.pix.width / 2, 1);
 		src += fmt->fmt.pix.bytesperline / 2;
+		dest += fmt->fmt.pix.width / 2;
 	}
 
 	/* Last flip the V plane */
 	for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-		src += fmt->fmt.pix.width / 2;
-		for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-			*dest++ = *--src;
+		v4lconvert_hflip_line(src, dest, fmt->fmt.pix.width / 2, 1);
 		src += fmt->fmt.pix.bytesperline / 2;
+		dest += fmt->fmt.pix.width / 2;
 	}
 }
 
+/* Flipping x and y of a plane without padding is mirroring it as a whole */
 static void v4lconvert_rotate180_rgbbgr24(const unsigned char *src,
 		unsigned char *dst, int width, int height)
 {
-	int i;
-
-	src += 3 * width * height - 3;
-
-	for (i = 0; i < width * height; i++) {
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst += 3;
-		src -= 3;
-	}
+	v4lconvert_hflip_line(src, dst, width * height, 3);
 }
 
 static void v4lconvert_rotate180_yuv420(const unsigned char *src,
 		unsigned char *dst, int width, int height)
 {
-	int i;
-
 	/* First flip x and y of the Y plane */
-	src += width * height - 1;
-	for (i = 0; i < width * height; i++)
-		*dst++ = *src--;
+	v4lconvert_hflip_line(src, dst, width * height, 1);
 
 	/* Now flip the U plane */
-	src += width * height * 5 / 4;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
+	src += width * height;
+	dst += width * height;
+	v4lconvert_hflip_line(src, dst, width * height / 4, 1);
 
 	/* Last flip the V plane */
-	src += width * height / 2;
-	for (i = 0; i < width * height / 4; i++)
-		*dst++ = *src--;
+	src += width * height / 4;
+	dst += width * height / 4;
+	v4lconvert_hflip_line(src, dst, width * height / 4, 1);
+}
+
+/*
+ * Rotate a plane of bpp bytes per pixel 90 degrees clockwise, dest pixel
+ * (x, y) is source pixel (y, srcheight - 1 - x). Instead of walking the
+ * source column wise for each destination line, this is done per line of
+ * square tiles, which are a transpose with the source lines in reverse
+ * order. The 16 (8 bit) or 8 (24 bit) pixel wide column of source data these
+ * read then gets used completely before being evicted from the cache.
+ */
+static void v4lconvert_rotate90_plane(const unsigned char *src,
+		unsigned char *dst, int destwidth, int destheight, int bpp)
+{
+	int srcwidth = destheight, srcheight = destwidth;
+	int tile = bpp == 1 ? 16 : 8;
+	int x, y, x0, y0, x1, y1;
+
+	for (y0 = 0; y0 < destheight; y0 += tile)
+		for (x0 = 0; x0 < destwidth; x0 += tile) {
+			x1 = x0 + tile;
+			y1 = y0 + tile;
+			if (x1 <= destwidth && y1 <= destheight &&
+			    v4lconvert_simd_transpose_tile(src +
+					((srcheight - 1 - x0) * srcwidth + y0) * bpp,
+					-srcwidth * bpp,
+					dst + (y0 * destwidth + x0) * bpp,
+					destwidth * bpp, bpp))
+				continue;
+
+			if (x1 > destwidth)
+				x1 = destwidth;
+			if (y1 > destheight)
+				y1 = destheight;
+			for (y = y0; y < y1; y++)
+				for (x = x0; x < x1; x++) {
+					const unsigned char *s = src +
+						((srcheight - 1 - x) * srcwidth + y) * bpp;
+					unsigned char *d = dst + (y * destwidth + x) * bpp;
+
+					d[0] = s[0];
+					if (bpp == 3) {
+						d[1] = s[1];
+						d[2] = s[2];
+					}
+				}
+		}
 }
 
 static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
 		unsigned char *dst, int destwidth, int destheight)
 {
-	int x, y;
-#define srcwidth destheight
-#define srcheight destwidth
-
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = ((srcheight - x - 1) * srcwidth + y) * 3;
-			*dst++ = src[offset++];
-			*dst++ = src[offset++];
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(src, dst, destwidth, destheight, 3);
 }
 
 static void v4lconvert_rotate90_yuv420(const unsigned char *src,
 		unsigned char *dst, int destwidth, int destheight)
 {
-	int x, y;
-
 	/* Y-plane */
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(src, dst, destwidth, destheight, 1);
 
 	/* U-plane */
-	src += srcwidth * srcheight;
+	src += destwidth * destheight;
+	dst += destwidth * destheight;
 	destwidth /= 2;
 	destheight /= 2;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	v4lconvert_rotate90_plane(src, dst, destwidth, destheight, 1);
 
 	/* V-plane */
-	src += srcwidth * srcheight;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	src += destwidth * destheight;
+	dst += destwidth * destheight;
+	v4lconvert_rotate90_plane(src, dst, destwidth, destheight, 1);
 }
 
 void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels for the frame hash in hash.c
+ *
+ * They do the whole blocks of 16 stripes of the frame, including the
+ * scramble after each block, with the same results as the C code, and
+ * return the number of bytes done.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#define PRIME32_1 0x9e3779b1u
+
+#ifdef V4LCONVERT_SIMD_X86
+
+static SSE2 int hash_blocks_sse2(uint64_t *acc64, const unsigned char *src,
+		int size)
+{
+	const __m128i prime = _mm_set1_epi32(PRIME32_1);
+	__m128i acc[4], key[4];
+	int done, i, j;
+
+	for (i = 0; i < 4; i++) {
+		acc[i] = _mm_loadu_si128((const __m128i *)(acc64 + 2 * i));
+		key[i] = _mm_loadu_si128((const __m128i *)(v4lconvert_hash_key + 2 * i));
+	}
+
+	for (done = 0; done + V4LCONVERT_HASH_BLOCK <= size;
+	     done += V4LCONVERT_HASH_BLOCK) {
+		for (j = 0; j < V4LCONVERT_HASH_BLOCK; j += V4LCONVERT_HASH_STRIPE) {
+			const __m128i *s = (const __m128i *)(src + done + j);
+
+			for (i = 0; i < 4; i++) {
+				__m128i d = _mm_loadu_si128(s + i);
+				__m128i k = _mm_xor_si128(d, key[i]);
+				__m128i p = _mm_mul_epu32(k, _mm_srli_epi64(k, 32));
+
+				acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(p,
+					_mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+			}
+		}
+		for (i = 0; i < 4; i++) {
+			__m128i a = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+
+			a = _mm_xor_si128(a, key[i]);
+			acc[i] = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(
+				_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32));
+		}
+	}
+
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i *)(acc64 + 2 * i), acc[i]);
+
+	return done;
+}
+
+static AVX2 int hash_blocks_avx2(uint64_t *acc64, const unsigned char *src,
+		int size)
+{
+	const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+	__m256i acc[2], key[2];
+	int done, i, j;
+
+	for (i = 0; i < 2; i++) {
+		acc[i] = _mm256_loadu_si256((const __m256i *)(acc64 + 4 * i));
+		key[i] = _mm256_loadu_si256((const __m256i *)(v4lconvert_hash_key + 4 * i));
+	}
+
+	for (done = 0; done + V4LCONVERT_HASH_BLOCK <= size;
+	     done += V4LCONVERT_HASH_BLOCK) {
+		for (j = 0; j < V4LCONVERT_HASH_BLOCK; j += V4LCONVERT_HASH_STRIPE) {
+			const __m256i *s = (const __m256i *)(src + done + j);
+
+			for (i = 0; i < 2; i++) {
+				__m256i d = _mm256_loadu_si256(s + i);
+				__m256i k = _mm256_xor_si256(d, key[i]);
+				__m256i p = _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32));
+
+				acc[i] = _mm256_add_epi64(acc[i], _mm256_add_epi64(p,
+					_mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+			}
+		}
+		for (i = 0; i < 2; i++) {
+			__m256i a = _mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47));
+
+			a = _mm256_xor_si256(a, key[i]);
+			acc[i] = _mm256_add_epi64(_mm256_mul_epu32(a, prime),
+				_mm256_slli_epi64(_mm256_mul_epu32(
+					_mm256_srli_epi64(a, 32), prime), 32));
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+		_mm256_storeu_si256((__m256i *)(acc64 + 4 * i), acc[i]);
+
+	return done;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+static int hash_blocks_neon(uint64_t *acc64, const unsigned char *src,
+		int size)
+{
+	uint64x2_t acc[4], key[4];
+	int done, i, j;
+
+	for (i = 0; i < 4; i++) {
+		acc[i] = vld1q_u64(acc64 + 2 * i);
+		key[i] = vld1q_u64(v4lconvert_hash_key + 2 * i);
+	}
+
+	for (done = 0; done + V4LCONVERT_HASH_BLOCK <= size;
+	     done += V4LCONVERT_HASH_BLOCK) {
+		for (j = 0; j < V4LCONVERT_HASH_BLOCK; j += V4LCONVERT_HASH_STRIPE) {
+			for (i = 0; i < 4; i++) {
+				uint64x2_t d = vreinterpretq_u64_u8(
+					vld1q_u8(src + done + j + 16 * i));
+				uint64x2_t k = veorq_u64(d, key[i]);
+
+				acc[i] = vmlal_u32(vaddq_u64(acc[i], vextq_u64(d, d, 1)),
+						   vmovn_u64(k), vshrn_n_u64(k, 32));
+			}
+		}
+		for (i = 0; i < 4; i++) {
+			uint64x2_t a = veorq_u64(acc[i], vshrq_n_u64(acc[i], 47));
+
+			a = veorq_u64(a, key[i]);
+			acc[i] = vmlal_n_u32(vshlq_n_u64(vmull_n_u32(
+						vshrn_n_u64(a, 32), PRIME32_1), 32),
+					     vmovn_u64(a), PRIME32_1);
+		}
+	}
+
+	for (i = 0; i < 4; i++)
+		vst1q_u64(acc64 + 2 * i, acc[i]);
+
+	return done;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_hash_blocks(uint64_t *acc, const unsigned char *src,
+		int size)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return hash_blocks_avx2(acc, src, size);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return hash_blocks_sse2(acc, src, size);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return hash_blocks_neon(acc, src, size);
+#endif
+	return 0;
+}
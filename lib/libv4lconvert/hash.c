@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Fast 64 bit hash of a frame, to detect repeated frames
+ *
+ * This follows the structure of XXH3: 8 64 bit accumulators take 64 byte
+ * stripes, each accumulator adding the product of the low and high 32 bits
+ * of its keyed input word plus the unkeyed word of its neighbour. Every 16
+ * stripes the accumulators get scrambled, and at the end merged with the
+ * length. A 32 x 32 -> 64 bit multiply per 8 bytes maps directly onto SSE2,
+ * AVX2 and NEON, see hash-simd.c, which gives a hash much cheaper than any
+ * conversion.
+ *
+ * Frames are only compared within one process, so the input words are read
+ * in native byte order. This is not a cryptographic hash.
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+#define PRIME32_1 0x9e3779b1u
+#define PRIME32_2 0x85ebca77u
+#define PRIME32_3 0xc2b2ae3du
+#define PRIME64_1 0x9e3779b185ebca87ull
+#define PRIME64_2 0xc2b2ae3d27d4eb4full
+#define PRIME64_3 0x165667b19e3779f9ull
+#define PRIME64_4 0x85ebca77c2b2ae63ull
+#define PRIME64_5 0x27d4eb2f165667c5ull
+
+/* The first hex digits of pi */
+const uint64_t v4lconvert_hash_key[8] = {
+	0x243f6a8885a308d3ull, 0x13198a2e03707344ull,
+	0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull,
+	0x452821e638d01377ull, 0xbe5466cf34e90c6cull,
+	0xc0ac29b7c97c50ddull, 0x3f84d5b5b5470917ull,
+};
+
+static void hash_stripe(uint64_t *acc, const unsigned char *src)
+{
+	uint64_t d[8];
+	int i;
+
+	memcpy(d, src, sizeof(d));
+	for (i = 0; i < 8; i++) {
+		uint64_t k = d[i] ^ v4lconvert_hash_key[i];
+
+		acc[i] += (k & 0xffffffff) * (k >> 32) + d[i ^ 1];
+	}
+}
+
+static void hash_scramble(uint64_t *acc)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= v4lconvert_hash_key[i];
+		acc[i] *= PRIME32_1;
+	}
+}
+
+uint64_t v4lconvert_hash(const unsigned char *src, int size)
+{
+	uint64_t acc[8] = {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+	};
+	unsigned char last[V4LCONVERT_HASH_STRIPE] = { 0 };
+	uint64_t h = (uint64_t)size * PRIME64_1;
+	int i, done;
+
+	done = v4lconvert_simd_hash_blocks(acc, src, size);
+	for (; done + V4LCONVERT_HASH_BLOCK <= size;
+	     done += V4LCONVERT_HASH_BLOCK) {
+		for (i = 0; i < V4LCONVERT_HASH_BLOCK;
+		     i += V4LCONVERT_HASH_STRIPE)
+			hash_stripe(acc, src + done + i);
+		hash_scramble(acc);
+	}
+	for (; done + V4LCONVERT_HASH_STRIPE <= size;
+	     done += V4LCONVERT_HASH_STRIPE)
+		hash_stripe(acc, src + done);
+	/* The length in h tells zero padding apart from zeros */
+	memcpy(last, src + done, size - done);
+	hash_stripe(acc, last);
+
+	for (i = 0; i < 8; i++) {
+		h ^= acc[i] * PRIME64_2;
+		h = ((h << 27) | (h >> 37)) * PRIME64_1 + PRIME64_4;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels for the fixed-point inverse DCT in jidctint.c
+ *
+ * A whole 8x8 block is kept in 8 vectors of 8 16 bit values. Each pass
+ * does the 1-D IDCT of all 8 columns at once, followed by a transpose, so
+ * the second pass works on the rows. The products are summed in 32 bits,
+ * in the same order as the C code, which makes the results bit-exact with
+ * it.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#define CONST_BITS	13
+#define PASS1_BITS	2
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/* Constant pair for pmaddwd: a for the even, b for the odd 16 bit lanes */
+static inline SSE2 __m128i idct_pair_sse2(int a, int b)
+{
+	return _mm_set1_epi32((a & 0xffff) | ((unsigned int)(b & 0xffff) << 16));
+}
+
+/* 4 columns of the 1-D IDCT, the inputs are interleaved in pairs */
+static inline SSE2 void idct_1d_half_sse2(__m128i p04, __m128i p26,
+		__m128i p13, __m128i p57, __m128i rnd, __m128i shift,
+		__m128i out[8])
+{
+	__m128i t0, t1, t2, t3, e0, e1, e2, e3, o0, o1, o2, o3;
+
+	/* Even part */
+	t0 = _mm_add_epi32(_mm_madd_epi16(p04, idct_pair_sse2(8192, 8192)), rnd);
+	t1 = _mm_add_epi32(_mm_madd_epi16(p04, idct_pair_sse2(8192, -8192)), rnd);
+	t2 = _mm_madd_epi16(p26, idct_pair_sse2(4433, -10704));
+	t3 = _mm_madd_epi16(p26, idct_pair_sse2(10703, 4433));
+	e0 = _mm_add_epi32(t0, t3);
+	e3 = _mm_sub_epi32(t0, t3);
+	e1 = _mm_add_epi32(t1, t2);
+	e2 = _mm_sub_epi32(t1, t2);
+
+	/* Odd part */
+	o0 = _mm_add_epi32(_mm_madd_epi16(p13, idct_pair_sse2(2260, -6436)),
+			   _mm_madd_epi16(p57, idct_pair_sse2(9633, -11363)));
+	o1 = _mm_add_epi32(_mm_madd_epi16(p13, idct_pair_sse2(6437, -11362)),
+			   _mm_madd_epi16(p57, idct_pair_sse2(2261, 9633)));
+	o2 = _mm_add_epi32(_mm_madd_epi16(p13, idct_pair_sse2(9633, -2259)),
+			   _mm_madd_epi16(p57, idct_pair_sse2(-11362, -6436)));
+	o3 = _mm_add_epi32(_mm_madd_epi16(p13, idct_pair_sse2(11363, 9633)),
+			   _mm_madd_epi16(p57, idct_pair_sse2(6437, 2260)));
+
+	out[0] = _mm_sra_epi32(_mm_add_epi32(e0, o3), shift);
+	out[7] = _mm_sra_epi32(_mm_sub_epi32(e0, o3), shift);
+	out[1] = _mm_sra_epi32(_mm_add_epi32(e1, o2), shift);
+	out[6] = _mm_sra_epi32(_mm_sub_epi32(e1, o2), shift);
+	out[2] = _mm_sra_epi32(_mm_add_epi32(e2, o1), shift);
+	out[5] = _mm_sra_epi32(_mm_sub_epi32(e2, o1), shift);
+	out[3] = _mm_sra_epi32(_mm_add_epi32(e3, o0), shift);
+	out[4] = _mm_sra_epi32(_mm_sub_epi32(e3, o0), shift);
+}
+
+/* The 1-D IDCT of 8 columns, v[n] holds input n of each column */
+static inline SSE2 void idct_1d_sse2(__m128i v[8], int rnd, int shift)
+{
+	const __m128i vrnd = _mm_set1_epi32(rnd);
+	const __m128i vshift = _mm_cvtsi32_si128(shift);
+	__m128i lo[8], hi[8];
+	int i;
+
+	idct_1d_half_sse2(_mm_unpacklo_epi16(v[0], v[4]),
+			  _mm_unpacklo_epi16(v[2], v[6]),
+			  _mm_unpacklo_epi16(v[1], v[3]),
+			  _mm_unpacklo_epi16(v[5], v[7]), vrnd, vshift, lo);
+	idct_1d_half_sse2(_mm_unpackhi_epi16(v[0], v[4]),
+			  _mm_unpackhi_epi16(v[2], v[6]),
+			  _mm_unpackhi_epi16(v[1], v[3]),
+			  _mm_unpackhi_epi16(v[5], v[7]), vrnd, vshift, hi);
+
+	/* The saturating pack does the clipping to 16 bits */
+	for (i = 0; i < 8; i++)
+		v[i] = _mm_packs_epi32(lo[i], hi[i]);
+}
+
+static inline SSE2 void transpose_8x8_sse2(__m128i v[8])
+{
+	__m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	v[0] = _mm_unpacklo_epi64(b0, b4);
+	v[1] = _mm_unpackhi_epi64(b0, b4);
+	v[2] = _mm_unpacklo_epi64(b1, b5);
+	v[3] = _mm_unpackhi_epi64(b1, b5);
+	v[4] = _mm_unpacklo_epi64(b2, b6);
+	v[5] = _mm_unpackhi_epi64(b2, b6);
+	v[6] = _mm_unpacklo_epi64(b3, b7);
+	v[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static SSE2 void idct_islow_sse2(const int16_t *coef, const int16_t *quant,
+		uint8_t *out, int stride)
+{
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i v[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v[i] = _mm_mullo_epi16(
+			_mm_loadu_si128((const __m128i *)(coef + 8 * i)),
+			_mm_loadu_si128((const __m128i *)(quant + 8 * i)));
+
+	idct_1d_sse2(v, 1 << (CONST_BITS - PASS1_BITS - 1),
+		     CONST_BITS - PASS1_BITS);
+	transpose_8x8_sse2(v);
+	idct_1d_sse2(v, 1 << (CONST_BITS + PASS1_BITS + 3 - 1),
+		     CONST_BITS + PASS1_BITS + 3);
+	transpose_8x8_sse2(v);
+
+	for (i = 0; i < 8; i++) {
+		__m128i row = _mm_adds_epi16(v[i], c128);
+
+		_mm_storel_epi64((__m128i *)(out + i * stride),
+				 _mm_packus_epi16(row, row));
+	}
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+/* 4 columns of the 1-D IDCT */
+static inline void idct_1d_half_neon(int16x4_t i0, int16x4_t i1,
+		int16x4_t i2, int16x4_t i3, int16x4_t i4, int16x4_t i5,
+		int16x4_t i6, int16x4_t i7, int32x4_t rnd, int32x4_t shift,
+		int32x4_t out[8])
+{
+	int32x4_t t0, t1, t2, t3, e0, e1, e2, e3, o0, o1, o2, o3;
+
+	/* Even part */
+	t0 = vmlal_n_s16(vmlal_n_s16(rnd, i0, 8192), i4, 8192);
+	t1 = vmlal_n_s16(vmlal_n_s16(rnd, i0, 8192), i4, -8192);
+	t2 = vmlal_n_s16(vmull_n_s16(i2, 4433), i6, -10704);
+	t3 = vmlal_n_s16(vmull_n_s16(i2, 10703), i6, 4433);
+	e0 = vaddq_s32(t0, t3);
+	e3 = vsubq_s32(t0, t3);
+	e1 = vaddq_s32(t1, t2);
+	e2 = vsubq_s32(t1, t2);
+
+	/* Odd part */
+	o0 = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(vmull_n_s16(i1, 2260),
+			i3, -6436), i5, 9633), i7, -11363);
+	o1 = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(vmull_n_s16(i1, 6437),
+			i3, -11362), i5, 2261), i7, 9633);
+	o2 = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(vmull_n_s16(i1, 9633),
+			i3, -2259), i5, -11362), i7, -6436);
+	o3 = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(vmull_n_s16(i1, 11363),
+			i3, 9633), i5, 6437), i7, 2260);
+
+	/* shift is negative, vshlq then shifts right */
+	out[0] = vshlq_s32(vaddq_s32(e0, o3), shift);
+	out[7] = vshlq_s32(vsubq_s32(e0, o3), shift);
+	out[1] = vshlq_s32(vaddq_s32(e1, o2), shift);
+	out[6] = vshlq_s32(vsubq_s32(e1, o2), shift);
+	out[2] = vshlq_s32(vaddq_s32(e2, o1), shift);
+	out[5] = vshlq_s32(vsubq_s32(e2, o1), shift);
+	out[3] = vshlq_s32(vaddq_s32(e3, o0), shift);
+	out[4] = vshlq_s32(vsubq_s32(e3, o0), shift);
+}
+
+/* The 1-D IDCT of 8 columns, v[n] holds input n of each column */
+static inline void idct_1d_neon(int16x8_t v[8], int rnd, int shift)
+{
+	const int32x4_t vrnd = vdupq_n_s32(rnd);
+	const int32x4_t vshift = vdupq_n_s32(-shift);
+	int32x4_t lo[8], hi[8];
+	int i;
+
+	idct_1d_half_neon(vget_low_s16(v[0]), vget_low_s16(v[1]),
+			  vget_low_s16(v[2]), vget_low_s16(v[3]),
+			  vget_low_s16(v[4]), vget_low_s16(v[5]),
+			  vget_low_s16(v[6]), vget_low_s16(v[7]),
+			  vrnd, vshift, lo);
+	idct_1d_half_neon(vget_high_s16(v[0]), vget_high_s16(v[1]),
+			  vget_high_s16(v[2]), vget_high_s16(v[3]),
+			  vget_high_s16(v[4]), vget_high_s16(v[5]),
+			  vget_high_s16(v[6]), vget_high_s16(v[7]),
+			  vrnd, vshift, hi);
+
+	/* The saturating narrow does the clipping to 16 bits */
+	for (i = 0; i < 8; i++)
+		v[i] = vcombine_s16(vqmovn_s32(lo[i]), vqmovn_s32(hi[i]));
+}
+
+static inline void transpose_8x8_neon(int16x8_t v[8])
+{
+	int16x8x2_t a0 = vtrnq_s16(v[0], v[1]);
+	int16x8x2_t a1 = vtrnq_s16(v[2], v[3]);
+	int16x8x2_t a2 = vtrnq_s16(v[4], v[5]);
+	int16x8x2_t a3 = vtrnq_s16(v[6], v[7]);
+	/* Even columns of rows 0-3 and of rows 4-7 */
+	int32x4x2_t b0 = vtrnq_s32(vreinterpretq_s32_s16(a0.val[0]),
+				   vreinterpretq_s32_s16(a1.val[0]));
+	int32x4x2_t b1 = vtrnq_s32(vreinterpretq_s32_s16(a2.val[0]),
+				   vreinterpretq_s32_s16(a3.val[0]));
+	/* Odd columns of rows 0-3 and of rows 4-7 */
+	int32x4x2_t b2 = vtrnq_s32(vreinterpretq_s32_s16(a0.val[1]),
+				   vreinterpretq_s32_s16(a1.val[1]));
+	int32x4x2_t b3 = vtrnq_s32(vreinterpretq_s32_s16(a2.val[1]),
+				   vreinterpretq_s32_s16(a3.val[1]));
+
+	v[0] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(b0.val[0]),
+						  vget_low_s32(b1.val[0])));
+	v[4] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(b0.val[0]),
+						  vget_high_s32(b1.val[0])));
+	v[2] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(b0.val[1]),
+						  vget_low_s32(b1.val[1])));
+	v[6] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(b0.val[1]),
+						  vget_high_s32(b1.val[1])));
+	v[1] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(b2.val[0]),
+						  vget_low_s32(b3.val[0])));
+	v[5] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(b2.val[0]),
+						  vget_high_s32(b3.val[0])));
+	v[3] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(b2.val[1]),
+						  vget_low_s32(b3.val[1])));
+	v[7] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(b2.val[1]),
+						  vget_high_s32(b3.val[1])));
+}
+
+static void idct_islow_neon(const int16_t *coef, const int16_t *quant,
+		uint8_t *out, int stride)
+{
+	const int16x8_t c128 = vdupq_n_s16(128);
+	int16x8_t v[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v[i] = vmulq_s16(vld1q_s16(coef + 8 * i),
+				 vld1q_s16(quant + 8 * i));
+
+	idct_1d_neon(v, 1 << (CONST_BITS - PASS1_BITS - 1),
+		     CONST_BITS - PASS1_BITS);
+	transpose_8x8_neon(v);
+	idct_1d_neon(v, 1 << (CONST_BITS + PASS1_BITS + 3 - 1),
+		     CONST_BITS + PASS1_BITS + 3);
+	transpose_8x8_neon(v);
+
+	for (i = 0; i < 8; i++)
+		vst1_u8(out + i * stride, vqmovun_s16(vqaddq_s16(v[i], c128)));
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_idct_islow(const int16_t *coef, const int16_t *quant,
+		uint8_t *out, int stride)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2) {
+		idct_islow_sse2(coef, quant, out, stride);
+		return 1;
+	}
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON) {
+		idct_islow_neon(coef, quant, out, stride);
+		return 1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Fixed-point inverse DCT for tinyjpeg
+ *
+ * This is the Loeffler, Ligtenberg and Moschytz (LLM) algorithm, as used by
+ * the "islow" IDCT of the IJG code: 12 multiplies per 1-D IDCT, with 13 bit
+ * constants and 2 extra bits of precision kept between the column and the
+ * row pass.
+ *
+ * The multiplies of the odd part and of the even part are regrouped so that
+ * every output is a sum of products of two inputs with a pair of constants.
+ * That is exactly what the SSE2 pmaddwd and NEON vmlal instructions compute,
+ * so the SIMD kernels in jidctint-simd.c give results which are bit-exact
+ * with this code. For the same reason the dequantized coefficients and the
+ * intermediate results of the column pass are saturated to 16 bits.
+ */
+
+#include <stdint.h>
+#include "tinyjpeg-internal.h"
+#include "libv4lconvert-priv.h"
+
+#define JIDCT_SIZE	8
+#define JIDCT_SIZE2	(JIDCT_SIZE * JIDCT_SIZE)
+#define CONST_BITS	13
+#define PASS1_BITS	2
+
+static inline int16_t sat16(int x)
+{
+	return x < INT16_MIN ? INT16_MIN : x > INT16_MAX ? INT16_MAX : x;
+}
+
+static inline uint8_t range_limit(int x)
+{
+	x = sat16(x) + 128;
+	return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/*
+ * 1-D IDCT of in[0], in[step], ... in[7 * step], adding rnd to all results
+ * before they get descaled by shift.
+ */
+#define IDCT_1D(in, step, rnd, shift, STORE)				\
+	do {								\
+		int i0 = in[0], i1 = in[step], i2 = in[2 * step];	\
+		int i3 = in[3 * step], i4 = in[4 * step];		\
+		int i5 = in[5 * step], i6 = in[6 * step];		\
+		int i7 = in[7 * step];					\
+		int t0, t1, t2, t3, e0, e1, e2, e3;			\
+		int o0, o1, o2, o3;					\
+									\
+		/* Even part */						\
+		t0 = i0 * 8192 + i4 * 8192 + (rnd);			\
+		t1 = i0 * 8192 - i4 * 8192 + (rnd);			\
+		t2 = i2 * 4433 - i6 * 10704;				\
+		t3 = i2 * 10703 + i6 * 4433;				\
+		e0 = t0 + t3;						\
+		e3 = t0 - t3;						\
+		e1 = t1 + t2;						\
+		e2 = t1 - t2;						\
+									\
+		/* Odd part */						\
+		o0 = i1 * 2260 + i3 * -6436 + i5 * 9633 + i7 * -11363;	\
+		o1 = i1 * 6437 + i3 * -11362 + i5 * 2261 + i7 * 9633;	\
+		o2 = i1 * 9633 + i3 * -2259 + i5 * -11362 + i7 * -6436; \
+		o3 = i1 * 11363 + i3 * 9633 + i5 * 6437 + i7 * 2260;	\
+									\
+		STORE(0, (e0 + o3) >> (shift));				\
+		STORE(7, (e0 - o3) >> (shift));				\
+		STORE(1, (e1 + o2) >> (shift));				\
+		STORE(6, (e1 - o2) >> (shift));				\
+		STORE(2, (e2 + o1) >> (shift));				\
+		STORE(5, (e2 - o1) >> (shift));				\
+		STORE(3, (e3 + o0) >> (shift));				\
+		STORE(4, (e3 - o0) >> (shift));				\
+	} while (0)
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients.
+ */
+void tinyjpeg_idct_islow(struct component *compptr, uint8_t *output_buf, int stride)
+{
+	const int16_t *quantptr = compptr->Q_table;
+	int16_t coef[JIDCT_SIZE2];
+	int16_t workspace[JIDCT_SIZE2];	/* buffers data between passes */
+	int16_t *wsptr;
+	uint8_t *outptr;
+	int i;
+
+	if (v4lconvert_simd_idct_islow(compptr->DCT, quantptr, output_buf,
+				       stride))
+		return;
+
+	for (i = 0; i < JIDCT_SIZE2; i++)
+		coef[i] = compptr->DCT[i] * quantptr[i];
+
+	/* Pass 1: process columns from input, store into work array. */
+	for (i = 0; i < JIDCT_SIZE; i++) {
+		const int16_t *inptr = coef + i;
+
+		wsptr = workspace + i;
+
+		/* Due to quantization many columns have no AC terms, then each
+		   output is the DC coefficient scaled up by PASS1_BITS */
+		if (!(inptr[JIDCT_SIZE * 1] | inptr[JIDCT_SIZE * 2] |
+		      inptr[JIDCT_SIZE * 3] | inptr[JIDCT_SIZE * 4] |
+		      inptr[JIDCT_SIZE * 5] | inptr[JIDCT_SIZE * 6] |
+		      inptr[JIDCT_SIZE * 7])) {
+			int16_t dcval = sat16(inptr[0] * (1 << PASS1_BITS));
+			int j;
+
+			for (j = 0; j < JIDCT_SIZE; j++)
+				wsptr[JIDCT_SIZE * j] = dcval;
+			continue;
+		}
+
+#define STORE_WS(n, x)	wsptr[JIDCT_SIZE * (n)] = sat16(x)
+		IDCT_1D(inptr, JIDCT_SIZE, 1 << (CONST_BITS - PASS1_BITS - 1),
+			CONST_BITS - PASS1_BITS, STORE_WS);
+#undef STORE_WS
+	}
+
+	/* Pass 2: process rows from work array, store into output array.
+	   Note that we must descale the results by a factor of 8 == 2**3,
+	   and also undo the PASS1_BITS scaling. */
+	wsptr = workspace;
+	outptr = output_buf;
+	for (i = 0; i < JIDCT_SIZE; i++) {
+#define STORE_OUT(n, x)	outptr[n] = range_limit(x)
+		IDCT_1D(wsptr, 1, 1 << (CONST_BITS + PASS1_BITS + 3 - 1),
+			CONST_BITS + PASS1_BITS + 3, STORE_OUT);
+#undef STORE_OUT
+		wsptr += JIDCT_SIZE;
+		outptr += stride;
+	}
+}
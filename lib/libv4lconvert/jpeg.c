@@ -183,9 +183,8 @@ static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
 	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
 
-	uv_buf = v4lconvert_alloc_buffer(width * 16,
-					 &data->convert_pixfmt_buf,
-					 &data->convert_pixfmt_buf_size);
+	uv_buf = v4lconvert_get_buffer(data,
+			V4LCONVERT_CONVERT_PIXFMT_BUF, width * 16);
 	if (!uv_buf)
 		return v4lconvert_oom_error(data);
 
@@ -321,8 +320,20 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			data->cinfo.out_color_space = JCS_EXT_BGR;
 #endif
+		/*
+		 * When the frame gets downscaled afterwards anyway, let
+		 * libjpeg do the scaling as part of the IDCT, this is a lot
+		 * cheaper than decoding the full frame. jpeg_read_header()
+		 * resets the scaling factor, so this is per frame.
+		 */
+		if (data->jpeg_scale > 1) {
+			data->cinfo.scale_num = 1;
+			data->cinfo.scale_denom = data->jpeg_scale;
+		}
 		row_pointer[0] = dest;
 		jpeg_start_decompress(&data->cinfo);
+		width = data->cinfo.output_width;
+		height = data->cinfo.output_height;
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
 		while (data->cinfo.output_scanline < height) {
@@ -334,6 +345,8 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 		if (dest_pix_fmt == V4L2_PIX_FMT_BGR24)
 			v4lconvert_swap_rgb(dest, dest, width, height);
 #endif
+		fmt->fmt.pix.width = width;
+		fmt->fmt.pix.height = height;
 	} else {
 		int h_samp, v_samp;
 		unsigned char *udest, *vdest;
@@ -19,6 +19,7 @@
 #ifndef __LIBV4LCONVERT_PRIV_H
 #define __LIBV4LCONVERT_PRIV_H
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -37,6 +38,11 @@
 
 #define V4LCONVERT_ERROR_MSG_SIZE 256
 #define V4LCONVERT_MAX_FRAMESIZES 256
+#define V4LCONVERT_MAX_THREADS 32
+
+/* The frame hash takes 64 byte stripes, scrambled every 16, see hash.c */
+#define V4LCONVERT_HASH_STRIPE 64
+#define V4LCONVERT_HASH_BLOCK (16 * V4LCONVERT_HASH_STRIPE)
 
 #define V4LCONVERT_ERR(...) \
 	snprintf(data->error_msg, V4LCONVERT_ERROR_MSG_SIZE, \
@@ -45,6 +51,50 @@
 /* Card flags */
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
+#define V4LCONVERT_BAYER_EDGE_AWARE      0x04
+#define V4LCONVERT_USE_HUGEPAGES         0x08
+#define V4LCONVERT_SCALE                 0x10
+#define V4LCONVERT_SKIP_UNCHANGED        0x20
+
+/* CPU features usable by the SIMD code paths, see cpu.c */
+#define V4LCONVERT_CPU_SSE2              0x01
+#define V4LCONVERT_CPU_SSSE3             0x02
+#define V4LCONVERT_CPU_AVX2              0x04
+#define V4LCONVERT_CPU_NEON              0x08
+
+/* Packed yuv 4:2:2 byte orders for the SIMD row converters */
+#define V4LCONVERT_YUV422_YUYV           0
+#define V4LCONVERT_YUV422_YVYU           1
+#define V4LCONVERT_YUV422_UYVY           2
+
+/* The scratch buffers of a v4lconvert_data, see v4lconvert_get_buffer() */
+enum v4lconvert_buf_id {
+	V4LCONVERT_CONVERT1_BUF,
+	V4LCONVERT_CONVERT2_BUF,
+	V4LCONVERT_ROTATE90_BUF,
+	V4LCONVERT_FLIP_BUF,
+	V4LCONVERT_CONVERT_PIXFMT_BUF,
+	V4LCONVERT_PACK_BUF,
+	V4LCONVERT_BUF_COUNT
+};
+
+/* Alignment of the scratch buffers, a cache line and enough for AVX2 */
+#define V4LCONVERT_BUF_ALIGN             64
+
+/* Fixed point Y'CbCr -> R'G'B' matrix for one Y'CbCr encoding and
+   quantization, see v4lconvert_update_yuv_matrix(). The coefficients are
+   3.13 fixed point and each term is computed as ((x - offset) * c) >> 9,
+   giving 1/16th units. So with y = ((Y - y_offset) * cy >> 9) + 8:
+   R = (y + (V - 128) * crv >> 9) >> 4
+   G = (y - (U - 128) * cgu >> 9 - (V - 128) * cgv >> 9) >> 4
+   B = (y + (U - 128) * cbu >> 9) >> 4
+   all clipped to 0 - 255. */
+struct v4lconvert_yuv_matrix {
+	unsigned int ycbcr_enc;
+	unsigned int quantization;
+	int y_offset;
+	int cy, crv, cgu, cgv, cbu;
+};
 
 struct v4lconvert_data {
 	int fd;
@@ -52,6 +102,11 @@ struct v4lconvert_data {
 	int control_flags; /* bitfield */
 	unsigned int no_formats;
 	unsigned long supported_src_formats[128 / BITS_PER_LONG];
+	/* The supported_src_pixfmts indexes of the supported src formats in
+	   the driver's order, for enumerating their framesizes on first use */
+	unsigned char src_fmt_order[128];
+	int no_src_fmt_order;
+	int have_framesizes;
 	char error_msg[V4LCONVERT_ERROR_MSG_SIZE];
 	struct jdec_private *tinyjpeg;
 #ifdef HAVE_JPEG
@@ -60,25 +115,39 @@ struct v4lconvert_data {
 	jmp_buf jerr_jmp_state;
 	struct jpeg_decompress_struct cinfo;
 	int cinfo_initialized;
+	/* Decode the next libjpeg frame at 1 / jpeg_scale of its size */
+	int jpeg_scale;
 #endif // HAVE_JPEG
 	struct v4l2_frmsizeenum framesizes[V4LCONVERT_MAX_FRAMESIZES];
 	/* Bitmask of all supported src_formats which can do for a size */
-	int64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES];
+	unsigned long framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES]
+					      [128 / BITS_PER_LONG];
 	unsigned int no_framesizes;
 	int bandwidth;
 	int fps;
-	int convert1_buf_size;
-	int convert2_buf_size;
-	int rotate90_buf_size;
-	int flip_buf_size;
-	int convert_pixfmt_buf_size;
-	unsigned char *convert1_buf;
-	unsigned char *convert2_buf;
-	unsigned char *rotate90_buf;
-	unsigned char *flip_buf;
-	unsigned char *convert_pixfmt_buf;
+	/* The scratch buffers are slots of one arena, sized by try_format */
+	unsigned char *arena;
+	size_t arena_size;
+	int arena_slot_size;
+	int arena_mmapped;
+	unsigned char *buf[V4LCONVERT_BUF_COUNT];
+	int buf_size[V4LCONVERT_BUF_COUNT];
+	/* Bitmask of the buffers which did not fit in their arena slot */
+	unsigned int buf_allocated;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
+	struct v4lconvert_pool *pool;
+	struct v4lconvert_m2m *m2m;
+	struct v4lconvert_scaler *scaler;
+#ifdef HAVE_EGL
+	struct v4lconvert_egl *egl;
+#endif
+	struct v4lconvert_yuv_matrix yuv_matrix;
+	/* Serializes the use of processing by the instance and its contexts,
+	   see v4lconvert_convert_ctx() */
+	pthread_mutex_t processing_lock;
+	int stats_enabled;
+	struct v4lconvert_stats stats;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
 
@@ -92,55 +161,272 @@ struct v4lconvert_data {
 
 	/* For cpia1 decoder */
 	unsigned char *previous_frame;
+
+	/* The last converted frame and its key for V4LCONVERT_SKIP_UNCHANGED,
+	   see v4lconvert_convert() */
+	unsigned char *last_frame;
+	int last_frame_alloc;
+	int last_frame_size;
+	uint64_t last_hash;
+	struct v4l2_pix_format last_src_pix;
+	struct v4l2_pix_format last_dest_pix;
+	int last_flips;
+	int frame_unchanged;
+};
+
+/* The instance of a context is only used for its shared state, the
+   conversions use data, see v4lconvert_ctx_create() */
+struct v4lconvert_ctx {
+	struct v4lconvert_data *parent;
+	struct v4lconvert_data data;
 };
 
+/* Convert band number band of bands, see threads.c */
+typedef void (*v4lconvert_band_func)(void *arg, int band, int bands);
+
 struct v4lconvert_pixfmt {
 	unsigned int fmt;	/* v4l2 fourcc */
 	int bpp;		/* bits per pixel, 0 for compressed formats */
-	int rgb_rank;		/* rank for converting to rgb32 / bgr32 */
-	int yuv_rank;		/* rank for converting to yuv420 / yvu420 */
+	int rgb_cost;		/* cost of converting to rgb24 / bgr24 */
+	int yuv_cost;		/* cost of converting to yuv420 / yvu420 */
 	int needs_conversion;
 };
 
+/* A plane of tiles of tile_width bytes x tile_height lines in raster order,
+   stride bytes per line of tiles, see detile.c */
+struct v4lconvert_tiling {
+	int tile_width;
+	int tile_height;
+	int stride;
+};
+
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size);
 
+unsigned char *v4lconvert_get_buffer(struct v4lconvert_data *data,
+		enum v4lconvert_buf_id id, int needed);
+
 int v4lconvert_oom_error(struct v4lconvert_data *data);
 
+unsigned int v4lconvert_get_cpu_flags(void);
+
+struct v4lconvert_pool *v4lconvert_pool_create(int threads);
+
+void v4lconvert_pool_destroy(struct v4lconvert_pool *pool);
+
+int v4lconvert_pool_threads(struct v4lconvert_pool *pool);
+
+void v4lconvert_pool_run(struct v4lconvert_pool *pool,
+		v4lconvert_band_func func, void *arg, int bands);
+
+struct v4lconvert_m2m *v4lconvert_m2m_create(const char *devname);
+
+void v4lconvert_m2m_destroy(struct v4lconvert_m2m *m2m);
+
+/* Returns 1 if the mem2mem device did the conversion, 0 if it could not */
+int v4lconvert_m2m_convert(struct v4lconvert_m2m *m2m,
+		unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size,
+		const struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+
+#ifdef HAVE_EGL
+struct v4lconvert_egl *v4lconvert_egl_create(void);
+
+void v4lconvert_egl_destroy(struct v4lconvert_egl *egl);
+
+/* Returns 1 if the frame was converted with EGL, 0 if it could not */
+int v4lconvert_egl_convert(struct v4lconvert_egl *egl,
+		const unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size,
+		const struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+#endif
+
+/* The SIMD row converters return the number of pixels converted, which may
+   be less than width (or 0 if no SIMD support is available), the caller
+   must convert the remaining pixels itself */
+int v4lconvert_simd_yuv422_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+int v4lconvert_simd_yuv420_to_rgb24_row(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+int v4lconvert_simd_yuv422_to_y_row(const unsigned char *src,
+		unsigned char *dest, int width, int layout);
+
+int v4lconvert_simd_yuv422_to_uv_row(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int layout);
+
+/* Semi planar, uvsrc is the interleaved chroma line, vu is set when V
+   comes first (NV21 / NV61) */
+int v4lconvert_simd_nv_to_rgb24_row(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m);
+
+/* Split (the average of) 2 interleaved chroma lines into U and V, src1 may
+   be src0 */
+int v4lconvert_simd_nv_to_uv_row(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width);
+
+/* The 8 msb of Y10BPACK samples, src must be at a multiple of 4 pixels */
+int v4lconvert_simd_y10b_to_8_row(const unsigned char *src,
+		unsigned char *dest, int width);
+
+/* The bgr flag swaps r and b, which for rgb32 includes the 32 bit BGR
+   formats. rgb32 src may point to the byte after a leading alpha byte. */
+int v4lconvert_simd_rgb565_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int bgr);
+
+int v4lconvert_simd_rgb565_to_y_row(const unsigned char *src,
+		unsigned char *dest, int width);
+
+int v4lconvert_simd_rgb565_to_uv_row(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width);
+
+int v4lconvert_simd_rgb32_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int bgr);
+
+int v4lconvert_simd_grey_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width);
+
+/* The msb of Y16 samples */
+int v4lconvert_simd_y16_to_8_row(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian);
+
+int v4lconvert_simd_y16_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian);
+
+/* src points to the first pixel including any leading pad byte of the 4
+   bytes per pixel format */
+int v4lconvert_simd_hsv_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int bpp, int bgr, int hsv_enc);
+
+/* The bayer row kernels count in pixel pairs, see bayer-simd.c */
+int v4lconvert_simd_bayer_to_rgb24_row(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware);
+
+int v4lconvert_simd_bayer_to_y_row(const unsigned char *bayer,
+		unsigned int stride, unsigned char *dest, int pairs,
+		int blue_line, int edge_aware);
+
+int v4lconvert_simd_bayer16_to_bayer8_row(const uint16_t *src,
+		unsigned char *dest, int width, int shift);
+
+/* The 8 msb of 10 bit packed (MIPI RAW10) samples */
+int v4lconvert_simd_raw10_to_8_row(const unsigned char *src,
+		unsigned char *dest, int width);
+
+/* Transpose a tile of 16x16 pixels for bpp 1, or 8x8 pixels for bpp 3 (the
+   strides may be negative), returns 0 if the caller must do it */
+int v4lconvert_simd_transpose_tile(const unsigned char *src, int src_stride,
+		unsigned char *dst, int dst_stride, int bpp);
+
+/* Mirror a line of 8 (bpp 1) or 24 (bpp 3) bit pixels */
+int v4lconvert_simd_hflip_row(const unsigned char *src, unsigned char *dest,
+		int width, int bpp);
+
+/* Dequantize and inverse DCT one 8x8 block of coefficients (natural order)
+   into 8 lines of out, returns 0 if the caller must do it, see jidctint.c */
+int v4lconvert_simd_idct_islow(const int16_t *coef, const int16_t *quant,
+		uint8_t *out, int stride);
+
+/* One line of the vertical pass of the scaler, the weighted sum of taps
+   lines with 4 fractional bits, see scale-simd.c */
+int v4lconvert_simd_scale_vert_row(const unsigned char *const *rows,
+		const int16_t *weights, int taps, uint16_t *dest, int width);
+
+/* Gather a line of width bytes from tiles tile_size bytes apart, see
+   detile-simd.c */
+int v4lconvert_simd_detile_row(const unsigned char *src, int tile_size,
+		unsigned char *dest, int width, int tile_width);
+
+/* Likewise splitting width interleaved chroma pairs into U and V */
+int v4lconvert_simd_detile_uv_row(const unsigned char *src, int tile_size,
+		unsigned char *udest, unsigned char *vdest, int width,
+		int tile_width);
+
+/* Feed the whole V4LCONVERT_HASH_BLOCK blocks of src to the 8 hash
+   accumulators, returns the number of bytes done, see hash-simd.c */
+int v4lconvert_simd_hash_blocks(uint64_t *acc, const unsigned char *src,
+		int size);
+
+/* Pad 24 bit pixels with an opaque alpha byte */
+int v4lconvert_simd_rgb24_to_rgb32_row(const unsigned char *src,
+		unsigned char *dest, int width);
+
+/* Interleave width U and V samples (NV12 chroma) */
+int v4lconvert_simd_uv_to_nv_row(const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int width);
+
+int v4lconvert_simd_yuv420_to_yuyv_row(const unsigned char *y,
+		const unsigned char *u, const unsigned char *v,
+		unsigned char *dest, int width);
+
+const struct v4lconvert_yuv_matrix *v4lconvert_update_yuv_matrix(
+		struct v4lconvert_yuv_matrix *m, const struct v4l2_format *fmt);
+
 void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp);
 
 void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride, int yvu);
+		int width, int height, int stride, int yvu,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride, int yvu);
+		int width, int height, int stride, int yvu,
+		const struct v4lconvert_yuv_matrix *m);
+
+/* Convert one line of planar 4:2:0 or 4:2:2 Y'CbCr, for decoders which
+   produce the planes a few lines at a time (tinyjpeg) */
+void v4lconvert_yuv420_to_rgbbgr24_row(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dst, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+/* Convert one line of packed 4:2:2 Y'CbCr (layout is one of
+   V4LCONVERT_YUV422_*) resp. of semi planar Y'CbCr with chroma line uv */
+void v4lconvert_yuv422_to_rgbbgr24_row(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+void v4lconvert_nv_to_rgbbgr24_row(const unsigned char *ysrc,
+		const unsigned char *uv, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride, int yvu);
 
-void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride);
-
 void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_yvyu_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dst,
-		int width, int height, int stride);
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride, int yvu);
@@ -166,11 +452,17 @@ void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
 void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr);
 
-int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
-	const unsigned char *src, unsigned char *dest, int width, int height);
+void v4lconvert_y10b_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height);
+
+void v4lconvert_y10b_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height);
+
+void v4lconvert_y10p_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride);
 
-int v4lconvert_y10b_to_yuv420(struct v4lconvert_data *data,
-	const unsigned char *src, unsigned char *dest, int width, int height);
+void v4lconvert_y10p_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride);
 
 void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride);
@@ -227,8 +519,8 @@ int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 void v4lconvert_decode_spca561(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_decode_sn9c10x(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c10x(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 int v4lconvert_decode_pac207(struct v4lconvert_data *data,
 		const unsigned char *inp, int src_size, unsigned char *outp,
@@ -242,8 +534,8 @@ int v4lconvert_decode_jl2005bcd(struct v4lconvert_data *data,
 		const unsigned char *src, int src_size,
 		unsigned char *dest, int width, int height);
 
-void v4lconvert_decode_sn9c2028(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c2028(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 		int width, int height);
@@ -252,41 +544,71 @@ void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
 void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+		unsigned char *rgb, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int edge_aware);
 
 void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+		unsigned char *rgb, int width, int height, const unsigned int stride,
+		unsigned int pixfmt, int edge_aware);
 
 void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt,
+		int yvu, int edge_aware);
 
-void v4lconvert_bayer10_to_bayer8(void *bayer10,
-		unsigned char *bayer8, int width, int height);
+/* Lines at a time v4lconvert_bayer_deep_convert unpacks to 8 bit, its scratch
+   buffer must hold V4LCONVERT_BAYER_BAND_LINES + 2 lines of width bytes */
+#define V4LCONVERT_BAYER_BAND_LINES 32
 
-void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
-		unsigned char *bayer8, int width, int height);
+int v4lconvert_bayer_deep_line_size(unsigned int pixfmt, int width);
 
-void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
-		unsigned char *bayer8, int width, int height);
+void v4lconvert_bayer_deep_convert(const unsigned char *src,
+		unsigned char *scratch, unsigned char *dest, int width,
+		int height, const unsigned int stride, unsigned int src_pixfmt,
+		unsigned int dest_pixfmt, int edge_aware);
 
-void v4lconvert_nv12_16l16_to_rgb24(const unsigned char *src,
-		unsigned char *dst, int width, int height);
+/* Unpack a line of 10 bit packed (MIPI RAW10) samples to their 8 msb */
+void v4lconvert_raw10_line_to_8bit(const unsigned char *src,
+		unsigned char *dest, int width);
 
-void v4lconvert_nv12_16l16_to_bgr24(const unsigned char *src,
-		unsigned char *dst, int width, int height);
+/* Returns -1 if the frame is too short */
+int v4lconvert_nv12_16l16_to_yuv420(const unsigned char *src, int src_size,
+		unsigned char *dest, int width, int height, int yvu);
 
-void v4lconvert_nv12_16l16_to_yuv420(const unsigned char *src,
-		unsigned char *dst, int width, int height, int yvu);
+/* Detile a tiled NV12 frame with the chroma plane at uv_offset, see
+   detile.c */
+void v4lconvert_tiled_nv12_to_yuv420(const unsigned char *src,
+		unsigned char *dest, int width, int height,
+		const struct v4lconvert_tiling *t, int uv_offset, int yvu);
+
+/* Returns -1 if the stride is invalid or the frame is too short */
+int v4lconvert_nv12_32l32_to_yuv420(const unsigned char *src, int src_size,
+		unsigned char *dest, int width, int height, int stride, int yvu);
 
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr, int Xin, unsigned char hsv_enc);
 
 void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int bgr);
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+void v4lconvert_nv21_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+void v4lconvert_nv16_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
+
+void v4lconvert_nv61_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m);
 
 void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride, int yvu);
 
+void v4lconvert_nv16_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu);
+
 void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt);
 
@@ -296,6 +618,35 @@ void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 void v4lconvert_crop(unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt);
 
+/* Scale src to the size of dest_fmt, returns -1 if out of memory */
+int v4lconvert_scale(struct v4lconvert_data *data, unsigned char *src,
+		unsigned char *dest, const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt);
+
+void v4lconvert_scaler_destroy(struct v4lconvert_scaler *scaler);
+
+/* The format to convert to before packing into dest_pix_fmt, 0 if
+   dest_pix_fmt does not need packing, see pack.c */
+unsigned int v4lconvert_pack_work_format(unsigned int dest_pix_fmt);
+
+/* Convert src straight into a packed destination format, returns 1 if done
+   and 0 if this combination of formats has no direct converter */
+int v4lconvert_pack_direct(struct v4lconvert_data *data,
+		const unsigned char *src, int src_size, unsigned char *dest,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt);
+
+/* Pack src in the work format fmt into dest, src may be dest for RGBA32,
+   ABGR32 and NV12, returns -1 if out of memory */
+int v4lconvert_pack(struct v4lconvert_data *data, const unsigned char *src,
+		unsigned char *dest, const struct v4l2_format *fmt,
+		unsigned int dest_pix_fmt);
+
+/* 64 bit hash of size bytes of src, see hash.c */
+uint64_t v4lconvert_hash(const unsigned char *src, int size);
+
+extern const uint64_t v4lconvert_hash_key[8];
+
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int command);
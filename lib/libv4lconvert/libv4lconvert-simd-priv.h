@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Helpers shared by the SIMD conversion kernels (rgbyuv-simd.c,
+ * bayer-simd.c).
+ */
+
+#ifndef __LIBV4LCONVERT_SIMD_PRIV_H
+#define __LIBV4LCONVERT_SIMD_PRIV_H
+
+#include "libv4lconvert-priv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define V4LCONVERT_SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define V4LCONVERT_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+
+#define SSE2  __attribute__((target("sse2")))
+#define SSSE3 __attribute__((target("ssse3")))
+#define AVX2  __attribute__((target("avx2")))
+
+/* Interleave 16 pixels worth of 3 planes into packed 24 bit pixels */
+static inline SSE2 void store_rgb24_sse2(unsigned char *dest,
+		__m128i r, __m128i g, __m128i b)
+{
+	unsigned char rb[16], gb[16], bb[16];
+	int i;
+
+	_mm_storeu_si128((__m128i *)rb, r);
+	_mm_storeu_si128((__m128i *)gb, g);
+	_mm_storeu_si128((__m128i *)bb, b);
+
+	for (i = 0; i < 16; i++) {
+		*dest++ = rb[i];
+		*dest++ = gb[i];
+		*dest++ = bb[i];
+	}
+}
+
+static inline SSSE3 void store_rgb24_ssse3(unsigned char *dest,
+		__m128i r, __m128i g, __m128i b)
+{
+	const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+	const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+	const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+	const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+	const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+	const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+	const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+	const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+	const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+	__m128i *d = (__m128i *)dest;
+
+	_mm_storeu_si128(d, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r0),
+			_mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(b, b0)));
+	_mm_storeu_si128(d + 1, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r1),
+			_mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(b, b1)));
+	_mm_storeu_si128(d + 2, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r2),
+			_mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(b, b2)));
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#endif
@@ -20,16 +20,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include "libv4lconvert.h"
 #include "libv4lconvert-priv.h"
 #include "libv4lsyscall-priv.h"
+#include "libv4l-probes.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
 #define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
 
+V4L_PROBE_SEMAPHORE(libv4lconvert, convert_entry);
+V4L_PROBE_SEMAPHORE(libv4lconvert, convert_return);
+V4L_PROBE_SEMAPHORE(libv4lconvert, stage);
+
 static inline void set_bit(int nr, volatile unsigned long *addr)
 {
 	unsigned long mask = BIT_MASK(nr);
@@ -89,8 +96,10 @@ const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops()
 	return &default_dev_ops;
 }
 
-static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
-		unsigned int pixelformat, int index);
+static void v4lconvert_get_all_framesizes(struct v4lconvert_data *data);
+static int v4lconvert_processing_needs_double_conversion(
+		unsigned int src_pix_fmt, unsigned int dest_pix_fmt);
+static void v4lconvert_free_buffers(struct v4lconvert_data *data);
 
 /*
  * Notes:
@@ -100,91 +109,108 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
  * 2) The field needs_conversion should be zero, *except* for device-specific
  *    formats, where it doesn't make sense for applications to have their
  *    own decoders.
+ * 3) The rgb and yuv costs are the CPU cost per pixel of converting to
+ *    rgb24 / bgr24 resp. yuv420 / yvu420, in units of 0.1 ns. These were
+ *    measured with the plain C code at 1280x720 on x86-64 for the common
+ *    formats, and estimated for the device-specific ones.
+ *    See v4lconvert_get_cost().
  */
+
+/* Grey scale formats are never autoselected, unless they are the only choice */
+#define GREY_COST 1000
+
 #define SUPPORTED_DST_PIXFMTS \
 	/* fourcc			bpp	rgb	yuv	needs      */ \
-	/*					rank	rank	conversion */ \
-	{ V4L2_PIX_FMT_RGB24,		24,	 1,	 5,	0 }, \
-	{ V4L2_PIX_FMT_BGR24,		24,	 1,	 5,	0 }, \
-	{ V4L2_PIX_FMT_YUV420,		12,	 6,	 1,	0 }, \
-	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }
+	/*					cost	cost	conversion */ \
+	{ V4L2_PIX_FMT_RGB24,		24,	 13,	 44,	0 }, \
+	{ V4L2_PIX_FMT_BGR24,		24,	 13,	 44,	0 }, \
+	{ V4L2_PIX_FMT_YUV420,		12,	 67,	  2,	0 }, \
+	{ V4L2_PIX_FMT_YVU420,		12,	 67,	  2,	0 }, \
+	{ V4L2_PIX_FMT_NV12,		12,	 63,	 12,	1 }, \
+	{ V4L2_PIX_FMT_YUYV,		16,	 64,	 11,	0 }, \
+	{ V4L2_PIX_FMT_RGBA32,		32,	  9,	 26,	0 }, \
+	{ V4L2_PIX_FMT_ABGR32,		32,	  9,	 26,	0 }
 
 static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	SUPPORTED_DST_PIXFMTS,
 	/* packed rgb formats */
-	{ V4L2_PIX_FMT_RGB565,		16,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_BGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_RGB32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_ABGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	0 },
+	{ V4L2_PIX_FMT_RGB565,		16,	 16,	 36,	0 },
+	{ V4L2_PIX_FMT_BGR32,		32,	  9,	 26,	0 },
+	{ V4L2_PIX_FMT_RGB32,		32,	  9,	 26,	0 },
+	{ V4L2_PIX_FMT_XBGR32,		32,	  9,	 26,	0 },
+	{ V4L2_PIX_FMT_XRGB32,		32,	  9,	 26,	0 },
+	{ V4L2_PIX_FMT_ARGB32,		32,	  9,	 26,	0 },
 	/* yuv 4:2:2 formats */
-	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_YVYU,		16,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_UYVY,		16,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_NV16,		16,	 5,	 4,	1 },
-	{ V4L2_PIX_FMT_NV61,		16,	 5,	 4,	1 },
+	{ V4L2_PIX_FMT_YVYU,		16,	 64,	 11,	0 },
+	{ V4L2_PIX_FMT_UYVY,		16,	 64,	 11,	0 },
+	{ V4L2_PIX_FMT_NV16,		16,	 64,	 12,	1 },
+	{ V4L2_PIX_FMT_NV61,		16,	 64,	 12,	1 },
 	/* yuv 4:2:0 formats */
-	{ V4L2_PIX_FMT_SPCA501,		12,      6,	 3,	1 },
-	{ V4L2_PIX_FMT_SPCA505,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_SPCA508,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_CIT_YYVYUY,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_KONICA420,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_SN9C20X_I420,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_M420,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_NV12_16L16,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_CPIA1,		 0,	 6,	 3,	1 },
+	{ V4L2_PIX_FMT_SPCA501,		12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_SPCA505,		12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_SPCA508,		12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_KONICA420,	12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_M420,		12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_NV12_16L16,	12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_NV12_32L32,	12,	 66,	 14,	1 },
+	{ V4L2_PIX_FMT_NV21,		12,	 63,	 12,	1 },
+	{ V4L2_PIX_FMT_CPIA1,		 0,	 90,	 30,	1 },
 	/* JPEG and variants */
-	{ V4L2_PIX_FMT_MJPEG,		 0,	 7,	 7,	0 },
-	{ V4L2_PIX_FMT_JPEG,		 0,	 7,	 7,	0 },
-	{ V4L2_PIX_FMT_PJPG,		 0,	 7,	 7,	1 },
-	{ V4L2_PIX_FMT_JPGL,		 0,	 7,	 7,	1 },
+	{ V4L2_PIX_FMT_MJPEG,		 0,	 79,	 59,	0 },
+	{ V4L2_PIX_FMT_JPEG,		 0,	 79,	 59,	0 },
+	{ V4L2_PIX_FMT_PJPG,		 0,	 85,	 65,	1 },
+	{ V4L2_PIX_FMT_JPGL,		 0,	 90,	 70,	1 },
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
-	{ V4L2_PIX_FMT_OV511,		 0,	 7,	 7,	1 },
-	{ V4L2_PIX_FMT_OV518,		 0,	 7,	 7,	1 },
+	{ V4L2_PIX_FMT_OV511,		 0,	150,	150,	1 },
+	{ V4L2_PIX_FMT_OV518,		 0,	150,	150,	1 },
 #endif
 	/* uncompressed bayer */
-	{ V4L2_PIX_FMT_SBGGR8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_SGBRG8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_SGRBG8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_SRGGB8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_STV0680,		 8,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SBGGR10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGBRG10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGRBG10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SRGGB10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SBGGR10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGBRG10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGRBG10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SRGGB10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SBGGR16,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGBRG16,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGRBG16,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SRGGB16,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR8,		 8,	 17,	 27,	0 },
+	{ V4L2_PIX_FMT_SGBRG8,		 8,	 17,	 27,	0 },
+	{ V4L2_PIX_FMT_SGRBG8,		 8,	 17,	 27,	0 },
+	{ V4L2_PIX_FMT_SRGGB8,		 8,	 17,	 27,	0 },
+	{ V4L2_PIX_FMT_STV0680,		 8,	 20,	 30,	1 },
+	{ V4L2_PIX_FMT_SBGGR10P,	10,	 19,	 29,	1 },
+	{ V4L2_PIX_FMT_SGBRG10P,	10,	 19,	 29,	1 },
+	{ V4L2_PIX_FMT_SGRBG10P,	10,	 19,	 29,	1 },
+	{ V4L2_PIX_FMT_SRGGB10P,	10,	 19,	 29,	1 },
+	{ V4L2_PIX_FMT_SBGGR10,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SGBRG10,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SGRBG10,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SRGGB10,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SBGGR12,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SGBRG12,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SGRBG12,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SRGGB12,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SBGGR16,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SGBRG16,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SGRBG16,		16,	 23,	 38,	1 },
+	{ V4L2_PIX_FMT_SRGGB16,		16,	 23,	 38,	1 },
 	/* compressed bayer */
-	{ V4L2_PIX_FMT_SPCA561,		 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_SN9C10X,		 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_SN9C2028,	 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_PAC207,		 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_MR97310A,	 0,	 9,	 9,	1 },
+	{ V4L2_PIX_FMT_SPCA561,		 0,	 60,	 70,	1 },
+	{ V4L2_PIX_FMT_SN9C10X,		 0,	 60,	 70,	1 },
+	{ V4L2_PIX_FMT_SN9C2028,	 0,	 60,	 70,	1 },
+	{ V4L2_PIX_FMT_PAC207,		 0,	 60,	 70,	1 },
+	{ V4L2_PIX_FMT_MR97310A,	 0,	 60,	 70,	1 },
 #ifdef HAVE_JPEG
-	{ V4L2_PIX_FMT_JL2005BCD,	 0,	 9,	 9,	1 },
+	{ V4L2_PIX_FMT_JL2005BCD,	 0,	 60,	 70,	1 },
 #endif
-	{ V4L2_PIX_FMT_SQ905C,		 0,	 9,	 9,	1 },
+	{ V4L2_PIX_FMT_SQ905C,		 0,	 60,	 70,	1 },
 	/* special */
-	{ V4L2_PIX_FMT_SE401,		 0,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SE401,		 0,	 40,	 50,	1 },
 	/* grey formats */
-	{ V4L2_PIX_FMT_GREY,		 8,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y4,		 8,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y6,		 8,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y10BPACK,	10,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y16,		16,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y16_BE,		16,	20,	20,	0 },
+	{ V4L2_PIX_FMT_GREY,		 8,	16 + GREY_COST,	33 + GREY_COST,	0 },
+	{ V4L2_PIX_FMT_Y4,		 8,	16 + GREY_COST,	33 + GREY_COST,	0 },
+	{ V4L2_PIX_FMT_Y6,		 8,	16 + GREY_COST,	33 + GREY_COST,	0 },
+	{ V4L2_PIX_FMT_Y10BPACK,	10,	20 + GREY_COST,	36 + GREY_COST,	0 },
+	{ V4L2_PIX_FMT_Y10P,		10,	20 + GREY_COST,	36 + GREY_COST,	0 },
+	{ V4L2_PIX_FMT_Y16,		16,	18 + GREY_COST,	35 + GREY_COST,	0 },
+	{ V4L2_PIX_FMT_Y16_BE,		16,	18 + GREY_COST,	35 + GREY_COST,	0 },
 	/* hsv formats */
-	{ V4L2_PIX_FMT_HSV32,		32,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_HSV24,		24,	 5,	 4,	0 },
+	{ V4L2_PIX_FMT_HSV32,		32,	247,	288,	0 },
+	{ V4L2_PIX_FMT_HSV24,		24,	247,	288,	0 },
 };
 
 static const struct v4lconvert_pixfmt supported_dst_pixfmts[] = {
@@ -215,6 +241,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	int i, j;
 	struct v4lconvert_data *data = calloc(1, sizeof(struct v4lconvert_data));
 	struct v4l2_capability cap;
+	char *s;
 	/*
 	 * This keeps tracks of device-specific formats for which apps most
 	 * likely don't know. If all a driver can offer are proprietary
@@ -234,6 +261,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->dev_ops_priv = dev_ops_priv;
 	data->decompress_pid = -1;
 	data->fps = 30;
+	pthread_mutex_init(&data->processing_lock, NULL);
 
 	/* Check supported formats */
 	for (i = 0; ; i++) {
@@ -250,8 +278,9 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 				break;
 
 		if (j < ARRAY_SIZE(supported_src_pixfmts)) {
+			if (!test_bit(j, data->supported_src_formats))
+				data->src_fmt_order[data->no_src_fmt_order++] = j;
 			set_bit(j, data->supported_src_formats);
-			v4lconvert_get_framesizes(data, fmt.pixelformat, j);
 			if (!supported_src_pixfmts[j].needs_conversion)
 				always_needs_conversion = 0;
 		} else
@@ -275,6 +304,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->control = v4lcontrol_create(fd, dev_ops_priv, dev_ops,
 						always_needs_conversion);
 	if (!data->control) {
+		pthread_mutex_destroy(&data->processing_lock);
 		free(data);
 		return NULL;
 	}
@@ -286,20 +316,43 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->processing = v4lprocessing_create(fd, data->control);
 	if (!data->processing) {
 		v4lcontrol_destroy(data->control);
+		pthread_mutex_destroy(&data->processing_lock);
 		free(data);
 		return NULL;
 	}
 
+	if (getenv("LIBV4LCONVERT_BAYER_EDGE_AWARE"))
+		data->flags |= V4LCONVERT_BAYER_EDGE_AWARE;
+
+	if (getenv("LIBV4LCONVERT_HUGEPAGES"))
+		data->flags |= V4LCONVERT_USE_HUGEPAGES;
+
+	if (getenv("LIBV4LCONVERT_SCALE"))
+		data->flags |= V4LCONVERT_SCALE;
+
+	if (getenv("LIBV4LCONVERT_SKIP_UNCHANGED"))
+		data->flags |= V4LCONVERT_SKIP_UNCHANGED;
+
+	s = getenv("LIBV4LCONVERT_M2M");
+	if (s)
+		data->m2m = v4lconvert_m2m_create(s);
+
+#ifdef HAVE_EGL
+	if (getenv("LIBV4LCONVERT_EGL"))
+		data->egl = v4lconvert_egl_create();
+#endif
+
+	s = getenv("LIBV4LCONVERT_THREADS");
+	if (s && v4lconvert_set_threads(data, strtol(s, NULL, 0)))
+		fprintf(stderr, "libv4lconvert: warning: could not start %s conversion threads\n", s);
+
 	return data;
 }
 
-void v4lconvert_destroy(struct v4lconvert_data *data)
+/* Frees the state which an instance and each of its contexts have */
+static void v4lconvert_free_scratch(struct v4lconvert_data *data)
 {
-	if (!data)
-		return;
-
-	v4lprocessing_destroy(data->processing);
-	v4lcontrol_destroy(data->control);
+	v4lconvert_scaler_destroy(data->scaler);
 	if (data->tinyjpeg) {
 		unsigned char *comps[3] = { NULL, NULL, NULL };
 
@@ -313,15 +366,65 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
 	v4lconvert_helper_cleanup(data);
 #endif
-	free(data->convert1_buf);
-	free(data->convert2_buf);
-	free(data->rotate90_buf);
-	free(data->flip_buf);
-	free(data->convert_pixfmt_buf);
+	v4lconvert_free_buffers(data);
 	free(data->previous_frame);
+	free(data->last_frame);
+}
+
+void v4lconvert_destroy(struct v4lconvert_data *data)
+{
+	if (!data)
+		return;
+
+	v4lconvert_pool_destroy(data->pool);
+	v4lconvert_m2m_destroy(data->m2m);
+#ifdef HAVE_EGL
+	v4lconvert_egl_destroy(data->egl);
+#endif
+	v4lprocessing_destroy(data->processing);
+	v4lcontrol_destroy(data->control);
+	v4lconvert_free_scratch(data);
+	pthread_mutex_destroy(&data->processing_lock);
 	free(data);
 }
 
+/*
+ * A context starts out with the device state of its instance, the
+ * conversion state (buffers, decoders, the cache of the previous frame)
+ * gets created on demand by the conversions, just like for the instance.
+ */
+struct v4lconvert_ctx *v4lconvert_ctx_create(struct v4lconvert_data *data)
+{
+	struct v4lconvert_ctx *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ctx->parent = data;
+	ctx->data.fd = data->fd;
+	ctx->data.flags = data->flags;
+	ctx->data.control_flags = data->control_flags;
+	ctx->data.bandwidth = data->bandwidth;
+	ctx->data.fps = data->fps;
+	ctx->data.control = data->control;
+	ctx->data.dev_ops = data->dev_ops;
+	ctx->data.dev_ops_priv = data->dev_ops_priv;
+	ctx->data.decompress_pid = -1;
+
+	return ctx;
+}
+
+void v4lconvert_ctx_destroy(struct v4lconvert_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	v4lconvert_free_scratch(&ctx->data);
+	free(ctx);
+}
+
 int v4lconvert_supported_dst_format(unsigned int pixelformat)
 {
 	int i;
@@ -333,6 +436,24 @@ int v4lconvert_supported_dst_format(unsigned int pixelformat)
 	return i != ARRAY_SIZE(supported_dst_pixfmts);
 }
 
+int v4lconvert_passthrough_format(struct v4lconvert_data *data,
+		unsigned int pixelformat)
+{
+	int i;
+
+	/* Only the destination formats which are converted to through pack.c
+	   are common device formats too, see v4lconvert_pack_work_format() */
+	if (!v4lconvert_pack_work_format(pixelformat) ||
+	    v4lcontrol_needs_conversion(data->control))
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(supported_dst_pixfmts); i++)
+		if (supported_dst_pixfmts[i].fmt == pixelformat)
+			return test_bit(i, data->supported_src_formats);
+
+	return 0;
+}
+
 int v4lconvert_supported_dst_fmt_only(struct v4lconvert_data *data)
 {
 	int i;
@@ -387,56 +508,78 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
 	return 0;
 }
 
-/* This function returns a value to rank (sort) source format by preference
-   when multiple source formats are available for a certain resolution, the
-   source format for which this function returns the lowest value wins.
-   
-   This function uses the rgb_rank resp. yuv_rank values as a base when
-   converting to rgb32 resp. yuv420. The initial ranks range from 1 - 10,
-   the initial rank purely expresses the CPU cost of doing the conversion, the
-   ranking algorithm will give a penalty of 10 points if
+/* Cost per pixel of a plain copy, and of the video processing (applying the
+   lookup tables) on bayer resp. rgb24 / bgr24 data, see supported_src_pixfmts */
+#define COPY_COST		3
+#define PROCESSING_BAYER_COST	3
+#define PROCESSING_RGB_COST	9
+/* Penalty per pixel for source formats which exceed the available bandwidth */
+#define BANDWIDTH_COST		500
+
+/* This function returns the estimated CPU cost of getting a frame of
+   src_width x src_height in dest_pixelformat from the source format, used
+   to pick the cheapest source format when multiple source formats are
+   available for a certain resolution.
+
+   The cost is the sum of the costs of all steps v4lconvert_convert() will
+   do: the conversion to the destination format, and when video processing
+   (whitebalance, etc.) is active, the processing itself and the extra
+   conversion to rgb24 and back when the processing can not be done on
+   either the source or the destination format.
+
+   A source format which causes the bandwidth to be exceeded, that is
    (width * height * fps * bpp / 8) > bandwidth
-   thus disqualifying a src format which causes the bandwidth to be exceeded,
-   except when all of them cause this.
-   
-   Note grey scale formats start at 20 rather than 1-10, because we want to
-   never autoselect them, unless they are the only choice */
-static int v4lconvert_get_rank(struct v4lconvert_data *data,
+   gets a penalty larger than the cost of any conversion, thus disqualifying
+   it, except when all of them cause this. */
+static uint64_t v4lconvert_get_cost(struct v4lconvert_data *data,
 	int src_index, int src_width, int src_height,
 	unsigned int dest_pixelformat)
 {
-	int needed, rank = 0;
-
-	switch (dest_pixelformat) {
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		rank = supported_src_pixfmts[src_index].rgb_rank;
-		break;
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-		rank = supported_src_pixfmts[src_index].yuv_rank;
-		break;
+	const struct v4lconvert_pixfmt *src = &supported_src_pixfmts[src_index];
+	/* Packing costs little compared to the conversion to the work format */
+	unsigned int work_pixelformat =
+		v4lconvert_pack_work_format(dest_pixelformat);
+	int needed, cost = 0;
+	int rgb;
+
+	if (!work_pixelformat)
+		work_pixelformat = dest_pixelformat;
+	rgb = work_pixelformat == V4L2_PIX_FMT_RGB24 ||
+	      work_pixelformat == V4L2_PIX_FMT_BGR24;
+
+	if (src->fmt == dest_pixelformat)
+		cost = COPY_COST;
+	else
+		cost = rgb ? src->rgb_cost : src->yuv_cost;
+
+	if (v4lprocessing_active(data->processing)) {
+		if (v4lconvert_processing_needs_double_conversion(src->fmt,
+							work_pixelformat))
+			/* src -> rgb24 -> processing -> yuv420 */
+			cost = src->rgb_cost + PROCESSING_RGB_COST +
+			       supported_src_pixfmts[0].yuv_cost;
+		else if (src->fmt != V4L2_PIX_FMT_RGB24 &&
+			 src->fmt != V4L2_PIX_FMT_BGR24 &&
+			 !v4lconvert_processing_needs_double_conversion(
+					src->fmt, V4L2_PIX_FMT_YUV420))
+			/* processing on the (decompressed) bayer data */
+			cost += PROCESSING_BAYER_COST;
+		else
+			/* processing on the rgb source or destination */
+			cost += PROCESSING_RGB_COST;
 	}
 
-	/* So that if both rgb32 and bgr32 are supported, or both yuv420 and
-	   yvu420 the right one wins */
-	if (supported_src_pixfmts[src_index].fmt == dest_pixelformat)
-		rank--;
-
 	/* check bandwidth needed */
-	needed = src_width * src_height * data->fps *
-		 supported_src_pixfmts[src_index].bpp / 8;
+	needed = src_width * src_height * data->fps * src->bpp / 8;
 	if (data->bandwidth && needed > data->bandwidth)
-		rank += 10;
+		cost += BANDWIDTH_COST;
 #if 0
-	printf("ranked: %c%c%c%c for %dx%d @ %d fps, needed: %d, bandwidth: %d, rank: %d\n",
-	       supported_src_pixfmts[src_index].fmt & 0xff,
-	       (supported_src_pixfmts[src_index].fmt >> 8) & 0xff,
-	       (supported_src_pixfmts[src_index].fmt >> 16) & 0xff,
-	       supported_src_pixfmts[src_index].fmt >> 24, src_width,
-	       src_height, data->fps, needed, data->bandwidth, rank);
+	printf("cost: %c%c%c%c for %dx%d @ %d fps, needed: %d, bandwidth: %d, cost: %d\n",
+	       src->fmt & 0xff, (src->fmt >> 8) & 0xff,
+	       (src->fmt >> 16) & 0xff, src->fmt >> 24, src_width,
+	       src_height, data->fps, needed, data->bandwidth, cost);
 #endif
-	return rank;
+	return (uint64_t)cost * src_width * src_height;
 }
 
 /* Find out what format to use based on the (cached) results of enum
@@ -446,12 +589,13 @@ static int v4lconvert_get_rank(struct v4lconvert_data *data,
 static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
 {
-	int i, rank;
+	int i;
 	unsigned int closest_fmt_size_diff = -1;
 	int best_framesize = 0;/* Just use the first format if no small enough one */
 	int best_format = 0;
-	int best_rank = 100;
+	uint64_t cost, best_cost = UINT64_MAX;
 
+	v4lconvert_get_all_framesizes(data);
 	for (i = 0; i < data->no_framesizes; i++) {
 		if (data->framesizes[i].discrete.width <= dest_fmt->fmt.pix.width &&
 				data->framesizes[i].discrete.height <= dest_fmt->fmt.pix.height) {
@@ -471,18 +615,17 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 
 	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
 		/* is this format supported? */
-		if (!(data->framesize_supported_src_formats[best_framesize] &
-		      (1ULL << i)))
+		if (!test_bit(i, data->framesize_supported_src_formats[best_framesize]))
 			continue;
 
 		/* Note the hardcoded use of discrete is based on this function
 		   only getting called for uvc devices */
-		rank = v4lconvert_get_rank(data, i,
+		cost = v4lconvert_get_cost(data, i,
 			    data->framesizes[best_framesize].discrete.width,
 			    data->framesizes[best_framesize].discrete.height,
 			    dest_fmt->fmt.pix.pixelformat);
-		if (rank < best_rank) {
-			best_rank = rank;
+		if (cost < best_cost) {
+			best_cost = cost;
 			best_format = supported_src_pixfmts[i].fmt;
 		}
 	}
@@ -506,8 +649,9 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
 {
-	int i, size_x_diff, size_y_diff, rank, best_rank = 0;
+	int i, size_x_diff, size_y_diff;
 	unsigned int size_diff, closest_fmt_size_diff = -1;
+	uint64_t cost, best_cost = 0;
 	unsigned int desired_pixfmt = dest_fmt->fmt.pix.pixelformat;
 	struct v4l2_format try_fmt, closest_fmt = { .type = 0 };
 
@@ -537,15 +681,15 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 		size_diff = size_x_diff * size_x_diff +
 			    size_y_diff * size_y_diff;
 
-		rank = v4lconvert_get_rank(data, i,
+		cost = v4lconvert_get_cost(data, i,
 					   try_fmt.fmt.pix.width,
 					   try_fmt.fmt.pix.height,
 					   desired_pixfmt);
 		if (size_diff < closest_fmt_size_diff ||
-		    (size_diff == closest_fmt_size_diff && rank < best_rank)) {
+		    (size_diff == closest_fmt_size_diff && cost < best_cost)) {
 			closest_fmt = try_fmt;
 			closest_fmt_size_diff = size_diff;
-			best_rank = rank;
+			best_cost = cost;
 		}
 	}
 
@@ -560,6 +704,114 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 	return 0;
 }
 
+static void v4lconvert_free_buffers(struct v4lconvert_data *data)
+{
+	int i;
+
+	for (i = 0; i < V4LCONVERT_BUF_COUNT; i++) {
+		if (data->buf_allocated & (1 << i))
+			free(data->buf[i]);
+		data->buf[i] = NULL;
+		data->buf_size[i] = 0;
+	}
+	data->buf_allocated = 0;
+
+	if (data->arena_mmapped)
+		SYS_MUNMAP(data->arena, data->arena_size);
+	else
+		free(data->arena);
+	data->arena = NULL;
+	data->arena_size = 0;
+	data->arena_slot_size = 0;
+	data->arena_mmapped = 0;
+}
+
+/*
+ * (Re)allocate the arena holding the scratch buffers, with slots of (at
+ * least) slot_size bytes. This frees all the buffers handed out by
+ * v4lconvert_get_buffer(), so it must only be called between conversions.
+ */
+static void v4lconvert_reserve_buffers(struct v4lconvert_data *data,
+		int slot_size)
+{
+	void *arena = NULL;
+	size_t size;
+	int i;
+
+	slot_size = (slot_size + V4LCONVERT_BUF_ALIGN - 1) &
+		    ~(V4LCONVERT_BUF_ALIGN - 1);
+	if (slot_size == data->arena_slot_size)
+		return;
+
+	v4lconvert_free_buffers(data);
+	if (slot_size <= 0)
+		return;
+
+	size = (size_t)slot_size * V4LCONVERT_BUF_COUNT;
+	if (data->flags & V4LCONVERT_USE_HUGEPAGES) {
+		long page_size = sysconf(_SC_PAGESIZE);
+
+		if (page_size > 0)
+			size = (size + page_size - 1) & ~(size_t)(page_size - 1);
+		arena = (void *)SYS_MMAP(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (arena == MAP_FAILED) {
+			arena = NULL;
+		} else {
+#ifdef MADV_HUGEPAGE
+			madvise(arena, size, MADV_HUGEPAGE);
+#endif
+			data->arena_mmapped = 1;
+		}
+	}
+	if (!arena && posix_memalign(&arena, V4LCONVERT_BUF_ALIGN, size))
+		arena = NULL;
+	/* Without an arena v4lconvert_get_buffer() allocates each buffer */
+	if (!arena)
+		return;
+
+	data->arena = arena;
+	data->arena_size = size;
+	data->arena_slot_size = slot_size;
+	for (i = 0; i < V4LCONVERT_BUF_COUNT; i++) {
+		data->buf[i] = data->arena + i * slot_size;
+		data->buf_size[i] = slot_size;
+	}
+}
+
+/* Size of the arena slots for converting frames of (source) format fmt,
+   the intermediate frames are at most RGB24 at the source resolution */
+static int v4lconvert_buffers_needed(const struct v4l2_format *fmt)
+{
+	return fmt->fmt.pix.width * fmt->fmt.pix.height * 3;
+}
+
+/*
+ * Returns scratch buffer id of at least needed bytes and aligned to
+ * V4LCONVERT_BUF_ALIGN. This normally is a slot of the arena, when that is
+ * too small (or missing) the buffer gets allocated separately until the
+ * next v4lconvert_reserve_buffers().
+ */
+unsigned char *v4lconvert_get_buffer(struct v4lconvert_data *data,
+		enum v4lconvert_buf_id id, int needed)
+{
+	void *buf;
+
+	if (data->buf_size[id] >= needed)
+		return data->buf[id];
+
+	if (posix_memalign(&buf, V4LCONVERT_BUF_ALIGN, needed))
+		return NULL;
+
+	if (data->buf_allocated & (1 << id))
+		free(data->buf[id]);
+	data->buf[id] = buf;
+	data->buf_size[id] = needed;
+	data->buf_allocated |= 1 << id;
+
+	return data->buf[id];
+}
+
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 {
 	switch (fmt->fmt.pix.pixelformat) {
@@ -573,6 +825,56 @@ void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
 		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_NV12:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 2;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 2;
+		break;
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_ABGR32:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 4;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 4;
+		break;
+	}
+}
+
+/* Pick the (discrete) framesize to scale to the size of fmt from: the
+   smallest one which is at least as large, or else the largest one. Without
+   discrete framesizes fmt is left alone, the driver picks the closest. */
+static void v4lconvert_get_scale_src_size(struct v4lconvert_data *data,
+		struct v4l2_format *fmt)
+{
+	const struct v4l2_frmsize_discrete *best = NULL;
+	uint64_t area, best_area = 0;
+	int i, larger, best_larger = 0;
+
+	v4lconvert_get_all_framesizes(data);
+	for (i = 0; i < data->no_framesizes; i++) {
+		const struct v4l2_frmsize_discrete *size =
+			&data->framesizes[i].discrete;
+
+		if (data->framesizes[i].type != V4L2_FRMSIZE_TYPE_DISCRETE)
+			continue;
+
+		larger = size->width >= fmt->fmt.pix.width &&
+			 size->height >= fmt->fmt.pix.height;
+		area = (uint64_t)size->width * size->height;
+		if (best && (larger < best_larger ||
+			     (larger == best_larger &&
+			      (larger ? area >= best_area : area <= best_area))))
+			continue;
+
+		best = size;
+		best_area = area;
+		best_larger = larger;
+	}
+
+	if (best) {
+		fmt->fmt.pix.width = best->width;
+		fmt->fmt.pix.height = best->height;
 	}
 }
 
@@ -594,6 +896,7 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 
 	/* Can we do conversion to the requested format & type? */
 	if (!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat) ||
+			v4lconvert_passthrough_format(data, dest_fmt->fmt.pix.pixelformat) ||
 			dest_fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE ||
 			v4lconvert_do_try_format(data, &try_dest, &try_src)) {
 		result = data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
@@ -669,6 +972,22 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 		}
 	}
 
+	/* When scaling, any resolution can be offered, scaled from the smallest
+	   resolution the device has which is at least as large */
+	if ((data->flags & V4LCONVERT_SCALE) &&
+			(try_dest.fmt.pix.width != desired_width ||
+			 try_dest.fmt.pix.height != desired_height)) {
+		try2_dest = *dest_fmt;
+		v4lconvert_get_scale_src_size(data, &try2_dest);
+		result = v4lconvert_do_try_format(data, &try2_dest, &try2_src);
+		if (result == 0) {
+			try2_dest.fmt.pix.width = desired_width;
+			try2_dest.fmt.pix.height = desired_height;
+			try_dest = try2_dest;
+			try_src = try2_src;
+		}
+	}
+
 	/* Some applications / libs (*cough* gstreamer *cough*) will not work
 	   correctly with planar YUV formats when the width is not a multiple of 8
 	   or the height is not a multiple of 2. With RGB formats these apps require
@@ -683,6 +1002,10 @@ int v4lconvert_try_format(struct v4lconvert_data *data,
 			try_src.fmt.pix.pixelformat != try_dest.fmt.pix.pixelformat)
 		v4lconvert_fixup_fmt(&try_dest);
 
+	/* Size the scratch buffers for the negotiated format now, rather than
+	   growing them while converting the first frames */
+	v4lconvert_reserve_buffers(data, v4lconvert_buffers_needed(&try_src));
+
 	*dest_fmt = try_dest;
 	if (src_fmt)
 		*src_fmt = try_src;
@@ -732,6 +1055,10 @@ static int v4lconvert_processing_needs_double_conversion(
 	case V4L2_PIX_FMT_SGBRG10:
 	case V4L2_PIX_FMT_SGRBG10:
 	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR12:
+	case V4L2_PIX_FMT_SGBRG12:
+	case V4L2_PIX_FMT_SGRBG12:
+	case V4L2_PIX_FMT_SRGGB12:
 	case V4L2_PIX_FMT_SBGGR16:
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
@@ -770,6 +1097,328 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
+/* A frame conversion split into bands of lines, for the converters which
+   convert each line independently of the others. When fused is set the
+   lines are written straight to their flipped and / or cropped location in
+   dest, instead of to an intermediate frame which then gets flipped and / or
+   cropped. */
+struct v4lconvert_band_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	unsigned int src_pix_fmt;
+	int width;
+	int height;
+	int src_stride;
+	int bpp;
+	int bgr;
+	unsigned char hsv_enc;
+	const struct v4lconvert_yuv_matrix *yuv;
+	/* For the fused convert + flip + crop path */
+	int fused;
+	int dest_width;
+	int dest_height;
+	int startx;
+	int starty;
+	int hflip;
+	int vflip;
+};
+
+static void v4lconvert_convert_lines(struct v4lconvert_band_job *job,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height)
+{
+	int stride = job->src_stride;
+
+	switch (job->src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		if (job->bgr)
+			v4lconvert_yuyv_to_bgr24(src, dest, width, height, stride,
+						 job->yuv);
+		else
+			v4lconvert_yuyv_to_rgb24(src, dest, width, height, stride,
+						 job->yuv);
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		if (job->bgr)
+			v4lconvert_yvyu_to_bgr24(src, dest, width, height, stride,
+						 job->yuv);
+		else
+			v4lconvert_yvyu_to_rgb24(src, dest, width, height, stride,
+						 job->yuv);
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		if (job->bgr)
+			v4lconvert_uyvy_to_bgr24(src, dest, width, height, stride,
+						 job->yuv);
+		else
+			v4lconvert_uyvy_to_rgb24(src, dest, width, height, stride,
+						 job->yuv);
+		break;
+	case V4L2_PIX_FMT_RGB565:
+		if (job->bgr)
+			v4lconvert_rgb565_to_bgr24(src, dest, width, height, stride);
+		else
+			v4lconvert_rgb565_to_rgb24(src, dest, width, height, stride);
+		break;
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_Y4:
+	case V4L2_PIX_FMT_Y6:
+		v4lconvert_grey_to_rgb24(src, dest, width, height, stride);
+		break;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		if ((job->src_pix_fmt == V4L2_PIX_FMT_BGR24) != job->bgr)
+			v4lconvert_swap_rgb(src, dest, width, height);
+		else
+			memcpy(dest, src, width * height * 3);
+		break;
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+		v4lconvert_rgb32_to_rgb24(src + 1, dest, width, height, job->bgr);
+		break;
+	case V4L2_PIX_FMT_RGBA32:
+		v4lconvert_rgb32_to_rgb24(src, dest, width, height, job->bgr);
+		break;
+	case V4L2_PIX_FMT_BGR32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+		v4lconvert_rgb32_to_rgb24(src, dest, width, height, !job->bgr);
+		break;
+	case V4L2_PIX_FMT_HSV24:
+		v4lconvert_hsv_to_rgb24(src, dest, width, height, job->bgr,
+					24, job->hsv_enc);
+		break;
+	case V4L2_PIX_FMT_HSV32:
+		v4lconvert_hsv_to_rgb24(src, dest, width, height, job->bgr,
+					32, job->hsv_enc);
+		break;
+	}
+}
+
+static void v4lconvert_hflip_line(unsigned char *line, int width)
+{
+	unsigned char *end = line + (width - 1) * 3;
+	unsigned char tmp[3];
+
+	while (line < end) {
+		memcpy(tmp, line, 3);
+		memcpy(line, end, 3);
+		memcpy(end, tmp, 3);
+		line += 3;
+		end -= 3;
+	}
+}
+
+static void v4lconvert_convert_band(void *arg, int band, int bands)
+{
+	struct v4lconvert_band_job *job = arg;
+	int height = job->fused ? job->dest_height : job->height;
+	int start = (height * band / bands) & ~1;
+	int end = band == bands - 1 ? height :
+		  (height * (band + 1) / bands) & ~1;
+	int y, sx, sy;
+
+	if (!job->fused) {
+		v4lconvert_convert_lines(job, job->src + start * job->src_stride,
+					 job->dest + start * job->width * 3,
+					 job->width, end - start);
+		return;
+	}
+
+	/* Crop after flipping, so take the mirrored source area when flipped */
+	sx = job->hflip ? job->width - job->startx - job->dest_width :
+			  job->startx;
+
+	for (y = start; y < end; y++) {
+		unsigned char *dest = job->dest + y * job->dest_width * 3;
+
+		sy = job->vflip ? job->height - 1 - job->starty - y :
+				  job->starty + y;
+		v4lconvert_convert_lines(job, job->src + sy * job->src_stride +
+					 sx * job->bpp, dest, job->dest_width, 1);
+		if (job->hflip)
+			v4lconvert_hflip_line(dest, job->dest_width);
+	}
+}
+
+/* Returns 0 if the src format / dest format combination cannot be done by
+   v4lconvert_convert_band */
+static int v4lconvert_band_job_init(struct v4lconvert_data *data,
+	struct v4lconvert_band_job *job, const unsigned char *src, int src_size, unsigned char *dest,
+	const struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	memset(job, 0, sizeof(*job));
+	job->src = src;
+	job->dest = dest;
+	job->src_pix_fmt = fmt->fmt.pix.pixelformat;
+	job->width = fmt->fmt.pix.width;
+	job->height = fmt->fmt.pix.height;
+	job->bgr = dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+	job->hsv_enc = fmt->fmt.pix.hsv_enc;
+	job->yuv = v4lconvert_update_yuv_matrix(&data->yuv_matrix, fmt);
+
+	if (dest_pix_fmt != V4L2_PIX_FMT_RGB24 &&
+	    dest_pix_fmt != V4L2_PIX_FMT_BGR24)
+		return 0;
+
+	/* The converters without a stride argument expect packed lines */
+	switch (job->src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_RGB565:
+		job->bpp = 2;
+		job->src_stride = fmt->fmt.pix.bytesperline;
+		break;
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_Y4:
+	case V4L2_PIX_FMT_Y6:
+		job->bpp = 1;
+		job->src_stride = fmt->fmt.pix.bytesperline;
+		break;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_HSV24:
+		job->bpp = 3;
+		job->src_stride = job->width * job->bpp;
+		break;
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_BGR32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_HSV32:
+		job->bpp = 4;
+		job->src_stride = job->width * job->bpp;
+		break;
+	default:
+		return 0;
+	}
+
+	/* Leave reporting short frames to v4lconvert_convert_pixfmt */
+	if (src_size < job->width * job->height * job->bpp)
+		return 0;
+
+	return 1;
+}
+
+/* Returns 1 if the conversion was done using the thread pool, 0 if it
+   must be done by v4lconvert_convert_pixfmt itself */
+static int v4lconvert_convert_pixfmt_threaded(struct v4lconvert_data *data,
+	const unsigned char *src, int src_size, unsigned char *dest,
+	const struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_band_job job;
+	int bands = v4lconvert_pool_threads(data->pool);
+
+	if (bands < 2 || fmt->fmt.pix.height < 16 * bands ||
+	    !v4lconvert_band_job_init(data, &job, src, src_size, dest, fmt,
+				      dest_pix_fmt))
+		return 0;
+
+	v4lconvert_pool_run(data->pool, v4lconvert_convert_band, &job, bands);
+
+	return 1;
+}
+
+#ifdef HAVE_JPEG
+/* Returns by how much a (M)JPEG src frame can be downscaled while decoding,
+   with the result still being at least as large as the destination */
+static int v4lconvert_get_jpeg_scale(struct v4lconvert_data *data,
+	const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+{
+	unsigned int width = src_fmt->fmt.pix.width;
+	unsigned int height = src_fmt->fmt.pix.height;
+	int scale;
+
+	if ((src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG &&
+	     src_fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_JPEG) ||
+	    (data->flags & V4LCONVERT_USE_TINYJPEG) ||
+	    (data->control_flags & V4LCONTROL_ROTATED_90_JPEG))
+		return 1;
+
+	/* libjpeg can do 1/2, 1/4 and 1/8 scaling as part of the IDCT */
+	for (scale = 8; scale > 1; scale /= 2) {
+		if (width % scale || height % scale)
+			continue;
+		if (width / scale >= dest_fmt->fmt.pix.width &&
+		    height / scale >= dest_fmt->fmt.pix.height)
+			break;
+	}
+
+	return scale;
+}
+#endif // HAVE_JPEG
+
+/* Do pixfmt conversion, flipping and (plain) cropping in a single pass over
+   the frame. Returns 1 on success, 0 if the steps must be done one by one. */
+static int v4lconvert_convert_fused(struct v4lconvert_data *data,
+	const unsigned char *src, int src_size, unsigned char *dest,
+	const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+	int hflip, int vflip)
+{
+	struct v4lconvert_band_job job;
+	int bands = v4lconvert_pool_threads(data->pool);
+	int dest_width = dest_fmt->fmt.pix.width;
+	int dest_height = dest_fmt->fmt.pix.height;
+
+	if (!v4lconvert_band_job_init(data, &job, src, src_size, dest, src_fmt,
+				      dest_fmt->fmt.pix.pixelformat))
+		return 0;
+
+	/* Only plain cropping, see v4lconvert_crop */
+	if (dest_width > job.width || dest_height > job.height ||
+	    (job.width >= 2 * dest_width && job.height >= 2 * dest_height))
+		return 0;
+
+	job.fused = 1;
+	job.dest_width = dest_width;
+	job.dest_height = dest_height;
+	job.startx = (job.width - dest_width) / 2;
+	job.starty = (job.height - dest_height) / 2;
+	job.hflip = hflip;
+	job.vflip = vflip;
+
+	/* Pixel pairs must line up with those of a full line conversion */
+	if (job.bpp == 2 && job.src_pix_fmt != V4L2_PIX_FMT_RGB565 &&
+	    ((job.startx | job.width | dest_width) & 1))
+		return 0;
+
+	if (dest_height < 16 * bands)
+		bands = 1;
+
+	v4lconvert_pool_run(data->pool, v4lconvert_convert_band, &job, bands);
+
+	return 1;
+}
+
+/* HSV to YUV420 goes through an intermediate RGB24 frame, as the RGB24
+   frame does not fit in the YUV420 destination buffer */
+static int v4lconvert_hsv_to_yuv420(struct v4lconvert_data *data,
+	const unsigned char *src, unsigned char *dest,
+	struct v4l2_format *fmt, int bits, int yvu)
+{
+	unsigned int width = fmt->fmt.pix.width;
+	unsigned int height = fmt->fmt.pix.height;
+	unsigned char *tmpbuf;
+
+	tmpbuf = v4lconvert_get_buffer(data,
+			V4LCONVERT_CONVERT_PIXFMT_BUF, width * height * 3);
+	if (!tmpbuf)
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_hsv_to_rgb24(src, tmpbuf, width, height, 0, bits,
+				fmt->fmt.pix.hsv_enc);
+	fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+	v4lconvert_fixup_fmt(fmt);
+	v4lconvert_rgb24_to_yuv420(tmpbuf, dest, fmt, 0, yvu, 3);
+
+	return 0;
+}
+
 static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
@@ -779,6 +1428,22 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned int width  = fmt->fmt.pix.width;
 	unsigned int height = fmt->fmt.pix.height;
 	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
+	int edge_aware = !!(data->flags & V4LCONVERT_BAYER_EDGE_AWARE);
+	const struct v4lconvert_yuv_matrix *yuv =
+		v4lconvert_update_yuv_matrix(&data->yuv_matrix, fmt);
+
+	if ((data->m2m && v4lconvert_m2m_convert(data->m2m, src, src_size,
+					dest, dest_size, fmt, dest_pix_fmt)) ||
+#ifdef HAVE_EGL
+	    (data->egl && v4lconvert_egl_convert(data->egl, src, src_size,
+					dest, dest_size, fmt, dest_pix_fmt)) ||
+#endif
+	    v4lconvert_convert_pixfmt_threaded(data, src, src_size, dest,
+					       fmt, dest_pix_fmt)) {
+		fmt->fmt.pix.pixelformat = dest_pix_fmt;
+		v4lconvert_fixup_fmt(fmt);
+		return 0;
+	}
 
 	switch (src_pix_fmt) {
 	/* JPG and variants */
@@ -834,8 +1499,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		if (dest_pix_fmt != V4L2_PIX_FMT_YUV420 &&
 				dest_pix_fmt != V4L2_PIX_FMT_YVU420) {
-			d = v4lconvert_alloc_buffer(width * height * 3 / 2,
-					&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+			d = v4lconvert_get_buffer(data,
+					V4LCONVERT_CONVERT_PIXFMT_BUF, width * height * 3 / 2);
 			if (!d)
 				return v4lconvert_oom_error(data);
 			d_size = width * height * 3 / 2;
@@ -899,43 +1564,72 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuv420_to_rgb24(data->convert_pixfmt_buf, dest, width,
-					height, bytesperline, yvu);
+			v4lconvert_yuv420_to_rgb24(d, dest, width,
+					height, bytesperline, yvu, yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
-					height, bytesperline, yvu);
+			v4lconvert_yuv420_to_bgr24(d, dest, width,
+					height, bytesperline, yvu, yuv);
 			break;
 		}
 		break;
 	}
 
-		/* Conexant cx2341x raw video macroblock format */
+		/* Tiled NV12: the Conexant cx2341x raw video macroblock format and
+		   the Allwinner (sunxi) format */
 	case V4L2_PIX_FMT_NV12_16L16:
+	case V4L2_PIX_FMT_NV12_32L32: {
+		unsigned char *d = dest;
+		int yvu = dest_pix_fmt == V4L2_PIX_FMT_YVU420;
+
+		if (dest_pix_fmt != V4L2_PIX_FMT_YUV420 &&
+				dest_pix_fmt != V4L2_PIX_FMT_YVU420) {
+			d = v4lconvert_get_buffer(data,
+					V4LCONVERT_CONVERT_PIXFMT_BUF, width * height * 3 / 2);
+			if (!d)
+				return v4lconvert_oom_error(data);
+		}
+
+		if (src_pix_fmt == V4L2_PIX_FMT_NV12_16L16)
+			result = v4lconvert_nv12_16l16_to_yuv420(src, src_size, d,
+					width, height, yvu);
+		else
+			result = v4lconvert_nv12_32l32_to_yuv420(src, src_size, d,
+					width, height, bytesperline, yvu);
+		if (result) {
+			V4LCONVERT_ERR("short or invalid tiled nv12 data frame\n");
+			errno = EPIPE;
+			return -1;
+		}
+
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_16l16_to_rgb24(src, dest, width, height);
+			v4lconvert_yuv420_to_rgb24(d, dest, width, height, width, 0,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_16l16_to_bgr24(src, dest, width, height);
-			break;
-		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_nv12_16l16_to_yuv420(src, dest, width, height, 0);
-			break;
-		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_nv12_16l16_to_yuv420(src, dest, width, height, 1);
+			v4lconvert_yuv420_to_bgr24(d, dest, width, height, width, 0,
+					yuv);
 			break;
 		}
 		break;
+	}
 
 		/* NV12 formats */
 	case V4L2_PIX_FMT_NV12:
+		if (src_size < (width * height * 3 / 2)) {
+			V4LCONVERT_ERR("short nv12 data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, bytesperline, 0);
+			v4lconvert_nv12_to_rgb24(src, dest, width, height, bytesperline, 0,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_to_rgb24(src, dest, width, height, bytesperline, 1);
+			v4lconvert_nv12_to_rgb24(src, dest, width, height, bytesperline, 1,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_nv12_to_yuv420(src, dest, width, height, bytesperline, 0);
@@ -946,6 +1640,72 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		break;
 
+	case V4L2_PIX_FMT_NV21:
+		if (src_size < (width * height * 3 / 2)) {
+			V4LCONVERT_ERR("short nv21 data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
+		switch (dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+			v4lconvert_nv21_to_rgb24(src, dest, width, height, bytesperline, 0,
+					yuv);
+			break;
+		case V4L2_PIX_FMT_BGR24:
+			v4lconvert_nv21_to_rgb24(src, dest, width, height, bytesperline, 1,
+					yuv);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+			/* Note NV21 is NV12 with U and V swapped */
+			v4lconvert_nv12_to_yuv420(src, dest, width, height, bytesperline, 1);
+			break;
+		case V4L2_PIX_FMT_YVU420:
+			v4lconvert_nv12_to_yuv420(src, dest, width, height, bytesperline, 0);
+			break;
+		}
+		break;
+
+		/* Raw bayer formats with more than 8 bits per sample */
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR12:
+	case V4L2_PIX_FMT_SGBRG12:
+	case V4L2_PIX_FMT_SGRBG12:
+	case V4L2_PIX_FMT_SRGGB12:
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16: {
+		int line_size = v4lconvert_bayer_deep_line_size(src_pix_fmt, width);
+		unsigned char *scratch;
+
+		if (bytesperline < (unsigned int)line_size)
+			bytesperline = line_size;
+
+		if (src_size < (int)((height - 1) * bytesperline + line_size)) {
+			V4LCONVERT_ERR("short raw bayer data frame\n");
+			errno = EPIPE;
+			result = -1;
+			break;
+		}
+
+		scratch = v4lconvert_get_buffer(data,
+				V4LCONVERT_CONVERT_PIXFMT_BUF,
+				(V4LCONVERT_BAYER_BAND_LINES + 2) * width);
+		if (!scratch)
+			return v4lconvert_oom_error(data);
+
+		v4lconvert_bayer_deep_convert(src, scratch, dest, width, height,
+				bytesperline, src_pix_fmt, dest_pix_fmt, edge_aware);
+		break;
+	}
+
 		/* compressed bayer formats */
 	case V4L2_PIX_FMT_SPCA561:
 	case V4L2_PIX_FMT_SN9C10X:
@@ -960,8 +1720,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		unsigned char *tmpbuf;
 		struct v4l2_format tmpfmt = *fmt;
 
-		tmpbuf = v4lconvert_alloc_buffer(width * height,
-				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+		tmpbuf = v4lconvert_get_buffer(data,
+				V4LCONVERT_CONVERT_PIXFMT_BUF, width * height);
 		if (!tmpbuf)
 			return v4lconvert_oom_error(data);
 
@@ -971,7 +1731,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SGBRG8;
 			break;
 		case V4L2_PIX_FMT_SN9C10X:
-			v4lconvert_decode_sn9c10x(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c10x(src, src_size, tmpbuf, width,
+						height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_PAC207:
@@ -1005,7 +1766,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			break;
 #endif
 		case V4L2_PIX_FMT_SN9C2028:
-			v4lconvert_decode_sn9c2028(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c2028(src, src_size, tmpbuf, width,
+						height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_SQ905C:
@@ -1030,118 +1792,6 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	}
 
 		/* Raw bayer formats */
-	case V4L2_PIX_FMT_SBGGR10P:
-	case V4L2_PIX_FMT_SGBRG10P:
-	case V4L2_PIX_FMT_SGRBG10P:
-	case V4L2_PIX_FMT_SRGGB10P: {
-		int b10format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR10P:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG10P:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB10P:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b10format = 0;
-			break;
-		}
-
-		if (b10format) {
-			if (src_size < ((width * height * 10)/8)) {
-				V4LCONVERT_ERR
-					("short raw bayer10 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer10p_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
-	case V4L2_PIX_FMT_SBGGR10:
-	case V4L2_PIX_FMT_SGBRG10:
-	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10: {
-		int b10format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR10:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG10:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB10:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b10format = 0;
-			break;
-		}
-
-		if (b10format) {
-			if (src_size < (width * height * 2)) {
-				V4LCONVERT_ERR
-					("short raw bayer10 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer10_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
-	case V4L2_PIX_FMT_SBGGR16:
-	case V4L2_PIX_FMT_SGBRG16:
-	case V4L2_PIX_FMT_SGRBG16:
-	case V4L2_PIX_FMT_SRGGB16: {
-		int b16format = 1;
-
-		switch (src_pix_fmt) {
-		case V4L2_PIX_FMT_SBGGR16:
-			src_pix_fmt = V4L2_PIX_FMT_SBGGR8;
-			break;
-		case V4L2_PIX_FMT_SGBRG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGBRG8;
-			break;
-		case V4L2_PIX_FMT_SGRBG16:
-			src_pix_fmt = V4L2_PIX_FMT_SGRBG8;
-			break;
-		case V4L2_PIX_FMT_SRGGB16:
-			src_pix_fmt = V4L2_PIX_FMT_SRGGB8;
-			break;
-		default:
-			b16format = 0;
-			break;
-		}
-
-		if (b16format) {
-			if (src_size < ((width * height * 2))) {
-				V4LCONVERT_ERR
-					("short raw bayer16 data frame\n");
-				errno = EPIPE;
-				result = -1;
-				break;
-			}
-			v4lconvert_bayer16_to_bayer8(src, src, width, height);
-			bytesperline = width;
-		}
-	}
-
-	/* Fall-through*/
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
@@ -1153,16 +1803,16 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt, edge_aware);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt, edge_aware);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
+			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0, edge_aware);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1);
+			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1, edge_aware);
 			break;
 		}
 		break;
@@ -1177,9 +1827,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_BGR24:
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
-			d = v4lconvert_alloc_buffer(width * height * 3,
-					&data->convert_pixfmt_buf,
-					&data->convert_pixfmt_buf_size);
+			d = v4lconvert_get_buffer(data,
+					V4LCONVERT_CONVERT_PIXFMT_BUF, width * height * 3);
 			if (!d)
 				return v4lconvert_oom_error(data);
 
@@ -1258,17 +1907,42 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
 	        case V4L2_PIX_FMT_BGR24:
-			result = v4lconvert_y10b_to_rgb24(data, src, dest,
-							  width, height);
+			v4lconvert_y10b_to_rgb24(src, dest, width, height);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
-			result = v4lconvert_y10b_to_yuv420(data, src, dest,
-							   width, height);
+			v4lconvert_y10b_to_yuv420(src, dest, width, height);
 			break;
 		}
 		break;
 
+	case V4L2_PIX_FMT_Y10P: {
+		int line_size = (width * 10 + 7) / 8;
+
+		if (bytesperline < (unsigned int)line_size)
+			bytesperline = line_size;
+
+		if (src_size < (int)((height - 1) * bytesperline + line_size)) {
+			V4LCONVERT_ERR("short y10p data frame\n");
+			errno = EPIPE;
+			result = -1;
+			break;
+		}
+		switch (dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			v4lconvert_y10p_to_rgb24(src, dest, width, height,
+						 bytesperline);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			v4lconvert_y10p_to_yuv420(src, dest, width, height,
+						  bytesperline);
+			break;
+		}
+		break;
+	}
+
 	case V4L2_PIX_FMT_RGB565:
 		if (src_size < (width * height * 2)) {
 			V4LCONVERT_ERR("short rgb565 data frame\n");
@@ -1338,12 +2012,15 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_RGB32:
 	case V4L2_PIX_FMT_XRGB32:
 	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_RGBA32:
 		if (src_size < (width * height * 4)) {
 			V4LCONVERT_ERR("short rgb32 data frame\n");
 			errno = EPIPE;
 			result = -1;
 		}
-		src++;
+		/* Skip the leading X / A byte, RGBA32 has it at the end */
+		if (src_pix_fmt != V4L2_PIX_FMT_RGBA32)
+			src++;
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
 			v4lconvert_rgb32_to_rgb24(src, dest, width, height, 0);
@@ -1393,11 +2070,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
 			v4lconvert_yuv420_to_rgb24(src, dest, width,
-					height, bytesperline, 0);
+					height, bytesperline, 0, yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
 			v4lconvert_yuv420_to_bgr24(src, dest, width,
-					height, bytesperline, 0);
+					height, bytesperline, 0, yuv);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			memcpy(dest, src, width * height * 3 / 2);
@@ -1417,11 +2094,11 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
 			v4lconvert_yuv420_to_rgb24(src, dest, width,
-					height, bytesperline, 1);
+					height, bytesperline, 1, yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
 			v4lconvert_yuv420_to_bgr24(src, dest, width,
-					height, bytesperline, 1);
+					height, bytesperline, 1, yuv);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_swap_uv(src, dest, fmt);
@@ -1432,20 +2109,30 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		break;
 
-	case V4L2_PIX_FMT_NV16: {
-		unsigned char *tmpbuf;
-
-		tmpbuf = v4lconvert_alloc_buffer(width * height * 2,
-				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
-		if (!tmpbuf)
-			return v4lconvert_oom_error(data);
+	case V4L2_PIX_FMT_NV16:
+		if (src_size < (width * height * 2)) {
+			V4LCONVERT_ERR("short nv16 data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
+		switch (dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+			v4lconvert_nv16_to_rgb24(src, dest, width, height, bytesperline, 0,
+					yuv);
+			break;
+		case V4L2_PIX_FMT_BGR24:
+			v4lconvert_nv16_to_rgb24(src, dest, width, height, bytesperline, 1,
+					yuv);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+			v4lconvert_nv16_to_yuv420(src, dest, width, height, bytesperline, 0);
+			break;
+		case V4L2_PIX_FMT_YVU420:
+			v4lconvert_nv16_to_yuv420(src, dest, width, height, bytesperline, 1);
+			break;
+		}
+		break;
 
-		v4lconvert_nv16_to_yuyv(src, tmpbuf, width, height, bytesperline);
-		src_pix_fmt = V4L2_PIX_FMT_YUYV;
-		src = tmpbuf;
-		bytesperline = width * 2;
-		/* fall through */
-	}
 	case V4L2_PIX_FMT_YUYV:
 		if (src_size < (width * height * 2)) {
 			V4LCONVERT_ERR("short yuyv data frame\n");
@@ -1454,10 +2141,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
@@ -1468,21 +2157,31 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		break;
 
-	case V4L2_PIX_FMT_NV61: {
-		unsigned char *tmpbuf;
-
-		tmpbuf = v4lconvert_alloc_buffer(width * height * 2,
-				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
-		if (!tmpbuf)
-			return v4lconvert_oom_error(data);
+	case V4L2_PIX_FMT_NV61:
+		if (src_size < (width * height * 2)) {
+			V4LCONVERT_ERR("short nv61 data frame\n");
+			errno = EPIPE;
+			result = -1;
+		}
+		switch (dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+			v4lconvert_nv61_to_rgb24(src, dest, width, height, bytesperline, 0,
+					yuv);
+			break;
+		case V4L2_PIX_FMT_BGR24:
+			v4lconvert_nv61_to_rgb24(src, dest, width, height, bytesperline, 1,
+					yuv);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+			/* Note NV61 is NV16 with U and V swapped */
+			v4lconvert_nv16_to_yuv420(src, dest, width, height, bytesperline, 1);
+			break;
+		case V4L2_PIX_FMT_YVU420:
+			v4lconvert_nv16_to_yuv420(src, dest, width, height, bytesperline, 0);
+			break;
+		}
+		break;
 
-		/* Note NV61 is NV16 with U and V swapped so this becomes yvyu. */
-		v4lconvert_nv16_to_yuyv(src, tmpbuf, width, height, bytesperline);
-		src_pix_fmt = V4L2_PIX_FMT_YVYU;
-		src = tmpbuf;
-		bytesperline = width * 2;
-		/* fall through */
-	}
 	case V4L2_PIX_FMT_YVYU:
 		if (src_size < (width * height * 2)) {
 			V4LCONVERT_ERR("short yvyu data frame\n");
@@ -1491,10 +2190,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			/* Note we use yuyv_to_yuv420 not v4lconvert_yvyu_to_yuv420,
@@ -1515,10 +2216,12 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline,
+					yuv);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
@@ -1544,14 +2247,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						24, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
-			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt, 24,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420))
+				return -1;
 			break;
 		}
 
@@ -1573,14 +2272,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						32, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
-			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt, 32,
+					dest_pix_fmt == V4L2_PIX_FMT_YVU420))
+				return -1;
 			break;
 		}
 
@@ -1600,13 +2295,67 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
-int v4lconvert_convert(struct v4lconvert_data *data,
+static uint64_t v4lconvert_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The stages are timed for the stats and for the libv4lconvert:stage probe */
+static uint64_t v4lconvert_stats_start(struct v4lconvert_data *data)
+{
+	if (!data->stats_enabled && !V4L_PROBE_ENABLED(libv4lconvert, stage))
+		return 0;
+
+	return v4lconvert_now();
+}
+
+static void v4lconvert_stats_end(struct v4lconvert_data *data, int stage,
+		uint64_t start, int bytes_in, int bytes_out)
+{
+	struct v4lconvert_stage_stats *stats = &data->stats.stage[stage];
+	uint64_t ns;
+
+	/* Not timed, or the stats got enabled while converting */
+	if (!start)
+		return;
+
+	ns = v4lconvert_now() - start;
+	V4L_PROBE(libv4lconvert, stage, stage, bytes_in, bytes_out, ns);
+
+	if (!data->stats_enabled)
+		return;
+
+	stats->count++;
+	stats->ns += ns;
+	stats->bytes_in += bytes_in;
+	stats->bytes_out += bytes_out;
+}
+
+/* Converting from compressed formats is accounted as decoding */
+static int v4lconvert_pixfmt_stage(unsigned int pixelformat)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++)
+		if (supported_src_pixfmts[i].fmt == pixelformat)
+			return supported_src_pixfmts[i].bpp ?
+				V4LCONVERT_STAGE_CONVERT : V4LCONVERT_STAGE_DECODE;
+
+	return V4LCONVERT_STAGE_CONVERT;
+}
+
+/* Convert to one of the formats the conversion steps work on, see pack.c
+   for the other destination formats */
+static int v4lconvert_convert_unpacked(struct v4lconvert_data *data,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
 {
 	int res, dest_needed, temp_needed, processing, convert = 0;
-	int rotate90, vflip, hflip, crop;
+	int rotate90, vflip, hflip, crop, scale;
 	unsigned char *convert1_dest = dest;
 	int convert1_dest_size = dest_size;
 	unsigned char *convert2_src = src, *convert2_dest = dest;
@@ -1616,6 +2365,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	unsigned char *crop_src = src;
 	struct v4l2_format my_src_fmt = *src_fmt;
 	struct v4l2_format my_dest_fmt = *dest_fmt;
+	uint64_t start = v4lconvert_stats_start(data);
+	int stage, size;
 
 	processing = v4lprocessing_pre_processing(data->processing);
 	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
@@ -1623,6 +2374,13 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	vflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
 	crop = my_dest_fmt.fmt.pix.width != my_src_fmt.fmt.pix.width ||
 		my_dest_fmt.fmt.pix.height != my_src_fmt.fmt.pix.height;
+	/* When scaling is enabled only the few extra (border) pixels of some
+	   sensors are cropped off, other size changes get scaled */
+	scale = crop && (data->flags & V4LCONVERT_SCALE) &&
+		!(my_src_fmt.fmt.pix.width >= my_dest_fmt.fmt.pix.width &&
+		  my_src_fmt.fmt.pix.width < my_dest_fmt.fmt.pix.width + 16 &&
+		  my_src_fmt.fmt.pix.height >= my_dest_fmt.fmt.pix.height &&
+		  my_src_fmt.fmt.pix.height < my_dest_fmt.fmt.pix.height + 16);
 
 	if (/* If no conversion/processing is needed */
 			(src_fmt->fmt.pix.pixelformat == dest_fmt->fmt.pix.pixelformat &&
@@ -1631,7 +2389,12 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 			   use the native cam format, we just return an unprocessed frame copy */
 			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat)) {
 		int to_copy = MIN(dest_size, src_size);
-		memcpy(dest, src, to_copy);
+
+		/* In place, the frame is already where it needs to be */
+		if (src != dest)
+			memcpy(dest, src, to_copy);
+		v4lconvert_stats_end(data, V4LCONVERT_STAGE_CONVERT, start,
+				     to_copy, to_copy);
 		return to_copy;
 	}
 
@@ -1662,6 +2425,46 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		return -1;
 	}
 
+	/* For apps which do not use v4lconvert_try_format(), or changed the
+	   resolution without it */
+	if (v4lconvert_buffers_needed(&my_src_fmt) > data->arena_slot_size)
+		v4lconvert_reserve_buffers(data,
+				v4lconvert_buffers_needed(&my_src_fmt));
+
+	/* In place conversion, most steps below write (part of) dest before
+	   they are done reading src, so let them work on a copy. Only the first
+	   step of a double conversion writes elsewhere, into CONVERT1_BUF,
+	   otherwise CONVERT1_BUF is unused and can hold the copy. */
+	if (src == dest && !(processing &&
+			v4lconvert_processing_needs_double_conversion(
+				my_src_fmt.fmt.pix.pixelformat,
+				my_dest_fmt.fmt.pix.pixelformat))) {
+		src = v4lconvert_get_buffer(data, V4LCONVERT_CONVERT1_BUF,
+					    src_size);
+		if (!src)
+			return v4lconvert_oom_error(data);
+
+		memcpy(src, dest, src_size);
+		convert2_src = rotate90_src = flip_src = crop_src = src;
+	}
+
+	/* When possible write the converted frame straight to its flipped
+	   and / or cropped location, saving one or two passes over the frame */
+	if (!processing && !rotate90 && !scale && (hflip || vflip || crop) &&
+	    v4lconvert_convert_fused(data, src, src_size, dest, &my_src_fmt,
+				     &my_dest_fmt, hflip, vflip)) {
+		v4lconvert_stats_end(data,
+			v4lconvert_pixfmt_stage(my_src_fmt.fmt.pix.pixelformat),
+			start, src_size, dest_needed);
+		return dest_needed;
+	}
+
+#ifdef HAVE_JPEG
+	/* When downscaling, let libjpeg decode at a lower resolution, the
+	   rotate / flip / crop steps below use the resulting src size */
+	data->jpeg_scale = crop ?
+		v4lconvert_get_jpeg_scale(data, &my_src_fmt, &my_dest_fmt) : 1;
+#endif // HAVE_JPEG
 
 	/* Sometimes we need foo -> rgb -> bar as video processing (whitebalance,
 	   etc.) can only be done on rgb data */
@@ -1681,9 +2484,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
 	if (convert == 2) {
-		convert1_dest = v4lconvert_alloc_buffer(
-				my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3,
-				&data->convert1_buf, &data->convert1_buf_size);
+		convert1_dest = v4lconvert_get_buffer(data, V4LCONVERT_CONVERT1_BUF,
+				my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3);
 		if (!convert1_dest)
 			return v4lconvert_oom_error(data);
 
@@ -1693,8 +2495,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if (convert && (rotate90 || hflip || vflip || crop)) {
-		convert2_dest = v4lconvert_alloc_buffer(temp_needed,
-				&data->convert2_buf, &data->convert2_buf_size);
+		convert2_dest = v4lconvert_get_buffer(data,
+				V4LCONVERT_CONVERT2_BUF, temp_needed);
 		if (!convert2_dest)
 			return v4lconvert_oom_error(data);
 
@@ -1703,8 +2505,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if (rotate90 && (hflip || vflip || crop)) {
-		rotate90_dest = v4lconvert_alloc_buffer(temp_needed,
-				&data->rotate90_buf, &data->rotate90_buf_size);
+		rotate90_dest = v4lconvert_get_buffer(data,
+				V4LCONVERT_ROTATE90_BUF, temp_needed);
 		if (!rotate90_dest)
 			return v4lconvert_oom_error(data);
 
@@ -1712,8 +2514,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	}
 
 	if ((vflip || hflip) && crop) {
-		flip_dest = v4lconvert_alloc_buffer(temp_needed, &data->flip_buf,
-				&data->flip_buf_size);
+		flip_dest = v4lconvert_get_buffer(data,
+				V4LCONVERT_FLIP_BUF, temp_needed);
 		if (!flip_dest)
 			return v4lconvert_oom_error(data);
 
@@ -1723,6 +2525,8 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	/* Done setting sources / dest and allocating intermediate buffers,
 	   real conversion / processing / ... starts here. */
 	if (convert == 2) {
+		stage = v4lconvert_pixfmt_stage(my_src_fmt.fmt.pix.pixelformat);
+		start = v4lconvert_stats_start(data);
 		res = v4lconvert_convert_pixfmt(data, src, src_size,
 				convert1_dest, convert1_dest_size,
 				&my_src_fmt,
@@ -1730,13 +2534,22 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		if (res)
 			return res;
 
+		v4lconvert_stats_end(data, stage, start, src_size,
+				     my_src_fmt.fmt.pix.sizeimage);
 		src_size = my_src_fmt.fmt.pix.sizeimage;
 	}
 
-	if (processing)
-		v4lprocessing_processing(data->processing, convert2_src, &my_src_fmt);
+	if (processing) {
+		start = v4lconvert_stats_start(data);
+		if (v4lprocessing_processing(data->processing, convert2_src,
+					     &my_src_fmt))
+			v4lconvert_stats_end(data, V4LCONVERT_STAGE_PROCESSING,
+					     start, src_size, src_size);
+	}
 
 	if (convert) {
+		stage = v4lconvert_pixfmt_stage(my_src_fmt.fmt.pix.pixelformat);
+		start = v4lconvert_stats_start(data);
 		res = v4lconvert_convert_pixfmt(data, convert2_src, src_size,
 				convert2_dest, convert2_dest_size,
 				&my_src_fmt,
@@ -1744,32 +2557,284 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		if (res)
 			return res;
 
+		v4lconvert_stats_end(data, stage, start, src_size,
+				     my_src_fmt.fmt.pix.sizeimage);
 		src_size = my_src_fmt.fmt.pix.sizeimage;
 
 		/* We call processing here again in case the source format was not
 		   rgb, but the dest is. v4lprocessing checks it self it only actually
 		   does the processing once per frame. */
-		if (processing)
-			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
+		if (processing) {
+			start = v4lconvert_stats_start(data);
+			if (v4lprocessing_processing(data->processing,
+						     convert2_dest, &my_src_fmt))
+				v4lconvert_stats_end(data,
+					V4LCONVERT_STAGE_PROCESSING, start,
+					src_size, src_size);
+		}
 	}
 
-	if (rotate90)
+	size = my_src_fmt.fmt.pix.sizeimage;
+
+	if (rotate90) {
+		start = v4lconvert_stats_start(data);
 		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
+		v4lconvert_stats_end(data, V4LCONVERT_STAGE_ROTATE, start,
+				     size, size);
+	}
 
-	if (hflip || vflip)
+	if (hflip || vflip) {
+		start = v4lconvert_stats_start(data);
 		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
+		v4lconvert_stats_end(data, V4LCONVERT_STAGE_FLIP, start,
+				     size, size);
+	}
 
-	if (crop)
+	if (scale) {
+		start = v4lconvert_stats_start(data);
+		if (v4lconvert_scale(data, crop_src, dest, &my_src_fmt,
+				     &my_dest_fmt))
+			return -1;
+		v4lconvert_stats_end(data, V4LCONVERT_STAGE_CROP, start,
+				     size, dest_needed);
+	} else if (crop) {
+		start = v4lconvert_stats_start(data);
 		v4lconvert_crop(crop_src, dest, &my_src_fmt, &my_dest_fmt);
+		v4lconvert_stats_end(data, V4LCONVERT_STAGE_CROP, start,
+				     size, dest_needed);
+	}
+
+	return dest_needed;
+}
+
+static int v4lconvert_convert_frame(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	unsigned int dest_pix_fmt = dest_fmt->fmt.pix.pixelformat;
+	struct v4l2_format work_fmt = *dest_fmt;
+	struct v4l2_format my_dest_fmt = *dest_fmt;
+	unsigned char *work = dest;
+	int res, steps, dest_needed;
+	uint64_t start;
+
+	work_fmt.fmt.pix.pixelformat = v4lconvert_pack_work_format(dest_pix_fmt);
+	if (!work_fmt.fmt.pix.pixelformat)
+		return v4lconvert_convert_unpacked(data, src_fmt, dest_fmt,
+						   src, src_size, dest, dest_size);
+
+	steps = v4lprocessing_pre_processing(data->processing) ||
+		(data->control_flags & V4LCONTROL_ROTATED_90_JPEG) ||
+		v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP) ||
+		v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP) ||
+		dest_fmt->fmt.pix.width != src_fmt->fmt.pix.width ||
+		dest_fmt->fmt.pix.height != src_fmt->fmt.pix.height;
+
+	/* Plain copy */
+	if (src_fmt->fmt.pix.pixelformat == dest_pix_fmt && !steps)
+		return v4lconvert_convert_unpacked(data, src_fmt, dest_fmt,
+						   src, src_size, dest, dest_size);
+
+	v4lconvert_fixup_fmt(&my_dest_fmt);
+	dest_needed = my_dest_fmt.fmt.pix.sizeimage;
+	if (dest_size < dest_needed) {
+		V4LCONVERT_ERR("destination buffer too small (%d < %d)\n",
+				dest_size, dest_needed);
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!steps) {
+		start = v4lconvert_stats_start(data);
+		/* The direct converters can not work in place */
+		if (src == dest) {
+			src = v4lconvert_get_buffer(data,
+					V4LCONVERT_CONVERT1_BUF, src_size);
+			if (!src)
+				return v4lconvert_oom_error(data);
+			memcpy(src, dest, src_size);
+		}
+		if (v4lconvert_pack_direct(data, src, src_size, dest, src_fmt,
+					   &my_dest_fmt)) {
+			v4lconvert_stats_end(data,
+				v4lconvert_pixfmt_stage(src_fmt->fmt.pix.pixelformat),
+				start, src_size, dest_needed);
+			return dest_needed;
+		}
+	}
+
+	/* YUYV is smaller than its work format, the others get packed in
+	   place */
+	v4lconvert_fixup_fmt(&work_fmt);
+	if (dest_pix_fmt == V4L2_PIX_FMT_YUYV) {
+		work = v4lconvert_get_buffer(data, V4LCONVERT_PACK_BUF,
+					     work_fmt.fmt.pix.sizeimage);
+		if (!work)
+			return v4lconvert_oom_error(data);
+	}
+
+	res = v4lconvert_convert_unpacked(data, src_fmt, &work_fmt, src,
+			src_size, work, work == dest ? dest_size :
+					work_fmt.fmt.pix.sizeimage);
+	if (res < 0)
+		return res;
+
+	start = v4lconvert_stats_start(data);
+	if (v4lconvert_pack(data, work, dest, &work_fmt, dest_pix_fmt))
+		return -1;
+	v4lconvert_stats_end(data, V4LCONVERT_STAGE_CONVERT, start,
+			     work_fmt.fmt.pix.sizeimage, dest_needed);
 
 	return dest_needed;
 }
 
+/*
+ * With V4LCONVERT_SKIP_UNCHANGED a frame is keyed by the hash of its source
+ * data, the formats and the flip controls. When the key is the same as for
+ * the previous frame, its output gets copied instead of converting the frame
+ * again. Frames which go through the software processing are always
+ * converted, as the auto gain / white balance state changes between frames.
+ */
+static int v4lconvert_convert_skip_unchanged(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	uint64_t hash;
+	int flips, res;
+
+	data->frame_unchanged = 0;
+	if (!(data->flags & V4LCONVERT_SKIP_UNCHANGED) || src_size <= 0 ||
+	    v4lprocessing_active(data->processing))
+		return v4lconvert_convert_frame(data, src_fmt, dest_fmt,
+				src, src_size, dest, dest_size);
+
+	hash = v4lconvert_hash(src, src_size);
+	flips = (v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP) ? 1 : 0) |
+		(v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP) ? 2 : 0);
+
+	if (data->last_frame_size > 0 && hash == data->last_hash &&
+	    flips == data->last_flips &&
+	    data->last_frame_size <= dest_size &&
+	    !memcmp(&src_fmt->fmt.pix, &data->last_src_pix,
+		    sizeof(data->last_src_pix)) &&
+	    !memcmp(&dest_fmt->fmt.pix, &data->last_dest_pix,
+		    sizeof(data->last_dest_pix))) {
+		memcpy(dest, data->last_frame, data->last_frame_size);
+		data->frame_unchanged = 1;
+		return data->last_frame_size;
+	}
+
+	data->last_frame_size = 0;
+	res = v4lconvert_convert_frame(data, src_fmt, dest_fmt, src, src_size,
+				       dest, dest_size);
+	if (res <= 0 || !v4lconvert_alloc_buffer(res, &data->last_frame,
+						 &data->last_frame_alloc))
+		return res;
+
+	memcpy(data->last_frame, dest, res);
+	data->last_frame_size = res;
+	data->last_hash = hash;
+	data->last_flips = flips;
+	data->last_src_pix = src_fmt->fmt.pix;
+	data->last_dest_pix = dest_fmt->fmt.pix;
+
+	return res;
+}
+
+static int v4lconvert_convert_probed(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	uint64_t start = V4L_PROBE_START(libv4lconvert, convert_return);
+	int res;
+
+	V4L_PROBE(libv4lconvert, convert_entry, src_fmt->fmt.pix.pixelformat,
+		  dest_fmt->fmt.pix.pixelformat, src_size);
+	res = v4lconvert_convert_skip_unchanged(data, src_fmt, dest_fmt,
+			src, src_size, dest, dest_size);
+	V4L_PROBE(libv4lconvert, convert_return, src_fmt->fmt.pix.pixelformat,
+		  dest_fmt->fmt.pix.pixelformat, res, data->frame_unchanged,
+		  V4L_PROBE_NS(start));
+
+	return res;
+}
+
+int v4lconvert_convert(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	int res;
+
+	/* Uncontended unless contexts are converting processed frames */
+	pthread_mutex_lock(&data->processing_lock);
+	res = v4lconvert_convert_probed(data, src_fmt, dest_fmt,
+			src, src_size, dest, dest_size);
+	pthread_mutex_unlock(&data->processing_lock);
+
+	return res;
+}
+
+/*
+ * The software processing has per device state, so a context only gets
+ * it, under the processing_lock of its instance, for the frames which are
+ * processed. The other frames are converted without any locking.
+ */
+int v4lconvert_convert_ctx(struct v4lconvert_ctx *ctx,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	struct v4lconvert_data *parent = ctx->parent;
+	struct v4lconvert_data *data = &ctx->data;
+	int res;
+
+	/* Keep a fallback to tinyjpeg this context ran into */
+	data->flags = parent->flags | (data->flags & V4LCONVERT_USE_TINYJPEG);
+
+	if (!v4lprocessing_enabled(parent->processing))
+		return v4lconvert_convert_probed(data, src_fmt, dest_fmt,
+				src, src_size, dest, dest_size);
+
+	pthread_mutex_lock(&parent->processing_lock);
+	data->processing = parent->processing;
+	res = v4lconvert_convert_probed(data, src_fmt, dest_fmt,
+			src, src_size, dest, dest_size);
+	data->processing = NULL;
+	pthread_mutex_unlock(&parent->processing_lock);
+
+	return res;
+}
+
+void v4lconvert_enable_skip_unchanged(struct v4lconvert_data *data,
+		int enable)
+{
+	if (enable) {
+		data->flags |= V4LCONVERT_SKIP_UNCHANGED;
+	} else {
+		data->flags &= ~V4LCONVERT_SKIP_UNCHANGED;
+		data->last_frame_size = 0;
+	}
+}
+
+int v4lconvert_frame_unchanged(struct v4lconvert_data *data)
+{
+	return data->frame_unchanged;
+}
+
 const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
 {
 	return data->error_msg;
 }
 
+const char *v4lconvert_ctx_get_error_message(struct v4lconvert_ctx *ctx)
+{
+	return ctx->data.error_msg;
+}
+
 static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 		unsigned int pixelformat, int index)
 {
@@ -1811,7 +2876,9 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 				return;
 			}
 			data->framesizes[data->no_framesizes].type = frmsize.type;
-			data->framesize_supported_src_formats[data->no_framesizes] = 1ULL << index;
+			memset(data->framesize_supported_src_formats[data->no_framesizes],
+			       0, sizeof(data->framesize_supported_src_formats[0]));
+			set_bit(index, data->framesize_supported_src_formats[data->no_framesizes]);
 
 			switch (frmsize.type) {
 			case V4L2_FRMSIZE_TYPE_DISCRETE:
@@ -1824,15 +2891,33 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 			}
 			data->no_framesizes++;
 		} else {
-			data->framesize_supported_src_formats[j] |= 1ULL << index;
+			set_bit(index, data->framesize_supported_src_formats[j]);
 		}
 	}
 }
 
+/* Enumerating the framesizes of all formats takes many ioctls, which on
+   UVC cams cause USB I/O, so this is only done when they are first needed
+   instead of on every open */
+static void v4lconvert_get_all_framesizes(struct v4lconvert_data *data)
+{
+	int i, j;
+
+	if (data->have_framesizes)
+		return;
+
+	data->have_framesizes = 1;
+	for (i = 0; i < data->no_src_fmt_order; i++) {
+		j = data->src_fmt_order[i];
+		v4lconvert_get_framesizes(data, supported_src_pixfmts[j].fmt, j);
+	}
+}
+
 int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 		struct v4l2_frmsizeenum *frmsize)
 {
-	if (!v4lconvert_supported_dst_format(frmsize->pixel_format)) {
+	if (!v4lconvert_supported_dst_format(frmsize->pixel_format) ||
+	    v4lconvert_passthrough_format(data, frmsize->pixel_format)) {
 		if (v4lconvert_supported_dst_fmt_only(data)) {
 			errno = EINVAL;
 			return -1;
@@ -1841,6 +2926,7 @@ int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 				VIDIOC_ENUM_FRAMESIZES, frmsize);
 	}
 
+	v4lconvert_get_all_framesizes(data);
 	if (frmsize->index >= data->no_framesizes) {
 		errno = EINVAL;
 		return -1;
@@ -1870,7 +2956,8 @@ int v4lconvert_enum_frameintervals(struct v4lconvert_data *data,
 	int res;
 	struct v4l2_format src_fmt, dest_fmt;
 
-	if (!v4lconvert_supported_dst_format(frmival->pixel_format)) {
+	if (!v4lconvert_supported_dst_format(frmival->pixel_format) ||
+	    v4lconvert_passthrough_format(data, frmival->pixel_format)) {
 		if (v4lconvert_supported_dst_fmt_only(data)) {
 			errno = EINVAL;
 			return -1;
@@ -1980,6 +3067,22 @@ int v4lconvert_vidioc_s_ext_ctrls(struct v4lconvert_data *data, void *arg)
 	return v4lcontrol_vidioc_s_ext_ctrls(data->control, arg);
 }
 
+int v4lconvert_vidioc_subscribe_event(struct v4lconvert_data *data, void *arg)
+{
+	return v4lcontrol_vidioc_subscribe_event(data->control, arg);
+}
+
+int v4lconvert_vidioc_unsubscribe_event(struct v4lconvert_data *data,
+		void *arg)
+{
+	return v4lcontrol_vidioc_unsubscribe_event(data->control, arg);
+}
+
+int v4lconvert_vidioc_dqevent(struct v4lconvert_data *data, void *arg)
+{
+	return v4lcontrol_vidioc_dqevent(data->control, arg);
+}
+
 int v4lconvert_get_fps(struct v4lconvert_data *data)
 {
 	return data->fps;
@@ -1989,3 +3092,68 @@ void v4lconvert_set_fps(struct v4lconvert_data *data, int fps)
 {
 	data->fps = fps;
 }
+
+int v4lconvert_get_threads(struct v4lconvert_data *data)
+{
+	return v4lconvert_pool_threads(data->pool);
+}
+
+int v4lconvert_set_threads(struct v4lconvert_data *data, int threads)
+{
+	struct v4lconvert_pool *pool = NULL;
+
+	if (threads < 1 || threads > V4LCONVERT_MAX_THREADS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (threads == v4lconvert_pool_threads(data->pool))
+		return 0;
+
+	if (threads > 1) {
+		pool = v4lconvert_pool_create(threads);
+		if (!pool)
+			return -1;
+	}
+
+	v4lconvert_pool_destroy(data->pool);
+	data->pool = pool;
+
+	return 0;
+}
+
+void v4lconvert_enable_stats(struct v4lconvert_data *data, int enable)
+{
+	if (enable && !data->stats_enabled)
+		memset(&data->stats, 0, sizeof(data->stats));
+	data->stats_enabled = enable;
+}
+
+int v4lconvert_get_stats(struct v4lconvert_data *data,
+		struct v4lconvert_stats *stats)
+{
+	if (!data->stats_enabled) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*stats = data->stats;
+	return 0;
+}
+
+const char *v4lconvert_get_stage_name(int stage)
+{
+	static const char *names[V4LCONVERT_STAGE_COUNT] = {
+		[V4LCONVERT_STAGE_DECODE] = "decode",
+		[V4LCONVERT_STAGE_CONVERT] = "convert",
+		[V4LCONVERT_STAGE_PROCESSING] = "processing",
+		[V4LCONVERT_STAGE_ROTATE] = "rotate",
+		[V4LCONVERT_STAGE_FLIP] = "flip",
+		[V4LCONVERT_STAGE_CROP] = "crop",
+	};
+
+	if (stage < 0 || stage >= V4LCONVERT_STAGE_COUNT)
+		return NULL;
+
+	return names[stage];
+}
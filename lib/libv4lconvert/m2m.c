@@ -0,0 +1,493 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Offload the pixel format conversion to a V4L2 mem2mem device, such as the
+ * color converter, scaler or JPEG decoder found in many SoCs.
+ *
+ * This is only used when the LIBV4LCONVERT_M2M environment variable is set,
+ * either to the device node to use, or to any other value to use the first
+ * mem2mem video node which can do the conversion. Frames are handed to the
+ * device as USERPTR buffers when the driver supports those, and copied in
+ * and out of MMAP buffers otherwise. Whenever the device can not do a
+ * conversion, libv4lconvert falls back to doing it in software.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "libv4lconvert-priv.h"
+#include "libv4lsyscall-priv.h"
+
+#define V4LCONVERT_M2M_MAX_NODES	64
+#define V4LCONVERT_M2M_TIMEOUT		1000 /* ms */
+#define V4LCONVERT_M2M_MAX_FAILED	8
+
+struct v4lconvert_m2m_cfg {
+	unsigned int src_pix_fmt;
+	unsigned int dest_pix_fmt;
+	unsigned int width;
+	unsigned int height;
+	unsigned int bytesperline;
+};
+
+struct v4lconvert_m2m_buf {
+	enum v4l2_buf_type type;
+	enum v4l2_memory memory;
+	void *start; /* MMAP only */
+	size_t length;
+};
+
+struct v4lconvert_m2m {
+	char *devname; /* NULL to search all video nodes */
+	int fd;
+	int mplane;
+	int streaming;
+	struct v4lconvert_m2m_cfg cfg;
+	/* Configurations the device could not do, these are not retried */
+	struct v4lconvert_m2m_cfg failed[V4LCONVERT_M2M_MAX_FAILED];
+	int next_failed;
+	struct v4lconvert_m2m_buf out, cap;
+};
+
+static int m2m_ioctl(int fd, unsigned long cmd, void *arg)
+{
+	int result;
+
+	do {
+		result = SYS_IOCTL(fd, cmd, arg);
+	} while (result == -1 && errno == EINTR);
+
+	return result;
+}
+
+static int m2m_has_fmt(int fd, enum v4l2_buf_type type, unsigned int pixfmt)
+{
+	struct v4l2_fmtdesc fmtdesc = { .type = type };
+
+	for (; m2m_ioctl(fd, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index++)
+		if (fmtdesc.pixelformat == pixfmt)
+			return 1;
+
+	return 0;
+}
+
+static int m2m_can_do(int fd, int mplane, const struct v4lconvert_m2m_cfg *cfg)
+{
+	return m2m_has_fmt(fd, mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+					V4L2_BUF_TYPE_VIDEO_OUTPUT,
+			   cfg->src_pix_fmt) &&
+	       m2m_has_fmt(fd, mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+					V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			   cfg->dest_pix_fmt);
+}
+
+/* Returns the fd of devname if it is a mem2mem device which can do cfg */
+static int m2m_open(const char *devname, const struct v4lconvert_m2m_cfg *cfg,
+		int *mplane)
+{
+	struct v4l2_capability cap;
+	unsigned int caps;
+	int fd;
+
+	fd = SYS_OPEN(devname, O_RDWR | O_NONBLOCK, 0);
+	if (fd == -1)
+		return -1;
+
+	if (m2m_ioctl(fd, VIDIOC_QUERYCAP, &cap))
+		goto error;
+
+	caps = cap.capabilities;
+	if (caps & V4L2_CAP_DEVICE_CAPS)
+		caps = cap.device_caps;
+	if (!(caps & V4L2_CAP_STREAMING))
+		goto error;
+
+	if (caps & V4L2_CAP_VIDEO_M2M)
+		*mplane = 0;
+	else if (caps & V4L2_CAP_VIDEO_M2M_MPLANE)
+		*mplane = 1;
+	else
+		goto error;
+
+	if (!m2m_can_do(fd, *mplane, cfg))
+		goto error;
+
+	return fd;
+
+error:
+	SYS_CLOSE(fd);
+	return -1;
+}
+
+static int m2m_find(struct v4lconvert_m2m *m2m,
+		const struct v4lconvert_m2m_cfg *cfg)
+{
+	char devname[32];
+	int i;
+
+	if (m2m->devname)
+		return m2m_open(m2m->devname, cfg, &m2m->mplane);
+
+	for (i = 0; i < V4LCONVERT_M2M_MAX_NODES; i++) {
+		int fd;
+
+		snprintf(devname, sizeof(devname), "/dev/video%d", i);
+		fd = m2m_open(devname, cfg, &m2m->mplane);
+		if (fd != -1)
+			return fd;
+	}
+
+	return -1;
+}
+
+static void m2m_stop(struct v4lconvert_m2m *m2m)
+{
+	struct v4lconvert_m2m_buf *bufs[2] = { &m2m->out, &m2m->cap };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		struct v4l2_requestbuffers req = {
+			.type = bufs[i]->type,
+			.memory = bufs[i]->memory,
+		};
+
+		if (!bufs[i]->memory)
+			continue;
+
+		m2m_ioctl(m2m->fd, VIDIOC_STREAMOFF, &bufs[i]->type);
+		if (bufs[i]->start)
+			SYS_MUNMAP(bufs[i]->start, bufs[i]->length);
+		m2m_ioctl(m2m->fd, VIDIOC_REQBUFS, &req);
+		bufs[i]->memory = 0;
+		bufs[i]->start = NULL;
+		bufs[i]->length = 0;
+	}
+	m2m->streaming = 0;
+}
+
+/* Set the format of one queue, the device must take it unmodified, except
+   for the bytesperline of compressed formats, returns the sizeimage */
+static int m2m_set_fmt(struct v4lconvert_m2m *m2m, enum v4l2_buf_type type,
+		unsigned int pixfmt, const struct v4l2_format *src_fmt,
+		unsigned int bytesperline, unsigned int sizeimage)
+{
+	struct v4l2_format fmt = { .type = type };
+
+	if (m2m->mplane) {
+		struct v4l2_pix_format_mplane *pix = &fmt.fmt.pix_mp;
+
+		pix->width = src_fmt->fmt.pix.width;
+		pix->height = src_fmt->fmt.pix.height;
+		pix->pixelformat = pixfmt;
+		pix->field = V4L2_FIELD_NONE;
+		pix->colorspace = src_fmt->fmt.pix.colorspace;
+		pix->ycbcr_enc = src_fmt->fmt.pix.ycbcr_enc;
+		pix->quantization = src_fmt->fmt.pix.quantization;
+		pix->num_planes = 1;
+		pix->plane_fmt[0].bytesperline = bytesperline;
+		pix->plane_fmt[0].sizeimage = sizeimage;
+		if (m2m_ioctl(m2m->fd, VIDIOC_S_FMT, &fmt) ||
+		    pix->pixelformat != pixfmt || pix->num_planes != 1 ||
+		    pix->width != src_fmt->fmt.pix.width ||
+		    pix->height != src_fmt->fmt.pix.height ||
+		    (bytesperline &&
+		     pix->plane_fmt[0].bytesperline != bytesperline))
+			return -1;
+
+		return pix->plane_fmt[0].sizeimage;
+	}
+
+	fmt.fmt.pix.width = src_fmt->fmt.pix.width;
+	fmt.fmt.pix.height = src_fmt->fmt.pix.height;
+	fmt.fmt.pix.pixelformat = pixfmt;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	fmt.fmt.pix.bytesperline = bytesperline;
+	fmt.fmt.pix.sizeimage = sizeimage;
+	fmt.fmt.pix.colorspace = src_fmt->fmt.pix.colorspace;
+	fmt.fmt.pix.ycbcr_enc = src_fmt->fmt.pix.ycbcr_enc;
+	fmt.fmt.pix.quantization = src_fmt->fmt.pix.quantization;
+	if (m2m_ioctl(m2m->fd, VIDIOC_S_FMT, &fmt) ||
+	    fmt.fmt.pix.pixelformat != pixfmt ||
+	    fmt.fmt.pix.width != src_fmt->fmt.pix.width ||
+	    fmt.fmt.pix.height != src_fmt->fmt.pix.height ||
+	    (bytesperline && fmt.fmt.pix.bytesperline != bytesperline))
+		return -1;
+
+	return fmt.fmt.pix.sizeimage;
+}
+
+/* Get 1 buffer for a queue, preferring USERPTR so that no copies are made */
+static int m2m_request_buf(struct v4lconvert_m2m *m2m,
+		struct v4lconvert_m2m_buf *buf, int sizeimage)
+{
+	struct v4l2_requestbuffers req = {
+		.count = 1,
+		.type = buf->type,
+		.memory = V4L2_MEMORY_USERPTR,
+	};
+	struct v4l2_plane plane;
+	struct v4l2_buffer vbuf;
+	void *start;
+
+	if (m2m_ioctl(m2m->fd, VIDIOC_REQBUFS, &req) == 0 && req.count) {
+		buf->memory = V4L2_MEMORY_USERPTR;
+		buf->length = sizeimage;
+		return 0;
+	}
+
+	req.count = 1;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (m2m_ioctl(m2m->fd, VIDIOC_REQBUFS, &req) || !req.count)
+		return -1;
+	buf->memory = V4L2_MEMORY_MMAP;
+
+	memset(&vbuf, 0, sizeof(vbuf));
+	memset(&plane, 0, sizeof(plane));
+	vbuf.type = buf->type;
+	vbuf.memory = V4L2_MEMORY_MMAP;
+	if (m2m->mplane) {
+		vbuf.m.planes = &plane;
+		vbuf.length = 1;
+	}
+	if (m2m_ioctl(m2m->fd, VIDIOC_QUERYBUF, &vbuf))
+		return -1;
+
+	if (m2m->mplane) {
+		buf->length = plane.length;
+		start = (void *)SYS_MMAP(NULL, plane.length,
+				PROT_READ | PROT_WRITE, MAP_SHARED, m2m->fd,
+				plane.m.mem_offset);
+	} else {
+		buf->length = vbuf.length;
+		start = (void *)SYS_MMAP(NULL, vbuf.length,
+				PROT_READ | PROT_WRITE, MAP_SHARED, m2m->fd,
+				vbuf.m.offset);
+	}
+	if (start == MAP_FAILED)
+		return -1;
+
+	buf->start = start;
+	return 0;
+}
+
+static int m2m_start(struct v4lconvert_m2m *m2m,
+		const struct v4lconvert_m2m_cfg *cfg,
+		const struct v4l2_format *fmt, int src_size, int dest_size)
+{
+	unsigned int dest_bpl = cfg->width;
+	int compressed, src_sizeimage, dest_sizeimage;
+
+	if (m2m->streaming)
+		m2m_stop(m2m);
+
+	/* A device found for an earlier configuration may not do this one */
+	if (m2m->fd != -1 && !m2m_can_do(m2m->fd, m2m->mplane, cfg)) {
+		SYS_CLOSE(m2m->fd);
+		m2m->fd = -1;
+	}
+	if (m2m->fd == -1) {
+		m2m->fd = m2m_find(m2m, cfg);
+		if (m2m->fd == -1)
+			return -1;
+	}
+	m2m->cfg = *cfg;
+
+	m2m->out.type = m2m->mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+				      V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	m2m->cap.type = m2m->mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+				      V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	compressed = cfg->src_pix_fmt == V4L2_PIX_FMT_MJPEG ||
+		     cfg->src_pix_fmt == V4L2_PIX_FMT_JPEG;
+	src_sizeimage = m2m_set_fmt(m2m, m2m->out.type, cfg->src_pix_fmt, fmt,
+				    compressed ? 0 : cfg->bytesperline,
+				    src_size);
+	if (src_sizeimage < 0)
+		return -1;
+
+	/* libv4lconvert frames have no padding */
+	if (cfg->dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
+	    cfg->dest_pix_fmt == V4L2_PIX_FMT_BGR24)
+		dest_bpl = cfg->width * 3;
+	dest_sizeimage = m2m_set_fmt(m2m, m2m->cap.type, cfg->dest_pix_fmt,
+				     fmt, dest_bpl, dest_size);
+	if (dest_sizeimage < 0)
+		return -1;
+
+	if (m2m_request_buf(m2m, &m2m->out, src_sizeimage) ||
+	    m2m_request_buf(m2m, &m2m->cap, dest_sizeimage))
+		goto error;
+
+	if (m2m_ioctl(m2m->fd, VIDIOC_STREAMON, &m2m->out.type) ||
+	    m2m_ioctl(m2m->fd, VIDIOC_STREAMON, &m2m->cap.type))
+		goto error;
+
+	m2m->streaming = 1;
+	return 0;
+
+error:
+	m2m_stop(m2m);
+	return -1;
+}
+
+static int m2m_qbuf(struct v4lconvert_m2m *m2m, struct v4lconvert_m2m_buf *buf,
+		unsigned char *data, int size, int bytesused)
+{
+	struct v4l2_plane plane;
+	struct v4l2_buffer vbuf;
+
+	memset(&vbuf, 0, sizeof(vbuf));
+	memset(&plane, 0, sizeof(plane));
+	vbuf.type = buf->type;
+	vbuf.memory = buf->memory;
+	vbuf.field = V4L2_FIELD_NONE;
+
+	if (buf->memory == V4L2_MEMORY_MMAP) {
+		if ((size_t)bytesused > buf->length)
+			return -1;
+		if (bytesused)
+			memcpy(buf->start, data, bytesused);
+		size = buf->length;
+	}
+
+	if (m2m->mplane) {
+		if (buf->memory == V4L2_MEMORY_USERPTR)
+			plane.m.userptr = (unsigned long)data;
+		plane.length = size;
+		plane.bytesused = bytesused;
+		vbuf.m.planes = &plane;
+		vbuf.length = 1;
+	} else {
+		if (buf->memory == V4L2_MEMORY_USERPTR)
+			vbuf.m.userptr = (unsigned long)data;
+		vbuf.length = size;
+		vbuf.bytesused = bytesused;
+	}
+
+	return m2m_ioctl(m2m->fd, VIDIOC_QBUF, &vbuf);
+}
+
+/* Returns the bytesused of the dequeued buffer, or -1 on error */
+static int m2m_dqbuf(struct v4lconvert_m2m *m2m, struct v4lconvert_m2m_buf *buf,
+		short events)
+{
+	struct pollfd pfd = { .fd = m2m->fd, .events = events };
+	struct v4l2_plane plane;
+	struct v4l2_buffer vbuf;
+	int result;
+
+	do {
+		result = poll(&pfd, 1, V4LCONVERT_M2M_TIMEOUT);
+	} while (result == -1 && errno == EINTR);
+	if (result != 1 || !(pfd.revents & events))
+		return -1;
+
+	memset(&vbuf, 0, sizeof(vbuf));
+	memset(&plane, 0, sizeof(plane));
+	vbuf.type = buf->type;
+	vbuf.memory = buf->memory;
+	if (m2m->mplane) {
+		vbuf.m.planes = &plane;
+		vbuf.length = 1;
+	}
+	if (m2m_ioctl(m2m->fd, VIDIOC_DQBUF, &vbuf) ||
+	    (vbuf.flags & V4L2_BUF_FLAG_ERROR))
+		return -1;
+
+	return m2m->mplane ? plane.bytesused : vbuf.bytesused;
+}
+
+struct v4lconvert_m2m *v4lconvert_m2m_create(const char *devname)
+{
+	struct v4lconvert_m2m *m2m = calloc(1, sizeof(*m2m));
+
+	if (!m2m)
+		return NULL;
+
+	m2m->fd = -1;
+	if (devname[0] == '/') {
+		m2m->devname = strdup(devname);
+		if (!m2m->devname) {
+			free(m2m);
+			return NULL;
+		}
+	}
+
+	return m2m;
+}
+
+void v4lconvert_m2m_destroy(struct v4lconvert_m2m *m2m)
+{
+	if (!m2m)
+		return;
+
+	if (m2m->fd != -1) {
+		m2m_stop(m2m);
+		SYS_CLOSE(m2m->fd);
+	}
+	free(m2m->devname);
+	free(m2m);
+}
+
+int v4lconvert_m2m_convert(struct v4lconvert_m2m *m2m,
+		unsigned char *src, int src_size,
+		unsigned char *dest, int dest_size,
+		const struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_m2m_cfg cfg;
+	int i, dest_needed;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.src_pix_fmt = fmt->fmt.pix.pixelformat;
+	cfg.dest_pix_fmt = dest_pix_fmt;
+	cfg.width = fmt->fmt.pix.width;
+	cfg.height = fmt->fmt.pix.height;
+	cfg.bytesperline = fmt->fmt.pix.bytesperline;
+
+	for (i = 0; i < V4LCONVERT_M2M_MAX_FAILED; i++)
+		if (!memcmp(&cfg, &m2m->failed[i], sizeof(cfg)))
+			return 0;
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		dest_needed = cfg.width * cfg.height * 3;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		dest_needed = cfg.width * cfg.height * 3 / 2;
+		break;
+	default:
+		return 0;
+	}
+	if (dest_size < dest_needed)
+		return 0;
+
+	if ((!m2m->streaming || memcmp(&cfg, &m2m->cfg, sizeof(cfg))) &&
+	    m2m_start(m2m, &cfg, fmt, src_size, dest_needed))
+		goto error;
+
+	if (m2m_qbuf(m2m, &m2m->out, src, src_size, src_size) ||
+	    m2m_qbuf(m2m, &m2m->cap, dest, dest_needed, 0))
+		goto error;
+
+	if (m2m_dqbuf(m2m, &m2m->cap, POLLIN) < dest_needed ||
+	    m2m_dqbuf(m2m, &m2m->out, POLLOUT) < 0)
+		goto error;
+
+	if (m2m->cap.memory == V4L2_MEMORY_MMAP)
+		memcpy(dest, m2m->cap.start, dest_needed);
+
+	return 1;
+
+error:
+	/* Let the CPU do this configuration from now on */
+	m2m_stop(m2m);
+	m2m->failed[m2m->next_failed] = cfg;
+	m2m->next_failed = (m2m->next_failed + 1) % V4LCONVERT_M2M_MAX_FAILED;
+	return 0;
+}
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD row kernels for packing into the destination formats in pack.c
+ *
+ * These only move bytes around, so they trivially give the same results as
+ * the C code. They do as many pixels of a line as fit in whole SIMD blocks
+ * and return the number of pixels done, the C code does the remainder.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/* 16 24 bit pixels get spread over 4 registers with alignr and then padded
+   with an alpha byte */
+static SSSE3 int rgb24_to_rgb32_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m128i pad = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 3 * x + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + 3 * x + 32));
+		__m128i *d = (__m128i *)(dest + 4 * x);
+
+		_mm_storeu_si128(d, _mm_or_si128(_mm_shuffle_epi8(a, pad), alpha));
+		_mm_storeu_si128(d + 1, _mm_or_si128(_mm_shuffle_epi8(
+				_mm_alignr_epi8(b, a, 12), pad), alpha));
+		_mm_storeu_si128(d + 2, _mm_or_si128(_mm_shuffle_epi8(
+				_mm_alignr_epi8(c, b, 8), pad), alpha));
+		_mm_storeu_si128(d + 3, _mm_or_si128(_mm_shuffle_epi8(
+				_mm_srli_si128(c, 4), pad), alpha));
+	}
+
+	return x;
+}
+
+static SSE2 int uv_to_nv_row_sse2(const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i cu = _mm_loadu_si128((const __m128i *)(u + x));
+		__m128i cv = _mm_loadu_si128((const __m128i *)(v + x));
+
+		_mm_storeu_si128((__m128i *)(dest + 2 * x),
+				 _mm_unpacklo_epi8(cu, cv));
+		_mm_storeu_si128((__m128i *)(dest + 2 * x + 16),
+				 _mm_unpackhi_epi8(cu, cv));
+	}
+
+	return x;
+}
+
+static SSE2 int yuv420_to_yuyv_row_sse2(const unsigned char *y,
+		const unsigned char *u, const unsigned char *v,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m128i y0 = _mm_loadu_si128((const __m128i *)(y + x));
+		__m128i y1 = _mm_loadu_si128((const __m128i *)(y + x + 16));
+		__m128i cu = _mm_loadu_si128((const __m128i *)(u + x / 2));
+		__m128i cv = _mm_loadu_si128((const __m128i *)(v + x / 2));
+		__m128i uv0 = _mm_unpacklo_epi8(cu, cv);
+		__m128i uv1 = _mm_unpackhi_epi8(cu, cv);
+		__m128i *d = (__m128i *)(dest + 2 * x);
+
+		_mm_storeu_si128(d, _mm_unpacklo_epi8(y0, uv0));
+		_mm_storeu_si128(d + 1, _mm_unpackhi_epi8(y0, uv0));
+		_mm_storeu_si128(d + 2, _mm_unpacklo_epi8(y1, uv1));
+		_mm_storeu_si128(d + 3, _mm_unpackhi_epi8(y1, uv1));
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+static int rgb24_to_rgb32_row_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x3_t rgb = vld3q_u8(src + 3 * x);
+		uint8x16x4_t rgba;
+
+		rgba.val[0] = rgb.val[0];
+		rgba.val[1] = rgb.val[1];
+		rgba.val[2] = rgb.val[2];
+		rgba.val[3] = vdupq_n_u8(0xff);
+		vst4q_u8(dest + 4 * x, rgba);
+	}
+
+	return x;
+}
+
+static int uv_to_nv_row_neon(const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x2_t uv;
+
+		uv.val[0] = vld1q_u8(u + x);
+		uv.val[1] = vld1q_u8(v + x);
+		vst2q_u8(dest + 2 * x, uv);
+	}
+
+	return x;
+}
+
+static int yuv420_to_yuyv_row_neon(const unsigned char *y,
+		const unsigned char *u, const unsigned char *v,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		uint8x16x2_t yy = vld2q_u8(y + x);
+		uint8x16x4_t yuyv;
+
+		yuyv.val[0] = yy.val[0];
+		yuyv.val[1] = vld1q_u8(u + x / 2);
+		yuyv.val[2] = yy.val[1];
+		yuyv.val[3] = vld1q_u8(v + x / 2);
+		vst4q_u8(dest + 2 * x, yuyv);
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_rgb24_to_rgb32_row(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return rgb24_to_rgb32_row_ssse3(src, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return rgb24_to_rgb32_row_neon(src, dest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_uv_to_nv_row(const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return uv_to_nv_row_sse2(u, v, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return uv_to_nv_row_neon(u, v, dest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_yuv420_to_yuyv_row(const unsigned char *y,
+		const unsigned char *u, const unsigned char *v,
+		unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return yuv420_to_yuyv_row_sse2(y, u, v, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return yuv420_to_yuyv_row_neon(y, u, v, dest, width);
+#endif
+	return 0;
+}
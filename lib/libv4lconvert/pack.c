@@ -0,0 +1,386 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Conversion to the destination formats which the conversion steps do not
+ * work on: NV12, YUYV, RGBA32 and ABGR32 (which is B, G, R, A in memory)
+ *
+ * The common camera formats are converted to these directly, a line at a
+ * time. Everything else, and all conversions which also process, rotate,
+ * flip, crop or scale the frame, is done in the closest format the
+ * conversion steps do work on (see v4lconvert_pack_work_format()), which
+ * then gets packed into the destination format. RGBA32 / ABGR32 and NV12
+ * are at least as large as their work format, so they get packed in place.
+ */
+
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+unsigned int v4lconvert_pack_work_format(unsigned int dest_pix_fmt)
+{
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUYV:
+		return V4L2_PIX_FMT_YUV420;
+	case V4L2_PIX_FMT_RGBA32:
+		return V4L2_PIX_FMT_RGB24;
+	case V4L2_PIX_FMT_ABGR32:
+		return V4L2_PIX_FMT_BGR24;
+	}
+
+	return 0;
+}
+
+static void rgb24_to_rgb32_row(const unsigned char *src, unsigned char *dest,
+		int width)
+{
+	int x = v4lconvert_simd_rgb24_to_rgb32_row(src, dest, width);
+
+	for (; x < width; x++) {
+		dest[4 * x] = src[3 * x];
+		dest[4 * x + 1] = src[3 * x + 1];
+		dest[4 * x + 2] = src[3 * x + 2];
+		dest[4 * x + 3] = 0xff;
+	}
+}
+
+/* Interleave width U and V samples */
+static void uv_to_nv_row(const unsigned char *u, const unsigned char *v,
+		unsigned char *dest, int width)
+{
+	int x = v4lconvert_simd_uv_to_nv_row(u, v, dest, width);
+
+	for (; x < width; x++) {
+		dest[2 * x] = u[x];
+		dest[2 * x + 1] = v[x];
+	}
+}
+
+static void yuv420_to_yuyv_row(const unsigned char *y, const unsigned char *u,
+		const unsigned char *v, unsigned char *dest, int width)
+{
+	int x = v4lconvert_simd_yuv420_to_yuyv_row(y, u, v, dest, width);
+
+	for (; x + 1 < width; x += 2) {
+		dest[2 * x] = y[x];
+		dest[2 * x + 1] = u[x / 2];
+		dest[2 * x + 2] = y[x + 1];
+		dest[2 * x + 3] = v[x / 2];
+	}
+	/* An odd last pixel only has room for its Y and U values */
+	if (x < width) {
+		dest[2 * x] = y[x];
+		dest[2 * x + 1] = u[x / 2];
+	}
+}
+
+/* Split a line of width / 2 interleaved chroma pairs into U and V */
+static void nv_to_uv_row(const unsigned char *uv, unsigned char *u,
+		unsigned char *v, int width, int vu)
+{
+	int x = v4lconvert_simd_nv_to_uv_row(uv, uv, vu ? v : u, vu ? u : v,
+					     width);
+
+	for (; x + 1 < width; x += 2) {
+		u[x / 2] = uv[x + vu];
+		v[x / 2] = uv[x + !vu];
+	}
+}
+
+/* The source formats with a direct converter, and the size of a frame */
+static int v4lconvert_direct_src_size(const struct v4l2_format *fmt)
+{
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		return stride * height;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		return stride * height * 3 / 2;
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		/* Like the other converters these assume packed lines */
+		return width * height * 3;
+	}
+
+	return 0;
+}
+
+static void v4lconvert_direct_to_rgb32(const unsigned char *src,
+		unsigned char *dest, unsigned char *line,
+		const struct v4l2_format *fmt, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	unsigned int pixfmt = fmt->fmt.pix.pixelformat;
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+	const unsigned char *chroma = src + stride * height;
+	int y;
+
+	for (y = 0; y < height; y++) {
+		const unsigned char *s = src + y * stride;
+		const unsigned char *u, *v;
+
+		switch (pixfmt) {
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv422_to_rgbbgr24_row(s, line, width,
+					V4LCONVERT_YUV422_YUYV, bgr, m);
+			break;
+		case V4L2_PIX_FMT_YVYU:
+			v4lconvert_yuv422_to_rgbbgr24_row(s, line, width,
+					V4LCONVERT_YUV422_YVYU, bgr, m);
+			break;
+		case V4L2_PIX_FMT_UYVY:
+			v4lconvert_yuv422_to_rgbbgr24_row(s, line, width,
+					V4LCONVERT_YUV422_UYVY, bgr, m);
+			break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			u = chroma + (y / 2) * (stride / 2);
+			v = u + stride * height / 4;
+			if (pixfmt == V4L2_PIX_FMT_YVU420)
+				v4lconvert_yuv420_to_rgbbgr24_row(s, v, u, line,
+						width, bgr, m);
+			else
+				v4lconvert_yuv420_to_rgbbgr24_row(s, u, v, line,
+						width, bgr, m);
+			break;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+			v4lconvert_nv_to_rgbbgr24_row(s,
+					chroma + (y / 2) * stride, line, width,
+					pixfmt == V4L2_PIX_FMT_NV21, bgr, m);
+			break;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			s = src + y * width * 3;
+			if ((pixfmt == V4L2_PIX_FMT_BGR24) != bgr)
+				v4lconvert_swap_rgb(s, line, width, 1);
+			else
+				line = (unsigned char *)s;
+			break;
+		}
+
+		rgb24_to_rgb32_row(line, dest, width);
+		dest += width * 4;
+	}
+}
+
+static void v4lconvert_direct_to_nv12(const unsigned char *src,
+		unsigned char *dest, unsigned char *line,
+		const struct v4l2_format *fmt)
+{
+	unsigned int pixfmt = fmt->fmt.pix.pixelformat;
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+	const unsigned char *chroma = src + stride * height;
+	const unsigned char *u, *v;
+	int y;
+
+	for (y = 0; y < height; y++) {
+		memcpy(dest, src + y * stride, width);
+		dest += width;
+	}
+
+	for (y = 0; y < height / 2; y++) {
+		switch (pixfmt) {
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			u = chroma + y * (stride / 2);
+			v = u + stride * height / 4;
+			if (pixfmt == V4L2_PIX_FMT_YVU420)
+				uv_to_nv_row(v, u, dest, width / 2);
+			else
+				uv_to_nv_row(u, v, dest, width / 2);
+			break;
+		case V4L2_PIX_FMT_NV21:
+			nv_to_uv_row(chroma + y * stride, line, line + width / 2,
+				     width, 1);
+			uv_to_nv_row(line, line + width / 2, dest, width / 2);
+			break;
+		}
+		dest += width / 2 * 2;
+	}
+}
+
+static void v4lconvert_direct_to_yuyv(const unsigned char *src,
+		unsigned char *dest, unsigned char *line,
+		const struct v4l2_format *fmt)
+{
+	unsigned int pixfmt = fmt->fmt.pix.pixelformat;
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+	const unsigned char *chroma = src + stride * height;
+	const unsigned char *u, *v;
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		const unsigned char *s = src + y * stride;
+
+		switch (pixfmt) {
+		case V4L2_PIX_FMT_YVYU:
+			for (x = 0; x + 1 < width; x += 2) {
+				dest[2 * x] = s[2 * x];
+				dest[2 * x + 1] = s[2 * x + 3];
+				dest[2 * x + 2] = s[2 * x + 2];
+				dest[2 * x + 3] = s[2 * x + 1];
+			}
+			break;
+		case V4L2_PIX_FMT_UYVY:
+			for (x = 0; x + 1 < width; x += 2) {
+				dest[2 * x] = s[2 * x + 1];
+				dest[2 * x + 1] = s[2 * x];
+				dest[2 * x + 2] = s[2 * x + 3];
+				dest[2 * x + 3] = s[2 * x + 2];
+			}
+			break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			u = chroma + (y / 2) * (stride / 2);
+			v = u + stride * height / 4;
+			if (pixfmt == V4L2_PIX_FMT_YVU420)
+				yuv420_to_yuyv_row(s, v, u, dest, width);
+			else
+				yuv420_to_yuyv_row(s, u, v, dest, width);
+			break;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+			/* Each chroma line is used for 2 lines */
+			if (!(y & 1))
+				nv_to_uv_row(chroma + (y / 2) * stride, line,
+					     line + width / 2, width,
+					     pixfmt == V4L2_PIX_FMT_NV21);
+			yuv420_to_yuyv_row(s, line, line + width / 2, dest,
+					   width);
+			break;
+		}
+		dest += width * 2;
+	}
+}
+
+int v4lconvert_pack_direct(struct v4lconvert_data *data,
+		const unsigned char *src, int src_size, unsigned char *dest,
+		const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	unsigned int src_pix_fmt = src_fmt->fmt.pix.pixelformat;
+	int width = src_fmt->fmt.pix.width;
+	int needed = v4lconvert_direct_src_size(src_fmt);
+	unsigned char *line;
+
+	/* Leave reporting short frames to v4lconvert_convert_pixfmt */
+	if (!needed || src_size < needed ||
+	    src_fmt->fmt.pix.width != dest_fmt->fmt.pix.width ||
+	    src_fmt->fmt.pix.height != dest_fmt->fmt.pix.height)
+		return 0;
+
+	/* A line of RGB24 or of U and V */
+	line = v4lconvert_get_buffer(data, V4LCONVERT_PACK_BUF, width * 3);
+	if (!line)
+		return 0;
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_ABGR32:
+		v4lconvert_direct_to_rgb32(src, dest, line, src_fmt,
+				dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_ABGR32,
+				v4lconvert_update_yuv_matrix(&data->yuv_matrix,
+							     src_fmt));
+		return 1;
+	case V4L2_PIX_FMT_NV12:
+		if (src_pix_fmt != V4L2_PIX_FMT_YUV420 &&
+		    src_pix_fmt != V4L2_PIX_FMT_YVU420 &&
+		    src_pix_fmt != V4L2_PIX_FMT_NV21)
+			return 0;
+		v4lconvert_direct_to_nv12(src, dest, line, src_fmt);
+		return 1;
+	case V4L2_PIX_FMT_YUYV:
+		if (src_pix_fmt == V4L2_PIX_FMT_YUYV ||
+		    src_pix_fmt == V4L2_PIX_FMT_RGB24 ||
+		    src_pix_fmt == V4L2_PIX_FMT_BGR24)
+			return 0;
+		v4lconvert_direct_to_yuyv(src, dest, line, src_fmt);
+		return 1;
+	}
+
+	return 0;
+}
+
+int v4lconvert_pack(struct v4lconvert_data *data, const unsigned char *src,
+		unsigned char *dest, const struct v4l2_format *fmt,
+		unsigned int dest_pix_fmt)
+{
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+	int stride = fmt->fmt.pix.bytesperline;
+	const unsigned char *u = src + width * height;
+	const unsigned char *v = u + width * height / 4;
+	unsigned char *buf;
+	int y;
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGBA32:
+	case V4L2_PIX_FMT_ABGR32:
+		buf = v4lconvert_get_buffer(data, V4LCONVERT_PACK_BUF,
+					    width * 3);
+		if (!buf)
+			return v4lconvert_oom_error(data);
+
+		/* Going backwards the lines of src which are still needed
+		   never get overwritten, except for the line being packed
+		   in the first few lines */
+		for (y = height - 1; y >= 0; y--) {
+			const unsigned char *s = src + y * stride;
+			unsigned char *d = dest + y * width * 4;
+
+			if (s < d + width * 4 && d < s + width * 3) {
+				memcpy(buf, s, width * 3);
+				s = buf;
+			}
+			rgb24_to_rgb32_row(s, d, width);
+		}
+		break;
+	case V4L2_PIX_FMT_NV12:
+		if (src == dest) {
+			buf = v4lconvert_get_buffer(data, V4LCONVERT_PACK_BUF,
+						    width * height / 2);
+			if (!buf)
+				return v4lconvert_oom_error(data);
+			memcpy(buf, u, width * height / 2);
+			v = buf + (v - u);
+			u = buf;
+		} else {
+			for (y = 0; y < height; y++)
+				memcpy(dest + y * width, src + y * stride,
+				       width);
+		}
+
+		dest += width * height;
+		for (y = 0; y < height / 2; y++) {
+			uv_to_nv_row(u, v, dest, width / 2);
+			u += width / 2;
+			v += width / 2;
+			dest += width / 2 * 2;
+		}
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		for (y = 0; y < height; y++) {
+			yuv420_to_yuyv_row(src + y * stride,
+					u + (y / 2) * (width / 2),
+					v + (y / 2) * (width / 2),
+					dest, width);
+			dest += width * 2;
+		}
+		break;
+	}
+
+	return 0;
+}
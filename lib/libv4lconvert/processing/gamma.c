@@ -30,8 +30,7 @@ static int gamma_active(struct v4lprocessing_data *data)
 }
 
 static int gamma_calculate_lookup_tables(
-		struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+		struct v4lprocessing_data *data, const struct v4l2_format *fmt)
 {
 	int i, x, gamma;
 
@@ -58,5 +57,5 @@ static int gamma_calculate_lookup_tables(
 }
 
 const struct v4lprocessing_filter gamma_filter = {
-	gamma_active, gamma_calculate_lookup_tables
+	gamma_active, gamma_calculate_lookup_tables, 0
 };
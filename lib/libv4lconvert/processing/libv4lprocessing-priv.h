@@ -21,10 +21,32 @@
 #ifndef __LIBV4LPROCESSING_PRIV_H
 #define __LIBV4LPROCESSING_PRIV_H
 
+#include <stdint.h>
 #include "../control/libv4lcontrol.h"
 #include "../libv4lsyscall-priv.h"
 
 #define V4L2PROCESSING_UPDATE_RATE 10
+/* Update the lookup tables sooner when the statistics drift more than
+   1 / V4L2PROCESSING_DRIFT_DIV away from those used for the last update,
+   but not sooner than V4L2PROCESSING_MIN_UPDATE_RATE frames after it */
+#define V4L2PROCESSING_DRIFT_DIV 16
+#define V4L2PROCESSING_MIN_UPDATE_RATE 3
+/* By default only about this many (pairs of) lines of a frame are sampled
+   for the statistics, see LIBV4LCONVERT_STATS_LINE_STEP */
+#define V4L2PROCESSING_STATS_LINES 128
+
+/* Frame statistics, gathered while applying the lookup tables. Only every
+   Nth line (pair of lines for bayer) is sampled, the sums are scaled to the
+   whole frame afterwards */
+struct v4lprocessing_stats {
+	/* Per component byte sums, for bayer the 2 components of the even
+	   rows followed by the 2 components of the odd rows, for RGB/BGR
+	   comp1, green, comp2 */
+	uint64_t sum[4];
+	/* Sum of all bytes in the center of the frame (half width, half
+	   height), used by autogain */
+	uint64_t center_sum;
+};
 
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
@@ -41,6 +63,13 @@ struct v4lprocessing_data {
 	unsigned char comp1[256];
 	unsigned char green[256];
 	unsigned char comp2[256];
+	struct v4lprocessing_stats stats;
+	/* The statistics used for the last lookup table update */
+	struct v4lprocessing_stats last_stats;
+	/* Set if any of the active filters uses the statistics */
+	int stats_needed;
+	/* Sample every Nth line, 0 for automatic */
+	int stats_line_step;
 	/* Filter private data for filters which need it */
 	/* whitebalance.c data */
 	int green_avg;
@@ -56,13 +85,21 @@ struct v4lprocessing_data {
 struct v4lprocessing_filter {
 	/* Returns 1 if the filter is active */
 	int (*active)(struct v4lprocessing_data *data);
-	/* Returns 1 if any of the lookup tables was changed */
+	/* Returns 1 if any of the lookup tables was changed, the statistics
+	   of the last frame are in data->stats */
 	int (*calculate_lookup_tables)(struct v4lprocessing_data *data,
-			unsigned char *buf, const struct v4l2_format *fmt);
+			const struct v4l2_format *fmt);
+	/* Set if calculate_lookup_tables uses data->stats */
+	int uses_stats;
 };
 
 extern const struct v4lprocessing_filter whitebalance_filter;
 extern const struct v4lprocessing_filter autogain_filter;
 extern const struct v4lprocessing_filter gamma_filter;
 
+/* stats-simd.c, adds the bytes of row to sums[i % period] for period 1 - 3,
+   returns the number of bytes done (a multiple of period) */
+int v4lprocessing_simd_row_sums(const unsigned char *row, int n, int period,
+		uint64_t *sums);
+
 #endif
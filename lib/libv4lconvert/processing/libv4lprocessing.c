@@ -37,6 +37,7 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 {
 	struct v4lprocessing_data *data =
 		calloc(1, sizeof(struct v4lprocessing_data));
+	char *s;
 
 	if (!data) {
 		fprintf(stderr, "libv4lprocessing: error: out of memory!\n");
@@ -46,6 +47,10 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 	data->fd = fd;
 	data->control = control;
 
+	s = getenv("LIBV4LCONVERT_STATS_LINE_STEP");
+	if (s)
+		data->stats_line_step = atoi(s);
+
 	return data;
 }
 
@@ -58,10 +63,18 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 {
 	int i;
 
+	/* Conversion contexts only have a processing while they need it */
+	if (!data)
+		return 0;
+
 	data->do_process = 0;
+	data->stats_needed = 0;
 	for (i = 0; i < ARRAY_SIZE(filters); i++) {
-		if (filters[i]->active(data))
+		if (filters[i]->active(data)) {
 			data->do_process = 1;
+			if (filters[i]->uses_stats)
+				data->stats_needed = 1;
+		}
 	}
 
 	data->controls_changed |= v4lcontrol_controls_changed(data->control);
@@ -69,8 +82,37 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 	return data->do_process;
 }
 
+int v4lprocessing_enabled(struct v4lprocessing_data *data)
+{
+	int gamma;
+
+	if (!data)
+		return 0;
+
+	gamma = v4lcontrol_get_ctrl(data->control, V4LCONTROL_GAMMA);
+
+	return v4lcontrol_get_ctrl(data->control, V4LCONTROL_WHITEBALANCE) ||
+	       v4lcontrol_get_ctrl(data->control, V4LCONTROL_AUTOGAIN) ||
+	       (gamma && gamma != 1000);
+}
+
+int v4lprocessing_active(struct v4lprocessing_data *data)
+{
+	int i;
+
+	if (!data)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(filters); i++) {
+		if (filters[i]->active(data))
+			return 1;
+	}
+
+	return 0;
+}
+
 static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+		const struct v4l2_format *fmt)
 {
 	int i;
 
@@ -83,80 +125,201 @@ static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 	data->lookup_table_active = 0;
 	for (i = 0; i < ARRAY_SIZE(filters); i++) {
 		if (filters[i]->active(data)) {
-			if (filters[i]->calculate_lookup_tables(data, buf, fmt))
+			if (filters[i]->calculate_lookup_tables(data, fmt))
 				data->lookup_table_active = 1;
 		}
 	}
 }
 
+/* Add bytes start - end of row to sums, where sums[0] is the component of
+   the first byte of the row, returns the total of the bytes */
+static uint64_t v4lprocessing_row_sums(const unsigned char *row,
+		int start, int end, int period, uint64_t *sums)
+{
+	uint64_t seg[3] = { 0, 0, 0 }, total = 0;
+	int i, n = end - start;
+
+	row += start;
+	i = v4lprocessing_simd_row_sums(row, n, period, seg);
+	if (period == 3) {
+		for (; i + 3 <= n; i += 3) {
+			seg[0] += row[i];
+			seg[1] += row[i + 1];
+			seg[2] += row[i + 2];
+		}
+	} else if (period == 2) {
+		for (; i + 2 <= n; i += 2) {
+			seg[0] += row[i];
+			seg[1] += row[i + 1];
+		}
+	}
+	for (; i < n; i++)
+		seg[i % period] += row[i];
+
+	for (i = 0; i < period; i++) {
+		sums[(start + i) % period] += seg[i];
+		total += seg[i];
+	}
+
+	return total;
+}
+
+static void v4lprocessing_gather_row_stats(struct v4lprocessing_data *data,
+		const unsigned char *row, int y, int n, int period,
+		const struct v4l2_format *fmt)
+{
+	uint64_t *sums = data->stats.sum;
+	int y0 = fmt->fmt.pix.height / 4;
+
+	if (period == 2 && (y & 1))
+		sums += 2;
+
+	if (y < y0 || y >= y0 + fmt->fmt.pix.height / 2) {
+		v4lprocessing_row_sums(row, 0, n, period, sums);
+		return;
+	}
+
+	/* Center of the frame, half the row starting at a quarter of it */
+	v4lprocessing_row_sums(row, 0, n / 4, period, sums);
+	data->stats.center_sum +=
+		v4lprocessing_row_sums(row, n / 4, n / 4 + n / 2, period, sums);
+	v4lprocessing_row_sums(row, n / 4 + n / 2, n, period, sums);
+}
+
+static void v4lprocessing_apply_row2(unsigned char *row, int n,
+		const unsigned char *t0, const unsigned char *t1)
+{
+	int x;
+
+	for (x = 0; x < n; x += 2) {
+		row[x] = t0[row[x]];
+		row[x + 1] = t1[row[x + 1]];
+	}
+}
+
+static void v4lprocessing_apply_row3(unsigned char *row, int n,
+		const unsigned char *t0, const unsigned char *t1,
+		const unsigned char *t2)
+{
+	int x;
+
+	for (x = 0; x < n; x += 3) {
+		row[x] = t0[row[x]];
+		row[x + 1] = t1[row[x + 1]];
+		row[x + 2] = t2[row[x + 2]];
+	}
+}
+
+/*
+ * Apply the lookup tables to the frame and / or gather the statistics
+ * needed to update them, row by row, so that a frame is only read once.
+ * The statistics are gathered from the row before applying the (old) tables
+ * to it, which take effect for the frame after the update.
+ */
 static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
-		unsigned char *buf, const struct v4l2_format *fmt)
+		unsigned char *buf, const struct v4l2_format *fmt,
+		int gather_stats, int apply)
 {
-	int x, y;
+	const unsigned char *even[2] = { NULL, NULL }, *odd[2] = { NULL, NULL };
+	int y, n, period, height = fmt->fmt.pix.height;
+	int y0 = fmt->fmt.pix.height / 4, step = 1, lines_per_sample = 1;
+	int lines = 0, center_lines = 0;
 
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8: /* Bayer patterns starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp1[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp2[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		}
+		even[0] = data->green;
+		even[1] = data->comp1;
+		odd[0] = data->comp2;
+		odd[1] = data->green;
+		period = 2;
 		break;
-
 	case V4L2_PIX_FMT_SBGGR8:
 	case V4L2_PIX_FMT_SRGGB8: /* Bayer patterns *NOT* starting with green */
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		}
+		even[0] = data->comp1;
+		even[1] = data->green;
+		odd[0] = data->green;
+		odd[1] = data->comp2;
+		period = 2;
 		break;
+	default: /* RGB24 / BGR24 */
+		period = 3;
+		break;
+	}
 
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		for (y = 0; y < fmt->fmt.pix.height; y++) {
-			for (x = 0; x < fmt->fmt.pix.width; x++) {
-				*buf = data->comp1[*buf];
-				buf++;
-				*buf = data->green[*buf];
-				buf++;
-				*buf = data->comp2[*buf];
-				buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - 3 * fmt->fmt.pix.width;
+	if (period == 2) {
+		n = fmt->fmt.pix.width & ~1;
+		height &= ~1;
+		lines_per_sample = 2;
+	} else {
+		n = 3 * fmt->fmt.pix.width;
+	}
+
+	if (gather_stats) {
+		memset(&data->stats, 0, sizeof(data->stats));
+		/* Sample every step-th line, or pair of lines for bayer */
+		step = data->stats_line_step;
+		if (step <= 0)
+			step = height / (V4L2PROCESSING_STATS_LINES * lines_per_sample);
+		if (step < 1)
+			step = 1;
+		step *= lines_per_sample;
+	}
+
+	for (y = 0; y < height; y++, buf += fmt->fmt.pix.bytesperline) {
+		if (gather_stats && (y % step) < lines_per_sample) {
+			v4lprocessing_gather_row_stats(data, buf, y, n,
+						       period, fmt);
+			lines++;
+			if (y >= y0 && y < y0 + fmt->fmt.pix.height / 2)
+				center_lines++;
 		}
-		break;
+		if (!apply)
+			continue;
+
+		if (period == 3)
+			v4lprocessing_apply_row3(buf, n, data->comp1,
+						 data->green, data->comp2);
+		else if (y & 1)
+			v4lprocessing_apply_row2(buf, n, odd[0], odd[1]);
+		else
+			v4lprocessing_apply_row2(buf, n, even[0], even[1]);
+	}
+
+	/* Scale the sums of the sampled lines to the whole frame */
+	if (gather_stats && step > lines_per_sample) {
+		for (y = 0; y < 4 && lines; y++)
+			data->stats.sum[y] = data->stats.sum[y] * height / lines;
+		if (center_lines)
+			data->stats.center_sum = data->stats.center_sum *
+				(fmt->fmt.pix.height / 2) / center_lines;
+	}
+}
+
+/* Returns 1 if the statistics drifted away from those the lookup tables
+   were calculated from */
+static int v4lprocessing_stats_drifted(struct v4lprocessing_data *data)
+{
+	const uint64_t *cur = data->stats.sum, *last = data->last_stats.sum;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		uint64_t diff = cur[i] > last[i] ? cur[i] - last[i] : last[i] - cur[i];
+
+		if (diff * V4L2PROCESSING_DRIFT_DIV > last[i])
+			return 1;
 	}
+
+	return 0;
 }
 
-void v4lprocessing_processing(struct v4lprocessing_data *data,
+int v4lprocessing_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	if (!data->do_process)
-		return;
+	int update, gather_stats;
+
+	if (!data || !data->do_process)
+		return 0;
 
 	/* Do we support the current pixformat? */
 	switch (fmt->fmt.pix.pixelformat) {
@@ -168,21 +331,32 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 	case V4L2_PIX_FMT_BGR24:
 		break;
 	default:
-		return; /* Non supported pix format */
+		return 0; /* Non supported pix format */
 	}
 
-	if (data->controls_changed ||
-			data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE) {
+	update = data->controls_changed ||
+		 data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE;
+	gather_stats = update || data->stats_needed;
+
+	if (gather_stats || data->lookup_table_active)
+		v4lprocessing_do_processing(data, buf, fmt, gather_stats,
+					    data->lookup_table_active);
+
+	if (!update && data->stats_needed &&
+			data->lookup_table_update_counter >= V4L2PROCESSING_MIN_UPDATE_RATE)
+		update = v4lprocessing_stats_drifted(data);
+
+	if (update) {
 		data->controls_changed = 0;
 		data->lookup_table_update_counter = 0;
 		/* Do this after resetting lookup_table_update_counter so that filters can
 		   force the next update to be sooner when they changed camera settings */
-		v4lprocessing_update_lookup_tables(data, buf, fmt);
+		v4lprocessing_update_lookup_tables(data, fmt);
+		data->last_stats = data->stats;
 	} else
 		data->lookup_table_update_counter++;
 
-	if (data->lookup_table_active)
-		v4lprocessing_do_processing(data, buf, fmt);
-
 	data->do_process = 0;
+
+	return 1;
 }
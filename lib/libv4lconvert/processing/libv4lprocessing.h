@@ -38,10 +38,20 @@ void v4lprocessing_destroy(struct v4lprocessing_data *data);
    return 0 if no processing will be done */
 int v4lprocessing_pre_processing(struct v4lprocessing_data *data);
 
+/* Returns 1 if any of the processing filters is enabled, without preparing
+   to process a frame */
+int v4lprocessing_active(struct v4lprocessing_data *data);
+
+/* Returns 1 if the controls enable any of the processing filters. Unlike
+   v4lprocessing_active() this does not touch the filter state, so it can
+   be called while another thread is processing a frame */
+int v4lprocessing_enabled(struct v4lprocessing_data *data);
+
 /* Do the actual processing, this is a nop if v4lprocessing_pre_processing()
    returned 0, or if called more than 1 time after a single
-   v4lprocessing_pre_processing() call. */
-void v4lprocessing_processing(struct v4lprocessing_data *data,
+   v4lprocessing_pre_processing() call. Returns 1 if the frame was
+   processed, 0 for a nop. */
+int v4lprocessing_processing(struct v4lprocessing_data *data,
   unsigned char *buf, const struct v4l2_format *fmt);
 
 #endif
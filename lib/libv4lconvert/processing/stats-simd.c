@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels gathering the frame statistics used by the whitebalance and
+ * autogain filters, see v4lprocessing_row_sums() in libv4lprocessing.c
+ *
+ * The kernels add as many bytes of a row to the sums as fit in whole SIMD
+ * blocks (a multiple of period bytes) and return the number of bytes done,
+ * the C code then handles the remainder of the row.
+ */
+
+#include "../libv4lconvert-simd-priv.h"
+#include "libv4lprocessing-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+static inline SSE2 uint64_t sum_epi64_sse2(__m128i acc)
+{
+	return (uint64_t)_mm_cvtsi128_si64(acc) +
+	       (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+}
+
+static SSE2 int row_sums_sse2(const unsigned char *row, int n, int period,
+		uint64_t *sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero, acct = zero;
+	__m128i v;
+	int i = 0;
+
+	switch (period) {
+	case 1:
+		for (; i + 16 <= n; i += 16) {
+			v = _mm_loadu_si128((const __m128i *)(row + i));
+			acct = _mm_add_epi64(acct, _mm_sad_epu8(v, zero));
+		}
+		sums[0] += sum_epi64_sse2(acct);
+		break;
+	case 2: {
+		const __m128i even = _mm_set1_epi16(0x00ff);
+
+		for (; i + 16 <= n; i += 16) {
+			v = _mm_loadu_si128((const __m128i *)(row + i));
+			acc0 = _mm_add_epi64(acc0,
+				_mm_sad_epu8(_mm_and_si128(v, even), zero));
+			acct = _mm_add_epi64(acct, _mm_sad_epu8(v, zero));
+		}
+		sums[0] += sum_epi64_sse2(acc0);
+		sums[1] += sum_epi64_sse2(acct) - sum_epi64_sse2(acc0);
+		break;
+	}
+	case 3: {
+		/* Select the bytes of component 0 / 1 in 3 consecutive blocks */
+		unsigned char comp[48];
+		__m128i m0[3], m1[3];
+		int k;
+
+		for (k = 0; k < 48; k++)
+			comp[k] = k % 3;
+		for (k = 0; k < 3; k++) {
+			v = _mm_loadu_si128((const __m128i *)(comp + 16 * k));
+			m0[k] = _mm_cmpeq_epi8(v, zero);
+			m1[k] = _mm_cmpeq_epi8(v, _mm_set1_epi8(1));
+		}
+
+		for (; i + 48 <= n; i += 48) {
+			for (k = 0; k < 3; k++) {
+				v = _mm_loadu_si128((const __m128i *)(row + i + 16 * k));
+				acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(
+						_mm_and_si128(v, m0[k]), zero));
+				acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(
+						_mm_and_si128(v, m1[k]), zero));
+				acct = _mm_add_epi64(acct, _mm_sad_epu8(v, zero));
+			}
+		}
+		sums[0] += sum_epi64_sse2(acc0);
+		sums[1] += sum_epi64_sse2(acc1);
+		sums[2] += sum_epi64_sse2(acct) - sum_epi64_sse2(acc0) -
+			   sum_epi64_sse2(acc1);
+		break;
+	}
+	}
+
+	return i;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+static inline uint64_t sum_u32_neon(uint32x4_t acc)
+{
+	uint64x2_t s = vpaddlq_u32(acc);
+
+	return vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+}
+
+/* The 32 bit lanes can not overflow, as rows are less than 64k bytes */
+static int row_sums_neon(const unsigned char *row, int n, int period,
+		uint64_t *sums)
+{
+	uint32x4_t acc0 = vdupq_n_u32(0);
+	uint32x4_t acc1 = vdupq_n_u32(0);
+	uint32x4_t acc2 = vdupq_n_u32(0);
+	int i = 0;
+
+	switch (period) {
+	case 1:
+		for (; i + 16 <= n; i += 16)
+			acc0 = vpadalq_u16(acc0, vpaddlq_u8(vld1q_u8(row + i)));
+		sums[0] += sum_u32_neon(acc0);
+		break;
+	case 2:
+		for (; i + 32 <= n; i += 32) {
+			uint8x16x2_t v = vld2q_u8(row + i);
+
+			acc0 = vpadalq_u16(acc0, vpaddlq_u8(v.val[0]));
+			acc1 = vpadalq_u16(acc1, vpaddlq_u8(v.val[1]));
+		}
+		sums[0] += sum_u32_neon(acc0);
+		sums[1] += sum_u32_neon(acc1);
+		break;
+	case 3:
+		for (; i + 48 <= n; i += 48) {
+			uint8x16x3_t v = vld3q_u8(row + i);
+
+			acc0 = vpadalq_u16(acc0, vpaddlq_u8(v.val[0]));
+			acc1 = vpadalq_u16(acc1, vpaddlq_u8(v.val[1]));
+			acc2 = vpadalq_u16(acc2, vpaddlq_u8(v.val[2]));
+		}
+		sums[0] += sum_u32_neon(acc0);
+		sums[1] += sum_u32_neon(acc1);
+		sums[2] += sum_u32_neon(acc2);
+		break;
+	}
+
+	return i;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lprocessing_simd_row_sums(const unsigned char *row, int n, int period,
+		uint64_t *sums)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return row_sums_sse2(row, n, period, sums);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return row_sums_neon(row, n, period, sums);
+#endif
+	return 0;
+}
@@ -0,0 +1,1762 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD row kernels for the converters in rgbyuv.c
+ *
+ * All kernels produce results which are bit-exact with the C code in
+ * rgbyuv.c. They convert as many pixels of a line as fit in whole SIMD
+ * blocks and return the number of pixels done, the C code then handles
+ * the remainder of the line.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/*
+ * Split 16 pixels of packed 4:2:2 data into the Y values of pixels 0-7 (y0)
+ * and 8-15 (y1) and the U and V values of the 8 pixel pairs, all as 16 bit
+ * values.
+ */
+static inline SSE2 void yuv422_unpack_sse2(const unsigned char *src,
+		int layout, __m128i *y0, __m128i *y1, __m128i *u, __m128i *v)
+{
+	const __m128i lo8 = _mm_set1_epi16(0x00ff);
+	const __m128i lo16 = _mm_set1_epi32(0x0000ffff);
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+	__m128i ca, cb, c0, c1;
+
+	if (layout == V4LCONVERT_YUV422_UYVY) {
+		*y0 = _mm_srli_epi16(a, 8);
+		*y1 = _mm_srli_epi16(b, 8);
+		ca = _mm_and_si128(a, lo8);
+		cb = _mm_and_si128(b, lo8);
+	} else {
+		*y0 = _mm_and_si128(a, lo8);
+		*y1 = _mm_and_si128(b, lo8);
+		ca = _mm_srli_epi16(a, 8);
+		cb = _mm_srli_epi16(b, 8);
+	}
+
+	c0 = _mm_packs_epi32(_mm_and_si128(ca, lo16), _mm_and_si128(cb, lo16));
+	c1 = _mm_packs_epi32(_mm_srli_epi32(ca, 16), _mm_srli_epi32(cb, 16));
+
+	if (layout == V4LCONVERT_YUV422_YVYU) {
+		*u = c1;
+		*v = c0;
+	} else {
+		*u = c0;
+		*v = c1;
+	}
+}
+
+/* The struct v4lconvert_yuv_matrix coefficients, broadcast */
+struct yuv_coeffs_sse2 {
+	__m128i y_offset, cy, crv, cgu, cgv, cbu;
+};
+
+static inline SSE2 void yuv_coeffs_sse2(const struct v4lconvert_yuv_matrix *m,
+		struct yuv_coeffs_sse2 *c)
+{
+	c->y_offset = _mm_set1_epi16(m->y_offset);
+	c->cy = _mm_set1_epi16(m->cy);
+	c->crv = _mm_set1_epi16(m->crv);
+	c->cgu = _mm_set1_epi16(m->cgu);
+	c->cgv = _mm_set1_epi16(m->cgv);
+	c->cbu = _mm_set1_epi16(m->cbu);
+}
+
+/*
+ * Convert 16 pixels, y0 holds the Y values of pixels 0-7 and y1 of pixels
+ * 8-15, u and v the U and V values of the 8 pixel pairs. This is the same
+ * math as the tables used by the C code: ((x << 7) * c) >> 16 is exactly
+ * (x * c) >> 9.
+ */
+static inline SSE2 void yuv_to_rgb_sse2(__m128i y0, __m128i y1,
+		__m128i u, __m128i v, const struct yuv_coeffs_sse2 *c,
+		__m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i rnd = _mm_set1_epi16(8);
+	__m128i du = _mm_slli_epi16(_mm_sub_epi16(u, c128), 7);
+	__m128i dv = _mm_slli_epi16(_mm_sub_epi16(v, c128), 7);
+	__m128i rv = _mm_mulhi_epi16(dv, c->crv);
+	__m128i guv = _mm_add_epi16(_mm_mulhi_epi16(du, c->cgu),
+				    _mm_mulhi_epi16(dv, c->cgv));
+	__m128i bu = _mm_mulhi_epi16(du, c->cbu);
+	__m128i lo, hi;
+
+	y0 = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(
+			_mm_sub_epi16(y0, c->y_offset), 7), c->cy), rnd);
+	y1 = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(
+			_mm_sub_epi16(y1, c->y_offset), 7), c->cy), rnd);
+
+	/* The saturating pack does the clipping */
+	lo = _mm_unpacklo_epi16(rv, rv);
+	hi = _mm_unpackhi_epi16(rv, rv);
+	*r = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(y0, lo), 4),
+			      _mm_srai_epi16(_mm_add_epi16(y1, hi), 4));
+	lo = _mm_unpacklo_epi16(guv, guv);
+	hi = _mm_unpackhi_epi16(guv, guv);
+	*g = _mm_packus_epi16(_mm_srai_epi16(_mm_sub_epi16(y0, lo), 4),
+			      _mm_srai_epi16(_mm_sub_epi16(y1, hi), 4));
+	lo = _mm_unpacklo_epi16(bu, bu);
+	hi = _mm_unpackhi_epi16(bu, bu);
+	*b = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(y0, lo), 4),
+			      _mm_srai_epi16(_mm_add_epi16(y1, hi), 4));
+}
+
+static SSE2 int yuv422_to_rgb24_row_sse2(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	struct yuv_coeffs_sse2 c;
+	int j;
+
+	yuv_coeffs_sse2(m, &c);
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i y0, y1, u, v, r, g, b;
+
+		yuv422_unpack_sse2(src, layout, &y0, &y1, &u, &v);
+		yuv_to_rgb_sse2(y0, y1, u, v, &c, &r, &g, &b);
+
+		if (bgr)
+			store_rgb24_sse2(dest, b, g, r);
+		else
+			store_rgb24_sse2(dest, r, g, b);
+
+		src += 32;
+		dest += 48;
+	}
+
+	return j;
+}
+
+static SSE2 int yuv420_to_rgb24_row_sse2(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	const __m128i zero = _mm_setzero_si128();
+	struct yuv_coeffs_sse2 c;
+	int j;
+
+	yuv_coeffs_sse2(m, &c);
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+		__m128i u = _mm_loadl_epi64((const __m128i *)usrc);
+		__m128i v = _mm_loadl_epi64((const __m128i *)vsrc);
+		__m128i r, g, b;
+
+		yuv_to_rgb_sse2(_mm_unpacklo_epi8(y, zero),
+				_mm_unpackhi_epi8(y, zero),
+				_mm_unpacklo_epi8(u, zero),
+				_mm_unpacklo_epi8(v, zero), &c, &r, &g, &b);
+
+		if (bgr)
+			store_rgb24_sse2(dest, b, g, r);
+		else
+			store_rgb24_sse2(dest, r, g, b);
+
+		ysrc += 16;
+		usrc += 8;
+		vsrc += 8;
+		dest += 48;
+	}
+
+	return j;
+}
+
+static SSE2 int nv_to_rgb24_row_sse2(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo8 = _mm_set1_epi16(0x00ff);
+	struct yuv_coeffs_sse2 c;
+	int j;
+
+	yuv_coeffs_sse2(m, &c);
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+		__m128i uv = _mm_loadu_si128((const __m128i *)uvsrc);
+		__m128i c0 = _mm_and_si128(uv, lo8);
+		__m128i c1 = _mm_srli_epi16(uv, 8);
+		__m128i r, g, b;
+
+		yuv_to_rgb_sse2(_mm_unpacklo_epi8(y, zero),
+				_mm_unpackhi_epi8(y, zero),
+				vu ? c1 : c0, vu ? c0 : c1, &c, &r, &g, &b);
+
+		if (bgr)
+			store_rgb24_sse2(dest, b, g, r);
+		else
+			store_rgb24_sse2(dest, r, g, b);
+
+		ysrc += 16;
+		uvsrc += 16;
+		dest += 48;
+	}
+
+	return j;
+}
+
+static inline AVX2 void yuv422_unpack_avx2(const unsigned char *src,
+		int layout, __m256i *y0, __m256i *y1, __m256i *u, __m256i *v)
+{
+	const __m256i lo8 = _mm256_set1_epi16(0x00ff);
+	const __m256i lo16 = _mm256_set1_epi32(0x0000ffff);
+	__m256i a = _mm256_loadu_si256((const __m256i *)src);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+	__m256i ca, cb, c0, c1;
+
+	if (layout == V4LCONVERT_YUV422_UYVY) {
+		*y0 = _mm256_srli_epi16(a, 8);
+		*y1 = _mm256_srli_epi16(b, 8);
+		ca = _mm256_and_si256(a, lo8);
+		cb = _mm256_and_si256(b, lo8);
+	} else {
+		*y0 = _mm256_and_si256(a, lo8);
+		*y1 = _mm256_and_si256(b, lo8);
+		ca = _mm256_srli_epi16(a, 8);
+		cb = _mm256_srli_epi16(b, 8);
+	}
+
+	/*
+	 * The pack works per 128 bit lane, so the chroma of pixel pairs
+	 * 0-3 and 8-11 ends up in the low lane and of 4-7 and 12-15 in the
+	 * high lane. Unpacking these per lane again later on lines up with
+	 * the Y values of pixels 0-15 in y0 and 16-31 in y1.
+	 */
+	c0 = _mm256_packs_epi32(_mm256_and_si256(ca, lo16), _mm256_and_si256(cb, lo16));
+	c1 = _mm256_packs_epi32(_mm256_srli_epi32(ca, 16), _mm256_srli_epi32(cb, 16));
+
+	if (layout == V4LCONVERT_YUV422_YVYU) {
+		*u = c1;
+		*v = c0;
+	} else {
+		*u = c0;
+		*v = c1;
+	}
+}
+
+/* Pack 2 x 16 16 bit values into 32 bytes in pixel order */
+static inline AVX2 __m256i pack_pixels_avx2(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+struct yuv_coeffs_avx2 {
+	__m256i y_offset, cy, crv, cgu, cgv, cbu;
+};
+
+static inline AVX2 void yuv_coeffs_avx2(const struct v4lconvert_yuv_matrix *m,
+		struct yuv_coeffs_avx2 *c)
+{
+	c->y_offset = _mm256_set1_epi16(m->y_offset);
+	c->cy = _mm256_set1_epi16(m->cy);
+	c->crv = _mm256_set1_epi16(m->crv);
+	c->cgu = _mm256_set1_epi16(m->cgu);
+	c->cgv = _mm256_set1_epi16(m->cgv);
+	c->cbu = _mm256_set1_epi16(m->cbu);
+}
+
+/*
+ * Convert 32 pixels, y0 holds the Y values of pixels 0-15 and y1 of pixels
+ * 16-31. u and v hold the U and V values of pixel pairs 0-3 and 8-11 in
+ * the low lane and of 4-7 and 12-15 in the high lane, see
+ * yuv422_unpack_avx2. The r, g and b results are in pixel order.
+ */
+static inline AVX2 void yuv_to_rgb_avx2(__m256i y0, __m256i y1,
+		__m256i u, __m256i v, const struct yuv_coeffs_avx2 *c,
+		__m256i *r, __m256i *g, __m256i *b)
+{
+	const __m256i c128 = _mm256_set1_epi16(128);
+	const __m256i rnd = _mm256_set1_epi16(8);
+	__m256i du = _mm256_slli_epi16(_mm256_sub_epi16(u, c128), 7);
+	__m256i dv = _mm256_slli_epi16(_mm256_sub_epi16(v, c128), 7);
+	__m256i rv = _mm256_mulhi_epi16(dv, c->crv);
+	__m256i guv = _mm256_add_epi16(_mm256_mulhi_epi16(du, c->cgu),
+				       _mm256_mulhi_epi16(dv, c->cgv));
+	__m256i bu = _mm256_mulhi_epi16(du, c->cbu);
+	__m256i lo, hi;
+
+	y0 = _mm256_add_epi16(_mm256_mulhi_epi16(_mm256_slli_epi16(
+			_mm256_sub_epi16(y0, c->y_offset), 7), c->cy), rnd);
+	y1 = _mm256_add_epi16(_mm256_mulhi_epi16(_mm256_slli_epi16(
+			_mm256_sub_epi16(y1, c->y_offset), 7), c->cy), rnd);
+
+	lo = _mm256_unpacklo_epi16(rv, rv);
+	hi = _mm256_unpackhi_epi16(rv, rv);
+	*r = pack_pixels_avx2(_mm256_srai_epi16(_mm256_add_epi16(y0, lo), 4),
+			      _mm256_srai_epi16(_mm256_add_epi16(y1, hi), 4));
+	lo = _mm256_unpacklo_epi16(guv, guv);
+	hi = _mm256_unpackhi_epi16(guv, guv);
+	*g = pack_pixels_avx2(_mm256_srai_epi16(_mm256_sub_epi16(y0, lo), 4),
+			      _mm256_srai_epi16(_mm256_sub_epi16(y1, hi), 4));
+	lo = _mm256_unpacklo_epi16(bu, bu);
+	hi = _mm256_unpackhi_epi16(bu, bu);
+	*b = pack_pixels_avx2(_mm256_srai_epi16(_mm256_add_epi16(y0, lo), 4),
+			      _mm256_srai_epi16(_mm256_add_epi16(y1, hi), 4));
+}
+
+static inline AVX2 void store_rgb24_avx2(unsigned char *dest,
+		__m256i r, __m256i g, __m256i b, int bgr)
+{
+	__m256i t;
+
+	if (bgr) {
+		t = r;
+		r = b;
+		b = t;
+	}
+
+	store_rgb24_ssse3(dest, _mm256_castsi256_si128(r),
+			  _mm256_castsi256_si128(g),
+			  _mm256_castsi256_si128(b));
+	store_rgb24_ssse3(dest + 48, _mm256_extracti128_si256(r, 1),
+			  _mm256_extracti128_si256(g, 1),
+			  _mm256_extracti128_si256(b, 1));
+}
+
+static AVX2 int yuv422_to_rgb24_row_avx2(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	struct yuv_coeffs_avx2 c;
+	int j;
+
+	yuv_coeffs_avx2(m, &c);
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i y0, y1, u, v, r, g, b;
+
+		yuv422_unpack_avx2(src, layout, &y0, &y1, &u, &v);
+		yuv_to_rgb_avx2(y0, y1, u, v, &c, &r, &g, &b);
+		store_rgb24_avx2(dest, r, g, b, bgr);
+
+		src += 64;
+		dest += 96;
+	}
+
+	return j;
+}
+
+static AVX2 int yuv420_to_rgb24_row_avx2(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	struct yuv_coeffs_avx2 c;
+	int j;
+
+	yuv_coeffs_avx2(m, &c);
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i y0, y1, u, v, r, g, b;
+
+		y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)ysrc));
+		y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ysrc + 16)));
+		/* Spread the pixel pairs over the lanes like yuv_to_rgb_avx2 wants */
+		u = _mm256_permute4x64_epi64(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)usrc)), 0xd8);
+		v = _mm256_permute4x64_epi64(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)vsrc)), 0xd8);
+		yuv_to_rgb_avx2(y0, y1, u, v, &c, &r, &g, &b);
+		store_rgb24_avx2(dest, r, g, b, bgr);
+
+		ysrc += 32;
+		usrc += 16;
+		vsrc += 16;
+		dest += 96;
+	}
+
+	return j;
+}
+
+static AVX2 int nv_to_rgb24_row_avx2(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m)
+{
+	const __m256i lo8 = _mm256_set1_epi16(0x00ff);
+	struct yuv_coeffs_avx2 c;
+	int j;
+
+	yuv_coeffs_avx2(m, &c);
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i y0, y1, uv, c0, c1, r, g, b;
+
+		y0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)ysrc));
+		y1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(ysrc + 16)));
+		/* Spread the pixel pairs over the lanes like yuv_to_rgb_avx2 wants */
+		uv = _mm256_permute4x64_epi64(
+			_mm256_loadu_si256((const __m256i *)uvsrc), 0xd8);
+		c0 = _mm256_and_si256(uv, lo8);
+		c1 = _mm256_srli_epi16(uv, 8);
+		yuv_to_rgb_avx2(y0, y1, vu ? c1 : c0, vu ? c0 : c1, &c,
+				&r, &g, &b);
+		store_rgb24_avx2(dest, r, g, b, bgr);
+
+		ysrc += 32;
+		uvsrc += 32;
+		dest += 96;
+	}
+
+	return j;
+}
+
+static SSE2 int yuv422_to_y_row_sse2(const unsigned char *src,
+		unsigned char *dest, int width, int layout)
+{
+	int j;
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i y0, y1, u, v;
+
+		yuv422_unpack_sse2(src, layout, &y0, &y1, &u, &v);
+		_mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(y0, y1));
+		src += 32;
+		dest += 16;
+	}
+
+	return j;
+}
+
+static AVX2 int yuv422_to_y_row_avx2(const unsigned char *src,
+		unsigned char *dest, int width, int layout)
+{
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i y0, y1, u, v;
+
+		yuv422_unpack_avx2(src, layout, &y0, &y1, &u, &v);
+		_mm256_storeu_si256((__m256i *)dest, pack_pixels_avx2(y0, y1));
+		src += 64;
+		dest += 32;
+	}
+
+	return j;
+}
+
+static SSE2 int yuv422_to_uv_row_sse2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int layout)
+{
+	int j;
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i y0, y1, u0, v0, u1, v1, u, v;
+
+		yuv422_unpack_sse2(src0, layout, &y0, &y1, &u0, &v0);
+		yuv422_unpack_sse2(src1, layout, &y0, &y1, &u1, &v1);
+		u = _mm_srli_epi16(_mm_add_epi16(u0, u1), 1);
+		v = _mm_srli_epi16(_mm_add_epi16(v0, v1), 1);
+		_mm_storel_epi64((__m128i *)udest, _mm_packus_epi16(u, u));
+		_mm_storel_epi64((__m128i *)vdest, _mm_packus_epi16(v, v));
+		src0 += 32;
+		src1 += 32;
+		udest += 8;
+		vdest += 8;
+	}
+
+	return j;
+}
+
+static AVX2 int yuv422_to_uv_row_avx2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int layout)
+{
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i y0, y1, u0, v0, u1, v1, u, v;
+
+		yuv422_unpack_avx2(src0, layout, &y0, &y1, &u0, &v0);
+		yuv422_unpack_avx2(src1, layout, &y0, &y1, &u1, &v1);
+		/* Put the pixel pairs back in order, see yuv422_unpack_avx2 */
+		u = _mm256_permute4x64_epi64(
+			_mm256_srli_epi16(_mm256_add_epi16(u0, u1), 1), 0xd8);
+		v = _mm256_permute4x64_epi64(
+			_mm256_srli_epi16(_mm256_add_epi16(v0, v1), 1), 0xd8);
+		_mm_storeu_si128((__m128i *)udest,
+			_mm_packus_epi16(_mm256_castsi256_si128(u),
+					 _mm256_extracti128_si256(u, 1)));
+		_mm_storeu_si128((__m128i *)vdest,
+			_mm_packus_epi16(_mm256_castsi256_si128(v),
+					 _mm256_extracti128_si256(v, 1)));
+		src0 += 64;
+		src1 += 64;
+		udest += 16;
+		vdest += 16;
+	}
+
+	return j;
+}
+
+static SSE2 int nv_to_uv_row_sse2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+	const __m128i lo8 = _mm_set1_epi16(0x00ff);
+	int j;
+
+	for (j = 0; j + 16 <= width; j += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src0);
+		__m128i b = _mm_loadu_si128((const __m128i *)src1);
+		__m128i u = _mm_srli_epi16(_mm_add_epi16(_mm_and_si128(a, lo8),
+						_mm_and_si128(b, lo8)), 1);
+		__m128i v = _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(a, 8),
+						_mm_srli_epi16(b, 8)), 1);
+
+		_mm_storel_epi64((__m128i *)udest, _mm_packus_epi16(u, u));
+		_mm_storel_epi64((__m128i *)vdest, _mm_packus_epi16(v, v));
+		src0 += 16;
+		src1 += 16;
+		udest += 8;
+		vdest += 8;
+	}
+
+	return j;
+}
+
+static AVX2 int nv_to_uv_row_avx2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+	const __m256i lo8 = _mm256_set1_epi16(0x00ff);
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)src0);
+		__m256i b = _mm256_loadu_si256((const __m256i *)src1);
+		__m256i u = _mm256_srli_epi16(_mm256_add_epi16(
+				_mm256_and_si256(a, lo8),
+				_mm256_and_si256(b, lo8)), 1);
+		__m256i v = _mm256_srli_epi16(_mm256_add_epi16(
+				_mm256_srli_epi16(a, 8),
+				_mm256_srli_epi16(b, 8)), 1);
+
+		_mm_storeu_si128((__m128i *)udest,
+			_mm_packus_epi16(_mm256_castsi256_si128(u),
+					 _mm256_extracti128_si256(u, 1)));
+		_mm_storeu_si128((__m128i *)vdest,
+			_mm_packus_epi16(_mm256_castsi256_si128(v),
+					 _mm256_extracti128_si256(v, 1)));
+		src0 += 32;
+		src1 += 32;
+		udest += 16;
+		vdest += 16;
+	}
+
+	return j;
+}
+
+/*
+ * Y10BPACK to 8 bit: the samples are a big endian bit stream, so the 8 msb of
+ * pixel k are bits 2 * (k % 4) and up of the 16 bit big endian word at byte
+ * 10 * k / 8. Shifting these words left by the multiply puts them in the high
+ * byte.
+ */
+static SSSE3 int y10b_to_8_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m128i words = _mm_setr_epi8(1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8);
+	const __m128i shift = _mm_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64);
+	int j;
+
+	/* 8 pixels from each 10 bytes, the loads read 6 bytes more, so stop
+	   8 pixels early */
+	for (j = 0; j + 24 <= width; j += 16) {
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), words);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 10)), words);
+
+		a = _mm_srli_epi16(_mm_mullo_epi16(a, shift), 8);
+		b = _mm_srli_epi16(_mm_mullo_epi16(b, shift), 8);
+		_mm_storeu_si128((__m128i *)dest, _mm_packus_epi16(a, b));
+		src += 20;
+		dest += 16;
+	}
+
+	return j;
+}
+
+static AVX2 int y10b_to_8_row_avx2(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	const __m256i words = _mm256_setr_epi8(1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8,
+					       1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8);
+	const __m256i shift = _mm256_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64,
+						1, 4, 16, 64, 1, 4, 16, 64);
+	int j;
+
+	for (j = 0; j + 40 <= width; j += 32) {
+		__m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)src)),
+				_mm_loadu_si128((const __m128i *)(src + 10)), 1);
+		__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)(src + 20))),
+				_mm_loadu_si128((const __m128i *)(src + 30)), 1);
+
+		a = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(a, words), shift), 8);
+		b = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_shuffle_epi8(b, words), shift), 8);
+		_mm256_storeu_si256((__m256i *)dest,
+			_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+		src += 40;
+		dest += 32;
+	}
+
+	return j;
+}
+
+/* Expand 8 rgb565 pixels to 8 bit r, g and b in 16 bit lanes */
+static inline SSE2 void rgb565_unpack_sse2(__m128i p, __m128i *r,
+		__m128i *g, __m128i *b)
+{
+	*r = _mm_and_si128(_mm_srli_epi16(p, 8), _mm_set1_epi16(0xf8));
+	*g = _mm_and_si128(_mm_srli_epi16(p, 3), _mm_set1_epi16(0xfc));
+	*b = _mm_and_si128(_mm_slli_epi16(p, 3), _mm_set1_epi16(0xf8));
+}
+
+static SSSE3 int rgb565_to_rgb24_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i r0, g0, b0, r1, g1, b1, r, g, b;
+
+		rgb565_unpack_sse2(_mm_loadu_si128((const __m128i *)(src + 2 * x)),
+				   &r0, &g0, &b0);
+		rgb565_unpack_sse2(_mm_loadu_si128((const __m128i *)(src + 2 * x + 16)),
+				   &r1, &g1, &b1);
+		r = _mm_packus_epi16(r0, r1);
+		g = _mm_packus_epi16(g0, g1);
+		b = _mm_packus_epi16(b0, b1);
+		if (bgr)
+			store_rgb24_ssse3(dest + 3 * x, b, g, r);
+		else
+			store_rgb24_ssse3(dest + 3 * x, r, g, b);
+	}
+
+	return x;
+}
+
+/*
+ * RGB2Y and RGB2UV of 8 pixels, with the rounding constants folded into the
+ * madd by pairing b with 16384.
+ */
+static inline SSE2 __m128i rgb_to_y_sse2(__m128i r, __m128i g, __m128i b)
+{
+	const __m128i crg = _mm_set1_epi32((16594 << 16) | 8453);
+	const __m128i cb = _mm_set1_epi32((32 << 16) | 3223);
+	const __m128i k = _mm_set1_epi16(16384);
+	__m128i rg, bk, lo, hi;
+
+	rg = _mm_unpacklo_epi16(r, g);
+	bk = _mm_unpacklo_epi16(b, k);
+	lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg, crg),
+					  _mm_madd_epi16(bk, cb)), 15);
+	rg = _mm_unpackhi_epi16(r, g);
+	bk = _mm_unpackhi_epi16(b, k);
+	hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(rg, crg),
+					  _mm_madd_epi16(bk, cb)), 15);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+static inline SSE2 __m128i rgb_to_chroma_sse2(__m128i r, __m128i g,
+		__m128i b, int cr, int cg, int cb)
+{
+	const __m128i crg = _mm_unpacklo_epi16(_mm_set1_epi16(cr), _mm_set1_epi16(cg));
+	const __m128i cbk = _mm_unpacklo_epi16(_mm_set1_epi16(cb), _mm_set1_epi16(257));
+	const __m128i k = _mm_set1_epi16(16384);
+	__m128i lo, hi;
+
+	lo = _mm_srai_epi32(_mm_add_epi32(
+		_mm_madd_epi16(_mm_unpacklo_epi16(r, g), crg),
+		_mm_madd_epi16(_mm_unpacklo_epi16(b, k), cbk)), 15);
+	hi = _mm_srai_epi32(_mm_add_epi32(
+		_mm_madd_epi16(_mm_unpackhi_epi16(r, g), crg),
+		_mm_madd_epi16(_mm_unpackhi_epi16(b, k), cbk)), 15);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+static SSE2 int rgb565_to_y_row_sse2(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i r, g, b, y0, y1;
+
+		rgb565_unpack_sse2(_mm_loadu_si128((const __m128i *)(src + 2 * x)),
+				   &r, &g, &b);
+		y0 = rgb_to_y_sse2(r, g, b);
+		rgb565_unpack_sse2(_mm_loadu_si128((const __m128i *)(src + 2 * x + 16)),
+				   &r, &g, &b);
+		y1 = rgb_to_y_sse2(r, g, b);
+		_mm_storeu_si128((__m128i *)(dest + x), _mm_packus_epi16(y0, y1));
+	}
+
+	return x;
+}
+
+/* Sum of 8 pixels of 2 lines per horizontal pair, in the low 16 bits of
+   each 32 bit lane */
+static inline SSE2 __m128i sum_pairs_sse2(__m128i a, __m128i b)
+{
+	__m128i s = _mm_add_epi16(a, b);
+
+	return _mm_and_si128(_mm_add_epi16(s, _mm_srli_epi32(s, 16)),
+			     _mm_set1_epi32(0xffff));
+}
+
+static SSE2 int rgb565_to_uv_row_sse2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i r0, g0, b0, r1, g1, b1, r[2], g[2], b[2], u, v;
+		int i;
+
+		for (i = 0; i < 2; i++) {
+			rgb565_unpack_sse2(_mm_loadu_si128((const __m128i *)(src0 + 2 * x + 16 * i)),
+					   &r0, &g0, &b0);
+			rgb565_unpack_sse2(_mm_loadu_si128((const __m128i *)(src1 + 2 * x + 16 * i)),
+					   &r1, &g1, &b1);
+			r[i] = sum_pairs_sse2(r0, r1);
+			g[i] = sum_pairs_sse2(g0, g1);
+			b[i] = sum_pairs_sse2(b0, b1);
+		}
+		r0 = _mm_srli_epi16(_mm_packs_epi32(r[0], r[1]), 2);
+		g0 = _mm_srli_epi16(_mm_packs_epi32(g[0], g[1]), 2);
+		b0 = _mm_srli_epi16(_mm_packs_epi32(b[0], b[1]), 2);
+
+		u = rgb_to_chroma_sse2(r0, g0, b0, -4878, -9578, 14456);
+		v = rgb_to_chroma_sse2(r0, g0, b0, 14456, -12105, -2351);
+		_mm_storel_epi64((__m128i *)(udest + x / 2), _mm_packus_epi16(u, zero));
+		_mm_storel_epi64((__m128i *)(vdest + x / 2), _mm_packus_epi16(v, zero));
+	}
+
+	return x;
+}
+
+/*
+ * The 64 byte loads of the 32 bit rgb kernels reach the last byte of the
+ * last pixel, which is past the end of the frame when src points to the byte
+ * after a leading alpha byte, so they stop a block early.
+ */
+static SSSE3 int rgb32_to_rgb24_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+	const __m128i rgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	const __m128i swap = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m128i m = bgr ? swap : rgb;
+	int x;
+
+	for (x = 0; x + 16 < width; x += 16) {
+		const __m128i *s = (const __m128i *)(src + 4 * x);
+		__m128i *d = (__m128i *)(dest + 3 * x);
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128(s), m);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128(s + 1), m);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128(s + 2), m);
+		__m128i e = _mm_shuffle_epi8(_mm_loadu_si128(s + 3), m);
+
+		_mm_storeu_si128(d, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storeu_si128(d + 1, _mm_or_si128(_mm_srli_si128(b, 4),
+						     _mm_slli_si128(c, 8)));
+		_mm_storeu_si128(d + 2, _mm_or_si128(_mm_srli_si128(c, 8),
+						     _mm_slli_si128(e, 4)));
+	}
+
+	return x;
+}
+
+static inline SSSE3 void store_grey_rgb24_ssse3(unsigned char *dest,
+		__m128i g)
+{
+	const __m128i g0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i g1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i g2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+	__m128i *d = (__m128i *)dest;
+
+	_mm_storeu_si128(d, _mm_shuffle_epi8(g, g0));
+	_mm_storeu_si128(d + 1, _mm_shuffle_epi8(g, g1));
+	_mm_storeu_si128(d + 2, _mm_shuffle_epi8(g, g2));
+}
+
+static SSSE3 int grey_to_rgb24_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16)
+		store_grey_rgb24_ssse3(dest + 3 * x,
+			_mm_loadu_si128((const __m128i *)(src + x)));
+
+	return x;
+}
+
+/* The msb of 16 Y16 pixels */
+static inline SSE2 __m128i y16_to_8_sse2(const unsigned char *src,
+		int little_endian)
+{
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+	if (little_endian) {
+		a = _mm_srli_epi16(a, 8);
+		b = _mm_srli_epi16(b, 8);
+	} else {
+		a = _mm_and_si128(a, _mm_set1_epi16(0xff));
+		b = _mm_and_si128(b, _mm_set1_epi16(0xff));
+	}
+
+	return _mm_packus_epi16(a, b);
+}
+
+static SSE2 int y16_to_8_row_sse2(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16)
+		_mm_storeu_si128((__m128i *)(dest + x),
+				 y16_to_8_sse2(src + 2 * x, little_endian));
+
+	return x;
+}
+
+static SSSE3 int y16_to_rgb24_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16)
+		store_grey_rgb24_ssse3(dest + 3 * x,
+				       y16_to_8_sse2(src + 2 * x, little_endian));
+
+	return x;
+}
+
+static inline SSE2 __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*
+ * hsvtorgb of 8 pixels in 16 bit lanes. The divisions by 43 and 30 are
+ * (h * 191) >> 13 and (h * 137) >> 12, and the 180 encoding remain
+ * (h % 30) * 6 * 256 / 180 is 8 * rem + ((rem * 137) >> 8), which are exact
+ * for all 8 bit h.
+ */
+static inline SSE2 void hsv_to_rgb_sse2(__m128i h, __m128i s, __m128i v,
+		int hsv_enc, __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i ff = _mm_set1_epi16(255);
+	__m128i region, remain, p, q, t, m;
+
+	if (hsv_enc == V4L2_HSV_ENC_256) {
+		region = _mm_srli_epi16(_mm_mullo_epi16(h, _mm_set1_epi16(191)), 13);
+		remain = _mm_mullo_epi16(_mm_sub_epi16(h,
+				_mm_mullo_epi16(region, _mm_set1_epi16(43))),
+				_mm_set1_epi16(6));
+	} else {
+		region = _mm_srli_epi16(_mm_mullo_epi16(h, _mm_set1_epi16(137)), 12);
+		remain = _mm_sub_epi16(h, _mm_mullo_epi16(region, _mm_set1_epi16(30)));
+		remain = _mm_add_epi16(_mm_slli_epi16(remain, 3), _mm_srli_epi16(
+				_mm_mullo_epi16(remain, _mm_set1_epi16(137)), 8));
+	}
+
+	p = _mm_srli_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(ff, s)), 8);
+	q = _mm_srli_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(ff,
+		_mm_srli_epi16(_mm_mullo_epi16(s, remain), 8))), 8);
+	t = _mm_srli_epi16(_mm_mullo_epi16(v, _mm_sub_epi16(ff,
+		_mm_srli_epi16(_mm_mullo_epi16(s, _mm_sub_epi16(ff, remain)), 8))), 8);
+
+	/* Region 5 and up */
+	*r = v; *g = p; *b = q;
+
+	m = _mm_cmpeq_epi16(region, _mm_setzero_si128());
+	*r = select_sse2(m, v, *r); *g = select_sse2(m, t, *g); *b = select_sse2(m, p, *b);
+	m = _mm_cmpeq_epi16(region, _mm_set1_epi16(1));
+	*r = select_sse2(m, q, *r); *g = select_sse2(m, v, *g); *b = select_sse2(m, p, *b);
+	m = _mm_cmpeq_epi16(region, _mm_set1_epi16(2));
+	*r = select_sse2(m, p, *r); *g = select_sse2(m, v, *g); *b = select_sse2(m, t, *b);
+	m = _mm_cmpeq_epi16(region, _mm_set1_epi16(3));
+	*r = select_sse2(m, p, *r); *g = select_sse2(m, q, *g); *b = select_sse2(m, v, *b);
+	m = _mm_cmpeq_epi16(region, _mm_set1_epi16(4));
+	*r = select_sse2(m, t, *r); *g = select_sse2(m, p, *g); *b = select_sse2(m, v, *b);
+
+	/* No saturation */
+	m = _mm_cmpeq_epi16(s, _mm_setzero_si128());
+	*r = select_sse2(m, v, *r); *g = select_sse2(m, v, *g); *b = select_sse2(m, v, *b);
+}
+
+/*
+ * 16 HSV24 pixels get spread over 4 registers like in rgb24_to_rgb32, so
+ * both formats have h, s and v in bytes 1, 2 and 3 of 32 bit lanes.
+ */
+static SSSE3 int hsv_to_rgb24_row_ssse3(const unsigned char *src,
+		unsigned char *dest, int width, int bpp, int bgr, int hsv_enc)
+{
+	const __m128i pad = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	const __m128i ff = _mm_set1_epi32(0xff);
+	int x, i;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i p[4], h, s, v, r[2], g[2], b[2];
+
+		if (bpp == 3) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+			__m128i c = _mm_loadu_si128((const __m128i *)(src + 3 * x + 16));
+			__m128i e = _mm_loadu_si128((const __m128i *)(src + 3 * x + 32));
+
+			p[0] = _mm_shuffle_epi8(a, pad);
+			p[1] = _mm_shuffle_epi8(_mm_alignr_epi8(c, a, 12), pad);
+			p[2] = _mm_shuffle_epi8(_mm_alignr_epi8(e, c, 8), pad);
+			p[3] = _mm_shuffle_epi8(_mm_srli_si128(e, 4), pad);
+		} else {
+			for (i = 0; i < 4; i++)
+				p[i] = _mm_loadu_si128((const __m128i *)(src + 4 * x + 16 * i));
+		}
+
+		for (i = 0; i < 2; i++) {
+			h = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p[2 * i], 8), ff),
+					    _mm_and_si128(_mm_srli_epi32(p[2 * i + 1], 8), ff));
+			s = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p[2 * i], 16), ff),
+					    _mm_and_si128(_mm_srli_epi32(p[2 * i + 1], 16), ff));
+			v = _mm_packs_epi32(_mm_srli_epi32(p[2 * i], 24),
+					    _mm_srli_epi32(p[2 * i + 1], 24));
+			hsv_to_rgb_sse2(h, s, v, hsv_enc, &r[i], &g[i], &b[i]);
+		}
+
+		r[0] = _mm_packus_epi16(r[0], r[1]);
+		g[0] = _mm_packus_epi16(g[0], g[1]);
+		b[0] = _mm_packus_epi16(b[0], b[1]);
+		if (bgr)
+			store_rgb24_ssse3(dest + 3 * x, b[0], g[0], r[0]);
+		else
+			store_rgb24_ssse3(dest + 3 * x, r[0], g[0], b[0]);
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+/* Deinterleave 32 pixels */
+static inline void yuv422_unpack_neon(const unsigned char *src, int layout,
+		uint8x16_t *y0, uint8x16_t *y1, uint8x16_t *u, uint8x16_t *v)
+{
+	uint8x16x4_t p = vld4q_u8(src);
+
+	switch (layout) {
+	case V4LCONVERT_YUV422_YUYV:
+		*y0 = p.val[0]; *u = p.val[1]; *y1 = p.val[2]; *v = p.val[3];
+		break;
+	case V4LCONVERT_YUV422_YVYU:
+		*y0 = p.val[0]; *v = p.val[1]; *y1 = p.val[2]; *u = p.val[3];
+		break;
+	default:
+		*u = p.val[0]; *y0 = p.val[1]; *v = p.val[2]; *y1 = p.val[3];
+		break;
+	}
+}
+
+struct yuv_coeffs_neon {
+	uint8x8_t y_offset;
+	int16x8_t cy, crv, cgu, cgv, cbu;
+};
+
+static inline void yuv_coeffs_neon(const struct v4lconvert_yuv_matrix *m,
+		struct yuv_coeffs_neon *c)
+{
+	c->y_offset = vdup_n_u8(m->y_offset);
+	c->cy = vdupq_n_s16(m->cy);
+	c->crv = vdupq_n_s16(m->crv);
+	c->cgu = vdupq_n_s16(m->cgu);
+	c->cgv = vdupq_n_s16(m->cgv);
+	c->cbu = vdupq_n_s16(m->cbu);
+}
+
+/*
+ * Convert 8 pixel pairs, y0 holds the even and y1 the odd pixels. This is
+ * the same math as the tables used by the C code, the doubling multiply
+ * returning the high half: (2 * (x << 6) * c) >> 16 is exactly (x * c) >> 9.
+ */
+static inline uint8x16x3_t yuv_to_rgb24_neon(uint8x8_t y0, uint8x8_t y1,
+		uint8x8_t u, uint8x8_t v, const struct yuv_coeffs_neon *c,
+		int bgr)
+{
+	const uint8x8_t c128 = vdup_n_u8(128);
+	const int16x8_t rnd = vdupq_n_s16(8);
+	int16x8_t du = vshlq_n_s16(vreinterpretq_s16_u16(vsubl_u8(u, c128)), 6);
+	int16x8_t dv = vshlq_n_s16(vreinterpretq_s16_u16(vsubl_u8(v, c128)), 6);
+	int16x8_t ye = vshlq_n_s16(vreinterpretq_s16_u16(vsubl_u8(y0, c->y_offset)), 6);
+	int16x8_t yo = vshlq_n_s16(vreinterpretq_s16_u16(vsubl_u8(y1, c->y_offset)), 6);
+	int16x8_t rv, guv, bu;
+	uint8x8x2_t r, g, b;
+	uint8x16x3_t rgb;
+
+	ye = vaddq_s16(vqdmulhq_s16(ye, c->cy), rnd);
+	yo = vaddq_s16(vqdmulhq_s16(yo, c->cy), rnd);
+	rv = vqdmulhq_s16(dv, c->crv);
+	guv = vaddq_s16(vqdmulhq_s16(du, c->cgu), vqdmulhq_s16(dv, c->cgv));
+	bu = vqdmulhq_s16(du, c->cbu);
+
+	/* The saturating narrowing shift does the clipping */
+	r = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, rv), 4),
+		    vqshrun_n_s16(vaddq_s16(yo, rv), 4));
+	g = vzip_u8(vqshrun_n_s16(vsubq_s16(ye, guv), 4),
+		    vqshrun_n_s16(vsubq_s16(yo, guv), 4));
+	b = vzip_u8(vqshrun_n_s16(vaddq_s16(ye, bu), 4),
+		    vqshrun_n_s16(vaddq_s16(yo, bu), 4));
+
+	rgb.val[bgr ? 2 : 0] = vcombine_u8(r.val[0], r.val[1]);
+	rgb.val[1] = vcombine_u8(g.val[0], g.val[1]);
+	rgb.val[bgr ? 0 : 2] = vcombine_u8(b.val[0], b.val[1]);
+
+	return rgb;
+}
+
+static int yuv422_to_rgb24_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	struct yuv_coeffs_neon c;
+	int j;
+
+	yuv_coeffs_neon(m, &c);
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		uint8x16_t y0, y1, u, v;
+
+		yuv422_unpack_neon(src, layout, &y0, &y1, &u, &v);
+		vst3q_u8(dest, yuv_to_rgb24_neon(vget_low_u8(y0),
+				vget_low_u8(y1), vget_low_u8(u),
+				vget_low_u8(v), &c, bgr));
+		vst3q_u8(dest + 48, yuv_to_rgb24_neon(vget_high_u8(y0),
+				vget_high_u8(y1), vget_high_u8(u),
+				vget_high_u8(v), &c, bgr));
+		src += 64;
+		dest += 96;
+	}
+
+	return j;
+}
+
+static int yuv420_to_rgb24_row_neon(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	struct yuv_coeffs_neon c;
+	int j;
+
+	yuv_coeffs_neon(m, &c);
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		/* Deinterleave into even and odd pixels */
+		uint8x16x2_t y = vld2q_u8(ysrc);
+		uint8x16_t u = vld1q_u8(usrc);
+		uint8x16_t v = vld1q_u8(vsrc);
+
+		vst3q_u8(dest, yuv_to_rgb24_neon(vget_low_u8(y.val[0]),
+				vget_low_u8(y.val[1]), vget_low_u8(u),
+				vget_low_u8(v), &c, bgr));
+		vst3q_u8(dest + 48, yuv_to_rgb24_neon(vget_high_u8(y.val[0]),
+				vget_high_u8(y.val[1]), vget_high_u8(u),
+				vget_high_u8(v), &c, bgr));
+		ysrc += 32;
+		usrc += 16;
+		vsrc += 16;
+		dest += 96;
+	}
+
+	return j;
+}
+
+static int yuv422_to_y_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int layout)
+{
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		uint8x16x2_t y;
+		uint8x16_t u, v;
+
+		yuv422_unpack_neon(src, layout, &y.val[0], &y.val[1], &u, &v);
+		vst2q_u8(dest, y);
+		src += 64;
+		dest += 32;
+	}
+
+	return j;
+}
+
+static int yuv422_to_uv_row_neon(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int layout)
+{
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		uint8x16_t y0, y1, u0, v0, u1, v1;
+
+		yuv422_unpack_neon(src0, layout, &y0, &y1, &u0, &v0);
+		yuv422_unpack_neon(src1, layout, &y0, &y1, &u1, &v1);
+		/* Halving add truncates, just like the C code */
+		vst1q_u8(udest, vhaddq_u8(u0, u1));
+		vst1q_u8(vdest, vhaddq_u8(v0, v1));
+		src0 += 64;
+		src1 += 64;
+		udest += 16;
+		vdest += 16;
+	}
+
+	return j;
+}
+
+static int nv_to_rgb24_row_neon(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m)
+{
+	struct yuv_coeffs_neon c;
+	int j;
+
+	yuv_coeffs_neon(m, &c);
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		/* Deinterleave into even and odd pixels and into U and V */
+		uint8x16x2_t y = vld2q_u8(ysrc);
+		uint8x16x2_t uv = vld2q_u8(uvsrc);
+		uint8x16_t u = uv.val[vu];
+		uint8x16_t v = uv.val[!vu];
+
+		vst3q_u8(dest, yuv_to_rgb24_neon(vget_low_u8(y.val[0]),
+				vget_low_u8(y.val[1]), vget_low_u8(u),
+				vget_low_u8(v), &c, bgr));
+		vst3q_u8(dest + 48, yuv_to_rgb24_neon(vget_high_u8(y.val[0]),
+				vget_high_u8(y.val[1]), vget_high_u8(u),
+				vget_high_u8(v), &c, bgr));
+		ysrc += 32;
+		uvsrc += 32;
+		dest += 96;
+	}
+
+	return j;
+}
+
+static int nv_to_uv_row_neon(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+	int j;
+
+	for (j = 0; j + 32 <= width; j += 32) {
+		uint8x16x2_t a = vld2q_u8(src0);
+		uint8x16x2_t b = vld2q_u8(src1);
+
+		/* Halving add truncates, just like the C code */
+		vst1q_u8(udest, vhaddq_u8(a.val[0], b.val[0]));
+		vst1q_u8(vdest, vhaddq_u8(a.val[1], b.val[1]));
+		src0 += 32;
+		src1 += 32;
+		udest += 16;
+		vdest += 16;
+	}
+
+	return j;
+}
+
+static int y10b_to_8_row_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	static const uint8_t hi_idx[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+	static const uint8_t lo_idx[8] = { 1, 2, 3, 4, 6, 7, 8, 9 };
+	static const int16_t shifts[8] = { 0, 2, 4, 6, 0, 2, 4, 6 };
+	const uint8x8_t hi = vld1_u8(hi_idx), lo = vld1_u8(lo_idx);
+	const int16x8_t shift = vld1q_s16(shifts);
+	uint8x8_t out[2];
+	int i, j;
+
+	for (j = 0; j + 24 <= width; j += 16) {
+		for (i = 0; i < 2; i++) {
+			uint8x8x2_t t = { { vld1_u8(src), vld1_u8(src + 8) } };
+			uint16x8_t w = vorrq_u16(vshll_n_u8(vtbl2_u8(t, hi), 8),
+						 vmovl_u8(vtbl2_u8(t, lo)));
+
+			out[i] = vshrn_n_u16(vshlq_u16(w, shift), 8);
+			src += 10;
+		}
+		vst1q_u8(dest, vcombine_u8(out[0], out[1]));
+		dest += 16;
+	}
+
+	return j;
+}
+
+static inline void rgb565_unpack_neon(uint16x8_t p, uint16x8_t *r,
+		uint16x8_t *g, uint16x8_t *b)
+{
+	*r = vandq_u16(vshrq_n_u16(p, 8), vdupq_n_u16(0xf8));
+	*g = vandq_u16(vshrq_n_u16(p, 3), vdupq_n_u16(0xfc));
+	*b = vandq_u16(vshlq_n_u16(p, 3), vdupq_n_u16(0xf8));
+}
+
+static int rgb565_to_rgb24_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint16x8_t r0, g0, b0, r1, g1, b1;
+		uint8x16x3_t rgb;
+
+		rgb565_unpack_neon(vld1q_u16((const uint16_t *)(src + 2 * x)),
+				   &r0, &g0, &b0);
+		rgb565_unpack_neon(vld1q_u16((const uint16_t *)(src + 2 * x + 16)),
+				   &r1, &g1, &b1);
+		rgb.val[bgr ? 2 : 0] = vcombine_u8(vmovn_u16(r0), vmovn_u16(r1));
+		rgb.val[1] = vcombine_u8(vmovn_u16(g0), vmovn_u16(g1));
+		rgb.val[bgr ? 0 : 2] = vcombine_u8(vmovn_u16(b0), vmovn_u16(b1));
+		vst3q_u8(dest + 3 * x, rgb);
+	}
+
+	return x;
+}
+
+static inline uint8x8_t rgb_to_y_neon(uint16x8_t r, uint16x8_t g,
+		uint16x8_t b)
+{
+	uint32x4_t lo = vdupq_n_u32(524288), hi = lo;
+
+	lo = vmlal_n_u16(lo, vget_low_u16(r), 8453);
+	lo = vmlal_n_u16(lo, vget_low_u16(g), 16594);
+	lo = vmlal_n_u16(lo, vget_low_u16(b), 3223);
+	hi = vmlal_n_u16(hi, vget_high_u16(r), 8453);
+	hi = vmlal_n_u16(hi, vget_high_u16(g), 16594);
+	hi = vmlal_n_u16(hi, vget_high_u16(b), 3223);
+
+	return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 15), vshrn_n_u32(hi, 15)));
+}
+
+static inline uint8x8_t rgb_to_chroma_neon(int16x8_t r, int16x8_t g,
+		int16x8_t b, int16_t cr, int16_t cg, int16_t cb)
+{
+	int32x4_t lo = vdupq_n_s32(4210688), hi = lo;
+
+	lo = vmlal_n_s16(lo, vget_low_s16(r), cr);
+	lo = vmlal_n_s16(lo, vget_low_s16(g), cg);
+	lo = vmlal_n_s16(lo, vget_low_s16(b), cb);
+	hi = vmlal_n_s16(hi, vget_high_s16(r), cr);
+	hi = vmlal_n_s16(hi, vget_high_s16(g), cg);
+	hi = vmlal_n_s16(hi, vget_high_s16(b), cb);
+
+	return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, 15), vshrn_n_s32(hi, 15)));
+}
+
+static int rgb565_to_y_row_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint16x8_t r, g, b;
+		uint8x8_t y0;
+
+		rgb565_unpack_neon(vld1q_u16((const uint16_t *)(src + 2 * x)),
+				   &r, &g, &b);
+		y0 = rgb_to_y_neon(r, g, b);
+		rgb565_unpack_neon(vld1q_u16((const uint16_t *)(src + 2 * x + 16)),
+				   &r, &g, &b);
+		vst1q_u8(dest + x, vcombine_u8(y0, rgb_to_y_neon(r, g, b)));
+	}
+
+	return x;
+}
+
+/* vld2q splits the even and odd pixels, so summing the 4 unpacked
+   registers sums each 2x2 block */
+static int rgb565_to_uv_row_neon(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+	int x, i;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint16x8x2_t p[2];
+		uint16x8_t r, g, b, rs, gs, bs;
+		int16x8_t sr, sg, sb;
+
+		p[0] = vld2q_u16((const uint16_t *)(src0 + 2 * x));
+		p[1] = vld2q_u16((const uint16_t *)(src1 + 2 * x));
+		rs = gs = bs = vdupq_n_u16(0);
+		for (i = 0; i < 4; i++) {
+			rgb565_unpack_neon(p[i / 2].val[i % 2], &r, &g, &b);
+			rs = vaddq_u16(rs, r);
+			gs = vaddq_u16(gs, g);
+			bs = vaddq_u16(bs, b);
+		}
+		sr = vreinterpretq_s16_u16(vshrq_n_u16(rs, 2));
+		sg = vreinterpretq_s16_u16(vshrq_n_u16(gs, 2));
+		sb = vreinterpretq_s16_u16(vshrq_n_u16(bs, 2));
+
+		vst1_u8(udest + x / 2, rgb_to_chroma_neon(sr, sg, sb, -4878, -9578, 14456));
+		vst1_u8(vdest + x / 2, rgb_to_chroma_neon(sr, sg, sb, 14456, -12105, -2351));
+	}
+
+	return x;
+}
+
+/* See rgb32_to_rgb24_row_ssse3 for why this stops a block early */
+static int rgb32_to_rgb24_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+	int x;
+
+	for (x = 0; x + 16 < width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(src + 4 * x);
+		uint8x16x3_t rgb;
+
+		rgb.val[0] = p.val[bgr ? 2 : 0];
+		rgb.val[1] = p.val[1];
+		rgb.val[2] = p.val[bgr ? 0 : 2];
+		vst3q_u8(dest + 3 * x, rgb);
+	}
+
+	return x;
+}
+
+static int grey_to_rgb24_row_neon(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x3_t rgb;
+
+		rgb.val[0] = rgb.val[1] = rgb.val[2] = vld1q_u8(src + x);
+		vst3q_u8(dest + 3 * x, rgb);
+	}
+
+	return x;
+}
+
+static int y16_to_8_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16)
+		vst1q_u8(dest + x, vld2q_u8(src + 2 * x).val[little_endian ? 1 : 0]);
+
+	return x;
+}
+
+static int y16_to_rgb24_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x3_t rgb;
+
+		rgb.val[0] = vld2q_u8(src + 2 * x).val[little_endian ? 1 : 0];
+		rgb.val[1] = rgb.val[2] = rgb.val[0];
+		vst3q_u8(dest + 3 * x, rgb);
+	}
+
+	return x;
+}
+
+/* See hsv_to_rgb_sse2 */
+static inline void hsv_to_rgb_neon(uint16x8_t h, uint16x8_t s, uint16x8_t v,
+		int hsv_enc, uint16x8_t *r, uint16x8_t *g, uint16x8_t *b)
+{
+	const uint16x8_t ff = vdupq_n_u16(255);
+	uint16x8_t region, remain, p, q, t, m;
+
+	if (hsv_enc == V4L2_HSV_ENC_256) {
+		region = vshrq_n_u16(vmulq_n_u16(h, 191), 13);
+		remain = vmulq_n_u16(vmlsq_n_u16(h, region, 43), 6);
+	} else {
+		region = vshrq_n_u16(vmulq_n_u16(h, 137), 12);
+		remain = vmlsq_n_u16(h, region, 30);
+		remain = vaddq_u16(vshlq_n_u16(remain, 3),
+				   vshrq_n_u16(vmulq_n_u16(remain, 137), 8));
+	}
+
+	p = vshrq_n_u16(vmulq_u16(v, vsubq_u16(ff, s)), 8);
+	q = vshrq_n_u16(vmulq_u16(v, vsubq_u16(ff,
+		vshrq_n_u16(vmulq_u16(s, remain), 8))), 8);
+	t = vshrq_n_u16(vmulq_u16(v, vsubq_u16(ff,
+		vshrq_n_u16(vmulq_u16(s, vsubq_u16(ff, remain)), 8))), 8);
+
+	/* Region 5 and up */
+	*r = v; *g = p; *b = q;
+
+	m = vceqq_u16(region, vdupq_n_u16(0));
+	*r = vbslq_u16(m, v, *r); *g = vbslq_u16(m, t, *g); *b = vbslq_u16(m, p, *b);
+	m = vceqq_u16(region, vdupq_n_u16(1));
+	*r = vbslq_u16(m, q, *r); *g = vbslq_u16(m, v, *g); *b = vbslq_u16(m, p, *b);
+	m = vceqq_u16(region, vdupq_n_u16(2));
+	*r = vbslq_u16(m, p, *r); *g = vbslq_u16(m, v, *g); *b = vbslq_u16(m, t, *b);
+	m = vceqq_u16(region, vdupq_n_u16(3));
+	*r = vbslq_u16(m, p, *r); *g = vbslq_u16(m, q, *g); *b = vbslq_u16(m, v, *b);
+	m = vceqq_u16(region, vdupq_n_u16(4));
+	*r = vbslq_u16(m, t, *r); *g = vbslq_u16(m, p, *g); *b = vbslq_u16(m, v, *b);
+
+	/* No saturation */
+	m = vceqq_u16(s, vdupq_n_u16(0));
+	*r = vbslq_u16(m, v, *r); *g = vbslq_u16(m, v, *g); *b = vbslq_u16(m, v, *b);
+}
+
+static int hsv_to_rgb24_row_neon(const unsigned char *src,
+		unsigned char *dest, int width, int bpp, int bgr, int hsv_enc)
+{
+	int x, i;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16_t h, s, v;
+		uint16x8_t r[2], g[2], b[2];
+		uint8x16x3_t rgb;
+
+		if (bpp == 3) {
+			uint8x16x3_t p = vld3q_u8(src + 3 * x);
+
+			h = p.val[0]; s = p.val[1]; v = p.val[2];
+		} else {
+			uint8x16x4_t p = vld4q_u8(src + 4 * x);
+
+			h = p.val[1]; s = p.val[2]; v = p.val[3];
+		}
+
+		hsv_to_rgb_neon(vmovl_u8(vget_low_u8(h)), vmovl_u8(vget_low_u8(s)),
+				vmovl_u8(vget_low_u8(v)), hsv_enc, &r[0], &g[0], &b[0]);
+		hsv_to_rgb_neon(vmovl_u8(vget_high_u8(h)), vmovl_u8(vget_high_u8(s)),
+				vmovl_u8(vget_high_u8(v)), hsv_enc, &r[1], &g[1], &b[1]);
+
+		i = bgr ? 2 : 0;
+		rgb.val[i] = vcombine_u8(vmovn_u16(r[0]), vmovn_u16(r[1]));
+		rgb.val[1] = vcombine_u8(vmovn_u16(g[0]), vmovn_u16(g[1]));
+		rgb.val[2 - i] = vcombine_u8(vmovn_u16(b[0]), vmovn_u16(b[1]));
+		vst3q_u8(dest + 3 * x, rgb);
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_yuv422_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return yuv422_to_rgb24_row_avx2(src, dest, width, layout, bgr, m);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return yuv422_to_rgb24_row_sse2(src, dest, width, layout, bgr, m);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return yuv422_to_rgb24_row_neon(src, dest, width, layout, bgr, m);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_yuv420_to_rgb24_row(const unsigned char *ysrc,
+		const unsigned char *usrc, const unsigned char *vsrc,
+		unsigned char *dest, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return yuv420_to_rgb24_row_avx2(ysrc, usrc, vsrc, dest, width,
+						bgr, m);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return yuv420_to_rgb24_row_sse2(ysrc, usrc, vsrc, dest, width,
+						bgr, m);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return yuv420_to_rgb24_row_neon(ysrc, usrc, vsrc, dest, width,
+						bgr, m);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_yuv422_to_y_row(const unsigned char *src,
+		unsigned char *dest, int width, int layout)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return yuv422_to_y_row_avx2(src, dest, width, layout);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return yuv422_to_y_row_sse2(src, dest, width, layout);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return yuv422_to_y_row_neon(src, dest, width, layout);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_yuv422_to_uv_row(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int layout)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return yuv422_to_uv_row_avx2(src0, src1, udest, vdest, width, layout);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return yuv422_to_uv_row_sse2(src0, src1, udest, vdest, width, layout);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return yuv422_to_uv_row_neon(src0, src1, udest, vdest, width, layout);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_nv_to_rgb24_row(const unsigned char *ysrc,
+		const unsigned char *uvsrc, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return nv_to_rgb24_row_avx2(ysrc, uvsrc, dest, width, vu,
+					    bgr, m);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return nv_to_rgb24_row_sse2(ysrc, uvsrc, dest, width, vu,
+					    bgr, m);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return nv_to_rgb24_row_neon(ysrc, uvsrc, dest, width, vu,
+					    bgr, m);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_nv_to_uv_row(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return nv_to_uv_row_avx2(src0, src1, udest, vdest, width);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return nv_to_uv_row_sse2(src0, src1, udest, vdest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return nv_to_uv_row_neon(src0, src1, udest, vdest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_y10b_to_8_row(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return y10b_to_8_row_avx2(src, dest, width);
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return y10b_to_8_row_ssse3(src, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return y10b_to_8_row_neon(src, dest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_rgb565_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return rgb565_to_rgb24_row_ssse3(src, dest, width, bgr);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return rgb565_to_rgb24_row_neon(src, dest, width, bgr);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_rgb565_to_y_row(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return rgb565_to_y_row_sse2(src, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return rgb565_to_y_row_neon(src, dest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_rgb565_to_uv_row(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return rgb565_to_uv_row_sse2(src0, src1, udest, vdest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return rgb565_to_uv_row_neon(src0, src1, udest, vdest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_rgb32_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int bgr)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return rgb32_to_rgb24_row_ssse3(src, dest, width, bgr);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return rgb32_to_rgb24_row_neon(src, dest, width, bgr);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_grey_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return grey_to_rgb24_row_ssse3(src, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return grey_to_rgb24_row_neon(src, dest, width);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_y16_to_8_row(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return y16_to_8_row_sse2(src, dest, width, little_endian);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return y16_to_8_row_neon(src, dest, width, little_endian);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_y16_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int little_endian)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return y16_to_rgb24_row_ssse3(src, dest, width, little_endian);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return y16_to_rgb24_row_neon(src, dest, width, little_endian);
+#endif
+	return 0;
+}
+
+int v4lconvert_simd_hsv_to_rgb24_row(const unsigned char *src,
+		unsigned char *dest, int width, int bpp, int bgr, int hsv_enc)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+	if (bpp != 3 && bpp != 4)
+		return 0;
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_SSSE3)
+		return hsv_to_rgb24_row_ssse3(src, dest, width, bpp, bgr, hsv_enc);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return hsv_to_rgb24_row_neon(src, dest, width, bpp, bgr, hsv_enc);
+#endif
+	return 0;
+}
@@ -83,79 +83,133 @@ void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-#define YUV2R(y, u, v) ({ \
-		int r = (y) + ((((v) - 128) * 1436) >> 10); r > 255 ? 255 : r < 0 ? 0 : r; })
-#define YUV2G(y, u, v) ({ \
-		int g = (y) - ((((u) - 128) * 352 + ((v) - 128) * 731) >> 10); g > 255 ? 255 : g < 0 ? 0 : g; })
-#define YUV2B(y, u, v) ({ \
-		int b = (y) + ((((u) - 128) * 1814) >> 10); b > 255 ? 255 : b < 0 ? 0 : b; })
+/* (Re)build the Y'CbCr -> R'G'B' matrix for the Y'CbCr encoding and
+   quantization of fmt, when these differ from the ones m was built for.
+   Unset (default) encoding and quantization are derived from the
+   colorspace as described in the V4L2 spec. */
+const struct v4lconvert_yuv_matrix *v4lconvert_update_yuv_matrix(
+		struct v4lconvert_yuv_matrix *m, const struct v4l2_format *fmt)
+{
+	unsigned int colorspace = fmt->fmt.pix.colorspace;
+	unsigned int ycbcr_enc = fmt->fmt.pix.ycbcr_enc;
+	unsigned int quantization = fmt->fmt.pix.quantization;
+	double kr, kb, kg, ys, cs;
+
+	if (ycbcr_enc == V4L2_YCBCR_ENC_DEFAULT)
+		ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(colorspace);
+	if (quantization == V4L2_QUANTIZATION_DEFAULT)
+		quantization = V4L2_MAP_QUANTIZATION_DEFAULT(0, colorspace,
+							     ycbcr_enc);
+
+	if (m->ycbcr_enc == ycbcr_enc && m->quantization == quantization)
+		return m;
+
+	switch (ycbcr_enc) {
+	case V4L2_YCBCR_ENC_709:
+	case V4L2_YCBCR_ENC_XV709:
+		kr = 0.2126;
+		kb = 0.0722;
+		break;
+	case V4L2_YCBCR_ENC_BT2020:
+	case V4L2_YCBCR_ENC_BT2020_CONST_LUM: /* Close enough */
+		kr = 0.2627;
+		kb = 0.0593;
+		break;
+	case V4L2_YCBCR_ENC_SMPTE240M:
+		kr = 0.212;
+		kb = 0.087;
+		break;
+	default: /* 601, xvYCC 601 and sYCC */
+		kr = 0.299;
+		kb = 0.114;
+		break;
+	}
+	kg = 1.0 - kr - kb;
 
-#define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
+	if (quantization == V4L2_QUANTIZATION_FULL_RANGE) {
+		m->y_offset = 0;
+		ys = 1.0;
+		cs = 1.0;
+	} else {
+		m->y_offset = 16;
+		ys = 255.0 / 219.0;
+		cs = 255.0 / 224.0;
+	}
 
-void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
-{
-	int i, j;
+	m->cy  = ys * 8192 + 0.5;
+	m->crv = 2 * (1 - kr) * cs * 8192 + 0.5;
+	m->cgu = 2 * (1 - kb) * kb / kg * cs * 8192 + 0.5;
+	m->cgv = 2 * (1 - kr) * kr / kg * cs * 8192 + 0.5;
+	m->cbu = 2 * (1 - kb) * cs * 8192 + 0.5;
 
-	const unsigned char *ysrc = src;
-	const unsigned char *usrc, *vsrc;
+	m->ycbcr_enc = ycbcr_enc;
+	m->quantization = quantization;
 
-	if (yvu) {
-		vsrc = src + stride * height;
-		usrc = vsrc + (stride * height) / 4;
+	return m;
+}
+
+/* The luma and chroma terms of struct v4lconvert_yuv_matrix, the SIMD code
+   relies on these being exactly ((x - offset) * c) >> 9 */
+#define YUV_Y(m, y)	((((y) - (m)->y_offset) * (m)->cy >> 9) + 8)
+#define YUV_C(c, x)	(((x) - 128) * (c) >> 9)
+
+static inline unsigned char yuv_clip(int x)
+{
+	x >>= 4;
+	return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/* Store the pixel with luma term y, using the chroma terms r, g and b */
+static inline unsigned char *yuv_store_pixel(unsigned char *dest,
+		int y, int r, int g, int b, int bgr)
+{
+	if (bgr) {
+		*dest++ = yuv_clip(y + b);
+		*dest++ = yuv_clip(y - g);
+		*dest++ = yuv_clip(y + r);
 	} else {
-		usrc = src + stride * height;
-		vsrc = usrc + (stride * height) / 4;
+		*dest++ = yuv_clip(y + r);
+		*dest++ = yuv_clip(y - g);
+		*dest++ = yuv_clip(y + b);
 	}
+	return dest;
+}
 
-	for (i = 0; i < height; i++) {
-		for (j = 0; j < width; j += 2) {
-#if 1 /* fast slightly less accurate multiplication free code */
-			int u1 = (((*usrc - 128) << 7) +  (*usrc - 128)) >> 6;
-			int rg = (((*usrc - 128) << 1) +  (*usrc - 128) +
-					((*vsrc - 128) << 2) + ((*vsrc - 128) << 1)) >> 3;
-			int v1 = (((*vsrc - 128) << 1) +  (*vsrc - 128)) >> 1;
-
-			*dest++ = CLIP(*ysrc + u1);
-			*dest++ = CLIP(*ysrc - rg);
-			*dest++ = CLIP(*ysrc + v1);
-			ysrc++;
-
-			*dest++ = CLIP(*ysrc + u1);
-			*dest++ = CLIP(*ysrc - rg);
-			*dest++ = CLIP(*ysrc + v1);
-#else
-			*dest++ = YUV2B(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2G(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2R(*ysrc, *usrc, *vsrc);
-			ysrc++;
-
-			*dest++ = YUV2B(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2G(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2R(*ysrc, *usrc, *vsrc);
-#endif
-			ysrc++;
-			usrc++;
-			vsrc++;
-		}
-		ysrc += stride - width;
-		/* Rewind u and v for next line */
-		if (!(i & 1)) {
-			usrc -= width / 2;
-			vsrc -= width / 2;
-		} else {
-			usrc += (stride - width) / 2;
-			vsrc += (stride - width) / 2;
-		}
-	}
+/* Store the pixel pair with luma values y[0] and y[ystep] (or only the
+   first pixel of it if width is 1) */
+static inline unsigned char *yuv_store_pixels(unsigned char *dest,
+		const struct v4lconvert_yuv_matrix *m, const unsigned char *y,
+		int ystep, int width, int u, int v, int bgr)
+{
+	int r = YUV_C(m->crv, v);
+	int g = YUV_C(m->cgu, u) + YUV_C(m->cgv, v);
+	int b = YUV_C(m->cbu, u);
+
+	dest = yuv_store_pixel(dest, YUV_Y(m, y[0]), r, g, b, bgr);
+	if (width > 1)
+		dest = yuv_store_pixel(dest, YUV_Y(m, y[ystep]), r, g, b, bgr);
+	return dest;
 }
 
-void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+void v4lconvert_yuv420_to_rgbbgr24_row(const unsigned char *y,
+		const unsigned char *u, const unsigned char *v,
+		unsigned char *dest, int width, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
 {
-	int i, j;
+	int j;
 
-	const unsigned char *ysrc = src;
+	j = v4lconvert_simd_yuv420_to_rgb24_row(y, u, v, dest, width, bgr, m);
+	dest += j * 3;
+	for (; j < width; j += 2)
+		dest = yuv_store_pixels(dest, m, y + j, 1, width - j,
+					u[j / 2], v[j / 2], bgr);
+}
+
+static void yuv420_to_rgbbgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	int i;
 	const unsigned char *usrc, *vsrc;
 
 	if (yvu) {
@@ -167,101 +221,78 @@ void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
 	}
 
 	for (i = 0; i < height; i++) {
-		for (j = 0; j < width; j += 2) {
-#if 1 /* fast slightly less accurate multiplication free code */
-			int u1 = (((*usrc - 128) << 7) +  (*usrc - 128)) >> 6;
-			int rg = (((*usrc - 128) << 1) +  (*usrc - 128) +
-					((*vsrc - 128) << 2) + ((*vsrc - 128) << 1)) >> 3;
-			int v1 = (((*vsrc - 128) << 1) +  (*vsrc - 128)) >> 1;
-
-			*dest++ = CLIP(*ysrc + v1);
-			*dest++ = CLIP(*ysrc - rg);
-			*dest++ = CLIP(*ysrc + u1);
-			ysrc++;
-
-			*dest++ = CLIP(*ysrc + v1);
-			*dest++ = CLIP(*ysrc - rg);
-			*dest++ = CLIP(*ysrc + u1);
-#else
-			*dest++ = YUV2R(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2G(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2B(*ysrc, *usrc, *vsrc);
-			ysrc++;
-
-			*dest++ = YUV2R(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2G(*ysrc, *usrc, *vsrc);
-			*dest++ = YUV2B(*ysrc, *usrc, *vsrc);
-#endif
-			ysrc++;
-			usrc++;
-			vsrc++;
-		}
-		ysrc += stride - width;
-		/* Rewind u and v for next line */
-		if (!(i & 1)) {
-			usrc -= width / 2;
-			vsrc -= width / 2;
-		} else {
-			usrc += (stride - width) / 2;
-			vsrc += (stride - width) / 2;
-		}
+		v4lconvert_yuv420_to_rgbbgr24_row(src + i * stride,
+				usrc + (i / 2) * (stride / 2),
+				vsrc + (i / 2) * (stride / 2), dest, width, bgr, m);
+		dest += width * 3;
 	}
 }
 
-void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+void v4lconvert_yuv420_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu,
+		const struct v4lconvert_yuv_matrix *m)
 {
-	int j;
+	yuv420_to_rgbbgr24(src, dest, width, height, stride, yvu, 1, m);
+}
 
-	while (--height >= 0) {
-		for (j = 0; j + 1 < width; j += 2) {
-			int u = src[1];
-			int v = src[3];
-			int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
-			int rg = (((u - 128) << 1) +  (u - 128) +
-					((v - 128) << 2) + ((v - 128) << 1)) >> 3;
-			int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
-
-			*dest++ = CLIP(src[0] + u1);
-			*dest++ = CLIP(src[0] - rg);
-			*dest++ = CLIP(src[0] + v1);
-
-			*dest++ = CLIP(src[2] + u1);
-			*dest++ = CLIP(src[2] - rg);
-			*dest++ = CLIP(src[2] + v1);
-			src += 4;
-		}
-		src += stride - width * 2;
-	}
+void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	yuv420_to_rgbbgr24(src, dest, width, height, stride, yvu, 0, m);
 }
 
-void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+/* Packed 4:2:2, layout is one of V4LCONVERT_YUV422_* */
+void v4lconvert_yuv422_to_rgbbgr24_row(const unsigned char *src,
+		unsigned char *dest, int width, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
 {
+	int yo = layout == V4LCONVERT_YUV422_UYVY ? 1 : 0;
+	int uo = layout == V4LCONVERT_YUV422_YUYV ? 1 :
+		 layout == V4LCONVERT_YUV422_YVYU ? 3 : 0;
+	int vo = layout == V4LCONVERT_YUV422_YUYV ? 3 :
+		 layout == V4LCONVERT_YUV422_YVYU ? 1 : 2;
 	int j;
 
+	j = v4lconvert_simd_yuv422_to_rgb24_row(src, dest, width, layout,
+						bgr, m);
+	src += j * 2;
+	dest += j * 3;
+	for (; j + 1 < width; j += 2) {
+		dest = yuv_store_pixels(dest, m, src + yo, 2, 2,
+					src[uo], src[vo], bgr);
+		src += 4;
+	}
+}
+
+static void yuv422_to_rgbbgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int layout, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
 	while (--height >= 0) {
-		for (j = 0; j + 1 < width; j += 2) {
-			int u = src[1];
-			int v = src[3];
-			int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
-			int rg = (((u - 128) << 1) +  (u - 128) +
-					((v - 128) << 2) + ((v - 128) << 1)) >> 3;
-			int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
-
-			*dest++ = CLIP(src[0] + v1);
-			*dest++ = CLIP(src[0] - rg);
-			*dest++ = CLIP(src[0] + u1);
-
-			*dest++ = CLIP(src[2] + v1);
-			*dest++ = CLIP(src[2] - rg);
-			*dest++ = CLIP(src[2] + u1);
-			src += 4;
-		}
-		src += stride - (width * 2);
+		v4lconvert_yuv422_to_rgbbgr24_row(src, dest, width, layout,
+						  bgr, m);
+		src += stride;
+		dest += (width & ~1) * 3;
 	}
 }
 
+void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	yuv422_to_rgbbgr24(src, dest, width, height, stride,
+			   V4LCONVERT_YUV422_YUYV, 1, m);
+}
+
+void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	yuv422_to_rgbbgr24(src, dest, width, height, stride,
+			   V4LCONVERT_YUV422_YUYV, 0, m);
+}
+
 void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride, int yvu)
 {
@@ -272,7 +303,11 @@ void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 	/* copy the Y values */
 	src1 = src;
 	for (i = 0; i < height; i++) {
-		for (j = 0; j + 1 < width; j += 2) {
+		j = v4lconvert_simd_yuv422_to_y_row(src1, dest, width,
+				V4LCONVERT_YUV422_YUYV);
+		src1 += j * 2;
+		dest += j;
+		for (; j + 1 < width; j += 2) {
 			*dest++ = src1[0];
 			*dest++ = src1[2];
 			src1 += 4;
@@ -291,7 +326,14 @@ void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 		vdest = dest + width * height / 4;
 	}
 	for (i = 0; i < height; i += 2) {
-		for (j = 0; j + 1 < width; j += 2) {
+		/* src and src1 point to U, the SIMD code wants the pixel start */
+		j = v4lconvert_simd_yuv422_to_uv_row(src - 1, src1 - 1,
+				udest, vdest, width, V4LCONVERT_YUV422_YUYV);
+		src += j * 2;
+		src1 += j * 2;
+		udest += j / 2;
+		vdest += j / 2;
+		for (; j + 1 < width; j += 2) {
 			*udest++ = ((int) src[0] + src1[0]) / 2;	/* U */
 			*vdest++ = ((int) src[2] + src1[2]) / 2;	/* V */
 			src += 4;
@@ -303,131 +345,36 @@ void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
-{
-	const unsigned char *y, *cbcr;
-	int i, j;
-
-	y = src;
-	cbcr = src + stride * height;
-
-	for (i = 0; i < height; i++) {
-		for (j = 0; j < width; j++) {
-			*dest++ = *y++;
-			*dest++ = *cbcr++;
-		}
-		y += stride - width;
-		cbcr += stride - width;
-	}
-}
-
 void v4lconvert_yvyu_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m)
 {
-	int j;
-
-	while (--height >= 0) {
-		for (j = 0; j + 1 < width; j += 2) {
-			int u = src[3];
-			int v = src[1];
-			int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
-			int rg = (((u - 128) << 1) +  (u - 128) +
-					((v - 128) << 2) + ((v - 128) << 1)) >> 3;
-			int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
-
-			*dest++ = CLIP(src[0] + u1);
-			*dest++ = CLIP(src[0] - rg);
-			*dest++ = CLIP(src[0] + v1);
-
-			*dest++ = CLIP(src[2] + u1);
-			*dest++ = CLIP(src[2] - rg);
-			*dest++ = CLIP(src[2] + v1);
-			src += 4;
-		}
-		src += stride - (width * 2);
-	}
+	yuv422_to_rgbbgr24(src, dest, width, height, stride,
+			   V4LCONVERT_YUV422_YVYU, 1, m);
 }
 
 void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m)
 {
-	int j;
-
-	while (--height >= 0) {
-		for (j = 0; j + 1 < width; j += 2) {
-			int u = src[3];
-			int v = src[1];
-			int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
-			int rg = (((u - 128) << 1) +  (u - 128) +
-					((v - 128) << 2) + ((v - 128) << 1)) >> 3;
-			int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
-
-			*dest++ = CLIP(src[0] + v1);
-			*dest++ = CLIP(src[0] - rg);
-			*dest++ = CLIP(src[0] + u1);
-
-			*dest++ = CLIP(src[2] + v1);
-			*dest++ = CLIP(src[2] - rg);
-			*dest++ = CLIP(src[2] + u1);
-			src += 4;
-		}
-		src += stride - (width * 2);
-	}
+	yuv422_to_rgbbgr24(src, dest, width, height, stride,
+			   V4LCONVERT_YUV422_YVYU, 0, m);
 }
 
 void v4lconvert_uyvy_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m)
 {
-	int j;
-
-	while (--height >= 0) {
-		for (j = 0; j + 1 < width; j += 2) {
-			int u = src[0];
-			int v = src[2];
-			int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
-			int rg = (((u - 128) << 1) +  (u - 128) +
-					((v - 128) << 2) + ((v - 128) << 1)) >> 3;
-			int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
-
-			*dest++ = CLIP(src[1] + u1);
-			*dest++ = CLIP(src[1] - rg);
-			*dest++ = CLIP(src[1] + v1);
-
-			*dest++ = CLIP(src[3] + u1);
-			*dest++ = CLIP(src[3] - rg);
-			*dest++ = CLIP(src[3] + v1);
-			src += 4;
-		}
-		src += stride - width * 2;
-	}
+	yuv422_to_rgbbgr24(src, dest, width, height, stride,
+			   V4LCONVERT_YUV422_UYVY, 1, m);
 }
 
 void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+		int width, int height, int stride,
+		const struct v4lconvert_yuv_matrix *m)
 {
-	int j;
-
-	while (--height >= 0) {
-		for (j = 0; j + 1 < width; j += 2) {
-			int u = src[0];
-			int v = src[2];
-			int u1 = (((u - 128) << 7) +  (u - 128)) >> 6;
-			int rg = (((u - 128) << 1) +  (u - 128) +
-					((v - 128) << 2) + ((v - 128) << 1)) >> 3;
-			int v1 = (((v - 128) << 1) +  (v - 128)) >> 1;
-
-			*dest++ = CLIP(src[1] + v1);
-			*dest++ = CLIP(src[1] - rg);
-			*dest++ = CLIP(src[1] + u1);
-
-			*dest++ = CLIP(src[3] + v1);
-			*dest++ = CLIP(src[3] - rg);
-			*dest++ = CLIP(src[3] + u1);
-			src += 4;
-		}
-		src += stride - width * 2;
-	}
+	yuv422_to_rgbbgr24(src, dest, width, height, stride,
+			   V4LCONVERT_YUV422_UYVY, 0, m);
 }
 
 void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
@@ -440,7 +387,11 @@ void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
 	/* copy the Y values */
 	src1 = src;
 	for (i = 0; i < height; i++) {
-		for (j = 0; j + 1 < width; j += 2) {
+		j = v4lconvert_simd_yuv422_to_y_row(src1, dest, width,
+				V4LCONVERT_YUV422_UYVY);
+		src1 += j * 2;
+		dest += j;
+		for (; j + 1 < width; j += 2) {
 			*dest++ = src1[1];
 			*dest++ = src1[3];
 			src1 += 4;
@@ -458,7 +409,13 @@ void v4lconvert_uyvy_to_yuv420(const unsigned char *src, unsigned char *dest,
 		vdest = dest + width * height / 4;
 	}
 	for (i = 0; i < height; i += 2) {
-		for (j = 0; j + 1 < width; j += 2) {
+		j = v4lconvert_simd_yuv422_to_uv_row(src, src1, udest, vdest,
+				width, V4LCONVERT_YUV422_UYVY);
+		src += j * 2;
+		src1 += j * 2;
+		udest += j / 2;
+		vdest += j / 2;
+		for (; j + 1 < width; j += 2) {
 			*udest++ = ((int) src[0] + src1[0]) / 2;	/* U */
 			*vdest++ = ((int) src[2] + src1[2]) / 2;	/* V */
 			src += 4;
@@ -514,105 +471,92 @@ void v4lconvert_swap_uv(const unsigned char *src, unsigned char *dest,
 	}
 }
 
-void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride)
+/* Original format: rrrrrggg gggbbbbb */
+#define RGB565_R(p) (0xf8 & ((p) >> 8))
+#define RGB565_G(p) (0xfc & ((p) >> 3))
+#define RGB565_B(p) (0xf8 & ((p) << 3))
+
+static void rgb565_to_rgbbgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr)
 {
 	int j;
-	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			unsigned short tmp = *(unsigned short *)src;
 
-			/* Original format: rrrrrggg gggbbbbb */
-			*dest++ = 0xf8 & (tmp >> 8);
-			*dest++ = 0xfc & (tmp >> 3);
-			*dest++ = 0xf8 & (tmp << 3);
-
-			src += 2;
+	while (--height >= 0) {
+		j = v4lconvert_simd_rgb565_to_rgb24_row(src, dest, width, bgr);
+		dest += 3 * j;
+		for (; j < width; j++) {
+			unsigned short tmp = ((const unsigned short *)src)[j];
+
+			*dest++ = bgr ? RGB565_B(tmp) : RGB565_R(tmp);
+			*dest++ = RGB565_G(tmp);
+			*dest++ = bgr ? RGB565_R(tmp) : RGB565_B(tmp);
 		}
-		src += stride - 2 * width;
+		src += stride;
 	}
 }
 
-void v4lconvert_rgb565_to_bgr24(const unsigned char *src, unsigned char *dest,
+void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride)
 {
-	int j;
-	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			unsigned short tmp = *(unsigned short *)src;
-
-			/* Original format: rrrrrggg gggbbbbb */
-			*dest++ = 0xf8 & (tmp << 3);
-			*dest++ = 0xfc & (tmp >> 3);
-			*dest++ = 0xf8 & (tmp >> 8);
+	rgb565_to_rgbbgr24(src, dest, width, height, stride, 0);
+}
 
-			src += 2;
-		}
-		src += stride - 2 * width;
-	}
+void v4lconvert_rgb565_to_bgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	rgb565_to_rgbbgr24(src, dest, width, height, stride, 1);
 }
 
 void v4lconvert_rgb565_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int yvu)
 {
-	int x, y;
+	int width = src_fmt->fmt.pix.width;
+	int height = src_fmt->fmt.pix.height;
+	int stride = src_fmt->fmt.pix.bytesperline;
+	int x, y, i;
 	unsigned short tmp;
 	unsigned char *udest, *vdest;
-	unsigned r[4], g[4], b[4];
-	int avg_src[3];
+	unsigned r, g, b;
 
 	/* Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
-		for (x = 0; x < src_fmt->fmt.pix.width; x++) {
-			tmp = *(unsigned short *)src;
-			r[0] = 0xf8 & (tmp << 3);
-			g[0] = 0xfc & (tmp >> 3);
-			b[0] = 0xf8 & (tmp >> 8);
-			RGB2Y(r[0], g[0], b[0], *dest++);
-			src += 2;
-		}
-		src += src_fmt->fmt.pix.bytesperline - 2 * src_fmt->fmt.pix.width;
+	for (y = 0; y < height; y++) {
+		const unsigned short *s = (const unsigned short *)(src + y * stride);
+
+		x = v4lconvert_simd_rgb565_to_y_row(src + y * stride, dest, width);
+		for (; x < width; x++)
+			RGB2Y(RGB565_R(s[x]), RGB565_G(s[x]), RGB565_B(s[x]),
+			      dest[x]);
+		dest += width;
 	}
-	src -= src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline;
 
 	/* U + V */
 	if (yvu) {
 		vdest = dest;
-		udest = dest + src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 4;
+		udest = dest + width * height / 4;
 	} else {
 		udest = dest;
-		vdest = dest + src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 4;
+		vdest = dest + width * height / 4;
 	}
 
-	for (y = 0; y < src_fmt->fmt.pix.height / 2; y++) {
-		for (x = 0; x < src_fmt->fmt.pix.width / 2; x++) {
-			tmp = *(unsigned short *)src;
-			r[0] = 0xf8 & (tmp << 3);
-			g[0] = 0xfc & (tmp >> 3);
-			b[0] = 0xf8 & (tmp >> 8);
-
-			tmp = *(((unsigned short *)src) + 1);
-			r[1] = 0xf8 & (tmp << 3);
-			g[1] = 0xfc & (tmp >> 3);
-			b[1] = 0xf8 & (tmp >> 8);
-
-			tmp = *(((unsigned short *)src) + src_fmt->fmt.pix.bytesperline);
-			r[2] = 0xf8 & (tmp << 3);
-			g[2] = 0xfc & (tmp >> 3);
-			b[2] = 0xf8 & (tmp >> 8);
-
-			tmp = *(((unsigned short *)src) + src_fmt->fmt.pix.bytesperline + 1);
-			r[3] = 0xf8 & (tmp << 3);
-			g[3] = 0xfc & (tmp >> 3);
-			b[3] = 0xf8 & (tmp >> 8);
-
-			avg_src[0] = (r[0] + r[1] + r[2] + r[3]) / 4;
-			avg_src[1] = (g[0] + g[1] + g[2] + g[3]) / 4;
-			avg_src[2] = (b[0] + b[1] + b[2] + b[3]) / 4;
-			RGB2UV(avg_src[0], avg_src[1], avg_src[2], *udest++, *vdest++);
-			src += 4;
+	for (y = 0; y < height / 2; y++) {
+		const unsigned char *src0 = src + 2 * y * stride;
+		const unsigned char *src1 = src0 + stride;
+
+		x = v4lconvert_simd_rgb565_to_uv_row(src0, src1, udest, vdest,
+						     width);
+		for (; x + 1 < width; x += 2) {
+			r = g = b = 0;
+			for (i = 0; i < 4; i++) {
+				tmp = ((const unsigned short *)
+				       (i < 2 ? src0 : src1))[x + i % 2];
+				r += RGB565_R(tmp);
+				g += RGB565_G(tmp);
+				b += RGB565_B(tmp);
+			}
+			RGB2UV(r / 4, g / 4, b / 4, udest[x / 2], vdest[x / 2]);
 		}
-		src += 2 * src_fmt->fmt.pix.bytesperline - 2 * src_fmt->fmt.pix.width;
+		udest += width / 2;
+		vdest += width / 2;
 	}
 }
 
@@ -621,168 +565,186 @@ void v4lconvert_y16_to_rgb24(const unsigned char *src, unsigned char *dest,
 {
 	int j;
 
-	if (little_endian)
-		src++;
-
 	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			*dest++ = *src;
-			*dest++ = *src;
-			*dest++ = *src;
-			src+=2;
+		j = v4lconvert_simd_y16_to_rgb24_row(src, dest, width,
+						     little_endian);
+		dest += 3 * j;
+		for (; j < width; j++) {
+			unsigned char g = src[2 * j + !!little_endian];
+
+			*dest++ = g;
+			*dest++ = g;
+			*dest++ = g;
 		}
+		src += 2 * width;
 	}
 }
 
 void v4lconvert_y16_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int little_endian)
 {
+	int width = src_fmt->fmt.pix.width;
+	int height = src_fmt->fmt.pix.height;
 	int x, y;
 
-	if (little_endian)
-		src++;
-
 	/* Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++)
-		for (x = 0; x < src_fmt->fmt.pix.width; x++){
-			*dest++ = *src;
-			src+=2;
-		}
+	for (y = 0; y < height; y++) {
+		x = v4lconvert_simd_y16_to_8_row(src, dest, width,
+						 little_endian);
+		for (; x < width; x++)
+			dest[x] = src[2 * x + !!little_endian];
+		src += 2 * width;
+		dest += width;
+	}
 
 	/* Clear U/V */
-	memset(dest, 0x80, src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 2);
+	memset(dest, 0x80, width * height / 2);
 }
 
 void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride)
 {
 	int j;
+
 	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			*dest++ = *src;
-			*dest++ = *src;
-			*dest++ = *src;
-			src++;
+		j = v4lconvert_simd_grey_to_rgb24_row(src, dest, width);
+		dest += 3 * j;
+		for (; j < width; j++) {
+			*dest++ = src[j];
+			*dest++ = src[j];
+			*dest++ = src[j];
 		}
-		src += stride - width;
+		src += stride;
 	}
 }
 
 void v4lconvert_grey_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt)
 {
-	int x, y;
+	int y;
 
 	/* Y */
-	for (y = 0; y < src_fmt->fmt.pix.height; y++)
-		for (x = 0; x < src_fmt->fmt.pix.width; x++)
-			*dest++ = *src++;
+	for (y = 0; y < src_fmt->fmt.pix.height; y++) {
+		memcpy(dest, src, src_fmt->fmt.pix.width);
+		src += src_fmt->fmt.pix.bytesperline;
+		dest += src_fmt->fmt.pix.width;
+	}
 
 	/* Clear U/V */
 	memset(dest, 0x80, src_fmt->fmt.pix.width * src_fmt->fmt.pix.height / 2);
 }
 
-/* Unpack buffer of (vw bit) data into padded 16bit buffer. */
-static inline void convert_packed_to_16bit(const uint8_t *raw, uint16_t *unpacked,
-					   int vw, int unpacked_len)
+/* Pixels of Y10BPACK data v4lconvert_y10b_to_rgb24 unpacks at a time */
+#define Y10B_BLOCK_PIXELS 4096
+
+/* Unpack n pixels of Y10BPACK data, a big endian stream of 10 bit samples,
+   to their 8 msb. src must be at a multiple of 4 pixels. */
+static void y10b_to_grey(const unsigned char *src, unsigned char *dest, int n)
 {
-	int mask = (1 << vw) - 1;
 	uint32_t buffer = 0;
-	int bitsIn = 0;
-	while (unpacked_len--) {
-		while (bitsIn < vw) {
-			buffer = (buffer << 8) | *(raw++);
-			bitsIn += 8;
+	int bits_in = 0;
+	int i;
+
+	i = v4lconvert_simd_y10b_to_8_row(src, dest, n);
+	src += i / 4 * 5;
+	for (; i < n; i++) {
+		while (bits_in < 10) {
+			buffer = (buffer << 8) | *src++;
+			bits_in += 8;
 		}
-		bitsIn -= vw;
-		*(unpacked++) = (buffer >> bitsIn) & mask;
+		bits_in -= 10;
+		dest[i] = buffer >> (bits_in + 2);
 	}
 }
 
-int v4lconvert_y10b_to_rgb24(struct v4lconvert_data *data,
-	const unsigned char *src, unsigned char *dest, int width, int height)
+/* Expand the n grey pixels at the end of the 3 * n bytes at dest to rgb24.
+   Going forward this never overwrites a grey pixel before it is read. */
+static void grey_tail_to_rgb24(unsigned char *dest, int n)
 {
-	unsigned char *unpacked_buffer;
+	const unsigned char *grey = dest + 2 * n;
+	int i;
 
-	unpacked_buffer = v4lconvert_alloc_buffer(width * height * 2,
-					&data->convert_pixfmt_buf,
-					&data->convert_pixfmt_buf_size);
-	if (!unpacked_buffer)
-		return v4lconvert_oom_error(data);
+	for (i = 0; i < n; i++) {
+		unsigned char g = grey[i];
 
-	convert_packed_to_16bit((uint8_t *)src, (uint16_t *)unpacked_buffer,
-				10, width * height);
+		*dest++ = g;
+		*dest++ = g;
+		*dest++ = g;
+	}
+}
 
-	int j;
-	unsigned short *tmp = (unsigned short *)unpacked_buffer;
-	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
+/* The frame gets unpacked in blocks which stay in the cache, straight into
+   the destination, so without an intermediate frame sized buffer */
+void v4lconvert_y10b_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height)
+{
+	int left = width * height;
 
-			/* Only 10 useful bits, so we discard the LSBs */
-			*dest++ = (*tmp & 0x3ff) >> 2;
-			*dest++ = (*tmp & 0x3ff) >> 2;
-			*dest++ = (*tmp & 0x3ff) >> 2;
+	while (left > 0) {
+		int n = left < Y10B_BLOCK_PIXELS ? left : Y10B_BLOCK_PIXELS;
 
-			/* +1 means two bytes as we are dealing with (unsigned short) */
-			tmp += 1;
-		}
+		y10b_to_grey(src, dest + 2 * n, n);
+		grey_tail_to_rgb24(dest, n);
+		src += n / 4 * 5;
+		dest += 3 * n;
+		left -= n;
 	}
-	return 0;
 }
 
-int v4lconvert_y10b_to_yuv420(struct v4lconvert_data *data,
-	const unsigned char *src, unsigned char *dest, int width, int height)
+void v4lconvert_y10b_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height)
 {
-	unsigned char *unpacked_buffer;
+	/* Y */
+	y10b_to_grey(src, dest, width * height);
 
-	unpacked_buffer = v4lconvert_alloc_buffer(width * height * 2,
-					&data->convert_pixfmt_buf,
-					&data->convert_pixfmt_buf_size);
-	if (!unpacked_buffer)
-		return v4lconvert_oom_error(data);
+	/* Clear U/V */
+	memset(dest + width * height, 0x80, width * height / 2);
+}
 
-	convert_packed_to_16bit((uint8_t *)src, (uint16_t *)unpacked_buffer,
-				10, width * height);
+/* Y10P is 10 bit packed like the 10 bit packed bayer formats */
+void v4lconvert_y10p_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	while (--height >= 0) {
+		v4lconvert_raw10_line_to_8bit(src, dest + 2 * width, width);
+		grey_tail_to_rgb24(dest, width);
+		src += stride;
+		dest += 3 * width;
+	}
+}
 
-	int x, y;
-	unsigned short *tmp = (unsigned short *)unpacked_buffer;
+void v4lconvert_y10p_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	int y;
 
 	/* Y */
-	for (y = 0; y < height; y++)
-		for (x = 0; x < width; x++) {
-
-			/* Only 10 useful bits, so we discard the LSBs */
-			*dest++ = (*tmp & 0x3ff) >> 2;
-
-			/* +1 means two bytes as we are dealing with (unsigned short) */
-			tmp += 1;
-		}
+	for (y = 0; y < height; y++) {
+		v4lconvert_raw10_line_to_8bit(src, dest, width);
+		src += stride;
+		dest += width;
+	}
 
 	/* Clear U/V */
 	memset(dest, 0x80, width * height / 2);
-
-	return 0;
 }
 
 void v4lconvert_rgb32_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height,int bgr)
+		int width, int height, int bgr)
 {
 	int j;
+
 	while (--height >= 0) {
-		for (j = 0; j < width; j++) {
-			if (bgr){
-				*dest++ = src[2];
-				*dest++ = src[1];
-				*dest++ = src[0];
-				src+=4;
-			}
-			else{
-				*dest++ = *src++;
-				*dest++ = *src++;
-				*dest++ = *src++;
-				src+=1;
-			}
+		j = v4lconvert_simd_rgb32_to_rgb24_row(src, dest, width, bgr);
+		dest += 3 * j;
+		for (; j < width; j++) {
+			const unsigned char *p = src + 4 * j;
+
+			*dest++ = p[bgr ? 2 : 0];
+			*dest++ = p[1];
+			*dest++ = p[bgr ? 0 : 2];
 		}
+		src += 4 * width;
 	}
 }
 
@@ -847,80 +809,130 @@ void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 	int bppIN = Xin / 8;
 	unsigned char rgb[3];
 
-	src += bppIN - 3;
-
-	while (--height >= 0)
-		for (j = 0; j < width; j++) {
-			hsvtorgb(src, rgb, hsv_enc);
+	while (--height >= 0) {
+		j = v4lconvert_simd_hsv_to_rgb24_row(src, dest, width, bppIN,
+						     bgr, hsv_enc);
+		dest += 3 * j;
+		for (; j < width; j++) {
+			hsvtorgb(src + j * bppIN + bppIN - 3, rgb, hsv_enc);
 			for (k = 0; k < 3; k++)
-				if (bgr && k < 3)
+				if (bgr)
 					*dest++ = rgb[2-k];
 				else
 					*dest++ = rgb[k];
-			src += bppIN;
 		}
+		src += width * bppIN;
+	}
 }
 
-void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int bgr)
+/* Semi planar formats, the chroma lines have the same stride as the luma
+   lines and are interleaved U first (NV12 / NV16) or V first (NV21 / NV61).
+   4:2:0 has one chroma line per 2 luma lines, 4:2:2 one per luma line. */
+void v4lconvert_nv_to_rgbbgr24_row(const unsigned char *ysrc,
+		const unsigned char *uv, unsigned char *dest, int width,
+		int vu, int bgr, const struct v4lconvert_yuv_matrix *m)
 {
-	int i, j;
+	int j;
+
+	j = v4lconvert_simd_nv_to_rgb24_row(ysrc, uv, dest, width, vu, bgr, m);
+	dest += j * 3;
+	for (; j < width; j += 2)
+		dest = yuv_store_pixels(dest, m, ysrc + j, 1, width - j,
+					uv[j + vu], uv[j + !vu], bgr);
+}
+
+static void nv_to_rgbbgr24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int chroma422, int vu,
+		int bgr, const struct v4lconvert_yuv_matrix *m)
+{
+	int i;
 	const unsigned char *ysrc = src;
 	const unsigned char *uvsrc = src + stride * height;
 
 	for (i = 0; i < height; i++) {
-		for (j = 0; j < width; j ++) {
-			if (bgr) {
-				*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2G(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2R(*ysrc, *uvsrc, *(uvsrc + 1));
-			} else {
-				*dest++ = YUV2R(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2G(*ysrc, *uvsrc, *(uvsrc + 1));
-				*dest++ = YUV2B(*ysrc, *uvsrc, *(uvsrc + 1));
-			}
-			ysrc++;
-			if (j&1)
-				uvsrc += 2;
-		}
+		const unsigned char *uv = uvsrc + (chroma422 ? i : i / 2) * stride;
 
-		ysrc += stride - width;
-		/* Rewind u and v for next line */
-		if (!(i&1))
-			uvsrc -= width;
-		else
-			uvsrc += stride - width;
+		v4lconvert_nv_to_rgbbgr24_row(ysrc, uv, dest, width, vu, bgr, m);
+		dest += width * 3;
+		ysrc += stride;
 	}
 }
 
-void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
-		int width, int height, int stride, int yvu)
+static void nv_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int chroma422, int yvu)
 {
 	int i, j;
 	const unsigned char *ysrc = src;
 	const unsigned char *uvsrc = src + stride * height;
-	unsigned char *ydst = dest;
 	unsigned char *udst, *vdst;
 
+	for (i = 0; i < height; i++) {
+		memcpy(dest, ysrc, width);
+		dest += width;
+		ysrc += stride;
+	}
+
 	if (yvu) {
-		vdst = ydst + width * height;
+		vdst = dest;
 		udst = vdst + ((width / 2) * (height / 2));
 	} else {
-		udst = ydst + width * height;
+		udst = dest;
 		vdst = udst + ((width / 2) * (height / 2));
 	}
 
-	for (i = 0; i < height; i++) {
-		for (j = 0; j < width; j++) {
-			*ydst++ = *ysrc++;
-			if (((i % 2) == 0) && ((j % 2) == 0)) {
-				*udst++ = *uvsrc++;
-				*vdst++ = *uvsrc++;
-			}
-		}
+	for (i = 0; i < height / 2; i++) {
+		/* For 4:2:2 average the chroma of the 2 lines */
+		const unsigned char *uv0 = uvsrc + (chroma422 ? 2 * i : i) * stride;
+		const unsigned char *uv1 = chroma422 ? uv0 + stride : uv0;
 
-		ysrc += stride - width;
-		if ((i % 2) == 0)
-			uvsrc += stride - width;
+		j = v4lconvert_simd_nv_to_uv_row(uv0, uv1, udst, vdst, width);
+		for (; j + 1 < width; j += 2) {
+			udst[j / 2] = ((int) uv0[j] + uv1[j]) / 2;
+			vdst[j / 2] = ((int) uv0[j + 1] + uv1[j + 1]) / 2;
+		}
+		udst += width / 2;
+		vdst += width / 2;
 	}
 }
+
+void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	nv_to_rgbbgr24(src, dest, width, height, stride, 0, 0, bgr, m);
+}
+
+void v4lconvert_nv21_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	nv_to_rgbbgr24(src, dest, width, height, stride, 0, 1, bgr, m);
+}
+
+void v4lconvert_nv16_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	nv_to_rgbbgr24(src, dest, width, height, stride, 1, 0, bgr, m);
+}
+
+void v4lconvert_nv61_to_rgb24(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int bgr,
+		const struct v4lconvert_yuv_matrix *m)
+{
+	nv_to_rgbbgr24(src, dest, width, height, stride, 1, 1, bgr, m);
+}
+
+/* Note NV21 is NV12 with U and V swapped, so use this with yvu reversed */
+void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	nv_to_yuv420(src, dest, width, height, stride, 0, yvu);
+}
+
+/* Note NV61 is NV16 with U and V swapped, so use this with yvu reversed */
+void v4lconvert_nv16_to_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	nv_to_yuv420(src, dest, width, height, stride, 1, yvu);
+}
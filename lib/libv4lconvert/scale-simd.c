@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * SIMD kernels for the vertical pass of the scaler in scale.c
+ *
+ * Each output is the sum of taps source lines weighted by 14 bit weights,
+ * scaled down to 4 fractional bits: (sum + 512) >> 10. The weights are
+ * positive and sum to 16384, so neither the 32 bit sums nor the 16 bit
+ * results can overflow and the kernels are bit-exact with the C code.
+ * They return the number of bytes of the line done.
+ */
+
+#include "libv4lconvert-simd-priv.h"
+
+#ifdef V4LCONVERT_SIMD_X86
+
+/* The weights of 2 taps as the pmaddwd multiplier of interleaved pixels */
+static inline int32_t weight_pair(const int16_t *weights, int k, int taps)
+{
+	uint16_t w0 = weights[k];
+	uint16_t w1 = k + 1 < taps ? weights[k + 1] : 0;
+
+	return (int32_t)(w0 | (uint32_t)w1 << 16);
+}
+
+static SSE2 int scale_vert_row_sse2(const unsigned char *const *rows,
+		const int16_t *weights, int taps, uint16_t *dest, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rnd = _mm_set1_epi32(512);
+	int x, k;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i acc0 = rnd, acc1 = rnd, acc2 = rnd, acc3 = rnd;
+
+		for (k = 0; k < taps; k += 2) {
+			__m128i w = _mm_set1_epi32(weight_pair(weights, k, taps));
+			__m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+			__m128i b = k + 1 < taps ?
+				_mm_loadu_si128((const __m128i *)(rows[k + 1] + x)) :
+				zero;
+			__m128i lo = _mm_unpacklo_epi8(a, b);
+			__m128i hi = _mm_unpackhi_epi8(a, b);
+
+			/* a0 b0 a1 b1 ... widened to 16 bit */
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(
+					_mm_unpacklo_epi8(lo, zero), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(
+					_mm_unpackhi_epi8(lo, zero), w));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(
+					_mm_unpacklo_epi8(hi, zero), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(
+					_mm_unpackhi_epi8(hi, zero), w));
+		}
+
+		acc0 = _mm_srli_epi32(acc0, 10);
+		acc1 = _mm_srli_epi32(acc1, 10);
+		acc2 = _mm_srli_epi32(acc2, 10);
+		acc3 = _mm_srli_epi32(acc3, 10);
+		_mm_storeu_si128((__m128i *)(dest + x),
+				 _mm_packs_epi32(acc0, acc1));
+		_mm_storeu_si128((__m128i *)(dest + x + 8),
+				 _mm_packs_epi32(acc2, acc3));
+	}
+
+	return x;
+}
+
+/* The 256 bit unpack and pack instructions work per 128 bit lane, which
+   cancels out, so the results come out in order */
+static AVX2 int scale_vert_row_avx2(const unsigned char *const *rows,
+		const int16_t *weights, int taps, uint16_t *dest, int width)
+{
+	const __m256i rnd = _mm256_set1_epi32(512);
+	int x, k;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m256i acc0 = rnd, acc1 = rnd;
+
+		for (k = 0; k < taps; k += 2) {
+			__m256i w = _mm256_set1_epi32(weight_pair(weights, k, taps));
+			__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i *)(rows[k] + x)));
+			__m256i b = k + 1 < taps ?
+				_mm256_cvtepu8_epi16(_mm_loadu_si128(
+					(const __m128i *)(rows[k + 1] + x))) :
+				_mm256_setzero_si256();
+
+			acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(
+					_mm256_unpacklo_epi16(a, b), w));
+			acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(
+					_mm256_unpackhi_epi16(a, b), w));
+		}
+
+		_mm256_storeu_si256((__m256i *)(dest + x),
+				_mm256_packs_epi32(_mm256_srli_epi32(acc0, 10),
+						   _mm256_srli_epi32(acc1, 10)));
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_X86 */
+
+#ifdef V4LCONVERT_SIMD_NEON
+
+static int scale_vert_row_neon(const unsigned char *const *rows,
+		const int16_t *weights, int taps, uint16_t *dest, int width)
+{
+	int x, k;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint32x4_t acc0 = vdupq_n_u32(0), acc1 = vdupq_n_u32(0);
+		uint32x4_t acc2 = vdupq_n_u32(0), acc3 = vdupq_n_u32(0);
+
+		for (k = 0; k < taps; k++) {
+			uint8x16_t s = vld1q_u8(rows[k] + x);
+			uint16x8_t lo = vmovl_u8(vget_low_u8(s));
+			uint16x8_t hi = vmovl_u8(vget_high_u8(s));
+			uint16_t w = weights[k];
+
+			acc0 = vmlal_n_u16(acc0, vget_low_u16(lo), w);
+			acc1 = vmlal_n_u16(acc1, vget_high_u16(lo), w);
+			acc2 = vmlal_n_u16(acc2, vget_low_u16(hi), w);
+			acc3 = vmlal_n_u16(acc3, vget_high_u16(hi), w);
+		}
+
+		vst1q_u16(dest + x, vcombine_u16(vmovn_u32(vrshrq_n_u32(acc0, 10)),
+						 vmovn_u32(vrshrq_n_u32(acc1, 10))));
+		vst1q_u16(dest + x + 8, vcombine_u16(vmovn_u32(vrshrq_n_u32(acc2, 10)),
+						     vmovn_u32(vrshrq_n_u32(acc3, 10))));
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_SIMD_NEON */
+
+int v4lconvert_simd_scale_vert_row(const unsigned char *const *rows,
+		const int16_t *weights, int taps, uint16_t *dest, int width)
+{
+#if defined(V4LCONVERT_SIMD_X86) || defined(V4LCONVERT_SIMD_NEON)
+	unsigned int flags = v4lconvert_get_cpu_flags();
+#endif
+
+#ifdef V4LCONVERT_SIMD_X86
+	if (flags & V4LCONVERT_CPU_AVX2)
+		return scale_vert_row_avx2(rows, weights, taps, dest, width);
+	if (flags & V4LCONVERT_CPU_SSE2)
+		return scale_vert_row_sse2(rows, weights, taps, dest, width);
+#endif
+#ifdef V4LCONVERT_SIMD_NEON
+	if (flags & V4LCONVERT_CPU_NEON)
+		return scale_vert_row_neon(rows, weights, taps, dest, width);
+#endif
+	return 0;
+}
@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * RGB and YUV scaling routines
+ *
+ * The scaler is separable: every destination line is first computed at the
+ * source width as a weighted sum of source lines (the vertical pass, which
+ * does most of the work and has SIMD kernels in scale-simd.c), which is then
+ * scaled horizontally. Downscaling averages the area of the source covered
+ * by each destination pixel, upscaling interpolates bilinearly.
+ *
+ * The weights are 14 bit fixed point and sum to 16384 for every pixel. The
+ * line between the passes keeps 4 extra bits of precision.
+ *
+ * To keep the aspect ratio the source is cropped to the aspect ratio of the
+ * destination first, as v4lconvert_crop() does when cropping.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "libv4lconvert-priv.h"
+
+#define WEIGHT_BITS	14
+#define WEIGHT_ONE	(1 << WEIGHT_BITS)
+#define ROW_BITS	4
+
+/* Per destination pixel the first source pixel and the weights of taps
+   source pixels starting with it */
+struct v4lconvert_scale_axis {
+	int src_size;
+	int dest_size;
+	int taps;
+	int *start;
+	int16_t *weights;
+};
+
+struct v4lconvert_scaler {
+	/* The tables for the (luma / rgb) plane and for the chroma planes */
+	struct v4lconvert_scale_axis x[2], y[2];
+	/* One line of the vertical pass */
+	uint16_t *row;
+	int row_size;
+	const unsigned char **rows;
+	int rows_size;
+};
+
+static void v4lconvert_scale_axis_free(struct v4lconvert_scale_axis *axis)
+{
+	free(axis->start);
+	free(axis->weights);
+	memset(axis, 0, sizeof(*axis));
+}
+
+static int v4lconvert_scale_axis_init(struct v4lconvert_scale_axis *axis,
+		int src_size, int dest_size)
+{
+	int i, j, taps;
+
+	if (axis->start && axis->src_size == src_size &&
+	    axis->dest_size == dest_size)
+		return 0;
+
+	v4lconvert_scale_axis_free(axis);
+
+	if (dest_size < src_size)
+		taps = (src_size + dest_size - 1) / dest_size + 1;
+	else
+		taps = 2;
+	if (taps > src_size)
+		taps = src_size;
+
+	axis->start = malloc(dest_size * sizeof(*axis->start));
+	axis->weights = calloc(dest_size * taps, sizeof(*axis->weights));
+	if (!axis->start || !axis->weights) {
+		v4lconvert_scale_axis_free(axis);
+		return -1;
+	}
+	axis->src_size = src_size;
+	axis->dest_size = dest_size;
+	axis->taps = taps;
+
+	for (i = 0; i < dest_size; i++) {
+		int16_t *w = axis->weights + i * taps;
+		int start;
+
+		if (dest_size < src_size) {
+			/* In units of 1 / dest_size source pixel, destination
+			   pixel i covers [i * src_size, (i + 1) * src_size) */
+			int from = i * src_size, to = from + src_size;
+			int sum = 0, largest = 0;
+
+			start = from / dest_size;
+			if (start > src_size - taps)
+				start = src_size - taps;
+
+			for (j = 0; j < taps; j++) {
+				int lo = (start + j) * dest_size;
+				int hi = lo + dest_size;
+
+				if (lo < from)
+					lo = from;
+				if (hi > to)
+					hi = to;
+				if (hi <= lo)
+					continue;
+
+				w[j] = (hi - lo) * WEIGHT_ONE / src_size;
+				sum += w[j];
+				if (w[j] > w[largest])
+					largest = j;
+			}
+			/* Make the weights sum to exactly 1 */
+			w[largest] += WEIGHT_ONE - sum;
+		} else {
+			/* Bilinear, with the pixel centres aligned. The source
+			   position of pixel i in 16.16 fixed point is
+			   (i + 0.5) * src_size / dest_size - 0.5 */
+			int pos = (int)(((2LL * i + 1) * src_size << 16) /
+					(2 * dest_size)) - (1 << 15);
+			int frac;
+
+			if (pos < 0)
+				pos = 0;
+			start = pos >> 16;
+			frac = pos & 0xffff;
+			if (start > src_size - taps) {
+				start = src_size - taps;
+				frac = taps == 2 ? 0x10000 : 0;
+			}
+
+			if (taps == 2) {
+				w[1] = (frac * WEIGHT_ONE + (1 << 15)) >> 16;
+				w[0] = WEIGHT_ONE - w[1];
+			} else {
+				w[0] = WEIGHT_ONE;
+			}
+		}
+		axis->start[i] = start;
+	}
+
+	return 0;
+}
+
+/* Scale one plane of bpp bytes per pixel with the tables of xaxis and yaxis */
+static void v4lconvert_scale_plane(struct v4lconvert_scaler *scaler,
+		const struct v4lconvert_scale_axis *xaxis,
+		const struct v4lconvert_scale_axis *yaxis,
+		const unsigned char *src, int src_stride,
+		unsigned char *dest, int dest_stride, int bpp)
+{
+	int width = xaxis->src_size * bpp;
+	int x, y, k, c;
+
+	for (y = 0; y < yaxis->dest_size; y++) {
+		const int16_t *w = yaxis->weights + y * yaxis->taps;
+		const unsigned char *src0 = src + yaxis->start[y] * src_stride;
+		unsigned char *d = dest;
+
+		/* Vertical pass */
+		for (k = 0; k < yaxis->taps; k++)
+			scaler->rows[k] = src0 + k * src_stride;
+
+		x = v4lconvert_simd_scale_vert_row(scaler->rows, w,
+						   yaxis->taps, scaler->row,
+						   width);
+		for (; x < width; x++) {
+			int sum = 1 << (WEIGHT_BITS - ROW_BITS - 1);
+
+			for (k = 0; k < yaxis->taps; k++)
+				sum += w[k] * scaler->rows[k][x];
+			scaler->row[x] = sum >> (WEIGHT_BITS - ROW_BITS);
+		}
+
+		/* Horizontal pass */
+		w = xaxis->weights;
+		for (x = 0; x < xaxis->dest_size; x++) {
+			const uint16_t *row = scaler->row + xaxis->start[x] * bpp;
+
+			for (c = 0; c < bpp; c++) {
+				int sum = 1 << (WEIGHT_BITS + ROW_BITS - 1);
+
+				for (k = 0; k < xaxis->taps; k++)
+					sum += w[k] * row[k * bpp + c];
+				*d++ = sum >> (WEIGHT_BITS + ROW_BITS);
+			}
+			w += xaxis->taps;
+		}
+
+		dest += dest_stride;
+	}
+}
+
+void v4lconvert_scaler_destroy(struct v4lconvert_scaler *scaler)
+{
+	int i;
+
+	if (!scaler)
+		return;
+
+	for (i = 0; i < 2; i++) {
+		v4lconvert_scale_axis_free(&scaler->x[i]);
+		v4lconvert_scale_axis_free(&scaler->y[i]);
+	}
+	free(scaler->row);
+	free(scaler->rows);
+	free(scaler);
+}
+
+/* Grow the buffers of the vertical pass to hold a line of width bytes
+   and taps line pointers */
+static int v4lconvert_scaler_reserve(struct v4lconvert_scaler *scaler,
+		int width, int taps)
+{
+	if (width > scaler->row_size) {
+		uint16_t *row = realloc(scaler->row, width * sizeof(*row));
+
+		if (!row)
+			return -1;
+		scaler->row = row;
+		scaler->row_size = width;
+	}
+
+	if (taps > scaler->rows_size) {
+		const unsigned char **rows = realloc(scaler->rows,
+				taps * sizeof(*rows));
+
+		if (!rows)
+			return -1;
+		scaler->rows = rows;
+		scaler->rows_size = taps;
+	}
+
+	return 0;
+}
+
+int v4lconvert_scale(struct v4lconvert_data *data, unsigned char *src,
+		unsigned char *dest, const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt)
+{
+	struct v4lconvert_scaler *scaler = data->scaler;
+	int src_width = src_fmt->fmt.pix.width;
+	int src_height = src_fmt->fmt.pix.height;
+	int dest_width = dest_fmt->fmt.pix.width;
+	int dest_height = dest_fmt->fmt.pix.height;
+	int src_stride = src_fmt->fmt.pix.bytesperline;
+	int dest_stride = dest_fmt->fmt.pix.bytesperline;
+	int width = src_width, height = src_height, startx, starty;
+	int yuv = 0, bpp = 3;
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		yuv = 1;
+		bpp = 1;
+		break;
+	default:
+		return 0;
+	}
+
+	if (dest_width < 2 || dest_height < 2 || src_width < 2 ||
+	    src_height < 2)
+		return 0;
+
+	/* Crop the source to the aspect ratio of the destination, keeping the
+	   offsets and sizes even for the chroma planes */
+	if ((int64_t)src_width * dest_height > (int64_t)dest_width * src_height)
+		width = ((int64_t)src_height * dest_width / dest_height) & ~1;
+	else
+		height = ((int64_t)src_width * dest_height / dest_width) & ~1;
+	if (width < 2)
+		width = 2;
+	if (height < 2)
+		height = 2;
+	startx = ((src_width - width) / 2) & ~1;
+	starty = ((src_height - height) / 2) & ~1;
+
+	if (!scaler) {
+		scaler = calloc(1, sizeof(*scaler));
+		if (!scaler)
+			return v4lconvert_oom_error(data);
+		data->scaler = scaler;
+	}
+
+	if (v4lconvert_scale_axis_init(&scaler->x[0], width, dest_width) ||
+	    v4lconvert_scale_axis_init(&scaler->y[0], height, dest_height) ||
+	    (yuv && (v4lconvert_scale_axis_init(&scaler->x[1], width / 2,
+						dest_width / 2) ||
+		     v4lconvert_scale_axis_init(&scaler->y[1], height / 2,
+						dest_height / 2))) ||
+	    v4lconvert_scaler_reserve(scaler, width * bpp,
+				      scaler->y[0].taps > scaler->y[1].taps ?
+				      scaler->y[0].taps : scaler->y[1].taps))
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_scale_plane(scaler, &scaler->x[0], &scaler->y[0],
+			src + starty * src_stride + startx * bpp, src_stride,
+			dest, dest_stride, bpp);
+	if (!yuv)
+		return 0;
+
+	/* U and V, or V and U, the order does not matter here */
+	src += src_height * src_stride + (starty / 2) * (src_stride / 2) +
+	       startx / 2;
+	dest += dest_height * dest_stride;
+	v4lconvert_scale_plane(scaler, &scaler->x[1], &scaler->y[1],
+			src, src_stride / 2, dest, dest_stride / 2, 1);
+
+	src += (src_height / 2) * (src_stride / 2);
+	dest += (dest_height / 2) * (dest_stride / 2);
+	v4lconvert_scale_plane(scaler, &scaler->x[1], &scaler->y[1],
+			src, src_stride / 2, dest, dest_stride / 2, 1);
+
+	return 0;
+}
@@ -37,77 +37,83 @@
  */
 
 #include "libv4lconvert-priv.h"
+#include "bitstream.h"
 
-/* Four defines for bitstream operations, used in the decode function */
+static pthread_once_t decoder_initialized = PTHREAD_ONCE_INIT;
 
-#define PEEK_BITS(num, to) { \
-	if (bitBufCount < num) { \
-		do { \
-			bitBuf = (bitBuf << 8) | (*(src++)); \
-			bitBufCount += 8; \
-		} while (bitBufCount < 24); \
-	} \
-	to = bitBuf >> (bitBufCount - num); \
-}
+static struct {
+	unsigned char is_abs;
+	unsigned char len;
+	signed char val;
+} table[256];
 
 /*
- * PEEK_BITS puts the next <num> bits into the low bits of <to>.
- * when the buffer is empty, it is completely refilled.
- * This strategy tries to reduce memory access. Note that the high bits
- * are NOT set to zero!
+ * Each entry at index x in the table represents the code present at the
+ * MSB of byte x.
  */
+static void init_sn9c2028_decoder(void)
+{
+	int i;
+	int is_abs, val, len;
 
-#define EAT_BITS(num) { bitBufCount -= num; bits_eaten += num; }
-
-/*
- * EAT_BITS consumes <num> bits (PEEK_BITS does not consume anything,
- * it just peeks)
- */
+	for (i = 0; i < 256; i++) {
+		is_abs = 0;
+		val = 0;
+		len = 0;
+		if ((i & 0x80) == 0) {
+			/* code 0 */
+			val = 0;
+			len = 1;
+		} else if ((i & 0xe0) == 0xa0) {
+			/* code 101 */
+			val = 3;
+			len = 3;
+		} else if ((i & 0xe0) == 0xc0) {
+			/* code 110 */
+			val = -3;
+			len = 3;
+		} else if ((i & 0xf0) == 0x80) {
+			/* code 1000 */
+			val = 8;
+			len = 4;
+		} else if ((i & 0xf0) == 0x90) {
+			/* code 1001 */
+			val = -8;
+			len = 4;
+		} else if ((i & 0xf0) == 0xf0) {
+			/* code 1111 */
+			val = -20;
+			len = 4;
+		} else if ((i & 0xf8) == 0xe0) {
+			/* code 11100 */
+			val = 20;
+			len = 5;
+		} else {
+			/* code 11101xxxxx */
+			is_abs = 1;
+			val = 0;  /* value is the next 5 bits */
+			len = 5;
+		}
+		table[i].is_abs = is_abs;
+		table[i].val = val;
+		table[i].len = len;
+	}
+}
 
-#define PARSE_PIXEL(val) {\
-	PEEK_BITS(10, bits);\
-	if ((bits & 0x200) == 0) {\
-		EAT_BITS(1);\
-	} \
-	else if ((bits & 0x380) == 0x280) {\
-		EAT_BITS(3);\
-		val += 3;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else if ((bits & 0x380) == 0x300) {\
-		EAT_BITS(3);\
-		val -= 3;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3c0) == 0x200) {\
-		EAT_BITS(4);\
-		val += 8;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else if ((bits & 0x3c0) == 0x240) {\
-		EAT_BITS(4);\
-		val -= 8;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3c0) == 0x3c0) {\
-		EAT_BITS(4);\
-		val -= 20;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3e0) == 0x380) {\
-		EAT_BITS(5);\
-		val += 20;\
-		if (val > 255)\
-			val = 255;\
+#define PARSE_PIXEL(cval) {\
+	v4lconvert_bits_need(&bits, 10);\
+	code = v4lconvert_bits_peek(&bits, 8);\
+	v4lconvert_bits_skip(&bits, table[code].len);\
+	if (table[code].is_abs) {\
+		cval = 8 * v4lconvert_bits_peek(&bits, 5);\
+		v4lconvert_bits_skip(&bits, 5);\
 	} \
 	else {\
-		EAT_BITS(10);\
-		val = 8 * (bits & 0x1f);\
+		cval += table[code].val;\
+		if (cval < 0)\
+			cval = 0;\
+		else if (cval > 255)\
+			cval = 255;\
 	} \
 }
 
@@ -121,27 +127,24 @@
 
 /* Now the decode function itself */
 
-void v4lconvert_decode_sn9c2028(const unsigned char *src, unsigned char *dst,
-		int width, int height)
+void v4lconvert_decode_sn9c2028(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height)
 {
+	struct v4lconvert_bits bits;
 	long dst_index = 0;
 	int starting_row = 0;
-	unsigned short bits;
+	unsigned char code;
 	short c1val, c2val;
 	int x, y;
-	unsigned long bitBuf = 0;
-	unsigned long bitBufCount = 0;
-	unsigned long bits_eaten = 0;
+
+	pthread_once(&decoder_initialized, init_sn9c2028_decoder);
 
 	src += 12;    /* Remove the header */
+	v4lconvert_bits_init(&bits, src, src_size > 12 ? src_size - 12 : 0);
 
 	for (y = starting_row; y < height; y++) {
-		PEEK_BITS(8, bits);
-		EAT_BITS(8);
-		c2val = (bits & 0xff);
-		PEEK_BITS(8, bits);
-		EAT_BITS(8);
-		c1val = (bits & 0xff);
+		c2val = v4lconvert_bits_get(&bits, 8);
+		c1val = v4lconvert_bits_get(&bits, 8);
 
 		PUT_PIXEL_PAIR;
 
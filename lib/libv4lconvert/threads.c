@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Worker thread pool for splitting a conversion into bands, which are
+ * converted in parallel.
+ *
+ * The thread calling v4lconvert_pool_run() converts bands too, so a pool
+ * for n threads has n - 1 worker threads.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "libv4lconvert-priv.h"
+
+struct v4lconvert_pool {
+	int threads;
+	int started;
+	pthread_t *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	/* The current job, protected by lock */
+	v4lconvert_band_func func;
+	void *arg;
+	int bands;
+	int next_band;
+	int pending;
+	unsigned int generation;
+	int exit;
+};
+
+/* Called with pool->lock held, returns with it held */
+static void v4lconvert_pool_do_bands(struct v4lconvert_pool *pool)
+{
+	while (pool->next_band < pool->bands) {
+		int band = pool->next_band++;
+
+		pthread_mutex_unlock(&pool->lock);
+		pool->func(pool->arg, band, pool->bands);
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *v4lconvert_pool_worker(void *arg)
+{
+	struct v4lconvert_pool *pool = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->exit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->exit)
+			break;
+		generation = pool->generation;
+		v4lconvert_pool_do_bands(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct v4lconvert_pool *v4lconvert_pool_create(int threads)
+{
+	struct v4lconvert_pool *pool;
+	int i;
+
+	if (threads < 2 || threads > V4LCONVERT_MAX_THREADS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->workers = calloc(threads - 1, sizeof(pthread_t));
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->threads = threads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool->workers[i], NULL,
+				   v4lconvert_pool_worker, pool))
+			break;
+		pool->started++;
+	}
+
+	if (pool->started != threads - 1) {
+		v4lconvert_pool_destroy(pool);
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	return pool;
+}
+
+void v4lconvert_pool_destroy(struct v4lconvert_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->exit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->started; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+int v4lconvert_pool_threads(struct v4lconvert_pool *pool)
+{
+	return pool ? pool->threads : 1;
+}
+
+void v4lconvert_pool_run(struct v4lconvert_pool *pool,
+		v4lconvert_band_func func, void *arg, int bands)
+{
+	int i;
+
+	if (!pool || bands < 2) {
+		for (i = 0; i < bands; i++)
+			func(arg, i, bands);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->bands = bands;
+	pool->next_band = 0;
+	pool->pending = bands;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	v4lconvert_pool_do_bands(pool);
+	while (pool->pending)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
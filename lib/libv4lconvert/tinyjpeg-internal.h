@@ -60,12 +60,16 @@ struct huffman_table {
 	 * IMPROVEME: Calculate if 256 value is enough to store all values
 	 */
 	uint16_t slowtable[16 - HUFFMAN_HASH_NBITS][256];
+	/* Joint look up table for a symbol and the coefficient after it, using
+	 * HUFFMAN_HASH_NBITS bits: coefficient << 16 | run << 8 | total bits,
+	 * or 0 if the lookup table (and get_nbits) must be used */
+	int32_t fast[HUFFMAN_HASH_SIZE];
 };
 
 struct component {
 	unsigned int Hfactor;
 	unsigned int Vfactor;
-	float *Q_table;		/* Pointer to the quantisation table to use */
+	int16_t *Q_table;	/* Pointer to the quantisation table to use */
 	struct huffman_table *AC_table;
 	struct huffman_table *DC_table;
 	short int previous_DC;	/* Previous DC coefficient */
@@ -90,10 +94,11 @@ struct jdec_private {
 	const unsigned char *stream;	/* Pointer to the current stream */
 	unsigned char *stream_filtered;
 	int stream_filtered_bufsize;
-	unsigned int reservoir, nbits_in_reservoir;
+	uint64_t reservoir;
+	unsigned int nbits_in_reservoir;
 
 	struct component component_infos[COMPONENTS];
-	float Q_tables[COMPONENTS][64];		/* quantization tables */
+	int16_t Q_tables[COMPONENTS][64];	/* quantization tables */
 	struct huffman_table HTDC[HUFFMAN_TABLES];	/* DC huffman tables   */
 	struct huffman_table HTAC[HUFFMAN_TABLES];	/* AC huffman tables   */
 	int default_huffman_table_initialized;
@@ -118,10 +123,14 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* Planar YUV of one row of MCUs, for 2x1 and 2x2 JPG -> RGB decoding */
+	uint8_t *mcu_row_buf;
+	int mcu_row_buf_size;
 };
 
-#define IDCT tinyjpeg_idct_float
-void tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride);
+#define IDCT tinyjpeg_idct_islow
+void tinyjpeg_idct_islow(struct component *compptr, uint8_t *output_buf, int stride);
 
 #endif
 
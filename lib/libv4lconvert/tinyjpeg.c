@@ -236,71 +236,110 @@ const unsigned char standard_quantization[][64] = { {
  *
  *  fill_nbits: put at least nbits in the reservoir of bits.
  *              But convert any 0xff,0x00 into 0xff
- *  get_nbits: read nbits from the stream, and put it in result,
- *             bits is removed from the stream and the reservoir is filled
- *             automaticaly. The result is signed according to the number of
- *             bits.
+ *  get_nbits: read nbits from the stream, and return it, bits is removed
+ *             from the stream and the reservoir is filled automaticaly.
+ *             The result is signed according to the number of bits.
  *  look_nbits: read nbits from the stream without marking as read.
  *  skip_nbits: read nbits from the stream but do not return the result.
  *
- * stream: current pointer in the jpeg data (read bytes per bytes)
+ * stream: current pointer in the jpeg data
  * nbits_in_reservoir: number of bits filled into the reservoir
- * reservoir: register that contains bits information. Only nbits_in_reservoir
- *            is valid.
- *                          nbits_in_reservoir
- *                        <--    17 bits    -->
- *            Ex: 0000 0000 1010 0000 1111 0000   <== reservoir
- *                        ^
- *                        bit 1
- *            To get two bits from this example
- *                 result = (reservoir >> 15) & 3
+ * reservoir: 64 bits register that contains the next nbits_in_reservoir bits
+ *            of the stream, starting at its most significant bit.
+ *            To get two bits from it
+ *                 result = reservoir >> 62
  *
+ * The reservoir is refilled with 8 bytes at once if none of them is 0xff,
+ * otherwise byte per byte. Filling stops at a marker, from there on the
+ * reservoir gets filled with zero bits, so the stream pointer never goes
+ * beyond the marker which ends the scan or restart interval. At the end of
+ * the data there is nothing to fill it with, and asking for more bits than
+ * are left is an error.
  */
-#define fill_nbits(reservoir, nbits_in_reservoir, stream, nbits_wanted) do { \
-	while (nbits_in_reservoir < nbits_wanted) { \
-		unsigned char c; \
-		if (stream >= priv->stream_end) { \
-			snprintf(priv->error_string, sizeof(priv->error_string), \
-					"fill_nbits error: need %u more bits\n", \
-					nbits_wanted - nbits_in_reservoir); \
-			longjmp(priv->jump_state, -EIO); \
-		} \
-		c = *stream++; \
-		reservoir <<= 8; \
-		if (c == 0xff && *stream == 0x00) \
-			stream++; \
-		reservoir |= c; \
-		nbits_in_reservoir += 8; \
-	} \
-}  while (0);
+static void refill_reservoir(struct jdec_private *priv, unsigned int nbits_wanted)
+{
+	const unsigned char *stream = priv->stream;
+	uint64_t reservoir = priv->reservoir;
+	unsigned int nbits = priv->nbits_in_reservoir;
+
+	if (priv->stream_end - stream >= 8) {
+		uint64_t v;
+
+		memcpy(&v, stream, sizeof(v));
+		/* No 0xff byte in v */
+		if (!((~v - 0x0101010101010101ULL) & v & 0x8080808080808080ULL)) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			v = __builtin_bswap64(v);
+#endif
+			/* The bits below nbits_in_reservoir which were loaded
+			   by the previous refill get loaded with the same value */
+			priv->reservoir = reservoir | (v >> nbits);
+			priv->stream = stream + ((63 - nbits) >> 3);
+			priv->nbits_in_reservoir = nbits | 56;
+			return;
+		}
+	}
+
+	while (nbits <= 56) {
+		unsigned char c;
+
+		if (stream >= priv->stream_end) {
+			if (nbits >= nbits_wanted)
+				break;
+			snprintf(priv->error_string, sizeof(priv->error_string),
+					"fill_nbits error: need %u more bits\n",
+					nbits_wanted - nbits);
+			longjmp(priv->jump_state, -EIO);
+		}
+		c = *stream;
+		if (c == 0xff) {
+			if (stream + 1 < priv->stream_end && stream[1] == 0x00)
+				stream += 2;
+			else
+				c = 0; /* A marker, stay in front of it */
+		} else {
+			stream++;
+		}
+		reservoir |= (uint64_t)c << (56 - nbits);
+		nbits += 8;
+	}
+
+	priv->stream = stream;
+	priv->reservoir = reservoir;
+	priv->nbits_in_reservoir = nbits;
+}
+
+/* nbits_wanted must be <= 57 */
+static inline void fill_nbits(struct jdec_private *priv, unsigned int nbits_wanted)
+{
+	if (priv->nbits_in_reservoir < nbits_wanted)
+		refill_reservoir(priv, nbits_wanted);
+}
+
+/* nbits_wanted must be 1 - 32 */
+static inline unsigned int look_nbits(struct jdec_private *priv, unsigned int nbits_wanted)
+{
+	fill_nbits(priv, nbits_wanted);
+	return priv->reservoir >> (64 - nbits_wanted);
+}
+
+/* To speed up the decoding, we assume that the reservoir have enough bits */
+static inline void skip_nbits(struct jdec_private *priv, unsigned int nbits_wanted)
+{
+	priv->reservoir <<= nbits_wanted;
+	priv->nbits_in_reservoir -= nbits_wanted;
+}
 
 /* Signed version !!!! */
-#define get_nbits(reservoir, nbits_in_reservoir, stream, nbits_wanted, result) do { \
-	fill_nbits(reservoir, nbits_in_reservoir, stream, (nbits_wanted)); \
-	result = ((reservoir) >> (nbits_in_reservoir - (nbits_wanted))); \
-	nbits_in_reservoir -= (nbits_wanted);  \
-	reservoir &= ((1U << nbits_in_reservoir) - 1); \
-	if ((unsigned int)result < (1UL << ((nbits_wanted) - 1))) \
-		result += (0xFFFFFFFFUL << (nbits_wanted)) + 1; \
-}  while (0);
-
-#define look_nbits(reservoir, nbits_in_reservoir, stream, nbits_wanted, result) do { \
-	fill_nbits(reservoir, nbits_in_reservoir, stream, (nbits_wanted)); \
-	result = ((reservoir) >> (nbits_in_reservoir - (nbits_wanted))); \
-}  while (0);
-
-/* To speed up the decoding, we assume that the reservoir have enough bit
- * slow version:
- * #define skip_nbits(reservoir, nbits_in_reservoir, stream, nbits_wanted) do { \
- *   fill_nbits(reservoir, nbits_in_reservoir, stream, (nbits_wanted)); \
- *   nbits_in_reservoir -= (nbits_wanted); \
- *   reservoir &= ((1U << nbits_in_reservoir) - 1); \
- * }  while(0);
- */
-#define skip_nbits(reservoir, nbits_in_reservoir, stream, nbits_wanted) do { \
-	nbits_in_reservoir -= (nbits_wanted); \
-	reservoir &= ((1U << nbits_in_reservoir) - 1); \
-}  while (0);
+static inline int get_nbits(struct jdec_private *priv, unsigned int nbits_wanted)
+{
+	int result = look_nbits(priv, nbits_wanted);
+
+	skip_nbits(priv, nbits_wanted);
+	if (result < (1 << (nbits_wanted - 1)))
+		result += 1 - (1 << nbits_wanted);
+	return result;
+}
 
 #define be16_to_cpu(x) (((x)[0] << 8) | (x)[1])
 
@@ -323,12 +362,12 @@ static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table
 	unsigned int extra_nbits, nbits;
 	uint16_t *slowtable;
 
-	look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
+	hcode = look_nbits(priv, HUFFMAN_HASH_NBITS);
 	value = huffman_table->lookup[hcode];
 	if (value >= 0) {
 		unsigned int code_size = huffman_table->code_size[value];
 
-		skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, code_size);
+		skip_nbits(priv, code_size);
 		return value;
 	}
 
@@ -336,12 +375,12 @@ static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table
 	for (extra_nbits = 0; extra_nbits < 16 - HUFFMAN_HASH_NBITS; extra_nbits++) {
 		nbits = HUFFMAN_HASH_NBITS + 1 + extra_nbits;
 
-		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits, hcode);
+		hcode = look_nbits(priv, nbits);
 		slowtable = huffman_table->slowtable[extra_nbits];
 		/* Search if the code is in this array */
 		while (slowtable[0]) {
 			if (slowtable[0] == hcode) {
-				skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
+				skip_nbits(priv, nbits);
 				return slowtable[1];
 			}
 			slowtable += 2;
@@ -364,6 +403,7 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	unsigned char j;
 	unsigned int huff_code;
 	unsigned char size_val, count_0;
+	int32_t fast;
 
 	struct component *c = &priv->component_infos[component];
 	short int DCT[64];
@@ -372,19 +412,40 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	memset(DCT, 0, sizeof(DCT));
 
 	/* DC coefficient decoding */
-	huff_code = get_next_huffman_code(priv, c->DC_table);
-	if (huff_code) {
-		get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, huff_code, DCT[0]);
-		DCT[0] += c->previous_DC;
+	fast = c->DC_table->fast[look_nbits(priv, HUFFMAN_HASH_NBITS)];
+	if (fast) {
+		skip_nbits(priv, fast & 0xff);
+		DCT[0] = (fast >> 16) + c->previous_DC;
 		c->previous_DC = DCT[0];
 	} else {
-		DCT[0] = c->previous_DC;
+		huff_code = get_next_huffman_code(priv, c->DC_table);
+		if (huff_code > 16) {
+			snprintf(priv->error_string, sizeof(priv->error_string),
+					"error: DC coefficient of %u bits\n", huff_code);
+			longjmp(priv->jump_state, -EIO);
+		}
+		if (huff_code) {
+			DCT[0] = get_nbits(priv, huff_code) + c->previous_DC;
+			c->previous_DC = DCT[0];
+		} else {
+			DCT[0] = c->previous_DC;
+		}
 	}
 
 
 	/* AC coefficient decoding */
 	j = 1;
 	while (j < 64) {
+		/* Most codes and the coefficients following them are short
+		   enough to be decoded together with a single lookup */
+		fast = c->AC_table->fast[look_nbits(priv, HUFFMAN_HASH_NBITS)];
+		if (fast && j + ((fast >> 8) & 0xf) < 64) {
+			skip_nbits(priv, fast & 0xff);
+			j += (fast >> 8) & 0xf;
+			DCT[j++] = fast >> 16;
+			continue;
+		}
+
 		huff_code = get_next_huffman_code(priv, c->AC_table);
 
 		size_val = huff_code & 0xF;
@@ -398,8 +459,7 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 		} else {
 			j += count_0;	/* skip count_0 zeroes */
 			if (j < 64) {
-				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[j]);
-				j++;
+				DCT[j++] = get_nbits(priv, size_val);
 			}
 		}
 	}
@@ -420,6 +480,7 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
  * lookup will return the symbol if the code is less or equal than HUFFMAN_HASH_NBITS.
  * code_size will be used to known how many bits this symbol is encoded.
  * slowtable will be used when the first lookup didn't give the result.
+ * fast gives the symbol and the coefficient which follows it at once.
  */
 static int build_huffman_table(struct jdec_private *priv, const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
 {
@@ -499,6 +560,30 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
 		table->slowtable[i][slowtable_used[i]] = 0;
 
+	/*
+	 * Build the joint lookup table for the symbols with a coefficient,
+	 * for when the code and the coefficient bits together fit in
+	 * HUFFMAN_HASH_NBITS bits. For DC tables the run is always 0.
+	 */
+	for (i = 0; i < HUFFMAN_HASH_SIZE; i++) {
+		int coef;
+
+		table->fast[i] = 0;
+		if (table->lookup[i] < 0)
+			continue;
+		val = table->lookup[i];
+		code_size = table->code_size[val];
+		nbits = val & 0xf;
+		if (nbits == 0 || code_size + nbits > HUFFMAN_HASH_NBITS)
+			continue;
+
+		coef = (i >> (HUFFMAN_HASH_NBITS - code_size - nbits)) & ((1 << nbits) - 1);
+		if (coef < (1 << (nbits - 1)))
+			coef += 1 - (1 << nbits);
+		table->fast[i] = (int32_t)((uint32_t)coef << 16) |
+				 (val >> 4) << 8 | (code_size + nbits);
+	}
+
 	return 0;
 }
 
@@ -626,6 +711,45 @@ static void YCrCB_to_YUV420P_2x1(struct jdec_private *priv)
 }
 
 
+/**
+ *  YCrCb -> YUV422P (2x1)
+ *  .-------.
+ *  | 1 | 2 |
+ *  `-------'
+ *  Unlike YCrCB_to_YUV420P_2x1 this keeps all chroma lines, it is used to
+ *  store a row of MCUs for the RGB conversion done by tinyjpeg_decode().
+ */
+static void YCrCB_to_YUV422P_2x1(struct jdec_private *priv)
+{
+	unsigned char *p;
+	const unsigned char *s, *y1;
+	unsigned int i;
+
+	p = priv->plane[0];
+	y1 = priv->Y;
+	for (i = 0; i < 8; i++) {
+		memcpy(p, y1, 16);
+		p += priv->width;
+		y1 += 16;
+	}
+
+	p = priv->plane[1];
+	s = priv->Cb;
+	for (i = 0; i < 8; i++) {
+		memcpy(p, s, 8);
+		s += 8;
+		p += priv->width / 2;
+	}
+
+	p = priv->plane[2];
+	s = priv->Cr;
+	for (i = 0; i < 8; i++) {
+		memcpy(p, s, 8);
+		s += 8;
+		p += priv->width / 2;
+	}
+}
+
 /**
  *  YCrCb -> YUV420P (1x2)
  *  .---.
@@ -810,126 +934,6 @@ static void YCrCB_to_BGR24_1x1(struct jdec_private *priv)
 }
 
 
-/**
- *  YCrCb -> RGB24 (2x1)
- *  .-------.
- *  | 1 | 2 |
- *  `-------'
- */
-static void YCrCB_to_RGB24_2x1(struct jdec_private *priv)
-{
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = priv->width * 3 - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			y  = (*Y++) << SCALEBITS;
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-
-			y  = (*Y++) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-		}
-
-		p += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
-}
-
-/*
- *  YCrCb -> BGR24 (2x1)
- *  .-------.
- *  | 1 | 2 |
- *  `-------'
- */
-static void YCrCB_to_BGR24_2x1(struct jdec_private *priv)
-{
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = priv->width * 3 - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-		}
-
-		p += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
-}
-
 /**
  *  YCrCb -> RGB24 (1x2)
  *  .---.
@@ -1061,169 +1065,6 @@ static void YCrCB_to_BGR24_1x2(struct jdec_private *priv)
 }
 
 
-/**
- *  YCrCb -> RGB24 (2x2)
- *  .-------.
- *  | 1 | 2 |
- *  |---+---|
- *  | 3 | 4 |
- *  `-------'
- */
-static void YCrCB_to_RGB24_2x2(struct jdec_private *priv)
-{
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p, *p2;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	p2 = priv->plane[0] + priv->width * 3;
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = (priv->width * 3 * 2) - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			y  = (*Y++) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-
-			y  = (*Y++) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-
-			y  = (Y[16-2]) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-
-			y  = (Y[16-1]) << SCALEBITS;
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-		}
-		Y  += 16;
-		p  += offset_to_next_row;
-		p2 += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
-}
-
-
-/*
- *  YCrCb -> BGR24 (2x2)
- *  .-------.
- *  | 1 | 2 |
- *  |---+---|
- *  | 3 | 4 |
- *  `-------'
- */
-static void YCrCB_to_BGR24_2x2(struct jdec_private *priv)
-{
-	const unsigned char *Y, *Cb, *Cr;
-	unsigned char *p, *p2;
-	int i, j;
-	int offset_to_next_row;
-
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	p = priv->plane[0];
-	p2 = priv->plane[0] + priv->width * 3;
-	Y = priv->Y;
-	Cb = priv->Cb;
-	Cr = priv->Cr;
-	offset_to_next_row = (priv->width * 3 * 2) - 16 * 3;
-
-	for (i = 0; i < 8; i++) {
-		for (j = 0; j < 8; j++) {
-			int y, cb, cr;
-			int add_r, add_g, add_b;
-			int r, g , b;
-
-			cb = *Cb++ - 128;
-			cr = *Cr++ - 128;
-			add_r = FIX(1.40200) * cr + ONE_HALF;
-			add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-			add_b = FIX(1.77200) * cb + ONE_HALF;
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-
-			y  = (*Y++) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p++ = clamp(r);
-
-			y  = (Y[16-2]) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-
-			y  = (Y[16-1]) << SCALEBITS;
-			b = (y + add_b) >> SCALEBITS;
-			*p2++ = clamp(b);
-			g = (y + add_g) >> SCALEBITS;
-			*p2++ = clamp(g);
-			r = (y + add_r) >> SCALEBITS;
-			*p2++ = clamp(r);
-		}
-		Y  += 16;
-		p  += offset_to_next_row;
-		p2 += offset_to_next_row;
-	}
-
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
-}
-
-
-
 /**
  *  YCrCb -> Grey (1x1)
  *  .---.
@@ -1380,14 +1221,13 @@ static void decode_MCU_2x1_3planes(struct jdec_private *priv)
 	IDCT(&priv->component_infos[cCr], priv->Cr, 8);
 }
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table);
+static void build_quantization_table(int16_t *qtable, const unsigned char *ref_table);
 
 static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 {
 	unsigned char marker;
 
-	look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream,
-		   8, marker);
+	marker = look_nbits(priv, 8);
 
 	/* Sometimes the pac7302 switches chrominance setting halfway though a
 	   frame, with a quite ugly looking result, so we drop such frames. */
@@ -1480,7 +1320,7 @@ static void pixart_decode_MCU_2x1_3planes(struct jdec_private *priv)
 
 		priv->marker = marker;
 	}
-	skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, 8);
+	skip_nbits(priv, 8);
 
 	// Y
 	process_Huffman_data_unit(priv, cY);
@@ -1657,34 +1497,20 @@ static void print_SOF(const unsigned char *stream)
  *
  ******************************************************************************/
 
-static void build_quantization_table(float *qtable, const unsigned char *ref_table)
+static void build_quantization_table(int16_t *qtable, const unsigned char *ref_table)
 {
-	/* Taken from libjpeg. Copyright Independent JPEG Group's LLM idct.
-	 * For float AA&N IDCT method, divisors are equal to quantization
-	 * coefficients scaled by scalefactor[row]*scalefactor[col], where
-	 *   scalefactor[0] = 1
-	 *   scalefactor[k] = cos(k*PI/16) * sqrt(2)    for k=1..7
-	 * We apply a further scale factor of 8.
-	 * What's actually stored is 1/divisor so that the inner loop can
-	 * use a multiplication rather than a division.
-	 */
-	int i, j;
-	static const double aanscalefactor[8] = {
-		1.0, 1.387039845, 1.306562965, 1.175875602,
-		1.0, 0.785694958, 0.541196100, 0.275899379
-	};
+	/* The table is stored in zigzag order, the IDCT wants natural order */
 	const unsigned char *zz = zigzag;
+	int i;
 
-	for (i = 0; i < 8; i++)
-		for (j = 0; j < 8; j++)
-			*qtable++ = ref_table[*zz++] * aanscalefactor[i] * aanscalefactor[j];
-
+	for (i = 0; i < 64; i++)
+		*qtable++ = ref_table[*zz++];
 }
 
 static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 {
 	int qi;
-	float *table;
+	int16_t *table;
 	const unsigned char *dqt_block_end;
 
 	trace("> DQT marker\n");
@@ -2101,6 +1927,7 @@ void tinyjpeg_free(struct jdec_private *priv)
 	}
 	priv->tmp_buf_y_size = 0;
 	free(priv->stream_filtered);
+	free(priv->mcu_row_buf);
 	free(priv);
 }
 
@@ -2149,18 +1976,20 @@ static const convert_colorspace_fct convert_colorspace_yuv420p[4] = {
 	YCrCB_to_YUV420P_2x2,
 };
 
+/* 2x1 and 2x2 MCUs are stored as planar YUV in a buffer for a whole row of
+   MCUs, which then gets converted to RGB a line at a time */
 static const convert_colorspace_fct convert_colorspace_rgb24[4] = {
 	YCrCB_to_RGB24_1x1,
 	YCrCB_to_RGB24_1x2,
-	YCrCB_to_RGB24_2x1,
-	YCrCB_to_RGB24_2x2,
+	YCrCB_to_YUV422P_2x1,
+	YCrCB_to_YUV420P_2x2,
 };
 
 static const convert_colorspace_fct convert_colorspace_bgr24[4] = {
 	YCrCB_to_BGR24_1x1,
 	YCrCB_to_BGR24_1x2,
-	YCrCB_to_BGR24_2x1,
-	YCrCB_to_BGR24_2x2,
+	YCrCB_to_YUV422P_2x1,
+	YCrCB_to_YUV420P_2x2,
 };
 
 static const convert_colorspace_fct convert_colorspace_grey[4] = {
@@ -2236,8 +2065,42 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
  *
  * Note: components will be automaticaly allocated if no memory is attached.
  */
+/* The JFIF Y'CbCr -> R'G'B' matrix: BT.601 coefficients, full range */
+static const struct v4lconvert_yuv_matrix *jfif_yuv_matrix(
+		struct v4lconvert_yuv_matrix *m)
+{
+	struct v4l2_format fmt = {
+		.fmt.pix.colorspace = V4L2_COLORSPACE_JPEG,
+	};
+
+	m->ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT; /* Force (re)building it */
+	return v4lconvert_update_yuv_matrix(m, &fmt);
+}
+
+/* Convert the row of MCUs in priv->mcu_row_buf (stored by the YUV420P_2x2 or
+   YUV422P_2x1 colorspace conversion function) to RGB24 or BGR24 */
+static void convert_mcu_row(struct jdec_private *priv, uint8_t *dest,
+		unsigned int lines, int bgr, const struct v4lconvert_yuv_matrix *m)
+{
+	const uint8_t *y = priv->mcu_row_buf;
+	const uint8_t *u = y + priv->width * lines;
+	const uint8_t *v = u + priv->width / 2 * 8;
+	unsigned int i, c;
+
+	for (i = 0; i < lines; i++) {
+		/* 8 chroma lines for either 8 or 16 luma lines */
+		c = i * 8 / lines * (priv->width / 2);
+		v4lconvert_yuv420_to_rgbbgr24_row(y, u + c, v + c, dest,
+						  priv->width, bgr, m);
+		y += priv->width;
+		dest += priv->width * 3;
+	}
+}
+
 int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 {
+	struct v4lconvert_yuv_matrix yuv_matrix;
+	const struct v4lconvert_yuv_matrix *yuv = NULL;
 	unsigned int x, y, xstride_by_mcu, ystride_by_mcu;
 	unsigned int bytes_per_blocklines[3], bytes_per_mcu[3];
 	decode_MCU_fct decode_MCU;
@@ -2353,6 +2216,19 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	if (decode_MCU == NULL)
 		error("no decode MCU function for this JPEG format (PIXART?)\n");
 
+	if ((pixfmt == TINYJPEG_FMT_RGB24 || pixfmt == TINYJPEG_FMT_BGR24) &&
+	    xstride_by_mcu == 16) {
+		/* Store the MCUs as planar YUV, see convert_mcu_row() */
+		if (!v4lconvert_alloc_buffer(priv->width * (ystride_by_mcu + 8),
+					     &priv->mcu_row_buf,
+					     &priv->mcu_row_buf_size))
+			error("Out of memory!\n");
+		yuv = jfif_yuv_matrix(&yuv_matrix);
+		bytes_per_mcu[0] = 8;
+		bytes_per_mcu[1] = 4;
+		bytes_per_mcu[2] = 4;
+	}
+
 	resync(priv);
 
 	/* Don't forget to that block can be either 8 or 16 lines */
@@ -2367,9 +2243,15 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
-		priv->plane[0] = priv->components[0] + (y * bytes_per_blocklines[0]);
-		priv->plane[1] = priv->components[1] + (y * bytes_per_blocklines[1]);
-		priv->plane[2] = priv->components[2] + (y * bytes_per_blocklines[2]);
+		if (yuv) {
+			priv->plane[0] = priv->mcu_row_buf;
+			priv->plane[1] = priv->plane[0] + priv->width * ystride_by_mcu;
+			priv->plane[2] = priv->plane[1] + priv->width / 2 * 8;
+		} else {
+			priv->plane[0] = priv->components[0] + (y * bytes_per_blocklines[0]);
+			priv->plane[1] = priv->components[1] + (y * bytes_per_blocklines[1]);
+			priv->plane[2] = priv->components[2] + (y * bytes_per_blocklines[2]);
+		}
 		for (x = 0; x < priv->width; x += xstride_by_mcu) {
 			decode_MCU(priv);
 			convert_to_pixfmt(priv);
@@ -2379,13 +2261,17 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 			if (priv->restarts_to_go > 0) {
 				priv->restarts_to_go--;
 				if (priv->restarts_to_go == 0) {
-					priv->stream -= (priv->nbits_in_reservoir / 8);
 					resync(priv);
 					if (find_next_rst_marker(priv) < 0)
 						return -1;
 				}
 			}
 		}
+		if (yuv)
+			convert_mcu_row(priv, priv->components[0] +
+					y * bytes_per_blocklines[0],
+					ystride_by_mcu,
+					pixfmt == TINYJPEG_FMT_BGR24, yuv);
 	}
 
 	if (priv->flags & TINYJPEG_FLAGS_PIXART_JPEG) {
@@ -2400,7 +2286,8 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 {
 	unsigned int i, x, y;
-	uint8_t *y_buf, *u_buf, *v_buf, *p, *p2;
+	uint8_t *y_buf, *u_buf, *v_buf, *p;
+	struct v4lconvert_yuv_matrix yuv_matrix;
 
 	switch (pixfmt) {
 	case TINYJPEG_FMT_GREY:
@@ -2450,7 +2337,6 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 		y_buf += 7 * priv->width;
 	}
 
-	priv->stream -= (priv->nbits_in_reservoir/8);
 	resync(priv);
 	if (find_next_sos_marker(priv) < 0)
 		return -1;
@@ -2472,7 +2358,6 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 		u_buf += 7 * (priv->width / 2);
 	}
 
-	priv->stream -= (priv->nbits_in_reservoir / 8);
 	resync(priv);
 	if (find_next_sos_marker(priv) < 0)
 		return -1;
@@ -2494,138 +2379,21 @@ int tinyjpeg_decode_planar(struct jdec_private *priv, int pixfmt)
 		v_buf += 7 * (priv->width / 2);
 	}
 
-#define SCALEBITS       10
-#define ONE_HALF        (1UL << (SCALEBITS - 1))
-#define FIX(x)          ((int)((x) * (1UL << SCALEBITS) + 0.5))
-
-	switch (pixfmt) {
-	case TINYJPEG_FMT_RGB24:
-		y_buf = priv->tmp_buf[cY];
-		u_buf = priv->tmp_buf[cCb];
-		v_buf = priv->tmp_buf[cCr];
-		p = priv->components[0];
-		p2 = priv->components[0] + priv->width * 3;
-
-		for (y = 0; y < priv->height / 2; y++) {
-			for (x = 0; x < priv->width / 2; x++) {
-				int l, cb, cr;
-				int add_r, add_g, add_b;
-				int r, g , b;
-
-				cb = *u_buf++ - 128;
-				cr = *v_buf++ - 128;
-				add_r = FIX(1.40200) * cr + ONE_HALF;
-				add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-				add_b = FIX(1.77200) * cb + ONE_HALF;
-
-				l  = (*y_buf) << SCALEBITS;
-				r = (l + add_r) >> SCALEBITS;
-				*p++ = clamp(r);
-				g = (l + add_g) >> SCALEBITS;
-				*p++ = clamp(g);
-				b = (l + add_b) >> SCALEBITS;
-				*p++ = clamp(b);
-
-				l  = (y_buf[priv->width]) << SCALEBITS;
-				r = (l + add_r) >> SCALEBITS;
-				*p2++ = clamp(r);
-				g = (l + add_g) >> SCALEBITS;
-				*p2++ = clamp(g);
-				b = (l + add_b) >> SCALEBITS;
-				*p2++ = clamp(b);
-
-				y_buf++;
-
-				l  = (*y_buf) << SCALEBITS;
-				r = (l + add_r) >> SCALEBITS;
-				*p++ = clamp(r);
-				g = (l + add_g) >> SCALEBITS;
-				*p++ = clamp(g);
-				b = (l + add_b) >> SCALEBITS;
-				*p++ = clamp(b);
-
-				l  = (y_buf[priv->width]) << SCALEBITS;
-				r = (l + add_r) >> SCALEBITS;
-				*p2++ = clamp(r);
-				g = (l + add_g) >> SCALEBITS;
-				*p2++ = clamp(g);
-				b = (l + add_b) >> SCALEBITS;
-				*p2++ = clamp(b);
-
-				y_buf++;
-			}
-			y_buf += priv->width;
-			p  += priv->width * 3;
-			p2 += priv->width * 3;
-		}
-		break;
+	if (pixfmt == TINYJPEG_FMT_RGB24 || pixfmt == TINYJPEG_FMT_BGR24) {
+		const struct v4lconvert_yuv_matrix *yuv =
+			jfif_yuv_matrix(&yuv_matrix);
 
-	case TINYJPEG_FMT_BGR24:
-		y_buf = priv->tmp_buf[cY];
-		u_buf = priv->tmp_buf[cCb];
-		v_buf = priv->tmp_buf[cCr];
 		p = priv->components[0];
-		p2 = priv->components[0] + priv->width * 3;
-
-		for (y = 0; y < priv->height / 2; y++) {
-			for (x = 0; x < priv->width / 2; x++) {
-				int l, cb, cr;
-				int add_r, add_g, add_b;
-				int r, g , b;
-
-				cb = *u_buf++ - 128;
-				cr = *v_buf++ - 128;
-				add_r = FIX(1.40200) * cr + ONE_HALF;
-				add_g = -FIX(0.34414) * cb - FIX(0.71414) * cr + ONE_HALF;
-				add_b = FIX(1.77200) * cb + ONE_HALF;
-
-				l  = (*y_buf) << SCALEBITS;
-				b = (l + add_b) >> SCALEBITS;
-				*p++ = clamp(b);
-				g = (l + add_g) >> SCALEBITS;
-				*p++ = clamp(g);
-				r = (l + add_r) >> SCALEBITS;
-				*p++ = clamp(r);
-
-				l  = (y_buf[priv->width]) << SCALEBITS;
-				b = (l + add_b) >> SCALEBITS;
-				*p2++ = clamp(b);
-				g = (l + add_g) >> SCALEBITS;
-				*p2++ = clamp(g);
-				r = (l + add_r) >> SCALEBITS;
-				*p2++ = clamp(r);
-
-				y_buf++;
-
-				l  = (*y_buf) << SCALEBITS;
-				b = (l + add_b) >> SCALEBITS;
-				*p++ = clamp(b);
-				g = (l + add_g) >> SCALEBITS;
-				*p++ = clamp(g);
-				r = (l + add_r) >> SCALEBITS;
-				*p++ = clamp(r);
-
-				l  = (y_buf[priv->width]) << SCALEBITS;
-				b = (l + add_b) >> SCALEBITS;
-				*p2++ = clamp(b);
-				g = (l + add_g) >> SCALEBITS;
-				*p2++ = clamp(g);
-				r = (l + add_r) >> SCALEBITS;
-				*p2++ = clamp(r);
-
-				y_buf++;
-			}
-			y_buf += priv->width;
-			p  += priv->width * 3;
-			p2 += priv->width * 3;
+		for (y = 0; y < priv->height; y++) {
+			v4lconvert_yuv420_to_rgbbgr24_row(
+				priv->tmp_buf[cY] + y * priv->width,
+				priv->tmp_buf[cCb] + y / 2 * (priv->width / 2),
+				priv->tmp_buf[cCr] + y / 2 * (priv->width / 2),
+				p, priv->width, pixfmt == TINYJPEG_FMT_BGR24, yuv);
+			p += priv->width * 3;
 		}
-		break;
 	}
 
-#undef SCALEBITS
-#undef ONE_HALF
-#undef FIX
-
 	return 0;
 }
 
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * The V4L2 constants v4l2-convert.glsl compares against. GLSL has no
+ * videodev2.h, so users of the shader prepend a #define for each of these:
+ * define V4L2_CONVERT_DEFINE(name) and expand V4L2_CONVERT_DEFINES.
+ */
+
+#ifndef __V4L2_CONVERT_DEFINES_H
+#define __V4L2_CONVERT_DEFINES_H
+
+#define V4L2_CONVERT_DEFINES \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUYV) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YVYU) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_UYVY) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_VYUY) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV422P) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YVU420) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV420) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV12) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV21) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV16) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV61) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV24) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV42) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV16M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV61M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YVU420M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV420M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YVU422M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV422M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YVU444M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV444M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV12M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_NV21M) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV565) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUV32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_AYUV32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XYUV32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_VUYA32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_VUYX32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUVA32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_YUVX32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XRGB32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ARGB32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGBX32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGBA32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGR32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XBGR32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ABGR32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGRX32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGRA32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB24) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGR24) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB565) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB565X) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XRGB444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ARGB444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XBGR444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ABGR444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGBX444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGBA444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGRX444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGRA444) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XRGB555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ARGB555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB555X) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XRGB555X) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ARGB555X) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGBX555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGBA555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_XBGR555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_ABGR555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGRX555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGRA555) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_RGB332) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_BGR666) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SBGGR8) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGBRG8) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGRBG8) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SRGGB8) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SBGGR10) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGBRG10) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGRBG10) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SRGGB10) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SBGGR12) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGBRG12) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGRBG12) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SRGGB12) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SBGGR16) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGBRG16) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SGRBG16) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_SRGGB16) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_HSV24) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_HSV32) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_GREY) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_Y10) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_Y12) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_Y16) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_Y16_BE) \
+	V4L2_CONVERT_DEFINE(V4L2_PIX_FMT_Z16) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_ANY) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_NONE) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_TOP) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_BOTTOM) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_INTERLACED) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_SEQ_TB) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_SEQ_BT) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_ALTERNATE) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_INTERLACED_TB) \
+	V4L2_CONVERT_DEFINE(V4L2_FIELD_INTERLACED_BT) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_DEFAULT) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_SMPTE170M) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_SMPTE240M) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_REC709) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_470_SYSTEM_M) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_470_SYSTEM_BG) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_SRGB) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_OPRGB) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_BT2020) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_RAW) \
+	V4L2_CONVERT_DEFINE(V4L2_COLORSPACE_DCI_P3) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_DEFAULT) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_709) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_SRGB) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_OPRGB) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_SMPTE240M) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_NONE) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_DCI_P3) \
+	V4L2_CONVERT_DEFINE(V4L2_XFER_FUNC_SMPTE2084) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_DEFAULT) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_601) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_709) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_XV601) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_XV709) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_BT2020) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_BT2020_CONST_LUM) \
+	V4L2_CONVERT_DEFINE(V4L2_YCBCR_ENC_SMPTE240M) \
+	V4L2_CONVERT_DEFINE(V4L2_HSV_ENC_180) \
+	V4L2_CONVERT_DEFINE(V4L2_HSV_ENC_256) \
+	V4L2_CONVERT_DEFINE(V4L2_QUANTIZATION_DEFAULT) \
+	V4L2_CONVERT_DEFINE(V4L2_QUANTIZATION_FULL_RANGE) \
+	V4L2_CONVERT_DEFINE(V4L2_QUANTIZATION_LIM_RANGE)
+
+#endif
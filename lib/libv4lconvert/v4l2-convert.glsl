@@ -359,6 +359,10 @@ void main()
 #endif
 #endif // !IS_RGB
 
+// When converting frames instead of displaying them (libv4lconvert) the
+// R'G'B' values are kept as they are.
+#ifndef KEEP_COLORSPACE
+
 // Convert non-linear R'G'B' to linear RGB, taking into account the
 // colorspace.
 #if XFERFUNC == V4L2_XFER_FUNC_SMPTE240M
@@ -429,5 +433,7 @@ void main()
 
 	rgb = vec3(XFER_SRGB(rgb.r), XFER_SRGB(rgb.g), XFER_SRGB(rgb.b));
 
+#endif // !KEEP_COLORSPACE
+
 	fs_FragColor = vec4(rgb, alpha);
 }
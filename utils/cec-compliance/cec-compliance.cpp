@@ -3,12 +3,14 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <algorithm>
 #include <sstream>
 
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "cec-compliance.h"
@@ -86,6 +88,9 @@ enum Option {
 	OptSkipTestVendorSpecificCommands,
 	OptSkipTestStandbyResume,
 
+	OptAdaptiveTimeout,
+	OptFuzzingThroughput,
+	OptParallel,
 	OptVersion,
 	OptLast = 256
 };
@@ -104,6 +109,7 @@ bool exit_on_warn;
 unsigned warnings;
 unsigned reply_threshold = 1000;
 time_t long_timeout = 60;
+bool adaptive_timeout;
 
 static struct option long_options[] = {
 	{"device", required_argument, nullptr, OptSetDevice},
@@ -126,9 +132,12 @@ static struct option long_options[] = {
 	{"show-timestamp", no_argument, nullptr, OptShowTimestamp},
 	{"interactive", no_argument, nullptr, OptInteractive},
 	{"reply-threshold", required_argument, nullptr, OptReplyThreshold},
+	{"adaptive-timeout", no_argument, nullptr, OptAdaptiveTimeout},
+	{"parallel", no_argument, nullptr, OptParallel},
 
 	{"test-adapter", no_argument, nullptr, OptTestAdapter},
 	{"test-fuzzing", no_argument, nullptr, OptTestFuzzing},
+	{"fuzzing-throughput", no_argument, nullptr, OptFuzzingThroughput},
 	{"test-core", no_argument, nullptr, OptTestCore},
 	{"test-audio-rate-control", no_argument, nullptr, OptTestAudioRateControl},
 	{"test-audio-return-channel-control", no_argument, nullptr, OptTestARCControl},
@@ -188,9 +197,14 @@ static void usage()
 	       "                       Warn if replies take longer than this threshold (default 1000ms)\n"
 	       "  -i, --interactive    Interactive mode when doing remote tests\n"
 	       "  -t, --timeout <secs> Set the standby/resume timeout to <secs>. Default is 60s.\n"
+	       "  --adaptive-timeout   Wait for replies at most twice as long as the slowest reply\n"
+	       "                       seen so far from that remote device (min. 500ms)\n"
+	       "  --parallel           Test all remote devices at the same time\n"
 	       "\n"
 	       "  -A, --test-adapter                  Test the CEC adapter API\n"
 	       "  -F, --test-fuzzing                  Test by fuzzing CEC messages\n"
+	       "  --fuzzing-throughput                When fuzzing, keep the transmit queue full instead\n"
+	       "                                      of waiting for each message to finish\n"
 	       "  --test-core                         Test the core functionality\n"
 	       "\n"
 	       "By changing --test to --skip-test in the following options you can skip tests\n"
@@ -620,9 +634,22 @@ static bool wait_for_hpd(struct node *node, bool send_image_view_on)
 bool transmit_timeout(struct node *node, struct cec_msg *msg, unsigned timeout)
 {
 	struct cec_msg original_msg = *msg;
+	struct remote *remote = nullptr;
 	bool retried = false;
 	int res;
 
+	if (!cec_msg_is_broadcast(msg))
+		remote = &node->remote[cec_msg_destination(msg)];
+
+	/*
+	 * Only shorten the default timeout, tests that explicitly ask
+	 * for a longer one wait for something slow to happen.
+	 */
+	if (adaptive_timeout && remote && msg->reply &&
+	    timeout == DEFAULT_REPLY_TIMEOUT && remote->num_replies >= 3)
+		timeout = std::min(timeout,
+				   std::max(2 * remote->max_response_ms, 500U));
+
 	msg->timeout = timeout;
 retry:
 	res = doioctl(node, CEC_TRANSMIT, msg);
@@ -648,6 +675,13 @@ retry:
 	if (res || !(msg->tx_status & CEC_TX_STATUS_OK))
 		return false;
 
+	if (remote && ((msg->rx_status & CEC_RX_STATUS_OK) ||
+		       (msg->rx_status & CEC_RX_STATUS_FEATURE_ABORT))) {
+		remote->num_replies++;
+		remote->max_response_ms = std::max(remote->max_response_ms,
+						   response_time_ms(msg));
+	}
+
 	if (((msg->rx_status & CEC_RX_STATUS_OK) || (msg->rx_status & CEC_RX_STATUS_FEATURE_ABORT))
 	    && response_time_ms(msg) > reply_threshold)
 		warn("Waited %4ums for %s to msg %s.\n",
@@ -887,6 +921,115 @@ static void topology_probe_device(struct node *node, unsigned i, unsigned la)
 	}
 }
 
+static void test_remote_la(struct node *node, const struct cec_log_addrs &laddrs,
+			   unsigned to, unsigned test_tags, bool interactive,
+			   bool show_ts)
+{
+	for (unsigned i = 0; i < node->num_log_addrs; i++) {
+		node->prim_devtype = laddrs.primary_device_type[i];
+		testRemote(node, node->log_addr[i], to, test_tags,
+			   interactive, show_ts);
+	}
+}
+
+struct remote_result {
+	int tests_total;
+	int tests_ok;
+	int app_result;
+	unsigned warnings;
+};
+
+/*
+ * Test each remote device from a child process with its own filehandle,
+ * so the time spent waiting for one device to reply overlaps with the
+ * tests of the others. The CEC framework hands each reply to the
+ * transmit that is waiting for it, so the children don't see each
+ * other's replies. The output of each child is shown in logical address
+ * order once it is done.
+ */
+static void test_remotes_parallel(struct node *node, const struct cec_log_addrs &laddrs,
+				  unsigned remote_la_mask, unsigned test_tags, bool show_ts)
+{
+	pid_t pids[16] = { };
+	FILE *out[16] = { };
+	int result_fds[16];
+
+	fflush(stdout);
+	for (unsigned to = 0; to <= 15; to++) {
+		int fds[2];
+
+		if ((node->adap_la_mask & (1 << to)) ||
+		    !(remote_la_mask & (1 << to)))
+			continue;
+
+		out[to] = tmpfile();
+		if (!out[to] || pipe(fds)) {
+			perror("cec-compliance");
+			std::exit(EXIT_FAILURE);
+		}
+		pids[to] = fork();
+		if (pids[to] < 0) {
+			perror("fork");
+			std::exit(EXIT_FAILURE);
+		}
+		if (pids[to]) {
+			close(fds[1]);
+			result_fds[to] = fds[0];
+			continue;
+		}
+
+		struct remote_result res = { tests_total, tests_ok, 0, warnings };
+
+		close(fds[0]);
+		dup2(fileno(out[to]), STDOUT_FILENO);
+		node->fd = open(node->device, O_RDWR);
+		if (node->fd < 0) {
+			printf("Failed to open %s: %s\n", node->device, strerror(errno));
+			fflush(stdout);
+			std::exit(EXIT_FAILURE);
+		}
+		test_remote_la(node, laddrs, to, test_tags, false, show_ts);
+		fflush(stdout);
+
+		res.tests_total = tests_total - res.tests_total;
+		res.tests_ok = tests_ok - res.tests_ok;
+		res.app_result = app_result;
+		res.warnings = warnings - res.warnings;
+		if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+			std::exit(EXIT_FAILURE);
+		std::exit(EXIT_SUCCESS);
+	}
+
+	for (unsigned to = 0; to <= 15; to++) {
+		struct remote_result res;
+		char buf[4096];
+		size_t len;
+		bool done;
+
+		if (!pids[to])
+			continue;
+
+		done = read(result_fds[to], &res, sizeof(res)) == sizeof(res);
+		close(result_fds[to]);
+		waitpid(pids[to], nullptr, 0);
+
+		rewind(out[to]);
+		while ((len = fread(buf, 1, sizeof(buf), out[to])))
+			fwrite(buf, 1, len, stdout);
+		fclose(out[to]);
+
+		/* The child exited early, e.g. due to --exit-on-fail */
+		if (!done)
+			std::exit(EXIT_FAILURE);
+
+		tests_total += res.tests_total;
+		tests_ok += res.tests_ok;
+		warnings += res.warnings;
+		if (res.app_result)
+			app_result = res.app_result;
+	}
+}
+
 int main(int argc, char **argv)
 {
 	std::string device;
@@ -974,6 +1117,9 @@ int main(int argc, char **argv)
 		case OptTimeout:
 			long_timeout = strtoul(optarg, nullptr, 0);
 			break;
+		case OptAdaptiveTimeout:
+			adaptive_timeout = true;
+			break;
 		case OptColor:
 			if (!strcmp(optarg, "always"))
 				show_colors = true;
@@ -1047,6 +1193,11 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (options[OptParallel] && options[OptInteractive]) {
+		fprintf(stderr, "--parallel cannot be combined with --interactive\n");
+		std::exit(EXIT_FAILURE);
+	}
+
 	if (device.empty() && (driver || adapter)) {
 		device = cec_device_find(driver, adapter);
 		if (device.empty()) {
@@ -1271,14 +1422,19 @@ int main(int argc, char **argv)
 	printf("\n");
 
 	if (options[OptTestFuzzing] && remote_la >= 0)
-		std::exit(testFuzzing(node, laddrs.log_addr[0], remote_la));
+		std::exit(options[OptFuzzingThroughput] ?
+			  testFuzzingThroughput(node, laddrs.log_addr[0], remote_la) :
+			  testFuzzing(node, laddrs.log_addr[0], remote_la));
 
 	unsigned remote_la_mask = node.remote_la_mask;
 
 	if (remote_la >= 0)
 		remote_la_mask = 1 << remote_la;
 
-	if (test_remote) {
+	if (test_remote && options[OptParallel]) {
+		test_remotes_parallel(&node, laddrs, remote_la_mask, test_tags,
+				      options[OptShowTimestamp]);
+	} else if (test_remote) {
 		for (unsigned i = 0; i < node.num_log_addrs; i++) {
 			unsigned from = node.log_addr[i];
 			node.prim_devtype = laddrs.primary_device_type[i];
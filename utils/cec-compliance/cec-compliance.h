@@ -110,6 +110,7 @@ extern bool exit_on_warn;
 extern unsigned warnings;
 extern unsigned reply_threshold;
 extern time_t long_timeout;
+extern bool adaptive_timeout;
 
 struct remote {
 	bool recognized_op[256];
@@ -146,6 +147,8 @@ struct remote {
 	__u8 dig_bcast_sys;
 	bool has_rec_tv;
 	bool has_cdc;
+	unsigned num_replies;
+	unsigned max_response_ms;
 };
 
 struct node {
@@ -386,8 +389,10 @@ static inline unsigned response_time_ms(const struct cec_msg *msg)
 	return 0;
 }
 
+#define DEFAULT_REPLY_TIMEOUT	2000
+
 bool transmit_timeout(struct node *node, struct cec_msg *msg,
-		      unsigned timeout = 2000);
+		      unsigned timeout = DEFAULT_REPLY_TIMEOUT);
 
 static inline bool transmit(struct node *node, struct cec_msg *msg)
 {
@@ -434,6 +439,7 @@ void testAdapter(struct node &node, struct cec_log_addrs &laddrs,
 
 // CEC fuzzing test
 int testFuzzing(struct node &node, unsigned me, unsigned la);
+int testFuzzingThroughput(struct node &node, unsigned me, unsigned la);
 
 // CEC core tests
 int testCore(struct node *node);
@@ -4,12 +4,110 @@
  */
 
 #include <ctime>
+#include <map>
 #include <string>
 
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 
 #include "cec-compliance.h"
 
+/* Health check the remote device after this many fuzzed messages */
+#define FUZZ_CHECK_INTERVAL	100
+
+/*
+ * Maximum number of fuzzed messages transmitted or waiting for a reply.
+ * Messages waiting for a reply don't count against the transmit queue
+ * of the adapter, so without a limit all opcodes would end up in flight.
+ */
+#define FUZZ_MAX_IN_FLIGHT	32
+
+static const char *abort_reason2s(__u8 reason)
+{
+	switch (reason) {
+	case CEC_OP_ABORT_UNRECOGNIZED_OP:
+		return "Unrecognized Op";
+	case CEC_OP_ABORT_UNDETERMINED:
+		return "Undetermined";
+	case CEC_OP_ABORT_INVALID_OP:
+		return "Invalid Op";
+	case CEC_OP_ABORT_NO_SOURCE:
+		return "No Source";
+	case CEC_OP_ABORT_REFUSED:
+		return "Refused";
+	case CEC_OP_ABORT_INCORRECT_MODE:
+		return "Incorrect Mode";
+	default:
+		return nullptr;
+	}
+}
+
+/*
+ * Fill msg with a random message to la. Returns false if the random
+ * message should not be sent.
+ */
+static bool fuzz_msg(struct node &node, unsigned me, unsigned la, cec_msg &msg)
+{
+	unsigned offset = 2;
+
+	cec_msg_init(&msg, me, la);
+	msg.msg[1] = random() & 0xff;
+	if (msg.msg[1] == CEC_MSG_STANDBY)
+		return false;
+	msg.len = (random() & 0xf) + 2;
+	if (msg.msg[1] == CEC_MSG_VENDOR_COMMAND_WITH_ID &&
+	    node.remote[la].vendor_id != CEC_VENDOR_ID_NONE) {
+		msg.len += 3;
+		offset += 3;
+		msg.msg[2] = (node.remote[la].vendor_id & 0xff0000) >> 16;
+		msg.msg[3] = (node.remote[la].vendor_id & 0xff00) >> 8;
+		msg.msg[4] = node.remote[la].vendor_id & 0xff;
+	}
+	if (msg.len > CEC_MAX_MSG_SIZE)
+		return false;
+	for (unsigned int i = offset; i < msg.len; i++)
+		msg.msg[i] = random() & 0xff;
+	msg.reply = CEC_MSG_FEATURE_ABORT;
+	return true;
+}
+
+static void print_fuzz_msg(unsigned cnt, const cec_msg &msg)
+{
+	const char *name = cec_opcode2s(msg.msg[1]);
+
+	printf("Send message %u:", cnt);
+	for (unsigned int i = 0; i < msg.len; i++)
+		printf(" %02x", msg.msg[i]);
+	if (name)
+		printf(" (%s)", name);
+	printf(": ");
+}
+
+static int show_fuzz_result(const cec_msg &msg, __u8 cmd)
+{
+	__u8 abort_msg, reason;
+	const char *s;
+
+	printf("%s", timed_out(&msg) ? "Timed out" : "Feature Abort");
+	if (!cec_msg_status_is_abort(&msg)) {
+		printf("\n");
+		return 0;
+	}
+	cec_ops_feature_abort(&msg, &abort_msg, &reason);
+	s = abort_reason2s(reason);
+	if (s)
+		printf(" (%s)\n", s);
+	else
+		printf(" (0x%02x)\n", reason);
+	if (abort_msg != cmd)
+		return fail("abort_msg != cmd\n");
+	/* An unknown reason is reported, but fuzzing carries on */
+	if (!s)
+		fail("Invalid reason\n");
+	return 0;
+}
+
 int testFuzzing(struct node &node, unsigned me, unsigned la)
 {
 	printf("test fuzzing CEC local LA %d (%s) to remote LA %d (%s):\n\n",
@@ -29,71 +127,16 @@ int testFuzzing(struct node &node, unsigned me, unsigned la)
 	for (;;) {
 		cec_msg msg;
 		__u8 cmd;
-		unsigned offset = 2;
 
-		cec_msg_init(&msg, me, la);
-		msg.msg[1] = cmd = random() & 0xff;
-		if (msg.msg[1] == CEC_MSG_STANDBY)
+		if (!fuzz_msg(node, me, la, msg))
 			continue;
-		msg.len = (random() & 0xf) + 2;
-		if (msg.msg[1] == CEC_MSG_VENDOR_COMMAND_WITH_ID &&
-		    node.remote[la].vendor_id != CEC_VENDOR_ID_NONE) {
-			msg.len += 3;
-			offset += 3;
-			msg.msg[2] = (node.remote[la].vendor_id & 0xff0000) >> 16;
-			msg.msg[3] = (node.remote[la].vendor_id & 0xff00) >> 8;
-			msg.msg[4] = node.remote[la].vendor_id & 0xff;
-		}
-		if (msg.len > CEC_MAX_MSG_SIZE)
-			continue;
-
-		const char *name = cec_opcode2s(msg.msg[1]);
 
-		printf("Send message %u:", cnt);
-		for (unsigned int i = 0; i < offset; i++)
-			printf(" %02x", msg.msg[i]);
-		for (unsigned int i = offset; i < msg.len; i++) {
-			msg.msg[i] = random() & 0xff;
-			printf(" %02x", msg.msg[i]);
-		}
-		if (name)
-			printf(" (%s)", name);
-		printf(": ");
-		msg.reply = CEC_MSG_FEATURE_ABORT;
+		cmd = msg.msg[1];
+		print_fuzz_msg(cnt, msg);
 		fail_on_test(!transmit_timeout(&node, &msg, 1200));
-		printf("%s", timed_out(&msg) ? "Timed out" : "Feature Abort");
-
-		if (cec_msg_status_is_abort(&msg)) {
-			__u8 abort_msg, reason;
+		if (show_fuzz_result(msg, cmd))
+			return FAIL;
 
-			cec_ops_feature_abort(&msg, &abort_msg, &reason);
-			fail_on_test(abort_msg != cmd);
-			switch (reason) {
-			case CEC_OP_ABORT_UNRECOGNIZED_OP:
-				printf(" (Unrecognized Op)");
-				break;
-			case CEC_OP_ABORT_UNDETERMINED:
-				printf(" (Undetermined)");
-				break;
-			case CEC_OP_ABORT_INVALID_OP:
-				printf(" (Invalid Op)");
-				break;
-			case CEC_OP_ABORT_NO_SOURCE:
-				printf(" (No Source)");
-				break;
-			case CEC_OP_ABORT_REFUSED:
-				printf(" (Refused)");
-				break;
-			case CEC_OP_ABORT_INCORRECT_MODE:
-				printf(" (Incorrect Mode)");
-				break;
-			default:
-				printf(" (0x%02x)\n", reason);
-				fail("Invalid reason\n");
-				break;
-			}
-		}
-		printf("\n");
 		if (++cnt % 10)
 			continue;
 		if (la == CEC_LOG_ADDR_BROADCAST)
@@ -105,3 +148,167 @@ int testFuzzing(struct node &node, unsigned me, unsigned la)
 		printf("OK\n");
 	}
 }
+
+/*
+ * Coverage of the fuzzed messages: for each opcode which numbers of
+ * operands were sent, and how the remote device answered.
+ */
+struct fuzz_coverage {
+	__u16 operands[256];
+	__u8 results[256];
+};
+
+#define FUZZ_RESULT_TIMEOUT	(1 << 7)
+
+struct fuzz_tx {
+	unsigned cnt;		/* ~0U for the CEC Version health check */
+	cec_msg msg;		/* the message as it was sent */
+};
+
+static void show_fuzz_coverage(const struct fuzz_coverage &cov, unsigned cnt,
+			       time_t start)
+{
+	unsigned opcodes = 0, pairs = 0, answered = 0;
+	time_t secs = time(nullptr) - start;
+
+	for (unsigned op = 0; op < 256; op++) {
+		if (!cov.operands[op])
+			continue;
+		opcodes++;
+		pairs += __builtin_popcount(cov.operands[op]);
+		if (cov.results[op] & ~FUZZ_RESULT_TIMEOUT)
+			answered++;
+	}
+	printf("Fuzzed %u messages in %llds (%.1f/s): %u opcodes, %u opcode/operand count pairs, %u opcodes answered\n",
+	       cnt, static_cast<long long>(secs), secs ? static_cast<double>(cnt) / secs : 0.0,
+	       opcodes, pairs, answered);
+}
+
+/*
+ * Like testFuzzing(), but the messages are transmitted non-blocking so the
+ * transmit queue of the adapter stays full, and the time spent waiting for
+ * a reply that never comes overlaps with the other messages. The results
+ * are picked up with CEC_RECEIVE and matched to the transmits by their
+ * sequence number. The framework matches a Feature Abort to the transmit
+ * by the aborted opcode, so only one message per opcode is in flight.
+ */
+int testFuzzingThroughput(struct node &node, unsigned me, unsigned la)
+{
+	printf("test fuzzing (throughput) CEC local LA %d (%s) to remote LA %d (%s):\n\n",
+	       me, cec_la2s(me), la, cec_la2s(la));
+
+	if (node.remote[la].in_standby) {
+		announce("The remote device is in standby. It should be powered on when fuzzing. Aborting.");
+		return 0;
+	}
+	if (!node.remote[la].has_power_status) {
+		announce("The device didn't support Give Device Power Status.");
+		announce("Assuming that the device is powered on.");
+	}
+
+	std::map<__u32, fuzz_tx> in_flight;
+	bool busy[256] = { };
+	struct fuzz_coverage cov = { };
+	unsigned cnt = 0, done = 0;
+	bool queue_full = false;
+	bool check_version = false;
+	time_t start = time(nullptr);
+	int fd = node.fd;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	for (;;) {
+		cec_msg msg;
+		int res;
+
+		/* Fill the transmit queue */
+		while (!queue_full && in_flight.size() < FUZZ_MAX_IN_FLIGHT) {
+			if (check_version) {
+				if (busy[CEC_MSG_GET_CEC_VERSION])
+					break;
+				cec_msg_init(&msg, me, la);
+				cec_msg_get_cec_version(&msg, true);
+			} else if (!fuzz_msg(node, me, la, msg) || busy[msg.msg[1]]) {
+				continue;
+			}
+			msg.timeout = 1200;
+			res = doioctl(&node, CEC_TRANSMIT, &msg);
+			if (res == EBUSY) {
+				queue_full = true;
+				break;
+			}
+			if (res == ENODEV) {
+				printf("Device was disconnected.\n");
+				std::exit(EXIT_FAILURE);
+			}
+			fail_on_test(res);
+			busy[msg.msg[1]] = true;
+			if (check_version) {
+				in_flight[msg.sequence] = { ~0U, msg };
+				check_version = false;
+				continue;
+			}
+			in_flight[msg.sequence] = { cnt++, msg };
+			if (la != CEC_LOG_ADDR_BROADCAST &&
+			    !(cnt % FUZZ_CHECK_INTERVAL))
+				check_version = true;
+		}
+
+		struct timeval tv = { 5, 0 };
+		fd_set rd_fds, ex_fds;
+
+		FD_ZERO(&rd_fds);
+		FD_ZERO(&ex_fds);
+		FD_SET(fd, &rd_fds);
+		FD_SET(fd, &ex_fds);
+		res = select(fd + 1, &rd_fds, nullptr, &ex_fds, &tv);
+		if (res < 0)
+			return fail("select failed with error %d\n", errno);
+		fail_on_test(!res && !in_flight.empty());
+
+		if (FD_ISSET(fd, &ex_fds)) {
+			struct cec_event ev;
+
+			while (!doioctl(&node, CEC_DQEVENT, &ev)) {
+				if (ev.event == CEC_EVENT_LOST_MSGS)
+					return fail("Lost %u messages\n", ev.lost_msgs.lost_msgs);
+				if (ev.event == CEC_EVENT_STATE_CHANGE &&
+				    !ev.state_change.log_addr_mask)
+					return fail("The adapter was unconfigured\n");
+			}
+		}
+
+		while (!doioctl(&node, CEC_RECEIVE, &msg)) {
+			/* Not the result of one of our transmits */
+			if (!msg.sequence || !in_flight.count(msg.sequence))
+				continue;
+
+			/* msg now holds the reply, if there was one */
+			struct fuzz_tx tx = in_flight[msg.sequence];
+			__u8 cmd = tx.msg.msg[1];
+
+			in_flight.erase(msg.sequence);
+			busy[cmd] = false;
+			queue_full = false;
+
+			if (tx.cnt == ~0U) {
+				printf("Query CEC Version: ");
+				fail_on_test(!(msg.tx_status & CEC_TX_STATUS_OK));
+				fail_on_test(timed_out_or_abort(&msg));
+				printf("OK\n");
+				continue;
+			}
+			print_fuzz_msg(tx.cnt, tx.msg);
+			fail_on_test(!(msg.tx_status & CEC_TX_STATUS_OK));
+			if (show_fuzz_result(msg, cmd))
+				return FAIL;
+			cov.operands[cmd] |= 1 << (tx.msg.len - 2);
+			if (cec_msg_status_is_abort(&msg))
+				cov.results[cmd] |= 1 << abort_reason(&msg);
+			else
+				cov.results[cmd] |= FUZZ_RESULT_TIMEOUT;
+			if (!(++done % 1000))
+				show_fuzz_coverage(cov, done, start);
+		}
+	}
+}
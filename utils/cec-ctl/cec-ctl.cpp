@@ -16,8 +16,10 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <linux/cec-funcs.h>
@@ -105,7 +107,11 @@ enum Option {
 	OptMonitorPin,
 	OptIgnore,
 	OptStorePin,
+	OptStorePinBinary,
 	OptAnalyzePin,
+	OptStoreMsgs,
+	OptAnalyzeMsgs,
+	OptMsgStats,
 	OptRcTVProfile1,
 	OptRcTVProfile2,
 	OptRcTVProfile3,
@@ -124,6 +130,7 @@ enum Option {
 	OptTestStandbyWakeupCycle,
 	OptStressTestStandbyWakeupCycle,
 	OptStressTestRandomStandbyWakeupCycle,
+	OptStressTestParallelStandbyWakeupCycle,
 	OptVendorCommand = 508,
 	OptVendorCommandWithID,
 	OptVendorRemoteButtonDown,
@@ -175,7 +182,11 @@ static struct option long_options[] = {
 	{ "monitor-time", required_argument, nullptr, OptMonitorTime },
 	{ "ignore", required_argument, nullptr, OptIgnore },
 	{ "store-pin", required_argument, nullptr, OptStorePin },
+	{ "store-pin-binary", required_argument, nullptr, OptStorePinBinary },
 	{ "analyze-pin", required_argument, nullptr, OptAnalyzePin },
+	{ "store-msgs", required_argument, nullptr, OptStoreMsgs },
+	{ "analyze-msgs", required_argument, nullptr, OptAnalyzeMsgs },
+	{ "msg-stats", required_argument, nullptr, OptMsgStats },
 	{ "no-reply", no_argument, nullptr, OptToggleNoReply },
 	{ "non-blocking", no_argument, nullptr, OptNonBlocking },
 	{ "logical-address", no_argument, nullptr, OptLogicalAddress },
@@ -231,6 +242,7 @@ static struct option long_options[] = {
 	{ "test-standby-wakeup-cycle", optional_argument, nullptr, OptTestStandbyWakeupCycle }, \
 	{ "stress-test-standby-wakeup-cycle", required_argument, nullptr, OptStressTestStandbyWakeupCycle }, \
 	{ "stress-test-random-standby-wakeup-cycle", required_argument, nullptr, OptStressTestRandomStandbyWakeupCycle }, \
+	{ "stress-test-parallel-standby-wakeup-cycle", required_argument, nullptr, OptStressTestParallelStandbyWakeupCycle }, \
 
 	{ nullptr, 0, nullptr, 0 }
 };
@@ -263,7 +275,8 @@ static void usage()
 	       "  -L, --logical-addresses  Show all configured logical addresses\n"
 	       "  -C, --clear              Clear all logical addresses\n"
 	       "  -n, --no-reply           Toggle 'don't wait for a reply'\n"
-	       "  -N, --non-blocking       Transmit messages in non-blocking mode\n"
+	       "  -N, --non-blocking       Transmit messages in non-blocking mode. Combined with -S,\n"
+	       "                           query all devices at the same time\n"
 	       "  -t, --to <la>            Send message to the given logical address\n"
 	       "  -f, --from <la>          Send message from the given logical address\n"
 	       "                           By default use the first assigned logical address\n"
@@ -324,8 +337,16 @@ static void usage()
 	       "                           To ignore poll messages use 'poll' as <opcode>.\n"
 	       "  --store-pin <to>         Store the low-level CEC pin changes to the file <to>.\n"
 	       "                           Use - for stdout.\n"
+	       "  --store-pin-binary <to>  As --store-pin, but use a compact binary format.\n"
 	       "  --analyze-pin <from>     Analyze the low-level CEC pin changes from the file <from>.\n"
+	       "                           Both the text and the binary formats are accepted.\n"
 	       "                           Use - for stdin.\n"
+	       "  --store-msgs <to>        Monitor CEC traffic and store the messages and events to the\n"
+	       "                           file <to> in a compact binary format. Use - for stdout.\n"
+	       "  --analyze-msgs <from>    Show the messages and events stored in the file <from>.\n"
+	       "                           The --ignore filters apply. Use - for stdin.\n"
+	       "  --msg-stats <from>       Show per-opcode counts, NACK rates and reply latencies of\n"
+	       "                           the messages stored in the file <from>. Use - for stdin.\n"
 	       "  --test-standby-wakeup-cycle [polls=<n>][,sleep=<secs>][,hpd-may-be-low=<0/1>]\n"
 	       "                           Test standby-wakeup cycle behavior of the display. It polls up to\n"
 	       "                           <n> times (default 15), waiting for a state change. If\n"
@@ -359,6 +380,18 @@ static void usage()
 	       "                           it checks if the display can handle this situation without\n"
 	       "                           locking up. After every 10 cycles it attempts to properly\n"
 	       "                           wake up the display and check if that works. If not, this test fails.\n"
+	       "  --stress-test-parallel-standby-wakeup-cycle cnt=<count>[,polls=<n>][,poll-interval=<ms>][,max-sleep=<maxsecs>]\n"
+	       "                            [,min-sleep=<minsecs>][,seed=<seed>][,hpd-may-be-low=<0/1>]\n"
+	       "                           Standby-Wakeup cycle the displays of several CEC adapters <count> times\n"
+	       "                           at the same time. If <count> is 0, then never stop, use Ctrl-C to stop.\n"
+	       "                           The adapters are given with --device, which can be repeated. If not\n"
+	       "                           given, all the adapters matching --driver and --adapter are used.\n"
+	       "                           The adapters must be configured already, and not as a TV.\n"
+	       "                           It polls up to <n> times (default 30) every <ms> milliseconds\n"
+	       "                           (default 1000), waiting for a state change. The other arguments\n"
+	       "                           are as for --stress-test-standby-wakeup-cycle. A display that fails\n"
+	       "                           drops out, the others continue. When done, the wakeup and standby\n"
+	       "                           latency histograms are shown for each display.\n"
 	       "\n"
 	       CEC_PARSE_USAGE
 	       "\n"
@@ -503,7 +536,8 @@ static void log_event(struct cec_event &ev, bool show, bool pin_logging = false)
 	bool is_initial = ev.flags & CEC_EVENT_FL_INITIAL_STATE;
 	__u16 pa;
 
-	if (ev.event != CEC_EVENT_PIN_CEC_LOW && ev.event != CEC_EVENT_PIN_CEC_HIGH &&
+	if (show &&
+	    ev.event != CEC_EVENT_PIN_CEC_LOW && ev.event != CEC_EVENT_PIN_CEC_HIGH &&
 	    ev.event != CEC_EVENT_PIN_HPD_LOW && ev.event != CEC_EVENT_PIN_HPD_HIGH &&
 	    ev.event != CEC_EVENT_PIN_5V_LOW && ev.event != CEC_EVENT_PIN_5V_HIGH)
 		printf("\n");
@@ -570,7 +604,29 @@ static void log_event(struct cec_event &ev, bool show, bool pin_logging = false)
  */
 static __u32 phys_addrs[16];
 
-static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
+/* The requests sent to each device found by showTopology() */
+enum {
+	TOPO_CEC_VERSION,
+	TOPO_PHYS_ADDR,
+	TOPO_VENDOR_ID,
+	TOPO_OSD_NAME,
+	TOPO_MENU_LANGUAGE,
+	TOPO_POWER_STATUS,
+	TOPO_FEATURES,
+	TOPO_NUM_REQS
+};
+
+static void (* const topology_reqs[TOPO_NUM_REQS])(struct cec_msg *msg, int reply) = {
+	cec_msg_get_cec_version,
+	cec_msg_give_physical_addr,
+	cec_msg_give_device_vendor_id,
+	cec_msg_give_osd_name,
+	cec_msg_get_menu_language,
+	cec_msg_give_device_power_status,
+	cec_msg_give_features,
+};
+
+static void showTopologyDeviceInfo(unsigned i, unsigned la, struct cec_msg *msgs)
 {
 	struct cec_msg msg;
 	char osd_name[15];
@@ -578,15 +634,11 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 	printf("\tSystem Information for device %d (%s) from device %d (%s):\n",
 	       i, cec_la2s(i), la & 0xf, cec_la2s(la));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_get_cec_version(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_CEC_VERSION];
 	printf("\t\tCEC Version                : %s\n",
 	       (!cec_msg_status_is_ok(&msg)) ? cec_status2s(msg).c_str() : cec_version2s(msg.msg[2]));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_physical_addr(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_PHYS_ADDR];
 	printf("\t\tPhysical Address           : ");
 	if (!cec_msg_status_is_ok(&msg)) {
 		printf("%s\n", cec_status2s(msg).c_str());
@@ -599,9 +651,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		phys_addrs[i] = (phys_addr << 8) | i;
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_device_vendor_id(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_VENDOR_ID];
 	printf("\t\tVendor ID                  : ");
 	if (!cec_msg_status_is_ok(&msg)) {
 		printf("%s\n", cec_status2s(msg).c_str());
@@ -615,9 +665,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 			printf("0x%06x, %u\n", vendor_id, vendor_id);
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_osd_name(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_OSD_NAME];
 	cec_ops_set_osd_name(&msg, osd_name);
 	printf("\t\tOSD Name                   : ");
 	if (cec_msg_status_is_ok(&msg))
@@ -625,9 +673,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 	else
 		printf("%s\n", cec_status2s(msg).c_str());
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_get_menu_language(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_MENU_LANGUAGE];
 	if (cec_msg_status_is_ok(&msg)) {
 		char language[4];
 
@@ -636,9 +682,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		printf("\t\tMenu Language              : %s\n", language);
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_device_power_status(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_POWER_STATUS];
 	if (cec_msg_status_is_ok(&msg)) {
 		__u8 pwr;
 
@@ -647,9 +691,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		       power_status2s(pwr));
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_features(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_FEATURES];
 	if (cec_msg_status_is_ok(&msg)) {
 		__u8 vers, all_dev_types;
 		const __u8 *rc, *feat;
@@ -697,9 +739,115 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 				break;
 		}
 	}
+}
+
+
+static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
+{
+	struct cec_msg msgs[TOPO_NUM_REQS];
+
+	for (unsigned r = 0; r < TOPO_NUM_REQS; r++) {
+		cec_msg_init(&msgs[r], la, i);
+		topology_reqs[r](&msgs[r], true);
+		doioctl(node, CEC_TRANSMIT, &msgs[r]);
+	}
+	showTopologyDeviceInfo(i, la, msgs);
 	return 0;
 }
 
+/*
+ * Transmit all messages in non-blocking mode, keeping the transmit queue
+ * of the adapter full, and collect the results by sequence number. While
+ * one device takes its time to reply, the requests to the others are
+ * already on the bus.
+ */
+static void transmit_pipelined(struct node *node, struct cec_msg *msgs, unsigned num)
+{
+	std::map<__u32, unsigned> pending;
+	int fd = node->fd;
+	int flags = fcntl(fd, F_GETFL);
+	unsigned next = 0;
+
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	while (next < num || !pending.empty()) {
+		struct timeval tv = { 5, 0 };
+		fd_set rd_fds;
+		int res;
+
+		while (next < num) {
+			res = doioctl(node, CEC_TRANSMIT, &msgs[next]);
+			if (res == EBUSY && !pending.empty())
+				break;
+			if (!res && msgs[next].sequence)
+				pending[msgs[next].sequence] = next;
+			next++;
+		}
+		if (pending.empty())
+			continue;
+
+		FD_ZERO(&rd_fds);
+		FD_SET(fd, &rd_fds);
+		res = select(fd + 1, &rd_fds, nullptr, nullptr, &tv);
+		if (res < 0)
+			break;
+		if (res == 0) {
+			/* Should not happen, the CEC framework always reports back */
+			for (auto &p : pending)
+				msgs[p.second].rx_status = CEC_RX_STATUS_TIMEOUT;
+			pending.clear();
+			continue;
+		}
+		while (true) {
+			struct cec_msg msg = { };
+
+			if (doioctl(node, CEC_RECEIVE, &msg))
+				break;
+
+			auto it = pending.find(msg.sequence);
+
+			if (it == pending.end())
+				continue;
+			msgs[it->second] = msg;
+			pending.erase(it);
+		}
+	}
+	fcntl(fd, F_SETFL, flags);
+}
+
+static void showTopologyPipelined(struct node *node, unsigned la)
+{
+	struct cec_msg polls[15];
+	std::vector<struct cec_msg> msgs;
+	std::vector<unsigned> las;
+
+	for (unsigned i = 0; i < 15; i++)
+		cec_msg_init(&polls[i], la, i);
+	transmit_pipelined(node, polls, 15);
+
+	for (unsigned i = 0; i < 15; i++) {
+		const struct cec_msg &msg = polls[i];
+
+		if (msg.tx_status & CEC_TX_STATUS_OK)
+			las.push_back(i);
+		else if (verbose && msg.tx_status && !(msg.tx_status & CEC_TX_STATUS_MAX_RETRIES))
+			printf("\t\t%s for addr %d\n", cec_status2s(msg).c_str(), i);
+	}
+
+	msgs.resize(las.size() * TOPO_NUM_REQS);
+	for (unsigned d = 0; d < las.size(); d++) {
+		for (unsigned r = 0; r < TOPO_NUM_REQS; r++) {
+			struct cec_msg *msg = &msgs[d * TOPO_NUM_REQS + r];
+
+			cec_msg_init(msg, la, las[d]);
+			topology_reqs[r](msg, true);
+		}
+	}
+	transmit_pipelined(node, msgs.data(), msgs.size());
+
+	for (unsigned d = 0; d < las.size(); d++)
+		showTopologyDeviceInfo(las[d], la, &msgs[d * TOPO_NUM_REQS]);
+}
+
 static __u16 calc_mask(__u16 pa)
 {
 	if (pa & 0xf)
@@ -726,19 +874,23 @@ static int showTopology(struct node *node)
 	if (!laddrs.num_log_addrs)
 		return 0;
 
-	for (unsigned i = 0; i < 15; i++) {
-		int ret;
+	if (options[OptNonBlocking]) {
+		showTopologyPipelined(node, laddrs.log_addr[0]);
+	} else {
+		for (unsigned i = 0; i < 15; i++) {
+			int ret;
 
-		cec_msg_init(&msg, laddrs.log_addr[0], i);
-		ret = doioctl(node, CEC_TRANSMIT, &msg);
+			cec_msg_init(&msg, laddrs.log_addr[0], i);
+			ret = doioctl(node, CEC_TRANSMIT, &msg);
 
-		if (ret)
-			continue;
+			if (ret)
+				continue;
 
-		if (msg.tx_status & CEC_TX_STATUS_OK)
-			showTopologyDevice(node, i, laddrs.log_addr[0]);
-		else if (verbose && !(msg.tx_status & CEC_TX_STATUS_MAX_RETRIES))
-			printf("\t\t%s for addr %d\n", cec_status2s(msg).c_str(), i);
+			if (msg.tx_status & CEC_TX_STATUS_OK)
+				showTopologyDevice(node, i, laddrs.log_addr[0]);
+			else if (verbose && !(msg.tx_status & CEC_TX_STATUS_MAX_RETRIES))
+				printf("\t\t%s for addr %d\n", cec_status2s(msg).c_str(), i);
+		}
 	}
 
 	__u32 pas[16];
@@ -791,6 +943,232 @@ static inline unsigned response_time_ms(const struct cec_msg &msg)
 	return 0;
 }
 
+#define MONITOR_STATE_CHANGE		0x10
+#define MONITOR_FL_DROPPED_EVENTS	(1 << 16)
+
+/*
+ * Binary pin store format
+ *
+ * A 16 byte header: the PIN_BIN_MAGIC, a version byte, a reserved byte,
+ * and the little endian 16 bit log_addr_mask and phys_addr, followed by
+ * 4 reserved bytes.
+ *
+ * It is followed by records that start with a LEB128 encoded value:
+ * the time in ns since the previous record shifted left by 4, with
+ * the record type in the lower 3 bits and PIN_BIN_DROPPED in bit 3. The
+ * first record is a PIN_BIN_CLOCK, so its delta is the absolute time.
+ *
+ * - 0-5: pin event (CEC_EVENT_PIN_* - CEC_EVENT_PIN_CEC_LOW)
+ * - PIN_BIN_STATE_CHANGE: followed by the phys_addr and log_addr_mask,
+ *   LEB128 encoded
+ * - PIN_BIN_CLOCK: followed by the wallclock time matching the monotonic
+ *   time of the record, in us, LEB128 encoded
+ *
+ * A typical pin event takes 4 bytes instead of the ~22 bytes of the
+ * text format.
+ */
+static const __u8 PIN_BIN_MAGIC[8] = { 0x89, 'C', 'E', 'C', 'P', 'I', 'N', '\n' };
+#define PIN_BIN_VERSION		1
+#define PIN_BIN_HDR_SIZE	16
+#define PIN_BIN_STATE_CHANGE	6
+#define PIN_BIN_CLOCK		7
+#define PIN_BIN_DROPPED		(1 << 3)
+/* The largest record: three 64 bit LEB128 values */
+#define PIN_BIN_MAX_RECORD	30
+
+/*
+ * Binary records are collected in a ring buffer that is written out in
+ * batches: when it is half full, when the monitor loop is idle, once a
+ * minute together with the clock record, and when monitoring stops.
+ */
+#define PIN_RING_SIZE		(1 << 16)
+
+struct pin_ring {
+	__u8 buf[PIN_RING_SIZE];
+	unsigned head;
+	unsigned tail;
+	int fd;
+	__u64 last_ts;
+};
+
+static struct pin_ring *pin_ring;
+
+static unsigned pin_ring_used(const struct pin_ring *r)
+{
+	return r->head - r->tail;
+}
+
+static void pin_ring_drain(struct pin_ring *r)
+{
+	while (pin_ring_used(r)) {
+		unsigned tail = r->tail % PIN_RING_SIZE;
+		unsigned head = r->head % PIN_RING_SIZE;
+		struct iovec iov[2];
+		int cnt = 1;
+		ssize_t res;
+
+		iov[0].iov_base = r->buf + tail;
+		if (head > tail) {
+			iov[0].iov_len = head - tail;
+		} else {
+			iov[0].iov_len = PIN_RING_SIZE - tail;
+			iov[1].iov_base = r->buf;
+			iov[1].iov_len = head;
+			cnt = head ? 2 : 1;
+		}
+		res = writev(r->fd, iov, cnt);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0) {
+			fprintf(stderr, "Failed to store events: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		r->tail += res;
+	}
+}
+
+static void pin_ring_put_val(struct pin_ring *r, __u64 v)
+{
+	do {
+		__u8 b = v & 0x7f;
+
+		v >>= 7;
+		r->buf[r->head++ % PIN_RING_SIZE] = b | (v ? 0x80 : 0);
+	} while (v);
+}
+
+static void pin_ring_put(struct pin_ring *r, __u64 ts, unsigned type, bool dropped)
+{
+	if (pin_ring_used(r) > PIN_RING_SIZE - PIN_BIN_MAX_RECORD)
+		pin_ring_drain(r);
+	/* The timestamps are monotonic, but don't trust that blindly */
+	if (ts < r->last_ts)
+		ts = r->last_ts;
+	pin_ring_put_val(r, ((ts - r->last_ts) << 4) | type | (dropped ? PIN_BIN_DROPPED : 0));
+	r->last_ts = ts;
+}
+
+static void pin_ring_clock(struct pin_ring *r)
+{
+	pin_ring_put(r, start_monotonic.tv_sec * 1000000000ULL + start_monotonic.tv_nsec,
+		     PIN_BIN_CLOCK, false);
+	pin_ring_put_val(r, start_timeofday.tv_sec * 1000000ULL + start_timeofday.tv_usec);
+}
+
+/* Start a binary store file on fd with the given magic and version */
+static struct pin_ring *pin_ring_open(int fd, const __u8 *magic, __u8 version,
+				      const struct node &node)
+{
+	auto r = new struct pin_ring();
+	__u8 *hdr = r->buf;
+
+	r->fd = fd;
+	memcpy(hdr, magic, sizeof(PIN_BIN_MAGIC));
+	hdr[8] = version;
+	hdr[10] = node.log_addr_mask & 0xff;
+	hdr[11] = node.log_addr_mask >> 8;
+	hdr[12] = node.phys_addr & 0xff;
+	hdr[13] = node.phys_addr >> 8;
+	r->head = PIN_BIN_HDR_SIZE;
+	pin_ring_clock(r);
+	return r;
+}
+
+/* Store an event, v is encoded as in the text format */
+static void store_pin_event(FILE *fstore, __u64 ts, unsigned v,
+			    __u16 pa = 0, __u16 la_mask = 0)
+{
+	bool dropped = v & MONITOR_FL_DROPPED_EVENTS;
+	unsigned event = v & ~MONITOR_FL_DROPPED_EVENTS;
+
+	if (pin_ring) {
+		if (event == MONITOR_STATE_CHANGE) {
+			pin_ring_put(pin_ring, ts, PIN_BIN_STATE_CHANGE, dropped);
+			pin_ring_put_val(pin_ring, pa);
+			pin_ring_put_val(pin_ring, la_mask);
+		} else {
+			pin_ring_put(pin_ring, ts, event, dropped);
+		}
+		if (pin_ring_used(pin_ring) >= PIN_RING_SIZE / 2)
+			pin_ring_drain(pin_ring);
+		return;
+	}
+	if (event == MONITOR_STATE_CHANGE)
+		fprintf(fstore, "%llu.%09llu 0x%x 0x%04x 0x%04x\n",
+			ts / 1000000000, ts % 1000000000, v, pa, la_mask);
+	else
+		fprintf(fstore, "%llu.%09llu 0x%x\n",
+			ts / 1000000000, ts % 1000000000, v);
+	fflush(fstore);
+}
+
+/*
+ * The binary message format of --store-msgs has the same header and
+ * record encoding as the binary pin format, but starts with MSG_BIN_MAGIC
+ * and has these record types:
+ *
+ * - MSG_BIN_RX: a received message: its length, the message bytes and
+ *   the rx_status. The time of the record is the rx_ts.
+ * - MSG_BIN_TX: a transmitted message: its length, the message bytes, the
+ *   tx_status and the tx_nack_cnt, tx_arb_lost_cnt, tx_low_drive_cnt and
+ *   tx_error_cnt as one value, one byte each starting at the LSB. The
+ *   time of the record is the tx_ts.
+ * - MSG_BIN_LOST_MSGS: followed by the number of lost messages
+ * - MSG_BIN_STATE_CHANGE and MSG_BIN_CLOCK: as in the pin format
+ *
+ * All values but the message bytes are LEB128 encoded. A typical message
+ * takes 6 to 10 bytes.
+ */
+static const __u8 MSG_BIN_MAGIC[8] = { 0x89, 'C', 'E', 'C', 'M', 'S', 'G', '\n' };
+#define MSG_BIN_VERSION		1
+#define MSG_BIN_RX		0
+#define MSG_BIN_TX		1
+#define MSG_BIN_LOST_MSGS	2
+#define MSG_BIN_STATE_CHANGE	PIN_BIN_STATE_CHANGE
+#define MSG_BIN_CLOCK		PIN_BIN_CLOCK
+/* The largest record: a transmitted message */
+#define MSG_BIN_MAX_RECORD	(10 + 1 + CEC_MAX_MSG_SIZE + 1 + 5)
+
+static struct pin_ring *msg_ring;
+
+static void store_msg(const cec_msg &msg)
+{
+	bool transmitted = msg.tx_status != 0;
+
+	if (pin_ring_used(msg_ring) > PIN_RING_SIZE - MSG_BIN_MAX_RECORD)
+		pin_ring_drain(msg_ring);
+	pin_ring_put(msg_ring, transmitted ? msg.tx_ts : msg.rx_ts,
+		     transmitted ? MSG_BIN_TX : MSG_BIN_RX, false);
+	pin_ring_put_val(msg_ring, msg.len);
+	for (unsigned i = 0; i < msg.len; i++)
+		msg_ring->buf[msg_ring->head++ % PIN_RING_SIZE] = msg.msg[i];
+	if (transmitted) {
+		pin_ring_put_val(msg_ring, msg.tx_status);
+		pin_ring_put_val(msg_ring, msg.tx_nack_cnt |
+				 (msg.tx_arb_lost_cnt << 8) |
+				 (msg.tx_low_drive_cnt << 16) |
+				 (static_cast<__u32>(msg.tx_error_cnt) << 24));
+	} else {
+		pin_ring_put_val(msg_ring, msg.rx_status);
+	}
+	if (pin_ring_used(msg_ring) >= PIN_RING_SIZE / 2)
+		pin_ring_drain(msg_ring);
+}
+
+static void store_msg_event(const struct cec_event &ev)
+{
+	bool dropped = ev.flags & CEC_EVENT_FL_DROPPED_EVENTS;
+
+	if (ev.event == CEC_EVENT_STATE_CHANGE) {
+		pin_ring_put(msg_ring, ev.ts, MSG_BIN_STATE_CHANGE, dropped);
+		pin_ring_put_val(msg_ring, ev.state_change.phys_addr);
+		pin_ring_put_val(msg_ring, ev.state_change.log_addr_mask);
+	} else if (ev.event == CEC_EVENT_LOST_MSGS) {
+		pin_ring_put(msg_ring, ev.ts, MSG_BIN_LOST_MSGS, dropped);
+		pin_ring_put_val(msg_ring, ev.lost_msgs.lost_msgs);
+	}
+}
+
 static void generate_eob_event(__u64 ts, FILE *fstore)
 {
 	if (!eob_ts || eob_ts_max >= ts)
@@ -801,31 +1179,44 @@ static void generate_eob_event(__u64 ts, FILE *fstore)
 		CEC_EVENT_PIN_CEC_HIGH
 	};
 
-	if (fstore) {
-		fprintf(fstore, "%llu.%09llu 0x%x\n",
-			ev_eob.ts / 1000000000, ev_eob.ts % 1000000000,
-			ev_eob.event - CEC_EVENT_PIN_CEC_LOW);
-		fflush(fstore);
-	}
+	if (fstore)
+		store_pin_event(fstore, ev_eob.ts, ev_eob.event - CEC_EVENT_PIN_CEC_LOW);
 	log_event(ev_eob, fstore != stdout, true);
 }
 
+static bool msg_is_ignored(const cec_msg &msg)
+{
+	__u8 from = cec_msg_initiator(&msg);
+
+	if (ignore_la[from])
+		return true;
+	return (msg.len == 1 && (ignore_opcode[POLL_FAKE_OPCODE] & (1 << from))) ||
+	       (msg.len > 1 && (ignore_opcode[msg.msg[1]] & (1 << from)));
+}
+
 static void show_msg(const cec_msg &msg)
 {
 	__u8 from = cec_msg_initiator(&msg);
 	__u8 to = cec_msg_destination(&msg);
 
-	if (ignore_la[from])
-		return;
-	if ((msg.len == 1 && (ignore_opcode[POLL_FAKE_OPCODE] & (1 << from))) ||
-	    (msg.len > 1 && (ignore_opcode[msg.msg[1]] & (1 << from))))
+	if (msg_is_ignored(msg))
 		return;
 
 	bool transmitted = msg.tx_status != 0;
-	printf("%s %s to %s (%d to %d): ",
-	       transmitted ? "Transmitted by" : "Received from",
-	       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to);
-	cec_log_msg(&msg);
+	char buf[1024];
+
+	/* Write the message as a whole, unless it is too long for buf */
+	if (cec_log_msg_buf(buf, sizeof(buf), &msg) < sizeof(buf)) {
+		printf("%s %s to %s (%d to %d): %s",
+		       transmitted ? "Transmitted by" : "Received from",
+		       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to,
+		       buf);
+	} else {
+		printf("%s %s to %s (%d to %d): ",
+		       transmitted ? "Transmitted by" : "Received from",
+		       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to);
+		cec_log_msg(&msg);
+	}
 	if (options[OptShowRaw])
 		log_raw_msg(&msg);
 	std::string status;
@@ -888,10 +1279,15 @@ static void wait_for_msgs(const struct node &node, __u32 monitor_time)
 	}
 }
 
-#define MONITOR_STATE_CHANGE		0x10
-#define MONITOR_FL_DROPPED_EVENTS	(1 << 16)
+static volatile sig_atomic_t monitor_stopped;
 
-static void monitor(const struct node &node, __u32 monitor_time, const char *store_pin)
+static void monitor_stop(int sig)
+{
+	monitor_stopped = 1;
+}
+
+static void monitor(const struct node &node, __u32 monitor_time, const char *store_pin,
+		    bool binary, const char *store_msgs)
 {
 	__u32 monitor = CEC_MODE_MONITOR;
 	fd_set rd_fds;
@@ -940,6 +1336,18 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 				strerror(errno));
 			std::exit(EXIT_FAILURE);
 		}
+	}
+
+	if (fstore && binary) {
+		int store_fd = fileno(fstore);
+
+		if (fstore == stdout) {
+			/* Keep any other output from ending up in the binary stream */
+			store_fd = dup(STDOUT_FILENO);
+			freopen("/dev/null", "w", stdout);
+		}
+		pin_ring = pin_ring_open(store_fd, PIN_BIN_MAGIC, PIN_BIN_VERSION, node);
+	} else if (fstore) {
 		fprintf(fstore, "# cec-ctl --store-pin\n");
 		fprintf(fstore, "# version %d\n", CEC_CTL_VERSION);
 		fprintf(fstore, "# start_monotonic %lu.%09lu\n",
@@ -951,6 +1359,35 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 			cec_phys_addr_exp(node.phys_addr));
 	}
 
+	if (store_msgs) {
+		int store_fd;
+
+		if (!strcmp(store_msgs, "-")) {
+			store_fd = dup(STDOUT_FILENO);
+			freopen("/dev/null", "w", stdout);
+		} else {
+			store_fd = open(store_msgs, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		}
+		if (store_fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", store_msgs,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		msg_ring = pin_ring_open(store_fd, MSG_BIN_MAGIC, MSG_BIN_VERSION, node);
+	}
+
+	if (pin_ring || msg_ring) {
+		struct sigaction sa = { };
+
+		/*
+		 * Buffered events would be lost if the process is killed,
+		 * so stop monitoring cleanly on SIGINT and SIGTERM.
+		 */
+		sa.sa_handler = monitor_stop;
+		sigaction(SIGINT, &sa, nullptr);
+		sigaction(SIGTERM, &sa, nullptr);
+	}
+
 	if (fstore != stdout)
 		printf("\n");
 
@@ -965,7 +1402,7 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 		int res;
 
 		fflush(stdout);
-		if (monitor_time && now >= t)
+		if ((monitor_time && now >= t) || monitor_stopped)
 			break;
 		FD_ZERO(&rd_fds);
 		FD_ZERO(&ex_fds);
@@ -974,7 +1411,11 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 		res = select(fd + 1, &rd_fds, nullptr, &ex_fds, &tv);
 		if (res < 0)
 			break;
-		if (store_pin && now - start_minute > 60 &&
+		if (!res && pin_ring)
+			pin_ring_drain(pin_ring);
+		if (!res && msg_ring)
+			pin_ring_drain(msg_ring);
+		if ((store_pin || msg_ring) && now - start_minute > 60 &&
 		    (FD_ISSET(fd, &rd_fds) || FD_ISSET(fd, &ex_fds))) {
 			/*
 			 * The drift between the monotonic and wallclock
@@ -984,11 +1425,20 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 			 */
 			clock_gettime(CLOCK_MONOTONIC, &start_monotonic);
 			gettimeofday(&start_timeofday, nullptr);
-			fprintf(fstore, "# start_monotonic %lu.%09lu\n",
-				start_monotonic.tv_sec, start_monotonic.tv_nsec);
-			fprintf(fstore, "# start_timeofday %lu.%06lu\n",
-				start_timeofday.tv_sec, start_timeofday.tv_usec);
-			fflush(fstore);
+			if (pin_ring) {
+				pin_ring_clock(pin_ring);
+				pin_ring_drain(pin_ring);
+			} else if (fstore) {
+				fprintf(fstore, "# start_monotonic %lu.%09lu\n",
+					start_monotonic.tv_sec, start_monotonic.tv_nsec);
+				fprintf(fstore, "# start_timeofday %lu.%06lu\n",
+					start_timeofday.tv_sec, start_timeofday.tv_usec);
+				fflush(fstore);
+			}
+			if (msg_ring) {
+				pin_ring_clock(msg_ring);
+				pin_ring_drain(msg_ring);
+			}
 			start_minute = now;
 		}
 		if (FD_ISSET(fd, &rd_fds)) {
@@ -999,6 +1449,8 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 				fprintf(stderr, "Device was disconnected.\n");
 				break;
 			}
+			if (!res && msg_ring)
+				store_msg(msg);
 			if (!res && fstore != stdout)
 				show_msg(msg);
 		}
@@ -1007,6 +1459,8 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 
 			if (doioctl(&node, CEC_DQEVENT, &ev))
 				continue;
+			if (msg_ring)
+				store_msg_event(ev);
 			if (ev.event == CEC_EVENT_PIN_CEC_LOW ||
 			    ev.event == CEC_EVENT_PIN_CEC_HIGH ||
 			    ev.event == CEC_EVENT_PIN_HPD_LOW ||
@@ -1023,18 +1477,14 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 				if (ev.flags & CEC_EVENT_FL_DROPPED_EVENTS)
 					v |= MONITOR_FL_DROPPED_EVENTS;
 
-				fprintf(fstore, "%llu.%09llu 0x%x 0x%04x 0x%04x\n",
-					ev.ts / 1000000000, ev.ts % 1000000000, v,
-					ev.state_change.phys_addr, ev.state_change.log_addr_mask);
-				fflush(fstore);
+				store_pin_event(fstore, ev.ts, v, ev.state_change.phys_addr,
+						ev.state_change.log_addr_mask);
 			} else if (fstore && pin_event) {
 				unsigned int v = ev.event - CEC_EVENT_PIN_CEC_LOW;
 
 				if (ev.flags & CEC_EVENT_FL_DROPPED_EVENTS)
 					v |= MONITOR_FL_DROPPED_EVENTS;
-				fprintf(fstore, "%llu.%09llu 0x%x\n",
-					ev.ts / 1000000000, ev.ts % 1000000000, v);
-				fflush(fstore);
+				store_pin_event(fstore, ev.ts, v);
 			}
 			if (!pin_event || options[OptMonitorPin])
 				log_event(ev, fstore != stdout, true);
@@ -1048,6 +1498,19 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 			generate_eob_event(ts64, fstore);
 		}
 	}
+	if (pin_ring) {
+		pin_ring_drain(pin_ring);
+		if (fstore == stdout)
+			close(pin_ring->fd);
+		delete pin_ring;
+		pin_ring = nullptr;
+	}
+	if (msg_ring) {
+		pin_ring_drain(msg_ring);
+		close(msg_ring->fd);
+		delete msg_ring;
+		msg_ring = nullptr;
+	}
 	if (fstore && fstore != stdout)
 		fclose(fstore);
 }
@@ -1077,6 +1540,120 @@ static unsigned read_val(char **p)
 	return v;
 }
 
+static bool get_val(const __u8 **p, const __u8 *end, __u64 &v)
+{
+	unsigned shift = 0;
+
+	v = 0;
+	while (*p < end && shift < 64) {
+		__u8 b = *(*p)++;
+
+		v |= (__u64)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+		shift += 7;
+	}
+	return false;
+}
+
+/*
+ * Decode the binary format in a single pass, reading the file in large
+ * blocks and feeding each event straight to the pin analyzer.
+ */
+static void analyze_binary(FILE *fanalyze)
+{
+	static __u8 buf[PIN_RING_SIZE + PIN_BIN_MAX_RECORD];
+	struct cec_event ev = { };
+	unsigned long long offset = PIN_BIN_HDR_SIZE;
+	__u8 hdr[PIN_BIN_HDR_SIZE];
+	bool eof = false;
+	size_t len = 0;
+	__u64 ts = 0;
+
+	if (fread(hdr, 1, sizeof(hdr), fanalyze) != sizeof(hdr) ||
+	    memcmp(hdr, PIN_BIN_MAGIC, sizeof(PIN_BIN_MAGIC))) {
+		fprintf(stderr, "Not a pin store file: malformed header\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (hdr[8] > PIN_BIN_VERSION) {
+		fprintf(stderr, "Pin store file has binary version %d, but we only support up to version %d\n",
+			hdr[8], PIN_BIN_VERSION);
+		std::exit(EXIT_FAILURE);
+	}
+
+	__u16 pa = hdr[12] | (hdr[13] << 8);
+
+	printf("Physical Address:     %x.%x.%x.%x\n", cec_phys_addr_exp(pa));
+	printf("Logical Address Mask: 0x%04x\n\n", hdr[10] | (hdr[11] << 8));
+
+	while (true) {
+		const __u8 *p = buf;
+		const __u8 *end;
+
+		if (!eof) {
+			size_t n = fread(buf + len, 1, PIN_RING_SIZE, fanalyze);
+
+			eof = n < PIN_RING_SIZE;
+			len += n;
+		}
+		if (!len)
+			break;
+		end = buf + len;
+
+		/* Only decode records that are known to be complete, unless at EOF */
+		while (p < end && (eof || end - p >= PIN_BIN_MAX_RECORD)) {
+			const __u8 *rec = p;
+			__u64 v, pa, la_mask, tv;
+			unsigned type;
+
+			if (!get_val(&p, end, v))
+				goto truncated;
+			ts += v >> 4;
+			type = v & 7;
+			ev.ts = ts;
+			ev.flags = (v & PIN_BIN_DROPPED) ? CEC_EVENT_FL_DROPPED_EVENTS : 0;
+			switch (type) {
+			case PIN_BIN_CLOCK:
+				if (!get_val(&p, end, tv))
+					goto truncated;
+				start_monotonic.tv_sec = ts / 1000000000;
+				start_monotonic.tv_nsec = ts % 1000000000;
+				start_timeofday.tv_sec = tv / 1000000;
+				start_timeofday.tv_usec = tv % 1000000;
+				valid_until_t = 0;
+				break;
+			case PIN_BIN_STATE_CHANGE:
+				if (!get_val(&p, end, pa) || !get_val(&p, end, la_mask))
+					goto truncated;
+				ev.event = CEC_EVENT_STATE_CHANGE;
+				ev.state_change.phys_addr = pa;
+				ev.state_change.log_addr_mask = la_mask;
+				log_event(ev, true, true);
+				break;
+			default:
+				ev.event = type + CEC_EVENT_PIN_CEC_LOW;
+				log_event(ev, true, true);
+				break;
+			}
+			offset += p - rec;
+		}
+		len = end - p;
+		if (eof && !len)
+			break;
+		memmove(buf, p, len);
+	}
+
+	if (eob_ts) {
+		ev.event = CEC_EVENT_PIN_CEC_HIGH;
+		ev.ts = eob_ts;
+		log_event(ev, true, true);
+	}
+	return;
+
+truncated:
+	fprintf(stderr, "truncated record at offset %llu\n", offset);
+}
+
 static void analyze(const char *analyze_pin)
 {
 	FILE *fanalyze;
@@ -1097,6 +1674,12 @@ static void analyze(const char *analyze_pin)
 			strerror(errno));
 		std::exit(EXIT_FAILURE);
 	}
+	if (ungetc(getc(fanalyze), fanalyze) == PIN_BIN_MAGIC[0]) {
+		analyze_binary(fanalyze);
+		if (fanalyze != stdin)
+			fclose(fanalyze);
+		return;
+	}
 	if (!fgets(s, sizeof(s), fanalyze) ||
 	    strcmp(s, "# cec-ctl --store-pin\n"))
 		goto err;
@@ -1195,23 +1778,301 @@ static void analyze(const char *analyze_pin)
 		} else {
 			ev.event = event + CEC_EVENT_PIN_CEC_LOW;
 		}
-		log_event(ev, true, true);
-		line++;
-	}
-
-	if (eob_ts) {
-		ev.event = CEC_EVENT_PIN_CEC_HIGH;
-		ev.ts = eob_ts;
-		log_event(ev, true, true);
+		log_event(ev, true, true);
+		line++;
+	}
+
+	if (eob_ts) {
+		ev.event = CEC_EVENT_PIN_CEC_HIGH;
+		ev.ts = eob_ts;
+		log_event(ev, true, true);
+	}
+
+	if (fanalyze != stdin)
+		fclose(fanalyze);
+	return;
+
+err:
+	fprintf(stderr, "Not a pin store file: malformed data at line %d\n", line);
+	std::exit(EXIT_FAILURE);
+}
+
+/* Reply latency buckets of --msg-stats, in ms */
+static const unsigned msg_stats_buckets[] = { 50, 100, 200, 500, 1000 };
+#define MSG_STATS_NUM_BUCKETS \
+	(sizeof(msg_stats_buckets) / sizeof(msg_stats_buckets[0]))
+
+struct msg_stats {
+	/* Indexed by opcode, POLL_FAKE_OPCODE for polls */
+	unsigned rx[257];
+	unsigned tx[257];
+	unsigned nacks[257];
+	unsigned replies[257][MSG_STATS_NUM_BUCKETS];
+	/* The last unanswered directed message from initiator to follower */
+	struct {
+		__u64 ts;
+		unsigned opcode;
+	} pending[16][16];
+	unsigned lost_msgs;
+	unsigned state_changes;
+	__u64 first_ts;
+	__u64 last_ts;
+};
+
+/*
+ * A directed message counts as replied to when its follower sends a message
+ * back to the initiator, or broadcasts one, within a second. A reply is not
+ * expected to be replied to in turn.
+ */
+static void msg_stats_add(struct msg_stats &st, const cec_msg &msg, __u64 ts)
+{
+	unsigned opcode = msg.len > 1 ? msg.msg[1] : POLL_FAKE_OPCODE;
+	__u8 from = cec_msg_initiator(&msg);
+	__u8 to = cec_msg_destination(&msg);
+	bool transmitted = msg.tx_status != 0;
+	unsigned reply_to = 16;
+	__u64 reply_ts = ~0ULL;
+
+	if (!st.first_ts)
+		st.first_ts = ts;
+	st.last_ts = ts;
+	if (transmitted) {
+		st.tx[opcode]++;
+		if (msg.tx_status & CEC_TX_STATUS_NACK)
+			st.nacks[opcode]++;
+		if (!(msg.tx_status & CEC_TX_STATUS_OK))
+			return;
+	} else {
+		st.rx[opcode]++;
+	}
+	if (msg.len == 1)
+		return;
+
+	for (unsigned i = 0; i < 16; i++) {
+		if (to != CEC_LOG_ADDR_BROADCAST && i != to)
+			continue;
+		if (st.pending[i][from].ts && st.pending[i][from].ts < reply_ts) {
+			reply_ts = st.pending[i][from].ts;
+			reply_to = i;
+		}
+	}
+	if (reply_to < 16 && ts - reply_ts >= 1000000000ULL) {
+		st.pending[reply_to][from].ts = 0;
+		reply_to = 16;
+	}
+	if (reply_to < 16) {
+		__u64 ms = (ts - reply_ts) / 1000000;
+
+		for (unsigned i = 0; i < MSG_STATS_NUM_BUCKETS; i++) {
+			if (ms < msg_stats_buckets[i]) {
+				st.replies[st.pending[reply_to][from].opcode][i]++;
+				break;
+			}
+		}
+		st.pending[reply_to][from].ts = 0;
+	} else if (to != CEC_LOG_ADDR_BROADCAST) {
+		st.pending[from][to].ts = ts;
+		st.pending[from][to].opcode = opcode;
+	}
+}
+
+static void msg_stats_show(const struct msg_stats &st)
+{
+	unsigned rx = 0, tx = 0, nacks = 0;
+
+	for (unsigned op = 0; op < 257; op++) {
+		rx += st.rx[op];
+		tx += st.tx[op];
+		nacks += st.nacks[op];
+	}
+	printf("Duration:             %s\n", ts2s((st.last_ts - st.first_ts) / 1000000000.0).c_str());
+	printf("Received Messages:    %u\n", rx);
+	printf("Transmitted Messages: %u (%u NACKed)\n", tx, nacks);
+	printf("Lost Messages:        %u\n", st.lost_msgs);
+	printf("State Changes:        %u\n\n", st.state_changes);
+
+	printf("%-36s %8s %8s %6s %8s", "Opcode", "Rx", "Tx", "NACK%", "Replies");
+	for (unsigned i = 0; i < MSG_STATS_NUM_BUCKETS; i++)
+		printf(" %5s%-2u", "<", msg_stats_buckets[i]);
+	printf("  (ms)\n");
+	for (unsigned op = 0; op < 257; op++) {
+		unsigned replies = 0;
+		char buf[16];
+		const char *name;
+
+		if (!st.rx[op] && !st.tx[op])
+			continue;
+		for (unsigned i = 0; i < MSG_STATS_NUM_BUCKETS; i++)
+			replies += st.replies[op][i];
+		if (op == POLL_FAKE_OPCODE) {
+			name = "Poll";
+		} else {
+			name = cec_opcode2s(op);
+			if (!name) {
+				sprintf(buf, "0x%02x", op);
+				name = buf;
+			}
+		}
+		printf("%-36s %8u %8u ", name, st.rx[op], st.tx[op]);
+		if (st.tx[op])
+			printf("%6.1f", 100.0 * st.nacks[op] / st.tx[op]);
+		else
+			printf("%6s", "-");
+		printf(" %8u", replies);
+		for (unsigned i = 0; i < MSG_STATS_NUM_BUCKETS; i++)
+			printf(" %7u", st.replies[op][i]);
+		printf("\n");
+	}
+}
+
+/*
+ * Decode a --store-msgs file in a single pass. Each message is shown, or
+ * if stats is set, only added to the statistics which are shown at the end.
+ */
+static void analyze_msgs(const char *from, bool stats)
+{
+	static __u8 buf[PIN_RING_SIZE + MSG_BIN_MAX_RECORD];
+	static struct msg_stats st;
+	unsigned long long offset = PIN_BIN_HDR_SIZE;
+	__u8 hdr[PIN_BIN_HDR_SIZE];
+	FILE *fanalyze;
+	bool eof = false;
+	size_t len = 0;
+	__u64 ts = 0;
+
+	if (!strcmp(from, "-"))
+		fanalyze = stdin;
+	else
+		fanalyze = fopen(from, "r");
+	if (fanalyze == nullptr) {
+		fprintf(stderr, "Failed to open %s: %s\n", from, strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	if (fread(hdr, 1, sizeof(hdr), fanalyze) != sizeof(hdr) ||
+	    memcmp(hdr, MSG_BIN_MAGIC, sizeof(MSG_BIN_MAGIC))) {
+		fprintf(stderr, "Not a message store file: malformed header\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (hdr[8] > MSG_BIN_VERSION) {
+		fprintf(stderr, "Message store file has version %d, but we only support up to version %d\n",
+			hdr[8], MSG_BIN_VERSION);
+		std::exit(EXIT_FAILURE);
+	}
+
+	__u16 pa = hdr[12] | (hdr[13] << 8);
+
+	printf("Physical Address:     %x.%x.%x.%x\n", cec_phys_addr_exp(pa));
+	printf("Logical Address Mask: 0x%04x\n\n", hdr[10] | (hdr[11] << 8));
+
+	while (true) {
+		const __u8 *p = buf;
+		const __u8 *end;
+
+		if (!eof) {
+			size_t n = fread(buf + len, 1, PIN_RING_SIZE, fanalyze);
+
+			eof = n < PIN_RING_SIZE;
+			len += n;
+		}
+		if (!len)
+			break;
+		end = buf + len;
+
+		/* Only decode records that are known to be complete, unless at EOF */
+		while (p < end && (eof || end - p >= MSG_BIN_MAX_RECORD)) {
+			const __u8 *rec = p;
+			struct cec_event ev = { };
+			cec_msg msg = { };
+			__u64 v, v1, v2;
+			unsigned type;
+
+			if (!get_val(&p, end, v))
+				goto truncated;
+			ts += v >> 4;
+			type = v & 7;
+			ev.ts = ts;
+			ev.flags = (v & PIN_BIN_DROPPED) ? CEC_EVENT_FL_DROPPED_EVENTS : 0;
+			switch (type) {
+			case MSG_BIN_RX:
+			case MSG_BIN_TX:
+				if (!get_val(&p, end, v1) || !v1 || v1 > CEC_MAX_MSG_SIZE ||
+				    end - p < static_cast<long>(v1))
+					goto truncated;
+				msg.len = v1;
+				memcpy(msg.msg, p, msg.len);
+				p += msg.len;
+				if (!get_val(&p, end, v1))
+					goto truncated;
+				if (type == MSG_BIN_RX) {
+					msg.rx_status = v1;
+					msg.rx_ts = ts;
+				} else {
+					if (!get_val(&p, end, v2))
+						goto truncated;
+					msg.tx_status = v1;
+					msg.tx_nack_cnt = v2 & 0xff;
+					msg.tx_arb_lost_cnt = (v2 >> 8) & 0xff;
+					msg.tx_low_drive_cnt = (v2 >> 16) & 0xff;
+					msg.tx_error_cnt = (v2 >> 24) & 0xff;
+					msg.tx_ts = ts;
+				}
+				if (stats) {
+					msg_stats_add(st, msg, ts);
+				} else if (!msg_is_ignored(msg)) {
+					printf("%s: ", ts2s(ts).c_str());
+					show_msg(msg);
+				}
+				break;
+			case MSG_BIN_LOST_MSGS:
+				if (!get_val(&p, end, v1))
+					goto truncated;
+				ev.event = CEC_EVENT_LOST_MSGS;
+				ev.lost_msgs.lost_msgs = v1;
+				st.lost_msgs += v1;
+				if (!stats)
+					log_event(ev, true);
+				break;
+			case MSG_BIN_STATE_CHANGE:
+				if (!get_val(&p, end, v1) || !get_val(&p, end, v2))
+					goto truncated;
+				ev.event = CEC_EVENT_STATE_CHANGE;
+				ev.state_change.phys_addr = v1;
+				ev.state_change.log_addr_mask = v2;
+				st.state_changes++;
+				if (!stats)
+					log_event(ev, true, true);
+				break;
+			case MSG_BIN_CLOCK:
+				if (!get_val(&p, end, v1))
+					goto truncated;
+				start_monotonic.tv_sec = ts / 1000000000;
+				start_monotonic.tv_nsec = ts % 1000000000;
+				start_timeofday.tv_sec = v1 / 1000000;
+				start_timeofday.tv_usec = v1 % 1000000;
+				valid_until_t = 0;
+				break;
+			default:
+				fprintf(stderr, "unknown record type %u at offset %llu\n",
+					type, offset);
+				std::exit(EXIT_FAILURE);
+			}
+			offset += p - rec;
+		}
+		len = end - p;
+		if (eof && !len)
+			break;
+		memmove(buf, p, len);
 	}
-
 	if (fanalyze != stdin)
 		fclose(fanalyze);
+	if (stats)
+		msg_stats_show(st);
 	return;
 
-err:
-	fprintf(stderr, "Not a pin store file: malformed data at line %d\n", line);
-	std::exit(EXIT_FAILURE);
+truncated:
+	fprintf(stderr, "truncated record at offset %llu\n", offset);
+	if (stats)
+		msg_stats_show(st);
 }
 
 static bool wait_for_pwr_state(const struct node &node, unsigned from,
@@ -2084,6 +2945,500 @@ done:
 	}
 }
 
+/*
+ * Upper bounds, in seconds, of the buckets of the transition latency
+ * histograms. The last bucket holds everything slower.
+ */
+static const unsigned latency_bucket_s[] = { 1, 2, 3, 5, 7, 10, 15, 20, 30, 60 };
+static constexpr unsigned num_latency_bounds =
+	sizeof(latency_bucket_s) / sizeof(latency_bucket_s[0]);
+static constexpr unsigned num_latency_buckets = num_latency_bounds + 1;
+
+struct latency_stats {
+	unsigned cnt;
+	__u64 min;
+	__u64 max;
+	__u64 sum;
+	unsigned hist[num_latency_buckets];
+};
+
+static void latency_add(struct latency_stats &stats, __u64 latency)
+{
+	unsigned i;
+
+	for (i = 0; i < num_latency_bounds; i++)
+		if (latency < latency_bucket_s[i] * 1000000000ULL)
+			break;
+	stats.hist[i]++;
+	if (!stats.cnt || latency < stats.min)
+		stats.min = latency;
+	if (latency > stats.max)
+		stats.max = latency;
+	stats.sum += latency;
+	stats.cnt++;
+}
+
+enum cycle_state {
+	CYCLE_SLEEP_BEFORE_ON,
+	CYCLE_IMAGE_VIEW_ON,
+	CYCLE_WAIT_FOR_ON,
+	CYCLE_SLEEP_BEFORE_OFF,
+	CYCLE_ACTIVE_SOURCE,
+	CYCLE_STANDBY,
+	CYCLE_WAIT_FOR_OFF,
+	CYCLE_DONE,
+	CYCLE_FAILED,
+};
+
+struct cycle_node {
+	struct node node;
+	std::string device;
+	enum cycle_state state;
+	unsigned iter;
+	unsigned tries;
+	unsigned hpd_is_low_cnt;
+	bool hpd_is_low;
+	unsigned from;
+	__u16 pa;
+	/* Sequence number of the transmit in progress, 0 if none */
+	__u32 sequence;
+	/* When to act next, 0 while waiting for a transmit result */
+	__u64 deadline;
+	/* When the display accepted the current Image View On or Standby */
+	__u64 start_ts;
+	unsigned nacks;
+	struct latency_stats on;
+	struct latency_stats off;
+};
+
+struct cycle_config {
+	unsigned cnt;
+	unsigned max_tries;
+	__u64 poll_interval;
+	__u64 min_sleep;
+	__u64 mod_sleep;
+};
+
+static volatile sig_atomic_t cycle_stopped;
+
+static void cycle_stop(int sig)
+{
+	cycle_stopped = 1;
+}
+
+static void cycle_fail(struct cycle_node &cn, const char *reason)
+{
+	printf("%s: %s: FAIL: %s (iteration %u)\n", ts2s(current_ts()).c_str(),
+	       cn.device.c_str(), reason, cn.iter);
+	cn.state = CYCLE_FAILED;
+	cn.deadline = 0;
+	cn.sequence = 0;
+}
+
+static void cycle_sleep(struct cycle_node &cn, const struct cycle_config &cfg,
+			enum cycle_state state)
+{
+	__u64 sleep = cfg.min_sleep;
+
+	if (cfg.mod_sleep)
+		sleep += random() % cfg.mod_sleep;
+	cn.state = state;
+	cn.deadline = current_ts() + sleep;
+}
+
+static void cycle_reached(struct cycle_node &cn, const struct cycle_config &cfg,
+			  __u64 ts, bool on)
+{
+	__u64 latency = ts > cn.start_ts ? ts - cn.start_ts : 0;
+
+	latency_add(on ? cn.on : cn.off, latency);
+	printf("%s: %s: iteration %u: %s after %.3fs\n", ts2s(current_ts()).c_str(),
+	       cn.device.c_str(), cn.iter, on ? "on" : "standby", latency / 1000000000.0);
+	cn.sequence = 0;
+	if (!on) {
+		cycle_sleep(cn, cfg, CYCLE_SLEEP_BEFORE_ON);
+	} else if (cfg.cnt && cn.iter == cfg.cnt) {
+		cn.state = CYCLE_DONE;
+		cn.deadline = 0;
+	} else {
+		cycle_sleep(cn, cfg, CYCLE_SLEEP_BEFORE_OFF);
+	}
+}
+
+/* The display isn't in the expected power state (yet) */
+static void cycle_poll_failed(struct cycle_node &cn, const struct cycle_config &cfg)
+{
+	if (++cn.tries > cfg.max_tries) {
+		cycle_fail(cn, cn.state == CYCLE_WAIT_FOR_ON ?
+			   "never woke up" : "never went into standby");
+		return;
+	}
+	cn.deadline = current_ts() + cfg.poll_interval;
+}
+
+/*
+ * Transmit the message of the current state in non-blocking mode. The
+ * result, and the reply if one is expected, are handled by cycle_result()
+ * when they are received. If the message can't be transmitted right now
+ * (no logical address claimed, or the transmit queue is full), then
+ * retry shortly.
+ */
+static void cycle_transmit(struct cycle_node &cn, const struct cycle_config &cfg)
+{
+	struct cec_log_addrs laddrs = { };
+	struct cec_msg msg;
+	int ret;
+
+	doioctl(&cn.node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
+	if (laddrs.log_addr[0] != CEC_LOG_ADDR_INVALID)
+		cn.from = laddrs.log_addr[0];
+	else if (cn.state == CYCLE_IMAGE_VIEW_ON)
+		cn.from = CEC_LOG_ADDR_UNREGISTERED;
+
+	cec_msg_init(&msg, cn.from, CEC_LOG_ADDR_TV);
+	switch (cn.state) {
+	case CYCLE_IMAGE_VIEW_ON:
+		cec_msg_image_view_on(&msg);
+		break;
+	case CYCLE_ACTIVE_SOURCE:
+		doioctl(&cn.node, CEC_ADAP_G_PHYS_ADDR, &cn.pa);
+		cec_msg_active_source(&msg, cn.pa);
+		break;
+	case CYCLE_STANDBY:
+		cec_msg_standby(&msg);
+		break;
+	case CYCLE_WAIT_FOR_ON:
+	case CYCLE_WAIT_FOR_OFF:
+		cec_msg_give_device_power_status(&msg, true);
+		break;
+	default:
+		return;
+	}
+
+	ret = doioctl(&cn.node, CEC_TRANSMIT, &msg);
+	if (!ret) {
+		cn.sequence = msg.sequence;
+		/* Safety net, the CEC framework always reports back */
+		cn.deadline = current_ts() + 10000000000ULL;
+		return;
+	}
+	if (ret != ENONET && ret != EINVAL && ret != EBUSY) {
+		cycle_fail(cn, strerror(ret));
+		return;
+	}
+	if (cn.state != CYCLE_WAIT_FOR_ON && cn.state != CYCLE_WAIT_FOR_OFF) {
+		/* Can happen while the adapter is (re)configuring */
+		if (++cn.tries > 10 * cfg.max_tries)
+			cycle_fail(cn, strerror(ret));
+		else
+			cn.deadline = current_ts() + 100000000ULL;
+		return;
+	}
+	if (ret == ENONET && cn.state == CYCLE_WAIT_FOR_OFF && cn.hpd_is_low &&
+	    ++cn.hpd_is_low_cnt > 2) {
+		/* The display pulled the HPD low when going into standby */
+		cycle_reached(cn, cfg, current_ts(), false);
+		return;
+	}
+	cycle_poll_failed(cn, cfg);
+}
+
+/* Called when the deadline of the node expired */
+static void cycle_timeout(struct cycle_node &cn, const struct cycle_config &cfg)
+{
+	if (cn.sequence) {
+		cycle_fail(cn, "no transmit result");
+		return;
+	}
+	switch (cn.state) {
+	case CYCLE_SLEEP_BEFORE_ON:
+		cn.iter++;
+		cn.tries = 0;
+		cn.state = CYCLE_IMAGE_VIEW_ON;
+		break;
+	case CYCLE_SLEEP_BEFORE_OFF:
+		cn.tries = 0;
+		cn.state = CYCLE_ACTIVE_SOURCE;
+		break;
+	default:
+		break;
+	}
+	cycle_transmit(cn, cfg);
+}
+
+/* Called with the result of the transmit in progress */
+static void cycle_result(struct cycle_node &cn, const struct cycle_config &cfg,
+			 struct cec_msg &msg)
+{
+	__u64 now = current_ts();
+	__u8 pwr;
+
+	cn.sequence = 0;
+	/*
+	 * As in stress_test_standby_wakeup_cycle(): assume that an aborted
+	 * message was really Nacked, so it is retried.
+	 */
+	if (msg.tx_status & CEC_TX_STATUS_ABORTED)
+		msg.tx_status = CEC_TX_STATUS_NACK;
+
+	switch (cn.state) {
+	case CYCLE_IMAGE_VIEW_ON:
+	case CYCLE_ACTIVE_SOURCE:
+	case CYCLE_STANDBY:
+		if (!(msg.tx_status & (CEC_TX_STATUS_OK | CEC_TX_STATUS_NACK))) {
+			cycle_fail(cn, cec_status2s(msg).c_str());
+			return;
+		}
+		if (!(msg.tx_status & CEC_TX_STATUS_OK)) {
+			cn.nacks++;
+			cn.deadline = now + 1000000000ULL;
+			return;
+		}
+		cn.tries = 0;
+		cn.hpd_is_low_cnt = 0;
+		cn.start_ts = msg.tx_ts;
+		if (cn.state == CYCLE_IMAGE_VIEW_ON)
+			cn.state = CYCLE_WAIT_FOR_ON;
+		else if (cn.state == CYCLE_ACTIVE_SOURCE)
+			cn.state = CYCLE_STANDBY;
+		else
+			cn.state = CYCLE_WAIT_FOR_OFF;
+		cycle_transmit(cn, cfg);
+		return;
+
+	case CYCLE_WAIT_FOR_ON:
+	case CYCLE_WAIT_FOR_OFF:
+		if ((msg.rx_status & CEC_RX_STATUS_OK) &&
+		    !(msg.rx_status & CEC_RX_STATUS_FEATURE_ABORT)) {
+			bool on = cn.state == CYCLE_WAIT_FOR_ON;
+
+			cec_ops_report_power_status(&msg, &pwr);
+			if (pwr == (on ? CEC_OP_POWER_STATUS_ON : CEC_OP_POWER_STATUS_STANDBY)) {
+				cycle_reached(cn, cfg, msg.rx_ts, on);
+				return;
+			}
+		}
+		cycle_poll_failed(cn, cfg);
+		return;
+
+	default:
+		return;
+	}
+}
+
+/*
+ * Called for a message that isn't the result of our own transmit.
+ * Displays may report their power status changes by themselves, so
+ * don't wait for the next poll if this happens.
+ */
+static void cycle_received(struct cycle_node &cn, const struct cycle_config &cfg,
+			   const struct cec_msg &msg)
+{
+	bool on = cn.state == CYCLE_WAIT_FOR_ON;
+	__u8 pwr;
+
+	if (cn.sequence || (!on && cn.state != CYCLE_WAIT_FOR_OFF) ||
+	    cec_msg_initiator(&msg) != CEC_LOG_ADDR_TV ||
+	    cec_msg_opcode(&msg) != CEC_MSG_REPORT_POWER_STATUS || msg.len < 3)
+		return;
+	cec_ops_report_power_status(&msg, &pwr);
+	if (pwr == (on ? CEC_OP_POWER_STATUS_ON : CEC_OP_POWER_STATUS_STANDBY))
+		cycle_reached(cn, cfg, msg.rx_ts, on);
+}
+
+static void show_latency_stats(const struct cycle_node &cn)
+{
+	const struct latency_stats *stats[2] = { &cn.on, &cn.off };
+
+	printf("%s: %u iteration%s%s, %u Nack%s\n", cn.device.c_str(),
+	       cn.iter, cn.iter == 1 ? "" : "s",
+	       cn.state == CYCLE_FAILED ? " (FAILED)" : "",
+	       cn.nacks, cn.nacks == 1 ? "" : "s");
+	for (const auto s : stats) {
+		if (!s->cnt)
+			continue;
+		printf("\t%-7s min %.3fs avg %.3fs max %.3fs\n",
+		       s == &cn.on ? "Wakeup" : "Standby",
+		       s->min / 1000000000.0,
+		       s->sum / s->cnt / 1000000000.0,
+		       s->max / 1000000000.0);
+	}
+	if (!cn.on.cnt && !cn.off.cnt)
+		return;
+	printf("\t%-7s %8s %8s\n", "Latency", "Wakeup", "Standby");
+	for (unsigned i = 0; i < num_latency_buckets; i++) {
+		char bucket[16];
+
+		if (i < num_latency_bounds)
+			sprintf(bucket, "< %us", latency_bucket_s[i]);
+		else
+			sprintf(bucket, ">= %us", latency_bucket_s[i - 1]);
+		printf("\t%7s %8u %8u\n", bucket, cn.on.hist[i], cn.off.hist[i]);
+	}
+}
+
+/*
+ * Run the standby-wakeup cycle on all displays at the same time. Each
+ * adapter has its own state machine, driven by the results of
+ * non-blocking transmits, by the power status reports of the display and
+ * by timers, all waited for with a single select(), so a display that
+ * takes its time never holds up the others. Instead of stopping at the
+ * first failure, a failing display drops out and the test continues
+ * with the others.
+ *
+ * Returns the number of displays that failed.
+ */
+static unsigned stress_test_parallel_standby_wakeup_cycle(const std::vector<std::string> &devices,
+							  unsigned cnt, double min_sleep,
+							  double max_sleep, unsigned max_tries,
+							  unsigned poll_interval_ms,
+							  bool has_seed, unsigned seed,
+							  bool hpd_may_be_low)
+{
+	std::vector<cycle_node> nodes(devices.size());
+	struct cycle_config cfg = { };
+	unsigned failures = 0;
+
+	cfg.cnt = cnt;
+	cfg.max_tries = max_tries;
+	cfg.poll_interval = poll_interval_ms * 1000000ULL;
+	cfg.min_sleep = 1000000000.0 * (max_sleep ? min_sleep : 0);
+	if (max_sleep)
+		cfg.mod_sleep = 1000000000.0 * (max_sleep - min_sleep) + 1;
+
+	if (!has_seed)
+		seed = time(nullptr);
+	if (cfg.mod_sleep)
+		printf("Randomizer seed: %u\n\n", seed);
+	srandom(seed);
+
+	for (unsigned i = 0; i < devices.size(); i++) {
+		struct cycle_node &cn = nodes[i];
+		struct cec_log_addrs laddrs = { };
+		struct cec_caps caps = { };
+
+		cn.device = devices[i];
+		cn.node.device = cn.device.c_str();
+		cn.node.fd = open(cn.node.device, O_RDWR | O_NONBLOCK);
+		if (cn.node.fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", cn.node.device,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		doioctl(&cn.node, CEC_ADAP_G_CAPS, &caps);
+		cn.node.caps = caps.capabilities;
+		doioctl(&cn.node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
+		if (!laddrs.num_log_addrs) {
+			fprintf(stderr, "%s: no logical address types were configured\n",
+				cn.node.device);
+			std::exit(EXIT_FAILURE);
+		}
+		if (laddrs.log_addr_type[0] == CEC_LOG_ADDR_TYPE_TV) {
+			fprintf(stderr, "%s: a TV can't run the standby-wakeup cycle test.\n",
+				cn.node.device);
+			std::exit(EXIT_FAILURE);
+		}
+		cn.from = laddrs.log_addr[0];
+		cn.hpd_is_low = cn.from == CEC_LOG_ADDR_INVALID || hpd_may_be_low;
+		/*
+		 * If no logical address was claimed, then assume that the display
+		 * is already in standby, otherwise start with putting it in standby.
+		 */
+		if (cn.from == CEC_LOG_ADDR_INVALID) {
+			cn.from = CEC_LOG_ADDR_UNREGISTERED;
+			cn.state = CYCLE_SLEEP_BEFORE_ON;
+		} else {
+			cn.state = CYCLE_SLEEP_BEFORE_OFF;
+		}
+		cn.deadline = current_ts();
+		printf("%s: the Hotplug Detect pin %s when in Standby\n", cn.node.device,
+		       hpd_may_be_low ? "may be pulled low" :
+		       (cn.hpd_is_low ? "is pulled low" : "remains high"));
+	}
+	printf("\n");
+
+	signal(SIGINT, cycle_stop);
+	signal(SIGTERM, cycle_stop);
+
+	while (!cycle_stopped) {
+		__u64 now = current_ts();
+		__u64 next = 0;
+		fd_set rd_fds;
+		fd_set ex_fds;
+		int max_fd = -1;
+		int res;
+
+		FD_ZERO(&rd_fds);
+		FD_ZERO(&ex_fds);
+		for (auto &cn : nodes) {
+			if (cn.deadline && cn.deadline <= now)
+				cycle_timeout(cn, cfg);
+			if (cn.state == CYCLE_FAILED || cn.state == CYCLE_DONE)
+				continue;
+			if (cn.deadline && (!next || cn.deadline < next))
+				next = cn.deadline;
+			FD_SET(cn.node.fd, &rd_fds);
+			FD_SET(cn.node.fd, &ex_fds);
+			max_fd = std::max(max_fd, cn.node.fd);
+		}
+		if (max_fd < 0)
+			break;
+
+		__u64 wait = next > now ? next - now : 0;
+		struct timeval tv = { (time_t)(wait / 1000000000),
+				      (suseconds_t)(wait % 1000000000 / 1000) };
+
+		fflush(stdout);
+		res = select(max_fd + 1, &rd_fds, nullptr, &ex_fds, next ? &tv : nullptr);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res < 0)
+			break;
+
+		for (auto &cn : nodes) {
+			if (FD_ISSET(cn.node.fd, &ex_fds)) {
+				struct cec_event ev;
+
+				/*
+				 * A state change means that the display changed
+				 * the HPD, so it is worth polling it right away.
+				 */
+				while (!doioctl(&cn.node, CEC_DQEVENT, &ev))
+					if (ev.event == CEC_EVENT_STATE_CHANGE &&
+					    !cn.sequence && cn.deadline &&
+					    (cn.state == CYCLE_WAIT_FOR_ON ||
+					     cn.state == CYCLE_WAIT_FOR_OFF))
+						cn.deadline = current_ts();
+			}
+			if (!FD_ISSET(cn.node.fd, &rd_fds))
+				continue;
+
+			struct cec_msg msg = { };
+
+			while (!doioctl(&cn.node, CEC_RECEIVE, &msg)) {
+				if (cn.sequence && msg.sequence == cn.sequence)
+					cycle_result(cn, cfg, msg);
+				else if (!msg.sequence)
+					cycle_received(cn, cfg, msg);
+				memset(&msg, 0, sizeof(msg));
+			}
+		}
+	}
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	printf("\n");
+	for (auto &cn : nodes) {
+		show_latency_stats(cn);
+		if (cn.state == CYCLE_FAILED)
+			failures++;
+		close(cn.node.fd);
+	}
+	if (failures)
+		printf("\nTest had %u failure%s\n", failures, failures == 1 ? "" : "s");
+	return failures;
+}
+
 
 static int calc_node_val(const char *s)
 {
@@ -2292,6 +3647,7 @@ static void list_devices()
 int main(int argc, char **argv)
 {
 	std::string device;
+	std::vector<std::string> devices;
 	const char *driver = nullptr;
 	const char *adapter = nullptr;
 	const struct cec_msg_args *opt;
@@ -2319,6 +3675,14 @@ int main(int argc, char **argv)
 	bool stress_test_random_standby_wakeup_has_seed = false;
 	unsigned int stress_test_random_standby_wakeup_seed = 0;
 	bool stress_test_random_standby_wakeup_hpd_may_be_low = false;
+	unsigned int stress_test_parallel_standby_wakeup_cycle_cnt = 0;
+	double stress_test_parallel_standby_wakeup_cycle_min_sleep = 0;
+	double stress_test_parallel_standby_wakeup_cycle_max_sleep = 0;
+	unsigned int stress_test_parallel_standby_wakeup_cycle_polls = 30;
+	unsigned int stress_test_parallel_standby_wakeup_cycle_poll_interval = 1000;
+	bool stress_test_parallel_standby_wakeup_cycle_has_seed = false;
+	unsigned int stress_test_parallel_standby_wakeup_cycle_seed = 0;
+	bool stress_test_parallel_standby_wakeup_cycle_hpd_may_be_low = false;
 	bool warn_if_unconfigured = false;
 	__u16 phys_addr;
 	__u8 from = 0, to = 0, first_to = 0xff;
@@ -2328,6 +3692,8 @@ int main(int argc, char **argv)
 	const char *osd_name = "";
 	const char *store_pin = nullptr;
 	const char *analyze_pin = nullptr;
+	const char *store_msgs = nullptr;
+	const char *analyze_msgs_from = nullptr;
 	bool reply = true;
 	int idx = 0;
 	int fd = -1;
@@ -2369,6 +3735,7 @@ int main(int argc, char **argv)
 				sprintf(newdev, "/dev/cec%s", optarg);
 				device = newdev;
 			}
+			devices.push_back(device);
 			break;
 		case OptSetDriver:
 			driver = optarg;
@@ -2434,11 +3801,20 @@ int main(int argc, char **argv)
 			break;
 		}
 		case OptStorePin:
+		case OptStorePinBinary:
 			store_pin = optarg;
 			break;
 		case OptAnalyzePin:
 			analyze_pin = optarg;
 			break;
+		case OptStoreMsgs:
+			store_msgs = optarg;
+			options[OptMonitor] = 1;
+			break;
+		case OptAnalyzeMsgs:
+		case OptMsgStats:
+			analyze_msgs_from = optarg;
+			break;
 		case OptToggleNoReply:
 			reply = !reply;
 			break;
@@ -2823,6 +4199,58 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		case OptStressTestParallelStandbyWakeupCycle: {
+			static constexpr const char *arg_names[] = {
+				"cnt",
+				"min-sleep",
+				"max-sleep",
+				"seed",
+				"polls",
+				"poll-interval",
+				"hpd-may-be-low",
+				nullptr
+			};
+			char *value, *subs = optarg;
+
+			while (*subs != '\0') {
+				switch (cec_parse_subopt(&subs, arg_names, &value)) {
+				case 0:
+					stress_test_parallel_standby_wakeup_cycle_cnt = strtoul(value, nullptr, 0);
+					break;
+				case 1:
+					stress_test_parallel_standby_wakeup_cycle_min_sleep = strtod(value, nullptr);
+					break;
+				case 2:
+					stress_test_parallel_standby_wakeup_cycle_max_sleep = strtod(value, nullptr);
+					break;
+				case 3:
+					stress_test_parallel_standby_wakeup_cycle_has_seed = true;
+					stress_test_parallel_standby_wakeup_cycle_seed = strtoul(value, nullptr, 0);
+					break;
+				case 4:
+					stress_test_parallel_standby_wakeup_cycle_polls = strtoul(value, nullptr, 0);
+					break;
+				case 5:
+					stress_test_parallel_standby_wakeup_cycle_poll_interval = strtoul(value, nullptr, 0);
+					break;
+				case 6:
+					stress_test_parallel_standby_wakeup_cycle_hpd_may_be_low = true;
+					break;
+				default:
+					std::exit(EXIT_FAILURE);
+				}
+			}
+			if (stress_test_parallel_standby_wakeup_cycle_min_sleep > stress_test_parallel_standby_wakeup_cycle_max_sleep) {
+				fprintf(stderr, "min-sleep > max-sleep\n");
+				std::exit(EXIT_FAILURE);
+			}
+			if (!stress_test_parallel_standby_wakeup_cycle_poll_interval) {
+				fprintf(stderr, "poll-interval must be > 0\n");
+				std::exit(EXIT_FAILURE);
+			}
+			break;
+		}
+
 		case OptVersion:
 			print_version();
 			std::exit(EXIT_SUCCESS);
@@ -2869,10 +4297,29 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (analyze_msgs_from && options[OptSetDevice]) {
+		fprintf(stderr, "--device and --analyze-msgs/--msg-stats options cannot be combined.\n\n");
+		usage();
+		return 1;
+	}
+
+	if (analyze_msgs_from) {
+		analyze_msgs(analyze_msgs_from, options[OptMsgStats]);
+		return 0;
+	}
+
+	if (store_pin && store_msgs &&
+	    !strcmp(store_pin, "-") && !strcmp(store_msgs, "-")) {
+		fprintf(stderr, "--store-pin and --store-msgs cannot both write to stdout.\n\n");
+		usage();
+		return 1;
+	}
+
 	if (options[OptWallClock] && !options[OptMonitorPin])
 		verbose = true;
 
-	if (store_pin && !strcmp(store_pin, "-"))
+	if ((store_pin && !strcmp(store_pin, "-")) ||
+	    (store_msgs && !strcmp(store_msgs, "-")))
 		options[OptSkipInfo] = 1;
 
 	if (rc_tv && rc_src) {
@@ -2908,6 +4355,26 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (options[OptStressTestParallelStandbyWakeupCycle]) {
+		if (devices.empty())
+			devices = cec_devices_find(driver, adapter);
+		if (devices.empty()) {
+			fprintf(stderr, "Could not find any CEC device\n");
+			std::exit(EXIT_FAILURE);
+		}
+		print_version();
+		printf("\n");
+		return stress_test_parallel_standby_wakeup_cycle(devices,
+								 stress_test_parallel_standby_wakeup_cycle_cnt,
+								 stress_test_parallel_standby_wakeup_cycle_min_sleep,
+								 stress_test_parallel_standby_wakeup_cycle_max_sleep,
+								 stress_test_parallel_standby_wakeup_cycle_polls,
+								 stress_test_parallel_standby_wakeup_cycle_poll_interval,
+								 stress_test_parallel_standby_wakeup_cycle_has_seed,
+								 stress_test_parallel_standby_wakeup_cycle_seed,
+								 stress_test_parallel_standby_wakeup_cycle_hpd_may_be_low) ? 1 : 0;
+	}
+
 	if (device.empty() && (driver || adapter)) {
 		device = cec_device_find(driver, adapter);
 		if (device.empty()) {
@@ -3221,7 +4688,8 @@ int main(int argc, char **argv)
 skip_la:
 	if (options[OptMonitor] || options[OptMonitorAll] ||
 	    options[OptMonitorPin]) {
-		monitor(node, monitor_time, store_pin);
+		monitor(node, monitor_time, store_pin, options[OptStorePinBinary],
+			store_msgs);
 	} else if (options[OptWaitForMsgs]) {
 		wait_for_msgs(node, monitor_time);
 	} else if (options[OptPhysAddrFromEDIDPoll]) {
@@ -6,10 +6,12 @@
 #include <cstring>
 #include <ctime>
 #include <sstream>
+#include <vector>
 
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 
 #include "cec-follower.h"
 #include "compiler.h"
@@ -39,6 +41,7 @@ enum Option {
 	OptTogglePowerStatus,
 	OptIgnoreStandby,
 	OptIgnoreViewOn,
+	OptAllDevices,
 	OptVersion,
 	OptLast = 256
 };
@@ -50,10 +53,10 @@ bool show_msgs;
 bool show_state;
 bool show_warnings = true;
 unsigned warnings;
-std::set<struct Timer> programmed_timers;
 
 static struct option long_options[] = {
 	{ "device", required_argument, nullptr, OptSetDevice },
+	{ "all-devices", no_argument, nullptr, OptAllDevices },
 	{ "adapter", required_argument, nullptr, OptSetAdapter },
 	{ "driver", required_argument, nullptr, OptSetDriver },
 	{ "exclusive", no_argument, 0, OptExclusive },
@@ -83,6 +86,8 @@ static void usage()
 	printf("Usage:\n"
 	       "  -d, --device <dev>  Use device <dev> instead of /dev/cec0\n"
 	       "                      If <dev> starts with a digit, then /dev/cec<dev> is used.\n"
+	       "                      Can be given more than once to follow several devices.\n"
+	       "  --all-devices       Follow all cec devices, or the ones matching -D and -a\n"
 	       "  -D, --driver <driver>    Use a cec device with this driver name\n"
 	       "  -a, --adapter <adapter>  Use a cec device with this adapter name\n"
 	       "  -h, --help          Display this help message\n"
@@ -273,13 +278,13 @@ std::string opcode2s(const struct cec_msg *msg)
 	return oss.str();
 }
 
-int cec_named_ioctl(int fd, const char *name,
+int cec_named_ioctl(struct node *node, const char *name,
 		    unsigned long int request, void *parm)
 {
 	int retval;
 	int e;
 
-	retval = ioctl(fd, request, parm);
+	retval = ioctl(node->fd, request, parm);
 
 	e = retval == 0 ? 0 : errno;
 	if (options[OptTrace])
@@ -295,14 +300,14 @@ int cec_named_ioctl(int fd, const char *name,
 		    !cec_msg_is_broadcast(msg)) {
 			if (msg->timeout) {
 				if (msg->rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT))
-					la_info[cec_msg_initiator(msg)].ts = msg->rx_ts;
+					node->la_info[cec_msg_initiator(msg)].ts = msg->rx_ts;
 			} else
-				la_info[cec_msg_destination(msg)].ts = msg->tx_ts;
+				node->la_info[cec_msg_destination(msg)].ts = msg->tx_ts;
 		}
 		if (request == CEC_RECEIVE &&
 		    cec_msg_initiator(msg) != CEC_LOG_ADDR_UNREGISTERED &&
 		    (msg->rx_status & CEC_RX_STATUS_OK))
-			la_info[cec_msg_initiator(msg)].ts = msg->rx_ts;
+			node->la_info[cec_msg_initiator(msg)].ts = msg->rx_ts;
 	}
 
 	return retval == -1 ? e : (retval ? -1 : 0);
@@ -316,7 +321,7 @@ void print_timers(struct node *node)
 			printf("Deck is currently recording from the first timer.\n");
 		if (node->state.one_touch_record_on && !node->state.recording_controlled_by_timer)
 			printf("Deck is currently recording independent of timers.\n");
-		for (auto &t : programmed_timers) {
+		for (auto &t : node->programmed_timers) {
 			std::string start = ctime(&t.start_time);
 			time_t end_time = t.start_time + t.duration;
 			std::string end = ctime(&end_time);
@@ -393,16 +398,90 @@ void state_init(struct node &node)
 	node.state.last_aud_rate_rx_ts = 0;
 }
 
+static bool node_init(struct node &node, const struct node &opts,
+		      const char *device, unsigned toggle_power_status)
+{
+	int fd;
+
+	if ((fd = open(device, O_RDWR)) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", device,
+			strerror(errno));
+		return false;
+	}
+
+	struct cec_caps caps = { };
+
+	node.fd = fd;
+	node.device = device;
+	memcpy(node.ignore_la, opts.ignore_la, sizeof(node.ignore_la));
+	memcpy(node.ignore_opcode, opts.ignore_opcode, sizeof(node.ignore_opcode));
+	node.ignore_standby = opts.ignore_standby;
+	node.ignore_view_on = opts.ignore_view_on;
+	doioctl(&node, CEC_ADAP_G_CAPS, &caps);
+	node.caps = caps.capabilities;
+	node.available_log_addrs = caps.available_log_addrs;
+	node.state.service_by_dig_id = options[OptServiceByDigID];
+	node.state.toggle_power_status = toggle_power_status;
+	state_init(node);
+
+	doioctl(&node, CEC_ADAP_G_PHYS_ADDR, &node.phys_addr);
+
+	struct cec_log_addrs laddrs = { };
+	doioctl(&node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
+	node.adap_la_mask = laddrs.log_addr_mask;
+	node.cec_version = laddrs.cec_version;
+
+	struct cec_connector_info conn_info = {};
+
+	doioctl(&node, CEC_ADAP_G_CONNECTOR_INFO, &conn_info);
+
+	cec_driver_info(caps, laddrs, node.phys_addr, conn_info);
+
+	/*
+	 * For CEC 1.4, features of a logical address may still be
+	 * filled in according to the CEC 2.0 guidelines even though
+	 * the CEC framework won’t use the features in the CEC 2.0
+	 * CEC_MSG_REPORT_FEATURES.
+	 */
+	bool is_dev_feat = false;
+
+	for (__u8 byte : laddrs.features[0]) {
+		if (is_dev_feat) {
+			node.source_has_arc_rx = (byte & CEC_OP_FEAT_DEV_SOURCE_HAS_ARC_RX) != 0;
+			node.sink_has_arc_tx = (byte & CEC_OP_FEAT_DEV_SINK_HAS_ARC_TX) != 0;
+			node.has_aud_rate = (byte & CEC_OP_FEAT_DEV_HAS_SET_AUDIO_RATE) != 0;
+			node.has_deck_ctl = (byte & CEC_OP_FEAT_DEV_HAS_DECK_CONTROL) != 0;
+			node.has_rec_tv = (byte & CEC_OP_FEAT_DEV_HAS_RECORD_TV_SCREEN) != 0;
+			node.has_osd_string = (byte & CEC_OP_FEAT_DEV_HAS_SET_OSD_STRING) != 0;
+			break;
+		}
+		if (byte & CEC_OP_FEAT_EXT)
+			continue;
+		if (!is_dev_feat)
+			is_dev_feat = true;
+		else
+			break;
+	}
+	printf("\n");
+
+	if (laddrs.num_log_addrs == 0 && (node.caps & CEC_CAP_LOG_ADDRS)) {
+		printf("\nFAIL: missing logical address(es) on %s, use cec-ctl to configure this\n",
+		       device);
+		close(fd);
+		return false;
+	}
+	return true;
+}
+
 int main(int argc, char **argv)
 {
-	std::string device;
+	std::vector<std::string> devices;
 	struct node node = { };
 	const char *driver = nullptr;
 	const char *adapter = nullptr;
 	unsigned toggle_power_status = 0;
 	char short_options[26 * 2 * 2 + 1];
 	int idx = 0;
-	int fd = -1;
 	int ch;
 	int i;
 
@@ -443,15 +522,14 @@ int main(int argc, char **argv)
 		case OptHelp:
 			usage();
 			return 0;
-		case OptSetDevice:
-			device = optarg;
-			if (device[0] >= '0' && device[0] <= '9' && device.length() <= 3) {
-				static char newdev[20];
+		case OptSetDevice: {
+			std::string device = optarg;
 
-				sprintf(newdev, "/dev/cec%s", optarg);
-				device = newdev;
-			}
+			if (device[0] >= '0' && device[0] <= '9' && device.length() <= 3)
+				device = std::string("/dev/cec") + optarg;
+			devices.push_back(device);
 			break;
+		}
 		case OptSetDriver:
 			driver = optarg;
 			break;
@@ -545,82 +623,47 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	if (device.empty() && (driver || adapter)) {
-		device = cec_device_find(driver, adapter);
+	if (options[OptAllDevices]) {
+		devices = cec_devices_find(driver, adapter);
+		if (devices.empty()) {
+			fprintf(stderr, "Could not find any CEC device\n");
+			std::exit(EXIT_FAILURE);
+		}
+	} else if (devices.empty() && (driver || adapter)) {
+		std::string device = cec_device_find(driver, adapter);
+
 		if (device.empty()) {
 			fprintf(stderr,
 				"Could not find a CEC device for the given driver/adapter combination\n");
 			std::exit(EXIT_FAILURE);
 		}
+		devices.push_back(device);
 	}
-	if (device.empty())
-		device = "/dev/cec0";
-
-	if ((fd = open(device.c_str(), O_RDWR)) < 0) {
-		fprintf(stderr, "Failed to open %s: %s\n", device.c_str(),
-			strerror(errno));
-		std::exit(EXIT_FAILURE);
-	}
-
-	struct cec_caps caps = { };
-
-	node.fd = fd;
-	node.device = device.c_str();
-	doioctl(&node, CEC_ADAP_G_CAPS, &caps);
-	node.caps = caps.capabilities;
-	node.available_log_addrs = caps.available_log_addrs;
-	node.state.service_by_dig_id = options[OptServiceByDigID];
-	node.state.toggle_power_status = toggle_power_status;
-	state_init(node);
+	if (devices.empty())
+		devices.emplace_back("/dev/cec0");
 
 	if (strlen(STRING(GIT_SHA)))
 		printf("cec-follower SHA                   : %s %s\n",
 		       STRING(GIT_SHA), STRING(GIT_COMMIT_DATE));
 
-	doioctl(&node, CEC_ADAP_G_PHYS_ADDR, &node.phys_addr);
-
-	struct cec_log_addrs laddrs = { };
-	doioctl(&node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
-	node.adap_la_mask = laddrs.log_addr_mask;
-	node.cec_version = laddrs.cec_version;
-
-	struct cec_connector_info conn_info = {};
-
-	doioctl(&node, CEC_ADAP_G_CONNECTOR_INFO, &conn_info);
-
-	cec_driver_info(caps, laddrs, node.phys_addr, conn_info);
-
 	/*
-	 * For CEC 1.4, features of a logical address may still be
-	 * filled in according to the CEC 2.0 guidelines even though
-	 * the CEC framework won’t use the features in the CEC 2.0
-	 * CEC_MSG_REPORT_FEATURES.
+	 * The nodes point to the device names, and testProcessing() keeps
+	 * pointers to the nodes, so neither vector may grow after this.
 	 */
-	bool is_dev_feat = false;
-
-	for (__u8 byte : laddrs.features[0]) {
-		if (is_dev_feat) {
-			node.source_has_arc_rx = (byte & CEC_OP_FEAT_DEV_SOURCE_HAS_ARC_RX) != 0;
-			node.sink_has_arc_tx = (byte & CEC_OP_FEAT_DEV_SINK_HAS_ARC_TX) != 0;
-			node.has_aud_rate = (byte & CEC_OP_FEAT_DEV_HAS_SET_AUDIO_RATE) != 0;
-			node.has_deck_ctl = (byte & CEC_OP_FEAT_DEV_HAS_DECK_CONTROL) != 0;
-			node.has_rec_tv = (byte & CEC_OP_FEAT_DEV_HAS_RECORD_TV_SCREEN) != 0;
-			node.has_osd_string = (byte & CEC_OP_FEAT_DEV_HAS_SET_OSD_STRING) != 0;
-			break;
+	std::vector<struct node> nodes;
+
+	nodes.reserve(devices.size());
+	for (const auto &device : devices) {
+		nodes.emplace_back();
+		if (!node_init(nodes.back(), node, device.c_str(), toggle_power_status)) {
+			nodes.pop_back();
+			/* With --all-devices, unconfigured adapters are skipped */
+			if (!options[OptAllDevices])
+				std::exit(EXIT_FAILURE);
 		}
-		if (byte & CEC_OP_FEAT_EXT)
-			continue;
-		if (!is_dev_feat)
-			is_dev_feat = true;
-		else
-			break;
 	}
-	printf("\n");
-
-	if (laddrs.num_log_addrs == 0 && (node.caps & CEC_CAP_LOG_ADDRS)) {
-		printf("\nFAIL: missing logical address(es), use cec-ctl to configure this\n");
+	if (nodes.empty())
 		std::exit(EXIT_FAILURE);
-	}
 
-	testProcessing(&node, options[OptExclusive], options[OptWallClock]);
+	testProcessing(nodes.data(), nodes.size(), options[OptExclusive], options[OptWallClock]);
 }
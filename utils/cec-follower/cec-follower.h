@@ -21,7 +21,6 @@ extern bool show_msgs;
 extern bool show_state;
 extern bool show_warnings;
 extern unsigned warnings;
-extern std::set<struct Timer> programmed_timers;
 extern void print_timers(struct node *node);
 
 struct state {
@@ -59,33 +58,6 @@ struct state {
 	__u64 last_aud_rate_rx_ts;
 };
 
-struct node {
-	int fd;
-	const char *device;
-	unsigned caps;
-	unsigned available_log_addrs;
-	__u8 remote_prim_devtype[15];
-	unsigned adap_la_mask;
-	unsigned remote_la_mask;
-	__u16 remote_phys_addr[15];
-	struct state state;
-	__u16 phys_addr;
-	__u8 cec_version;
-	bool source_has_arc_rx;
-	bool sink_has_arc_tx;
-	bool has_aud_rate;
-	bool has_deck_ctl;
-	bool has_rec_tv;
-	bool has_osd_string;
-
-	bool ignore_la[16];
-	unsigned short ignore_opcode[256];
-	unsigned standby_cnt;
-	unsigned ignore_standby;
-	unsigned view_on_cnt;
-	unsigned ignore_view_on;
-};
-
 struct Timer {
 	time_t start_time;
 	time_t duration; /* In seconds. */
@@ -133,7 +105,57 @@ struct la_info {
 	__u16 phys_addr;
 };
 
-extern struct la_info la_info[15];
+/* Periodic state machines of a node, scheduled by testProcessing() */
+enum node_timer {
+	TIMER_PWR_STATE,
+	TIMER_TOGGLE_PWR,
+	TIMER_POLL,
+	TIMER_RC,
+	TIMER_AUD_RATE,
+	TIMER_DECK_SKIP,
+	TIMER_PROG_TIMERS,
+	TIMER_NUM
+};
+
+struct node {
+	int fd;
+	const char *device;
+	unsigned caps;
+	unsigned available_log_addrs;
+	__u8 remote_prim_devtype[15];
+	unsigned adap_la_mask;
+	unsigned remote_la_mask;
+	__u16 remote_phys_addr[15];
+	struct state state;
+	__u16 phys_addr;
+	__u8 cec_version;
+	bool source_has_arc_rx;
+	bool sink_has_arc_tx;
+	bool has_aud_rate;
+	bool has_deck_ctl;
+	bool has_rec_tv;
+	bool has_osd_string;
+
+	bool ignore_la[16];
+	unsigned short ignore_opcode[256];
+	unsigned standby_cnt;
+	unsigned ignore_standby;
+	unsigned view_on_cnt;
+	unsigned ignore_view_on;
+
+	std::set<struct Timer> programmed_timers;
+	struct la_info la_info[15];
+
+	/* Message loop state */
+	unsigned me;
+	__u8 type;
+	unsigned last_poll_s;
+	__u8 last_pwr_state;
+	time_t last_pwr_status_toggle;
+	/* CLOCK_MONOTONIC deadline of each node_timer, 0 if not scheduled */
+	__u64 timers[TIMER_NUM];
+};
+
 
 struct short_audio_desc {
 	/* Byte 1 */
@@ -232,10 +254,10 @@ struct short_audio_desc {
 		}							\
 	} while (0)
 
-int cec_named_ioctl(int fd, const char *name,
+int cec_named_ioctl(struct node *node, const char *name,
 		    unsigned long int request, void *parm);
 
-#define doioctl(n, r, p) cec_named_ioctl((n)->fd, #r, r, p)
+#define doioctl(n, r, p) cec_named_ioctl(n, #r, r, p)
 
 #define transmit(n, m) (doioctl(n, CEC_TRANSMIT, m))
 
@@ -278,7 +300,7 @@ void process_timer_msgs(struct node *node, struct cec_msg &msg, unsigned me, __u
 // CEC processing
 void reply_feature_abort(struct node *node, struct cec_msg *msg,
 			 __u8 reason = CEC_OP_ABORT_UNRECOGNIZED_OP);
-void testProcessing(struct node *node, bool exclusive, bool wallclock);
+void testProcessing(struct node *nodes, unsigned num_nodes, bool exclusive, bool wallclock);
 bool enter_standby(struct node *node);
 
 #endif
@@ -5,10 +5,16 @@
 
 #include <cerrno>
 #include <ctime>
+#include <functional>
+#include <queue>
 #include <string>
+#include <vector>
 
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "cec-follower.h"
 #include "compiler.h"
@@ -40,8 +46,6 @@ struct cec_enum_values {
 	__u8 value;
 };
 
-struct la_info la_info[15];
-
 static struct timespec start_monotonic;
 static struct timeval start_timeofday;
 static constexpr time_t time_to_transient = 1;
@@ -123,8 +127,8 @@ void reply_feature_abort(struct node *node, struct cec_msg *msg, __u8 reason)
 	if (cec_msg_is_broadcast(msg) || cec_msg_initiator(msg) == CEC_LOG_ADDR_UNREGISTERED)
 		return;
 	if (reason == CEC_OP_ABORT_UNRECOGNIZED_OP) {
-		la_info[la].feature_aborted[opcode].count++;
-		if (la_info[la].feature_aborted[opcode].count == 2) {
+		node->la_info[la].feature_aborted[opcode].count++;
+		if (node->la_info[la].feature_aborted[opcode].count == 2) {
 			/* If the Abort Reason was "Unrecognized opcode", the Initiator should not send
 			   the same message to the same Follower again at that time to avoid saturating
 			   the bus. */
@@ -133,12 +137,12 @@ void reply_feature_abort(struct node *node, struct cec_msg *msg, __u8 reason)
 			warn("replying Feature Abort [Unrecognized Opcode] to the same message.\n");
 		}
 	}
-	else if (la_info[la].feature_aborted[opcode].count) {
+	else if (node->la_info[la].feature_aborted[opcode].count) {
 		warn("Replying Feature Abort with abort reason different than [Unrecognized Opcode]\n");
 		warn("to message that has previously been replied Feature Abort to with [Unrecognized Opcode].\n");
 	}
 	else
-		la_info[la].feature_aborted[opcode].ts = ts_now;
+		node->la_info[la].feature_aborted[opcode].ts = ts_now;
 
 	cec_msg_reply_feature_abort(msg, reason);
 	transmit(node, msg);
@@ -389,7 +393,7 @@ static void processMsg(struct node *node, struct cec_msg &msg, unsigned me, __u8
 	case CEC_MSG_ROUTING_INFORMATION: {
 		__u8 la = cec_msg_initiator(&msg);
 
-		if (cec_has_tv(1 << la) && la_info[la].phys_addr == 0)
+		if (cec_has_tv(1 << la) && node->la_info[la].phys_addr == 0)
 			warn("TV (0) at 0.0.0.0 sent Routing Information.");
 		return;
 	}
@@ -1013,7 +1017,7 @@ static void poll_remote_devs(struct node *node, unsigned me)
 
 static void update_programmed_timers(struct node *node)
 {
-	std::set<struct Timer>::iterator it = programmed_timers.begin();
+	std::set<struct Timer>::iterator it = node->programmed_timers.begin();
 	/* Use the current minute because timers do not have second precision. */
 	time_t current_minute = time(nullptr) / 60;
 	time_t timer_start_minute = it->start_time / 60;
@@ -1029,7 +1033,7 @@ static void update_programmed_timers(struct node *node)
 	/* Delete an overlapped timer. Recording will be at best incomplete. */
 	if (timer_start_minute < current_minute &&
 	    (!node->state.recording_controlled_by_timer || !node->state.one_touch_record_on)) {
-		programmed_timers.erase(*it);
+		node->programmed_timers.erase(*it);
 		if (show_info)
 			printf("Deleted overlapped timer.\n");
 		print_timers(node);
@@ -1061,9 +1065,9 @@ static void update_programmed_timers(struct node *node)
 		last_start_time->tm_mday += days_to_move_ahead;
 		last_start_time->tm_isdst = -1;
 		next_timer.start_time = mktime(last_start_time);
-		programmed_timers.insert(next_timer);
+		node->programmed_timers.insert(next_timer);
 	}
-	programmed_timers.erase(*it);
+	node->programmed_timers.erase(*it);
 	if (show_info)
 		printf("Deleted finished timer.\n");
 	print_timers(node);
@@ -1078,170 +1082,461 @@ static void update_programmed_timers(struct node *node)
 	}
 }
 
-void testProcessing(struct node *node, bool exclusive, bool wallclock)
+/*
+ * Convert a time(nullptr) based time to a CLOCK_MONOTONIC timestamp.
+ * time() may lag behind CLOCK_REALTIME by a tick, so add 1 ms to avoid
+ * waking up just before the second changes.
+ */
+static __u64 wall_to_ts(time_t t)
 {
-	struct cec_log_addrs laddrs;
-	fd_set rd_fds;
-	fd_set ex_fds;
-	int fd = node->fd;
-	__u32 mode = CEC_MODE_INITIATOR |
-		(exclusive ? CEC_MODE_EXCL_FOLLOWER : CEC_MODE_FOLLOWER);
-	unsigned me;
-	unsigned last_poll_la = 15;
-	__u8 last_pwr_state = current_power_state(node);
-	time_t last_pwr_status_toggle = time(nullptr);
+	struct timespec now;
+	__u64 ts_now = get_ts();
 
-	clock_gettime(CLOCK_MONOTONIC, &start_monotonic);
-	gettimeofday(&start_timeofday, nullptr);
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (t <= now.tv_sec)
+		return ts_now + 1000000;
+	return ts_now + (t - now.tv_sec) * 1000000000ULL - now.tv_nsec + 1000000;
+}
+
+static void show_node(struct node *node, unsigned num_nodes)
+{
+	static struct node *last_node;
+
+	if (num_nodes == 1 || node == last_node)
+		return;
+	last_node = node;
+	printf("\n%s:\n", node->device);
+}
+
+static void process_start(struct node *node, __u32 mode)
+{
+	struct cec_log_addrs laddrs;
 
 	doioctl(node, CEC_S_MODE, &mode);
 	doioctl(node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
-	me = laddrs.log_addr[0];
-	__u8 type = laddrs.log_addr_type[0];
+	node->me = laddrs.log_addr[0];
+	node->type = laddrs.log_addr_type[0];
+	node->last_poll_s = ~0U;
+	node->last_pwr_state = current_power_state(node);
+	node->last_pwr_status_toggle = time(nullptr);
 
-	poll_remote_devs(node, me);
+	poll_remote_devs(node, node->me);
+}
 
-	while (true) {
-		int res;
-		struct timeval timeval = {};
+static int process_event(struct node *node, bool wallclock)
+{
+	struct cec_log_addrs laddrs;
+	struct cec_event ev;
+	int res;
+
+	res = doioctl(node, CEC_DQEVENT, &ev);
+	if (res)
+		return res;
+	log_event(ev, wallclock);
+	if (ev.event == CEC_EVENT_STATE_CHANGE) {
+		dev_info("CEC adapter state change.\n");
+		node->phys_addr = ev.state_change.phys_addr;
+		node->adap_la_mask = ev.state_change.log_addr_mask;
+		if (node->adap_la_mask) {
+			doioctl(node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
+			node->me = laddrs.log_addr[0];
+		} else {
+			node->state.active_source_pa = CEC_PHYS_ADDR_INVALID;
+			node->me = CEC_LOG_ADDR_INVALID;
+		}
+		memset(node->la_info, 0, sizeof(node->la_info));
+	}
+	return 0;
+}
 
-		fflush(stdout);
-		timeval.tv_sec = 1;
-		FD_ZERO(&rd_fds);
-		FD_ZERO(&ex_fds);
-		FD_SET(fd, &rd_fds);
-		FD_SET(fd, &ex_fds);
-		res = select(fd + 1, &rd_fds, nullptr, &ex_fds, &timeval);
-		if (res < 0)
-			break;
-		if (FD_ISSET(fd, &ex_fds)) {
-			struct cec_event ev;
+static int process_msg(struct node *node, bool wallclock)
+{
+	struct cec_msg msg = { };
+	int res;
 
-			res = doioctl(node, CEC_DQEVENT, &ev);
-			if (res == ENODEV) {
-				printf("Device was disconnected.\n");
-				break;
-			}
-			if (res)
-				continue;
-			log_event(ev, wallclock);
-			if (ev.event == CEC_EVENT_STATE_CHANGE) {
-				dev_info("CEC adapter state change.\n");
-				node->phys_addr = ev.state_change.phys_addr;
-				node->adap_la_mask = ev.state_change.log_addr_mask;
-				if (node->adap_la_mask) {
-					doioctl(node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
-					me = laddrs.log_addr[0];
-				} else {
-					node->state.active_source_pa = CEC_PHYS_ADDR_INVALID;
-					me = CEC_LOG_ADDR_INVALID;
-				}
-				memset(la_info, 0, sizeof(la_info));
-			}
-		}
-		if (FD_ISSET(fd, &rd_fds)) {
-			struct cec_msg msg = { };
+	res = doioctl(node, CEC_RECEIVE, &msg);
+	if (res)
+		return res;
 
-			res = doioctl(node, CEC_RECEIVE, &msg);
-			if (res == ENODEV) {
-				printf("Device was disconnected.\n");
-				break;
-			}
-			if (res)
-				continue;
+	__u8 from = cec_msg_initiator(&msg);
+	__u8 to = cec_msg_destination(&msg);
+	__u8 opcode = cec_msg_opcode(&msg);
+
+	if (node->ignore_la[from])
+		return 0;
+	if (node->ignore_opcode[msg.msg[1]] & (1 << from))
+		return 0;
+
+	if (from != CEC_LOG_ADDR_UNREGISTERED &&
+	    node->la_info[from].feature_aborted[opcode].ts &&
+	    ts_to_ms(get_ts() - node->la_info[from].feature_aborted[opcode].ts) < 200) {
+		warn("Received message %s from LA %d (%s) less than 200 ms after\n",
+		     opcode2s(&msg).c_str(), from, cec_la2s(from));
+		warn("replying Feature Abort (not [Unrecognized Opcode]) to the same message.\n");
+	}
+	if (from != CEC_LOG_ADDR_UNREGISTERED && !node->la_info[from].ts)
+		dev_info("Logical address %d (%s) discovered.\n", from, cec_la2s(from));
+	if (show_msgs) {
+		printf("    %s to %s (%d to %d): ",
+		       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to);
+		cec_log_msg(&msg);
+		if (show_info)
+			printf("\tSequence: %u Rx Timestamp: %s\n",
+			       msg.sequence, ts2s(msg.rx_ts, wallclock).c_str());
+	}
+	if (node->adap_la_mask)
+		processMsg(node, msg, node->me, node->type);
+	return 0;
+}
 
-			__u8 from = cec_msg_initiator(&msg);
-			__u8 to = cec_msg_destination(&msg);
-			__u8 opcode = cec_msg_opcode(&msg);
+static __u64 pwr_state_deadline(struct node *node, __u64 ts_now)
+{
+	time_t changed = node->state.power_status_changed_time;
+	time_t t = time(nullptr);
 
-			if (node->ignore_la[from])
-				continue;
-			if (node->ignore_opcode[msg.msg[1]] & (1 << from))
-				continue;
+	if (node->cec_version < CEC_OP_CEC_VERSION_2_0)
+		return 0;
+	if (current_power_state(node) != node->last_pwr_state)
+		return ts_now;
+	if (t <= changed + time_to_transient)
+		return wall_to_ts(changed + time_to_transient + 1);
+	if (t < changed + time_to_stable)
+		return wall_to_ts(changed + time_to_stable);
+	return 0;
+}
 
-			if (from != CEC_LOG_ADDR_UNREGISTERED &&
-			    la_info[from].feature_aborted[opcode].ts &&
-			    ts_to_ms(get_ts() - la_info[from].feature_aborted[opcode].ts) < 200) {
-				warn("Received message %s from LA %d (%s) less than 200 ms after\n",
-				     opcode2s(&msg).c_str(), from, cec_la2s(from));
-				warn("replying Feature Abort (not [Unrecognized Opcode]) to the same message.\n");
-			}
-			if (from != CEC_LOG_ADDR_UNREGISTERED && !la_info[from].ts)
-				dev_info("Logical address %d (%s) discovered.\n", from, cec_la2s(from));
-			if (show_msgs) {
-				printf("    %s to %s (%d to %d): ",
-				       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to);
-				cec_log_msg(&msg);
-				if (show_info)
-					printf("\tSequence: %u Rx Timestamp: %s\n",
-					       msg.sequence, ts2s(msg.rx_ts, wallclock).c_str());
-			}
-			if (node->adap_la_mask)
-				processMsg(node, msg, me, type);
-		}
+static void pwr_state_expire(struct node *node, __u64 ts_now)
+{
+	__u8 pwr_state = current_power_state(node);
 
-		__u8 pwr_state = current_power_state(node);
-		if (node->cec_version >= CEC_OP_CEC_VERSION_2_0 &&
-		    last_pwr_state != pwr_state &&
-		    (time_to_stable > 2 || pwr_state < CEC_OP_POWER_STATUS_TO_ON)) {
-			struct cec_msg msg;
+	if (node->last_pwr_state != pwr_state &&
+	    (time_to_stable > 2 || pwr_state < CEC_OP_POWER_STATUS_TO_ON)) {
+		struct cec_msg msg;
 
-			cec_msg_init(&msg, me, CEC_LOG_ADDR_BROADCAST);
-			cec_msg_report_power_status(&msg, pwr_state);
-			transmit(node, &msg);
-			last_pwr_state = pwr_state;
-		}
+		cec_msg_init(&msg, node->me, CEC_LOG_ADDR_BROADCAST);
+		cec_msg_report_power_status(&msg, pwr_state);
+		transmit(node, &msg);
+		node->last_pwr_state = pwr_state;
+	}
+}
 
-		if (node->state.toggle_power_status && cec_has_tv(1 << me) &&
-		    (time(nullptr) - last_pwr_status_toggle > node->state.toggle_power_status)) {
-			last_pwr_status_toggle = time(nullptr);
-			if (pwr_state & 1) // standby or to-standby
-				exit_standby(node);
-			else
-				enter_standby(node);
-		}
+static __u64 toggle_pwr_deadline(struct node *node, __u64 ts_now)
+{
+	if (!node->state.toggle_power_status || !cec_has_tv(1 << node->me))
+		return 0;
+	return wall_to_ts(node->last_pwr_status_toggle +
+			  node->state.toggle_power_status + 1);
+}
 
-		__u64 ts_now = get_ts();
-		unsigned poll_la = ts_to_s(ts_now) % 16;
+static void toggle_pwr_expire(struct node *node, __u64 ts_now)
+{
+	if (time(nullptr) - node->last_pwr_status_toggle <= node->state.toggle_power_status)
+		return;
+	node->last_pwr_status_toggle = time(nullptr);
+	if (current_power_state(node) & 1) // standby or to-standby
+		exit_standby(node);
+	else
+		enter_standby(node);
+}
 
-		if (poll_la != me &&
-		    poll_la != last_poll_la && poll_la < 15 && la_info[poll_la].ts &&
-		    ts_to_ms(ts_now - la_info[poll_la].ts) > POLL_PERIOD) {
-			struct cec_msg msg;
+/*
+ * Each remote logical address is polled in the seconds that match
+ * it modulo 16, once POLL_PERIOD has passed since it was last seen.
+ */
+static __u64 poll_deadline(struct node *node, __u64 ts_now)
+{
+	__u64 deadline = 0;
 
-			cec_msg_init(&msg, me, poll_la);
-			transmit(node, &msg);
-			if (msg.tx_status & CEC_TX_STATUS_NACK) {
-				dev_info("Logical address %d stopped responding to polling message.\n", poll_la);
-				memset(&la_info[poll_la], 0, sizeof(la_info[poll_la]));
-				node->remote_la_mask &= ~(1 << poll_la);
-				node->remote_phys_addr[poll_la] = CEC_PHYS_ADDR_INVALID;
-			}
-		}
-		last_poll_la = poll_la;
+	for (unsigned la = 0; la < 15; la++) {
+		if (la == node->me || !node->la_info[la].ts)
+			continue;
 
-		unsigned ms_since_press = ts_to_ms(ts_now - node->state.rc_press_rx_ts);
+		__u64 ts = node->la_info[la].ts + (POLL_PERIOD + 1) * 1000000ULL;
 
-		if (ms_since_press > FOLLOWER_SAFETY_TIMEOUT) {
-			if (node->state.rc_state == PRESS_HOLD)
-				rc_press_hold_stop(&node->state);
-			else if (node->state.rc_state == PRESS) {
-				dev_info("Button timeout: %s\n", get_ui_cmd_string(node->state.rc_ui_cmd));
-				node->state.rc_state = NOPRESS;
-			}
+		if (ts < ts_now)
+			ts = ts_now;
+
+		unsigned s = ts_to_s(ts);
+		unsigned poll_s = s + (la + 16 - s % 16) % 16;
+
+		if (poll_s == node->last_poll_s)
+			poll_s += 16;
+		if (poll_s != s)
+			ts = poll_s * 1000000000ULL;
+		if (!deadline || ts < deadline)
+			deadline = ts;
+	}
+	return deadline;
+}
+
+static void poll_expire(struct node *node, __u64 ts_now)
+{
+	unsigned poll_la = ts_to_s(ts_now) % 16;
+
+	if (poll_la == node->me || ts_to_s(ts_now) == node->last_poll_s ||
+	    poll_la >= 15 || !node->la_info[poll_la].ts ||
+	    ts_to_ms(ts_now - node->la_info[poll_la].ts) <= POLL_PERIOD)
+		return;
+
+	struct cec_msg msg;
+
+	node->last_poll_s = ts_to_s(ts_now);
+	cec_msg_init(&msg, node->me, poll_la);
+	transmit(node, &msg);
+	if (msg.tx_status & CEC_TX_STATUS_NACK) {
+		dev_info("Logical address %d stopped responding to polling message.\n", poll_la);
+		memset(&node->la_info[poll_la], 0, sizeof(node->la_info[poll_la]));
+		node->remote_la_mask &= ~(1 << poll_la);
+		node->remote_phys_addr[poll_la] = CEC_PHYS_ADDR_INVALID;
+	}
+}
+
+static __u64 rc_deadline(struct node *node, __u64 ts_now)
+{
+	__u64 ts = node->state.rc_press_rx_ts + (FOLLOWER_SAFETY_TIMEOUT + 1) * 1000000ULL;
+
+	/* A Press and Hold stays in that state after the timeout, so only wait for it once */
+	if (node->state.rc_state == NOPRESS || ts <= ts_now)
+		return 0;
+	return ts;
+}
+
+static void rc_expire(struct node *node, __u64 ts_now)
+{
+	if (ts_to_ms(ts_now - node->state.rc_press_rx_ts) <= FOLLOWER_SAFETY_TIMEOUT)
+		return;
+	if (node->state.rc_state == PRESS_HOLD)
+		rc_press_hold_stop(&node->state);
+	else if (node->state.rc_state == PRESS) {
+		dev_info("Button timeout: %s\n", get_ui_cmd_string(node->state.rc_ui_cmd));
+		node->state.rc_state = NOPRESS;
+	}
+}
+
+static __u64 aud_rate_deadline(struct node *node, __u64 ts_now)
+{
+	if (!node->has_aud_rate || !node->state.last_aud_rate_rx_ts)
+		return 0;
+	return node->state.last_aud_rate_rx_ts + MAX_AUD_RATE_MSG_INTERVAL_NS + 1;
+}
+
+static void aud_rate_expire(struct node *node, __u64 ts_now)
+{
+	aud_rate_msg_interval_check(node, ts_now);
+}
+
+static __u64 deck_skip_deadline(struct node *node, __u64 ts_now)
+{
+	if (!node->state.deck_skip_start)
+		return 0;
+	return node->state.deck_skip_start + MAX_DECK_SKIP_NS + 1;
+}
+
+static void deck_skip_expire(struct node *node, __u64 ts_now)
+{
+	if (node->state.deck_skip_start && ts_now - node->state.deck_skip_start > MAX_DECK_SKIP_NS) {
+		node->state.deck_skip_start = 0;
+		update_deck_state(node, node->me, CEC_OP_DECK_INFO_PLAY);
+	}
+}
+
+static __u64 prog_timers_deadline(struct node *node, __u64 ts_now)
+{
+	if (node->programmed_timers.empty())
+		return 0;
+	/* Timers have a precision of one minute */
+	return wall_to_ts((time(nullptr) / 60 + 1) * 60);
+}
+
+static void prog_timers_expire(struct node *node, __u64 ts_now)
+{
+	if (!node->programmed_timers.empty())
+		update_programmed_timers(node);
+}
+
+static const struct {
+	/* CLOCK_MONOTONIC time when expire() is due, or 0 if it isn't needed */
+	__u64 (*deadline)(struct node *node, __u64 ts_now);
+	void (*expire)(struct node *node, __u64 ts_now);
+} timer_ops[TIMER_NUM] = {
+	{ pwr_state_deadline, pwr_state_expire }, /* TIMER_PWR_STATE */
+	{ toggle_pwr_deadline, toggle_pwr_expire }, /* TIMER_TOGGLE_PWR */
+	{ poll_deadline, poll_expire }, /* TIMER_POLL */
+	{ rc_deadline, rc_expire }, /* TIMER_RC */
+	{ aud_rate_deadline, aud_rate_expire }, /* TIMER_AUD_RATE */
+	{ deck_skip_deadline, deck_skip_expire }, /* TIMER_DECK_SKIP */
+	{ prog_timers_deadline, prog_timers_expire }, /* TIMER_PROG_TIMERS */
+};
+
+/*
+ * The timers of all nodes are kept in a min-heap, and a single timerfd
+ * is armed for the earliest one. Rescheduling a timer just pushes a new
+ * entry: entries whose deadline no longer matches node->timers[] are
+ * dropped when they reach the top.
+ */
+struct timer_entry {
+	__u64 deadline;
+	struct node *node;
+	unsigned timer;
+
+	bool operator>(const timer_entry &r) const
+	{
+		return deadline > r.deadline;
+	}
+};
+
+static std::priority_queue<timer_entry, std::vector<timer_entry>,
+			   std::greater<timer_entry>> timer_queue;
+
+static bool timer_entry_valid(const timer_entry &e)
+{
+	return e.node->fd >= 0 && e.node->timers[e.timer] == e.deadline;
+}
+
+static void schedule_timers(struct node *node)
+{
+	__u64 ts_now = get_ts();
+
+	for (unsigned i = 0; i < TIMER_NUM; i++) {
+		__u64 deadline = timer_ops[i].deadline(node, ts_now);
+
+		if (deadline == node->timers[i])
+			continue;
+		node->timers[i] = deadline;
+		if (deadline)
+			timer_queue.push({ deadline, node, i });
+	}
+}
+
+static void run_timers()
+{
+	__u64 ts_now = get_ts();
+
+	while (!timer_queue.empty() && timer_queue.top().deadline <= ts_now) {
+		timer_entry e = timer_queue.top();
+
+		timer_queue.pop();
+		if (!timer_entry_valid(e))
+			continue;
+		e.node->timers[e.timer] = 0;
+		timer_ops[e.timer].expire(e.node, ts_now);
+		schedule_timers(e.node);
+	}
+}
+
+static void arm_timer(int timer_fd)
+{
+	struct itimerspec its = {};
+
+	while (!timer_queue.empty() && !timer_entry_valid(timer_queue.top()))
+		timer_queue.pop();
+	if (!timer_queue.empty()) {
+		__u64 deadline = timer_queue.top().deadline;
+
+		its.it_value.tv_sec = deadline / 1000000000ULL;
+		its.it_value.tv_nsec = deadline % 1000000000ULL;
+		/* An all-zero it_value would disarm the timer */
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+static void process_stop(struct node *node, int epfd)
+{
+	__u32 mode = CEC_MODE_INITIATOR;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, node->fd, nullptr);
+	doioctl(node, CEC_S_MODE, &mode);
+	close(node->fd);
+	node->fd = -1;
+}
+
+void testProcessing(struct node *nodes, unsigned num_nodes, bool exclusive, bool wallclock)
+{
+	struct epoll_event events[16];
+	struct epoll_event ev = {};
+	__u32 mode = CEC_MODE_INITIATOR |
+		(exclusive ? CEC_MODE_EXCL_FOLLOWER : CEC_MODE_FOLLOWER);
+	unsigned active = num_nodes;
+	int timer_fd;
+	int epfd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start_monotonic);
+	gettimeofday(&start_timeofday, nullptr);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (epfd < 0 || timer_fd < 0) {
+		perror("epoll_create1/timerfd_create");
+		return;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u64 = ~0ULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+	for (unsigned i = 0; i < num_nodes; i++) {
+		struct node *node = &nodes[i];
+
+		ev.events = EPOLLIN | EPOLLPRI;
+		ev.data.u64 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, node->fd, &ev);
+
+		process_start(node, mode);
+		schedule_timers(node);
+	}
+
+	while (active) {
+		bool timer_expired = false;
+		int n;
+
+		arm_timer(timer_fd);
+		fflush(stdout);
+		n = epoll_wait(epfd, events, 16, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
 		}
+		/* Reply to messages first, the timers can wait a little */
+		for (int e = 0; e < n; e++) {
+			if (events[e].data.u64 == ~0ULL) {
+				timer_expired = true;
+				continue;
+			}
 
-		if (node->has_aud_rate)
-			aud_rate_msg_interval_check(node, ts_now);
+			struct node *node = &nodes[events[e].data.u64];
+			int res = 0;
 
-		if (node->state.deck_skip_start && ts_now - node->state.deck_skip_start > MAX_DECK_SKIP_NS) {
-			node->state.deck_skip_start = 0;
-			update_deck_state(node, me, CEC_OP_DECK_INFO_PLAY);
+			if (node->fd < 0)
+				continue;
+
+			show_node(node, num_nodes);
+			if (events[e].events & (EPOLLPRI | EPOLLERR))
+				res = process_event(node, wallclock);
+			if (res != ENODEV && (events[e].events & EPOLLIN))
+				res = process_msg(node, wallclock);
+			if (res == ENODEV) {
+				printf("Device was disconnected.\n");
+				process_stop(node, epfd);
+				active--;
+				continue;
+			}
+			schedule_timers(node);
 		}
+		if (timer_expired) {
+			__u64 expirations;
 
-		if (!programmed_timers.empty())
-			update_programmed_timers(node);
+			if (read(timer_fd, &expirations, sizeof(expirations)) < 0 &&
+			    errno != EAGAIN)
+				perror("timerfd read");
+		}
+		run_timers();
 	}
-	mode = CEC_MODE_INITIATOR;
-	doioctl(node, CEC_S_MODE, &mode);
+
+	for (unsigned i = 0; i < num_nodes; i++)
+		if (nodes[i].fd >= 0)
+			process_stop(&nodes[i], epfd);
+	close(timer_fd);
+	close(epfd);
 }
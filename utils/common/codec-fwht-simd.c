@@ -0,0 +1,658 @@
+// SPDX-License-Identifier: LGPL-2.1+
+/*
+ * SSE2 and NEON versions of the transform, quantization and block type
+ * kernels of codec-fwht.c.
+ *
+ * An 8x8 block is kept in 8 vectors of 8 16 bit values, one per row. All
+ * arithmetic wraps at 16 bits, just like storing the results in the s16
+ * blocks of the C code does, so the results are bit-exact and the stream
+ * format does not change. The kernels return true when they did the work
+ * and false when there is no SIMD support, in which case the C code in
+ * codec-fwht.c does it.
+ */
+
+#include "codec-fwht.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FWHT_SIMD_X86
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define FWHT_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/* These must match quant_table and quant_table_p in codec-fwht.c */
+#define QUANT_TABLE(Q) { \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(3), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(2), Q(3), Q(6), \
+	Q(2), Q(2), Q(2), Q(2), Q(2), Q(3), Q(6), Q(6), \
+	Q(2), Q(2), Q(2), Q(2), Q(3), Q(6), Q(6), Q(6), \
+	Q(2), Q(2), Q(2), Q(3), Q(6), Q(6), Q(6), Q(6), \
+	Q(2), Q(2), Q(3), Q(6), Q(6), Q(6), Q(6), Q(8), \
+}
+
+#define QUANT_TABLE_P(Q) { \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(6), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(3), Q(6), Q(6), \
+	Q(3), Q(3), Q(3), Q(3), Q(3), Q(6), Q(6), Q(9), \
+	Q(3), Q(3), Q(3), Q(3), Q(6), Q(6), Q(9), Q(9), \
+	Q(3), Q(3), Q(3), Q(6), Q(6), Q(9), Q(9), Q(10), \
+}
+
+/* Gather the 8 pixels of a row of a block of a packed format */
+static inline void gather_row(const u8 *input, unsigned int input_step,
+			      u8 *row)
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, input += input_step)
+		row[i] = *input;
+}
+
+#ifdef FWHT_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+
+/*
+ * SSE2 can not shift each value by its own amount, multiplying by
+ * 2^(16 - q) and keeping the high 16 bits does the same for the
+ * 2 <= q <= 15 the tables use.
+ */
+#define QUANT_DIV(q) (1 << (16 - (q)))
+#define QUANT_MUL(q) (1 << (q))
+
+static const s16 quant_div[2][64] = {
+	QUANT_TABLE_P(QUANT_DIV), QUANT_TABLE(QUANT_DIV)
+};
+static const s16 quant_mul[2][64] = {
+	QUANT_TABLE_P(QUANT_MUL), QUANT_TABLE(QUANT_MUL)
+};
+
+/* The 3 stages of an 8 point transform, done on 8 vectors at once */
+static inline SSE2 void butterfly8_sse2(__m128i *v)
+{
+	__m128i w1[8], w2[8];
+
+	w1[0] = _mm_add_epi16(v[0], v[1]);
+	w1[1] = _mm_sub_epi16(v[0], v[1]);
+	w1[2] = _mm_add_epi16(v[2], v[3]);
+	w1[3] = _mm_sub_epi16(v[2], v[3]);
+	w1[4] = _mm_add_epi16(v[4], v[5]);
+	w1[5] = _mm_sub_epi16(v[4], v[5]);
+	w1[6] = _mm_add_epi16(v[6], v[7]);
+	w1[7] = _mm_sub_epi16(v[6], v[7]);
+
+	w2[0] = _mm_add_epi16(w1[0], w1[2]);
+	w2[1] = _mm_sub_epi16(w1[0], w1[2]);
+	w2[2] = _mm_sub_epi16(w1[1], w1[3]);
+	w2[3] = _mm_add_epi16(w1[1], w1[3]);
+	w2[4] = _mm_add_epi16(w1[4], w1[6]);
+	w2[5] = _mm_sub_epi16(w1[4], w1[6]);
+	w2[6] = _mm_sub_epi16(w1[5], w1[7]);
+	w2[7] = _mm_add_epi16(w1[5], w1[7]);
+
+	v[0] = _mm_add_epi16(w2[0], w2[4]);
+	v[1] = _mm_sub_epi16(w2[0], w2[4]);
+	v[2] = _mm_sub_epi16(w2[1], w2[5]);
+	v[3] = _mm_add_epi16(w2[1], w2[5]);
+	v[4] = _mm_add_epi16(w2[2], w2[6]);
+	v[5] = _mm_sub_epi16(w2[2], w2[6]);
+	v[6] = _mm_sub_epi16(w2[3], w2[7]);
+	v[7] = _mm_add_epi16(w2[3], w2[7]);
+}
+
+static inline SSE2 void transpose8x8_16_sse2(__m128i *v)
+{
+	__m128i t0 = _mm_unpacklo_epi16(v[0], v[1]);
+	__m128i t1 = _mm_unpackhi_epi16(v[0], v[1]);
+	__m128i t2 = _mm_unpacklo_epi16(v[2], v[3]);
+	__m128i t3 = _mm_unpackhi_epi16(v[2], v[3]);
+	__m128i t4 = _mm_unpacklo_epi16(v[4], v[5]);
+	__m128i t5 = _mm_unpackhi_epi16(v[4], v[5]);
+	__m128i t6 = _mm_unpacklo_epi16(v[6], v[7]);
+	__m128i t7 = _mm_unpackhi_epi16(v[6], v[7]);
+	__m128i u0 = _mm_unpacklo_epi32(t0, t2);
+	__m128i u1 = _mm_unpackhi_epi32(t0, t2);
+	__m128i u2 = _mm_unpacklo_epi32(t1, t3);
+	__m128i u3 = _mm_unpackhi_epi32(t1, t3);
+	__m128i u4 = _mm_unpacklo_epi32(t4, t6);
+	__m128i u5 = _mm_unpackhi_epi32(t4, t6);
+	__m128i u6 = _mm_unpacklo_epi32(t5, t7);
+	__m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+	v[0] = _mm_unpacklo_epi64(u0, u4);
+	v[1] = _mm_unpackhi_epi64(u0, u4);
+	v[2] = _mm_unpacklo_epi64(u1, u5);
+	v[3] = _mm_unpackhi_epi64(u1, u5);
+	v[4] = _mm_unpacklo_epi64(u2, u6);
+	v[5] = _mm_unpackhi_epi64(u2, u6);
+	v[6] = _mm_unpacklo_epi64(u3, u7);
+	v[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+/*
+ * The C code first transforms the rows and then the columns. Transposing
+ * before each pass lets both passes work on whole vectors.
+ */
+static inline SSE2 void transform_sse2(__m128i *v)
+{
+	transpose8x8_16_sse2(v);
+	butterfly8_sse2(v);
+	transpose8x8_16_sse2(v);
+	butterfly8_sse2(v);
+}
+
+static inline SSE2 __m128i load_row_sse2(const u8 *input,
+					 unsigned int input_step)
+{
+	u8 row[8];
+
+	if (input_step != 1) {
+		gather_row(input, input_step, row);
+		input = row;
+	}
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)input),
+				 _mm_setzero_si128());
+}
+
+static SSE2 void fwht_sse2(const u8 *block, s16 *output_block,
+			   unsigned int stride, unsigned int input_step,
+			   bool intra)
+{
+	/* Subtracting 256 from each sum of 2 pixels equals this */
+	const __m128i add = _mm_set1_epi16(intra ? 128 : 0);
+	__m128i v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, block += stride)
+		v[i] = _mm_sub_epi16(load_row_sse2(block, input_step), add);
+	transform_sse2(v);
+	for (i = 0; i < 8; i++)
+		_mm_storeu_si128((__m128i *)(output_block + i * 8), v[i]);
+}
+
+static SSE2 void fwht16_sse2(const s16 *block, s16 *output_block, int stride)
+{
+	__m128i v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, block += stride)
+		v[i] = _mm_loadu_si128((const __m128i *)block);
+	transform_sse2(v);
+	for (i = 0; i < 8; i++)
+		_mm_storeu_si128((__m128i *)(output_block + i * 8), v[i]);
+}
+
+static SSE2 void ifwht_sse2(const s16 *block, s16 *output_block, int intra)
+{
+	const __m128i add = _mm_set1_epi16(intra ? 128 : 0);
+	__m128i v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		v[i] = _mm_loadu_si128((const __m128i *)(block + i * 8));
+	transform_sse2(v);
+	for (i = 0; i < 8; i++)
+		_mm_storeu_si128((__m128i *)(output_block + i * 8),
+				 _mm_add_epi16(_mm_srai_epi16(v[i], 6), add));
+}
+
+static SSE2 void quantize_sse2(s16 *coeff, s16 *de_coeff, u16 qp, bool intra)
+{
+	const __m128i max = _mm_set1_epi16(qp);
+	const __m128i min = _mm_set1_epi16(-qp);
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(coeff + i));
+		__m128i keep;
+
+		c = _mm_mulhi_epi16(c, _mm_loadu_si128((const __m128i *)
+						       (quant_div[intra] + i)));
+		keep = _mm_or_si128(_mm_cmpgt_epi16(c, max),
+				    _mm_cmplt_epi16(c, min));
+		c = _mm_and_si128(c, keep);
+		_mm_storeu_si128((__m128i *)(coeff + i), c);
+		_mm_storeu_si128((__m128i *)(de_coeff + i),
+				 _mm_mullo_epi16(c, _mm_loadu_si128((const __m128i *)
+								    (quant_mul[intra] + i))));
+	}
+}
+
+static SSE2 void dequantize_sse2(s16 *coeff, bool intra)
+{
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(coeff + i));
+
+		c = _mm_mullo_epi16(c, _mm_loadu_si128((const __m128i *)
+						       (quant_mul[intra] + i)));
+		_mm_storeu_si128((__m128i *)(coeff + i), c);
+	}
+}
+
+static inline SSE2 int hsum_sad_sse2(__m128i sad)
+{
+	return _mm_cvtsi128_si32(_mm_add_epi32(sad, _mm_srli_si128(sad, 8)));
+}
+
+static SSE2 void var_sse2(const u8 *cur, const u8 *reference,
+			  s16 *deltablock, unsigned int stride,
+			  unsigned int input_step, int *vari, int *vard)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i c[4], sum = zero, sad = zero, mean;
+	const __m128i *ref = (const __m128i *)reference;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++, cur += 2 * stride) {
+		__m128i r = _mm_loadu_si128(ref + i);
+		u8 row[16];
+
+		if (input_step != 1) {
+			gather_row(cur, input_step, row);
+			gather_row(cur + stride, input_step, row + 8);
+		} else {
+			memcpy(row, cur, 8);
+			memcpy(row + 8, cur + stride, 8);
+		}
+		c[i] = _mm_loadu_si128((const __m128i *)row);
+		sum = _mm_add_epi32(sum, _mm_sad_epu8(c[i], zero));
+		sad = _mm_add_epi32(sad, _mm_sad_epu8(c[i], r));
+		_mm_storeu_si128((__m128i *)(deltablock + i * 16),
+				 _mm_sub_epi16(_mm_unpacklo_epi8(c[i], zero),
+					       _mm_unpacklo_epi8(r, zero)));
+		_mm_storeu_si128((__m128i *)(deltablock + i * 16 + 8),
+				 _mm_sub_epi16(_mm_unpackhi_epi8(c[i], zero),
+					       _mm_unpackhi_epi8(r, zero)));
+	}
+
+	/* The mean of 8 bit values always fits in 8 bits */
+	mean = _mm_set1_epi8(hsum_sad_sse2(sum) / 64);
+	sum = zero;
+	for (i = 0; i < 4; i++)
+		sum = _mm_add_epi32(sum, _mm_sad_epu8(c[i], mean));
+	*vari = hsum_sad_sse2(sum);
+	*vard = hsum_sad_sse2(sad);
+}
+
+static SSE2 void add_deltas_sse2(s16 *deltas, const u8 *ref, int stride)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, ref += stride) {
+		__m128i d = _mm_loadu_si128((const __m128i *)(deltas + i * 8));
+
+		d = _mm_add_epi16(d, _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)ref), zero));
+		/* Clamp to 0 - 255 */
+		d = _mm_unpacklo_epi8(_mm_packus_epi16(d, d), zero);
+		_mm_storeu_si128((__m128i *)(deltas + i * 8), d);
+	}
+}
+
+static SSE2 void fill_decoder_block_sse2(u8 *dst, const s16 *input, int stride)
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, dst += stride) {
+		__m128i d = _mm_loadu_si128((const __m128i *)(input + i * 8));
+
+		_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(d, d));
+	}
+}
+
+#endif /* FWHT_SIMD_X86 */
+
+#ifdef FWHT_SIMD_NEON
+
+/* Negative shifts shift right */
+#define QUANT_SHIFT(q) (q)
+
+static const s16 quant_shift[2][64] = {
+	QUANT_TABLE_P(QUANT_SHIFT), QUANT_TABLE(QUANT_SHIFT)
+};
+
+static inline void butterfly8_neon(int16x8_t *v)
+{
+	int16x8_t w1[8], w2[8];
+
+	w1[0] = vaddq_s16(v[0], v[1]);
+	w1[1] = vsubq_s16(v[0], v[1]);
+	w1[2] = vaddq_s16(v[2], v[3]);
+	w1[3] = vsubq_s16(v[2], v[3]);
+	w1[4] = vaddq_s16(v[4], v[5]);
+	w1[5] = vsubq_s16(v[4], v[5]);
+	w1[6] = vaddq_s16(v[6], v[7]);
+	w1[7] = vsubq_s16(v[6], v[7]);
+
+	w2[0] = vaddq_s16(w1[0], w1[2]);
+	w2[1] = vsubq_s16(w1[0], w1[2]);
+	w2[2] = vsubq_s16(w1[1], w1[3]);
+	w2[3] = vaddq_s16(w1[1], w1[3]);
+	w2[4] = vaddq_s16(w1[4], w1[6]);
+	w2[5] = vsubq_s16(w1[4], w1[6]);
+	w2[6] = vsubq_s16(w1[5], w1[7]);
+	w2[7] = vaddq_s16(w1[5], w1[7]);
+
+	v[0] = vaddq_s16(w2[0], w2[4]);
+	v[1] = vsubq_s16(w2[0], w2[4]);
+	v[2] = vsubq_s16(w2[1], w2[5]);
+	v[3] = vaddq_s16(w2[1], w2[5]);
+	v[4] = vaddq_s16(w2[2], w2[6]);
+	v[5] = vsubq_s16(w2[2], w2[6]);
+	v[6] = vsubq_s16(w2[3], w2[7]);
+	v[7] = vaddq_s16(w2[3], w2[7]);
+}
+
+static inline void transpose8x8_16_neon(int16x8_t *v)
+{
+	int16x8x2_t t01 = vtrnq_s16(v[0], v[1]);
+	int16x8x2_t t23 = vtrnq_s16(v[2], v[3]);
+	int16x8x2_t t45 = vtrnq_s16(v[4], v[5]);
+	int16x8x2_t t67 = vtrnq_s16(v[6], v[7]);
+	int32x4x2_t u02 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]),
+				    vreinterpretq_s32_s16(t23.val[0]));
+	int32x4x2_t u13 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]),
+				    vreinterpretq_s32_s16(t23.val[1]));
+	int32x4x2_t u46 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]),
+				    vreinterpretq_s32_s16(t67.val[0]));
+	int32x4x2_t u57 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]),
+				    vreinterpretq_s32_s16(t67.val[1]));
+
+	v[0] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(u02.val[0]),
+						  vget_low_s32(u46.val[0])));
+	v[1] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(u13.val[0]),
+						  vget_low_s32(u57.val[0])));
+	v[2] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(u02.val[1]),
+						  vget_low_s32(u46.val[1])));
+	v[3] = vreinterpretq_s16_s32(vcombine_s32(vget_low_s32(u13.val[1]),
+						  vget_low_s32(u57.val[1])));
+	v[4] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(u02.val[0]),
+						  vget_high_s32(u46.val[0])));
+	v[5] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(u13.val[0]),
+						  vget_high_s32(u57.val[0])));
+	v[6] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(u02.val[1]),
+						  vget_high_s32(u46.val[1])));
+	v[7] = vreinterpretq_s16_s32(vcombine_s32(vget_high_s32(u13.val[1]),
+						  vget_high_s32(u57.val[1])));
+}
+
+static inline void transform_neon(int16x8_t *v)
+{
+	transpose8x8_16_neon(v);
+	butterfly8_neon(v);
+	transpose8x8_16_neon(v);
+	butterfly8_neon(v);
+}
+
+static inline uint8x8_t load_row_neon(const u8 *input,
+				      unsigned int input_step)
+{
+	u8 row[8];
+
+	if (input_step != 1) {
+		gather_row(input, input_step, row);
+		input = row;
+	}
+	return vld1_u8(input);
+}
+
+static void fwht_neon(const u8 *block, s16 *output_block,
+		      unsigned int stride, unsigned int input_step, bool intra)
+{
+	const int16x8_t add = vdupq_n_s16(intra ? 128 : 0);
+	int16x8_t v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, block += stride)
+		v[i] = vsubq_s16(vreinterpretq_s16_u16(
+			vmovl_u8(load_row_neon(block, input_step))), add);
+	transform_neon(v);
+	for (i = 0; i < 8; i++)
+		vst1q_s16(output_block + i * 8, v[i]);
+}
+
+static void fwht16_neon(const s16 *block, s16 *output_block, int stride)
+{
+	int16x8_t v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, block += stride)
+		v[i] = vld1q_s16(block);
+	transform_neon(v);
+	for (i = 0; i < 8; i++)
+		vst1q_s16(output_block + i * 8, v[i]);
+}
+
+static void ifwht_neon(const s16 *block, s16 *output_block, int intra)
+{
+	const int16x8_t add = vdupq_n_s16(intra ? 128 : 0);
+	int16x8_t v[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		v[i] = vld1q_s16(block + i * 8);
+	transform_neon(v);
+	for (i = 0; i < 8; i++)
+		vst1q_s16(output_block + i * 8,
+			  vaddq_s16(vshrq_n_s16(v[i], 6), add));
+}
+
+static void quantize_neon(s16 *coeff, s16 *de_coeff, u16 qp, bool intra)
+{
+	const int16x8_t max = vdupq_n_s16(qp);
+	const int16x8_t min = vdupq_n_s16(-qp);
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8) {
+		int16x8_t shift = vld1q_s16(quant_shift[intra] + i);
+		int16x8_t c = vshlq_s16(vld1q_s16(coeff + i), vnegq_s16(shift));
+		uint16x8_t keep = vorrq_u16(vcgtq_s16(c, max), vcltq_s16(c, min));
+
+		c = vandq_s16(c, vreinterpretq_s16_u16(keep));
+		vst1q_s16(coeff + i, c);
+		vst1q_s16(de_coeff + i, vshlq_s16(c, shift));
+	}
+}
+
+static void dequantize_neon(s16 *coeff, bool intra)
+{
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8)
+		vst1q_s16(coeff + i, vshlq_s16(vld1q_s16(coeff + i),
+					       vld1q_s16(quant_shift[intra] + i)));
+}
+
+static inline int hsum_u16_neon(uint16x8_t v)
+{
+	uint64x2_t s = vpaddlq_u32(vpaddlq_u16(v));
+
+	return vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+}
+
+static void var_neon(const u8 *cur, const u8 *reference, s16 *deltablock,
+		     unsigned int stride, unsigned int input_step,
+		     int *vari, int *vard)
+{
+	uint8x8_t c[8];
+	uint16x8_t sum = vdupq_n_u16(0), sad = vdupq_n_u16(0);
+	uint8x8_t mean;
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, cur += stride) {
+		uint8x8_t r = vld1_u8(reference + i * 8);
+
+		c[i] = load_row_neon(cur, input_step);
+		sum = vaddw_u8(sum, c[i]);
+		sad = vabal_u8(sad, c[i], r);
+		vst1q_s16(deltablock + i * 8,
+			  vreinterpretq_s16_u16(vsubl_u8(c[i], r)));
+	}
+
+	/* The mean of 8 bit values always fits in 8 bits */
+	mean = vdup_n_u8(hsum_u16_neon(sum) / 64);
+	*vard = hsum_u16_neon(sad);
+	sum = vdupq_n_u16(0);
+	for (i = 0; i < 8; i++)
+		sum = vabal_u8(sum, c[i], mean);
+	*vari = hsum_u16_neon(sum);
+}
+
+static void add_deltas_neon(s16 *deltas, const u8 *ref, int stride)
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, ref += stride) {
+		int16x8_t d = vaddq_s16(vld1q_s16(deltas + i * 8),
+					vreinterpretq_s16_u16(vmovl_u8(vld1_u8(ref))));
+
+		/* Clamp to 0 - 255 */
+		vst1q_s16(deltas + i * 8,
+			  vreinterpretq_s16_u16(vmovl_u8(vqmovun_s16(d))));
+	}
+}
+
+static void fill_decoder_block_neon(u8 *dst, const s16 *input, int stride)
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, dst += stride)
+		vst1_u8(dst, vqmovun_s16(vld1q_s16(input + i * 8)));
+}
+
+#endif /* FWHT_SIMD_NEON */
+
+bool fwht_simd_fwht(const u8 *block, s16 *output_block, unsigned int stride,
+		    unsigned int input_step, bool intra)
+{
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		fwht_sse2(block, output_block, stride, input_step, intra);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	fwht_neon(block, output_block, stride, input_step, intra);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_fwht16(const s16 *block, s16 *output_block, int stride)
+{
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		fwht16_sse2(block, output_block, stride);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	fwht16_neon(block, output_block, stride);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_ifwht(const s16 *block, s16 *output_block, int intra)
+{
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		ifwht_sse2(block, output_block, intra);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	ifwht_neon(block, output_block, intra);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_quantize(s16 *coeff, s16 *de_coeff, u16 qp, bool intra)
+{
+	/* The comparisons are done on 16 bit signed values */
+	if (qp > 0x7fff)
+		return false;
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		quantize_sse2(coeff, de_coeff, qp, intra);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	quantize_neon(coeff, de_coeff, qp, intra);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_dequantize(s16 *coeff, bool intra)
+{
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		dequantize_sse2(coeff, intra);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	dequantize_neon(coeff, intra);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_var(const u8 *cur, const u8 *reference, s16 *deltablock,
+		   unsigned int stride, unsigned int input_step,
+		   int *vari, int *vard)
+{
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		var_sse2(cur, reference, deltablock, stride, input_step,
+			 vari, vard);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	var_neon(cur, reference, deltablock, stride, input_step, vari, vard);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_add_deltas(s16 *deltas, const u8 *ref, int stride,
+			  unsigned int ref_step)
+{
+	if (ref_step != 1)
+		return false;
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		add_deltas_sse2(deltas, ref, stride);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	add_deltas_neon(deltas, ref, stride);
+	return true;
+#endif
+	return false;
+}
+
+bool fwht_simd_fill_decoder_block(u8 *dst, const s16 *input, int stride,
+				  unsigned int dst_step)
+{
+	if (dst_step != 1)
+		return false;
+#if defined(FWHT_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2) {
+		fill_decoder_block_sse2(dst, input, stride);
+		return true;
+	}
+#elif defined(FWHT_SIMD_NEON)
+	fill_decoder_block_neon(dst, input, stride);
+	return true;
+#endif
+	return false;
+}
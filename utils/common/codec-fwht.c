@@ -12,6 +12,7 @@
 #include <linux/string.h>
 #include <linux/kernel.h>
 #include <linux/videodev2.h>
+#include <pthread.h>
 #include "codec-fwht.h"
 
 #define OVERFLOW_BIT BIT(14)
@@ -171,6 +172,34 @@ derlc(const __be16 **rlc_in, s16 *dwht_out, const __be16 *end_of_input)
 	return stat;
 }
 
+/*
+ * Skip the rlc data of one macroblock in the same way as derlc(), but
+ * without decoding it. Returns the macroblock header or OVERFLOW_BIT.
+ */
+static u16 skip_rlc(const __be16 **rlc_in, const __be16 *end_of_input)
+{
+	const __be16 *input = *rlc_in;
+	int dec_count = 0;
+	u16 stat;
+
+	if (input > end_of_input)
+		return OVERFLOW_BIT;
+	stat = ntohs(*input++);
+
+	while (dec_count < 8 * 8) {
+		int length;
+
+		if (input > end_of_input)
+			return OVERFLOW_BIT;
+		length = ntohs(*input++) & 0xf;
+		if (length == 15)
+			break;
+		dec_count += length + 1;
+	}
+	*rlc_in = input;
+	return stat;
+}
+
 static const int quant_table[] = {
 	2, 2, 2, 2, 2, 2,  2,  2,
 	2, 2, 2, 2, 2, 2,  2,  2,
@@ -198,6 +227,9 @@ static void quantize_intra(s16 *coeff, s16 *de_coeff, u16 qp)
 	const int *quant = quant_table;
 	int i, j;
 
+	if (fwht_simd_quantize(coeff, de_coeff, qp, true))
+		return;
+
 	for (j = 0; j < 8; j++) {
 		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
 			*coeff >>= *quant;
@@ -214,6 +246,9 @@ static void dequantize_intra(s16 *coeff)
 	const int *quant = quant_table;
 	int i, j;
 
+	if (fwht_simd_dequantize(coeff, true))
+		return;
+
 	for (j = 0; j < 8; j++)
 		for (i = 0; i < 8; i++, quant++, coeff++)
 			*coeff <<= *quant;
@@ -224,6 +259,9 @@ static void quantize_inter(s16 *coeff, s16 *de_coeff, u16 qp)
 	const int *quant = quant_table_p;
 	int i, j;
 
+	if (fwht_simd_quantize(coeff, de_coeff, qp, false))
+		return;
+
 	for (j = 0; j < 8; j++) {
 		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
 			*coeff >>= *quant;
@@ -240,6 +278,9 @@ static void dequantize_inter(s16 *coeff)
 	const int *quant = quant_table_p;
 	int i, j;
 
+	if (fwht_simd_dequantize(coeff, false))
+		return;
+
 	for (j = 0; j < 8; j++)
 		for (i = 0; i < 8; i++, quant++, coeff++)
 			*coeff <<= *quant;
@@ -256,6 +297,9 @@ static void noinline_for_stack fwht(const u8 *block, s16 *output_block,
 	int add = intra ? 256 : 0;
 	unsigned int i;
 
+	if (fwht_simd_fwht(block, output_block, stride, input_step, intra))
+		return;
+
 	/* stage 1 */
 	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
 		switch (input_step) {
@@ -388,6 +432,9 @@ fwht16(const s16 *block, s16 *output_block, int stride, int intra)
 	s16 *out = output_block;
 	int i;
 
+	if (fwht_simd_fwht16(block, output_block, stride))
+		return;
+
 	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
 		/* stage 1 */
 		workspace1[0]  = tmp[0] + tmp[1];
@@ -476,6 +523,9 @@ ifwht(const s16 *block, s16 *output_block, int intra)
 	s16 *out = output_block;
 	int i;
 
+	if (fwht_simd_ifwht(block, output_block, intra))
+		return;
+
 	for (i = 0; i < 8; i++, tmp += 8, out += 8) {
 		/* stage 1 */
 		workspace1[0]  = tmp[0] + tmp[1];
@@ -623,6 +673,10 @@ decide_blocktype(const u8 *cur, const u8 *reference, s16 *deltablock,
 	int vari;
 	int vard;
 
+	if (fwht_simd_var(cur, reference, deltablock, stride, input_step,
+			  &vari, &vard))
+		return vari <= vard ? IBLOCK : PBLOCK;
+
 	fill_encoder_block(cur, tmp, stride, input_step);
 	fill_encoder_block(reference, old, 8, 1);
 	vari = var_intra(tmp);
@@ -645,6 +699,9 @@ static void fill_decoder_block(u8 *dst, const s16 *input, int stride,
 {
 	int i, j;
 
+	if (fwht_simd_fill_decoder_block(dst, input, stride, dst_step))
+		return;
+
 	for (i = 0; i < 8; i++) {
 		for (j = 0; j < 8; j++, input++, dst += dst_step) {
 			if (*input < 0)
@@ -663,6 +720,9 @@ static void add_deltas(s16 *deltas, const u8 *ref, int stride,
 {
 	int k, l;
 
+	if (fwht_simd_add_deltas(deltas, ref, stride, ref_step))
+		return;
+
 	for (k = 0; k < 8; k++) {
 		for (l = 0; l < 8; l++) {
 			*deltas += *ref;
@@ -681,23 +741,24 @@ static void add_deltas(s16 *deltas, const u8 *ref, int stride,
 	}
 }
 
-static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
-			struct fwht_cframe *cf, u32 height, u32 width,
-			u32 stride, unsigned int input_step,
-			bool is_intra, bool next_is_intra)
+/*
+ * Encode rows rows of macroblocks. Each macroblock only depends on the
+ * co-located macroblock of the reference frame, so separate ranges of rows
+ * can be encoded independently of each other.
+ */
+static u32 encode_rows(u8 *input_start, u8 *refp, __be16 **rlco,
+		       __be16 *rlco_max, struct fwht_cframe *cf, u32 rows,
+		       u32 width, u32 stride, unsigned int input_step,
+		       bool is_intra, bool next_is_intra)
 {
-	u8 *input_start = input;
-	__be16 *rlco_start = *rlco;
+	u8 *input;
 	s16 deltablock[64];
 	__be16 pframe_bit = htons(PFRAME_BIT);
 	u32 encoding = 0;
 	unsigned int last_size = 0;
 	unsigned int i, j;
 
-	width = round_up(width, 8);
-	height = round_up(height, 8);
-
-	for (j = 0; j < height / 8; j++) {
+	for (j = 0; j < rows; j++) {
 		input = input_start + j * 8 * stride;
 		for (i = 0; i < width / 8; i++) {
 			/* intra code, first frame is always intra coded. */
@@ -743,15 +804,138 @@ static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
 			} else {
 				*rlco += size;
 			}
-			if (*rlco >= rlco_max) {
-				encoding |= FWHT_FRAME_UNENCODED;
-				goto exit_loop;
-			}
+			if (*rlco >= rlco_max)
+				return encoding | FWHT_FRAME_UNENCODED;
 			last_size = size;
 		}
 	}
+	return encoding;
+}
+
+/* The most rlc output of one macroblock */
+#define RLC_MAX_BLOCK_SIZE 65
+
+struct encode_stripe {
+	struct fwht_cframe cf;
+	u8 *input;
+	u8 *refp;
+	__be16 *rlco_start;
+	__be16 *rlco;
+	__be16 *rlco_max;
+	u32 rows;
+	u32 width;
+	u32 stride;
+	unsigned int input_step;
+	bool is_intra;
+	bool next_is_intra;
+	u32 encoding;
+	pthread_t thread;
+};
+
+static void *encode_stripe_thread(void *arg)
+{
+	struct encode_stripe *s = arg;
+
+	s->encoding = encode_rows(s->input, s->refp, &s->rlco, s->rlco_max,
+				  &s->cf, s->rows, s->width, s->stride,
+				  s->input_step, s->is_intra, s->next_is_intra);
+	return NULL;
+}
+
+/*
+ * Split the plane in stripes of macroblock rows, each encoded by its own
+ * thread into its own part of the rlco buffer. Afterwards the stripes are
+ * moved together. The result is a valid stream for any decoder, only
+ * identical macroblocks at the start of a stripe are not merged with the
+ * end of the previous stripe.
+ */
+static u32 encode_stripes(u8 *input, u8 *refp, __be16 **rlco,
+			  __be16 *rlco_max, struct fwht_cframe *cf,
+			  unsigned int stripes, u32 rows, u32 width,
+			  u32 stride, unsigned int input_step,
+			  bool is_intra, bool next_is_intra)
+{
+	struct encode_stripe s[FWHT_MAX_STRIPES];
+	unsigned long space = rlco_max - *rlco;
+	u32 encoding = 0;
+	unsigned int k;
+
+	for (k = 0; k < stripes; k++) {
+		u32 first = rows * k / stripes;
+		u32 next = rows * (k + 1) / stripes;
+
+		s[k].cf.i_frame_qp = cf->i_frame_qp;
+		s[k].cf.p_frame_qp = cf->p_frame_qp;
+		s[k].input = input + first * 8 * stride;
+		s[k].refp = refp + first * (width / 8) * 8 * 8;
+		s[k].rlco_start = *rlco + space * first / rows;
+		s[k].rlco = s[k].rlco_start;
+		/* Make sure that no stripe can overwrite the next one */
+		s[k].rlco_max = k == stripes - 1 ? rlco_max :
+			*rlco + space * next / rows - RLC_MAX_BLOCK_SIZE;
+		s[k].rows = next - first;
+		s[k].width = width;
+		s[k].stride = stride;
+		s[k].input_step = input_step;
+		s[k].is_intra = is_intra;
+		s[k].next_is_intra = next_is_intra;
+		if (k && pthread_create(&s[k].thread, NULL,
+					encode_stripe_thread, &s[k])) {
+			/* Encode it in this thread later on */
+			s[k].thread = pthread_self();
+		}
+	}
+
+	encode_stripe_thread(&s[0]);
+	for (k = 1; k < stripes; k++) {
+		if (pthread_equal(s[k].thread, pthread_self()))
+			encode_stripe_thread(&s[k]);
+		else
+			pthread_join(s[k].thread, NULL);
+	}
+
+	for (k = 0; k < stripes; k++) {
+		encoding |= s[k].encoding;
+		if (encoding & FWHT_FRAME_UNENCODED)
+			continue;
+		memmove(*rlco, s[k].rlco_start,
+			(s[k].rlco - s[k].rlco_start) * sizeof(**rlco));
+		*rlco += s[k].rlco - s[k].rlco_start;
+	}
+	return encoding;
+}
+
+static u32 encode_plane(u8 *input, u8 *refp, __be16 **rlco, __be16 *rlco_max,
+			struct fwht_cframe *cf, u32 height, u32 width,
+			u32 stride, unsigned int input_step,
+			bool is_intra, bool next_is_intra)
+{
+	u8 *input_start = input;
+	__be16 *rlco_start = *rlco;
+	unsigned int stripes = cf->stripes;
+	u32 encoding;
+	unsigned int i, j;
+
+	width = round_up(width, 8);
+	height = round_up(height, 8);
+
+	if (stripes > FWHT_MAX_STRIPES)
+		stripes = FWHT_MAX_STRIPES;
+	if (stripes > height / 8)
+		stripes = height / 8;
+	/* Each stripe should have room for a fair number of macroblocks */
+	if (rlco_max - *rlco < (long)stripes * 16 * RLC_MAX_BLOCK_SIZE)
+		stripes = 1;
+
+	if (stripes > 1)
+		encoding = encode_stripes(input, refp, rlco, rlco_max, cf,
+					  stripes, height / 8, width, stride,
+					  input_step, is_intra, next_is_intra);
+	else
+		encoding = encode_rows(input, refp, rlco, rlco_max, cf,
+				       height / 8, width, stride, input_step,
+				       is_intra, next_is_intra);
 
-exit_loop:
 	if (encoding & FWHT_FRAME_UNENCODED) {
 		u8 *out = (u8 *)rlco_start;
 		u8 *p;
@@ -832,32 +1016,33 @@ u32 fwht_encode_frame(struct fwht_raw_frame *frm,
 	return encoding;
 }
 
-static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
-			 u32 height, u32 width, const u8 *ref, u32 ref_stride,
-			 unsigned int ref_step, u8 *dst,
-			 unsigned int dst_stride, unsigned int dst_step,
-			 bool uncompressed, const __be16 *end_of_rlco_buf)
+/*
+ * Decode rows rows of macroblocks. The rows can start in the middle of a
+ * run of identical macroblocks: then copies is the number of macroblocks
+ * that are left in the run, and dup points to the repeated macroblock.
+ */
+static bool decode_rows(struct fwht_cframe *cf, const __be16 **rlco,
+			const __be16 *dup, unsigned int copies, u32 rows,
+			u32 width, const u8 *ref, u32 ref_stride,
+			unsigned int ref_step, u8 *dst,
+			unsigned int dst_stride, unsigned int dst_step,
+			const __be16 *end_of_rlco_buf)
 {
-	unsigned int copies = 0;
 	s16 copy[8 * 8];
-	u16 stat;
+	u16 stat = 0;
 	unsigned int i, j;
 	bool is_intra = !ref;
 
-	width = round_up(width, 8);
-	height = round_up(height, 8);
-
-	if (uncompressed) {
-		int i;
-
-		if (end_of_rlco_buf + 1 < *rlco + width * height / 2)
+	if (copies) {
+		stat = derlc(&dup, cf->coeffs, end_of_rlco_buf);
+		if (stat & OVERFLOW_BIT)
 			return false;
-		for (i = 0; i < height; i++) {
-			memcpy(dst, *rlco, width);
-			dst += dst_stride;
-			*rlco += width / 2;
-		}
-		return true;
+		if ((stat & PFRAME_BIT) && !is_intra)
+			dequantize_inter(cf->coeffs);
+		else
+			dequantize_intra(cf->coeffs);
+		ifwht(cf->coeffs, copy,
+		      ((stat & PFRAME_BIT) && !is_intra) ? 0 : 1);
 	}
 
 	/*
@@ -866,7 +1051,7 @@ static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
 	 * To avoid overflow the buffer has to be 65/64th of the actual raw
 	 * image size, just in case someone feeds it malicious data.
 	 */
-	for (j = 0; j < height / 8; j++) {
+	for (j = 0; j < rows; j++) {
 		for (i = 0; i < width / 8; i++) {
 			const u8 *refp = ref + j * 8 * ref_stride +
 				i * 8 * ref_step;
@@ -907,6 +1092,169 @@ static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
 	return true;
 }
 
+struct decode_stripe {
+	const __be16 *rlco;
+	const __be16 *dup;
+	unsigned int copies;
+	u32 rows;
+	u32 width;
+	const u8 *ref;
+	u32 ref_stride;
+	unsigned int ref_step;
+	u8 *dst;
+	unsigned int dst_stride;
+	unsigned int dst_step;
+	const __be16 *end_of_rlco_buf;
+	bool ok;
+	pthread_t thread;
+};
+
+/* The stripes in which the planes of a frame are decoded */
+struct decode_plan {
+	/* The number of threads to decode the frame with */
+	unsigned int threads;
+	/* The total number of macroblocks in all planes */
+	u32 blocks;
+	unsigned int nr_stripes;
+	struct decode_stripe s[FWHT_MAX_STRIPES + 4];
+};
+
+static void *decode_stripe_thread(void *arg)
+{
+	struct decode_stripe *s = arg;
+	struct fwht_cframe cf;
+	const __be16 *rlco = s->rlco;
+
+	s->ok = decode_rows(&cf, &rlco, s->dup, s->copies, s->rows, s->width,
+			    s->ref, s->ref_stride, s->ref_step, s->dst,
+			    s->dst_stride, s->dst_step, s->end_of_rlco_buf);
+	return NULL;
+}
+
+/*
+ * The start of each macroblock row can only be found by parsing the rlc
+ * data of the rows before it. That takes little time compared to decoding
+ * the macroblocks, so split the plane in stripes of macroblock rows and
+ * find where each stripe starts. The stripes are decoded by
+ * decode_stripes() later on.
+ */
+static bool plan_stripes(struct decode_plan *plan, const __be16 **rlco,
+			 u32 height, u32 width, const u8 *ref, u32 ref_stride,
+			 unsigned int ref_step, u8 *dst,
+			 unsigned int dst_stride, unsigned int dst_step,
+			 const __be16 *end_of_rlco_buf)
+{
+	struct decode_stripe *s = plan->s + plan->nr_stripes;
+	u32 rows = height / 8;
+	unsigned int stripes = (plan->threads * rows * (width / 8) +
+				plan->blocks - 1) / plan->blocks;
+	const __be16 *dup = NULL;
+	unsigned int copies = 0;
+	unsigned int k = 0;
+	u16 stat;
+	u32 i, j;
+
+	if (stripes > rows)
+		stripes = rows;
+	if (stripes > ARRAY_SIZE(plan->s) - plan->nr_stripes)
+		stripes = ARRAY_SIZE(plan->s) - plan->nr_stripes;
+
+	for (j = 0; j < rows; j++) {
+		if (k < stripes && j == rows * k / stripes) {
+			s[k].rlco = *rlco;
+			s[k].dup = dup;
+			s[k].copies = copies;
+			s[k].rows = rows * (k + 1) / stripes - j;
+			s[k].width = width;
+			s[k].ref = ref ? ref + j * 8 * ref_stride : NULL;
+			s[k].ref_stride = ref_stride;
+			s[k].ref_step = ref_step;
+			s[k].dst = dst + j * 8 * dst_stride;
+			s[k].dst_stride = dst_stride;
+			s[k].dst_step = dst_step;
+			s[k].end_of_rlco_buf = end_of_rlco_buf;
+			k++;
+		}
+		for (i = 0; i < width / 8; i++) {
+			if (copies) {
+				copies--;
+				continue;
+			}
+			dup = *rlco;
+			stat = skip_rlc(rlco, end_of_rlco_buf);
+			if (stat & OVERFLOW_BIT)
+				return false;
+			copies = (stat & DUPS_MASK) >> 1;
+		}
+	}
+	plan->nr_stripes += k;
+	return true;
+}
+
+static bool decode_stripes(struct decode_plan *plan)
+{
+	struct decode_stripe *s = plan->s;
+	bool ok = true;
+	unsigned int k;
+
+	for (k = 1; k < plan->nr_stripes; k++) {
+		if (pthread_create(&s[k].thread, NULL,
+				   decode_stripe_thread, &s[k])) {
+			/* Decode it in this thread later on */
+			s[k].thread = pthread_self();
+		}
+	}
+
+	if (plan->nr_stripes)
+		decode_stripe_thread(&s[0]);
+	for (k = 1; k < plan->nr_stripes; k++) {
+		if (pthread_equal(s[k].thread, pthread_self()))
+			decode_stripe_thread(&s[k]);
+		else
+			pthread_join(s[k].thread, NULL);
+	}
+
+	for (k = 0; k < plan->nr_stripes; k++)
+		ok = ok && s[k].ok;
+	return ok;
+}
+
+/*
+ * Without a plan the plane is decoded right away, otherwise it is added
+ * to the plan.
+ */
+static bool decode_plane(struct fwht_cframe *cf, const __be16 **rlco,
+			 u32 height, u32 width, const u8 *ref, u32 ref_stride,
+			 unsigned int ref_step, u8 *dst,
+			 unsigned int dst_stride, unsigned int dst_step,
+			 bool uncompressed, const __be16 *end_of_rlco_buf,
+			 struct decode_plan *plan)
+{
+	width = round_up(width, 8);
+	height = round_up(height, 8);
+
+	if (uncompressed) {
+		int i;
+
+		if (end_of_rlco_buf + 1 < *rlco + width * height / 2)
+			return false;
+		for (i = 0; i < height; i++) {
+			memcpy(dst, *rlco, width);
+			dst += dst_stride;
+			*rlco += width / 2;
+		}
+		return true;
+	}
+
+	if (plan)
+		return plan_stripes(plan, rlco, height, width, ref, ref_stride,
+				    ref_step, dst, dst_stride, dst_step,
+				    end_of_rlco_buf);
+	return decode_rows(cf, rlco, NULL, 0, height / 8, width, ref,
+			   ref_stride, ref_step, dst, dst_stride, dst_step,
+			   end_of_rlco_buf);
+}
+
 bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 		       unsigned int components_num, unsigned int width,
 		       unsigned int height, const struct fwht_raw_frame *ref,
@@ -917,34 +1265,50 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 	const __be16 *rlco = cf->rlc_data;
 	const __be16 *end_of_rlco_buf = cf->rlc_data +
 			(cf->size / sizeof(*rlco)) - 1;
+	struct decode_plan stripes_plan;
+	struct decode_plan *plan = NULL;
+	u32 h = height;
+	u32 w = width;
+
+	if (!(hdr_flags & V4L2_FWHT_FL_CHROMA_FULL_HEIGHT))
+		h /= 2;
+	if (!(hdr_flags & V4L2_FWHT_FL_CHROMA_FULL_WIDTH))
+		w /= 2;
+
+	if (cf->stripes > 1 && width && height) {
+		plan = &stripes_plan;
+		plan->threads = cf->stripes > FWHT_MAX_STRIPES ?
+				FWHT_MAX_STRIPES : cf->stripes;
+		plan->blocks = (round_up(width, 8) / 8) *
+			       (round_up(height, 8) / 8);
+		if (components_num >= 3)
+			plan->blocks += 2 * (round_up(w, 8) / 8) *
+					(round_up(h, 8) / 8);
+		if (components_num == 4)
+			plan->blocks += (round_up(width, 8) / 8) *
+					(round_up(height, 8) / 8);
+		plan->nr_stripes = 0;
+	}
 
 	if (!decode_plane(cf, &rlco, height, width, ref->luma, ref_stride,
 			  ref->luma_alpha_step, dst->luma, dst_stride,
 			  dst->luma_alpha_step,
 			  hdr_flags & V4L2_FWHT_FL_LUMA_IS_UNCOMPRESSED,
-			  end_of_rlco_buf))
+			  end_of_rlco_buf, plan))
 		return false;
 
 	if (components_num >= 3) {
-		u32 h = height;
-		u32 w = width;
-
-		if (!(hdr_flags & V4L2_FWHT_FL_CHROMA_FULL_HEIGHT))
-			h /= 2;
-		if (!(hdr_flags & V4L2_FWHT_FL_CHROMA_FULL_WIDTH))
-			w /= 2;
-
 		if (!decode_plane(cf, &rlco, h, w, ref->cb, ref_chroma_stride,
 				  ref->chroma_step, dst->cb, dst_chroma_stride,
 				  dst->chroma_step,
 				  hdr_flags & V4L2_FWHT_FL_CB_IS_UNCOMPRESSED,
-				  end_of_rlco_buf))
+				  end_of_rlco_buf, plan))
 			return false;
 		if (!decode_plane(cf, &rlco, h, w, ref->cr, ref_chroma_stride,
 				  ref->chroma_step, dst->cr, dst_chroma_stride,
 				  dst->chroma_step,
 				  hdr_flags & V4L2_FWHT_FL_CR_IS_UNCOMPRESSED,
-				  end_of_rlco_buf))
+				  end_of_rlco_buf, plan))
 			return false;
 	}
 
@@ -953,7 +1317,10 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 				  ref->luma_alpha_step, dst->alpha, dst_stride,
 				  dst->luma_alpha_step,
 				  hdr_flags & V4L2_FWHT_FL_ALPHA_IS_UNCOMPRESSED,
-				  end_of_rlco_buf))
+				  end_of_rlco_buf, plan))
 			return false;
+
+	if (plan)
+		return decode_stripes(plan);
 	return true;
 }
@@ -96,9 +96,17 @@ struct fwht_cframe_hdr {
 	__be32 size;
 };
 
+/* The most threads a plane gets encoded, or a frame decoded, with */
+#define FWHT_MAX_STRIPES 16
+
 struct fwht_cframe {
 	u16 i_frame_qp;
 	u16 p_frame_qp;
+	/*
+	 * The number of threads to encode each plane, or to decode the
+	 * frame with, 0 or 1 for none
+	 */
+	unsigned int stripes;
 	__be16 *rlc_data;
 	s16 coeffs[8 * 8];
 	s16 de_coeffs[8 * 8];
@@ -135,4 +143,19 @@ bool fwht_decode_frame(struct fwht_cframe *cf, u32 hdr_flags,
 		unsigned int ref_stride, unsigned int ref_chroma_stride,
 		struct fwht_raw_frame *dst, unsigned int dst_stride,
 		unsigned int dst_chroma_stride);
+
+/* The SIMD kernels in codec-fwht-simd.c, these return false without SIMD */
+bool fwht_simd_fwht(const u8 *block, s16 *output_block, unsigned int stride,
+		    unsigned int input_step, bool intra);
+bool fwht_simd_fwht16(const s16 *block, s16 *output_block, int stride);
+bool fwht_simd_ifwht(const s16 *block, s16 *output_block, int intra);
+bool fwht_simd_quantize(s16 *coeff, s16 *de_coeff, u16 qp, bool intra);
+bool fwht_simd_dequantize(s16 *coeff, bool intra);
+bool fwht_simd_var(const u8 *cur, const u8 *reference, s16 *deltablock,
+		   unsigned int stride, unsigned int input_step,
+		   int *vari, int *vard);
+bool fwht_simd_add_deltas(s16 *deltas, const u8 *ref, int stride,
+			  unsigned int ref_step);
+bool fwht_simd_fill_decoder_block(u8 *dst, const s16 *input, int stride,
+				  unsigned int dst_step);
 #endif
@@ -35,6 +35,7 @@ struct v4l2_fwht_state {
 	unsigned int gop_cnt;
 	u16 i_frame_qp;
 	u16 p_frame_qp;
+	unsigned int stripes;
 
 	enum v4l2_colorspace colorspace;
 	enum v4l2_ycbcr_encoding ycbcr_enc;
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: LGPL-2.1+
+/*
+ * Runtime CPU feature detection for the SIMD paths in utils/common.
+ */
+
+#include <pthread.h>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "cpu.h"
+
+static unsigned int cpu_flags;
+static pthread_once_t cpu_flags_once = PTHREAD_ONCE_INIT;
+
+static void cpu_init_flags(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		cpu_flags |= CPU_SSE2;
+	if (__builtin_cpu_supports("sse4.2"))
+		cpu_flags |= CPU_SSE42;
+#elif defined(__aarch64__) && defined(__linux__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		cpu_flags |= CPU_CRC32;
+#endif
+}
+
+unsigned int cpu_get_flags(void)
+{
+	pthread_once(&cpu_flags_once, cpu_init_flags);
+	return cpu_flags;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+/*
+ * Runtime CPU feature detection for the SIMD paths in utils/common.
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define CPU_SSE2	0x01
+#define CPU_SSE42	0x02
+#define CPU_CRC32	0x04	/* ARMv8 CRC32 instructions */
+
+/*
+ * Returns the CPU_* flags of the features the CPU has. The SIMD versions
+ * are built with per-function target attributes, so the caller picks one
+ * at runtime with these flags.
+ */
+unsigned int cpu_get_flags(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
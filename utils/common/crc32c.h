@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+/*
+ * CRC-32C (Castagnoli), as used by iSCSI and ext4.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*
+ * Returns the CRC-32C of len bytes at buf, continuing from crc, which is
+ * the result of the previous call or 0 for the first one. It uses the CRC32
+ * instructions of SSE4.2 or ARMv8 when the CPU has them.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif
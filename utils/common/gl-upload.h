@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Asynchronous texture uploads through pixel buffer objects, used by
+ * qv4l2 and qvidcap.
+ */
+
+#ifndef GL_UPLOAD_H
+#define GL_UPLOAD_H
+
+#include <QOpenGLContext>
+#include <string.h>
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+/*
+ * Instead of letting glTexSubImage2D() copy the frame straight from the
+ * application memory, which lets the GL driver block until it has the whole
+ * frame, texSubImage2D() copies the pixels in a pixel buffer object and lets
+ * the GPU fetch them from there in the background.
+ *
+ * The frame is uploaded between begin() and end(), there is a ring of
+ * GL_UPLOAD_RING_SIZE PBOs and each one gets a fence, so the next frames can
+ * be copied while the GPU still reads the previous ones. With
+ * GL_ARB_buffer_storage the PBOs are persistently mapped.
+ *
+ * On OpenGL < 3.2 or for pixel formats it doesn't know texSubImage2D() just
+ * calls glTexSubImage2D().
+ */
+#define GL_UPLOAD_RING_SIZE 3
+
+class GLUpload {
+public:
+	GLUpload() : m_enabled(false), m_persistent(false), m_active(false),
+		m_cur(0), m_size(0), m_needed(0), m_offset(0), m_bufferStorage(NULL)
+	{
+		memset(m_pbo, 0, sizeof(m_pbo));
+		memset(m_fence, 0, sizeof(m_fence));
+		memset(m_map, 0, sizeof(m_map));
+	}
+
+	// Must be called with the GL context current.
+	void init()
+	{
+		QOpenGLContext *ctx = QOpenGLContext::currentContext();
+		GLint major = 0, minor = 0;
+
+		destroy();
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		// OpenGL 2 doesn't know GL_MAJOR_VERSION
+		while (glGetError() != GL_NO_ERROR);
+		m_enabled = ctx && (major > 3 || (major == 3 && minor >= 2));
+		m_bufferStorage = NULL;
+		if (m_enabled && ctx->hasExtension("GL_ARB_buffer_storage"))
+			m_bufferStorage = (BufferStorageFn)ctx->getProcAddress("glBufferStorage");
+	}
+
+	// Must be called with the GL context current.
+	void destroy()
+	{
+		m_active = false;
+		if (!m_size)
+			return;
+		for (unsigned i = 0; i < GL_UPLOAD_RING_SIZE; i++) {
+			if (m_fence[i])
+				glDeleteSync(m_fence[i]);
+			m_fence[i] = 0;
+			if (m_map[i]) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				m_map[i] = NULL;
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(GL_UPLOAD_RING_SIZE, m_pbo);
+		memset(m_pbo, 0, sizeof(m_pbo));
+		m_size = 0;
+		m_persistent = false;
+	}
+
+	void begin()
+	{
+		if (!m_enabled)
+			return;
+		// The previous frame did not fit, grow the ring
+		if (m_needed > m_size && !allocate(m_needed)) {
+			destroy();
+			m_enabled = false;
+			return;
+		}
+		m_needed = 0;
+		m_offset = 0;
+		if (!m_size)
+			return;
+		if (m_fence[m_cur]) {
+			glClientWaitSync(m_fence[m_cur], GL_SYNC_FLUSH_COMMANDS_BIT,
+					 1000000000ULL);
+			glDeleteSync(m_fence[m_cur]);
+			m_fence[m_cur] = 0;
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[m_cur]);
+		if (!m_persistent)
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, m_size, NULL, GL_STREAM_DRAW);
+		m_active = true;
+	}
+
+	void end()
+	{
+		if (!m_active)
+			return;
+		m_fence[m_cur] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		m_cur = (m_cur + 1) % GL_UPLOAD_RING_SIZE;
+		m_active = false;
+	}
+
+	void texSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset,
+			   GLsizei width, GLsizei height, GLenum format, GLenum type,
+			   const void *pixels)
+	{
+		GLsizeiptr size = pixels && m_enabled ?
+			imageSize(width, height, format, type) : 0;
+
+		if (!size) {
+			if (m_active)
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+					format, type, pixels);
+			if (m_active)
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[m_cur]);
+			return;
+		}
+
+		GLintptr offset = (m_offset + 63) & ~63;
+
+		m_needed = offset + size;
+		if (!m_active || m_needed > m_size) {
+			// Doesn't fit (yet), the ring is grown in the next begin()
+			if (m_active)
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+					format, type, pixels);
+			if (m_active)
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[m_cur]);
+			m_offset = m_needed;
+			return;
+		}
+
+		if (m_persistent) {
+			memcpy(m_map[m_cur] + offset, pixels, size);
+		} else {
+			void *p = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+						   GL_MAP_WRITE_BIT |
+						   GL_MAP_INVALIDATE_RANGE_BIT |
+						   GL_MAP_UNSYNCHRONIZED_BIT);
+
+			if (p) {
+				memcpy(p, pixels, size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			} else {
+				glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, size, pixels);
+			}
+		}
+		glTexSubImage2D(target, level, xoffset, yoffset, width, height,
+				format, type, (const void *)offset);
+		m_offset = m_needed;
+	}
+
+private:
+	typedef void (*BufferStorageFn)(GLenum target, GLsizeiptr size,
+					const void *data, GLbitfield flags);
+
+	bool allocate(GLsizeiptr size)
+	{
+		destroy();
+		// Leave some room so a slightly bigger frame doesn't need a new ring
+		size += size / 8;
+		glGenBuffers(GL_UPLOAD_RING_SIZE, m_pbo);
+		m_persistent = m_bufferStorage != NULL;
+		for (unsigned i = 0; i < GL_UPLOAD_RING_SIZE; i++) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+			if (!m_persistent) {
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+				continue;
+			}
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+					   GL_MAP_COHERENT_BIT;
+
+			m_bufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+			m_map[i] = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+								     0, size, flags);
+			if (!m_map[i]) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				m_size = size;
+				destroy();
+				return false;
+			}
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		m_size = size;
+		return glGetError() == GL_NO_ERROR;
+	}
+
+	// The number of bytes glTexSubImage2D() reads, 0 if unknown
+	static GLsizeiptr imageSize(GLsizei width, GLsizei height,
+				    GLenum format, GLenum type)
+	{
+		unsigned comps, bytes;
+		GLint rowLength = 0, align = 4;
+
+		switch (format) {
+		case GL_RED:
+		case GL_RED_INTEGER:
+		case GL_LUMINANCE:
+		case GL_ALPHA:
+			comps = 1;
+			break;
+		case GL_RG:
+		case GL_LUMINANCE_ALPHA:
+			comps = 2;
+			break;
+		case GL_RGB:
+		case GL_BGR:
+			comps = 3;
+			break;
+		case GL_RGBA:
+		case GL_BGRA:
+			comps = 4;
+			break;
+		default:
+			return 0;
+		}
+
+		switch (type) {
+		case GL_UNSIGNED_BYTE:
+			bytes = comps;
+			break;
+		case GL_UNSIGNED_SHORT:
+			bytes = 2 * comps;
+			break;
+		case GL_UNSIGNED_BYTE_3_3_2:
+		case GL_UNSIGNED_BYTE_2_3_3_REV:
+			bytes = 1;
+			break;
+		case GL_UNSIGNED_SHORT_5_6_5:
+		case GL_UNSIGNED_SHORT_5_6_5_REV:
+		case GL_UNSIGNED_SHORT_4_4_4_4:
+		case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+		case GL_UNSIGNED_SHORT_5_5_5_1:
+		case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+			bytes = 2;
+			break;
+		case GL_UNSIGNED_INT_8_8_8_8:
+		case GL_UNSIGNED_INT_8_8_8_8_REV:
+		case GL_UNSIGNED_INT_10_10_10_2:
+		case GL_UNSIGNED_INT_2_10_10_10_REV:
+			bytes = 4;
+			break;
+		default:
+			return 0;
+		}
+
+		if (width <= 0 || height <= 0)
+			return 0;
+		glGetIntegerv(GL_UNPACK_ROW_LENGTH, &rowLength);
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &align);
+
+		GLsizeiptr stride = (rowLength > 0 ? rowLength : width) * bytes;
+
+		if (align > 1)
+			stride = (stride + align - 1) / align * align;
+		return stride * (height - 1) + (GLsizeiptr)width * bytes;
+	}
+
+	GLuint m_pbo[GL_UPLOAD_RING_SIZE];
+	GLsync m_fence[GL_UPLOAD_RING_SIZE];
+	unsigned char *m_map[GL_UPLOAD_RING_SIZE];
+	bool m_enabled;
+	bool m_persistent;
+	bool m_active;
+	unsigned m_cur;
+	GLsizeiptr m_size;
+	GLsizeiptr m_needed;
+	GLintptr m_offset;
+	BufferStorageFn m_bufferStorage;
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include <linux/lirc.h>
 
@@ -533,3 +534,506 @@ const char* protocol_name(enum rc_proto proto)
 
 	return protocols[proto].name;
 }
+
+/*
+ * The decoder runs the encoders in reverse. For each protocol, the scancode
+ * 0 and the scancodes with a single bit set are encoded once, which tells
+ * where in the message each scancode bit is found: at a particular edge if
+ * the number of edges doesn't depend on the scancode (pulse distance and
+ * pulse length protocols), or at a particular time otherwise (bi-phase
+ * protocols like rc5 and rc6). A message is then decoded by looking at
+ * those edges or times only, and accepted if encoding the decoded scancode
+ * gives the same message, within a tolerance.
+ */
+#define DECODE_MAX_EDGES 128
+
+static struct {
+	bool learned;
+	bool by_time;
+	unsigned edges;
+	unsigned leader[DECODE_MAX_EDGES];
+	unsigned leader_len;
+	unsigned unit;
+	/*
+	 * the range of each edge for pulse distance and length protocols,
+	 * including the tolerance
+	 */
+	unsigned lo[DECODE_MAX_EDGES];
+	unsigned hi[DECODE_MAX_EDGES];
+	unsigned nbits;
+	struct {
+		unsigned bit;
+		unsigned pos;
+		unsigned val0;
+		unsigned val1;
+	} bits[32];
+} decoders[ARRAY_SIZE(protocols)];
+
+/* Is the IR signal a pulse at time t, in microseconds */
+static bool level_at(const unsigned *buf, unsigned len, unsigned t)
+{
+	unsigned i;
+
+	for (i=0; i<len; i++) {
+		if (t < buf[i])
+			return !(i & 1);
+		t -= buf[i];
+	}
+
+	return false;
+}
+
+/* Middle of the first period in which the two signals differ */
+static unsigned first_difference(const unsigned *a, unsigned a_len,
+				 const unsigned *b, unsigned b_len)
+{
+	unsigned i = 0, j = 0, t = 0;
+	unsigned ta = a[0], tb = b[0];
+
+	while (i < a_len || j < b_len) {
+		unsigned end = ta < tb ? ta : tb;
+		bool la = i < a_len && !(i & 1);
+		bool lb = j < b_len && !(j & 1);
+
+		if (la != lb)
+			return t + (end - t) / 2;
+
+		t = end;
+		if (ta == end)
+			ta = ++i < a_len ? ta + a[i] : UINT_MAX;
+		if (tb == end)
+			tb = ++j < b_len ? tb + b[j] : UINT_MAX;
+	}
+
+	return UINT_MAX;
+}
+
+static void decoder_learn(enum rc_proto proto)
+{
+	unsigned base[DECODE_MAX_EDGES], buf[DECODE_MAX_EDGES];
+	unsigned mask = protocols[proto].scancode_mask;
+	unsigned i, b, n, len;
+
+	decoders[proto].learned = true;
+	n = protocols[proto].encode(proto, 0, base);
+	decoders[proto].edges = n;
+	decoders[proto].unit = UINT_MAX;
+
+	for (i=0; i<n; i++) {
+		if (base[i] < decoders[proto].unit)
+			decoders[proto].unit = base[i];
+		decoders[proto].lo[i] = base[i];
+		decoders[proto].hi[i] = base[i];
+	}
+
+	// the leader is the part that is the same for all scancodes
+	len = n;
+	for (b=0; b<32; b++) {
+		unsigned m;
+
+		if (!(mask & (1u << b)))
+			continue;
+
+		m = protocols[proto].encode(proto, 1u << b, buf);
+		if (m != n)
+			decoders[proto].by_time = true;
+		for (i=0; i<len && i<m; i++)
+			if (buf[i] != base[i])
+				break;
+		len = i;
+		for (i=0; i<n && i<m; i++) {
+			if (buf[i] < decoders[proto].lo[i])
+				decoders[proto].lo[i] = buf[i];
+			if (buf[i] > decoders[proto].hi[i])
+				decoders[proto].hi[i] = buf[i];
+		}
+	}
+	for (i=0; i<len; i++)
+		decoders[proto].leader[i] = base[i];
+	decoders[proto].leader_len = len;
+
+	for (i=0; i<n; i++) {
+		unsigned lo = decoders[proto].lo[i], hi = decoders[proto].hi[i];
+
+		decoders[proto].lo[i] = lo > lo * 3 / 10 + 100 ? lo - lo * 3 / 10 - 100 : 0;
+		decoders[proto].hi[i] = hi + hi * 3 / 10 + 100;
+	}
+
+	for (b=0; b<32; b++) {
+		unsigned pos = UINT_MAX, val0 = 0, val1 = 0;
+
+		if (!(mask & (1u << b)))
+			continue;
+
+		len = protocols[proto].encode(proto, 1u << b, buf);
+
+		if (decoders[proto].by_time) {
+			pos = first_difference(base, n, buf, len);
+			val0 = level_at(base, n, pos);
+			val1 = !val0;
+		} else {
+			for (i=0; i<n; i++) {
+				if (buf[i] != base[i]) {
+					pos = i;
+					val0 = base[i];
+					val1 = buf[i];
+					break;
+				}
+			}
+		}
+
+		// bit is not transmitted
+		if (pos == UINT_MAX)
+			continue;
+
+		i = decoders[proto].nbits++;
+		decoders[proto].bits[i].bit = b;
+		decoders[proto].bits[i].pos = pos;
+		decoders[proto].bits[i].val0 = val0;
+		decoders[proto].bits[i].val1 = val1;
+	}
+}
+
+/*
+ * Check the message against the encoded scancode. Returns how well it fits,
+ * the lower the better, or UINT_MAX if it doesn't.
+ */
+static unsigned decode_verify(enum rc_proto proto, unsigned scancode,
+			      const unsigned *buf, unsigned len)
+{
+	unsigned expected[DECODE_MAX_EDGES];
+	unsigned i, n, error = 0;
+
+	n = protocols[proto].encode(proto, scancode, expected);
+	if (n != len)
+		return UINT_MAX;
+
+	for (i=0; i<n; i++) {
+		unsigned diff = buf[i] > expected[i] ?
+			buf[i] - expected[i] : expected[i] - buf[i];
+
+		if (diff > expected[i] * 3 / 10 + 100)
+			return UINT_MAX;
+
+		error += diff * 1000 / expected[i];
+	}
+
+	return error / n;
+}
+
+static unsigned decode_proto(enum rc_proto proto, const unsigned *buf, unsigned len,
+			     unsigned *scancode)
+{
+	unsigned quantized[DECODE_MAX_EDGES];
+	unsigned i, s = 0;
+
+	if (!decoders[proto].learned)
+		decoder_learn(proto);
+
+	if (decoders[proto].by_time) {
+		unsigned unit = decoders[proto].unit;
+
+		// resynchronize on every edge; the leader can be long, so
+		// take it as is rather than rounding off its error
+		for (i=0; i<len; i++) {
+			if (i < decoders[proto].leader_len)
+				quantized[i] = decoders[proto].leader[i];
+			else
+				quantized[i] = (buf[i] + unit / 2) / unit * unit;
+			if (!quantized[i])
+				quantized[i] = unit;
+		}
+
+		for (i=0; i<decoders[proto].nbits; i++) {
+			if (level_at(quantized, len, decoders[proto].bits[i].pos) !=
+			    decoders[proto].bits[i].val0)
+				s |= 1u << decoders[proto].bits[i].bit;
+		}
+	} else {
+		if (len != decoders[proto].edges)
+			return UINT_MAX;
+
+		for (i=0; i<decoders[proto].nbits; i++) {
+			unsigned v = buf[decoders[proto].bits[i].pos];
+			unsigned v0 = decoders[proto].bits[i].val0;
+			unsigned v1 = decoders[proto].bits[i].val1;
+			unsigned d0 = v > v0 ? v - v0 : v0 - v;
+			unsigned d1 = v > v1 ? v - v1 : v1 - v;
+
+			if (d1 < d0)
+				s |= 1u << decoders[proto].bits[i].bit;
+		}
+	}
+
+	*scancode = s;
+	return decode_verify(proto, s, buf, len);
+}
+
+/*
+ * Several protocols may fit, e.g. sony and rc6 have similar timings, so pick
+ * the one that fits best. If they fit equally well, like nec and nec32 do,
+ * pick the first one.
+ */
+bool protocol_decode(const unsigned *buf, unsigned len, enum rc_proto *proto,
+		     unsigned *scancode)
+{
+	unsigned best = UINT_MAX;
+	enum rc_proto p;
+
+	if (len == 0 || len >= DECODE_MAX_EDGES)
+		return false;
+
+	for (p=0; p<ARRAY_SIZE(protocols); p++) {
+		unsigned s, error;
+
+		// rc6_mce is decoded as rc6_6a_32, see below
+		if (!protocols[p].encode || p == RC_PROTO_RC6_MCE)
+			continue;
+
+		error = decode_proto(p, buf, len, &s);
+		if (error < best) {
+			best = error;
+			*proto = p;
+			*scancode = s;
+		}
+	}
+
+	if (best == UINT_MAX)
+		return false;
+
+	if (*proto == RC_PROTO_RC6_6A_32 &&
+	    (*scancode & 0xffff0000) == 0x800f0000) {
+		*proto = RC_PROTO_RC6_MCE;
+		*scancode &= protocols[*proto].scancode_mask;
+	}
+
+	return true;
+}
+
+/*
+ * The stream decoder runs all the protocols at once over the pulses and
+ * spaces, as they are received. A message starts at the first pulse after
+ * a long space, and each protocol follows it edge by edge, checking each
+ * edge against the range learned by decoder_learn(), or against the
+ * leader and the protocol unit for the bi-phase protocols. Most protocols
+ * give up after an edge or two, so only the ones which fit the whole
+ * message are decoded, by decode_proto(), once the space after it is long
+ * enough to tell that the message is over.
+ */
+#define DECODE_GAP 6000
+#define DECODE_RING 256
+
+struct protocol_decoder {
+	protocol_decoded_fn fn;
+	void *priv;
+	/* the edges received so far, the last DECODE_RING of them */
+	unsigned ring[DECODE_RING];
+	unsigned long num_edges;
+	/* the edge being received */
+	bool pulse;
+	unsigned duration;
+	bool gap;
+	/* no edge since the last gap, so the next pulse starts a message */
+	bool idle;
+	/* bitmasks of protocols */
+	uint64_t enabled;
+	uint64_t active;
+	/* all the edges are there, waiting for the gap */
+	uint64_t complete;
+	/* the first edge of the message, for the active protocols */
+	unsigned long start[ARRAY_SIZE(protocols)];
+};
+
+struct protocol_decoder *protocol_decoder_new(protocol_decoded_fn fn, void *priv)
+{
+	struct protocol_decoder *d;
+	enum rc_proto p;
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	d->fn = fn;
+	d->priv = priv;
+	d->idle = true;
+
+	for (p=0; p<ARRAY_SIZE(protocols); p++) {
+		// rc6_mce is decoded as rc6_6a_32, see protocol_decode()
+		if (!protocols[p].encode || p == RC_PROTO_RC6_MCE)
+			continue;
+
+		if (!decoders[p].learned)
+			decoder_learn(p);
+		d->enabled |= 1ull << p;
+	}
+
+	return d;
+}
+
+void protocol_decoder_free(struct protocol_decoder *d)
+{
+	free(d);
+}
+
+/* Is the duration the expected one, within the tolerance of decode_verify() */
+static bool decode_near(unsigned val, unsigned expected)
+{
+	return val + expected * 3 / 10 + 100 >= expected &&
+	       val <= expected + expected * 3 / 10 + 100;
+}
+
+/* Does the edge, the n-th of the message, fit the protocol */
+static bool decoder_edge(enum rc_proto proto, unsigned n, unsigned val)
+{
+	unsigned unit, k;
+
+	if (!decoders[proto].by_time)
+		return n < decoders[proto].edges &&
+		       val >= decoders[proto].lo[n] && val <= decoders[proto].hi[n];
+
+	if (n < decoders[proto].leader_len)
+		return decode_near(val, decoders[proto].leader[n]);
+
+	if (n >= protocols[proto].max_edges)
+		return false;
+
+	unit = decoders[proto].unit;
+	k = (val + unit / 2) / unit;
+	if (!k)
+		k = 1;
+
+	return decode_near(val, k * unit);
+}
+
+static void decoder_add_edge(struct protocol_decoder *d, bool pulse, unsigned val)
+{
+	unsigned long edge = d->num_edges++;
+	uint64_t m;
+
+	d->ring[edge % DECODE_RING] = val;
+
+	// an edge after the last one means it wasn't the protocol
+	d->active &= ~d->complete;
+	d->complete = 0;
+
+	for (m = d->active; m; m &= m - 1) {
+		enum rc_proto p = __builtin_ctzll(m);
+		unsigned n = edge - d->start[p];
+
+		if (!decoder_edge(p, n, val))
+			d->active &= ~(1ull << p);
+		else if (!decoders[p].by_time && n + 1 == decoders[p].edges)
+			d->complete |= 1ull << p;
+	}
+
+	if (!d->idle || !pulse)
+		return;
+
+	d->idle = false;
+	for (m = d->enabled & ~d->active; m; m &= m - 1) {
+		enum rc_proto p = __builtin_ctzll(m);
+
+		if (decoder_edge(p, 0, val)) {
+			d->active |= 1ull << p;
+			d->start[p] = edge;
+		}
+	}
+}
+
+/* The message is over: pick the protocol that fits it best */
+static void decoder_gap(struct protocol_decoder *d)
+{
+	unsigned buf[DECODE_MAX_EDGES];
+	unsigned best = UINT_MAX, best_scancode = 0;
+	enum rc_proto best_proto = RC_PROTO_UNKNOWN;
+	uint64_t m, done = d->complete, keep = 0;
+
+	for (m = d->active & ~d->complete; m; m &= m - 1) {
+		enum rc_proto p = __builtin_ctzll(m);
+		unsigned n = d->num_edges - d->start[p];
+
+		// the bi-phase protocols have no fixed length, they end here
+		if (decoders[p].by_time)
+			done |= 1ull << p;
+		// the sharp protocol has a long space in the middle
+		else if (n < decoders[p].edges && decoders[p].hi[n] >= DECODE_GAP)
+			keep |= 1ull << p;
+	}
+
+	d->active = keep;
+	d->complete = 0;
+	d->idle = true;
+
+	for (m = done; m; m &= m - 1) {
+		enum rc_proto p = __builtin_ctzll(m);
+		unsigned long e;
+		unsigned len = 0, s, error;
+
+		for (e = d->start[p]; e < d->num_edges; e++)
+			buf[len++] = d->ring[e % DECODE_RING];
+
+		error = decode_proto(p, buf, len, &s);
+		if (error < best) {
+			best = error;
+			best_proto = p;
+			best_scancode = s;
+		}
+	}
+
+	if (best == UINT_MAX)
+		return;
+
+	if (best_proto == RC_PROTO_RC6_6A_32 &&
+	    (best_scancode & 0xffff0000) == 0x800f0000) {
+		best_proto = RC_PROTO_RC6_MCE;
+		best_scancode &= protocols[best_proto].scancode_mask;
+	}
+
+	d->fn(d->priv, best_proto, best_scancode);
+}
+
+void protocol_decoder_sample(struct protocol_decoder *d, unsigned msg, unsigned val)
+{
+	bool pulse = msg == LIRC_MODE2_PULSE;
+
+	switch (msg) {
+	case LIRC_MODE2_PULSE:
+	case LIRC_MODE2_SPACE:
+		break;
+	case LIRC_MODE2_TIMEOUT:
+	case LIRC_MODE2_OVERFLOW:
+		protocol_decoder_flush(d);
+		return;
+	default:
+		return;
+	}
+
+	if (d->duration && d->pulse == pulse) {
+		d->duration += val;
+	} else {
+		if (d->duration)
+			decoder_add_edge(d, d->pulse, d->duration);
+		d->pulse = pulse;
+		d->duration = val;
+		d->gap = false;
+	}
+
+	// the space isn't over yet, but it's long enough to end the message
+	if (!pulse && !d->gap && d->duration >= DECODE_GAP) {
+		d->gap = true;
+		decoder_gap(d);
+	}
+}
+
+void protocol_decoder_flush(struct protocol_decoder *d)
+{
+	if (d->duration && d->pulse)
+		decoder_add_edge(d, true, d->duration);
+	if (!d->gap)
+		decoder_gap(d);
+
+	// whatever was going on, it's over
+	d->active = 0;
+	d->duration = 0;
+	d->gap = false;
+}
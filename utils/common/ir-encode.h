@@ -11,6 +11,14 @@ void protocol_scancode_valid(enum rc_proto *proto, unsigned *scancode);
 unsigned protocol_scancode_mask(enum rc_proto proto);
 bool protocol_encoder_available(enum rc_proto proto);
 unsigned protocol_encode(enum rc_proto proto, unsigned scancode, unsigned *buf);
+bool protocol_decode(const unsigned *buf, unsigned len, enum rc_proto *proto, unsigned *scancode);
 const char *protocol_name(enum rc_proto proto);
 
+struct protocol_decoder;
+typedef void (*protocol_decoded_fn)(void *priv, enum rc_proto proto, unsigned scancode);
+struct protocol_decoder *protocol_decoder_new(protocol_decoded_fn fn, void *priv);
+void protocol_decoder_sample(struct protocol_decoder *d, unsigned msg, unsigned val);
+void protocol_decoder_flush(struct protocol_decoder *d);
+void protocol_decoder_free(struct protocol_decoder *d);
+
 #endif
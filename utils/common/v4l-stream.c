@@ -5,12 +5,26 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <netinet/in.h>
+#include <sys/stat.h>
 
 #include "v4l-stream.h"
 #include "codec-fwht.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RLE_SIMD_X86
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define RLE_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
 #define MIN_WIDTH  64
 #define MAX_WIDTH  4096
@@ -60,6 +74,99 @@ unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat)
 	}
 }
 
+/*
+ * Runs are found and written 32 bytes at a time, the C loops in rle_run()
+ * and rle_fill() do whatever is left.
+ */
+#ifdef RLE_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+
+static SSE2 unsigned rle_run_sse2(const __u32 *p, unsigned n, unsigned max)
+{
+	__m128i v = _mm_set1_epi32(*p);
+
+	for (; n + 8 <= max; n += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p + n));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + n + 4));
+
+		if (_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi32(a, v),
+						    _mm_cmpeq_epi32(b, v))) != 0xffff)
+			break;
+	}
+	return n;
+}
+
+static SSE2 __u32 *rle_fill_sse2(__u32 *dst, __u32 v, unsigned *n)
+{
+	__m128i vv = _mm_set1_epi32(v);
+
+	for (; *n >= 8; *n -= 8, dst += 8) {
+		_mm_storeu_si128((__m128i *)dst, vv);
+		_mm_storeu_si128((__m128i *)(dst + 4), vv);
+	}
+	return dst;
+}
+
+#endif /* RLE_SIMD_X86 */
+
+#ifdef RLE_SIMD_NEON
+
+static unsigned rle_run_neon(const __u32 *p, unsigned n, unsigned max)
+{
+	uint32x4_t v = vdupq_n_u32(*p);
+
+	for (; n + 8 <= max; n += 8) {
+		uint32x4_t eq = vandq_u32(vceqq_u32(vld1q_u32(p + n), v),
+					  vceqq_u32(vld1q_u32(p + n + 4), v));
+		uint32x2_t m = vand_u32(vget_low_u32(eq), vget_high_u32(eq));
+
+		if ((vget_lane_u32(m, 0) & vget_lane_u32(m, 1)) != 0xffffffff)
+			break;
+	}
+	return n;
+}
+
+static __u32 *rle_fill_neon(__u32 *dst, __u32 v, unsigned *n)
+{
+	uint32x4_t vv = vdupq_n_u32(v);
+
+	for (; *n >= 8; *n -= 8, dst += 8) {
+		vst1q_u32(dst, vv);
+		vst1q_u32(dst + 4, vv);
+	}
+	return dst;
+}
+
+#endif /* RLE_SIMD_NEON */
+
+/* Returns the first index from n on, below max, where p[] differs from *p */
+static unsigned rle_run(const __u32 *p, unsigned n, unsigned max)
+{
+#if defined(RLE_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2)
+		n = rle_run_sse2(p, n, max);
+#elif defined(RLE_SIMD_NEON)
+	n = rle_run_neon(p, n, max);
+#endif
+	while (n < max && p[n] == *p)
+		n++;
+	return n;
+}
+
+static __u32 *rle_fill(__u32 *dst, __u32 v, unsigned n)
+{
+#if defined(RLE_SIMD_X86)
+	if (cpu_get_flags() & CPU_SSE2)
+		dst = rle_fill_sse2(dst, v, &n);
+#elif defined(RLE_SIMD_NEON)
+	dst = rle_fill_neon(dst, v, &n);
+#endif
+	while (n--)
+		*dst++ = v;
+	return dst;
+}
+
 void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 {
 	__u32 magic_x = ntohl(V4L_STREAM_PACKET_FRAME_VIDEO_X_RLE);
@@ -95,8 +202,7 @@ void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 			i += 8;
 		}
 
-		while (n--)
-			*dst++ = v;
+		dst = rle_fill(dst, v, n);
 
 		if (dst == next_line) {
 			while (l--) {
@@ -159,10 +265,7 @@ unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
 			*dst++ = *p;
 			continue;
 		}
-		n = 4;
-
-		while (i + n * 4 < max && *p == p[n])
-			n++;
+		n = rle_run(p, 4, (max - i) / 4);
 		*dst++ = magic_x;
 		*dst++ = p[1];
 		*dst++ = htonl(n);
@@ -181,6 +284,7 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 	const struct v4l2_fwht_pixfmt_info *info = v4l2_fwht_find_pixfmt(pixfmt);
 	unsigned int chroma_div;
 	unsigned int size = coded_width * coded_height;
+	long cpus;
 
 	// fwht expects macroblock alignment, check can be dropped once that
 	// restriction is lifted.
@@ -234,6 +338,10 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 		ctx->state.ref_frame.alpha = NULL;
 	ctx->state.gop_size = 10;
 	ctx->state.gop_cnt = 0;
+	/* Encode and decode with a thread per CPU */
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	ctx->state.stripes = cpus < 1 ? 1 :
+		cpus > FWHT_MAX_STRIPES ? FWHT_MAX_STRIPES : cpus;
 	return ctx;
 }
 
@@ -298,3 +406,195 @@ bool fwht_decompress(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
 	copy_cap_to_ref(p_out, ctx->state.info, &ctx->state);
 	return true;
 }
+
+static __u64 clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+__u64 v4l_stream_trace_now(void)
+{
+	return clock_ns(CLOCK_REALTIME);
+}
+
+/* Convert a CLOCK_MONOTONIC time, like a buffer timestamp, to the trace clock */
+__u64 v4l_stream_trace_from_monotonic(__u64 ns)
+{
+	__u64 now = clock_ns(CLOCK_MONOTONIC);
+
+	return v4l_stream_trace_now() - (now > ns ? now - ns : 0);
+}
+
+void v4l_stream_trace_init(struct v4l_stream_trace *trace, __u32 sequence)
+{
+	memset(trace, 0, sizeof(*trace));
+	trace->sequence = sequence;
+}
+
+/* Stages beyond V4L_STREAM_TRACE_MAX_STAGES are dropped */
+void v4l_stream_trace_add(struct v4l_stream_trace *trace, unsigned stage,
+			  __u64 start_ns, __u64 end_ns)
+{
+	unsigned i = trace->num_stages;
+
+	if (i >= V4L_STREAM_TRACE_MAX_STAGES)
+		return;
+	trace->stages[i].stage = stage;
+	trace->stages[i].start_ns = start_ns;
+	trace->stages[i].end_ns = end_ns > start_ns ? end_ns : start_ns;
+	trace->num_stages++;
+}
+
+/* The end of the last stage, 0 if there are none */
+__u64 v4l_stream_trace_last_end(const struct v4l_stream_trace *trace)
+{
+	__u64 end = 0;
+	unsigned i;
+
+	for (i = 0; i < trace->num_stages; i++)
+		if (trace->stages[i].end_ns > end)
+			end = trace->stages[i].end_ns;
+	return end;
+}
+
+const char *v4l_stream_trace_stage_name(unsigned stage)
+{
+	static const char *names[V4L_STREAM_TRACE_NUM_STAGES] = {
+		[V4L_STREAM_TRACE_CAPTURE] = "capture",
+		[V4L_STREAM_TRACE_CONVERT] = "convert",
+		[V4L_STREAM_TRACE_M2M] = "m2m",
+		[V4L_STREAM_TRACE_COMPRESS] = "compress",
+		[V4L_STREAM_TRACE_TRANSFER] = "transfer",
+		[V4L_STREAM_TRACE_DECOMPRESS] = "decompress",
+		[V4L_STREAM_TRACE_OUTPUT] = "output",
+		[V4L_STREAM_TRACE_DISPLAY] = "display",
+	};
+
+	return stage < V4L_STREAM_TRACE_NUM_STAGES ? names[stage] : "unknown";
+}
+
+/* Fill the V4L_STREAM_TRACE_SIZE bytes of words in network order */
+void v4l_stream_trace_pack(const struct v4l_stream_trace *trace, __u32 *words)
+{
+	unsigned i;
+
+	memset(words, 0, V4L_STREAM_TRACE_SIZE);
+	*words++ = htonl(trace->sequence);
+	*words++ = htonl(trace->num_stages);
+	for (i = 0; i < trace->num_stages; i++) {
+		*words++ = htonl(trace->stages[i].stage);
+		*words++ = htonl(trace->stages[i].start_ns >> 32);
+		*words++ = htonl(trace->stages[i].start_ns & 0xffffffff);
+		*words++ = htonl(trace->stages[i].end_ns >> 32);
+		*words++ = htonl(trace->stages[i].end_ns & 0xffffffff);
+	}
+}
+
+bool v4l_stream_trace_unpack(struct v4l_stream_trace *trace, const __u32 *words)
+{
+	unsigned i;
+
+	v4l_stream_trace_init(trace, ntohl(words[0]));
+	trace->num_stages = ntohl(words[1]);
+	if (trace->num_stages > V4L_STREAM_TRACE_MAX_STAGES) {
+		trace->num_stages = 0;
+		return false;
+	}
+	words += 2;
+	for (i = 0; i < trace->num_stages; i++, words += 5) {
+		trace->stages[i].stage = ntohl(words[0]);
+		trace->stages[i].start_ns = (__u64)ntohl(words[1]) << 32 | ntohl(words[2]);
+		trace->stages[i].end_ns = (__u64)ntohl(words[3]) << 32 | ntohl(words[4]);
+	}
+	return true;
+}
+
+/*
+ * The trace file is written as Chrome trace events in the JSON array
+ * format, which may lack the closing bracket. That way several processes
+ * can append to the same file: it is opened with O_APPEND and the events
+ * of a frame are written with a single write().
+ *
+ * Returns the fd of the trace file, or -1 with errno set.
+ */
+int v4l_stream_trace_open(const char *filename, const char *process)
+{
+	char buf[4096];
+	struct stat st;
+	int len = 0;
+	unsigned i;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (!fstat(fd, &st) && !st.st_size)
+		len = snprintf(buf, sizeof(buf), "[\n");
+
+	/* Name the tracks: the process and a thread per stage */
+	len += snprintf(buf + len, sizeof(buf) - len,
+			"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+			"\"args\":{\"name\":\"%s\"}},\n", getpid(), process);
+	for (i = 0; i < V4L_STREAM_TRACE_NUM_STAGES; i++) {
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+				"\"args\":{\"name\":\"%s\"}},\n",
+				getpid(), i + 1, v4l_stream_trace_stage_name(i));
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+				"\"args\":{\"sort_index\":%u}},\n", getpid(), i + 1, i);
+	}
+	if (write(fd, buf, len) != len) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Each stage becomes a complete event on the track of the stage, and the
+ * stages of a frame are connected by flow events.
+ */
+bool v4l_stream_trace_write(int fd, const struct v4l_stream_trace *trace)
+{
+	/* Unique in the file, and below 2^53 for JSON parsers using doubles */
+	__u64 id = (__u64)(getpid() & 0x1fffff) << 32 | trace->sequence;
+	char buf[4096];
+	int len = 0;
+	unsigned i;
+
+	for (i = 0; i < trace->num_stages; i++) {
+		__u64 start = trace->stages[i].start_ns;
+		__u64 dur = trace->stages[i].end_ns - start;
+		__u64 mid = start + dur / 2;
+		unsigned stage = trace->stages[i].stage;
+		unsigned tid = (stage < V4L_STREAM_TRACE_NUM_STAGES ?
+				stage : V4L_STREAM_TRACE_NUM_STAGES) + 1;
+		const char *ph = "t";
+
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\","
+				"\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%u,"
+				"\"args\":{\"sequence\":%u}},\n",
+				v4l_stream_trace_stage_name(stage),
+				(unsigned long long)(start / 1000), (unsigned)(start % 1000),
+				(unsigned long long)(dur / 1000), (unsigned)(dur % 1000),
+				getpid(), tid, trace->sequence);
+		if (trace->num_stages < 2)
+			continue;
+		if (i == 0)
+			ph = "s";
+		else if (i == trace->num_stages - 1)
+			ph = "f\",\"bp\":\"e";
+		len += snprintf(buf + len, sizeof(buf) - len,
+				"{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%s\",\"id\":%llu,"
+				"\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%u},\n",
+				ph, (unsigned long long)id,
+				(unsigned long long)(mid / 1000), (unsigned)(mid % 1000),
+				getpid(), tid);
+	}
+	return write(fd, buf, len) == len;
+}
@@ -130,12 +130,120 @@ extern "C" {
  * details.
  */
 
+/*
+ * Frame tracing (v4l2-ctl --stream-trace, qvidcap --trace):
+ *
+ * A frame can carry a trace context: the sequence number it was captured
+ * with and the start and end time of each stage it went through so far.
+ * The times are CLOCK_REALTIME in ns, so that the stages of frames that are
+ * streamed between hosts with synchronized clocks line up.
+ *
+ * If a frame video packet carries a trace context, then size_hdr is
+ * V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE instead of
+ * V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR and flags is followed by:
+ *
+ * uint32_t sequence;
+ * uint32_t num_stages;
+ * struct stage {
+ * 	uint32_t stage;		// enum v4l_stream_trace_stage
+ * 	uint32_t start_hi;	// start time in ns, high and low 32 bits
+ * 	uint32_t start_lo;
+ * 	uint32_t end_hi;	// end time in ns
+ * 	uint32_t end_lo;
+ * } stages[V4L_STREAM_TRACE_MAX_STAGES];	// only num_stages are used
+ *
+ * Receivers without tracing support reject these packets, so senders only
+ * add the trace context when asked to.
+ */
+#define V4L_STREAM_TRACE_MAX_STAGES			8
+#define V4L_STREAM_TRACE_SIZE				((2 + 5 * V4L_STREAM_TRACE_MAX_STAGES) * 4)
+#define V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE	(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR + \
+							 V4L_STREAM_TRACE_SIZE)
+
+enum v4l_stream_trace_stage {
+	V4L_STREAM_TRACE_CAPTURE,	/* driver timestamp until DQBUF */
+	V4L_STREAM_TRACE_CONVERT,	/* libv4l2 format conversion */
+	V4L_STREAM_TRACE_M2M,		/* OUTPUT QBUF until CAPTURE DQBUF */
+	V4L_STREAM_TRACE_COMPRESS,	/* FWHT or RLE compression */
+	V4L_STREAM_TRACE_TRANSFER,	/* previous stage until the packet arrived */
+	V4L_STREAM_TRACE_DECOMPRESS,	/* packet arrived until decompressed */
+	V4L_STREAM_TRACE_OUTPUT,	/* QBUF until DQBUF on an output device */
+	V4L_STREAM_TRACE_DISPLAY,	/* previous stage until shown on screen */
+	V4L_STREAM_TRACE_NUM_STAGES
+};
+
+struct v4l_stream_trace {
+	__u32 sequence;
+	__u32 num_stages;
+	struct {
+		__u32 stage;
+		__u64 start_ns;
+		__u64 end_ns;
+	} stages[V4L_STREAM_TRACE_MAX_STAGES];
+};
+
 /*
  * This packet ends the stream and, after reading this, the socket can be closed
  * since no more data will follow.
  */
 #define V4L_STREAM_PACKET_END				v4l2_fourcc('e', 'n', 'd', ' ')
 
+/*
+ * Shared memory frame ring (v4l2-ctl --stream-to-shm)
+ *
+ * The POSIX shared memory object starts with struct v4l_shm_header,
+ * followed by 'slots' slots of 'slot_size' bytes each, starting at
+ * offset 'slot_offset'. Each slot starts with struct v4l_shm_slot,
+ * followed by the plane data at the given offsets from the slot start.
+ * All values are in host order.
+ *
+ * There is a single writer and any number of readers, which never block
+ * the writer. Frame N (counting from 0) is written to slot N % slots.
+ * The slot 'seq' field is a sequence lock: it is set to 2 * N + 1 before
+ * the slot is written to and to 2 * N + 2 once it is complete. The
+ * header 'head' field is then set to N + 1. Readers load 'head' and the
+ * slot 'seq' with acquire semantics, use the data in place, and then
+ * load 'seq' again: if it changed, the writer reused the slot meanwhile
+ * and the data must be discarded.
+ *
+ * When streaming stops, or the format changes, the writer sets 'magic' to
+ * 0 and removes the object. It creates a new one if streaming continues,
+ * so readers that find 'magic' cleared should open the object again.
+ */
+#define V4L_SHM_MAGIC			v4l2_fourcc('V', '4', 'L', 'S')
+#define V4L_SHM_VERSION			1
+
+struct v4l_shm_header {
+	__u32 magic;
+	__u32 version;
+	__u32 slots;
+	__u32 slot_offset;
+	__u32 slot_size;
+	__u32 pixelformat;
+	__u32 width;
+	__u32 height;
+	__u32 field;
+	__u32 colorspace;
+	__u32 ycbcr_enc;
+	__u32 quantization;
+	__u32 xfer_func;
+	__u32 num_planes;
+	__u32 sizeimage[VIDEO_MAX_PLANES];
+	__u32 bytesperline[VIDEO_MAX_PLANES];
+	__u64 head;
+};
+
+struct v4l_shm_slot {
+	__u64 seq;
+	__u64 timestamp_ns;	/* buffer timestamp */
+	__u32 sequence;		/* buffer sequence number */
+	__u32 field;
+	__u32 flags;		/* V4L2_BUF_FLAG_* */
+	__u32 num_planes;
+	__u32 bytesused[VIDEO_MAX_PLANES];
+	__u32 offset[VIDEO_MAX_PLANES];
+};
+
 struct codec_ctx {
 	struct v4l2_fwht_state	state;
 	unsigned int		flags;
@@ -156,6 +264,18 @@ bool fwht_decompress(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
 		     __u8 *buf, unsigned size);
 unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat);
 
+__u64 v4l_stream_trace_now(void);
+__u64 v4l_stream_trace_from_monotonic(__u64 ns);
+void v4l_stream_trace_init(struct v4l_stream_trace *trace, __u32 sequence);
+void v4l_stream_trace_add(struct v4l_stream_trace *trace, unsigned stage,
+			  __u64 start_ns, __u64 end_ns);
+__u64 v4l_stream_trace_last_end(const struct v4l_stream_trace *trace);
+const char *v4l_stream_trace_stage_name(unsigned stage);
+void v4l_stream_trace_pack(const struct v4l_stream_trace *trace, __u32 *words);
+bool v4l_stream_trace_unpack(struct v4l_stream_trace *trace, const __u32 *words);
+int v4l_stream_trace_open(const char *filename, const char *process);
+bool v4l_stream_trace_write(int fd, const struct v4l_stream_trace *trace);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -8,6 +8,7 @@
  * Copyright 2014 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <pthread.h>
 #include "compiler.h"
 #include "v4l2-tpg-colors.h"
 
@@ -78,6 +79,10 @@ static const s8 sin[257] = {
 /* Global font descriptor */
 static const u8 *font8x16;
 
+/* A glyph line is 8 pixels of at most 4 bytes */
+#define TPG_GLYPH_LINE_SIZE	32
+#define TPG_GLYPHS_SIZE		(256 * 16 * TPG_GLYPH_LINE_SIZE)
+
 void tpg_set_font(const u8 *f)
 {
 	font8x16 = f;
@@ -153,6 +158,11 @@ int tpg_alloc(struct tpg_data *tpg, unsigned max_w)
 			ret = -ENOMEM;
 			goto free_contrast_line;
 		}
+		tpg->glyphs[plane] = vzalloc(TPG_GLYPHS_SIZE);
+		if (!tpg->glyphs[plane]) {
+			ret = -ENOMEM;
+			goto free_contrast_line;
+		}
 	}
 	return 0;
 
@@ -161,9 +171,11 @@ free_contrast_line:
 		vfree(tpg->contrast_line[plane]);
 		vfree(tpg->black_line[plane]);
 		vfree(tpg->random_line[plane]);
+		vfree(tpg->glyphs[plane]);
 		tpg->contrast_line[plane] = NULL;
 		tpg->black_line[plane] = NULL;
 		tpg->random_line[plane] = NULL;
+		tpg->glyphs[plane] = NULL;
 	}
 free_lines:
 	for (pat = 0; pat < TPG_MAX_PAT_LINES; pat++)
@@ -196,15 +208,23 @@ void tpg_free(struct tpg_data *tpg)
 		vfree(tpg->contrast_line[plane]);
 		vfree(tpg->black_line[plane]);
 		vfree(tpg->random_line[plane]);
+		vfree(tpg->glyphs[plane]);
+		vfree(tpg->noise_pairs[plane]);
 		tpg->contrast_line[plane] = NULL;
 		tpg->black_line[plane] = NULL;
 		tpg->random_line[plane] = NULL;
+		tpg->glyphs[plane] = NULL;
+		tpg->noise_pairs[plane] = NULL;
 	}
+	tpg->glyphs_valid = false;
 }
 
+static void tpg_s_gen_twopix(struct tpg_data *tpg);
+
 bool tpg_s_fourcc(struct tpg_data *tpg, u32 fourcc)
 {
 	tpg->fourcc = fourcc;
+	tpg_s_gen_twopix(tpg);
 	tpg->planes = 1;
 	tpg->buffers = 1;
 	tpg->recalc_colors = true;
@@ -892,12 +912,13 @@ static void precalculate_color(struct tpg_data *tpg, int k)
 		r = tpg_colors[col].r;
 		g = tpg_colors[col].g;
 		b = tpg_colors[col].b;
+	} else if (k >= TPG_COLOR_RAMP) {
+		/* The noise pattern uses these as its grey levels */
+		r = g = b = k - TPG_COLOR_RAMP;
 	} else if (tpg->pattern == TPG_PAT_NOISE) {
 		r = g = b = get_random_u8();
 	} else if (k == TPG_COLOR_RANDOM) {
 		r = g = b = tpg->qual_offset + get_random_u32_below(196);
-	} else if (k >= TPG_COLOR_RAMP) {
-		r = g = b = k - TPG_COLOR_RAMP;
 	}
 
 	if (tpg->pattern == TPG_PAT_CSC_COLORBAR && col <= TPG_COLOR_CSC_BLACK) {
@@ -1121,8 +1142,8 @@ static void tpg_precalculate_colors(struct tpg_data *tpg)
 }
 
 /* 'odd' is true for pixels 1, 3, 5, etc. and false for pixels 0, 2, 4, etc. */
-static void gen_twopix(struct tpg_data *tpg,
-		u8 buf[TPG_MAX_PLANES][8], int color, bool odd)
+static __always_inline void __gen_twopix(struct tpg_data *tpg,
+		u8 buf[TPG_MAX_PLANES][8], int color, bool odd, u32 fourcc)
 {
 	unsigned offset = odd * tpg->twopixelsize[0] / 2;
 	u8 alpha = tpg->alpha_component;
@@ -1138,7 +1159,7 @@ static void gen_twopix(struct tpg_data *tpg,
 	g_u_s = tpg->colors[color][1]; /* G or precalculated U, V */
 	b_v = tpg->colors[color][2]; /* B or precalculated V */
 
-	switch (tpg->fourcc) {
+	switch (fourcc) {
 	case V4L2_PIX_FMT_GREY:
 		buf[0][offset] = r_y_h;
 		break;
@@ -1533,6 +1554,64 @@ static void gen_twopix(struct tpg_data *tpg,
 	}
 }
 
+/*
+ * With a constant fourcc the switch in __gen_twopix() folds away, so this
+ * gives a gen_twopix_<fourcc>() for each fourcc that only does the work for
+ * that format. tpg_s_fourcc() selects the one to use.
+ */
+#define TPG_TWOPIX_FOURCCS(X) X(GREY) X(Y10) X(Y12) X(Y16) X(Z16) X(Y16_BE) \
+	X(YUV422M) X(YUV422P) X(YUV420) X(YUV420M) X(YVU422M) X(YVU420) \
+	X(YVU420M) X(NV12) X(NV12M) X(NV16) X(NV16M) X(NV21) X(NV21M) X(NV61) \
+	X(NV61M) X(YUV444M) X(YVU444M) X(NV24) X(NV42) X(YUYV) X(UYVY) \
+	X(YVYU) X(VYUY) X(RGB332) X(YUV565) X(RGB565) X(RGB565X) X(RGB444) \
+	X(XRGB444) X(YUV444) X(ARGB444) X(RGBX444) X(RGBA444) X(XBGR444) \
+	X(ABGR444) X(BGRX444) X(BGRA444) X(RGB555) X(XRGB555) X(YUV555) \
+	X(ARGB555) X(RGBX555) X(RGBA555) X(XBGR555) X(ABGR555) X(BGRX555) \
+	X(BGRA555) X(RGB555X) X(XRGB555X) X(ARGB555X) X(RGB24) X(HSV24) \
+	X(BGR24) X(BGR666) X(RGB32) X(XRGB32) X(HSV32) X(XYUV32) X(YUV32) \
+	X(ARGB32) X(AYUV32) X(RGBX32) X(YUVX32) X(RGBA32) X(YUVA32) X(BGR32) \
+	X(XBGR32) X(VUYX32) X(ABGR32) X(VUYA32) X(BGRX32) X(BGRA32) X(SBGGR8) \
+	X(SGBRG8) X(SGRBG8) X(SRGGB8) X(SBGGR10) X(SGBRG10) X(SGRBG10) \
+	X(SRGGB10) X(SBGGR12) X(SGBRG12) X(SGRBG12) X(SRGGB12) X(SBGGR16) \
+	X(SGBRG16) X(SGRBG16) X(SRGGB16)
+
+#define TPG_GEN_TWOPIX(fmt)						\
+static void gen_twopix_##fmt(struct tpg_data *tpg,			\
+		u8 buf[TPG_MAX_PLANES][8], int color, bool odd)		\
+{									\
+	__gen_twopix(tpg, buf, color, odd, V4L2_PIX_FMT_##fmt);		\
+}
+
+TPG_TWOPIX_FOURCCS(TPG_GEN_TWOPIX)
+
+static void gen_twopix_any(struct tpg_data *tpg,
+		u8 buf[TPG_MAX_PLANES][8], int color, bool odd)
+{
+	__gen_twopix(tpg, buf, color, odd, tpg->fourcc);
+}
+
+static void tpg_s_gen_twopix(struct tpg_data *tpg)
+{
+#define TPG_TWOPIX_CASE(fmt)						\
+	case V4L2_PIX_FMT_##fmt:					\
+		tpg->gen_twopix = gen_twopix_##fmt;			\
+		break;
+
+	switch (tpg->fourcc) {
+	TPG_TWOPIX_FOURCCS(TPG_TWOPIX_CASE)
+	default:
+		tpg->gen_twopix = gen_twopix_any;
+		break;
+	}
+#undef TPG_TWOPIX_CASE
+}
+
+static inline void gen_twopix(struct tpg_data *tpg,
+		u8 buf[TPG_MAX_PLANES][8], int color, bool odd)
+{
+	tpg->gen_twopix(tpg, buf, color, odd);
+}
+
 unsigned tpg_g_interleaved_plane(const struct tpg_data *tpg, unsigned buf_line)
 {
 	switch (tpg->fourcc) {
@@ -1777,6 +1856,134 @@ static void tpg_calculate_square_border(struct tpg_data *tpg)
 	}
 }
 
+/*
+ * The noise pattern gets its random numbers from TPG_RNG_LANES xorshift32
+ * generators that are stepped together. The lanes do not depend on each
+ * other, so the compiler can step them with vector instructions.
+ */
+#define TPG_RNG_LANES 8
+/* Each pair of noise pixels is picked with 16 random bits */
+#define TPG_NOISE_PAIRS 65536
+
+struct tpg_rng {
+	u32 s[TPG_RNG_LANES];
+};
+
+static void tpg_rng_seed(struct tpg_rng *rng, u32 seed)
+{
+	unsigned i;
+
+	for (i = 0; i < TPG_RNG_LANES; i++) {
+		u32 x = seed + (i + 1) * 0x9e3779b9;
+
+		/* Mix the bits, so that close seeds give unrelated lanes */
+		x ^= x >> 16;
+		x *= 0x85ebca6b;
+		x ^= x >> 13;
+		x *= 0xc2b2ae35;
+		x ^= x >> 16;
+		rng->s[i] = x ? x : 1;
+	}
+}
+
+static __always_inline void tpg_rng_next(struct tpg_rng *rng,
+					 u32 r[TPG_RNG_LANES])
+{
+	unsigned i;
+
+	for (i = 0; i < TPG_RNG_LANES; i++) {
+		u32 x = rng->s[i];
+
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		rng->s[i] = x;
+		r[i] = x;
+	}
+}
+
+/*
+ * Render the two pixels of each plane for every combination of two grey
+ * levels, so that a line of noise is a copy of random pairs. Returns false
+ * if the pattern is not noise, or there is no memory for the pairs.
+ */
+static bool tpg_precalculate_noise_pairs(struct tpg_data *tpg)
+{
+	u8 pix[TPG_MAX_PLANES][8];
+	unsigned p;
+	unsigned i;
+
+	if (tpg->pattern != TPG_PAT_NOISE)
+		return false;
+
+	for (p = 0; p < tpg->planes; p++) {
+		if (!tpg->noise_pairs[p])
+			tpg->noise_pairs[p] = vzalloc(array_size(TPG_NOISE_PAIRS, 8));
+		if (tpg->noise_pairs[p])
+			continue;
+		for (p = 0; p < TPG_MAX_PLANES; p++) {
+			vfree(tpg->noise_pairs[p]);
+			tpg->noise_pairs[p] = NULL;
+		}
+		return false;
+	}
+
+	for (i = 0; i < TPG_NOISE_PAIRS; i++) {
+		gen_twopix(tpg, pix, TPG_COLOR_RAMP + (i & 0xff), 0);
+		gen_twopix(tpg, pix, TPG_COLOR_RAMP + (i >> 8), 1);
+		for (p = 0; p < tpg->planes; p++) {
+			unsigned twopixsize = tpg->twopixelsize[p];
+
+			memcpy(tpg->noise_pairs[p] + i * twopixsize, pix[p],
+			       twopixsize);
+		}
+	}
+	return true;
+}
+
+/* Copy n random pairs of size bytes, the size is a constant for memcpy() */
+#define TPG_NOISE_COPY(size) do {					\
+	for (i = 0; i < n; i++, vbuf += (size))				\
+		memcpy(vbuf, pairs + (size) * ((i & 1) ? r[i / 2] >> 16 :	\
+					       r[i / 2] & 0xffff), (size));	\
+} while (0)
+
+/* Fill len bytes of a line of plane p with random noise pairs */
+static void tpg_fill_noise_line(const struct tpg_data *tpg, unsigned p,
+				struct tpg_rng *rng, u8 *vbuf, unsigned len)
+{
+	unsigned twopixsize = tpg->twopixelsize[p];
+	const u8 *pairs = tpg->noise_pairs[p];
+	u32 r[TPG_RNG_LANES];
+
+	while (len >= twopixsize) {
+		unsigned n = tpg_min(len / twopixsize, 2 * TPG_RNG_LANES);
+		unsigned i;
+
+		tpg_rng_next(rng, r);
+		len -= n * twopixsize;
+		switch (twopixsize) {
+		case 2:
+			TPG_NOISE_COPY(2);
+			break;
+		case 4:
+			TPG_NOISE_COPY(4);
+			break;
+		case 6:
+			TPG_NOISE_COPY(6);
+			break;
+		case 8:
+			TPG_NOISE_COPY(8);
+			break;
+		default:
+			TPG_NOISE_COPY(twopixsize);
+			break;
+		}
+	}
+	if (len)
+		memcpy(vbuf, pairs, len);
+}
+
 static void tpg_precalculate_line(struct tpg_data *tpg)
 {
 	enum tpg_color contrast;
@@ -1879,14 +2086,23 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 			memcpy(pos, pix[p], twopixsize);
 	}
 
-	for (x = 0; x < tpg->scaled_width * 2; x += 2) {
-		gen_twopix(tpg, pix, TPG_COLOR_RANDOM, 0);
-		gen_twopix(tpg, pix, TPG_COLOR_RANDOM, 1);
-		for (p = 0; p < tpg->planes; p++) {
-			unsigned twopixsize = tpg->twopixelsize[p];
-			u8 *pos = tpg->random_line[p] + x * twopixsize / 2;
+	if (tpg_precalculate_noise_pairs(tpg)) {
+		struct tpg_rng rng;
 
-			memcpy(pos, pix[p], twopixsize);
+		tpg_rng_seed(&rng, get_random_u32());
+		for (p = 0; p < tpg->planes; p++)
+			tpg_fill_noise_line(tpg, p, &rng, tpg->random_line[p],
+					    tpg->scaled_width * tpg->twopixelsize[p]);
+	} else {
+		for (x = 0; x < tpg->scaled_width * 2; x += 2) {
+			gen_twopix(tpg, pix, TPG_COLOR_RANDOM, 0);
+			gen_twopix(tpg, pix, TPG_COLOR_RANDOM, 1);
+			for (p = 0; p < tpg->planes; p++) {
+				unsigned twopixsize = tpg->twopixelsize[p];
+				u8 *pos = tpg->random_line[p] + x * twopixsize / 2;
+
+				memcpy(pos, pix[p], twopixsize);
+			}
 		}
 	}
 
@@ -1981,6 +2197,100 @@ static noinline void tpg_print_str_8(const struct tpg_data *tpg, u8 *basep[TPG_M
 	PRINTSTR(u32);
 }
 
+/*
+ * Render the lines of all font characters in the text colors, in the
+ * same way as PRINTSTR, so that tpg_print_glyphs() only has to copy them.
+ */
+static void tpg_precalculate_glyphs(struct tpg_data *tpg)
+{
+	unsigned p;
+
+	tpg->glyphs_valid = false;
+	if (font8x16 == NULL || tpg->glyphs[0] == NULL)
+		return;
+
+	for (p = 0; p < tpg->planes; p++) {
+		unsigned hdiv = tpg->hdownsampling[p];
+		unsigned pixsz = tpg->twopixelsize[p] / 2;
+		unsigned npix = 8 / hdiv;
+		u8 *glyph = tpg->glyphs[p];
+		unsigned i;
+
+		if (pixsz == 0 || pixsz > 4)
+			continue;
+		for (i = 0; i < 256 * 16; i++, glyph += TPG_GLYPH_LINE_SIZE) {
+			u8 chr = font8x16[i];
+			unsigned x;
+
+			for (x = 0; x < npix; x++) {
+				unsigned bit;
+
+				if (hdiv == 2 && tpg->hflip)
+					bit = 2 * x;
+				else if (hdiv == 2)
+					bit = 7 - 2 * x;
+				else if (tpg->hflip)
+					bit = x;
+				else
+					bit = 7 - x;
+				memcpy(glyph + x * pixsz,
+				       chr & (1 << bit) ? tpg->textfg[p] : tpg->textbg[p],
+				       pixsz);
+			}
+		}
+	}
+	tpg->glyphs_valid = true;
+}
+
+/* The glyph line size is a constant here, so that memcpy() is inlined */
+#define PRINTGLYPHS(SIZE) do {	\
+	unsigned s;	\
+	\
+	for (s = 0; s < len; s++) {	\
+		memcpy(pos, glyphs + (u8)text[s] * 16 * TPG_GLYPH_LINE_SIZE, SIZE);	\
+		pos += tpg->hflip ? -(SIZE) : (SIZE);	\
+	}	\
+} while (0)
+
+static void tpg_print_glyphs(const struct tpg_data *tpg, u8 *basep[TPG_MAX_PLANES][2],
+			unsigned p, unsigned first, unsigned div, unsigned step,
+			int y, int x, const char *text, unsigned len)
+{
+	unsigned vdiv = tpg->vdownsampling[p];
+	unsigned hdiv = tpg->hdownsampling[p];
+	unsigned pixsz = tpg->twopixelsize[p] / 2;
+	int line;
+
+	for (line = first; line < 16; line += vdiv * step) {
+		int l = tpg->vflip ? 15 - line : line;
+		u8 *pos = basep[p][(line / vdiv) & 1] +
+			  ((y * step + l) / (vdiv * div)) * tpg->bytesperline[p] +
+			  (x / hdiv) * pixsz;
+		const u8 *glyphs = tpg->glyphs[p] + line * TPG_GLYPH_LINE_SIZE;
+
+		switch (8 / hdiv * pixsz) {
+		case 4:
+			PRINTGLYPHS(4);
+			break;
+		case 8:
+			PRINTGLYPHS(8);
+			break;
+		case 12:
+			PRINTGLYPHS(12);
+			break;
+		case 16:
+			PRINTGLYPHS(16);
+			break;
+		case 24:
+			PRINTGLYPHS(24);
+			break;
+		case 32:
+			PRINTGLYPHS(32);
+			break;
+		}
+	}
+}
+
 void tpg_gen_text(const struct tpg_data *tpg, u8 *basep[TPG_MAX_PLANES][2],
 		  int y, int x, const char *text)
 {
@@ -2014,6 +2324,18 @@ void tpg_gen_text(const struct tpg_data *tpg, u8 *basep[TPG_MAX_PLANES][2],
 
 	for (p = 0; p < tpg->planes; p++) {
 		/* Print text */
+		if (tpg->glyphs_valid) {
+			switch (tpg->twopixelsize[p]) {
+			case 2:
+			case 4:
+			case 6:
+			case 8:
+				tpg_print_glyphs(tpg, basep, p, first, div, step,
+						 y, x, text, len);
+				break;
+			}
+			continue;
+		}
 		switch (tpg->twopixelsize[p]) {
 		case 2:
 			tpg_print_str_2(tpg, basep, p, first, div, step, y, x,
@@ -2175,6 +2497,7 @@ static void tpg_recalc(struct tpg_data *tpg)
 	if (tpg->recalc_lines) {
 		tpg->recalc_lines = false;
 		tpg_precalculate_line(tpg);
+		tpg_precalculate_glyphs(tpg);
 	}
 }
 
@@ -2275,6 +2598,10 @@ struct tpg_draw_params {
 	unsigned sav_eav_f;
 	unsigned left_pillar_width;
 	unsigned right_pillar_start;
+
+	/* noise pattern: seed of the frame, generator of the band */
+	u32 noise_seed;
+	struct tpg_rng *rng;
 };
 
 static void tpg_fill_params_pattern(const struct tpg_data *tpg, unsigned p,
@@ -2510,6 +2837,10 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 		    frame_line >= tpg->border.top + tpg->border.height)) {
 		linestart_older = tpg->black_line[p];
 		linestart_newer = tpg->black_line[p];
+	} else if (tpg->pattern == TPG_PAT_NOISE && tpg->noise_pairs[p]) {
+		/* Every line of every frame gets new noise */
+		tpg_fill_noise_line(tpg, p, params->rng, vbuf, img_width);
+		return;
 	} else if (tpg->pattern == TPG_PAT_NOISE || tpg->qual == TPG_QUAL_NOISE) {
 		linestart_older = tpg->random_line[p] +
 				  twopixsize * get_random_u32_below(tpg->src_width / 2);
@@ -2608,34 +2939,28 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 	}
 }
 
-void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
-			   unsigned p, u8 *vbuf)
+/* Render the lines [first, last) of the composed image */
+static void tpg_fill_plane_lines(const struct tpg_data *tpg,
+				 const struct tpg_draw_params *line_params,
+				 unsigned p, u8 *vbuf,
+				 unsigned first, unsigned last)
 {
-	struct tpg_draw_params params;
+	struct tpg_draw_params params = *line_params;
 	unsigned factor = V4L2_FIELD_HAS_T_OR_B(tpg->field) ? 2 : 1;
+	struct tpg_rng rng;
 
 	/* Coarse scaling with Bresenham */
 	unsigned int_part = (tpg->crop.height / factor) / tpg->compose.height;
 	unsigned fract_part = (tpg->crop.height / factor) % tpg->compose.height;
-	unsigned src_y = 0;
-	unsigned error = 0;
+	unsigned src_y = first * int_part + first * fract_part / tpg->compose.height;
+	unsigned error = first * fract_part % tpg->compose.height;
 	unsigned h;
 
-	tpg_recalc(tpg);
+	/* Each band has its own generator, seeded from its first line */
+	tpg_rng_seed(&rng, params.noise_seed + first);
+	params.rng = &rng;
 
-	params.is_tv = std;
-	params.is_60hz = std & V4L2_STD_525_60;
-	params.twopixsize = tpg->twopixelsize[p];
-	params.img_width = tpg_hdiv(tpg, p, tpg->compose.width);
-	params.stride = tpg->bytesperline[p];
-	params.hmax = (tpg->compose.height * tpg->perc_fill) / 100;
-
-	tpg_fill_params_pattern(tpg, p, &params);
-	tpg_fill_params_extras(tpg, p, &params);
-
-	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
-
-	for (h = 0; h < tpg->compose.height; h++) {
+	for (h = first; h < last; h++) {
 		unsigned buf_line;
 
 		params.frame_line = tpg_calc_frameline(tpg, src_y, tpg->field);
@@ -2691,6 +3016,87 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 	}
 }
 
+/*
+ * Each line only reads the pattern lines prepared by tpg_recalc(), so the
+ * lines can be split in bands, each rendered by its own thread.
+ */
+#define TPG_MIN_BAND_LINES 64
+
+struct tpg_band {
+	const struct tpg_data *tpg;
+	const struct tpg_draw_params *params;
+	unsigned p;
+	u8 *vbuf;
+	unsigned first, last;
+};
+
+static void *tpg_fill_band_thread(void *arg)
+{
+	struct tpg_band *band = arg;
+
+	tpg_fill_plane_lines(band->tpg, band->params, band->p, band->vbuf,
+			     band->first, band->last);
+	return NULL;
+}
+
+static void tpg_fill_plane_bands(const struct tpg_data *tpg,
+				 const struct tpg_draw_params *params,
+				 unsigned p, u8 *vbuf)
+{
+	unsigned height = tpg->compose.height;
+	unsigned bands = tpg_min(tpg->threads, height / TPG_MIN_BAND_LINES);
+	struct tpg_band band[TPG_MAX_THREADS];
+	pthread_t thread[TPG_MAX_THREADS];
+	bool started[TPG_MAX_THREADS];
+	unsigned i;
+
+	if (bands <= 1) {
+		tpg_fill_plane_lines(tpg, params, p, vbuf, 0, height);
+		return;
+	}
+
+	for (i = 0; i < bands; i++) {
+		band[i].tpg = tpg;
+		band[i].params = params;
+		band[i].p = p;
+		band[i].vbuf = vbuf;
+		band[i].first = height * i / bands;
+		band[i].last = height * (i + 1) / bands;
+		/* Render the band here if there is no thread for it */
+		started[i] = i &&
+			!pthread_create(&thread[i], NULL, tpg_fill_band_thread, &band[i]);
+		if (i && !started[i])
+			tpg_fill_band_thread(&band[i]);
+	}
+	tpg_fill_band_thread(&band[0]);
+	for (i = 1; i < bands; i++)
+		if (started[i])
+			pthread_join(thread[i], NULL);
+}
+
+void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
+			   unsigned p, u8 *vbuf)
+{
+	struct tpg_draw_params params;
+
+	tpg_recalc(tpg);
+
+	params.is_tv = std;
+	params.is_60hz = std & V4L2_STD_525_60;
+	params.twopixsize = tpg->twopixelsize[p];
+	params.img_width = tpg_hdiv(tpg, p, tpg->compose.width);
+	params.stride = tpg->bytesperline[p];
+	params.hmax = (tpg->compose.height * tpg->perc_fill) / 100;
+
+	tpg_fill_params_pattern(tpg, p, &params);
+	tpg_fill_params_extras(tpg, p, &params);
+	params.noise_seed = get_random_u32();
+
+	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
+
+	tpg_fill_plane_bands(tpg, &params, p, vbuf);
+}
+
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std, unsigned p, u8 *vbuf)
 {
 	unsigned offset = 0;
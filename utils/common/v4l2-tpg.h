@@ -27,6 +27,9 @@ typedef __s8 s8;
 #endif
 #define pr_info printf
 #define noinline
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
 
 #define tpg_min(a,b)	((a) < (b) ? (a) : (b))
 #define tpg_max(a,b)	((a) > (b) ? (a) : (b))
@@ -66,6 +69,11 @@ static inline u32 get_random_u8(void)
 	return get_random_u32_below(256);
 }
 
+static inline u32 get_random_u32(void)
+{
+	return ((u32)rand() << 16) ^ (u32)rand();
+}
+
 
 struct tpg_rbg_color8 {
 	unsigned char r, g, b;
@@ -181,6 +189,7 @@ extern const char * const tpg_aspect_strings[];
 
 #define TPG_MAX_PLANES 3
 #define TPG_MAX_PAT_LINES 8
+#define TPG_MAX_THREADS 16
 
 struct tpg_data {
 	/* Source frame size */
@@ -209,6 +218,10 @@ struct tpg_data {
 	u8				saturation;
 	s16				hue;
 	u32				fourcc;
+	/* Generates two pixels of a color in fourcc, see tpg_s_fourcc() */
+	void				(*gen_twopix)(struct tpg_data *tpg,
+						u8 buf[TPG_MAX_PLANES][8],
+						int color, bool odd);
 	enum tgp_color_enc		color_enc;
 	u32				colorspace;
 	u32				xfer_func;
@@ -263,6 +276,8 @@ struct tpg_data {
 	bool				insert_sav;
 	bool				insert_eav;
 	bool				insert_hdmi_video_guard_band;
+	/* Number of threads that render the lines of a plane */
+	unsigned			threads;
 
 	/* Test pattern movement */
 	enum tpg_move_mode		mv_hor_mode;
@@ -283,6 +298,18 @@ struct tpg_data {
 	u8				*random_line[TPG_MAX_PLANES];
 	u8				*contrast_line[TPG_MAX_PLANES];
 	u8				*black_line[TPG_MAX_PLANES];
+	/*
+	 * The 16 lines of each of the 256 font characters, rendered for each
+	 * plane in the text colors by tpg_recalc(), for tpg_gen_text().
+	 */
+	u8				*glyphs[TPG_MAX_PLANES];
+	bool				glyphs_valid;
+	/*
+	 * For TPG_PAT_NOISE: the two pixels of each plane for all 65536
+	 * combinations of the grey levels of the two pixels, allocated by
+	 * tpg_recalc() when first needed.
+	 */
+	u8				*noise_pairs[TPG_MAX_PLANES];
 };
 
 void tpg_init(struct tpg_data *tpg, unsigned w, unsigned h);
@@ -593,6 +620,11 @@ static inline unsigned tpg_g_perc_fill(const struct tpg_data *tpg)
 	return tpg->perc_fill;
 }
 
+static inline void tpg_s_threads(struct tpg_data *tpg, unsigned threads)
+{
+	tpg->threads = tpg_min(threads, TPG_MAX_THREADS);
+}
+
 static inline void tpg_s_perc_fill_blank(struct tpg_data *tpg,
 					 bool perc_fill_blank)
 {
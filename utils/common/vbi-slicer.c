@@ -0,0 +1,375 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/*
+ * Software slicer for raw VBI
+ *
+ * Each service starts with a clock run-in of alternating bits followed by
+ * a framing code. The slicer looks for the first rising edge through the
+ * middle of the signal in a window around the nominal start of the run-in,
+ * which gives the bit phase, then samples the run-in and framing code at
+ * the bit rate of the service and, if they match, the payload.
+ *
+ * Searching the edge and the signal levels are the only loops over all
+ * samples of a line, these have SSE2 and NEON versions. Once the phase is
+ * known only one sample per bit is looked at. The slicer has no global
+ * state, so one slicer per device can run in each thread.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "vbi-slicer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VBI_SIMD_X86
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define VBI_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+struct vbi_service {
+	__u32 id;
+	bool is_625;
+	/* ITU line range of the service in the first and the second field */
+	unsigned first[2];
+	unsigned last[2];
+	/* nominal start of the clock run-in after 0H in ns */
+	unsigned offset;
+	/* element rate in Hz */
+	unsigned rate;
+	/* number of clock run-in and framing code elements */
+	unsigned cri_frc_bits;
+	/* the last 32 of these elements, and the ones that must match */
+	__u32 cri_frc;
+	__u32 cri_frc_mask;
+	/* payload bits, the elements per bit and their coding and order */
+	unsigned payload_bits;
+	unsigned bit_elements;
+	bool biphase;
+	bool msb_first;
+};
+
+static const struct vbi_service vbi_services[] = {
+	{
+		V4L2_SLICED_TELETEXT_B, true, { 6, 318 }, { 22, 335 },
+		10300, 6937500, 24, 0x00aaaae4, 0x0000ffff, 42 * 8, 1, false, false
+	},
+	{
+		V4L2_SLICED_VPS, true, { 16, 0 }, { 16, 0 },
+		12500, 5000000, 32, 0xaaaa8a99, 0x00ffffff, 13 * 8, 2, true, true
+	},
+	{
+		/*
+		 * The 7 cycles of the run-in are at the bit rate of 32 fH,
+		 * so the elements are half bits.
+		 */
+		V4L2_SLICED_CAPTION_525, false, { 21, 284 }, { 21, 284 },
+		10500, 1006993, 20, 0x000aaa83, 0x00000fff, 16, 2, false, false
+	},
+	{
+		V4L2_SLICED_WSS_625, true, { 23, 0 }, { 23, 0 },
+		11000, 5000000, 53, 0xc71e3c1f, 0x924c99ce, 14, 6, true, false
+	},
+};
+
+#define NUM_SERVICES (sizeof(vbi_services) / sizeof(vbi_services[0]))
+
+/* The edge is searched from 1 us before to 2 us after the nominal start */
+#define WINDOW_BEFORE	1000
+#define WINDOW_AFTER	2000
+/* Elements the run-in may start late because its first edge was missed */
+#define CRI_SLACK	2
+/* The minimum peak to peak amplitude of a run-in */
+#define MIN_AMPLITUDE	32
+
+static unsigned next_edge_c(const __u8 *p, unsigned i, unsigned end, __u8 t)
+{
+	for (; i < end; i++)
+		if (p[i - 1] < t && p[i] >= t)
+			break;
+	return i;
+}
+
+static void min_max_c(const __u8 *p, unsigned n, __u8 *min, __u8 *max)
+{
+	__u8 lo = 255, hi = 0;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		lo = p[i] < lo ? p[i] : lo;
+		hi = p[i] > hi ? p[i] : hi;
+	}
+	*min = lo;
+	*max = hi;
+}
+
+#ifdef VBI_SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+
+/* 16 samples at a time: x >= t where max(x, t) == x */
+static SSE2 unsigned next_edge_sse2(const __u8 *p, unsigned i, unsigned end, __u8 t)
+{
+	__m128i vt = _mm_set1_epi8(t);
+
+	for (; i + 16 <= end; i += 16) {
+		__m128i cur = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i prev = _mm_loadu_si128((const __m128i *)(p + i - 1));
+		__m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(cur, vt), cur);
+		__m128i ge_prev = _mm_cmpeq_epi8(_mm_max_epu8(prev, vt), prev);
+		int mask = _mm_movemask_epi8(_mm_andnot_si128(ge_prev, ge));
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	return next_edge_c(p, i, end, t);
+}
+
+static SSE2 void min_max_sse2(const __u8 *p, unsigned n, __u8 *min, __u8 *max)
+{
+	__m128i lo = _mm_set1_epi8(-1);
+	__m128i hi = _mm_setzero_si128();
+	__u8 v[32];
+	unsigned i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+
+		lo = _mm_min_epu8(lo, x);
+		hi = _mm_max_epu8(hi, x);
+	}
+	_mm_storeu_si128((__m128i *)v, lo);
+	_mm_storeu_si128((__m128i *)(v + 16), hi);
+	min_max_c(p + i, n - i, min, max);
+	for (i = 0; i < 16; i++) {
+		*min = v[i] < *min ? v[i] : *min;
+		*max = v[16 + i] > *max ? v[16 + i] : *max;
+	}
+}
+
+#elif defined(VBI_SIMD_NEON)
+
+static unsigned next_edge_neon(const __u8 *p, unsigned i, unsigned end, __u8 t)
+{
+	uint8x16_t vt = vdupq_n_u8(t);
+
+	for (; i + 16 <= end; i += 16) {
+		uint8x16_t edge = vbicq_u8(vcgeq_u8(vld1q_u8(p + i), vt),
+					   vcgeq_u8(vld1q_u8(p + i - 1), vt));
+		/* 4 bits per sample */
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+				vshrn_n_u16(vreinterpretq_u16_u8(edge), 4)), 0);
+
+		if (mask)
+			return i + __builtin_ctzll(mask) / 4;
+	}
+	return next_edge_c(p, i, end, t);
+}
+
+static void min_max_neon(const __u8 *p, unsigned n, __u8 *min, __u8 *max)
+{
+	uint8x16_t lo = vdupq_n_u8(255);
+	uint8x16_t hi = vdupq_n_u8(0);
+	__u8 v[32];
+	unsigned i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		uint8x16_t x = vld1q_u8(p + i);
+
+		lo = vminq_u8(lo, x);
+		hi = vmaxq_u8(hi, x);
+	}
+	vst1q_u8(v, lo);
+	vst1q_u8(v + 16, hi);
+	min_max_c(p + i, n - i, min, max);
+	for (i = 0; i < 16; i++) {
+		*min = v[i] < *min ? v[i] : *min;
+		*max = v[16 + i] > *max ? v[16 + i] : *max;
+	}
+}
+
+#endif
+
+/* The first rising edge through t of p[i - 1] to p[end - 1] */
+static unsigned next_edge(const __u8 *p, unsigned i, unsigned end, __u8 t)
+{
+#ifdef VBI_SIMD_X86
+	if (cpu_get_flags() & CPU_SSE2)
+		return next_edge_sse2(p, i, end, t);
+#elif defined(VBI_SIMD_NEON)
+	return next_edge_neon(p, i, end, t);
+#endif
+	return next_edge_c(p, i, end, t);
+}
+
+static void min_max(const __u8 *p, unsigned n, __u8 *min, __u8 *max)
+{
+#ifdef VBI_SIMD_X86
+	if (cpu_get_flags() & CPU_SSE2) {
+		min_max_sse2(p, n, min, max);
+		return;
+	}
+#elif defined(VBI_SIMD_NEON)
+	min_max_neon(p, n, min, max);
+	return;
+#endif
+	min_max_c(p, n, min, max);
+}
+
+/* The sample at 16.16 fixed point position pos, times 256 */
+static inline int sample(const __u8 *p, __u32 pos)
+{
+	unsigned i = pos >> 16;
+	int f = (pos >> 8) & 0xff;
+
+	return (p[i] << 8) + (p[i + 1] - p[i]) * f;
+}
+
+static void decode_payload(const struct vbi_service *svc, const __u8 *p,
+			   __u32 pos, __u32 step, int t, __u8 *data)
+{
+	unsigned half = svc->bit_elements / 2;
+	unsigned i, j;
+
+	memset(data, 0, (svc->payload_bits + 7) / 8);
+	for (i = 0; i < svc->payload_bits; i++) {
+		int first = 0, second = 0;
+		bool bit;
+
+		for (j = 0; j < half; j++, pos += step)
+			first += sample(p, pos);
+		for (j = half; j < svc->bit_elements; j++, pos += step)
+			second += sample(p, pos);
+		/* A biphase 1 has its first half high */
+		if (svc->biphase)
+			bit = first > second;
+		else
+			bit = first + second >= (int)svc->bit_elements * t;
+		if (bit)
+			data[i / 8] |= svc->msb_first ? 0x80 >> (i % 8) : 1 << (i % 8);
+	}
+}
+
+static bool slice_line(const struct vbi_slicer *slicer,
+		       const struct vbi_service *svc, const __u8 *p, __u8 *data)
+{
+	const struct v4l2_vbi_format *fmt = &slicer->fmt;
+	__u64 rate = fmt->sampling_rate;
+	__u32 step = (rate << 16) / svc->rate;
+	unsigned elements = svc->cri_frc_bits + CRI_SLACK +
+			    svc->payload_bits * svc->bit_elements;
+	unsigned min_bits = 32 - __builtin_clz(svc->cri_frc_mask);
+	long start = rate * (svc->offset - WINDOW_BEFORE) / 1000000000 - fmt->offset;
+	long end = rate * (svc->offset + WINDOW_AFTER) / 1000000000 - fmt->offset;
+	/* The last sample that is looked at must be within the line */
+	long last = (long)fmt->samples_per_line - 2 -
+		    (long)(((__u64)elements * step + step) >> 16);
+	unsigned cri_len = ((__u64)svc->cri_frc_bits * step) >> 16;
+	__u8 lo, hi, t;
+	unsigned i;
+
+	if (start < 1)
+		start = 1;
+	if (end > last)
+		end = last;
+	if (start >= end)
+		return false;
+
+	/* Take the middle of the run-in as threshold */
+	min_max(p + start - 1, end - start + 1 + cri_len, &lo, &hi);
+	if (hi - lo < MIN_AMPLITUDE)
+		return false;
+	t = (lo + hi + 1) / 2;
+
+	for (i = start; (i = next_edge(p, i, end, t)) < end; i++) {
+		/* The edge between p[i - 1] and p[i], with subsample precision */
+		__u32 frac = ((p[i] - t) << 16) / (p[i] - p[i - 1]);
+		__u32 pos = (i << 16) - frac + step / 2;
+		__u32 cri_frc = 0;
+		unsigned k;
+
+		for (k = 1; k <= svc->cri_frc_bits + CRI_SLACK; k++, pos += step) {
+			cri_frc = (cri_frc << 1) | (sample(p, pos) >= t << 8);
+			if (k >= min_bits &&
+			    !((cri_frc ^ svc->cri_frc) & svc->cri_frc_mask)) {
+				decode_payload(svc, p, pos + step, step, t << 8, data);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+int vbi_slicer_init(struct vbi_slicer *slicer,
+		    const struct v4l2_vbi_format *fmt, __u32 services)
+{
+	bool known = fmt->start[0] && fmt->start[1];
+	bool is_625 = fmt->start[1] >= V4L2_VBI_ITU_625_F2_START - 1;
+	unsigned f, l, s;
+
+	memset(slicer, 0, sizeof(*slicer));
+	if (fmt->sample_format != V4L2_PIX_FMT_GREY || !fmt->sampling_rate ||
+	    fmt->samples_per_line < 2 || fmt->count[0] > 64 || fmt->count[1] > 64)
+		return -EINVAL;
+	slicer->fmt = *fmt;
+
+	for (f = 0; f < 2; f++) {
+		for (l = 0; l < fmt->count[f]; l++) {
+			unsigned line = fmt->start[f] + l;
+
+			for (s = 0; s < NUM_SERVICES; s++) {
+				const struct vbi_service *svc = &vbi_services[s];
+
+				if (!(services & svc->id))
+					continue;
+				if (known && (svc->is_625 != is_625 ||
+					      line < svc->first[f] || line > svc->last[f]))
+					continue;
+				slicer->line_services[f][l] |= svc->id;
+				slicer->services |= svc->id;
+			}
+		}
+	}
+	return slicer->services ? 0 : -EINVAL;
+}
+
+unsigned vbi_slicer_decode(struct vbi_slicer *slicer, const __u8 *raw,
+			   struct v4l2_sliced_vbi_data *sliced, unsigned max)
+{
+	const struct v4l2_vbi_format *fmt = &slicer->fmt;
+	bool interlaced = fmt->flags & V4L2_VBI_INTERLACED;
+	bool is_625 = fmt->start[1] >= V4L2_VBI_ITU_625_F2_START - 1;
+	unsigned n = 0;
+	unsigned f, l, s;
+
+	slicer->found = 0;
+	for (f = 0; f < 2; f++) {
+		for (l = 0; l < fmt->count[f] && n < max; l++) {
+			unsigned row = interlaced ? 2 * l + f : f * fmt->count[0] + l;
+			const __u8 *p = raw + row * fmt->samples_per_line;
+
+			if (!slicer->line_services[f][l])
+				continue;
+			for (s = 0; s < NUM_SERVICES; s++) {
+				const struct vbi_service *svc = &vbi_services[s];
+
+				if (!(slicer->line_services[f][l] & svc->id) ||
+				    !slice_line(slicer, svc, p, sliced[n].data))
+					continue;
+				sliced[n].id = svc->id;
+				sliced[n].field = f;
+				sliced[n].line = 0;
+				if (fmt->start[f])
+					sliced[n].line = fmt->start[f] + l -
+						(f ? (is_625 ? 312 : 263) : 0);
+				sliced[n].reserved = 0;
+				slicer->found |= svc->id;
+				n++;
+				break;
+			}
+		}
+	}
+	return n;
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/*
+ * Software slicer for raw VBI
+ *
+ * Recovers teletext, closed caption, WSS and VPS data from raw VBI lines,
+ * for capture devices that do not slice VBI themselves.
+ */
+
+#ifndef VBI_SLICER_H
+#define VBI_SLICER_H
+
+#include <linux/types.h>
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Services the slicer can recover */
+#define VBI_SLICER_SERVICES	(V4L2_SLICED_TELETEXT_B | V4L2_SLICED_VPS | \
+				 V4L2_SLICED_CAPTION_525 | V4L2_SLICED_WSS_625)
+
+struct vbi_slicer {
+	/* the raw VBI format of the lines passed to vbi_slicer_decode() */
+	struct v4l2_vbi_format fmt;
+	/* the requested services that are possible with this format */
+	__u32 services;
+	/* the services per line of the raw VBI image */
+	__u32 line_services[2][64];
+	/* the V4L2_SLICED_* services found by the last vbi_slicer_decode() */
+	__u32 found;
+};
+
+/*
+ * Prepare the slicer for raw VBI in format fmt, which must be
+ * V4L2_PIX_FMT_GREY. services is a mask of V4L2_SLICED_* services.
+ * Returns 0, or -EINVAL if the format is not supported or none of the
+ * services can be recovered with it.
+ */
+int vbi_slicer_init(struct vbi_slicer *slicer,
+		    const struct v4l2_vbi_format *fmt, __u32 services);
+
+/*
+ * Slice one raw VBI image of both fields into at most max entries of
+ * sliced. Returns the number of entries filled in, lines without any
+ * service are not reported.
+ */
+unsigned vbi_slicer_decode(struct vbi_slicer *slicer, const __u8 *raw,
+			   struct v4l2_sliced_vbi_data *sliced, unsigned max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -355,7 +355,7 @@ int main(int argc, char *argv[])
 			usleep(1000000);
 		}
 	}
-	dvb_dev_find(dvb, NULL, NULL);
+	dvb_dev_find_adapter(dvb, adapter);
 	parms = dvb->fe_parms;
 
 	dvb_dev = dvb_dev_seek_by_adapter(dvb, adapter, frontend,
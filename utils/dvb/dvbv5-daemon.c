@@ -29,18 +29,26 @@
 #endif
 
 #include <argp.h>
+#include <arpa/inet.h>
 #include <endian.h>
+#include <inttypes.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
-#include <poll.h>
 #include <pthread.h>
 #include <search.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
 #include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <netdb.h>
@@ -64,8 +72,26 @@
 
 # define N_(string) string
 
-/* Max number of open files */
-#define NUM_FOPEN	1024
+/* Max number of events handled per epoll_wait() call */
+#define MAX_EVENTS	64
+
+/* How often the frontend is checked for changes, when stats are subscribed */
+#define STATS_POLL_MS	250
+
+/*
+ * Max size of the data sent on each data_read message. The whole message
+ * should fit on the client's REMOTE_BUF_SIZE receive buffer, and there's
+ * no reason to break TS packets.
+ *
+ * With protocol version 2, data frames carry up to REMOTE_DATA_SIZE.
+ */
+#define DATA_READ_SIZE	(REMOTE_BUF_SIZE - 188)
+
+/*
+ * With protocol version 2, the DVR data is sent straight from this many
+ * memory mapped buffers of REMOTE_DATA_SIZE, when the Kernel supports it.
+ */
+#define DATA_MMAP_BUFS	32
 
 /*
  * Argument processing data and logic
@@ -84,6 +110,7 @@ static const char doc[] = N_(
 static const struct argp_option options[] = {
 	{"verbose",	'v',	0,		0,	N_("enables debug messages"), 0},
 	{"port",	'p',	"5555",		0,	N_("port to listen"), 0},
+	{"metrics",	'm',	"port",		0,	N_("serve OpenMetrics via HTTP on this port"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -91,6 +118,7 @@ static const struct argp_option options[] = {
 };
 
 static int port = 0;
+static int metrics_port = 0;
 static int verbose = 0;
 
 static error_t parse_opt(int k, char *arg, struct argp_state *state)
@@ -99,6 +127,9 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 'p':
 		port = atoi(arg);
 		break;
+	case 'm':
+		metrics_port = atoi(arg);
+		break;
 	case 'v':
 		verbose	++;
 		break;
@@ -191,24 +222,55 @@ void local_log(int level, const char *fmt, ...)
 } while (0)
 
 /*
- * Static data used by the code
+ * Per-client data. Each connection has its own struct dvb_device, so
+ * several clients can use different devices at the same time.
  */
 
-static pthread_mutex_t msg_mutex;
-static pthread_mutex_t dvb_read_mutex;
-static pthread_t read_id = 0;
+/* Data counters, kept per client and per open device, see metrics_get() */
+struct data_counters {
+	uint64_t sent_bytes;
+	uint64_t sent_chunks;
+	uint64_t overflows;		/* EOVERFLOW from the device */
+	uint64_t empty_reads;		/* woken up without data */
+	uint64_t read_errors;
+};
 
 struct dvb_descriptors {
 	int uid;
 	struct dvb_open_descriptor *open_dev;
+	struct data_counters data;	/* protected by the client's io_lock */
 };
 
-static struct dvb_device *dvb = NULL;
-static void *desc_root = NULL;
-static int dvb_fd = -1;
+struct client {
+	int fd;				/* socket */
+	char peer[INET_ADDRSTRLEN + 6];	/* address:port */
+	struct client *next;		/* on the clients list */
+	int handshake;			/* daemon_get_version() was called */
+	int protocol;			/* see REMOTE_PROTOCOL_VERSION */
+	struct dvb_device *dvb;
+
+	pthread_mutex_t send_lock;	/* serializes messages to the socket */
+	pthread_mutex_t io_lock;	/* protects desc_root and data */
+	void *desc_root;
+	struct data_counters data;	/* includes the closed devices */
 
-static struct pollfd fds[NUM_FOPEN];
-static nfds_t numfds = 0;
+	/* Data read thread: it waits for demux/dvr data with epoll */
+	int epoll_fd, stop_fd;
+	pthread_t read_id;
+	int read_started;
+
+	/*
+	 * Stats push thread, started by fe_subscribe_stats. fe_lock
+	 * serializes its frontend access with the command handlers.
+	 */
+	pthread_mutex_t fe_lock;
+	pthread_mutex_t stats_lock;	/* protects the fields below */
+	pthread_cond_t stats_cond;
+	unsigned int stats_interval;	/* in ms. 0 means not subscribed */
+	int stats_stop;
+	pthread_t stats_id;
+	int stats_started;
+};
 
 static char output_charset[256] = "utf-8";
 static char default_charset[256] = "iso-8859-1";
@@ -245,32 +307,44 @@ static int dvb_desc_compare(const void *__a, const void *__b)
 	return (b->uid - a->uid);
 }
 
-static struct dvb_open_descriptor *get_open_dev(int uid)
+static struct dvb_descriptors *get_open_desc(struct client *cl, int uid)
 {
 	struct dvb_descriptors desc, **p;
 
-	if (!desc_root)
+	if (!cl->desc_root)
 		return NULL;
 
 	desc.uid = uid;
-	p = tfind(&desc, &desc_root, dvb_desc_compare);
+	p = tfind(&desc, &cl->desc_root, dvb_desc_compare);
 
 	if (!p) {
 		err("open element not retrieved!");
 		return NULL;
 	}
 
-	return (*p)->open_dev;
+	return *p;
 }
 
-static void destroy_open_dev(int uid)
+static struct dvb_open_descriptor *get_open_dev(struct client *cl, int uid)
 {
-	struct dvb_descriptors desc, **p;
+	struct dvb_descriptors *desc = get_open_desc(cl, uid);
+
+	return desc ? desc->open_dev : NULL;
+}
+
+static void destroy_open_dev(struct client *cl, int uid)
+{
+	struct dvb_descriptors desc, *found, **p;
 
 	desc.uid = uid;
-	p = tdelete(&desc, &desc_root, dvb_desc_compare);
-	if (!p)
+	p = tfind(&desc, &cl->desc_root, dvb_desc_compare);
+	if (!p) {
 		err("can't destroy opened element");
+		return;
+	}
+	found = *p;
+	tdelete(&desc, &cl->desc_root, dvb_desc_compare);
+	free(found);
 }
 
 static void free_opendevs(void *node)
@@ -284,13 +358,12 @@ static void free_opendevs(void *node)
 	free (desc);
 }
 
-static void close_all_devs(void)
+static void close_all_devs(struct client *cl)
 {
-	dvb_fd = -1;
-	numfds = 0;
-	tdestroy(desc_root, free_opendevs);
-
-	desc_root = NULL;
+	pthread_mutex_lock(&cl->io_lock);
+	tdestroy(cl->desc_root, free_opendevs);
+	cl->desc_root = NULL;
+	pthread_mutex_unlock(&cl->io_lock);
 }
 
 /*
@@ -302,9 +375,6 @@ static void sigterm_handler(int const sig_class)
 	info(PROGRAM_NAME" interrupted.");
 
 	pthread_exit(NULL);
-
-	close_all_devs();
-	dvb_dev_free(dvb);
 }
 
 static void start_signal_handler(void)
@@ -429,35 +499,78 @@ static ssize_t prepare_data(char *buf, const size_t size,
 	return ret;
 }
 
-static int send_buf(int fd, const char *buf, size_t size)
+/*
+ * Sends a message made of several buffers, prefixed by its size, with
+ * a single sendmsg() call in most cases.
+ */
+static int send_iov(struct client *cl, struct iovec *iov, int iovcnt,
+		    uint32_t flags)
 {
-	int ret;
+	struct msghdr msg = {};
+	struct iovec vec[iovcnt + 1];
+	size_t size = 0;
+	ssize_t ret;
 	int32_t i32;
+	int i;
 
-	if (fd < 0)
+	if (!cl || cl->fd < 0)
 		return ECONNRESET;
 
-	pthread_mutex_lock(&msg_mutex);
-	i32 = htobe32(size);
-	ret = send(fd, (void *)&i32, 4, MSG_MORE);
-	if (ret >= 0)
-		ret = send(fd, buf, size, 0);
-	pthread_mutex_unlock(&msg_mutex);
-	if (ret < 0) {
-		local_perror("write");
-		if (ret == ECONNRESET)
-			close_all_devs();
+	for (i = 0; i < iovcnt; i++) {
+		vec[i + 1] = iov[i];
+		size += iov[i].iov_len;
+	}
+	i32 = htobe32(size | flags);
+	vec[0].iov_base = &i32;
+	vec[0].iov_len = 4;
+
+	msg.msg_iov = vec;
+	msg.msg_iovlen = iovcnt + 1;
+
+	pthread_mutex_lock(&cl->send_lock);
+	while (msg.msg_iovlen) {
+		ret = sendmsg(cl->fd, &msg, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
 
+		/* Partial send: skip what was already sent */
+		while (msg.msg_iovlen && ret >= msg.msg_iov->iov_len) {
+			ret -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + ret;
+			msg.msg_iov->iov_len -= ret;
+		}
+	}
+	pthread_mutex_unlock(&cl->send_lock);
+
+	if (msg.msg_iovlen) {
+		local_perror("write");
 		return errno;
 	}
 
-	return ret;
+	return size;
 }
 
-static ssize_t send_data(int fd, const char *fmt, ...)
+static int send_buf(struct client *cl, const char *buf, size_t size)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = size,
+	};
+
+	return send_iov(cl, &iov, 1, 0);
+}
+
+static ssize_t send_data(struct client *cl, const char *fmt, ...)
 	__attribute__ (( format( printf, 2, 3 )));
 
-static ssize_t send_data(int fd, const char *fmt, ...)
+static ssize_t send_data(struct client *cl, const char *fmt, ...)
 {
 	char buf[REMOTE_BUF_SIZE];
 	va_list ap;
@@ -472,7 +585,7 @@ static ssize_t send_data(int fd, const char *fmt, ...)
 	if (ret < 0)
 		return ret;
 
-	return send_buf(fd, buf, ret);
+	return send_buf(cl, buf, ret);
 }
 
 static ssize_t scan_data(char *buf, int buf_size, const char *fmt, ...)
@@ -558,7 +671,7 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 	char *buf;
 
 	va_list ap;
-	int fd = *(int*)priv;
+	struct client *cl = priv;
 
 	va_start(ap, fmt);
 	ret = vasprintf(&buf, fmt, ap);
@@ -569,8 +682,8 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 
 	va_end(ap);
 
-	if (fd >= 0)
-		send_data(fd, "%i%s%i%s", 0, "log", level, buf);
+	if (cl && cl->handshake)
+		send_data(cl, "%i%s%i%s", 0, "log", level, buf);
 	else
 		local_log(level, buf);
 
@@ -580,7 +693,9 @@ void dvb_remote_log(void *priv, int level, const char *fmt, ...)
 static int dev_change_monitor(char *sysname,
 			      enum dvb_dev_change_type type, void *user_priv)
 {
-	send_data(dvb_fd, "%i%s%i%s", 0, "dev_change", type, sysname);
+	struct client *cl = user_priv;
+
+	send_data(cl, "%i%s%i%s", 0, "dev_change", type, sysname);
 
 	return 0;
 }
@@ -589,15 +704,40 @@ static int dev_change_monitor(char *sysname,
 /*
  * command handler methods
  */
-static int daemon_get_version(uint32_t seq, char *cmd, int fd,
+static int daemon_get_version(uint32_t seq, char *cmd, struct client *cl,
 			      char *buf, ssize_t size)
 {
 	int ret = 0;
 
-	return send_data(fd, "%i%s%i%s", seq, cmd, ret, argp_program_version);
+	return send_data(cl, "%i%s%i%s%i", seq, cmd, ret, argp_program_version,
+			 REMOTE_PROTOCOL_VERSION);
+}
+
+static int daemon_set_protocol(uint32_t seq, char *cmd, struct client *cl,
+			       char *buf, ssize_t size)
+{
+	int ret, protocol;
+
+	ret = scan_data(buf, size, "%i", &protocol);
+	if (ret < 0)
+		goto error;
+
+	if (protocol < 1)
+		protocol = 1;
+	if (protocol > REMOTE_PROTOCOL_VERSION)
+		protocol = REMOTE_PROTOCOL_VERSION;
+
+	/* Don't change the data format while data is being sent */
+	pthread_mutex_lock(&cl->io_lock);
+	cl->protocol = protocol;
+	pthread_mutex_unlock(&cl->io_lock);
+
+	ret = protocol;
+error:
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_find(uint32_t seq, char *cmd, struct client *cl, char *buf, ssize_t size)
 {
 	int enable_monitor = 0, ret;
 	dvb_dev_change_t handler = NULL;
@@ -609,21 +749,21 @@ static int dev_find(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (enable_monitor)
 		handler = &dev_change_monitor;
 
-	ret = dvb_dev_find(dvb, handler, NULL);
+	ret = dvb_dev_find(cl->dvb, handler, cl);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_stop_monitor(uint32_t seq, char *cmd, int fd,
+static int dev_stop_monitor(uint32_t seq, char *cmd, struct client *cl,
 			    char *buf, ssize_t size)
 {
-	dvb_dev_stop_monitor(dvb);
+	dvb_dev_stop_monitor(cl->dvb);
 
-	return send_data(fd, "%i%s%i", seq, cmd, 0);
+	return send_data(cl, "%i%s%i", seq, cmd, 0);
 }
 
-static int dev_seek_by_adapter(uint32_t seq, char *cmd, int fd,
+static int dev_seek_by_adapter(uint32_t seq, char *cmd, struct client *cl,
 			       char *buf, ssize_t size)
 {
 	struct dvb_dev_list *dev;
@@ -633,19 +773,19 @@ static int dev_seek_by_adapter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	dev = dvb_dev_seek_by_adapter(dvb, adapter, num, type);
+	dev = dvb_dev_seek_by_adapter(cl->dvb, adapter, num, type);
 	if (!dev)
 		goto error;
 
-	return send_data(fd, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
+	return send_data(cl, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
 			 dev->syspath, dev->path, dev->sysname, dev->dvb_type,
 			 dev->bus_addr, dev->bus_id, dev->manufacturer,
 			 dev->product, dev->serial);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_dev_info(uint32_t seq, char *cmd, int fd,
+static int dev_get_dev_info(uint32_t seq, char *cmd, struct client *cl,
 			       char *buf, ssize_t size)
 {
 	struct dvb_dev_list *dev;
@@ -656,128 +796,233 @@ static int dev_get_dev_info(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	dev = dvb_get_dev_info(dvb, sysname);
+	dev = dvb_get_dev_info(cl->dvb, sysname);
 	if (!dev)
 		goto error;
 
-	return send_data(fd, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
+	return send_data(cl, "%i%s%i%s%s%s%i%s%s%s%s%s", seq, cmd, ret,
 			 dev->syspath, dev->path, dev->sysname, dev->dvb_type,
 			 dev->bus_addr, dev->bus_id, dev->manufacturer,
 			 dev->product, dev->serial);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static void *read_data(void *privdata)
+/* Adds to the counters of an open device and of its client */
+static void count_data(struct client *cl, struct dvb_descriptors *desc,
+		       const struct data_counters *inc)
 {
-	struct dvb_open_descriptor *open_dev;
-	int timeout;
-	int ret, read_ret = -1, fd, i;
-	char databuf[REMOTE_BUF_SIZE];
-	char buf[REMOTE_BUF_SIZE + 32], *p;
-	size_t size;
-	size_t count;
-	struct pollfd __fds[NUM_FOPEN];
-	nfds_t __numfds;
+	struct data_counters *c[] = { &cl->data, &desc->data };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		c[i]->sent_bytes += inc->sent_bytes;
+		c[i]->sent_chunks += inc->sent_chunks;
+		c[i]->overflows += inc->overflows;
+		c[i]->empty_reads += inc->empty_reads;
+		c[i]->read_errors += inc->read_errors;
+	}
+}
 
-	timeout = 10; /* ms */
-	while (1) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		if (!numfds) {
-			pthread_mutex_unlock(&dvb_read_mutex);
-			break;
+/*
+ * Sends the data of a demux/dvr device to the client. The read data is
+ * sent directly from databuf, or from the memory mapped buffer, after the
+ * message header.
+ */
+static int send_read_data(struct client *cl, int uid, char *databuf)
+{
+	struct dvb_descriptors *desc;
+	struct dvb_open_descriptor *open_dev;
+	struct dvb_dev_buffer mbuf;
+	struct iovec iov[2];
+	char hdr[64];
+	int32_t *hdr32 = (int32_t *)hdr;
+	int ret, read_ret, dequeued = 0;
+
+	desc = get_open_desc(cl, uid);
+	if (!desc)
+		return 0;	/* Closed after epoll_wait() */
+	open_dev = desc->open_dev;
+
+	/* Only with protocol version 2. See dev_open() */
+	if (open_dev->bufs) {
+		read_ret = dvb_dev_dqbuf(open_dev, &mbuf);
+		if (!read_ret) {
+			read_ret = mbuf.bytesused;
+			databuf = mbuf.data;
+			dequeued = 1;
 		}
-		__numfds = numfds;
-		memcpy(__fds, fds, sizeof(fds));
-		pthread_mutex_unlock(&dvb_read_mutex);
+	} else {
+		read_ret = dvb_dev_read(open_dev, databuf,
+					cl->protocol >= 2 ? REMOTE_DATA_SIZE
+							  : DATA_READ_SIZE);
+	}
+	if (verbose) {
+		if (read_ret < 0)
+			dbg("#%d: read error: %d on %p", uid, read_ret, open_dev);
+		else
+			dbg("#%d: read %d bytes", uid, read_ret);
+	}
 
-		ret = poll(__fds, __numfds, timeout);
-		if (!ret)
-			continue;
+	if (read_ret == -EOVERFLOW)
+		count_data(cl, desc, &(struct data_counters){ .overflows = 1 });
+	else if (!read_ret || read_ret == -EAGAIN)
+		count_data(cl, desc, &(struct data_counters){ .empty_reads = 1 });
+	else if (read_ret < 0)
+		count_data(cl, desc, &(struct data_counters){ .read_errors = 1 });
+
+	iov[1].iov_base = databuf;
+	iov[1].iov_len = read_ret > 0 ? read_ret : 0;
+
+	/* Protocol version 2: binary frame, without any parsing */
+	if (cl->protocol >= 2) {
+		hdr32[0] = htobe32(uid);
+		hdr32[1] = htobe32(read_ret);
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = REMOTE_DATA_HDR_SIZE;
+
+		ret = send_iov(cl, iov, 2, REMOTE_DATA_FRAME);
+		if (dequeued && dvb_dev_qbuf(open_dev, &mbuf) < 0)
+			err("can't queue buffer on uid %d", uid);
+	} else {
+		ret = prepare_data(hdr, sizeof(hdr), "%i%s%i%i", 0,
+				   "data_read", read_ret, uid);
 		if (ret < 0) {
-			err("poll");
-			continue;
-		}
-
-		for (i = 0; i < __numfds; i++) {
-			if (__fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
-				continue;
-			if (__fds[i].revents)
-				break;
+			err("Failed to prepare answer to dvb_read()");
+			return ret;
 		}
 
-		/*
-		 * it means that one error condition happened.
-		 * Likely the file was closed.
-		 */
-		if (i == __numfds)
-			continue;
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = ret;
 
-		fd = __fds[i].fd;
+		ret = send_iov(cl, iov, 2, 0);
+	}
 
-		if (!desc_root)
-			break;
+	/* send_iov() returns the message size, or an errno */
+	if (iov[1].iov_len && ret == iov[0].iov_len + iov[1].iov_len)
+		count_data(cl, desc, &(struct data_counters){
+			.sent_bytes = iov[1].iov_len,
+			.sent_chunks = 1,
+		});
 
-		open_dev = get_open_dev(fd);
-		if (!open_dev) {
-			err("Couldn't find opened file %d", fd);
-			continue;
-		}
-
-		count = REMOTE_BUF_SIZE;
-		read_ret = dvb_dev_read(open_dev, databuf, count);
-		if (verbose) {
-			if (read_ret < 0)
-				dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
-			else
-				dbg("#%d: read %ul bytes (count %d)", fd, read_ret, count);
-		}
+	return ret;
+}
 
-		/* Initialize to the start of the buffer */
-		p = buf;
-		size = sizeof(buf);
+static void *read_data(void *privdata)
+{
+	struct client *cl = privdata;
+	struct epoll_event events[MAX_EVENTS];
+	char databuf[REMOTE_DATA_SIZE];
+	int i, n, ret;
 
-		ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
-				   read_ret, fd);
-		if (ret < 0) {
-			err("Failed to prepare answer to dvb_read()");
+	while (1) {
+		n = epoll_wait(cl->epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			local_perror("epoll_wait");
 			break;
 		}
 
-		p += ret;
-		size -= ret;
-
-		if (read_ret > 0) {
-			if (read_ret > size) {
-				dbg("buffer to short to store read data!");
-				read_ret = -EOVERFLOW;
-			} else {
-				memcpy(p, databuf, read_ret);
-				p += read_ret;
+		/* Handle all devices with data, not just the first one */
+		pthread_mutex_lock(&cl->io_lock);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == cl->stop_fd)
+				goto stop;
+			/* Error without data: stop polling it, to avoid a loop */
+			if (!(events[i].events & (EPOLLIN | EPOLLPRI))) {
+				err("error condition on uid %d", events[i].data.fd);
+				epoll_ctl(cl->epoll_fd, EPOLL_CTL_DEL,
+					  events[i].data.fd, NULL);
+				continue;
 			}
-		}
 
-		ret = send_buf(dvb_fd, buf, p - buf);
-		if (ret < 0) {
-			err("Error %d sending buffer\n", ret);
-			if (ret == ECONNRESET) {
-				close_all_devs();
-				break;
+			ret = send_read_data(cl, events[i].data.fd, databuf);
+			if (ret == ECONNRESET || ret == EPIPE) {
+				err("Error %d sending buffer\n", ret);
+				goto stop;
 			}
-			continue;
 		}
+		pthread_mutex_unlock(&cl->io_lock);
 	}
 
 	dbg("Finishing kthread");
-	read_id = 0;
+	return NULL;
+
+stop:
+	pthread_mutex_unlock(&cl->io_lock);
+	dbg("Finishing kthread");
 	return NULL;
 }
 
-static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int start_read_thread(struct client *cl)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+	};
+	int ret;
+
+	if (cl->read_started)
+		return 0;
+
+	cl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (cl->epoll_fd < 0) {
+		local_perror("epoll_create1");
+		return -errno;
+	}
+	cl->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (cl->stop_fd < 0) {
+		local_perror("eventfd");
+		goto error;
+	}
+	ev.data.fd = cl->stop_fd;
+	if (epoll_ctl(cl->epoll_fd, EPOLL_CTL_ADD, cl->stop_fd, &ev) < 0) {
+		local_perror("epoll_ctl");
+		goto error;
+	}
+
+	ret = pthread_create(&cl->read_id, NULL, read_data, cl);
+	if (ret) {
+		errno = ret;
+		local_perror("pthread_create");
+		goto error;
+	}
+	cl->read_started = 1;
+	return 0;
+
+error:
+	if (cl->stop_fd >= 0)
+		close(cl->stop_fd);
+	close(cl->epoll_fd);
+	cl->stop_fd = -1;
+	cl->epoll_fd = -1;
+	return -1;
+}
+
+static void stop_read_thread(struct client *cl)
+{
+	uint64_t val = 1;
+
+	if (!cl->read_started)
+		return;
+
+	if (write(cl->stop_fd, &val, sizeof(val)) < 0)
+		pthread_cancel(cl->read_id);
+	pthread_join(cl->read_id, NULL);
+
+	close(cl->stop_fd);
+	close(cl->epoll_fd);
+	cl->read_started = 0;
+}
+
+static int dev_open(uint32_t seq, char *cmd, struct client *cl, char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
 	struct dvb_dev_list *dev;
 	struct dvb_descriptors *desc, **p;
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLPRI,
+	};
 	int ret, flags, uid;
 	char sysname[REMOTE_BUF_SIZE];
 
@@ -800,7 +1045,7 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	 */
 	flags &= ~O_NONBLOCK;
 
-	open_dev = dvb_dev_open(dvb, sysname, flags);
+	open_dev = dvb_dev_open(cl->dvb, sysname, flags);
 	if (!open_dev) {
 		ret = -errno;
 		free(desc);
@@ -811,34 +1056,15 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (verbose)
 		dbg("open dev handler for %s: %p with uid#%d", sysname, open_dev, open_dev->fd);
 
-	dev = open_dev->dev;
-	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
-	    dev->dvb_type == DVB_DEVICE_DVR) {
-		pthread_mutex_lock(&dvb_read_mutex);
-		fds[numfds].fd = open_dev->fd;
-		fds[numfds].events = POLLIN | POLLPRI;
-		numfds++;
-		pthread_mutex_unlock(&dvb_read_mutex);
-	}
-
-	if (!read_id) {
-		ret = pthread_create(&read_id, NULL, read_data, NULL);
-		if (ret < 0) {
-			local_perror("pthread_create");
-			pthread_mutex_unlock(&msg_mutex);
-			free(desc);
-			return -1;
-		}
-	}
-
-	pthread_mutex_unlock(&msg_mutex);
 	uid = open_dev->fd;
 
 	desc->uid = uid;
 	desc->open_dev = open_dev;
 
 	/* Add element to the desc_root tree */
-	p = tsearch(desc, &desc_root, dvb_desc_compare);
+	pthread_mutex_lock(&cl->io_lock);
+	p = tsearch(desc, &cl->desc_root, dvb_desc_compare);
+	pthread_mutex_unlock(&cl->io_lock);
 	if (!p) {
 		local_perror("tsearch");
 		uid = 0;
@@ -846,54 +1072,62 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		err("uid %d was already opened!", uid);
 	}
 
-	pthread_mutex_unlock(&msg_mutex);
+	dev = open_dev->dev;
+
+	/*
+	 * Binary data frames can be sent straight from memory mapped
+	 * buffers. Section filters on demux devices aren't streamed that
+	 * way, as a buffer is only given back when it is full.
+	 */
+	if (dev->dvb_type == DVB_DEVICE_DVR && cl->protocol >= 2 &&
+	    dvb_dev_mmap_start(open_dev, REMOTE_DATA_SIZE, DATA_MMAP_BUFS) > 0 &&
+	    verbose)
+		dbg("uid %d streaming with memory mapped buffers", uid);
+
+	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
+	    dev->dvb_type == DVB_DEVICE_DVR) {
+		ev.data.fd = uid;
+		if (start_read_thread(cl) < 0 ||
+		    epoll_ctl(cl->epoll_fd, EPOLL_CTL_ADD, uid, &ev) < 0)
+			err("can't wait for data on uid %d", uid);
+	}
 
 	ret = uid;
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_close(uint32_t seq, char *cmd, struct client *cl, char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
-	int uid, ret, i;
+	int uid, ret;
 
 	ret = scan_data(buf, size, "%i",  &uid);
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	pthread_mutex_lock(&cl->io_lock);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
+		pthread_mutex_unlock(&cl->io_lock);
 		err("Can't find uid to close");
 		ret = -1;
 		goto error;
 	}
 
-	/* Delete fd from the opened array */
-	pthread_mutex_lock(&dvb_read_mutex);
-	for (i = 0; i < numfds; i++) {
-		if (fds[i].fd != open_dev->fd)
-		    continue;
-		if (i < numfds - 1)
-			memmove(&fds[i], &fds[i + 1],
-				sizeof(*fds)*(numfds - i - 1));
-		numfds--;
-		break;
-	}
-	pthread_mutex_unlock(&dvb_read_mutex);
-	if (read_id && !numfds) {
-		pthread_cancel(read_id);
-		read_id = 0;
-	}
+	/* Stop waiting for data on it. Not an error if it is not there */
+	if (cl->read_started)
+		epoll_ctl(cl->epoll_fd, EPOLL_CTL_DEL, uid, NULL);
 
 	dvb_dev_close(open_dev);
-	destroy_open_dev(uid);
+	destroy_open_dev(cl, uid);
+	pthread_mutex_unlock(&cl->io_lock);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_stop(uint32_t seq, char *cmd, struct client *cl,
 			char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -903,7 +1137,7 @@ static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to stop");
@@ -913,10 +1147,10 @@ static int dev_dmx_stop(uint32_t seq, char *cmd, int fd,
 	dvb_dev_dmx_stop(open_dev);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
+static int dev_set_bufsize(uint32_t seq, char *cmd, struct client *cl,
 			   char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -926,7 +1160,7 @@ static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to stop");
@@ -936,10 +1170,10 @@ static int dev_set_bufsize(uint32_t seq, char *cmd, int fd,
 	dvb_dev_set_bufsize(open_dev, bufsize);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, struct client *cl,
 				 char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -950,7 +1184,7 @@ static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to set pesfilter");
@@ -960,10 +1194,10 @@ static int dev_dmx_set_pesfilter(uint32_t seq, char *cmd, int fd,
 	ret = dvb_dev_dmx_set_pesfilter(open_dev, pid, type, output, bufsize);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, struct client *cl,
 				      char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -975,7 +1209,7 @@ static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to set section filter");
@@ -986,10 +1220,10 @@ static int dev_dmx_set_section_filter(uint32_t seq, char *cmd, int fd,
 					     mask, mode, flags);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
+static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, struct client *cl,
 			       char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
@@ -999,7 +1233,7 @@ static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to get PMT PID");
@@ -1009,10 +1243,10 @@ static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 	ret = dvb_dev_dmx_get_pmt_pid(open_dev, sid);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
+static int dev_scan(uint32_t seq, char *cmd, struct client *cl, char *buf, ssize_t size)
 {
 	int ret = -1;
 
@@ -1029,7 +1263,7 @@ static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	if (ret < 0)
 		goto error;
 
-	open_dev = get_open_dev(uid);
+	open_dev = get_open_dev(cl, uid);
 	if (!open_dev) {
 		ret = -1;
 		err("Can't find uid to scan");
@@ -1039,16 +1273,16 @@ static int dev_scan(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 	ret = dvb_scan(foo);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 #else
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 #endif
 }
 
-static int dev_set_sys(uint32_t seq, char *cmd, int fd,
+static int dev_set_sys(uint32_t seq, char *cmd, struct client *cl,
 		       char *buf, ssize_t size)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)cl->dvb->fe_parms;
 	struct dvb_v5_fe_parms *p = (void *)parms;
 	int sys = 0, ret;
 
@@ -1058,13 +1292,13 @@ static int dev_set_sys(uint32_t seq, char *cmd, int fd,
 
 	ret = __dvb_set_sys(p, sys);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_parms(uint32_t seq, char *cmd, int fd,
+static int dev_get_parms(uint32_t seq, char *cmd, struct client *cl,
 			 char *inbuf, ssize_t insize)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)cl->dvb->fe_parms;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	struct dvb_frontend_info *info = &par->info;
 	int ret, i;
@@ -1143,15 +1377,15 @@ static int dev_get_parms(uint32_t seq, char *cmd, int fd,
 	strcpy(output_charset, par->output_charset);
 	strcpy(default_charset, par->default_charset);
 
-	return send_buf(fd, buf, p - buf);
+	return send_buf(cl, buf, p - buf);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_set_parms(uint32_t seq, char *cmd, int fd,
+static int dev_set_parms(uint32_t seq, char *cmd, struct client *cl,
 			 char *buf, ssize_t size)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)cl->dvb->fe_parms;
 	struct dvb_v5_fe_parms *par = (void *)parms;
 	int ret, i;
 	char *p = buf;
@@ -1219,26 +1453,21 @@ static int dev_set_parms(uint32_t seq, char *cmd, int fd,
 	ret = __dvb_fe_set_parms(par);
 
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
 }
 
-static int dev_get_stats(uint32_t seq, char *cmd, int fd,
-			 char *inbuf, ssize_t insize)
+/*
+ * Sends the stats cache of the frontend, either as a fe_get_stats reply
+ * or as a fe_stats message
+ */
+static int send_stats(struct client *cl, uint32_t seq, char *cmd)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)cl->dvb->fe_parms;
 	struct dvb_v5_stats *st = &parms->stats;
-	struct dvb_v5_fe_parms *par = (void *)parms;
-	int ret, i;
+	int ret = 0, i;
 	char buf[REMOTE_BUF_SIZE], *p = buf;
 	size_t size = sizeof(buf);
 
-	if (verbose)
-		dbg("dev_get_stats called");
-
-	ret = __dvb_fe_get_stats(par);
-	if (ret < 0)
-		goto error;
-
 	ret = prepare_data(p, size, "%i%s%i%i", seq, cmd, ret, st->prev_status);
 	if (ret < 0)
 		goto error;
@@ -1293,26 +1522,517 @@ static int dev_get_stats(uint32_t seq, char *cmd, int fd,
 		size -= ret;
 	}
 
-	return send_buf(fd, buf, p - buf);
+	return send_buf(cl, buf, p - buf);
 error:
-	return send_data(fd, "%i%s%i", seq, cmd, ret);
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
+}
+
+static int dev_get_stats(uint32_t seq, char *cmd, struct client *cl,
+			 char *inbuf, ssize_t insize)
+{
+	struct dvb_v5_fe_parms *par = cl->dvb->fe_parms;
+	int ret;
+
+	if (verbose)
+		dbg("dev_get_stats called");
+
+	ret = __dvb_fe_get_stats(par);
+	if (ret < 0)
+		return send_data(cl, "%i%s%i", seq, cmd, ret);
+
+	return send_stats(cl, seq, cmd);
+}
+
+static void timespec_add_ms(struct timespec *ts, unsigned int ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static int timespec_after(struct timespec *a, struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec > b->tv_sec;
+	return a->tv_nsec >= b->tv_nsec;
+}
+
+/*
+ * Checks the frontend every STATS_POLL_MS, and sends a fe_stats message
+ * when the lock status or the signal quality changes, or when the
+ * subscribed interval has elapsed since the last one.
+ */
+static void *push_stats(void *privdata)
+{
+	struct client *cl = privdata;
+	struct dvb_v5_fe_parms *par = cl->dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)par;
+	struct timespec now, wakeup, next = {};
+	enum dvb_quality quality, last_quality = DVB_QUAL_UNKNOWN;
+	fe_status_t last_status = 0;
+	unsigned int interval;
+	int ret;
+
+	pthread_mutex_lock(&cl->stats_lock);
+	while (!cl->stats_stop) {
+		if (!cl->stats_interval) {
+			pthread_cond_wait(&cl->stats_cond, &cl->stats_lock);
+			continue;
+		}
+		interval = cl->stats_interval;
+
+		clock_gettime(CLOCK_MONOTONIC, &wakeup);
+		timespec_add_ms(&wakeup, interval < STATS_POLL_MS ?
+					 interval : STATS_POLL_MS);
+		pthread_cond_timedwait(&cl->stats_cond, &cl->stats_lock,
+				       &wakeup);
+		if (cl->stats_stop || !cl->stats_interval)
+			continue;
+
+		/* A new interval sends the stats at once */
+		if (interval != cl->stats_interval)
+			next.tv_sec = 0;
+		interval = cl->stats_interval;
+		pthread_mutex_unlock(&cl->stats_lock);
+
+		pthread_mutex_lock(&cl->fe_lock);
+		ret = __dvb_fe_get_stats(par);
+		if (ret >= 0) {
+			quality = dvb_fe_retrieve_quality(par, 0);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			if (parms->stats.prev_status != last_status ||
+			    quality != last_quality ||
+			    timespec_after(&now, &next)) {
+				last_status = parms->stats.prev_status;
+				last_quality = quality;
+				next = now;
+				timespec_add_ms(&next, interval);
+
+				send_stats(cl, 0, "fe_stats");
+			}
+		}
+		pthread_mutex_unlock(&cl->fe_lock);
+
+		pthread_mutex_lock(&cl->stats_lock);
+	}
+	pthread_mutex_unlock(&cl->stats_lock);
+
+	return NULL;
+}
+
+static int dev_subscribe_stats(uint32_t seq, char *cmd, struct client *cl,
+			       char *buf, ssize_t size)
+{
+	int ret, interval;
+
+	ret = scan_data(buf, size, "%i", &interval);
+	if (ret < 0)
+		goto error;
+
+	if (verbose)
+		dbg("stats subscription with interval %d ms", interval);
+
+	pthread_mutex_lock(&cl->stats_lock);
+	if (!cl->stats_started && interval > 0) {
+		ret = pthread_create(&cl->stats_id, NULL, push_stats, cl);
+		if (ret) {
+			pthread_mutex_unlock(&cl->stats_lock);
+			errno = ret;
+			local_perror("pthread_create");
+			ret = -ret;
+			goto error;
+		}
+		cl->stats_started = 1;
+	}
+	cl->stats_interval = interval > 0 ? interval : 0;
+	pthread_cond_signal(&cl->stats_cond);
+	pthread_mutex_unlock(&cl->stats_lock);
+
+	ret = 0;
+error:
+	return send_data(cl, "%i%s%i", seq, cmd, ret);
+}
+
+static void stop_stats_thread(struct client *cl)
+{
+	if (!cl->stats_started)
+		return;
+
+	pthread_mutex_lock(&cl->stats_lock);
+	cl->stats_stop = 1;
+	pthread_cond_signal(&cl->stats_cond);
+	pthread_mutex_unlock(&cl->stats_lock);
+
+	pthread_join(cl->stats_id, NULL);
+	cl->stats_started = 0;
+}
+
+/*
+ * Metrics
+ *
+ * With --metrics, the daemon serves its counters and the state of the
+ * frontends at http://host:port/metrics, in the OpenMetrics text format.
+ * The series are labeled by the client's address:port and, for the open
+ * devices, by their sysname and uid.
+ */
+
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct client *clients;
+
+static void add_client(struct client *cl)
+{
+	pthread_mutex_lock(&clients_lock);
+	cl->next = clients;
+	clients = cl;
+	pthread_mutex_unlock(&clients_lock);
+}
+
+static void del_client(struct client *cl)
+{
+	struct client **p;
+
+	pthread_mutex_lock(&clients_lock);
+	for (p = &clients; *p; p = &(*p)->next) {
+		if (*p == cl) {
+			*p = cl->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&clients_lock);
+}
+
+struct dev_metrics {
+	char sysname[64];
+	int uid;
+	struct data_counters data;
+};
+
+struct client_metrics {
+	char peer[sizeof(((struct client *)0)->peer)];
+	struct data_counters data;
+	int send_queue;			/* -1 if unknown */
+
+	char fe[64];			/* empty without an open frontend */
+	fe_status_t fe_status;
+	enum dvb_quality fe_quality;
+
+	struct dev_metrics *devs;
+	unsigned int num_devs;
+};
+
+/* The metrics thread is the only one walking the trees */
+static struct client_metrics *walk_metrics;
+
+static void walk_desc(const void *node, VISIT which, int depth)
+{
+	const struct dvb_descriptors *desc = *(const struct dvb_descriptors **)node;
+	struct client_metrics *m = walk_metrics;
+	struct dvb_dev_list *dev = desc->open_dev->dev;
+	struct dev_metrics *devs;
+
+	if (which != postorder && which != leaf)
+		return;
+
+	if (dev->dvb_type == DVB_DEVICE_FRONTEND) {
+		snprintf(m->fe, sizeof(m->fe), "%s", dev->sysname);
+		return;
+	}
+
+	devs = realloc(m->devs, (m->num_devs + 1) * sizeof(*devs));
+	if (!devs)
+		return;
+	m->devs = devs;
+
+	snprintf(devs[m->num_devs].sysname, sizeof(devs->sysname), "%s",
+		 dev->sysname);
+	devs[m->num_devs].uid = desc->uid;
+	devs[m->num_devs].data = desc->data;
+	m->num_devs++;
+}
+
+/*
+ * Takes a snapshot of a client. The frontend is only queried when no
+ * command is running for the client, as that could take a while (e. g.
+ * while tuning). Otherwise, the last known status is used.
+ */
+static void get_client_metrics(struct client *cl, struct client_metrics *m)
+{
+	struct dvb_v5_fe_parms *par = cl->dvb->fe_parms;
+	struct dvb_v5_fe_parms_priv *parms = (void *)par;
+	int fe_locked;
+
+	memset(m, 0, sizeof(*m));
+	snprintf(m->peer, sizeof(m->peer), "%s", cl->peer);
+	if (ioctl(cl->fd, SIOCOUTQ, &m->send_queue) < 0)
+		m->send_queue = -1;
+
+	fe_locked = !pthread_mutex_trylock(&cl->fe_lock);
+
+	pthread_mutex_lock(&cl->io_lock);
+	m->data = cl->data;
+	walk_metrics = m;
+	twalk(cl->desc_root, walk_desc);
+	pthread_mutex_unlock(&cl->io_lock);
+
+	if (m->fe[0]) {
+		if (fe_locked)
+			__dvb_fe_get_stats(par);
+		m->fe_status = parms->stats.prev_status;
+		m->fe_quality = dvb_fe_retrieve_quality(par, 0);
+	}
+
+	if (fe_locked)
+		pthread_mutex_unlock(&cl->fe_lock);
+}
+
+static const struct data_metric {
+	const char *name;
+	const char *help;
+	size_t offset;
+} data_metrics[] = {
+	{ "sent_bytes", "Data bytes sent",
+	  offsetof(struct data_counters, sent_bytes) },
+	{ "sent_chunks", "Data messages sent",
+	  offsetof(struct data_counters, sent_chunks) },
+	{ "overflows", "Reads which returned EOVERFLOW",
+	  offsetof(struct data_counters, overflows) },
+	{ "empty_reads", "Wakeups without data",
+	  offsetof(struct data_counters, empty_reads) },
+	{ "read_errors", "Other read errors",
+	  offsetof(struct data_counters, read_errors) },
+};
+
+#define DATA_COUNTER(d, i) \
+	(*(const uint64_t *)((const char *)(d) + data_metrics[i].offset))
+
+static void metric_family(FILE *f, const char *prefix, const char *name,
+			  const char *type, const char *help)
+{
+	fprintf(f, "# TYPE dvbv5_daemon_%s%s %s\n", prefix, name, type);
+	fprintf(f, "# HELP dvbv5_daemon_%s%s %s.\n", prefix, name, help);
+}
+
+/* Returns the metrics text, which should be freed by the caller */
+static char *metrics_get(size_t *size)
+{
+	struct client_metrics *m = NULL, *tmp;
+	unsigned int num = 0, i, j, k;
+	struct client *cl;
+	char *text = NULL;
+	FILE *f;
+
+	pthread_mutex_lock(&clients_lock);
+	for (cl = clients; cl; cl = cl->next) {
+		tmp = realloc(m, (num + 1) * sizeof(*m));
+		if (!tmp)
+			break;
+		m = tmp;
+		get_client_metrics(cl, &m[num++]);
+	}
+	pthread_mutex_unlock(&clients_lock);
+
+	f = open_memstream(&text, size);
+	if (!f)
+		goto free;
+
+	metric_family(f, "", "clients", "gauge", "Connected clients");
+	fprintf(f, "dvbv5_daemon_clients %u\n", num);
+
+	for (k = 0; k < ARRAY_SIZE(data_metrics); k++) {
+		metric_family(f, "client_", data_metrics[k].name, "counter",
+			      data_metrics[k].help);
+		for (i = 0; i < num; i++)
+			fprintf(f, "dvbv5_daemon_client_%s_total{client=\"%s\"} %" PRIu64 "\n",
+				data_metrics[k].name, m[i].peer,
+				DATA_COUNTER(&m[i].data, k));
+	}
+
+	metric_family(f, "client_", "send_queue_bytes", "gauge",
+		      "Bytes queued on the socket, not yet sent");
+	for (i = 0; i < num; i++)
+		if (m[i].send_queue >= 0)
+			fprintf(f, "dvbv5_daemon_client_send_queue_bytes{client=\"%s\"} %d\n",
+				m[i].peer, m[i].send_queue);
+
+	for (k = 0; k < ARRAY_SIZE(data_metrics); k++) {
+		metric_family(f, "dev_", data_metrics[k].name, "counter",
+			      data_metrics[k].help);
+		for (i = 0; i < num; i++)
+			for (j = 0; j < m[i].num_devs; j++)
+				fprintf(f, "dvbv5_daemon_dev_%s_total{client=\"%s\",dev=\"%s\",uid=\"%d\"} %" PRIu64 "\n",
+					data_metrics[k].name, m[i].peer,
+					m[i].devs[j].sysname, m[i].devs[j].uid,
+					DATA_COUNTER(&m[i].devs[j].data, k));
+	}
+
+	metric_family(f, "", "frontend_status", "gauge",
+		      "Frontend status flags (fe_status_t)");
+	for (i = 0; i < num; i++)
+		if (m[i].fe[0])
+			fprintf(f, "dvbv5_daemon_frontend_status{client=\"%s\",dev=\"%s\"} %u\n",
+				m[i].peer, m[i].fe, m[i].fe_status);
+
+	metric_family(f, "", "frontend_locked", "gauge",
+		      "1 if the frontend has lock");
+	for (i = 0; i < num; i++)
+		if (m[i].fe[0])
+			fprintf(f, "dvbv5_daemon_frontend_locked{client=\"%s\",dev=\"%s\"} %d\n",
+				m[i].peer, m[i].fe,
+				!!(m[i].fe_status & FE_HAS_LOCK));
+
+	metric_family(f, "", "frontend_quality", "gauge",
+		      "Signal quality: 0 unknown, 1 poor, 2 ok, 3 good");
+	for (i = 0; i < num; i++)
+		if (m[i].fe[0])
+			fprintf(f, "dvbv5_daemon_frontend_quality{client=\"%s\",dev=\"%s\"} %d\n",
+				m[i].peer, m[i].fe, m[i].fe_quality);
+
+	fprintf(f, "# EOF\n");
+	if (fclose(f)) {
+		free(text);
+		text = NULL;
+	}
+free:
+	for (i = 0; i < num; i++)
+		free(m[i].devs);
+	free(m);
+
+	return text;
+}
+
+/*
+ * Answers each HTTP request on the metrics socket with the metrics,
+ * one request per connection.
+ */
+static void *metrics_server(void *privdata)
+{
+	static const char not_found[] =
+		"HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	struct timeval timeout = { .tv_sec = 5 };
+	int sockfd = *(int *)privdata;
+	char req[1024], hdr[256], *text;
+	ssize_t len, n;
+	size_t size;
+	int fd;
+
+	while (1) {
+		fd = accept(sockfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			local_perror("accept");
+			break;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		/* Just the request line matters */
+		len = 0;
+		do {
+			n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+			if (n <= 0)
+				break;
+			len += n;
+			req[len] = '\0';
+		} while (!strstr(req, "\r\n\r\n") && !strstr(req, "\n\n") &&
+			 len < sizeof(req) - 1);
+
+		if (len <= 0) {
+			close(fd);
+			continue;
+		}
+		req[len] = '\0';
+
+		if (strncmp(req, "GET /metrics ", 13) &&
+		    strncmp(req, "GET / ", 6)) {
+			send(fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+			close(fd);
+			continue;
+		}
+
+		text = metrics_get(&size);
+		if (!text) {
+			err("can't get the metrics");
+			close(fd);
+			continue;
+		}
+
+		len = snprintf(hdr, sizeof(hdr),
+			       "HTTP/1.0 200 OK\r\n"
+			       "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			       "Content-Length: %zu\r\n\r\n", size);
+		if (send(fd, hdr, len, MSG_NOSIGNAL) == len)
+			send(fd, text, size, MSG_NOSIGNAL);
+		free(text);
+		close(fd);
+	}
+
+	close(sockfd);
+	return NULL;
+}
+
+static int start_metrics_server(void)
+{
+	static int sockfd;
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = INADDR_ANY,
+		.sin_port = htons(metrics_port),
+	};
+	pthread_t id;
+	int ret;
+
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sockfd < 0) {
+		local_perror("socket");
+		return -1;
+	}
+	if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		local_perror("bind");
+		goto error;
+	}
+	if (listen(sockfd, 5) < 0) {
+		local_perror("listen");
+		goto error;
+	}
+
+	ret = pthread_create(&id, NULL, metrics_server, &sockfd);
+	if (ret) {
+		errno = ret;
+		local_perror("pthread_create");
+		goto error;
+	}
+	pthread_detach(id);
+
+	info("serving metrics on port %d", metrics_port);
+	return 0;
+
+error:
+	close(sockfd);
+	return -1;
 }
 
 /*
  * Structure with all methods with RPC calls
  */
 
-typedef int (*method_handler) (uint32_t seq, char *cmd, int fd,
+typedef int (*method_handler) (uint32_t seq, char *cmd, struct client *cl,
 			       char *buf, ssize_t size);
 
+/* handshake: method that should be called before any other one */
 struct method_types {
 	char *name;
 	method_handler handler;
-	int locks_dvb;
+	int handshake;
 };
 
 static const struct method_types methods[] = {
 	{"daemon_get_version", &daemon_get_version, 1},
+	{"daemon_set_protocol", &daemon_set_protocol, 0},
 	{"dev_find", &dev_find, 0},
 	{"dev_stop_monitor", &dev_stop_monitor, 0},
 	{"dev_seek_by_adapter", &dev_seek_by_adapter, 0},
@@ -1331,14 +2051,16 @@ static const struct method_types methods[] = {
 	{"fe_get_parms", &dev_get_parms, 0},
 	{"fe_set_parms", &dev_set_parms, 0},
 	{"fe_get_stats", &dev_get_stats, 0},
+	{"fe_subscribe_stats", &dev_subscribe_stats, 0},
 
 	{}
 };
 
-static void *start_server(void *fd_pointer)
+static void *start_server(void *client)
 {
+	struct client *cl = client;
 	const struct method_types *method;
-	int fd = *(int *)fd_pointer, ret, flag = 1;
+	int fd = cl->fd, ret, flag = 1;
 	char buf[REMOTE_BUF_SIZE + 8], cmd[CMD_SIZE], *p;
 	ssize_t size;
 	uint32_t seq;
@@ -1359,6 +2081,17 @@ static void *start_server(void *fd_pointer)
 		dbg("Failed to avoid TCP delays");
 	};
 
+	/* Each client has its own devices */
+	cl->dvb = dvb_dev_alloc();
+	if (!cl->dvb) {
+		err("Can't allocate DVB data\n");
+		goto close;
+	}
+	/* FIXME: should allow the caller to set the verbosity */
+	dvb_dev_set_logpriv(cl->dvb, 1, dvb_remote_log, cl);
+	dvb_dev_find(cl->dvb, NULL, NULL);
+	add_client(cl);
+
 	/* Command dispatcher */
 	do {
 		size = recv(fd, buf, 4, MSG_WAITALL);
@@ -1374,7 +2107,7 @@ static void *start_server(void *fd_pointer)
 		if (ret < 0) {
 			if (verbose)
 				dbg("message too short: %ld", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(cl, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "msg too short");
 			continue;
 		}
@@ -1388,7 +2121,7 @@ static void *start_server(void *fd_pointer)
 		if (size > buf + sizeof(buf) - p) {
 			if (verbose)
 				dbg("data length too big: %d", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(cl, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "data length too big");
 			continue;
 		}
@@ -1396,17 +2129,19 @@ static void *start_server(void *fd_pointer)
 		method = methods;
 		while (method->name) {
 			if (!strcmp(cmd, method->name)) {
-				if (dvb_fd > 0 || method->locks_dvb) {
+				if (cl->handshake || method->handshake) {
+					pthread_mutex_lock(&cl->fe_lock);
 					ret = method->handler(seq, cmd,
-							      fd, p, size);
+							      cl, p, size);
+					pthread_mutex_unlock(&cl->fe_lock);
 					if (ret < 0)
 						break;
-					if (method->locks_dvb)
-						dvb_fd = fd;
+					if (method->handshake)
+						cl->handshake = 1;
 					break;
 				}
-				send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-					  "daemon busy");
+				send_data(cl, "%i%s%i%s", 0, "log", LOG_ERR,
+					  "version not checked");
 				break;
 			}
 			method++;
@@ -1414,7 +2149,7 @@ static void *start_server(void *fd_pointer)
 		if (!method->name) {
 			if (verbose)
 				dbg("invalid command: %s", cmd);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			send_data(cl, "%i%s%i%s", 0, "log", LOG_ERR,
 				  "invalid command");
 		}
 	} while (1);
@@ -1422,13 +2157,19 @@ static void *start_server(void *fd_pointer)
 	if (verbose)
 		dbg("Closing socket %d", fd);
 
+	del_client(cl);
+	stop_stats_thread(cl);
+	stop_read_thread(cl);
+	close_all_devs(cl);
+	dvb_dev_free(cl->dvb);
+close:
 	close(fd);
-	if (read_id) {
-		pthread_cancel(read_id);
-		read_id = 0;
-	}
-	if (dvb_fd > 0)
-		close_all_devs();
+	pthread_mutex_destroy(&cl->send_lock);
+	pthread_mutex_destroy(&cl->io_lock);
+	pthread_mutex_destroy(&cl->fe_lock);
+	pthread_mutex_destroy(&cl->stats_lock);
+	pthread_cond_destroy(&cl->stats_cond);
+	free(cl);
 
 	return NULL;
 }
@@ -1443,6 +2184,7 @@ int main(int argc, char *argv[])
 	int sockfd;
 	socklen_t addrlen;
 	struct sockaddr_in serv_addr, cli_addr;
+	pthread_condattr_t cond_attr;
 
 #ifdef ENABLE_NLS
 	setlocale (LC_ALL, "");
@@ -1460,15 +2202,6 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	/* Allocate DVB structure and start seek for devices */
-	dvb = dvb_dev_alloc();
-	if (!dvb) {
-		err("Can't allocate DVB data\n");
-		return -1;
-	}
-
-	dvb_dev_find(dvb, 0, NULL);
-
 	/* Create a socket */
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd < 0) {
@@ -1489,16 +2222,18 @@ int main(int argc, char *argv[])
 		goto error;
 	}
 
-	/* FIXME: should allow the caller to set the verbosity */
-	dvb_dev_set_logpriv(dvb, 1, dvb_remote_log, &dvb_fd);
-
 	/* Listen up to 5 connections */
 	listen(sockfd, 5);
 	addrlen = sizeof(cli_addr);
 
 	start_signal_handler();
-	pthread_mutex_init(&msg_mutex, NULL);
-	pthread_mutex_init(&dvb_read_mutex, NULL);
+
+	if (metrics_port && start_metrics_server() < 0)
+		goto error;
+
+	/* push_stats() waits with timeouts based on CLOCK_MONOTONIC */
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
 
 	/* Accept actual connection from the client */
 
@@ -1513,6 +2248,7 @@ int main(int argc, char *argv[])
 	info(PROGRAM_NAME" started.");
 
 	while (1) {
+		struct client *cl;
 		int fd;
 		pthread_t id;
 
@@ -1526,11 +2262,32 @@ int main(int argc, char *argv[])
 
 		if (verbose)
 			dbg("accepted connection %d", fd);
-		ret = pthread_create(&id, NULL, start_server, (void *)&fd);
-		if (ret < 0) {
+
+		cl = calloc(1, sizeof(*cl));
+		if (!cl) {
+			local_perror("calloc");
+			close(fd);
+			continue;
+		}
+		cl->fd = fd;
+		snprintf(cl->peer, sizeof(cl->peer), "%s:%d",
+			 inet_ntoa(cli_addr.sin_addr), ntohs(cli_addr.sin_port));
+		cl->protocol = 1;
+		cl->epoll_fd = -1;
+		cl->stop_fd = -1;
+		pthread_mutex_init(&cl->send_lock, NULL);
+		pthread_mutex_init(&cl->io_lock, NULL);
+		pthread_mutex_init(&cl->fe_lock, NULL);
+		pthread_mutex_init(&cl->stats_lock, NULL);
+		pthread_cond_init(&cl->stats_cond, &cond_attr);
+
+		ret = pthread_create(&id, NULL, start_server, cl);
+		if (ret) {
+			errno = ret;
 			local_perror("pthread_create");
 			break;
 		}
+		pthread_detach(id);
 	}
 
 	/* Just in case we add some way for the remote part to stop the daemon */
@@ -1541,8 +2298,5 @@ error:
 
 	pthread_exit(NULL);
 
-	if (dvb)
-		dvb_dev_free(dvb);
-
 	return -1;
 }
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <argp.h>
@@ -52,19 +53,34 @@
 
 #define PROGRAM_NAME	"dvbv5-scan"
 #define DEFAULT_OUTPUT  "dvb_channel.conf"
+#define MAX_FRONTENDS	16
+#define MAX_FREQ_OFFSETS	8
 
 const char *argp_program_version = PROGRAM_NAME " version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Mauro Carvalho Chehab <mchehab@kernel.org>";
 
+struct scan_frontend {
+	unsigned adapter, frontend, adapter_dmx, demux;
+};
+
 struct arguments {
-	char *confname, *lnb_name, *output, *demux_dev;
+	char *confname, *lnb_name, *output, *demux_dev, *ts_file;
 	unsigned adapter, n_adapter, adapter_fe, adapter_dmx, frontend, demux, get_detected, get_nit;
 	int lna, lnb, sat_number, freq_bpf;
 	unsigned diseqc_wait, dont_add_new_freqs, timeout_multiply;
-	unsigned other_nit;
+	unsigned other_nit, scan_tables;
+	uint32_t blind_start, blind_stop, blind_step;
 	enum dvb_file_formats input_format, output_format;
 	const char *cc;
 
+	/* Frontends to scan with, in parallel */
+	struct scan_frontend fe[MAX_FRONTENDS];
+	unsigned n_frontends;
+
+	/* Offsets in Hz from the nominal terrestrial frequencies to try */
+	int32_t freq_offsets[MAX_FREQ_OFFSETS];
+	unsigned n_freq_offsets;
+
 	/* Used by status print */
 	unsigned n_status_lines;
 };
@@ -73,6 +89,7 @@ static const struct argp_option options[] = {
 	{"adapter",	'a',	N_("adapter#"),		0, N_("use given adapter (default 0)"), 0},
 	{"frontend",	'f',	N_("frontend#"),	0, N_("use given frontend (default 0)"), 0},
 	{"demux",	'd',	N_("demux#"),		0, N_("use given demux (default 0)"), 0},
+	{"frontends",	'M',	N_("adapter[:frontend[:demux]],..."), 0, N_("split the scan between the given frontends"), 0},
 	{"lnbf",	'l',	N_("LNBf_type"),	0, N_("type of LNBf to use. 'help' lists the available ones"), 0},
 	{"lna",		'w',	N_("LNA (0, 1, -1)"),	0, N_("enable/disable/auto LNA power"), 0},
 	{"sat_number",	'S',	N_("satellite_number"),	0, N_("satellite number. If not specified, disable DISEqC"), 0},
@@ -85,9 +102,13 @@ static const struct argp_option options[] = {
 	{"file-freqs-only", 'F', NULL,			0, N_("don't use the other frequencies discovered during scan"), 0},
 	{"timeout-multiply", 'T', N_("factor"),		0, N_("Multiply scan timeouts by this factor"), 0},
 	{"parse-other-nit", 'p', NULL,			0, N_("Parse the other NIT/SDT tables"), 0},
+	{"profile",	'P',	N_("profile"),		0, N_("tables to read: full, quick (no NIT) or zap (only PAT/PMT) (default: full)"), 0},
 	{"input-format", 'I',	N_("format"),		0, N_("Input format: CHANNEL, DVBV5 (default: DVBV5)"), 0},
 	{"output-format", 'O',	N_("format"),		0, N_("Output format: VDR, CHANNEL, ZAP, DVBV5 (default: DVBV5)"), 0},
 	{"cc",		'C',	N_("country_code"),	0, N_("Set the default country to be used (in ISO 3166-1 two letter code)"), 0},
+	{"blind",	'B',	N_("start:stop:step"),	0, N_("blind scan: sweep the band for carriers, using the channel file entries as templates"), 0},
+	{"ts-file",	't',	N_("file"),		0, N_("parse a recorded MPEG-TS file, instead of tuning the frontend"), 0},
+	{"freq-offsets", 'X',	N_("kHz,..."),		OPTION_ARG_OPTIONAL, N_("also try these offsets from terrestrial frequencies with a carrier but no lock (default: 166.667,-166.667,125,142.857)"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -189,19 +210,23 @@ static int check_frontend(void *__args,
 
 	args->n_status_lines = 0;
 	for (i = 0; i < args->timeout_multiply * 40; i++) {
-		if (parms->abort)
+		/* Returns as soon as it locks, else shows the stats every 100 ms */
+		rc = dvb_fe_wait_lock(parms, 100);
+		if (rc == -EINTR)
 			return 0;
-		rc = dvb_fe_get_stats(parms);
-		if (rc)
-			PERROR(_("dvb_fe_get_stats failed"));
+		if (rc && rc != -ETIMEDOUT) {
+			PERROR(_("dvb_fe_wait_lock failed"));
+			usleep(100000);
+		}
 
 		rc = dvb_fe_retrieve_stats(parms, DTV_STATUS, &status);
 		if (rc)
 			status = 0;
-		print_frontend_stats(args, parms);
+		/* Several frontends would overwrite each other's status */
+		if (args->n_frontends <= 1)
+			print_frontend_stats(args, parms);
 		if (status & FE_HAS_LOCK)
 			break;
-		usleep(100000);
 	};
 
 	if (isatty(STDERR_FILENO)) {
@@ -211,54 +236,173 @@ static int check_frontend(void *__args,
 	return (status & FE_HAS_LOCK) ? 0 : -1;
 }
 
-static int run_scan(struct arguments *args, struct dvb_device *dvb)
-{
-	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	struct dvb_file *dvb_file = NULL, *dvb_file_new = NULL;
+struct scan_state {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct dvb_file *dvb_file, *dvb_file_new;
+	struct dvb_file_index *index;	/* entries up to last */
+	struct dvb_entry *last;		/* last entry handed to a frontend */
+	unsigned busy;			/* frontends currently scanning */
+	int count;
+
+	/* Offset search, see queue_offsets() */
+	struct offset_try *tries;	/* offsets any frontend can try */
+	unsigned offset_hits[MAX_FREQ_OFFSETS + 1];
+};
+
+/*
+ * Some terrestrial channel plans put the transmitters at an offset from
+ * the nominal center frequencies. With --freq-offsets, each transponder
+ * is first tried at the offset that gave the most locks so far. If the
+ * frontend sees a carrier but can't lock, the other offsets are queued,
+ * so that every idle frontend helps trying them, and the ones not tried
+ * yet are dropped as soon as one of them locks.
+ */
+struct offset_search {
+	unsigned pending;	/* tries queued or being scanned */
+	int found;
+	int count;
+};
+
+struct offset_try {
+	struct offset_try *next;
 	struct dvb_entry *entry;
-	struct dvb_open_descriptor *dmx_fd;
-	int count = 0, shift;
-	uint32_t freq, sys;
-	enum dvb_sat_polarization pol;
+	struct offset_search *search;
+	unsigned idx;		/* 0 for the nominal frequency */
+};
 
-	/* This is used only when reading old formats */
-	switch (parms->current_sys) {
-	case SYS_DVBT:
-	case SYS_DVBS:
-	case SYS_DVBC_ANNEX_A:
-	case SYS_ATSC:
+static int32_t offset_hz(struct arguments *args, unsigned idx)
+{
+	return idx ? args->freq_offsets[idx - 1] : 0;
+}
+
+static int entry_uses_offsets(struct arguments *args,
+			      struct dvb_v5_fe_parms *parms,
+			      struct dvb_entry *entry)
+{
+	uint32_t sys;
+
+	if (!args->n_freq_offsets)
+		return 0;
+	if (dvb_retrieve_entry_prop(entry, DTV_DELIVERY_SYSTEM, &sys))
 		sys = parms->current_sys;
-		break;
-	case SYS_DVBC_ANNEX_C:
-		sys = SYS_DVBC_ANNEX_A;
-		break;
-	case SYS_DVBC_ANNEX_B:
-		sys = SYS_ATSC;
-		break;
-	case SYS_ISDBT:
-	case SYS_DTMB:
-		sys = SYS_DVBT;
-		break;
-	default:
-		sys = SYS_UNDEFINED;
-		break;
+
+	return sys == SYS_DVBT || sys == SYS_DVBT2 || sys == SYS_ISDBT;
+}
+
+/* Sorts the offsets by the locks they gave, the nominal one first on ties */
+static unsigned offsets_by_hits(struct scan_state *st, struct arguments *args,
+				unsigned *order)
+{
+	unsigned i, j, n = args->n_freq_offsets + 1;
+
+	for (i = 0; i < n; i++) {
+		for (j = i; j && st->offset_hits[order[j - 1]] < st->offset_hits[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
 	}
-	dvb_file = dvb_read_file_format(args->confname, sys,
-				    args->input_format);
-	if (!dvb_file)
-		return -2;
+	return n;
+}
 
-	/* FIXME: should be replaced by dvb_dev_open() */
-	dmx_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
-	if (!dmx_fd) {
-		perror(_("opening demux failed"));
-		return -3;
+/* Called with st->lock held */
+static void queue_offsets(struct scan_state *st, struct dvb_entry *entry,
+			  int count, unsigned *order, unsigned n)
+{
+	struct offset_search *search;
+	struct offset_try *try, **tail;
+	unsigned i;
+
+	search = calloc(1, sizeof(*search));
+	if (!search)
+		return;
+	search->count = count;
+
+	for (tail = &st->tries; *tail; tail = &(*tail)->next);
+	for (i = 0; i < n; i++) {
+		try = calloc(1, sizeof(*try));
+		if (!try)
+			break;
+		try->entry = entry;
+		try->search = search;
+		try->idx = order[i];
+		*tail = try;
+		tail = &try->next;
+		search->pending++;
 	}
+	if (!search->pending)
+		free(search);
+}
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+static void put_offset_search(struct offset_search *search)
+{
+	if (!--search->pending)
+		free(search);
+}
+
+struct sweep_state;
+
+struct scan_worker {
+	struct arguments args;
+	struct scan_state *state;
+	struct sweep_state *sweep;
+	struct dvb_device *dvb;
+	struct dvb_open_descriptor *dmx_fd;
+	const char *fe_name;
+	pthread_t thread;
+};
+
+static void *scan_transponders(void *priv)
+{
+	struct scan_worker *w = priv;
+	struct scan_state *st = w->state;
+	struct arguments *args = &w->args;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
+	struct dvb_entry *entry, tmp_entry;
+	int count, shift;
+	uint32_t freq;
+	enum dvb_sat_polarization pol;
+
+	pthread_mutex_lock(&st->lock);
+	while (!parms->abort) {
 		struct dvb_v5_descriptors *dvb_scan_handler = NULL;
+		struct dvb_entry *scan_entry;
+		struct offset_search *search = NULL;
+		unsigned order[MAX_FREQ_OFFSETS + 1], n_order = 0, idx = 0;
+		fe_status_t status;
 		uint32_t stream_id;
 
+		if (st->tries) {
+			struct offset_try *try = st->tries;
+
+			st->tries = try->next;
+			entry = try->entry;
+			search = try->search;
+			idx = try->idx;
+			free(try);
+
+			if (search->found) {
+				put_offset_search(search);
+				continue;
+			}
+			dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq);
+			count = search->count;
+			goto scan;
+		}
+
+		entry = st->last ? st->last->next : st->dvb_file->first_entry;
+		if (!entry) {
+			/*
+			 * The frontends still scanning may add new
+			 * transponders from their NIT tables, or queue
+			 * frequency offsets to try.
+			 */
+			if (!st->busy)
+				break;
+			pthread_cond_wait(&st->cond, &st->lock);
+			continue;
+		}
+		st->last = entry;
+
 		/*
 		 * If the channel file has duplicated frequencies, or some
 		 * entries without any frequency at all, discard.
@@ -273,12 +417,32 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		if (dvb_retrieve_entry_prop(entry, DTV_STREAM_ID, &stream_id))
 			stream_id = NO_STREAM_ID_FILTER;
 
-		if (!dvb_new_entry_is_needed(dvb_file->first_entry, entry,
-						  freq, shift, pol, stream_id))
+		if (dvb_file_find_freq(st->index, freq, shift, pol, stream_id))
 			continue;
+		dvb_file_index_add(st->index, entry);
 
-		count++;
-		dvb_log(_("Scanning frequency #%d %d"), count, freq);
+		count = ++st->count;
+		if (entry_uses_offsets(args, parms, entry)) {
+			n_order = offsets_by_hits(st, args, order);
+			idx = order[0];
+		}
+scan:
+		st->busy++;
+		pthread_mutex_unlock(&st->lock);
+
+		scan_entry = entry;
+		if (idx) {
+			freq += offset_hz(args, idx);
+			tmp_entry = *entry;
+			dvb_store_entry_prop(&tmp_entry, DTV_FREQUENCY, freq);
+			scan_entry = &tmp_entry;
+		}
+
+		if (args->n_frontends > 1)
+			dvb_log(_("Scanning frequency #%d %d on %s"),
+				count, freq, w->fe_name);
+		else
+			dvb_log(_("Scanning frequency #%d %d"), count, freq);
 
 		/*
 		 * update params->lnb only if it differs from entry->lnb
@@ -293,11 +457,28 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		 * Run the scanning logic
 		 */
 
-		dvb_scan_handler = dvb_dev_scan(dmx_fd, entry,
+		dvb_scan_handler = dvb_dev_scan(w->dmx_fd, scan_entry,
 						&check_frontend, args,
 						args->other_nit,
 						args->timeout_multiply);
 
+		pthread_mutex_lock(&st->lock);
+		if (dvb_scan_handler) {
+			if (search || n_order)
+				st->offset_hits[idx]++;
+			if (search)
+				search->found = 1;
+		} else if (n_order > 1 && !parms->abort &&
+			   !dvb_fe_retrieve_stats(parms, DTV_STATUS, &status) &&
+			   !(status & FE_HAS_LOCK) &&
+			   (status & (FE_HAS_SIGNAL | FE_HAS_CARRIER))) {
+			queue_offsets(st, entry, count, order + 1, n_order - 1);
+		}
+		if (search)
+			put_offset_search(search);
+		st->busy--;
+		pthread_cond_broadcast(&st->cond);
+
 		if (parms->abort) {
 			dvb_scan_free_handler_table(dvb_scan_handler);
 			break;
@@ -308,15 +489,17 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		/*
 		 * Store the service entry
 		 */
-		dvb_store_channel(&dvb_file_new, parms, dvb_scan_handler,
+		dvb_store_channel(&st->dvb_file_new, parms, dvb_scan_handler,
 				  args->get_detected, args->get_nit);
 
 		/*
-		 * Add new transponders based on NIT table information
+		 * Add new transponders based on NIT table information.
+		 * They're appended after the original entry, even when
+		 * scanning with an offset.
 		 */
 		if (!args->dont_add_new_freqs)
 			dvb_add_scaned_transponders(parms, dvb_scan_handler,
-						    dvb_file->first_entry, entry);
+						    st->dvb_file->first_entry, entry);
 
 		/*
 		 * Free the scan handler associated with the transponder
@@ -324,19 +507,575 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 
 		dvb_scan_free_handler_table(dvb_scan_handler);
 	}
+	pthread_mutex_unlock(&st->lock);
 
-	if (dvb_file_new)
-		dvb_write_file_format(args->output, dvb_file_new,
-				      parms->current_sys, args->output_format);
+	return NULL;
+}
+
+/*
+ * Runs func on all frontends: on new threads for the others, and on the
+ * current one for the first.
+ */
+static void run_workers(struct scan_worker *w, unsigned n_workers,
+			void *(*func)(void *))
+{
+	unsigned i;
+
+	for (i = 1; i < n_workers; i++) {
+		if (pthread_create(&w[i].thread, NULL, func, &w[i])) {
+			PERROR(_("can't create a thread for %s"), w[i].fe_name);
+			n_workers = i;
+			break;
+		}
+	}
+	func(&w[0]);
+	for (i = 1; i < n_workers; i++)
+		pthread_join(w[i].thread, NULL);
+}
+
+/*
+ * Blind scan: instead of trying to lock at each frequency step, the band
+ * is swept with a coarse step, measuring the signal strength and C/N,
+ * which takes just a few milliseconds per step. The edges of each group
+ * of steps with energy are then bisected down to 1/8 of the step, and
+ * only the frequencies at the middle of them are scanned.
+ */
+#define SWEEP_BLOCK		16	/* steps handed to a frontend at once */
+#define SWEEP_POLL_USEC		25000
+#define SWEEP_POLLS		4	/* multiplied by timeout_multiply */
+#define SWEEP_REFINE_STEPS	3	/* the edges are found within step / 8 */
+#define SWEEP_MIN_CNR		3000	/* 3 dB */
+#define SWEEP_DB_DELTA		3000	/* 3 dB above the noise floor */
+#define SWEEP_REL_DELTA		(65535 / 16)
+
+struct sweep_point {
+	uint32_t freq;
+	int64_t level;
+	uint8_t scale;		/* FE_SCALE_NOT_AVAILABLE if not measured */
+	int has_carrier;	/* locked, or a good C/N */
+};
+
+struct sweep_edge {
+	uint32_t cold, hot;
+};
+
+struct sweep_state {
+	pthread_mutex_t lock;
+	struct dvb_entry *tmpl;
+
+	struct sweep_point *pt;
+	unsigned n_pt, next_pt;
+	int64_t threshold;
+
+	struct sweep_edge *edge;
+	unsigned n_edge, next_edge;
+};
+
+static const uint32_t sweep_stats[] = {
+	DTV_STAT_SIGNAL_STRENGTH,
+	DTV_STAT_CNR,
+};
 
-	dvb_file_free(dvb_file);
-	if (dvb_file_new)
-		dvb_file_free(dvb_file_new);
+static int sweep_measure(struct scan_worker *w, uint32_t freq,
+			 struct sweep_point *pt)
+{
+	struct sweep_state *sw = w->sweep;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
+	struct dvb_entry *tmpl = sw->tmpl;
+	struct dtv_stats *stat;
+	uint32_t status, delsys = SYS_UNDEFINED;
+	int i, rc;
+
+	memset(pt, 0, sizeof(*pt));
+	pt->freq = freq;
+
+	dvb_retrieve_entry_prop(tmpl, DTV_DELIVERY_SYSTEM, &delsys);
+	dvb_set_compat_delivery_system(parms, delsys);
+	for (i = 0; i < tmpl->n_props; i++) {
+		if (tmpl->props[i].cmd == DTV_DELIVERY_SYSTEM)
+			continue;
+		dvb_fe_store_parm(parms, tmpl->props[i].cmd,
+				  tmpl->props[i].u.data);
+	}
+	dvb_fe_store_parm(parms, DTV_FREQUENCY, freq);
+
+	/* Only the frequency changes, so this is cheap after the first one */
+	rc = dvb_fe_set_parms(parms);
+	if (rc < 0)
+		return rc;
+
+	for (i = 0; i < SWEEP_POLLS * w->args.timeout_multiply; i++) {
+		usleep(SWEEP_POLL_USEC);
+		if (parms->abort)
+			return -1;
+		if (dvb_fe_get_stats(parms))
+			continue;
+
+		stat = dvb_fe_retrieve_stats_layer(parms,
+						   DTV_STAT_SIGNAL_STRENGTH, 0);
+		if (stat && stat->scale == FE_SCALE_DECIBEL) {
+			pt->scale = stat->scale;
+			pt->level = stat->svalue;
+		} else if (stat && stat->scale == FE_SCALE_RELATIVE) {
+			pt->scale = stat->scale;
+			pt->level = stat->uvalue;
+		}
 
-	dvb_dev_close(dmx_fd);
+		stat = dvb_fe_retrieve_stats_layer(parms, DTV_STAT_CNR, 0);
+		if (stat && stat->scale == FE_SCALE_DECIBEL &&
+		    stat->svalue >= SWEEP_MIN_CNR)
+			pt->has_carrier = 1;
+
+		if (!dvb_fe_retrieve_stats(parms, DTV_STATUS, &status) &&
+		    (status & FE_HAS_LOCK))
+			pt->has_carrier = 1;
+		if (pt->has_carrier)
+			break;
+	}
+	if (verbose > 1)
+		dvb_log(_("Sweep: %u: level %lld%s"), freq,
+			(long long)pt->level,
+			pt->has_carrier ? _(", carrier") : "");
 	return 0;
 }
 
+static int sweep_is_hot(struct sweep_state *sw, struct sweep_point *pt)
+{
+	return pt->has_carrier ||
+	       (pt->scale != FE_SCALE_NOT_AVAILABLE &&
+		pt->level >= sw->threshold);
+}
+
+static void *sweep_coarse(void *priv)
+{
+	struct scan_worker *w = priv;
+	struct sweep_state *sw = w->sweep;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
+	unsigned i, first;
+
+	dvb_fe_select_stats(parms, sweep_stats, ARRAY_SIZE(sweep_stats));
+
+	/*
+	 * Blocks of contiguous steps are measured by the same frontend, as
+	 * levels from different tuners may not match.
+	 */
+	pthread_mutex_lock(&sw->lock);
+	while (!parms->abort && sw->next_pt < sw->n_pt) {
+		first = sw->next_pt;
+		sw->next_pt += SWEEP_BLOCK;
+		pthread_mutex_unlock(&sw->lock);
+
+		for (i = first; i < first + SWEEP_BLOCK && i < sw->n_pt; i++)
+			if (sweep_measure(w, sw->pt[i].freq, &sw->pt[i]) < 0)
+				break;
+
+		pthread_mutex_lock(&sw->lock);
+	}
+	pthread_mutex_unlock(&sw->lock);
+
+	return NULL;
+}
+
+static void *sweep_refine(void *priv)
+{
+	struct scan_worker *w = priv;
+	struct sweep_state *sw = w->sweep;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
+	struct sweep_point pt;
+	struct sweep_edge *e;
+	uint32_t mid;
+	int i;
+
+	pthread_mutex_lock(&sw->lock);
+	while (!parms->abort && sw->next_edge < sw->n_edge) {
+		e = &sw->edge[sw->next_edge++];
+		pthread_mutex_unlock(&sw->lock);
+
+		for (i = 0; i < SWEEP_REFINE_STEPS; i++) {
+			mid = e->cold / 2 + e->hot / 2;
+			if (sweep_measure(w, mid, &pt) < 0)
+				break;
+			if (sweep_is_hot(sw, &pt))
+				e->hot = mid;
+			else
+				e->cold = mid;
+		}
+
+		pthread_mutex_lock(&sw->lock);
+	}
+	pthread_mutex_unlock(&sw->lock);
+
+	dvb_fe_select_stats(parms, NULL, 0);
+
+	return NULL;
+}
+
+static int cmp_level(const void *a, const void *b)
+{
+	int64_t la = *(const int64_t *)a, lb = *(const int64_t *)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+/* Uses the median level as the noise floor */
+static void sweep_threshold(struct sweep_state *sw)
+{
+	int64_t *level, delta = SWEEP_REL_DELTA;
+	unsigned i, n = 0;
+
+	sw->threshold = INT64_MAX;
+	level = malloc(sw->n_pt * sizeof(*level));
+	if (!level)
+		return;
+	for (i = 0; i < sw->n_pt; i++) {
+		if (sw->pt[i].scale == FE_SCALE_NOT_AVAILABLE)
+			continue;
+		if (sw->pt[i].scale == FE_SCALE_DECIBEL)
+			delta = SWEEP_DB_DELTA;
+		level[n++] = sw->pt[i].level;
+	}
+	if (n) {
+		qsort(level, n, sizeof(*level), cmp_level);
+		if ((level[n - 1] - level[n / 2]) / 4 > delta)
+			delta = (level[n - 1] - level[n / 2]) / 4;
+		sw->threshold = level[n / 2] + delta;
+	}
+	free(level);
+}
+
+/* Expected width of a carrier, in the same unit as the frequencies */
+static uint32_t sweep_carrier_width(struct dvb_v5_fe_parms *parms)
+{
+	uint32_t bw = 0, sr = 0;
+
+	dvb_fe_retrieve_parm(parms, DTV_BANDWIDTH_HZ, &bw);
+	if (bw)
+		return bw;
+	dvb_fe_retrieve_parm(parms, DTV_SYMBOL_RATE, &sr);
+	if (dvb_fe_is_satellite(parms->current_sys))
+		sr /= 1000;
+	return sr / 100 * 135;
+}
+
+static int sweep_template(struct scan_worker *w, unsigned n_workers,
+			  struct dvb_entry *tmpl, struct dvb_entry **first)
+{
+	struct arguments *args = &w[0].args;
+	struct dvb_v5_fe_parms *parms = w[0].dvb->fe_parms;
+	struct sweep_state sw = {};
+	uint32_t lo, hi, width, freq, pol, stream_id;
+	unsigned i, j, n, e, n_carriers = 0;
+	struct dvb_entry *new_entry;
+	int shift, ret = 0;
+
+	sw.tmpl = tmpl;
+	sw.n_pt = (args->blind_stop - args->blind_start) / args->blind_step + 1;
+	sw.pt = calloc(sw.n_pt, sizeof(*sw.pt));
+	sw.edge = calloc(2 * sw.n_pt, sizeof(*sw.edge));
+	if (!sw.pt || !sw.edge) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < sw.n_pt; i++)
+		sw.pt[i].freq = args->blind_start + i * args->blind_step;
+
+	pthread_mutex_init(&sw.lock, NULL);
+	for (i = 0; i < n_workers; i++)
+		w[i].sweep = &sw;
+
+	dvb_log(_("Sweeping %u to %u, step %u"), args->blind_start,
+		args->blind_stop, args->blind_step);
+	run_workers(w, n_workers, sweep_coarse);
+	if (parms->abort)
+		goto out_lock;
+
+	sweep_threshold(&sw);
+	if (sw.threshold == INT64_MAX)
+		dvb_logwarn(_("No signal strength without a lock: trying to lock at each step"));
+
+	/* Each group of steps with energy has its edges refined */
+	for (i = 0; i < sw.n_pt && sw.threshold != INT64_MAX; i++) {
+		if (!sweep_is_hot(&sw, &sw.pt[i]))
+			continue;
+		for (j = i; j + 1 < sw.n_pt && sweep_is_hot(&sw, &sw.pt[j + 1]); j++)
+			;
+		if (i > 0) {
+			sw.edge[sw.n_edge].cold = sw.pt[i - 1].freq;
+			sw.edge[sw.n_edge++].hot = sw.pt[i].freq;
+		}
+		if (j + 1 < sw.n_pt) {
+			sw.edge[sw.n_edge].cold = sw.pt[j + 1].freq;
+			sw.edge[sw.n_edge++].hot = sw.pt[j].freq;
+		}
+		i = j;
+	}
+	if (sw.threshold != INT64_MAX)
+		run_workers(w, n_workers, sweep_refine);
+	else
+		for (i = 0; i < n_workers; i++)
+			dvb_fe_select_stats(w[i].dvb->fe_parms, NULL, 0);
+	if (parms->abort)
+		goto out_lock;
+
+	/* Scan the middle of each carrier, or of each carrier width */
+	width = sweep_carrier_width(parms);
+	shift = dvb_estimate_freq_shift(parms);
+	if (dvb_retrieve_entry_prop(tmpl, DTV_POLARIZATION, &pol))
+		pol = POLARIZATION_OFF;
+	if (dvb_retrieve_entry_prop(tmpl, DTV_STREAM_ID, &stream_id))
+		stream_id = NO_STREAM_ID_FILTER;
+
+	for (i = 0, e = 0; i < sw.n_pt; i++) {
+		if (sw.threshold == INT64_MAX) {
+			new_entry = dvb_scan_add_entry_ex(parms, *first, tmpl,
+							  sw.pt[i].freq, shift,
+							  pol, stream_id);
+			if (new_entry && !*first)
+				*first = new_entry;
+			n_carriers += !!new_entry;
+			continue;
+		}
+		if (!sweep_is_hot(&sw, &sw.pt[i]))
+			continue;
+		for (j = i; j + 1 < sw.n_pt && sweep_is_hot(&sw, &sw.pt[j + 1]); j++)
+			;
+		lo = sw.pt[i].freq;
+		hi = sw.pt[j].freq;
+		if (i > 0) {
+			lo = sw.edge[e].cold / 2 + sw.edge[e].hot / 2;
+			e++;
+		}
+		if (j + 1 < sw.n_pt) {
+			hi = sw.edge[e].cold / 2 + sw.edge[e].hot / 2;
+			e++;
+		}
+		i = j;
+
+		/* Several carriers side by side look like a single one */
+		n = 1;
+		if (width && hi - lo > width + width / 2)
+			n = (hi - lo + width / 2) / width;
+		for (j = 0; j < n; j++) {
+			if (n == 1)
+				freq = lo / 2 + hi / 2;
+			else
+				freq = lo + width / 2 + j * width;
+			new_entry = dvb_scan_add_entry_ex(parms, *first, tmpl,
+							  freq, shift, pol,
+							  stream_id);
+			if (!new_entry)
+				continue;
+			if (!*first)
+				*first = new_entry;
+			n_carriers++;
+		}
+	}
+	dvb_log(_("Found %u carriers"), n_carriers);
+
+out_lock:
+	pthread_mutex_destroy(&sw.lock);
+out:
+	free(sw.pt);
+	free(sw.edge);
+	return ret;
+}
+
+/*
+ * Replaces the entries of the channel file by the carriers found on the
+ * band, using each of them as the template for the tuning parameters.
+ */
+static int blind_sweep(struct scan_worker *w, unsigned n_workers,
+		       struct scan_state *st)
+{
+	struct dvb_entry *tmpl, *last = NULL, *first = NULL;
+	int ret;
+
+	for (tmpl = st->dvb_file->first_entry; tmpl; tmpl = tmpl->next)
+		last = tmpl;
+	if (!last)
+		return 0;
+
+	for (tmpl = st->dvb_file->first_entry; ; tmpl = tmpl->next) {
+		ret = sweep_template(w, n_workers, tmpl, &first);
+		if (ret < 0 || w[0].dvb->fe_parms->abort || tmpl == last)
+			break;
+	}
+
+	/* The scan starts after the templates */
+	st->last = last;
+	return ret;
+}
+
+static int run_scan(struct scan_worker *w, unsigned n_workers)
+{
+	struct arguments *args = &w[0].args;
+	struct dvb_v5_fe_parms *parms = w[0].dvb->fe_parms;
+	struct scan_state st = {};
+	uint32_t sys;
+	unsigned i;
+	int err = 0;
+
+	/* This is used only when reading old formats */
+	switch (parms->current_sys) {
+	case SYS_DVBT:
+	case SYS_DVBS:
+	case SYS_DVBC_ANNEX_A:
+	case SYS_ATSC:
+		sys = parms->current_sys;
+		break;
+	case SYS_DVBC_ANNEX_C:
+		sys = SYS_DVBC_ANNEX_A;
+		break;
+	case SYS_DVBC_ANNEX_B:
+		sys = SYS_ATSC;
+		break;
+	case SYS_ISDBT:
+	case SYS_DTMB:
+		sys = SYS_DVBT;
+		break;
+	default:
+		sys = SYS_UNDEFINED;
+		break;
+	}
+	st.dvb_file = dvb_read_file_format(args->confname, sys,
+					   args->input_format);
+	if (!st.dvb_file)
+		return -2;
+
+	/* Avoids walking through all previous entries, for each one */
+	st.index = dvb_file_index_alloc(NULL);
+	if (!st.index) {
+		dvb_file_free(st.dvb_file);
+		return -ENOMEM;
+	}
+
+	if (args->blind_stop) {
+		err = blind_sweep(w, n_workers, &st);
+		if (err < 0)
+			goto out;
+	}
+
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+
+	/*
+	 * Each frontend takes the next transponder not scanned yet, so the
+	 * ones found on the NIT tables are split between them as well.
+	 */
+	for (i = 0; i < n_workers; i++)
+		w[i].state = &st;
+	run_workers(w, n_workers, scan_transponders);
+
+	/* Offsets left to try after an abort */
+	while (st.tries) {
+		struct offset_try *try = st.tries;
+
+		st.tries = try->next;
+		put_offset_search(try->search);
+		free(try);
+	}
+
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.lock);
+
+	if (st.dvb_file_new)
+		dvb_write_file_format(args->output, st.dvb_file_new,
+				      parms->current_sys, args->output_format);
+
+out:
+	dvb_file_index_free(st.index);
+	dvb_file_free(st.dvb_file);
+	if (st.dvb_file_new)
+		dvb_file_free(st.dvb_file_new);
+
+	return err;
+}
+
+static int parse_frontends(struct arguments *args, char *optarg)
+{
+	struct scan_frontend *fe;
+	char *p = optarg, *end;
+
+	args->n_frontends = 0;
+	while (*p) {
+		if (args->n_frontends == MAX_FRONTENDS) {
+			ERROR(_("at most %d frontends can be used"), MAX_FRONTENDS);
+			return EINVAL;
+		}
+		fe = &args->fe[args->n_frontends++];
+		memset(fe, 0, sizeof(*fe));
+
+		fe->adapter = strtoul(p, &end, 0);
+		if (end == p)
+			goto err;
+		fe->adapter_dmx = fe->adapter;
+		p = end;
+		if (*p == ':') {
+			fe->frontend = strtoul(++p, &end, 0);
+			if (end == p)
+				goto err;
+			p = end;
+			if (*p == ':') {
+				fe->demux = strtoul(++p, &end, 0);
+				if (end == p)
+					goto err;
+				p = end;
+			}
+		}
+		if (*p == ',')
+			p++;
+		else if (*p)
+			goto err;
+	}
+	if (args->n_frontends)
+		return 0;
+err:
+	ERROR(_("invalid frontend list: %s"), optarg);
+	return EINVAL;
+}
+
+static int parse_freq_offsets(struct arguments *args, char *optarg)
+{
+	/* UK DVB-T, Australian DVB-T and Brazilian ISDB-T channel plans */
+	static const int32_t default_offsets[] = {
+		166667, -166667, 125000, 142857,
+	};
+	char *p = optarg, *end;
+	double khz;
+	unsigned i;
+
+	args->n_freq_offsets = 0;
+	if (!optarg) {
+		for (i = 0; i < ARRAY_SIZE(default_offsets); i++)
+			args->freq_offsets[i] = default_offsets[i];
+		args->n_freq_offsets = ARRAY_SIZE(default_offsets);
+		return 0;
+	}
+
+	while (*p) {
+		if (args->n_freq_offsets == MAX_FREQ_OFFSETS) {
+			ERROR(_("at most %d frequency offsets can be used"),
+			      MAX_FREQ_OFFSETS);
+			return EINVAL;
+		}
+		khz = strtod(p, &end);
+		if (end == p || !khz)
+			goto err;
+		args->freq_offsets[args->n_freq_offsets++] =
+			khz * 1000 + (khz < 0 ? -0.5 : 0.5);
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			goto err;
+	}
+	if (args->n_freq_offsets)
+		return 0;
+err:
+	ERROR(_("invalid frequency offset list: %s"), optarg);
+	return EINVAL;
+}
+
 static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 {
 	struct arguments *args = state->input;
@@ -353,6 +1092,10 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 		args->demux = strtoul(optarg, NULL, 0);
 		args->adapter_dmx = args->adapter;
 		break;
+	case 'M':
+		return parse_frontends(args, optarg);
+	case 'X':
+		return parse_freq_offsets(args, optarg);
 	case 'w':
 		if (!strcasecmp(optarg,"on")) {
 			args->lna = 1;
@@ -394,6 +1137,18 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'p':
 		args->other_nit++;
 		break;
+	case 'P':
+		if (!strcasecmp(optarg, "full")) {
+			args->scan_tables = DVB_SCAN_FULL;
+		} else if (!strcasecmp(optarg, "quick")) {
+			args->scan_tables = DVB_SCAN_QUICK;
+		} else if (!strcasecmp(optarg, "zap")) {
+			args->scan_tables = DVB_SCAN_ZAP;
+		} else {
+			ERROR(_("invalid scan profile: %s"), optarg);
+			return EINVAL;
+		}
+		break;
 	case 'v':
 		verbose++;
 		break;
@@ -412,6 +1167,17 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'C':
 		args->cc = strndup(optarg, 2);
 		break;
+	case 't':
+		args->ts_file = optarg;
+		break;
+	case 'B':
+		if (sscanf(optarg, "%u:%u:%u", &args->blind_start,
+			   &args->blind_stop, &args->blind_step) != 3 ||
+		    !args->blind_step || args->blind_start > args->blind_stop) {
+			ERROR(_("invalid blind scan range: %s"), optarg);
+			return EINVAL;
+		}
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -430,13 +1196,17 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	return 0;
 }
 
-static int *timeout_flag;
+static int *timeout_flag[MAX_FRONTENDS];
+static unsigned n_timeout_flags;
 
 static void do_timeout(int x)
 {
+	unsigned i;
+
 	(void)x;
-	if (*timeout_flag == 0) {
-		*timeout_flag = 1;
+	if (*timeout_flag[0] == 0) {
+		for (i = 0; i < n_timeout_flags; i++)
+			*timeout_flag[i] = 1;
 		alarm(5);
 		signal(SIGALRM, do_timeout);
 	} else {
@@ -445,14 +1215,75 @@ static void do_timeout(int x)
 	}
 }
 
+static int open_frontend(struct scan_worker *w, struct scan_frontend *fe,
+			 int lnb)
+{
+	struct arguments *args = &w->args;
+	struct dvb_dev_list *dvb_dev;
+	struct dvb_v5_fe_parms *parms;
+	int err;
+
+	w->dvb = dvb_dev_alloc();
+	if (!w->dvb)
+		return -1;
+	dvb_dev_set_log(w->dvb, verbose, NULL);
+	if (args->ts_file) {
+		err = dvb_dev_file_init(w->dvb, args->ts_file);
+		if (err < 0)
+			return -1;
+	}
+	dvb_dev_find(w->dvb, NULL, NULL);
+	parms = w->dvb->fe_parms;
+
+	dvb_dev = dvb_dev_seek_by_adapter(w->dvb, fe->adapter_dmx, fe->demux,
+					  DVB_DEVICE_DEMUX);
+	if (!dvb_dev) {
+		fprintf(stderr, _("Couldn't find demux device node\n"));
+		return -1;
+	}
+	args->demux_dev = dvb_dev->sysname;
+
+	if (verbose)
+		fprintf(stderr, _("using demux '%s'\n"), args->demux_dev);
+
+	dvb_dev = dvb_dev_seek_by_adapter(w->dvb, fe->adapter, fe->frontend,
+					  DVB_DEVICE_FRONTEND);
+	if (!dvb_dev) {
+		fprintf(stderr, _("Couldn't find frontend device node\n"));
+		return -1;
+	}
+	w->fe_name = dvb_dev->sysname;
+
+	if (!dvb_dev_open(w->dvb, dvb_dev->sysname, O_RDWR))
+		return -1;
+
+	if (lnb >= 0)
+		parms->lnb = dvb_sat_get_lnb(lnb);
+	if (args->sat_number >= 0)
+		parms->sat_number = args->sat_number;
+	parms->diseqc_wait = args->diseqc_wait;
+	parms->freq_bpf = args->freq_bpf;
+	parms->lna = args->lna;
+	dvb_scan_set_tables(parms, args->scan_tables);
+	err = dvb_fe_set_default_country(parms, args->cc);
+	if (err < 0)
+		fprintf(stderr, _("Failed to set the country code:%s\n"), args->cc);
+
+	w->dmx_fd = dvb_dev_open(w->dvb, args->demux_dev, O_RDWR);
+	if (!w->dmx_fd) {
+		perror(_("opening demux failed"));
+		return -3;
+	}
+
+	return 0;
+}
 
 int main(int argc, char **argv)
 {
 	struct arguments args = {};
-	int err, lnb = -1,idx = -1;
-	struct dvb_device *dvb;
-	struct dvb_dev_list *dvb_dev;
-	struct dvb_v5_fe_parms *parms;
+	int err = 0, lnb = -1,idx = -1;
+	struct scan_worker w[MAX_FRONTENDS] = {};
+	unsigned i, n_workers;
 	const struct argp argp = {
 		.options = options,
 		.parser = parse_opt,
@@ -488,6 +1319,26 @@ int main(int argc, char **argv)
 		args.adapter_dmx = args.adapter;
 	}
 
+	if (!args.n_frontends) {
+		args.fe[0].adapter = args.adapter_fe;
+		args.fe[0].frontend = args.frontend;
+		args.fe[0].adapter_dmx = args.adapter_dmx;
+		args.fe[0].demux = args.demux;
+		args.n_frontends = 1;
+	}
+
+	/*
+	 * A recording has a single transponder, that is always "locked":
+	 * the ones announced at the NIT would just parse the same file again.
+	 */
+	if (args.ts_file) {
+		memset(&args.fe[0], 0, sizeof(args.fe[0]));
+		args.n_frontends = 1;
+		args.dont_add_new_freqs = 1;
+		args.blind_stop = 0;
+		args.n_freq_offsets = 0;
+	}
+
 	if (args.lnb_name) {
 		lnb = dvb_sat_search_lnb(args.lnb_name);
 		if (lnb < 0) {
@@ -515,51 +1366,27 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	dvb = dvb_dev_alloc();
-	if (!dvb)
-		return -1;
-	dvb_dev_set_log(dvb, verbose, NULL);
-	dvb_dev_find(dvb, NULL, NULL);
-	parms = dvb->fe_parms;
-
-	dvb_dev = dvb_dev_seek_by_adapter(dvb, args.adapter_dmx, args.demux, DVB_DEVICE_DEMUX);
-	if (!dvb_dev) {
-		fprintf(stderr, _("Couldn't find demux device node\n"));
-		dvb_dev_free(dvb);
-		return -1;
+	n_workers = args.n_frontends;
+	for (i = 0; i < n_workers; i++) {
+		w[i].args = args;
+		err = open_frontend(&w[i], &args.fe[i], lnb);
+		if (err)
+			goto out;
+		timeout_flag[n_timeout_flags++] = &w[i].dvb->fe_parms->abort;
 	}
-	args.demux_dev = dvb_dev->sysname;
 
-	if (verbose)
-		fprintf(stderr, _("using demux '%s'\n"), args.demux_dev);
-
-	dvb_dev = dvb_dev_seek_by_adapter(dvb, args.adapter_fe, args.frontend,
-					  DVB_DEVICE_FRONTEND);
-	if (!dvb_dev)
-		return -1;
-
-	if (!dvb_dev_open(dvb, dvb_dev->sysname, O_RDWR)) {
-		free(args.demux_dev);
-		return -1;
-	}
-	if (lnb >= 0)
-		parms->lnb = dvb_sat_get_lnb(lnb);
-	if (args.sat_number >= 0)
-		parms->sat_number = args.sat_number;
-	parms->diseqc_wait = args.diseqc_wait;
-	parms->freq_bpf = args.freq_bpf;
-	parms->lna = args.lna;
-	err = dvb_fe_set_default_country(parms, args.cc);
-	if (err < 0)
-		fprintf(stderr, _("Failed to set the country code:%s\n"), args.cc);
-
-	timeout_flag = &parms->abort;
 	signal(SIGTERM, do_timeout);
 	signal(SIGINT, do_timeout);
 
-	err = run_scan(&args, dvb);
+	err = run_scan(w, n_workers);
 
-	dvb_dev_free(dvb);
+out:
+	for (i = 0; i < n_workers; i++) {
+		if (w[i].dmx_fd)
+			dvb_dev_close(w[i].dmx_fd);
+		if (w[i].dvb)
+			dvb_dev_free(w[i].dvb);
+	}
 
 	return err;
 }
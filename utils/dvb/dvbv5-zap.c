@@ -38,6 +38,69 @@
  */
 #define BUFLEN (188 * 512)
 
+/*
+ * Maximum size moved by each dvb_dev_splice() call. It should fit on a
+ * pipe, whose size is limited by /proc/sys/fs/pipe-max-size (1 MiB by
+ * default).
+ */
+#define SPLICE_LEN (188 * 4096)
+
+/*
+ * Number of BUFLEN buffers used when recording with memory mapped
+ * buffers. They hold the same as DVB_BUF_SIZE, although the Kernel may
+ * give less of them.
+ */
+#define MMAP_BUFS	(DVB_BUF_SIZE / BUFLEN)
+
+/*
+ * On recording mode, the MPEG-TS is stored on the DVR device buffer,
+ * whose default size holds just a fraction of a second of a high bitrate
+ * transponder. It starts with DVB_BUF_SIZE, then it is resized to hold
+ * DVR_BUF_SECONDS of the measured bitrate, and doubled on each overrun,
+ * up to DVR_BUF_MAX.
+ */
+#define DVR_BUF_SECONDS	2
+#define DVR_BUF_MAX	(4096 * 64 * 188)
+
+/*
+ * When recording several services, the packets of each one are queued
+ * and written in chunks of this size, instead of doing one write() per
+ * packet.
+ */
+#define REC_BUF_LEN (188 * 1024)
+
+/* Maximum number of services that can be recorded at the same time */
+#define MAX_SERVICES	16
+
+/* Maximum number of elementary stream PIDs recorded per service */
+#define MAX_SERVICE_PIDS	32
+
+/*
+ * On streaming mode, each datagram has STREAM_PKTS packets, the most that
+ * fit on an Ethernet frame, and up to STREAM_BATCH datagrams are sent per
+ * sendmmsg() call, if they're due within STREAM_BURST_NSEC. The PCR clock
+ * is re-anchored when it gets STREAM_MAX_DRIFT_NSEC away from the local one.
+ */
+#define STREAM_PKTS		7
+#define STREAM_BATCH		64
+#define STREAM_BURST_NSEC	1000000
+#define STREAM_MAX_DRIFT_NSEC	100000000
+
+/* The PCR is a 27 MHz clock, wrapping at 2^33 * 300 */
+#define PCR_TICKS_PER_MS	27000ULL
+#define PCR_WRAP		((1ULL << 33) * 300)
+
+/* Longer PCR intervals are discontinuities, per ETSI TR 101 290 */
+#define PCR_DISCONTINUITY_MS	100
+
+/*
+ * On realtime mode, the DVR device is busy-polled for up to RT_SPIN_USEC
+ * microseconds before sleeping on it, with SCHED_FIFO priority
+ * RT_DEFAULT_PRIO, unless told otherwise.
+ */
+#define RT_DEFAULT_PRIO	50
+#define RT_SPIN_USEC	200
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,7 +109,14 @@
 #include <errno.h>
 #include <signal.h>
 #include <argp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
 #include <time.h>
 
 #ifdef ENABLE_NLS
@@ -66,9 +136,21 @@
 #include "libdvbv5/dvb-demux.h"
 #include "libdvbv5/dvb-dev.h"
 #include "libdvbv5/dvb-scan.h"
+#include "libdvbv5/dvb-ts-demux.h"
 #include "libdvbv5/header.h"
+#include "libdvbv5/pat.h"
+#include "libdvbv5/pmt.h"
+#include "libdvbv5/crc32.h"
 #include "libdvbv5/countries.h"
 
+/*
+ * dvb_fe_wait_lock() returns as soon as the frontend locks, as the time
+ * to lock is most of the time to zap. Until then, the stats are printed
+ * every STATS_POLLS waits.
+ */
+#define LOCK_WAIT_MSEC	100
+#define STATS_POLLS	10
+
 #define CHANNEL_FILE	"channels.conf"
 #define PROGRAM_NAME	"dvbv5-zap"
 
@@ -83,6 +165,10 @@ const int NANO_SECONDS_IN_SEC = 1000000000;
 const char *argp_program_version = PROGRAM_NAME " version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Mauro Carvalho Chehab <mchehab@kernel.org>";
 
+struct record_service {
+	char *channel, *filename;
+};
+
 struct arguments {
 	char *confname, *lnb_name, *output, *demux_dev, *dvr_dev, *dvr_fname;
 	char *filename, *dvr_pipe;
@@ -93,8 +179,13 @@ struct arguments {
 	unsigned n_apid, n_vpid, extra_pids, all_pids;
 	enum dvb_file_formats input_format, output_format;
 	unsigned traffic_monitor, low_traffic, non_human, port;
-	char *search, *server;
+	char *search, *server, *cache, *metrics, *stream;
+	int ttl;
+	int rt_prio, rt_cpu;
+	unsigned rt_spin;
 	const char *cc;
+	struct record_service services[MAX_SERVICES];
+	unsigned n_services;
 
 	/* Used by status print */
 	unsigned n_status_lines;
@@ -112,10 +203,12 @@ static const struct argp_option options[] = {
 	{"lnbf",	'l', N_("LNBf_type"),		0, N_("type of LNBf to use. 'help' lists the available ones"), 0},
 	{"search",	'L', N_("string"),		0, N_("search/look for a string inside the traffic"), 0},
 	{"monitor",	'm', NULL,			0, N_("monitors the DVB traffic"), 0},
+	{"metrics",	'M', N_("file"),		0, N_("on monitor mode, writes the traffic and error counters to 'file' every second, in the Prometheus text format"), 0},
 	{"output",	'o', N_("file"),		0, N_("output filename (use -o - for stdout)"), 0},
 	{"pat",		'p', NULL,			0, N_("add pat and pmt to TS recording (implies -r)"), 0},
 	{"all-pids",	'P', NULL,			0, N_("don't filter any pids. Instead, outputs all of them"), 0 },
 	{"record",	'r', NULL,			0, N_("set up /dev/dvb/adapterX/dvr0 for TS recording"), 0},
+	{"record-service", 'R', N_("channel=file"),	0, N_("record a service of the tuned transponder into a file, with its own PAT and PMT. Can be used more than once"), 0},
 	{"silence",	's', NULL,			0, N_("increases silence (can be used more than once)"), 0},
 	{"sat_number",	'S', N_("satellite_number"),	0, N_("satellite number. If not specified, disable DISEqC"), 0},
 	{"timeout",	't', N_("seconds"),		0, N_("timeout for zapping and for recording"), 0},
@@ -129,7 +222,13 @@ static const struct argp_option options[] = {
 	{"non-numan",	'N', NULL,			0, N_("Non-human formatted stats (useful for scripts)"), 0},
 	{"server",	'H', N_("SERVER"),		0, N_("dvbv5-daemon host IP address"), 0},
 	{"tcp-port",	'T', N_("PORT"),		0, N_("dvbv5-daemon host tcp port"), 0},
+	{"cache",	'K', N_("file"),		0, N_("cache of PMT PIDs, to start recording PAT/PMT at once. Validated after tuning"), 0},
 	{"dvr-pipe",	'D', N_("PIPE"),		0, N_("Named pipe for DVR output, when using remote access (by default: /tmp/dvr-pipe)"), 0},
+	{"stream",	'u', N_("url"),			0, N_("send the MPEG-TS to udp://host:port or rtp://host:port, paced by its PCR (implies -r)"), 0},
+	{"ttl",		-5,  N_("hops"),		0, N_("time to live of the multicast datagrams sent with --stream (default 1)"), 0},
+	{"realtime",	-6,  N_("priority"),		OPTION_ARG_OPTIONAL, N_("record with the memory locked and SCHED_FIFO priority (default 50), busy-polling the DVR device instead of sleeping on it"), 0},
+	{"cpu",		-7,  N_("cpu#"),		0, N_("on realtime mode, run only on the given CPU"), 0},
+	{"spin",	-8,  N_("usecs"),		0, N_("on realtime mode, how long to busy-poll before sleeping on the DVR device (default 200)"), 0},
 	{"help",        '?', 0,				0, N_("Give this help list"), -1},
 	{"usage",	-3,  0,				0, N_("Give a short usage message")},
 	{"version",	-4,  0,				0, N_("Print program version"), -1},
@@ -164,6 +263,27 @@ static int timeout_flag = 0;
 	} while (0)
 
 
+static struct dvb_entry *find_entry(struct dvb_file *dvb_file,
+				    const char *channel)
+{
+	struct dvb_entry *entry;
+
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+		if (entry->channel && !strcmp(entry->channel, channel))
+			return entry;
+		if (entry->vchannel && !strcmp(entry->vchannel, channel))
+			return entry;
+	}
+	/*
+	 * Give a second shot, using a case insensitive seek
+	 */
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+		if (entry->channel && !strcasecmp(entry->channel, channel))
+			return entry;
+	}
+	return NULL;
+}
+
 /*
  * Find channel configuration.
  * On success, the caller must dvb_file_free(*out_file).
@@ -209,22 +329,7 @@ static int parse(struct arguments *args,
 	if (!dvb_file)
 		return -2;
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		if (entry->channel && !strcmp(entry->channel, channel))
-			break;
-		if (entry->vchannel && !strcmp(entry->vchannel, channel))
-			break;
-	}
-	/*
-	 * Give a second shot, using a case insensitive seek
-	 */
-	if (!entry) {
-		for (entry = dvb_file->first_entry; entry != NULL;
-		     entry = entry->next) {
-			if (entry->channel && !strcasecmp(entry->channel, channel))
-				break;
-		}
-	}
+	entry = find_entry(dvb_file, channel);
 
 	/*
 	 * When this tool is used to just tune to a channel, to monitor it or
@@ -334,6 +439,100 @@ static int parse(struct arguments *args,
 	return 0;
 }
 
+/*
+ * Cache of PMT PIDs: each line has the frequency, the service ID, the
+ * PMT PID and the channel name.
+ */
+static uint32_t entry_frequency(const struct dvb_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->n_props; i++)
+		if (entry->props[i].cmd == DTV_FREQUENCY)
+			return entry->props[i].u.data;
+	return 0;
+}
+
+static int cache_get_pmt_pid(struct arguments *args,
+			     const struct dvb_entry *entry)
+{
+	uint32_t freq = entry_frequency(entry);
+	unsigned f, sid, pid;
+	char line[256];
+	int pmt_pid = 0;
+	FILE *fp;
+
+	fp = fopen(args->cache, "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%u %u %u", &f, &sid, &pid) != 3)
+			continue;
+		if (f == freq && sid == entry->service_id) {
+			pmt_pid = pid;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return pmt_pid;
+}
+
+static void cache_store_pmt_pid(struct arguments *args,
+				const struct dvb_entry *entry, int pmt_pid)
+{
+	uint32_t freq = entry_frequency(entry);
+	unsigned f, sid, pid;
+	char line[256], *tmp;
+	FILE *fp, *out;
+
+	if (asprintf(&tmp, "%s.tmp", args->cache) < 0)
+		return;
+
+	out = fopen(tmp, "w");
+	if (!out) {
+		PERROR(_("can't write to %s"), tmp);
+		free(tmp);
+		return;
+	}
+
+	/* Copy the other entries, and replace the one for this service */
+	fp = fopen(args->cache, "r");
+	if (fp) {
+		while (fgets(line, sizeof(line), fp)) {
+			if (sscanf(line, "%u %u %u", &f, &sid, &pid) == 3 &&
+			    f == freq && sid == entry->service_id)
+				continue;
+			fputs(line, out);
+		}
+		fclose(fp);
+	}
+	fprintf(out, "%u %u %u %s\n", freq, entry->service_id, pmt_pid,
+		entry->channel ? entry->channel : "");
+
+	if (fclose(out) || rename(tmp, args->cache))
+		PERROR(_("can't update %s"), args->cache);
+	free(tmp);
+}
+
+static int get_pmt_pid(struct arguments *args, struct dvb_device *dvb,
+		       uint16_t service_id)
+{
+	struct dvb_open_descriptor *sid_fd;
+	int pmtpid;
+
+	sid_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
+	if (!sid_fd) {
+		ERROR("opening sid demux failed");
+		return -1;
+	}
+	pmtpid = dvb_dev_dmx_get_pmt_pid(sid_fd, service_id);
+	dvb_dev_close(sid_fd);
+
+	return pmtpid;
+}
+
 static int setup_frontend(struct arguments *args,
 			  struct dvb_v5_fe_parms *parms)
 {
@@ -484,12 +683,14 @@ static int print_frontend_stats(FILE *fd,
 static int check_frontend(struct arguments *args,
 			  struct dvb_v5_fe_parms *parms)
 {
-	int rc;
+	int rc, polls = 0;
 	fe_status_t status = 0;
 	do {
-		rc = dvb_fe_get_stats(parms);
-		if (rc) {
-			ERROR("dvb_fe_get_stats failed");
+		rc = dvb_fe_wait_lock(parms, LOCK_WAIT_MSEC);
+		if (rc == -EINTR)
+			break;
+		if (rc && rc != -ETIMEDOUT) {
+			ERROR("dvb_fe_wait_lock failed");
 			usleep(1000000);
 			continue;
 		}
@@ -501,11 +702,10 @@ static int check_frontend(struct arguments *args,
 			usleep(1000000);
 			continue;
 		}
-		if (!args->silent)
-			print_frontend_stats(stderr, args, parms);
 		if (status & FE_HAS_LOCK)
 			break;
-		usleep(1000000);
+		if (!args->silent && !(polls++ % STATS_POLLS))
+			print_frontend_stats(stderr, args, parms);
 	} while (!timeout_flag);
 	if (args->silent < 2)
 		print_frontend_stats(stderr, args, parms);
@@ -549,65 +749,1088 @@ static struct timespec *elapsed_time(struct timespec *start)
 	return &elapsed;
 }
 
+/*
+ * Grows the DVR buffer to at least "size" bytes. Please notice that
+ * the Kernel discards the buffer contents when it is resized.
+ */
+static void set_dvr_bufsize(struct dvb_open_descriptor *dvr_fd, int *cur,
+			    long long size, int silent)
+{
+	/* Keep it a multiple of both the page and the packet sizes */
+	size = (size + 4096 * 188 - 1) / (4096 * 188) * (4096 * 188);
+	if (size > DVR_BUF_MAX)
+		size = DVR_BUF_MAX;
+	if (size <= *cur)
+		return;
+
+	if (dvb_dev_set_bufsize(dvr_fd, size) < 0)
+		return;
+	*cur = size;
+	if (silent < 2)
+		fprintf(stderr, _("DVR buffer set to %d bytes\n"), *cur);
+}
+
+/* Called after each read, to size the DVR buffer from the bitrate */
+static void adjust_dvr_bufsize(struct dvb_open_descriptor *dvr_fd, int *cur,
+			       int *measured, struct timespec *start,
+			       long long rc, int silent)
+{
+	struct timespec *elapsed;
+	double secs;
+
+	if (*measured)
+		return;
+
+	elapsed = elapsed_time(start);
+	if (!elapsed || !elapsed->tv_sec)
+		return;
+
+	secs = elapsed->tv_sec + elapsed->tv_nsec * 1. / NANO_SECONDS_IN_SEC;
+	set_dvr_bufsize(dvr_fd, cur, rc * DVR_BUF_SECONDS / secs, silent);
+	*measured = 1;
+}
+
+/*
+ * Both the data and the DVR buffer contents are lost on overruns.
+ * Reports it, and increases the buffer size to avoid new ones.
+ */
+static void dvr_overrun(struct dvb_open_descriptor *dvr_fd, int *cur,
+			struct timespec *start, long long rc, int silent)
+{
+	struct timespec *elapsed = elapsed_time(start);
+
+	if (!elapsed)
+		fprintf(stderr, _("buffer overrun at %lld\n"), rc);
+	else
+		fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
+			(long long)elapsed->tv_sec,
+			elapsed->tv_nsec / 10000000);
+
+	set_dvr_bufsize(dvr_fd, cur, 2LL * *cur, silent);
+}
+
+/*
+ * Realtime mode: the time between a read() finding no data and the next
+ * one returning some is measured, and reported at the end.
+ */
+struct rt_state {
+	int fd, slept;
+	unsigned long long spin_nsec, wait_start, spin_end, start;
+	unsigned long long *waits;
+	unsigned n_waits, max_waits, n_sleeps;
+};
+
+static unsigned long long rt_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void rt_setup(struct arguments *args)
+{
+	struct sched_param param = { .sched_priority = args->rt_prio };
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		PERROR(_("mlockall failed"));
+	if (args->rt_cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(args->rt_cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+			PERROR(_("can't run on CPU %d"), args->rt_cpu);
+	}
+	if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+		PERROR(_("can't set SCHED_FIFO priority %d"), args->rt_prio);
+}
+
+/* Called when a read() returns -EAGAIN */
+static void rt_wait(struct rt_state *rt, unsigned spin_usec)
+{
+	struct pollfd pfd = { .fd = rt->fd, .events = POLLIN };
+	unsigned long long now = rt_now();
+
+	if (!rt->wait_start) {
+		rt->wait_start = now;
+		rt->spin_end = now + spin_usec * 1000ULL;
+	}
+	if (now < rt->spin_end)
+		return;
+
+	/* Out of budget: sleep until there's data */
+	if (!rt->slept) {
+		rt->spin_nsec += now - rt->wait_start;
+		rt->n_sleeps++;
+		rt->slept = 1;
+	}
+	poll(&pfd, 1, 1000);
+}
+
+/* Called when a read() returns data */
+static void rt_got_data(struct rt_state *rt, unsigned spin_usec)
+{
+	unsigned long long now;
+
+	if (!rt->wait_start)
+		return;
+
+	now = rt_now();
+	if (!rt->slept)
+		rt->spin_nsec += now - rt->wait_start;
+	rt->slept = 0;
+	if (rt->n_waits == rt->max_waits) {
+		unsigned long long *p;
+
+		rt->max_waits = rt->max_waits ? 2 * rt->max_waits : 4096;
+		p = realloc(rt->waits, rt->max_waits * sizeof(*p));
+		if (!p) {
+			rt->max_waits = rt->n_waits;
+			rt->wait_start = 0;
+			return;
+		}
+		rt->waits = p;
+	}
+	rt->waits[rt->n_waits++] = now - rt->wait_start;
+	rt->wait_start = 0;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void rt_report(struct rt_state *rt)
+{
+	unsigned long long elapsed = rt_now() - rt->start;
+	unsigned n = rt->n_waits;
+
+	if (!n) {
+		fprintf(stderr, _("realtime: never waited for data\n"));
+		free(rt->waits);
+		return;
+	}
+	qsort(rt->waits, n, sizeof(*rt->waits), cmp_ull);
+	fprintf(stderr, _("realtime: waited for data %u times, p50/p90/p99/max %.1f/%.1f/%.1f/%.1f us, busy-polling %.1f%% of the time, slept %u times\n"),
+		n, rt->waits[n / 2] / 1000., rt->waits[n * 9 / 10] / 1000.,
+		rt->waits[n * 99 / 100] / 1000., rt->waits[n - 1] / 1000.,
+		elapsed ? 100. * rt->spin_nsec / elapsed : 0., rt->n_sleeps);
+	free(rt->waits);
+}
+
 static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
-			 int timeout, int silent)
+			 int timeout, int silent, int rt_spin)
 {
 	char buf[BUFLEN];
-	int r, first = 1;
+	struct dvb_dev_buffer mbuf;
+	int r, first = 1, use_splice = 1, use_mmap;
+	int bufsize = 0, measured = 0;
 	long long int rc = 0LL;
-	struct timespec start, *elapsed;
+	struct timespec start;
+	struct rt_state rt = { .fd = -1 };
+
+	/*
+	 * On realtime mode, the device is read on non-blocking mode, as
+	 * splice() and the memory mapped buffers would sleep on it.
+	 */
+	if (rt_spin >= 0) {
+		rt.fd = dvb_dev_get_fd(in_fd);
+		if (rt.fd >= 0 &&
+		    fcntl(rt.fd, F_SETFL, fcntl(rt.fd, F_GETFL) | O_NONBLOCK) < 0)
+			rt.fd = -1;
+		if (rt.fd < 0)
+			ERROR("can't busy-poll the DVR device");
+		rt.start = rt_now();
+	}
+
+	/*
+	 * Memory mapped buffers are filled by the Kernel without copying
+	 * the data to userspace, and written straight from there.
+	 */
+	use_mmap = rt.fd < 0 && dvb_dev_mmap_start(in_fd, BUFLEN, MMAP_BUFS) > 0;
+	if (!use_mmap)
+		set_dvr_bufsize(in_fd, &bufsize, DVB_BUF_SIZE, silent);
+	if (rt.fd >= 0)
+		use_splice = 0;
+
+	/* Initialize start time, due to -EOVERFLOW with first == 1 */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (timeout_flag == 0) {
+		/*
+		 * Use splice() when possible, as it avoids copying the data
+		 * to userspace and back.
+		 */
+		if (use_mmap) {
+			r = dvb_dev_dqbuf(in_fd, &mbuf);
+			if (!r)
+				r = mbuf.bytesused;
+		} else if (use_splice) {
+			r = dvb_dev_splice(in_fd, out_fd, SPLICE_LEN);
+			if (r == -EOPNOTSUPP) {
+				use_splice = 0;
+				continue;
+			}
+		} else {
+			r = dvb_dev_read(in_fd, buf, sizeof(buf));
+		}
+		if (r == -EAGAIN && rt.fd >= 0) {
+			rt_wait(&rt, rt_spin);
+			continue;
+		}
+		if (r < 0) {
+			if (r == -EOVERFLOW) {
+				dvr_overrun(in_fd, &bufsize, &start, rc, silent);
+				continue;
+			}
+			ERROR("Read failed");
+			break;
+		}
+		if (rt.fd >= 0)
+			rt_got_data(&rt, rt_spin);
+
+		/*
+		 * It takes a while for a DVB device to start streaming, as the
+		 * hardware may be waiting for some locks. The safest way to
+		 * ensure that a program record will have the start amount of
+		 * time specified by the user is to restart the timeout alarm
+		 * here, after the first succeded read.
+		 *
+		 * So, let's reset the start time here.
+		 */
+		if (first) {
+			if (timeout > 0)
+				alarm(timeout);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			first = 0;
+		}
+
+		if (use_mmap) {
+			if (write(out_fd, mbuf.data, r) < 0) {
+				PERROR(_("Write failed"));
+				break;
+			}
+			if (dvb_dev_qbuf(in_fd, &mbuf) < 0) {
+				ERROR("Queuing buffer failed");
+				break;
+			}
+			rc += r;
+			continue;
+		}
+
+		if (!use_splice && write(out_fd, buf, r) < 0) {
+			PERROR(_("Write failed"));
+			break;
+		}
+
+		rc += r;
+		adjust_dvr_bufsize(in_fd, &bufsize, &measured, &start, rc,
+				   silent);
+	}
+	if (use_mmap)
+		dvb_dev_mmap_stop(in_fd);
+	if (rt.fd >= 0)
+		rt_report(&rt);
+	if (silent < 2) {
+		if (timeout)
+			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
+				rc / (1024 * timeout));
+		else
+			fprintf(stderr, _("received %lld bytes\n"), rc);
+	}
+}
+
+/*
+ * Streaming mode: the MPEG-TS is sent to a UDP socket, usually a multicast
+ * group, optionally with a RTP header (RFC 2250). The datagrams are paced
+ * by the PCR of the stream, so that they leave at the same rate they were
+ * broadcast, instead of in bursts of a DVR read each.
+ */
+struct stream_state {
+	int fd, rtp;
+	uint16_t seq;
+	uint32_t ssrc;
+
+	/* Bytes of the TS already scheduled */
+	unsigned long long pos;
+
+	/*
+	 * PCR clock: the last PCR, its position, the PCR ticks since the
+	 * anchor and the CLOCK_MONOTONIC time of the anchor, in ns.
+	 */
+	int pcr_pid, have_clock;
+	unsigned long long pcr, pcr_pos, ticks, t0;
+	double ticks_per_byte;
+
+	/* Datagrams waiting to be sent */
+	struct mmsghdr msg[STREAM_BATCH];
+	struct iovec iov[STREAM_BATCH][2];
+	uint8_t hdr[STREAM_BATCH][12];
+	unsigned n_msg;
+	unsigned long long msg_t;
+
+	unsigned long long sent;
+};
+
+static unsigned long long now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Opens a socket connected to udp://host:port or rtp://host:port */
+static int stream_open(struct stream_state *st, const char *url, int ttl)
+{
+	struct addrinfo hints = {}, *res;
+	char *host, *port;
+	int fd, rc;
+
+	memset(st, 0, sizeof(*st));
+	st->fd = -1;
+	st->pcr_pid = -1;
+
+	if (!strncmp(url, "rtp://", 6)) {
+		st->rtp = 1;
+	} else if (strncmp(url, "udp://", 6)) {
+		ERROR("stream URL should be udp://host:port or rtp://host:port");
+		return -1;
+	}
+
+	host = strdup(url + 6);
+	if (!host)
+		return -1;
+	port = strrchr(host, ':');
+	if (!port) {
+		ERROR("no port at the stream URL '%s'", url);
+		free(host);
+		return -1;
+	}
+	*port++ = '\0';
+	if (*host == '[' && port[-2] == ']') {
+		port[-2] = '\0';
+		memmove(host, host + 1, strlen(host));
+	}
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	rc = getaddrinfo(host, port, &hints, &res);
+	free(host);
+	if (rc) {
+		ERROR("can't resolve '%s': %s", url, gai_strerror(rc));
+		return -1;
+	}
+
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0) {
+		PERROR(_("socket() failed"));
+		freeaddrinfo(res);
+		return -1;
+	}
+	if (ttl > 0) {
+		if (res->ai_family == AF_INET6)
+			setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+				   &ttl, sizeof(ttl));
+		else
+			setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL,
+				   &ttl, sizeof(ttl));
+	}
+	rc = connect(fd, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (rc < 0) {
+		PERROR(_("connect to '%s' failed"), url);
+		close(fd);
+		return -1;
+	}
+
+	st->fd = fd;
+	st->ssrc = random();
+	st->seq = random();
+	return 0;
+}
+
+/* Waits until the first queued datagram is due, and sends all of them */
+static int stream_flush(struct stream_state *st)
+{
+	struct timespec ts;
+	unsigned i = 0;
+	int r;
+
+	if (!st->n_msg)
+		return 0;
+
+	if (st->msg_t > now_nsec()) {
+		ts.tv_sec = st->msg_t / 1000000000ULL;
+		ts.tv_nsec = st->msg_t % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+		       !timeout_flag)
+			;
+	}
+
+	while (i < st->n_msg) {
+		r = sendmmsg(st->fd, st->msg + i, st->n_msg - i, 0);
+		if (r < 0) {
+			if (errno == EINTR && !timeout_flag)
+				continue;
+			PERROR(_("sendmmsg() failed"));
+			st->n_msg = 0;
+			return -1;
+		}
+		i += r;
+	}
+	st->sent += st->n_msg;
+	st->n_msg = 0;
+	return 0;
+}
+
+/* Updates the PCR clock with the PCRs of the packets of a datagram */
+static void stream_pcr(struct stream_state *st, const uint8_t *p)
+{
+	unsigned long long pcr, pos, delta;
+	unsigned i, pid;
+
+	for (i = 0; i < STREAM_PKTS; i++, p += 188) {
+		pid = (p[1] & 0x1f) << 8 | p[2];
+		if (!(p[3] & 0x20) || p[4] < 7 || !(p[5] & 0x10))
+			continue;
+		if (st->pcr_pid < 0)
+			st->pcr_pid = pid;
+		if (pid != st->pcr_pid)
+			continue;
+
+		pcr = ((unsigned long long)p[6] << 25 | p[7] << 17 |
+		       p[8] << 9 | p[9] << 1 | p[10] >> 7) * 300 +
+		      ((p[10] & 1) << 8 | p[11]);
+		pos = st->pos + i * 188;
+
+		if (!st->have_clock || (p[5] & 0x80)) {
+			/* First PCR, or a discontinuity: re-anchor */
+			st->t0 = now_nsec();
+			st->ticks = 0;
+			st->have_clock = 1;
+		} else {
+			delta = (pcr + PCR_WRAP - st->pcr) % PCR_WRAP;
+			if (delta > PCR_DISCONTINUITY_MS * PCR_TICKS_PER_MS) {
+				st->t0 = now_nsec();
+				st->ticks = 0;
+			} else {
+				st->ticks += delta;
+				if (pos > st->pcr_pos)
+					st->ticks_per_byte = (double)delta /
+							     (pos - st->pcr_pos);
+			}
+		}
+		st->pcr = pcr;
+		st->pcr_pos = pos;
+	}
+}
+
+/* Queues a datagram with STREAM_PKTS packets, sending the queue if needed */
+static int stream_put(struct stream_state *st, uint8_t *p)
+{
+	unsigned long long t, now = now_nsec();
+	struct mmsghdr *msg;
+	struct iovec *iov;
+	uint8_t *hdr;
+
+	/* Due time, from the last PCR and the PCR rate */
+	if (st->have_clock) {
+		t = st->ticks + (st->pos - st->pcr_pos) * st->ticks_per_byte;
+		t = st->t0 + t * 1000 / 27;
+
+		/*
+		 * The local clock drifts from the broadcaster one, and
+		 * there may be gaps at the stream. Re-anchor if too far.
+		 */
+		if (t > now + STREAM_MAX_DRIFT_NSEC ||
+		    t + STREAM_MAX_DRIFT_NSEC < now) {
+			st->t0 = st->t0 + now - t;
+			t = now;
+		}
+	} else {
+		t = now;
+	}
+
+	if (st->n_msg && (st->n_msg == STREAM_BATCH ||
+			  t > st->msg_t + STREAM_BURST_NSEC))
+		if (stream_flush(st) < 0)
+			return -1;
+
+	if (!st->n_msg)
+		st->msg_t = t;
+
+	msg = &st->msg[st->n_msg];
+	iov = st->iov[st->n_msg];
+	hdr = st->hdr[st->n_msg];
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_hdr.msg_iov = iov;
+
+	if (st->rtp) {
+		uint32_t ts = t / 100000 * 9;	/* 90 kHz */
+
+		hdr[0] = 0x80;			/* version 2 */
+		hdr[1] = 33;			/* MP2T */
+		hdr[2] = st->seq >> 8;
+		hdr[3] = st->seq;
+		hdr[4] = ts >> 24;
+		hdr[5] = ts >> 16;
+		hdr[6] = ts >> 8;
+		hdr[7] = ts;
+		hdr[8] = st->ssrc >> 24;
+		hdr[9] = st->ssrc >> 16;
+		hdr[10] = st->ssrc >> 8;
+		hdr[11] = st->ssrc;
+		st->seq++;
+
+		iov->iov_base = hdr;
+		iov->iov_len = 12;
+		iov++;
+		msg->msg_hdr.msg_iovlen++;
+	}
+	iov->iov_base = p;
+	iov->iov_len = STREAM_PKTS * 188;
+	msg->msg_hdr.msg_iovlen++;
+	st->n_msg++;
+
+	stream_pcr(st, p);
+	st->pos += STREAM_PKTS * 188;
+	return 0;
+}
+
+static void stream_to_udp(struct dvb_open_descriptor *in_fd,
+			  struct stream_state *st, int timeout, int silent)
+{
+	uint8_t buf[BUFLEN];
+	size_t len = 0, off;
+	int bufsize = 0, measured = 0, first = 1;
+	long long int rc = 0LL;
+	struct timespec start;
+	uint8_t *p;
+	ssize_t r;
+
+	set_dvr_bufsize(in_fd, &bufsize, DVB_BUF_SIZE, silent);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (timeout_flag == 0) {
+		/*
+		 * Reads may not be packet aligned, mostly on remote
+		 * devices. So, whatever didn't fill a datagram is kept
+		 * for the next one.
+		 */
+		r = dvb_dev_read(in_fd, buf + len, sizeof(buf) - len);
+		if (r < 0) {
+			if (r == -EOVERFLOW) {
+				dvr_overrun(in_fd, &bufsize, &start, rc, silent);
+				st->have_clock = 0;
+				continue;
+			}
+			ERROR("Read failed");
+			break;
+		}
+		if (!r)
+			break;
+
+		/* See copy_to_file() */
+		if (first) {
+			if (timeout > 0)
+				alarm(timeout);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			first = 0;
+		}
+		rc += r;
+		len += r;
+		adjust_dvr_bufsize(in_fd, &bufsize, &measured, &start, rc,
+				   silent);
+
+		/* Re-sync, if needed */
+		if (buf[0] != 0x47) {
+			p = memchr(buf, 0x47, len);
+			off = p ? p - buf : len;
+			memmove(buf, buf + off, len - off);
+			len -= off;
+		}
+
+		for (off = 0; off + STREAM_PKTS * 188 <= len;
+		     off += STREAM_PKTS * 188)
+			if (stream_put(st, buf + off) < 0)
+				goto out;
+
+		/* The queued datagrams point to buf */
+		if (stream_flush(st) < 0)
+			break;
+
+		memmove(buf, buf + off, len - off);
+		len -= off;
+	}
+out:
+	if (silent < 2)
+		fprintf(stderr, _("received %lld bytes, sent %llu datagrams\n"),
+			rc, st->sent);
+}
+
+/*
+ * Multi-service recording: the whole MPEG-TS is read once from the DVR
+ * device and split by a software demux. Each file gets the elementary
+ * streams of its service, the SDT, the PMT sections of the service and
+ * a PAT rebuilt to list only that service.
+ */
+struct rec_service {
+	const char *channel, *filename;
+	struct dvb_v5_fe_parms *parms;
+	int fd, error;
+	uint16_t service_id;
+
+	/* PMT PID with a filter, and the one found on the last PAT */
+	int pmt_pid, new_pmt_pid;
+
+	/* PIDs with a filter, and the ones found on the last PMT */
+	uint16_t pids[MAX_SERVICE_PIDS], new_pids[MAX_SERVICE_PIDS];
+	unsigned n_pids, n_new_pids, pids_changed;
+
+	uint8_t pat_cc, pmt_cc;
+	uint8_t buf[REC_BUF_LEN];
+	size_t len;
+	long long written;
+};
+
+struct rec_state {
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_ts_demux *dmx;
+	struct rec_service *svc;
+	unsigned n_svc;
+};
+
+static void rec_flush(struct rec_service *s)
+{
+	size_t pos = 0;
+	ssize_t r;
+
+	while (pos < s->len && !s->error) {
+		r = write(s->fd, s->buf + pos, s->len - pos);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			PERROR(_("Write to '%s' failed"), s->filename);
+			s->error = 1;
+			break;
+		}
+		pos += r;
+	}
+	s->written += pos;
+	s->len = 0;
+}
+
+static void rec_put_packet(struct rec_service *s, const uint8_t *pkt)
+{
+	if (s->error)
+		return;
+
+	memcpy(s->buf + s->len, pkt, 188);
+	s->len += 188;
+	if (s->len == sizeof(s->buf))
+		rec_flush(s);
+}
+
+/* Splits a section into TS packets, padding the last one with 0xff */
+static void rec_put_section(struct rec_service *s, uint16_t pid, uint8_t *cc,
+			    const uint8_t *sec, size_t len)
+{
+	uint8_t pkt[188];
+	size_t hdr, n;
+	int first = 1;
+
+	while (len) {
+		pkt[0] = 0x47;
+		pkt[1] = (first ? 0x40 : 0) | (pid >> 8);
+		pkt[2] = pid & 0xff;
+		pkt[3] = 0x10 | (*cc & 0x0f);
+		*cc = (*cc + 1) & 0x0f;
+		hdr = 4;
+		if (first)
+			pkt[hdr++] = 0;	/* pointer_field */
+
+		n = len < sizeof(pkt) - hdr ? len : sizeof(pkt) - hdr;
+		memcpy(pkt + hdr, sec, n);
+		memset(pkt + hdr + n, 0xff, sizeof(pkt) - hdr - n);
+		rec_put_packet(s, pkt);
+
+		sec += n;
+		len -= n;
+		first = 0;
+	}
+}
+
+static void rec_es(void *priv, uint16_t pid, const uint8_t *buf, size_t len)
+{
+	rec_put_packet(priv, buf);
+}
+
+static void rec_pat(void *priv, uint16_t pid, const uint8_t *buf, size_t len)
+{
+	struct rec_state *st = priv;
+	struct dvb_table_pat *pat = NULL;
+	struct rec_service *s;
+	uint8_t sec[16];
+	uint32_t crc;
+	unsigned i;
+
+	if (buf[0] != DVB_TABLE_PAT)
+		return;
+	dvb_table_pat_init(st->parms, buf, len, &pat);
+	if (!pat)
+		return;
+	if (!pat->header.current_next) {
+		dvb_table_pat_free(pat);
+		return;
+	}
+
+	for (i = 0; i < st->n_svc; i++) {
+		s = &st->svc[i];
+
+		dvb_pat_program_foreach(program, pat) {
+			if (program->service_id == s->service_id) {
+				s->new_pmt_pid = program->pid;
+				break;
+			}
+		}
+		if (s->new_pmt_pid < 0)
+			continue;
+
+		/* A single program PAT, with the same TS ID and version */
+		sec[0] = DVB_TABLE_PAT;
+		sec[1] = 0xb0;
+		sec[2] = sizeof(sec) - 3;
+		sec[3] = pat->header.id >> 8;
+		sec[4] = pat->header.id & 0xff;
+		sec[5] = 0xc1 | (pat->header.version << 1);
+		sec[6] = 0;
+		sec[7] = 0;
+		sec[8] = s->service_id >> 8;
+		sec[9] = s->service_id & 0xff;
+		sec[10] = 0xe0 | (s->new_pmt_pid >> 8);
+		sec[11] = s->new_pmt_pid & 0xff;
+		crc = dvb_crc32(sec, sizeof(sec) - 4, 0xffffffff);
+		sec[12] = crc >> 24;
+		sec[13] = crc >> 16;
+		sec[14] = crc >> 8;
+		sec[15] = crc;
+
+		rec_put_section(s, 0, &s->pat_cc, sec, sizeof(sec));
+	}
+	dvb_table_pat_free(pat);
+}
+
+static void rec_add_pid(struct rec_service *s, uint16_t pid)
+{
+	unsigned i;
+
+	if (pid >= 0x1fff)
+		return;
+	for (i = 0; i < s->n_new_pids; i++)
+		if (s->new_pids[i] == pid)
+			return;
+	if (s->n_new_pids < MAX_SERVICE_PIDS)
+		s->new_pids[s->n_new_pids++] = pid;
+}
+
+static void rec_pmt(void *priv, uint16_t pid, const uint8_t *buf, size_t len)
+{
+	struct rec_service *s = priv;
+	struct dvb_table_pmt *pmt = NULL;
+
+	/* The PMT PID may be shared with other services */
+	if (buf[0] != DVB_TABLE_PMT || len < 5 ||
+	    ((buf[3] << 8) | buf[4]) != s->service_id)
+		return;
+
+	dvb_table_pmt_init(s->parms, buf, len, &pmt);
+	if (!pmt)
+		return;
+	if (!pmt->header.current_next) {
+		dvb_table_pmt_free(pmt);
+		return;
+	}
+
+	s->n_new_pids = 0;
+	rec_add_pid(s, pmt->pcr_pid);
+	dvb_pmt_stream_foreach(stream, pmt) {
+		rec_add_pid(s, stream->elementary_pid);
+	}
+	dvb_table_pmt_free(pmt);
+
+	if (s->n_new_pids != s->n_pids ||
+	    memcmp(s->new_pids, s->pids, s->n_pids * sizeof(*s->pids)))
+		s->pids_changed = 1;
+
+	rec_put_section(s, pid, &s->pmt_cc, buf, len);
+}
+
+/*
+ * Filters can't be changed from the demux callbacks. So, apply the
+ * changes found on PAT and PMT after each chunk of data.
+ */
+static int rec_update_filters(struct arguments *args, struct rec_state *st)
+{
+	struct rec_service *s;
+	unsigned i, j;
+	int r;
+
+	for (i = 0; i < st->n_svc; i++) {
+		s = &st->svc[i];
+
+		if (s->new_pmt_pid != s->pmt_pid) {
+			if (s->pmt_pid >= 0)
+				dvb_ts_demux_remove_filter(st->dmx, s->pmt_pid,
+							   rec_pmt, s);
+			s->pmt_pid = s->new_pmt_pid;
+			r = dvb_ts_demux_add_filter(st->dmx, s->pmt_pid,
+						    DVB_TS_FILTER_SECTION,
+						    rec_pmt, s);
+			if (r < 0)
+				return r;
+			if (args->silent < 2)
+				fprintf(stderr, _("%s: pmt pid %d\n"),
+					s->channel, s->pmt_pid);
+		}
+
+		if (!s->pids_changed)
+			continue;
+
+		for (j = 0; j < s->n_pids; j++)
+			dvb_ts_demux_remove_filter(st->dmx, s->pids[j],
+						   rec_es, s);
+		memcpy(s->pids, s->new_pids, s->n_new_pids * sizeof(*s->pids));
+		s->n_pids = s->n_new_pids;
+		s->pids_changed = 0;
+
+		if (args->silent < 2)
+			fprintf(stderr, _("%s: pids"), s->channel);
+		for (j = 0; j < s->n_pids; j++) {
+			r = dvb_ts_demux_add_filter(st->dmx, s->pids[j],
+						    DVB_TS_FILTER_TS, rec_es, s);
+			if (r < 0)
+				return r;
+			if (args->silent < 2)
+				fprintf(stderr, " %d", s->pids[j]);
+		}
+		if (args->silent < 2)
+			fprintf(stderr, "\n");
+	}
+	return 0;
+}
+
+static int record_services(struct arguments *args, struct dvb_device *dvb,
+			   struct dvb_file *dvb_file)
+{
+	struct dvb_open_descriptor *dmx_fd = NULL, *dvr_fd = NULL;
+	struct dvb_ts_demux_stats stats;
+	struct rec_state st = {};
+	struct rec_service *s;
+	struct dvb_file_index *index = NULL;
+	struct dvb_entry *entry;
+	struct timespec start;
+	uint32_t freq = 0, pol = 0, f, p;
+	uint8_t buf[BUFLEN];
+	long long rc = 0LL;
+	int r, first = 1, ret = -1;
+	int bufsize = 0, measured = 0;
+	unsigned i;
+
+	st.parms = dvb->fe_parms;
+	st.n_svc = args->n_services;
+	st.svc = calloc(st.n_svc, sizeof(*st.svc));
+	if (!st.svc)
+		return -1;
+	for (i = 0; i < st.n_svc; i++)
+		st.svc[i].fd = -1;
+
+	/* The properties of the tuned channel, as stored by parse() */
+	dvb_fe_retrieve_parm(st.parms, DTV_FREQUENCY, &freq);
+	dvb_fe_retrieve_parm(st.parms, DTV_POLARIZATION, &pol);
+
+	/* Big channel files would otherwise be walked once per service */
+	index = dvb_file_index_alloc(dvb_file);
+
+	for (i = 0; i < st.n_svc; i++) {
+		s = &st.svc[i];
+		s->channel = args->services[i].channel;
+		s->filename = args->services[i].filename;
+		s->parms = st.parms;
+		s->pmt_pid = -1;
+		s->new_pmt_pid = -1;
+
+		if (index)
+			entry = dvb_file_find_channel(index, s->channel);
+		else
+			entry = find_entry(dvb_file, s->channel);
+		if (!entry) {
+			ERROR("Can't find channel %s", s->channel);
+			goto err;
+		}
+		f = 0;
+		p = 0;
+		dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &f);
+		dvb_retrieve_entry_prop(entry, DTV_POLARIZATION, &p);
+		if (f != freq || p != pol) {
+			ERROR("channel %s is not on the tuned transponder",
+			      s->channel);
+			goto err;
+		}
+		if (!entry->service_id) {
+			ERROR("channel %s doesn't have a service ID",
+			      s->channel);
+			goto err;
+		}
+		s->service_id = entry->service_id;
+
+		s->fd = open(s->filename, O_LARGEFILE | O_WRONLY | O_CREAT | O_TRUNC,
+			     0644);
+		if (s->fd < 0) {
+			PERROR(_("open of '%s' failed"), s->filename);
+			goto err;
+		}
+	}
+	dvb_file_index_free(index);
+	index = NULL;
+
+	st.dmx = dvb_ts_demux_alloc(st.parms);
+	if (!st.dmx)
+		goto err;
+	if (dvb_ts_demux_add_filter(st.dmx, 0, DVB_TS_FILTER_SECTION,
+				    rec_pat, &st) < 0)
+		goto err;
+	/*
+	 * SDT may also be needed in order to play some streams
+	 */
+	for (i = 0; i < st.n_svc; i++) {
+		if (dvb_ts_demux_add_filter(st.dmx, 0x0011, DVB_TS_FILTER_TS,
+					    rec_es, &st.svc[i]) < 0)
+			goto err;
+	}
+
+	dmx_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
+	if (!dmx_fd) {
+		ERROR("failed opening '%s'", args->demux_dev);
+		goto err;
+	}
+	dvb_dev_set_bufsize(dmx_fd, DVB_BUF_SIZE);
+	if (dvb_dev_dmx_set_pesfilter(dmx_fd, 0x2000, DMX_PES_OTHER,
+				      DMX_OUT_TS_TAP, 0) < 0)
+		goto err;
+
+	dvr_fd = dvb_dev_open(dvb, args->dvr_dev, O_RDONLY);
+	if (!dvr_fd) {
+		ERROR("failed opening '%s'", args->dvr_dev);
+		goto err;
+	}
+	set_dvr_bufsize(dvr_fd, &bufsize, DVB_BUF_SIZE, args->silent);
+
+	if (!timeout_flag)
+		fprintf(stderr, _("Record of %d services started\n"), st.n_svc);
 
 	/* Initialize start time, due to -EOVERFLOW with first == 1 */
 	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	while (timeout_flag == 0) {
-		r = dvb_dev_read(in_fd, buf, sizeof(buf));
+		r = dvb_dev_read(dvr_fd, buf, sizeof(buf));
 		if (r < 0) {
 			if (r == -EOVERFLOW) {
-				elapsed = elapsed_time(&start);
-				if (!elapsed)
-					fprintf(stderr, _("buffer overrun at %lld\n"), rc);
-				else
-					fprintf(stderr, _("buffer overrun after %lld.%02ld seconds\n"),
-						(long long)elapsed->tv_sec,
-						elapsed->tv_nsec / 10000000);
+				dvr_overrun(dvr_fd, &bufsize, &start, rc,
+					    args->silent);
 				continue;
 			}
 			ERROR("Read failed");
 			break;
 		}
 
-		/*
-		 * It takes a while for a DVB device to start streaming, as the
-		 * hardware may be waiting for some locks. The safest way to
-		 * ensure that a program record will have the start amount of
-		 * time specified by the user is to restart the timeout alarm
-		 * here, after the first succeded read.
-		 *
-		 * So, let's reset the start time here.
-		 */
+		/* See copy_to_file() */
 		if (first) {
-			if (timeout > 0)
-				alarm(timeout);
+			if (args->timeout > 0)
+				alarm(args->timeout);
 
 			clock_gettime(CLOCK_MONOTONIC, &start);
 			first = 0;
 		}
 
-		if (write(out_fd, buf, r) < 0) {
-			PERROR(_("Write failed"));
+		dvb_ts_demux_feed(st.dmx, buf, r);
+		rc += r;
+		adjust_dvr_bufsize(dvr_fd, &bufsize, &measured, &start, rc,
+				   args->silent);
+
+		if (rec_update_filters(args, &st) < 0) {
+			ERROR("failed to add a demux filter");
 			break;
 		}
+		for (i = 0; i < st.n_svc; i++)
+			if (st.svc[i].error)
+				break;
+		if (i < st.n_svc)
+			break;
+	}
 
-		rc += r;
+	for (i = 0; i < st.n_svc; i++)
+		rec_flush(&st.svc[i]);
+
+	if (args->silent < 2) {
+		fprintf(stderr, _("received %lld bytes\n"), rc);
+		for (i = 0; i < st.n_svc; i++) {
+			s = &st.svc[i];
+			if (s->pmt_pid < 0)
+				fprintf(stderr, _("%s: service %d not found on PAT\n"),
+					s->channel, s->service_id);
+			fprintf(stderr, _("%s: wrote %lld bytes to '%s'\n"),
+				s->channel, s->written, s->filename);
+		}
+		dvb_ts_demux_get_stats(st.dmx, &stats);
+		if (stats.sync_losses || stats.tei_errors || stats.cc_errors)
+			fprintf(stderr, _("%lu sync losses, %lu transport errors, %lu discontinuities\n"),
+				stats.sync_losses, stats.tei_errors,
+				stats.cc_errors);
 	}
-	if (silent < 2) {
-		if (timeout)
-			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
-				rc / (1024 * timeout));
-		else
-			fprintf(stderr, _("received %lld bytes\n"), rc);
+
+	ret = 0;
+	for (i = 0; i < st.n_svc; i++)
+		if (st.svc[i].error)
+			ret = -1;
+err:
+	if (dvr_fd)
+		dvb_dev_close(dvr_fd);
+	if (dmx_fd)
+		dvb_dev_close(dmx_fd);
+	if (st.dmx)
+		dvb_ts_demux_free(st.dmx);
+	dvb_file_index_free(index);
+	for (i = 0; i < st.n_svc; i++)
+		if (st.svc[i].fd >= 0)
+			close(st.svc[i].fd);
+	free(st.svc);
+	return ret;
+}
+
+static int parse_service(struct arguments *args, char *optarg)
+{
+	struct record_service *svc;
+	char *p = strrchr(optarg, '=');
+
+	if (!p || p == optarg || !p[1]) {
+		ERROR(_("invalid service: %s. It should be channel=file"), optarg);
+		return EINVAL;
+	}
+	if (args->n_services == MAX_SERVICES) {
+		ERROR(_("at most %d services can be recorded"), MAX_SERVICES);
+		return EINVAL;
 	}
+	svc = &args->services[args->n_services++];
+	svc->channel = strndup(optarg, p - optarg);
+	svc->filename = strdup(p + 1);
+	return 0;
 }
 
 static error_t parse_opt(int k, char *optarg, struct argp_state *state)
@@ -639,6 +1862,8 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'p':
 		args->rec_psi = 1;
 		break;
+	case 'R':
+		return parse_service(args, optarg);
 	case 'x':
 		args->exit_after_tuning = 1;
 		break;
@@ -695,6 +1920,9 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'm':
 		args->traffic_monitor = 1;
 		break;
+	case 'M':
+		args->metrics = strdup(optarg);
+		break;
 	case 'N':
 		args->non_human = 1;
 		break;
@@ -716,6 +1944,25 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'D':
 		args->dvr_pipe = strdup(optarg);
 		break;
+	case 'u':
+		args->stream = strdup(optarg);
+		args->dvr = 1;
+		break;
+	case -5:
+		args->ttl = atoi(optarg);
+		break;
+	case -6:
+		args->rt_prio = optarg ? atoi(optarg) : RT_DEFAULT_PRIO;
+		break;
+	case -7:
+		args->rt_cpu = atoi(optarg);
+		break;
+	case -8:
+		args->rt_spin = strtoul(optarg, NULL, 0);
+		break;
+	case 'K':
+		args->cache = strdup(optarg);
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -760,27 +2007,587 @@ static char *print_bytes(float val)
 	return buf;
 }
 
+/*
+ * Monitor mode statistics: traffic and continuity errors per PID, PCR
+ * interval and jitter, and the ETSI TR 101 290 priority 1 indicators.
+ * All of them are updated in a single pass over each packet header, and
+ * only the PAT and PMT packets are handed to the software demux.
+ */
+
+/* Time limits, in ms, from ETSI TR 101 290 */
+#define TSMON_PSI_INTERVAL	500	/* PAT and PMT repetition */
+#define TSMON_PID_INTERVAL	5000	/* PIDs referred at the PMT */
+#define TSMON_PCR_INTERVAL	40
+
+/* Consecutive sync bytes needed to lose and to acquire the sync */
+#define TSMON_SYNC_LOST		2
+#define TSMON_SYNC_ACQUIRED	5
+
+/*
+ * Don't check continuity nor tables during the first second, as the
+ * frontend is still starting streaming. After it, timeouts are checked
+ * every TSMON_CHECK_MS.
+ */
+#define TSMON_WARMUP_MS		1000
+#define TSMON_CHECK_MS		100
+
+enum tsmon_pid_flags {
+	TSMON_PMT		= 1 << 0,	/* has a PMT section filter */
+	TSMON_NEW_PMT		= 1 << 1,	/* announced at the last PAT */
+	TSMON_REFERRED		= 1 << 2,	/* announced at a PMT */
+};
+
+struct tsmon_pid {
+	unsigned long long packets, cc_errors;
+	signed char cc;
+	uint8_t dup, flags;
+
+	/* Last packet, last PMT section, and last PMT referring to it */
+	unsigned long long last_ms, psi_ms, ref_ms;
+
+	/* Last PCR, and the TS packet number where it was */
+	unsigned long long pcr, pcr_pkt;
+	unsigned pcr_count;
+	double pcr_ticks_per_pkt;
+
+	/* Maximum PCR interval and jitter since the last report, in ticks */
+	unsigned long long pcr_max_interval, pcr_max_jitter;
+};
+
+struct tsmon {
+	struct arguments *args;
+	struct dvb_v5_fe_parms *parms;
+	struct dvb_ts_demux *dmx;
+
+	unsigned long long now_ms, check_ms, pat_ms;
+	unsigned long long packets, counted;
+	int synced, pat_changed;
+	unsigned good_run, bad_run;
+	uint32_t pat_crc;
+
+	/* TR 101 290 priority 1 */
+	unsigned long long sync_losses, sync_byte_errors, pat_errors;
+	unsigned long long cc_errors, pmt_errors, pid_errors;
+
+	/* TR 101 290 priority 2 */
+	unsigned long long transport_errors, pcr_repetition_errors;
+	unsigned long long pcr_discontinuities;
+
+	struct tsmon_pid pid[0x2000];
+};
+
+static void tsmon_pat(void *priv, uint16_t pid, const uint8_t *buf, size_t len)
+{
+	struct tsmon *m = priv;
+	struct dvb_table_pat *pat = NULL;
+	uint32_t crc;
+	unsigned i;
+
+	if (buf[0] != DVB_TABLE_PAT) {
+		m->pat_errors++;
+		return;
+	}
+	m->pat_ms = m->now_ms;
+
+	/* The PAT is repeated several times per second */
+	crc = buf[len - 4] << 24 | buf[len - 3] << 16 | buf[len - 2] << 8 |
+	      buf[len - 1];
+	if (crc == m->pat_crc)
+		return;
+	m->pat_crc = crc;
+
+	dvb_table_pat_init(m->parms, buf, len, &pat);
+	if (!pat)
+		return;
+	if (pat->header.current_next) {
+		if (!pat->header.section_id)
+			for (i = 0; i < 0x2000; i++)
+				m->pid[i].flags &= ~TSMON_NEW_PMT;
+		dvb_pat_program_foreach(program, pat) {
+			/* Program 0 is the NIT */
+			if (program->service_id)
+				m->pid[program->pid].flags |= TSMON_NEW_PMT;
+		}
+		m->pat_changed = 1;
+	}
+	dvb_table_pat_free(pat);
+}
+
+static void tsmon_refer(struct tsmon *m, uint16_t pid)
+{
+	struct tsmon_pid *s = &m->pid[pid];
+
+	if (pid >= 0x1fff)
+		return;
+
+	/* A PID that was never seen has its timeout counted from now */
+	if (!(s->flags & TSMON_REFERRED) && !s->last_ms)
+		s->last_ms = m->now_ms;
+	s->flags |= TSMON_REFERRED;
+	s->ref_ms = m->now_ms;
+}
+
+static void tsmon_pmt(void *priv, uint16_t pid, const uint8_t *buf, size_t len)
+{
+	struct tsmon *m = priv;
+	struct dvb_table_pmt *pmt = NULL;
+
+	if (buf[0] != DVB_TABLE_PMT)
+		return;
+	m->pid[pid].psi_ms = m->now_ms;
+
+	dvb_table_pmt_init(m->parms, buf, len, &pmt);
+	if (!pmt)
+		return;
+	tsmon_refer(m, pmt->pcr_pid);
+	dvb_pmt_stream_foreach(stream, pmt) {
+		tsmon_refer(m, stream->elementary_pid);
+	}
+	dvb_table_pmt_free(pmt);
+}
+
+static struct tsmon *tsmon_alloc(struct arguments *args,
+				 struct dvb_v5_fe_parms *parms)
+{
+	struct tsmon *m;
+	unsigned i;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->args = args;
+	m->parms = parms;
+	for (i = 0; i < 0x2000; i++)
+		m->pid[i].cc = -1;
+
+	m->dmx = dvb_ts_demux_alloc(parms);
+	if (!m->dmx ||
+	    dvb_ts_demux_add_filter(m->dmx, 0, DVB_TS_FILTER_SECTION,
+				    tsmon_pat, m) < 0) {
+		if (m->dmx)
+			dvb_ts_demux_free(m->dmx);
+		free(m);
+		return NULL;
+	}
+	return m;
+}
+
+static void tsmon_free(struct tsmon *m)
+{
+	dvb_ts_demux_free(m->dmx);
+	free(m);
+}
+
+/* Filters can't be changed from the demux callbacks */
+static void tsmon_update_filters(struct tsmon *m)
+{
+	struct tsmon_pid *s;
+	unsigned pid;
+
+	if (!m->pat_changed)
+		return;
+	m->pat_changed = 0;
+
+	for (pid = 0; pid < 0x2000; pid++) {
+		s = &m->pid[pid];
+		if ((s->flags & TSMON_NEW_PMT) && !(s->flags & TSMON_PMT)) {
+			if (dvb_ts_demux_add_filter(m->dmx, pid,
+						    DVB_TS_FILTER_SECTION,
+						    tsmon_pmt, m) < 0)
+				continue;
+			s->flags |= TSMON_PMT;
+			s->psi_ms = m->now_ms;
+		} else if (!(s->flags & TSMON_NEW_PMT) &&
+			   (s->flags & TSMON_PMT)) {
+			dvb_ts_demux_remove_filter(m->dmx, pid, tsmon_pmt, m);
+			s->flags &= ~TSMON_PMT;
+		}
+	}
+}
+
+static void tsmon_reset_pcr(struct tsmon *m)
+{
+	unsigned pid;
+
+	for (pid = 0; pid < 0x2000; pid++)
+		m->pid[pid].pcr_count = 0;
+}
+
+static void tsmon_pcr(struct tsmon *m, struct tsmon_pid *s,
+		      const uint8_t *p, int discontinued)
+{
+	unsigned long long pcr, delta, pkts;
+	double jitter, rate;
+
+	pcr = ((unsigned long long)p[6] << 25 | p[7] << 17 | p[8] << 9 |
+	       p[9] << 1 | p[10] >> 7) * 300 + ((p[10] & 1) << 8 | p[11]);
+
+	if (discontinued)
+		s->pcr_count = 0;
+
+	if (s->pcr_count) {
+		/* A PCR going backwards looks like a too big interval */
+		delta = (pcr + PCR_WRAP - s->pcr) % PCR_WRAP;
+		pkts = m->packets - s->pcr_pkt;
+
+		if (delta > PCR_DISCONTINUITY_MS * PCR_TICKS_PER_MS) {
+			m->pcr_discontinuities++;
+			s->pcr_count = 0;
+		} else {
+			if (delta > TSMON_PCR_INTERVAL * PCR_TICKS_PER_MS)
+				m->pcr_repetition_errors++;
+			if (delta > s->pcr_max_interval)
+				s->pcr_max_interval = delta;
+
+			/*
+			 * The TS has a constant bitrate, so the PCR should
+			 * grow linearly with the packet position. Its jitter
+			 * is the difference from the average PCR rate.
+			 */
+			rate = (double)delta / pkts;
+			if (s->pcr_count > 1) {
+				jitter = delta - pkts * s->pcr_ticks_per_pkt;
+				if (jitter < 0)
+					jitter = -jitter;
+				if (jitter > s->pcr_max_jitter)
+					s->pcr_max_jitter = jitter;
+				s->pcr_ticks_per_pkt += (rate - s->pcr_ticks_per_pkt) / 16;
+			} else {
+				s->pcr_ticks_per_pkt = rate;
+			}
+		}
+	}
+
+	s->pcr = pcr;
+	s->pcr_pkt = m->packets;
+	if (s->pcr_count < 2)
+		s->pcr_count++;
+}
+
+static void tsmon_packet(struct tsmon *m, const uint8_t *p)
+{
+	struct arguments *args = m->args;
+	struct tsmon_pid *s;
+	unsigned pid, afc, cc, af_len = 0, next;
+	int i, discontinued = 0, error = 0, ok = 1;
+
+	/* Counts all packets, as the PCR jitter depends on their positions */
+	m->packets++;
+
+	if (p[0] != 0x47) {
+		m->sync_byte_errors++;
+		m->good_run = 0;
+		if (m->synced && ++m->bad_run >= TSMON_SYNC_LOST) {
+			monitor_log(_("%.2fs: sync lost\n"));
+			m->synced = 0;
+			m->sync_losses++;
+		}
+		return;
+	}
+	m->bad_run = 0;
+	if (!m->synced && ++m->good_run >= TSMON_SYNC_ACQUIRED)
+		m->synced = 1;
+
+	pid = (p[1] & 0x1f) << 8 | p[2];
+	afc = (p[3] >> 4) & 3;
+	cc = p[3] & 0x0f;
+	s = &m->pid[pid];
+	s->last_ms = m->now_ms;
+
+	if (p[1] & 0x80)
+		m->transport_errors++;
+
+	/* PAT and PMT can't be scrambled */
+	if (p[3] & 0xc0) {
+		if (!pid)
+			m->pat_errors++;
+		else if (s->flags & TSMON_PMT)
+			m->pmt_errors++;
+	}
+
+	if (afc & 2) {
+		af_len = p[4];
+		if (af_len >= 1 && af_len <= 183)
+			discontinued = p[5] & 0x80;
+		else if (afc == 3)
+			monitor_log(_("%.2fs: pid %d has adaption layer, but size is too small!\n"),
+				    pid);
+	}
+
+	/*
+	 * According to ITU-T H.222.0 | ISO/IEC 13818-1, the continuity
+	 * counter is only incremented on packets with payload, and a packet
+	 * may be sent twice.
+	 */
+	if (pid < 0x1fff && afc & 1) {
+		if (m->now_ms < TSMON_WARMUP_MS)
+			discontinued = 1;
+
+		if (!discontinued && s->cc >= 0) {
+			next = (s->cc + 1) % 16;
+			if (cc == (unsigned)s->cc && !s->dup) {
+				s->dup = 1;
+			} else if (cc != next) {
+				monitor_log(_("%.2fs: pid %d, expecting %d received %d\n"),
+					    pid, next, cc);
+				error = 1;
+				m->cc_errors++;
+				s->cc_errors++;
+			} else {
+				s->dup = 0;
+			}
+		}
+		if (discontinued || error) {
+			s->cc = -1;
+			s->dup = 0;
+		} else {
+			s->cc = cc;
+		}
+	}
+
+	if ((afc & 2) && af_len >= 7 && af_len <= 183 && (p[5] & 0x10))
+		tsmon_pcr(m, s, p, discontinued);
+
+	if (!pid || s->flags & TSMON_PMT)
+		dvb_ts_demux_feed(m->dmx, p, 188);
+
+	if (args->search) {
+		int sl = strlen(args->search);
+
+		ok = 0;
+		if (pid != 0x1fff) {
+			for (i = 0; i < (188 - sl); ++i) {
+				if (!memcmp(p + i, args->search, sl))
+					ok = 1;
+			}
+		}
+	}
+
+	if (ok) {
+		s->packets++;
+		m->counted++;
+	}
+}
+
+/* Checks the PAT, PMT and PID timeouts, counting each one once per period */
+static void tsmon_check(struct tsmon *m)
+{
+	struct tsmon_pid *s;
+	unsigned pid;
+
+	tsmon_update_filters(m);
+
+	if (m->now_ms < TSMON_WARMUP_MS) {
+		m->pat_ms = m->now_ms;
+		return;
+	}
+	if (m->now_ms < m->check_ms + TSMON_CHECK_MS)
+		return;
+	m->check_ms = m->now_ms;
+
+	if (m->now_ms - m->pat_ms > TSMON_PSI_INTERVAL) {
+		m->pat_errors++;
+		m->pat_ms = m->now_ms;
+	}
+
+	for (pid = 0; pid < 0x2000; pid++) {
+		s = &m->pid[pid];
+		if (!s->flags)
+			continue;
+
+		if ((s->flags & TSMON_PMT) &&
+		    m->now_ms - s->psi_ms > TSMON_PSI_INTERVAL) {
+			m->pmt_errors++;
+			s->psi_ms = m->now_ms;
+		}
+
+		/* Only PIDs still listed at the PMT are checked */
+		if ((s->flags & TSMON_REFERRED) &&
+		    m->now_ms - s->ref_ms < TSMON_PID_INTERVAL &&
+		    m->now_ms - s->last_ms > TSMON_PID_INTERVAL) {
+			monitor_log(_("%.2fs: pid %d is missing\n"), pid);
+			m->pid_errors++;
+			s->last_ms = m->now_ms;
+		}
+	}
+}
+
+static void tsmon_print(struct tsmon *m, unsigned long long diff)
+{
+	struct arguments *args = m->args;
+	unsigned long long other_pidt = 0, other_err_cnt = 0;
+	struct tsmon_pid *s;
+	int pid;
+
+	if (isatty(STDOUT_FILENO))
+		printf("\x1b[1H\x1b[2J");
+
+	args->n_status_lines = 0;
+	printf(_(" PID           FREQ         SPEED       TOTAL\n"));
+	for (pid = 0; pid < 0x2000; pid++) {
+		s = &m->pid[pid];
+		if (!s->packets)
+			continue;
+		if (args->low_traffic && (s->packets * 1000. / diff) < args->low_traffic) {
+			other_pidt += s->packets;
+			other_err_cnt += s->cc_errors;
+			continue;
+		}
+		printf("%5d %9.2f p/s %sbps ",
+			pid,
+			s->packets * 1000. / diff,
+			print_bytes(s->packets * 1000. * 8 * 188/ diff));
+		if (s->packets * 188 / 1024)
+			printf("%8llu KB", (s->packets * 188 + 512) / 1024);
+		else
+			printf(" %8llu B", s->packets * 188);
+		if (s->cc_errors > 0)
+			printf(" %8llu continuity errors", s->cc_errors);
+		if (s->pcr_max_interval)
+			printf(" PCR %5.1f ms, jitter %7.1f us",
+			       s->pcr_max_interval * 1. / PCR_TICKS_PER_MS,
+			       s->pcr_max_jitter * 1000. / PCR_TICKS_PER_MS);
+
+		printf("\n");
+	}
+	if (other_pidt) {
+		printf(_("OTHER"));
+		printf(" %9.2f p/s %sbps ",
+			other_pidt * 1000. / diff,
+			print_bytes(other_pidt * 1000. * 8 * 188/ diff));
+		if (other_pidt * 188 / 1024)
+			printf("%8llu KB", (other_pidt * 188 + 512) / 1024);
+		else
+			printf(" %8llu B", other_pidt * 188);
+		if (other_err_cnt > 0)
+			printf(" %8llu continuity errors",
+			       other_err_cnt);
+		printf("\n");
+	}
+
+	printf("TOT %11.2f p/s %sbps %8llu KB\n",
+		m->counted * 1000. / diff,
+		print_bytes(m->counted * 1000. * 8 * 188/ diff),
+		(m->counted * 188 + 512) / 1024);
+	printf("\n");
+	get_show_stats(stdout, args, m->parms, 0);
+
+	printf(_("TR 101 290 errors: sync loss %llu, sync byte %llu, PAT %llu, CONTINUITY %llu, PMT %llu, PID %llu\n"),
+	       m->sync_losses, m->sync_byte_errors, m->pat_errors,
+	       m->cc_errors, m->pmt_errors, m->pid_errors);
+	if (m->transport_errors || m->pcr_repetition_errors ||
+	    m->pcr_discontinuities)
+		printf(_("                   transport %llu, PCR repetition %llu, PCR discontinuity %llu\n"),
+		       m->transport_errors, m->pcr_repetition_errors,
+		       m->pcr_discontinuities);
+}
+
+/*
+ * Writes the counters in the Prometheus text format. The file is replaced
+ * atomically, so it can be read at any time, for example by the textfile
+ * collector of the node exporter.
+ */
+static void tsmon_export(struct tsmon *m)
+{
+	struct arguments *args = m->args;
+	const struct {
+		const char *name, *help;
+		unsigned long long val;
+	} counter[] = {
+		{ "sync_loss", "TS sync losses", m->sync_losses },
+		{ "sync_byte_errors", "packets with a wrong sync byte", m->sync_byte_errors },
+		{ "pat_errors", "missing, wrong or scrambled PAT", m->pat_errors },
+		{ "cc_errors", "continuity counter errors", m->cc_errors },
+		{ "pmt_errors", "missing or scrambled PMT", m->pmt_errors },
+		{ "pid_errors", "PIDs referred at the PMT that are missing", m->pid_errors },
+		{ "transport_errors", "packets with the transport error indicator", m->transport_errors },
+		{ "pcr_repetition_errors", "PCR intervals longer than 40 ms", m->pcr_repetition_errors },
+		{ "pcr_discontinuity_errors", "PCR discontinuities not signaled", m->pcr_discontinuities },
+	};
+	struct tsmon_pid *s;
+	char *tmp;
+	unsigned i;
+	FILE *fp;
+
+	if (asprintf(&tmp, "%s.tmp", args->metrics) < 0)
+		return;
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		PERROR(_("open of '%s' failed"), tmp);
+		free(tmp);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(counter); i++) {
+		fprintf(fp, "# HELP dvb_ts_%s_total %s\n", counter[i].name,
+			counter[i].help);
+		fprintf(fp, "# TYPE dvb_ts_%s_total counter\n", counter[i].name);
+		fprintf(fp, "dvb_ts_%s_total{adapter=\"%u\",frontend=\"%u\"} %llu\n",
+			counter[i].name, args->adapter, args->frontend,
+			counter[i].val);
+	}
+
+	fprintf(fp, "# HELP dvb_ts_packets_total MPEG-TS packets per PID\n");
+	fprintf(fp, "# TYPE dvb_ts_packets_total counter\n");
+	for (i = 0; i < 0x2000; i++)
+		if (m->pid[i].packets)
+			fprintf(fp, "dvb_ts_packets_total{adapter=\"%u\",frontend=\"%u\",pid=\"%u\"} %llu\n",
+				args->adapter, args->frontend, i,
+				m->pid[i].packets);
+
+	fprintf(fp, "# HELP dvb_ts_pid_cc_errors_total continuity counter errors per PID\n");
+	fprintf(fp, "# TYPE dvb_ts_pid_cc_errors_total counter\n");
+	for (i = 0; i < 0x2000; i++)
+		if (m->pid[i].packets)
+			fprintf(fp, "dvb_ts_pid_cc_errors_total{adapter=\"%u\",frontend=\"%u\",pid=\"%u\"} %llu\n",
+				args->adapter, args->frontend, i,
+				m->pid[i].cc_errors);
+
+	fprintf(fp, "# HELP dvb_ts_pcr_interval_seconds longest PCR interval since the last update\n");
+	fprintf(fp, "# TYPE dvb_ts_pcr_interval_seconds gauge\n");
+	fprintf(fp, "# HELP dvb_ts_pcr_jitter_seconds largest PCR jitter since the last update\n");
+	fprintf(fp, "# TYPE dvb_ts_pcr_jitter_seconds gauge\n");
+	for (i = 0; i < 0x2000; i++) {
+		s = &m->pid[i];
+		if (!s->pcr_max_interval)
+			continue;
+		fprintf(fp, "dvb_ts_pcr_interval_seconds{adapter=\"%u\",frontend=\"%u\",pid=\"%u\"} %.6f\n",
+			args->adapter, args->frontend, i,
+			s->pcr_max_interval / (PCR_TICKS_PER_MS * 1000.));
+		fprintf(fp, "dvb_ts_pcr_jitter_seconds{adapter=\"%u\",frontend=\"%u\",pid=\"%u\"} %.9f\n",
+			args->adapter, args->frontend, i,
+			s->pcr_max_jitter / (PCR_TICKS_PER_MS * 1000.));
+	}
+
+	if (fclose(fp))
+		PERROR(_("write to '%s' failed"), tmp);
+	else if (rename(tmp, args->metrics))
+		PERROR(_("rename of '%s' failed"), tmp);
+	free(tmp);
+}
+
 int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 		       int out_fd, int timeout)
 {
 	struct dvb_open_descriptor *fd, *dvr_fd;
 	struct timespec startt;
 	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	unsigned long long pidt[0x2001], wait, cont_err = 0;
-	unsigned long long err_cnt[0x2000];
-	signed char pid_cont[0x2000];
+	unsigned long long wait;
+	struct tsmon *m;
 	int i, first = 1;
 
-	memset(pidt, 0, sizeof(pidt));
-	memset(err_cnt, 0, sizeof(err_cnt));
-	memset(pid_cont, 0, sizeof(pid_cont));
+	m = tsmon_alloc(args, parms);
+	if (!m)
+		return -1;
 
 	args->exit_after_tuning = 1;
 	check_frontend(args, parms);
 
 	dvr_fd = dvb_dev_open(dvb, args->dvr_dev, O_RDONLY);
-	if (!dvr_fd)
+	if (!dvr_fd) {
+		tsmon_free(m);
 		return -1;
+	}
 
 	fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), DVB_BUF_SIZE);
 	dvb_dev_set_bufsize(dvr_fd, DVB_BUF_SIZE);
@@ -788,6 +2595,7 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
 	if (!fd) {
 		dvb_dev_close(dvr_fd);
+		tsmon_free(m);
 		return -1;
 	}
 
@@ -797,12 +2605,16 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 				      DMX_OUT_TS_TAP, 0) < 0) {
 		dvb_dev_close(dvr_fd);
 		dvb_dev_close(fd);
+		tsmon_free(m);
 		return -1;
 	}
 
 	if (clock_gettime(CLOCK_MONOTONIC, &startt)) {
 		fprintf(stderr, _("Can't get timespec\n"));
-                return -1;
+		dvb_dev_close(dvr_fd);
+		dvb_dev_close(fd);
+		tsmon_free(m);
+		return -1;
 	}
 
 	wait = 1000;
@@ -811,7 +2623,7 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	while (1) {
 		struct timespec *elapsed;
 		unsigned char buffer[BUFLEN];
-		int pid, ok, diff;
+		unsigned long long diff;
 		ssize_t r;
 
 		if (timeout_flag)
@@ -820,6 +2632,8 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 		if ((r = dvb_dev_read(dvr_fd, buffer, BUFLEN)) <= 0) {
 			if (r == -EOVERFLOW) {
 				monitor_log(_("%.2fs: buffer overrun\n"));
+				/* Packets were lost, so the PCR positions are wrong */
+				tsmon_reset_pcr(m);
 				continue;
 			}
 			monitor_log(_("%.2fs: read() returned error %zd\n"), r);
@@ -849,166 +2663,33 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 			break;
 		}
 
-		for (i = 0; i < BUFLEN; i += 188) {
-			struct dvb_ts_packet_header *h = (void *)&buffer[i];
-			if (h->sync_byte != 0x47) {
-				monitor_log(_("%.2fs: invalid sync byte. Discarding %zd bytes\n"), r);
-				continue;
-			}
-
-			bswap16(h->bitfield);
-
-#if 0
-			/*
-			 * ITU-T Rec. H.222.0 decoders shall discard Transport
-			 * Stream packets with the adaptation_field_control
-			 * field set to a value of '00' (invalid). Packets with
-			 * a value of '01' are NULL packets. Yet, as those are
-			 * actually part of the stream, we won't be discarding,
-			 * as we want to take them into account for traffic
-			 * estimation purposes.
-			 */
-			if (h->adaptation_field_control == 0)
-				continue;
-#endif
-			ok = 1;
-			pid = h->pid;
-
-			if (pid > 0x1fff) {
-				monitor_log(_("%.2fs: invalid pid: 0x%04x\n"),
-					    pid);
-				pid = 0x1fff;
-			}
-
-			/*
-			 * After 1 second of processing, check if are there
-			 * any issues with regards to frame continuity for
-			 * non-NULL packets.
-			 *
-			 * According to ITU-T H.222.0 | ISO/IEC 13818-1, the
-			 * continuity counter isn't incremented if the packet
-			 * is 00 or 10. It is only incremented on odd values.
-			 *
-			 * Also, don't check continuity errors on the first
-			 * second, as the frontend is still starting streaming
-			 */
-			if (pid < 0x1fff && h->adaptation_field_control & 1) {
-				int discontinued = 0;
-
-				if (h->adaptation_field_control & 2) {
-					if (h->adaptation_field_length >= 1) {
-						discontinued = h->discontinued;
-					} else {
-						monitor_log(_("%.2fs: pid %d has adaption layer, but size is too small!\n"),
-							    pid);
-					}
-				}
-
-				if (wait < 2000)
-					discontinued = 1;
-
-				if (!discontinued && pid_cont[pid] >= 0) {
-					unsigned int next = (pid_cont[pid] + 1) % 16;
-					if (next != h->continuity_counter) {
-						monitor_log(_("%.2fs: pid %d, expecting %d received %d\n"),
-							    pid, next,
-							    h->continuity_counter);
-						discontinued = 1;
-						cont_err++;
-						err_cnt[pid]++;
-					}
-				}
-				if (discontinued)
-					pid_cont[pid] = -1;
-				else
-					pid_cont[pid] = h->continuity_counter;
-			}
-
-			if (args->search) {
-				int i, sl = strlen(args->search);
-				ok = 0;
-				if (pid != 0x1fff) {
-					for (i = 0; i < (188 - sl); ++i) {
-						if (!memcmp((char *)h + i, args->search, sl))
-							ok = 1;
-					}
-				}
-			}
-
-			if (ok) {
-				pidt[pid]++;
-				pidt[0x2000]++;
-			}
-		}
-
 		elapsed = elapsed_time(&startt);
 		if (!elapsed)
 			diff = wait;
 		else
 			diff = (unsigned long long)elapsed->tv_sec * 1000
 				+ elapsed->tv_nsec * 1000 / NANO_SECONDS_IN_SEC;
+		m->now_ms = diff;
+
+		for (i = 0; i < BUFLEN; i += 188)
+			tsmon_packet(m, &buffer[i]);
+		tsmon_check(m);
 
 		if (diff > wait) {
-			unsigned long long other_pidt = 0, other_err_cnt = 0;
-
-			if (isatty(STDOUT_FILENO))
-				printf("\x1b[1H\x1b[2J");
-
-			args->n_status_lines = 0;
-			printf(_(" PID           FREQ         SPEED       TOTAL\n"));
-			int _pid = 0;
-			for (_pid = 0; _pid < 0x2000; _pid++) {
-				if (pidt[_pid]) {
-					if (args->low_traffic && (pidt[_pid] * 1000. / diff) < args->low_traffic) {
-						other_pidt += pidt[_pid];
-						other_err_cnt += err_cnt[_pid];
-						continue;
-					}
-					printf("%5d %9.2f p/s %sbps ",
-						_pid,
-						pidt[_pid] * 1000. / diff,
-						print_bytes(pidt[_pid] * 1000. * 8 * 188/ diff));
-					if (pidt[_pid] * 188 / 1024)
-						printf("%8llu KB", (pidt[_pid] * 188 + 512) / 1024);
-					else
-						printf(" %8llu B", pidt[_pid] * 188);
-					if (err_cnt[_pid] > 0)
-						printf(" %8llu continuity errors",
-						       err_cnt[_pid]);
-
-					printf("\n");
-				}
+			tsmon_print(m, diff);
+			if (args->metrics)
+				tsmon_export(m);
+			for (i = 0; i < 0x2000; i++) {
+				m->pid[i].pcr_max_interval = 0;
+				m->pid[i].pcr_max_jitter = 0;
 			}
-			if (other_pidt) {
-				printf(_("OTHER"));
-				printf(" %9.2f p/s %sbps ",
-					other_pidt * 1000. / diff,
-					print_bytes(other_pidt * 1000. * 8 * 188/ diff));
-				if (other_pidt * 188 / 1024)
-					printf("%8llu KB", (other_pidt * 188 + 512) / 1024);
-				else
-					printf(" %8llu B", other_pidt * 188);
-				if (other_err_cnt > 0)
-					printf(" %8llu continuity errors",
-					       other_err_cnt);
-				printf("\n");
-			}
-
-			/* 0x2000 is the total traffic */
-			printf("TOT %11.2f p/s %sbps %8llu KB\n",
-				pidt[_pid] * 1000. / diff,
-				print_bytes(pidt[_pid] * 1000. * 8 * 188/ diff),
-				(pidt[_pid] * 188 + 512) / 1024);
-			printf("\n");
-			get_show_stats(stdout, args, parms, 0);
 			wait += 1000;
-			if (cont_err)
-				printf("CONTINUITY errors: %llu\n", cont_err);
 		}
 	}
 	monitor_log(_("%.2fs: Stopping capture\n"));
 	dvb_dev_close(dvr_fd);
 	dvb_dev_close(fd);
+	tsmon_free(m);
 	return 0;
 }
 
@@ -1030,12 +2711,12 @@ int main(int argc, char **argv)
 	char *homedir = getenv("HOME");
 	char *channel = NULL;
 	int lnb = -1, idx = -1;
-	int pmtpid = 0;
+	int pmtpid = 0, cached_pmtpid = 0;
 	struct dvb_file *dvb_file = NULL;
 	const struct dvb_entry *dvb_entry = NULL;
 	struct dvb_open_descriptor *pat_fd = NULL, *pmt_fd = NULL;
 	struct dvb_open_descriptor *sdt_fd = NULL;
-	struct dvb_open_descriptor *sid_fd = NULL, *dvr_fd = NULL;
+	struct dvb_open_descriptor *dvr_fd = NULL;
 	int file_fd = -1;
 	int err = -1;
 	int r, ret;
@@ -1060,6 +2741,8 @@ int main(int argc, char **argv)
 	args.input_format = FILE_DVBV5;
 	args.dvr_pipe = default_dvr_pipe;
 	args.low_traffic = 1;
+	args.rt_cpu = -1;
+	args.rt_spin = RT_SPIN_USEC;
 
 	if (argp_parse(&argp, argc, argv, ARGP_NO_HELP | ARGP_NO_EXIT, &idx, &args)) {
 		argp_help(&argp, stderr, ARGP_HELP_SHORT_USAGE, PROGRAM_NAME);
@@ -1068,6 +2751,8 @@ int main(int argc, char **argv)
 
 	if (idx < argc)
 		channel = argv[idx];
+	else if (args.n_services)
+		channel = args.services[0].channel;
 
 	if (!channel) {
 		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
@@ -1080,8 +2765,21 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	if (!args.traffic_monitor && args.search) {
-		ERROR("search string can be used only on monitor mode\n");
+	if (args.n_services &&
+	    (args.dvr || args.rec_psi || args.traffic_monitor || args.server)) {
+		ERROR("services to record can't be used with -o, -r, -p, -m or -H\n");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (args.stream && (args.filename || args.traffic_monitor)) {
+		ERROR("stream can't be used with -o or -m\n");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (!args.traffic_monitor && (args.search || args.metrics)) {
+		ERROR("search string and metrics can be used only on monitor mode\n");
 		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
 		return -1;
 	}
@@ -1110,7 +2808,7 @@ int main(int argc, char **argv)
 	}
 
 	dvb_dev_set_log(dvb, args.verbose, NULL);
-	dvb_dev_find(dvb, NULL, NULL);
+	dvb_dev_find_adapter(dvb, args.adapter);
 	parms = dvb->fe_parms;
 
 	dvb_dev = dvb_dev_seek_by_adapter(dvb, args.adapter, args.demux, DVB_DEVICE_DEMUX);
@@ -1171,6 +2869,13 @@ int main(int argc, char **argv)
 	if (setup_frontend(&args, parms) < 0)
 		goto err;
 
+	/* Let the daemon send the stats, instead of asking every second */
+	if (args.server && args.port)
+		dvb_fe_subscribe_stats(parms, 1000);
+
+	if (args.rt_prio)
+		rt_setup(&args);
+
 	if (args.exit_after_tuning) {
 		set_signals(&args);
 		err = 0;
@@ -1194,14 +2899,30 @@ int main(int argc, char **argv)
 		goto err;
 	}
 
-	if (args.rec_psi) {
-		sid_fd = dvb_dev_open(dvb, args.demux_dev, O_RDWR);
-		if (!sid_fd) {
-			ERROR("opening sid demux failed");
-			return -1;
+	if (args.n_services) {
+		set_signals(&args);
+		if (!check_frontend(&args, parms)) {
+			err = 1;
+			fprintf(stderr, _("frontend doesn't lock\n"));
+			goto err;
 		}
-		pmtpid = dvb_dev_dmx_get_pmt_pid(sid_fd, dvb_entry->service_id);
-		dvb_dev_close(sid_fd);
+		if (args.silent < 2)
+			get_show_stats(stderr, &args, parms, 0);
+		err = record_services(&args, dvb, dvb_file);
+		goto err;
+	}
+
+	if (args.rec_psi) {
+		/*
+		 * With a cached PMT PID, there's no need to wait for the PAT
+		 * before starting the PMT filter. It is checked after lock.
+		 */
+		if (args.cache)
+			cached_pmtpid = cache_get_pmt_pid(&args, dvb_entry);
+		if (cached_pmtpid > 0)
+			pmtpid = cached_pmtpid;
+		else
+			pmtpid = get_pmt_pid(&args, dvb, dvb_entry->service_id);
 		if (pmtpid <= 0) {
 			fprintf(stderr, _("couldn't find pmt-pid for sid %04x\n"),
 				dvb_entry->service_id);
@@ -1361,6 +3082,25 @@ int main(int argc, char **argv)
 		goto err;
 	}
 
+	/* Check the cached PMT PID, and update the cache */
+	if (args.rec_psi && args.cache) {
+		if (cached_pmtpid > 0) {
+			r = get_pmt_pid(&args, dvb, dvb_entry->service_id);
+			if (r > 0 && r != pmtpid) {
+				fprintf(stderr, _("PMT PID changed from %d to %d\n"),
+					pmtpid, r);
+				pmtpid = r;
+				dvb_dev_dmx_stop(pmt_fd);
+				if (dvb_dev_dmx_set_pesfilter(pmt_fd, pmtpid, DMX_PES_OTHER,
+						args.dvr ? DMX_OUT_TS_TAP : DMX_OUT_DECODER,
+						args.dvr ? 64 * 1024 : 0) < 0)
+					goto err;
+			}
+		}
+		if (pmtpid != cached_pmtpid)
+			cache_store_pmt_pid(&args, dvb_entry, pmtpid);
+	}
+
 	if (args.dvr) {
 		if (args.filename) {
 			file_fd = STDOUT_FILENO;
@@ -1381,7 +3121,22 @@ int main(int argc, char **argv)
 		if (args.silent < 2)
 			get_show_stats(stderr, &args, parms, 0);
 
-		if (file_fd >= 0) {
+		if (args.stream) {
+			struct stream_state st;
+
+			if (stream_open(&st, args.stream, args.ttl) < 0)
+				goto err;
+			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
+			if (!dvr_fd) {
+				ERROR("failed opening '%s'", args.dvr_dev);
+				close(st.fd);
+				goto err;
+			}
+			if (!timeout_flag)
+				fprintf(stderr, _("Streaming to '%s' started\n"), args.stream);
+			stream_to_udp(dvr_fd, &st, args.timeout, args.silent);
+			close(st.fd);
+		} else if (file_fd >= 0) {
 			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
 			if (!dvr_fd) {
 				ERROR("failed opening '%s'", args.dvr_dev);
@@ -1389,7 +3144,8 @@ int main(int argc, char **argv)
 			}
 			if (!timeout_flag)
 				fprintf(stderr, _("Record to file '%s' started\n"), args.filename);
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent,
+				     args.rt_prio ? (int)args.rt_spin : -1);
 		} else if (args.server && args.port) {
 			struct stat st;
 			if (stat(args.dvr_pipe, &st) == -1) {
@@ -1428,7 +3184,8 @@ int main(int argc, char **argv)
 				err = -1;
 				goto err;
 			}
-			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
+			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent,
+				     args.rt_prio ? (int)args.rt_spin : -1);
 		} else {
 			if (!timeout_flag)
 				fprintf(stderr, _("DVR interface '%s' can now be opened\n"), args.dvr_fname);
@@ -1468,8 +3225,18 @@ err:
 		free(args.search);
 	if (args.server)
 		free(args.server);
+	if (args.cache)
+		free(args.cache);
+	if (args.metrics)
+		free(args.metrics);
+	if (args.stream)
+		free(args.stream);
 	if (args.dvr_pipe != default_dvr_pipe)
 		free(args.dvr_pipe);
+	for (idx = 0; idx < args.n_services; idx++) {
+		free(args.services[idx].channel);
+		free(args.services[idx].filename);
+	}
 
 	return err;
 }
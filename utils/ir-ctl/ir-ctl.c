@@ -56,7 +56,11 @@
 
 /* See drivers/media/rc/lirc_dev.c line 22 */
 #define LIRCBUF_SIZE 1024
+/* Samples read at once while receiving */
+#define LIRC_RECV_SIZE 16384
 #define IR_DEFAULT_TIMEOUT 125000
+// lirc refuses to send IR longer than this many microseconds at once
+#define IR_MAX_SEND_DURATION 500000
 #define UNSET UINT32_MAX
 
 const char *argp_program_version = "IR ctl version " V4L_UTILS_VERSION;
@@ -97,8 +101,11 @@ struct arguments {
 	bool receive;
 	bool verbose;
 	bool mode2;
+	bool binary;
+	bool decode;
 	struct keymap *keymap;
 	struct send *send;
+	char *script;
 	bool oneshot;
 	char *savetofile;
 	int wideband;
@@ -119,10 +126,13 @@ static const struct argp_option options[] = {
 	{ "send",	's',	N_("FILE"),	0,	N_("send IR pulse and space file") },
 	{ "scancode",	'S',	N_("SCANCODE"),	0,	N_("send IR scancode in protocol specified") },
 	{ "keycode",	'K',	N_("KEYCODE"),	0,	N_("send IR keycode from keymap") },
+	{ "script",	5,	N_("SCRIPT"),	0,	N_("send the keycodes and scancodes listed in file") },
 	{ "verbose",	'v',	0,		0,	N_("verbose output") },
 		{ .doc = N_("Receiving options:") },
 	{ "one-shot",	'1',	0,		0,	N_("end receiving after first message") },
 	{ "mode2",	2,	0,		0,	N_("output in mode2 format") },
+	{ "binary",	3,	0,		0,	N_("output the raw lirc mode2 samples in binary") },
+	{ "decode",	4,	0,		0,	N_("output the decoded scancodes") },
 	{ "wideband",	'w',	0,		0,	N_("use wideband receiver aka learning mode") },
 	{ "narrowband",	'n',	0,		0,	N_("use narrowband receiver, disable learning mode") },
 	{ "carrier-range", 'R', N_("RANGE"),	0,	N_("set receiver carrier range") },
@@ -144,6 +154,7 @@ static const char args_doc[] = N_(
 	"--send [file to send]\n"
 	"--scancode [scancode to send]\n"
 	"--keycode [keycode to send]\n"
+	"--script [file with keys to send]\n"
 	"[to set lirc option]");
 
 static const char doc[] = N_(
@@ -160,7 +171,8 @@ static const char doc[] = N_(
 	"  TIMEOUT  - set length of space before receiving stops in microseconds\n"
 	"  KEYCODE  - key code in keymap\n"
 	"  SCANCODE - protocol:scancode, e.g. nec:0xa814\n"
-	"  KEYMAP   - a rc keymap file from which to send keys\n\n"
+	"  KEYMAP   - a rc keymap file from which to send keys\n"
+	"  SCRIPT   - a text file with a keycode or scancode and optional gap per line\n\n"
 	"Note that most lirc setting have global state, i.e. the device will remain\n"
 	"in this state until set otherwise.");
 
@@ -592,13 +604,13 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 
 	switch (k) {
 	case 'f':
-		if (arguments->receive || arguments->send)
+		if (arguments->receive || arguments->send || arguments->script)
 			argp_error(state, _("features can not be combined with receive or send option"));
 		arguments->features = true;
 		break;
 	// receiving
 	case 'r':
-		if (arguments->features || arguments->send)
+		if (arguments->features || arguments->send || arguments->script)
 			argp_error(state, _("receive can not be combined with features or send option"));
 
 		arguments->receive = true;
@@ -615,6 +627,12 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 2:
 		arguments->mode2 = true;
 		break;
+	case 3:
+		arguments->binary = true;
+		break;
+	case 4:
+		arguments->decode = true;
+		break;
 	case 'v':
 		arguments->verbose = true;
 		break;
@@ -715,6 +733,14 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		add_to_send_list(arguments, s);
 		break;
 
+	case 5:
+		if (arguments->receive || arguments->features)
+			argp_error(state, _("script can not be combined with receive or features option"));
+		if (arguments->script)
+			argp_error(state, _("script already set"));
+		arguments->script = arg;
+		break;
+
 	case 'k':
 		if (parse_keymap(arg, &map, arguments->verbose))
 			exit(EX_DATAERR);
@@ -732,12 +758,17 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		if (!arguments->work_to_do)
 			argp_usage(state);
 
+		if (arguments->mode2 && (arguments->binary || arguments->decode))
+			argp_error(state, _("mode2 can not be combined with binary or decode option"));
+		if (arguments->binary && arguments->decode && !arguments->savetofile)
+			argp_error(state, _("binary and decode option need a file to receive to"));
+
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
 
-	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2)
+	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2 && k != 3 && k != 4)
 		arguments->work_to_do = true;
 
 	return 0;
@@ -815,6 +846,297 @@ static struct send* convert_keycode(struct keymap *map, const char *keycode)
 	return s;
 }
 
+/*
+ * The keycodes of the keymaps with their IR, encoded once when sending a
+ * script, rather than looking up and encoding each key as it is sent.
+ */
+struct encoded_key {
+	const char *keycode;
+	struct keymap *map;
+	struct send *send;
+	unsigned pos;
+};
+
+struct encoded_keymap {
+	struct encoded_key *keys;
+	unsigned count;
+};
+
+static int cmp_encoded_key(const void *__a, const void *__b)
+{
+	const struct encoded_key *a = __a, *b = __b;
+	int rc = strcmp(a->keycode, b->keycode);
+
+	if (rc)
+		return rc;
+	return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
+
+static int cmp_encoded_key_name(const void *__a, const void *__b)
+{
+	const struct encoded_key *a = __a, *b = __b;
+
+	return strcmp(a->keycode, b->keycode);
+}
+
+/*
+ * Encodes the scancode in user space if possible, so that it can be sent
+ * along with other IR in one transmit
+ */
+static void encode_scancode(struct send *s)
+{
+	enum rc_proto proto = s->protocol;
+
+	if (!protocol_encoder_available(proto))
+		return;
+
+	s->len = protocol_encode(proto, s->scancode, s->buf);
+	s->carrier = protocol_carrier(proto);
+	s->ty = SEND_RAW;
+}
+
+static bool encode_keymap(struct keymap *map, struct encoded_keymap *ek)
+{
+	struct keymap *m;
+	struct scancode_entry *se;
+	struct raw_entry *re;
+	unsigned i, n = 0, size = 0;
+
+	for (m = map; m; m = m->next) {
+		for (re = m->raw; re; re = re->next)
+			size++;
+		for (se = m->scancode; se; se = se->next)
+			size++;
+	}
+
+	ek->keys = calloc(size ? size : 1, sizeof(*ek->keys));
+	if (!ek->keys) {
+		fprintf(stderr, _("Failed to allocate memory\n"));
+		return false;
+	}
+
+	// same order as convert_keycode(), so the same definition is used
+	for (m = map; m; m = m->next) {
+		for (re = m->raw; re; re = re->next) {
+			struct send *s;
+
+			s = malloc(sizeof(*s) + re->raw_length * sizeof(int));
+			if (!s) {
+				fprintf(stderr, _("Failed to allocate memory\n"));
+				return false;
+			}
+			s->len = re->raw_length;
+			memcpy(s->buf, re->raw, s->len * sizeof(int));
+			s->ty = SEND_RAW;
+			s->carrier = keymap_param(m, "carrier", UNSET);
+			s->next = NULL;
+
+			ek->keys[n].keycode = re->keycode;
+			ek->keys[n].map = m;
+			ek->keys[n].send = s;
+			ek->keys[n].pos = n;
+			n++;
+		}
+
+		for (se = m->scancode; se; se = se->next) {
+			int buf[LIRCBUF_SIZE], length;
+			const char *proto_str;
+			enum rc_proto proto;
+			struct send *s;
+
+			s = malloc(sizeof(*s));
+			if (!s) {
+				fprintf(stderr, _("Failed to allocate memory\n"));
+				return false;
+			}
+			s->next = NULL;
+
+			proto_str = m->variant ?: m->protocol;
+
+			if (protocol_match(proto_str, &proto)) {
+				s->protocol = proto;
+				s->scancode = se->scancode;
+				s->ty = SEND_SCANCODE;
+				encode_scancode(s);
+			} else if (encode_bpf_protocol(m, se->scancode,
+						       buf, &length)) {
+				s->len = length;
+				memcpy(s->buf, buf, length * sizeof(int));
+				s->ty = SEND_RAW;
+				s->carrier = keymap_param(m, "carrier", UNSET);
+			} else {
+				// only an error if the key is sent
+				free(s);
+				s = NULL;
+			}
+
+			ek->keys[n].keycode = se->keycode;
+			ek->keys[n].map = m;
+			ek->keys[n].send = s;
+			ek->keys[n].pos = n;
+			n++;
+		}
+	}
+
+	qsort(ek->keys, n, sizeof(*ek->keys), cmp_encoded_key);
+
+	// keep the first definition of each keycode
+	ek->count = 0;
+	for (i = 0; i < n; i++) {
+		if (ek->count &&
+		    !strcmp(ek->keys[ek->count - 1].keycode, ek->keys[i].keycode)) {
+			free(ek->keys[i].send);
+			continue;
+		}
+		ek->keys[ek->count++] = ek->keys[i];
+	}
+
+	return true;
+}
+
+static struct send *find_encoded_key(struct encoded_keymap *ek, const char *keycode)
+{
+	struct encoded_key key = { .keycode = keycode }, *k;
+
+	k = bsearch(&key, ek->keys, ek->count, sizeof(key), cmp_encoded_key_name);
+	if (!k) {
+		fprintf(stderr, _("error: keycode `%s' not found in keymap\n"), keycode);
+		return NULL;
+	}
+
+	if (!k->send) {
+		const char *proto_str = k->map->variant ?: k->map->protocol;
+
+		fprintf(stderr, _("error: protocol '%s' not supported\n"), proto_str);
+		return NULL;
+	}
+
+	return k->send;
+}
+
+static void free_encoded_keymap(struct encoded_keymap *ek)
+{
+	unsigned i;
+
+	for (i = 0; i < ek->count; i++)
+		free(ek->keys[i].send);
+	free(ek->keys);
+}
+
+struct script_entry {
+	struct send *send;
+	unsigned gap;
+	bool owned;
+};
+
+/*
+ * A script has one key per line, either a keycode from the keymaps or a
+ * protocol:scancode, optionally followed by the gap after it in microseconds.
+ */
+static struct script_entry *read_script(struct arguments *args, struct encoded_keymap *ek, unsigned *count)
+{
+	static const char whitespace[] = " \n\r\t";
+	struct script_entry *e = NULL, *tmp;
+	FILE *input;
+	char *line = NULL;
+	size_t line_size;
+	unsigned n = 0, size = 0;
+	int lineno = 0;
+
+	if (!strcmp(args->script, "-"))
+		input = stdin;
+	else
+		input = fopen(args->script, "r");
+	if (!input) {
+		fprintf(stderr, _("%s: could not open: %m\n"), args->script);
+		return NULL;
+	}
+
+	while (getline(&line, &line_size, input) > 0) {
+		char *key, *p, *saveptr;
+		struct send *s;
+		unsigned gap = args->gap;
+		bool owned = false;
+
+		lineno++;
+		key = strtok_r(line, whitespace, &saveptr);
+		if (key == NULL || *key == '#' || (key[0] == '/' && key[1] == '/'))
+			continue;
+
+		p = strtok_r(NULL, whitespace, &saveptr);
+		if (p && p[0] != '#' && !(p[0] == '/' && p[1] == '/')) {
+			if (!strtoint(p, "", &gap)) {
+				fprintf(stderr, _("error: %s:%d: invalid gap '%s'\n"), args->script, lineno, p);
+				goto err;
+			}
+
+			p = strtok_r(NULL, whitespace, &saveptr);
+			if (p && p[0] != '#' && !(p[0] == '/' && p[1] == '/')) {
+				fprintf(stderr, _("error: %s:%d: '%s' unexpected\n"), args->script, lineno, p);
+				goto err;
+			}
+		}
+
+		if (strchr(key, ':')) {
+			s = read_scancode(key);
+			if (!s)
+				goto err_line;
+			s->next = NULL;
+			s->fname = NULL;
+			encode_scancode(s);
+			owned = true;
+		} else {
+			if (!args->keymap) {
+				fprintf(stderr, _("error: no keymap specified\n"));
+				goto err;
+			}
+			s = find_encoded_key(ek, key);
+			if (!s)
+				goto err_line;
+		}
+
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			tmp = realloc(e, size * sizeof(*e));
+			if (!tmp) {
+				fprintf(stderr, _("Failed to allocate memory\n"));
+				if (owned)
+					free(s);
+				goto err;
+			}
+			e = tmp;
+		}
+		e[n].send = s;
+		e[n].gap = gap;
+		e[n].owned = owned;
+		n++;
+	}
+
+	if (!n) {
+		fprintf(stderr, _("%s: file is empty\n"), args->script);
+		goto err;
+	}
+
+	free(line);
+	if (input != stdin)
+		fclose(input);
+
+	*count = n;
+	return e;
+
+err_line:
+	fprintf(stderr, _("error: %s:%d: cannot send '%s'\n"), args->script, lineno, line);
+err:
+	while (n--)
+		if (e[n].owned)
+			free(e[n].send);
+	free(e);
+	free(line);
+	if (input != stdin)
+		fclose(input);
+	return NULL;
+}
+
 static const struct argp argp = {
 	.options = options,
 	.parser = parse_opt,
@@ -1123,10 +1445,98 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 	return 0;
 }
 
+/*
+ * Sends the keys of a script. As many consecutive keys as the device
+ * accepts in one transmit are joined into a burst, with their gaps sent as
+ * spaces, so that the gaps within a burst are exact.
+ */
+static int lirc_send_script(struct arguments *args, int fd, unsigned features,
+			    struct script_entry *e, unsigned count)
+{
+	struct send *burst;
+	unsigned i, j, duration = 0, gap = 0;
+	int rc = 0;
+
+	burst = malloc(sizeof(*burst));
+	if (!burst) {
+		fprintf(stderr, _("Failed to allocate memory\n"));
+		return EX_OSERR;
+	}
+	burst->ty = SEND_RAW;
+	burst->len = 0;
+	burst->carrier = UNSET;
+
+	for (i = 0; i < count; i++) {
+		struct send *s = e[i].send;
+		unsigned d = 0;
+
+		if (s->ty == SEND_RAW && s->len < LIRCBUF_SIZE) {
+			for (j = 0; j < s->len; j++)
+				d += s->buf[j];
+
+			if (burst->len &&
+			    burst->len + 1 + s->len <= LIRCBUF_SIZE &&
+			    duration + gap + d <= IR_MAX_SEND_DURATION &&
+			    (s->carrier == UNSET || burst->carrier == UNSET ||
+			     s->carrier == burst->carrier)) {
+				burst->buf[burst->len++] = gap;
+				duration += gap;
+			} else if (burst->len) {
+				rc = lirc_send(args, fd, features, burst);
+				if (rc)
+					goto out;
+				usleep(gap);
+				burst->len = 0;
+				burst->carrier = UNSET;
+				duration = 0;
+			}
+
+			memcpy(burst->buf + burst->len, s->buf, s->len * sizeof(unsigned));
+			burst->len += s->len;
+			if (s->carrier != UNSET)
+				burst->carrier = s->carrier;
+			duration += d;
+			gap = e[i].gap;
+			continue;
+		}
+
+		// scancodes only the kernel can encode are sent on their own
+		if (burst->len) {
+			rc = lirc_send(args, fd, features, burst);
+			if (rc)
+				goto out;
+			usleep(gap);
+			burst->len = 0;
+			burst->carrier = UNSET;
+			duration = 0;
+		}
+
+		rc = lirc_send(args, fd, features, s);
+		if (rc)
+			goto out;
+		if (i + 1 < count)
+			usleep(e[i].gap);
+	}
+
+	if (burst->len)
+		rc = lirc_send(args, fd, features, burst);
+out:
+	free(burst);
+	return rc;
+}
+
+static void decode_print(void *priv, enum rc_proto proto, unsigned scancode)
+{
+	// same format as the files for --send
+	fprintf(priv, "scancode %s:0x%x\n", protocol_name(proto), scancode);
+}
+
 int lirc_receive(struct arguments *args, int fd, unsigned features)
 {
 	char *dev = args->device;
 	FILE *out = stdout;
+	FILE *decode_out = stdout;
+	struct protocol_decoder *decode = NULL;
 	int rc = EX_IOERR;
 	int mode = LIRC_MODE_MODE2;
 
@@ -1148,7 +1558,20 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 			return EX_CANTCREAT;
 		}
 	}
-	unsigned buf[LIRCBUF_SIZE];
+
+	// with --binary, the raw samples go to the file
+	if (args->decode && !args->binary)
+		decode_out = out;
+
+	if (args->decode) {
+		decode = protocol_decoder_new(decode_print, decode_out);
+		if (!decode) {
+			fprintf(stderr, _("Failed to allocate memory\n"));
+			goto err;
+		}
+	}
+
+	static unsigned buf[LIRC_RECV_SIZE];
 
 	bool keep_reading = true;
 	bool leading_space = true;
@@ -1167,7 +1590,9 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 			goto err;
 		}
 
-		for (int i=0; i<ret / sizeof(unsigned); i++) {
+		int i;
+
+		for (i=0; i<ret / sizeof(unsigned); i++) {
 			unsigned val = buf[i] & LIRC_VALUE_MASK;
 			unsigned msg = buf[i] & LIRC_MODE2_MASK;
 
@@ -1185,7 +1610,14 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 				break;
 			}
 
-			if (args->mode2) {
+			if (args->decode) {
+				protocol_decoder_sample(decode, msg, val);
+				if (msg == LIRC_MODE2_TIMEOUT || msg == LIRC_MODE2_OVERFLOW)
+					leading_space = true;
+			} else if (args->binary) {
+				if (msg == LIRC_MODE2_TIMEOUT || msg == LIRC_MODE2_OVERFLOW)
+					leading_space = true;
+			} else if (args->mode2) {
 				switch (msg) {
 				case LIRC_MODE2_TIMEOUT:
 					fprintf(out, "timeout %u\n", val);
@@ -1234,13 +1666,29 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 					break;
 				}
 			}
+		}
 
-			fflush(out);
+		// write everything read at once, rather than sample by sample
+		if (args->binary && i &&
+		    fwrite(buf, sizeof(buf[0]), i, out) != (size_t)i) {
+			fprintf(stderr, _("%s: failed to write: %m\n"),
+				args->savetofile ? args->savetofile : "stdout");
+			goto err;
 		}
+
+		fflush(out);
+		if (decode_out != out)
+			fflush(decode_out);
+	}
+
+	if (args->decode) {
+		protocol_decoder_flush(decode);
+		fflush(decode_out);
 	}
 
 	rc = 0;
 err:
+	protocol_decoder_free(decode);
 	if (args->savetofile)
 		fclose(out);
 
@@ -1310,6 +1758,33 @@ int main(int argc, char *argv[])
 		s = next;
 	}
 
+	if (args.script) {
+		struct encoded_keymap ek = {};
+		struct script_entry *e;
+		unsigned i, count;
+
+		if (args.keymap && !encode_keymap(args.keymap, &ek))
+			exit(EX_OSERR);
+
+		e = read_script(&args, &ek, &count);
+		if (!e)
+			exit(EX_DATAERR);
+
+		if (args.send)
+			usleep(args.gap);
+		rc = lirc_send_script(&args, fd, features, e, count);
+
+		for (i = 0; i < count; i++)
+			if (e[i].owned)
+				free(e[i].send);
+		free(e);
+		free_encoded_keymap(&ek);
+		if (rc) {
+			close(fd);
+			exit(rc);
+		}
+	}
+
 	if (args.receive) {
 		rc = lirc_receive(&args, fd, features);
 		if (rc) {
@@ -265,6 +265,7 @@ static const struct argp_option options[] = {
 	{"clear",	'c',	0,		0,	N_("Clears the scancode to keycode mappings"), 0},
 	{"sysdev",	's',	N_("SYSDEV"),	0,	N_("rc device to control, defaults to rc0 if not specified"), 0},
 	{"test",	't',	0,		0,	N_("test if IR is generating events"), 0},
+	{"decode",	2,	0,		0,	N_("with --test, also decode the raw IR in user space, for all protocols"), 0},
 	{"read",	'r',	0,		0,	N_("reads the current scancode/keycode mapping"), 0},
 	{"write",	'w',	N_("KEYMAP"),	0,	N_("write (adds) the keymap from the specified file"), 0},
 	{"set-key",	'k',	N_("SCANKEY"),	0,	N_("Change scan/key pairs"), 0},
@@ -288,6 +289,7 @@ static int readtable = 0;
 static int clear = 0;
 int debug = 0;
 static int test = 0;
+static int decode = 0;
 static int delay = -1;
 static int period = -1;
 static int test_keymap = 0;
@@ -305,6 +307,7 @@ static struct protocol_param *bpf_parameter;
 struct cfgfile cfg = {
 	NULL, NULL, NULL, NULL
 };
+static char *cfg_fname;
 
 /*
  * Stores the input layer protocol version
@@ -544,6 +547,9 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 't':
 		test++;
 		break;
+	case 2:
+		decode++;
+		break;
 	case 'c':
 		clear++;
 		break;
@@ -578,12 +584,10 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		free_keymap(map);
 		break;
 	}
-	case 'a': {
-		rc = parse_cfgfile(arg);
-		if (rc)
-			argp_error(state, _("Failed to read config file %s"), arg);
+	case 'a':
+		/* Parsed only if the keymap cache can't be used */
+		cfg_fname = arg;
 		break;
-	}
 	case 'k':
 		p = strtok(arg, ":=");
 		do {
@@ -1430,11 +1434,53 @@ static void clear_table(int fd)
 	}
 }
 
+static void set_keycode(int fd, unsigned long long scancode, uint32_t keycode)
+{
+	unsigned codes[2];
+
+	codes[0] = scancode;
+	codes[1] = keycode;
+
+	if (codes[0] != scancode) {
+		// 64 bit scancode
+		struct input_keymap_entry_v2 entry = {
+			.keycode = keycode,
+			.len = sizeof(scancode)
+		};
+
+		memcpy(entry.scancode, &scancode, sizeof(scancode));
+
+		if (ioctl(fd, EVIOCSKEYCODE_V2, &entry)) {
+			fprintf(stderr,
+				_("Setting scancode 0x%04llx with 0x%04x via "),
+				scancode, keycode);
+			perror("EVIOCSKEYCODE");
+		}
+	} else {
+		if (ioctl(fd, EVIOCSKEYCODE, codes)) {
+			fprintf(stderr,
+				_("Setting scancode 0x%04llx with 0x%04x via "),
+				scancode, keycode);
+			perror("EVIOCSKEYCODE");
+		}
+	}
+}
+
+static void free_keytable(void)
+{
+	struct keytable_entry *ke;
+
+	while (keytable) {
+		ke = keytable;
+		keytable = ke->next;
+		free(ke);
+	}
+}
+
 static int add_keys(int fd)
 {
 	int write_cnt = 0;
 	struct keytable_entry *ke;
-	unsigned codes[2];
 
 	for (ke = keytable; ke; ke = ke->next) {
 		write_cnt++;
@@ -1442,40 +1488,156 @@ static int add_keys(int fd)
 			fprintf(stderr, "\t%04llx=%04x\n",
 				ke->scancode, ke->keycode);
 
-		codes[0] = ke->scancode;
-		codes[1] = ke->keycode;
+		set_keycode(fd, ke->scancode, ke->keycode);
+	}
 
-		if (codes[0] != ke->scancode) {
-			// 64 bit scancode
-			struct input_keymap_entry_v2 entry = {
-				.keycode = ke->keycode,
-				.len = sizeof(ke->scancode)
-			};
+	free_keytable();
 
-			memcpy(entry.scancode, &ke->scancode, sizeof(ke->scancode));
+	return write_cnt;
+}
 
-			if (ioctl(fd, EVIOCSKEYCODE_V2, &entry)) {
-				fprintf(stderr,
-					_("Setting scancode 0x%04llx with 0x%04x via "),
-					ke->scancode, ke->keycode);
-				perror("EVIOCSKEYCODE");
+struct sync_key {
+	unsigned long long scancode;
+	uint32_t keycode;
+	unsigned pos;
+};
+
+static int cmp_sync_key(const void *__a, const void *__b)
+{
+	const struct sync_key *a = __a, *b = __b;
+
+	if (a->scancode != b->scancode)
+		return a->scancode < b->scancode ? -1 : 1;
+	return a->pos < b->pos ? -1 : a->pos > b->pos;
+}
+
+/*
+ * Reads the scancode table of the device, sorted by scancode.
+ * Returns the number of entries, or -1 if it can't be read.
+ */
+static int read_kernel_keys(int fd, struct sync_key **keys)
+{
+	struct input_keymap_entry_v2 entry = {};
+	struct sync_key *k = NULL, *tmp;
+	unsigned n = 0, size = 0;
+
+	while (1) {
+		entry.flags = KEYMAP_BY_INDEX;
+		entry.index = n;
+		entry.len = sizeof(uint64_t);
+
+		if (ioctl(fd, EVIOCGKEYCODE_V2, &entry) == -1)
+			break;
+
+		if (n == size) {
+			size = size ? size * 2 : 128;
+			tmp = realloc(k, size * sizeof(*k));
+			if (!tmp) {
+				free(k);
+				return -1;
 			}
+			k = tmp;
+		}
+
+		if (entry.len == sizeof(uint32_t)) {
+			uint32_t temp;
+
+			memcpy(&temp, entry.scancode, sizeof(temp));
+			k[n].scancode = temp;
+		} else if (entry.len == sizeof(uint64_t)) {
+			uint64_t temp;
+
+			memcpy(&temp, entry.scancode, sizeof(temp));
+			k[n].scancode = temp;
 		} else {
-			if (ioctl(fd, EVIOCSKEYCODE, codes)) {
-				fprintf(stderr,
-					_("Setting scancode 0x%04llx with 0x%04x via "),
-					ke->scancode, ke->keycode);
-				perror("EVIOCSKEYCODE");
-			}
+			free(k);
+			return -1;
 		}
+		k[n].keycode = entry.keycode;
+		k[n].pos = n;
+		n++;
 	}
 
-	while (keytable) {
-		ke = keytable;
-		keytable = ke->next;
-		free(ke);
+	qsort(k, n, sizeof(*k), cmp_sync_key);
+	*keys = k;
+	return n;
+}
+
+/*
+ * Updates the device table to match the keytable, reading the current
+ * table once and only writing the entries that changed. With clear_old,
+ * the entries that aren't at the keytable are removed.
+ * Returns the number of written keycodes, or -1 if the current table
+ * can't be read.
+ */
+static int sync_keys(int fd, int clear_old)
+{
+	struct sync_key *cur, *want;
+	struct keytable_entry *ke;
+	int n_cur, n_want = 0, write_cnt = 0, del_cnt = 0;
+	int i, j, k;
+
+	n_cur = read_kernel_keys(fd, &cur);
+	if (n_cur < 0)
+		return -1;
+
+	for (ke = keytable; ke; ke = ke->next)
+		n_want++;
+	want = malloc((n_want + 1) * sizeof(*want));
+	if (!want) {
+		free(cur);
+		return -1;
+	}
+	for (i = 0, ke = keytable; ke; ke = ke->next, i++) {
+		want[i].scancode = ke->scancode;
+		want[i].keycode = ke->keycode;
+		want[i].pos = i;
+	}
+	qsort(want, n_want, sizeof(*want), cmp_sync_key);
+
+	/* Like add_keys(), the last duplicated scancode wins */
+	for (i = 0, k = 0; i < n_want; i++) {
+		if (k && want[k - 1].scancode == want[i].scancode)
+			k--;
+		want[k++] = want[i];
+	}
+	n_want = k;
+
+	for (i = 0, j = 0; i < n_cur || j < n_want; ) {
+		if (j == n_want ||
+		    (i < n_cur && cur[i].scancode < want[j].scancode)) {
+			if (clear_old) {
+				if (debug)
+					fprintf(stderr, _("Deleting scancode 0x%04llx\n"),
+						cur[i].scancode);
+				set_keycode(fd, cur[i].scancode, KEY_RESERVED);
+				del_cnt++;
+			}
+			i++;
+			continue;
+		}
+
+		if (i == n_cur || cur[i].scancode != want[j].scancode ||
+		    cur[i].keycode != want[j].keycode) {
+			if (debug)
+				fprintf(stderr, "\t%04llx=%04x\n",
+					want[j].scancode, want[j].keycode);
+			set_keycode(fd, want[j].scancode, want[j].keycode);
+			write_cnt++;
+		}
+		if (i < n_cur && cur[i].scancode == want[j].scancode)
+			i++;
+		j++;
 	}
 
+	if (debug)
+		fprintf(stderr, _("%d keycode(s) unchanged, %d removed\n"),
+			n_want - write_cnt, del_cnt);
+
+	free(cur);
+	free(want);
+	free_keytable();
+
 	return write_cnt;
 }
 
@@ -1528,11 +1690,24 @@ static void print_scancodes(const struct lirc_scancode *scancodes, unsigned coun
 	}
 }
 
+static void print_decoded(void *priv, enum rc_proto proto, unsigned scancode)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	printf(_("%llu.%06llu: user space protocol(%s): scancode = 0x%x\n"),
+		(unsigned long long)ts.tv_sec,
+		(unsigned long long)ts.tv_nsec / 1000ull,
+		protocol_name(proto), scancode);
+}
+
 static void test_event(struct rc_device *rc_dev, int fd)
 {
 	struct input_event ev[64];
 	struct lirc_scancode sc[64];
-	int rd, i, lircfd = -1;
+	unsigned raw[256];
+	struct protocol_decoder *decoder = NULL;
+	int rd, i, lircfd = -1, rawfd = -1;
 	unsigned mode;
 
 	/* LIRC reports time in monotonic, set event to same */
@@ -1553,14 +1728,39 @@ static void test_event(struct rc_device *rc_dev, int fd)
 		}
 	}
 
+	/*
+	 * Each lirc file has its own receive mode, so the raw IR can be
+	 * read at the same time as the scancodes
+	 */
+	if (decode && rc_dev->lirc_name) {
+		unsigned mode = LIRC_MODE_MODE2;
+
+		rawfd = open(rc_dev->lirc_name, O_RDONLY | O_NONBLOCK);
+		if (rawfd != -1 && ioctl(rawfd, LIRC_SET_REC_MODE, &mode)) {
+			close(rawfd);
+			rawfd = -1;
+		}
+		if (rawfd != -1)
+			decoder = protocol_decoder_new(print_decoded, NULL);
+		if (!decoder) {
+			fprintf(stderr, _("Can't read raw IR from lirc device\n"));
+			if (rawfd != -1)
+				close(rawfd);
+			rawfd = -1;
+		}
+	} else if (decode) {
+		fprintf(stderr, _("No lirc device to read raw IR from\n"));
+	}
+
 	printf (_("Testing events. Please, press CTRL-C to abort.\n"));
 	while (1) {
-		struct pollfd pollstruct[2] = {
+		struct pollfd pollstruct[3] = {
 			{ .fd = fd, .events = POLLIN },
 			{ .fd = lircfd, .events = POLLIN },
+			{ .fd = rawfd, .events = POLLIN },
 		};
 
-		if (poll(pollstruct, 2, -1) < 0) {
+		if (poll(pollstruct, 3, -1) < 0) {
 			if (errno == EINTR)
 				continue;
 
@@ -1578,6 +1778,20 @@ static void test_event(struct rc_device *rc_dev, int fd)
 			}
 		}
 
+		if (rawfd != -1) {
+			rd = read(rawfd, raw, sizeof(raw));
+
+			if (rd != -1) {
+				for (i = 0; i < rd / sizeof(raw[0]); i++)
+					protocol_decoder_sample(decoder,
+								LIRC_MODE2(raw[i]),
+								LIRC_VALUE(raw[i]));
+			} else if (errno != EAGAIN) {
+				perror(_("Error reading lirc raw IR"));
+				return;
+			}
+		}
+
 		rd = read(fd, ev, sizeof(ev));
 
 		if (rd < (int) sizeof(struct input_event)) {
@@ -2055,6 +2269,477 @@ char* keymap_to_filename(const char *fname)
 	return NULL;
 }
 
+#ifdef IR_KEYTABLE_CACHE_DIR
+/*
+ * Auto-load keymap cache
+ *
+ * udev runs "ir-keytable -a" for every rc device at boot and on hotplug.
+ * The outcome of matching a device against the config file and parsing
+ * its keymaps is stored per driver/table, together with the stat data of
+ * each file it was built from, so that the next runs don't need to parse
+ * them again. BPF programs are not cached, as they are loaded and relocated
+ * against the maps of each lirc device.
+ */
+#define KEYMAP_CACHE_MAGIC	0x4b435249	/* "IRCK" */
+#define KEYMAP_CACHE_VERSION	1
+#define KEYMAP_CACHE_MAX_LEN	65536
+
+struct cache_stamp {
+	char			*fname;
+	uint32_t		exists;
+	uint64_t		ino, size, mtime_sec;
+	uint32_t		mtime_nsec;
+	struct cache_stamp	*next;
+};
+
+struct cache_io {
+	FILE	*f;
+	bool	err;
+};
+
+static struct cache_stamp *cache_stamps;
+static bool cache_disabled;
+
+static void cache_stat(struct cache_stamp *cs, const char *fname)
+{
+	struct stat st;
+
+	memset(cs, 0, sizeof(*cs));
+	if (stat(fname, &st))
+		return;
+
+	cs->exists = 1;
+	cs->ino = st.st_ino;
+	cs->size = st.st_size;
+	cs->mtime_sec = st.st_mtim.tv_sec;
+	cs->mtime_nsec = st.st_mtim.tv_nsec;
+}
+
+/*
+ * Records a file the cache depends on. Relative names would depend on the
+ * working directory, so they disable the cache.
+ */
+static void cache_add_stamp(const char *fname)
+{
+	struct cache_stamp *cs;
+
+	if (fname[0] != '/') {
+		cache_disabled = true;
+		return;
+	}
+
+	cs = malloc(sizeof(*cs));
+	if (!cs) {
+		cache_disabled = true;
+		return;
+	}
+	cache_stat(cs, fname);
+	cs->fname = strdup(fname);
+	cs->next = cache_stamps;
+	cache_stamps = cs;
+}
+
+static void cache_put(struct cache_io *c, const void *p, size_t size)
+{
+	if (!c->err && size && fwrite(p, size, 1, c->f) != 1)
+		c->err = true;
+}
+
+static void cache_put_u32(struct cache_io *c, uint32_t v)
+{
+	cache_put(c, &v, sizeof(v));
+}
+
+static void cache_put_u64(struct cache_io *c, uint64_t v)
+{
+	cache_put(c, &v, sizeof(v));
+}
+
+static void cache_put_str(struct cache_io *c, const char *s)
+{
+	if (!s) {
+		cache_put_u32(c, UINT32_MAX);
+		return;
+	}
+	cache_put_u32(c, strlen(s));
+	cache_put(c, s, strlen(s));
+}
+
+static void cache_get(struct cache_io *c, void *p, size_t size)
+{
+	if (!c->err && size && fread(p, size, 1, c->f) != 1)
+		c->err = true;
+	if (c->err)
+		memset(p, 0, size);
+}
+
+static uint32_t cache_get_u32(struct cache_io *c)
+{
+	uint32_t v;
+
+	cache_get(c, &v, sizeof(v));
+	return v;
+}
+
+static uint64_t cache_get_u64(struct cache_io *c)
+{
+	uint64_t v;
+
+	cache_get(c, &v, sizeof(v));
+	return v;
+}
+
+static uint32_t cache_get_len(struct cache_io *c)
+{
+	uint32_t len = cache_get_u32(c);
+
+	if (len > KEYMAP_CACHE_MAX_LEN)
+		c->err = true;
+	return c->err ? 0 : len;
+}
+
+static char *cache_get_str(struct cache_io *c)
+{
+	uint32_t len = cache_get_u32(c);
+	char *s;
+
+	if (c->err || len == UINT32_MAX)
+		return NULL;
+	if (len > KEYMAP_CACHE_MAX_LEN) {
+		c->err = true;
+		return NULL;
+	}
+	s = malloc(len + 1);
+	if (!s) {
+		c->err = true;
+		return NULL;
+	}
+	cache_get(c, s, len);
+	s[len] = '\0';
+	return s;
+}
+
+/* Compares a stored string, which may be NULL */
+static bool cache_get_match(struct cache_io *c, const char *s)
+{
+	char *p = cache_get_str(c);
+	bool match = !c->err && (p && s ? !strcmp(p, s) : p == s);
+
+	free(p);
+	return match;
+}
+
+static char *keymap_cache_name(struct rc_device *rc_dev)
+{
+	char *p, *s;
+
+	if (asprintf(&p, IR_KEYTABLE_CACHE_DIR "/%s:%s",
+		     rc_dev->drv_name ? rc_dev->drv_name : "",
+		     rc_dev->keytable_name ? rc_dev->keytable_name : "") < 0)
+		return NULL;
+
+	for (s = p + strlen(IR_KEYTABLE_CACHE_DIR) + 1; *s; s++)
+		if (*s == '/')
+			*s = '_';
+	return p;
+}
+
+static void free_auto_load(void)
+{
+	while (keytable) {
+		struct keytable_entry *ke = keytable;
+
+		keytable = ke->next;
+		free(ke);
+	}
+	while (rawtable) {
+		struct raw_entry *re = rawtable;
+
+		rawtable = re->next;
+		free(re->keycode);
+		free(re);
+	}
+	while (bpf_protocol) {
+		struct bpf_protocol *b = bpf_protocol;
+
+		bpf_protocol = b->next;
+		while (b->param) {
+			struct protocol_param *param = b->param;
+
+			b->param = param->next;
+			free(param->name);
+			free(param);
+		}
+		free(b->name);
+		free(b);
+	}
+	ch_proto = 0;
+	clear = 0;
+	raw_scancode = 0;
+}
+
+/*
+ * Returns the number of keymaps that matched the device, as stored at the
+ * cache, or -1 if there's no valid cache for it.
+ */
+static int read_keymap_cache(struct rc_device *rc_dev)
+{
+	struct keytable_entry **ke_tail = &keytable;
+	struct raw_entry **re_tail = &rawtable;
+	struct bpf_protocol **b_tail = &bpf_protocol;
+	struct cache_io c = {};
+	uint32_t i, j, n;
+	char *cache;
+	int matches;
+
+	/* Entries given on the command line can't come from the cache */
+	if (bpf_protocol) {
+		cache_disabled = true;
+		return -1;
+	}
+
+	cache = keymap_cache_name(rc_dev);
+	if (!cache)
+		return -1;
+	c.f = fopen(cache, "r");
+	if (!c.f) {
+		free(cache);
+		return -1;
+	}
+
+	if (cache_get_u32(&c) != KEYMAP_CACHE_MAGIC ||
+	    cache_get_u32(&c) != KEYMAP_CACHE_VERSION ||
+	    !cache_get_match(&c, V4L_UTILS_VERSION) ||
+	    !cache_get_match(&c, cfg_fname) ||
+	    !cache_get_match(&c, rc_dev->drv_name) ||
+	    !cache_get_match(&c, rc_dev->keytable_name))
+		goto miss;
+
+	n = cache_get_len(&c);
+	for (i = 0; i < n && !c.err; i++) {
+		struct cache_stamp stored, cur;
+		char *fname = cache_get_str(&c);
+
+		stored.exists = cache_get_u32(&c);
+		stored.ino = cache_get_u64(&c);
+		stored.size = cache_get_u64(&c);
+		stored.mtime_sec = cache_get_u64(&c);
+		stored.mtime_nsec = cache_get_u32(&c);
+		if (c.err || !fname) {
+			free(fname);
+			goto miss;
+		}
+
+		cache_stat(&cur, fname);
+		free(fname);
+		if (cur.exists != stored.exists || cur.ino != stored.ino ||
+		    cur.size != stored.size ||
+		    cur.mtime_sec != stored.mtime_sec ||
+		    cur.mtime_nsec != stored.mtime_nsec)
+			goto miss;
+	}
+
+	matches = cache_get_u32(&c);
+	clear = cache_get_u32(&c);
+	raw_scancode = cache_get_u32(&c);
+	ch_proto = cache_get_u32(&c);
+
+	n = cache_get_len(&c);
+	for (i = 0; i < n && !c.err; i++) {
+		struct keytable_entry *ke = calloc(1, sizeof(*ke));
+
+		if (!ke)
+			goto miss;
+		*ke_tail = ke;
+		ke_tail = &ke->next;
+		ke->scancode = cache_get_u64(&c);
+		ke->keycode = cache_get_u32(&c);
+	}
+
+	n = cache_get_len(&c);
+	for (i = 0; i < n && !c.err; i++) {
+		uint32_t raw_length;
+		uint64_t scancode;
+		struct raw_entry *re;
+
+		scancode = cache_get_u64(&c);
+		raw_length = cache_get_len(&c);
+		if (c.err || !raw_length)
+			goto miss;
+		re = calloc(1, sizeof(*re) + sizeof(re->raw[0]) * raw_length);
+		if (!re)
+			goto miss;
+		*re_tail = re;
+		re_tail = &re->next;
+		re->scancode = scancode;
+		re->raw_length = raw_length;
+		re->keycode = cache_get_str(&c);
+		cache_get(&c, re->raw, sizeof(re->raw[0]) * raw_length);
+	}
+
+	n = cache_get_len(&c);
+	for (i = 0; i < n && !c.err; i++) {
+		struct protocol_param **p_tail;
+		struct bpf_protocol *b = calloc(1, sizeof(*b));
+
+		if (!b)
+			goto miss;
+		*b_tail = b;
+		b_tail = &b->next;
+		b->name = cache_get_str(&c);
+		if (!b->name)
+			goto miss;
+
+		p_tail = &b->param;
+		for (j = cache_get_len(&c); j && !c.err; j--) {
+			struct protocol_param *param = calloc(1, sizeof(*param));
+
+			if (!param)
+				goto miss;
+			*p_tail = param;
+			p_tail = &param->next;
+			param->name = cache_get_str(&c);
+			param->value = (int64_t)cache_get_u64(&c);
+			if (!param->name)
+				goto miss;
+		}
+	}
+
+	if (c.err || fgetc(c.f) != EOF)
+		goto miss;
+
+	if (debug)
+		fprintf(stderr, _("Using cached keymaps from %s\n"), cache);
+
+	fclose(c.f);
+	free(cache);
+	return matches;
+
+miss:
+	free_auto_load();
+	fclose(c.f);
+	free(cache);
+	return -1;
+}
+
+/*
+ * Stores the result of auto-load on the cache. Failures are silently
+ * ignored, as the cache directory may not be writable.
+ */
+static void write_keymap_cache(struct rc_device *rc_dev, int matches)
+{
+	struct keytable_entry *ke;
+	struct raw_entry *re;
+	struct bpf_protocol *b;
+	struct protocol_param *param;
+	struct cache_stamp *cs;
+	struct cache_io c = {};
+	char *cache, *tmp;
+	uint32_t n;
+	int fd;
+
+	if (cache_disabled)
+		return;
+
+	cache = keymap_cache_name(rc_dev);
+	if (!cache)
+		return;
+	if (asprintf(&tmp, "%s.XXXXXX", cache) < 0) {
+		free(cache);
+		return;
+	}
+
+	mkdir(IR_KEYTABLE_CACHE_DIR, 0755);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	fchmod(fd, 0644);
+	c.f = fdopen(fd, "w");
+	if (!c.f) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	cache_put_u32(&c, KEYMAP_CACHE_MAGIC);
+	cache_put_u32(&c, KEYMAP_CACHE_VERSION);
+	cache_put_str(&c, V4L_UTILS_VERSION);
+	cache_put_str(&c, cfg_fname);
+	cache_put_str(&c, rc_dev->drv_name);
+	cache_put_str(&c, rc_dev->keytable_name);
+
+	for (n = 0, cs = cache_stamps; cs; cs = cs->next)
+		n++;
+	cache_put_u32(&c, n);
+	for (cs = cache_stamps; cs; cs = cs->next) {
+		cache_put_str(&c, cs->fname);
+		cache_put_u32(&c, cs->exists);
+		cache_put_u64(&c, cs->ino);
+		cache_put_u64(&c, cs->size);
+		cache_put_u64(&c, cs->mtime_sec);
+		cache_put_u32(&c, cs->mtime_nsec);
+	}
+
+	cache_put_u32(&c, matches);
+	cache_put_u32(&c, clear);
+	cache_put_u32(&c, raw_scancode);
+	cache_put_u32(&c, ch_proto);
+
+	for (n = 0, ke = keytable; ke; ke = ke->next)
+		n++;
+	cache_put_u32(&c, n);
+	for (ke = keytable; ke; ke = ke->next) {
+		cache_put_u64(&c, ke->scancode);
+		cache_put_u32(&c, ke->keycode);
+	}
+
+	for (n = 0, re = rawtable; re; re = re->next)
+		n++;
+	cache_put_u32(&c, n);
+	for (re = rawtable; re; re = re->next) {
+		cache_put_u64(&c, re->scancode);
+		cache_put_u32(&c, re->raw_length);
+		cache_put_str(&c, re->keycode);
+		cache_put(&c, re->raw, sizeof(re->raw[0]) * re->raw_length);
+	}
+
+	for (n = 0, b = bpf_protocol; b; b = b->next)
+		n++;
+	cache_put_u32(&c, n);
+	for (b = bpf_protocol; b; b = b->next) {
+		cache_put_str(&c, b->name);
+		for (n = 0, param = b->param; param; param = param->next)
+			n++;
+		cache_put_u32(&c, n);
+		for (param = b->param; param; param = param->next) {
+			cache_put_str(&c, param->name);
+			cache_put_u64(&c, param->value);
+		}
+	}
+
+	if (fclose(c.f))
+		c.err = true;
+	if (c.err || rename(tmp, cache))
+		unlink(tmp);
+out:
+	free(tmp);
+	free(cache);
+}
+#else
+static void cache_add_stamp(const char *fname)
+{
+}
+
+static int read_keymap_cache(struct rc_device *rc_dev)
+{
+	return -1;
+}
+
+static void write_keymap_cache(struct rc_device *rc_dev, int matches)
+{
+}
+#endif
+
 int main(int argc, char *argv[])
 {
 	int dev_from_class = 0, write_cnt;
@@ -2074,7 +2759,7 @@ int main(int argc, char *argv[])
 		return 0;
 
 	/* Just list all devices */
-	if (!clear && !readtable && !keytable && !ch_proto && !cfg.next && !test && delay < 0 && period < 0 && !bpf_protocol) {
+	if (!clear && !readtable && !keytable && !ch_proto && !cfg_fname && !test && delay < 0 && period < 0 && !bpf_protocol) {
 		if (show_sysfs_attribs(&rc_dev, devclass))
 			return -1;
 
@@ -2084,7 +2769,7 @@ int main(int argc, char *argv[])
 	if (!devclass)
 		devclass = "rc0";
 
-	if (cfg.next && (clear || keytable || ch_proto)) {
+	if (cfg_fname && (clear || keytable || ch_proto)) {
 		fprintf (stderr, _("Auto-mode can be used only with --read, --verbose and --sysdev options\n"));
 		return -1;
 	}
@@ -2102,39 +2787,55 @@ int main(int argc, char *argv[])
 
 	dev_from_class++;
 
-	if (cfg.next) {
+	if (cfg_fname) {
 		struct cfgfile *cur;
 		struct keymap *map;
 		char *fname;
 		int rc;
-		int matches = 0;
+		int matches;
 
-		for (cur = &cfg; cur->next; cur = cur->next) {
-			if ((!rc_dev.drv_name || strcasecmp(cur->driver, rc_dev.drv_name)) && strcasecmp(cur->driver, "*"))
-				continue;
-			if ((!rc_dev.keytable_name || strcasecmp(cur->table, rc_dev.keytable_name)) && strcasecmp(cur->table, "*"))
-				continue;
-
-			if (debug)
-				fprintf(stderr, _("Keymap for %s, %s is on %s file.\n"),
-					rc_dev.drv_name, rc_dev.keytable_name,
-					cur->fname);
+		matches = read_keymap_cache(&rc_dev);
+		if (matches < 0) {
+			matches = 0;
 
-			fname = keymap_to_filename(cur->fname);
-			if (!fname)
+			cache_add_stamp(cfg_fname);
+			cache_add_stamp(IR_KEYTABLE_USER_DIR);
+			cache_add_stamp(IR_KEYTABLE_SYSTEM_DIR);
+			if (parse_cfgfile(cfg_fname)) {
+				fprintf(stderr, _("Failed to read config file %s\n"), cfg_fname);
 				return -1;
+			}
 
-			rc = parse_keymap(fname, &map, debug);
-			if (rc < 0) {
-				fprintf(stderr, _("Can't load %s keymap\n"), fname);
+			for (cur = &cfg; cur->next; cur = cur->next) {
+				if ((!rc_dev.drv_name || strcasecmp(cur->driver, rc_dev.drv_name)) && strcasecmp(cur->driver, "*"))
+					continue;
+				if ((!rc_dev.keytable_name || strcasecmp(cur->table, rc_dev.keytable_name)) && strcasecmp(cur->table, "*"))
+					continue;
+
+				if (debug)
+					fprintf(stderr, _("Keymap for %s, %s is on %s file.\n"),
+						rc_dev.drv_name, rc_dev.keytable_name,
+						cur->fname);
+
+				fname = keymap_to_filename(cur->fname);
+				if (!fname)
+					return -1;
+
+				cache_add_stamp(fname);
+				rc = parse_keymap(fname, &map, debug);
+				if (rc < 0) {
+					fprintf(stderr, _("Can't load %s keymap\n"), fname);
+					free(fname);
+					return -1;
+				}
+				add_keymap(map, fname);
+				free_keymap(map);
 				free(fname);
-				return -1;
+				clear = 1;
+				matches++;
 			}
-			add_keymap(map, fname);
-			free_keymap(map);
-			free(fname);
-			clear = 1;
-			matches++;
+
+			write_keymap_cache(&rc_dev, matches);
 		}
 
 		if (!matches) {
@@ -2158,17 +2859,24 @@ int main(int argc, char *argv[])
 		return -1;
 
 	/*
-	 * First step: clear, if --clear is specified
+	 * First step: clear, if --clear is specified, and
+	 * second step: stores key tables from file or from commandline.
+	 * When the device table can be read, only the entries that differ
+	 * from the current one are changed.
 	 */
-	if (clear) {
-		clear_table(fd);
-		fprintf(stderr, _("Old keytable cleared\n"));
+	write_cnt = -1;
+	if (input_protocol_version >= 0x10001 && (clear || keytable))
+		write_cnt = sync_keys(fd, clear);
+	if (write_cnt >= 0) {
+		if (clear)
+			fprintf(stderr, _("Old keytable cleared\n"));
+	} else {
+		if (clear) {
+			clear_table(fd);
+			fprintf(stderr, _("Old keytable cleared\n"));
+		}
+		write_cnt = add_keys(fd);
 	}
-
-	/*
-	 * Second step: stores key tables from file or from commandline
-	 */
-	write_cnt = add_keys(fd);
 	if (write_cnt)
 		fprintf(stderr, _("Wrote %d keycode(s) to driver\n"), write_cnt);
 
@@ -89,7 +89,7 @@ sub process_func
 		}
 		if (@args == 0) {
 			$logswitch .= "\tcase $cec_msg:\n";
-			$logswitch .= "\t\tprintf(\"$msg_name (0x%02x)\\n\", $cec_msg);\n";
+			$logswitch .= "\t\tlog_printf(\"$msg_name (0x%02x)\\n\", $cec_msg);\n";
 			$logswitch .= "\t\tbreak;\n\n";
 		} else {
 			$logswitch .= "\tcase $cec_msg: {\n";
@@ -133,7 +133,7 @@ sub process_func
 				}
 			}
 			$logswitch .= ");\n";
-			$logswitch .= "\t\tprintf(\"$msg_name (0x%02x):\\n\", $cec_msg);\n";
+			$logswitch .= "\t\tlog_printf(\"$msg_name (0x%02x):\\n\", $cec_msg);\n";
 			if ($cdc_case) {
 				$logswitch .= "\t\tlog_arg(&arg_phys_addr, \"phys-addr\", phys_addr);\n";
 			}
@@ -478,7 +478,7 @@ print $fh <<'EOF';
 void cec_log_msg(const struct cec_msg *msg)
 {
 	if (msg->len == 1) {
-		printf("POLL\n");
+		log_printf("POLL\n");
 		goto status;
 	}
 
@@ -500,14 +500,14 @@ print $fh <<'EOF';
 status:
 	if ((msg->tx_status && !(msg->tx_status & CEC_TX_STATUS_OK)) ||
 	    (msg->rx_status && !(msg->rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT))))
-		printf("\t%s\n", cec_status2s(*msg).c_str());
+		log_printf("\t%s\n", cec_status2s(*msg).c_str());
 }
 
 static void log_htng_msg(const struct cec_msg *msg)
 {
 	if ((msg->tx_status && !(msg->tx_status & CEC_TX_STATUS_OK)) ||
 	    (msg->rx_status && !(msg->rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT))))
-		printf("\t%s\n", cec_status2s(*msg).c_str());
+		log_printf("\t%s\n", cec_status2s(*msg).c_str());
 
 	if (msg->len < 6)
 		return;
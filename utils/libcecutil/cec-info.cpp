@@ -6,6 +6,8 @@
  */
 
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 
 #include <dirent.h>
@@ -493,6 +495,23 @@ void cec_driver_info(const struct cec_caps &caps,
 	}
 }
 
+static bool cec_device_matches(const std::string &devname,
+			       const char *driver, const char *adapter)
+{
+	struct cec_caps caps;
+	int fd;
+
+	fd = open(devname.c_str(), O_RDWR);
+	if (fd < 0)
+		return false;
+	int err = ioctl(fd, CEC_ADAP_G_CAPS, &caps);
+	close(fd);
+	if (err)
+		return false;
+	return (!driver || !strcmp(driver, caps.driver)) &&
+	       (!adapter || !strcmp(adapter, caps.name));
+}
+
 std::string cec_device_find(const char *driver, const char *adapter)
 {
 	DIR *dp;
@@ -507,20 +526,9 @@ std::string cec_device_find(const char *driver, const char *adapter)
 	while ((ep = readdir(dp)))
 		if (!memcmp(ep->d_name, "cec", 3) && isdigit(ep->d_name[3])) {
 			std::string devname("/dev/");
-			struct cec_caps caps;
-			int fd;
 
 			devname += ep->d_name;
-			fd = open(devname.c_str(), O_RDWR);
-
-			if (fd < 0)
-				continue;
-			int err = ioctl(fd, CEC_ADAP_G_CAPS, &caps);
-			close(fd);
-			if (err)
-				continue;
-			if ((!driver || !strcmp(driver, caps.driver)) &&
-			    (!adapter || !strcmp(adapter, caps.name))) {
+			if (cec_device_matches(devname, driver, adapter)) {
 				name = devname;
 				break;
 			}
@@ -528,3 +536,30 @@ std::string cec_device_find(const char *driver, const char *adapter)
 	closedir(dp);
 	return name;
 }
+
+std::vector<std::string> cec_devices_find(const char *driver, const char *adapter)
+{
+	std::vector<std::string> names;
+	struct dirent **namelist;
+	int n;
+
+	n = scandir("/dev", &namelist, nullptr, versionsort);
+	if (n < 0) {
+		perror("Couldn't open the directory");
+		return names;
+	}
+	for (int i = 0; i < n; i++) {
+		const char *d_name = namelist[i]->d_name;
+
+		if (!memcmp(d_name, "cec", 3) && isdigit(d_name[3])) {
+			std::string devname("/dev/");
+
+			devname += d_name;
+			if (cec_device_matches(devname, driver, adapter))
+				names.push_back(devname);
+		}
+		free(namelist[i]);
+	}
+	free(namelist);
+	return names;
+}
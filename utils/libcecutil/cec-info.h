@@ -8,6 +8,9 @@
 #ifndef _CEC_INFO_H_
 #define _CEC_INFO_H_
 
+#include <string>
+#include <vector>
+
 #include <linux/cec.h>
 
 #define cec_phys_addr_exp(pa) \
@@ -31,5 +34,6 @@ void cec_driver_info(const struct cec_caps &caps,
 		     const struct cec_connector_info &conn_info);
 
 std::string cec_device_find(const char *driver, const char *adapter);
+std::vector<std::string> cec_devices_find(const char *driver, const char *adapter);
 
 #endif
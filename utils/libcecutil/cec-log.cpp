@@ -3,6 +3,7 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <cstdarg>
 #include <string>
 
 #include <unistd.h>
@@ -30,6 +31,36 @@ static const struct cec_arg arg_string = {
 	CEC_ARG_TYPE_STRING,
 };
 
+/*
+ * The log functions write to stdout, or to the buffer given to
+ * cec_log_msg_buf(). Formatting into that buffer doesn't allocate
+ * (except for the rarely shown transmit/receive error status).
+ */
+static char *log_buf;
+static size_t log_buf_size;
+static size_t log_buf_len;
+
+static void __attribute__((format(printf, 1, 2))) log_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (!log_buf) {
+		vprintf(fmt, ap);
+	} else {
+		int len;
+
+		if (log_buf_len < log_buf_size)
+			len = vsnprintf(log_buf + log_buf_len,
+					log_buf_size - log_buf_len, fmt, ap);
+		else
+			len = vsnprintf(nullptr, 0, fmt, ap);
+		if (len > 0)
+			log_buf_len += len;
+	}
+	va_end(ap);
+}
+
 static void log_arg(const struct cec_arg *arg, const char *arg_name, __u32 val)
 {
 	unsigned i;
@@ -38,7 +69,7 @@ static void log_arg(const struct cec_arg *arg, const char *arg_name, __u32 val)
 	case CEC_ARG_TYPE_ENUM:
 		for (i = 0; i < arg->num_enum_values; i++) {
 			if (arg->values[i].value == val) {
-				printf("\t%s: %s (0x%02x)\n", arg_name,
+				log_printf("\t%s: %s (0x%02x)\n", arg_name,
 				       arg->values[i].type_name, val);
 				return;
 			}
@@ -47,31 +78,31 @@ static void log_arg(const struct cec_arg *arg, const char *arg_name, __u32 val)
 	case CEC_ARG_TYPE_U8:
 		if (!strcmp(arg_name, "video-latency") ||
 		    !strcmp(arg_name, "audio-out-delay")) {
-			printf("\t%s: %u (0x%02x, %d ms)\n", arg_name, val, val,
+			log_printf("\t%s: %u (0x%02x, %d ms)\n", arg_name, val, val,
 			       (val - 1) * 2);
 		} else if (!strcmp(arg_name, "abort-msg")) {
 			if (cec_opcode2s(val))
-				printf("\t%s: %u (0x%02x, %s)\n",
+				log_printf("\t%s: %u (0x%02x, %s)\n",
 				       arg_name, val, val, cec_opcode2s(val));
 			else
-				printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
+				log_printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
 		} else {
-			printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
+			log_printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
 		}
 		return;
 	case CEC_ARG_TYPE_U16:
 		if (strstr(arg_name, "phys-addr"))
-			printf("\t%s: %x.%x.%x.%x\n", arg_name, cec_phys_addr_exp(val));
+			log_printf("\t%s: %x.%x.%x.%x\n", arg_name, cec_phys_addr_exp(val));
 		else
-			printf("\t%s: %u (0x%04x)\n", arg_name, val, val);
+			log_printf("\t%s: %u (0x%04x)\n", arg_name, val, val);
 		return;
 	case CEC_ARG_TYPE_U32:
-		printf("\t%s: %u (0x%08x)\n", arg_name, val, val);
+		log_printf("\t%s: %u (0x%08x)\n", arg_name, val, val);
 		return;
 	default:
 		break;
 	}
-	printf("\t%s: unknown type\n", arg_name);
+	log_printf("\t%s: unknown type\n", arg_name);
 }
 
 static void log_arg(const struct cec_arg *arg, const char *arg_name,
@@ -79,12 +110,12 @@ static void log_arg(const struct cec_arg *arg, const char *arg_name,
 {
 	switch (arg->type) {
 	case CEC_ARG_TYPE_STRING:
-		printf("\t%s: %s\n", arg_name, s);
+		log_printf("\t%s: %s\n", arg_name, s);
 		return;
 	default:
 		break;
 	}
-	printf("\t%s: unknown type\n", arg_name);
+	log_printf("\t%s: unknown type\n", arg_name);
 }
 
 static const struct cec_arg_enum_values type_rec_src_type[] = {
@@ -232,9 +263,9 @@ static void log_vendor_id(const char *arg_name, __u32 vendor_id)
 	const char *vendor = cec_vendor2s(vendor_id);
 
 	if (vendor)
-		printf("\t%s: 0x%06x (%s)\n", arg_name, vendor_id, vendor);
+		log_printf("\t%s: 0x%06x (%s)\n", arg_name, vendor_id, vendor);
 	else
-		printf("\t%s: 0x%06x, %u\n", arg_name, vendor_id, vendor_id);
+		log_printf("\t%s: 0x%06x, %u\n", arg_name, vendor_id, vendor_id);
 }
 
 static void log_descriptors(const char *arg_name, unsigned num, const __u32 *descriptors)
@@ -257,13 +288,13 @@ static void log_htng_unknown_msg(const struct cec_msg *msg)
 	unsigned i;
 
 	cec_ops_vendor_command_with_id(msg, &vendor_id, &size, &bytes);
-	printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
+	log_printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
 	       CEC_MSG_VENDOR_COMMAND_WITH_ID);
 	log_vendor_id("vendor-id", vendor_id);
-	printf("\tvendor-specific-data:");
+	log_printf("\tvendor-specific-data:");
 	for (i = 0; i < size; i++)
-		printf(" 0x%02x", bytes[i]);
-	printf("\n");
+		log_printf(" 0x%02x", bytes[i]);
+	log_printf("\n");
 }
 
 static void log_unknown_msg(const struct cec_msg *msg)
@@ -276,13 +307,13 @@ static void log_unknown_msg(const struct cec_msg *msg)
 
 	switch (msg->msg[1]) {
 	case CEC_MSG_VENDOR_COMMAND:
-		printf("VENDOR_COMMAND (0x%02x):\n",
+		log_printf("VENDOR_COMMAND (0x%02x):\n",
 		       CEC_MSG_VENDOR_COMMAND);
 		cec_ops_vendor_command(msg, &size, &bytes);
-		printf("\tvendor-specific-data:");
+		log_printf("\tvendor-specific-data:");
 		for (i = 0; i < size; i++)
-			printf(" 0x%02x", bytes[i]);
-		printf("\n");
+			log_printf(" 0x%02x", bytes[i]);
+		log_printf("\n");
 		break;
 	case CEC_MSG_VENDOR_COMMAND_WITH_ID:
 		cec_ops_vendor_command_with_id(msg, &vendor_id, &size, &bytes);
@@ -291,45 +322,65 @@ static void log_unknown_msg(const struct cec_msg *msg)
 			log_htng_msg(msg);
 			break;
 		default:
-			printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
+			log_printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
 			       CEC_MSG_VENDOR_COMMAND_WITH_ID);
 			log_vendor_id("vendor-id", vendor_id);
-			printf("\tvendor-specific-data:");
+			log_printf("\tvendor-specific-data:");
 			for (i = 0; i < size; i++)
-				printf(" 0x%02x", bytes[i]);
-			printf("\n");
+				log_printf(" 0x%02x", bytes[i]);
+			log_printf("\n");
 			break;
 		}
 		break;
 	case CEC_MSG_VENDOR_REMOTE_BUTTON_DOWN:
-		printf("VENDOR_REMOTE_BUTTON_DOWN (0x%02x):\n",
+		log_printf("VENDOR_REMOTE_BUTTON_DOWN (0x%02x):\n",
 		       CEC_MSG_VENDOR_REMOTE_BUTTON_DOWN);
 		cec_ops_vendor_remote_button_down(msg, &size, &bytes);
-		printf("\tvendor-specific-rc-code:");
+		log_printf("\tvendor-specific-rc-code:");
 		for (i = 0; i < size; i++)
-			printf(" 0x%02x", bytes[i]);
-		printf("\n");
+			log_printf(" 0x%02x", bytes[i]);
+		log_printf("\n");
 		break;
 	case CEC_MSG_CDC_MESSAGE:
 		phys_addr = (msg->msg[2] << 8) | msg->msg[3];
 
-		printf("CDC_MESSAGE (0x%02x): 0x%02x:\n",
+		log_printf("CDC_MESSAGE (0x%02x): 0x%02x:\n",
 		       CEC_MSG_CDC_MESSAGE, msg->msg[4]);
 		log_arg(&arg_u16, "phys-addr", phys_addr);
-		printf("\tpayload:");
+		log_printf("\tpayload:");
 		for (i = 5; i < msg->len; i++)
-			printf(" 0x%02x", msg->msg[i]);
-		printf("\n");
+			log_printf(" 0x%02x", msg->msg[i]);
+		log_printf("\n");
 		break;
 	default:
-		printf("UNKNOWN (0x%02x)%s", msg->msg[1], msg->len > 2 ? ":\n\tpayload:" : "");
+		log_printf("UNKNOWN (0x%02x)%s", msg->msg[1], msg->len > 2 ? ":\n\tpayload:" : "");
 		for (i = 2; i < msg->len; i++)
-			printf(" 0x%02x", msg->msg[i]);
-		printf("\n");
+			log_printf(" 0x%02x", msg->msg[i]);
+		log_printf("\n");
 		break;
 	}
 }
 
+size_t cec_log_msg_buf(char *buf, size_t size, const struct cec_msg *msg)
+{
+	char *old_buf = log_buf;
+	size_t old_size = log_buf_size;
+	size_t old_len = log_buf_len;
+	size_t len;
+
+	log_buf = buf;
+	log_buf_size = size;
+	log_buf_len = 0;
+	if (size)
+		buf[0] = 0;
+	cec_log_msg(msg);
+	len = log_buf_len;
+	log_buf = old_buf;
+	log_buf_size = old_size;
+	log_buf_len = old_len;
+	return len;
+}
+
 const char *cec_log_ui_cmd_string(__u8 ui_cmd)
 {
 	for (unsigned i = 0; i < arg_ui_cmd.num_enum_values; i++) {
@@ -37,6 +37,12 @@ struct cec_msg_args {
 
 const struct cec_msg_args *cec_log_msg_args(unsigned int index);
 void cec_log_msg(const struct cec_msg *msg);
+/*
+ * Like cec_log_msg(), but write the text into buf instead of to stdout.
+ * Returns the length of the full text, like snprintf(): if it is
+ * >= size, the text was truncated.
+ */
+size_t cec_log_msg_buf(char *buf, size_t size, const struct cec_msg *msg);
 void cec_log_htng_msg(const struct cec_msg *msg);
 const char *cec_log_ui_cmd_string(__u8 ui_cmd);
 
@@ -42,6 +42,9 @@
 struct media_device_entry {
 	char *device;
 	char *node;
+	char *syspath;			/* Canonical sysfs path of the node */
+	char *devname;			/* /dev node, as named by the kernel */
+	char *name;			/* sysfs name or model, if any */
 	enum device_type type;
 	enum bus_type bus;
 	unsigned major, minor;		/* Device major/minor */
@@ -65,13 +68,13 @@ typedef int (*fill_data_t)(struct media_device_entry *md);
 
 #define DEVICE_STR "devices"
 
-static void get_uevent_info(struct media_device_entry *md_ptr, char *dname)
+static void get_uevent_info(struct media_device_entry *md_ptr)
 {
 	FILE *fd;
 	char file[PATH_MAX + 8], *name, *p;
 	char s[1024];
 
-	snprintf(file, sizeof(file), "%s/%s/uevent", dname, md_ptr->node);
+	snprintf(file, sizeof(file), "%s/uevent", md_ptr->syspath);
 	fd = fopen(file, "r");
 	if (!fd)
 		return;
@@ -87,11 +90,43 @@ static void get_uevent_info(struct media_device_entry *md_ptr, char *dname)
 			md_ptr->major = atol(p);
 		else if (!strcmp(name, "MINOR"))
 			md_ptr->minor = atol(p);
+		else if (!strcmp(name, "DEVNAME")) {
+			free(md_ptr->devname);
+			md_ptr->devname = malloc(strlen(p) + 6);
+			if (md_ptr->devname)
+				sprintf(md_ptr->devname, "/dev/%s", p);
+		}
 	}
 
 	fclose(fd);
 }
 
+static char *get_attr(const char *syspath, const char *attr)
+{
+	char file[PATH_MAX + 16];
+	char s[256];
+	size_t len;
+	FILE *f;
+
+	snprintf(file, sizeof(file), "%s/%s", syspath, attr);
+	f = fopen(file, "r");
+	if (!f)
+		return NULL;
+	if (!fgets(s, sizeof(s), f)) {
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+
+	len = strlen(s);
+	while (len && (s[len - 1] == '\n' || s[len - 1] == ' '))
+		s[--len] = '\0';
+	if (!len)
+		return NULL;
+
+	return strdup(s);
+}
+
 static enum bus_type get_bus(char *device)
 {
 	char file[PATH_MAX + 9];
@@ -117,99 +152,147 @@ static enum bus_type get_bus(char *device)
 	return MEDIA_BUS_UNKNOWN;
 }
 
-static int get_class(char *class,
+/**
+ * struct media_class - Describes where the nodes of one kind are in sysfs
+ *
+ * @name:	class or bus name, as shown at the node's subsystem link
+ * @dir:	sysfs directory with links to all nodes of this kind
+ * @bus:	if not zero, nodes are bus devices, directly below their
+ *		parent, instead of class devices
+ * @fill:	callback that identifies the type of each node
+ */
+struct media_class {
+	const char *name;
+	const char *dir;
+	int bus;
+	fill_data_t fill;
+};
+
+static int add_entry(const struct media_class *cls,
+		     const char *fname, const char *node,
 		     struct media_device_entry **md,
-		     unsigned int *md_size,
-		     fill_data_t fill)
+		     unsigned int *md_size)
 {
-	DIR		*dir;
-	struct dirent	*entry;
-	char		dname[PATH_MAX];
-	char		fname[PATH_MAX + sizeof(entry->d_name)];
 	char		link[PATH_MAX];
 	char		virt_dev[60];
-	int		err = -2;
 	struct		media_device_entry *md_ptr = NULL;
-	char		*p, *device;
+	char		*p, *device, *syspath;
 	enum bus_type	bus;
 	static int	virtual = 0;
 
-	snprintf(dname, PATH_MAX, "/sys/class/%s", class);
-	dir = opendir(dname);
-	if (!dir) {
+	/* Canonicalize the device name */
+	if (!realpath(fname, link))
 		return 0;
+	syspath = strdup(link);
+	if (!syspath)
+		return -2;
+	device = link;
+
+	if (cls->bus) {
+		/* Bus devices are direct children of the parent device */
+		p = strrchr(device, '/');
+		if (!p)
+			goto skip;
+		*p = '\0';
+	} else {
+		/* Remove the subsystem/class_name from the string */
+		p = strstr(device, cls->name);
+		if (!p)
+			goto skip;
+		*(p - 1) = '\0';
 	}
-	for (entry = readdir(dir); entry; entry = readdir(dir)) {
-		/* Skip . and .. */
-		if (entry->d_name[0] == '.')
-			continue;
-		/* Canonicalize the device name */
-		snprintf(fname, sizeof(fname), "%s/%s", dname, entry->d_name);
-		if (realpath(fname, link)) {
-			device = link;
-
-			/* Remove the subsystem/class_name from the string */
-			p = strstr(device, class);
-			if (!p)
-				continue;
-			*(p - 1) = '\0';
 
-			bus = get_bus(device);
+	bus = get_bus(device);
 
-			/* remove the /sys/devices/ from the name */
-			device += 13;
+	/* remove the /sys/devices/ from the name */
+	device += 13;
 
-			switch (bus) {
-			case MEDIA_BUS_PCI:
-				/* Remove the device function nr */
-				p = strrchr(device, '.');
-				if (!p)
-					continue;
-				*p = '\0';
-				break;
-			case MEDIA_BUS_USB:
-				/* Remove USB interface from the path */
-				p = strrchr(device, '/');
-				if (!p)
-					continue;
-				/* In case we have a device where the driver
-				   attaches directly to the usb device rather
-				   then to an interface */
-				if (!strchr(p, ':'))
-					break;
-				*p = '\0';
-				break;
-			case MEDIA_BUS_VIRTUAL:
-				/* Don't group virtual devices */
-				sprintf(virt_dev, "virtual%d", virtual++);
-				device = virt_dev;
-				break;
-			case MEDIA_BUS_UNKNOWN:
-				break;
-			}
+	switch (bus) {
+	case MEDIA_BUS_PCI:
+		/* Remove the device function nr */
+		p = strrchr(device, '.');
+		if (!p)
+			goto skip;
+		*p = '\0';
+		break;
+	case MEDIA_BUS_USB:
+		/* Remove USB interface from the path */
+		p = strrchr(device, '/');
+		if (!p)
+			goto skip;
+		/* In case we have a device where the driver
+		   attaches directly to the usb device rather
+		   then to an interface */
+		if (!strchr(p, ':'))
+			break;
+		*p = '\0';
+		break;
+	case MEDIA_BUS_VIRTUAL:
+		/* Don't group virtual devices */
+		sprintf(virt_dev, "virtual%d", virtual++);
+		device = virt_dev;
+		break;
+	case MEDIA_BUS_UNKNOWN:
+		break;
+	}
 
-			/* Add one more element to the devices struct */
-			*md = realloc(*md, (*md_size + 1) * sizeof(*md_ptr));
-			if (!*md)
-				goto error;
-			md_ptr = (*md) + *md_size;
-			(*md_size)++;
+	/* Add one more element to the devices struct */
+	*md = realloc(*md, (*md_size + 1) * sizeof(*md_ptr));
+	if (!*md) {
+		free(syspath);
+		return -2;
+	}
+	md_ptr = (*md) + *md_size;
+	(*md_size)++;
 
-			/* Cleans previous data and fills it with device/node */
-			memset(md_ptr, 0, sizeof(*md_ptr));
-			md_ptr->type = UNKNOWN;
-			md_ptr->device = strdup(device);
-			md_ptr->node = strdup(entry->d_name);
+	/* Cleans previous data and fills it with device/node */
+	memset(md_ptr, 0, sizeof(*md_ptr));
+	md_ptr->type = UNKNOWN;
+	md_ptr->bus = bus;
+	md_ptr->device = strdup(device);
+	md_ptr->node = strdup(node);
+	md_ptr->syspath = syspath;
 
-			/* Retrieve major and minor information */
-			get_uevent_info(md_ptr, dname);
+	/* Retrieve major, minor and the device node name */
+	get_uevent_info(md_ptr);
 
-			/* Used to identify the type of node */
-			fill(md_ptr);
-		}
+	/* V4L nodes have a name, media controller nodes have a model */
+	md_ptr->name = get_attr(syspath, "name");
+	if (!md_ptr->name)
+		md_ptr->name = get_attr(syspath, "model");
+
+	/* Used to identify the type of node */
+	cls->fill(md_ptr);
+
+	return 0;
+
+skip:
+	free(syspath);
+	return 0;
+}
+
+static int get_class(const struct media_class *cls,
+		     struct media_device_entry **md,
+		     unsigned int *md_size)
+{
+	DIR		*dir;
+	struct dirent	*entry;
+	char		fname[PATH_MAX + sizeof(entry->d_name)];
+	int		err = 0;
+
+	dir = opendir(cls->dir);
+	if (!dir) {
+		return 0;
+	}
+	for (entry = readdir(dir); entry; entry = readdir(dir)) {
+		/* Skip . and .. */
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(fname, sizeof(fname), "%s/%s", cls->dir, entry->d_name);
+		err = add_entry(cls, fname, entry->d_name, md, md_size);
+		if (err)
+			break;
 	}
-	err = 0;
-error:
 	closedir(dir);
 	return err;
 }
@@ -300,6 +383,21 @@ static int add_dvb_class(struct media_device_entry *md)
 	return 0;
 }
 
+static int add_media_class(struct media_device_entry *md)
+{
+	if (!strncmp(md->node, "media", 5))
+		md->type = MEDIA_MC_MEDIA;
+
+	return 0;
+}
+
+static const struct media_class media_classes[] = {
+	{ "video4linux", "/sys/class/video4linux", 0, add_v4l_class },
+	{ "sound", "/sys/class/sound", 0, add_snd_class },
+	{ "dvb", "/sys/class/dvb", 0, add_dvb_class },
+	{ "media", "/sys/bus/media/devices", 1, add_media_class },
+};
+
 static int sort_media_device_entry(const void *a, const void *b)
 {
 	const struct media_device_entry *md_a = a;
@@ -327,6 +425,9 @@ void free_media_devices(void *opaque)
 	for (i = 0; i < md->md_size; i++) {
 		free(md_ptr->node);
 		free(md_ptr->device);
+		free(md_ptr->syspath);
+		free(md_ptr->devname);
+		free(md_ptr->name);
 		md_ptr++;
 	}
 	free(md->md_entry);
@@ -337,24 +438,27 @@ void *discover_media_devices(void)
 {
 	struct media_devices *md = NULL;
 	struct media_device_entry *md_entry = NULL;
+	unsigned int i;
 
 	md = calloc(1, sizeof(*md));
 	if (!md)
 		return NULL;
 
 	md->md_size = 0;
-	if (get_class("video4linux", &md_entry, &md->md_size, add_v4l_class))
-		goto error;
-	if (get_class("sound", &md_entry, &md->md_size, add_snd_class))
-		goto error;
-	if (get_class("dvb", &md_entry, &md->md_size, add_dvb_class))
-		goto error;
-
-	/* There's no media device */
-	if (!md_entry)
-		goto error;
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++) {
+		if (get_class(&media_classes[i], &md_entry, &md->md_size)) {
+			md->md_entry = md_entry;
+			goto error;
+		}
+	}
 
-	qsort(md_entry, md->md_size, sizeof(*md_entry), sort_media_device_entry);
+	/*
+	 * There's no media device. Still return an empty list, as
+	 * media_devices_hotplug() may add devices to it later.
+	 */
+	if (md_entry)
+		qsort(md_entry, md->md_size, sizeof(*md_entry),
+		      sort_media_device_entry);
 
 	md->md_entry = md_entry;
 
@@ -365,6 +469,131 @@ error:
 	return NULL;
 }
 
+int media_devices_hotplug(void *opaque, const char *action,
+			  const char *devpath)
+{
+	struct media_devices *md = opaque;
+	struct media_device_entry *md_ptr;
+	char syspath[PATH_MAX], subsystem[PATH_MAX + 12];
+	char link[PATH_MAX];
+	const char *node, *p;
+	unsigned int i;
+	int err;
+
+	/* udev and the kernel uevents give the path without /sys */
+	if (strncmp(devpath, "/sys/", 5))
+		snprintf(syspath, sizeof(syspath), "/sys%s", devpath);
+	else
+		snprintf(syspath, sizeof(syspath), "%s", devpath);
+
+	if (!strcmp(action, "remove")) {
+		/* The node is gone, so its path can't be canonicalized */
+		for (i = 0; i < md->md_size; i++) {
+			md_ptr = &md->md_entry[i];
+			if (!strcmp(md_ptr->syspath, syspath))
+				break;
+		}
+		if (i == md->md_size)
+			return 0;
+
+		free(md_ptr->node);
+		free(md_ptr->device);
+		free(md_ptr->syspath);
+		free(md_ptr->devname);
+		free(md_ptr->name);
+		memmove(md_ptr, md_ptr + 1,
+			(md->md_size - i - 1) * sizeof(*md_ptr));
+		md->md_size--;
+		return 1;
+	}
+
+	if (strcmp(action, "add"))
+		return 0;
+
+	if (!realpath(syspath, link))
+		return 0;
+	for (i = 0; i < md->md_size; i++)
+		if (!strcmp(md->md_entry[i].syspath, link))
+			return 0;
+
+	/* Only the nodes of the known classes and buses are indexed */
+	snprintf(subsystem, sizeof(subsystem), "%s/subsystem", link);
+	if (!realpath(subsystem, syspath))
+		return 0;
+	p = strrchr(syspath, '/');
+	if (!p)
+		return 0;
+	p++;
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++)
+		if (!strcmp(media_classes[i].name, p))
+			break;
+	if (i == ARRAY_SIZE(media_classes))
+		return 0;
+
+	node = strrchr(link, '/') + 1;
+	err = add_entry(&media_classes[i], link, node,
+			&md->md_entry, &md->md_size);
+	if (err)
+		return err;
+
+	qsort(md->md_entry, md->md_size, sizeof(*md->md_entry),
+	      sort_media_device_entry);
+
+	return 1;
+}
+
+int get_media_device_node(void *opaque, unsigned int index,
+			  struct media_device_node *node)
+{
+	struct media_devices *md = opaque;
+	struct media_device_entry *md_ptr;
+
+	if (index >= md->md_size)
+		return -1;
+
+	md_ptr = &md->md_entry[index];
+	node->device = md_ptr->device;
+	node->node = md_ptr->node;
+	node->devname = md_ptr->devname;
+	node->name = md_ptr->name;
+	node->type = md_ptr->type;
+	node->bus = md_ptr->bus;
+	node->major = md_ptr->major;
+	node->minor = md_ptr->minor;
+
+	return 0;
+}
+
+int get_media_devname(unsigned int major, unsigned int minor,
+		      char *devname, size_t size)
+{
+	struct media_device_entry md_entry;
+	char syspath[64];
+
+	/*
+	 * This is the same as the kernel gave to udev, so it doesn't
+	 * need to walk sysfs, nor /dev, nor to open anything.
+	 */
+	snprintf(syspath, sizeof(syspath), "/sys/dev/char/%u:%u",
+		 major, minor);
+
+	memset(&md_entry, 0, sizeof(md_entry));
+	md_entry.syspath = syspath;
+	get_uevent_info(&md_entry);
+	if (!md_entry.devname)
+		return -1;
+	if (md_entry.major != major || md_entry.minor != minor ||
+	    strlen(md_entry.devname) >= size) {
+		free(md_entry.devname);
+		return -1;
+	}
+
+	strcpy(devname, md_entry.devname);
+	free(md_entry.devname);
+
+	return 0;
+}
+
 const char *media_device_type(enum device_type type)
 {
 	switch(type) {
@@ -418,6 +647,10 @@ const char *media_device_type(enum device_type type)
 	case MEDIA_SND_SEQ:
 		return  "sound sequencer";
 
+		/* Media controller nodes */
+	case MEDIA_MC_MEDIA:
+		return  "media controller";
+
 	default:
 		return "unknown";
 	};
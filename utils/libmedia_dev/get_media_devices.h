@@ -17,10 +17,12 @@
    02110-1335 USA.
  */
 
+#include <stddef.h>
+
 /*
  * Version of the API
  */
-#define GET_MEDIA_DEVICES_VERSION	0x0105
+#define GET_MEDIA_DEVICES_VERSION	0x0106
 
 /**
  * enum device_type - Enumerates the type for each device
@@ -60,6 +62,8 @@ enum device_type {
 	 * FIXME: not all alsa devices were mapped. missing things like
 	 *	midi, midiC%iD%i and timer interfaces
 	 */
+
+	MEDIA_MC_MEDIA = 300,
 };
 
 enum bus_type {
@@ -69,12 +73,41 @@ enum bus_type {
 	MEDIA_BUS_USB,
 };
 
+/**
+ * struct media_device_node - Describes one node of the media devices list
+ *
+ * @device:	sysfs name for the physical device the node belongs to.
+ *		All nodes of the same device have the same name
+ * @node:	Device node, in sysfs or alsa hw identifier
+ * @devname:	Device node path at /dev, as named by the kernel, or NULL
+ * @name:	sysfs name of a V4L node or model of a media controller node,
+ *		or NULL
+ * @type:	Type of the device (V4L_*, DVB_*, SND_*, MC_*)
+ * @bus:	Bus where the physical device is
+ * @major:	Device major number
+ * @minor:	Device minor number
+ *
+ * The strings belong to the media devices list, and are valid only until
+ * it is freed or changed by media_devices_hotplug().
+ */
+struct media_device_node {
+	const char *device;
+	const char *node;
+	const char *devname;
+	const char *name;
+	enum device_type type;
+	enum bus_type bus;
+	unsigned int major, minor;
+};
+
 /**
  * discover_media_devices() - Returns a list of the media devices
  * @md_size:	Returns the size of the media devices found
  *
- * This function reads the /sys/class nodes for V4L, DVB and sound,
- * and returns an opaque desciptor that keeps a list of the devices.
+ * This function reads the /sys/class nodes for V4L, DVB and sound, and
+ * the media controller nodes at /sys/bus/media, and returns an opaque
+ * desciptor that keeps a list of the devices. Only sysfs is read: no
+ * device node is opened. If no device is found, the list is empty.
  * The fields on this list is opaque, as they can be changed on newer
  * releases of this library. So, all access to it should be done via
  * a function provided by the API. The devices are ordered by device,
@@ -168,3 +201,49 @@ const char *get_not_associated_device(void *opaque,
 				      const char *last_seek,
 				      const enum device_type desired_type,
 				      const enum device_type not_desired_type);
+
+/**
+ * media_devices_hotplug() - Updates the media devices list on hotplug
+ *
+ * @opaque:	media devices opaque descriptor
+ * @action:	uevent action, like "add" or "remove"
+ * @devpath:	uevent device path, with or without the /sys prefix
+ *
+ * Adds or removes just the node of an uevent, without scanning sysfs
+ * again, so the list can be kept as a cache by long running applications
+ * that listen to udev or kernel uevents. Other actions, and nodes that
+ * aren't V4L, DVB, sound or media controller ones, are ignored.
+ *
+ * Returns 1 if the list changed, 0 if not, or a negative value on errors.
+ */
+int media_devices_hotplug(void *opaque, const char *action,
+			  const char *devpath);
+
+/**
+ * get_media_device_node() - Returns the information about one node
+ *
+ * @opaque:	media devices opaque descriptor
+ * @index:	index of the node, starting from 0
+ * @node:	where the node information will be stored
+ *
+ * The nodes are ordered by device, type and node, so all nodes of the
+ * same physical device are consecutive. Returns 0 on success or -1 if
+ * @index is past the end of the list.
+ */
+int get_media_device_node(void *opaque, unsigned int index,
+			  struct media_device_node *node);
+
+/**
+ * get_media_devname() - Returns the /dev name of a char device
+ *
+ * @major:	device major number
+ * @minor:	device minor number
+ * @devname:	buffer where the device name will be stored
+ * @size:	size of the buffer
+ *
+ * Gets the node name that the kernel gave to udev, via sysfs, without
+ * discovering all media devices and without opening the device.
+ * Returns 0 on success or -1 if there's no such device.
+ */
+int get_media_devname(unsigned int major, unsigned int minor,
+		      char *devname, size_t size);
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +37,7 @@
 #include <linux/media.h>
 #include <linux/videodev2.h>
 
+#include "get_media_devices.h"
 #include "mediactl.h"
 #include "mediactl-priv.h"
 #include "tools.h"
@@ -44,6 +46,8 @@
  * Graph access
  */
 
+static void media_entity_lookup_devname(struct media_entity *entity);
+
 struct media_pad *media_entity_remote_source(struct media_pad *pad)
 {
 	unsigned int i;
@@ -64,11 +68,96 @@ struct media_pad *media_entity_remote_source(struct media_pad *pad)
 	return NULL;
 }
 
+static unsigned int media_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	for (; *name; ++name)
+		hash = (hash ^ (unsigned char)*name) * 16777619U;
+
+	return hash;
+}
+
+static unsigned int media_hash_id(__u32 id)
+{
+	return id * 2654435761U;
+}
+
+/*
+ * Build the entity hash tables if entities have been added since they were
+ * last built. Only the first entity with a given name or id is hashed, to
+ * return the same entity as a linear search would.
+ */
+static int media_hash_entities(struct media_device *media)
+{
+	unsigned int size = 16;
+	unsigned int mask;
+	unsigned int i, h;
+
+	if (media->entities_by_name &&
+	    media->entities_hashed == media->entities_count)
+		return 0;
+
+	while (size < media->entities_count * 2)
+		size *= 2;
+	mask = size - 1;
+
+	free(media->entities_by_name);
+	free(media->entities_by_id);
+	media->entities_by_name = calloc(size, sizeof(*media->entities_by_name));
+	media->entities_by_id = calloc(size, sizeof(*media->entities_by_id));
+	if (media->entities_by_name == NULL || media->entities_by_id == NULL) {
+		free(media->entities_by_name);
+		free(media->entities_by_id);
+		media->entities_by_name = NULL;
+		media->entities_by_id = NULL;
+		return -ENOMEM;
+	}
+
+	media->entities_hash_size = size;
+	media->entities_hashed = media->entities_count;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+		unsigned int *bucket;
+
+		for (h = media_hash_name(entity->info.name) & mask;
+		     *(bucket = &media->entities_by_name[h]); h = (h + 1) & mask)
+			if (strcmp(media->entities[*bucket - 1].info.name,
+				   entity->info.name) == 0)
+				break;
+		if (!*bucket)
+			*bucket = i + 1;
+
+		for (h = media_hash_id(entity->info.id) & mask;
+		     *(bucket = &media->entities_by_id[h]); h = (h + 1) & mask)
+			if (media->entities[*bucket - 1].info.id == entity->info.id)
+				break;
+		if (!*bucket)
+			*bucket = i + 1;
+	}
+
+	return 0;
+}
+
 struct media_entity *media_get_entity_by_name(struct media_device *media,
 					      const char *name)
 {
-	unsigned int i;
+	unsigned int i, h, mask;
+
+	if (media_hash_entities(media) == 0) {
+		mask = media->entities_hash_size - 1;
+
+		for (h = media_hash_name(name) & mask;
+		     (i = media->entities_by_name[h]); h = (h + 1) & mask) {
+			if (strcmp(media->entities[i - 1].info.name, name) == 0)
+				return &media->entities[i - 1];
+		}
+
+		return NULL;
+	}
 
+	/* Fall back to a linear search if the tables can't be allocated. */
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -83,10 +172,22 @@ struct media_entity *media_get_entity_by_id(struct media_device *media,
 					    __u32 id)
 {
 	bool next = id & MEDIA_ENT_ID_FLAG_NEXT;
-	unsigned int i;
+	unsigned int i, h, mask;
 
 	id &= ~MEDIA_ENT_ID_FLAG_NEXT;
 
+	if (!next && media_hash_entities(media) == 0) {
+		mask = media->entities_hash_size - 1;
+
+		for (h = media_hash_id(id) & mask;
+		     (i = media->entities_by_id[h]); h = (h + 1) & mask) {
+			if (media->entities[i - 1].info.id == id)
+				return &media->entities[i - 1];
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -134,6 +235,10 @@ const struct media_link *media_entity_get_link(struct media_entity *entity, unsi
 
 const char *media_entity_get_devname(struct media_entity *entity)
 {
+	/* The device node name is looked up on first use. */
+	if (entity->devname_lookup)
+		media_entity_lookup_devname(entity);
+
 	return entity->devname[0] ? entity->devname : NULL;
 }
 
@@ -315,6 +420,39 @@ static struct media_link *media_entity_add_link(struct media_entity *entity)
 	return &entity->links[entity->num_links++];
 }
 
+/* The pads may not be initialized yet, only their addresses are used. */
+static int media_entity_add_links(struct media_entity *source,
+				  unsigned int source_index,
+				  struct media_entity *sink,
+				  unsigned int sink_index, __u32 flags)
+{
+	struct media_link *fwdlink;
+	struct media_link *backlink;
+
+	fwdlink = media_entity_add_link(source);
+	if (fwdlink == NULL)
+		return -ENOMEM;
+
+	backlink = media_entity_add_link(sink);
+	if (backlink == NULL) {
+		source->num_links--;
+		return -ENOMEM;
+	}
+
+	fwdlink->source = &source->pads[source_index];
+	fwdlink->sink = &sink->pads[sink_index];
+	fwdlink->flags = flags;
+
+	backlink->source = &source->pads[source_index];
+	backlink->sink = &sink->pads[sink_index];
+	backlink->flags = flags;
+
+	fwdlink->twin = backlink;
+	backlink->twin = fwdlink;
+
+	return 0;
+}
+
 static int media_enum_links(struct media_device *media)
 {
 	__u32 id;
@@ -347,8 +485,6 @@ static int media_enum_links(struct media_device *media)
 
 		for (i = 0; i < entity->info.links; ++i) {
 			struct media_link_desc *link = &links.links[i];
-			struct media_link *fwdlink;
-			struct media_link *backlink;
 			struct media_entity *source;
 			struct media_entity *sink;
 
@@ -363,19 +499,10 @@ static int media_enum_links(struct media_device *media)
 					  link->sink.entity,
 					  link->sink.index);
 				ret = -EINVAL;
-			} else {
-				fwdlink = media_entity_add_link(source);
-				fwdlink->source = &source->pads[link->source.index];
-				fwdlink->sink = &sink->pads[link->sink.index];
-				fwdlink->flags = link->flags;
-
-				backlink = media_entity_add_link(sink);
-				backlink->source = &source->pads[link->source.index];
-				backlink->sink = &sink->pads[link->sink.index];
-				backlink->flags = link->flags;
-
-				fwdlink->twin = backlink;
-				backlink->twin = fwdlink;
+			} else if (media_entity_add_links(source, link->source.index,
+							  sink, link->sink.index,
+							  link->flags) < 0) {
+				ret = -ENOMEM;
 			}
 		}
 
@@ -453,37 +580,14 @@ static int media_get_devname_sysfs(struct media_entity *entity)
 {
 	struct stat devstat;
 	char devname[32];
-	char sysname[32];
-	char target[1024];
-	char *p;
 	int ret;
 
-	sprintf(sysname, "/sys/dev/char/%u:%u", entity->info.v4l.major,
-		entity->info.v4l.minor);
-	ret = readlink(sysname, target, sizeof(target) - 1);
+	/* The device name given by the kernel to udev, read from sysfs */
+	ret = get_media_devname(entity->info.v4l.major, entity->info.v4l.minor,
+				devname, sizeof(devname));
 	if (ret < 0)
-		return -errno;
-
-	target[ret] = '\0';
-	p = strrchr(target, '/');
-	if (p == NULL)
-		return -EINVAL;
+		return -ENOENT;
 
-	sprintf(devname, "/dev/%s", p + 1);
-	if (strstr(p + 1, "dvb")) {
-		char *s = p + 1;
-
-		if (strncmp(s, "dvb", 3))
-			return -EINVAL;
-		s += 3;
-		p = strchr(s, '.');
-		if (!p)
-			return -EINVAL;
-		*p = '/';
-		sprintf(devname, "/dev/dvb/adapter%s", s);
-	} else {
-		sprintf(devname, "/dev/%s", p + 1);
-	}
 	ret = stat(devname, &devstat);
 	if (ret < 0)
 		return -errno;
@@ -499,18 +603,62 @@ static int media_get_devname_sysfs(struct media_entity *entity)
 	return 0;
 }
 
+static void media_entity_lookup_devname(struct media_entity *entity)
+{
+	struct media_device *media = entity->media;
+
+	entity->devname_lookup = false;
+
+	if (media->udev == NULL && media_udev_open(&media->udev) < 0)
+		media_dbg(media, "Can't get udev context\n");
+
+	/* Try to get the device name via udev */
+	if (!media_get_devname_udev(media->udev, entity))
+		return;
+
+	/* Fall back to get the device name via sysfs */
+	media_get_devname_sysfs(entity);
+}
+
+static void media_entity_init(struct media_device *media,
+			      struct media_entity *entity)
+{
+	if (entity->info.flags & MEDIA_ENT_FL_DEFAULT) {
+		switch (entity->info.type) {
+		case MEDIA_ENT_T_DEVNODE_V4L:
+			media->def.v4l = entity;
+			break;
+		case MEDIA_ENT_T_DEVNODE_FB:
+			media->def.fb = entity;
+			break;
+		case MEDIA_ENT_T_DEVNODE_ALSA:
+			media->def.alsa = entity;
+			break;
+		case MEDIA_ENT_T_DEVNODE_DVB:
+			media->def.dvb = entity;
+			break;
+		}
+	}
+
+	/* Find the corresponding device name, on first use. */
+	if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
+	    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
+		return;
+
+	/* Don't try to parse empty major,minor */
+	if (!entity->info.dev.major && !entity->info.dev.minor)
+		return;
+
+	entity->devname_lookup = true;
+}
+
 static int media_enum_entities(struct media_device *media)
 {
 	struct media_entity *entity;
-	struct udev *udev;
 	unsigned int size;
 	__u32 id;
 	int ret;
 
-	ret = media_udev_open(&udev);
-	if (ret < 0)
-		media_dbg(media, "Can't get udev context\n");
-
 	for (id = 0, ret = 0; ; id = entity->info.id) {
 		size = (media->entities_count + 1) * sizeof(*media->entities);
 		media->entities = realloc(media->entities, size);
@@ -542,44 +690,317 @@ static int media_enum_entities(struct media_device *media)
 
 		media->entities_count++;
 
-		if (entity->info.flags & MEDIA_ENT_FL_DEFAULT) {
-			switch (entity->info.type) {
-			case MEDIA_ENT_T_DEVNODE_V4L:
-				media->def.v4l = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_FB:
-				media->def.fb = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_ALSA:
-				media->def.alsa = entity;
+		media_entity_init(media, entity);
+	}
+
+	return ret;
+}
+
+/* -----------------------------------------------------------------------------
+ * Topology enumeration
+ */
+
+struct media_topology_link {
+	struct media_entity *source;
+	const struct media_v2_pad *source_pad;
+	const struct media_v2_pad *sink_pad;
+	__u32 flags;
+	unsigned int order;
+};
+
+/* The media_v2_* objects all start with their id. */
+static int media_cmp_id(const void *a, const void *b)
+{
+	__u32 ida = *(const __u32 *)a;
+	__u32 idb = *(const __u32 *)b;
+
+	return ida < idb ? -1 : ida > idb;
+}
+
+/* Order the links as MEDIA_IOC_ENUM_LINKS reports them, by source entity. */
+static int media_cmp_topology_link(const void *a, const void *b)
+{
+	const struct media_topology_link *la = a;
+	const struct media_topology_link *lb = b;
+
+	if (la->source != lb->source)
+		return la->source < lb->source ? -1 : 1;
+
+	return la->order < lb->order ? -1 : la->order > lb->order;
+}
+
+/*
+ * Entities without a subdev device node can't be told apart from other
+ * entities by their interfaces. Consider them as subdevs unless they are
+ * connectors or their function is a DVB or I/O one.
+ */
+static bool media_entity_is_subdev(__u32 function, __u32 flags)
+{
+	if (flags & MEDIA_ENT_FL_CONNECTOR)
+		return false;
+
+	return function > MEDIA_ENT_F_IO_SWRADIO;
+}
+
+/*
+ * Get the entity type that MEDIA_IOC_ENUM_ENTITIES reports for a function,
+ * see media_device_enum_entities() in the kernel.
+ */
+static __u32 media_function_to_type(__u32 function, bool subdev)
+{
+	if (function >= MEDIA_ENT_F_OLD_BASE && function <= MEDIA_ENT_F_TUNER)
+		return function;
+
+	return subdev ? MEDIA_ENT_T_V4L2_SUBDEV : MEDIA_ENT_T_DEVNODE_UNKNOWN;
+}
+
+static int media_get_topology(struct media_device *media,
+			      struct media_v2_topology *topology)
+{
+	struct media_v2_entity *entities;
+	struct media_v2_interface *interfaces;
+	struct media_v2_pad *pads;
+	struct media_v2_link *links;
+	int ret;
+
+	for (;;) {
+		memset(topology, 0, sizeof(*topology));
+
+		ret = ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, topology);
+		if (ret < 0)
+			return -errno;
+
+		entities = calloc(topology->num_entities + 1, sizeof(*entities));
+		interfaces = calloc(topology->num_interfaces + 1, sizeof(*interfaces));
+		pads = calloc(topology->num_pads + 1, sizeof(*pads));
+		links = calloc(topology->num_links + 1, sizeof(*links));
+
+		topology->ptr_entities = (uintptr_t)entities;
+		topology->ptr_interfaces = (uintptr_t)interfaces;
+		topology->ptr_pads = (uintptr_t)pads;
+		topology->ptr_links = (uintptr_t)links;
+
+		if (entities == NULL || interfaces == NULL || pads == NULL ||
+		    links == NULL)
+			ret = -ENOMEM;
+		else if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, topology) < 0)
+			ret = -errno;
+		else
+			return 0;
+
+		free(entities);
+		free(interfaces);
+		free(pads);
+		free(links);
+
+		/* Retry if the graph has grown in between the two calls. */
+		if (ret != -ENOSPC)
+			return ret;
+	}
+}
+
+static int media_enum_topology(struct media_device *media)
+{
+	struct media_v2_topology topology;
+	struct media_v2_entity *entities;
+	struct media_v2_interface *interfaces;
+	struct media_v2_pad *pads;
+	struct media_v2_link *links;
+	struct media_topology_link *data_links = NULL;
+	unsigned int num_data_links = 0;
+	unsigned char *intf_types = NULL;
+	unsigned int i;
+	int ret;
+
+	/* The legacy entity descriptors need the entity flags and pad indexes. */
+	if (!MEDIA_V2_ENTITY_HAS_FLAGS(media->info.media_version) ||
+	    !MEDIA_V2_PAD_HAS_INDEX(media->info.media_version))
+		return -ENOTSUP;
+
+	ret = media_get_topology(media, &topology);
+	if (ret < 0)
+		return ret;
+
+	entities = (struct media_v2_entity *)(uintptr_t)topology.ptr_entities;
+	interfaces = (struct media_v2_interface *)(uintptr_t)topology.ptr_interfaces;
+	pads = (struct media_v2_pad *)(uintptr_t)topology.ptr_pads;
+	links = (struct media_v2_link *)(uintptr_t)topology.ptr_links;
+
+	/* MEDIA_IOC_ENUM_ENTITIES reports the entities by ascending id. */
+	qsort(entities, topology.num_entities, sizeof(*entities), media_cmp_id);
+	qsort(interfaces, topology.num_interfaces, sizeof(*interfaces), media_cmp_id);
+	qsort(pads, topology.num_pads, sizeof(*pads), media_cmp_id);
+
+	media->entities = calloc(topology.num_entities + 1, sizeof(*media->entities));
+	/* 0: no interface, 1: subdev interface, 2: other interface */
+	intf_types = calloc(topology.num_entities + 1, 1);
+	data_links = calloc(topology.num_links + 1, sizeof(*data_links));
+	if (media->entities == NULL || intf_types == NULL || data_links == NULL) {
+		ret = -ENOMEM;
+		goto done;
+	}
+
+	for (i = 0; i < topology.num_entities; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		entity->fd = -1;
+		entity->media = media;
+		entity->info.id = entities[i].id;
+		entity->info.flags = entities[i].flags;
+		strncpy(entity->info.name, entities[i].name,
+			sizeof(entity->info.name) - 1);
+	}
+
+	media->entities_count = topology.num_entities;
+
+	for (i = 0; i < topology.num_pads; ++i) {
+		struct media_entity *entity;
+
+		entity = media_get_entity_by_id(media, pads[i].entity_id);
+		if (entity == NULL) {
+			media_dbg(media, "WARNING pad %u of unknown entity %u!\n",
+				  pads[i].id, pads[i].entity_id);
+			ret = -EINVAL;
+			goto done;
+		}
+
+		if (pads[i].index >= entity->info.pads)
+			entity->info.pads = pads[i].index + 1;
+	}
+
+	for (i = 0; i < topology.num_links; ++i) {
+		struct media_v2_link *link = &links[i];
+		struct media_topology_link *data_link;
+		struct media_v2_interface *intf;
+		struct media_entity *entity;
+
+		switch (link->flags & MEDIA_LNK_FL_LINK_TYPE) {
+		case MEDIA_LNK_FL_DATA_LINK:
+			data_link = &data_links[num_data_links];
+			data_link->source_pad = bsearch(&link->source_id, pads,
+							topology.num_pads,
+							sizeof(*pads), media_cmp_id);
+			data_link->sink_pad = bsearch(&link->sink_id, pads,
+						      topology.num_pads,
+						      sizeof(*pads), media_cmp_id);
+			if (data_link->source_pad == NULL ||
+			    data_link->sink_pad == NULL) {
+				media_dbg(media,
+					  "WARNING link %u from pad %u to pad %u is invalid!\n",
+					  link->id, link->source_id, link->sink_id);
+				ret = -EINVAL;
 				break;
-			case MEDIA_ENT_T_DEVNODE_DVB:
-				media->def.dvb = entity;
+			}
+
+			data_link->source = media_get_entity_by_id(media,
+					data_link->source_pad->entity_id);
+			data_link->flags = link->flags & ~MEDIA_LNK_FL_LINK_TYPE;
+			data_link->order = i;
+			data_link->source->info.links++;
+			num_data_links++;
+			break;
+
+		case MEDIA_LNK_FL_INTERFACE_LINK:
+			intf = bsearch(&link->source_id, interfaces,
+				       topology.num_interfaces,
+				       sizeof(*interfaces), media_cmp_id);
+			entity = media_get_entity_by_id(media, link->sink_id);
+			if (intf == NULL || entity == NULL)
 				break;
+
+			if (!intf_types[entity - media->entities]) {
+				entity->info.dev.major = intf->devnode.major;
+				entity->info.dev.minor = intf->devnode.minor;
 			}
+			if (intf->intf_type == MEDIA_INTF_T_V4L_SUBDEV)
+				intf_types[entity - media->entities] = 1;
+			else if (!intf_types[entity - media->entities])
+				intf_types[entity - media->entities] = 2;
+			break;
 		}
+	}
 
-		/* Find the corresponding device name. */
-		if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
-		    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
-			continue;
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+		bool subdev;
 
-		/* Don't try to parse empty major,minor */
-		if (!entity->info.dev.major && !entity->info.dev.minor)
-			continue;
+		subdev = intf_types[i] == 1 ||
+			 (!intf_types[i] &&
+			  media_entity_is_subdev(entities[i].function,
+						 entities[i].flags));
+		entity->info.type = media_function_to_type(entities[i].function, subdev);
 
-		/* Try to get the device name via udev */
-		if (!media_get_devname_udev(udev, entity))
-			continue;
+		entity->max_links = entity->info.pads + entity->info.links;
+		entity->pads = calloc(entity->info.pads, sizeof(*entity->pads));
+		entity->links = malloc(entity->max_links * sizeof(*entity->links));
+		if (entity->pads == NULL || entity->links == NULL) {
+			ret = -ENOMEM;
+			goto done;
+		}
+
+		media_entity_init(media, entity);
+	}
+
+	for (i = 0; i < topology.num_pads; ++i) {
+		struct media_entity *entity;
+		struct media_pad *pad;
 
-		/* Fall back to get the device name via sysfs */
-		media_get_devname_sysfs(entity);
+		entity = media_get_entity_by_id(media, pads[i].entity_id);
+		pad = &entity->pads[pads[i].index];
+		pad->entity = entity;
+		pad->index = pads[i].index;
+		pad->flags = pads[i].flags;
 	}
 
-	media_udev_close(udev);
+	qsort(data_links, num_data_links, sizeof(*data_links),
+	      media_cmp_topology_link);
+
+	for (i = 0; i < num_data_links; ++i) {
+		struct media_topology_link *link = &data_links[i];
+		struct media_entity *sink;
+
+		sink = media_get_entity_by_id(media, link->sink_pad->entity_id);
+		if (media_entity_add_links(link->source, link->source_pad->index,
+					   sink, link->sink_pad->index,
+					   link->flags) < 0) {
+			ret = -ENOMEM;
+			goto done;
+		}
+	}
+
+done:
+	free(entities);
+	free(interfaces);
+	free(pads);
+	free(links);
+	free(data_links);
+	free(intf_types);
 	return ret;
 }
 
+static void media_free_entities(struct media_device *media)
+{
+	unsigned int i;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		free(entity->pads);
+		free(entity->links);
+		if (entity->fd != -1)
+			close(entity->fd);
+	}
+
+	free(media->entities);
+	free(media->entities_by_name);
+	free(media->entities_by_id);
+	media->entities = NULL;
+	media->entities_count = 0;
+	media->entities_by_name = NULL;
+	media->entities_by_id = NULL;
+	memset(&media->def, 0, sizeof(media->def));
+}
+
 int media_device_enumerate(struct media_device *media)
 {
 	int ret;
@@ -602,6 +1023,21 @@ int media_device_enumerate(struct media_device *media)
 		goto done;
 	}
 
+	media_dbg(media, "Enumerating the topology\n");
+
+	ret = media_enum_topology(media);
+	if (ret == 0) {
+		media_dbg(media, "Found %u entities\n", media->entities_count);
+		goto done;
+	}
+
+	if (ret != -ENOTSUP) {
+		media_dbg(media,
+			  "%s: Unable to enumerate the topology of device %s (%s)\n",
+			  __func__, media->devnode, strerror(-ret));
+		media_free_entities(media);
+	}
+
 	media_dbg(media, "Enumerating entities\n");
 
 	ret = media_enum_entities(media);
@@ -705,22 +1141,12 @@ struct media_device *media_device_ref(struct media_device *media)
 
 void media_device_unref(struct media_device *media)
 {
-	unsigned int i;
-
 	media->refcount--;
 	if (media->refcount > 0)
 		return;
 
-	for (i = 0; i < media->entities_count; ++i) {
-		struct media_entity *entity = &media->entities[i];
-
-		free(entity->pads);
-		free(entity->links);
-		if (entity->fd != -1)
-			close(entity->fd);
-	}
-
-	free(media->entities);
+	media_free_entities(media);
+	media_udev_close(media->udev);
 	free(media->devnode);
 	free(media);
 }
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -57,6 +58,9 @@ int v4l2_subdev_open(struct media_entity *entity)
 	if (entity->fd != -1)
 		return 0;
 
+	/* Look the device node name up if not done yet. */
+	media_entity_get_devname(entity);
+
 	entity->fd = open(entity->devname, O_RDWR);
 	if (entity->fd == -1) {
 		int ret = -errno;
@@ -512,7 +516,43 @@ static int v4l2_subdev_parse_setup_route(struct media_device *media,
 	return 0;
 }
 
-int v4l2_subdev_parse_setup_routes(struct media_device *media, const char *p)
+/* Check if the routing table of a subdev already holds the given routes. */
+static bool v4l2_subdev_routes_match(struct media_entity *entity,
+				     const struct v4l2_subdev_route *routes,
+				     unsigned int num_routes)
+{
+	struct v4l2_subdev_route *current;
+	unsigned int num_current;
+	unsigned int i, j;
+	bool match;
+
+	if (v4l2_subdev_get_routing(entity, &current, &num_current) < 0)
+		return false;
+
+	match = num_current == num_routes;
+	for (i = 0; match && i < num_routes; ++i) {
+		const struct v4l2_subdev_route *r = &routes[i];
+
+		for (j = 0; j < num_current; ++j) {
+			const struct v4l2_subdev_route *c = &current[j];
+
+			if (c->sink_pad == r->sink_pad &&
+			    c->sink_stream == r->sink_stream &&
+			    c->source_pad == r->source_pad &&
+			    c->source_stream == r->source_stream &&
+			    c->flags == r->flags)
+				break;
+		}
+
+		match = j < num_current;
+	}
+
+	free(current);
+	return match;
+}
+
+int v4l2_subdev_parse_routes(struct media_device *media, const char *p,
+			     unsigned int flags)
 {
 	struct media_entity *entity;
 	struct v4l2_subdev_route *routes;
@@ -565,6 +605,17 @@ int v4l2_subdev_parse_setup_routes(struct media_device *media, const char *p)
 		goto out;
 	}
 
+	ret = 0;
+	if (flags & V4L2_SUBDEV_SETUP_DRY_RUN)
+		goto out;
+
+	if ((flags & V4L2_SUBDEV_SETUP_CHANGED) &&
+	    v4l2_subdev_routes_match(entity, routes, num_routes)) {
+		media_dbg(entity->media, "Routes of %s unchanged\n",
+			  entity->info.name);
+		goto out;
+	}
+
 	for (i = 0; i < num_routes; ++i) {
 		struct v4l2_subdev_route *r = &routes[i];
 
@@ -589,6 +640,11 @@ out:
 	return ret;
 }
 
+int v4l2_subdev_parse_setup_routes(struct media_device *media, const char *p)
+{
+	return v4l2_subdev_parse_routes(media, p, 0);
+}
+
 static int v4l2_subdev_parse_format(struct media_device *media,
 				    struct v4l2_mbus_framefmt *format,
 				    const char *p, char **endp)
@@ -957,15 +1013,52 @@ static struct media_pad *v4l2_subdev_parse_pad_format(
 	return pad;
 }
 
+/*
+ * Check if the active format of a pad matches the requested one. Fields left
+ * to the driver's choice in the request match any value.
+ */
+static bool format_matches(struct media_pad *pad, unsigned int stream,
+			   struct v4l2_mbus_framefmt *format)
+{
+	struct v4l2_mbus_framefmt current;
+
+	if (v4l2_subdev_get_format(pad->entity, &current, pad->index, stream,
+				   V4L2_SUBDEV_FORMAT_ACTIVE) < 0)
+		return false;
+
+	if (current.code != format->code ||
+	    current.width != format->width ||
+	    current.height != format->height ||
+	    (format->field && current.field != format->field) ||
+	    (format->colorspace && current.colorspace != format->colorspace) ||
+	    (format->xfer_func && current.xfer_func != format->xfer_func) ||
+	    (format->ycbcr_enc && current.ycbcr_enc != format->ycbcr_enc) ||
+	    (format->quantization &&
+	     current.quantization != format->quantization))
+		return false;
+
+	*format = current;
+	return true;
+}
+
 static int set_format(struct media_pad *pad,
 		      unsigned int stream,
-		      struct v4l2_mbus_framefmt *format)
+		      struct v4l2_mbus_framefmt *format,
+		      unsigned int flags)
 {
 	int ret;
 
 	if (format->width == 0 || format->height == 0)
 		return 0;
 
+	if ((flags & V4L2_SUBDEV_SETUP_CHANGED) &&
+	    format_matches(pad, stream, format)) {
+		media_dbg(pad->entity->media,
+			  "Format on pad %s/%u/%u unchanged\n",
+			  pad->entity->info.name, pad->index, stream);
+		return 0;
+	}
+
 	media_dbg(pad->entity->media,
 		  "Setting up format %s %ux%u on pad %s/%u/%u\n",
 		  v4l2_subdev_pixelcode_to_string(format->code),
@@ -990,13 +1083,25 @@ static int set_format(struct media_pad *pad,
 }
 
 static int set_selection(struct media_pad *pad, unsigned int stream,
-			 unsigned int target, struct v4l2_rect *rect)
+			 unsigned int target, struct v4l2_rect *rect,
+			 unsigned int flags)
 {
+	struct v4l2_rect current;
 	int ret;
 
 	if (rect->left == -1 || rect->top == -1)
 		return 0;
 
+	if ((flags & V4L2_SUBDEV_SETUP_CHANGED) &&
+	    !v4l2_subdev_get_selection(pad->entity, &current, pad->index, stream,
+				       target, V4L2_SUBDEV_FORMAT_ACTIVE) &&
+	    !memcmp(&current, rect, sizeof(current))) {
+		media_dbg(pad->entity->media,
+			  "Selection target %u on pad %s/%u/%u unchanged\n",
+			  target, pad->entity->info.name, pad->index, stream);
+		return 0;
+	}
+
 	media_dbg(pad->entity->media,
 		  "Setting up selection target %u rectangle (%u,%u)/%ux%u on pad %s/%u/%u\n",
 		  target, rect->left, rect->top, rect->width, rect->height,
@@ -1019,13 +1124,25 @@ static int set_selection(struct media_pad *pad, unsigned int stream,
 }
 
 static int set_frame_interval(struct media_pad *pad, unsigned int stream,
-			      struct v4l2_fract *interval)
+			      struct v4l2_fract *interval, unsigned int flags)
 {
+	struct v4l2_fract current;
 	int ret;
 
 	if (interval->numerator == 0)
 		return 0;
 
+	if ((flags & V4L2_SUBDEV_SETUP_CHANGED) &&
+	    !v4l2_subdev_get_frame_interval(pad->entity, &current, pad->index,
+					    stream) &&
+	    (__u64)current.numerator * interval->denominator ==
+	    (__u64)interval->numerator * current.denominator) {
+		media_dbg(pad->entity->media,
+			  "Frame interval on pad %s/%u/%u unchanged\n",
+			  pad->entity->info.name, pad->index, stream);
+		return 0;
+	}
+
 	media_dbg(pad->entity->media,
 		  "Setting up frame interval %u/%u on pad %s/%u/%u\n",
 		  interval->numerator, interval->denominator,
@@ -1048,7 +1165,8 @@ static int set_frame_interval(struct media_pad *pad, unsigned int stream,
 
 
 static int v4l2_subdev_parse_setup_format(struct media_device *media,
-					  const char *p, char **endp)
+					  const char *p, char **endp,
+					  unsigned int flags)
 {
 	struct v4l2_mbus_framefmt format = { 0, 0, 0 };
 	struct media_pad *pad;
@@ -1069,27 +1187,32 @@ static int v4l2_subdev_parse_setup_format(struct media_device *media,
 		return -EINVAL;
 	}
 
+	if (flags & V4L2_SUBDEV_SETUP_DRY_RUN) {
+		*endp = end;
+		return 0;
+	}
+
 	if (pad->flags & MEDIA_PAD_FL_SINK) {
-		ret = set_format(pad, stream, &format);
+		ret = set_format(pad, stream, &format, flags);
 		if (ret < 0)
 			return ret;
 	}
 
-	ret = set_selection(pad, stream, V4L2_SEL_TGT_CROP, &crop);
+	ret = set_selection(pad, stream, V4L2_SEL_TGT_CROP, &crop, flags);
 	if (ret < 0)
 		return ret;
 
-	ret = set_selection(pad, stream, V4L2_SEL_TGT_COMPOSE, &compose);
+	ret = set_selection(pad, stream, V4L2_SEL_TGT_COMPOSE, &compose, flags);
 	if (ret < 0)
 		return ret;
 
 	if (pad->flags & MEDIA_PAD_FL_SOURCE) {
-		ret = set_format(pad, stream, &format);
+		ret = set_format(pad, stream, &format, flags);
 		if (ret < 0)
 			return ret;
 	}
 
-	ret = set_frame_interval(pad, stream, &interval);
+	ret = set_frame_interval(pad, stream, &interval, flags);
 	if (ret < 0)
 		return ret;
 
@@ -1107,9 +1230,10 @@ static int v4l2_subdev_parse_setup_format(struct media_device *media,
 			if (link->source == pad &&
 			    link->sink->entity->info.type == MEDIA_ENT_T_V4L2_SUBDEV) {
 				remote_format = format;
-				set_format(link->sink, stream, &remote_format);
+				set_format(link->sink, stream, &remote_format, flags);
 
-				ret = set_frame_interval(link->sink, stream, &interval);
+				ret = set_frame_interval(link->sink, stream, &interval,
+							 flags);
 				if (ret < 0 && ret != -EINVAL && ret != -ENOTTY)
 					return ret;
 			}
@@ -1120,13 +1244,178 @@ static int v4l2_subdev_parse_setup_format(struct media_device *media,
 	return 0;
 }
 
-int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p)
+/*
+ * Pipelines that aren't connected through enabled links don't depend on each
+ * other: their formats can be set up concurrently, which saves time when the
+ * subdevs are slow to configure (I2C sensors in multi-camera systems). The
+ * formats of each pipeline are set up in the order they are given.
+ */
+struct format_group {
+	struct media_device *media;
+	char **formats;
+	unsigned int num_formats;
+	unsigned int flags;
+	pthread_t thread;
+	bool started;
+	int ret;
+};
+
+static unsigned int entity_group_root(unsigned int *parent, unsigned int i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static void *format_group_setup(void *arg)
 {
+	struct format_group *group = arg;
+	unsigned int i;
 	char *end;
+
+	for (i = 0; i < group->num_formats; ++i) {
+		group->ret = v4l2_subdev_parse_setup_format(group->media,
+							    group->formats[i],
+							    &end, group->flags);
+		if (group->ret < 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static int v4l2_subdev_setup_formats_parallel(struct media_device *media,
+					      const char *p, unsigned int flags)
+{
+	unsigned int nents = media->entities_count;
+	struct format_group *groups = NULL;
+	unsigned int *group_of = NULL;
+	unsigned int *parent = NULL;
+	unsigned int num_groups = 0;
+	unsigned int i, j;
 	int ret;
 
+	ret = v4l2_subdev_parse_formats(media, p, V4L2_SUBDEV_SETUP_DRY_RUN);
+	if (ret < 0)
+		return ret;
+
+	parent = calloc(nents, sizeof(*parent));
+	group_of = calloc(nents, sizeof(*group_of));
+	groups = calloc(nents, sizeof(*groups));
+	if (!parent || !group_of || !groups) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Find the pipelines, connected through enabled links. */
+	for (i = 0; i < nents; ++i)
+		parent[i] = i;
+
+	for (i = 0; i < nents; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		for (j = 0; j < entity->num_links; ++j) {
+			struct media_link *link = &entity->links[j];
+			unsigned int source, sink;
+
+			if (!(link->flags & MEDIA_LNK_FL_ENABLED))
+				continue;
+
+			source = entity_group_root(parent,
+						   link->source->entity - media->entities);
+			sink = entity_group_root(parent,
+						 link->sink->entity - media->entities);
+			parent[source] = sink;
+		}
+	}
+
+	/* Split the formats between the pipelines of their pads. */
 	do {
-		ret = v4l2_subdev_parse_setup_format(media, p, &end);
+		struct format_group *group;
+		struct media_pad *pad;
+		const char *start = p;
+		char **formats;
+		char *end;
+
+		pad = media_parse_pad(media, p, NULL);
+		v4l2_subdev_parse_setup_format(media, p, &end,
+					       V4L2_SUBDEV_SETUP_DRY_RUN);
+		for (; isspace(*end); end++);
+		p = end + 1;
+
+		i = entity_group_root(parent, pad->entity - media->entities);
+		if (!group_of[i]) {
+			group_of[i] = ++num_groups;
+			groups[num_groups - 1].media = media;
+			groups[num_groups - 1].flags = flags;
+		}
+		group = &groups[group_of[i] - 1];
+
+		formats = realloc(group->formats,
+				  (group->num_formats + 1) * sizeof(*formats));
+		if (!formats) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		group->formats = formats;
+		formats[group->num_formats] = strndup(start, end - start);
+		if (!formats[group->num_formats]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		group->num_formats++;
+	} while (p[-1] == ',');
+
+	/*
+	 * Look the device node names up before starting the threads, the
+	 * lookup isn't thread-safe.
+	 */
+	for (i = 0; i < nents; ++i)
+		media_entity_get_devname(&media->entities[i]);
+
+	for (i = 1; i < num_groups; ++i) {
+		if (pthread_create(&groups[i].thread, NULL, format_group_setup,
+				   &groups[i]))
+			format_group_setup(&groups[i]);
+		else
+			groups[i].started = true;
+	}
+
+	format_group_setup(&groups[0]);
+
+	for (i = 1; i < num_groups; ++i) {
+		if (groups[i].started)
+			pthread_join(groups[i].thread, NULL);
+	}
+
+	for (i = 0; i < num_groups && !ret; ++i)
+		ret = groups[i].ret;
+
+out:
+	for (i = 0; groups && i < num_groups; ++i) {
+		for (j = 0; j < groups[i].num_formats; ++j)
+			free(groups[i].formats[j]);
+		free(groups[i].formats);
+	}
+	free(groups);
+	free(group_of);
+	free(parent);
+	return ret;
+}
+
+int v4l2_subdev_parse_formats(struct media_device *media, const char *p,
+			      unsigned int flags)
+{
+	char *end;
+	int ret;
+
+	if ((flags & V4L2_SUBDEV_SETUP_PARALLEL) &&
+	    !(flags & V4L2_SUBDEV_SETUP_DRY_RUN))
+		return v4l2_subdev_setup_formats_parallel(media, p,
+				flags & ~V4L2_SUBDEV_SETUP_PARALLEL);
+
+	do {
+		ret = v4l2_subdev_parse_setup_format(media, p, &end, flags);
 		if (ret < 0)
 			return ret;
 
@@ -1137,6 +1426,11 @@ int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p)
 	return *end ? -EINVAL : 0;
 }
 
+int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p)
+{
+	return v4l2_subdev_parse_formats(media, p, 0);
+}
+
 static const struct {
 	const char *name;
 	enum v4l2_mbus_pixelcode code;
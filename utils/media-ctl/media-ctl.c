@@ -609,6 +609,275 @@ static void media_print_topology_text(struct media_device *media)
 			media, media_get_entity(media, i));
 }
 
+/* -----------------------------------------------------------------------------
+ * Batch mode
+ */
+
+struct batch_link {
+	struct media_link *link;
+	__u32 flags;
+};
+
+struct batch {
+	bool reset;
+	struct batch_link *links;
+	unsigned int num_links;
+	char **routes;
+	unsigned int num_routes;
+	char **formats;
+	unsigned int num_formats;
+};
+
+static void batch_free(struct batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->num_routes; ++i)
+		free(batch->routes[i]);
+	for (i = 0; i < batch->num_formats; ++i)
+		free(batch->formats[i]);
+	free(batch->links);
+	free(batch->routes);
+	free(batch->formats);
+}
+
+static int batch_add_string(char ***strings, unsigned int *count, const char *p)
+{
+	char **s;
+
+	s = realloc(*strings, (*count + 1) * sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	*strings = s;
+
+	s[*count] = strdup(p);
+	if (!s[*count])
+		return -ENOMEM;
+	(*count)++;
+	return 0;
+}
+
+static int batch_parse_links(struct media_device *media, struct batch *batch,
+			     const char *p)
+{
+	struct batch_link *links;
+	struct media_link *link;
+	__u32 flags;
+	char *end;
+
+	for (;;) {
+		link = media_parse_link(media, p, &end);
+		if (!link)
+			return -EINVAL;
+
+		for (p = end; isspace(*p); p++);
+		if (*p++ != '[')
+			return -EINVAL;
+		flags = strtoul(p, &end, 10);
+		for (p = end; isspace(*p); p++);
+		if (*p++ != ']')
+			return -EINVAL;
+		for (; isspace(*p); p++);
+
+		links = realloc(batch->links,
+				(batch->num_links + 1) * sizeof(*links));
+		if (!links)
+			return -ENOMEM;
+		batch->links = links;
+		links[batch->num_links].link = link;
+		links[batch->num_links].flags = flags;
+		batch->num_links++;
+
+		if (*p != ',')
+			break;
+		p++;
+	}
+
+	return *p ? -EINVAL : 0;
+}
+
+/*
+ * Parse a batch file. Everything is validated before anything is applied,
+ * routes and formats through a dry run of their parsers.
+ */
+static int batch_parse(struct media_device *media, struct batch *batch,
+		       const char *filename)
+{
+	unsigned int lineno = 0;
+	size_t size = 0;
+	char *line = NULL;
+	FILE *f;
+	int ret = 0;
+
+	f = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+	if (!f) {
+		printf("Unable to open %s: %s\n", filename, strerror(errno));
+		return -errno;
+	}
+
+	while (getline(&line, &size, f) >= 0) {
+		char *cmd, *arg, *end;
+
+		lineno++;
+
+		for (cmd = line; isspace(*cmd); cmd++);
+		if (*cmd == '\0' || *cmd == '#')
+			continue;
+		for (end = cmd + strlen(cmd); end > cmd && isspace(end[-1]); end--);
+		*end = '\0';
+		for (arg = cmd; *arg && !isspace(*arg); arg++);
+		if (*arg)
+			*arg++ = '\0';
+		for (; isspace(*arg); arg++);
+
+		if (!strcmp(cmd, "reset") && !*arg) {
+			batch->reset = true;
+		} else if (!strcmp(cmd, "link")) {
+			ret = batch_parse_links(media, batch, arg);
+		} else if (!strcmp(cmd, "route")) {
+			ret = v4l2_subdev_parse_routes(media, arg,
+						       V4L2_SUBDEV_SETUP_DRY_RUN);
+			if (!ret)
+				ret = batch_add_string(&batch->routes,
+						       &batch->num_routes, arg);
+		} else if (!strcmp(cmd, "format")) {
+			ret = v4l2_subdev_parse_formats(media, arg,
+							V4L2_SUBDEV_SETUP_DRY_RUN);
+			if (!ret)
+				ret = batch_add_string(&batch->formats,
+						       &batch->num_formats, arg);
+		} else {
+			ret = -EINVAL;
+		}
+
+		if (ret) {
+			printf("%s:%u: unable to parse '%s%s%s'\n", filename,
+			       lineno, cmd, *arg ? " " : "", arg);
+			break;
+		}
+	}
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
+
+/* Return the last flags requested for a link, or -1 if not in the batch. */
+static int batch_link_flags(struct batch *batch, struct media_link *link)
+{
+	unsigned int i;
+
+	for (i = batch->num_links; i > 0; --i) {
+		if (batch->links[i - 1].link == link)
+			return batch->links[i - 1].flags;
+	}
+
+	return -1;
+}
+
+static int batch_setup_link(struct media_device *media,
+			    struct media_link *link, __u32 flags)
+{
+	if ((link->flags & MEDIA_LNK_FL_ENABLED) == (flags & MEDIA_LNK_FL_ENABLED))
+		return 0;
+
+	if (media_opts.verbose)
+		printf("Setting up link \"%s\":%u -> \"%s\":%u [%u]\n",
+		       media_entity_get_info(link->source->entity)->name,
+		       link->source->index,
+		       media_entity_get_info(link->sink->entity)->name,
+		       link->sink->index, flags);
+
+	return media_setup_link(media, link->source, link->sink, flags);
+}
+
+/*
+ * Apply a parsed batch, leaving the links, routes and pads whose state
+ * already matches the batch alone.
+ */
+static int batch_apply(struct media_device *media, struct batch *batch)
+{
+	unsigned int nents = media_get_entities_count(media);
+	unsigned int i, j;
+	char *formats;
+	size_t size;
+	int flags;
+	int ret;
+
+	/* Disable links first, enabling a link may require disabling others. */
+	for (i = 0; batch->reset && i < nents; ++i) {
+		struct media_entity *entity = media_get_entity(media, i);
+		unsigned int num_links = media_entity_get_links_count(entity);
+
+		for (j = 0; j < num_links; ++j) {
+			struct media_link *link =
+				(struct media_link *)media_entity_get_link(entity, j);
+
+			if (link->source->entity != entity ||
+			    link->flags & MEDIA_LNK_FL_IMMUTABLE ||
+			    batch_link_flags(batch, link) >= 0)
+				continue;
+
+			ret = batch_setup_link(media, link,
+					       link->flags & ~MEDIA_LNK_FL_ENABLED);
+			if (ret)
+				return ret;
+		}
+	}
+
+	for (i = 0; i < batch->num_links; ++i) {
+		struct media_link *link = batch->links[i].link;
+
+		flags = batch_link_flags(batch, link);
+		if (!(flags & MEDIA_LNK_FL_ENABLED)) {
+			ret = batch_setup_link(media, link, flags);
+			if (ret)
+				return ret;
+		}
+	}
+
+	for (i = 0; i < batch->num_links; ++i) {
+		struct media_link *link = batch->links[i].link;
+
+		flags = batch_link_flags(batch, link);
+		if (flags & MEDIA_LNK_FL_ENABLED) {
+			ret = batch_setup_link(media, link, flags);
+			if (ret)
+				return ret;
+		}
+	}
+
+	for (i = 0; i < batch->num_routes; ++i) {
+		ret = v4l2_subdev_parse_routes(media, batch->routes[i],
+					       V4L2_SUBDEV_SETUP_CHANGED);
+		if (ret)
+			return ret;
+	}
+
+	if (!batch->num_formats)
+		return 0;
+
+	/* Set up all formats at once, to set up pipelines concurrently. */
+	size = 0;
+	for (i = 0; i < batch->num_formats; ++i)
+		size += strlen(batch->formats[i]) + 1;
+
+	formats = malloc(size);
+	if (!formats)
+		return -ENOMEM;
+
+	for (i = 0, size = 0; i < batch->num_formats; ++i)
+		size += sprintf(formats + size, "%s%s", i ? "," : "",
+				batch->formats[i]);
+
+	ret = v4l2_subdev_parse_formats(media, formats,
+					V4L2_SUBDEV_SETUP_CHANGED |
+					V4L2_SUBDEV_SETUP_PARALLEL);
+	free(formats);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	struct media_device *media;
@@ -761,8 +1030,8 @@ int main(int argc, char **argv)
 	}
 
 	if (media_opts.formats) {
-		ret = v4l2_subdev_parse_setup_formats(media,
-						      media_opts.formats);
+		ret = v4l2_subdev_parse_formats(media, media_opts.formats,
+						V4L2_SUBDEV_SETUP_PARALLEL);
 		if (ret) {
 			printf("Unable to setup formats: %s (%d)\n",
 			       strerror(-ret), -ret);
@@ -770,6 +1039,21 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (media_opts.batch) {
+		struct batch batch = {};
+
+		ret = batch_parse(media, &batch, media_opts.batch);
+		if (!ret) {
+			ret = batch_apply(media, &batch);
+			if (ret)
+				printf("Unable to apply %s: %s (%d)\n",
+				       media_opts.batch, strerror(-ret), -ret);
+		}
+		batch_free(&batch);
+		if (ret)
+			goto out;
+	}
+
 	if (media_opts.interactive) {
 		while (1) {
 			char buffer[32];
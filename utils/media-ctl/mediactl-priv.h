@@ -36,9 +36,12 @@ struct media_entity {
 	bool supports_streams;
 
 	char devname[32];
+	bool devname_lookup;	/* devname not looked up yet */
 	int fd;
 };
 
+struct udev;
+
 struct media_device {
 	int fd;
 	int refcount;
@@ -48,6 +51,15 @@ struct media_device {
 	struct media_entity *entities;
 	unsigned int entities_count;
 
+	/* Hash tables of entity indexes + 1 (0 for an empty bucket) by name
+	 * and by id, built for entities_hashed entities. */
+	unsigned int *entities_by_name;
+	unsigned int *entities_by_id;
+	unsigned int entities_hash_size;
+	unsigned int entities_hashed;
+
+	struct udev *udev;
+
 	void (*debug_handler)(void *, ...);
 	void *debug_priv;
 
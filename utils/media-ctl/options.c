@@ -58,6 +58,8 @@ static void usage(const char *argv0)
 	printf("			If <dev> starts with a digit, then /dev/media<dev> is used.\n");
 	printf("			If <dev> doesn't exist, then find a media device that\n");
 	printf("			reports a bus info string equal to <dev>.\n");
+	printf("-b, --batch file	Apply the link, route and format commands of a batch file\n");
+	printf("			('-' for stdin), see below\n");
 	printf("-e, --entity name	Print the device name associated with the given entity\n");
 	printf("-V, --set-v4l2 v4l2	Comma-separated list of formats to setup\n");
 	printf("    --get-v4l2 pad	Print the active format on a given pad\n");
@@ -99,6 +101,14 @@ static void usage(const char *argv0)
 	printf("\troutes          = entity '[' route { ',' route } ']' ;\n");
 	printf("\troute           = pad-number '/' stream-number '->' pad-number '/' stream-number '[' route-flags ']' ;\n");
 	printf("\n");
+	printf("Batch files contain one command per line, empty lines and lines\n");
+	printf("starting with '#' are ignored. The whole file is parsed before\n");
+	printf("anything is applied. Links are applied first, then routes, then\n");
+	printf("formats, and the links, routes, formats, selection rectangles and\n");
+	printf("frame intervals that are already set up as requested are left alone.\n");
+	printf("\tbatch-command   = 'reset' | 'link' links | 'route' routes | 'format' v4l2 ;\n");
+	printf("where 'reset' disables all links that the file doesn't list.\n");
+	printf("\n");
 	printf("where the fields are\n");
 	printf("\tentity-number   Entity numeric identifier\n");
 	printf("\tentity-name     Entity name (string) \n");
@@ -150,6 +160,7 @@ static void usage(const char *argv0)
 #define OPT_VERSION			261
 
 static struct option opts[] = {
+	{"batch", 1, 0, 'b'},
 	{"device", 1, 0, 'd'},
 	{"entity", 1, 0, 'e'},
 	{"set-format", 1, 0, 'f'},
@@ -244,9 +255,13 @@ int parse_cmdline(int argc, char **argv)
 	}
 
 	/* parse options */
-	while ((opt = getopt_long(argc, argv, "d:e:f:hil:prvV:R:",
+	while ((opt = getopt_long(argc, argv, "b:d:e:f:hil:prvV:R:",
 				  opts, NULL)) != -1) {
 		switch (opt) {
+		case 'b':
+			media_opts.batch = optarg;
+			break;
+
 		case 'd':
 			media_opts.devname = make_devname(optarg);
 			break;
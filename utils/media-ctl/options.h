@@ -37,6 +37,7 @@ struct media_options
 	const char *get_dv_pad;
 	const char *dv_pad;
 	const char *routes;
+	const char *batch;
 };
 
 extern struct media_options media_opts;
@@ -276,6 +276,32 @@ int v4l2_subdev_set_frame_interval(struct media_entity *entity,
  */
 int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p);
 
+/* Flags for v4l2_subdev_parse_formats() and v4l2_subdev_parse_routes() */
+#define V4L2_SUBDEV_SETUP_CHANGED	(1 << 0)
+#define V4L2_SUBDEV_SETUP_DRY_RUN	(1 << 1)
+#define V4L2_SUBDEV_SETUP_PARALLEL	(1 << 2)
+
+/**
+ * @brief Parse a string and apply format, crop and frame interval settings.
+ * @param media - media device.
+ * @param p - input string
+ * @param flags - V4L2_SUBDEV_SETUP_* flags.
+ *
+ * Like v4l2_subdev_parse_setup_formats(). With V4L2_SUBDEV_SETUP_CHANGED,
+ * the formats, selection rectangles and frame intervals that already match
+ * the active ones are not set again. With V4L2_SUBDEV_SETUP_DRY_RUN, @a p is
+ * only parsed and nothing is applied.
+ *
+ * With V4L2_SUBDEV_SETUP_PARALLEL, the formats are grouped by pipeline, made
+ * of the entities connected through enabled links, and the pipelines are set
+ * up concurrently in separate threads. The formats of a pipeline are set up
+ * in the order they are given. @a p is validated before anything is applied.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_parse_formats(struct media_device *media, const char *p,
+			      unsigned int flags);
+
 /**
  * @brief Parse a string and apply route settings.
  * @param media - media device.
@@ -287,6 +313,21 @@ int v4l2_subdev_parse_setup_formats(struct media_device *media, const char *p);
  */
 int v4l2_subdev_parse_setup_routes(struct media_device *media, const char *p);
 
+/**
+ * @brief Parse a string and apply route settings.
+ * @param media - media device.
+ * @param p - input string
+ * @param flags - V4L2_SUBDEV_SETUP_* flags.
+ *
+ * Like v4l2_subdev_parse_setup_routes(). With V4L2_SUBDEV_SETUP_CHANGED, the
+ * routes are not set if the routing table of the subdev already holds the
+ * same routes. With V4L2_SUBDEV_SETUP_DRY_RUN, @a p is only parsed.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_parse_routes(struct media_device *media, const char *p,
+			     unsigned int flags);
+
 /**
  * @brief Convert media bus pixel code to string.
  * @param code - input string
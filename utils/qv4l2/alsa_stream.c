@@ -56,12 +56,41 @@ struct final_params {
     int rate;
     int latency;
     int channels;
+    int p_mmap;
+    int c_mmap;
+};
+
+/*
+ * Adaptive latency: the capture and playback clocks drift apart, so instead
+ * of copying the audio as is, it is resampled by at most ADAPT_MAX_PPM to
+ * keep the playback buffer filled at the negotiated latency.
+ */
+#define ADAPT_MAX_PPM	5000
+#define ADAPT_AVG_SECS	0.5	/* Time constant of the fill average */
+#define ADAPT_KP	0.005	/* Ratio adjustment per relative fill error */
+#define ADAPT_KI	0.001	/* Same, per second of relative fill error */
+
+struct resampler {
+    double ratio;	/* Capture frames consumed per playback frame */
+    double pos;		/* Of the next playback frame, -1 is prev */
+    int channels;
+    short prev[2];
+};
+
+/* A capture or playback stream, either mmap'ed or with a bounce buffer */
+struct xfer {
+    snd_pcm_t *handle;
+    int use_mmap;
+    snd_pcm_uframes_t offset;
+    short *buf;
+    snd_pcm_uframes_t bufsize;
 };
 
 static int setparams_stream(snd_pcm_t *handle,
 			    snd_pcm_hw_params_t *params,
 			    snd_pcm_format_t format,
 			    int *channels,
+			    int *use_mmap,
 			    const char *id)
 {
     int err;
@@ -74,12 +103,24 @@ static int setparams_stream(snd_pcm_t *handle,
 	return err;
     }
 
-    err = snd_pcm_hw_params_set_access(handle, params,
-				       SND_PCM_ACCESS_RW_INTERLEAVED);
-    if (err < 0) {
-	fprintf(error_fp, "alsa: Access type not available for %s: %s\n", id,
-		snd_strerror(err));
-	return err;
+    /* Prefer mmap'ed transfers, but not all devices support them */
+    if (*use_mmap &&
+	snd_pcm_hw_params_set_access(handle, params,
+				     SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0) {
+	if (verbose)
+	    fprintf(error_fp, "alsa: mmap access not available for %s, using read/write\n",
+		    id);
+	*use_mmap = 0;
+    }
+
+    if (!*use_mmap) {
+	err = snd_pcm_hw_params_set_access(handle, params,
+					   SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err < 0) {
+	    fprintf(error_fp, "alsa: Access type not available for %s: %s\n", id,
+		    snd_strerror(err));
+	    return err;
+	}
     }
 
     err = snd_pcm_hw_params_set_format(handle, params, format);
@@ -246,13 +287,14 @@ static int alsa_try_rate(snd_pcm_t *phandle, snd_pcm_t *chandle,
 
 static int setparams(snd_pcm_t *phandle, snd_pcm_t *chandle,
 		     snd_pcm_format_t format,
-		     int latency, int allow_resample,
+		     int latency, int allow_resample, int adaptive,
 		     struct final_params *negotiated)
 {
     int i;
     unsigned ratep, ratec = 0;
     unsigned ratemin = 32000, ratemax = 96000, val;
     int err, channels = 2;
+    int p_mmap = adaptive, c_mmap = adaptive;
     snd_pcm_hw_params_t *p_hwparams, *c_hwparams;
     snd_pcm_sw_params_t *p_swparams, *c_swparams;
     snd_pcm_uframes_t c_size, p_psize, c_psize;
@@ -266,10 +308,12 @@ static int setparams(snd_pcm_t *phandle, snd_pcm_t *chandle,
     snd_pcm_sw_params_alloca(&p_swparams);
     snd_pcm_sw_params_alloca(&c_swparams);
 
-    if (setparams_stream(chandle, c_hwparams, format, &channels, "capture"))
+    if (setparams_stream(chandle, c_hwparams, format, &channels, &c_mmap,
+			 "capture"))
 	return 1;
 
-    if (setparams_stream(phandle, p_hwparams, format, &channels, "playback"))
+    if (setparams_stream(phandle, p_hwparams, format, &channels, &p_mmap,
+			 "playback"))
 	return 1;
 
     if (allow_resample) {
@@ -421,6 +465,8 @@ static int setparams(snd_pcm_t *phandle, snd_pcm_t *chandle,
     negotiated->rate = ratep;
     negotiated->channels = channels;
     negotiated->latency = latency;
+    negotiated->p_mmap = p_mmap;
+    negotiated->c_mmap = c_mmap;
     return 0;
 }
 
@@ -463,12 +509,268 @@ static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len)
     return -1;
 }
 
-static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
+/*
+ * Linear interpolation from in to out, until either in_frames are consumed
+ * or out_frames are written. Returns the number of frames written, the
+ * number of frames consumed from in is returned in *consumed. At a ratio of
+ * 1 this is an exact copy.
+ */
+static long resample(struct resampler *rs, const short *in, long in_frames,
+		     short *out, long out_frames, long *consumed)
 {
-    snd_pcm_t *phandle, *chandle;
+    long n = 0, used;
+    int c;
+
+    while (n < out_frames && rs->pos < in_frames - 1) {
+	long i = floor(rs->pos);
+	double frac = rs->pos - i;
+	const short *a = i < 0 ? rs->prev : in + i * rs->channels;
+	const short *b = in + (i + 1) * rs->channels;
+
+	for (c = 0; c < rs->channels; c++)
+	    out[c] = lrint(a[c] + (b[c] - a[c]) * frac);
+	out += rs->channels;
+	rs->pos += rs->ratio;
+	n++;
+    }
+
+    /* Keep the frame the next playback frame is interpolated from */
+    used = floor(rs->pos) + 1;
+    if (used > in_frames)
+	used = in_frames;
+    if (used > 0) {
+	memcpy(rs->prev, in + (used - 1) * rs->channels,
+	       rs->channels * sizeof(*in));
+	rs->pos -= used;
+    }
+    *consumed = used;
+    return n;
+}
+
+static short *mmap_area(const snd_pcm_channel_area_t *areas,
+			snd_pcm_uframes_t offset)
+{
+    return (short *)((char *)areas[0].addr +
+		     (areas[0].first + offset * areas[0].step) / 8);
+}
+
+/* Get the captured frames, NULL if there are none */
+static short *capture_begin(struct xfer *x, snd_pcm_uframes_t *frames)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_sframes_t r;
+    snd_pcm_uframes_t avail;
+
+    if (!x->use_mmap) {
+	r = readbuf(x->handle, (char *)x->buf, x->bufsize);
+	if (r <= 0)
+	    return NULL;
+	*frames = r;
+	return x->buf;
+    }
+
+    /* Unlike reads, the mmap'ed transfers don't (re)start the capture */
+    if (snd_pcm_state(x->handle) == SND_PCM_STATE_PREPARED)
+	snd_pcm_start(x->handle);
+
+    snd_pcm_htimestamp(x->handle, &avail, &timestamp);
+    r = snd_pcm_avail_update(x->handle);
+    if (r < 0) {
+	r = snd_pcm_recover(x->handle, r, 0);
+	if (r < 0)
+	    fprintf(error_fp, "alsa: overrun recover error: %s\n", snd_strerror(r));
+	return NULL;
+    }
+    if (r == 0)
+	return NULL;
+
+    *frames = r;
+    r = snd_pcm_mmap_begin(x->handle, &areas, &x->offset, frames);
+    if (r < 0 || *frames == 0)
+	return NULL;
+    return mmap_area(areas, x->offset);
+}
+
+static void capture_end(struct xfer *x, snd_pcm_uframes_t frames)
+{
+    if (x->use_mmap)
+	snd_pcm_mmap_commit(x->handle, x->offset, frames);
+}
+
+/* Get room for playback frames, waits for it if the buffer is full */
+static short *playback_begin(struct xfer *x, snd_pcm_uframes_t *frames)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_sframes_t r = 0;
+
+    if (!x->use_mmap) {
+	*frames = x->bufsize;
+	return x->buf;
+    }
+
+    while (!stop_alsa) {
+	r = snd_pcm_avail_update(x->handle);
+	if (r > 0)
+	    break;
+	if (r < 0) {
+	    r = snd_pcm_recover(x->handle, r, 0);
+	    if (r < 0) {
+		fprintf(error_fp, "alsa: underrun recover error: %s\n",
+			snd_strerror(r));
+		return NULL;
+	    }
+	    continue;
+	}
+	snd_pcm_wait(x->handle, 100);
+    }
+    if (r <= 0)
+	return NULL;
+
+    *frames = r;
+    r = snd_pcm_mmap_begin(x->handle, &areas, &x->offset, frames);
+    if (r < 0 || *frames == 0)
+	return NULL;
+    return mmap_area(areas, x->offset);
+}
+
+static void playback_commit(struct xfer *x, snd_pcm_uframes_t frames)
+{
+    snd_pcm_sframes_t r;
+
+    if (!x->use_mmap) {
+	writebuf(x->handle, (char *)x->buf, frames);
+	return;
+    }
+
+    /* This also starts the playback at the start threshold */
+    r = snd_pcm_mmap_commit(x->handle, x->offset, frames);
+    if (r < 0) {
+	r = snd_pcm_recover(x->handle, r, 0);
+	if (r < 0)
+	    fprintf(error_fp, "alsa: underrun recover error: %s\n",
+		    snd_strerror(r));
+    }
+}
+
+/*
+ * Keep the playback buffer filled at the negotiated latency. The fill is
+ * measured after each transfer, averaged, and a PI controller turns its
+ * deviation from the target into the resampling ratio.
+ */
+static void alsa_stream_adaptive(snd_pcm_t *phandle, snd_pcm_t *chandle,
+				 struct final_params *negotiated)
+{
+    struct xfer cap = { chandle, negotiated->c_mmap };
+    struct xfer play = { phandle, negotiated->p_mmap };
+    struct resampler rs = { 1.0, 0, negotiated->channels };
+    double target = negotiated->latency, fill = target;
+    double max_adj = ADAPT_MAX_PPM / 1000000.0;
+    double integral = 0, err, adj, w;
+    snd_pcm_uframes_t frames, pframes, done;
+    snd_pcm_sframes_t delay;
+    long used, n, reported = 0;
+    short *in, *out;
+
+    cap.bufsize = play.bufsize = negotiated->bufsize;
+    if (!cap.use_mmap)
+	cap.buf = malloc(cap.bufsize * negotiated->channels * sizeof(short));
+    if (!play.use_mmap)
+	play.buf = malloc(play.bufsize * negotiated->channels * sizeof(short));
+    if ((!cap.use_mmap && cap.buf == NULL) ||
+	(!play.use_mmap && play.buf == NULL)) {
+	fprintf(error_fp, "alsa: Failed allocating buffer for audio\n");
+	free(cap.buf);
+	free(play.buf);
+	return;
+    }
+
+    if (verbose)
+	fprintf(error_fp, "alsa: adaptive latency with %s capture and %s playback\n",
+		cap.use_mmap ? "mmap'ed" : "read", play.use_mmap ? "mmap'ed" : "write");
+
+    while (!stop_alsa) {
+	/* We start with a read and not a wait to auto(re)start the capture */
+	in = capture_begin(&cap, &frames);
+	if (in) {
+	    for (done = 0; done < frames && !stop_alsa; done += used) {
+		out = playback_begin(&play, &pframes);
+		if (!out)
+		    break;
+		n = resample(&rs, in + done * rs.channels, frames - done,
+			     out, pframes, &used);
+		playback_commit(&play, n);
+	    }
+	    capture_end(&cap, frames);
+
+	    if (snd_pcm_state(phandle) == SND_PCM_STATE_RUNNING &&
+		snd_pcm_delay(phandle, &delay) == 0) {
+		w = frames / (ADAPT_AVG_SECS * negotiated->rate);
+		fill += (delay - fill) * (w < 1 ? w : 1);
+		err = (fill - target) / target;
+		integral += err * frames / negotiated->rate;
+		if (integral * ADAPT_KI > max_adj)
+		    integral = max_adj / ADAPT_KI;
+		if (integral * ADAPT_KI < -max_adj)
+		    integral = -max_adj / ADAPT_KI;
+		adj = ADAPT_KP * err + ADAPT_KI * integral;
+		if (adj > max_adj)
+		    adj = max_adj;
+		if (adj < -max_adj)
+		    adj = -max_adj;
+		/* More than the target buffered: consume the capture faster */
+		rs.ratio = 1 + adj;
+
+		reported += frames;
+		if (verbose && reported >= 5 * negotiated->rate) {
+		    fprintf(error_fp, "alsa: latency %.2f ms, ratio %.6f\n",
+			    fill * 1000.0 / negotiated->rate, rs.ratio);
+		    reported = 0;
+		}
+	    }
+	}
+	/* use poll to wait for next event */
+	while (!stop_alsa && !snd_pcm_wait(chandle, 50))
+	    ;
+    }
+
+    free(cap.buf);
+    free(play.buf);
+}
+
+static void alsa_stream_copy(snd_pcm_t *phandle, snd_pcm_t *chandle,
+			     struct final_params *negotiated)
+{
+    snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
     char *buffer;
-    int err;
     ssize_t r;
+
+    buffer = malloc((negotiated->bufsize * snd_pcm_format_width(format) / 8)
+		    * negotiated->channels);
+    if (buffer == NULL) {
+	fprintf(error_fp, "alsa: Failed allocating buffer for audio\n");
+	return;
+    }
+
+    while (!stop_alsa) {
+	/* We start with a read and not a wait to auto(re)start the capture */
+	r = readbuf(chandle, buffer, negotiated->bufsize);
+	if (r == 0)   /* Succesfully recovered from an overrun? */
+	    continue; /* Force restart of capture stream */
+	if (r > 0)
+	    writebuf(phandle, buffer, r);
+	/* use poll to wait for next event */
+	while (!stop_alsa && !snd_pcm_wait(chandle, 50))
+	    ;
+    }
+
+    free(buffer);
+}
+
+static int alsa_stream(const char *pdevice, const char *cdevice, int latency,
+		       int adaptive)
+{
+    snd_pcm_t *phandle, *chandle;
+    int err;
     struct final_params negotiated;
     snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
     char pdevice_new[32];
@@ -494,7 +796,8 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 	return 0;
     }
 
-    err = setparams(phandle, chandle, format, latency, 0, &negotiated);
+    err = setparams(phandle, chandle, format, latency, 0, adaptive,
+		    &negotiated);
 
     /* Try to use plughw instead, as it allows emulating speed */
     if (err == 2 && strncmp(pdevice, "hw", 2) == 0) {
@@ -513,7 +816,8 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 	    return 0;
 	}
 
-	err = setparams(phandle, chandle, format, latency, 1, &negotiated);
+	err = setparams(phandle, chandle, format, latency, 1, adaptive,
+			&negotiated);
     }
 
     if (err != 0) {
@@ -523,32 +827,16 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 	return 1;
     }
 
-    buffer = malloc((negotiated.bufsize * snd_pcm_format_width(format) / 8)
-		    * negotiated.channels);
-    if (buffer == NULL) {
-	fprintf(error_fp, "alsa: Failed allocating buffer for audio\n");
-	snd_pcm_close(phandle);
-	snd_pcm_close(chandle);
-	return 0;
-    }
-
     if (verbose)
         fprintf(error_fp,
 	    "alsa: stream started from %s to %s (%i Hz, buffer delay = %.2f ms)\n",
 	    cdevice, pdevice, negotiated.rate,
 	    negotiated.latency * 1000.0 / negotiated.rate);
 
-    while (!stop_alsa) {
-	/* We start with a read and not a wait to auto(re)start the capture */
-	r = readbuf(chandle, buffer, negotiated.bufsize);
-	if (r == 0)   /* Succesfully recovered from an overrun? */
-	    continue; /* Force restart of capture stream */
-	if (r > 0)
-	    writebuf(phandle, buffer, r);
-	/* use poll to wait for next event */
-	while (!stop_alsa && !snd_pcm_wait(chandle, 50))
-	    ;
-    }
+    if (adaptive)
+	alsa_stream_adaptive(phandle, chandle, &negotiated);
+    else
+	alsa_stream_copy(phandle, chandle, &negotiated);
 
     snd_pcm_drop(chandle);
     snd_pcm_drop(phandle);
@@ -567,6 +855,7 @@ struct input_params {
     char *pdevice;
     char *cdevice;
     int latency;
+    int adaptive;
 };
 
 static void *alsa_thread_entry(void *whatever)
@@ -576,7 +865,8 @@ static void *alsa_thread_entry(void *whatever)
     if (verbose)
 	fprintf(error_fp, "alsa: starting copying alsa stream from %s to %s\n",
 		inputs->cdevice, inputs->pdevice);
-    alsa_stream(inputs->pdevice, inputs->cdevice, inputs->latency);
+    alsa_stream(inputs->pdevice, inputs->cdevice, inputs->latency,
+		inputs->adaptive);
     if (verbose)
         fprintf(error_fp, "alsa: stream stopped\n");
 
@@ -592,6 +882,7 @@ static void *alsa_thread_entry(void *whatever)
  *************************************************************************/
 
 static int alsa_is_running = 0;
+static int alsa_adaptive = 0;
 static pthread_t alsa_thread;
 
 int alsa_thread_startup(const char *pdevice, const char *cdevice, int latency,
@@ -625,6 +916,7 @@ int alsa_thread_startup(const char *pdevice, const char *cdevice, int latency,
     inputs->pdevice = strdup(pdevice);
     inputs->cdevice = strdup(cdevice);
     inputs->latency = latency;
+    inputs->adaptive = alsa_adaptive;
 
     stop_alsa = 0;
     ret = pthread_create(&alsa_thread, NULL,
@@ -645,6 +937,12 @@ void alsa_thread_stop(void)
     alsa_is_running = 0;
 }
 
+/* Takes effect at the next alsa_thread_startup() */
+void alsa_thread_set_adaptive(int adaptive)
+{
+    alsa_adaptive = adaptive;
+}
+
 int alsa_thread_is_running(void)
 {
     return alsa_is_running;
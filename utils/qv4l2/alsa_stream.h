@@ -7,6 +7,7 @@
 int alsa_thread_startup(const char *pdevice, const char *cdevice,
 			int latency, FILE *__error_fp, int __verbose);
 void alsa_thread_stop(void);
+void alsa_thread_set_adaptive(int adaptive);
 int alsa_thread_is_running(void);
 void alsa_thread_timestamp(struct timeval *tv);
 #endif
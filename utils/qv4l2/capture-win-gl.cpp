@@ -90,6 +90,15 @@ bool CaptureWinGL::hasNativeFormat(__u32 format)
 #endif
 }
 
+bool CaptureWinGL::renderPending()
+{
+#ifdef HAVE_QTGL
+	return m_videoSurface.renderPending();
+#else
+	return false;
+#endif
+}
+
 bool CaptureWinGL::isSupported()
 {
 #ifdef HAVE_QTGL
@@ -147,17 +156,23 @@ CaptureWinGLEngine::CaptureWinGLEngine() :
 	m_frameFormat(0),
 	m_frameData(NULL),
 	m_blending(false),
+	m_renderPending(false),
 	m_mag_filter(GL_NEAREST),
 	m_min_filter(GL_NEAREST)
 {
 	makeCurrent();
 #if QT_VERSION < 0x060000
 	m_glfunction.initializeGLFunctions(context());
+#else
+	// update() only schedules the repaint, it is done once the frame is swapped
+	connect(this, &QOpenGLWidget::frameSwapped, [this]() { m_renderPending = false; });
 #endif
 }
 
 CaptureWinGLEngine::~CaptureWinGLEngine()
 {
+	makeCurrent();
+	m_upload.destroy();
 	clearShader();
 }
 
@@ -310,6 +325,7 @@ void CaptureWinGLEngine::initializeGL()
 
 	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 	glBlendFunc(GL_ONE, GL_ZERO);
+	m_upload.init();
 	checkError("InitializeGL");
 }
 
@@ -345,6 +361,7 @@ void CaptureWinGLEngine::setFrame(int width, int height, int WCrop, int HCrop,
 #if QT_VERSION < 0x060000
 	updateGL();
 #else
+	m_renderPending = true;
 	update();
 #endif
 }
@@ -628,6 +645,7 @@ void CaptureWinGLEngine::paintGL()
 		glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
 	}
 
+	m_upload.begin();
 	switch (m_frameFormat) {
 	case V4L2_PIX_FMT_YUYV:
 	case V4L2_PIX_FMT_YVYU:
@@ -733,6 +751,7 @@ void CaptureWinGLEngine::paintGL()
 		render_RGB(m_frameFormat);
 		break;
 	}
+	m_upload.end();
 	paintFrame();
 
 	if (m_blending)
@@ -1082,7 +1101,7 @@ void CaptureWinGLEngine::render_YUV(__u32 format)
 	GLint Y = glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 #endif
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("YUV paint ytex");
 
@@ -1098,19 +1117,19 @@ void CaptureWinGLEngine::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData == NULL ? NULL : &m_frameData[idxU]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData3);
 		break;
 	}
@@ -1128,19 +1147,19 @@ void CaptureWinGLEngine::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData == NULL ? NULL : &m_frameData[idxV]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData3);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / hdiv, m_frameHeight / vdiv,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	}
@@ -1256,7 +1275,7 @@ void CaptureWinGLEngine::render_NV12(__u32 format)
 	GLint Y = glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 #endif
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("NV12 paint ytex");
 
@@ -1271,13 +1290,13 @@ void CaptureWinGLEngine::render_NV12(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV12:
 	case V4L2_PIX_FMT_NV21:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
 				m_glRed, GL_UNSIGNED_BYTE,
 				m_frameData ? m_frameData + m_frameWidth * m_frameHeight : NULL);
 		break;
 	case V4L2_PIX_FMT_NV12M:
 	case V4L2_PIX_FMT_NV21M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight / 2,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	}
@@ -1384,7 +1403,7 @@ void CaptureWinGLEngine::render_NV24(__u32 format)
 	GLint Y = glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 #endif
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("NV24 paint ytex");
 
@@ -1396,7 +1415,7 @@ void CaptureWinGLEngine::render_NV24(__u32 format)
 	GLint U = glGetUniformLocation(m_shaderProgram.programId(), "uvtex");
 #endif
 	glUniform1i(U, 1);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRedGreen, GL_UNSIGNED_BYTE,
 			m_frameData ? m_frameData + m_frameWidth * m_frameHeight : NULL);
 	checkError("NV24 paint uvtex");
@@ -1509,7 +1528,7 @@ void CaptureWinGLEngine::render_NV16(__u32 format)
 	GLint Y = glGetUniformLocation(m_shaderProgram.programId(), "ytex");
 #endif
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("NV16 paint ytex");
 
@@ -1524,13 +1543,13 @@ void CaptureWinGLEngine::render_NV16(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV16:
 	case V4L2_PIX_FMT_NV61:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE,
 				m_frameData ? m_frameData + m_frameWidth * m_frameHeight : NULL);
 		break;
 	case V4L2_PIX_FMT_NV16M:
 	case V4L2_PIX_FMT_NV61M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData2);
 		break;
 	}
@@ -1661,7 +1680,7 @@ void CaptureWinGLEngine::render_YUY2(__u32 format)
 	GLint Y = glGetUniformLocation(m_shaderProgram.programId(), "tex");
 #endif
 	glUniform1i(Y, 0);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / 2, m_frameHeight,
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth / 2, m_frameHeight,
 			GL_RGBA, GL_UNSIGNED_BYTE, m_frameData);
 	checkError("YUY2 paint");
 }
@@ -1892,25 +1911,25 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 
 	switch (format) {
 	case V4L2_PIX_FMT_RGB332:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_BYTE_3_3_2, m_frameData);
 		break;
 	case V4L2_PIX_FMT_RGB555:
 	case V4L2_PIX_FMT_XRGB555:
 	case V4L2_PIX_FMT_ARGB555:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_RGB444:
 	case V4L2_PIX_FMT_XRGB444:
 	case V4L2_PIX_FMT_ARGB444:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_GREY:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 		break;
 
@@ -1919,12 +1938,12 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_Y16:
 	case V4L2_PIX_FMT_Z16:
 	case V4L2_PIX_FMT_INZI:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		break;
 	case V4L2_PIX_FMT_Y16_BE:
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1936,13 +1955,13 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 		// for the RGB555 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
 
 	case V4L2_PIX_FMT_RGB565:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_frameData);
 		break;
 
@@ -1951,7 +1970,7 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 		// for the RGB565 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_frameData);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1960,21 +1979,21 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_XRGB32:
 	case V4L2_PIX_FMT_ARGB32:
 	case V4L2_PIX_FMT_HSV32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, m_frameData);
 		break;
 	case V4L2_PIX_FMT_BGR666:
 	case V4L2_PIX_FMT_BGR32:
 	case V4L2_PIX_FMT_XBGR32:
 	case V4L2_PIX_FMT_ABGR32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, m_frameData);
 		break;
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
 	case V4L2_PIX_FMT_HSV24:
 	default:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_BYTE, m_frameData);
 		break;
 	}
@@ -2140,7 +2159,7 @@ void CaptureWinGLEngine::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SRGGB8:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_BYTE, m_frameData);
 		break;
 	case V4L2_PIX_FMT_SBGGR10:
@@ -2155,7 +2174,7 @@ void CaptureWinGLEngine::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
 	case V4L2_PIX_FMT_SRGGB16:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		break;
 	}
@@ -2269,31 +2288,31 @@ void CaptureWinGLEngine::render_YUV_packed(__u32 format)
 
 	switch (format) {
 	case V4L2_PIX_FMT_YUV555:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_YUV444:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_YUV565:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_frameData);
 		break;
 
 	case V4L2_PIX_FMT_YUV32:
 	case V4L2_PIX_FMT_AYUV32:
 	case V4L2_PIX_FMT_XYUV32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, m_frameData);
 		break;
 	case V4L2_PIX_FMT_VUYA32:
 	case V4L2_PIX_FMT_VUYX32:
 	case V4L2_PIX_FMT_YUVA32:
 	case V4L2_PIX_FMT_YUVX32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, m_frameData);
 		break;
 	}
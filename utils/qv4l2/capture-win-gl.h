@@ -25,6 +25,9 @@
 
 #include "qv4l2.h"
 #include "capture-win.h"
+#ifdef HAVE_QTGL
+#include "gl-upload.h"
+#endif
 
 #include <QResizeEvent>
 
@@ -48,6 +51,7 @@ public:
 		      __u32 format, unsigned char *data, unsigned char *data2,
 		      unsigned char *data3);
 	bool hasNativeFormat(__u32 format);
+	bool renderPending() const { return m_renderPending; }
 	void lockSize(QSize size);
 	void setColorspace(unsigned colorspace, unsigned xfer_func,
 			unsigned ycbcr_enc, unsigned quantization, bool is_sdtv);
@@ -113,6 +117,7 @@ private:
 	bool m_formatChange;
 	__u32 m_frameFormat;
 	GLuint m_screenTexture[MAX_TEXTURES_NEEDED];
+	GLUpload m_upload;
 #if QT_VERSION < 0x060000
 	QGLFunctions m_glfunction;
 #endif
@@ -130,6 +135,7 @@ private:
 	unsigned m_glRed16;
 	unsigned m_glRedGreen;
 	bool m_blending;
+	bool m_renderPending;
 	GLint m_mag_filter;
 	GLint m_min_filter;
 };
@@ -144,6 +150,7 @@ public:
 
 	void stop();
 	bool hasNativeFormat(__u32 format);
+	bool renderPending();
 	static bool isSupported();
 	void setColorspace(unsigned colorspace, unsigned xfer_func,
 			unsigned ycbcr_enc, unsigned quantization, bool is_sdtv);
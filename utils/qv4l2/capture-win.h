@@ -110,6 +110,16 @@ public:
 	 */
 	virtual bool hasNativeFormat(__u32 format) = 0;
 
+	/**
+	 * @brief Queries if the last frame is still waiting to be shown.
+	 *
+	 * Frames captured in the meantime would replace it before it is
+	 * shown, so they don't have to be converted.
+	 *
+	 * @return true if the last frame was not shown yet, false if not.
+	 */
+	virtual bool renderPending() { return false; }
+
 	/**
 	 * @brief Defines wether a capture window is supported.
 	 *
@@ -41,12 +41,16 @@
 #include <QInputDialog>
 #include <QActionGroup>
 
+#include <algorithm>
+
 #include <assert.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "qv4l2.h"
 #include "general-tab.h"
@@ -122,6 +126,12 @@ ApplicationWindow::ApplicationWindow() :
 	m_nbuffers = 0;
 	m_makeSnapshot = false;
 	m_singleStep = false;
+	m_capShown = NULL;
+	m_capExit = false;
+	m_capNotified = false;
+	m_capShow = false;
+	m_capSteps = 0;
+	m_capWakeup[0] = m_capWakeup[1] = -1;
 	m_tpgColorspace = 0;
 	m_tpgXferFunc = 0;
 	m_tpgYCbCrEnc = 0;
@@ -321,6 +331,13 @@ ApplicationWindow::ApplicationWindow() :
 	m_audioBufferAct->setStatusTip("Set audio buffer capacity in amount of ms than can be stored");
 	connect(m_audioBufferAct, SIGNAL(triggered()), this, SLOT(setAudioBufferSize()));
 	m_capMenu->addAction(m_audioBufferAct);
+
+	m_audioAdaptiveAct = new QAction("&Adaptive Audio Latency", this);
+	m_audioAdaptiveAct->setStatusTip("Keep the audio latency at the buffer capacity by resampling the captured audio");
+	m_audioAdaptiveAct->setCheckable(true);
+	m_audioAdaptiveAct->setChecked(false);
+	connect(m_audioAdaptiveAct, SIGNAL(toggled(bool)), this, SLOT(changeAudioDevice()));
+	m_capMenu->addAction(m_audioAdaptiveAct);
 #endif
 
 	QMenu *helpMenu = menuBar()->addMenu("&Help");
@@ -412,6 +429,7 @@ void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
 	if (open(device.toLatin1(), true) < 0) {
 #ifdef HAVE_ALSA
 		m_audioBufferAct->setEnabled(false);
+		m_audioAdaptiveAct->setEnabled(false);
 #endif
 		return;
 	}
@@ -426,8 +444,10 @@ void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
 	if (m_genTab->hasAlsaAudio()) {
 		connect(m_genTab, SIGNAL(audioDeviceChanged()), this, SLOT(changeAudioDevice()));
 		m_audioBufferAct->setEnabled(true);
+		m_audioAdaptiveAct->setEnabled(true);
 	} else {
 		m_audioBufferAct->setEnabled(false);
+		m_audioAdaptiveAct->setEnabled(false);
 	}
 #endif
 	connect(m_genTab, SIGNAL(pixelAspectRatioChanged()), this, SLOT(updatePixelAspectRatio()));
@@ -438,6 +458,7 @@ void ApplicationWindow::setDevice(const QString &device, bool rawOpen)
 	if (has_vid_out()) {
 		addTpgTab(m_minWidth);
 		tpg_init(&m_tpg, 640, 360);
+		tpg_s_threads(&m_tpg, QThread::idealThreadCount());
 		updateLimRGBRange();
 	}
 
@@ -1020,155 +1041,346 @@ void ApplicationWindow::outFrame()
 		refresh();
 }
 
-void ApplicationWindow::capFrame()
+/*
+ * The capture thread dequeues the frames and converts them with libv4lconvert,
+ * so slow conversions (MJPEG, Bayer) don't block the GUI. Frames are handed
+ * over to capFrame() through m_capReady. A converted frame gives its buffer
+ * back to the driver right away, any other frame keeps it until the frame is
+ * no longer shown.
+ */
+void ApplicationWindow::startCapThread()
 {
-	cv4l_buffer buf(m_queue);
-	unsigned char *plane[3];
-	unsigned bytesused[3];
-	int s = 0;
-	int err = 0;
-#ifdef HAVE_ALSA
-	struct timeval tv_alsa;
-#endif
+	unsigned nframes = 3;
 
-	if (m_singleStep)
-		m_capNotifier->setEnabled(false);
+	if (m_capMethod != methodRead)
+		nframes = std::max(2U, std::min(3U, m_queue.g_buffers() - 1));
+
+	for (unsigned i = 0; i < nframes; i++) {
+		CapFrame *f = new CapFrame;
+
+		f->raw = NULL;
+		f->conv = NULL;
+		if (m_capMethod == methodRead)
+			f->raw = new unsigned char[m_capSrcFormat.g_sizeimage(0) +
+						   m_capSrcFormat.g_sizeimage(1)];
+		if (m_mustConvert)
+			f->conv = new unsigned char[m_capDestFormat.g_sizeimage(0)];
+		m_capFrames.push_back(f);
+		m_capFree.push_back(f);
+	}
+	m_capShown = NULL;
+	m_capExit = false;
+	m_capNotified = false;
+	m_capShow = showFrames();
+	m_capSteps = m_singleStep ? 1 : 0;
+	if (pipe(m_capWakeup)) {
+		m_capWakeup[0] = m_capWakeup[1] = -1;
+		error("pipe");
+		return;
+	}
+	m_capThread = std::thread(&ApplicationWindow::capThread, this);
+}
+
+void ApplicationWindow::stopCapThread()
+{
+	if (m_capThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lk(m_capLock);
+
+			m_capExit = true;
+		}
+		m_capCond.notify_one();
+		if (::write(m_capWakeup[1], "x", 1) != 1)
+			perror("write");
+		m_capThread.join();
+	}
+	if (m_capWakeup[0] >= 0) {
+		::close(m_capWakeup[0]);
+		::close(m_capWakeup[1]);
+		m_capWakeup[0] = m_capWakeup[1] = -1;
+	}
+}
+
+/*
+ * The shown frame is still referenced by the capture window, so only call
+ * this after m_capture->stop().
+ */
+void ApplicationWindow::freeCapFrames()
+{
+	for (auto f : m_capFrames) {
+		delete [] f->raw;
+		delete [] f->conv;
+		delete f;
+	}
+	m_capFrames.clear();
+	m_capFree.clear();
+	m_capReady.clear();
+	m_capShown = NULL;
+}
+
+void ApplicationWindow::capThread()
+{
+	for (;;) {
+		CapFrame *f;
+
+		{
+			std::unique_lock<std::mutex> lk(m_capLock);
+
+			m_capCond.wait(lk, [this] {
+				return m_capExit ||
+				       (!m_capFree.empty() && (!m_singleStep || m_capSteps));
+			});
+			if (m_capExit)
+				return;
+			f = m_capFree.back();
+			m_capFree.pop_back();
+			f->show = m_capShow;
+		}
+
+		struct pollfd pfd[2] = {
+			{ g_fd(), POLLIN, 0 },
+			{ m_capWakeup[0], POLLIN, 0 },
+		};
+		int ret = poll(pfd, 2, -1);
+		bool ready = ret > 0 && !pfd[1].revents && capThreadFrame(f);
+
+		std::lock_guard<std::mutex> lk(m_capLock);
+
+		if (!ready) {
+			m_capFree.push_back(f);
+			if (pfd[1].revents)
+				return;
+			continue;
+		}
+		m_capReady.push_back(f);
+		if (m_capSteps)
+			m_capSteps--;
+		if (!m_capNotified) {
+			m_capNotified = true;
+			QMetaObject::invokeMethod(this, "capFrame", Qt::QueuedConnection);
+		}
+		if (f->err)
+			return;
+	}
+}
+
+/*
+ * Dequeue and convert a frame in the capture thread. Returns false if
+ * there was no frame after all, otherwise the frame is passed on to
+ * capFrame(), also on errors.
+ */
+bool ApplicationWindow::capThreadFrame(CapFrame *f)
+{
+	f->dequeued = false;
+	f->convertFailed = false;
+	f->err = NULL;
+	f->s = 0;
+	f->plane[0] = f->plane[1] = f->plane[2] = NULL;
+	f->tvAlsa.tv_sec = f->tvAlsa.tv_usec = 0;
 
-	plane[0] = plane[1] = plane[2] = NULL;
 	switch (m_capMethod) {
 	case methodRead:
-		s = read(m_frameData, m_capSrcFormat.g_sizeimage(0));
+		f->s = read(f->raw, m_capSrcFormat.g_sizeimage(0));
 #ifdef HAVE_ALSA
-		alsa_thread_timestamp(&tv_alsa);
+		alsa_thread_timestamp(&f->tvAlsa);
 #endif
 
-		if (s < 0) {
-			if (errno != EAGAIN) {
-				error("read");
-				m_capStartAct->setChecked(false);
-			}
-			return;
-		}
-		if (m_makeSnapshot)
-			makeSnapshot((unsigned char *)m_frameData, s);
-		if (m_saveRaw.openMode())
-			m_saveRaw.write((const char *)m_frameData, s);
-
-		plane[0] = m_frameData;
-		if (showFrames() && m_mustConvert) {
-			err = v4lconvert_convert(m_convertData, &m_capSrcFormat, &m_capDestFormat,
-						 m_frameData, s,
-						 m_capImage->bits(), m_capDestFormat.fmt.pix.sizeimage);
-			if (err != -1)
-				plane[0] = m_capImage->bits();
+		if (f->s < 0) {
+			if (errno == EAGAIN)
+				return false;
+			f->err = "read";
+			return true;
 		}
+		f->plane[0] = f->raw;
+		f->bytesused[0] = f->s;
 		break;
 
 	case methodMmap:
 	case methodUser:
-		if (dqbuf(buf)) {
+		f->buf.init(m_queue);
+		if (dqbuf(f->buf)) {
 			if (errno == EAGAIN)
-				return;
-			error("dqbuf");
-			m_capStartAct->setChecked(false);
-			return;
+				return false;
+			f->err = "dqbuf";
+			return true;
 		}
-		if (buf.g_flags() & V4L2_BUF_FLAG_ERROR) {
+		if (f->buf.g_flags() & V4L2_BUF_FLAG_ERROR) {
 			printf("error\n");
-			if (qbuf(buf)) {
-				error("Couldn't queue buffer\n");
-				m_capStartAct->setChecked(false);
+			if (qbuf(f->buf)) {
+				f->err = "Couldn't queue buffer\n";
+				return true;
 			}
-			return;
+			return false;
 		}
+		f->dequeued = true;
 
 #ifdef HAVE_ALSA
-		alsa_thread_timestamp(&tv_alsa);
+		alsa_thread_timestamp(&f->tvAlsa);
 #endif
 
-		plane[0] = (__u8 *)m_queue.g_dataptr(buf.g_index(), 0);
-		plane[1] = (__u8 *)m_queue.g_dataptr(buf.g_index(), 1);
-		plane[2] = (__u8 *)m_queue.g_dataptr(buf.g_index(), 2);
-		plane[0] += buf.g_data_offset(0);
-		bytesused[0] = buf.g_bytesused(0) - buf.g_data_offset(0);
-		if (plane[1]) {
-			plane[1] += buf.g_data_offset(1);
-			bytesused[1] = buf.g_bytesused(1) - buf.g_data_offset(1);
-		}
-		if (plane[2]) {
-			plane[2] += buf.g_data_offset(2);
-			bytesused[2] = buf.g_bytesused(2) - buf.g_data_offset(2);
-		}
-		if (showFrames() && m_mustConvert) {
-			err = v4lconvert_convert(m_convertData, &m_capSrcFormat, &m_capDestFormat,
-						 plane[0], bytesused[0], m_capImage->bits(),
-						 m_capDestFormat.fmt.pix.sizeimage);
-			if (err != -1) {
-				plane[0] = m_capImage->bits();
-				bytesused[0] = m_capDestFormat.fmt.pix.sizeimage;
+		for (unsigned p = 0; p < 3; p++) {
+			f->plane[p] = (__u8 *)m_queue.g_dataptr(f->buf.g_index(), p);
+			if (f->plane[p]) {
+				f->plane[p] += f->buf.g_data_offset(p);
+				f->bytesused[p] = f->buf.g_bytesused(p) - f->buf.g_data_offset(p);
 			}
 		}
-		if (m_makeSnapshot)
-			makeSnapshot(plane[0], bytesused[0]);
-		if (m_saveRaw.openMode())
-			m_saveRaw.write((const char *)plane[0], bytesused[0]);
-
 		break;
 	}
-	if (err == -1 && m_frame == 0)
-		error(v4lconvert_get_error_message(m_convertData));
 
-	QString status, curStatus;
+	if (!f->show || !m_mustConvert)
+		return true;
 
-	calculateFps();
+	if (v4lconvert_convert(m_convertData, &m_capSrcFormat, &m_capDestFormat,
+			       f->plane[0], f->bytesused[0], f->conv,
+			       m_capDestFormat.g_sizeimage(0)) == -1) {
+		f->convertFailed = true;
+		f->convertError = v4lconvert_get_error_message(m_convertData);
+		return true;
+	}
+	f->plane[0] = f->conv;
+	f->plane[1] = f->plane[2] = NULL;
+	f->bytesused[0] = m_capDestFormat.g_sizeimage(0);
+	if (f->dequeued) {
+		if (!releaseFrame(f))
+			f->err = "Couldn't queue buffer\n";
+	}
+	return true;
+}
 
-	float wscale = m_capture->getHorScaleFactor();
-	float hscale = m_capture->getVertScaleFactor();
-	status = QString("Frame: %1 Fps: %2 Scale Factors: %3x%4").arg(++m_frame)
-			 .arg(m_fps, 0, 'f', 2, '0').arg(wscale).arg(hscale);
-	if (m_capMethod != methodRead)
-		status.append(QString(" SeqNr: %1").arg(buf.g_sequence()));
-#ifdef HAVE_ALSA
-	if (m_capMethod != methodRead && alsa_thread_is_running()) {
-		if (tv_alsa.tv_sec || tv_alsa.tv_usec) {
-			m_totalAudioLatency.tv_sec += buf.g_timestamp().tv_sec - tv_alsa.tv_sec;
-			m_totalAudioLatency.tv_usec += buf.g_timestamp().tv_usec - tv_alsa.tv_usec;
+/*
+ * Give the buffer of a frame back to the driver, clearing it first if
+ * requested. Called from both threads, but never for the same frame at
+ * the same time.
+ */
+bool ApplicationWindow::releaseFrame(CapFrame *f)
+{
+	if (!f->dequeued)
+		return true;
+
+	bool clear;
+
+	{
+		std::lock_guard<std::mutex> lk(m_capLock);
+
+		clear = m_clear[f->buf.g_index()];
+		m_clear[f->buf.g_index()] = false;
+	}
+	if (clear) {
+		memset(m_queue.g_dataptr(f->buf.g_index(), 0), 0, f->buf.g_length());
+		if (V4L2_TYPE_IS_MULTIPLANAR(f->buf.g_type())) {
+			memset(m_queue.g_dataptr(f->buf.g_index(), 1), 0, f->buf.g_length(1));
+			if (m_queue.g_dataptr(f->buf.g_index(), 2))
+				memset(m_queue.g_dataptr(f->buf.g_index(), 2), 0, f->buf.g_length(2));
 		}
-		status.append(QString(" Average A-V: %1 ms")
-			      .arg((m_totalAudioLatency.tv_sec * 1000 + m_totalAudioLatency.tv_usec / 1000) / m_frame));
 	}
-#endif
-	if (plane[0] == NULL && showFrames())
-		status.append(" Error: Unsupported format.");
+	f->dequeued = false;
+	return !qbuf(f->buf);
+}
 
-	if (showFrames())
-		m_capture->setFrame(m_capImage->width(), m_capImage->height(),
-				    m_capDestFormat.g_pixelformat(),
-				    plane[0], plane[1], plane[2]);
+void ApplicationWindow::capFrame()
+{
+	std::deque<CapFrame *> frames;
+	CapFrame *shown = NULL;
+	bool show = showFrames();
 
-	if (m_capMethod == methodMmap || m_capMethod == methodUser) {
-		if (m_clear[buf.g_index()]) {
-			memset(m_queue.g_dataptr(buf.g_index(), 0), 0, buf.g_length());
-			if (V4L2_TYPE_IS_MULTIPLANAR(buf.g_type())) {
-				memset(m_queue.g_dataptr(buf.g_index(), 1), 0, buf.g_length(1));
-				if (m_queue.g_dataptr(buf.g_index(), 2))
-					memset(m_queue.g_dataptr(buf.g_index(), 2), 0, buf.g_length(2));
-			}
-			m_clear[buf.g_index()] = false;
-		}
-			
-		if (qbuf(buf)) {
-			error("Couldn't queue buffer\n");
+	{
+		std::lock_guard<std::mutex> lk(m_capLock);
+
+		frames.swap(m_capReady);
+		m_capNotified = false;
+		m_capShow = show;
+	}
+
+	/*
+	 * Latest frame wins: only the last frame of this batch is shown, and
+	 * only if the previous one was shown already.
+	 */
+	for (auto f : frames) {
+		if (f->err)
+			break;
+		if (f->show && show && !m_capture->renderPending())
+			shown = f;
+	}
+
+	for (auto f : frames) {
+		if (f->err) {
+			error(f->err);
 			m_capStartAct->setChecked(false);
 			return;
 		}
-	}
 
-	curStatus = statusBar()->currentMessage();
-	if (curStatus.isEmpty() || curStatus.startsWith("Frame: ") || curStatus.startsWith("No frame"))
-		statusBar()->showMessage(status);
-	if (m_frame == 1)
-		refresh();
+		if (f->convertFailed && m_frame == 0)
+			error(f->convertError);
+
+		if (m_capMethod == methodRead) {
+			if (m_makeSnapshot)
+				makeSnapshot(f->raw, f->s);
+			if (m_saveRaw.openMode())
+				m_saveRaw.write((const char *)f->raw, f->s);
+		} else {
+			if (m_makeSnapshot)
+				makeSnapshot(f->plane[0], f->bytesused[0]);
+			if (m_saveRaw.openMode())
+				m_saveRaw.write((const char *)f->plane[0], f->bytesused[0]);
+		}
+
+		QString status, curStatus;
+
+		calculateFps();
+
+		float wscale = m_capture->getHorScaleFactor();
+		float hscale = m_capture->getVertScaleFactor();
+		status = QString("Frame: %1 Fps: %2 Scale Factors: %3x%4").arg(++m_frame)
+				 .arg(m_fps, 0, 'f', 2, '0').arg(wscale).arg(hscale);
+		if (show && f != shown)
+			m_skipped++;
+		if (show)
+			status.append(QString(" Rendered: %1 Skipped: %2")
+				      .arg(m_frame - m_skipped).arg(m_skipped));
+		if (m_capMethod != methodRead)
+			status.append(QString(" SeqNr: %1").arg(f->buf.g_sequence()));
+#ifdef HAVE_ALSA
+		if (m_capMethod != methodRead && alsa_thread_is_running()) {
+			if (f->tvAlsa.tv_sec || f->tvAlsa.tv_usec) {
+				m_totalAudioLatency.tv_sec += f->buf.g_timestamp().tv_sec - f->tvAlsa.tv_sec;
+				m_totalAudioLatency.tv_usec += f->buf.g_timestamp().tv_usec - f->tvAlsa.tv_usec;
+			}
+			status.append(QString(" Average A-V: %1 ms")
+				      .arg((m_totalAudioLatency.tv_sec * 1000 + m_totalAudioLatency.tv_usec / 1000) / m_frame));
+		}
+#endif
+		if (f->plane[0] == NULL && show)
+			status.append(" Error: Unsupported format.");
+
+		if (f == shown) {
+			m_capture->setFrame(m_capImage->width(), m_capImage->height(),
+					    m_capDestFormat.g_pixelformat(),
+					    f->plane[0], f->plane[1], f->plane[2]);
+			// The previous frame is no longer referenced by the capture window
+			std::swap(f, m_capShown);
+		}
+
+		if (f) {
+			if (!releaseFrame(f)) {
+				error("Couldn't queue buffer\n");
+				m_capStartAct->setChecked(false);
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lk(m_capLock);
+
+				m_capFree.push_back(f);
+			}
+			m_capCond.notify_one();
+		}
+
+		curStatus = statusBar()->currentMessage();
+		if (curStatus.isEmpty() || curStatus.startsWith("Frame: ") || curStatus.startsWith("No frame"))
+			statusBar()->showMessage(status);
+		if (m_frame == 1)
+			refresh();
+	}
 }
 
 void ApplicationWindow::stopStreaming()
@@ -1177,6 +1389,7 @@ void ApplicationWindow::stopStreaming()
 					 !has_radio_tx();
 	v4l2_encoder_cmd cmd;
 
+	stopCapThread();
 	m_singleStep = false;
 	m_capStepAct->setEnabled(canStream && v4l_type_is_capture(g_type()));
 	stopAudio();
@@ -1188,6 +1401,7 @@ void ApplicationWindow::stopStreaming()
 
 	if (v4l_type_is_capture(g_type()) && m_capture)
 		m_capture->stop();
+	freeCapFrames();
 
 	m_snapshotAct->setDisabled(true);
 #ifdef HAVE_QTGL
@@ -1253,9 +1467,12 @@ void ApplicationWindow::updateCropping()
 
 void ApplicationWindow::clearBuffers()
 {
-	if (m_capture)
+	if (m_capture) {
+		std::lock_guard<std::mutex> lk(m_capLock);
+
 		for (unsigned b = 0; b < sizeof(m_clear); b++)
 			m_clear[b] = true;
+	}
 }
 
 void ApplicationWindow::startAudio()
@@ -1268,6 +1485,7 @@ void ApplicationWindow::startAudio()
 	QString audOut = m_genTab->getAudioOutDevice();
 
 	if (audIn != nullptr && audOut != nullptr && audIn.compare("None") && audIn.compare(audOut) != 0) {
+		alsa_thread_set_adaptive(m_audioAdaptiveAct->isChecked());
 		alsa_thread_startup(audOut.toLatin1().data(), audIn.toLatin1().data(),
 				    m_genTab->getAudioDeviceBufferSize(), NULL, 0);
 
@@ -1374,8 +1592,15 @@ void ApplicationWindow::capStep(bool checked)
 	if (!m_capStartAct->isChecked()) {
 		m_singleStep = true;
 		m_capStartAct->setChecked(true);
-	} else if (m_singleStep) {
+	} else if (m_singleStep && m_capNotifier) {
 		m_capNotifier->setEnabled(true);
+	} else if (m_singleStep) {
+		{
+			std::lock_guard<std::mutex> lk(m_capLock);
+
+			m_capSteps++;
+		}
+		m_capCond.notify_one();
 	}
 }
 
@@ -1418,6 +1643,7 @@ void ApplicationWindow::capStart(bool start)
 		return;
 	}
 	m_frame = m_fps = 0;
+	m_skipped = 0;
 	m_capMethod = m_genTab->capMethod();
 
 	if (m_genTab->isSlicedVbi()) {
@@ -1599,10 +1825,8 @@ void ApplicationWindow::capStart(bool start)
 		m_capture->show();
 
 	statusBar()->showMessage("No frame");
-	if (startStreaming()) {
-		m_capNotifier = new QSocketNotifier(g_fd(), QSocketNotifier::Read, m_tabs);
-		connect(m_capNotifier, SIGNAL(activated(int)), this, SLOT(capFrame()));
-	}
+	if (startStreaming())
+		startCapThread();
 }
 
 void ApplicationWindow::makeFullScreen(bool checked)
@@ -1637,6 +1861,10 @@ void ApplicationWindow::closeDevice()
 			m_ctrlNotifier->deleteLater();
 			m_ctrlNotifier = NULL;
 		}
+		stopCapThread();
+		if (m_capture)
+			m_capture->stop();
+		freeCapFrames();
 		delete [] m_frameData;
 		m_frameData = NULL;
 		v4lconvert_destroy(m_convertData);
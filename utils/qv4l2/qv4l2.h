@@ -28,8 +28,13 @@
 #include <QSocketNotifier>
 #include <QImage>
 #include <QFileDialog>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <thread>
 #include <vector>
+#include <sys/time.h>
 
 // Must come before cv4l-helpers.h
 #include <libv4l2.h>
@@ -113,6 +118,45 @@ private:
 	bool startOutput();
 	void stopOutput();
 
+	/*
+	 * A captured frame, dequeued (and converted if needed) by the
+	 * capture thread and handed over to capFrame().
+	 */
+	struct CapFrame {
+		cv4l_buffer buf;
+		bool dequeued;
+		int s;
+		unsigned char *raw;
+		unsigned char *conv;
+		unsigned char *plane[3];
+		unsigned bytesused[3];
+		bool show;
+		bool convertFailed;
+		QString convertError;
+		const char *err;
+		struct timeval tvAlsa;
+	};
+
+	void startCapThread();
+	void stopCapThread();
+	void freeCapFrames();
+	void capThread();
+	bool capThreadFrame(CapFrame *f);
+	bool releaseFrame(CapFrame *f);
+
+	std::thread m_capThread;
+	std::mutex m_capLock;
+	std::condition_variable m_capCond;
+	std::vector<CapFrame *> m_capFrames;
+	std::vector<CapFrame *> m_capFree;
+	std::deque<CapFrame *> m_capReady;
+	CapFrame *m_capShown;
+	bool m_capExit;
+	bool m_capNotified;
+	bool m_capShow;
+	unsigned m_capSteps;
+	int m_capWakeup[2];
+
 	bool m_clear[64];
 	cv4l_fmt m_capSrcFormat;
 	cv4l_fmt m_capDestFormat;
@@ -268,6 +312,7 @@ private:
 	QAction *m_saveRawAct;
 	QAction *m_useGLAct;
 	QAction *m_audioBufferAct;
+	QAction *m_audioAdaptiveAct;
 	QAction *m_scalingAct;
 	QAction *m_makeFullScreenAct;
 	QString m_filename;
@@ -288,6 +333,7 @@ private:
 	struct vbi_handle m_vbiHandle;
 	int m_sdrSize;
 	unsigned m_frame;
+	unsigned m_skipped;
 	double m_fps;
 	struct timespec m_startTimestamp;
 	struct timeval m_totalAudioLatency;
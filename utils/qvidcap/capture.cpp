@@ -26,7 +26,9 @@
 #include <QTimer>
 #include <QApplication>
 
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include "v4l2-info.h"
 
 const __u32 formats[] = {
@@ -225,14 +227,33 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	m_singleStep(false),
 	m_singleStepStart(0),
 	m_singleStepNext(false),
+	m_paintPending(false),
+	m_framePending(false),
+	m_newFrame(false),
+	m_rendered(0),
+	m_skipped(0),
 	m_screenTextureCount(0),
 	m_program(0),
+	m_haveDmaBuf(false),
 	m_curIndex(-1),
 	m_nextIndex(-1),
+	m_scopeMode(ScopeNone),
+	m_scopeProgramMode(ScopeNone),
+	m_scopeScatter(0),
+	m_scopeDisplay(0),
+	m_scopeVao(0),
+	m_recordPboIdx(0),
+	m_traceFd(-1),
+	m_tracePending(false),
 	m_scrollArea(sa)
 {
-	m_curSize[0] = 0;
-	m_curData[0] = 0;
+	for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++) {
+		m_curSize[p] = 0;
+		m_curData[p] = 0;
+	}
+	memset(m_dmaBufImage, 0, sizeof(m_dmaBufImage));
+	m_recordPbo[0] = m_recordPbo[1] = 0;
+	m_recordPboFull[0] = m_recordPboFull[1] = false;
 	m_canOverrideResolution = false;
 	m_pixelaspect.numerator = 1;
 	m_pixelaspect.denominator = 1;
@@ -301,6 +322,16 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 			       quantization2s(quantizations[i]).c_str(), quantizations[i]);
 	connect(grp, SIGNAL(triggered(QAction *)), this, SLOT(quantChanged(QAction *)));
 
+	menu = new QMenu("Scopes (S)");
+	m_scopeMenu = menu;
+	grp = new QActionGroup(menu);
+	addSubMenuItem(grp, menu, "None", ScopeNone)->setChecked(true);
+	addSubMenuItem(grp, menu, "Luma Histogram", ScopeLumaHistogram);
+	addSubMenuItem(grp, menu, "RGB Histogram", ScopeRGBHistogram);
+	addSubMenuItem(grp, menu, "Luma Waveform", ScopeWaveform);
+	addSubMenuItem(grp, menu, "Vectorscope", ScopeVectorscope);
+	connect(grp, SIGNAL(triggered(QAction *)), this, SLOT(scopeChanged(QAction *)));
+
 	menu = new QMenu("Display Options");
 	m_displayMenu = menu;
 	grp = new QActionGroup(menu);
@@ -320,12 +351,22 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	m_exitFullScreen = new QAction("Exit fullscreen (F or Esc)", this);
 	connect(m_exitFullScreen, SIGNAL(triggered(bool)),
 		this, SLOT(toggleFullScreen(bool)));
+
+	connect(this, SIGNAL(frameSwapped()), this, SLOT(frameSwappedEvent()));
 }
 
 CaptureWin::~CaptureWin()
 {
+	m_sockReader.stop();
 	makeCurrent();
-	delete m_program;
+	freeDmaBuf();
+	freeScopes();
+	freeRecord();
+	m_recorder.stop();
+	if (m_traceFd >= 0)
+		::close(m_traceFd);
+	m_upload.destroy();
+	releaseProgram();
 }
 
 void CaptureWin::resizeEvent(QResizeEvent *event)
@@ -459,6 +500,12 @@ void CaptureWin::quantChanged(QAction *a)
 	updateShader();
 }
 
+void CaptureWin::scopeChanged(QAction *a)
+{
+	m_scopeMode = (ScopeMode)a->data().toInt();
+	update();
+}
+
 void CaptureWin::restoreSize(bool)
 {
 	QSize s = correctAspect(QSize(m_origWidth, m_origHeight));
@@ -503,10 +550,12 @@ void CaptureWin::resolutionOverrideChanged(bool checked)
 
 void CaptureWin::toggleFullScreen(bool)
 {
-	if (m_scrollArea->isFullScreen())
-		m_scrollArea->showNormal();
+	QWidget *win = m_scrollArea->window();
+
+	if (win->isFullScreen())
+		win->showNormal();
 	else
-		m_scrollArea->showFullScreen();
+		win->showFullScreen();
 }
 
 void CaptureWin::contextMenuEvent(QContextMenuEvent *event)
@@ -519,7 +568,7 @@ void CaptureWin::contextMenuEvent(QContextMenuEvent *event)
 	act = menu.addAction("Reset window");
 	connect(act, SIGNAL(triggered(bool)), this, SLOT(restoreSize(bool)));
 
-	if (m_scrollArea->isFullScreen())
+	if (m_scrollArea->window()->isFullScreen())
 		menu.addAction(m_exitFullScreen);
 	else
 		menu.addAction(m_enterFullScreen);
@@ -536,6 +585,7 @@ void CaptureWin::contextMenuEvent(QContextMenuEvent *event)
 	else if (!m_is_rgb)
 		menu.addMenu(m_ycbcrEncMenu);
 	menu.addMenu(m_quantMenu);
+	menu.addMenu(m_scopeMenu);
 	menu.addMenu(m_displayMenu);
 
 	menu.exec(event->globalPos());
@@ -588,11 +638,14 @@ void CaptureWin::keyPressEvent(QKeyEvent *event)
 	case Qt::Key_Space:
 		if (m_mode == AppModeTest)
 			m_cnt = 1;
-		else if (m_singleStep && m_frame > m_singleStepStart)
+		else if (m_singleStep && m_frame > m_singleStepStart) {
 			m_singleStepNext = true;
+			if (m_mode == AppModeSocket)
+				sockReadEvent();
+		}
 		return;
 	case Qt::Key_Escape:
-		if (!m_scrollArea->isFullScreen())
+		if (!m_scrollArea->window()->isFullScreen())
 			return;
 	case Qt::Key_Left:
 		if (hasShift) {
@@ -667,6 +720,14 @@ void CaptureWin::keyPressEvent(QKeyEvent *event)
 		checkSubMenuItem(m_quantMenu, m_overrideQuantization);
 		updateShader();
 		return;
+	case Qt::Key_S:
+		if (hasShift)
+			m_scopeMode = (ScopeMode)((m_scopeMode + ScopeCount - 1) % ScopeCount);
+		else
+			m_scopeMode = (ScopeMode)((m_scopeMode + 1) % ScopeCount);
+		checkSubMenuItem(m_scopeMenu, m_scopeMode);
+		update();
+		return;
 	case Qt::Key_X:
 		cycleMenu(m_overrideXferFunc, m_origXferFunc,
 			  xfer_funcs, hasShift, hasCtrl);
@@ -799,10 +860,11 @@ void CaptureWin::setModeV4L2(cv4l_fd *fd)
 		printf("using libv4l2\n");
 }
 
-void CaptureWin::setModeSocket(int socket, int port)
+void CaptureWin::setModeSocket(int socket, const QString &host, int port)
 {
 	m_mode = AppModeSocket;
 	m_sock = socket;
+	m_host = host;
 	m_port = port;
 	if (m_ctx)
 		free(m_ctx);
@@ -811,10 +873,7 @@ void CaptureWin::setModeSocket(int socket, int port)
 			   m_v4l_fmt.g_field(), m_v4l_fmt.g_colorspace(), m_v4l_fmt.g_xfer_func(),
 			   m_v4l_fmt.g_ycbcr_enc(), m_v4l_fmt.g_quantization());
 
-	QSocketNotifier *readSock = new QSocketNotifier(m_sock,
-		QSocketNotifier::Read, this);
-
-	connect(readSock, SIGNAL(activated(int)), this, SLOT(sockReadEvent()));
+	m_sockReader.start(this, m_sock, m_v4l_fmt, m_ctx, m_singleStep);
 }
 
 void CaptureWin::setModeFile(const QString &filename)
@@ -842,6 +901,12 @@ void CaptureWin::setModeTest(unsigned cnt)
 void CaptureWin::setQueue(cv4l_queue *q)
 {
 	m_v4l_queue = q;
+#ifdef HAVE_EGL
+	// Exported buffers can be imported as EGLImages, see render_DmaBuf()
+	if (q->g_memory() == V4L2_MEMORY_MMAP &&
+	    q->export_bufs(m_fd, m_fd->g_type()))
+		q->close_exported_fds();
+#endif
 	if (m_origPixelFormat == 0)
 		updateOrigValues();
 }
@@ -1137,11 +1202,13 @@ void CaptureWin::v4l2ReadEvent()
 	int next = m_nextIndex;
 	m_nextIndex = buf.g_index();
 	if (next != -1) {
+		// The previous frame was never shown
 		buf.s_index(next);
 		m_fd->qbuf(buf);
+		m_skipped++;
 	}
 	m_frame++;
-	update();
+	scheduleFrame();
 	if (m_cnt == 0)
 		return;
 	if (--m_cnt == 0)
@@ -1175,6 +1242,7 @@ void CaptureWin::listenForNewConnection()
 	cv4l_fmt fmt;
 	v4l2_fract pixelaspect = { 1, 1 };
 
+	m_sockReader.stop();
 	::close(m_sock);
 
 	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
@@ -1186,7 +1254,7 @@ void CaptureWin::listenForNewConnection()
 	int sock_fd;
 
 	for (;;) {
-		sock_fd = initSocket(m_port, fmt, pixelaspect);
+		sock_fd = initSocket(m_host, m_port, fmt, pixelaspect);
 		if (setV4LFormat(fmt))
 			break;
 		fprintf(stderr, "Unsupported format: '%s' %s\n",
@@ -1202,137 +1270,521 @@ void CaptureWin::listenForNewConnection()
 			   fmt.g_ycbcr_enc(), fmt.g_quantization());
 	setPixelAspect(pixelaspect);
 	updateOrigValues();
-	setModeSocket(sock_fd, m_port);
+	setModeSocket(sock_fd, m_host, m_port);
 	restoreSize();
 }
 
-int CaptureWin::read_u32(__u32 &v)
+SockReader::SockReader() :
+	m_win(0),
+	m_sock(-1),
+	m_ctx(0),
+	m_noDrop(false),
+	m_sequence(0),
+	m_haveReady(false),
+	m_notified(false),
+	m_closed(false),
+	m_exit(false),
+	m_dropped(0),
+	m_buf(65536),
+	m_bufStart(0),
+	m_bufEnd(0)
 {
-	int n;
+	for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++)
+		m_back[p] = m_ready[p] = NULL;
+}
 
-	v = 0;
-	n = read(m_sock, &v, sizeof(v));
-	if (n != sizeof(v)) {
-		fprintf(stderr, "could not read __u32\n");
-		return -1;
+void SockReader::start(CaptureWin *win, int sock, const cv4l_fmt &fmt,
+		       codec_ctx *ctx, bool noDrop)
+{
+	stop();
+	m_win = win;
+	m_sock = sock;
+	m_fmt = fmt;
+	m_ctx = ctx;
+	m_noDrop = noDrop;
+	m_haveReady = m_notified = m_closed = m_exit = false;
+	m_dropped = 0;
+	m_bufStart = m_bufEnd = 0;
+	m_thread = std::thread(&SockReader::run, this);
+}
+
+void SockReader::stop()
+{
+	if (!m_thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_exit = true;
 	}
-	v = ntohl(v);
-	return 0;
+	m_cond.notify_all();
+	// Wake up the thread if it is waiting for data
+	shutdown(m_sock, SHUT_RD);
+	m_thread.join();
+	freeFrames();
 }
 
-void CaptureWin::sockReadEvent()
+void SockReader::freeFrames()
 {
-	int n;
+	for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++) {
+		delete [] m_back[p];
+		delete [] m_ready[p];
+		m_back[p] = m_ready[p] = NULL;
+	}
+}
 
-	if (m_singleStep && m_frame > m_singleStepStart && !m_singleStepNext)
+/*
+ * Swap the latest frame with the planes in data. Returns false if there
+ * is no new frame. Sets closed if the connection was lost.
+ */
+bool SockReader::takeFrame(__u8 *data[MAX_TEXTURES_NEEDED], bool &closed,
+			   v4l_stream_trace &trace)
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	m_notified = false;
+	closed = m_closed;
+	if (!m_haveReady)
+		return false;
+	for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++)
+		std::swap(data[p], m_ready[p]);
+	trace = m_readyTrace;
+	m_haveReady = false;
+	m_cond.notify_all();
+	return true;
+}
+
+// The number of received frames that were replaced before the GUI took them
+unsigned SockReader::dropped()
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	return m_dropped;
+}
+
+void SockReader::run()
+{
+	for (;;) {
+		int ret = recvFrame();
+		std::unique_lock<std::mutex> lk(m_lock);
+
+		if (m_exit)
+			break;
+		if (ret < 0) {
+			m_closed = true;
+		} else if (ret == 0) {
+			continue;
+		} else {
+			while (m_noDrop && m_haveReady && !m_exit)
+				m_cond.wait(lk);
+			if (m_exit)
+				break;
+			for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++)
+				std::swap(m_back[p], m_ready[p]);
+			m_readyTrace = m_backTrace;
+			if (m_haveReady)
+				m_dropped++;
+			m_haveReady = true;
+		}
+		if (!m_notified) {
+			m_notified = true;
+			QMetaObject::invokeMethod(m_win, "sockReadEvent", Qt::QueuedConnection);
+		}
+		if (m_closed)
+			break;
+	}
+}
+
+FrameRecorder::FrameRecorder() :
+	m_fd(-1),
+	m_width(0),
+	m_height(0),
+	m_written(0),
+	m_dropped(0),
+	m_exit(false)
+{
+}
+
+bool FrameRecorder::start(const QString &filename)
+{
+	stop();
+	m_fd = open(filename.toUtf8().data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_fd < 0) {
+		fprintf(stderr, "could not open %s for writing\n", filename.toUtf8().data());
+		return false;
+	}
+	m_width = m_height = 0;
+	m_written = m_dropped = 0;
+	m_exit = false;
+	m_free.clear();
+	m_queued.clear();
+	for (unsigned i = 0; i < numBufs; i++)
+		m_free.push_back(i);
+	m_thread = std::thread(&FrameRecorder::run, this);
+	return true;
+}
+
+void FrameRecorder::stop()
+{
+	if (m_fd < 0)
 		return;
-	m_singleStepNext = false;
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_exit = true;
+	}
+	m_cond.notify_all();
+	m_thread.join();
+	close(m_fd);
+	m_fd = -1;
+	for (unsigned i = 0; i < numBufs; i++)
+		std::vector<__u8>().swap(m_bufs[i]);
+	if (m_width)
+		printf("Recorded %u frames of %ux%u, %u dropped\n",
+		       m_written, m_width, m_height, m_dropped);
+}
 
-	if (m_origPixelFormat == 0)
-		updateOrigValues();
+/*
+ * Queues a bottom-up RGBA frame, as read by glReadPixels(). All frames in the
+ * file have the size of the first one, others are dropped.
+ */
+void FrameRecorder::write(const __u8 *data, unsigned width, unsigned height)
+{
+	unsigned stride = width * 4;
+	unsigned idx;
 
-	if (m_curSize[0] == 0) {
-		for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-			m_curSize[p] = m_v4l_fmt.g_sizeimage(p);
-			m_curData[p] = new __u8[m_curSize[p]];
+	if (!m_width) {
+		m_width = width;
+		m_height = height;
+	}
+	if (width != m_width || height != m_height) {
+		m_dropped++;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+
+		if (m_free.empty()) {
+			m_dropped++;
+			return;
+		}
+		idx = m_free.back();
+		m_free.pop_back();
+	}
+
+	std::vector<__u8> &buf = m_bufs[idx];
+
+	buf.resize(stride * height);
+	for (unsigned y = 0; y < height; y++)
+		memcpy(&buf[y * stride], data + (height - 1 - y) * stride, stride);
+
+	std::lock_guard<std::mutex> lk(m_lock);
+
+	m_queued.push_back(idx);
+	m_cond.notify_all();
+}
+
+void FrameRecorder::run()
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+
+	for (;;) {
+		while (m_queued.empty() && !m_exit)
+			m_cond.wait(lk);
+		if (m_queued.empty())
+			break;
+
+		unsigned idx = m_queued.front();
+		std::vector<__u8> &buf = m_bufs[idx];
+		size_t done = 0;
+
+		m_queued.erase(m_queued.begin());
+		lk.unlock();
+		while (done < buf.size()) {
+			ssize_t n = ::write(m_fd, buf.data() + done, buf.size() - done);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				fprintf(stderr, "error writing the recording: %s\n", strerror(errno));
+				break;
+			}
+			done += n;
+		}
+		lk.lock();
+		if (done == buf.size())
+			m_written++;
+		m_free.push_back(idx);
+	}
+}
+
+/*
+ * Headers are read from the socket in batches through m_buf, large
+ * payloads are received straight into their destination.
+ */
+bool SockReader::recvData(void *p, unsigned size)
+{
+	__u8 *dst = (__u8 *)p;
+
+	while (size) {
+		unsigned avail = m_bufEnd - m_bufStart;
+		ssize_t n;
+
+		if (avail) {
+			if (avail > size)
+				avail = size;
+			memcpy(dst, &m_buf[m_bufStart], avail);
+			m_bufStart += avail;
+			dst += avail;
+			size -= avail;
+			continue;
 		}
+		if (size >= m_buf.size()) {
+			n = recv(m_sock, dst, size, MSG_WAITALL);
+			if (n > 0) {
+				dst += n;
+				size -= n;
+				continue;
+			}
+		} else {
+			n = recv(m_sock, m_buf.data(), m_buf.size(), 0);
+			if (n > 0) {
+				m_bufStart = 0;
+				m_bufEnd = n;
+				continue;
+			}
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			fprintf(stderr, "error reading %u bytes\n", size);
+		return false;
+	}
+	return true;
+}
+
+bool SockReader::recvU32(__u32 &v)
+{
+	v = 0;
+	if (!recvData(&v, sizeof(v))) {
+		fprintf(stderr, "could not read __u32\n");
+		return false;
 	}
+	v = ntohl(v);
+	return true;
+}
+
+bool SockReader::recvSkip(unsigned size)
+{
+	char buf[1024];
 
-	unsigned packet, sz;
+	while (size) {
+		unsigned rdsize = size > sizeof(buf) ? sizeof(buf) : size;
+
+		if (!recvData(buf, rdsize))
+			return false;
+		size -= rdsize;
+	}
+	return true;
+}
+
+/*
+ * Receive the next packet into the back buffer.
+ * Returns 1 for a frame, 0 if the packet was skipped and -1 on errors.
+ */
+int SockReader::recvFrame()
+{
+	__u32 packet, sz;
 	bool is_fwht;
+	__u64 arrived;
 
-	if (read_u32(packet))
-		goto new_conn;
+	if (!recvU32(packet))
+		return -1;
+	arrived = v4l_stream_trace_now();
 
 	if (packet == V4L_STREAM_PACKET_END) {
 		fprintf(stderr, "END packet read\n");
-		goto new_conn;
+		return -1;
 	}
 
-	if (read_u32(sz))
-		goto new_conn;
+	if (!recvU32(sz))
+		return -1;
 
 	if (packet != V4L_STREAM_PACKET_FRAME_VIDEO_RLE &&
 	    packet != V4L_STREAM_PACKET_FRAME_VIDEO_FWHT) {
-		char buf[1024];
-
 		fprintf(stderr, "expected FRAME_VIDEO, got 0x%08x\n", packet);
-		while (sz) {
-			unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
-
-			n = read(m_sock, buf, rdsize);
-			if (n < 0) {
-				fprintf(stderr, "error reading %d bytes\n", sz);
-				goto new_conn;
-			}
-			sz -= n;
-		}
-		return;
+		return recvSkip(sz) ? 0 : -1;
 	}
 
 	is_fwht = m_ctx && packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
 
-	if (read_u32(sz))
-		goto new_conn;
+	if (!recvU32(sz))
+		return -1;
 
-	if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR) {
+	if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR &&
+	    sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE) {
 		fprintf(stderr, "unsupported FRAME_VIDEO size\n");
-		goto new_conn;
+		return -1;
 	}
-	if (read_u32(sz) ||  // ignore field
-	    read_u32(sz))    // ignore flags
-		goto new_conn;
+	bool has_trace = sz == V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE;
 
-	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-		__u32 max_size = is_fwht ? m_ctx->comp_max_size : m_curSize[p];
-		__u8 *dst = is_fwht ? m_ctx->state.compressed_frame : m_curData[p];
+	if (!recvU32(sz) ||  // ignore field
+	    !recvU32(sz))    // ignore flags
+		return -1;
+
+	v4l_stream_trace_init(&m_backTrace, m_sequence++);
+	if (has_trace) {
+		__u32 words[V4L_STREAM_TRACE_SIZE / 4];
+
+		if (!recvData(words, sizeof(words)))
+			return -1;
+		if (!v4l_stream_trace_unpack(&m_backTrace, words))
+			v4l_stream_trace_init(&m_backTrace, m_sequence - 1);
+		else if (m_backTrace.num_stages)
+			v4l_stream_trace_add(&m_backTrace, V4L_STREAM_TRACE_TRANSFER,
+					     v4l_stream_trace_last_end(&m_backTrace),
+					     arrived);
+	}
+
+	for (unsigned p = 0; p < m_fmt.g_num_planes(); p++) {
+		__u32 plane_size = m_fmt.g_sizeimage(p);
+
+		if (!m_back[p])
+			m_back[p] = new __u8[plane_size];
+
+		__u32 max_size = is_fwht ? m_ctx->comp_max_size : plane_size;
+		__u8 *dst = is_fwht ? m_ctx->state.compressed_frame : m_back[p];
 		__u32 data_size;
 		__u32 offset;
 		__u32 size;
 
-		if (read_u32(sz))
-			goto new_conn;
+		if (!recvU32(sz))
+			return -1;
 		if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR) {
 			fprintf(stderr, "unsupported FRAME_VIDEO plane size\n");
-			goto new_conn;
+			return -1;
 		}
-		if (read_u32(size) || read_u32(data_size))
-			goto new_conn;
-		offset = is_fwht ? 0 : size - data_size;
-		sz = data_size;
+		if (!recvU32(size) || !recvU32(data_size))
+			return -1;
 
 		if (data_size > max_size) {
 			fprintf(stderr, "data size is too large (%u > %u)\n",
 				data_size, max_size);
-			goto new_conn;
+			return -1;
 		}
-		while (sz) {
-			n = read(m_sock, dst + offset, sz);
-			if (n < 0) {
-				fprintf(stderr, "error reading %d bytes\n", sz);
-				goto new_conn;
-			}
-			if ((__u32)n == sz)
-				break;
-			offset += n;
-			sz -= n;
+		if (!is_fwht && (size > plane_size || data_size > size)) {
+			fprintf(stderr, "plane size is too large (%u > %u)\n",
+				size, plane_size);
+			return -1;
 		}
+		offset = is_fwht ? 0 : size - data_size;
+		if (!recvData(dst + offset, data_size))
+			return -1;
 		if (is_fwht)
-			fwht_decompress(m_ctx, dst, data_size, m_curData[p], m_curSize[p]);
+			fwht_decompress(m_ctx, dst, data_size, m_back[p], plane_size);
 		else
 			rle_decompress(dst, size, data_size,
-				       rle_calc_bpl(m_v4l_fmt.g_bytesperline(p), m_v4l_fmt.g_pixelformat()));
+				       rle_calc_bpl(m_fmt.g_bytesperline(p), m_fmt.g_pixelformat()));
+	}
+	v4l_stream_trace_add(&m_backTrace, V4L_STREAM_TRACE_DECOMPRESS,
+			     arrived, v4l_stream_trace_now());
+	return 1;
+}
+
+void CaptureWin::sockReadEvent()
+{
+	bool closed;
+
+	if (m_singleStep && m_frame > m_singleStepStart && !m_singleStepNext)
+		return;
+
+	if (m_origPixelFormat == 0)
+		updateOrigValues();
+
+	// Leave the frame to the reader until the previous one is shown
+	if (m_paintPending) {
+		m_framePending = true;
+		return;
+	}
+
+	bool haveFrame = m_sockReader.takeFrame(m_curData, closed, m_curTrace);
+
+	if (closed) {
+		listenForNewConnection();
+		return;
 	}
+	if (!haveFrame)
+		return;
+	m_singleStepNext = false;
+	m_tracePending = m_traceFd >= 0;
+
+	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++)
+		m_curSize[p] = m_v4l_fmt.g_sizeimage(p);
 	m_frame++;
-	update();
+	scheduleFrame();
 	if (m_cnt == 0)
 		return;
 	if (--m_cnt == 0)
 		std::exit(EXIT_SUCCESS);
-	return;
+}
 
-new_conn:
-	listenForNewConnection();
+/*
+ * Latest frame wins: only one repaint is requested until the frame is
+ * swapped, which happens at most once per vsync. Frames that arrive in
+ * the meantime replace each other and are never uploaded.
+ */
+void CaptureWin::scheduleFrame()
+{
+	m_newFrame = true;
+	if (m_paintPending) {
+		m_framePending = true;
+		return;
+	}
+	m_paintPending = true;
+	update();
+}
+
+bool CaptureWin::setTraceFile(const QString &filename)
+{
+	m_traceFd = v4l_stream_trace_open(filename.toUtf8().data(), "qvidcap");
+	if (m_traceFd < 0) {
+		fprintf(stderr, "could not open %s for writing\n", filename.toUtf8().data());
+		return false;
+	}
+	return true;
+}
+
+void CaptureWin::frameSwappedEvent()
+{
+	m_paintPending = false;
+
+	if (m_tracePending) {
+		v4l_stream_trace_add(&m_curTrace, V4L_STREAM_TRACE_DISPLAY,
+				     v4l_stream_trace_last_end(&m_curTrace),
+				     v4l_stream_trace_now());
+		v4l_stream_trace_write(m_traceFd, &m_curTrace);
+		m_tracePending = false;
+	}
+
+	if (m_reportTimings) {
+		if (!m_statsTimer.isValid())
+			m_statsTimer.start();
+		if (m_statsTimer.elapsed() >= 1000) {
+			unsigned dropped = m_sockReader.dropped();
+
+			printf("Frames captured: %u, rendered: %u, skipped: %u\n",
+			       m_frame + dropped, m_rendered, m_skipped + dropped);
+			m_statsTimer.restart();
+		}
+	}
+
+	if (!m_framePending)
+		return;
+	m_framePending = false;
+	if (m_mode == AppModeSocket) {
+		sockReadEvent();
+		return;
+	}
+	m_paintPending = true;
+	update();
 }
 
 void CaptureWin::resizeGL(int w, int h)
@@ -1484,14 +1936,22 @@ void CaptureWin::tpgUpdateFrame()
 			tpg_s_field(&m_tpg, V4L2_FIELD_TOP, true);
 	}
 
+	// Don't generate a frame that would be replaced before it is shown
+	bool skip = m_paintPending && m_mode != AppModeTest && !m_singleStep;
+
 	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-		if (m_mode == AppModeFile)
+		if (m_mode == AppModeFile && skip)
+			m_file.seek(m_file.pos() + m_curSize[p]);
+		else if (m_mode == AppModeFile)
 			m_file.read((char *)m_curData[p], m_curSize[p]);
-		else
+		else if (!skip)
 			tpg_fillbuffer(&m_tpg, 0, p, m_curData[p]);
 	}
 	m_frame++;
-	update();
+	if (skip)
+		m_skipped++;
+	else
+		scheduleFrame();
 	if (m_cnt != 1)
 		tpg_update_mv_count(&m_tpg, is_alt);
 
@@ -16,6 +16,11 @@
 #include <QAction>
 #include <QActionGroup>
 #include <QScrollArea>
+#include <QElapsedTimer>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 #if QT_VERSION < 0x060000
 #include <QtGui/QOpenGLShaderProgram>
 #else
@@ -23,6 +28,7 @@
 #endif
 
 #include "qvidcap.h"
+#include "gl-upload.h"
 
 extern "C" {
 #include "v4l2-tpg.h"
@@ -54,6 +60,16 @@ enum AppMode {
 #define YCBCR_HSV_ENC_MASK	(1 << 4)
 #define QUANT_MASK		(1 << 5)
 
+// The scope shown on top of the frame, cycled with 'S'
+enum ScopeMode {
+	ScopeNone,
+	ScopeLumaHistogram,
+	ScopeRGBHistogram,
+	ScopeWaveform,
+	ScopeVectorscope,
+	ScopeCount
+};
+
 struct TestState {
 	unsigned fmt_idx;
 	unsigned field_idx;
@@ -68,6 +84,96 @@ struct TestState {
 // This must be equal to the max number of textures that any shader uses
 #define MAX_TEXTURES_NEEDED 3
 
+class CaptureWin;
+
+/*
+ * Receives the v4l-stream frames on its own thread, so a slow link does not
+ * freeze the GUI. Each frame is received and decompressed into the back
+ * buffer, which is then swapped with the ready buffer. The GUI swaps the
+ * ready buffer with the one it shows, so it always shows the latest complete
+ * frame. In noDrop mode the thread waits for the GUI instead of replacing a
+ * ready frame that was not shown yet.
+ */
+class SockReader
+{
+public:
+	SockReader();
+	~SockReader() { stop(); }
+
+	void start(CaptureWin *win, int sock, const cv4l_fmt &fmt,
+		   codec_ctx *ctx, bool noDrop);
+	void stop();
+	bool takeFrame(__u8 *data[MAX_TEXTURES_NEEDED], bool &closed,
+		       v4l_stream_trace &trace);
+	unsigned dropped();
+
+private:
+	void run();
+	int recvFrame();
+	bool recvData(void *p, unsigned size);
+	bool recvU32(__u32 &v);
+	bool recvSkip(unsigned size);
+	void freeFrames();
+
+	CaptureWin *m_win;
+	int m_sock;
+	cv4l_fmt m_fmt;
+	codec_ctx *m_ctx;
+	bool m_noDrop;
+	__u8 *m_back[MAX_TEXTURES_NEEDED];
+	__u8 *m_ready[MAX_TEXTURES_NEEDED];
+	v4l_stream_trace m_backTrace;
+	v4l_stream_trace m_readyTrace;
+	__u32 m_sequence;
+	bool m_haveReady;
+	bool m_notified;
+	bool m_closed;
+	bool m_exit;
+	unsigned m_dropped;
+	std::vector<__u8> m_buf;
+	unsigned m_bufStart;
+	unsigned m_bufEnd;
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+};
+
+/*
+ * Writes the frames that --record reads back from the GPU to a file on its
+ * own thread, so a slow disk does not stall rendering. The GUI copies each
+ * frame into a free buffer, flipping it upright. When all buffers are
+ * waiting to be written the frame is dropped instead.
+ */
+class FrameRecorder
+{
+public:
+	FrameRecorder();
+	~FrameRecorder() { stop(); }
+
+	bool start(const QString &filename);
+	void stop();
+	bool active() const { return m_fd >= 0; }
+	void write(const __u8 *data, unsigned width, unsigned height);
+
+private:
+	void run();
+
+	static const unsigned numBufs = 4;
+
+	int m_fd;
+	unsigned m_width;
+	unsigned m_height;
+	unsigned m_written;
+	unsigned m_dropped;
+	bool m_exit;
+	std::vector<__u8> m_bufs[numBufs];
+	std::vector<unsigned> m_free;
+	std::vector<unsigned> m_queued;
+	std::mutex m_lock;
+	std::condition_variable m_cond;
+	std::thread m_thread;
+};
+
 class CaptureWin : public QOpenGLWidget, protected QOpenGLFunctions
 {
 	Q_OBJECT
@@ -76,7 +182,7 @@ public:
 	~CaptureWin();
 
 	void setModeV4L2(cv4l_fd *fd);
-	void setModeSocket(int sock, int port);
+	void setModeSocket(int sock, const QString &host, int port);
 	void setModeFile(const QString &filename);
 	void setModeTPG();
 	void setModeTest(unsigned cnt);
@@ -100,6 +206,8 @@ public:
 	void setFps(double fps) { m_fps = fps; }
 	void setSingleStepStart(unsigned start) { m_singleStep = true; m_singleStepStart = start; }
 	void setTestState(const TestState &state) { m_testState = state; }
+	bool setRecordFile(const QString &filename) { return m_recorder.start(filename); }
+	bool setTraceFile(const QString &filename);
 	QSize correctAspect(const QSize &s) const;
 	void startTimer();
 	struct tpg_data *getTPG() { return &m_tpg; }
@@ -109,6 +217,7 @@ private slots:
 	void v4l2ExceptionEvent();
 	void sockReadEvent();
 	void tpgUpdateFrame();
+	void frameSwappedEvent();
 
 	void restoreAll(bool checked);
 	void restoreSize(bool checked = false);
@@ -119,6 +228,7 @@ private slots:
 	void ycbcrEncChanged(QAction *a);
 	void hsvEncChanged(QAction *a);
 	void quantChanged(QAction *a);
+	void scopeChanged(QAction *a);
 	void windowScalingChanged(QAction *a);
 	void resolutionOverrideChanged(bool);
 	void toggleFullScreen(bool b = false);
@@ -132,7 +242,7 @@ private:
 	void keyPressEvent(QKeyEvent *event);
 	void mouseDoubleClickEvent(QMouseEvent * e);
 	void listenForNewConnection();
-	int read_u32(__u32 &v);
+	void scheduleFrame();
 	void showCurrentOverrides();
 	void cycleMenu(__u32 &overrideVal, __u32 origVal,
 		       const __u32 values[], bool hasShift, bool hasCtrl);
@@ -144,6 +254,9 @@ private:
 	void updateOrigValues();
 	void updateShader();
 	void changeShader();
+	QOpenGLShaderProgram *acquireProgram(const QString &fragment,
+					     const QString &vertex);
+	void releaseProgram();
 
 	// Colorspace conversion shaders
 	void shader_YUV();
@@ -165,10 +278,26 @@ private:
 	void render_NV16(__u32 format);
 	void render_NV24(__u32 format);
 
+	// Zero-copy display of DMABUF exported V4L2 buffers
+	void initDmaBuf();
+	bool render_DmaBuf(__u32 format);
+	void freeDmaBuf();
+
+	// Histogram, waveform and vectorscope overlays computed on the GPU
+	bool initScopes();
+	void renderScopes(GLuint frameVao);
+	void freeScopes();
+
+	// Asynchronous read back of the rendered frames for --record
+	void recordFrame(const QRect &r);
+	void freeRecord();
+
 	enum AppMode m_mode;
 	cv4l_fd *m_fd;
 	int m_sock;
+	QString m_host;
 	int m_port;
+	SockReader m_sockReader;
 	QFile m_file;
 	bool m_v4l2;
 	cv4l_fmt m_v4l_fmt;
@@ -218,10 +347,22 @@ private:
 	unsigned m_singleStepStart;
 	bool m_singleStepNext;
 
+	// Latest frame wins render scheduling
+	bool m_paintPending;
+	bool m_framePending;
+	bool m_newFrame;
+	unsigned m_rendered;
+	unsigned m_skipped;
+	QElapsedTimer m_statsTimer;
+
 	QTimer *m_timer;
 	int m_screenTextureCount;
 	GLuint m_screenTexture[MAX_TEXTURES_NEEDED];
 	QOpenGLShaderProgram *m_program;
+	QString m_programKey;
+	GLUpload m_upload;
+	bool m_haveDmaBuf;
+	void *m_dmaBufImage[VIDEO_MAX_FRAME][MAX_TEXTURES_NEEDED];
 	__u8 *m_curData[MAX_TEXTURES_NEEDED];
 	unsigned m_curSize[MAX_TEXTURES_NEEDED];
 	__u8 *m_nextData[MAX_TEXTURES_NEEDED];
@@ -230,6 +371,27 @@ private:
 	int m_nextIndex;
 	struct tpg_data m_tpg;
 
+	ScopeMode m_scopeMode;
+	ScopeMode m_scopeProgramMode;
+	QOpenGLShaderProgram *m_scopeScatter;
+	QOpenGLShaderProgram *m_scopeDisplay;
+	GLuint m_scopeVao;
+	GLuint m_scopeFbo[2];
+	GLuint m_scopeTex[2];
+	QSize m_scopeSampleSize;
+	QSize m_scopeAccSize;
+
+	FrameRecorder m_recorder;
+	GLuint m_recordPbo[2];
+	QSize m_recordPboSize[2];
+	bool m_recordPboFull[2];
+	unsigned m_recordPboIdx;
+
+	// --trace: the frame taken from the SockReader until it is shown
+	int m_traceFd;
+	v4l_stream_trace m_curTrace;
+	bool m_tracePending;
+
 	QScrollArea *m_scrollArea;
 	QAction *m_resolutionOverride;
 	QAction *m_exitFullScreen;
@@ -241,6 +403,7 @@ private:
 	QMenu *m_ycbcrEncMenu;
 	QMenu *m_hsvEncMenu;
 	QMenu *m_quantMenu;
+	QMenu *m_scopeMenu;
 	QMenu *m_displayMenu;
 };
 
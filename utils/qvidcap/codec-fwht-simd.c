@@ -0,0 +1 @@
+../common/codec-fwht-simd.c
\ No newline at end of file
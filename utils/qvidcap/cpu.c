@@ -0,0 +1 @@
+../common/cpu.c
\ No newline at end of file
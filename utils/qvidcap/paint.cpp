@@ -22,11 +22,30 @@
 #include <QtGui/QKeyEvent>
 #include <QtGui/QPainter>
 #include <QtCore/QSocketNotifier>
+#include <QHash>
 #include <QtMath>
+#include <QVector2D>
 #include <QTimer>
 #include <QApplication>
 
 #include "v4l2-info.h"
+#include "v4l2-convert-defines.h"
+
+#ifdef HAVE_EGL
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// DRM_FORMAT_R8 from drm_fourcc.h
+#define DRM_FORMAT_R8 0x20203852
+
+typedef void (*EGLImageTargetTexture2DOESFn)(GLenum target, EGLImageKHR image);
+
+static PFNEGLCREATEIMAGEKHRPROC createImageKHR;
+static PFNEGLDESTROYIMAGEKHRPROC destroyImageKHR;
+static EGLImageTargetTexture2DOESFn imageTargetTexture2DOES;
+#endif
 
 void CaptureWin::initializeGL()
 {
@@ -62,7 +81,8 @@ void CaptureWin::initializeGL()
 		     0.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 	checkError("InitializeGL Part 2");
-	m_program = new QOpenGLShaderProgram(this);
+	m_upload.init();
+	initDmaBuf();
 	m_updateShader = true;
 }
 
@@ -89,6 +109,12 @@ void CaptureWin::paintGL()
 		}
 	}
 
+	bool newFrame = m_newFrame;
+
+	if (m_newFrame) {
+		m_newFrame = false;
+		m_rendered++;
+	}
 
 	if (m_curData[0] == NULL) {
 		// No data, just clear display
@@ -116,6 +142,7 @@ void CaptureWin::paintGL()
 	if (!supportedFmt(m_v4l_fmt.g_pixelformat()))
 		return;
 
+	m_upload.begin();
 	switch (m_v4l_fmt.g_pixelformat()) {
 	case V4L2_PIX_FMT_YUYV:
 	case V4L2_PIX_FMT_YVYU:
@@ -236,6 +263,7 @@ void CaptureWin::paintGL()
 		render_RGB(m_v4l_fmt.g_pixelformat());
 		break;
 	}
+	m_upload.end();
 
 	static unsigned long long tot_t;
 	static unsigned cnt;
@@ -296,6 +324,16 @@ void CaptureWin::paintGL()
 	// Draw quad with texture
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
+	// The scopes are not recorded, and frames that are only repainted
+	// are not recorded again
+	if (m_recorder.active() && newFrame)
+		recordFrame(QRect(scale ? (size().width() - s.width()) / 2 : 0,
+				  scale ? (size().height() - s.height()) / 2 : 0,
+				  s.width(), s.height()));
+
+	if (m_scopeMode != ScopeNone && initScopes())
+		renderScopes(VertexArrayID);
+
 	// Disable attrib arrays
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
@@ -327,158 +365,95 @@ struct define {
 	unsigned id;
 };
 
-#define DEF(c) { .name = #c, .id = c }
-
 static const struct define defines[] = {
-	DEF(V4L2_PIX_FMT_YUYV),
-	DEF(V4L2_PIX_FMT_YVYU),
-	DEF(V4L2_PIX_FMT_UYVY),
-	DEF(V4L2_PIX_FMT_VYUY),
-	DEF(V4L2_PIX_FMT_YUV422P),
-	DEF(V4L2_PIX_FMT_YVU420),
-	DEF(V4L2_PIX_FMT_YUV420),
-	DEF(V4L2_PIX_FMT_NV12),
-	DEF(V4L2_PIX_FMT_NV21),
-	DEF(V4L2_PIX_FMT_NV16),
-	DEF(V4L2_PIX_FMT_NV61),
-	DEF(V4L2_PIX_FMT_NV24),
-	DEF(V4L2_PIX_FMT_NV42),
-	DEF(V4L2_PIX_FMT_NV16M),
-	DEF(V4L2_PIX_FMT_NV61M),
-	DEF(V4L2_PIX_FMT_YVU420M),
-	DEF(V4L2_PIX_FMT_YUV420M),
-	DEF(V4L2_PIX_FMT_YVU422M),
-	DEF(V4L2_PIX_FMT_YUV422M),
-	DEF(V4L2_PIX_FMT_YVU444M),
-	DEF(V4L2_PIX_FMT_YUV444M),
-	DEF(V4L2_PIX_FMT_NV12M),
-	DEF(V4L2_PIX_FMT_NV21M),
-	DEF(V4L2_PIX_FMT_YUV444),
-	DEF(V4L2_PIX_FMT_YUV555),
-	DEF(V4L2_PIX_FMT_YUV565),
-	DEF(V4L2_PIX_FMT_YUV32),
-	DEF(V4L2_PIX_FMT_AYUV32),
-	DEF(V4L2_PIX_FMT_XYUV32),
-	DEF(V4L2_PIX_FMT_VUYA32),
-	DEF(V4L2_PIX_FMT_VUYX32),
-	DEF(V4L2_PIX_FMT_YUVA32),
-	DEF(V4L2_PIX_FMT_YUVX32),
-	DEF(V4L2_PIX_FMT_RGB32),
-	DEF(V4L2_PIX_FMT_XRGB32),
-	DEF(V4L2_PIX_FMT_ARGB32),
-	DEF(V4L2_PIX_FMT_RGBX32),
-	DEF(V4L2_PIX_FMT_RGBA32),
-	DEF(V4L2_PIX_FMT_BGR32),
-	DEF(V4L2_PIX_FMT_XBGR32),
-	DEF(V4L2_PIX_FMT_ABGR32),
-	DEF(V4L2_PIX_FMT_BGRX32),
-	DEF(V4L2_PIX_FMT_BGRA32),
-	DEF(V4L2_PIX_FMT_RGB24),
-	DEF(V4L2_PIX_FMT_BGR24),
-	DEF(V4L2_PIX_FMT_RGB565),
-	DEF(V4L2_PIX_FMT_RGB565X),
-	DEF(V4L2_PIX_FMT_RGB444),
-	DEF(V4L2_PIX_FMT_XRGB444),
-	DEF(V4L2_PIX_FMT_ARGB444),
-	DEF(V4L2_PIX_FMT_XBGR444),
-	DEF(V4L2_PIX_FMT_ABGR444),
-	DEF(V4L2_PIX_FMT_RGBX444),
-	DEF(V4L2_PIX_FMT_RGBA444),
-	DEF(V4L2_PIX_FMT_BGRX444),
-	DEF(V4L2_PIX_FMT_BGRA444),
-	DEF(V4L2_PIX_FMT_RGB555),
-	DEF(V4L2_PIX_FMT_XRGB555),
-	DEF(V4L2_PIX_FMT_ARGB555),
-	DEF(V4L2_PIX_FMT_RGB555X),
-	DEF(V4L2_PIX_FMT_XRGB555X),
-	DEF(V4L2_PIX_FMT_ARGB555X),
-	DEF(V4L2_PIX_FMT_RGBX555),
-	DEF(V4L2_PIX_FMT_RGBA555),
-	DEF(V4L2_PIX_FMT_XBGR555),
-	DEF(V4L2_PIX_FMT_ABGR555),
-	DEF(V4L2_PIX_FMT_BGRX555),
-	DEF(V4L2_PIX_FMT_BGRA555),
-	DEF(V4L2_PIX_FMT_RGB332),
-	DEF(V4L2_PIX_FMT_BGR666),
-	DEF(V4L2_PIX_FMT_SBGGR8),
-	DEF(V4L2_PIX_FMT_SGBRG8),
-	DEF(V4L2_PIX_FMT_SGRBG8),
-	DEF(V4L2_PIX_FMT_SRGGB8),
-	DEF(V4L2_PIX_FMT_SBGGR10),
-	DEF(V4L2_PIX_FMT_SGBRG10),
-	DEF(V4L2_PIX_FMT_SGRBG10),
-	DEF(V4L2_PIX_FMT_SRGGB10),
-	DEF(V4L2_PIX_FMT_SBGGR12),
-	DEF(V4L2_PIX_FMT_SGBRG12),
-	DEF(V4L2_PIX_FMT_SGRBG12),
-	DEF(V4L2_PIX_FMT_SRGGB12),
-	DEF(V4L2_PIX_FMT_SBGGR16),
-	DEF(V4L2_PIX_FMT_SGBRG16),
-	DEF(V4L2_PIX_FMT_SGRBG16),
-	DEF(V4L2_PIX_FMT_SRGGB16),
-	DEF(V4L2_PIX_FMT_HSV24),
-	DEF(V4L2_PIX_FMT_HSV32),
-	DEF(V4L2_PIX_FMT_GREY),
-	DEF(V4L2_PIX_FMT_Y10),
-	DEF(V4L2_PIX_FMT_Y12),
-	DEF(V4L2_PIX_FMT_Y16),
-	DEF(V4L2_PIX_FMT_Y16_BE),
-	DEF(V4L2_PIX_FMT_Z16),
-
-	DEF(V4L2_FIELD_ANY),
-	DEF(V4L2_FIELD_NONE),
-	DEF(V4L2_FIELD_TOP),
-	DEF(V4L2_FIELD_BOTTOM),
-	DEF(V4L2_FIELD_INTERLACED),
-	DEF(V4L2_FIELD_SEQ_TB),
-	DEF(V4L2_FIELD_SEQ_BT),
-	DEF(V4L2_FIELD_ALTERNATE),
-	DEF(V4L2_FIELD_INTERLACED_TB),
-	DEF(V4L2_FIELD_INTERLACED_BT),
-
-	DEF(V4L2_COLORSPACE_DEFAULT),
-	DEF(V4L2_COLORSPACE_SMPTE170M),
-	DEF(V4L2_COLORSPACE_SMPTE240M),
-	DEF(V4L2_COLORSPACE_REC709),
-	DEF(V4L2_COLORSPACE_470_SYSTEM_M),
-	DEF(V4L2_COLORSPACE_470_SYSTEM_BG),
-	DEF(V4L2_COLORSPACE_SRGB),
-	DEF(V4L2_COLORSPACE_OPRGB),
-	DEF(V4L2_COLORSPACE_BT2020),
-	DEF(V4L2_COLORSPACE_RAW),
-	DEF(V4L2_COLORSPACE_DCI_P3),
-
-	DEF(V4L2_XFER_FUNC_DEFAULT),
-	DEF(V4L2_XFER_FUNC_709),
-	DEF(V4L2_XFER_FUNC_SRGB),
-	DEF(V4L2_XFER_FUNC_OPRGB),
-	DEF(V4L2_XFER_FUNC_SMPTE240M),
-	DEF(V4L2_XFER_FUNC_NONE),
-	DEF(V4L2_XFER_FUNC_DCI_P3),
-	DEF(V4L2_XFER_FUNC_SMPTE2084),
-
-	DEF(V4L2_YCBCR_ENC_DEFAULT),
-	DEF(V4L2_YCBCR_ENC_601),
-	DEF(V4L2_YCBCR_ENC_709),
-	DEF(V4L2_YCBCR_ENC_XV601),
-	DEF(V4L2_YCBCR_ENC_XV709),
-	DEF(V4L2_YCBCR_ENC_BT2020),
-	DEF(V4L2_YCBCR_ENC_BT2020_CONST_LUM),
-	DEF(V4L2_YCBCR_ENC_SMPTE240M),
-	DEF(V4L2_HSV_ENC_180),
-	DEF(V4L2_HSV_ENC_256),
-
-	DEF(V4L2_QUANTIZATION_DEFAULT),
-	DEF(V4L2_QUANTIZATION_FULL_RANGE),
-	DEF(V4L2_QUANTIZATION_LIM_RANGE),
+#define V4L2_CONVERT_DEFINE(c) { .name = #c, .id = c },
+	V4L2_CONVERT_DEFINES
+#undef V4L2_CONVERT_DEFINE
 	{ NULL, 0 }
 };
 
+/*
+ * The shader programs are shared by all tiles of a mosaic: they only depend
+ * on the shader source code, and all contexts are in the same share group.
+ */
+struct SharedProgram {
+	QOpenGLShaderProgram *program;
+	unsigned refs;
+};
+
+static QHash<QString, SharedProgram> sharedPrograms;
+
+/*
+ * Compiles and links the program. The shaders are added as cacheable, so Qt
+ * stores the program binary (glGetProgramBinary) in its disk cache, keyed by
+ * the source code and the GL vendor, renderer and version. The next time,
+ * also in another qvidcap instance, it is loaded instead of compiled, which
+ * takes seconds for the conversion shaders on some embedded GPUs.
+ */
+static bool linkProgram(QOpenGLShaderProgram *program, const QString &vertex,
+			const QString &fragment)
+{
+#if QT_VERSION >= 0x050900
+	return program->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, vertex) &&
+	       program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, fragment) &&
+	       program->link();
+#else
+	return program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertex) &&
+	       program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment) &&
+	       program->link();
+#endif
+}
+
+// Returns the program for this source code, it is compiled if needed
+QOpenGLShaderProgram *CaptureWin::acquireProgram(const QString &fragment,
+						 const QString &vertex)
+{
+	QString key = fragment + vertex;
+	auto it = sharedPrograms.find(key);
+
+	if (it != sharedPrograms.end()) {
+		it->refs++;
+		m_programKey = key;
+		return it->program;
+	}
+
+	QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+
+	// Mandatory vertex shader replaces fixed pipeline in GLES 2.0. In this case just a feedthrough shader.
+	if (!linkProgram(program, vertex, fragment)) {
+		fprintf(stderr, "OpenGL Error: shader compilation failed.\n");
+		std::exit(EXIT_FAILURE);
+	}
+
+	SharedProgram shared = { program, 1 };
+
+	sharedPrograms.insert(key, shared);
+	m_programKey = key;
+	return program;
+}
+
+// Must be called with the context made current
+void CaptureWin::releaseProgram()
+{
+	if (!m_program)
+		return;
+
+	auto it = sharedPrograms.find(m_programKey);
+
+	if (it != sharedPrograms.end() && --it->refs == 0) {
+		delete it->program;
+		sharedPrograms.erase(it);
+	}
+	m_program = NULL;
+	m_programKey.clear();
+}
+
 void CaptureWin::changeShader()
 {
+	freeDmaBuf();
 	if (m_screenTextureCount)
 		glDeleteTextures(m_screenTextureCount, m_screenTexture);
-	m_program->removeAllShaders();
+	releaseProgram();
 	checkError("Render settings.\n");
 
 	QString code;
@@ -518,15 +493,6 @@ void CaptureWin::changeShader()
 
 	code += prog;
 
-	bool src_ok = m_program->addShaderFromSourceCode(
-		QOpenGLShader::Fragment, code);
-
-	if (!src_ok) {
-		fprintf(stderr, "OpenGL Error: fragment shader compilation failed.\n");
-		std::exit(EXIT_FAILURE);
-	}
-
-	// Mandatory vertex shader replaces fixed pipeline in GLES 2.0. In this case just a feedthrough shader.
 	QString vertexShaderSrc;
 
 	if (context()->isOpenGLES())
@@ -544,14 +510,7 @@ void CaptureWin::changeShader()
 		"       vs_TexCoord = texCoord;\n"
 		"}\n";
 
-	src_ok = m_program->addShaderFromSourceCode(
-		QOpenGLShader::Vertex, vertexShaderSrc);
-
-	if (!src_ok) {
-		fprintf(stderr, "OpenGL Error: vertex shader compilation failed.\n");
-		std::exit(EXIT_FAILURE);
-	}
-
+	m_program = acquireProgram(code, vertexShaderSrc);
 	if (!m_program->bind()) {
 		fprintf(stderr, "OpenGL Error: shader bind failed.\n");
 		std::exit(EXIT_FAILURE);
@@ -967,6 +926,9 @@ void CaptureWin::shader_YUV_packed()
 
 void CaptureWin::render_YUV(__u32 format)
 {
+	if (render_DmaBuf(format))
+		return;
+
 	unsigned vdiv = 2, hdiv = 2;
 	int idxU = 0;
 	int idxV = 0;
@@ -997,7 +959,7 @@ void CaptureWin::render_YUV(__u32 format)
 
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("YUV paint ytex");
 
@@ -1007,19 +969,19 @@ void CaptureWin::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[0] == NULL ? NULL : &m_curData[0][idxU]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[2]);
 		break;
 	}
@@ -1031,19 +993,19 @@ void CaptureWin::render_YUV(__u32 format)
 	case V4L2_PIX_FMT_YUV422P:
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[0] == NULL ? NULL : &m_curData[0][idxV]);
 		break;
 	case V4L2_PIX_FMT_YUV420M:
 	case V4L2_PIX_FMT_YUV422M:
 	case V4L2_PIX_FMT_YUV444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[2]);
 		break;
 	case V4L2_PIX_FMT_YVU420M:
 	case V4L2_PIX_FMT_YVU422M:
 	case V4L2_PIX_FMT_YVU444M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / hdiv, m_v4l_fmt.g_height() / vdiv,
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	}
@@ -1052,9 +1014,12 @@ void CaptureWin::render_YUV(__u32 format)
 
 void CaptureWin::render_NV12(__u32 format)
 {
+	if (render_DmaBuf(format))
+		return;
+
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("NV12 paint ytex");
 
@@ -1063,13 +1028,13 @@ void CaptureWin::render_NV12(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV12:
 	case V4L2_PIX_FMT_NV21:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
 				GL_RED, GL_UNSIGNED_BYTE,
 				m_curData[0] ? m_curData[0] + m_v4l_fmt.g_width() * m_v4l_fmt.g_height() : NULL);
 		break;
 	case V4L2_PIX_FMT_NV12M:
 	case V4L2_PIX_FMT_NV21M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height() / 2,
 				GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	}
@@ -1081,14 +1046,14 @@ void CaptureWin::render_NV24(__u32 format)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("NV24 paint ytex");
 
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[1]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			GL_RG, GL_UNSIGNED_BYTE,
 			m_curData[0] ? m_curData[0] + m_v4l_fmt.g_sizeimage() / 3 : NULL);
 	checkError("NV24 paint uvtex");
@@ -1099,7 +1064,7 @@ void CaptureWin::render_NV16(__u32 format)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 			GL_RED, GL_UNSIGNED_BYTE, m_curData[0]);
 	checkError("NV16 paint ytex");
 
@@ -1108,13 +1073,13 @@ void CaptureWin::render_NV16(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_NV16:
 	case V4L2_PIX_FMT_NV61:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED, GL_UNSIGNED_BYTE,
 				m_curData[0] ? m_curData[0] + m_v4l_fmt.g_sizeimage() / 2 : NULL);
 		break;
 	case V4L2_PIX_FMT_NV16M:
 	case V4L2_PIX_FMT_NV61M:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED, GL_UNSIGNED_BYTE, m_curData[1]);
 		break;
 	}
@@ -1127,7 +1092,7 @@ void CaptureWin::render_YUY2(__u32 format)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 4);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / 2, m_v4l_fmt.g_height(),
+	m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width() / 2, m_v4l_fmt.g_height(),
 			GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	checkError("YUY2 paint");
@@ -1141,7 +1106,7 @@ void CaptureWin::render_RGB(__u32 format)
 	switch (format) {
 	case V4L2_PIX_FMT_RGB332:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_BYTE_3_3_2, m_curData[0]);
 		break;
 
@@ -1155,13 +1120,13 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_BGRX444:
 	case V4L2_PIX_FMT_BGRA444:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_GREY:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 
@@ -1170,12 +1135,12 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_Y16:
 	case V4L2_PIX_FMT_Z16:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_curData[0]);
 		break;
 	case V4L2_PIX_FMT_Y16_BE:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_curData[0]);
 		break;
 
@@ -1185,7 +1150,7 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_XBGR555:
 	case V4L2_PIX_FMT_ABGR555:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_curData[0]);
 		break;
 
@@ -1197,7 +1162,7 @@ void CaptureWin::render_RGB(__u32 format)
 		// for the RGB555 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_curData[0]);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1207,13 +1172,13 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_BGRX555:
 	case V4L2_PIX_FMT_BGRA555:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_5_5_5_1, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_RGB565:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_curData[0]);
 		break;
 
@@ -1223,7 +1188,7 @@ void CaptureWin::render_RGB(__u32 format)
 		// for the RGB565 format, and false for this format. This would have
 		// to be tested first, though.
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_curData[0]);
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 		break;
@@ -1240,12 +1205,12 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_BGRX32:
 	case V4L2_PIX_FMT_BGRA32:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 4);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	case V4L2_PIX_FMT_BGR666:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 4);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, m_curData[0]);
 		break;
 
@@ -1254,7 +1219,7 @@ void CaptureWin::render_RGB(__u32 format)
 	case V4L2_PIX_FMT_HSV24:
 	default:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 3);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	}
@@ -1273,7 +1238,7 @@ void CaptureWin::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SRGGB8:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline());
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	case V4L2_PIX_FMT_SBGGR10:
@@ -1289,7 +1254,7 @@ void CaptureWin::render_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SGRBG16:
 	case V4L2_PIX_FMT_SRGGB16:
 		glPixelStorei(GL_UNPACK_ROW_LENGTH, m_v4l_fmt.g_bytesperline() / 2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RED_INTEGER, GL_UNSIGNED_SHORT, m_curData[0]);
 		break;
 	}
@@ -1303,17 +1268,17 @@ void CaptureWin::render_YUV_packed(__u32 format)
 
 	switch (format) {
 	case V4L2_PIX_FMT_YUV555:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_YUV444:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, m_curData[0]);
 		break;
 
 	case V4L2_PIX_FMT_YUV565:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGB, GL_UNSIGNED_SHORT_5_6_5, m_curData[0]);
 		break;
 
@@ -1324,9 +1289,489 @@ void CaptureWin::render_YUV_packed(__u32 format)
 	case V4L2_PIX_FMT_VUYX32:
 	case V4L2_PIX_FMT_YUVA32:
 	case V4L2_PIX_FMT_YUVX32:
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
+		m_upload.texSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
 				GL_RGBA, GL_UNSIGNED_BYTE, m_curData[0]);
 		break;
 	}
 	checkError("Packed YUV paint");
 }
+
+void CaptureWin::initDmaBuf()
+{
+	m_haveDmaBuf = false;
+#ifdef HAVE_EGL
+	EGLDisplay dpy = eglGetCurrentDisplay();
+
+	// Qt only uses EGL on Wayland, EGLFS or with QT_XCB_GL_INTEGRATION=xcb_egl
+	if (dpy == EGL_NO_DISPLAY)
+		return;
+
+	const char *exts = eglQueryString(dpy, EGL_EXTENSIONS);
+
+	if (!exts || !strstr(exts, "EGL_EXT_image_dma_buf_import") ||
+	    !context()->hasExtension("GL_OES_EGL_image"))
+		return;
+	createImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+	destroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+	imageTargetTexture2DOES = (EGLImageTargetTexture2DOESFn)
+		eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	m_haveDmaBuf = createImageKHR && destroyImageKHR && imageTargetTexture2DOES;
+	if (m_verbose && m_haveDmaBuf)
+		printf("Using EGL_EXT_image_dma_buf_import for zero-copy display\n");
+#endif
+}
+
+void CaptureWin::freeDmaBuf()
+{
+#ifdef HAVE_EGL
+	for (unsigned i = 0; i < VIDEO_MAX_FRAME; i++) {
+		for (unsigned t = 0; t < MAX_TEXTURES_NEEDED; t++) {
+			if (m_dmaBufImage[i][t])
+				destroyImageKHR(eglGetCurrentDisplay(), m_dmaBufImage[i][t]);
+			m_dmaBufImage[i][t] = NULL;
+		}
+	}
+#endif
+}
+
+/*
+ * Instead of copying the mmap()ed frame into the textures, bind the
+ * textures to EGLImages of the exported buffer planes. The textures keep
+ * the GL_RED layout the shaders expect, so every texture is imported as a
+ * single DRM_FORMAT_R8 plane at the right offset in the buffer.
+ */
+bool CaptureWin::render_DmaBuf(__u32 format)
+{
+#ifdef HAVE_EGL
+	struct {
+		unsigned plane;
+		unsigned offset;
+		unsigned width;
+		unsigned height;
+		unsigned pitch;
+	} tex[MAX_TEXTURES_NEEDED];
+	unsigned w = m_v4l_fmt.g_width();
+	unsigned h = m_v4l_fmt.g_height();
+	unsigned bpl = m_v4l_fmt.g_bytesperline();
+	unsigned num_tex = 3;
+
+	if (!m_haveDmaBuf || m_mode != AppModeV4L2 || m_curIndex < 0 ||
+	    m_v4l_queue->g_fd(m_curIndex, 0) < 0)
+		return false;
+
+	tex[0] = { 0, 0, w, h, bpl };
+	switch (format) {
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		tex[1] = { 0, bpl * h, w, h / 2, bpl };
+		num_tex = 2;
+		break;
+	case V4L2_PIX_FMT_NV12M:
+	case V4L2_PIX_FMT_NV21M:
+		tex[1] = { 1, 0, w, h / 2, m_v4l_fmt.g_bytesperline(1) };
+		num_tex = 2;
+		break;
+	case V4L2_PIX_FMT_YUV420:
+		tex[1] = { 0, bpl * h, w / 2, h / 2, bpl / 2 };
+		tex[2] = { 0, bpl * h + bpl / 2 * h / 2, w / 2, h / 2, bpl / 2 };
+		break;
+	case V4L2_PIX_FMT_YVU420:
+		tex[1] = { 0, bpl * h + bpl / 2 * h / 2, w / 2, h / 2, bpl / 2 };
+		tex[2] = { 0, bpl * h, w / 2, h / 2, bpl / 2 };
+		break;
+	case V4L2_PIX_FMT_YUV420M:
+		tex[1] = { 1, 0, w / 2, h / 2, m_v4l_fmt.g_bytesperline(1) };
+		tex[2] = { 2, 0, w / 2, h / 2, m_v4l_fmt.g_bytesperline(2) };
+		break;
+	case V4L2_PIX_FMT_YVU420M:
+		tex[1] = { 2, 0, w / 2, h / 2, m_v4l_fmt.g_bytesperline(2) };
+		tex[2] = { 1, 0, w / 2, h / 2, m_v4l_fmt.g_bytesperline(1) };
+		break;
+	default:
+		return false;
+	}
+
+	void **images = m_dmaBufImage[m_curIndex];
+
+	for (unsigned t = 0; t < num_tex; t++) {
+		if (images[t])
+			continue;
+
+		EGLint attrs[] = {
+			EGL_WIDTH, (EGLint)tex[t].width,
+			EGL_HEIGHT, (EGLint)tex[t].height,
+			EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_R8,
+			EGL_DMA_BUF_PLANE0_FD_EXT, m_v4l_queue->g_fd(m_curIndex, tex[t].plane),
+			EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)tex[t].offset,
+			EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)tex[t].pitch,
+			EGL_NONE
+		};
+
+		images[t] = createImageKHR(eglGetCurrentDisplay(), EGL_NO_CONTEXT,
+					   EGL_LINUX_DMA_BUF_EXT, NULL, attrs);
+		if (images[t] == EGL_NO_IMAGE_KHR) {
+			images[t] = NULL;
+			fprintf(stderr, "Could not import the DMABUF, copying the frames instead\n");
+			freeDmaBuf();
+			m_haveDmaBuf = false;
+			return false;
+		}
+	}
+
+	for (unsigned t = 0; t < num_tex; t++) {
+		glActiveTexture(GL_TEXTURE0 + t);
+		glBindTexture(GL_TEXTURE_2D, m_screenTexture[t]);
+		imageTargetTexture2DOES(GL_TEXTURE_2D, images[t]);
+	}
+	checkError("DMABUF paint");
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Scopes are computed without reading the frame back: the frame is drawn
+ * once more by the colorspace conversion shader into a small R'G'B' texture
+ * of at most SCOPE_SAMPLE_WIDTH pixels wide. The scatter shader then draws a
+ * point for each of its pixels into a float texture with additive blending,
+ * positioned at its histogram bin, waveform level or Cb/Cr coordinate. The
+ * display shader draws that texture in the bottom right corner.
+ */
+#define SCOPE_SAMPLE_WIDTH	512U
+#define SCOPE_LEVELS		256
+
+static const char *scopeScatterVertex =
+	"uniform sampler2D frame;\n"
+	"uniform int channel0;\n"
+	"out vec4 vs_Color;\n"
+	"\n"
+	"#define LEVEL(v) ((floor((v) * 255.0 + 0.5) + 0.5) / float(SCOPE_LEVELS))\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	ivec2 size = textureSize(frame, 0);\n"
+	"	int pixels = size.x * size.y;\n"
+	"	int idx = gl_VertexID % pixels;\n"
+	"	int channel = channel0 + gl_VertexID / pixels;\n"
+	"	ivec2 pos = ivec2(idx % size.x, idx / size.x);\n"
+	"	vec3 rgb = clamp(texelFetch(frame, pos, 0).rgb, 0.0, 1.0);\n"
+	"	// Rec. 709 luma\n"
+	"	float y = dot(rgb, vec3(0.2126, 0.7152, 0.0722));\n"
+	"	vec2 p;\n"
+	"\n"
+	"	vs_Color = vec4(0.0);\n"
+	"#if SCOPE == SCOPE_WAVEFORM\n"
+	"	p = vec2((float(pos.x) + 0.5) / float(size.x), LEVEL(y));\n"
+	"	vs_Color.r = 1.0;\n"
+	"#elif SCOPE == SCOPE_VECTORSCOPE\n"
+	"	// Rec. 709 Cb and Cr, moved to 0...1\n"
+	"	p = vec2((rgb.b - y) / 1.8556, (rgb.r - y) / 1.5748) + 0.5;\n"
+	"	vs_Color.r = 1.0;\n"
+	"#else\n"
+	"	// R, G and B are counted in rgb, luma in alpha\n"
+	"	p = vec2(LEVEL(channel == 3 ? y : rgb[channel]), 0.5);\n"
+	"	vs_Color[channel] = 1.0;\n"
+	"#endif\n"
+	"	gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+	"	gl_PointSize = 1.0;\n"
+	"}\n";
+
+static const char *scopeScatterFragment =
+	"in vec4 vs_Color;\n"
+	"out vec4 fs_FragColor;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	fs_FragColor = vs_Color;\n"
+	"}\n";
+
+static const char *scopeDisplayVertex =
+	"out vec2 vs_TexCoord;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	vs_TexCoord = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));\n"
+	"	gl_Position = vec4(vs_TexCoord * 2.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+static const char *scopeDisplayFragment =
+	"uniform highp sampler2D acc;\n"
+	"uniform float gain;\n"
+	"uniform vec2 pixel;\n"
+	"in vec2 vs_TexCoord;\n"
+	"out vec4 fs_FragColor;\n"
+	"\n"
+	"#define LINE(v, at, w) (abs((v) - (at)) <= (w))\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 uv = vs_TexCoord;\n"
+	"	vec3 color;\n"
+	"	bool grid = false;\n"
+	"\n"
+	"#if SCOPE == SCOPE_WAVEFORM || SCOPE == SCOPE_VECTORSCOPE\n"
+	"	color = vec3(0.3, 1.0, 0.3) * (1.0 - exp(-texture(acc, uv).r * gain));\n"
+	"#else\n"
+	"	// Scale to the highest bin, the bins are few enough to search them all\n"
+	"	vec4 peak = vec4(1.0);\n"
+	"	for (int i = 0; i < SCOPE_LEVELS; i++)\n"
+	"		peak = max(peak, texelFetch(acc, ivec2(i, 0), 0));\n"
+	"	int bin = min(int(uv.x * float(SCOPE_LEVELS)), SCOPE_LEVELS - 1);\n"
+	"	vec4 bar = step(vec4(uv.y), texelFetch(acc, ivec2(bin, 0), 0) / peak);\n"
+	"#if SCOPE == SCOPE_LUMA_HISTOGRAM\n"
+	"	color = vec3(0.8 * bar.a);\n"
+	"#else\n"
+	"	color = 0.8 * bar.rgb;\n"
+	"#endif\n"
+	"#endif\n"
+	"\n"
+	"#if SCOPE == SCOPE_VECTORSCOPE\n"
+	"	vec2 c = uv - 0.5;\n"
+	"	grid = LINE(c.x, 0.0, pixel.x) || LINE(c.y, 0.0, pixel.y) ||\n"
+	"	       LINE(length(c), 0.5, pixel.x) || LINE(length(c), 0.25, pixel.x);\n"
+	"#elif SCOPE == SCOPE_WAVEFORM\n"
+	"	for (int i = 0; i <= 4; i++)\n"
+	"		grid = grid || LINE(uv.y, (float(i) * 63.75 + 0.5) / float(SCOPE_LEVELS), pixel.y);\n"
+	"#else\n"
+	"	for (int i = 1; i < 4; i++)\n"
+	"		grid = grid || LINE(uv.x, float(i) * 0.25, pixel.x);\n"
+	"#endif\n"
+	"	if (grid)\n"
+	"		color = max(color, vec3(0.4));\n"
+	"	fs_FragColor = vec4(color, 0.85);\n"
+	"}\n";
+
+static QOpenGLShaderProgram *scopeProgram(QOpenGLContext *ctx, ScopeMode mode,
+					  const char *vertex, const char *fragment)
+{
+	QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+	QString code;
+
+	if (ctx->isOpenGLES())
+		code = "#version 300 es\n"
+			"precision highp float;\n"
+			"precision highp int;\n";
+	else
+		code = "#version 330\n";
+	code += QString("#define SCOPE %1\n"
+			"#define SCOPE_LUMA_HISTOGRAM %2\n"
+			"#define SCOPE_RGB_HISTOGRAM %3\n"
+			"#define SCOPE_WAVEFORM %4\n"
+			"#define SCOPE_VECTORSCOPE %5\n"
+			"#define SCOPE_LEVELS %6\n")
+		.arg(mode)
+		.arg(ScopeLumaHistogram)
+		.arg(ScopeRGBHistogram)
+		.arg(ScopeWaveform)
+		.arg(ScopeVectorscope)
+		.arg(SCOPE_LEVELS);
+
+	if (!linkProgram(program, code + vertex, code + fragment)) {
+		fprintf(stderr, "OpenGL Error: scope shader compilation failed.\n");
+		delete program;
+		return NULL;
+	}
+	return program;
+}
+
+static bool scopeTarget(GLuint fbo, GLuint tex, GLint internalFmt, GLenum type,
+			const QSize &size)
+{
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFmt, size.width(), size.height(), 0,
+		     GL_RGBA, type, NULL);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// (Re)creates the scope resources if needed, returns false if scopes can't be shown
+bool CaptureWin::initScopes()
+{
+	unsigned w = m_v4l_fmt.g_width();
+	unsigned h = m_v4l_fmt.g_frame_height();
+	QSize sample(std::min(w, SCOPE_SAMPLE_WIDTH), 0);
+	QSize acc(SCOPE_LEVELS, 1);
+
+	sample.setHeight(std::max(1U, h * sample.width() / w));
+	if (m_scopeMode == ScopeWaveform)
+		acc = QSize(sample.width(), SCOPE_LEVELS);
+	else if (m_scopeMode == ScopeVectorscope)
+		acc = QSize(SCOPE_LEVELS, SCOPE_LEVELS);
+
+	if (m_scopeScatter && m_scopeProgramMode == m_scopeMode &&
+	    sample == m_scopeSampleSize && acc == m_scopeAccSize)
+		return true;
+
+	freeScopes();
+
+	// Counting needs blending into a float render target
+	if (context()->isOpenGLES() &&
+	    (!context()->hasExtension("GL_EXT_color_buffer_float") ||
+	     !context()->hasExtension("GL_EXT_float_blend"))) {
+		fprintf(stderr, "Scopes need GL_EXT_color_buffer_float and GL_EXT_float_blend.\n");
+		m_scopeMode = ScopeNone;
+		m_scopeMenu->actions().first()->setChecked(true);
+		return false;
+	}
+
+	m_scopeScatter = scopeProgram(context(), m_scopeMode,
+				      scopeScatterVertex, scopeScatterFragment);
+	m_scopeDisplay = scopeProgram(context(), m_scopeMode,
+				      scopeDisplayVertex, scopeDisplayFragment);
+	glGenVertexArrays(1, &m_scopeVao);
+	glGenFramebuffers(2, m_scopeFbo);
+	glGenTextures(2, m_scopeTex);
+	m_scopeSampleSize = sample;
+	m_scopeAccSize = acc;
+
+	glActiveTexture(GL_TEXTURE3);
+	bool ok = m_scopeScatter && m_scopeDisplay &&
+		  scopeTarget(m_scopeFbo[0], m_scopeTex[0], GL_RGBA8, GL_UNSIGNED_BYTE, sample) &&
+		  scopeTarget(m_scopeFbo[1], m_scopeTex[1], GL_RGBA32F, GL_FLOAT, acc);
+	glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+	glActiveTexture(GL_TEXTURE0);
+	checkError("initScopes");
+
+	if (!ok) {
+		fprintf(stderr, "OpenGL Error: cannot render the scopes.\n");
+		freeScopes();
+		m_scopeMode = ScopeNone;
+		m_scopeMenu->actions().first()->setChecked(true);
+		return false;
+	}
+	m_scopeProgramMode = m_scopeMode;
+	return true;
+}
+
+// Called from paintGL() right after the frame is drawn
+void CaptureWin::renderScopes(GLuint frameVao)
+{
+	unsigned samples = m_scopeSampleSize.width() * m_scopeSampleSize.height();
+	float gain;
+
+	// Sample the frame, the frame textures and the quad are still bound
+	glBindFramebuffer(GL_FRAMEBUFFER, m_scopeFbo[0]);
+	glViewport(0, 0, m_scopeSampleSize.width(), m_scopeSampleSize.height());
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	// Count
+	glBindFramebuffer(GL_FRAMEBUFFER, m_scopeFbo[1]);
+	glViewport(0, 0, m_scopeAccSize.width(), m_scopeAccSize.height());
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindVertexArray(m_scopeVao);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, m_scopeTex[0]);
+	m_scopeScatter->bind();
+	m_scopeScatter->setUniformValue("frame", 3);
+	m_scopeScatter->setUniformValue("channel0", m_scopeMode == ScopeLumaHistogram ? 3 : 0);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glDrawArrays(GL_POINTS, 0, samples * (m_scopeMode == ScopeRGBHistogram ? 3 : 1));
+
+	/*
+	 * Show the result in the bottom right corner. The gain maps the counts
+	 * to a brightness: a waveform cell that gets 1/16th of its column or
+	 * a vectorscope cell that gets 1/1024th of the frame is at 63%.
+	 */
+	QSize win = size();
+	int sh = qBound(64, std::min(win.width(), win.height()) / 3, 512);
+	int sw = std::min(m_scopeMode == ScopeVectorscope ? sh : 2 * sh, win.width() - 16);
+
+	if (m_scopeMode == ScopeWaveform)
+		gain = 16.0f / m_scopeSampleSize.height();
+	else
+		gain = 1024.0f / samples;
+	glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+	glViewport(win.width() - sw - 8, 8, sw, sh);
+	glBindTexture(GL_TEXTURE_2D, m_scopeTex[1]);
+	m_scopeDisplay->bind();
+	m_scopeDisplay->setUniformValue("acc", 3);
+	m_scopeDisplay->setUniformValue("gain", gain);
+	m_scopeDisplay->setUniformValue("pixel", QVector2D(1.0f / sw, 1.0f / sh));
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glDisable(GL_BLEND);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindVertexArray(frameVao);
+	m_program->bind();
+	checkError("renderScopes");
+}
+
+// Must be called with the context made current
+void CaptureWin::freeScopes()
+{
+	delete m_scopeScatter;
+	delete m_scopeDisplay;
+	m_scopeScatter = NULL;
+	m_scopeDisplay = NULL;
+	if (m_scopeVao) {
+		glDeleteVertexArrays(1, &m_scopeVao);
+		glDeleteFramebuffers(2, m_scopeFbo);
+		glDeleteTextures(2, m_scopeTex);
+		m_scopeVao = 0;
+	}
+	m_scopeSampleSize = QSize();
+	m_scopeAccSize = QSize();
+}
+
+/*
+ * Reads the frame that was just rendered into one of two pixel pack buffers,
+ * and maps the other one, which holds the previous frame. By then the GPU
+ * has long finished that transfer, so neither the GPU nor the GUI waits for
+ * the other.
+ */
+void CaptureWin::recordFrame(const QRect &r)
+{
+	unsigned idx = m_recordPboIdx;
+
+	if (!m_recordPbo[0])
+		glGenBuffers(2, m_recordPbo);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_recordPbo[idx]);
+	if (m_recordPboSize[idx] != r.size()) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, r.width() * r.height() * 4,
+			     NULL, GL_STREAM_READ);
+		m_recordPboSize[idx] = r.size();
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(r.x(), r.y(), r.width(), r.height(),
+		     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	m_recordPboFull[idx] = true;
+
+	idx ^= 1;
+	if (m_recordPboFull[idx]) {
+		QSize sz = m_recordPboSize[idx];
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_recordPbo[idx]);
+		void *p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+					   sz.width() * sz.height() * 4,
+					   GL_MAP_READ_BIT);
+		if (p) {
+			m_recorder.write(static_cast<__u8 *>(p), sz.width(), sz.height());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		m_recordPboFull[idx] = false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	m_recordPboIdx = idx;
+	checkError("recordFrame");
+}
+
+// Must be called with the context made current
+void CaptureWin::freeRecord()
+{
+	if (!m_recordPbo[0])
+		return;
+	glDeleteBuffers(2, m_recordPbo);
+	m_recordPbo[0] = m_recordPbo[1] = 0;
+	m_recordPboFull[0] = m_recordPboFull[1] = false;
+	m_recordPboSize[0] = m_recordPboSize[1] = QSize();
+}
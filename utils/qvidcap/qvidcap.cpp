@@ -8,9 +8,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netdb.h>
 
 #include <QApplication>
+#include <QGridLayout>
+#include <QHash>
 #include <QScrollArea>
+#include <QThread>
 #include <QtMath>
 
 #include "qvidcap.h"
@@ -29,9 +33,13 @@ static void usage()
 	       "  -f, --file=<file>        read from the file <file> for the raw frame data\n"
 	       "  -p, --port[=<port>]      listen for a network connection on the given port\n"
 	       "                           The default port is %d\n"
+	       "  --connect=<host>[:<port>] connect to a v4l2-ctl --stream-serve server on\n"
+	       "                           the given host, instead of listening for a connection\n"
 	       "  -T, --tpg                use the test pattern generator\n"
 	       "\n"
-	       "  If neither -d, -f, -p nor -T is specified then use /dev/video0.\n"
+	       "  If neither -d, -f, -p, --connect nor -T is specified then use /dev/video0.\n"
+	       "  If -d, -p and --connect are given more than once, then all those streams\n"
+	       "  are shown as a mosaic in a single window.\n"
 	       "\n"
 	       "  -c, --count=<cnt>        stop after <cnt> captured frames\n"
 	       "  -b, --buffers=<bufs>     request <bufs> buffers (default 4) when streaming\n"
@@ -61,7 +69,11 @@ static void usage()
 	       "\n"
 	       "  -l, --list-formats       display all supported formats\n"
 	       "  -h, --help               display this help message\n"
-	       "  -t, --timings            report frame render timings\n"
+	       "  -t, --timings            report frame render timings and the number of\n"
+	       "                           captured, rendered and skipped frames\n"
+	       "  --record=<file>          write the rendered frames to <file> as raw RGBA32\n"
+	       "  --trace=<file>           append the stages of each frame received from the\n"
+	       "                           network to <file>, see v4l2-ctl --stream-trace\n"
 	       "  -v, --verbose            be more verbose\n"
 	       "  -R, --raw                open device in raw mode\n"
 	       "\n"
@@ -324,9 +336,40 @@ __u32 read_u32(int fd)
 	return ntohl(v);
 }
 
-int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
+/* Wait until the server accepts the connection */
+static int connectSocket(const QString &host, int port)
 {
-	static int listen_fd = -1;
+	struct sockaddr_in serv_addr = {};
+	struct hostent *server;
+
+	server = gethostbyname(host.toUtf8().data());
+	if (server == NULL) {
+		fprintf(stderr, "no such host %s\n", host.toUtf8().data());
+		std::exit(EXIT_FAILURE);
+	}
+	serv_addr.sin_family = AF_INET;
+	memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+	serv_addr.sin_port = htons(port);
+
+	for (;;) {
+		int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (sock_fd < 0) {
+			fprintf(stderr, "could not opening socket\n");
+			std::exit(EXIT_FAILURE);
+		}
+		if (!::connect(sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)))
+			return sock_fd;
+		::close(sock_fd);
+		sleep(1);
+	}
+}
+
+static int acceptSocket(int port)
+{
+	// One listening socket for each port of a mosaic
+	static QHash<int, int> listen_fds;
+	int listen_fd = listen_fds.value(port, -1);
 	int sock_fd;
 	socklen_t clilen;
 	struct sockaddr_in serv_addr = {}, cli_addr;
@@ -347,6 +390,7 @@ int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 			fprintf(stderr, "could not bind: %s\n", strerror(errno));
 			std::exit(EXIT_FAILURE);
 		}
+		listen_fds.insert(port, listen_fd);
 	}
 	listen(listen_fd, 1);
 	clilen = sizeof(cli_addr);
@@ -355,6 +399,14 @@ int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 		fprintf(stderr, "could not accept\n");
 		std::exit(EXIT_FAILURE);
 	}
+	return sock_fd;
+}
+
+int initSocket(const QString &host, int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
+{
+	int sock_fd = host.isEmpty() ? acceptSocket(port) :
+				       connectSocket(host, port);
+
 	if (read_u32(sock_fd) != V4L_STREAM_ID) {
 		fprintf(stderr, "unknown protocol ID\n");
 		std::exit(EXIT_FAILURE);
@@ -424,17 +476,26 @@ int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 	return sock_fd;
 }
 
+/* A video device or network stream, several of them are shown as a mosaic */
+struct StreamSource {
+	enum AppMode mode;
+	QString name;	// The video device or the host to connect to
+	int port;
+};
+
 int main(int argc, char **argv)
 {
+	// Lets the tiles of a mosaic share their shader programs
+	QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+
 	QApplication disp(argc, argv);
-	QScrollArea *sa = new QScrollArea; // Automatically freed on window close
 	QSurfaceFormat format;
 	QString video_device = "0";
 	QString filename;
-	cv4l_fd fd;
+	QString connect_host;
+	QList<StreamSource> sources;
+	bool raw = false;
 	enum AppMode mode = AppModeV4L2;
-	int sock_fd = -1;
-	cv4l_fmt fmt;
 	v4l2_fract pixelaspect = { 1, 1 };
 	unsigned cnt = 0;
 	unsigned v4l2_bufs = 4;
@@ -443,6 +504,8 @@ int main(int argc, char **argv)
 	int port = 0;
 	bool info_option = false;
 	bool report_timings = false;
+	QString record_file;
+	QString trace_file;
 	bool verbose = false;
 	__u32 overridePixelFormat = 0;
 	__u32 overrideWidth = 0;
@@ -483,6 +546,7 @@ int main(int argc, char **argv)
 			if (!processOption(args, i, video_device))
 				return 0;
 			mode = AppModeV4L2;
+			sources.append({ mode, video_device, 0 });
 		} else if (isOptArg(args[i], "--file", "-f")) {
 			if (!processOption(args, i, filename))
 				return 0;
@@ -490,10 +554,27 @@ int main(int argc, char **argv)
 		} else if (isOption(args[i], "--port", "-p")) {
 			mode = AppModeSocket;
 			port = V4L_STREAM_PORT;
+			connect_host.clear();
+			sources.append({ mode, connect_host, port });
 		} else if (isOptArg(args[i], "--port", "-p")) {
 			if (!processOption(args, i, port))
 				return 0;
 			mode = AppModeSocket;
+			connect_host.clear();
+			sources.append({ mode, connect_host, port });
+		} else if (isOptArg(args[i], "--connect")) {
+			int colon;
+
+			if (!processOption(args, i, connect_host))
+				return 0;
+			port = V4L_STREAM_PORT;
+			colon = connect_host.lastIndexOf(':');
+			if (colon >= 0) {
+				port = connect_host.mid(colon + 1).toInt();
+				connect_host.truncate(colon);
+			}
+			mode = AppModeSocket;
+			sources.append({ mode, connect_host, port });
 		} else if (isOption(args[i], "--tpg", "-T")) {
 			mode = AppModeTPG;
 		} else if (isOptArg(args[i], "--test-mask")) {
@@ -641,6 +722,12 @@ int main(int argc, char **argv)
 			info_option = true;
 		} else if (isOption(args[i], "--timings", "-t")) {
 			report_timings = true;
+		} else if (isOptArg(args[i], "--record")) {
+			if (!processOption(args, i, record_file))
+				return 0;
+		} else if (isOptArg(args[i], "--trace")) {
+			if (!processOption(args, i, trace_file))
+				return 0;
 		} else if (isOptArg(args[i], "--opengles")) {
 			force_opengles = true;
 		} else if (isOptArg(args[i], "--opengl")) {
@@ -648,7 +735,7 @@ int main(int argc, char **argv)
 		} else if (isOption(args[i], "--verbose", "-v")) {
 			verbose = true;
 		} else if (isOption(args[i], "--raw", "-R")) {
-			fd.s_direct(true);
+			raw = true;
 		} else if (isOptArg(args[i], "--count", "-c")) {
 			if (!processOption(args, i, cnt))
 				return 0;
@@ -670,66 +757,16 @@ int main(int argc, char **argv)
 	if (info_option)
 		return 0;
 
-	if (mode == AppModeV4L2) {
-		fps = 0;
-		video_device = getDeviceName("/dev/video", video_device);
-		if (fd.open(video_device.toUtf8().data(), true) < 0) {
-			perror((QString("could not open ") + video_device).toUtf8().data());
-			std::exit(EXIT_FAILURE);
-		}
-		if (!fd.has_vid_cap()) {
-			fprintf(stderr, "%s is not a video capture device\n", video_device.toUtf8().data());
-			std::exit(EXIT_FAILURE);
-		}
-		fd.g_fmt(fmt);
-
-		if (!overridePixelFormat) {
-			bool found = false;
-
-			for (unsigned i = 0; formats[i]; i++) {
-				if (fmt.g_pixelformat() == formats[i]) {
-					found = true;
-					break;
-				}
-			}
-			if (!found)
-				overridePixelFormat = V4L2_PIX_FMT_RGB24;
-		}
-
-		if (overridePixelFormat) {
-			fmt.s_pixelformat(overridePixelFormat);
-			fd.s_fmt(fmt);
-			fd.g_fmt(fmt);
-			if (fmt.g_pixelformat() != overridePixelFormat) {
-				fprintf(stderr, "Could not set format: '%s' %s\n",
-					fcc2s(overridePixelFormat).c_str(),
-					pixfmt2s(overridePixelFormat).c_str());
-				fprintf(stderr, "Fall back to format: '%s' %s\n",
-					fcc2s(fmt.g_pixelformat()).c_str(),
-					pixfmt2s(fmt.g_pixelformat()).c_str());
-			}
-		}
-
-		unsigned tmp_w, tmp_h;
-
-		pixelaspect = fd.g_pixel_aspect(tmp_w, tmp_h);
-	} else if (mode == AppModeSocket) {
-		fps = 0;
-		sock_fd = initSocket(port, fmt, pixelaspect);
-	} else {
-		fmt.s_type(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
-		fmt.s_num_planes(1);
-		fmt.s_pixelformat(V4L2_PIX_FMT_RGB24);
-		fmt.s_width(640);
-		fmt.s_height(360);
-		fmt.s_field(V4L2_FIELD_NONE);
-		fmt.s_colorspace(V4L2_COLORSPACE_SRGB);
-		fmt.s_xfer_func(V4L2_XFER_FUNC_DEFAULT);
-		fmt.s_ycbcr_enc(V4L2_YCBCR_ENC_DEFAULT);
-		fmt.s_quantization(V4L2_QUANTIZATION_DEFAULT);
-		fmt.s_bytesperline(3 * fmt.g_width());
-		fmt.s_sizeimage(fmt.g_bytesperline() * fmt.g_height());
+	if (sources.size() > 1 && mode != AppModeV4L2 && mode != AppModeSocket) {
+		fprintf(stderr, "-f, -T and --test cannot be combined with several devices or ports\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (sources.size() > 1 && !record_file.isEmpty()) {
+		fprintf(stderr, "--record cannot be combined with several devices or ports\n");
+		std::exit(EXIT_FAILURE);
 	}
+	if (sources.size() <= 1)
+		sources = { { mode, mode == AppModeV4L2 ? video_device : connect_host, port } };
 
 	format.setDepthBufferSize(24);
 
@@ -741,106 +778,224 @@ int main(int argc, char **argv)
 	format.setVersion(3, 3);
 
 	QSurfaceFormat::setDefaultFormat(format);
-	CaptureWin win(sa);
-	win.setVerbose(verbose);
-	if (mode == AppModeFile) {
-		win.setModeFile(filename);
-		if (single_step_start)
-			single_step_start--;
-	} else if (mode == AppModeV4L2) {
-		win.setModeV4L2(&fd);
-	} else if (mode == AppModeTPG) {
-		win.setModeTPG();
-	}
-	win.setOverrideWidth(overrideWidth);
-	win.setOverrideHeight(overrideHeight);
-	win.setOverrideHorPadding(overrideHorPadding);
-	win.setFps(fps);
-	win.setFormat(format);
-	win.setReportTimings(report_timings);
-	win.setCount(test ? test : cnt);
-	if (mode == AppModeTest) {
-		win.setModeTest(test);
-
-		TestState state = { };
-
-		state.fmt_idx = findVal(formats, overridePixelFormat);
-		state.field_idx = findVal(fields, overrideField);
-		state.colorspace_idx = findVal(colorspaces, overrideColorspace);
-		state.xfer_func_idx = findVal(xfer_funcs, overrideXferFunc);
-		state.ycbcr_enc_idx = findVal(ycbcr_encs, overrideYCbCrEnc);
-		state.hsv_enc_idx = findVal(hsv_encs, overrideHSVEnc);
-		state.quant_idx = findVal(quantizations, overrideQuantization);
-		state.mask = test_mask;
-		win.setTestState(state);
-	}
 
-	win.setOverridePixelFormat(overridePixelFormat);
-	win.setOverrideField(overrideField);
-	win.setOverrideColorspace(overrideColorspace);
-	win.setOverrideYCbCrEnc(overrideYCbCrEnc);
-	win.setOverrideHSVEnc(overrideHSVEnc);
-	win.setOverrideXferFunc(overrideXferFunc);
-	win.setOverrideQuantization(overrideQuantization);
-	while (!win.setV4LFormat(fmt)) {
-		fprintf(stderr, "Unsupported format: '%s' %s\n",
-			fcc2s(fmt.g_pixelformat()).c_str(),
-			pixfmt2s(fmt.g_pixelformat()).c_str());
-		if (mode != AppModeSocket)
+	/*
+	 * Open a stream and show it in sa. Everything it allocates is
+	 * freed when the application exits.
+	 */
+	auto openStream = [&](const StreamSource &src, QScrollArea *sa) -> CaptureWin * {
+		enum AppMode mode = src.mode;
+		__u32 pixelFormat = overridePixelFormat;
+		unsigned start = single_step_start;
+		v4l2_fract aspect = pixelaspect;
+		double rate = fps;
+		cv4l_fd *fd = new cv4l_fd;
+		int sock_fd = -1;
+		cv4l_fmt fmt;
+
+		fd->s_direct(raw);
+		if (mode == AppModeV4L2) {
+			rate = 0;
+			QString device = getDeviceName("/dev/video", src.name);
+			if (fd->open(device.toUtf8().data(), true) < 0) {
+				perror((QString("could not open ") + device).toUtf8().data());
+				std::exit(EXIT_FAILURE);
+			}
+			if (!fd->has_vid_cap()) {
+				fprintf(stderr, "%s is not a video capture device\n", device.toUtf8().data());
+				std::exit(EXIT_FAILURE);
+			}
+			fd->g_fmt(fmt);
+
+			if (!pixelFormat) {
+				bool found = false;
+
+				for (unsigned i = 0; formats[i]; i++) {
+					if (fmt.g_pixelformat() == formats[i]) {
+						found = true;
+						break;
+					}
+				}
+				if (!found)
+					pixelFormat = V4L2_PIX_FMT_RGB24;
+			}
+
+			if (pixelFormat) {
+				fmt.s_pixelformat(pixelFormat);
+				fd->s_fmt(fmt);
+				fd->g_fmt(fmt);
+				if (fmt.g_pixelformat() != pixelFormat) {
+					fprintf(stderr, "Could not set format: '%s' %s\n",
+						fcc2s(pixelFormat).c_str(),
+						pixfmt2s(pixelFormat).c_str());
+					fprintf(stderr, "Fall back to format: '%s' %s\n",
+						fcc2s(fmt.g_pixelformat()).c_str(),
+						pixfmt2s(fmt.g_pixelformat()).c_str());
+				}
+			}
+
+			unsigned tmp_w, tmp_h;
+
+			aspect = fd->g_pixel_aspect(tmp_w, tmp_h);
+		} else if (mode == AppModeSocket) {
+			rate = 0;
+			sock_fd = initSocket(src.name, src.port, fmt, aspect);
+		} else {
+			fmt.s_type(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+			fmt.s_num_planes(1);
+			fmt.s_pixelformat(V4L2_PIX_FMT_RGB24);
+			fmt.s_width(640);
+			fmt.s_height(360);
+			fmt.s_field(V4L2_FIELD_NONE);
+			fmt.s_colorspace(V4L2_COLORSPACE_SRGB);
+			fmt.s_xfer_func(V4L2_XFER_FUNC_DEFAULT);
+			fmt.s_ycbcr_enc(V4L2_YCBCR_ENC_DEFAULT);
+			fmt.s_quantization(V4L2_QUANTIZATION_DEFAULT);
+			fmt.s_bytesperline(3 * fmt.g_width());
+			fmt.s_sizeimage(fmt.g_bytesperline() * fmt.g_height());
+		}
+
+		CaptureWin *win = new CaptureWin(sa);
+
+		win->setVerbose(verbose);
+		if (mode == AppModeFile) {
+			win->setModeFile(filename);
+			if (start)
+				start--;
+		} else if (mode == AppModeV4L2) {
+			win->setModeV4L2(fd);
+		} else if (mode == AppModeTPG) {
+			win->setModeTPG();
+		}
+		win->setOverrideWidth(overrideWidth);
+		win->setOverrideHeight(overrideHeight);
+		win->setOverrideHorPadding(overrideHorPadding);
+		win->setFps(rate);
+		win->setFormat(format);
+		win->setReportTimings(report_timings);
+		if (!record_file.isEmpty() && !win->setRecordFile(record_file))
 			std::exit(EXIT_FAILURE);
-		sock_fd = initSocket(port, fmt, pixelaspect);
-	}
-	win.setPixelAspect(pixelaspect);
-	win.setMinimumSize(16, 16);
-	win.setSizeIncrement(2, 2);
-	win.resize(fmt.g_width(), fmt.g_frame_height());
-	win.setFocusPolicy(Qt::StrongFocus);
-	if (single_step && mode != AppModeTest)
-		win.setSingleStepStart(single_step_start);
-
-	sa->setAlignment(Qt::AlignVCenter | Qt::AlignHCenter);
-	sa->setWidget(win.window());
-	sa->setFrameShape(QFrame::NoFrame);
-	sa->resize(win.correctAspect(QSize(fmt.g_width(), fmt.g_frame_height())));
-	sa->setWidgetResizable(true);
-
-	if (mode == AppModeSocket)
-		win.setModeSocket(sock_fd, port);
-	else if (mode == AppModeV4L2) {
-		cv4l_queue q(fd.g_type(), V4L2_MEMORY_MMAP);
-		q.reqbufs(&fd, v4l2_bufs);
-		q.obtain_bufs(&fd);
-		q.queue_all(&fd);
-		win.setQueue(&q);
-		if (fd.streamon())
+		if (!trace_file.isEmpty() && !win->setTraceFile(trace_file))
 			std::exit(EXIT_FAILURE);
-	} else {
-		struct tpg_data *tpg = win.getTPG();
-
-		tpg_init(tpg, fmt.g_width(), fmt.g_height());
-		tpg_alloc(tpg, fmt.g_width());
-		tpg_s_pattern(tpg, (tpg_pattern)pattern);
-		tpg_s_mv_hor_mode(tpg, hor_mode);
-		tpg_s_mv_vert_mode(tpg, vert_mode);
-		tpg_s_show_square(tpg, square);
-		tpg_s_show_border(tpg, border);
-		tpg_s_insert_sav(tpg, sav);
-		tpg_s_insert_eav(tpg, eav);
-		tpg_s_perc_fill(tpg, perc_fill);
-		if (rgb_lim_range)
-			tpg_s_real_rgb_range(tpg, V4L2_DV_RGB_RANGE_LIMITED);
-		tpg_s_alpha_component(tpg, alpha);
-		tpg_s_alpha_mode(tpg, alpha_red_only);
-		tpg_s_video_aspect(tpg, video_aspect);
-		switch (tpg_pixelaspect) {
-		case -1:
-			break;
-		default:
-			tpg_s_pixel_aspect(tpg, (tpg_pixel_aspect)tpg_pixelaspect);
-			break;
+		win->setCount(test ? test : cnt);
+		if (mode == AppModeTest) {
+			win->setModeTest(test);
+
+			TestState state = { };
+
+			state.fmt_idx = findVal(formats, pixelFormat);
+			state.field_idx = findVal(fields, overrideField);
+			state.colorspace_idx = findVal(colorspaces, overrideColorspace);
+			state.xfer_func_idx = findVal(xfer_funcs, overrideXferFunc);
+			state.ycbcr_enc_idx = findVal(ycbcr_encs, overrideYCbCrEnc);
+			state.hsv_enc_idx = findVal(hsv_encs, overrideHSVEnc);
+			state.quant_idx = findVal(quantizations, overrideQuantization);
+			state.mask = test_mask;
+			win->setTestState(state);
 		}
-		win.startTimer();
+
+		win->setOverridePixelFormat(pixelFormat);
+		win->setOverrideField(overrideField);
+		win->setOverrideColorspace(overrideColorspace);
+		win->setOverrideYCbCrEnc(overrideYCbCrEnc);
+		win->setOverrideHSVEnc(overrideHSVEnc);
+		win->setOverrideXferFunc(overrideXferFunc);
+		win->setOverrideQuantization(overrideQuantization);
+		while (!win->setV4LFormat(fmt)) {
+			fprintf(stderr, "Unsupported format: '%s' %s\n",
+				fcc2s(fmt.g_pixelformat()).c_str(),
+				pixfmt2s(fmt.g_pixelformat()).c_str());
+			if (mode != AppModeSocket)
+				std::exit(EXIT_FAILURE);
+			::close(sock_fd);
+			sock_fd = initSocket(src.name, src.port, fmt, aspect);
+		}
+		win->setPixelAspect(aspect);
+		win->setMinimumSize(16, 16);
+		win->setSizeIncrement(2, 2);
+		win->resize(fmt.g_width(), fmt.g_frame_height());
+		win->setFocusPolicy(Qt::StrongFocus);
+		if (single_step && mode != AppModeTest)
+			win->setSingleStepStart(start);
+
+		sa->setAlignment(Qt::AlignVCenter | Qt::AlignHCenter);
+		sa->setWidget(win->window());
+		sa->setFrameShape(QFrame::NoFrame);
+		sa->resize(win->correctAspect(QSize(fmt.g_width(), fmt.g_frame_height())));
+		sa->setWidgetResizable(true);
+
+		if (mode == AppModeSocket)
+			win->setModeSocket(sock_fd, src.name, src.port);
+		else if (mode == AppModeV4L2) {
+			cv4l_queue *q = new cv4l_queue(fd->g_type(), V4L2_MEMORY_MMAP);
+			q->reqbufs(fd, v4l2_bufs);
+			q->obtain_bufs(fd);
+			q->queue_all(fd);
+			win->setQueue(q);
+			if (fd->streamon())
+				std::exit(EXIT_FAILURE);
+		} else {
+			struct tpg_data *tpg = win->getTPG();
+
+			tpg_init(tpg, fmt.g_width(), fmt.g_height());
+			tpg_s_threads(tpg, QThread::idealThreadCount());
+			tpg_alloc(tpg, fmt.g_width());
+			tpg_s_pattern(tpg, (tpg_pattern)pattern);
+			tpg_s_mv_hor_mode(tpg, hor_mode);
+			tpg_s_mv_vert_mode(tpg, vert_mode);
+			tpg_s_show_square(tpg, square);
+			tpg_s_show_border(tpg, border);
+			tpg_s_insert_sav(tpg, sav);
+			tpg_s_insert_eav(tpg, eav);
+			tpg_s_perc_fill(tpg, perc_fill);
+			if (rgb_lim_range)
+				tpg_s_real_rgb_range(tpg, V4L2_DV_RGB_RANGE_LIMITED);
+			tpg_s_alpha_component(tpg, alpha);
+			tpg_s_alpha_mode(tpg, alpha_red_only);
+			tpg_s_video_aspect(tpg, video_aspect);
+			switch (tpg_pixelaspect) {
+			case -1:
+				break;
+			default:
+				tpg_s_pixel_aspect(tpg, (tpg_pixel_aspect)tpg_pixelaspect);
+				break;
+			}
+			win->startTimer();
+		}
+		return win;
+	};
+
+	if (sources.size() == 1) {
+		QScrollArea *sa = new QScrollArea; // Automatically freed on window close
+
+		openStream(sources[0], sa);
+		sa->show();
+		return disp.exec();
+	}
+
+	/*
+	 * Show the streams tiled in a single window. The tiles are updated
+	 * independently, and since they share the window they also share
+	 * its OpenGL context group.
+	 */
+	QWidget *mosaic = new QWidget;
+	QGridLayout *grid = new QGridLayout(mosaic);
+	unsigned cols = qCeil(qSqrt(sources.size()));
+	unsigned rows = (sources.size() + cols - 1) / cols;
+	QSize tile;
+
+	grid->setContentsMargins(0, 0, 0, 0);
+	grid->setSpacing(2);
+	for (int i = 0; i < sources.size(); i++) {
+		QScrollArea *sa = new QScrollArea;
+
+		openStream(sources[i], sa);
+		grid->addWidget(sa, i / cols, i % cols);
+		if (i == 0)
+			tile = sa->size();
 	}
-	sa->show();
+	mosaic->setWindowTitle(QString("Mosaic of %1 streams").arg(sources.size()));
+	mosaic->resize(tile.width(), tile.height() * rows / cols);
+	mosaic->show();
 	return disp.exec();
 }
@@ -15,6 +15,6 @@
 #include "capture.h"
 
 __u32 read_u32(int fd);
-int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect);
+int initSocket(const QString &host, int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect);
 
 #endif
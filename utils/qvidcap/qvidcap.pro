@@ -21,10 +21,11 @@ QMAKE_CXXFLAGS += -include $$MESON_BUILD_PATH/config.h
 
 INCLUDEPATH += $$PWD/../..
 INCLUDEPATH += $$PWD/../common
+INCLUDEPATH += $$PWD/../../lib/libv4lconvert
 INCLUDEPATH += $$PWD/../v4l2-compliance
 
-v4l2_convert_hook.depends = $$PWD/v4l2-convert.pl $$PWD/v4l2-convert.glsl
-v4l2_convert_hook.commands = perl $$PWD/v4l2-convert.pl < $$PWD/v4l2-convert.glsl > v4l2-convert.h
+v4l2_convert_hook.depends = $$PWD/../../lib/libv4lconvert/v4l2-convert.pl $$PWD/../../lib/libv4lconvert/v4l2-convert.glsl
+v4l2_convert_hook.commands = perl $$PWD/../../lib/libv4lconvert/v4l2-convert.pl < $$PWD/../../lib/libv4lconvert/v4l2-convert.glsl > v4l2-convert.h
 QMAKE_EXTRA_TARGETS += v4l2_convert_hook
 PRE_TARGETDEPS += v4l2_convert_hook
 
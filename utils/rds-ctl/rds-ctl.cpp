@@ -12,6 +12,7 @@
 #include <clocale>
 #include <cmath>
 #include <csignal>
+#include <cstdarg>
 #include <cstring>
 #include <ctime>
 #include <map>
@@ -21,6 +22,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
@@ -52,6 +54,7 @@ enum Option {
 	OptFreqSeek,
 	OptListDevices,
 	OptListFreqBands,
+	OptMonitor,
 	OptOpenFile,
 	OptPrintBlock,
 	OptSilent,
@@ -74,6 +77,7 @@ struct ctl_parameters {
 };
 
 static struct ctl_parameters params;
+static dev_vec monitor_devices;
 static int app_result;
 
 static struct option long_options[] = {
@@ -88,6 +92,7 @@ static struct option long_options[] = {
 	{"info", no_argument, nullptr, OptGetDriverInfo},
 	{"list-devices", no_argument, nullptr, OptListDevices},
 	{"list-freq-bands", no_argument, nullptr, OptListFreqBands},
+	{"monitor", no_argument, nullptr, OptMonitor},
 	{"print-block", no_argument, nullptr, OptPrintBlock},
 	{"read-rds", no_argument, nullptr, OptReadRds},
 	{"set-freq", required_argument, nullptr, OptSetFreq},
@@ -149,6 +154,10 @@ static void usage_rds()
 	       "  --print-block      prints all valid RDS fields, whenever a value is updated\n"
 	       "                     instead of printing only updated values\n"
 	       "  --tmc              print information about TMC (Traffic Message Channel) messages\n"
+	       "  --monitor          read RDS data from all devices given with -d at the same time,\n"
+	       "                     or all RDS-capable devices if there is no -d, and print one\n"
+	       "                     line with the fields updated by each read:\n"
+	       "                     <time> <device> <field>=<value>...\n"
 	       "  --silent           only set the result code, do not print any messages\n"
 	       "  --verbose          turn on verbose mode - every received RDS group\n"
 	       "                     will be printed\n"
@@ -608,6 +617,214 @@ static void read_rds(struct v4l2_rds *handle, const int fd, const int wait_limit
 	print_rds_data(handle, 0xFFFFFFFF);
 }
 
+static void add_rds_string(std::string &rec, const char *key, const uint8_t *s)
+{
+	char buf[8];
+
+	rec += " ";
+	rec += key;
+	rec += "=\"";
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			rec += '\\';
+			rec += *s;
+		} else if (*s < 0x20 || *s == 0x7f) {
+			snprintf(buf, sizeof(buf), "\\x%02x", *s);
+			rec += buf;
+		} else {
+			rec += *s;
+		}
+	}
+	rec += "\"";
+}
+
+static void add_rds_field(std::string &rec, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void add_rds_field(std::string &rec, const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	rec += " ";
+	rec += buf;
+}
+
+/*
+ * Print the updated fields as a single line record:
+ * <time> <device> <field>=<value>...
+ */
+static void print_rds_record(const char *name, const struct v4l2_rds *handle,
+			     uint32_t updated_fields)
+{
+	uint32_t fields = updated_fields & handle->valid_fields;
+	struct timespec ts;
+	std::string rec;
+	char buf[64];
+
+	if (fields & V4L2_RDS_PI)
+		add_rds_field(rec, "pi=%04x", handle->pi);
+	if (fields & V4L2_RDS_PS)
+		add_rds_string(rec, "ps", handle->ps);
+	if (fields & V4L2_RDS_PTY)
+		add_rds_field(rec, "pty=%u", handle->pty);
+	if (fields & V4L2_RDS_PTYN)
+		add_rds_string(rec, "ptyn", handle->ptyn);
+	if (fields & V4L2_RDS_RT)
+		add_rds_string(rec, "rt", handle->rt);
+	if (fields & V4L2_RDS_TP)
+		add_rds_field(rec, "tp=%u", handle->tp);
+	if (fields & V4L2_RDS_TA)
+		add_rds_field(rec, "ta=%u", handle->ta);
+	if (fields & V4L2_RDS_MS)
+		add_rds_field(rec, "ms=%u", handle->ms);
+	if (fields & V4L2_RDS_DI)
+		add_rds_field(rec, "di=%x", handle->di);
+	if (fields & V4L2_RDS_ECC)
+		add_rds_field(rec, "ecc=%02x", handle->ecc);
+	if (fields & V4L2_RDS_LC)
+		add_rds_field(rec, "lc=%u", handle->lc);
+	if (updated_fields & V4L2_RDS_TIME)
+		add_rds_field(rec, "time=%lld", static_cast<long long>(handle->time));
+	if (fields & V4L2_RDS_AF) {
+		const struct v4l2_rds_af_set *af_set = &handle->rds_af;
+
+		rec += " af=";
+		for (int i = 0; i < af_set->size && i < af_set->announced_af; i++) {
+			if (i)
+				rec += ",";
+			rec += std::to_string(af_set->af[i] / 1000);
+		}
+	}
+	if (params.options[OptTMC] &&
+	    (updated_fields & (V4L2_RDS_TMC_SG | V4L2_RDS_TMC_MG))) {
+		const struct v4l2_rds_tmc_msg *msg = &handle->tmc.tmc_msg;
+
+		add_rds_field(rec, "tmc_location=%04x tmc_event=%04x",
+			      msg->location, msg->event);
+		add_rds_field(rec, "tmc_extent=%02x tmc_duration=%02x",
+			      msg->extent, msg->dp);
+	}
+	if (rec.empty())
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	snprintf(buf, sizeof(buf), "%lld.%03ld %s",
+		 static_cast<long long>(ts.tv_sec), ts.tv_nsec / 1000000, name);
+	rec.insert(0, buf);
+	rec += "\n";
+	fwrite(rec.c_str(), 1, rec.size(), stdout);
+}
+
+struct rds_monitor {
+	std::string name;
+	int fd;
+	struct v4l2_rds *handle;
+};
+
+static void monitor_rds(const dev_vec &devices)
+{
+	std::vector<rds_monitor> mons(devices.size());
+	struct epoll_event events[16];
+	struct v4l2_rds_data rds_data[64];
+	unsigned active = 0;
+	int epfd;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		std::exit(EXIT_FAILURE);
+	}
+
+	for (unsigned i = 0; i < devices.size(); i++) {
+		rds_monitor &mon = mons[i];
+		struct epoll_event ev = {};
+		const char *p = strrchr(devices[i].c_str(), '/');
+
+		mon.name = p ? p + 1 : devices[i];
+		mon.fd = open(devices[i].c_str(), O_RDONLY | O_NONBLOCK);
+		if (mon.fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", devices[i].c_str(),
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		mon.handle = v4l2_rds_create(params.options[OptRBDS]);
+		if (!mon.handle) {
+			fprintf(stderr, "Failed to init RDS lib: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, mon.fd, &ev)) {
+			fprintf(stderr, "Cannot monitor %s: %s\n", devices[i].c_str(),
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		active++;
+	}
+
+	while (!params.terminate_decoding && active) {
+		int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]),
+				   params.wait_limit);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			app_result = -1;
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			rds_monitor &mon = mons[events[i].data.u32];
+			ssize_t bytes;
+
+			/* read all pending blocks, each is 3 bytes */
+			bytes = read(mon.fd, rds_data, sizeof(rds_data));
+			if (bytes < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (bytes <= 0) {
+				fprintf(stderr, "%s: %s, stopped monitoring\n",
+					mon.name.c_str(),
+					bytes ? strerror(errno) : "end of input");
+				epoll_ctl(epfd, EPOLL_CTL_DEL, mon.fd, nullptr);
+				app_result = -1;
+				active--;
+				continue;
+			}
+
+			unsigned num_blocks = bytes / sizeof(rds_data[0]);
+
+			/* TMC messages can't be coalesced, so decode those block by block */
+			if (params.options[OptTMC]) {
+				for (unsigned j = 0; j < num_blocks; j++) {
+					uint32_t updated_fields = v4l2_rds_add(mon.handle, &rds_data[j]);
+
+					if (updated_fields)
+						print_rds_record(mon.name.c_str(), mon.handle,
+								 updated_fields);
+				}
+				continue;
+			}
+
+			uint32_t updated_fields = v4l2_rds_add_batch(mon.handle, rds_data,
+								     num_blocks, nullptr, nullptr);
+			if (updated_fields)
+				print_rds_record(mon.name.c_str(), mon.handle, updated_fields);
+		}
+		fflush(stdout);
+	}
+
+	for (auto &mon : mons) {
+		v4l2_rds_destroy(mon.handle);
+		close(mon.fd);
+	}
+	close(epfd);
+}
+
 static void read_rds_from_fd(const int fd)
 {
 	struct v4l2_rds *rds_handle;
@@ -665,6 +882,7 @@ static int parse_cl(int argc, char **argv)
 				snprintf(params.fd_name, sizeof(params.fd_name), "/dev/radio%s", optarg);
 			}
 			params.fd_name[sizeof(params.fd_name) - 1] = '\0';
+			monitor_devices.push_back(params.fd_name);
 			break;
 		case OptSetFreq:
 			params.freq = strtod(optarg, nullptr);
@@ -862,6 +1080,19 @@ int main(int argc, char **argv)
 		std::exit(EXIT_SUCCESS);
 	}
 
+	/* Monitor Mode: decode RDS data of many devices at once */
+	if (params.options[OptMonitor]) {
+		if (monitor_devices.empty())
+			monitor_devices = list_devices();
+		if (monitor_devices.empty()) {
+			fprintf(stderr, "No RDS-capable device found\n");
+			std::exit(EXIT_FAILURE);
+		}
+		signal(SIGTERM, signal_handler_interrupt);
+		monitor_rds(monitor_devices);
+		std::exit(app_result);
+	}
+
 	/* Device Mode: open the radio device as read-only and non-blocking */
 	if (!params.options[OptSetDevice]) {
 		/* check the system for RDS capable devices */
@@ -50,6 +50,7 @@ enum Option {
 	OptExitOnFail = 'E',
 	OptStreamAllFormats = 'f',
 	OptHelp = 'h',
+	OptJobs = 'j',
 	OptSetMediaDevice = 'm',
 	OptSetMediaDeviceOnly = 'M',
 	OptNoWarnings = 'n',
@@ -67,6 +68,9 @@ enum Option {
 	OptMediaBusInfo = 'z',
 	OptStreamFrom = 128,
 	OptStreamFromHdr,
+	OptStreamSample,
+	OptPerformance,
+	OptReuseBuffers,
 	OptVersion,
 	OptLast = 256
 };
@@ -88,11 +92,16 @@ bool is_vivid;
 bool is_uvcvideo;
 int media_fd = -1;
 unsigned warnings;
+unsigned jobs = 1;
+bool stream_sample;
+unsigned stream_sample_sizes = 1;
+bool reuse_buffers;
 bool has_mmu = true;
 
 static unsigned color_component;
 static unsigned color_skip;
 static unsigned color_perc = 90;
+static unsigned perf_frame_count = 300;
 
 struct dev_state {
 	struct node *node;
@@ -127,6 +136,7 @@ static struct option long_options[] = {
 	{"media-device", required_argument, nullptr, OptSetMediaDevice},
 	{"media-device-only", required_argument, nullptr, OptSetMediaDeviceOnly},
 	{"media-bus-info", required_argument, nullptr, OptMediaBusInfo},
+	{"jobs", required_argument, nullptr, OptJobs},
 	{"help", no_argument, nullptr, OptHelp},
 	{"verbose", no_argument, nullptr, OptVerbose},
 	{"color", required_argument, nullptr, OptColor},
@@ -142,6 +152,9 @@ static struct option long_options[] = {
 	{"stream-from", required_argument, nullptr, OptStreamFrom},
 	{"stream-from-hdr", required_argument, nullptr, OptStreamFromHdr},
 	{"stream-all-formats", optional_argument, nullptr, OptStreamAllFormats},
+	{"stream-sample", optional_argument, nullptr, OptStreamSample},
+	{"performance", optional_argument, nullptr, OptPerformance},
+	{"reuse-buffers", no_argument, nullptr, OptReuseBuffers},
 	{"stream-all-io", no_argument, nullptr, OptStreamAllIO},
 	{"stream-all-color", required_argument, nullptr, OptStreamAllColorTest},
 	{"version", no_argument, nullptr, OptVersion},
@@ -222,6 +235,11 @@ static void usage()
 	printf("                     If <dev> starts with a digit, then /dev/media<dev> is used.\n");
 	printf("                     If <dev> doesn't exist, then attempt to find a media device with a\n");
 	printf("                     bus info string equal to <dev>.\n");
+	printf("  -j, --jobs <count> With -m, test up to <count> interfaces of the media device at\n");
+	printf("                     the same time, each in its own process. Interfaces that are\n");
+	printf("                     linked to the same entities are still tested one by one.\n");
+	printf("                     The output is shown once all interfaces are tested.\n");
+	printf("                     This can't be combined with --expbuf-device.\n");
 	printf("  -s, --streaming <count>\n");
 	printf("                     Enable the streaming tests. Set <count> to the number of\n");
 	printf("                     frames to stream (default 60). Requires a valid input/output\n");
@@ -241,6 +259,21 @@ static void usage()
 	printf("                     for one second for all formats, at all sizes, at all intervals\n");
 	printf("                     and with all field values. If <count> is given, then stream\n");
 	printf("                     for that many frames instead of one second.\n");
+	printf("  --stream-sample [<sizes>]\n");
+	printf("                     Make --stream-all-formats only stream the smallest, the largest\n");
+	printf("                     and <sizes> (default 1) evenly spread discrete frame sizes, and\n");
+	printf("                     the shortest and longest discrete frame interval of each format.\n");
+	printf("                     Formats the driver already streamed are not streamed again.\n");
+	printf("  --performance [<count>]\n");
+	printf("                     Capture <count> (default 300) frames with each memory type and\n");
+	printf("                     report the frame rate, the QBUF to DQBUF latency percentiles and\n");
+	printf("                     the dropped frames. Fails if the frame rate is less than 90%% of\n");
+	printf("                     the frame interval of VIDIOC_G_PARM. For DMABUF testing\n");
+	printf("                     --expbuf-device needs to be set as well.\n");
+	printf("  --reuse-buffers    Keep the USERPTR memory and the DMABUF buffers exported by\n");
+	printf("                     --expbuf-device from one streaming test to the next, instead\n");
+	printf("                     of allocating them for each test, and add a separate test that\n");
+	printf("                     allocates and frees MMAP buffers several times.\n");
 	printf("  -a, --stream-all-io\n");
 	printf("                     Do streaming tests for all inputs or outputs instead of just\n");
 	printf("                     the current input or output. This requires that a valid video\n");
@@ -290,6 +323,25 @@ const char *ok(int res)
 	return buf;
 }
 
+/* Return the grand totals and the overall result so far, and reset them. */
+void takeTestTotals(struct test_totals &totals)
+{
+	totals.total = grand_total;
+	totals.ok = grand_ok;
+	totals.warnings = grand_warnings;
+	totals.result = app_result;
+	grand_total = grand_ok = grand_warnings = app_result = 0;
+}
+
+void addTestTotals(const struct test_totals &totals)
+{
+	grand_total += totals.total;
+	grand_ok += totals.ok;
+	grand_warnings += totals.warnings;
+	if (totals.result)
+		app_result = totals.result;
+}
+
 int check_string(const char *s, size_t len)
 {
 	size_t sz = strnlen(s, len);
@@ -1496,7 +1548,8 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 		if (!node.is_v4l2())
 			break;
 
-		if (options[OptStreaming] || (node.is_video && options[OptStreamAllFormats]) ||
+		if (options[OptStreaming] || options[OptPerformance] ||
+		    (node.is_video && options[OptStreamAllFormats]) ||
 		    (node.is_video && node.can_capture && options[OptStreamAllColorTest]))
 			printf("Test %s %d:\n\n",
 				node.can_capture ? "input" : "output", io);
@@ -1549,10 +1602,34 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			} else if (!options[OptSetExpBufDevice]) {
 				printf("\ttest DMABUF: Cannot test, specify --expbuf-device\n");
 			}
+			if (reuse_buffers) {
+				printf("\ttest buffer allocation churn: %s\n",
+				       ok(testAllocChurn(&node, 16)));
+				node.reopen();
+			}
 
 			printf("\n");
 		}
 
+		if (options[OptPerformance]) {
+			printf("Performance tests:\n");
+			printf("\ttest MMAP performance: %s\n",
+			       ok(testPerformance(&expbuf_node, &node, perf_frame_count,
+						  V4L2_MEMORY_MMAP)));
+			node.reopen();
+			printf("\ttest USERPTR performance: %s\n",
+			       ok(testPerformance(&expbuf_node, &node, perf_frame_count,
+						  V4L2_MEMORY_USERPTR)));
+			node.reopen();
+			if (options[OptSetExpBufDevice]) {
+				printf("\ttest DMABUF performance: %s\n",
+				       ok(testPerformance(&expbuf_node, &node, perf_frame_count,
+							  V4L2_MEMORY_DMABUF)));
+				node.reopen();
+			}
+			printf("\n");
+		}
+
 		if (node.is_video && options[OptStreamAllFormats]) {
 			printf("Stream using all formats:\n");
 
@@ -1596,6 +1673,7 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 	}
 
 	restoreState();
+	freeBufferPool();
 
 show_total:
 	/* Final test report */
@@ -1746,6 +1824,18 @@ int main(int argc, char **argv)
 			if (optarg)
 				all_fmt_frame_count = strtoul(optarg, nullptr, 0);
 			break;
+		case OptPerformance:
+			if (optarg)
+				perf_frame_count = strtoul(optarg, nullptr, 0);
+			break;
+		case OptReuseBuffers:
+			reuse_buffers = true;
+			break;
+		case OptStreamSample:
+			stream_sample = true;
+			if (optarg)
+				stream_sample_sizes = strtoul(optarg, nullptr, 0);
+			break;
 		case OptStreamAllColorTest:
 			subs = optarg;
 			while (*subs != '\0') {
@@ -1812,6 +1902,11 @@ int main(int argc, char **argv)
 		case OptNoProgress:
 			no_progress = true;
 			break;
+		case OptJobs:
+			jobs = strtoul(optarg, nullptr, 0);
+			if (!jobs)
+				jobs = 1;
+			break;
 		case OptVersion:
 			print_sha();
 			std::exit(EXIT_SUCCESS);
@@ -1836,6 +1931,16 @@ int main(int argc, char **argv)
 		usage();
 		std::exit(EXIT_FAILURE);
 	}
+	/*
+	 * All jobs would share the open file of the exporting device, and with
+	 * it its buffer queue, so their DMABUF tests would free each other's
+	 * buffers.
+	 */
+	if (jobs > 1 && !expbuf_device.empty()) {
+		fprintf(stderr, "--jobs can't be used together with --expbuf-device\n");
+		usage();
+		std::exit(EXIT_FAILURE);
+	}
 
 	print_sha();
 	printf("\n");
@@ -53,6 +53,10 @@ extern bool is_uvcvideo; // We're testing the uvc driver
 extern int kernel_version;
 extern int media_fd;
 extern unsigned warnings;
+extern unsigned jobs;
+extern bool stream_sample;
+extern unsigned stream_sample_sizes;
+extern bool reuse_buffers;
 extern bool has_mmu;
 
 enum poll_mode {
@@ -310,6 +314,16 @@ int check_0(const void *p, int len);
 int restoreFormat(struct node *node);
 void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_node, media_type type,
 	      unsigned frame_count, unsigned all_fmt_frame_count, int parent_media_fd = -1);
+
+// The grand totals and the overall result, passed from the --jobs processes
+struct test_totals {
+	int total;
+	int ok;
+	int warnings;
+	int result;
+};
+void takeTestTotals(struct test_totals &totals);
+void addTestTotals(const struct test_totals &totals);
 std::string stream_from(const std::string &pixelformat, bool &use_hdr);
 
 // Media Controller ioctl tests
@@ -409,6 +423,10 @@ int testDmaBuf(struct node *expbuf_node, struct node *node,
 	       struct node *node_m2m_cap, unsigned frame_count,
 	       enum poll_mode pollmode);
 int testRequests(struct node *node, bool test_streaming);
+int testPerformance(struct node *expbuf_node, struct node *node,
+		    unsigned frame_count, unsigned memory);
+int testAllocChurn(struct node *node, unsigned rounds);
+void freeBufferPool();
 void streamAllFormats(struct node *node, unsigned frame_count);
 void streamM2MAllFormats(struct node *node, unsigned frame_count);
 
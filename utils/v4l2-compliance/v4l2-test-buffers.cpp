@@ -1714,6 +1714,92 @@ int testMmap(struct node *node, struct node *node_m2m_cap, unsigned frame_count,
 	return 0;
 }
 
+/*
+ * With --reuse-buffers the memory used for USERPTR buffers and the buffers
+ * exported by the --expbuf-device for DMABUF are kept from one streaming
+ * test to the next, as long as they are big enough, instead of allocating
+ * them for each test. freeBufferPool() releases them.
+ */
+static std::vector<std::pair<void *, __u32> > userptr_pool;
+static cv4l_queue exp_pool;
+static struct node *exp_pool_node;
+
+static void *getUserPtrMem(unsigned idx, __u32 len)
+{
+	if (!reuse_buffers)
+		return malloc(len);
+
+	if (idx >= userptr_pool.size())
+		userptr_pool.resize(idx + 1, { nullptr, 0 });
+
+	auto &mem = userptr_pool[idx];
+
+	if (mem.second < len) {
+		free(mem.first);
+		mem.first = malloc(len);
+		mem.second = mem.first ? len : 0;
+	}
+	return mem.first;
+}
+
+static void putUserPtrMem(void *m)
+{
+	if (!reuse_buffers)
+		free(m);
+}
+
+static bool expBufsFit(struct node *expbuf_node, const cv4l_queue &q,
+		       const cv4l_queue &exp_q)
+{
+	if (exp_pool_node != expbuf_node ||
+	    exp_q.g_buffers() < q.g_buffers() ||
+	    exp_q.g_num_planes() < q.g_num_planes() ||
+	    exp_q.g_fd(0, 0) < 0)
+		return false;
+	for (unsigned p = 0; p < q.g_num_planes(); p++)
+		if (exp_q.g_length(p) < q.g_length(p))
+			return false;
+	return true;
+}
+
+/* The queue to export the DMABUF buffers from: the pool with --reuse-buffers */
+static cv4l_queue &expBufQueue(cv4l_queue &exp_q)
+{
+	if (!reuse_buffers)
+		return exp_q;
+	if (!exp_pool_node)
+		exp_pool.init(exp_q.g_type(), V4L2_MEMORY_MMAP);
+	return exp_pool;
+}
+
+static int exportBufs(struct node *expbuf_node, const cv4l_queue &q,
+		      cv4l_queue &exp_q)
+{
+	if (reuse_buffers) {
+		if (expBufsFit(expbuf_node, q, exp_q))
+			return 0;
+		if (exp_pool_node)
+			exp_q.free(exp_pool_node);
+		exp_pool_node = nullptr;
+	}
+	fail_on_test(exp_q.reqbufs(expbuf_node, q.g_buffers()));
+	fail_on_test(exp_q.g_buffers() < q.g_buffers());
+	fail_on_test(exp_q.export_bufs(expbuf_node, exp_q.g_type()));
+	if (reuse_buffers)
+		exp_pool_node = expbuf_node;
+	return 0;
+}
+
+void freeBufferPool()
+{
+	for (auto &mem : userptr_pool)
+		free(mem.first);
+	userptr_pool.clear();
+	if (exp_pool_node)
+		exp_pool.free(exp_pool_node);
+	exp_pool_node = nullptr;
+}
+
 static int setupUserPtr(struct node *node, cv4l_queue &q)
 {
 	for (unsigned i = 0; i < q.g_buffers(); i++) {
@@ -1859,7 +1945,7 @@ int testUserPtr(struct node *node, struct node *node_m2m_cap, unsigned frame_cou
 			for (unsigned p = 0; p < q.g_num_planes(); p++) {
 				/* ensure that len is a multiple of 4 */
 				__u32 len = ((q.g_length(p) + 3) & ~0x3) + 4 * 4096;
-				auto m = static_cast<__u32 *>(malloc(len));
+				auto m = static_cast<__u32 *>(getUserPtrMem(i * VIDEO_MAX_PLANES + p, len));
 
 				fail_on_test(!m);
 				fail_on_test((uintptr_t)m & 0x7);
@@ -1956,7 +2042,7 @@ int testUserPtr(struct node *node, struct node *node_m2m_cap, unsigned frame_cou
 					if (*x != filler)
 						fail("data at %zd bytes after the end of the buffer was touched\n",
 						     (x - (u + buflen / 4)) * 4);
-				free(m);
+				putUserPtrMem(m);
 				q.s_userptr(i, p, nullptr);
 			}
 		}
@@ -1968,9 +2054,7 @@ int testUserPtr(struct node *node, struct node *node_m2m_cap, unsigned frame_cou
 static int setupDmaBuf(struct node *expbuf_node, struct node *node,
 		       cv4l_queue &q, cv4l_queue &exp_q)
 {
-	fail_on_test(exp_q.reqbufs(expbuf_node, q.g_buffers()));
-	fail_on_test(exp_q.g_buffers() < q.g_buffers());
-	fail_on_test(exp_q.export_bufs(expbuf_node, exp_q.g_type()));
+	fail_on_test(exportBufs(expbuf_node, q, exp_q));
 
 	for (unsigned i = 0; i < q.g_buffers(); i++) {
 		buffer buf(q);
@@ -2070,7 +2154,8 @@ int testDmaBuf(struct node *expbuf_node, struct node *node, struct node *node_m2
 
 		cv4l_queue q(type, V4L2_MEMORY_DMABUF);
 		cv4l_queue m2m_q(v4l_type_invert(type));
-		cv4l_queue exp_q(expbuf_type, V4L2_MEMORY_MMAP);
+		cv4l_queue local_exp_q(expbuf_type, V4L2_MEMORY_MMAP);
+		cv4l_queue &exp_q = expBufQueue(local_exp_q);
 
 		if (testSetupVbi(node, type))
 			continue;
@@ -2130,7 +2215,11 @@ int testDmaBuf(struct node *expbuf_node, struct node *node, struct node *node_m2
 					 pollmode, capture_count));
 		fail_on_test(node->streamoff(q.g_type()));
 		fail_on_test(node->streamoff(q.g_type()));
-		if (node->supports_orphaned_bufs) {
+		if (reuse_buffers) {
+			// Keep the exported buffers for the next test
+			q.munmap_bufs(node);
+			fail_on_test(q.reqbufs(node, 0));
+		} else if (node->supports_orphaned_bufs) {
 			fail_on_test(q.reqbufs(node, 0));
 			exp_q.close_exported_fds();
 		} else if (q.reqbufs(node, 0) != EBUSY) {
@@ -3074,6 +3163,174 @@ int restoreFormat(struct node *node)
 	return 0;
 }
 
+static __u64 perf_now_ns()
+{
+	timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double perf_percentile_ms(std::vector<__u64> &v, unsigned perc)
+{
+	if (v.empty())
+		return 0;
+	std::sort(v.begin(), v.end());
+	return v[(v.size() - 1) * perc / 100] / 1000000.0;
+}
+
+/*
+ * Capture frame_count frames using the given memory type and measure the
+ * sustained frame rate against the frame interval reported by G_PARM, the
+ * QBUF to DQBUF latency and how many frames were dropped according to the
+ * sequence counter. A driver that can't keep up with its own frame interval
+ * fails this test.
+ */
+int testPerformance(struct node *expbuf_node, struct node *node,
+		    unsigned frame_count, unsigned memory)
+{
+	int type = node->g_type();
+
+	if (!(node->g_caps() & V4L2_CAP_STREAMING) || node->is_m2m ||
+	    !node->can_capture || !(node->valid_buftypes & (1 << type)) ||
+	    !(node->valid_memorytype & (1 << memory)))
+		return ENOTTY;
+	if (memory == V4L2_MEMORY_DMABUF && expbuf_node->g_fd() < 0)
+		return ENOTTY;
+
+	cur_fmt.s_type(type);
+	node->g_fmt(cur_fmt);
+
+	int expbuf_type = (expbuf_node->g_caps() & V4L2_CAP_VIDEO_CAPTURE_MPLANE) ?
+		V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	cv4l_queue q(type, memory);
+	cv4l_queue local_exp_q(expbuf_type, V4L2_MEMORY_MMAP);
+	cv4l_queue &exp_q = expBufQueue(local_exp_q);
+	v4l2_fract interval = { 0, 0 };
+	double expected_fps = 0;
+
+	if (!node->get_interval(interval) && interval.numerator && interval.denominator)
+		expected_fps = 1.0 / fract2f(&interval);
+
+	fail_on_test(q.reqbufs(node, 4));
+	if (memory == V4L2_MEMORY_DMABUF) {
+		fail_on_test(exportBufs(expbuf_node, q, exp_q));
+		for (unsigned i = 0; i < q.g_buffers(); i++)
+			for (unsigned p = 0; p < q.g_num_planes(); p++)
+				q.s_fd(i, p, exp_q.g_fd(i, p));
+	} else if (memory == V4L2_MEMORY_USERPTR && reuse_buffers) {
+		for (unsigned i = 0; i < q.g_buffers(); i++) {
+			for (unsigned p = 0; p < q.g_num_planes(); p++) {
+				void *m = getUserPtrMem(i * VIDEO_MAX_PLANES + p, q.g_length(p));
+
+				fail_on_test(!m);
+				q.s_userptr(i, p, m);
+			}
+		}
+	} else {
+		fail_on_test(q.obtain_bufs(node));
+	}
+
+	std::vector<__u64> queued_ns(q.g_buffers());
+	std::vector<__u64> latencies;
+	cv4l_buffer buf(q);
+
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		buf.init(q, i);
+		queued_ns[i] = perf_now_ns();
+		fail_on_test(node->qbuf(buf));
+	}
+	fail_on_test(node->streamon());
+
+	__u64 first_ns = 0, last_ns = 0;
+	unsigned frames = 0, dropped = 0;
+	int last_seq = -1;
+
+	while (frames < frame_count && node->dqbuf(buf) == 0) {
+		last_ns = perf_now_ns();
+		if (!frames)
+			first_ns = last_ns;
+		frames++;
+		latencies.push_back(last_ns - queued_ns[buf.g_index()]);
+		if (last_seq >= 0 && static_cast<int>(buf.g_sequence()) > last_seq + 1)
+			dropped += buf.g_sequence() - last_seq - 1;
+		last_seq = buf.g_sequence();
+		if (!no_progress)
+			printf("\r\t\t%s: Frame #%03d   ",
+			       buftype2s(q.g_type()).c_str(), buf.g_sequence());
+		fflush(stdout);
+		queued_ns[buf.g_index()] = perf_now_ns();
+		fail_on_test(node->qbuf(buf));
+	}
+	fail_on_test(node->streamoff());
+	if (memory == V4L2_MEMORY_USERPTR && reuse_buffers)
+		for (unsigned i = 0; i < q.g_buffers(); i++)
+			for (unsigned p = 0; p < q.g_num_planes(); p++)
+				q.s_userptr(i, p, nullptr);
+	q.free(node);
+	if (memory == V4L2_MEMORY_DMABUF && !reuse_buffers)
+		exp_q.free(expbuf_node);
+	if (!no_progress)
+		printf("\r\t\t                                                            \r");
+	fail_on_test(frames < 2);
+
+	double fps = (frames - 1) * 1000000000.0 / (last_ns - first_ns);
+	double drop_perc = 100.0 * dropped / (frames + dropped);
+	double p50 = perf_percentile_ms(latencies, 50);
+	double p90 = perf_percentile_ms(latencies, 90);
+	double p99 = perf_percentile_ms(latencies, 99);
+	double max = perf_percentile_ms(latencies, 100);
+
+	if (expected_fps)
+		printf("\t\t%.2f fps (G_PARM %.2f fps), ", fps, expected_fps);
+	else
+		printf("\t\t%.2f fps, ", fps);
+	printf("QBUF->DQBUF p50/p90/p99/max %.1f/%.1f/%.1f/%.1f ms, dropped %u (%.1f%%)\n",
+	       p50, p90, p99, max, dropped, drop_perc);
+
+	if (dropped)
+		warn("%u of %u frames were dropped\n", dropped, frames + dropped);
+	if (expected_fps && fps < expected_fps * 0.9)
+		return fail("%.2f fps is less than 90%% of the %.2f fps of G_PARM\n",
+			    fps, expected_fps);
+	return 0;
+}
+
+/*
+ * With --reuse-buffers the streaming tests no longer allocate and free
+ * buffers over and over again, so do that explicitly here.
+ */
+int testAllocChurn(struct node *node, unsigned rounds)
+{
+	int type = node->g_type();
+
+	if (!(node->g_caps() & V4L2_CAP_STREAMING) ||
+	    !(node->valid_buftypes & (1 << type)))
+		return ENOTTY;
+
+	cv4l_queue q(type, V4L2_MEMORY_MMAP);
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < rounds; i++) {
+		fail_on_test(q.reqbufs(node, 3));
+		if (i == 0)
+			count = q.g_buffers();
+		// The same number of buffers must be available each time
+		fail_on_test(q.g_buffers() != count);
+		fail_on_test(q.mmap_bufs(node));
+		fail_on_test(q.munmap_bufs(node));
+		fail_on_test(q.reqbufs(node, 0));
+		fail_on_test(q.g_buffers());
+		if (!no_progress)
+			printf("\r\t\t%s: Round #%03u   ",
+			       buftype2s(q.g_type()).c_str(), i);
+		fflush(stdout);
+	}
+	if (!no_progress)
+		printf("\r\t\t                                                            \r");
+	return 0;
+}
+
 static int testStreaming(struct node *node, unsigned frame_count)
 {
 	int type = node->g_type();
@@ -3212,6 +3469,34 @@ static bool haveSelTest(const selTest &test)
 		{ return &selfTest != &test; });
 }
 
+/*
+ * With --stream-sample the formats that were already streamed, as set by the
+ * driver, are not streamed again. Drivers often round different frame sizes
+ * to the same format.
+ */
+static std::set<std::vector<__u32>> streamedFmts;
+
+/*
+ * Return the indices of the frame sizes or intervals to stream: all of them,
+ * or with --stream-sample the first, the last and 'between' evenly spread
+ * ones in between.
+ */
+static std::vector<unsigned> sampleIndices(unsigned n, unsigned between)
+{
+	std::vector<unsigned> indices;
+
+	if (!stream_sample || n <= between + 2) {
+		for (unsigned i = 0; i < n; i++)
+			indices.push_back(i);
+		return indices;
+	}
+	indices.push_back(0);
+	for (unsigned k = 1; k <= between; k++)
+		indices.push_back(k * (n - 1) / (between + 1));
+	indices.push_back(n - 1);
+	return indices;
+}
+
 static void streamFmtRun(struct node *node, cv4l_fmt &fmt, unsigned frame_count,
 		bool testSelection = false)
 {
@@ -3290,6 +3575,21 @@ static void streamFmt(struct node *node, __u32 pixelformat, __u32 w, __u32 h,
 				fcc2s(pixelformat).c_str(),
 				fmt.g_width(), fmt.g_frame_height(), hz);
 
+	if (stream_sample) {
+		v4l2_fract interval = { 0, 0 };
+
+		node->get_interval(interval);
+		std::vector<__u32> key = {
+			fmt.g_pixelformat(), fmt.g_width(), fmt.g_frame_height(),
+			fmt.g_field(), fmt.g_bytesperline(), fmt.g_sizeimage(),
+			interval.numerator, interval.denominator
+		};
+		if (!streamedFmts.insert(key).second) {
+			printf("\t\tSame format as before, skipped\n");
+			return;
+		}
+	}
+
 	if (has_crop)
 		node->g_frame_selection(crop, fmt.g_field());
 	if (has_compose)
@@ -3483,10 +3783,14 @@ static void streamIntervals(struct node *node, __u32 pixelformat, __u32 w, __u32
 	}
 
 	if (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+		std::vector<v4l2_fract> intervals;
+
 		do {
-			streamFmt(node, pixelformat, w, h, &frmival.discrete,
-				  frame_count);
+			intervals.push_back(frmival.discrete);
 		} while (!node->enum_frameintervals(frmival));
+		for (auto i : sampleIndices(intervals.size(), 0))
+			streamFmt(node, pixelformat, w, h, &intervals[i],
+				  frame_count);
 		return;
 	}
 	streamFmt(node, pixelformat, w, h, &frmival.stepwise.min, frame_count);
@@ -3500,6 +3804,7 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 	if (node->enum_fmt(fmtdesc, true))
 		return;
 	selTests.clear();
+	streamedFmts.clear();
 	do {
 		v4l2_frmsizeenum frmsize;
 		cv4l_fmt fmt;
@@ -3540,14 +3845,18 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 		v4l2_frmsize_stepwise &ss = frmsize.stepwise;
 
 		switch (frmsize.type) {
-		case V4L2_FRMSIZE_TYPE_DISCRETE:
+		case V4L2_FRMSIZE_TYPE_DISCRETE: {
+			std::vector<v4l2_frmsize_discrete> sizes;
+
 			do {
+				sizes.push_back(frmsize.discrete);
+			} while (!node->enum_framesizes(frmsize));
+			for (auto i : sampleIndices(sizes.size(), stream_sample_sizes))
 				streamIntervals(node, fmtdesc.pixelformat,
-						frmsize.discrete.width,
-						frmsize.discrete.height,
+						sizes[i].width, sizes[i].height,
 						frame_count);
-			} while (!node->enum_framesizes(frmsize));
 			break;
+		}
 		default:
 			restoreFormat(node);
 			streamIntervals(node, fmtdesc.pixelformat,
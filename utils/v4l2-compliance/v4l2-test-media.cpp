@@ -20,10 +20,13 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include <dirent.h>
+#include <sys/mman.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include "v4l2-compliance.h"
 
@@ -535,84 +538,257 @@ int testMediaSetupLink(struct node *node)
 	return 0;
 }
 
-void walkTopology(struct node &node, struct node &expbuf_node,
-		  unsigned frame_count, unsigned all_fmt_frame_count)
+static void testInterface(struct node &node, struct node &expbuf_node,
+			  const media_v2_interface &iface,
+			  unsigned frame_count, unsigned all_fmt_frame_count)
 {
-	media_v2_topology topology;
+	std::string dev = mi_media_get_device(iface.devnode.major,
+					      iface.devnode.minor);
+	if (dev.empty())
+		return;
 
-	memset(&topology, 0, sizeof(topology));
-	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+	printf("--------------------------------------------------------------------------------\n");
+
+	media_type type = mi_media_detect_type(dev.c_str());
+	if (type == MEDIA_TYPE_CANT_STAT) {
+		fprintf(stderr, "\nCannot open device %s, skipping.\n\n",
+			dev.c_str());
 		return;
+	}
 
-	media_v2_interface v2_ifaces[topology.num_interfaces];
+	switch (type) {
+	// For now we can only handle V4L2 devices
+	case MEDIA_TYPE_VIDEO:
+	case MEDIA_TYPE_VBI:
+	case MEDIA_TYPE_RADIO:
+	case MEDIA_TYPE_SDR:
+	case MEDIA_TYPE_TOUCH:
+	case MEDIA_TYPE_SUBDEV:
+		break;
+	default:
+		type = MEDIA_TYPE_UNKNOWN;
+		break;
+	}
 
-	topology.ptr_interfaces = (uintptr_t)v2_ifaces;
-	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+	if (type == MEDIA_TYPE_UNKNOWN) {
+		fprintf(stderr, "\nUnable to detect what device %s is, skipping.\n\n",
+			dev.c_str());
+		return;
+	}
+
+	struct node test_node;
+	int fd = -1;
+
+	test_node.device = dev.c_str();
+	test_node.s_trace(node.g_trace());
+	switch (type) {
+	case MEDIA_TYPE_MEDIA:
+		test_node.s_direct(true);
+		fd = test_node.media_open(dev.c_str(), false);
+		break;
+	case MEDIA_TYPE_SUBDEV:
+		test_node.s_direct(true);
+		fd = test_node.subdev_open(dev.c_str(), false);
+		break;
+	default:
+		test_node.s_direct(node.g_direct());
+		fd = test_node.open(dev.c_str(), false);
+		break;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "\nFailed to open device %s, skipping\n\n",
+			dev.c_str());
 		return;
+	}
+
+	testNode(test_node, test_node, expbuf_node, type,
+		 frame_count, all_fmt_frame_count, node.g_fd());
+	test_node.close();
+}
+
+static __u32 findGroup(std::map<__u32, __u32> &groups, __u32 id)
+{
+	while (groups.find(id) != groups.end() && groups[id] != id)
+		id = groups[id] = groups[groups[id]];
+	return id;
+}
+
+static void joinGroups(std::map<__u32, __u32> &groups, __u32 a, __u32 b)
+{
+	a = findGroup(groups, a);
+	b = findGroup(groups, b);
+	groups[a] = a;
+	groups[b] = a;
+}
+
+/*
+ * Split the interfaces into groups that can be tested at the same time:
+ * interfaces that are linked to the same entity, or to entities that are
+ * linked to each other (e.g. the capture and output side of an m2m device
+ * or the nodes of one pipeline), end up in the same group.
+ */
+static std::vector<std::vector<unsigned>> groupInterfaces(const media_v2_topology &topology)
+{
+	auto ifaces = reinterpret_cast<media_v2_interface *>(topology.ptr_interfaces);
+	auto pads = reinterpret_cast<media_v2_pad *>(topology.ptr_pads);
+	auto links = reinterpret_cast<media_v2_link *>(topology.ptr_links);
+	std::map<__u32, __u32> pad_entity;
+	std::map<__u32, __u32> groups;
+
+	for (unsigned i = 0; i < topology.num_pads; i++)
+		pad_entity[pads[i].id] = pads[i].entity_id;
+
+	for (unsigned i = 0; i < topology.num_links; i++) {
+		const media_v2_link &link = links[i];
+
+		if ((link.flags & MEDIA_LNK_FL_LINK_TYPE) == MEDIA_LNK_FL_DATA_LINK)
+			joinGroups(groups, pad_entity[link.source_id],
+				   pad_entity[link.sink_id]);
+		else
+			joinGroups(groups, link.source_id, link.sink_id);
+	}
+
+	std::vector<std::vector<unsigned>> result;
+	std::map<__u32, unsigned> group_idx;
 
 	for (unsigned i = 0; i < topology.num_interfaces; i++) {
-		media_v2_interface &iface = v2_ifaces[i];
-		std::string dev = mi_media_get_device(iface.devnode.major,
-						      iface.devnode.minor);
-		if (dev.empty())
-			continue;
+		__u32 group = findGroup(groups, ifaces[i].id);
+
+		if (group_idx.find(group) == group_idx.end()) {
+			group_idx[group] = result.size();
+			result.push_back(std::vector<unsigned>());
+		}
+		result[group_idx[group]].push_back(i);
+	}
+	return result;
+}
+
+struct job_result {
+	struct test_totals totals;
+	bool done;
+};
 
-		printf("--------------------------------------------------------------------------------\n");
+/*
+ * Test each group of interfaces in its own process, at most 'jobs' at the
+ * same time. The output of each process is collected in a temporary file
+ * and printed in the order of the groups once all of them are done.
+ */
+static void testGroups(struct node &node, struct node &expbuf_node,
+		       const media_v2_interface *ifaces,
+		       const std::vector<std::vector<unsigned>> &groups,
+		       unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	unsigned num_groups = groups.size();
+	auto results = static_cast<job_result *>(mmap(nullptr,
+			num_groups * sizeof(job_result), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+	std::vector<FILE *> outputs(num_groups);
+	unsigned running = 0;
+	unsigned next = 0;
+
+	if (results == MAP_FAILED) {
+		for (const auto &group : groups)
+			for (auto i : group)
+				testInterface(node, expbuf_node, ifaces[i],
+					      frame_count, all_fmt_frame_count);
+		return;
+	}
 
-		media_type type = mi_media_detect_type(dev.c_str());
-		if (type == MEDIA_TYPE_CANT_STAT) {
-			fprintf(stderr, "\nCannot open device %s, skipping.\n\n",
-				dev.c_str());
+	fflush(stdout);
+	fflush(stderr);
+	while (next < num_groups || running) {
+		if (next < num_groups && running < jobs) {
+			pid_t pid = -1;
+
+			outputs[next] = tmpfile();
+			if (outputs[next])
+				pid = fork();
+			if (pid == 0) {
+				struct test_totals totals;
+
+				dup2(fileno(outputs[next]), STDOUT_FILENO);
+				dup2(fileno(outputs[next]), STDERR_FILENO);
+				setvbuf(stdout, nullptr, _IOLBF, 0);
+				takeTestTotals(totals);
+				for (auto i : groups[next])
+					testInterface(node, expbuf_node, ifaces[i],
+						      frame_count, all_fmt_frame_count);
+				fflush(stdout);
+				takeTestTotals(results[next].totals);
+				results[next].done = true;
+				_exit(0);
+			}
+			if (pid < 0) {
+				fprintf(stderr, "Cannot start a job, testing the next nodes in this process\n");
+				if (outputs[next])
+					fclose(outputs[next]);
+				outputs[next] = nullptr;
+				for (auto i : groups[next])
+					testInterface(node, expbuf_node, ifaces[i],
+						      frame_count, all_fmt_frame_count);
+			} else {
+				running++;
+			}
+			next++;
 			continue;
 		}
-
-		switch (type) {
-		// For now we can only handle V4L2 devices
-		case MEDIA_TYPE_VIDEO:
-		case MEDIA_TYPE_VBI:
-		case MEDIA_TYPE_RADIO:
-		case MEDIA_TYPE_SDR:
-		case MEDIA_TYPE_TOUCH:
-		case MEDIA_TYPE_SUBDEV:
+		if (waitpid(-1, nullptr, 0) < 0)
 			break;
-		default:
-			type = MEDIA_TYPE_UNKNOWN;
-			break;
-		}
+		running--;
+	}
 
-		if (type == MEDIA_TYPE_UNKNOWN) {
-			fprintf(stderr, "\nUnable to detect what device %s is, skipping.\n\n",
-				dev.c_str());
+	for (unsigned g = 0; g < num_groups; g++) {
+		if (!outputs[g])
 			continue;
-		}
 
-		struct node test_node;
-		int fd = -1;
+		char buf[4096];
+		size_t len;
 
-		test_node.device = dev.c_str();
-		test_node.s_trace(node.g_trace());
-		switch (type) {
-		case MEDIA_TYPE_MEDIA:
-			test_node.s_direct(true);
-			fd = test_node.media_open(dev.c_str(), false);
-			break;
-		case MEDIA_TYPE_SUBDEV:
-			test_node.s_direct(true);
-			fd = test_node.subdev_open(dev.c_str(), false);
-			break;
-		default:
-			test_node.s_direct(node.g_direct());
-			fd = test_node.open(dev.c_str(), false);
-			break;
-		}
-		if (fd < 0) {
-			fprintf(stderr, "\nFailed to open device %s, skipping\n\n",
-				dev.c_str());
-			continue;
+		rewind(outputs[g]);
+		while ((len = fread(buf, 1, sizeof(buf), outputs[g])) > 0)
+			fwrite(buf, 1, len, stdout);
+		fclose(outputs[g]);
+		if (results[g].done) {
+			addTestTotals(results[g].totals);
+		} else {
+			struct test_totals failed = { 0, 0, 0, 1 };
+
+			printf("\nTesting did not finish\n");
+			addTestTotals(failed);
 		}
+	}
+	fflush(stdout);
+	munmap(results, num_groups * sizeof(job_result));
+}
+
+void walkTopology(struct node &node, struct node &expbuf_node,
+		  unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	media_v2_topology topology;
 
-		testNode(test_node, test_node, expbuf_node, type,
-			 frame_count, all_fmt_frame_count, node.g_fd());
-		test_node.close();
+	memset(&topology, 0, sizeof(topology));
+	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+		return;
+
+	media_v2_entity v2_ents[topology.num_entities];
+	media_v2_interface v2_ifaces[topology.num_interfaces];
+	media_v2_pad v2_pads[topology.num_pads];
+	media_v2_link v2_links[topology.num_links];
+
+	topology.ptr_entities = (uintptr_t)v2_ents;
+	topology.ptr_interfaces = (uintptr_t)v2_ifaces;
+	topology.ptr_pads = (uintptr_t)v2_pads;
+	topology.ptr_links = (uintptr_t)v2_links;
+	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+		return;
+
+	if (jobs > 1) {
+		testGroups(node, expbuf_node, v2_ifaces, groupInterfaces(topology),
+			   frame_count, all_fmt_frame_count);
+		return;
 	}
+
+	for (unsigned i = 0; i < topology.num_interfaces; i++)
+		testInterface(node, expbuf_node, v2_ifaces[i],
+			      frame_count, all_fmt_frame_count);
 }
@@ -0,0 +1 @@
+../common/crc32c.c
\ No newline at end of file
@@ -13,6 +13,10 @@
 
 #include "v4l2-ctl.h"
 
+extern "C" {
+#include "get_media_devices.h"
+}
+
 #ifdef HAVE_SYS_KLOG_H
 #include <sys/klog.h>
 #endif
@@ -101,9 +105,13 @@ void common_usage()
 #ifndef NO_LIBV4L2
 	       "  -w, --wrapper      use the libv4l2 wrapper library.\n"
 #endif
-	       "  --list-devices     list all v4l devices. If -z was given, then list just the\n"
+	       "  --list-devices[=sysfs]\n"
+	       "                     list all v4l devices. If -z was given, then list just the\n"
 	       "                     devices of the media device with the bus info string as\n"
-	       "                     specified by the -z option.\n"
+	       "                     specified by the -z option. With sysfs, the devices\n"
+	       "                     are found and grouped using just sysfs, without opening\n"
+	       "                     them. The card name is then the sysfs name of the first\n"
+	       "                     node and the bus info is the sysfs device path.\n"
 	       "  --log-status       log the board status in the kernel log [VIDIOC_LOG_STATUS]\n"
 	       "  --get-priority     query the current access priority [VIDIOC_G_PRIORITY]\n"
 	       "  --set-priority <prio>\n"
@@ -323,6 +331,42 @@ static void list_devices()
 	}
 }
 
+static void list_devices_sysfs()
+{
+	void *md = discover_media_devices();
+	struct media_device_node node;
+	std::map<std::string, dev_vec> devices;
+	dev_map names;
+
+	if (!md) {
+		fprintf(stderr, "Couldn't read the devices from sysfs\n");
+		return;
+	}
+	for (unsigned i = 0; !get_media_device_node(md, i, &node); i++) {
+		if (!node.devname)
+			continue;
+		if (node.type > MEDIA_V4L_SUBDEV && node.type != MEDIA_MC_MEDIA)
+			continue;
+		devices[node.device].push_back(node.devname);
+		if (node.name)
+			names[node.devname] = node.name;
+	}
+	free_media_devices(md);
+
+	for (auto &dev : devices) {
+		std::sort(dev.second.begin(), dev.second.end(), sort_on_device_name);
+
+		std::string card = names[dev.second.front()];
+
+		if (card.empty())
+			card = "unknown";
+		printf("%s (%s):\n", card.c_str(), dev.first.c_str());
+		for (const auto &file : dev.second)
+			printf("\t%s\n", file.c_str());
+		printf("\n");
+	}
+}
+
 static std::string name2var(const char *name)
 {
 	std::string s;
@@ -1085,7 +1129,13 @@ void common_cmd(const std::string &media_bus_info, int ch, char *optarg)
 		prio = static_cast<enum v4l2_priority>(strtoul(optarg, nullptr, 0));
 		break;
 	case OptListDevices:
-		if (media_bus_info.empty())
+		if (optarg && !strcmp(optarg, "sysfs") && media_bus_info.empty())
+			list_devices_sysfs();
+		else if (optarg && strcmp(optarg, "sysfs")) {
+			fprintf(stderr, "Unknown --list-devices argument '%s'\n", optarg);
+			common_usage();
+			std::exit(EXIT_FAILURE);
+		} else if (media_bus_info.empty())
 			list_devices();
 		else
 			list_media_devices(media_bus_info);
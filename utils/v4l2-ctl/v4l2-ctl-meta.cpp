@@ -1,4 +1,9 @@
+#include <atomic>
+#include <cstddef>
+
 #include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include "v4l2-ctl.h"
 
@@ -6,6 +11,62 @@ static struct v4l2_format vfmt;	/* set_format/get_format */
 static unsigned mbus_code;
 static unsigned mbus_code_out;
 
+#ifndef NO_STREAM_TO
+/*
+ * The fixed size records written by --stream-meta-to, in host byte order.
+ * A metadata buffer has the sequence number of the video buffer it
+ * belongs to, so the records can be matched with the video frames by
+ * their sequence number.
+ */
+struct meta_record {
+	__u32 sequence;
+	__u32 dataformat;
+	__u64 timestamp;		/* buffer timestamp in ns */
+	__u32 flags;			/* V4L2_BUF_FLAG_* */
+	__u32 bytesused;
+	union {
+		struct {
+			__u64 ns;	/* system time at the start of the frame */
+			__u16 sof;	/* USB frame number */
+			__u8 length;	/* of the UVC payload header */
+			__u8 flags;	/* UVC_STREAM_* */
+			__u32 pts;	/* if UVC_STREAM_PTS */
+			__u32 stc;	/* source clock, if UVC_STREAM_SCR */
+			__u16 sof_counter; /* SOF counter, if UVC_STREAM_SCR */
+			__u16 reserved;
+		} uvc;
+		__u8 data[40];		/* other formats: the start of the buffer */
+	};
+};
+
+static_assert(sizeof(struct meta_record) == 64, "meta_record must be 64 bytes");
+
+/*
+ * The header of the --stream-meta-to shm: ring, followed by the ring of
+ * 'records' records. 'written' counts the records written so far, record
+ * n is at index n % records. It is updated after the record is written,
+ * a reader that copied record n has a consistent copy if 'written' is
+ * still at most n + records afterwards.
+ */
+struct meta_ring_hdr {
+	char magic[8];			/* "V4L2MD" */
+	__u32 version;			/* 1 */
+	__u32 hdr_size;
+	__u32 record_size;
+	__u32 records;
+	std::atomic<__u64> written;
+};
+
+#define META_RING_HDR_SIZE	64
+
+static const char *meta_to;
+static int meta_fd = -1;
+static struct meta_ring_hdr *meta_ring;
+static struct meta_record *meta_ring_records;
+static unsigned meta_ring_size = 4096;
+static bool meta_write_failed;
+#endif
+
 void meta_usage()
 {
 	printf("\nMetadata Formats options:\n"
@@ -31,6 +92,16 @@ void meta_usage()
 	       "  --try-fmt-meta-out <f> try the metadata output format [VIDIOC_TRY_FMT]\n"
 	       "                     parameter is either the format index as reported by\n"
 	       "                     --list-formats-meta-out, or the fourcc value as a string\n"
+#ifndef NO_STREAM_TO
+	       "  --stream-meta-to <dest>\n"
+	       "                     write a fixed size binary record of 64 bytes for each\n"
+	       "                     metadata capture buffer with its sequence number, timestamp\n"
+	       "                     and the decoded UVC timestamps and SOF counter (or the start\n"
+	       "                     of the buffer for other formats). <dest> is a file ('-' for\n"
+	       "                     stdout) or shm:<name>[:<records>] for a POSIX shared memory\n"
+	       "                     ring of <records> records (default 4096). See the\n"
+	       "                     meta_record struct in v4l2-ctl-meta.cpp for the layout.\n"
+#endif
 	       );
 }
 
@@ -59,6 +130,13 @@ void meta_cmd(int ch, char *optarg)
 		if (optarg)
 			mbus_code_out = strtoul(optarg, nullptr, 0);
 		break;
+#ifndef NO_STREAM_TO
+	case OptStreamMetaTo:
+		meta_to = optarg;
+		if (!strcmp(meta_to, "-"))
+			options[OptSilent] = true;
+		break;
+#endif
 	}
 }
 
@@ -185,6 +263,150 @@ void print_meta_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
 	}
 }
 
+#ifndef NO_STREAM_TO
+static bool meta_ring_open(const char *dest)
+{
+	std::string name(dest);
+	size_t colon = name.find(':');
+	size_t map_size;
+	void *p;
+
+	if (colon != std::string::npos) {
+		meta_ring_size = strtoul(name.c_str() + colon + 1, nullptr, 0);
+		name.resize(colon);
+	}
+	if (name.empty() || !meta_ring_size) {
+		fprintf(stderr, "invalid shared memory ring %s\n", dest);
+		return false;
+	}
+	if (name[0] != '/')
+		name = "/" + name;
+
+	meta_fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+	if (meta_fd < 0) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+		return false;
+	}
+	map_size = META_RING_HDR_SIZE + meta_ring_size * sizeof(struct meta_record);
+	if (ftruncate(meta_fd, map_size)) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+		return false;
+	}
+	p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, meta_fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+		return false;
+	}
+	meta_ring = static_cast<struct meta_ring_hdr *>(p);
+	meta_ring_records = reinterpret_cast<struct meta_record *>(static_cast<__u8 *>(p) +
+								   META_RING_HDR_SIZE);
+	memset(p, 0, META_RING_HDR_SIZE);
+	meta_ring->version = 1;
+	meta_ring->hdr_size = META_RING_HDR_SIZE;
+	meta_ring->record_size = sizeof(struct meta_record);
+	meta_ring->records = meta_ring_size;
+	/* Readers check the magic last */
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(meta_ring->magic, "V4L2MD", 7);
+	return true;
+}
+
+bool meta_export_active()
+{
+	return meta_fd >= 0;
+}
+
+int meta_export_start()
+{
+	bool ok;
+
+	if (!meta_to || meta_export_active())
+		return 0;
+	meta_write_failed = false;
+	if (!strncmp(meta_to, "shm:", 4)) {
+		ok = meta_ring_open(meta_to + 4);
+	} else {
+		if (!strcmp(meta_to, "-"))
+			meta_fd = dup(STDOUT_FILENO);
+		else
+			meta_fd = open(meta_to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		ok = meta_fd >= 0;
+		if (!ok)
+			fprintf(stderr, "%s: %s\n", meta_to, strerror(errno));
+	}
+	if (!ok) {
+		meta_export_stop();
+		return -1;
+	}
+	return 0;
+}
+
+void meta_export(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
+{
+	const __u8 *p = static_cast<__u8 *>(q.g_dataptr(buf.g_index(), 0));
+	unsigned used = buf.g_bytesused(0);
+	struct meta_record rec = {};
+	struct meta_record *r = &rec;
+	__u64 n = 0;
+
+	if (meta_ring) {
+		/* Fill in the record in place */
+		n = meta_ring->written.load(std::memory_order_relaxed);
+		r = &meta_ring_records[n % meta_ring_size];
+		memset(r, 0, sizeof(*r));
+	}
+	r->sequence = buf.g_sequence();
+	r->dataformat = fmt.g_pixelformat();
+	r->timestamp = buf.g_timestamp().tv_sec * 1000000000ULL +
+		       buf.g_timestamp().tv_usec * 1000ULL;
+	r->flags = buf.g_flags();
+	r->bytesused = used;
+
+	if (fmt.g_pixelformat() == V4L2_META_FMT_UVC &&
+	    used >= offsetof(struct uvc_meta_buf, buf)) {
+		const struct uvc_meta_buf *vbuf = reinterpret_cast<const struct uvc_meta_buf *>(p);
+		unsigned off = 0;
+
+		r->uvc.ns = vbuf->ns;
+		r->uvc.sof = vbuf->sof;
+		r->uvc.length = vbuf->length;
+		r->uvc.flags = vbuf->flags;
+		if (vbuf->flags & UVC_STREAM_PTS) {
+			r->uvc.pts = le32toh(*(__u32 *)(vbuf->buf));
+			off = 4;
+		}
+		if (vbuf->flags & UVC_STREAM_SCR) {
+			r->uvc.stc = le32toh(*(__u32 *)(vbuf->buf + off));
+			r->uvc.sof_counter = le16toh(*(__u16 *)(vbuf->buf + off + 4));
+		}
+	} else {
+		memcpy(r->data, p, std::min<unsigned>(used, sizeof(r->data)));
+	}
+
+	if (meta_ring)
+		meta_ring->written.store(n + 1, std::memory_order_release);
+	else if (!meta_write_failed &&
+		 !write_raw(meta_fd, reinterpret_cast<const __u8 *>(r), sizeof(*r)))
+		meta_write_failed = true;
+}
+
+void meta_export_stop()
+{
+	if (meta_ring)
+		munmap(meta_ring, META_RING_HDR_SIZE + meta_ring_size * sizeof(struct meta_record));
+	if (meta_fd >= 0)
+		close(meta_fd);
+	meta_ring = nullptr;
+	meta_ring_records = nullptr;
+	meta_fd = -1;
+}
+#else
+bool meta_export_active()
+{
+	return false;
+}
+#endif
+
 void meta_fillbuffer(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
 {
 	struct vivid_meta_out_buf *vbuf;
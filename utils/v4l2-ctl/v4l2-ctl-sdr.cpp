@@ -1,7 +1,414 @@
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
 #include "v4l2-ctl.h"
 
 static struct v4l2_format vfmt;	/* set_format/get_format */
 
+#ifndef NO_STREAM_TO
+/*
+ * The header of the --stream-sdr-to shm: ring. The ring of 'size' bytes
+ * follows the header at offset 'hdr_size'. write_pos counts all bytes
+ * written so far and is only updated after the samples are in the ring,
+ * so a reader finds the most recent samples just before write_pos
+ * (modulo size). dropped_samples counts the samples the driver lost.
+ */
+struct sdr_shm_hdr {
+	char magic[8];			/* "V4L2SDR" */
+	__u32 version;			/* 1 */
+	__u32 hdr_size;
+	__u32 pixelformat;		/* V4L2_SDR_FMT_* or 'CF32' */
+	__u32 reserved;
+	__u64 size;
+	std::atomic<__u64> write_pos;
+	std::atomic<__u64> dropped_samples;
+};
+
+#define SDR_SHM_HDR_SIZE	64
+#define SDR_FMT_CF32		v4l2_fourcc('C', 'F', '3', '2')
+
+enum sdr_sink {
+	SDR_SINK_NONE,
+	SDR_SINK_FILE,
+	SDR_SINK_UDP,
+	SDR_SINK_SHM,
+};
+
+static const char *sdr_to;
+static bool sdr_cf32;
+static enum sdr_sink sdr_sink;
+static int sdr_fd = -1;
+static unsigned sdr_udp_size = 1472;
+static __u64 sdr_shm_size = 64 << 20;
+static struct sdr_shm_hdr *sdr_shm;
+static __u8 *sdr_shm_ring;
+static __u32 sdr_pixelformat;
+static unsigned sdr_sample_size;
+static float sdr_lut[256];
+static std::vector<float> sdr_conv;
+static std::vector<__u8> sdr_pkt;
+static unsigned sdr_pkt_used;
+static __u64 sdr_samples;
+static __u64 sdr_dropped;
+static __u32 sdr_last_seq;
+static bool sdr_have_seq;
+static bool sdr_write_failed;
+
+/* Bytes per (complex) sample, 0 if the format is not supported */
+static unsigned sdr_fmt_sample_size(__u32 pixelformat)
+{
+	switch (pixelformat) {
+	case V4L2_SDR_FMT_CU8:
+	case V4L2_SDR_FMT_CS8:
+	case V4L2_SDR_FMT_RU12LE:
+		return 2;
+	case V4L2_SDR_FMT_CU16LE:
+	case V4L2_SDR_FMT_CS14LE:
+		return 4;
+	case V4L2_SDR_FMT_PCU16BE:
+		/* one 32 bit word for I and one for Q */
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Convert 'size' bytes of samples to interleaved float I/Q in [-1, 1).
+ * Returns the number of complex samples. The loops are kept simple so
+ * the compiler can vectorize them, the 8 bit formats use a lookup table.
+ */
+static unsigned sdr_to_cf32(const __u8 *p, unsigned size, float *out)
+{
+	unsigned samples = size / sdr_sample_size;
+	unsigned i;
+
+	switch (sdr_pixelformat) {
+	case V4L2_SDR_FMT_CU8:
+	case V4L2_SDR_FMT_CS8:
+		for (i = 0; i < 2 * samples; i++)
+			out[i] = sdr_lut[p[i]];
+		break;
+	case V4L2_SDR_FMT_CU16LE:
+		for (i = 0; i < 2 * samples; i++)
+			out[i] = ((p[2 * i] | (p[2 * i + 1] << 8)) - 32768) / 32768.0f;
+		break;
+	case V4L2_SDR_FMT_CS14LE:
+		for (i = 0; i < 2 * samples; i++)
+			out[i] = static_cast<__s16>((p[2 * i] | (p[2 * i + 1] << 8)) << 2) / 32768.0f;
+		break;
+	case V4L2_SDR_FMT_RU12LE:
+		for (i = 0; i < samples; i++) {
+			out[2 * i] = (((p[2 * i] | (p[2 * i + 1] << 8)) & 0xfff) - 2048) / 2048.0f;
+			out[2 * i + 1] = 0;
+		}
+		break;
+	case V4L2_SDR_FMT_PCU16BE: {
+		/* The first half of the buffer holds I, the second half Q */
+		const __u8 *q = p + samples * 4;
+
+		for (i = 0; i < samples; i++) {
+			out[2 * i] = (((p[4 * i] << 8) | p[4 * i + 1]) - 32768) / 32768.0f;
+			out[2 * i + 1] = (((q[4 * i] << 8) | q[4 * i + 1]) - 32768) / 32768.0f;
+		}
+		break;
+	}
+	}
+	return samples;
+}
+
+static bool sdr_udp_open(const char *dest)
+{
+	std::string host(dest);
+	std::string port;
+	struct addrinfo hints = {};
+	struct addrinfo *res, *ai;
+	size_t colon;
+	int err;
+
+	/* udp:<host>:<port>[:<size>], <host> may be a [bracketed] IPv6 address */
+	colon = host[0] == '[' ? host.find("]:") : host.find(':');
+	if (colon == std::string::npos)
+		return false;
+	if (host[0] == '[') {
+		port = host.substr(colon + 2);
+		host = host.substr(1, colon - 1);
+	} else {
+		port = host.substr(colon + 1);
+		host = host.substr(0, colon);
+	}
+	colon = port.find(':');
+	if (colon != std::string::npos) {
+		sdr_udp_size = strtoul(port.c_str() + colon + 1, nullptr, 0);
+		port.resize(colon);
+	}
+	if (sdr_udp_size < (sdr_cf32 ? 2 * sizeof(float) : sdr_sample_size) ||
+	    sdr_udp_size > 65507) {
+		fprintf(stderr, "invalid datagram size %u\n", sdr_udp_size);
+		return false;
+	}
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", host.c_str(), gai_strerror(err));
+		return false;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		sdr_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (sdr_fd < 0)
+			continue;
+		if (!connect(sdr_fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(sdr_fd);
+		sdr_fd = -1;
+	}
+	freeaddrinfo(res);
+	if (sdr_fd < 0) {
+		fprintf(stderr, "could not connect to %s\n", dest);
+		return false;
+	}
+	sdr_pkt.resize(sdr_udp_size);
+	return true;
+}
+
+static bool sdr_shm_open(const char *dest)
+{
+	std::string name(dest);
+	size_t colon = name.find(':');
+	size_t map_size;
+	void *p;
+
+	if (colon != std::string::npos) {
+		sdr_shm_size = strtoull(name.c_str() + colon + 1, nullptr, 0);
+		name.resize(colon);
+	}
+	if (name.empty() || !sdr_shm_size) {
+		fprintf(stderr, "invalid shared memory ring %s\n", dest);
+		return false;
+	}
+	if (name[0] != '/')
+		name = "/" + name;
+
+	sdr_fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+	if (sdr_fd < 0) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+		return false;
+	}
+	map_size = SDR_SHM_HDR_SIZE + sdr_shm_size;
+	if (ftruncate(sdr_fd, map_size)) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+		return false;
+	}
+	p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, sdr_fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", name.c_str(), strerror(errno));
+		return false;
+	}
+	sdr_shm = static_cast<struct sdr_shm_hdr *>(p);
+	sdr_shm_ring = static_cast<__u8 *>(p) + SDR_SHM_HDR_SIZE;
+	memset(p, 0, SDR_SHM_HDR_SIZE);
+	sdr_shm->version = 1;
+	sdr_shm->hdr_size = SDR_SHM_HDR_SIZE;
+	sdr_shm->pixelformat = sdr_cf32 ? SDR_FMT_CF32 : sdr_pixelformat;
+	sdr_shm->size = sdr_shm_size;
+	/* Readers check the magic last */
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(sdr_shm->magic, "V4L2SDR", 8);
+	return true;
+}
+
+bool sdr_stream_active()
+{
+	return sdr_sink != SDR_SINK_NONE;
+}
+
+int sdr_stream_start(cv4l_fd &fd)
+{
+	cv4l_fmt fmt(V4L2_BUF_TYPE_SDR_CAPTURE);
+	bool ok;
+
+	if (!sdr_to || sdr_stream_active())
+		return 0;
+
+	fd.g_fmt(fmt, V4L2_BUF_TYPE_SDR_CAPTURE);
+	sdr_pixelformat = fmt.fmt.sdr.pixelformat;
+	sdr_sample_size = sdr_fmt_sample_size(sdr_pixelformat);
+	if (sdr_cf32 && !sdr_sample_size) {
+		fprintf(stderr, "--stream-sdr-cf32: unsupported SDR format %s\n",
+			fcc2s(sdr_pixelformat).c_str());
+		return -1;
+	}
+	if (!sdr_sample_size)
+		sdr_sample_size = 1;
+	for (unsigned i = 0; i < 256; i++) {
+		if (sdr_pixelformat == V4L2_SDR_FMT_CS8)
+			sdr_lut[i] = static_cast<__s8>(i) / 128.0f;
+		else
+			sdr_lut[i] = (static_cast<int>(i) - 128) / 128.0f;
+	}
+
+	if (!strncmp(sdr_to, "udp:", 4)) {
+		ok = sdr_udp_open(sdr_to + 4);
+		sdr_sink = SDR_SINK_UDP;
+	} else if (!strncmp(sdr_to, "shm:", 4)) {
+		ok = sdr_shm_open(sdr_to + 4);
+		sdr_sink = SDR_SINK_SHM;
+	} else {
+		if (!strcmp(sdr_to, "-"))
+			sdr_fd = dup(STDOUT_FILENO);
+		else
+			sdr_fd = open(sdr_to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		ok = sdr_fd >= 0;
+		if (!ok)
+			fprintf(stderr, "%s: %s\n", sdr_to, strerror(errno));
+		sdr_sink = SDR_SINK_FILE;
+	}
+	if (!ok) {
+		sdr_stream_stop();
+		return -1;
+	}
+	sdr_samples = sdr_dropped = 0;
+	sdr_have_seq = false;
+	sdr_write_failed = false;
+	sdr_pkt_used = 0;
+	return 0;
+}
+
+/* Send full datagrams, each holds a whole number of samples */
+static void sdr_udp_write(const __u8 *p, unsigned size, unsigned unit)
+{
+	unsigned max = sdr_udp_size - sdr_udp_size % unit;
+
+	while (size) {
+		unsigned n = std::min(size, max - sdr_pkt_used);
+
+		if (!sdr_pkt_used && n == max) {
+			/* Send directly from the buffer */
+			if (send(sdr_fd, p, n, 0) < 0 && !sdr_write_failed) {
+				fprintf(stderr, "udp: %s\n", strerror(errno));
+				sdr_write_failed = true;
+			}
+		} else {
+			memcpy(&sdr_pkt[sdr_pkt_used], p, n);
+			sdr_pkt_used += n;
+			if (sdr_pkt_used == max) {
+				if (send(sdr_fd, sdr_pkt.data(), max, 0) < 0 && !sdr_write_failed) {
+					fprintf(stderr, "udp: %s\n", strerror(errno));
+					sdr_write_failed = true;
+				}
+				sdr_pkt_used = 0;
+			}
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+static void sdr_shm_write(const __u8 *p, unsigned size)
+{
+	__u64 pos = sdr_shm->write_pos.load(std::memory_order_relaxed);
+
+	if (size > sdr_shm_size) {
+		p += size - sdr_shm_size;
+		pos += size - sdr_shm_size;
+		size = sdr_shm_size;
+	}
+	while (size) {
+		__u64 offset = pos % sdr_shm_size;
+		unsigned n = std::min<__u64>(size, sdr_shm_size - offset);
+
+		memcpy(sdr_shm_ring + offset, p, n);
+		p += n;
+		pos += n;
+		size -= n;
+	}
+	sdr_shm->write_pos.store(pos, std::memory_order_release);
+}
+
+void sdr_stream_write(cv4l_queue &q, cv4l_buffer &buf)
+{
+	const __u8 *p = static_cast<__u8 *>(q.g_dataptr(buf.g_index(), 0));
+	unsigned offset = buf.g_data_offset(0);
+	unsigned size = buf.g_bytesused(0);
+	unsigned unit = sdr_sample_size;
+	unsigned samples;
+
+	if (offset > size)
+		offset = 0;
+	p += offset;
+	size -= offset;
+	samples = size / sdr_sample_size;
+
+	/* A gap in the sequence numbers means whole buffers were lost */
+	if (sdr_have_seq && buf.g_sequence() != sdr_last_seq + 1) {
+		sdr_dropped += static_cast<__u64>(buf.g_sequence() - sdr_last_seq - 1) * samples;
+		if (sdr_shm)
+			sdr_shm->dropped_samples.store(sdr_dropped, std::memory_order_relaxed);
+	}
+	sdr_last_seq = buf.g_sequence();
+	sdr_have_seq = true;
+	sdr_samples += samples;
+
+	if (sdr_cf32) {
+		if (sdr_conv.size() < 2 * samples)
+			sdr_conv.resize(2 * samples);
+		sdr_to_cf32(p, size, sdr_conv.data());
+		p = reinterpret_cast<const __u8 *>(sdr_conv.data());
+		size = samples * 2 * sizeof(float);
+		unit = 2 * sizeof(float);
+	}
+
+	switch (sdr_sink) {
+	case SDR_SINK_FILE:
+		if (!sdr_write_failed && !write_raw(sdr_fd, p, size))
+			sdr_write_failed = true;
+		break;
+	case SDR_SINK_UDP:
+		sdr_udp_write(p, size, unit);
+		break;
+	case SDR_SINK_SHM:
+		sdr_shm_write(p, size);
+		break;
+	case SDR_SINK_NONE:
+		break;
+	}
+}
+
+void sdr_stream_stop()
+{
+	if (!sdr_stream_active())
+		return;
+	if (sdr_sink == SDR_SINK_UDP && sdr_pkt_used && sdr_fd >= 0)
+		send(sdr_fd, sdr_pkt.data(), sdr_pkt_used, 0);
+	if (sdr_shm)
+		munmap(sdr_shm, SDR_SHM_HDR_SIZE + sdr_shm_size);
+	if (sdr_fd >= 0)
+		close(sdr_fd);
+	if (sdr_samples || sdr_dropped)
+		stderr_info("%llu SDR samples, %llu dropped\n",
+			    static_cast<unsigned long long>(sdr_samples),
+			    static_cast<unsigned long long>(sdr_dropped));
+	sdr_shm = nullptr;
+	sdr_shm_ring = nullptr;
+	sdr_fd = -1;
+	sdr_pkt_used = 0;
+	sdr_sink = SDR_SINK_NONE;
+}
+#else
+bool sdr_stream_active()
+{
+	return false;
+}
+#endif
+
 void sdr_usage()
 {
 	printf("\nSDR Formats options:\n"
@@ -24,6 +431,19 @@ void sdr_usage()
 	       "                     try the SDR output format [VIDIOC_TRY_FMT]\n"
 	       "                     parameter is either the format index as reported by\n"
 	       "                     --list-formats-sdr-out, or the fourcc value as a string\n"
+#ifndef NO_STREAM_TO
+	       "  --stream-sdr-to <dest>\n"
+	       "                     stream the SDR capture samples to <dest>, which is either\n"
+	       "                     a file ('-' for stdout), udp:<host>:<port>[:<size>] to send\n"
+	       "                     datagrams of at most <size> bytes (default 1472), or\n"
+	       "                     shm:<name>[:<size>] to write a POSIX shared memory ring of\n"
+	       "                     <size> bytes (default 64 MiB). Use with --stream-mmap.\n"
+	       "                     Samples lost by the driver are counted from the buffer\n"
+	       "                     sequence numbers and reported at the end.\n"
+	       "  --stream-sdr-cf32  convert the CU8, CS8, CU16LE, CS14LE, RU12LE and PC16\n"
+	       "                     samples to interleaved 32 bit float I/Q in [-1, 1) before\n"
+	       "                     streaming them with --stream-sdr-to.\n"
+#endif
 	       );
 }
 
@@ -44,6 +464,16 @@ void sdr_cmd(int ch, char *optarg)
 			vfmt.fmt.sdr.pixelformat = strtol(optarg, nullptr, 0);
 		}
 		break;
+#ifndef NO_STREAM_TO
+	case OptStreamSdrTo:
+		sdr_to = optarg;
+		if (!strcmp(sdr_to, "-"))
+			options[OptSilent] = true;
+		break;
+	case OptStreamSdrCf32:
+		sdr_cf32 = true;
+		break;
+#endif
 	}
 }
 
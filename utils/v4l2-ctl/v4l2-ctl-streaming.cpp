@@ -1,11 +1,34 @@
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
 #include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 
 #include <linux/media.h>
+#include <linux/mempolicy.h>
 
 #include "compiler.h"
+#include "crc32c.h"
 #include "v4l2-ctl.h"
 #include "v4l-stream.h"
 #include <media-info.h>
@@ -24,6 +47,7 @@ static unsigned stream_sleep_mode = 1;
 static bool stream_no_query;
 static unsigned stream_pat;
 static bool stream_loop;
+static bool stream_from_mlock;
 static bool stream_out_square;
 static bool stream_out_border;
 static bool stream_out_sav;
@@ -36,19 +60,37 @@ static bool stream_out_rgb_lim_range;
 static unsigned stream_out_perc_fill = 100;
 static v4l2_std_id stream_out_std;
 static bool stream_out_refresh;
+static bool stream_out_field_cache;
+static std::vector<u8> stream_out_fields[2][VIDEO_MAX_PLANES];
+static std::vector<__u32> stream_out_buf_field;
 static tpg_move_mode stream_out_hor_mode = TPG_MOVE_NONE;
 static tpg_move_mode stream_out_vert_mode = TPG_MOVE_NONE;
 static unsigned reqbufs_count_cap = 4;
 static unsigned reqbufs_count_out = 4;
 static char *file_to;
 static bool to_with_hdr;
+static unsigned stream_to_bufs;
+static bool stream_to_direct;
 static char *host_to;
+static unsigned stream_to_host_bufs;
+static char *shm_to;
+
+/* --stream-crc state */
+static unsigned crc_first_line;
+static unsigned crc_lines;
+static std::unordered_set<std::string> crc_expected;
+static unsigned crc_frames;
+static unsigned crc_mismatches;
+static unsigned shm_to_slots = 4;
+static bool host_serve;
+static unsigned host_port_serve;
 #ifndef NO_STREAM_TO
 static unsigned host_port_to = V4L_STREAM_PORT;
 static unsigned bpl_cap[VIDEO_MAX_PLANES];
 #endif
 static bool host_lossless;
 static int host_fd_to = -1;
+static int host_fd_serve = -1;
 static unsigned comp_perc;
 static unsigned comp_perc_count;
 static char *file_from;
@@ -77,10 +119,63 @@ static fwht_cframe_hdr last_fwht_hdr;
 struct request_fwht {
 	int fd;
 	__u64 ts;
+	/* Queued, but not yet completed */
+	bool pending;
 	struct v4l2_ctrl_fwht_params params;
 };
 
 static request_fwht fwht_reqs[VIDEO_MAX_FRAME];
+/* The fwht_reqs index by request fd and by OUTPUT buffer timestamp */
+static std::unordered_map<int, unsigned> fwht_req_by_fd;
+static std::unordered_map<__u64, unsigned> fwht_req_by_ts;
+static int fwht_media_fd = -1;
+static unsigned stream_req_depth;
+static std::vector<std::string> stream_devices;
+static const char *stream_chain_dev;
+static int stream_numa_node = -1;
+
+/* --stream-realtime state */
+static struct {
+	int prio = 50;
+	int cpu = -1;
+	unsigned budget = 20;		/* percentage of a frame interval */
+	__u64 interval_ns;		/* average time between frames */
+	__u64 last_ns;			/* time of the last dequeue */
+	__u64 start_ns;
+	__u64 spin_ns;			/* time spent busy-polling */
+	unsigned blocked;		/* times the budget ran out */
+	std::vector<__u64> latencies;
+} stream_rt;
+
+/* --stream-grow-bufs state */
+static struct {
+	unsigned max;			/* upper limit for the number of buffers */
+	bool active;
+	unsigned min;			/* the --stream-mmap/user count */
+	bool has_seq;
+	__u32 last_seq;
+	unsigned frames;		/* frames since the last change */
+	unsigned min_queued;		/* fewest buffers the driver had in that time */
+	bool shrink;			/* remove the last buffer once it is dequeued */
+	unsigned grown, shrunk;
+	unsigned peak, buffers;
+} stream_grow;
+
+/* Frames without a shortage of buffers before one is removed again */
+#define GROW_WINDOW 300
+
+/* --stream-m2m-bench matrix, an empty list means the current setting */
+static struct {
+	std::vector<std::pair<__u32, __u32>> sizes;
+	std::vector<__u32> pixelformats;
+	std::vector<unsigned> bufs;
+	std::vector<__u32> memories;
+	unsigned repeat = 1;
+	bool csv;
+} m2m_matrix;
+
+/* Frames encoded per run if there is no --stream-count */
+#define M2M_BENCH_FRAMES 300
 
 #define TS_WINDOW 241
 #define FILE_HDR_ID			v4l2_fourcc('V', 'h', 'd', 'r')
@@ -109,6 +204,8 @@ private:
 	bool alternate_fields;
 	unsigned field_cnt;
 	unsigned last_field;
+	unsigned wakeups;
+	unsigned frames;
 
 public:
 	fps_timestamps()
@@ -124,6 +221,7 @@ public:
 		last_field = 0;
 		field_cnt = 0;
 		alternate_fields = false;
+		wakeups = frames = 0;
 	}
 
 	void determine_field(int fd, unsigned type);
@@ -131,6 +229,9 @@ public:
 	bool has_fps(bool continuous);
 	double fps();
 	unsigned dropped();
+	void add_wakeup() { wakeups++; }
+	bool has_wakeups() const { return wakeups && frames; }
+	double wakeups_per_frame() const { return static_cast<double>(wakeups) / frames; }
 };
 
 static bool need_sleep(unsigned count)
@@ -189,6 +290,7 @@ void fps_timestamps::determine_field(int fd, unsigned type)
 
 bool fps_timestamps::add_ts(double ts_secs, unsigned sequence, unsigned field)
 {
+	frames++;
 	if (ts_secs <= 0) {
 		struct timespec ts_cur;
 
@@ -292,6 +394,555 @@ double fps_timestamps::fps()
 	return fps;
 };
 
+/*
+ * Collects the statistics for --stream-bench. All times are in microseconds
+ * on the monotonic clock.
+ */
+class stream_bench {
+private:
+	bool started;
+	bool have_prev;
+	bool alternate_fields;
+	double nominal;
+	double prev_ts;
+	unsigned prev_seq;
+	unsigned frames;
+	unsigned dropped_seqs;
+	double start_time;
+	double cpu_start;
+	double duration;
+	double cpu_time;
+	double dq_time[VIDEO_MAX_FRAME];
+	std::vector<double> turnaround;
+	std::vector<double> latency;
+	std::vector<double> intervals;
+
+public:
+	stream_bench() : started(false) {}
+
+	static double now();
+	static double cpu_now();
+
+	void start(cv4l_fd &fd, const cv4l_fmt &fmt);
+	void dequeued(const cv4l_buffer &buf);
+	void queued(unsigned index);
+	void stop();
+	void report(FILE *f);
+};
+
+static stream_bench bench;
+
+double stream_bench::now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+double stream_bench::cpu_now()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*
+ * Called after each STREAMON: the sequence numbers and timestamps start over,
+ * and all buffers are queued.
+ */
+void stream_bench::start(cv4l_fd &fd, const cv4l_fmt &fmt)
+{
+	v4l2_fract interval;
+
+	have_prev = false;
+	for (auto &t : dq_time)
+		t = 0;
+	if (started)
+		return;
+
+	started = true;
+	frames = dropped_seqs = 0;
+	alternate_fields = fmt.g_field() == V4L2_FIELD_ALTERNATE;
+	nominal = 0;
+	if (!fd.get_interval(interval) && interval.numerator && interval.denominator)
+		nominal = 1000000.0 * interval.numerator / interval.denominator /
+			  (alternate_fields ? 2 : 1);
+	start_time = now();
+	cpu_start = cpu_now();
+}
+
+void stream_bench::dequeued(const cv4l_buffer &buf)
+{
+	double t = now();
+	double ts = buf.g_timestamp().tv_sec * 1000000.0 + buf.g_timestamp().tv_usec;
+	unsigned seq = buf.g_sequence();
+
+	if (!started)
+		return;
+	if (buf.g_index() < VIDEO_MAX_FRAME)
+		dq_time[buf.g_index()] = t;
+	if (buf.g_flags() & V4L2_BUF_FLAG_LAST)
+		return;
+	frames++;
+
+	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC && ts > 0 && ts <= t)
+		latency.push_back(t - ts);
+
+	/* Only intervals between buffers that follow each other count */
+	if (have_prev && seq > prev_seq + 1)
+		dropped_seqs += seq - prev_seq - 1;
+	else if (have_prev && (seq == prev_seq + 1 ||
+			       (alternate_fields && seq == prev_seq)) &&
+		 ts > prev_ts)
+		intervals.push_back(ts - prev_ts);
+	have_prev = true;
+	prev_seq = seq;
+	prev_ts = ts;
+}
+
+void stream_bench::queued(unsigned index)
+{
+	if (index >= VIDEO_MAX_FRAME || !dq_time[index])
+		return;
+	turnaround.push_back(now() - dq_time[index]);
+	dq_time[index] = 0;
+}
+
+void stream_bench::stop()
+{
+	if (!started)
+		return;
+	duration = now() - start_time;
+	cpu_time = cpu_now() - cpu_start;
+}
+
+struct bench_stats {
+	size_t count;
+	double min, mean, p50, p90, p99, p999, max;
+};
+
+static double percentile(const std::vector<double> &v, unsigned permille)
+{
+	size_t rank = (v.size() * permille + 999) / 1000;
+
+	return v[rank ? rank - 1 : 0];
+}
+
+/* Note that this sorts v */
+static bench_stats get_bench_stats(std::vector<double> &v)
+{
+	bench_stats s = {};
+	double sum = 0;
+
+	if (v.empty())
+		return s;
+	std::sort(v.begin(), v.end());
+	for (auto x : v)
+		sum += x;
+	s.count = v.size();
+	s.min = v.front();
+	s.mean = sum / v.size();
+	s.p50 = percentile(v, 500);
+	s.p90 = percentile(v, 900);
+	s.p99 = percentile(v, 990);
+	s.p999 = percentile(v, 999);
+	s.max = v.back();
+	return s;
+}
+
+static void print_bench_stats(const char *name, const bench_stats &s)
+{
+	if (!s.count) {
+		stderr_info("\t%-22s n/a\n", name);
+		return;
+	}
+	stderr_info("\t%-22s min %.1f mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f us\n",
+		    name, s.min, s.mean, s.p50, s.p90, s.p99, s.p999, s.max);
+}
+
+static void print_bench_json(FILE *f, const char *name, const bench_stats &s,
+			     const char *indent = "  ")
+{
+	if (!s.count) {
+		fprintf(f, "%s\"%s\": null", indent, name);
+		return;
+	}
+	fprintf(f, "%s\"%s\": { \"count\": %zu, \"min\": %.1f, \"mean\": %.1f, "
+		"\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+		"\"max\": %.1f }",
+		indent, name, s.count, s.min, s.mean, s.p50, s.p90, s.p99, s.p999, s.max);
+}
+
+static constexpr const char *memory_names[] = {
+	"", "mmap", "userptr", "overlay", "dmabuf"
+};
+
+/* Print a summary to stderr and a JSON summary to f */
+void stream_bench::report(FILE *f)
+{
+	double mean = 0;
+
+	if (!started || !frames)
+		return;
+
+	/* Without a nominal interval the jitter is against the average one */
+	for (auto x : intervals)
+		mean += x;
+	if (!intervals.empty())
+		mean /= intervals.size();
+	if (!nominal)
+		nominal = mean;
+	for (auto &x : intervals)
+		x = fabs(x - nominal);
+
+	bench_stats turnaround_stats = get_bench_stats(turnaround);
+	bench_stats latency_stats = get_bench_stats(latency);
+	bench_stats jitter_stats = get_bench_stats(intervals);
+
+	stderr_info("Benchmark of %u frames using %s buffers:\n", frames,
+		    memory_names[memory]);
+	print_bench_stats("DQBUF to QBUF:", turnaround_stats);
+	print_bench_stats("driver to user space:", latency_stats);
+	print_bench_stats("jitter:", jitter_stats);
+	stderr_info("\t%-22s %.1f us\n", "nominal interval:", nominal);
+	stderr_info("\t%-22s %u\n", "dropped sequences:", dropped_seqs);
+	stderr_info("\t%-22s %.1f us\n", "CPU time per frame:", cpu_time / frames);
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"memory\": \"%s\",\n", memory_names[memory]);
+	fprintf(f, "  \"frames\": %u,\n", frames);
+	fprintf(f, "  \"duration_us\": %.1f,\n", duration);
+	fprintf(f, "  \"fps\": %.3f,\n", mean ? 1000000.0 / mean : 0);
+	fprintf(f, "  \"nominal_interval_us\": %.1f,\n", nominal);
+	fprintf(f, "  \"dropped_sequences\": %u,\n", dropped_seqs);
+	fprintf(f, "  \"cpu_us_per_frame\": %.1f,\n", cpu_time / frames);
+	print_bench_json(f, "dqbuf_to_qbuf_us", turnaround_stats);
+	fprintf(f, ",\n");
+	print_bench_json(f, "driver_to_user_us", latency_stats);
+	fprintf(f, ",\n");
+	print_bench_json(f, "jitter_us", jitter_stats);
+	fprintf(f, "\n}\n");
+}
+
+struct m2m_bench_result {
+	__u32 width, height, pixelformat;
+	unsigned bufs;
+	__u32 memory;
+	unsigned run;
+	unsigned frames;
+	double duration;	/* first OUTPUT QBUF to last CAPTURE DQBUF */
+	double cpu_time;
+	double cpu_percent;
+	bench_stats latency;
+};
+
+/*
+ * Collects the statistics of one --stream-m2m-bench run. The codec copies
+ * the timestamp of each OUTPUT buffer to the CAPTURE buffer(s) it produces,
+ * so the latency of a frame is the time from the QBUF of the OUTPUT buffer
+ * with its timestamp to the DQBUF of the first CAPTURE buffer with it. With
+ * --stream-m2m-threads the queues are handled by two threads.
+ */
+class stream_m2m_bench {
+private:
+	std::mutex lock;
+	std::map<__u64, double> qbuf_time;
+	std::vector<double> latency;
+	unsigned frames;
+	double first_qbuf;
+	double last_dqbuf;
+	double start_time;
+	double cpu_start;
+
+public:
+	void start();
+	void queued(const cv4l_buffer &buf);
+	void dequeued(const cv4l_buffer &buf);
+	m2m_bench_result stop();
+};
+
+static stream_m2m_bench m2m_bench;
+
+void stream_m2m_bench::start()
+{
+	qbuf_time.clear();
+	latency.clear();
+	frames = 0;
+	first_qbuf = last_dqbuf = 0;
+	start_time = stream_bench::now();
+	cpu_start = stream_bench::cpu_now();
+}
+
+void stream_m2m_bench::queued(const cv4l_buffer &buf)
+{
+	double t = stream_bench::now();
+	std::lock_guard<std::mutex> lk(lock);
+
+	if (!first_qbuf)
+		first_qbuf = t;
+	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_COPY)
+		return;
+	/* Decoders may consume OUTPUT buffers without producing a frame */
+	if (qbuf_time.size() >= 2 * VIDEO_MAX_FRAME)
+		qbuf_time.erase(qbuf_time.begin());
+	qbuf_time[buf.g_timestamp_ns()] = t;
+}
+
+void stream_m2m_bench::dequeued(const cv4l_buffer &buf)
+{
+	double t = stream_bench::now();
+	std::lock_guard<std::mutex> lk(lock);
+
+	if (!buf.g_bytesused(0) || (buf.g_flags() & V4L2_BUF_FLAG_ERROR))
+		return;
+	frames++;
+	last_dqbuf = t;
+
+	auto it = qbuf_time.find(buf.g_timestamp_ns());
+
+	if (it == qbuf_time.end())
+		return;
+	latency.push_back(t - it->second);
+	qbuf_time.erase(it);
+}
+
+m2m_bench_result stream_m2m_bench::stop()
+{
+	m2m_bench_result r = {};
+	double wall = stream_bench::now() - start_time;
+
+	r.frames = frames;
+	r.cpu_time = stream_bench::cpu_now() - cpu_start;
+	r.cpu_percent = wall > 0 ? 100.0 * r.cpu_time / wall : 0;
+	if (frames && last_dqbuf > first_qbuf)
+		r.duration = last_dqbuf - first_qbuf;
+	r.latency = get_bench_stats(latency);
+	return r;
+}
+
+static void m2m_bench_report(FILE *f, const std::vector<m2m_bench_result> &results)
+{
+	const char *codec = codec_type == ENCODER ? "encoder" : "decoder";
+	bool first = true;
+
+	if (m2m_matrix.csv)
+		fprintf(f, "codec,width,height,pixelformat,buffers,memory,run,frames,"
+			"duration_us,fps,latency_min_us,latency_mean_us,latency_p50_us,"
+			"latency_p90_us,latency_p99_us,latency_max_us,"
+			"cpu_us_per_frame,cpu_percent\n");
+	else
+		fprintf(f, "[");
+
+	for (const auto &r : results) {
+		double fps = r.duration ? r.frames * 1000000.0 / r.duration : 0;
+		double cpu = r.frames ? r.cpu_time / r.frames : 0;
+		std::string fcc = fcc2s(r.pixelformat);
+
+		if (m2m_matrix.csv) {
+			fprintf(f, "%s,%u,%u,%s,%u,%s,%u,%u,%.1f,%.3f,",
+				codec, r.width, r.height, fcc.c_str(), r.bufs,
+				memory_names[r.memory], r.run, r.frames,
+				r.duration, fps);
+			if (r.latency.count)
+				fprintf(f, "%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,",
+					r.latency.min, r.latency.mean, r.latency.p50,
+					r.latency.p90, r.latency.p99, r.latency.max);
+			else
+				fprintf(f, ",,,,,,");
+			fprintf(f, "%.1f,%.1f\n", cpu, r.cpu_percent);
+			continue;
+		}
+
+		fprintf(f, "%s\n  {\n", first ? "" : ",");
+		first = false;
+		fprintf(f, "    \"codec\": \"%s\",\n", codec);
+		fprintf(f, "    \"width\": %u,\n", r.width);
+		fprintf(f, "    \"height\": %u,\n", r.height);
+		fprintf(f, "    \"pixelformat\": \"%s\",\n", fcc.c_str());
+		fprintf(f, "    \"buffers\": %u,\n", r.bufs);
+		fprintf(f, "    \"memory\": \"%s\",\n", memory_names[r.memory]);
+		fprintf(f, "    \"run\": %u,\n", r.run);
+		fprintf(f, "    \"frames\": %u,\n", r.frames);
+		fprintf(f, "    \"duration_us\": %.1f,\n", r.duration);
+		fprintf(f, "    \"fps\": %.3f,\n", fps);
+		print_bench_json(f, "latency_us", r.latency, "    ");
+		fprintf(f, ",\n");
+		fprintf(f, "    \"cpu_us_per_frame\": %.1f,\n", cpu);
+		fprintf(f, "    \"cpu_percent\": %.1f\n  }", r.cpu_percent);
+	}
+	if (!m2m_matrix.csv)
+		fprintf(f, "\n]\n");
+}
+
+/*
+ * --stream-trace: follows each frame through the stages it passes, see the
+ * frame tracing in v4l-stream.h. A frame gets a trace context when it is
+ * captured, received from --stream-from-host or queued to an OUTPUT queue.
+ * While a frame is on an OUTPUT queue its context is kept by timestamp for
+ * m2m devices, which copy it to the CAPTURE buffer(s) they produce, and by
+ * buffer index for output devices. The context is appended to the trace file
+ * once the frame leaves this process, and sent along with the frame to
+ * --stream-to-host.
+ */
+class stream_tracer {
+private:
+	struct queued_trace {
+		v4l_stream_trace trace;
+		__u64 qbuf_ns;
+		bool valid;
+	};
+
+	std::mutex lock;
+	int trace_fd = -1;
+	std::map<__u64, queued_trace> by_ts;
+	queued_trace by_index[VIDEO_MAX_FRAME];
+	__u32 out_sequence;
+	bool have_cur;
+	bool have_in;
+
+public:
+	/* The frame last dequeued from a CAPTURE queue */
+	v4l_stream_trace cur;
+	/* The frame last received from --stream-from-host */
+	v4l_stream_trace in;
+
+	bool start(const char *filename, cv4l_fd &fd);
+	void stop();
+	bool active() const { return trace_fd >= 0; }
+	bool has_cur() const { return have_cur; }
+	void received(const v4l_stream_trace &trace) { in = trace; have_in = true; }
+	void dequeued(cv4l_fd &fd, const cv4l_buffer &buf);
+	void queued(cv4l_fd &fd, const cv4l_buffer &buf, bool from_cap);
+	void out_dequeued(cv4l_fd &fd, const cv4l_buffer &buf);
+	void flush();
+};
+
+static stream_tracer tracer;
+static const char *stream_trace_file;
+
+bool stream_tracer::start(const char *filename, cv4l_fd &fd)
+{
+	trace_fd = v4l_stream_trace_open(filename, "v4l2-ctl");
+	if (trace_fd < 0)
+		return false;
+	by_ts.clear();
+	memset(by_index, 0, sizeof(by_index));
+	out_sequence = 0;
+	have_cur = have_in = false;
+#ifndef NO_LIBV4L2
+	/* Splits the CAPTURE stage at the point where libv4l2 got the frame */
+	if (!fd.g_direct())
+		v4l2_enable_latency_stats(fd.g_fd(), 1);
+#endif
+	return true;
+}
+
+void stream_tracer::stop()
+{
+	if (trace_fd < 0)
+		return;
+	flush();
+	close(trace_fd);
+	trace_fd = -1;
+}
+
+void stream_tracer::flush()
+{
+	if (have_cur && cur.num_stages)
+		v4l_stream_trace_write(trace_fd, &cur);
+	have_cur = false;
+}
+
+void stream_tracer::dequeued(cv4l_fd &fd, const cv4l_buffer &buf)
+{
+	__u64 now = v4l_stream_trace_now();
+
+	flush();
+	have_cur = true;
+	if (fd.has_vid_m2m()) {
+		std::lock_guard<std::mutex> lk(lock);
+		auto it = by_ts.find(buf.g_timestamp_ns());
+
+		if (it != by_ts.end()) {
+			cur = it->second.trace;
+			v4l_stream_trace_add(&cur, V4L_STREAM_TRACE_M2M,
+					     it->second.qbuf_ns, now);
+			by_ts.erase(it);
+			return;
+		}
+	}
+
+	v4l_stream_trace_init(&cur, buf.g_sequence());
+#ifndef NO_LIBV4L2
+	v4l2_frame_times times;
+
+	if (!fd.g_direct() && !v4l2_get_frame_times(fd.g_fd(), &times) &&
+	    times.sequence == buf.g_sequence()) {
+		if (times.captured_ns)
+			v4l_stream_trace_add(&cur, V4L_STREAM_TRACE_CAPTURE,
+					     v4l_stream_trace_from_monotonic(times.captured_ns),
+					     v4l_stream_trace_from_monotonic(times.dequeued_ns));
+		v4l_stream_trace_add(&cur, V4L_STREAM_TRACE_CONVERT,
+				     v4l_stream_trace_from_monotonic(times.dequeued_ns),
+				     v4l_stream_trace_from_monotonic(times.returned_ns));
+		return;
+	}
+#endif
+	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		v4l_stream_trace_add(&cur, V4L_STREAM_TRACE_CAPTURE,
+				     v4l_stream_trace_from_monotonic(buf.g_timestamp_ns()),
+				     now);
+}
+
+void stream_tracer::queued(cv4l_fd &fd, const cv4l_buffer &buf, bool from_cap)
+{
+	queued_trace q;
+
+	q.qbuf_ns = v4l_stream_trace_now();
+	q.valid = true;
+	if (from_cap && have_cur) {
+		q.trace = cur;
+		have_cur = false;
+	} else if (have_in) {
+		q.trace = in;
+		have_in = false;
+	} else {
+		v4l_stream_trace_init(&q.trace, out_sequence++);
+	}
+
+	std::lock_guard<std::mutex> lk(lock);
+
+	if (fd.has_vid_m2m()) {
+		/* Decoders may consume OUTPUT buffers without producing a frame */
+		if (by_ts.size() >= 2 * VIDEO_MAX_FRAME)
+			by_ts.erase(by_ts.begin());
+		by_ts[buf.g_timestamp_ns()] = q;
+	} else if (buf.g_index() < VIDEO_MAX_FRAME) {
+		by_index[buf.g_index()] = q;
+	}
+}
+
+void stream_tracer::out_dequeued(cv4l_fd &fd, const cv4l_buffer &buf)
+{
+	__u64 now = v4l_stream_trace_now();
+
+	if (fd.has_vid_m2m() || buf.g_index() >= VIDEO_MAX_FRAME)
+		return;
+
+	std::lock_guard<std::mutex> lk(lock);
+	queued_trace &q = by_index[buf.g_index()];
+
+	if (!q.valid)
+		return;
+	q.valid = false;
+	v4l_stream_trace_add(&q.trace, V4L_STREAM_TRACE_OUTPUT, q.qbuf_ns, now);
+	v4l_stream_trace_write(trace_fd, &q.trace);
+}
+
 void streaming_usage()
 {
 	printf("\nVideo Streaming options:\n"
@@ -319,11 +970,122 @@ void streaming_usage()
 	       "                     and the --silent option is turned on automatically.\n"
 	       "  --stream-to-hdr <file> stream to this file. Same as --stream-to, but each\n"
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
+	       "  --stream-to-bufs <count>\n"
+	       "                     write the --stream-to(-hdr) file from a separate thread,\n"
+	       "                     which buffers up to <count> frames. This keeps the capture\n"
+	       "                     going when writing to the file stalls for a while.\n"
+	       "  --stream-to-direct write the --stream-to file with O_DIRECT, bypassing the page\n"
+	       "                     cache. This falls back to normal writes if the frame size\n"
+	       "                     is not a multiple of the file system block size.\n"
 	       "  --stream-to-host <hostname[:port]>\n"
                "                     stream to this host. The default port is %d.\n"
+	       "  --stream-to-host-bufs <count>\n"
+	       "                     send the frames to the --stream-to-host host from a separate\n"
+	       "                     thread, which queues up to <count> frames. If the host can\n"
+	       "                     not keep up, the oldest queued frames are dropped so the\n"
+	       "                     capture keeps going at full rate.\n"
+	       "  --stream-serve <port>\n"
+	       "                     accept connections from any number of hosts on this port\n"
+	       "                     (0 selects port %d) and stream to all of them. Each frame\n"
+	       "                     is only compressed once. Every host gets its own queue of\n"
+	       "                     --stream-to-host-bufs frames (default 4), hosts that stop\n"
+	       "                     reading for 5 seconds are disconnected.\n"
 	       "  --stream-lossless  always use lossless video compression.\n"
 #endif
+	       "  --stream-to-shm <name>\n"
+	       "                     publish the captured frames in the POSIX shared memory object\n"
+	       "                     <name>, as a ring of frames that any number of processes can\n"
+	       "                     read without slowing down the capture. See v4l-stream.h for\n"
+	       "                     the layout.\n"
+	       "  --stream-to-shm-slots <count>\n"
+	       "                     the number of frames in the --stream-to-shm ring (default 4).\n"
 	       "  --stream-poll      use non-blocking mode and select() to stream.\n"
+	       "  --stream-batch     as --stream-poll, but dequeue all buffers that are ready\n"
+	       "                     after each select() and queue them back together.\n"
+	       "  --stream-crc[=first=<line>,lines=<count>]\n"
+	       "                     print the CRC-32C of each plane of each frame, instead of\n"
+	       "                     storing the frames to compare them. With first and lines,\n"
+	       "                     only that range of lines is used, scaled for subsampled\n"
+	       "                     planes. Works for both capture and output.\n"
+	       "  --stream-crc-check <file>\n"
+	       "                     compute the CRCs as --stream-crc, but only report the frames\n"
+	       "                     whose CRCs are not one of the lines of <file>, which is in\n"
+	       "                     the format --stream-crc prints. So the CRCs of the frames of\n"
+	       "                     a --stream-out-pattern can be stored with --stream-crc on\n"
+	       "                     the output side and checked on the capture side.\n"
+	       "  --stream-bench     when capturing, measure the time between DQBUF and QBUF,\n"
+	       "                     the time from the driver timestamp to user space, the\n"
+	       "                     jitter of the timestamps, dropped sequence numbers and\n"
+	       "                     the CPU time per frame. A summary is shown at the end,\n"
+	       "                     followed by a JSON summary on stdout (on stderr when\n"
+	       "                     streaming to stdout).\n"
+	       "  --stream-req-depth <depth>\n"
+	       "                     for stateless codecs, keep <depth> requests queued. This\n"
+	       "                     sets the number of OUTPUT buffers, and the number of\n"
+	       "                     CAPTURE buffers to at least <depth> + 1.\n"
+	       "  --stream-m2m-threads\n"
+	       "                     for stateful codecs, feed the OUTPUT queue and drain the\n"
+	       "                     CAPTURE queue from separate threads, and read the\n"
+	       "                     --stream-from file ahead from a third thread, so that the\n"
+	       "                     file I/O does not limit the codec throughput.\n"
+	       "  --stream-m2m-bench[=sizes=<w>x<h>[:<w>x<h>...],pixelformats=<fourcc>[:<fourcc>...],\n"
+	       "                     bufs=<count>[:<count>...],memory=<mem>[:<mem>...],repeat=<runs>,\n"
+	       "                     report=<csv|json>]\n"
+	       "                     benchmark a codec: run it <runs> times (default 1) for each\n"
+	       "                     combination of the listed values, which apply to the raw\n"
+	       "                     side of the codec. <mem> is mmap, userptr or dmabuf (which\n"
+	       "                     needs --export-device). Values that are not listed stay as\n"
+	       "                     set. Encoders encode --stream-count frames (default %u) of\n"
+	       "                     the test pattern, decoders decode the --stream-from file,\n"
+	       "                     at the size of the bitstream. For each run the frames/s, the\n"
+	       "                     latency from the OUTPUT QBUF to the DQBUF of the CAPTURE\n"
+	       "                     buffer with the same timestamp and the CPU usage are\n"
+	       "                     reported on stdout, as JSON (default) or CSV.\n"
+	       "  --stream-devices <dev>[,<dev>...]\n"
+	       "                     capture from the listed devices as well as from the -d\n"
+	       "                     device, using one event loop. Each device is written to\n"
+	       "                     its own --stream-to file: a %%u in the file name is\n"
+	       "                     replaced by the device number (0 is the -d device),\n"
+	       "                     otherwise .<number> is appended. The timestamp skew\n"
+	       "                     between the devices is reported for each set of frames.\n"
+	       "  --stream-chain <m2m-dev>\n"
+	       "                     with --stream-mmap, --stream-out-dmabuf and --out-device:\n"
+	       "                     pass the captured frames through the m2m device to the\n"
+	       "                     output device without copying them. Each queue has the\n"
+	       "                     --stream-mmap number of buffers, and how often each queue\n"
+	       "                     ran out of buffers is reported at the end.\n"
+	       "  --stream-numa[=<node>]\n"
+	       "                     run the streaming threads on the CPUs of NUMA node <node>\n"
+	       "                     and allocate memory, like the user pointer buffers and\n"
+	       "                     the buffers for conversions, from that node. If <node> is\n"
+	       "                     not given, the node the device is attached to is read\n"
+	       "                     from sysfs.\n"
+	       "  --stream-realtime[=prio=<prio>,cpu=<cpu>,budget=<perc>]\n"
+	       "                     capture with mlockall(), SCHED_FIFO priority <prio> (default\n"
+	       "                     50) and optionally pinned to CPU <cpu>. Instead of waiting\n"
+	       "                     in select(), busy-poll VIDIOC_DQBUF around the time the next\n"
+	       "                     frame is expected, for at most <perc> percent (default 20) of\n"
+	       "                     the frame interval. At the end the distribution of the time\n"
+	       "                     between the buffer timestamp and its dequeue is reported.\n"
+	       "  --stream-grow-bufs <max>\n"
+	       "                     start capturing with the --stream-mmap/user number of\n"
+	       "                     buffers and add buffers with VIDIOC_CREATE_BUFS, up to <max>,\n"
+	       "                     when sequence numbers are dropped or the driver is about\n"
+	       "                     to run out of queued buffers. If the driver supports\n"
+	       "                     VIDIOC_REMOVE_BUFS, a buffer is removed again when at least\n"
+	       "                     two were always left queued during %u frames. Not for\n"
+	       "                     --stream-dmabuf or --stream-batch.\n"
+	       "  --stream-trace <file>\n"
+	       "                     append the stages each frame passes to <file>, in the JSON\n"
+	       "                     trace event format of chrome://tracing and Perfetto: its\n"
+	       "                     capture (split at the point libv4l2 got it with -w), the\n"
+	       "                     conversion by libv4l2, the m2m device, the compression and\n"
+	       "                     transfer to and decompression from --stream-to-host and\n"
+	       "                     --stream-from-host, and the output device. The stages are\n"
+	       "                     sent along with the frames to --stream-to-host, so tools\n"
+	       "                     that trace to the same file on the same or a clock\n"
+	       "                     synchronized host show the whole pipeline of each frame.\n"
+	       "                     Not for --stream-chain or --stream-devices.\n"
 	       "  --stream-buf-caps  show capture buffer capabilities\n"
 	       "  --stream-show-delta-now\n"
 	       "                     output the difference between the buffer timestamp and current\n"
@@ -347,6 +1109,12 @@ void streaming_usage()
 	       "  --stream-no-query  Do not query and set the DV timings or standard before streaming.\n"
 	       "  --stream-loop      loop when the end of the file we are streaming from is reached.\n"
 	       "                     The default is to stop.\n"
+	       "  --stream-from-mmap[=lock]\n"
+	       "                     map the --stream-from file in memory and read it all in before\n"
+	       "                     streaming, so that the frames are copied straight from the\n"
+	       "                     mapping instead of with one read() per frame. If 'lock' is\n"
+	       "                     given, the mapping is also locked in RAM. The file must be a\n"
+	       "                     regular file.\n"
 	       "  --stream-out-pattern <count>\n"
 	       "                     choose output test pattern. The default is 0.\n"
 	       "  --stream-out-square\n"
@@ -404,9 +1172,9 @@ void streaming_usage()
 	       "  --list-buffers-meta\n"
 	       "                     list all Meta RX buffers [VIDIOC_QUERYBUF]\n",
 #ifndef NO_STREAM_TO
-		V4L_STREAM_PORT,
+		V4L_STREAM_PORT, V4L_STREAM_PORT,
 #endif
-	       	V4L_STREAM_PORT);
+	       	M2M_BENCH_FRAMES, GROW_WINDOW, V4L_STREAM_PORT);
 }
 
 static void get_codec_type(cv4l_fd &fd)
@@ -496,11 +1264,210 @@ static void set_time_stamp(cv4l_buffer &buf)
 	buf.s_timestamp_clock();
 }
 
+/*
+ * Reads the --stream-from file ahead into a ring buffer on its own thread,
+ * so that feeding the OUTPUT queue does not have to wait for the file.
+ * Only the reader thread touches the FILE while it is active, all reads
+ * from it must go through read_input().
+ */
+class stream_reader {
+public:
+	bool active(FILE *f) const { return fin && fin == f; }
+
+	void start(FILE *f, size_t size)
+	{
+		fin = f;
+		ring.resize(size);
+		head = fill = 0;
+		eof = exit = false;
+		thread = std::thread(&stream_reader::run, this);
+	}
+
+	void stop()
+	{
+		if (!fin)
+			return;
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			exit = true;
+		}
+		cond.notify_all();
+		thread.join();
+		fin = nullptr;
+	}
+
+	/* Rewinds the file and drops what was read ahead */
+	void rewind()
+	{
+		FILE *f = fin;
+
+		stop();
+		fseek(f, 0, SEEK_SET);
+		start(f, ring.size());
+	}
+
+	/* Returns less than size bytes only at the end of the file */
+	size_t read(void *p, size_t size)
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		u8 *dst = static_cast<u8 *>(p);
+		size_t done = 0;
+
+		while (done < size) {
+			while (!fill && !eof)
+				cond.wait(lk);
+			if (!fill)
+				break;
+
+			size_t n = std::min({ size - done, fill, ring.size() - head });
+
+			/* The reader thread does not touch the filled part */
+			lk.unlock();
+			memcpy(dst + done, &ring[head], n);
+			lk.lock();
+			head = (head + n) % ring.size();
+			fill -= n;
+			done += n;
+			cond.notify_all();
+		}
+		return done;
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lk(lock);
+
+		for (;;) {
+			while ((fill == ring.size() || eof) && !exit)
+				cond.wait(lk);
+			if (exit)
+				break;
+
+			size_t tail = (head + fill) % ring.size();
+			size_t n = std::min(ring.size() - fill, ring.size() - tail);
+
+			n = std::min(n, chunk_size);
+			lk.unlock();
+			size_t ret = fread(&ring[tail], 1, n, fin);
+			lk.lock();
+			fill += ret;
+			if (ret < n)
+				eof = true;
+			cond.notify_all();
+		}
+	}
+
+	static constexpr size_t chunk_size = 256 * 1024;
+
+	FILE *fin = nullptr;
+	std::vector<u8> ring;
+	size_t head = 0;
+	size_t fill = 0;
+	bool eof = false;
+	bool exit = false;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::thread thread;
+};
+
+static stream_reader reader;
+/* How much of the --stream-from file is read ahead */
+#define STREAM_READER_SIZE (16 * 1024 * 1024)
+
+/*
+ * --stream-from-mmap: the whole --stream-from file is mapped and faulted in
+ * up front, so reading a frame is a memcpy() and looping is just resetting
+ * the position, without any syscalls or page cache lookups.
+ */
+class stream_map {
+public:
+	~stream_map() { unmap(); }
+
+	bool active(FILE *f) const { return fin && fin == f; }
+
+	bool map(FILE *f, bool lock)
+	{
+		struct stat st;
+
+		unmap();
+		if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode)) {
+			fprintf(stderr, "--stream-from-mmap needs a regular file\n");
+			return false;
+		}
+		size = st.st_size;
+		pos = 0;
+		if (!size) {
+			fin = f;
+			return true;
+		}
+		data = static_cast<u8 *>(mmap(nullptr, size, PROT_READ,
+					      MAP_PRIVATE | MAP_POPULATE,
+					      fileno(f), 0));
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "could not map the input file: %s\n", strerror(errno));
+			data = nullptr;
+			return false;
+		}
+		madvise(data, size, MADV_SEQUENTIAL);
+		if (lock && mlock(data, size))
+			fprintf(stderr, "could not lock the input file in memory: %s\n",
+				strerror(errno));
+		fin = f;
+		return true;
+	}
+
+	void unmap()
+	{
+		if (data)
+			munmap(data, size);
+		data = nullptr;
+		fin = nullptr;
+	}
+
+	void rewind() { pos = 0; }
+
+	size_t read(void *p, size_t len)
+	{
+		len = std::min(len, size - pos);
+		memcpy(p, data + pos, len);
+		pos += len;
+		return len;
+	}
+
+private:
+	FILE *fin = nullptr;
+	u8 *data = nullptr;
+	size_t size = 0;
+	size_t pos = 0;
+};
+
+static stream_map input_map;
+
+static size_t read_input(void *p, size_t size, size_t nmemb, FILE *f)
+{
+	if (input_map.active(f))
+		return input_map.read(p, size * nmemb) / size;
+	if (!reader.active(f))
+		return fread(p, size, nmemb, f);
+	return reader.read(p, size * nmemb) / size;
+}
+
+static void rewind_input(FILE *f)
+{
+	if (input_map.active(f))
+		input_map.rewind();
+	else if (reader.active(f))
+		reader.rewind();
+	else
+		fseek(f, 0, SEEK_SET);
+}
+
 static __u32 read_u32(FILE *f)
 {
 	__u32 v;
 
-	if (fread(&v, 1, sizeof(v), f) != sizeof(v))
+	if (read_input(&v, 1, sizeof(v), f) != sizeof(v))
 		return 0;
 	return ntohl(v);
 }
@@ -627,8 +1594,12 @@ static void print_concise_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt,
 		}
 		last_ts = ts;
 
-		if (fps_ts.has_fps(true))
+		if (fps_ts.has_fps(true)) {
 			fprintf(stderr, " fps: %.02f", fps_ts.fps());
+			if (fps_ts.has_wakeups())
+				fprintf(stderr, " wakeups/frame: %.02f",
+					fps_ts.wakeups_per_frame());
+		}
 
 		unsigned dropped = fps_ts.dropped();
 
@@ -753,6 +1724,9 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamLoop:
 		stream_loop = true;
 		break;
+	case OptStreamFromMmap:
+		stream_from_mlock = optarg && !strcmp(optarg, "lock");
+		break;
 	case OptStreamOutPattern:
 		stream_pat = strtoul(optarg, nullptr, 0);
 		for (i = 0; tpg_pattern_strings[i]; i++) ;
@@ -833,32 +1807,100 @@ void streaming_cmd(int ch, char *optarg)
 		if (!strcmp(file_to, "-"))
 			options[OptSilent] = true;
 		break;
-	case OptStreamToHost:
-		host_to = optarg;
-		break;
-	case OptStreamLossless:
-		host_lossless = true;
+	case OptStreamToBufs:
+		stream_to_bufs = strtoul(optarg, nullptr, 0);
 		break;
-	case OptStreamFrom:
-		file_from = optarg;
-		from_with_hdr = false;
+	case OptStreamToDirect:
+		stream_to_direct = true;
 		break;
-	case OptStreamFromHdr:
-		file_from = optarg;
-		from_with_hdr = true;
+	case OptStreamToHost:
+		host_to = optarg;
 		break;
-	case OptStreamFromHost:
-		host_from = optarg;
+	case OptStreamToHostBufs:
+		stream_to_host_bufs = strtoul(optarg, nullptr, 0);
 		break;
-	case OptStreamUser:
-		memory = V4L2_MEMORY_USERPTR;
-		fallthrough;
-	case OptStreamMmap:
-		if (optarg) {
-			reqbufs_count_cap = strtoul(optarg, nullptr, 0);
-			if (reqbufs_count_cap == 0)
-				reqbufs_count_cap = 3;
-		}
+	case OptStreamToShm:
+		shm_to = optarg;
+		break;
+	case OptStreamCrc:
+		subs = optarg;
+		while (subs && *subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"first",
+				"lines",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				crc_first_line = strtoul(value, nullptr, 0);
+				break;
+			case 1:
+				crc_lines = strtoul(value, nullptr, 0);
+				break;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
+	case OptStreamCrcCheck: {
+		FILE *f = fopen(optarg, "r");
+		char line[256];
+
+		if (!f) {
+			fprintf(stderr, "could not open %s for reading\n", optarg);
+			std::exit(EXIT_FAILURE);
+		}
+		while (fgets(line, sizeof(line), f)) {
+			char *p = std::strchr(line, ':');
+
+			p = p ? p + 1 : line;
+			p += strspn(p, " \t");
+			p[strcspn(p, "\r\n")] = '\0';
+			if (*p)
+				crc_expected.insert(p);
+		}
+		fclose(f);
+		options[OptStreamCrc] = true;
+		break;
+	}
+	case OptStreamToShmSlots:
+		shm_to_slots = strtoul(optarg, nullptr, 0);
+		if (!shm_to_slots) {
+			streaming_usage();
+			std::exit(EXIT_FAILURE);
+		}
+		break;
+	case OptStreamServe:
+		host_serve = true;
+		host_port_serve = strtoul(optarg, nullptr, 0);
+		if (!host_port_serve)
+			host_port_serve = V4L_STREAM_PORT;
+		break;
+	case OptStreamLossless:
+		host_lossless = true;
+		break;
+	case OptStreamFrom:
+		file_from = optarg;
+		from_with_hdr = false;
+		break;
+	case OptStreamFromHdr:
+		file_from = optarg;
+		from_with_hdr = true;
+		break;
+	case OptStreamFromHost:
+		host_from = optarg;
+		break;
+	case OptStreamUser:
+		memory = V4L2_MEMORY_USERPTR;
+		fallthrough;
+	case OptStreamMmap:
+		if (optarg) {
+			reqbufs_count_cap = strtoul(optarg, nullptr, 0);
+			if (reqbufs_count_cap == 0)
+				reqbufs_count_cap = 3;
+		}
 		break;
 	case OptStreamDmaBuf:
 		memory = V4L2_MEMORY_DMABUF;
@@ -873,10 +1915,253 @@ void streaming_cmd(int ch, char *optarg)
 				reqbufs_count_out = 3;
 		}
 		break;
+	case OptStreamReqDepth:
+		stream_req_depth = strtoul(optarg, nullptr, 0);
+		if (stream_req_depth >= VIDEO_MAX_FRAME)
+			stream_req_depth = VIDEO_MAX_FRAME - 1;
+		break;
+	case OptStreamChain:
+		stream_chain_dev = optarg;
+		if (*optarg >= '0' && *optarg <= '9') {
+			static char chain_dev[20];
+
+			snprintf(chain_dev, sizeof(chain_dev), "/dev/video%s", optarg);
+			stream_chain_dev = chain_dev;
+		}
+		break;
+	case OptStreamDevices:
+		stream_devices.clear();
+		for (char *p = optarg; *p; ) {
+			char *end = strchr(p, ',');
+			std::string dev = end ? std::string(p, end - p) : std::string(p);
+
+			/* Just a number means /dev/videoN */
+			if (!dev.empty() && dev.find_first_not_of("0123456789") == std::string::npos)
+				dev = "/dev/video" + dev;
+			if (!dev.empty())
+				stream_devices.push_back(dev);
+			if (!end)
+				break;
+			p = end + 1;
+		}
+		break;
 	case OptStreamOutDmaBuf:
 		out_memory = V4L2_MEMORY_DMABUF;
 		break;
+	case OptStreamNuma:
+		if (optarg)
+			stream_numa_node = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamRealtime:
+		subs = optarg;
+		while (subs && *subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"prio",
+				"cpu",
+				"budget",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				stream_rt.prio = strtol(value, nullptr, 0);
+				break;
+			case 1:
+				stream_rt.cpu = strtol(value, nullptr, 0);
+				break;
+			case 2:
+				stream_rt.budget = strtoul(value, nullptr, 0);
+				if (stream_rt.budget <= 100)
+					break;
+				fallthrough;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
+	case OptStreamGrowBufs:
+		stream_grow.max = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamTrace:
+		stream_trace_file = optarg;
+		break;
+	case OptStreamM2MBench:
+		subs = optarg;
+		while (subs && *subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"sizes",
+				"pixelformats",
+				"bufs",
+				"memory",
+				"repeat",
+				"report",
+				nullptr
+			};
+			int opt = parse_subopt(&subs, subopts, &value);
+
+			/* The values of the lists are separated by colons */
+			for (char *v = value; opt >= 0 && opt < 4 && v; ) {
+				char *next = strchr(v, ':');
+				__u32 w, h;
+
+				if (next)
+					*next++ = '\0';
+				switch (opt) {
+				case 0:
+					if (sscanf(v, "%ux%u", &w, &h) != 2)
+						opt = -1;
+					else
+						m2m_matrix.sizes.push_back({ w, h });
+					break;
+				case 1:
+					if (strlen(v) == 4)
+						m2m_matrix.pixelformats.push_back(v4l2_fourcc(v[0], v[1], v[2], v[3]));
+					else
+						opt = -1;
+					break;
+				case 2:
+					m2m_matrix.bufs.push_back(strtoul(v, nullptr, 0));
+					if (!m2m_matrix.bufs.back())
+						opt = -1;
+					break;
+				case 3:
+					if (!strcmp(v, "mmap"))
+						m2m_matrix.memories.push_back(V4L2_MEMORY_MMAP);
+					else if (!strcmp(v, "userptr"))
+						m2m_matrix.memories.push_back(V4L2_MEMORY_USERPTR);
+					else if (!strcmp(v, "dmabuf"))
+						m2m_matrix.memories.push_back(V4L2_MEMORY_DMABUF);
+					else
+						opt = -1;
+					break;
+				}
+				v = next;
+			}
+
+			if (opt == 4) {
+				m2m_matrix.repeat = strtoul(value, nullptr, 0);
+				if (!m2m_matrix.repeat)
+					opt = -1;
+			} else if (opt == 5) {
+				if (!strcmp(value, "csv"))
+					m2m_matrix.csv = true;
+				else if (strcmp(value, "json"))
+					opt = -1;
+			}
+			if (opt < 0) {
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
+	}
+}
+
+/*
+ * Return the NUMA node of the device, found by walking up its sysfs
+ * parents, as only the bus devices (e.g. PCI) have a numa_node attribute.
+ */
+static int get_numa_node(cv4l_fd &fd)
+{
+	struct stat st;
+	char path[PATH_MAX];
+
+	if (fstat(fd.g_fd(), &st) || !S_ISCHR(st.st_mode))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+
+	char *syspath = realpath(path, nullptr);
+
+	if (!syspath)
+		return -1;
+
+	std::string dir(syspath);
+	int node = -1;
+
+	free(syspath);
+	while (dir.length() > strlen("/sys/devices")) {
+		FILE *f = fopen((dir + "/numa_node").c_str(), "r");
+
+		if (f) {
+			if (fscanf(f, "%d", &node) != 1)
+				node = -1;
+			fclose(f);
+			if (node >= 0)
+				break;
+		}
+		dir.erase(dir.rfind('/'));
+	}
+	return node;
+}
+
+/*
+ * Bind the process to the CPUs and the memory of a NUMA node. This is
+ * done before any streaming thread is started and any buffer is
+ * allocated, so all of them inherit it.
+ */
+static void stream_numa_bind(cv4l_fd &fd)
+{
+	int node = stream_numa_node;
+
+	if (node < 0)
+		node = get_numa_node(fd);
+	if (node < 0) {
+		fprintf(stderr, "--stream-numa: the NUMA node of the device is unknown\n");
+		return;
+	}
+
+	char path[64];
+	char cpulist[4096];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+	FILE *f = fopen(path, "r");
+
+	if (!f || !fgets(cpulist, sizeof(cpulist), f)) {
+		fprintf(stderr, "--stream-numa: unknown NUMA node %d\n", node);
+		if (f)
+			fclose(f);
+		return;
+	}
+	fclose(f);
+
+	cpu_set_t cpus;
+	char *p = cpulist;
+
+	CPU_ZERO(&cpus);
+	while (*p && *p != '\n') {
+		unsigned first = strtoul(p, &p, 10);
+		unsigned last = first;
+
+		if (*p == '-')
+			last = strtoul(p + 1, &p, 10);
+		for (unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &cpus);
+		if (*p == ',')
+			p++;
+		else
+			break;
+	}
+	if (!CPU_COUNT(&cpus))
+		fprintf(stderr, "--stream-numa: NUMA node %d has no CPUs\n", node);
+	else if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		fprintf(stderr, "--stream-numa: sched_setaffinity: %s\n", strerror(errno));
+
+	unsigned long nodemask[4] = {};
+	unsigned max_nodes = sizeof(nodemask) * 8;
+
+	if (static_cast<unsigned>(node) >= max_nodes) {
+		fprintf(stderr, "--stream-numa: NUMA node %d is out of range\n", node);
+		return;
 	}
+	nodemask[node / (sizeof(nodemask[0]) * 8)] |= 1UL << (node % (sizeof(nodemask[0]) * 8));
+	/* Preferred, not bound, so allocations still succeed if the node is full */
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, max_nodes + 1))
+		fprintf(stderr, "--stream-numa: set_mempolicy: %s\n", strerror(errno));
+	else if (verbose)
+		printf("Streaming on NUMA node %d, CPUs %s", node, cpulist);
 }
 
 /*
@@ -890,14 +2175,14 @@ static bool read_fwht_frame(cv4l_fmt &fmt, unsigned char *buf,
 	expected_len = sizeof(struct fwht_cframe_hdr);
 	if (expected_len > buf_len)
 		return false;
-	sz = fread(&last_fwht_hdr, 1, sizeof(struct fwht_cframe_hdr), fpointer);
+	sz = read_input(&last_fwht_hdr, 1, sizeof(struct fwht_cframe_hdr), fpointer);
 	if (sz < sizeof(struct fwht_cframe_hdr))
 		return true;
 
 	expected_len = ntohl(last_fwht_hdr.size);
 	if (expected_len > buf_len)
 		return false;
-	sz = fread(buf, 1, ntohl(last_fwht_hdr.size), fpointer);
+	sz = read_input(buf, 1, ntohl(last_fwht_hdr.size), fpointer);
 	return true;
 }
 
@@ -924,6 +2209,10 @@ static void set_fwht_stateless_params(struct v4l2_ctrl_fwht_params &fwht_params,
 		fwht_params.flags |= V4L2_FWHT_FL_I_FRAME;
 }
 
+/*
+ * A request is allocated once for each OUTPUT buffer, after that it is
+ * reused with MEDIA_REQUEST_IOC_REINIT.
+ */
 static int alloc_fwht_req(int media_fd, unsigned index)
 {
 	int rc = 0;
@@ -935,44 +2224,43 @@ static int alloc_fwht_req(int media_fd, unsigned index)
 		return rc;
 	}
 
+	fwht_req_by_fd[fwht_reqs[index].fd] = index;
 	return 0;
 }
 
+/* Called right before the request is queued */
 static void set_fwht_req_by_idx(unsigned idx, const struct fwht_cframe_hdr *hdr,
 				__u64 last_bf_ts, __u64 ts)
 {
 	struct v4l2_ctrl_fwht_params fwht_params;
+	auto it = fwht_req_by_ts.find(fwht_reqs[idx].ts);
 
 	set_fwht_stateless_params(fwht_params, hdr, last_bf_ts);
 
+	if (it != fwht_req_by_ts.end() && it->second == idx)
+		fwht_req_by_ts.erase(it);
 	fwht_reqs[idx].ts = ts;
 	fwht_reqs[idx].params = fwht_params;
+	fwht_reqs[idx].pending = true;
+	fwht_req_by_ts[ts] = idx;
 }
 
 static int get_fwht_req_by_ts(__u64 ts)
 {
-	for (int idx = 0; idx < VIDEO_MAX_FRAME; idx++) {
-		if (fwht_reqs[idx].ts == ts)
-			return idx;
-	}
-	return -1;
+	auto it = fwht_req_by_ts.find(ts);
+
+	return it == fwht_req_by_ts.end() ? -1 : it->second;
 }
 
 static bool set_fwht_req_by_fd(const struct fwht_cframe_hdr *hdr,
 			       int req_fd, __u64 last_bf_ts, __u64 ts)
 {
-	struct v4l2_ctrl_fwht_params fwht_params;
-
-	set_fwht_stateless_params(fwht_params, hdr, last_bf_ts);
+	auto it = fwht_req_by_fd.find(req_fd);
 
-	for (auto &fwht_req : fwht_reqs) {
-		if (fwht_req.fd == req_fd) {
-			fwht_req.ts = ts;
-			fwht_req.params = fwht_params;
-			return true;
-		}
-	}
-	return false;
+	if (it == fwht_req_by_fd.end())
+		return false;
+	set_fwht_req_by_idx(it->second, hdr, last_bf_ts, ts);
+	return true;
 }
 
 static int set_fwht_ext_ctrl(cv4l_fd &fd, const struct fwht_cframe_hdr *hdr,
@@ -1043,7 +2331,7 @@ static bool read_write_padded_frame(cv4l_fmt &fmt, unsigned char *buf,
 			unsigned int wsz = 0;
 
 			if (is_read)
-				wsz = fread(row_p, 1, consume_sz, fpointer);
+				wsz = read_input(row_p, 1, consume_sz, fpointer);
 			else
 				wsz = fwrite(row_p, 1, consume_sz, fpointer);
 			if (wsz == 0 && i == 0 && plane_idx == 0)
@@ -1069,6 +2357,10 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 	static bool is_fwht = false;
 
 	if (host_fd_from >= 0) {
+		static __u32 host_sequence;
+		v4l_stream_trace trace;
+		__u64 arrived;
+
 		for (;;) {
 			unsigned packet = read_u32(fin);
 
@@ -1094,7 +2386,7 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 			while (sz) {
 				unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
 
-				int n = fread(buf, 1, rdsize, fin);
+				int n = read_input(buf, 1, rdsize, fin);
 				if (n < 0) {
 					fprintf(stderr, "error reading %d bytes\n", sz);
 					return false;
@@ -1103,14 +2395,32 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 			}
 		}
 
+		arrived = v4l_stream_trace_now();
+
 		unsigned sz = read_u32(fin);
 
-		if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR) {
+		if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR &&
+		    sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE) {
 			fprintf(stderr, "unsupported FRAME_VIDEO size\n");
 			return false;
 		}
 		read_u32(fin);  // ignore field
 		read_u32(fin);  // ignore flags
+		v4l_stream_trace_init(&trace, host_sequence++);
+		if (sz == V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE) {
+			__u32 words[V4L_STREAM_TRACE_SIZE / 4];
+
+			if (!read_input(words, sizeof(words), 1, fin)) {
+				fprintf(stderr, "error reading the frame trace\n");
+				return false;
+			}
+			if (!v4l_stream_trace_unpack(&trace, words))
+				v4l_stream_trace_init(&trace, host_sequence - 1);
+			else if (trace.num_stages)
+				v4l_stream_trace_add(&trace, V4L_STREAM_TRACE_TRANSFER,
+						     v4l_stream_trace_last_end(&trace),
+						     arrived);
+		}
 		for (unsigned j = 0; j < q.g_num_planes(); j++) {
 			__u8 *buf = static_cast<__u8 *>(q.g_dataptr(b.g_index(), j));
 
@@ -1136,7 +2446,7 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 				return false;
 			}
 			while (sz) {
-				int n = fread(read_buf + offset, 1, sz, fin);
+				int n = read_input(read_buf + offset, 1, sz, fin);
 				if (n < 0) {
 					fprintf(stderr, "error reading %d bytes\n", sz);
 					return false;
@@ -1153,6 +2463,11 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 				rle_decompress(buf, size, comp_size, bpl_out[j]);
 			}
 		}
+		if (tracer.active()) {
+			v4l_stream_trace_add(&trace, V4L_STREAM_TRACE_DECOMPRESS,
+					     arrived, v4l_stream_trace_now());
+			tracer.received(trace);
+		}
 		return true;
 	}
 
@@ -1160,13 +2475,13 @@ restart:
 	if (from_with_hdr) {
 		__u32 v;
 
-		if (!fread(&v, sizeof(v), 1, fin)) {
+		if (!read_input(&v, sizeof(v), 1, fin)) {
 			if (first) {
 				fprintf(stderr, "Insufficient data\n");
 				return false;
 			}
 			if (stream_loop) {
-				fseek(fin, 0, SEEK_SET);
+				rewind_input(fin);
 				first = true;
 				goto restart;
 			}
@@ -1204,7 +2519,7 @@ restart:
 			res = read_write_padded_frame(fmt, static_cast<unsigned char *>(buf),
 						      fin, sz, expected_len, buf_len, true);
 		else
-			sz = fread(buf, 1, expected_len, fin);
+			sz = read_input(buf, 1, expected_len, fin);
 
 		if (!res) {
 			fprintf(stderr, "amount intended to be read/written is larger than the buffer size\n");
@@ -1216,7 +2531,7 @@ restart:
 			return false;
 		}
 		if (j == 0 && sz == 0 && stream_loop) {
-			fseek(fin, 0, SEEK_SET);
+			rewind_input(fin);
 			first = true;
 			goto restart;
 		}
@@ -1232,6 +2547,38 @@ restart:
 	return true;
 }
 
+/*
+ * Render the test pattern for this field into buffer index. A static pattern
+ * only differs between the top and bottom field, so with alternating fields
+ * each field is rendered once and then copied into buffers that last held
+ * the other field. The buffers that already hold the right field are left
+ * alone.
+ */
+static void fill_out_pattern(cv4l_queue &q, unsigned index, __u32 field)
+{
+	if (!stream_out_field_cache) {
+		for (unsigned j = 0; j < q.g_num_planes(); j++)
+			tpg_fillbuffer(&tpg, stream_out_std, j, static_cast<u8 *>(q.g_dataptr(index, j)));
+		return;
+	}
+
+	std::vector<u8> *cache = stream_out_fields[field == V4L2_FIELD_BOTTOM];
+
+	if (stream_out_buf_field[index] == field)
+		return;
+	stream_out_buf_field[index] = field;
+	for (unsigned j = 0; j < q.g_num_planes(); j++) {
+		u8 *p = static_cast<u8 *>(q.g_dataptr(index, j));
+
+		if (cache[j].empty()) {
+			tpg_fillbuffer(&tpg, stream_out_std, j, p);
+			cache[j].assign(p, p + q.g_length(j));
+		} else {
+			memcpy(p, cache[j].data(), cache[j].size());
+		}
+	}
+}
+
 static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf,
 				bool ignore_count_skip)
 {
@@ -1277,8 +2624,12 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 		output_field = (stream_out_std & V4L2_STD_525_60) ?
 			V4L2_FIELD_BOTTOM : V4L2_FIELD_TOP;
 
+	stream_out_refresh = stream_out_field_cache = false;
 	if (is_video) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
 		tpg_init(&tpg, 640, 360);
+		tpg_s_threads(&tpg, cpus > 0 ? cpus : 1);
 		tpg_alloc(&tpg, fmt.g_width());
 		can_fill = tpg_s_fourcc(&tpg, fmt.g_pixelformat());
 		tpg_reset_source(&tpg, fmt.g_width(), fmt.g_frame_height(), field);
@@ -1311,9 +2662,13 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 			break;
 		}
 		field = output_field;
-		if (can_fill && ((V4L2_FIELD_HAS_T_OR_B(field) && (stream_count & 1)) ||
-				 !tpg_pattern_is_static(&tpg)))
-			stream_out_refresh = true;
+		stream_out_refresh = can_fill && !tpg_pattern_is_static(&tpg);
+		stream_out_field_cache = can_fill && !fin && !stream_out_refresh &&
+					 output_field_alt;
+		for (auto &cache : stream_out_fields)
+			for (auto &plane : cache)
+				plane.clear();
+		stream_out_buf_field.assign(q.g_buffers(), V4L2_FIELD_ANY);
 	}
 
 	for (unsigned i = 0; i < q.g_buffers(); i++) {
@@ -1337,10 +2692,8 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 					field = V4L2_FIELD_TOP;
 			}
 
-			if (can_fill) {
-				for (unsigned j = 0; j < q.g_num_planes(); j++)
-					tpg_fillbuffer(&tpg, stream_out_std, j, static_cast<u8 *>(q.g_dataptr(i, j)));
-			}
+			if (can_fill)
+				fill_out_pattern(q, i, buf.g_field());
 		}
 		if (is_meta)
 			meta_fillbuffer(buf, fmt, q);
@@ -1349,16 +2702,18 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 			return QUEUE_STOPPED;
 
 		if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
-			struct v4l2_capability vcap = {};
-			fd.querycap(vcap);
-			int media_fd = mi_get_media_fd(fd.g_fd(), (const char *)vcap.bus_info);
+			if (fwht_media_fd < 0) {
+				struct v4l2_capability vcap = {};
 
-			if (media_fd < 0) {
+				fd.querycap(vcap);
+				fwht_media_fd = mi_get_media_fd(fd.g_fd(), (const char *)vcap.bus_info);
+			}
+			if (fwht_media_fd < 0) {
 				fprintf(stderr, "%s: mi_get_media_fd failed\n", __func__);
-				return media_fd;
+				return fwht_media_fd;
 			}
 
-			if (alloc_fwht_req(media_fd, i))
+			if (alloc_fwht_req(fwht_media_fd, i))
 				return QUEUE_ERROR;
 			buf.s_request_fd(fwht_reqs[i].fd);
 			buf.or_flags(V4L2_BUF_FLAG_REQUEST_FD);
@@ -1376,6 +2731,10 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 			set_time_stamp(buf);
 			if (fd.qbuf(buf))
 				return QUEUE_ERROR;
+			if (options[OptStreamM2MBench])
+				m2m_bench.queued(buf);
+			if (tracer.active())
+				tracer.queued(fd, buf, false);
 			tpg_update_mv_count(&tpg, V4L2_FIELD_HAS_T_OR_B(field));
 			if (!verbose)
 				stderr_info(">");
@@ -1400,120 +2759,988 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 	return 0;
 }
 
-static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
-				 cv4l_fmt &fmt, FILE *fout)
+/*
+ * Without a header per frame the --stream-to file only contains the frames,
+ * so these are written straight from the buffers, without copying them into
+ * the stdio buffer first.
+ */
+bool write_raw(int fd, const u8 *p, size_t size)
 {
-#ifndef NO_STREAM_TO
-	unsigned comp_size[VIDEO_MAX_PLANES];
-	__u8 *comp_ptr[VIDEO_MAX_PLANES];
-
-	if (host_fd_to >= 0) {
-		unsigned tot_comp_size = 0;
-		unsigned tot_used = 0;
-
-		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-			__u32 used = buf.g_bytesused(j);
-			unsigned offset = buf.g_data_offset(j);
-			u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset;
-
-			if (ctx) {
-				comp_ptr[j] = fwht_compress(ctx, p,
-							    used - offset, &comp_size[j]);
-			} else {
-				comp_ptr[j] = p;
-				comp_size[j] = rle_compress(p, used - offset,
-							    bpl_cap[j]);
-			}
-			tot_comp_size += comp_size[j];
-			tot_used += used - offset;
-		}
-		write_u32(fout, ctx ? V4L_STREAM_PACKET_FRAME_VIDEO_FWHT :
-				V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
-		write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(buf.g_num_planes()) + tot_comp_size);
-		write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
-		write_u32(fout, buf.g_field());
-		write_u32(fout, buf.g_flags());
-		comp_perc += (tot_comp_size * 100 / tot_used);
-		comp_perc_count++;
-	}
-	if (to_with_hdr)
-		write_u32(fout, FILE_HDR_ID);
-	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-		__u32 used = buf.g_bytesused(j);
-		unsigned offset = buf.g_data_offset(j);
-		unsigned sz;
+	while (size) {
+		ssize_t ret = write(fd, p, size);
 
-		if (offset > used) {
-			// Should never happen
-			fprintf(stderr, "offset %d > used %d!\n",
-				offset, used);
-			offset = 0;
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EINVAL &&
+		    (fcntl(fd, F_GETFL) & O_DIRECT)) {
+			/* The size or the buffer is not aligned as O_DIRECT needs */
+			stderr_info("\nO_DIRECT not possible, using normal writes\n");
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+			continue;
 		}
-		used -= offset;
-		if (host_fd_to >= 0) {
-			write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
-			write_u32(fout, used);
-			write_u32(fout, comp_size[j]);
-			used = comp_size[j];
-		} else if (to_with_hdr) {
-			write_u32(fout, used);
+		if (ret <= 0) {
+			fprintf(stderr, "write error: %s\n", strerror(errno));
+			return false;
 		}
-		if (host_fd_to >= 0)
-			sz = fwrite(comp_ptr[j] + offset, 1, used, fout);
-		else if (codec_type != NOT_CODEC && support_cap_compose &&
-			 v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
-			read_write_padded_frame(fmt, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
-						fout, sz, used, used, false);
-		else
-			sz = fwrite(static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset, 1, used, fout);
-
-		if (sz != used)
-			fprintf(stderr, "%u != %u\n", sz, used);
+		p += ret;
+		size -= ret;
 	}
-	if (host_fd_to >= 0)
-		fflush(fout);
-#endif
+	return true;
 }
 
-static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
-			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
-			 bool ignore_count_skip)
-{
-	char ch = '<';
-	int ret;
-	cv4l_buffer buf(q);
+/*
+ * Writes frames to the --stream-to file on its own thread. The capture
+ * thread copies each frame into one of a fixed number of slots, so that
+ * the buffer can be queued again right away, and only waits when all slots
+ * are still waiting to be written.
+ */
+class stream_writer {
+public:
+	bool active(FILE *f) const { return fout && fout == f; }
 
-	for (;;) {
-		ret = fd.dqbuf(buf);
-		if (ret == EAGAIN)
-			return 0;
-		if (ret == EPIPE)
-			return QUEUE_STOPPED;
-		if (ret) {
-			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
-			return QUEUE_ERROR;
-		}
-		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
-			last_buffer = true;
-			break;
+	void start(FILE *f, unsigned count)
+	{
+		fout = f;
+		frames.resize(count);
+		head = pending = 0;
+		exit = false;
+		thread = std::thread(&stream_writer::run, this);
+	}
+
+	void stop()
+	{
+		if (!fout)
+			return;
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			exit = true;
 		}
-		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR))
-			break;
-		if (verbose)
-			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
-		if (fd.qbuf(buf))
-			return QUEUE_ERROR;
+		cond.notify_all();
+		thread.join();
+		fout = nullptr;
 	}
 
-	bool is_empty_frame = !buf.g_bytesused(0);
-	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
+	void write(cv4l_queue &q, cv4l_buffer &buf)
+	{
+		std::unique_lock<std::mutex> lk(lock);
 
-	double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
-	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+		while (pending == frames.size())
+			cond.wait(lk);
+		frame &f = frames[(head + pending) % frames.size()];
+		lk.unlock();
+
+		/* Only the writer thread touches the other slots */
+		f.num_planes = buf.g_num_planes();
+		for (unsigned j = 0; j < f.num_planes; j++) {
+			__u32 used = buf.g_bytesused(j);
+			unsigned offset = buf.g_data_offset(j);
+			u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j));
+
+			if (offset > used) {
+				// Should never happen
+				fprintf(stderr, "offset %d > used %d!\n",
+					offset, used);
+				offset = 0;
+			}
+			f.data[j].assign(p + offset, p + used);
+		}
+
+		lk.lock();
+		pending++;
+		cond.notify_all();
+	}
+
+private:
+	struct frame {
+		unsigned num_planes;
+		std::vector<u8> data[VIDEO_MAX_PLANES];
+	};
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lk(lock);
+
+		for (;;) {
+			while (!pending && !exit)
+				cond.wait(lk);
+			if (!pending)
+				break;
+			frame &f = frames[head];
+			lk.unlock();
+
+			if (to_with_hdr)
+				write_u32(fout, FILE_HDR_ID);
+			for (unsigned j = 0; j < f.num_planes; j++) {
+				unsigned used = f.data[j].size();
+				unsigned sz;
+
+				if (to_with_hdr) {
+					write_u32(fout, used);
+					sz = fwrite(f.data[j].data(), 1, used, fout);
+				} else {
+					sz = write_raw(fileno(fout), f.data[j].data(), used) ? used : 0;
+				}
+				if (sz != used)
+					fprintf(stderr, "%u != %u\n", sz, used);
+			}
+
+			lk.lock();
+			head = (head + 1) % frames.size();
+			pending--;
+			cond.notify_all();
+		}
+	}
+
+	FILE *fout = nullptr;
+	std::vector<frame> frames;
+	unsigned head = 0;
+	unsigned pending = 0;
+	bool exit = false;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::thread thread;
+};
+
+static stream_writer writer;
+
+/*
+ * Sends the frames to the --stream-to-host host or to a --stream-serve
+ * client on its own thread, so a slow host does not hold up the capture.
+ * The capture thread puts each v4l-stream packet in one of a fixed number
+ * of slots. The packets are shared, so the same packet can be queued for
+ * several clients. If all slots are in use, the oldest frames that are not
+ * being sent yet are dropped.
+ */
+class host_sender {
+public:
+	typedef std::shared_ptr<const std::vector<u8>> packet;
+
+	~host_sender() { stop(); }
+
+	bool active() const { return fd >= 0; }
+	unsigned dropped() const { return dropped_frames; }
+
+	/* Set if sending failed, all packets are discarded from then on */
+	bool failed()
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		return send_failed;
+	}
+
+	void start(int sock, unsigned count, bool owns_sock = false)
+	{
+		fd = sock;
+		close_fd = owns_sock;
+		packets.clear();
+		packets.resize(count);
+		head = pending = 0;
+		sending = send_failed = exit = false;
+		dropped_frames = 0;
+		thread = std::thread(&host_sender::run, this);
+	}
+
+	void stop()
+	{
+		if (fd < 0)
+			return;
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			exit = true;
+		}
+		cond.notify_all();
+		thread.join();
+		if (close_fd)
+			close(fd);
+		fd = -1;
+	}
+
+	/*
+	 * Make room for the next frame. Returns true if all queued frames
+	 * were dropped (just the oldest one unless all is set), after which
+	 * a FWHT stream has to continue with an I-frame.
+	 */
+	bool make_room(bool all)
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		unsigned first = sending ? 1 : 0;
+
+		if (pending < packets.size() || pending == first)
+			return false;
+		if (all) {
+			dropped_frames += pending - first;
+			while (pending > first)
+				packets[(head + --pending) % packets.size()].reset();
+			return true;
+		}
+		/* Move the oldest queued frame to the end, then forget it */
+		for (unsigned i = first; i < pending - 1; i++)
+			std::swap(packets[(head + i) % packets.size()],
+				  packets[(head + i + 1) % packets.size()]);
+		packets[(head + --pending) % packets.size()].reset();
+		dropped_frames++;
+		return false;
+	}
+
+	void send(const packet &pkt)
+	{
+		std::unique_lock<std::mutex> lk(lock);
+
+		/* Only if make_room() could not drop the frame being sent */
+		while (pending == packets.size())
+			cond.wait(lk);
+		packets[(head + pending) % packets.size()] = pkt;
+		pending++;
+		cond.notify_all();
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		int on = 1, off = 0;
+
+		for (;;) {
+			while (!pending && !exit)
+				cond.wait(lk);
+			if (!pending)
+				break;
+			packet pkt = packets[head];
+			bool failed = send_failed;
+
+			sending = true;
+			lk.unlock();
+
+			/* Send each frame in as few full size segments as possible */
+			if (!failed) {
+				setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+				failed = !write_raw(fd, pkt->data(), pkt->size());
+				setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+			}
+			pkt.reset();
+
+			lk.lock();
+			sending = false;
+			send_failed = failed;
+			packets[head].reset();
+			head = (head + 1) % packets.size();
+			pending--;
+			cond.notify_all();
+		}
+	}
+
+	int fd = -1;
+	bool close_fd = false;
+	std::vector<packet> packets;
+	unsigned head = 0;
+	unsigned pending = 0;
+	bool sending = false;
+	bool send_failed = false;
+	bool exit = false;
+	unsigned dropped_frames = 0;
+	std::mutex lock;
+	std::condition_variable cond;
+	std::thread thread;
+};
+
+static host_sender sender;
+
+/* The hosts connected to the --stream-serve port */
+static std::list<std::unique_ptr<host_sender>> serve_clients;
+static host_sender::packet serve_hdr;
+static unsigned serve_dropped;
+
+static void put_u32(std::vector<u8> &pkt, __u32 v)
+{
+	v = htonl(v);
+	pkt.insert(pkt.end(), reinterpret_cast<u8 *>(&v),
+		   reinterpret_cast<u8 *>(&v) + sizeof(v));
+}
+
+/* An empty packet buffer that none of the senders still refers to */
+static std::shared_ptr<std::vector<u8>> get_packet_buf()
+{
+	static std::vector<std::shared_ptr<std::vector<u8>>> pool;
+
+	for (auto &pkt : pool) {
+		if (pkt.use_count() == 1) {
+			pkt->clear();
+			return pkt;
+		}
+	}
+	pool.push_back(std::make_shared<std::vector<u8>>());
+	return pool.back();
+}
+
+/*
+ * Accept the hosts that connected to the --stream-serve port and forget
+ * the ones that went away. Returns true if a host connected, since that
+ * host can only start decoding a FWHT stream at an I-frame.
+ */
+static bool serve_update_clients()
+{
+	bool joined = false;
+	int sock;
+
+	for (auto it = serve_clients.begin(); it != serve_clients.end();) {
+		if ((*it)->failed()) {
+			serve_dropped += (*it)->dropped();
+			it = serve_clients.erase(it);
+			stderr_info("\nhost disconnected, %zu left\n", serve_clients.size());
+		} else {
+			++it;
+		}
+	}
+
+	while ((sock = accept(host_fd_serve, nullptr, nullptr)) >= 0) {
+		struct timeval tv = { 5, 0 };
+		int nodelay = 1;
+
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		/* The header always fits in the send buffer of a new connection */
+		if (!write_raw(sock, serve_hdr->data(), serve_hdr->size())) {
+			close(sock);
+			continue;
+		}
+		serve_clients.emplace_back(new host_sender);
+		serve_clients.back()->start(sock, stream_to_host_bufs ? stream_to_host_bufs : 4, true);
+		stderr_info("\nhost connected, %zu in total\n", serve_clients.size());
+		joined = true;
+	}
+	return joined;
+}
+
+/* Send the END packet to all --stream-serve hosts and disconnect them */
+static void serve_end_clients()
+{
+	std::shared_ptr<std::vector<u8>> pkt = get_packet_buf();
+
+	put_u32(*pkt, V4L_STREAM_PACKET_END);
+	for (auto &client : serve_clients) {
+		client->make_room(true);
+		client->send(pkt);
+		client->stop();
+		serve_dropped += client->dropped();
+	}
+	serve_clients.clear();
+}
+
+#ifndef NO_STREAM_TO
+static void write_buffer_to_host(cv4l_queue &q, cv4l_buffer &buf, FILE *fout)
+{
+	std::shared_ptr<std::vector<u8>> pkt;
+	unsigned comp_size[VIDEO_MAX_PLANES];
+	__u8 *comp_ptr[VIDEO_MAX_PLANES];
+	unsigned tot_comp_size = 0;
+	unsigned tot_used = 0;
+	bool iframe = false;
+	bool trace = tracer.active() && tracer.has_cur();
+	__u64 compress_ns = 0;
+
+	/* The P-frames after a dropped frame could not be decoded */
+	if (host_fd_serve >= 0) {
+		iframe = serve_update_clients();
+		if (serve_clients.empty())
+			return;
+		for (auto &client : serve_clients)
+			iframe |= client->make_room(ctx != nullptr);
+	} else if (sender.active()) {
+		iframe = sender.make_room(ctx != nullptr);
+	}
+	if (iframe && ctx)
+		ctx->state.gop_cnt = 0;
+
+	if (trace)
+		compress_ns = v4l_stream_trace_now();
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j));
+
+		if (offset > used) {
+			// Should never happen
+			fprintf(stderr, "offset %d > used %d!\n",
+				offset, used);
+			offset = 0;
+		}
+		p += offset;
+		if (ctx) {
+			comp_ptr[j] = fwht_compress(ctx, p,
+						    used - offset, &comp_size[j]);
+		} else {
+			comp_ptr[j] = p;
+			comp_size[j] = rle_compress(p, used - offset,
+						    bpl_cap[j]);
+		}
+		tot_comp_size += comp_size[j];
+		tot_used += used - offset;
+	}
+
+	if (trace)
+		v4l_stream_trace_add(&tracer.cur, V4L_STREAM_TRACE_COMPRESS,
+				     compress_ns, v4l_stream_trace_now());
+
+	pkt = get_packet_buf();
+	put_u32(*pkt, ctx ? V4L_STREAM_PACKET_FRAME_VIDEO_FWHT :
+		V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
+	put_u32(*pkt, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(buf.g_num_planes()) + tot_comp_size +
+		(trace ? V4L_STREAM_TRACE_SIZE : 0));
+	put_u32(*pkt, trace ? V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR_TRACE :
+		V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
+	put_u32(*pkt, buf.g_field());
+	put_u32(*pkt, buf.g_flags());
+	if (trace) {
+		__u32 words[V4L_STREAM_TRACE_SIZE / 4];
+
+		v4l_stream_trace_pack(&tracer.cur, words);
+		pkt->insert(pkt->end(), reinterpret_cast<u8 *>(words),
+			    reinterpret_cast<u8 *>(words) + sizeof(words));
+	}
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+
+		put_u32(*pkt, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
+		put_u32(*pkt, offset > used ? used : used - offset);
+		put_u32(*pkt, comp_size[j]);
+		pkt->insert(pkt->end(), comp_ptr[j], comp_ptr[j] + comp_size[j]);
+	}
+	comp_perc += (tot_comp_size * 100 / tot_used);
+	comp_perc_count++;
+
+	if (host_fd_serve >= 0) {
+		for (auto &client : serve_clients)
+			client->send(pkt);
+		return;
+	}
+	if (sender.active()) {
+		sender.send(pkt);
+		return;
+	}
+
+	int on = 1, off = 0;
+
+	setsockopt(host_fd_to, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+	if (fwrite(pkt->data(), 1, pkt->size(), fout) != pkt->size())
+		fprintf(stderr, "could not send frame\n");
+	fflush(fout);
+	setsockopt(host_fd_to, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+}
+#endif
+
+/*
+ * --stream-crc: prints '<frame>: <crc plane 0> [<crc plane 1>...]' for
+ * each frame, or with --stream-crc-check, checks that the CRCs are one of
+ * the lines of the --stream-crc-check file.
+ */
+static void stream_crc_frame(cv4l_queue &q, cv4l_buffer &buf, cv4l_fmt &fmt,
+			     unsigned frame)
+{
+	char crcs[VIDEO_MAX_PLANES * 9 + 1] = "";
+
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j));
+		unsigned offset = buf.g_data_offset(j);
+		unsigned used = buf.g_bytesused(j);
+		unsigned bpl = fmt.g_bytesperline(j);
+
+		if (offset > used)
+			offset = 0;
+		p += offset;
+		used -= offset;
+		if (crc_lines && bpl && fmt.g_height()) {
+			/* Planes of subsampled formats have fewer lines */
+			unsigned lines = used / bpl;
+			unsigned first = crc_first_line * lines / fmt.g_height();
+			unsigned count = crc_lines * lines / fmt.g_height();
+
+			first = std::min(first, lines);
+			count = std::min(count, lines - first);
+			p += first * bpl;
+			used = count * bpl;
+		}
+		sprintf(crcs + strlen(crcs), "%s%08x", j ? " " : "",
+			crc32c(0, p, used));
+	}
+	crc_frames++;
+	if (crc_expected.empty()) {
+		fprintf(file_to && !strcmp(file_to, "-") ? stderr : stdout,
+			"%u: %s\n", frame, crcs);
+		return;
+	}
+	if (crc_expected.find(crcs) != crc_expected.end())
+		return;
+	crc_mismatches++;
+	stderr_info("\nframe %u: unexpected CRC %s\n", frame, crcs);
+}
+
+static void stream_crc_report()
+{
+	if (crc_expected.empty())
+		return;
+	stderr_info("\nCRC check: %u of %u frames did not match\n",
+		    crc_mismatches, crc_frames);
+}
+
+/*
+ * --stream-to-shm: copies each captured frame into the next slot of a ring
+ * in a POSIX shared memory object, from where any number of processes can
+ * use it in place. The protocol is described in v4l-stream.h.
+ */
+class shm_publisher {
+public:
+	bool active() const { return hdr; }
+
+	bool start(const char *name, unsigned slots, cv4l_queue &q, cv4l_fmt &fmt)
+	{
+		unsigned page = sysconf(_SC_PAGESIZE);
+		unsigned slot_hdr = (sizeof(v4l_shm_slot) + 63) & ~63U;
+		unsigned slot_offset = (sizeof(v4l_shm_header) + page - 1) & ~(page - 1);
+		unsigned slot_size = slot_hdr;
+
+		for (unsigned j = 0; j < q.g_num_planes(); j++)
+			slot_size += (q.g_length(j) + 63) & ~63U;
+		slot_size = (slot_size + page - 1) & ~(page - 1);
+
+		shm_name = name[0] == '/' ? name : std::string("/") + name;
+		size = slot_offset + static_cast<size_t>(slots) * slot_size;
+		shm_unlink(shm_name.c_str());
+
+		int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+		if (fd < 0) {
+			fprintf(stderr, "could not create shared memory object %s: %s\n",
+				shm_name.c_str(), strerror(errno));
+			return false;
+		}
+		if (ftruncate(fd, size)) {
+			fprintf(stderr, "could not size shared memory object %s: %s\n",
+				shm_name.c_str(), strerror(errno));
+			close(fd);
+			shm_unlink(shm_name.c_str());
+			return false;
+		}
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		close(fd);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "could not map shared memory object %s: %s\n",
+				shm_name.c_str(), strerror(errno));
+			shm_unlink(shm_name.c_str());
+			return false;
+		}
+		hdr = static_cast<v4l_shm_header *>(p);
+		hdr->version = V4L_SHM_VERSION;
+		hdr->slots = slots;
+		hdr->slot_offset = slot_offset;
+		hdr->slot_size = slot_size;
+		hdr->pixelformat = fmt.g_pixelformat();
+		hdr->width = fmt.g_width();
+		hdr->height = fmt.g_height();
+		hdr->field = fmt.g_field();
+		hdr->colorspace = fmt.g_colorspace();
+		hdr->ycbcr_enc = fmt.g_ycbcr_enc();
+		hdr->quantization = fmt.g_quantization();
+		hdr->xfer_func = fmt.g_xfer_func();
+		hdr->num_planes = q.g_num_planes();
+		for (unsigned j = 0; j < q.g_num_planes(); j++) {
+			hdr->sizeimage[j] = fmt.g_sizeimage(j);
+			hdr->bytesperline[j] = fmt.g_bytesperline(j);
+		}
+		for (unsigned i = 0; i < slots; i++) {
+			v4l_shm_slot *slot = get_slot(i);
+			unsigned offset = slot_hdr;
+
+			for (unsigned j = 0; j < q.g_num_planes(); j++) {
+				slot->offset[j] = offset;
+				offset += (q.g_length(j) + 63) & ~63U;
+			}
+		}
+		/* Readers may only look at the header once the magic is set */
+		__atomic_store_n(&hdr->magic, V4L_SHM_MAGIC, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	void stop()
+	{
+		if (!hdr)
+			return;
+		__atomic_store_n(&hdr->magic, 0, __ATOMIC_RELEASE);
+		munmap(hdr, size);
+		shm_unlink(shm_name.c_str());
+		hdr = nullptr;
+	}
+
+	void publish(cv4l_queue &q, cv4l_buffer &buf)
+	{
+		__u64 n = hdr->head;
+		v4l_shm_slot *slot = get_slot(n % hdr->slots);
+		u8 *base = reinterpret_cast<u8 *>(slot);
+
+		__atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+		/* The seq store must be visible before any of the data stores */
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		slot->timestamp_ns = buf.g_timestamp().tv_sec * 1000000000ULL +
+				     buf.g_timestamp().tv_usec * 1000ULL;
+		slot->sequence = buf.g_sequence();
+		slot->field = buf.g_field();
+		slot->flags = buf.g_flags();
+		slot->num_planes = buf.g_num_planes();
+		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+			unsigned offset = buf.g_data_offset(j);
+			unsigned used = buf.g_bytesused(j);
+
+			if (offset > used)
+				offset = 0;
+			used -= offset;
+			slot->bytesused[j] = used;
+			memcpy(base + slot->offset[j],
+			       static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
+			       used);
+		}
+		__atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+		__atomic_store_n(&hdr->head, n + 1, __ATOMIC_RELEASE);
+	}
+
+private:
+	v4l_shm_slot *get_slot(unsigned i)
+	{
+		return reinterpret_cast<v4l_shm_slot *>(reinterpret_cast<u8 *>(hdr) +
+			hdr->slot_offset + static_cast<size_t>(i) * hdr->slot_size);
+	}
+
+	v4l_shm_header *hdr = nullptr;
+	size_t size = 0;
+	std::string shm_name;
+};
+
+static shm_publisher shm_out;
+
+static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
+				 cv4l_fmt &fmt, FILE *fout)
+{
+#ifndef NO_STREAM_TO
+	if (sdr_stream_active()) {
+		sdr_stream_write(q, buf);
+		return;
+	}
+	if (vbi_slice_active()) {
+		vbi_slice_write(q, buf, fout);
+		return;
+	}
+	if (meta_export_active()) {
+		meta_export(buf, fmt, q);
+		return;
+	}
+	if (writer.active(fout)) {
+		writer.write(q, buf);
+		return;
+	}
+	if (host_fd_to >= 0 || host_fd_serve >= 0) {
+		write_buffer_to_host(q, buf, fout);
+		return;
+	}
+
+	if (to_with_hdr)
+		write_u32(fout, FILE_HDR_ID);
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		unsigned sz;
+
+		if (offset > used) {
+			// Should never happen
+			fprintf(stderr, "offset %d > used %d!\n",
+				offset, used);
+			offset = 0;
+		}
+		used -= offset;
+		if (to_with_hdr)
+			write_u32(fout, used);
+		if (codec_type != NOT_CODEC && support_cap_compose &&
+			 v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
+			read_write_padded_frame(fmt, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
+						fout, sz, used, used, false);
+		else if (!to_with_hdr)
+			sz = write_raw(fileno(fout), static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
+				       used) ? used : 0;
+		else
+			sz = fwrite(static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset, 1, used, fout);
+
+		if (sz != used)
+			fprintf(stderr, "%u != %u\n", sz, used);
+	}
+#endif
+}
+
+static __u64 rt_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stream_rt_setup()
+{
+	struct sched_param param = {};
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+		fprintf(stderr, "--stream-realtime: mlockall: %s\n", strerror(errno));
+	if (stream_rt.cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(stream_rt.cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus))
+			fprintf(stderr, "--stream-realtime: sched_setaffinity: %s\n", strerror(errno));
+	}
+	param.sched_priority = stream_rt.prio;
+	if (sched_setscheduler(0, SCHED_FIFO, &param))
+		fprintf(stderr, "--stream-realtime: sched_setscheduler: %s\n", strerror(errno));
+	stream_rt.latencies.reserve(4096);
+	stream_rt.start_ns = rt_now_ns();
+}
+
+/* Called for each dequeued buffer */
+static void stream_rt_dequeued(const cv4l_buffer &buf)
+{
+	__u64 now = rt_now_ns();
+
+	if (stream_rt.last_ns) {
+		__u64 d = now - stream_rt.last_ns;
+
+		stream_rt.interval_ns = stream_rt.interval_ns ?
+			(stream_rt.interval_ns * 7 + d) / 8 : d;
+	}
+	stream_rt.last_ns = now;
+
+	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+	    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return;
+
+	__u64 ts = buf.g_timestamp().tv_sec * 1000000000ULL +
+		   buf.g_timestamp().tv_usec * 1000ULL;
+
+	if (now >= ts)
+		stream_rt.latencies.push_back(now - ts);
+}
+
+static void stream_rt_report()
+{
+	std::vector<__u64> &v = stream_rt.latencies;
+	__u64 elapsed = rt_now_ns() - stream_rt.start_ns;
+
+	if (v.empty()) {
+		fprintf(stderr, "Realtime: no buffers with monotonic timestamps\n");
+		return;
+	}
+	std::sort(v.begin(), v.end());
+
+	auto perc = [&v](unsigned p) {
+		return v[std::min<size_t>(v.size() - 1, v.size() * p / 100)] / 1000.0;
+	};
+
+	fprintf(stderr, "Realtime: timestamp to DQBUF p50/p90/p99/max %.1f/%.1f/%.1f/%.1f us, "
+		"busy-polling %.1f%% of the time, budget exceeded %u times\n",
+		perc(50), perc(90), perc(99), v.back() / 1000.0,
+		elapsed ? 100.0 * stream_rt.spin_ns / elapsed : 0.0,
+		stream_rt.blocked);
+}
+
+/*
+ * --stream-grow-bufs: buffers are added when the driver dropped frames, or
+ * when it has no buffer left queued besides the one being handled. A buffer
+ * is removed again when the driver always had at least two buffers queued
+ * during GROW_WINDOW frames, so one less would still have been enough.
+ */
+static void stream_grow_start(cv4l_fd &fd, cv4l_queue &q)
+{
+	stream_grow.active = false;
+	if (!stream_grow.max)
+		return;
+	if (q.g_memory() == V4L2_MEMORY_DMABUF || !q.has_create_bufs(&fd)) {
+		stderr_info("--stream-grow-bufs: VIDIOC_CREATE_BUFS is not available, keeping %u buffers\n",
+			    q.g_buffers());
+		return;
+	}
+	if (stream_grow.max > q.g_max_num_buffers())
+		stream_grow.max = q.g_max_num_buffers();
+	stream_grow.active = true;
+	stream_grow.min = q.g_buffers();
+	stream_grow.has_seq = false;
+	stream_grow.frames = 0;
+	stream_grow.min_queued = UINT_MAX;
+	stream_grow.shrink = false;
+	stream_grow.buffers = q.g_buffers();
+	if (stream_grow.peak < stream_grow.buffers)
+		stream_grow.peak = stream_grow.buffers;
+}
+
+static int stream_grow_add(cv4l_fd &fd, cv4l_queue &q, unsigned count)
+{
+	unsigned from = q.g_buffers();
+	cv4l_buffer buf;
+
+	stream_grow.shrink = false;
+	stream_grow.frames = 0;
+	stream_grow.min_queued = UINT_MAX;
+	if (from + count > stream_grow.max)
+		count = stream_grow.max - from;
+	if (!count)
+		return 0;
+
+	if (q.create_bufs(&fd, count)) {
+		stderr_info("--stream-grow-bufs: VIDIOC_CREATE_BUFS failed: %s\n",
+			    strerror(errno));
+		stream_grow.active = false;
+		return 0;
+	}
+	if (q.obtain_bufs(&fd, from))
+		return QUEUE_ERROR;
+	for (unsigned i = from; i < q.g_buffers(); i++) {
+		buf.init(q, i);
+		if (fd.qbuf(buf))
+			return QUEUE_ERROR;
+		if (options[OptStreamBench])
+			bench.queued(i);
+	}
+
+	stream_grow.grown++;
+	stream_grow.buffers = q.g_buffers();
+	if (stream_grow.peak < stream_grow.buffers)
+		stream_grow.peak = stream_grow.buffers;
+	if (verbose)
+		stderr_info("--stream-grow-bufs: %u buffers\n", q.g_buffers());
+	return 0;
+}
+
+/*
+ * Called for each dequeued buffer before it is queued again. Returns 1 if
+ * the buffer was removed instead, so it must not be queued.
+ */
+static int stream_grow_update(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf)
+{
+	unsigned last = q.g_buffers() - 1;
+	unsigned queued = 0;
+	unsigned dropped = 0;
+	__u32 seq = buf.g_sequence();
+
+	{
+		cv4l_disable_trace dt(fd);
+
+		for (unsigned i = 0; i < q.g_buffers(); i++) {
+			cv4l_buffer qbuf(q);
+
+			if (i != buf.g_index() && !fd.querybuf(qbuf, i) &&
+			    (qbuf.g_flags() & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE)) ==
+			    V4L2_BUF_FLAG_QUEUED)
+				queued++;
+		}
+	}
+
+	/* The sequence restarts after STREAMOFF/ON, so only look forward */
+	if (stream_grow.has_seq && (__s32)(seq - stream_grow.last_seq) > 1)
+		dropped = seq - stream_grow.last_seq - 1;
+	stream_grow.last_seq = seq;
+	stream_grow.has_seq = true;
+
+	if (dropped || !queued)
+		return stream_grow_add(fd, q, dropped ? dropped : 1);
+
+	if (queued < stream_grow.min_queued)
+		stream_grow.min_queued = queued;
+
+	if (stream_grow.shrink && buf.g_index() == last) {
+		if (q.release_bufs(&fd, last) || q.remove_bufs(&fd, last, 1)) {
+			stderr_info("--stream-grow-bufs: VIDIOC_REMOVE_BUFS failed: %s\n",
+				    strerror(errno));
+			return QUEUE_ERROR;
+		}
+		stream_grow.shrink = false;
+		stream_grow.frames = 0;
+		stream_grow.min_queued = UINT_MAX;
+		stream_grow.shrunk++;
+		stream_grow.buffers = q.g_buffers();
+		if (verbose)
+			stderr_info("--stream-grow-bufs: %u buffers\n", q.g_buffers());
+		return 1;
+	}
+
+	if (!stream_grow.shrink && ++stream_grow.frames >= GROW_WINDOW) {
+		stream_grow.shrink = q.g_buffers() > stream_grow.min &&
+			stream_grow.min_queued >= 2 &&
+			(q.g_capabilities() & V4L2_BUF_CAP_SUPPORTS_REMOVE_BUFS);
+		stream_grow.frames = 0;
+		stream_grow.min_queued = UINT_MAX;
+	}
+	return 0;
+}
+
+static void stream_grow_report()
+{
+	stderr_info("--stream-grow-bufs: added buffers %u times, removed %u, "
+		    "at most %u buffers, %u at the end\n",
+		    stream_grow.grown, stream_grow.shrunk,
+		    stream_grow.peak, stream_grow.buffers);
+}
+
+static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
+			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
+			 bool ignore_count_skip, cv4l_buffer *dq_buf = nullptr)
+{
+	char ch = '<';
+	int ret;
+	cv4l_buffer buf(q);
+
+	for (;;) {
+		ret = fd.dqbuf(buf);
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
+		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
+			last_buffer = true;
+			break;
+		}
+		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR))
+			break;
+		if (verbose)
+			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+		if (fd.qbuf(buf))
+			return QUEUE_ERROR;
+	}
 
-	if (fout && (!stream_skip || ignore_count_skip) &&
+	if (options[OptStreamRealtime])
+		stream_rt_dequeued(buf);
+
+	bool is_empty_frame = !buf.g_bytesused(0);
+	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
+
+	double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+	if (options[OptStreamBench])
+		bench.dequeued(buf);
+	if (options[OptStreamM2MBench])
+		m2m_bench.dequeued(buf);
+	if (tracer.active() && !is_empty_frame && !is_error_frame)
+		tracer.dequeued(fd, buf);
+
+	if ((fout || host_fd_serve >= 0 || sdr_stream_active() ||
+	     meta_export_active()) &&
+	    (!stream_skip || ignore_count_skip) &&
 	    !is_empty_frame && !is_error_frame)
 		write_buffer_to_file(fd, q, buf, fmt, fout);
+	if (shm_out.active() && (!stream_skip || ignore_count_skip) &&
+	    !is_empty_frame && !is_error_frame)
+		shm_out.publish(q, buf);
+	if (options[OptStreamCrc] && (!stream_skip || ignore_count_skip) &&
+	    !is_empty_frame && !is_error_frame)
+		stream_crc_frame(q, buf, fmt, buf.g_sequence());
 
 	if (buf.g_flags() & V4L2_BUF_FLAG_KEYFRAME)
 		ch = 'K';
@@ -1523,20 +3750,29 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 		ch = 'B';
 	if (verbose) {
 		print_concise_buffer(stderr, buf, fmt, q, fps_ts,
-				     host_fd_to >= 0 ? 100 - comp_perc / comp_perc_count : -1);
+				     comp_perc_count ? 100 - comp_perc / comp_perc_count : -1);
 		comp_perc_count = comp_perc = 0;
 	}
-	if (!last_buffer && index == nullptr) {
+	if (dq_buf)
+		*dq_buf = buf;
+	if (!last_buffer && index == nullptr && dq_buf == nullptr) {
+		int removed = stream_grow.active ?
+			stream_grow_update(fd, q, buf) : 0;
+
+		if (removed < 0)
+			return removed;
 		/*
 		 * EINVAL in qbuf can happen if this is the last buffer before
 		 * a dynamic resolution change sequence. In this case the buffer
 		 * has the size that fits the old resolution and might not
 		 * fit to the new one.
 		 */
-		if (fd.qbuf(buf) && errno != EINVAL) {
+		if (!removed && fd.qbuf(buf) && errno != EINVAL) {
 			fprintf(stderr, "%s: qbuf error\n", __func__);
 			return QUEUE_ERROR;
 		}
+		if (!removed && options[OptStreamBench])
+			bench.queued(buf.g_index());
 	}
 	if (index)
 		*index = buf.g_index();
@@ -1551,7 +3787,7 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 			stderr_info(" %.02f fps", fps_ts.fps());
 			if (dropped)
 				stderr_info(", dropped buffers: %u", dropped);
-			if (host_fd_to >= 0)
+			if (comp_perc_count)
 				stderr_info(" %d%% compression", 100 - comp_perc / comp_perc_count);
 			comp_perc_count = comp_perc = 0;
 			stderr_info("\n");
@@ -1585,6 +3821,46 @@ static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
 	return 0;
 }
 
+/*
+ * Dequeue all buffers that are ready and only then queue them back, this
+ * saves a select() per buffer at high frame rates. Requires a non-blocking fd.
+ */
+static int do_handle_cap_batch(cv4l_fd &fd, cv4l_queue &q, FILE *fout,
+			       unsigned &count, fps_timestamps &fps_ts,
+			       cv4l_fmt &fmt)
+{
+	cv4l_buffer bufs[VIDEO_MAX_FRAME];
+	unsigned num_bufs = 0;
+	int ret = 0;
+
+	while (num_bufs < q.g_buffers() && num_bufs < VIDEO_MAX_FRAME) {
+		int index = -1;
+
+		ret = do_handle_cap(fd, q, fout, &index, count, fps_ts, fmt,
+				    false, &bufs[num_bufs]);
+		if (index < 0)
+			break;
+		num_bufs++;
+		if (ret)
+			break;
+	}
+
+	/* The buffers are queued again by the restart after a STREAMOFF */
+	if (ret || last_buffer)
+		return ret;
+
+	for (unsigned i = 0; i < num_bufs; i++) {
+		/* See do_handle_cap() for why EINVAL is fine */
+		if (fd.qbuf(bufs[i]) && errno != EINVAL) {
+			fprintf(stderr, "%s: qbuf error\n", __func__);
+			return QUEUE_ERROR;
+		}
+		if (options[OptStreamBench])
+			bench.queued(bufs[i].g_index());
+	}
+	return 0;
+}
+
 static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap,
 			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt fmt,
 			 bool stopped, bool ignore_count_skip)
@@ -1639,6 +3915,8 @@ static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap
 		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(ret));
 		return QUEUE_ERROR;
 	}
+	if (!cap && tracer.active())
+		tracer.out_dequeued(fd, buf);
 	if (fps_ts.has_fps()) {
 		unsigned dropped = fps_ts.dropped();
 
@@ -1662,13 +3940,12 @@ static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap
 	if (fin && !fill_buffer_from_file(fd, q, buf, fmt, fin))
 		return QUEUE_STOPPED;
 
-	if (!fin && stream_out_refresh) {
-		for (unsigned j = 0; j < buf.g_num_planes(); j++)
-			tpg_fillbuffer(&tpg, stream_out_std, j,
-				       static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)));
-	}
+	if (!fin && (stream_out_refresh || (stream_out_field_cache && !cap)))
+		fill_out_pattern(q, buf.g_index(), buf.g_field());
 	if (is_meta)
 		meta_fillbuffer(buf, fmt, q);
+	if (options[OptStreamCrc] && !cap)
+		stream_crc_frame(q, buf, fmt, crc_frames);
 
 	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
 		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_REINIT, NULL)) {
@@ -1691,6 +3968,10 @@ static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap
 		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
 		return QUEUE_ERROR;
 	}
+	if (options[OptStreamM2MBench])
+		m2m_bench.queued(buf);
+	if (tracer.active())
+		tracer.queued(fd, buf, cap != nullptr);
 	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
 		if (!set_fwht_req_by_fd(&last_fwht_hdr, buf.g_request_fd(), last_fwht_bf_ts,
 					buf.g_timestamp_ns())) {
@@ -1749,6 +4030,8 @@ static int do_handle_out_to_in(cv4l_fd &out_fd, cv4l_fd &fd, cv4l_queue &out, cv
 		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
 		return QUEUE_ERROR;
 	}
+	if (tracer.active())
+		tracer.out_dequeued(out_fd, buf);
 	buf.init(in, buf.g_index());
 	ret = fd.querybuf(buf);
 	if (ret == 0)
@@ -1760,32 +4043,118 @@ static int do_handle_out_to_in(cv4l_fd &out_fd, cv4l_fd &fd, cv4l_queue &out, cv
 	return 0;
 }
 
+#ifndef NO_STREAM_TO
+/*
+ * The v4l-stream header that starts the stream to a host. This also sets up
+ * the compression of the frames for the current format.
+ */
+static host_sender::packet build_stream_hdr(cv4l_fd &fd)
+{
+	std::shared_ptr<std::vector<u8>> hdr = std::make_shared<std::vector<u8>>();
+	struct v4l2_fract aspect;
+	unsigned width, height;
+	cv4l_fmt cfmt;
+
+	fd.g_fmt(cfmt);
+
+	aspect = fd.g_pixel_aspect(width, height);
+	put_u32(*hdr, V4L_STREAM_ID);
+	put_u32(*hdr, V4L_STREAM_VERSION);
+	put_u32(*hdr, V4L_STREAM_PACKET_FMT_VIDEO);
+	put_u32(*hdr, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
+	put_u32(*hdr, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT);
+	put_u32(*hdr, cfmt.g_num_planes());
+	put_u32(*hdr, cfmt.g_pixelformat());
+	put_u32(*hdr, cfmt.g_width());
+	put_u32(*hdr, cfmt.g_height());
+	put_u32(*hdr, cfmt.g_field());
+	put_u32(*hdr, cfmt.g_colorspace());
+	put_u32(*hdr, cfmt.g_ycbcr_enc());
+	put_u32(*hdr, cfmt.g_quantization());
+	put_u32(*hdr, cfmt.g_xfer_func());
+	put_u32(*hdr, cfmt.g_flags());
+	put_u32(*hdr, aspect.numerator);
+	put_u32(*hdr, aspect.denominator);
+	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
+		put_u32(*hdr, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE);
+		put_u32(*hdr, cfmt.g_sizeimage(i));
+		put_u32(*hdr, cfmt.g_bytesperline(i));
+		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
+	}
+	if (!host_lossless) {
+		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
+		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
+
+		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
+				 cfmt.g_width(), cfmt.g_height(),
+				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
+				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+	}
+	return hdr;
+}
+
+/* The --stream-serve socket, the hosts are accepted while streaming */
+static int open_serve_socket()
+{
+	struct sockaddr_in serv_addr = {};
+	int sock;
+	int val = 1;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0) {
+		fprintf(stderr, "could not opening socket\n");
+		std::exit(EXIT_FAILURE);
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = INADDR_ANY;
+	serv_addr.sin_port = htons(host_port_serve);
+	if (bind(sock, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
+		fprintf(stderr, "could not bind: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	listen(sock, 16);
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+	/* A host that goes away must not take v4l2-ctl down with it */
+	signal(SIGPIPE, SIG_IGN);
+	return sock;
+}
+#endif
+
 static FILE *open_output_file(cv4l_fd &fd)
 {
 	FILE *fout = nullptr;
 
 #ifndef NO_STREAM_TO
 	if (file_to) {
-		if (!strcmp(file_to, "-"))
+		if (!strcmp(file_to, "-")) {
+			/* The frames may be written without going through stdio */
+			fflush(stdout);
 			return stdout;
+		}
 		fout = fopen(file_to, "w+");
 		if (!fout)
 			fprintf(stderr, "could not open %s for writing\n", file_to);
+		else if (stream_to_direct && !to_with_hdr &&
+			 fcntl(fileno(fout), F_SETFL,
+			       fcntl(fileno(fout), F_GETFL) | O_DIRECT))
+			fprintf(stderr, "O_DIRECT not supported for %s\n", file_to);
 		return fout;
 	}
+	if (host_serve) {
+		/* Kept open when the format changes, unlike the hosts */
+		if (host_fd_serve < 0)
+			host_fd_serve = open_serve_socket();
+		serve_hdr = build_stream_hdr(fd);
+		return nullptr;
+	}
 	if (!host_to)
 		return nullptr;
 
 	char *p = std::strchr(host_to, ':');
 	struct sockaddr_in serv_addr;
 	struct hostent *server;
-	struct v4l2_fract aspect;
-	unsigned width, height;
-	cv4l_fmt cfmt;
 
-	fd.g_fmt(cfmt);
-
-	aspect = fd.g_pixel_aspect(width, height);
 	if (p) {
 		host_port_to = strtoul(p + 1, nullptr, 0);
 		*p = '\0';
@@ -1810,51 +4179,84 @@ static FILE *open_output_file(cv4l_fd &fd)
 		fprintf(stderr, "could not connect\n");
 		std::exit(EXIT_SUCCESS);
 	}
+	/* Frames are sent as a whole, so do not wait for more data after that */
+	int nodelay = 1;
+
+	setsockopt(host_fd_to, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 	fout = fdopen(host_fd_to, "a");
-	write_u32(fout, V4L_STREAM_ID);
-	write_u32(fout, V4L_STREAM_VERSION);
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO);
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT);
-	write_u32(fout, cfmt.g_num_planes());
-	write_u32(fout, cfmt.g_pixelformat());
-	write_u32(fout, cfmt.g_width());
-	write_u32(fout, cfmt.g_height());
-	write_u32(fout, cfmt.g_field());
-	write_u32(fout, cfmt.g_colorspace());
-	write_u32(fout, cfmt.g_ycbcr_enc());
-	write_u32(fout, cfmt.g_quantization());
-	write_u32(fout, cfmt.g_xfer_func());
-	write_u32(fout, cfmt.g_flags());
-	write_u32(fout, aspect.numerator);
-	write_u32(fout, aspect.denominator);
-	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
-		write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE);
-		write_u32(fout, cfmt.g_sizeimage(i));
-		write_u32(fout, cfmt.g_bytesperline(i));
-		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
-	}
-	if (!host_lossless) {
-		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
-		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
 
-		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
-				 cfmt.g_width(), cfmt.g_height(),
-				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
-				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
-	}
+	host_sender::packet hdr = build_stream_hdr(fd);
+
+	if (fwrite(hdr->data(), 1, hdr->size(), fout) != hdr->size())
+		fprintf(stderr, "could not send header\n");
 	fflush(fout);
 #endif
 	return fout;
 }
 
+/*
+ * --stream-realtime: sleep until shortly before the next frame is expected,
+ * then busy-poll VIDIOC_DQBUF on the non-blocking fd. Once the budget is
+ * used up (or as long as the frame interval isn't known), block in poll().
+ */
+static int stream_rt_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout,
+				unsigned &count, fps_timestamps &fps_ts,
+				cv4l_fmt &fmt)
+{
+	__u64 window = stream_rt.interval_ns * stream_rt.budget / 200;
+	__u64 last = stream_rt.last_ns;
+	__u64 expected = last + stream_rt.interval_ns;
+
+	if (stream_rt.interval_ns && expected > window &&
+	    rt_now_ns() < expected - window) {
+		struct timespec ts = {
+			static_cast<time_t>((expected - window) / 1000000000ULL),
+			static_cast<long>((expected - window) % 1000000000ULL)
+		};
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+	}
+
+	__u64 spin_start = rt_now_ns();
+
+	for (;;) {
+		int r = do_handle_cap(fd, q, fout, nullptr, count, fps_ts, fmt, false);
+		__u64 now = rt_now_ns();
+
+		if (r || stream_rt.last_ns != last) {
+			stream_rt.spin_ns += now - spin_start;
+			return r;
+		}
+		if (stream_rt.interval_ns && now <= expected + window)
+			continue;
+
+		struct pollfd pfd = { fd.g_fd(), POLLIN | POLLPRI, 0 };
+
+		stream_rt.spin_ns += now - spin_start;
+		if (stream_rt.interval_ns)
+			stream_rt.blocked++;
+		if (poll(&pfd, 1, 2000) < 0 && errno != EINTR) {
+			stderr_info("poll error: %s\n", strerror(errno));
+			return QUEUE_ERROR;
+		}
+		/* Let the caller dequeue the event */
+		if (pfd.revents & POLLPRI)
+			return 0;
+		spin_start = rt_now_ns();
+		/* Don't count this as being out of budget again */
+		expected = spin_start;
+		window = stream_rt.interval_ns;
+	}
+}
+
 static void streaming_set_cap(cv4l_fd &fd, cv4l_fd &exp_fd)
 {
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
 	cv4l_queue q(fd.g_type(), memory);
 	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
 	fps_timestamps fps_ts;
-	bool use_poll = options[OptStreamPoll];
+	bool use_batch = options[OptStreamBatch];
+	bool use_poll = options[OptStreamPoll] || use_batch;
 	unsigned count;
 	bool eos;
 	bool source_change;
@@ -1872,13 +4274,17 @@ static void streaming_set_cap(cv4l_fd &fd, cv4l_fd &exp_fd)
 		fprintf(stderr, "--stream-dmabuf can only work in combination with --export-device\n");
 		return;
 	}
+	if (options[OptStreamRealtime] && use_poll) {
+		fprintf(stderr, "--stream-realtime can't be combined with --stream-poll or --stream-batch\n");
+		return;
+	}
 	switch (q.g_type()) {
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
 		break;
 	default:
-		if (host_to) {
-			fprintf(stderr, "--stream-to-host is not supported for non-video streams\n");
+		if (host_to || host_serve) {
+			fprintf(stderr, "--stream-to-host and --stream-serve are not supported for non-video streams\n");
 			return;
 		}
 		break;
@@ -1913,6 +4319,20 @@ recover:
 	}
 
 	fout = open_output_file(fd);
+	/* The padded frames of codecs are still written by this thread */
+	if (fout && stream_to_bufs && host_fd_to < 0 &&
+	    (codec_type == NOT_CODEC || !support_cap_compose))
+		writer.start(fout, stream_to_bufs);
+	if (fout && stream_to_host_bufs && host_fd_to >= 0)
+		sender.start(host_fd_to, stream_to_host_bufs);
+#ifndef NO_STREAM_TO
+	if (q.g_type() == V4L2_BUF_TYPE_SDR_CAPTURE && sdr_stream_start(fd))
+		goto done;
+	if (q.g_type() == V4L2_BUF_TYPE_VBI_CAPTURE && vbi_slice_start(fd))
+		goto done;
+	if (q.g_type() == V4L2_BUF_TYPE_META_CAPTURE && meta_export_start())
+		goto done;
+#endif
 
 	if (q.reqbufs(&fd, reqbufs_count_cap)) {
 		if (q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE ||
@@ -1934,8 +4354,14 @@ recover:
 	if (q.obtain_bufs(&fd))
 		goto done;
 
+	if (!use_batch)
+		stream_grow_start(fd, q);
+
 	fd.g_fmt(fmt);
 
+	if (shm_to && !shm_out.start(shm_to, shm_to_slots, q, fmt))
+		goto done;
+
 restart:
 	if (q.queue_all(&fd))
 		goto done;
@@ -1945,13 +4371,16 @@ restart:
 	if (fd.streamon())
 		goto done;
 
+	if (options[OptStreamBench])
+		bench.start(fd, fmt);
+
 	fd.s_trace(0);
 	exp_fd.s_trace(0);
 
 	if (stream_sleep_count == 0)
 		do_sleep();
 
-	if (use_poll)
+	if (use_poll || options[OptStreamRealtime])
 		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
 
 	while (!eos && !source_change) {
@@ -2001,8 +4430,16 @@ restart:
 		}
 
 		if (FD_ISSET(fd.g_fd(), &read_fds)) {
-			r = do_handle_cap(fd, q, fout, nullptr,
-					  count, fps_ts, fmt, false);
+			fps_ts.add_wakeup();
+			if (use_batch)
+				r = do_handle_cap_batch(fd, q, fout, count,
+							fps_ts, fmt);
+			else if (options[OptStreamRealtime])
+				r = stream_rt_handle_cap(fd, q, fout, count,
+							 fps_ts, fmt);
+			else
+				r = do_handle_cap(fd, q, fout, nullptr,
+						  count, fps_ts, fmt, false);
 			if (r == QUEUE_OFF_ON) {
 				fd.streamoff();
 				fps_ts.reset();
@@ -2021,10 +4458,41 @@ restart:
 
 	q.free(&fd);
 	tpg_free(&tpg);
-	if (source_change && !stream_no_query)
+	shm_out.stop();
+	if (source_change && !stream_no_query) {
+		writer.stop();
+		sender.stop();
+		serve_end_clients();
 		goto recover;
+	}
 
 done:
+	writer.stop();
+	sender.stop();
+	shm_out.stop();
+#ifndef NO_STREAM_TO
+	sdr_stream_stop();
+	meta_export_stop();
+#endif
+	if (options[OptStreamBench]) {
+		bench.stop();
+		bench.report(fout == stdout ? stderr : stdout);
+	}
+	if (options[OptStreamRealtime])
+		stream_rt_report();
+	if (stream_grow.grown || stream_grow.shrunk)
+		stream_grow_report();
+	if (options[OptStreamCrc])
+		stream_crc_report();
+	if (sender.dropped())
+		stderr_info("%u frames were not sent to the host\n", sender.dropped());
+	if (host_fd_serve >= 0) {
+		serve_end_clients();
+		close(host_fd_serve);
+		host_fd_serve = -1;
+		if (serve_dropped)
+			stderr_info("%u frames were not sent to the hosts\n", serve_dropped);
+	}
 	if (options[OptStreamDmaBuf])
 		exp_q.close_exported_fds();
 	if (fout && fout != stdout) {
@@ -2040,10 +4508,17 @@ static FILE *open_input_file(cv4l_fd &fd, __u32 type)
 
 	if (file_from) {
 		if (!strcmp(file_from, "-"))
-			return stdin;
-		fin = fopen(file_from, "r");
+			fin = stdin;
+		else
+			fin = fopen(file_from, "r");
 		if (!fin)
 			fprintf(stderr, "could not open %s for reading\n", file_from);
+		else if (options[OptStreamFromMmap] &&
+			 !input_map.map(fin, stream_from_mlock)) {
+			if (fin != stdin)
+				fclose(fin);
+			fin = nullptr;
+		}
 		return fin;
 	}
 	if (!host_from)
@@ -2296,6 +4771,7 @@ restart:
 done:
 	if (options[OptStreamOutDmaBuf])
 		exp_q.close_exported_fds();
+	input_map.unmap();
 	if (fin && fin != stdin)
 		fclose(fin);
 }
@@ -2354,6 +4830,163 @@ static int capture_setup(cv4l_fd &fd, cv4l_queue &in, cv4l_fd *exp_fd, cv4l_fmt
 	return 0;
 }
 
+static void stop_m2m(cv4l_fd &fd, bool is_encoder)
+{
+	static struct v4l2_encoder_cmd enc_stop = {
+		.cmd = V4L2_ENC_CMD_STOP,
+	};
+	static struct v4l2_decoder_cmd dec_stop = {
+		.cmd = V4L2_DEC_CMD_STOP,
+	};
+
+	if (!verbose)
+		stderr_info("\n");
+	stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
+	if (is_encoder)
+		fd.encoder_cmd(enc_stop);
+	else
+		fd.decoder_cmd(dec_stop);
+}
+
+/*
+ * The stateful_m2m() loop for --stream-m2m-threads: this thread feeds the
+ * OUTPUT queue while another thread drains the CAPTURE queue and handles the
+ * events, so that reading the input or writing the output only stalls its own
+ * queue. The globals used by do_handle_cap() and do_handle_out() are either
+ * only used by one of them, or only by the side that counts the buffers.
+ */
+static void stateful_m2m_threads(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
+				 FILE *fin, FILE *fout, cv4l_fmt &fmt_in,
+				 const cv4l_fmt &fmt_out, cv4l_fd *exp_fd_p,
+				 fps_timestamps fps_ts[2], unsigned count[2],
+				 bool stopped, bool have_eos, bool is_encoder,
+				 bool ignore_count_skip)
+{
+	std::atomic<bool> done(false);
+	std::atomic<bool> eos(false);
+	std::atomic<bool> out_stopped(stopped);
+
+	std::thread cap_thread([&] {
+		bool cap_streaming = false;
+		bool cap_done = false;
+		unsigned idle_ms = 0;
+
+		while (!done) {
+			struct timeval tv = { 0, 100000 };
+			fd_set rd_fds;
+			fd_set ex_fds;
+			int r;
+
+			FD_ZERO(&rd_fds);
+			FD_SET(fd.g_fd(), &rd_fds);
+			FD_ZERO(&ex_fds);
+			FD_SET(fd.g_fd(), &ex_fds);
+
+			r = select(fd.g_fd() + 1, cap_done ? nullptr : &rd_fds,
+				   nullptr, &ex_fds, &tv);
+			if (r == -1) {
+				if (EINTR == errno)
+					continue;
+				stderr_info("select error: %s\n", strerror(errno));
+				break;
+			}
+			if (r == 0) {
+				/* The same timeouts as in stateful_m2m() */
+				idle_ms += 100;
+				if (idle_ms < (out_stopped ? 500 : 2000))
+					continue;
+				if (!out_stopped)
+					stderr_info("select timeout");
+				stderr_info("\n");
+				break;
+			}
+			idle_ms = 0;
+
+			if (!cap_done && FD_ISSET(fd.g_fd(), &rd_fds)) {
+				r = do_handle_cap(fd, in, fin, nullptr,
+						  count[CAP], fps_ts[CAP], fmt_in,
+						  ignore_count_skip);
+				if (r == QUEUE_STOPPED)
+					break;
+				if (r < 0) {
+					cap_done = true;
+					if (!have_eos)
+						break;
+				}
+			}
+
+			if (FD_ISSET(fd.g_fd(), &ex_fds)) {
+				struct v4l2_event ev;
+
+				while (!fd.dqevent(ev)) {
+					if (ev.type == V4L2_EVENT_EOS) {
+						eos = true;
+						if (!verbose)
+							stderr_info("\n");
+						stderr_info("EOS EVENT\n");
+						fflush(stderr);
+					} else if (ev.type == V4L2_EVENT_SOURCE_CHANGE) {
+						if (!verbose)
+							stderr_info("\n");
+						stderr_info("SOURCE CHANGE EVENT\n");
+						in_source_change_event = true;
+						/* See stateful_m2m() */
+						if (!cap_streaming)
+							last_buffer = true;
+					}
+				}
+			}
+
+			if (last_buffer) {
+				if (!in_source_change_event)
+					break;
+				in_source_change_event = false;
+				last_buffer = false;
+				if (capture_setup(fd, in, exp_fd_p, &fmt_in))
+					break;
+				fps_ts[CAP].reset();
+				cap_streaming = true;
+			}
+		}
+		done = true;
+	});
+
+	while (!done && !eos) {
+		struct timeval tv = { 0, 100000 };
+		fd_set wr_fds;
+		int r;
+
+		FD_ZERO(&wr_fds);
+		FD_SET(fd.g_fd(), &wr_fds);
+		r = select(fd.g_fd() + 1, nullptr, &wr_fds, nullptr, &tv);
+		if (r == -1) {
+			if (EINTR == errno)
+				continue;
+			stderr_info("select error: %s\n", strerror(errno));
+			break;
+		}
+		/* Timeouts are handled by the CAPTURE thread */
+		if (r == 0)
+			continue;
+
+		r = do_handle_out(fd, out, fout, nullptr,
+				  count[OUT], fps_ts[OUT], fmt_out, stopped,
+				  !ignore_count_skip);
+		if (r == QUEUE_STOPPED) {
+			stopped = true;
+			out_stopped = true;
+			if (have_eos)
+				stop_m2m(fd, is_encoder);
+		} else if (r < 0) {
+			break;
+		}
+	}
+	/* The CAPTURE thread keeps going after an EOS until the last buffer */
+	if (!eos)
+		done = true;
+	cap_thread.join();
+}
+
 static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 			 FILE *fin, FILE *fout, cv4l_fmt &fmt_in,
 			 const cv4l_fmt &fmt_out, cv4l_fd *exp_fd_p)
@@ -2366,13 +4999,6 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 	fd_set *ex_fds = &fds[1]; /* for capture */
 	fd_set *wr_fds = &fds[2]; /* for output */
 	bool cap_streaming = false;
-	static struct v4l2_encoder_cmd enc_stop = {
-		.cmd = V4L2_ENC_CMD_STOP,
-	};
-	static struct v4l2_decoder_cmd dec_stop = {
-		.cmd = V4L2_DEC_CMD_STOP,
-	};
-
 	bool have_eos = subscribe_event(fd, V4L2_EVENT_EOS);
 	bool is_encoder = false;
 	bool ignore_count_skip = codec_type == ENCODER;
@@ -2419,14 +5045,15 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 
 	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
 
-	if (have_eos && stopped) {
-		if (!verbose)
-			stderr_info("\n");
-		stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
-		if (is_encoder)
-			fd.encoder_cmd(enc_stop);
-		else
-			fd.decoder_cmd(dec_stop);
+	if (have_eos && stopped)
+		stop_m2m(fd, is_encoder);
+
+	if (options[OptStreamM2MThreads]) {
+		stateful_m2m_threads(fd, in, out, fin, fout, fmt_in, fmt_out,
+				     exp_fd_p, fps_ts, count, stopped, have_eos,
+				     is_encoder, ignore_count_skip);
+		/* Skip the single threaded loop below */
+		rd_fds = wr_fds = ex_fds = nullptr;
 	}
 
 	while (rd_fds || wr_fds || ex_fds) {
@@ -2487,15 +5114,8 @@ static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 					  !ignore_count_skip);
 			if (r == QUEUE_STOPPED) {
 				stopped = true;
-				if (have_eos) {
-					if (!verbose)
-						stderr_info("\n");
-					stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
-					if (is_encoder)
-						fd.encoder_cmd(enc_stop);
-					else
-						fd.decoder_cmd(dec_stop);
-				}
+				if (have_eos)
+					stop_m2m(fd, is_encoder);
 			} else if (r < 0) {
 				break;
 			}
@@ -2561,13 +5181,25 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 	unsigned count[2] = { 0, 0 };
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
 	bool stopped = false;
+	unsigned out_count = reqbufs_count_out;
+	unsigned cap_count = reqbufs_count_cap;
+
+	/*
+	 * Each OUTPUT buffer has its own request, so the depth is the number
+	 * of OUTPUT buffers. The last decoded frame is held as the reference
+	 * frame, so that takes one more CAPTURE buffer.
+	 */
+	if (stream_req_depth) {
+		out_count = stream_req_depth;
+		cap_count = std::max(cap_count, stream_req_depth + 1);
+	}
 
-	if (out.reqbufs(&fd, reqbufs_count_out)) {
+	if (out.reqbufs(&fd, out_count)) {
 		fprintf(stderr, "%s: out.reqbufs failed\n", __func__);
 		return;
 	}
 
-	if (in.reqbufs(&fd, reqbufs_count_cap)) {
+	if (in.reqbufs(&fd, cap_count)) {
 		fprintf(stderr, "%s: in.reqbufs failed\n", __func__);
 		return;
 	}
@@ -2599,34 +5231,55 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 		fprintf(stderr, "%s: streamon for in failed\n", __func__);
 		return;
 	}
-	int index = 0;
+	unsigned completed = 0;
 	bool queue_lst_buf = false;
 	cv4l_buffer last_in_buf;
 
 	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
 
 	while (true) {
-		fd_set except_fds;
-		int req_fd = fwht_reqs[index].fd;
-		struct timeval tv = { 2, 0 };
-
-		if (req_fd < 0)
-			break;
+		/*
+		 * Wait for any of the queued requests, and then handle all
+		 * the requests that completed in one go.
+		 */
+		if (!completed) {
+			struct pollfd pfds[VIDEO_MAX_FRAME];
+			unsigned reqs[VIDEO_MAX_FRAME];
+			unsigned num_reqs = 0;
 
-		FD_ZERO(&except_fds);
-		FD_SET(req_fd, &except_fds);
+			for (unsigned i = 0; i < out.g_buffers(); i++) {
+				if (!fwht_reqs[i].pending)
+					continue;
+				pfds[num_reqs].fd = fwht_reqs[i].fd;
+				pfds[num_reqs].events = POLLPRI;
+				reqs[num_reqs++] = i;
+			}
+			if (!num_reqs)
+				break;
 
-		int rc = select(req_fd + 1, nullptr, nullptr, &except_fds, &tv);
+			int rc = poll(pfds, num_reqs, 2000);
 
-		if (rc == 0) {
-			fprintf(stderr, "Timeout when waiting for media request\n");
-			return;
-		}
-		if (rc < 0) {
-			fprintf(stderr, "Unable to select media request: %s\n",
-				strerror(errno));
-			return;
+			if (rc == 0) {
+				fprintf(stderr, "Timeout when waiting for media request\n");
+				return;
+			}
+			if (rc < 0) {
+				if (errno == EINTR)
+					continue;
+				fprintf(stderr, "Unable to poll media requests: %s\n",
+					strerror(errno));
+				return;
+			}
+			for (unsigned i = 0; i < num_reqs; i++) {
+				if (pfds[i].revents & POLLPRI) {
+					fwht_reqs[reqs[i]].pending = false;
+					completed++;
+				}
+			}
+			continue;
 		}
+		completed--;
+
 		/*
 		 * it is safe to queue back last cap buffer only after
 		 * the following request is done so that the buffer
@@ -2637,14 +5290,15 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 				stderr_info("%s: qbuf failed\n", __func__);
 				return;
 			}
+			queue_lst_buf = false;
 		}
 		int buf_idx = -1;
 		/*
 		 * fin is not sent to do_handle_cap since the capture buf is
 		 * written to the file in current function
 		 */
-		rc = do_handle_cap(fd, in, nullptr, &buf_idx, count[CAP],
-				   fps_ts[CAP], fmt_in, false);
+		int rc = do_handle_cap(fd, in, nullptr, &buf_idx, count[CAP],
+				       fps_ts[CAP], fmt_in, false);
 		if (rc && rc != QUEUE_STOPPED) {
 			stderr_info("%s: do_handle_cap err\n", __func__);
 			return;
@@ -2659,7 +5313,7 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 			stderr_info("%s: frame returned with error\n", __func__);
 			last_fwht_bf_ts	= 0;
 		} else {
-			cv4l_buffer cap_buf(in, index);
+			cv4l_buffer cap_buf(in, buf_idx);
 			if (fd.querybuf(cap_buf))
 				return;
 			last_in_buf = cap_buf;
@@ -2682,6 +5336,7 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 		if (rc == QUEUE_STOPPED)
 			return;
 
+		/* After the last OUTPUT buffer the loop ends once all requests completed */
 		if (!stopped) {
 			rc = do_handle_out(fd, out, fout, nullptr, count[OUT],
 					   fps_ts[OUT], fmt_out, false, true);
@@ -2689,11 +5344,8 @@ static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
 				stopped = true;
 				if (rc != QUEUE_STOPPED)
 					stderr_info("%s: output stream ended\n", __func__);
-				close(req_fd);
-				fwht_reqs[index].fd = -1;
 			}
 		}
-		index = (index + 1) % out.g_buffers();
 	}
 
 	fcntl(fd.g_fd(), F_SETFL, fd_flags);
@@ -2748,8 +5400,14 @@ static void streaming_set_m2m(cv4l_fd &fd, cv4l_fd &exp_fd)
 	}
 	if (fmt[OUT].g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS)
 		stateless_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
-	else
+	else if (options[OptStreamM2MThreads] && file[OUT] &&
+		 !input_map.active(file[OUT])) {
+		reader.start(file[OUT], STREAM_READER_SIZE);
+		stateful_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
+		reader.stop();
+	} else {
 		stateful_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
+	}
 
 done:
 	if (options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf])
@@ -2758,10 +5416,114 @@ done:
 	if (file[CAP] && file[CAP] != stdout)
 		fclose(file[CAP]);
 
+	input_map.unmap();
 	if (file[OUT] && file[OUT] != stdin)
 		fclose(file[OUT]);
 }
 
+/*
+ * Run the codec once for every combination of the --stream-m2m-bench matrix.
+ * The sizes, pixel formats and memory types apply to the raw side of the
+ * codec: the OUTPUT queue of an encoder, which is fed with the test pattern,
+ * and the CAPTURE queue of a decoder, which decodes the --stream-from file
+ * from the start in each run. The resolution of a decoder follows from the
+ * bitstream, so the sizes are ignored for decoders.
+ */
+static void streaming_m2m_bench(cv4l_fd &fd, cv4l_fd &exp_fd)
+{
+	bool is_encoder = codec_type == ENCODER;
+	unsigned raw_type = is_encoder ? v4l_type_invert(fd.g_type()) : fd.g_type();
+	unsigned count = stream_count;
+	std::vector<m2m_bench_result> results;
+	cv4l_fmt fmt(raw_type);
+
+	if (codec_type == NOT_CODEC) {
+		fprintf(stderr, "--stream-m2m-bench needs an encoder or a decoder\n");
+		return;
+	}
+	if (!is_encoder && (!file_from || !strcmp(file_from, "-"))) {
+		fprintf(stderr, "--stream-m2m-bench needs a --stream-from(-hdr) bitstream file for decoders\n");
+		return;
+	}
+	if (is_encoder && !file_from && !count)
+		count = M2M_BENCH_FRAMES;
+
+	fd.g_fmt(fmt);
+	if (m2m_matrix.sizes.empty())
+		m2m_matrix.sizes.push_back({ fmt.g_width(), fmt.g_height() });
+	if (!is_encoder)
+		m2m_matrix.sizes.resize(1);
+	if (m2m_matrix.pixelformats.empty())
+		m2m_matrix.pixelformats.push_back(fmt.g_pixelformat());
+	if (m2m_matrix.bufs.empty())
+		m2m_matrix.bufs.push_back(is_encoder ? reqbufs_count_out : reqbufs_count_cap);
+	if (m2m_matrix.memories.empty())
+		m2m_matrix.memories.push_back(is_encoder ? out_memory : memory);
+	for (auto mem : m2m_matrix.memories) {
+		if (mem == V4L2_MEMORY_DMABUF && exp_fd.g_fd() < 0) {
+			fprintf(stderr, "--stream-m2m-bench memory=dmabuf needs --export-device\n");
+			return;
+		}
+	}
+
+	for (const auto &size : m2m_matrix.sizes) {
+		for (auto pixfmt : m2m_matrix.pixelformats) {
+			fd.g_fmt(fmt, raw_type);
+			if (is_encoder) {
+				fmt.s_width(size.first);
+				fmt.s_height(size.second);
+			}
+			fmt.s_pixelformat(pixfmt);
+			if (fd.s_fmt(fmt, raw_type) || fmt.g_pixelformat() != pixfmt ||
+			    (is_encoder && (fmt.g_width() != size.first ||
+					    fmt.g_height() != size.second))) {
+				stderr_info("%ux%u %s is not supported, skipping it\n",
+					    size.first, size.second, fcc2s(pixfmt).c_str());
+				continue;
+			}
+			get_cap_compose_rect(fd);
+			get_out_crop_rect(fd);
+
+			for (auto bufs : m2m_matrix.bufs) {
+				for (auto mem : m2m_matrix.memories) {
+					reqbufs_count_cap = reqbufs_count_out = bufs;
+					if (is_encoder) {
+						out_memory = mem;
+						options[OptStreamOutDmaBuf] = mem == V4L2_MEMORY_DMABUF;
+					} else {
+						memory = mem;
+						options[OptStreamDmaBuf] = mem == V4L2_MEMORY_DMABUF;
+					}
+
+					for (unsigned run = 1; run <= m2m_matrix.repeat; run++) {
+						stream_count = count;
+						last_buffer = false;
+						in_source_change_event = false;
+						last_fwht_bf_ts = 0;
+
+						m2m_bench.start();
+						streaming_set_m2m(fd, exp_fd);
+
+						m2m_bench_result r = m2m_bench.stop();
+
+						/* A decoder chooses the size, and maybe the format */
+						fd.g_fmt(fmt, raw_type);
+						r.width = fmt.g_width();
+						r.height = fmt.g_height();
+						r.pixelformat = fmt.g_pixelformat();
+						r.bufs = bufs;
+						r.memory = mem;
+						r.run = run;
+						results.push_back(r);
+					}
+				}
+			}
+		}
+	}
+
+	m2m_bench_report(file_to && !strcmp(file_to, "-") ? stderr : stdout, results);
+}
+
 static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
 {
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
@@ -2834,6 +5596,12 @@ static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
 			fprintf(stderr, "could not open %s for reading\n", file_from);
 			return;
 		}
+		if (options[OptStreamFromMmap] &&
+		    !input_map.map(file[OUT], stream_from_mlock)) {
+			if (file[OUT] != stdin)
+				fclose(file[OUT]);
+			return;
+		}
 	}
 
 	if (in.reqbufs(&fd, reqbufs_count_cap) ||
@@ -2951,10 +5719,585 @@ done:
 	if (file[CAP] && file[CAP] != stdout)
 		fclose(file[CAP]);
 
+	input_map.unmap();
 	if (file[OUT] && file[OUT] != stdin)
 		fclose(file[OUT]);
 }
 
+/*
+ * --stream-chain: camera -> m2m -> output without any copies. The CAPTURE
+ * buffers of the -d device are imported by the OUTPUT queue of the m2m
+ * device and the CAPTURE buffers of the m2m device are imported by the
+ * --out-device, with buffer N of a queue always mapping to buffer N of the
+ * queue that imports it. So a buffer only goes back to its producer when
+ * the consumer is done with it, and each queue has the --stream-mmap number
+ * of buffers.
+ *
+ * A queue is starved when the driver hands out its last queued buffer: a
+ * CAPTURE queue then has no buffer to fill, an OUTPUT queue has nothing
+ * new to process or show.
+ */
+enum {
+	CHAIN_CAP,
+	CHAIN_M2M_OUT,
+	CHAIN_M2M_CAP,
+	CHAIN_DISP,
+	CHAIN_QUEUES,
+};
+
+static const char *chain_queue_names[CHAIN_QUEUES] = {
+	"capture", "m2m output", "m2m capture", "output",
+};
+
+struct chain_queue {
+	cv4l_fd *fd;
+	cv4l_queue *q;
+	unsigned queued;
+	unsigned frames;
+	unsigned starved;
+};
+
+static void close_imported_fds(cv4l_queue &q)
+{
+	for (unsigned b = 0; b < q.g_buffers(); b++) {
+		for (unsigned p = 0; p < q.g_num_planes(); p++) {
+			int fd = q.g_fd(b, p);
+
+			if (fd != -1) {
+				close(fd);
+				q.s_fd(b, p, -1);
+			}
+		}
+	}
+}
+
+/*
+ * Dequeue a buffer from queue 'from' and queue the buffer with the same
+ * index to queue 'to'. Returns 0 if a buffer was moved, EAGAIN if 'from' had
+ * no buffer ready or an error.
+ */
+static int chain_move(chain_queue *qs, unsigned from, unsigned to)
+{
+	chain_queue &f = qs[from];
+	chain_queue &t = qs[to];
+	cv4l_buffer buf(*f.q);
+	int ret = f.fd->dqbuf(buf);
+
+	if (ret)
+		return ret;
+	if (--f.queued == 0)
+		f.starved++;
+	f.frames++;
+
+	cv4l_buffer next(*t.q, buf.g_index());
+
+	/* CAPTURE -> OUTPUT passes the frame, the other way only the buffer */
+	if (v4l_type_is_capture(buf.g_type())) {
+		for (unsigned p = 0; p < buf.g_num_planes(); p++) {
+			next.s_bytesused(buf.g_bytesused(p), p);
+			next.s_data_offset(buf.g_data_offset(p), p);
+		}
+		next.s_field(buf.g_field());
+		next.s_timestamp(buf.g_timestamp());
+		if (verbose)
+			stderr_info("%s: seq: %6u index: %2u ts: %lu.%06lu\n",
+				    chain_queue_names[from], buf.g_sequence(),
+				    buf.g_index(), buf.g_timestamp().tv_sec,
+				    buf.g_timestamp().tv_usec);
+	}
+	ret = t.fd->qbuf(next);
+	if (ret) {
+		fprintf(stderr, "%s: VIDIOC_QBUF failed: %s\n",
+			chain_queue_names[to], strerror(ret));
+		return ret;
+	}
+	t.queued++;
+	return 0;
+}
+
+static void chain_stream(cv4l_fd &fd, cv4l_fd &m2m_fd, cv4l_fd &out_fd,
+			 chain_queue *qs)
+{
+	/* Each queue is moved to the queue that consumes its buffers */
+	static const unsigned next_queue[CHAIN_QUEUES] = {
+		CHAIN_M2M_OUT, CHAIN_CAP, CHAIN_DISP, CHAIN_M2M_CAP,
+	};
+	struct pollfd pfds[3] = {
+		{ fd.g_fd(), POLLIN, 0 },
+		{ m2m_fd.g_fd(), POLLIN | POLLOUT, 0 },
+		{ out_fd.g_fd(), POLLOUT, 0 },
+	};
+	/* The queues that can be dequeued when a pfds entry is ready */
+	static const unsigned poll_queues[3][2] = {
+		{ CHAIN_CAP, CHAIN_CAP },
+		{ CHAIN_M2M_CAP, CHAIN_M2M_OUT },
+		{ CHAIN_DISP, CHAIN_DISP },
+	};
+
+	for (;;) {
+		int r = poll(pfds, 3, 2000);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll error: %s\n", strerror(errno));
+			return;
+		}
+		if (r == 0) {
+			stderr_info("poll timeout\n");
+			return;
+		}
+		for (unsigned i = 0; i < 3; i++) {
+			if (pfds[i].revents & POLLERR) {
+				fprintf(stderr, "%s: poll error\n",
+					chain_queue_names[poll_queues[i][0]]);
+				return;
+			}
+			for (unsigned q : poll_queues[i]) {
+				int ret;
+
+				while (!(ret = chain_move(qs, q, next_queue[q])));
+				if (ret != EAGAIN)
+					return;
+			}
+		}
+		if (stream_count && qs[CHAIN_DISP].frames >= stream_count)
+			return;
+	}
+}
+
+static bool chain_reqbufs(chain_queue &cq, unsigned exp_idx, chain_queue *qs)
+{
+	cv4l_queue &q = *cq.q;
+
+	if (q.reqbufs(cq.fd, reqbufs_count_cap))
+		return false;
+	if (q.g_buffers() < reqbufs_count_cap) {
+		fprintf(stderr, "only %u buffers could be allocated\n", q.g_buffers());
+		return false;
+	}
+	if (exp_idx == CHAIN_QUEUES)
+		return true;
+
+	chain_queue &exp = qs[exp_idx];
+
+	if (q.g_num_planes() != exp.q->g_num_planes()) {
+		fprintf(stderr, "mismatch between number of planes\n");
+		return false;
+	}
+	if (q.export_bufs(exp.fd, exp.q->g_type())) {
+		fprintf(stderr, "could not export the %s buffers\n",
+			chain_queue_names[exp_idx]);
+		return false;
+	}
+	return true;
+}
+
+static void streaming_set_chain(cv4l_fd &fd, cv4l_fd &out_fd)
+{
+	cv4l_fd m2m_fd;
+	__u32 out_type = out_fd.has_vid_m2m() ? v4l_type_invert(out_fd.g_type()) : out_fd.g_type();
+	chain_queue qs[CHAIN_QUEUES] = {};
+	int fd_flags[3];
+	cv4l_fd *fds[3] = { &fd, &m2m_fd, &out_fd };
+
+	if (!options[OptStreamMmap] || !options[OptStreamOutDmaBuf]) {
+		fprintf(stderr, "--stream-chain needs --stream-mmap and --stream-out-dmabuf\n");
+		return;
+	}
+	if (out_fd.g_fd() < 0) {
+		fprintf(stderr, "--stream-chain needs --out-device\n");
+		return;
+	}
+	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
+		fprintf(stderr, "unsupported capture stream type\n");
+		return;
+	}
+	if (!(out_capabilities & (V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_VIDEO_OUTPUT_MPLANE |
+				  V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "unsupported output stream type\n");
+		return;
+	}
+	if (m2m_fd.open(stream_chain_dev, true) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", stream_chain_dev,
+			strerror(errno));
+		return;
+	}
+	if (!m2m_fd.has_vid_m2m()) {
+		fprintf(stderr, "%s is not a mem2mem device\n", stream_chain_dev);
+		m2m_fd.close();
+		return;
+	}
+	m2m_fd.s_trace(fd.g_trace());
+
+	cv4l_queue cap(fd.g_type(), V4L2_MEMORY_MMAP);
+	cv4l_queue m2m_out(v4l_type_invert(m2m_fd.g_type()), V4L2_MEMORY_DMABUF);
+	cv4l_queue m2m_cap(m2m_fd.g_type(), V4L2_MEMORY_MMAP);
+	cv4l_queue disp(out_type, V4L2_MEMORY_DMABUF);
+
+	qs[CHAIN_CAP] = { &fd, &cap };
+	qs[CHAIN_M2M_OUT] = { &m2m_fd, &m2m_out };
+	qs[CHAIN_M2M_CAP] = { &m2m_fd, &m2m_cap };
+	qs[CHAIN_DISP] = { &out_fd, &disp };
+
+	for (unsigned i = 0; i < 3; i++)
+		fd_flags[i] = fcntl(fds[i]->g_fd(), F_GETFL);
+
+	if (!chain_reqbufs(qs[CHAIN_CAP], CHAIN_QUEUES, qs) ||
+	    !chain_reqbufs(qs[CHAIN_M2M_OUT], CHAIN_CAP, qs) ||
+	    !chain_reqbufs(qs[CHAIN_M2M_CAP], CHAIN_QUEUES, qs) ||
+	    !chain_reqbufs(qs[CHAIN_DISP], CHAIN_M2M_CAP, qs))
+		goto done;
+
+	if (cap.queue_all(&fd) || m2m_cap.queue_all(&m2m_fd))
+		goto done;
+	qs[CHAIN_CAP].queued = qs[CHAIN_M2M_CAP].queued = reqbufs_count_cap;
+
+	/* Start the consumers first, so no frame is waiting for them */
+	if (out_fd.streamon(disp.g_type()) ||
+	    m2m_fd.streamon(m2m_cap.g_type()) ||
+	    m2m_fd.streamon(m2m_out.g_type()) ||
+	    fd.streamon(cap.g_type()))
+		goto done;
+
+	for (unsigned i = 0; i < 3; i++) {
+		fcntl(fds[i]->g_fd(), F_SETFL, fd_flags[i] | O_NONBLOCK);
+		fds[i]->s_trace(0);
+	}
+
+	chain_stream(fd, m2m_fd, out_fd, qs);
+
+	stderr_info("\n");
+	for (unsigned i = 0; i < CHAIN_QUEUES; i++)
+		stderr_info("%-12s %u buffers, %u frames, starved %u times\n",
+			    chain_queue_names[i], reqbufs_count_cap,
+			    qs[i].frames, qs[i].starved);
+
+done:
+	for (unsigned i = 0; i < 3; i++)
+		fcntl(fds[i]->g_fd(), F_SETFL, fd_flags[i]);
+
+	/* Drop the imported buffers before the exporters free them */
+	disp.free(&out_fd);
+	close_imported_fds(disp);
+	m2m_out.free(&m2m_fd);
+	close_imported_fds(m2m_out);
+	m2m_cap.free(&m2m_fd);
+	cap.free(&fd);
+	m2m_fd.close();
+}
+
+/*
+ * --stream-devices: capture from the -d device and the --stream-devices
+ * devices from a single epoll loop. A frame set is complete when each device
+ * has delivered a frame, the skew of a set is the difference between the
+ * newest and the oldest timestamp in it. A device that delivers a second
+ * frame before the set is complete replaces its frame in the set.
+ */
+struct multi_cap {
+	cv4l_fd *fd;
+	std::unique_ptr<cv4l_fd> own_fd;
+	std::unique_ptr<cv4l_queue> q;
+	std::string name;
+	FILE *fout = nullptr;
+	fps_timestamps fps_ts;
+	unsigned count = 0;
+	unsigned frames = 0;
+	unsigned replaced = 0;
+	double set_ts = 0;
+	bool done = false;
+};
+
+static FILE *open_multi_output_file(unsigned n)
+{
+#ifndef NO_STREAM_TO
+	std::string name;
+	char s[16];
+
+	if (!file_to)
+		return nullptr;
+
+	/* Replace %u by the device number, or append it */
+	sprintf(s, "%u", n);
+	name = file_to;
+	size_t pos = name.find("%u");
+	if (pos != std::string::npos)
+		name.replace(pos, 2, s);
+	else
+		name += std::string(".") + s;
+
+	FILE *f = fopen(name.c_str(), "w+");
+
+	if (!f)
+		fprintf(stderr, "could not open %s for writing\n", name.c_str());
+	return f;
+#else
+	return nullptr;
+#endif
+}
+
+static bool multi_cap_setup(multi_cap &c, unsigned n)
+{
+	cv4l_fd &fd = *c.fd;
+
+	if (!(fd.g_caps() & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
+		fprintf(stderr, "%s: not a video capture device\n", c.name.c_str());
+		return false;
+	}
+	c.q.reset(new cv4l_queue(fd.g_type(), memory));
+	if (c.q->reqbufs(&fd, reqbufs_count_cap) || c.q->obtain_bufs(&fd) ||
+	    c.q->queue_all(&fd))
+		return false;
+	c.fps_ts.determine_field(fd.g_fd(), c.q->g_type());
+	subscribe_event(fd, V4L2_EVENT_EOS);
+	c.fout = open_multi_output_file(n);
+	return !file_to || c.fout;
+}
+
+/* Dequeue all buffers that are ready, returns false on an error */
+static bool multi_cap_handle(multi_cap &c, std::vector<multi_cap> &caps,
+			     unsigned &sets, double &skew_sum, double &skew_max)
+{
+	cv4l_fd &fd = *c.fd;
+	cv4l_queue &q = *c.q;
+
+	for (;;) {
+		cv4l_buffer buf(q);
+		int ret = fd.dqbuf(buf);
+
+		if (ret == EAGAIN)
+			return true;
+		if (ret) {
+			fprintf(stderr, "%s: VIDIOC_DQBUF failed: %s\n",
+				c.name.c_str(), strerror(ret));
+			return false;
+		}
+		if ((buf.g_flags() & V4L2_BUF_FLAG_ERROR) || !buf.g_bytesused(0)) {
+			if (fd.qbuf(buf))
+				return false;
+			continue;
+		}
+
+		double ts = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+
+		c.fps_ts.add_ts(ts, buf.g_sequence(), buf.g_field());
+		if (c.fout) {
+			for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+				__u32 used = buf.g_bytesused(j);
+				unsigned offset = buf.g_data_offset(j);
+				u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j));
+
+				if (offset > used)
+					offset = 0;
+				if (fwrite(p + offset, 1, used - offset, c.fout) != used - offset)
+					fprintf(stderr, "%s: write error\n", c.name.c_str());
+			}
+		}
+		if (verbose)
+			fprintf(stderr, "%s: seq: %6u ts: %.06f\n",
+				c.name.c_str(), buf.g_sequence(), ts);
+		if (fd.qbuf(buf))
+			return false;
+		c.frames++;
+
+		if (c.set_ts)
+			c.replaced++;
+		c.set_ts = ts;
+
+		double ts_min = ts, ts_max = ts;
+		bool complete = true;
+
+		for (auto &o : caps) {
+			if (o.done)
+				continue;
+			if (!o.set_ts) {
+				complete = false;
+				break;
+			}
+			ts_min = std::min(ts_min, o.set_ts);
+			ts_max = std::max(ts_max, o.set_ts);
+		}
+		if (complete) {
+			double skew = (ts_max - ts_min) * 1000.0;
+
+			sets++;
+			skew_sum += skew;
+			skew_max = std::max(skew_max, skew);
+			if (verbose)
+				fprintf(stderr, "set: %6u skew: %.03f ms\n", sets, skew);
+			for (auto &o : caps)
+				o.set_ts = 0;
+		}
+
+		if (stream_count && ++c.count >= stream_count) {
+			c.done = true;
+			return true;
+		}
+	}
+}
+
+static void streaming_set_multi(cv4l_fd &fd)
+{
+	std::vector<multi_cap> caps(stream_devices.size() + 1);
+	struct epoll_event ev[VIDEO_MAX_FRAME];
+	int epfd = -1;
+	unsigned sets = 0, total_sets = 0;
+	double skew_sum = 0, skew_max = 0;
+	double total_skew_sum = 0, total_skew_max = 0;
+	unsigned active;
+	struct timespec last, now;
+
+	if (options[OptStreamDmaBuf]) {
+		fprintf(stderr, "--stream-devices does not support --stream-dmabuf\n");
+		return;
+	}
+	if (host_to || host_serve) {
+		fprintf(stderr, "--stream-devices does not support streaming to hosts\n");
+		return;
+	}
+	if (stream_devices.size() >= VIDEO_MAX_FRAME) {
+		fprintf(stderr, "too many --stream-devices\n");
+		return;
+	}
+
+	/* The devices are named by their number, as in the --stream-to files */
+	caps[0].fd = &fd;
+	caps[0].name = "0";
+	for (unsigned i = 1; i < caps.size(); i++) {
+		multi_cap &c = caps[i];
+		const char *devname = stream_devices[i - 1].c_str();
+
+		c.name = std::to_string(i);
+		c.own_fd.reset(new cv4l_fd);
+		c.fd = c.own_fd.get();
+		if (c.fd->open(devname, true) < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", devname,
+				strerror(errno));
+			goto done;
+		}
+		c.fd->s_trace(fd.g_trace());
+	}
+
+	epfd = epoll_create1(0);
+	if (epfd < 0) {
+		fprintf(stderr, "epoll_create1 failed: %s\n", strerror(errno));
+		goto done;
+	}
+	for (unsigned i = 0; i < caps.size(); i++) {
+		multi_cap &c = caps[i];
+		struct epoll_event e = {};
+
+		if (!multi_cap_setup(c, i))
+			goto done;
+		fcntl(c.fd->g_fd(), F_SETFL, fcntl(c.fd->g_fd(), F_GETFL) | O_NONBLOCK);
+		e.events = EPOLLIN | EPOLLPRI;
+		e.data.u32 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd->g_fd(), &e);
+	}
+
+	/* Start all devices as close together as possible */
+	for (auto &c : caps)
+		if (c.fd->streamon())
+			goto done;
+	for (auto &c : caps)
+		c.fd->s_trace(0);
+
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	active = caps.size();
+	while (active) {
+		int n = epoll_wait(epfd, ev, caps.size(), 2000);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "epoll_wait error: %s\n", strerror(errno));
+			break;
+		}
+		if (n == 0) {
+			stderr_info("select timeout\n");
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			multi_cap &c = caps[ev[i].data.u32];
+			bool ok = true;
+
+			if (c.done)
+				continue;
+			if (ev[i].events & EPOLLPRI) {
+				struct v4l2_event event;
+
+				while (!c.fd->dqevent(event))
+					if (event.type == V4L2_EVENT_EOS) {
+						stderr_info("%s: EOS EVENT\n", c.name.c_str());
+						c.done = true;
+					}
+			}
+			if (!c.done && (ev[i].events & EPOLLIN))
+				ok = multi_cap_handle(c, caps, sets, skew_sum, skew_max);
+			if (!ok)
+				c.done = true;
+			if (c.done) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd->g_fd(), nullptr);
+				active--;
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double elapsed = now.tv_sec - last.tv_sec +
+			(now.tv_nsec - last.tv_nsec) / 1000000000.0;
+
+		if (elapsed < 1.0 && active)
+			continue;
+		if (!verbose) {
+			for (auto &c : caps) {
+				unsigned dropped = c.fps_ts.dropped();
+
+				stderr_info("%s: %.02f fps", c.name.c_str(),
+					    c.frames / elapsed);
+				if (dropped)
+					stderr_info(" (dropped %u)", dropped);
+				stderr_info(", ");
+			}
+			if (sets)
+				stderr_info("skew avg %.03f ms max %.03f ms\n",
+					    skew_sum / sets, skew_max);
+			else
+				stderr_info("no complete frame sets\n");
+		}
+		for (auto &c : caps)
+			c.frames = 0;
+		total_sets += sets;
+		total_skew_sum += skew_sum;
+		total_skew_max = std::max(total_skew_max, skew_max);
+		sets = 0;
+		skew_sum = skew_max = 0;
+		last = now;
+	}
+
+	if (total_sets)
+		stderr_info("%u frame sets, skew avg %.03f ms max %.03f ms\n",
+			    total_sets, total_skew_sum / total_sets, total_skew_max);
+	for (auto &c : caps)
+		if (c.replaced)
+			stderr_info("%s: %u frames were not part of a frame set\n",
+				    c.name.c_str(), c.replaced);
+
+done:
+	for (auto &c : caps) {
+		if (!c.fd || c.fd->g_fd() < 0)
+			continue;
+		c.fd->streamoff();
+		if (c.q)
+			c.q->free(c.fd);
+		if (c.fout)
+			fclose(c.fout);
+		if (c.own_fd)
+			c.fd->close();
+	}
+	if (epfd >= 0)
+		close(epfd);
+}
+
 void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
 {
 	int do_cap = options[OptStreamMmap] + options[OptStreamUser] + options[OptStreamDmaBuf];
@@ -2978,19 +6321,37 @@ void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
 	unsigned int old_trace_out_fd = out_fd.g_trace();
 	unsigned int old_trace_exp_fd = exp_fd.g_trace();
 
+	if (options[OptStreamNuma])
+		stream_numa_bind(fd);
+	if (options[OptStreamRealtime])
+		stream_rt_setup();
+
 	get_cap_compose_rect(fd);
 	get_out_crop_rect(fd);
 	get_codec_type(fd);
 
-	if (do_cap && do_out && out_fd.g_fd() < 0)
+	if (stream_trace_file && !tracer.start(stream_trace_file, fd)) {
+		fprintf(stderr, "cannot open trace file %s: %s\n",
+			stream_trace_file, strerror(errno));
+		return;
+	}
+
+	if (options[OptStreamM2MBench])
+		streaming_m2m_bench(fd, exp_fd);
+	else if (do_cap && do_out && stream_chain_dev)
+		streaming_set_chain(fd, out_fd);
+	else if (do_cap && do_out && out_fd.g_fd() < 0)
 		streaming_set_m2m(fd, exp_fd);
 	else if (do_cap && do_out)
 		streaming_set_cap2out(fd, out_fd);
+	else if (do_cap && !stream_devices.empty())
+		streaming_set_multi(fd);
 	else if (do_cap)
 		streaming_set_cap(fd, exp_fd);
 	else if (do_out)
 		streaming_set_out(fd, exp_fd);
 
+	tracer.stop();
 	fd.s_trace(old_trace_fd);
 	out_fd.s_trace(old_trace_out_fd);
 	exp_fd.s_trace(old_trace_exp_fd);
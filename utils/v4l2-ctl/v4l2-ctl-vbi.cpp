@@ -1,12 +1,18 @@
 #include <cstring>
+#include <vector>
 
 #include "compiler.h"
 #include "v4l2-ctl.h"
+#include "vbi-slicer.h"
 
 static struct v4l2_format sliced_fmt;	  /* set_format/get_format for sliced VBI */
 static struct v4l2_format sliced_fmt_out; /* set_format/get_format for sliced VBI output */
 static struct v4l2_format raw_fmt;	  /* set_format/get_format for VBI */
 static struct v4l2_format raw_fmt_out;	  /* set_format/get_format for VBI output */
+static struct v4l2_format slice_fmt;	  /* services of --stream-slice-vbi */
+static bool slice_vbi;
+static struct vbi_slicer slicer;
+static std::vector<struct v4l2_sliced_vbi_data> sliced_data;
 
 void vbi_usage()
 {
@@ -48,6 +54,14 @@ void vbi_usage()
 	       "                     count0: number of lines in the first field\n"
 	       "                     start1: start line number of the second field\n"
 	       "                     count1: number of lines in the second field\n"
+#ifndef NO_STREAM_TO
+	       "  --stream-slice-vbi <mode>\n"
+	       "                     slice the raw VBI capture buffers in software and write\n"
+	       "                     the sliced VBI data of each buffer to the --stream-to file,\n"
+	       "                     as a sliced VBI capture would. <mode> is a comma separated\n"
+	       "                     list of teletext, cc, wss and vps. The raw VBI format must\n"
+	       "                     be GREY.\n"
+#endif
 	       );
 }
 
@@ -71,9 +85,11 @@ void vbi_cmd(int ch, char *optarg)
 	v4l2_format *raw = &raw_fmt;
 
 	switch (ch) {
+	case OptStreamSliceVbi:
 	case OptSetSlicedVbiOutFormat:
 	case OptTrySlicedVbiOutFormat:
-		sliced = &sliced_fmt_out;
+		slice_vbi |= ch == OptStreamSliceVbi;
+		sliced = ch == OptStreamSliceVbi ? &slice_fmt : &sliced_fmt_out;
 		fallthrough;
 	case OptSetSlicedVbiFormat:
 	case OptTrySlicedVbiFormat:
@@ -286,3 +302,40 @@ void vbi_list(cv4l_fd &fd)
 		}
 	}
 }
+
+bool vbi_slice_active()
+{
+	return slice_vbi && slicer.services;
+}
+
+int vbi_slice_start(cv4l_fd &fd)
+{
+	struct v4l2_format fmt = {};
+
+	if (!slice_vbi || vbi_slice_active())
+		return 0;
+	fmt.type = V4L2_BUF_TYPE_VBI_CAPTURE;
+	if (doioctl(fd.g_fd(), VIDIOC_G_FMT, &fmt))
+		return -1;
+	if (vbi_slicer_init(&slicer, &fmt.fmt.vbi,
+			    slice_fmt.fmt.sliced.service_set)) {
+		fprintf(stderr, "--stream-slice-vbi: none of the services can be sliced from this raw VBI format\n");
+		return -1;
+	}
+	sliced_data.resize(fmt.fmt.vbi.count[0] + fmt.fmt.vbi.count[1]);
+	return 0;
+}
+
+void vbi_slice_write(cv4l_queue &q, cv4l_buffer &buf, FILE *fout)
+{
+	const struct v4l2_vbi_format &fmt = slicer.fmt;
+	unsigned size = (fmt.count[0] + fmt.count[1]) * fmt.samples_per_line;
+	unsigned n;
+
+	if (!fout || buf.g_bytesused(0) < size)
+		return;
+	n = vbi_slicer_decode(&slicer, static_cast<__u8 *>(q.g_dataptr(buf.g_index(), 0)),
+			      sliced_data.data(), sliced_data.size());
+	if (n && fwrite(sliced_data.data(), sizeof(sliced_data[0]), n, fout) != n)
+		fprintf(stderr, "could not write the sliced VBI data\n");
+}
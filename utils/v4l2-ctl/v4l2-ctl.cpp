@@ -206,7 +206,7 @@ static struct option long_options[] = {
 	{"epoll-for-event", required_argument, nullptr, OptEPollForEvent},
 	{"overlay", required_argument, nullptr, OptOverlay},
 	{"sleep", required_argument, nullptr, OptSleep},
-	{"list-devices", no_argument, nullptr, OptListDevices},
+	{"list-devices", optional_argument, nullptr, OptListDevices},
 	{"list-dv-timings", optional_argument, nullptr, OptListDvTimings},
 	{"query-dv-timings", no_argument, nullptr, OptQueryDvTimings},
 	{"get-dv-timings", no_argument, nullptr, OptGetDvTimings},
@@ -237,14 +237,38 @@ static struct option long_options[] = {
 	{"stream-count", required_argument, nullptr, OptStreamCount},
 	{"stream-skip", required_argument, nullptr, OptStreamSkip},
 	{"stream-loop", no_argument, nullptr, OptStreamLoop},
+	{"stream-from-mmap", optional_argument, nullptr, OptStreamFromMmap},
 	{"stream-sleep", required_argument, nullptr, OptStreamSleep},
 	{"stream-poll", no_argument, nullptr, OptStreamPoll},
+	{"stream-batch", no_argument, nullptr, OptStreamBatch},
+	{"stream-bench", no_argument, nullptr, OptStreamBench},
+	{"stream-crc", optional_argument, nullptr, OptStreamCrc},
+	{"stream-crc-check", required_argument, nullptr, OptStreamCrcCheck},
+	{"stream-m2m-threads", no_argument, nullptr, OptStreamM2MThreads},
+	{"stream-m2m-bench", optional_argument, nullptr, OptStreamM2MBench},
+	{"stream-req-depth", required_argument, nullptr, OptStreamReqDepth},
+	{"stream-devices", required_argument, nullptr, OptStreamDevices},
+	{"stream-chain", required_argument, nullptr, OptStreamChain},
+	{"stream-numa", optional_argument, nullptr, OptStreamNuma},
+	{"stream-realtime", optional_argument, nullptr, OptStreamRealtime},
+	{"stream-grow-bufs", required_argument, nullptr, OptStreamGrowBufs},
+	{"stream-trace", required_argument, nullptr, OptStreamTrace},
 	{"stream-no-query", no_argument, nullptr, OptStreamNoQuery},
 #ifndef NO_STREAM_TO
 	{"stream-to", required_argument, nullptr, OptStreamTo},
 	{"stream-to-hdr", required_argument, nullptr, OptStreamToHdr},
+	{"stream-to-bufs", required_argument, nullptr, OptStreamToBufs},
+	{"stream-to-direct", no_argument, nullptr, OptStreamToDirect},
 	{"stream-lossless", no_argument, nullptr, OptStreamLossless},
 	{"stream-to-host", required_argument, nullptr, OptStreamToHost},
+	{"stream-to-host-bufs", required_argument, nullptr, OptStreamToHostBufs},
+	{"stream-to-shm", required_argument, nullptr, OptStreamToShm},
+	{"stream-to-shm-slots", required_argument, nullptr, OptStreamToShmSlots},
+	{"stream-serve", required_argument, nullptr, OptStreamServe},
+	{"stream-sdr-to", required_argument, nullptr, OptStreamSdrTo},
+	{"stream-sdr-cf32", no_argument, nullptr, OptStreamSdrCf32},
+	{"stream-slice-vbi", required_argument, nullptr, OptStreamSliceVbi},
+	{"stream-meta-to", required_argument, nullptr, OptStreamMetaTo},
 #endif
 	{"stream-buf-caps", no_argument, nullptr, OptStreamBufCaps},
 	{"stream-show-delta-now", no_argument, nullptr, OptStreamShowDeltaNow},
@@ -214,12 +214,36 @@ enum Option {
 	OptStreamCount,
 	OptStreamSkip,
 	OptStreamLoop,
+	OptStreamFromMmap,
 	OptStreamSleep,
 	OptStreamPoll,
+	OptStreamBatch,
+	OptStreamBench,
+	OptStreamCrc,
+	OptStreamCrcCheck,
+	OptStreamM2MThreads,
+	OptStreamM2MBench,
+	OptStreamReqDepth,
+	OptStreamDevices,
+	OptStreamChain,
+	OptStreamNuma,
+	OptStreamRealtime,
+	OptStreamGrowBufs,
+	OptStreamTrace,
 	OptStreamNoQuery,
 	OptStreamTo,
 	OptStreamToHdr,
+	OptStreamToBufs,
+	OptStreamToDirect,
 	OptStreamToHost,
+	OptStreamToHostBufs,
+	OptStreamToShm,
+	OptStreamToShmSlots,
+	OptStreamServe,
+	OptStreamSdrTo,
+	OptStreamSdrCf32,
+	OptStreamSliceVbi,
+	OptStreamMetaTo,
 	OptStreamLossless,
 	OptStreamShowDeltaNow,
 	OptStreamBufCaps,
@@ -402,6 +426,9 @@ void vbi_cmd(int ch, char *optarg);
 void vbi_set(cv4l_fd &fd);
 void vbi_get(cv4l_fd &fd);
 void vbi_list(cv4l_fd &fd);
+bool vbi_slice_active();
+int vbi_slice_start(cv4l_fd &fd);
+void vbi_slice_write(cv4l_queue &q, cv4l_buffer &buf, FILE *fout);
 
 // v4l2-ctl-sdr.cpp
 void sdr_usage(void);
@@ -409,6 +436,10 @@ void sdr_cmd(int ch, char *optarg);
 void sdr_set(cv4l_fd &fd);
 void sdr_get(cv4l_fd &fd);
 void sdr_list(cv4l_fd &fd);
+bool sdr_stream_active();
+int sdr_stream_start(cv4l_fd &fd);
+void sdr_stream_write(cv4l_queue &q, cv4l_buffer &buf);
+void sdr_stream_stop();
 
 // v4l2-ctl-meta.cpp
 void meta_usage(void);
@@ -418,6 +449,10 @@ void meta_get(cv4l_fd &fd);
 void meta_list(cv4l_fd &fd);
 void print_meta_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
 void meta_fillbuffer(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
+bool meta_export_active();
+int meta_export_start();
+void meta_export(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
+void meta_export_stop();
 
 // v4l2-ctl-subdev.cpp
 void subdev_usage(void);
@@ -445,6 +480,7 @@ void streaming_usage(void);
 void streaming_cmd(int ch, char *optarg);
 void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd);
 void streaming_list(cv4l_fd &fd, cv4l_fd &out_fd);
+bool write_raw(int fd, const __u8 *p, size_t size);
 
 // v4l2-ctl-edid.cpp
 void edid_usage(void);
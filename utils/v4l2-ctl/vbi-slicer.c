@@ -0,0 +1 @@
+../common/vbi-slicer.c
\ No newline at end of file
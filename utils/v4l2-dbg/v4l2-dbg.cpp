@@ -18,8 +18,11 @@
 
 #include <cctype>
 #include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <fcntl.h>
@@ -119,6 +122,9 @@ enum Option {
 	OptLogStatus = 128,
 	OptVerbose,
 	OptListSymbols,
+	OptSnapshot,
+	OptDiff,
+	OptParallel,
 	OptLast = 256
 };
 
@@ -139,6 +145,9 @@ static struct option long_options[] = {
 	{"log-status", no_argument, nullptr, OptLogStatus},
 	{"list-symbols", no_argument, nullptr, OptListSymbols},
 	{"wide", required_argument, nullptr, OptSetStride},
+	{"snapshot", required_argument, nullptr, OptSnapshot},
+	{"diff", required_argument, nullptr, OptDiff},
+	{"parallel", no_argument, nullptr, OptParallel},
 	{nullptr, 0, nullptr, 0}
 };
 
@@ -155,6 +164,8 @@ static void usage()
 	       "                         bridge<num>: bridge chip number <num>\n"
 	       "                         bridge (default): same as bridge0\n"
 	       "                         subdev<num>: sub-device number <num>\n"
+	       "                     It can be given more than once for --snapshot.\n"
+	       "                     The other commands use the last one.\n"
 	       "  -l, --list-registers[=min=<addr>[,max=<addr>]]\n"
 	       "		     Dump registers from <min> to <max> [VIDIOC_DBG_G_REGISTER]\n"
 	       "  -g, --get-register <addr>\n"
@@ -166,7 +177,17 @@ static void usage()
 	       "  -w, --wide <reg length>\n"
 	       "		     Sets step between two registers\n"
 	       "  --list-symbols     List the symbolic register names you can use, if any\n"
-	       "  --log-status       Log the board status in the kernel log [VIDIOC_LOG_STATUS]\n");
+	       "  --log-status       Log the board status in the kernel log [VIDIOC_LOG_STATUS]\n"
+	       "  --snapshot <file>  Read the registers of each chip given with --chip, in the\n"
+	       "                     ranges of --list-registers, and store them in <file>\n"
+	       "                     [VIDIOC_DBG_G_REGISTER]\n"
+	       "  --diff <file>      Read again the registers stored in the snapshot <file>,\n"
+	       "                     and show the ones that changed. When used together with\n"
+	       "                     --snapshot, the new values are stored there\n"
+	       "                     [VIDIOC_DBG_G_REGISTER]\n"
+	       "  --parallel         With --snapshot or --diff, read each chip from its own\n"
+	       "                     thread, so that chips on different buses are read at\n"
+	       "                     the same time\n");
 }
 
 static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min, unsigned long max, int stride)
@@ -214,6 +235,198 @@ static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min,
 	printf("\n");
 }
 
+struct reg_range {
+	unsigned long long min, max;
+};
+
+/* Registers dumped by --list-registers for each chip, if not given */
+static std::vector<reg_range> chip_ranges(const std::string &name)
+{
+	if (name == "saa7115")
+		return { { 0, 0xff } };
+	if (name == "saa717x")
+		// FIXME: use correct reg regions
+		return { { 0, 0xff } };
+	if (name == "saa7127")
+		return { { 0, 0x7f } };
+	if (name == "ov7670")
+		return { { 0, 0x89 } };
+	if (name == "cx25840")
+		return { { 0, 2 }, { 0x100, 0x15f }, { 0x200, 0x23f },
+			 { 0x400, 0x4bf }, { 0x800, 0x9af } };
+	if (name == "cs5345")
+		return { { 1, 0x10 } };
+	if (name == "cx23416")
+		return { { 0x02000000, 0x020000ff } };
+	if (name == "cx23418")
+		return { { 0x02c40000, 0x02c409c7 } };
+	if (name == "cafe")
+		return { { 0, 0x43 }, { 0x88, 0x8f }, { 0xb4, 0xbb },
+			 { 0x3000, 0x300c } };
+	/* unknown chip, dump 0-0xff by default */
+	return { { 0, 0xff } };
+}
+
+struct reg_value {
+	unsigned long long reg;
+	unsigned size;
+	unsigned long long val;
+};
+
+struct chip_snapshot {
+	struct v4l2_dbg_match match;
+	std::string id;			/* as given to --chip */
+	std::vector<reg_range> ranges;
+	std::vector<reg_value> regs;
+	unsigned long long err_reg;	/* first register that failed */
+	int err;
+};
+
+static std::string chip_id(const struct v4l2_dbg_match &match)
+{
+	return (match.type == V4L2_CHIP_MATCH_SUBDEV ? "subdev" : "bridge") +
+	       std::to_string(match.addr);
+}
+
+/*
+ * Reads the registers of the chip ranges into memory, with nothing else
+ * in between the ioctls: formatting and the file I/O come later.
+ */
+static void read_chip(int fd, struct chip_snapshot *chip, unsigned stride)
+{
+	struct v4l2_dbg_register reg;
+
+	/* Same default as --list-registers */
+	if (!stride)
+		stride = chip->match.type == V4L2_CHIP_MATCH_BRIDGE ? 4 : 1;
+	memset(&reg, 0, sizeof(reg));
+	reg.match = chip->match;
+	chip->err = 0;
+	for (const auto &r : chip->ranges) {
+		for (unsigned long long i = r.min; i <= r.max; ) {
+			reg.reg = i;
+			if (ioctl(fd, VIDIOC_DBG_G_REGISTER, &reg) < 0) {
+				if (!chip->err) {
+					chip->err = errno;
+					chip->err_reg = i;
+				}
+				break;
+			}
+			/* If size is set, then use this as the stride */
+			if (reg.size)
+				stride = reg.size;
+			chip->regs.push_back({ i, stride, reg.val });
+			i += stride;
+		}
+	}
+}
+
+static void read_chips(int fd, std::vector<chip_snapshot> &chips,
+		       unsigned stride, bool parallel)
+{
+	std::vector<std::thread> threads;
+
+	for (auto &chip : chips) {
+		if (parallel)
+			threads.emplace_back(read_chip, fd, &chip, stride);
+		else
+			read_chip(fd, &chip, stride);
+	}
+	for (auto &t : threads)
+		t.join();
+	for (const auto &chip : chips)
+		if (chip.err)
+			fprintf(stderr, "%s: VIDIOC_DBG_G_REGISTER failed for 0x%llx: %s\n",
+				chip.id.c_str(), chip.err_reg, strerror(chip.err));
+}
+
+static bool load_snapshot(const char *fname, std::vector<chip_snapshot> &chips)
+{
+	FILE *f = fopen(fname, "r");
+	char line[256];
+	unsigned lineno = 0;
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		char id[32];
+		struct reg_value v;
+		struct v4l2_dbg_match match;
+
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%31s %llx %u %llx", id, &v.reg, &v.size, &v.val) != 4 ||
+		    (strncmp(id, "bridge", 6) && strncmp(id, "subdev", 6)) ||
+		    !isdigit(id[6])) {
+			fprintf(stderr, "%s:%u: invalid line\n", fname, lineno);
+			fclose(f);
+			return false;
+		}
+		match.type = id[0] == 's' ? V4L2_CHIP_MATCH_SUBDEV : V4L2_CHIP_MATCH_BRIDGE;
+		match.addr = strtoul(id + 6, nullptr, 0);
+		if (chips.empty() || chips.back().id != id) {
+			chips.emplace_back();
+			chips.back().match = match;
+			chips.back().id = id;
+		}
+		chips.back().regs.push_back(v);
+	}
+	fclose(f);
+	return true;
+}
+
+static bool save_snapshot(const char *fname, const std::vector<chip_snapshot> &chips)
+{
+	FILE *f = fopen(fname, "w");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	fprintf(f, "# v4l2-dbg register snapshot: chip register size value\n");
+	for (const auto &chip : chips)
+		for (const auto &v : chip.regs)
+			fprintf(f, "%s 0x%08llx %u 0x%0*llx\n", chip.id.c_str(),
+				v.reg, v.size, 2 * v.size, v.val);
+	if (fclose(f)) {
+		fprintf(stderr, "Failed to write %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void print_diff(const std::vector<chip_snapshot> &old_chips,
+		       const std::vector<chip_snapshot> &chips)
+{
+	unsigned changed = 0, total = 0;
+
+	for (size_t c = 0; c < old_chips.size(); c++) {
+		std::map<unsigned long long, const reg_value *> now;
+
+		for (const auto &v : chips[c].regs)
+			now[v.reg] = &v;
+		for (const auto &v : old_chips[c].regs) {
+			auto it = now.find(v.reg);
+
+			total++;
+			if (it == now.end()) {
+				printf("%s 0x%08llx: 0x%0*llx -> unreadable\n",
+				       chips[c].id.c_str(), v.reg, 2 * v.size, v.val);
+				changed++;
+			} else if (it->second->val != v.val) {
+				printf("%s 0x%08llx: 0x%0*llx -> 0x%0*llx\n",
+				       chips[c].id.c_str(), v.reg, 2 * v.size, v.val,
+				       2 * it->second->size, it->second->val);
+				changed++;
+			}
+		}
+	}
+	printf("%u of %u registers changed\n", changed, total);
+}
+
 static void print_name(struct v4l2_dbg_chip_info *chip)
 {
 	printf("%-10s (%c%c)\n", chip->name,
@@ -339,6 +552,9 @@ int main(int argc, char **argv)
 	std::string reg_set_arg;
 	unsigned long long reg_min = 0, reg_max = 0;
 	std::vector<std::string> get_regs;
+	std::vector<struct v4l2_dbg_match> chips;
+	const char *snapshot_file = nullptr;
+	const char *diff_file = nullptr;
 	struct v4l2_dbg_match match;
 	char *p;
 
@@ -403,15 +619,14 @@ int main(int argc, char **argv)
 			if (!memcmp(optarg, "subdev", 6) && isdigit(optarg[6])) {
 				match.type = V4L2_CHIP_MATCH_SUBDEV;
 				match.addr = strtoul(optarg + 6, nullptr, 0);
-				break;
-			}
-			if (!memcmp(optarg, "bridge", 6)) {
+			} else if (!memcmp(optarg, "bridge", 6)) {
 				match.type = V4L2_CHIP_MATCH_BRIDGE;
 				match.addr = strtoul(optarg + 6, nullptr, 0);
-				break;
+			} else {
+				match.type = V4L2_CHIP_MATCH_BRIDGE;
+				match.addr = 0;
 			}
-			match.type = V4L2_CHIP_MATCH_BRIDGE;
-			match.addr = 0;
+			chips.push_back(match);
 			break;
 
 		case OptSetRegister:
@@ -454,6 +669,14 @@ int main(int argc, char **argv)
 		case OptListSymbols:
 			break;
 
+		case OptSnapshot:
+			snapshot_file = optarg;
+			break;
+
+		case OptDiff:
+			diff_file = optarg;
+			break;
+
 		case ':':
 			fprintf(stderr, "Option `%s' requires a value\n",
 				argv[optind]);
@@ -648,38 +871,65 @@ int main(int argc, char **argv)
 			*p = '\0';
 		name = chip_info.name;
 
-		if (name == "saa7115") {
-			print_regs(fd, &get_reg, 0, 0xff, stride);
-		} else if (name == "saa717x") {
-			// FIXME: use correct reg regions
-			print_regs(fd, &get_reg, 0, 0xff, stride);
-		} else if (name == "saa7127") {
-			print_regs(fd, &get_reg, 0, 0x7f, stride);
-		} else if (name == "ov7670") {
-			print_regs(fd, &get_reg, 0, 0x89, stride);
-		} else if (name == "cx25840") {
-			print_regs(fd, &get_reg, 0, 2, stride);
-			print_regs(fd, &get_reg, 0x100, 0x15f, stride);
-			print_regs(fd, &get_reg, 0x200, 0x23f, stride);
-			print_regs(fd, &get_reg, 0x400, 0x4bf, stride);
-			print_regs(fd, &get_reg, 0x800, 0x9af, stride);
-		} else if (name == "cs5345") {
-			print_regs(fd, &get_reg, 1, 0x10, stride);
-		} else if (name == "cx23416") {
-			print_regs(fd, &get_reg, 0x02000000, 0x020000ff, stride);
-		} else if (name == "cx23418") {
-			print_regs(fd, &get_reg, 0x02c40000, 0x02c409c7, stride);
-		} else if (name == "cafe") {
-			print_regs(fd, &get_reg, 0, 0x43, stride);
-			print_regs(fd, &get_reg, 0x88, 0x8f, stride);
-			print_regs(fd, &get_reg, 0xb4, 0xbb, stride);
-			print_regs(fd, &get_reg, 0x3000, 0x300c, stride);
+		for (const auto &r : chip_ranges(name))
+			print_regs(fd, &get_reg, r.min, r.max, stride);
+	}
+list_done:
+
+	if (options[OptSnapshot] || options[OptDiff]) {
+		std::vector<chip_snapshot> old_snap, snap;
+		size_t nregs = 0;
+
+		if (options[OptDiff]) {
+			/* Read again the same registers */
+			if (!load_snapshot(diff_file, old_snap))
+				std::exit(EXIT_FAILURE);
+			for (const auto &old : old_snap) {
+				snap.emplace_back();
+				snap.back().match = old.match;
+				snap.back().id = old.id;
+				for (const auto &v : old.regs)
+					snap.back().ranges.push_back({ v.reg, v.reg });
+			}
 		} else {
-			/* unknown chip, dump 0-0xff by default */
-			print_regs(fd, &get_reg, 0, 0xff, stride);
+			if (chips.empty())
+				chips.push_back(match);
+			for (const auto &m : chips) {
+				snap.emplace_back();
+				snap.back().match = m;
+				snap.back().id = chip_id(m);
+				if (!reg_min_arg.empty()) {
+					reg_min = parse_reg(curr_bd, reg_min_arg);
+					if (reg_max_arg.empty())
+						reg_max = reg_min + 0xff;
+					else
+						reg_max = parse_reg(curr_bd, reg_max_arg);
+					snap.back().ranges.push_back({ reg_min, reg_max });
+					continue;
+				}
+				chip_info.match = m;
+				if (doioctl(fd, VIDIOC_DBG_G_CHIP_INFO, &chip_info, "VIDIOC_DBG_G_CHIP_INFO") != 0)
+					chip_info.name[0] = '\0';
+				p = std::strchr(chip_info.name, ' ');
+				if (p)
+					*p = '\0';
+				snap.back().ranges = chip_ranges(chip_info.name);
+			}
 		}
+
+		auto start = std::chrono::steady_clock::now();
+		read_chips(fd, snap, forcedstride, options[OptParallel]);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		for (const auto &chip : snap)
+			nregs += chip.regs.size();
+		printf("Read %zu registers in %lld ms\n", nregs,
+		       static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()));
+		if (options[OptDiff])
+			print_diff(old_snap, snap);
+		if (options[OptSnapshot] && !save_snapshot(snapshot_file, snap))
+			std::exit(EXIT_FAILURE);
 	}
-list_done:
 
 	if (options[OptLogStatus]) {
 		static char buf[40960];
@@ -26,17 +26,23 @@
 
 #include "../libmedia_dev/get_media_devices.h"
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <argp.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 
 const char *argp_program_version = "v4l2-sysfs-path version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Mauro Carvalho Chehab <mchehab@kernel.org>";
 
 static const struct argp_option options[] = {
 	{"device", 'd', 0, 0, "use alternative device show mode", 0},
+	{"monitor", 'm', 0, 0, "keep running, showing the devices again when they change", 0},
 	{ 0, 0, 0, 0, 0, 0 }
 };
 
 static int device_mode = 0;
+static int monitor_mode = 0;
 
 static error_t parse_opt(int k, char *arg, struct argp_state *state)
 {
@@ -44,6 +50,9 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 'd':
 		device_mode++;
 		break;
+	case 'm':
+		monitor_mode++;
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -98,16 +107,11 @@ static void print_all_alsa_independent_playback(void *md)
 		printf("\n");
 }
 
-int main(int argc, char *argv[])
+static void show_devices(void *md)
 {
-	void *md;
 	const char *vid;
 	int i;
 
-	argp_parse(&argp, argc, argv, 0, 0, 0);
-
-	md = discover_media_devices();
-
 	if (device_mode) {
 		display_media_devices(md);
 	} else {
@@ -125,8 +129,79 @@ int main(int argc, char *argv[])
 
 		print_all_alsa_independent_playback(md);
 	}
+}
+
+/*
+ * Listen to the kernel uevents, updating just the nodes that were added
+ * or removed, instead of discovering all devices again.
+ */
+static int monitor_devices(void *md)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,
+	};
+	char buf[8192];
+	const char *action, *devpath, *p;
+	ssize_t len;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("Can't listen to uevents");
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
 
-	free_media_devices(md);
+	for (;;) {
+		fflush(stdout);
+		len = recv(fd, buf, sizeof(buf) - 1, 0);
+		if (len <= 0)
+			break;
+		buf[len] = '\0';
+
+		/* The message is "action@devpath", followed by KEY=value strings */
+		action = NULL;
+		devpath = NULL;
+		for (p = buf; p < buf + len; p += strlen(p) + 1) {
+			if (!strncmp(p, "ACTION=", 7))
+				action = p + 7;
+			else if (!strncmp(p, "DEVPATH=", 8))
+				devpath = p + 8;
+		}
+		if (!action || !devpath)
+			continue;
 
+		if (media_devices_hotplug(md, action, devpath) > 0) {
+			printf("\n");
+			show_devices(md);
+		}
+	}
+	close(fd);
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	void *md;
+	int ret = 0;
+
+	argp_parse(&argp, argc, argv, 0, 0, 0);
+
+	md = discover_media_devices();
+	if (!md) {
+		fprintf(stderr, "Can't discover the media devices\n");
+		return 1;
+	}
+
+	show_devices(md);
+
+	if (monitor_mode && monitor_devices(md))
+		ret = 1;
+
+	free_media_devices(md);
+
+	return ret;
+}
@@ -9,7 +9,61 @@
 
 extern struct trace_context ctx_trace;
 
-const std::list<unsigned long> ioctls = {
+/* The interposed functions, looked up once. */
+static struct {
+	int (*open)(const char *path, int oflag, ...);
+	int (*open64)(const char *path, int oflag, ...);
+	ssize_t (*write)(int fd, const void *buf, size_t count);
+	int (*close)(int fd);
+	void *(*mmap)(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+	void *(*mmap64)(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+	int (*munmap)(void *start, size_t length);
+	int (*ioctl)(int fd, unsigned long cmd, ...);
+} original;
+
+static pthread_once_t original_once = PTHREAD_ONCE_INIT;
+
+static void lookup_original(void)
+{
+	original.open = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open");
+	original.open64 = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open64");
+	original.write = (ssize_t (*)(int, const void *, size_t)) dlsym(RTLD_NEXT, "write");
+	original.close = (int (*)(int)) dlsym(RTLD_NEXT, "close");
+	original.mmap = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap");
+	original.mmap64 = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap64");
+	original.munmap = (int(*)(void *, size_t)) dlsym(RTLD_NEXT, "munmap");
+	original.ioctl = (int (*)(int, long unsigned int, ...)) dlsym(RTLD_NEXT, "ioctl");
+}
+
+/*
+ * Other libraries' constructors may already call the interposed functions
+ * before ours ran, so every wrapper makes sure they were looked up.
+ */
+static inline void get_original(void)
+{
+	pthread_once(&original_once, lookup_original);
+}
+
+/*
+ * The fast path for the interposed calls on fds that are neither a traced device
+ * nor a buffer, like the files and sockets of the application.
+ */
+static inline bool fd_may_be_traced(int fd)
+{
+	if (fd < 0)
+		return false;
+	if (fd >= TRACE_FDS_MAX)
+		return true;
+	return ctx_trace.fds[fd / TRACE_FDS_BITS_PER_LONG] & (1UL << (fd % TRACE_FDS_BITS_PER_LONG));
+}
+
+__attribute__((constructor)) static void libv4l2tracer_init(void)
+{
+	get_original();
+	trace_init();
+}
+
+const std::unordered_set<unsigned long> ioctls = {
 	VIDIOC_QUERYCAP,
 	VIDIOC_STREAMON,
 	VIDIOC_STREAMOFF,
@@ -71,15 +125,17 @@ int open(const char *path, int oflag, ...)
 		va_end(argp);
 	}
 
-	int (*original_open)(const char *path, int oflag, ...) = nullptr;
-	original_open = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open");
-	int fd = (*original_open)(path, oflag, mode);
+	get_original();
+	int fd = (*original.open)(path, oflag, mode);
+
+	if (!is_video_or_media_device(path))
+		return fd;
 	debug_line_info("\n\tfd: %d, path: %s", fd, path);
 
 	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr)
 		return fd;
 
-	if (is_video_or_media_device(path)) {
+	if (trace_path_selected(path)) {
 		trace_open(fd, path, oflag, mode, false);
 		add_device(fd, path);
 	}
@@ -90,20 +146,18 @@ int open(const char *path, int oflag, ...)
 
 ssize_t write(int fd, const void *buf, size_t count)
 {
-	ssize_t (*original_write)(int fd, const void *buf, size_t count) = nullptr;
-	original_write = (ssize_t (*)(int, const void *, size_t)) dlsym(RTLD_NEXT, "write");
-	ssize_t ret = (*original_write)(fd, buf, count);
+	get_original();
+	ssize_t ret = (*original.write)(fd, buf, count);
 
 	/*
 	 * If the write message starts with "v4l2-tracer", then assume it came from the
 	 * v4l2_tracer_info macro and trace it.
 	 */
-	std::string buf_string(static_cast<const char*>(buf), count);
-	if (buf_string.find("v4l2-tracer") == 0) {
+	static const char prefix[] = "v4l2-tracer";
+	if (count >= sizeof(prefix) - 1 && !memcmp(buf, prefix, sizeof(prefix) - 1)) {
 		json_object *write_obj = json_object_new_object();
 		json_object_object_add(write_obj, "write", json_object_new_string((const char*)buf));
 		write_json_object_to_json_file(write_obj);
-		json_object_put(write_obj);
 	}
 
 	return ret;
@@ -121,15 +175,17 @@ int open64(const char *path, int oflag, ...)
 		va_end(argp);
 	}
 
-	int (*original_open64)(const char *path, int oflag, ...) = nullptr;
-	original_open64 = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open64");
-	int fd = (*original_open64)(path, oflag, mode);
+	get_original();
+	int fd = (*original.open64)(path, oflag, mode);
+
+	if (!is_video_or_media_device(path))
+		return fd;
 	debug_line_info("\n\tfd: %d, path: %s", fd, path);
 
 	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr)
 		return fd;
 
-	if (is_video_or_media_device(path)) {
+	if (trace_path_selected(path)) {
 		add_device(fd, path);
 		trace_open(fd, path, oflag, mode, true);
 	}
@@ -142,11 +198,14 @@ int open64(const char *path, int oflag, ...)
 int close(int fd)
 {
 	errno = 0;
-	int (*original_close)(int fd) = nullptr;
-	original_close = (int (*)(int)) dlsym(RTLD_NEXT, "close");
+	get_original();
+
+	if (!fd_may_be_traced(fd))
+		return (*original.close)(fd);
+	remove_traced_fd(fd);
 
 	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr)
-		return (*original_close)(fd);
+		return (*original.close)(fd);
 
 	std::string path = get_device(fd);
 	debug_line_info("\n\tfd: %d, path: %s", fd, path.c_str());
@@ -157,7 +216,6 @@ int close(int fd)
 		json_object_object_add(close_obj, "fd", json_object_new_int(fd));
 		json_object_object_add(close_obj, "close", json_object_new_string(path.c_str()));
 		write_json_object_to_json_file(close_obj);
-		json_object_put(close_obj);
 		ctx_trace.devices.erase(fd);
 
 		/* If we removed the last device, close the json trace file. */
@@ -166,15 +224,17 @@ int close(int fd)
 	}
 	print_devices();
 
-	return (*original_close)(fd);
+	return (*original.close)(fd);
 }
 
 void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 {
 	errno = 0;
-	void *(*original_mmap)(void *addr, size_t len, int prot, int flags, int fildes, off_t off) = nullptr;
-	original_mmap = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap");
-	void *buf_address_pointer = (*original_mmap)(addr, len, prot, flags, fildes, off);
+	get_original();
+	void *buf_address_pointer = (*original.mmap)(addr, len, prot, flags, fildes, off);
+
+	if (!fd_may_be_traced(fildes))
+		return buf_address_pointer;
 
 	set_buffer_address_trace(fildes, off, (unsigned long) buf_address_pointer);
 
@@ -188,9 +248,11 @@ void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 void *mmap64(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 {
 	errno = 0;
-	void *(*original_mmap64)(void *addr, size_t len, int prot, int flags, int fildes, off_t off) = nullptr;
-	original_mmap64 = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap64");
-	void *buf_address_pointer = (*original_mmap64)(addr, len, prot, flags, fildes, off);
+	get_original();
+	void *buf_address_pointer = (*original.mmap64)(addr, len, prot, flags, fildes, off);
+
+	if (!fd_may_be_traced(fildes))
+		return buf_address_pointer;
 
 	set_buffer_address_trace(fildes, off, (unsigned long) buf_address_pointer);
 
@@ -204,9 +266,8 @@ void *mmap64(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 int munmap(void *start, size_t length)
 {
 	errno = 0;
-	int(*original_munmap)(void *start, size_t length) = nullptr;
-	original_munmap = (int(*)(void *, size_t)) dlsym(RTLD_NEXT, "munmap");
-	int ret = (*original_munmap)(start, length);
+	get_original();
+	int ret = (*original.munmap)(start, length);
 
 	/* Only trace the unmapping if the original mapping was traced. */
 	if (!buffer_is_mapped((unsigned long) start))
@@ -223,11 +284,36 @@ int munmap(void *start, size_t length)
 	json_object_object_add(munmap_obj, "munmap", munmap_args);
 
 	write_json_object_to_json_file(munmap_obj);
-	json_object_put(munmap_obj);
 
 	return ret;
 }
 
+/* Get info needed for writing the decoded video data to a yuv file. */
+static void ioctl_setup_before(unsigned long cmd, void *arg)
+{
+	if (cmd == VIDIOC_S_EXT_CTRLS)
+		s_ext_ctrls_setup(static_cast<struct v4l2_ext_controls*>(arg));
+	if (cmd == VIDIOC_QBUF)
+		qbuf_setup(static_cast<struct v4l2_buffer*>(arg));
+	if (cmd == VIDIOC_STREAMOFF)
+		streamoff_cleanup(*(static_cast<v4l2_buf_type*>(arg)));
+}
+
+/* Get additional info from driver for writing the decoded video data to a yuv file. */
+static void ioctl_setup_after(int fd, unsigned long cmd, void *arg)
+{
+	if (cmd == VIDIOC_G_FMT)
+		g_fmt_setup_trace(static_cast<struct v4l2_format*>(arg));
+	if (cmd == VIDIOC_S_FMT)
+		s_fmt_setup(static_cast<struct v4l2_format*>(arg));
+	if (cmd == VIDIOC_EXPBUF)
+		expbuf_setup(static_cast<struct v4l2_exportbuffer*>(arg));
+	if (cmd == VIDIOC_QUERYBUF)
+		querybuf_setup(fd, static_cast<struct v4l2_buffer*>(arg));
+	if (cmd == VIDIOC_DQBUF)
+		dqbuf_setup(static_cast<struct v4l2_buffer*>(arg));
+}
+
 int ioctl(int fd, unsigned long cmd, ...)
 {
 	errno = 0;
@@ -236,15 +322,31 @@ int ioctl(int fd, unsigned long cmd, ...)
 	void *arg = va_arg(argp, void *);
 	va_end(argp);
 
-	int (*original_ioctl)(int fd, unsigned long cmd, ...) = nullptr;
-	original_ioctl = (int (*)(int, long unsigned int, ...)) dlsym(RTLD_NEXT, "ioctl");
+	get_original();
+
+	/* Don't trace ioctls that are not in the specified ioctls list. */
+	if ((_IOC_TYPE(cmd) != 'V' && _IOC_TYPE(cmd) != '|') || !ioctls.count(cmd))
+		return (*original.ioctl)(fd, cmd, arg);
 
 	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr)
-		return (*original_ioctl)(fd, cmd, arg);
+		return (*original.ioctl)(fd, cmd, arg);
 
-	/* Don't trace ioctls that are not in the specified ioctls list. */
-	if (find(ioctls.begin(), ioctls.end(), cmd) == ioctls.end())
-		return (*original_ioctl)(fd, cmd, arg);
+	/* Don't trace ioctls on devices that were filtered out with --paths. */
+	if (!trace_fd_selected(fd))
+		return (*original.ioctl)(fd, cmd, arg);
+
+	/*
+	 * Ioctls that were filtered out with --ioctls are not traced, but the
+	 * buffer bookkeeping still has to see them.
+	 */
+	if (!trace_ioctl_selected(cmd)) {
+		if (arg == nullptr)
+			return (*original.ioctl)(fd, cmd, arg);
+		ioctl_setup_before(cmd, arg);
+		int ret = (*original.ioctl)(fd, cmd, arg);
+		ioctl_setup_after(fd, cmd, arg);
+		return ret;
+	}
 
 	json_object *ioctl_obj = json_object_new_object();
 	json_object_object_add(ioctl_obj, "fd", json_object_new_int(fd));
@@ -253,31 +355,28 @@ int ioctl(int fd, unsigned long cmd, ...)
 
 	/* Don't attempt to trace a nullptr. */
 	if (arg == nullptr) {
-		int ret = (*original_ioctl)(fd, cmd, arg);
+		__u64 start_ns = get_time_ns();
+		int ret = (*original.ioctl)(fd, cmd, arg);
+		add_call_timing(ioctl_obj, start_ns);
 		if (errno)
 			json_object_object_add(ioctl_obj, "errno",
 			                       json_object_new_string(STRERR(errno)));
 		write_json_object_to_json_file(ioctl_obj);
-		json_object_put(ioctl_obj);
 		return ret;
 	}
 
-	/* Get info needed for writing the decoded video data to a yuv file. */
-	if (cmd == VIDIOC_S_EXT_CTRLS)
-		s_ext_ctrls_setup(static_cast<struct v4l2_ext_controls*>(arg));
-	if (cmd == VIDIOC_QBUF)
-		qbuf_setup(static_cast<struct v4l2_buffer*>(arg));
-	if (cmd == VIDIOC_STREAMOFF)
-		streamoff_cleanup(*(static_cast<v4l2_buf_type*>(arg)));
+	ioctl_setup_before(cmd, arg);
 
 	/*
 	 * To avoid cluttering the trace file, only trace userspace arguments when necessary
 	 * or if the option to trace them is selected.
 	 */
 	if (((cmd & IOC_INOUT) == IOC_IN) ||
-		(getenv("V4L2_TRACER_OPTION_TRACE_USERSPACE_ARG") != nullptr) ||
+		ctx_trace.options.trace_userspace_arg ||
 		(cmd == VIDIOC_QBUF)) {
-		json_object *ioctl_args_userspace = trace_ioctl_args(cmd, arg);
+		json_object *ioctl_args_userspace = ctx_trace.options.raw_args ?
+		                                    trace_ioctl_args_raw(cmd, arg) :
+		                                    trace_ioctl_args(cmd, arg);
 		/* Some ioctls won't have arguments to trace e.g. MEDIA_REQUEST_IOC_QUEUE. */
 		if (json_object_object_length(ioctl_args_userspace))
 			json_object_object_add(ioctl_obj, "from_userspace", ioctl_args_userspace);
@@ -286,14 +385,18 @@ int ioctl(int fd, unsigned long cmd, ...)
 	}
 
 	/* Make the original ioctl call. */
-	int ret = (*original_ioctl)(fd, cmd, arg);
+	__u64 start_ns = get_time_ns();
+	int ret = (*original.ioctl)(fd, cmd, arg);
+	add_call_timing(ioctl_obj, start_ns);
 
 	if (errno)
 		json_object_object_add(ioctl_obj, "errno", json_object_new_string(STRERR(errno)));
 
 	/* Trace driver arguments if userspace will be reading them i.e. _IOR or _IOWR ioctls */
 	if ((cmd & IOC_OUT) != 0U) {
-		json_object *ioctl_args_driver = trace_ioctl_args(cmd, arg);
+		json_object *ioctl_args_driver = ctx_trace.options.raw_args ?
+		                                 trace_ioctl_args_raw(cmd, arg) :
+		                                 trace_ioctl_args(cmd, arg);
 		/* Some ioctls won't have arguments to trace e.g. MEDIA_REQUEST_IOC_QUEUE. */
 		if (json_object_object_length(ioctl_args_driver))
 			json_object_object_add(ioctl_obj, "from_driver", ioctl_args_driver);
@@ -302,23 +405,8 @@ int ioctl(int fd, unsigned long cmd, ...)
 	}
 
 	write_json_object_to_json_file(ioctl_obj);
-	json_object_put(ioctl_obj);
-
-	/* Get additional info from driver for writing the decoded video data to a yuv file. */
-	if (cmd == VIDIOC_G_FMT)
-		g_fmt_setup_trace(static_cast<struct v4l2_format*>(arg));
-	if (cmd == VIDIOC_S_FMT)
-		s_fmt_setup(static_cast<struct v4l2_format*>(arg));
-	if (cmd == VIDIOC_EXPBUF)
-		expbuf_setup(static_cast<struct v4l2_exportbuffer*>(arg));
-	if (cmd == VIDIOC_QUERYBUF)
-		querybuf_setup(fd, static_cast<struct v4l2_buffer*>(arg));
-	if (cmd == VIDIOC_DQBUF)
-		dqbuf_setup(static_cast<struct v4l2_buffer*>(arg));
 
-	/* Get info needed for tracing dynamic arrays */
-	if (cmd == VIDIOC_QUERY_EXT_CTRL)
-		query_ext_ctrl_setup(fd, static_cast<struct v4l2_query_ext_ctrl*>(arg));
+	ioctl_setup_after(fd, cmd, arg);
 
 	return ret;
 }
@@ -4,31 +4,25 @@
  */
 
 #include "retrace.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 struct retrace_context ctx_retrace = {};
 
 bool buffer_in_retrace_context(int fd, __u32 offset)
 {
-	bool buffer_in_retrace_context = false;
-	for (auto &b : ctx_retrace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			buffer_in_retrace_context = true;
-			break;
-		}
-	}
-	return buffer_in_retrace_context;
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	return ctx_retrace.buffers_by_fd_offset.count(buffer_key(fd, offset)) != 0;
 }
 
 int get_buffer_fd_retrace(__u32 type, __u32 index)
 {
-	int fd = -1;
-	for (auto &b : ctx_retrace.buffers) {
-		if ((b.type == type) && (b.index == index)) {
-			fd = b.fd;
-			break;
-		}
-	}
-	return fd;
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	auto it = ctx_retrace.buffers_by_type_index.find(buffer_key(type, index));
+	if (it == ctx_retrace.buffers_by_type_index.end())
+		return -1;
+	return it->second->fd;
 }
 
 void add_buffer_retrace(int fd, __u32 type, __u32 index, __u32 offset)
@@ -38,40 +32,56 @@ void add_buffer_retrace(int fd, __u32 type, __u32 index, __u32 offset)
 	buf.type = type;
 	buf.index = index;
 	buf.offset = offset;
+
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
 	ctx_retrace.buffers.push_front(buf);
+
+	auto it = ctx_retrace.buffers.begin();
+	ctx_retrace.buffers_by_fd_offset[buffer_key(fd, offset)] = it;
+	ctx_retrace.buffers_by_type_index[buffer_key(type, index)] = it;
 }
 
 void remove_buffer_retrace(__u32 type, __u32 index)
 {
-	for (auto it = ctx_retrace.buffers.begin(); it != ctx_retrace.buffers.end(); ++it) {
-		if ((it->type == type) && (it->index == index)) {
-			ctx_retrace.buffers.erase(it);
-			break;
-		}
-	}
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	auto idx = ctx_retrace.buffers_by_type_index.find(buffer_key(type, index));
+	if (idx == ctx_retrace.buffers_by_type_index.end())
+		return;
+
+	auto it = idx->second;
+	ctx_retrace.buffers_by_type_index.erase(idx);
+	auto fd_offset = ctx_retrace.buffers_by_fd_offset.find(buffer_key(it->fd, it->offset));
+	if (fd_offset != ctx_retrace.buffers_by_fd_offset.end() && fd_offset->second == it)
+		ctx_retrace.buffers_by_fd_offset.erase(fd_offset);
+	auto address = ctx_retrace.buffers_by_address.find(it->address_trace);
+	if (address != ctx_retrace.buffers_by_address.end() && address->second == it)
+		ctx_retrace.buffers_by_address.erase(address);
+	ctx_retrace.buffers.erase(it);
 }
 
 void set_buffer_address_retrace(int fd, __u32 offset, long address_trace, long address_retrace)
 {
-	for (auto &b : ctx_retrace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.address_trace = address_trace;
-			b.address_retrace = address_retrace;
-			break;
-		}
-	}
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	auto idx = ctx_retrace.buffers_by_fd_offset.find(buffer_key(fd, offset));
+	if (idx == ctx_retrace.buffers_by_fd_offset.end())
+		return;
+
+	auto it = idx->second;
+	auto old = ctx_retrace.buffers_by_address.find(it->address_trace);
+	if (old != ctx_retrace.buffers_by_address.end() && old->second == it)
+		ctx_retrace.buffers_by_address.erase(old);
+	it->address_trace = address_trace;
+	it->address_retrace = address_retrace;
+	ctx_retrace.buffers_by_address[address_trace] = it;
 }
 
 long get_retrace_address_from_trace_address(long address_trace)
 {
-	long address_retrace = 0;
-	for (auto &b : ctx_retrace.buffers) {
-		if (b.address_trace == address_trace) {
-			address_retrace = b.address_retrace;
-			break;
-		}
-	}
-	return address_retrace;
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	auto it = ctx_retrace.buffers_by_address.find(address_trace);
+	if (it == ctx_retrace.buffers_by_address.end())
+		return 0;
+	return it->second->address_retrace;
 }
 
 void print_buffers_retrace(void)
@@ -86,13 +96,21 @@ void add_fd(int fd_trace, int fd_retrace)
 {
 	std::pair<int, int> new_pair;
 	new_pair = std::make_pair(fd_trace, fd_retrace);
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
 	ctx_retrace.retrace_fds.insert(new_pair);
 }
 
+void remove_fd(int fd_trace)
+{
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	ctx_retrace.retrace_fds.erase(fd_trace);
+}
+
 int get_fd_retrace_from_fd_trace(int fd_trace)
 {
 	int fd_retrace = -1;
 	std::unordered_map<int, int>::const_iterator it;
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
 	it = ctx_retrace.retrace_fds.find(fd_trace);
 	if (it != ctx_retrace.retrace_fds.end())
 		fd_retrace = it->second;
@@ -172,6 +190,65 @@ std::string get_path_retrace_from_path_trace(std::string path_trace, json_object
 	return "";
 }
 
+/* Read a payload stored by --binary from the side-car file next to the json file. */
+static void read_from_mem_file(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj,
+                               json_object *mem_file_obj)
+{
+	std::string filename;
+	if (json_object_get_string(mem_file_obj) != nullptr)
+		filename = json_object_get_string(mem_file_obj);
+	size_t pos = ctx_retrace.trace_filename.rfind('/');
+	if (pos != std::string::npos)
+		filename = ctx_retrace.trace_filename.substr(0, pos + 1) + filename;
+
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	if (ctx_retrace.mem_file == nullptr || ctx_retrace.mem_filename != filename) {
+		if (ctx_retrace.mem_file != nullptr)
+			fclose(ctx_retrace.mem_file);
+		ctx_retrace.mem_filename = filename;
+		ctx_retrace.mem_file = fopen(filename.c_str(), "r");
+		if (ctx_retrace.mem_file == nullptr) {
+			line_info("\n\tCan't open \'%s\'", filename.c_str());
+			return;
+		}
+	}
+
+	json_object *offset_obj;
+	json_object_object_get_ex(mem_obj, "mem_offset", &offset_obj);
+	off_t offset = json_object_get_uint64(offset_obj);
+	json_object *size_obj;
+	json_object_object_get_ex(mem_obj, "mem_size", &size_obj);
+	size_t size = json_object_get_uint64(size_obj);
+	json_object *compression_obj;
+	bool compressed = json_object_object_get_ex(mem_obj, "mem_compression", &compression_obj);
+
+	std::vector<unsigned char> data(size);
+	if (fseeko(ctx_retrace.mem_file, offset, SEEK_SET) ||
+	    fread(data.data(), 1, size, ctx_retrace.mem_file) != size) {
+		line_info("\n\tCan't read %zu bytes at %jd from \'%s\'",
+		          size, (intmax_t)offset, filename.c_str());
+		return;
+	}
+
+	size_t byteswritten;
+	if (compressed) {
+#ifdef HAVE_ZSTD
+		byteswritten = ZSTD_decompress(buffer_pointer, bytesused, data.data(), size);
+		if (ZSTD_isError(byteswritten)) {
+			line_info("\n\tCan't decompress: %s", ZSTD_getErrorName(byteswritten));
+			return;
+		}
+#else
+		line_info("\n\tCan't decompress, v4l2-tracer was built without zstd support.");
+		return;
+#endif
+	} else {
+		byteswritten = std::min(size, (size_t) bytesused);
+		memcpy(buffer_pointer, data.data(), byteswritten);
+	}
+	debug_line_info("\n\tbytesused: %d, byteswritten: %zu", bytesused, byteswritten);
+}
+
 void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj)
 {
 	int byteswritten = 0;
@@ -180,6 +257,12 @@ void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_o
 	size_t number_of_lines;
 	std::string compressed_video_data;
 
+	json_object *mem_file_obj;
+	if (json_object_object_get_ex(mem_obj, "mem_file", &mem_file_obj)) {
+		read_from_mem_file(buffer_pointer, bytesused, mem_obj, mem_file_obj);
+		return;
+	}
+
 	json_object *mem_array_obj;
 	json_object_object_get_ex(mem_obj, "mem_array", &mem_array_obj);
 	number_of_lines = json_object_array_length(mem_array_obj);
@@ -210,6 +293,176 @@ void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_o
 	debug_line_info("\n\tbytesused: %d, byteswritten: %d", bytesused, byteswritten);
 }
 
+/*
+ * Compare a decoded frame with the hash stored by --hash when the frame was
+ * traced. The first mismatch is always reported, the others only if verbose.
+ */
+void check_decoded_frame(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj)
+{
+	json_object *hash_obj;
+	if (!json_object_object_get_ex(mem_obj, "mem_hash", &hash_obj))
+		return;
+
+	json_object *index_obj;
+	json_object_object_get_ex(mem_obj, "index", &index_obj);
+	int index = json_object_get_int(index_obj);
+
+	if (buffer_pointer == nullptr) {
+		debug_line_info("\n\tCan't check decoded frame, index: %d isn't mapped", index);
+		return;
+	}
+
+	json_object *hash_bytes_obj;
+	__u32 hash_bytes = bytesused;
+	if (json_object_object_get_ex(mem_obj, "mem_hash_bytes", &hash_bytes_obj))
+		hash_bytes = std::min((__u32) json_object_get_int64(hash_bytes_obj), (__u32) bytesused);
+
+	std::string hash_trace = json_object_get_string(hash_obj);
+	std::string hash_retrace = hash2s(hash_buffer(buffer_pointer, hash_bytes));
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
+	unsigned long frame = ctx_retrace.frames_checked++;
+
+	if (hash_retrace == hash_trace)
+		return;
+
+	if (!ctx_retrace.frames_mismatched++) {
+		ctx_retrace.first_mismatch = frame;
+		fprintf(stderr, "Decoded frame %lu (index %d) doesn't match the trace: %s, expected %s\n",
+		        frame, index, hash_retrace.c_str(), hash_trace.c_str());
+	} else if (is_verbose()) {
+		fprintf(stderr, "Decoded frame %lu (index %d) doesn't match the trace\n", frame, index);
+	}
+}
+
+/*
+ * Point an ioctl argument stored with --raw_args to the memory stored after it,
+ * see RAW_ARGS_ALIGN. Return false if the data is too short for the argument.
+ */
+static bool raw_args_fixup(unsigned long cmd, unsigned char *data, size_t size)
+{
+	size_t offset = raw_args_align(_IOC_SIZE(cmd));
+
+	switch (cmd) {
+	case VIDIOC_G_EXT_CTRLS:
+	case VIDIOC_TRY_EXT_CTRLS:
+	case VIDIOC_S_EXT_CTRLS: {
+		struct v4l2_ext_controls *ext_controls = reinterpret_cast<struct v4l2_ext_controls*>(data);
+		if (ext_controls->controls == nullptr)
+			break;
+		size_t controls_size = ext_controls->count * sizeof(struct v4l2_ext_control);
+		if (offset + controls_size > size)
+			return false;
+		ext_controls->controls = reinterpret_cast<struct v4l2_ext_control*>(data + offset);
+		offset = raw_args_align(offset + controls_size);
+		/* The payloads are left out if the driver returned ENOSPC. */
+		for (__u32 i = 0; i < ext_controls->count; i++) {
+			struct v4l2_ext_control *ctrl = &ext_controls->controls[i];
+			if (!ctrl->size || ctrl->ptr == nullptr)
+				continue;
+			if (offset + ctrl->size > size) {
+				ctrl->ptr = nullptr;
+				continue;
+			}
+			ctrl->ptr = data + offset;
+			offset = raw_args_align(offset + ctrl->size);
+		}
+		break;
+	}
+	case VIDIOC_PREPARE_BUF:
+	case VIDIOC_QUERYBUF:
+	case VIDIOC_QBUF:
+	case VIDIOC_DQBUF: {
+		struct v4l2_buffer *buf = reinterpret_cast<struct v4l2_buffer*>(data);
+		if ((buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE &&
+		     buf->type != V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) || buf->m.planes == nullptr)
+			break;
+		size_t planes_size = std::min(buf->length, (__u32) VIDEO_MAX_PLANES) * sizeof(struct v4l2_plane);
+		if (offset + planes_size > size)
+			return false;
+		buf->m.planes = reinterpret_cast<struct v4l2_plane*>(data + offset);
+		break;
+	}
+	default:
+		break;
+	}
+
+	return true;
+}
+
+/* Return the json of an ioctl argument stored with --raw_args, or nullptr if it can't be rendered. */
+static json_object *render_raw_args(unsigned long cmd, json_object *raw_obj)
+{
+	std::string ioctl_name = val2s(cmd, ioctl_val_def);
+
+	json_object *schema_obj;
+	json_object_object_get_ex(raw_obj, "schema", &schema_obj);
+	if ((__u32) json_object_get_int64(schema_obj) != ioctl_schema(cmd)) {
+		line_info("\n\tCan't render %s, its argument was traced with a different layout.",
+		          ioctl_name.c_str());
+		return nullptr;
+	}
+
+	json_object *ctrl_schema_obj;
+	if (json_object_object_get_ex(raw_obj, "ctrl_schema", &ctrl_schema_obj) &&
+	    (__u32) json_object_get_int64(ctrl_schema_obj) != ctrl_schema_id) {
+		line_info("\n\tCan't render %s, its controls were traced with a different layout.",
+		          ioctl_name.c_str());
+		return nullptr;
+	}
+
+	json_object *size_obj;
+	json_object_object_get_ex(raw_obj, "raw_size", &size_obj);
+	size_t size = json_object_get_uint64(size_obj);
+	if (size < _IOC_SIZE(cmd)) {
+		line_info("\n\tCan't render %s, its argument is truncated.", ioctl_name.c_str());
+		return nullptr;
+	}
+
+	/* Keep the structs in the data aligned. */
+	std::vector<__u64> data(raw_args_align(size) / sizeof(__u64));
+	unsigned char *ptr = reinterpret_cast<unsigned char *>(data.data());
+	write_to_output_buffer(ptr, size, raw_obj);
+	if (!raw_args_fixup(cmd, ptr, size)) {
+		line_info("\n\tCan't render %s, its argument is truncated.", ioctl_name.c_str());
+		return nullptr;
+	}
+
+	return trace_ioctl_args(cmd, ptr);
+}
+
+/*
+ * Replace the ioctl arguments stored with --raw_args by the json the tracer
+ * writes without it. Arguments that can't be rendered are left as they are.
+ */
+void render_raw_ioctl_args(json_object *ioctl_obj)
+{
+	json_object *cmd_obj;
+	json_object_object_get_ex(ioctl_obj, "ioctl", &cmd_obj);
+	unsigned long cmd = s2val(json_object_get_string(cmd_obj), ioctl_val_def);
+	bool failed = json_object_object_get_ex(ioctl_obj, "errno", nullptr);
+	const char *keys[] = { "from_userspace", "from_driver" };
+
+	for (const char *key : keys) {
+		json_object *raw_obj;
+		if (!json_object_object_get_ex(ioctl_obj, key, &raw_obj) ||
+		    !json_object_object_get_ex(raw_obj, "raw_size", nullptr))
+			continue;
+
+		/* The json of a failed ioctl depends on errno, e.g. error_idx. */
+		errno = (failed && strcmp(key, "from_driver") == 0) ? EINVAL : 0;
+		json_object *args_obj = render_raw_args(cmd, raw_obj);
+		errno = 0;
+		if (args_obj == nullptr)
+			continue;
+		if (json_object_object_length(args_obj))
+			json_object_object_add(ioctl_obj, key, args_obj);
+		else {
+			json_object_put(args_obj);
+			json_object_object_del(ioctl_obj, key);
+		}
+	}
+}
+
 void compare_program_versions(json_object *v4l2_tracer_info_obj)
 {
 	json_object *package_version_obj;
@@ -243,6 +496,7 @@ void print_context(void)
 {
 	if (!is_debug())
 		return;
+	std::lock_guard<std::mutex> lk(ctx_retrace.lock);
 	print_fds();
 	print_buffers_retrace();
 	fprintf(stderr, "\n");
@@ -4,6 +4,10 @@
  */
 
 #include "retrace.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <thread>
 
 extern struct retrace_context ctx_retrace;
 
@@ -182,7 +186,7 @@ void retrace_close(json_object *jobj)
 		return;
 
 	close(fd_retrace);
-	ctx_retrace.retrace_fds.erase(json_object_get_int(fd_trace_obj));
+	remove_fd(json_object_get_int(fd_trace_obj));
 
 	if (is_verbose() || (errno != 0)) {
 		fprintf(stderr, "fd: %d ", fd_retrace);
@@ -217,6 +221,10 @@ struct v4l2_plane *retrace_v4l2_plane(json_object *plane_obj, __u32 memory)
 		json_object *mem_offset_obj;
 		json_object_object_get_ex(m_obj, "mem_offset", &mem_offset_obj);
 		ptr->m.mem_offset = (__u32) json_object_get_int64(mem_offset_obj);
+	} else if (memory == V4L2_MEMORY_DMABUF) {
+		json_object *fd_obj;
+		if (json_object_object_get_ex(m_obj, "fd", &fd_obj))
+			ptr->m.fd = get_fd_retrace_from_fd_trace(json_object_get_int(fd_obj));
 	}
 
 	json_object *data_offset_obj;
@@ -295,6 +303,10 @@ struct v4l2_buffer *retrace_v4l2_buffer(json_object *ioctl_args)
 			json_object *offset_obj;
 			json_object_object_get_ex(m_obj, "offset", &offset_obj);
 			buf->m.offset = (__u32) json_object_get_uint64(offset_obj);
+		} else if (buf->memory == V4L2_MEMORY_DMABUF) {
+			json_object *fd_obj;
+			if (json_object_object_get_ex(m_obj, "fd", &fd_obj))
+				buf->m.fd = get_fd_retrace_from_fd_trace(json_object_get_int(fd_obj));
 		}
 	}
 
@@ -1455,6 +1467,8 @@ void retrace_mem(json_object *mem_obj)
 	/* Get the encoded data from the json file and write it to output buffer memory. */
 	if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE || type == V4L2_BUF_TYPE_VIDEO_OUTPUT)
 		write_to_output_buffer(buffer_pointer, bytesused, mem_obj);
+	else
+		check_decoded_frame(buffer_pointer, bytesused, mem_obj);
 
 	debug_line_info("\n\t%s, bytesused: %d, offset: %d, addr: %ld",
 			val2s(type, v4l2_buf_type_val_def).c_str(),
@@ -1467,6 +1481,7 @@ void retrace_object(json_object *jobj)
 	errno = 0;
 	json_object *temp_obj;
 	if (json_object_object_get_ex(jobj, "ioctl", &temp_obj)) {
+		render_raw_ioctl_args(jobj);
 		retrace_ioctl(jobj);
 		return;
 	}
@@ -1520,21 +1535,470 @@ void retrace_object(json_object *jobj)
 	line_info("\n\tWarning: unexpected JSON object in trace file.");
 }
 
-void retrace_array(json_object *root_array_obj)
+struct ioctl_latency {
+	unsigned count;
+	__u64 trace_total_ns;
+	__u64 trace_max_ns;
+	__u64 retrace_total_ns;
+	__u64 retrace_max_ns;
+};
+
+/*
+ * With --speed the calls are replayed at the timestamp_ns of the trace, scaled
+ * by the speed, relative to the first call.
+ */
+struct retrace_timing {
+	/* With --threads the calls of each device are timed on their own thread. */
+	std::mutex lock;
+	double speed;
+	bool started;
+	__u64 trace_start_ns;
+	__u64 retrace_start_ns;
+	unsigned calls;
+	unsigned late_calls;
+	__u64 total_lag_ns;
+	__u64 max_lag_ns;
+	std::map<std::string, struct ioctl_latency> ioctls;
+};
+
+static struct retrace_timing timing;
+
+/* A call is late when it is replayed more than this after its time. */
+#define RETRACE_LATE_NS 1000000ULL
+
+static void retrace_wait(json_object *jobj)
 {
-	json_object *jobj;
-	struct array_list *array_list_pointer = json_object_get_array(root_array_obj);
-	size_t json_objects_in_file = array_list_length(array_list_pointer);
+	json_object *timestamp_obj;
+	if (!json_object_object_get_ex(jobj, "timestamp_ns", &timestamp_obj))
+		return;
+	__u64 timestamp_ns = json_object_get_uint64(timestamp_obj);
+	__u64 now_ns = get_time_ns();
+	std::unique_lock<std::mutex> lk(timing.lock);
+
+	if (!timing.started) {
+		timing.started = true;
+		timing.trace_start_ns = timestamp_ns;
+		timing.retrace_start_ns = now_ns;
+	}
+	if (timestamp_ns < timing.trace_start_ns)
+		return;
+
+	__u64 target_ns = timing.retrace_start_ns +
+	                  (__u64)((timestamp_ns - timing.trace_start_ns) / timing.speed);
+	timing.calls++;
+	if (now_ns < target_ns) {
+		lk.unlock();
+		struct timespec ts;
+		ts.tv_sec = target_ns / 1000000000ULL;
+		ts.tv_nsec = target_ns % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+		return;
+	}
+
+	__u64 lag_ns = now_ns - target_ns;
+	timing.total_lag_ns += lag_ns;
+	timing.max_lag_ns = std::max(timing.max_lag_ns, lag_ns);
+	if (lag_ns > RETRACE_LATE_NS)
+		timing.late_calls++;
+}
+
+static void retrace_add_latency(json_object *jobj, __u64 retrace_ns)
+{
+	json_object *ioctl_obj;
+	if (!json_object_object_get_ex(jobj, "ioctl", &ioctl_obj) ||
+	    json_object_get_string(ioctl_obj) == nullptr)
+		return;
+
+	json_object *duration_obj;
+	__u64 trace_ns = 0;
+	if (json_object_object_get_ex(jobj, "duration_ns", &duration_obj))
+		trace_ns = json_object_get_uint64(duration_obj);
+
+	std::lock_guard<std::mutex> lk(timing.lock);
+	struct ioctl_latency &latency = timing.ioctls[json_object_get_string(ioctl_obj)];
+	latency.count++;
+	latency.trace_total_ns += trace_ns;
+	latency.trace_max_ns = std::max(latency.trace_max_ns, trace_ns);
+	latency.retrace_total_ns += retrace_ns;
+	latency.retrace_max_ns = std::max(latency.retrace_max_ns, retrace_ns);
+}
+
+static void retrace_timing_report(void)
+{
+	fprintf(stderr, "Replayed %u calls at %gx speed, %u calls were late by more than %llu ms\n",
+	        timing.calls, timing.speed, timing.late_calls, RETRACE_LATE_NS / 1000000);
+	if (timing.calls)
+		fprintf(stderr, "Lag behind the trace: avg %.3f ms, max %.3f ms\n",
+		        timing.total_lag_ns / 1e6 / timing.calls, timing.max_lag_ns / 1e6);
+
+	/* Unlike the trace, the replay latency includes decoding the json object. */
+	fprintf(stderr, "%-32s %8s %12s %12s %12s %12s\n", "ioctl (latency in us)", "count",
+	        "trace avg", "trace max", "retrace avg", "retrace max");
+	for (auto &it : timing.ioctls) {
+		const struct ioctl_latency &l = it.second;
+		fprintf(stderr, "%-32s %8u %12.1f %12.1f %12.1f %12.1f\n", it.first.c_str(), l.count,
+		        l.trace_total_ns / 1e3 / l.count, l.trace_max_ns / 1e3,
+		        l.retrace_total_ns / 1e3 / l.count, l.retrace_max_ns / 1e3);
+	}
+}
+
+static void retrace_next_object(json_object *jobj)
+{
+	if (timing.speed > 0) {
+		retrace_wait(jobj);
+		__u64 start_ns = get_time_ns();
+		retrace_object(jobj);
+		retrace_add_latency(jobj, get_time_ns() - start_ns);
+	} else {
+		retrace_object(jobj);
+	}
+	json_object_put(jobj);
+}
+
+/*
+ * The trace file is a json array of objects. Instead of parsing the whole
+ * array first, parse the file in chunks and handle each object as soon as it
+ * is complete, so that the memory needed does not depend on the trace size.
+ * handle_object takes over the reference to the object.
+ */
+static int read_trace_file(FILE *trace_file, void (*handle_object)(json_object *jobj))
+{
+	const size_t chunk_size = 1 << 16;
+	std::vector<char> chunk(chunk_size);
+	json_tokener *tok = json_tokener_new();
+	bool in_object = false;
+	size_t json_objects_in_file = 0;
+	size_t len;
+	int ret = 0;
+
+	while (ret == 0 && (len = fread(chunk.data(), 1, chunk_size, trace_file)) > 0) {
+		size_t pos = 0;
+
+		while (pos < len) {
+			if (!in_object) {
+				/* Skip the array brackets and the separators between the objects. */
+				char c = chunk[pos];
+				if (std::isspace(c) || c == '[' || c == ',' || c == ']') {
+					pos++;
+					continue;
+				}
+				in_object = true;
+			}
+
+			json_object *jobj = json_tokener_parse_ex(tok, chunk.data() + pos, len - pos);
+			enum json_tokener_error err = json_tokener_get_error(tok);
+			if (err == json_tokener_continue)
+				break;
+			if (err != json_tokener_success) {
+				line_info("\n\tCan't parse JSON-object %zu: %s",
+				          json_objects_in_file + 1, json_tokener_error_desc(err));
+				ret = 1;
+				break;
+			}
+			pos += json_tokener_get_parse_end(tok);
+			json_tokener_reset(tok);
+			in_object = false;
 
+			handle_object(jobj);
+			json_objects_in_file++;
+		}
+	}
+
+	if (ret == 0 && in_object) {
+		line_info("\n\tWarning: trace file ends in the middle of a JSON-object.");
+		ret = 1;
+	}
 	if (json_objects_in_file < 3)
 		line_info("\n\tWarning: trace file may be empty.");
 
-	for (size_t i = 0; i < json_objects_in_file; i++) {
-		jobj = (json_object *) array_list_get_idx(array_list_pointer, i);
-		retrace_object(jobj);
+	json_tokener_free(tok);
+	return ret;
+}
+
+/*
+ * With --threads the calls on each device are replayed on a thread of their
+ * own, so that a DQBUF that blocks on one device doesn't hold up the others.
+ * The devices are told apart by the path they were opened with in the trace.
+ * Besides the device, a call can use other file descriptors of the trace:
+ * the buffers exported with EXPBUF, the DMABUFs queued to another device and
+ * the requests. If the last call that used one of them was on another
+ * device, the call is a sync point: it waits until that call was replayed,
+ * which keeps the handoffs between the devices in the order of the trace.
+ * Calls only wait for calls that came before them in the trace, so the
+ * threads can't deadlock. Devices are opened by the thread reading the
+ * trace, once all threads are idle.
+ */
+struct retrace_stream;
+
+/* The call number seq (counting from 1) of a stream. */
+struct retrace_sync {
+	struct retrace_stream *stream;
+	unsigned long seq;
+};
+
+struct retrace_call {
+	json_object *jobj;
+	std::vector<struct retrace_sync> syncs;
+};
+
+struct retrace_stream {
+	std::string path;
+	std::deque<struct retrace_call> calls;
+	unsigned long queued;
+	unsigned long done;
+	std::thread thread;
+};
+
+/*
+ * Allocated and never freed, since a failing call exits the program while
+ * the other threads are running.
+ */
+struct retrace_threads {
+	std::mutex lock;
+	std::condition_variable cond;
+	bool exit;
+	std::list<struct retrace_stream> streams;
+	/* The stream of each file descriptor of the trace. */
+	std::unordered_map<int, struct retrace_stream *> fd_streams;
+	/* The last call that used each file descriptor of the trace. */
+	std::unordered_map<int, struct retrace_sync> fd_last;
+	/* The file descriptor mapped at each address of the trace, for munmap. */
+	std::unordered_map<long, int> mmap_fds;
+	unsigned long syncs;
+};
+
+static struct retrace_threads *threads;
+
+/* The number of calls a thread may fall behind the reading of the trace. */
+#define RETRACE_THREAD_QUEUE 256
+
+static void retrace_thread(struct retrace_stream *stream)
+{
+	std::unique_lock<std::mutex> lk(threads->lock);
+
+	for (;;) {
+		while (stream->calls.empty() && !threads->exit)
+			threads->cond.wait(lk);
+		if (stream->calls.empty())
+			break;
+
+		struct retrace_call call = std::move(stream->calls.front());
+		stream->calls.pop_front();
+		for (auto &sync : call.syncs)
+			while (sync.stream->done < sync.seq)
+				threads->cond.wait(lk);
+		lk.unlock();
+		retrace_next_object(call.jobj);
+		lk.lock();
+		stream->done++;
+		threads->cond.notify_all();
 	}
 }
 
+static struct retrace_stream *retrace_stream_of_path(const std::string &path)
+{
+	for (auto &stream : threads->streams)
+		if (stream.path == path)
+			return &stream;
+
+	threads->streams.emplace_back();
+	struct retrace_stream *stream = &threads->streams.back();
+	stream->path = path;
+	stream->queued = 0;
+	stream->done = 0;
+	stream->thread = std::thread(retrace_thread, stream);
+	return stream;
+}
+
+/* Add the file descriptors of the trace that an ioctl uses besides the device. */
+static void retrace_ioctl_fds(json_object *ioctl_obj, std::vector<int> &fds)
+{
+	json_object *ioctl_args;
+	if (json_object_object_get_ex(ioctl_obj, "from_userspace", &ioctl_args) == false &&
+	    json_object_object_get_ex(ioctl_obj, "from_driver", &ioctl_args) == false)
+		return;
+
+	json_object *fd_obj;
+	json_object *buf_obj;
+	if (json_object_object_get_ex(ioctl_args, "v4l2_buffer", &buf_obj)) {
+		if (json_object_object_get_ex(buf_obj, "request_fd", &fd_obj))
+			fds.push_back(json_object_get_int(fd_obj));
+
+		json_object *m_obj;
+		json_object *planes_obj;
+		json_object_object_get_ex(buf_obj, "m", &m_obj);
+		if (json_object_object_get_ex(m_obj, "planes", &planes_obj))
+			json_object_object_get_ex(json_object_array_get_idx(planes_obj, 0), "m", &m_obj);
+		if (json_object_object_get_ex(m_obj, "fd", &fd_obj))
+			fds.push_back(json_object_get_int(fd_obj));
+	}
+
+	json_object *ext_controls_obj;
+	json_object *which_obj;
+	if (json_object_object_get_ex(ioctl_args, "v4l2_ext_controls", &ext_controls_obj) &&
+	    json_object_object_get_ex(ext_controls_obj, "which", &which_obj) &&
+	    s2val(json_object_get_string(which_obj), which_val_def) == V4L2_CTRL_WHICH_REQUEST_VAL &&
+	    json_object_object_get_ex(ext_controls_obj, "request_fd", &fd_obj))
+		fds.push_back(json_object_get_int(fd_obj));
+}
+
+/* The file descriptor of the trace that EXPBUF or MEDIA_IOC_REQUEST_ALLOC returned, or -1. */
+static int retrace_ioctl_new_fd(json_object *ioctl_obj)
+{
+	json_object *ioctl_args;
+	if (json_object_object_get_ex(ioctl_obj, "from_userspace", &ioctl_args) == false &&
+	    json_object_object_get_ex(ioctl_obj, "from_driver", &ioctl_args) == false)
+		return -1;
+
+	json_object *cmd_obj;
+	json_object_object_get_ex(ioctl_obj, "ioctl", &cmd_obj);
+	json_object *fd_obj;
+	json_object *expbuf_obj;
+	switch (s2val(json_object_get_string(cmd_obj), ioctl_val_def)) {
+	case VIDIOC_EXPBUF:
+		if (json_object_object_get_ex(ioctl_args, "v4l2_exportbuffer", &expbuf_obj) &&
+		    json_object_object_get_ex(expbuf_obj, "fd", &fd_obj))
+			return json_object_get_int(fd_obj);
+		break;
+	case MEDIA_IOC_REQUEST_ALLOC:
+		if (json_object_object_get_ex(ioctl_args, "request_fd", &fd_obj))
+			return json_object_get_int(fd_obj);
+		break;
+	default:
+		break;
+	}
+	return -1;
+}
+
+static void retrace_open_threaded(json_object *jobj, json_object *open_args_obj)
+{
+	json_object *fd_obj;
+	json_object_object_get_ex(jobj, "fd", &fd_obj);
+	int fd_trace = json_object_get_int(fd_obj);
+	json_object *path_obj;
+	std::string path;
+	json_object_object_get_ex(open_args_obj, "path", &path_obj);
+	if (json_object_get_string(path_obj) != nullptr)
+		path = json_object_get_string(path_obj);
+
+	/* Finding the device may pause the tracer by changing the environment. */
+	std::unique_lock<std::mutex> lk(threads->lock);
+	for (auto &stream : threads->streams)
+		while (stream.done < stream.queued)
+			threads->cond.wait(lk);
+	lk.unlock();
+
+	retrace_next_object(jobj);
+
+	lk.lock();
+	threads->fd_streams[fd_trace] = retrace_stream_of_path(path);
+	threads->fd_last.erase(fd_trace);
+}
+
+static void retrace_dispatch(json_object *jobj)
+{
+	json_object *temp_obj;
+	std::vector<int> fds;
+	int new_fd = -1;
+
+	if (json_object_object_get_ex(jobj, "open", &temp_obj) ||
+	    json_object_object_get_ex(jobj, "open64", &temp_obj)) {
+		retrace_open_threaded(jobj, temp_obj);
+		return;
+	}
+
+	if (json_object_object_get_ex(jobj, "ioctl", &temp_obj)) {
+		/* The file descriptors in arguments stored with --raw_args are needed here. */
+		render_raw_ioctl_args(jobj);
+		json_object_object_get_ex(jobj, "fd", &temp_obj);
+		fds.push_back(json_object_get_int(temp_obj));
+		retrace_ioctl_fds(jobj, fds);
+		new_fd = retrace_ioctl_new_fd(jobj);
+	} else if (json_object_object_get_ex(jobj, "mmap", &temp_obj) ||
+	           json_object_object_get_ex(jobj, "mmap64", &temp_obj)) {
+		json_object *fildes_obj;
+		json_object_object_get_ex(temp_obj, "fildes", &fildes_obj);
+		fds.push_back(json_object_get_int(fildes_obj));
+	} else if (json_object_object_get_ex(jobj, "munmap", &temp_obj)) {
+		json_object *start_obj;
+		json_object_object_get_ex(temp_obj, "start", &start_obj);
+		std::lock_guard<std::mutex> lk(threads->lock);
+		auto it = threads->mmap_fds.find(json_object_get_int64(start_obj));
+		if (it != threads->mmap_fds.end()) {
+			fds.push_back(it->second);
+			threads->mmap_fds.erase(it);
+		}
+	} else if (json_object_object_get_ex(jobj, "close", &temp_obj) ||
+	           json_object_object_get_ex(jobj, "mem_dump", &temp_obj)) {
+		json_object_object_get_ex(jobj, "fd", &temp_obj);
+		fds.push_back(json_object_get_int(temp_obj));
+	}
+
+	/* Calls that don't use a device, like the tracer info. */
+	if (fds.empty()) {
+		retrace_next_object(jobj);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lk(threads->lock);
+	struct retrace_stream *stream;
+	auto it = threads->fd_streams.find(fds[0]);
+	if (it != threads->fd_streams.end())
+		stream = it->second;
+	else
+		stream = retrace_stream_of_path("");
+
+	struct retrace_call call = { jobj, {} };
+	struct retrace_sync self = { stream, stream->queued + 1 };
+	if (new_fd >= 0) {
+		fds.push_back(new_fd);
+		threads->fd_streams[new_fd] = stream;
+	}
+	for (int fd : fds) {
+		auto last = threads->fd_last.find(fd);
+		if (last != threads->fd_last.end() && last->second.stream != stream) {
+			call.syncs.push_back(last->second);
+			threads->syncs++;
+		}
+		threads->fd_last[fd] = self;
+	}
+
+	if (json_object_object_get_ex(jobj, "close", &temp_obj)) {
+		threads->fd_streams.erase(fds[0]);
+	} else if (json_object_object_get_ex(jobj, "mmap", &temp_obj) ||
+	           json_object_object_get_ex(jobj, "mmap64", &temp_obj)) {
+		json_object *address_obj;
+		json_object_object_get_ex(jobj, "buffer_address", &address_obj);
+		threads->mmap_fds[json_object_get_int64(address_obj)] = fds[0];
+	}
+
+	while (stream->calls.size() >= RETRACE_THREAD_QUEUE)
+		threads->cond.wait(lk);
+	stream->calls.push_back(std::move(call));
+	stream->queued++;
+	threads->cond.notify_all();
+}
+
+static int retrace_threaded(FILE *trace_file)
+{
+	threads = new retrace_threads();
+
+	int ret = read_trace_file(trace_file, retrace_dispatch);
+
+	std::unique_lock<std::mutex> lk(threads->lock);
+	threads->exit = true;
+	threads->cond.notify_all();
+	lk.unlock();
+	for (auto &stream : threads->streams)
+		stream.thread.join();
+
+	fprintf(stderr, "Retraced %zu devices on their own threads, with %lu sync points\n",
+	        threads->streams.size(), threads->syncs);
+	delete threads;
+	threads = nullptr;
+	return ret;
+}
+
 int retrace(std::string trace_filename)
 {
 	struct stat sb;
@@ -1544,18 +2008,94 @@ int retrace(std::string trace_filename)
 	}
 
 	fprintf(stderr, "Retracing: %s\n", trace_filename.c_str());
+	ctx_retrace.trace_filename = trace_filename;
+
+	FILE *trace_file = fopen(trace_filename.c_str(), "r");
+
+	if (trace_file == nullptr) {
+		line_info("\n\tCan't open trace file: %s", trace_filename.c_str());
+		return 1;
+	}
 
-	json_object *root_array_obj = json_object_from_file(trace_filename.c_str());
+	if (getenv("V4L2_TRACER_OPTION_SPEED") != nullptr)
+		timing.speed = strtod(getenv("V4L2_TRACER_OPTION_SPEED"), nullptr);
 
-	if (root_array_obj == nullptr) {
-		line_info("\n\t%s\tCan't get JSON-object from file: %s",
-			  json_util_get_last_err(),
-			  trace_filename.c_str());
+	int ret;
+	if (getenv("V4L2_TRACER_OPTION_THREADS") != nullptr)
+		ret = retrace_threaded(trace_file);
+	else
+		ret = read_trace_file(trace_file, retrace_next_object);
+	fclose(trace_file);
+
+	if (timing.speed > 0)
+		retrace_timing_report();
+
+	if (ctx_retrace.frames_checked) {
+		fprintf(stderr, "Checked %lu decoded frames, %lu didn't match the trace",
+		        ctx_retrace.frames_checked, ctx_retrace.frames_mismatched);
+		if (ctx_retrace.frames_mismatched) {
+			fprintf(stderr, ", the first was frame %lu\n", ctx_retrace.first_mismatch);
+			if (!ret)
+				ret = 1;
+		} else {
+			fprintf(stderr, "\n");
+		}
+	}
+
+	if (ctx_retrace.mem_file != nullptr)
+		fclose(ctx_retrace.mem_file);
+
+	return ret;
+}
+
+static struct {
+	FILE *file;
+	int flags;
+	size_t objects;
+} dump_ctx;
+
+static void dump_object(json_object *jobj)
+{
+	json_object *temp_obj;
+	if (json_object_object_get_ex(jobj, "ioctl", &temp_obj))
+		render_raw_ioctl_args(jobj);
+
+	fputs(dump_ctx.objects++ ? ",\n" : "[\n", dump_ctx.file);
+	fputs(json_object_to_json_string_ext(jobj, dump_ctx.flags), dump_ctx.file);
+	json_object_put(jobj);
+}
+
+/* Write a copy of the trace file with the ioctl arguments stored with --raw_args rendered as json. */
+int dump(std::string trace_filename)
+{
+	FILE *trace_file = fopen(trace_filename.c_str(), "r");
+	if (trace_file == nullptr) {
+		line_info("\n\tCan't open \'%s\'", trace_filename.c_str());
+		return 1;
+	}
+	ctx_retrace.trace_filename = trace_filename;
+
+	/* Keep the dump next to the trace file, it may refer to the binary file there. */
+	size_t pos = trace_filename.rfind('/') + 1;
+	std::string dump_filename = trace_filename.substr(0, pos) + "dump_" + trace_filename.substr(pos);
+	dump_ctx.file = fopen(dump_filename.c_str(), "w");
+	if (dump_ctx.file == nullptr) {
+		line_info("\n\tCan't open \'%s\'", dump_filename.c_str());
+		fclose(trace_file);
 		return 1;
 	}
+	dump_ctx.flags = getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr ?
+	                 JSON_C_TO_STRING_PLAIN : JSON_C_TO_STRING_PRETTY;
+
+	fprintf(stderr, "Dumping: %s\n", trace_filename.c_str());
+	int ret = read_trace_file(trace_file, dump_object);
+	fputs(dump_ctx.objects ? "\n]\n" : "[\n]\n", dump_ctx.file);
+	fclose(trace_file);
+	fclose(dump_ctx.file);
 
-	retrace_array(root_array_obj);
-	json_object_put(root_array_obj);
+	if (ctx_retrace.mem_file != nullptr)
+		fclose(ctx_retrace.mem_file);
 
-	return 0;
+	fprintf(stderr, "Dump complete: %s\n", dump_filename.c_str());
+	return ret;
 }
@@ -8,6 +8,7 @@
 
 #include "v4l2-tracer-common.h"
 #include "retrace-gen.h"
+#include <mutex>
 
 struct buffer_retrace {
 	int fd;
@@ -19,13 +20,28 @@ struct buffer_retrace {
 };
 
 struct retrace_context {
+	/* Taken by the helpers, with --threads the devices are retraced on several threads. */
+	std::mutex lock;
 	/* Key is a file descriptor from the trace, value is the corresponding fd in the retrace. */
 	std::unordered_map<int, int> retrace_fds;
 	/* List of output and capture buffers being retraced. */
 	std::list<struct buffer_retrace> buffers;
+	/* Indexes into buffers, keyed by buffer_key(fd, offset), buffer_key(type, index) and address_trace */
+	std::unordered_map<__u64, std::list<struct buffer_retrace>::iterator> buffers_by_fd_offset;
+	std::unordered_map<__u64, std::list<struct buffer_retrace>::iterator> buffers_by_type_index;
+	std::unordered_map<long, std::list<struct buffer_retrace>::iterator> buffers_by_address;
+	std::string trace_filename;
+	/* The --binary side-car file that is currently open. */
+	FILE *mem_file;
+	std::string mem_filename;
+	/* Decoded frames checked against the --hash in the trace, in display order. */
+	unsigned long frames_checked;
+	unsigned long frames_mismatched;
+	unsigned long first_mismatch;
 };
 
 int retrace(std::string trace_filename);
+int dump(std::string trace_filename);
 
 bool buffer_in_retrace_context(int fd, __u32 offset = 0);
 int get_buffer_fd_retrace(__u32 type, __u32 index);
@@ -34,9 +50,12 @@ void remove_buffer_retrace(__u32 type, __u32 index);
 void set_buffer_address_retrace(int fd, __u32 offset, long address_trace, long address_retrace);
 long get_retrace_address_from_trace_address(long address_trace);
 void add_fd(int fd_trace, int fd_retrace);
+void remove_fd(int fd_trace);
 int get_fd_retrace_from_fd_trace(int fd_trace);
 std::string get_path_retrace_from_path_trace(std::string path_trace, json_object *jobj);
 void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj);
+void check_decoded_frame(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj);
+void render_raw_ioctl_args(json_object *ioctl_obj);
 void compare_program_versions(json_object *v4l2_tracer_info_obj);
 void print_context(void);
 
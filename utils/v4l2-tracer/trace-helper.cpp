@@ -4,24 +4,76 @@
  */
 
 #include "trace.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <math.h>
+#include <mutex>
+#include <signal.h>
+#include <time.h>
 
 struct trace_context ctx_trace = {};
 
 bool is_video_or_media_device(const char *path)
 {
-	std::string dev_path_video = "/dev/video";
-	std::string dev_path_media = "/dev/media";
-	bool is_video = strncmp(path, dev_path_video.c_str(), dev_path_video.length()) == 0;
-	bool is_media = strncmp(path, dev_path_media.c_str(), dev_path_media.length()) == 0;
+	static const char dev_path_video[] = "/dev/video";
+	static const char dev_path_media[] = "/dev/media";
+	bool is_video = strncmp(path, dev_path_video, sizeof(dev_path_video) - 1) == 0;
+	bool is_media = strncmp(path, dev_path_media, sizeof(dev_path_media) - 1) == 0;
 	return (is_video || is_media);
 }
 
+/* Only the devices that match one of the --paths prefixes are traced. */
+bool trace_path_selected(const char *path)
+{
+	if (ctx_trace.options.paths.empty())
+		return true;
+	for (const auto &prefix : ctx_trace.options.paths)
+		if (strncmp(path, prefix.c_str(), prefix.length()) == 0)
+			return true;
+	return false;
+}
+
+bool trace_fd_selected(int fd)
+{
+	if (ctx_trace.options.paths.empty())
+		return true;
+	return ctx_trace.devices.find(fd) != ctx_trace.devices.end();
+}
+
+bool trace_ioctl_selected(unsigned long cmd)
+{
+	if (ctx_trace.options.ioctls.empty())
+		return true;
+	return ctx_trace.options.ioctls.find(cmd) != ctx_trace.options.ioctls.end();
+}
+
+/* With --payload_every N only the payload of every Nth buffer is dumped. */
+bool trace_payload_selected(void)
+{
+	unsigned every = ctx_trace.options.payload_every;
+
+	return every <= 1 || (ctx_trace.payloads++ % every) == 0;
+}
+
 void add_device(int fd, std::string path)
 {
 	debug_line_info("\n\tfd: %d, path: %s", fd, path.c_str());
 	std::pair<int, std::string> new_pair = std::make_pair(fd, path);
 	ctx_trace.devices.insert(new_pair);
+	add_traced_fd(fd);
+}
+
+void add_traced_fd(int fd)
+{
+	if (fd >= 0 && fd < TRACE_FDS_MAX)
+		ctx_trace.fds[fd / TRACE_FDS_BITS_PER_LONG] |= 1UL << (fd % TRACE_FDS_BITS_PER_LONG);
+}
+
+void remove_traced_fd(int fd)
+{
+	if (fd >= 0 && fd < TRACE_FDS_MAX)
+		ctx_trace.fds[fd / TRACE_FDS_BITS_PER_LONG] &= ~(1UL << (fd % TRACE_FDS_BITS_PER_LONG));
 }
 
 std::string get_device(int fd)
@@ -58,20 +110,39 @@ void set_decode_order(long decode_order)
 {
 	debug_line_info("\n\t%ld", decode_order);
 
-	std::list<long>::iterator it;
-	it = find(ctx_trace.decode_order.begin(), ctx_trace.decode_order.end(), decode_order);
-	if (it == ctx_trace.decode_order.end())
-		ctx_trace.decode_order.push_front(decode_order);
+	if (ctx_trace.decode_order.insert(decode_order).second)
+		ctx_trace.decode_order_history.push_back(decode_order);
 
 	print_decode_order();
 }
 
+/*
+ * Return the most recently added display order which was not traced yet, or 0 if all were
+ * traced. The history keeps the ones already traced until they end up at its end.
+ */
 long get_decode_order(void)
 {
-	long decode_order = 0;
-	if (!ctx_trace.decode_order.empty())
-		decode_order = ctx_trace.decode_order.front();
-	return decode_order;
+	std::vector<long> &history = ctx_trace.decode_order_history;
+
+	while (!history.empty() && !ctx_trace.decode_order.count(history.back()))
+		history.pop_back();
+	return history.empty() ? 0 : history.back();
+}
+
+static struct buffer_trace *find_buffer_trace(int fd, __u32 offset)
+{
+	auto it = ctx_trace.buffers_by_fd_offset.find(buffer_key(fd, offset));
+	if (it == ctx_trace.buffers_by_fd_offset.end())
+		return nullptr;
+	return &*it->second;
+}
+
+static struct buffer_trace *find_buffer_trace_by_index(__u32 type, __u32 index)
+{
+	auto it = ctx_trace.buffers_by_type_index.find(buffer_key(type, index));
+	if (it == ctx_trace.buffers_by_type_index.end())
+		return nullptr;
+	return &*it->second;
 }
 
 void add_buffer_trace(int fd, __u32 type, __u32 index, __u32 offset = 0)
@@ -83,143 +154,114 @@ void add_buffer_trace(int fd, __u32 type, __u32 index, __u32 offset = 0)
 	buf.offset = offset;
 	buf.display_order = -1;
 	ctx_trace.buffers.push_front(buf);
+	add_traced_fd(fd);
+
+	auto it = ctx_trace.buffers.begin();
+	ctx_trace.buffers_by_fd_offset[buffer_key(fd, offset)] = it;
+	ctx_trace.buffers_by_type_index[buffer_key(type, index)] = it;
 }
 
 void remove_buffer_trace(__u32 type, __u32 index)
 {
-	for (auto it = ctx_trace.buffers.begin(); it != ctx_trace.buffers.end(); ++it) {
-		if ((it->type == type) && (it->index == index)) {
-			ctx_trace.buffers.erase(it);
-			break;
-		}
-	}
+	auto idx = ctx_trace.buffers_by_type_index.find(buffer_key(type, index));
+	if (idx == ctx_trace.buffers_by_type_index.end())
+		return;
+
+	auto it = idx->second;
+	ctx_trace.buffers_by_type_index.erase(idx);
+	auto fd_offset = ctx_trace.buffers_by_fd_offset.find(buffer_key(it->fd, it->offset));
+	if (fd_offset != ctx_trace.buffers_by_fd_offset.end() && fd_offset->second == it)
+		ctx_trace.buffers_by_fd_offset.erase(fd_offset);
+	auto address = ctx_trace.buffers_by_address.find(it->address);
+	if (address != ctx_trace.buffers_by_address.end() && address->second == it)
+		ctx_trace.buffers_by_address.erase(address);
+	auto display_order = ctx_trace.buffers_by_display_order.find(it->display_order);
+	if (display_order != ctx_trace.buffers_by_display_order.end() && display_order->second == it)
+		ctx_trace.buffers_by_display_order.erase(display_order);
+	ctx_trace.buffers.erase(it);
 }
 
 bool buffer_in_trace_context(int fd, __u32 offset)
 {
-	bool buffer_in_trace_context = false;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			buffer_in_trace_context = true;
-			break;
-		}
-	}
-	return buffer_in_trace_context;
+	return find_buffer_trace(fd, offset) != nullptr;
 }
 
 int get_buffer_fd_trace(__u32 type, __u32 index)
 {
-	int fd = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.type == type) && (b.index == index)) {
-			fd = b.fd;
-			break;
-		}
-	}
-	return fd;
+	struct buffer_trace *b = find_buffer_trace_by_index(type, index);
+	return b ? b->fd : 0;
 }
 
 __u32 get_buffer_type_trace(int fd, __u32 offset)
 {
-	__u32 type = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			type = b.type;
-			break;
-		}
-	}
-	return type;
+	struct buffer_trace *b = find_buffer_trace(fd, offset);
+	return b ? b->type : 0;
 }
 
 int get_buffer_index_trace(int fd, __u32 offset)
 {
-	int index = -1;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			index = b.index;
-			break;
-		}
-	}
-	return index;
+	struct buffer_trace *b = find_buffer_trace(fd, offset);
+	return b ? (int) b->index : -1;
 }
 
 __u32 get_buffer_offset_trace(__u32 type, __u32 index)
 {
-	__u32 offset = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.type == type) && (b.index == index)) {
-			offset = b.offset;
-			break;
-		}
-	}
-	return offset;
+	struct buffer_trace *b = find_buffer_trace_by_index(type, index);
+	return b ? b->offset : 0;
 }
 
 void set_buffer_bytesused_trace(int fd, __u32 offset, __u32 bytesused)
 {
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.bytesused = bytesused;
-			break;
-		}
-	}
+	struct buffer_trace *b = find_buffer_trace(fd, offset);
+	if (b)
+		b->bytesused = bytesused;
 }
 
 long get_buffer_bytesused_trace(int fd, __u32 offset)
 {
-	long bytesused = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			bytesused = b.bytesused;
-			break;
-		}
-	}
-	return bytesused;
+	struct buffer_trace *b = find_buffer_trace(fd, offset);
+	return b ? b->bytesused : 0;
 }
 
 void set_buffer_display_order(int fd, __u32 offset, long display_order)
 {
 	debug_line_info("\n\t%ld", display_order);
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.display_order = display_order;
-			break;
-		}
-	}
+	auto idx = ctx_trace.buffers_by_fd_offset.find(buffer_key(fd, offset));
+	if (idx == ctx_trace.buffers_by_fd_offset.end())
+		return;
+
+	auto it = idx->second;
+	auto old = ctx_trace.buffers_by_display_order.find(it->display_order);
+	if (old != ctx_trace.buffers_by_display_order.end() && old->second == it)
+		ctx_trace.buffers_by_display_order.erase(old);
+	it->display_order = display_order;
+	if (display_order >= 0)
+		ctx_trace.buffers_by_display_order[display_order] = it;
 }
 
 void set_buffer_address_trace(int fd, __u32 offset, unsigned long address)
 {
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.address = address;
-			break;
-		}
-	}
+	auto idx = ctx_trace.buffers_by_fd_offset.find(buffer_key(fd, offset));
+	if (idx == ctx_trace.buffers_by_fd_offset.end())
+		return;
+
+	auto it = idx->second;
+	auto old = ctx_trace.buffers_by_address.find(it->address);
+	if (old != ctx_trace.buffers_by_address.end() && old->second == it)
+		ctx_trace.buffers_by_address.erase(old);
+	it->address = address;
+	ctx_trace.buffers_by_address[address] = it;
 }
 
 unsigned long get_buffer_address_trace(int fd, __u32 offset)
 {
-	unsigned long address = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			address = b.address;
-			break;
-		}
-	}
-	return address;
+	struct buffer_trace *b = find_buffer_trace(fd, offset);
+	return b ? b->address : 0;
 }
 
 bool buffer_is_mapped(unsigned long buffer_address)
 {
-	bool ret = false;
-	for (auto &b : ctx_trace.buffers) {
-		if (b.address == buffer_address) {
-			ret = true;
-			break;
-		}
-	}
-	return ret;
+	return ctx_trace.buffers_by_address.count(buffer_address) != 0;
 }
 
 void print_buffers_trace(void)
@@ -378,7 +420,7 @@ void dqbuf_setup(struct v4l2_buffer *buf)
 void streamoff_cleanup(v4l2_buf_type buf_type)
 {
 	debug_line_info();
-	if (is_verbose() || (getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE") != nullptr)) {
+	if (is_verbose() || ctx_trace.options.write_decoded_to_yuv) {
 		fprintf(stderr, "VIDIOC_STREAMOFF: %s\n", val2s(buf_type, v4l2_buf_type_val_def).c_str());
 		fprintf(stderr, "%s, %s %s, width: %d, height: %d\n",
 		        val2s(ctx_trace.compression_format, v4l2_pix_fmt_val_def).c_str(),
@@ -459,40 +501,349 @@ void querybuf_setup(int fd, struct v4l2_buffer *buf)
 	}
 }
 
-void query_ext_ctrl_setup(int fd, struct v4l2_query_ext_ctrl *ptr)
+static std::vector<std::string> split_option_list(const char *list)
 {
-	if (ptr->flags & (V4L2_CTRL_FLAG_HAS_PAYLOAD|V4L2_CTRL_FLAG_DYNAMIC_ARRAY)) {
-		if (ptr->id == V4L2_CID_STATELESS_HEVC_ENTRY_POINT_OFFSETS)
-			ctx_trace.elems = ptr->elems;
+	std::vector<std::string> items;
+
+	if (list == nullptr)
+		return items;
+
+	std::string str = list;
+	size_t start = 0;
+	while (start <= str.length()) {
+		size_t end = str.find(',', start);
+		if (end == std::string::npos)
+			end = str.length();
+		if (end > start)
+			items.push_back(str.substr(start, end - start));
+		start = end + 1;
 	}
+	return items;
 }
 
-void write_json_object_to_json_file(json_object *jobj)
+/* Look up an ioctl by its name, the VIDIOC_ prefix may be left out. */
+static long ioctl_name_to_val(const std::string &name)
+{
+	for (const val_def *def = ioctl_val_def; def->val != -1; def++)
+		if (name == def->str || "VIDIOC_" + name == def->str)
+			return def->val;
+	return -1;
+}
+
+void trace_options_init(void)
 {
-	std::string json_str;
-	if (getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr)
-		json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
-	else
-		json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
+	struct trace_options &options = ctx_trace.options;
+
+	options.binary = getenv("V4L2_TRACER_OPTION_BINARY") != nullptr;
+	options.compact = getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr;
+	options.hash_decoded = getenv("V4L2_TRACER_OPTION_HASH_DECODED") != nullptr;
+	options.raw_args = getenv("V4L2_TRACER_OPTION_RAW_ARGS") != nullptr;
+	options.trace_userspace_arg = getenv("V4L2_TRACER_OPTION_TRACE_USERSPACE_ARG") != nullptr;
+	options.write_decoded_to_json = getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_JSON_FILE") != nullptr;
+	options.write_decoded_to_yuv = getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE") != nullptr;
+	if (getenv("TRACE_ID") != nullptr)
+		options.trace_id = getenv("TRACE_ID");
+
+	for (const auto &name : split_option_list(getenv("V4L2_TRACER_OPTION_IOCTLS"))) {
+		long cmd = ioctl_name_to_val(name);
+		if (cmd == -1)
+			line_info("\n\tUnknown ioctl \'%s\', ignoring it.", name.c_str());
+		else
+			options.ioctls.insert(cmd);
+	}
+	options.paths = split_option_list(getenv("V4L2_TRACER_OPTION_PATHS"));
+	if (getenv("V4L2_TRACER_OPTION_PAYLOAD_BYTES") != nullptr)
+		options.payload_bytes = strtoul(getenv("V4L2_TRACER_OPTION_PAYLOAD_BYTES"), nullptr, 0);
+	if (getenv("V4L2_TRACER_OPTION_PAYLOAD_EVERY") != nullptr)
+		options.payload_every = strtoul(getenv("V4L2_TRACER_OPTION_PAYLOAD_EVERY"), nullptr, 0);
+	if (getenv("V4L2_TRACER_OPTION_FLIGHT_RECORDER") != nullptr)
+		options.flight_recorder_s = strtoul(getenv("V4L2_TRACER_OPTION_FLIGHT_RECORDER"), nullptr, 0);
+}
+
+/*
+ * The traced calls only queue their json objects, and a writer thread
+ * serializes them and writes them to the trace file in batches. The queue is
+ * an intrusive lock-free MPSC queue: the traced threads push to the head, the
+ * writer thread pops from the tail, and queue_stub keeps it from running empty.
+ */
+struct trace_record {
+	std::atomic<trace_record *> next;
+	json_object *jobj;
+};
+
+/* Write the batch when it got this large or after this time. */
+#define TRACE_FLUSH_SIZE	(1 << 20)
+#define TRACE_FLUSH_MS		100
+#define TRACE_POLL_MS		10
+
+static trace_record queue_stub;
+static std::atomic<trace_record *> queue_head(&queue_stub);
+static trace_record *queue_tail = &queue_stub;
+static pthread_t writer_thread;
+static std::atomic<bool> writer_running;
+static std::atomic<bool> writer_stop;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cond;
+
+static void queue_push(trace_record *rec)
+{
+	rec->next.store(nullptr, std::memory_order_relaxed);
+	trace_record *prev = queue_head.exchange(rec, std::memory_order_acq_rel);
+	prev->next.store(rec, std::memory_order_release);
+}
+
+/* Only the writer thread pops, returns nullptr if there is nothing (yet). */
+static trace_record *queue_pop(void)
+{
+	trace_record *tail = queue_tail;
+	trace_record *next = tail->next.load(std::memory_order_acquire);
+
+	if (tail == &queue_stub) {
+		if (next == nullptr)
+			return nullptr;
+		queue_tail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next != nullptr) {
+		queue_tail = next;
+		return tail;
+	}
+	/* Either a push is still in progress, or tail is the last record. */
+	if (tail != queue_head.load(std::memory_order_acquire))
+		return nullptr;
+	queue_push(&queue_stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next != nullptr) {
+		queue_tail = next;
+		return tail;
+	}
+	return nullptr;
+}
+
+static bool queue_empty(void)
+{
+	return queue_tail == &queue_stub && queue_head.load() == &queue_stub;
+}
+
+static void write_batch(std::string &batch)
+{
+	if (batch.empty())
+		return;
+	fwrite(batch.c_str(), sizeof(char), batch.length(), ctx_trace.trace_file);
+	fflush(ctx_trace.trace_file);
+	batch.clear();
+}
+
+/*
+ * With --flight_recorder the ioctl and mem_dump records of the last seconds are
+ * only kept in memory, and are appended to the trace file when the tracee gets
+ * a SIGUSR1. All other records (open, mmap, close...) are written right away,
+ * since they are needed to make sense of the dumped records.
+ */
+struct flight_record {
+	__u64 timestamp_ns;
+	std::string str;
+};
+
+static std::deque<flight_record> flight_ring;
+static volatile sig_atomic_t flight_dump;
+
+static void flight_recorder_signal(int)
+{
+	flight_dump = 1;
+}
+
+static bool is_flight_recorded(json_object *jobj)
+{
+	json_object *obj;
+
+	return json_object_object_get_ex(jobj, "ioctl", &obj) ||
+	       json_object_object_get_ex(jobj, "mem_dump", &obj);
+}
+
+static void flight_record_add(json_object *jobj, const char *str)
+{
+	json_object *timestamp_obj;
+	json_object_object_get_ex(jobj, "timestamp_ns", &timestamp_obj);
+	__u64 window_ns = ctx_trace.options.flight_recorder_s * 1000000000ULL;
+	flight_record rec = { json_object_get_uint64(timestamp_obj), str };
+
+	flight_ring.push_back(std::move(rec));
+	while (flight_ring.back().timestamp_ns - flight_ring.front().timestamp_ns > window_ns)
+		flight_ring.pop_front();
+}
+
+static void flight_ring_dump(std::string &batch)
+{
+	for (const auto &rec : flight_ring) {
+		batch += rec.str;
+		batch += ",\n";
+	}
+	flight_ring.clear();
+	write_batch(batch);
+}
+
+static void *trace_writer(void *)
+{
+	int flags = ctx_trace.options.compact ? JSON_C_TO_STRING_PLAIN : JSON_C_TO_STRING_PRETTY;
+	std::string batch;
+	struct timespec last_write;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_write);
+	for (;;) {
+		trace_record *rec;
+
+		while ((rec = queue_pop()) != nullptr) {
+			const char *str = json_object_to_json_string_ext(rec->jobj, flags);
+			if (ctx_trace.options.flight_recorder_s && is_flight_recorded(rec->jobj)) {
+				flight_record_add(rec->jobj, str);
+			} else {
+				batch += str;
+				batch += ",\n";
+			}
+			json_object_put(rec->jobj);
+			delete rec;
+			if (batch.length() >= TRACE_FLUSH_SIZE)
+				write_batch(batch);
+		}
+
+		if (flight_dump) {
+			flight_dump = 0;
+			flight_ring_dump(batch);
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long elapsed_ms = (now.tv_sec - last_write.tv_sec) * 1000 +
+		                  (now.tv_nsec - last_write.tv_nsec) / 1000000;
+		if (elapsed_ms >= TRACE_FLUSH_MS) {
+			write_batch(batch);
+			last_write = now;
+		}
+
+		std::unique_lock<std::mutex> lock(writer_mutex);
+		if (writer_stop && queue_empty())
+			break;
+		writer_cond.wait_for(lock, std::chrono::milliseconds(TRACE_POLL_MS));
+	}
+	write_batch(batch);
+	return nullptr;
+}
+
+static bool start_trace_writer(void)
+{
+	std::lock_guard<std::mutex> lock(writer_mutex);
+
+	if (writer_running)
+		return true;
 
 	if (ctx_trace.trace_file == nullptr) {
-		std::string filename;
-		if (getenv("TRACE_ID") != nullptr)
-			filename = getenv("TRACE_ID");
-		ctx_trace.trace_filename = filename;
-		ctx_trace.trace_filename += ".json";
+		ctx_trace.trace_filename = ctx_trace.options.trace_id + ".json";
 		ctx_trace.trace_file = fopen(ctx_trace.trace_filename.c_str(), "a");
+		if (ctx_trace.trace_file == nullptr) {
+			line_info("\n\tCan't open \'%s\'", ctx_trace.trace_filename.c_str());
+			return false;
+		}
 	}
 
-	fwrite(json_str.c_str(), sizeof(char), json_str.length(), ctx_trace.trace_file);
-	fputs(",\n", ctx_trace.trace_file);
-	fflush(ctx_trace.trace_file);
+	/*
+	 * Write out what is still queued when the tracee exits. This is registered
+	 * after the statics used here were constructed, so it runs before they are
+	 * destroyed.
+	 */
+	static bool atexit_registered;
+	if (!atexit_registered) {
+		atexit(close_json_file);
+		atexit_registered = true;
+	}
+
+	writer_stop = false;
+	writer_running = pthread_create(&writer_thread, nullptr, trace_writer, nullptr) == 0;
+	return writer_running;
+}
+
+/* Wait until the writer thread wrote everything that was queued. */
+static void stop_trace_writer(void)
+{
+	std::unique_lock<std::mutex> lock(writer_mutex);
+
+	if (!writer_running)
+		return;
+	writer_stop = true;
+	writer_cond.notify_one();
+	lock.unlock();
+	pthread_join(writer_thread, nullptr);
+	writer_running = false;
+}
+
+void trace_init(void)
+{
+	trace_options_init();
+	/*
+	 * The child of a fork doesn't have the writer thread, so write out all
+	 * queued records before forking. The writer is restarted on the next write.
+	 */
+	pthread_atfork(stop_trace_writer, nullptr, nullptr);
+
+	if (ctx_trace.options.flight_recorder_s) {
+		struct sigaction sa = {};
+		sa.sa_handler = flight_recorder_signal;
+		sa.sa_flags = SA_RESTART;
+		sigaction(SIGUSR1, &sa, nullptr);
+	}
+}
+
+/* Record when a call started and how long it took, before errno is looked at. */
+void add_call_timing(json_object *jobj, __u64 start_ns)
+{
+	int saved_errno = errno;
+	__u64 end_ns = get_time_ns();
+
+	json_object_object_add(jobj, "timestamp_ns", json_object_new_uint64(start_ns));
+	json_object_object_add(jobj, "duration_ns", json_object_new_uint64(end_ns - start_ns));
+	errno = saved_errno;
+}
+
+/* Takes over the reference to jobj. */
+void write_json_object_to_json_file(json_object *jobj)
+{
+	/* Calls that are not timed get the time they were traced at. */
+	json_object *timestamp_obj;
+	if (!json_object_object_get_ex(jobj, "timestamp_ns", &timestamp_obj))
+		json_object_object_add(jobj, "timestamp_ns", json_object_new_uint64(get_time_ns()));
+
+	if (!writer_running && !start_trace_writer()) {
+		/* Without the writer thread write it synchronously. */
+		if (ctx_trace.trace_file != nullptr) {
+			int flags = ctx_trace.options.compact ? JSON_C_TO_STRING_PLAIN :
+			                                        JSON_C_TO_STRING_PRETTY;
+			fputs(json_object_to_json_string_ext(jobj, flags), ctx_trace.trace_file);
+			fputs(",\n", ctx_trace.trace_file);
+			fflush(ctx_trace.trace_file);
+		}
+		json_object_put(jobj);
+		return;
+	}
+
+	trace_record *rec = new trace_record;
+	rec->jobj = jobj;
+	queue_push(rec);
 }
 
 void close_json_file(void)
 {
+	stop_trace_writer();
 	if (ctx_trace.trace_file != nullptr) {
 		fclose(ctx_trace.trace_file);
 		ctx_trace.trace_file = 0;
 	}
+	if (ctx_trace.mem_file != nullptr) {
+		fclose(ctx_trace.mem_file);
+		ctx_trace.mem_file = nullptr;
+	}
+	if (ctx_trace.yuv_file != nullptr) {
+		fclose(ctx_trace.yuv_file);
+		ctx_trace.yuv_file = nullptr;
+	}
 }
@@ -4,6 +4,9 @@
  */
 
 #include "trace.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 extern struct trace_context ctx_trace;
 
@@ -63,7 +66,6 @@ void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64
 	}
 
 	write_json_object_to_json_file(open_obj);
-	json_object_put(open_obj);
 }
 
 void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off, unsigned long buf_address, bool is_mmap64)
@@ -89,7 +91,6 @@ void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t o
 	json_object_object_add(mmap_obj, "buffer_address", json_object_new_uint64(buf_address));
 
 	write_json_object_to_json_file(mmap_obj);
-	json_object_put(mmap_obj);
 }
 
 json_object *trace_buffer(unsigned char *buffer_pointer, __u32 bytesused)
@@ -113,7 +114,7 @@ json_object *trace_buffer(unsigned char *buffer_pointer, __u32 bytesused)
 			byte_count_per_line = 0;
 			json_object_array_add(mem_array_obj, json_object_new_string(str.c_str()));
 			str.clear();
-		} else if (getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") == nullptr) {
+		} else if (!ctx_trace.options.compact) {
 			/* Add a space every byte e.g. "01 2A 40 01" */
 			str += " ";
 		}
@@ -126,6 +127,64 @@ json_object *trace_buffer(unsigned char *buffer_pointer, __u32 bytesused)
 	return mem_array_obj;
 }
 
+/*
+ * Store the payload in the <TRACE_ID>.bin side-car file, zstd compressed if
+ * available, and only add its location to the json object. Payloads seen
+ * before are not stored again.
+ */
+static void trace_buffer_binary(json_object *mem_obj, unsigned char *buffer_pointer, __u32 bytesused)
+{
+	if (ctx_trace.mem_file == nullptr) {
+		ctx_trace.mem_filename = ctx_trace.options.trace_id + ".bin";
+		ctx_trace.mem_file = fopen(ctx_trace.mem_filename.c_str(), "a");
+		if (ctx_trace.mem_file == nullptr) {
+			line_info("\n\tCan't open \'%s\'", ctx_trace.mem_filename.c_str());
+			return;
+		}
+	}
+
+	__u64 hash = hash_buffer(buffer_pointer, bytesused);
+	auto it = ctx_trace.mem_blobs.find(hash);
+
+	if (it == ctx_trace.mem_blobs.end() || it->second.length != bytesused) {
+		struct mem_blob blob = {};
+		const unsigned char *data = buffer_pointer;
+		std::vector<unsigned char> compressed;
+
+		blob.size = bytesused;
+		blob.length = bytesused;
+#ifdef HAVE_ZSTD
+		compressed.resize(ZSTD_compressBound(bytesused));
+		size_t ret = ZSTD_compress(compressed.data(), compressed.size(),
+		                           buffer_pointer, bytesused, 1);
+		if (!ZSTD_isError(ret) && ret < bytesused) {
+			data = compressed.data();
+			blob.size = ret;
+			blob.compressed = true;
+		}
+#endif
+		/*
+		 * The file is opened for appending, so after the flush the position is
+		 * the end of this payload, even if other tracees append to it as well.
+		 */
+		if (fwrite(data, 1, blob.size, ctx_trace.mem_file) != blob.size ||
+		    fflush(ctx_trace.mem_file)) {
+			line_info("\n\tCan't write to \'%s\'", ctx_trace.mem_filename.c_str());
+			return;
+		}
+		blob.offset = ftello(ctx_trace.mem_file) - blob.size;
+		it = ctx_trace.mem_blobs.insert(std::make_pair(hash, blob)).first;
+		it->second = blob;
+	}
+
+	json_object_object_add(mem_obj, "mem_file",
+	                       json_object_new_string(ctx_trace.mem_filename.c_str()));
+	json_object_object_add(mem_obj, "mem_offset", json_object_new_uint64(it->second.offset));
+	json_object_object_add(mem_obj, "mem_size", json_object_new_uint64(it->second.size));
+	if (it->second.compressed)
+		json_object_object_add(mem_obj, "mem_compression", json_object_new_string("zstd"));
+}
+
 void trace_mem(int fd, __u32 offset, __u32 type, int index, __u32 bytesused, unsigned long start)
 {
 	json_object *mem_obj = json_object_new_object();
@@ -137,15 +196,38 @@ void trace_mem(int fd, __u32 offset, __u32 type, int index, __u32 bytesused, uns
 	json_object_object_add(mem_obj, "bytesused", json_object_new_uint64(bytesused));
 	json_object_object_add(mem_obj, "address", json_object_new_uint64(start));
 
-	if ((type == V4L2_BUF_TYPE_VIDEO_OUTPUT || type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) ||
-	    (getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_JSON_FILE") != nullptr)) {
-		json_object *mem_array_obj = trace_buffer((unsigned char*) start, bytesused);
-		json_object_object_add(mem_obj, "mem_array", mem_array_obj);
+	if (((type == V4L2_BUF_TYPE_VIDEO_OUTPUT || type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) ||
+	     ctx_trace.options.write_decoded_to_json) && trace_payload_selected()) {
+		/* With --payload_bytes only the start of the payload is dumped. */
+		__u32 dump_bytes = bytesused;
+		if (ctx_trace.options.payload_bytes && dump_bytes > ctx_trace.options.payload_bytes) {
+			dump_bytes = ctx_trace.options.payload_bytes;
+			json_object_object_add(mem_obj, "mem_truncated", json_object_new_uint64(dump_bytes));
+		}
+		if (ctx_trace.options.binary) {
+			trace_buffer_binary(mem_obj, (unsigned char*) start, dump_bytes);
+		} else {
+			json_object *mem_array_obj = trace_buffer((unsigned char*) start, dump_bytes);
+			json_object_object_add(mem_obj, "mem_array", mem_array_obj);
+		}
 	}
 
-	write_json_object_to_json_file(mem_obj);
+	/*
+	 * Decoded frames can be checked by retrace against this hash instead of
+	 * the frame data. Hash the same bytes as the yuv file, not the padding.
+	 */
+	if (ctx_trace.options.hash_decoded &&
+	    (type == V4L2_BUF_TYPE_VIDEO_CAPTURE || type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)) {
+		__u32 hash_bytes = get_expected_length_trace();
+		if (!hash_bytes || hash_bytes > bytesused)
+			hash_bytes = bytesused;
+		json_object_object_add(mem_obj, "mem_hash",
+		                       json_object_new_string(hash2s(hash_buffer((unsigned char*) start,
+		                                                                 hash_bytes)).c_str()));
+		json_object_object_add(mem_obj, "mem_hash_bytes", json_object_new_uint64(hash_bytes));
+	}
 
-	json_object_put(mem_obj);
+	write_json_object_to_json_file(mem_obj);
 }
 
 void trace_mem_encoded(int fd, __u32 offset)
@@ -160,476 +242,117 @@ void trace_mem_encoded(int fd, __u32 offset)
 	trace_mem(fd, offset, type, index, bytesused, start);
 }
 
-void trace_mem_decoded(void)
+/* Append a decoded frame to the <TRACE_ID>.yuv file, which is kept open until the tracee exits. */
+static void trace_mem_decoded_to_yuv(const unsigned char *buffer_pointer, unsigned length)
 {
-	int displayed_count = 0;
-	unsigned expected_length = get_expected_length_trace();
-
-	while (!ctx_trace.decode_order.empty()) {
-		std::list<buffer_trace>::iterator it;
-		long next_frame_to_be_displayed = *std::min_element(ctx_trace.decode_order.begin(),
-		                                                    ctx_trace.decode_order.end());
-		for (it = ctx_trace.buffers.begin(); it != ctx_trace.buffers.end(); ++it) {
-			if (it->display_order != next_frame_to_be_displayed)
-				continue;
-			if (!it->address)
-				break;
-			/*
-			 * If bytesused exceeds the expected length of the decoded video data,
-			 * then assume that this is extraneous padding or info added by the driver
-			 * and do not trace it.
-			 */
-			if (it->bytesused < expected_length)
-				break;
-			debug_line_info("\n\tDisplaying: %ld, %s, index: %d", it->display_order,
-					val2s(it->type, v4l2_buf_type_val_def).c_str(), it->index);
-			displayed_count++;
-
-			if (getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE") != nullptr) {
-				std::string filename;
-				if (getenv("TRACE_ID") != nullptr)
-					filename = getenv("TRACE_ID");
-				filename +=  ".yuv";
-				FILE *fp = fopen(filename.c_str(), "a");
-				unsigned char *buffer_pointer = (unsigned char*) it->address;
-				for (__u32 i = 0; i < expected_length; i++)
-					fwrite(&buffer_pointer[i], sizeof(unsigned char), 1, fp);
-				fclose(fp);
-			}
-			trace_mem(it->fd, it->offset, it->type, it->index, it->bytesused, it->address);
-			ctx_trace.decode_order.remove(next_frame_to_be_displayed);
-			it->display_order = -1;
-			break;
+	if (ctx_trace.yuv_file == nullptr) {
+		ctx_trace.yuv_filename = ctx_trace.options.trace_id + ".yuv";
+		ctx_trace.yuv_file = fopen(ctx_trace.yuv_filename.c_str(), "a");
+		if (ctx_trace.yuv_file == nullptr) {
+			line_info("\n\tCan't open \'%s\'", ctx_trace.yuv_filename.c_str());
+			return;
 		}
-		if (!it->address || it == ctx_trace.buffers.end() || it->bytesused < expected_length)
-			break;
-	}
-}
-
-json_object *trace_v4l2_plane(struct v4l2_plane *ptr, __u32 memory)
-{
-	json_object *plane_obj = json_object_new_object();
-
-	json_object_object_add(plane_obj, "bytesused", json_object_new_int64(ptr->bytesused));
-	json_object_object_add(plane_obj, "length", json_object_new_int64(ptr->length));
-
-	json_object *m_obj = json_object_new_object();
-
-	if (memory == V4L2_MEMORY_MMAP)
-		json_object_object_add(m_obj, "mem_offset", json_object_new_int64(ptr->m.mem_offset));
-	json_object_object_add(plane_obj, "m", m_obj);
-
-	json_object_object_add(plane_obj, "data_offset", json_object_new_int64(ptr->data_offset));
-
-	return plane_obj;
-}
-
-void trace_v4l2_buffer(void *arg, json_object *ioctl_args)
-{
-	json_object *buf_obj = json_object_new_object();
-	struct v4l2_buffer *buf = static_cast<struct v4l2_buffer*>(arg);
-
-	json_object_object_add(buf_obj, "index", json_object_new_uint64(buf->index));
-	json_object_object_add(buf_obj, "type",
-	                       json_object_new_string(val2s(buf->type, v4l2_buf_type_val_def).c_str()));
-	json_object_object_add(buf_obj, "bytesused", json_object_new_uint64(buf->bytesused));
-	json_object_object_add(buf_obj, "flags", json_object_new_string(fl2s_buffer(buf->flags).c_str()));
-	json_object_object_add(buf_obj, "field",
-	                       json_object_new_string(val2s(buf->field, v4l2_field_val_def).c_str()));
-	json_object *timestamp_obj = json_object_new_object();
-	json_object_object_add(timestamp_obj, "tv_sec", json_object_new_int64(buf->timestamp.tv_sec));
-	json_object_object_add(timestamp_obj, "tv_usec",
-	                       json_object_new_int64(buf->timestamp.tv_usec));
-	json_object_object_add(buf_obj, "timestamp", timestamp_obj);
-	json_object_object_add(buf_obj, "timestamp_ns",
-	                       json_object_new_uint64(v4l2_timeval_to_ns(&buf->timestamp)));
-
-	json_object_object_add(buf_obj, "sequence", json_object_new_uint64(buf->sequence));
-	json_object_object_add(buf_obj, "memory",
-	                       json_object_new_string(val2s(buf->memory, v4l2_memory_val_def).c_str()));
-
-	json_object *m_obj = json_object_new_object();
-	if (buf->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
-	    buf->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
-		json_object *planes_obj = json_object_new_array();
-		/* TODO add planes > 0 */
-		json_object_array_add(planes_obj, trace_v4l2_plane(buf->m.planes, buf->memory));
-		json_object_object_add(m_obj, "planes", planes_obj);
 	}
 
-	if (buf->type == V4L2_BUF_TYPE_VIDEO_CAPTURE ||
-	    buf->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
-		if (buf->memory == V4L2_MEMORY_MMAP)
-			json_object_object_add(m_obj, "offset", json_object_new_uint64(buf->m.offset));
-	}
-	json_object_object_add(buf_obj, "m", m_obj);
-	json_object_object_add(buf_obj, "length", json_object_new_uint64(buf->length));
-
-	if (buf->flags & V4L2_BUF_FLAG_REQUEST_FD)
-		json_object_object_add(buf_obj, "request_fd", json_object_new_int(buf->request_fd));
-
-	json_object_object_add(ioctl_args, "v4l2_buffer", buf_obj);
+	/* Write the planes in one go, the buffer is reused once it is queued again. */
+	if (fwrite(buffer_pointer, 1, length, ctx_trace.yuv_file) != length ||
+	    fflush(ctx_trace.yuv_file))
+		line_info("\n\tCan't write to \'%s\'", ctx_trace.yuv_filename.c_str());
 }
 
-void trace_vidioc_stream(void *arg, json_object *ioctl_args)
-{
-	v4l2_buf_type buf_type = *(static_cast<v4l2_buf_type*>(arg));
-	json_object_object_add(ioctl_args, "type",
-	                       json_object_new_string(val2s(buf_type, v4l2_buf_type_val_def).c_str()));
-}
-
-void trace_v4l2_streamparm(void *arg, json_object *ioctl_args)
-{
-	json_object *v4l2_streamparm_obj = json_object_new_object();
-	struct v4l2_streamparm *streamparm = static_cast<struct v4l2_streamparm*>(arg);
-
-	json_object_object_add(v4l2_streamparm_obj, "type",
-	                       json_object_new_string(val2s(streamparm->type, v4l2_buf_type_val_def).c_str()));
-
-	if ((streamparm->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) ||
-	    (streamparm->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE))
-		trace_v4l2_captureparm_gen(&streamparm->parm, v4l2_streamparm_obj);
-
-	if ((streamparm->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) ||
-	    (streamparm->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE))
-		trace_v4l2_outputparm_gen(&streamparm->parm, v4l2_streamparm_obj);
-
-	json_object_object_add(ioctl_args, "v4l2_streamparm", v4l2_streamparm_obj);
-}
-
-void trace_v4l2_ext_control(void *arg, json_object *parent_obj, std::string key_name = "")
-{
-	json_object *v4l2_ext_control_obj = json_object_new_object();
-	struct v4l2_ext_control *p = static_cast<struct v4l2_ext_control*>(arg);
-
-	json_object_object_add(v4l2_ext_control_obj, "id",
-	                       json_object_new_string(val2s(p->id, control_val_def).c_str()));
-	json_object_object_add(v4l2_ext_control_obj, "size", json_object_new_uint64(p->size));
-
-	/* trace controls of type V4L2_CTRL_TYPE_MENU */
-	switch (p->id) {
-	case V4L2_CID_STATELESS_H264_DECODE_MODE: {
-		json_object_object_add(v4l2_ext_control_obj, "value",
-		                       json_object_new_string(val2s(p->value, v4l2_stateless_h264_decode_mode_val_def).c_str()));
-		json_object_array_add(parent_obj, v4l2_ext_control_obj);
-		return;
-	}
-	case V4L2_CID_STATELESS_H264_START_CODE: {
-		json_object_object_add(v4l2_ext_control_obj, "value",
-		                       json_object_new_string(val2s(p->value, v4l2_stateless_h264_start_code_val_def).c_str()));
-		json_object_array_add(parent_obj, v4l2_ext_control_obj);
-		return;
-	}
-	case V4L2_CID_STATELESS_HEVC_DECODE_MODE: {
-		json_object_object_add(v4l2_ext_control_obj, "value",
-		                       json_object_new_string(val2s(p->value, v4l2_stateless_hevc_decode_mode_val_def).c_str()));
-		json_object_array_add(parent_obj, v4l2_ext_control_obj);
-		return;
-	}
-	case V4L2_CID_STATELESS_HEVC_START_CODE: {
-		json_object_object_add(v4l2_ext_control_obj, "value",
-		                       json_object_new_string(val2s(p->value, v4l2_stateless_hevc_start_code_val_def).c_str()));
-		json_object_array_add(parent_obj, v4l2_ext_control_obj);
-		return;
-	}
-	default:
-		break;
-	}
-
-	if (p->ptr == nullptr) {
-		json_object_array_add(parent_obj, v4l2_ext_control_obj);
-		return;
-	}
-
-	switch (p->id) {
-	case V4L2_CID_STATELESS_VP8_FRAME:
-		trace_v4l2_ctrl_vp8_frame_gen(p->p_vp8_frame, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_H264_SPS:
-		trace_v4l2_ctrl_h264_sps_gen(p->p_h264_sps, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_H264_PPS:
-		trace_v4l2_ctrl_h264_pps_gen(p->p_h264_pps, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_H264_SCALING_MATRIX:
-		trace_v4l2_ctrl_h264_scaling_matrix_gen(p->p_h264_scaling_matrix, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_H264_PRED_WEIGHTS:
-		trace_v4l2_ctrl_h264_pred_weights_gen(p->p_h264_pred_weights, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_H264_SLICE_PARAMS:
-		trace_v4l2_ctrl_h264_slice_params_gen(p->p_h264_slice_params, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_H264_DECODE_PARAMS:
-		trace_v4l2_ctrl_h264_decode_params_gen(p->p_h264_decode_params, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_FWHT_PARAMS:
-		trace_v4l2_ctrl_fwht_params_gen(p->p_fwht_params, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_VP9_FRAME:
-		trace_v4l2_ctrl_vp9_frame_gen(p->p_vp9_frame, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_VP9_COMPRESSED_HDR:
-		trace_v4l2_ctrl_vp9_compressed_hdr_gen(p->p_vp9_compressed_hdr_probs, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_HEVC_SPS:
-		trace_v4l2_ctrl_hevc_sps_gen(p->p_hevc_sps, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_HEVC_PPS:
-		trace_v4l2_ctrl_hevc_pps_gen(p->p_hevc_pps, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_HEVC_SLICE_PARAMS:
-		trace_v4l2_ctrl_hevc_slice_params_gen(p->p_hevc_slice_params, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_HEVC_SCALING_MATRIX:
-		trace_v4l2_ctrl_hevc_scaling_matrix_gen(p->p_hevc_scaling_matrix, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_HEVC_DECODE_PARAMS:
-		trace_v4l2_ctrl_hevc_decode_params_gen(p->p_hevc_decode_params, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_HEVC_ENTRY_POINT_OFFSETS: {
-		/* V4L2_CTRL_TYPE_U32, V4L2_CTRL_FLAG_DYNAMIC_ARRAY */
-		__u32 elems = ctx_trace.elems;
-		json_object_object_add(v4l2_ext_control_obj, "elems", json_object_new_int64(elems));
-		json_object *hevc_entry_point_offsets_obj = json_object_new_array();
-		for (__u32 i = 0; i < elems; i++)
-			json_object_array_add(hevc_entry_point_offsets_obj, json_object_new_int64(p->p_u32[i]));
-		json_object_object_add(v4l2_ext_control_obj, "p_u32", hevc_entry_point_offsets_obj);
-		break;
-	}
-	case V4L2_CID_STATELESS_MPEG2_SEQUENCE:
-		trace_v4l2_ctrl_mpeg2_sequence_gen(p->p_mpeg2_sequence, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_MPEG2_PICTURE:
-		trace_v4l2_ctrl_mpeg2_picture_gen(p->p_mpeg2_picture, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_MPEG2_QUANTISATION:
-		trace_v4l2_ctrl_mpeg2_quantisation_gen(p->p_mpeg2_quantisation, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_MPEG_VIDEO_DEC_PTS:
-	case V4L2_CID_MPEG_VIDEO_DEC_FRAME:
-	case V4L2_CID_MPEG_VIDEO_DEC_CONCEAL_COLOR:
-	case V4L2_CID_PIXEL_RATE:
-		json_object_object_add(v4l2_ext_control_obj, "value64", json_object_new_int64(p->value64));
-		break;
-	case V4L2_CID_STATELESS_AV1_SEQUENCE:
-		trace_v4l2_ctrl_av1_sequence_gen(p->p_av1_sequence, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_AV1_TILE_GROUP_ENTRY:
-		trace_v4l2_ctrl_av1_tile_group_entry_gen(p->p_av1_tile_group_entry, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_AV1_FRAME:
-		trace_v4l2_ctrl_av1_frame_gen(p->p_av1_frame, v4l2_ext_control_obj);
-		break;
-	case V4L2_CID_STATELESS_AV1_FILM_GRAIN:
-		trace_v4l2_ctrl_av1_film_grain_gen(p->p_av1_film_grain, v4l2_ext_control_obj);
-		break;
-	default:
-		if (p->size)
-			line_info("\n\tWarning: cannot trace control: %s", val2s(p->id, control_val_def).c_str());
-		else
-			json_object_object_add(v4l2_ext_control_obj, "value", json_object_new_int(p->value));
-		break;
-	}
-
-	json_object_array_add(parent_obj, v4l2_ext_control_obj);
-}
-
-void trace_v4l2_ext_controls(void *arg, json_object *ioctl_args)
+void trace_mem_decoded(void)
 {
-	json_object *ext_controls_obj = json_object_new_object();
-	struct v4l2_ext_controls *ext_controls = static_cast<struct v4l2_ext_controls*>(arg);
-
-	json_object_object_add(ext_controls_obj, "which",
-	                       json_object_new_string(val2s(ext_controls->which, which_val_def).c_str()));
-
-	json_object_object_add(ext_controls_obj, "count", json_object_new_int64(ext_controls->count));
-
-	/* error_idx is defined only if the ioctl returned an error  */
-	if (errno)
-		json_object_object_add(ext_controls_obj, "error_idx",
-		                       json_object_new_uint64(ext_controls->error_idx));
+	unsigned expected_length = get_expected_length_trace();
 
-	/* request_fd is only valid when "which" == V4L2_CTRL_WHICH_REQUEST_VAL */
-	if (ext_controls->which == V4L2_CTRL_WHICH_REQUEST_VAL)
-		json_object_object_add(ext_controls_obj, "request_fd",
-		                       json_object_new_int(ext_controls->request_fd));
+	while (!ctx_trace.decode_order.empty()) {
+		long next_frame_to_be_displayed = *ctx_trace.decode_order.begin();
+		auto idx = ctx_trace.buffers_by_display_order.find(next_frame_to_be_displayed);
+		if (idx == ctx_trace.buffers_by_display_order.end())
+			break;
 
-	json_object *controls_obj = json_object_new_array();
-	for (__u32 i = 0; i < ext_controls->count; i++) {
-		if ((void *) ext_controls->controls == nullptr)
+		auto it = idx->second;
+		if (!it->address)
+			break;
+		/*
+		 * If bytesused exceeds the expected length of the decoded video data,
+		 * then assume that this is extraneous padding or info added by the driver
+		 * and do not trace it.
+		 */
+		if (it->bytesused < expected_length)
 			break;
-		trace_v4l2_ext_control((void *) &ext_controls->controls[i], controls_obj);
+		debug_line_info("\n\tDisplaying: %ld, %s, index: %d", it->display_order,
+				val2s(it->type, v4l2_buf_type_val_def).c_str(), it->index);
+
+		if (ctx_trace.options.write_decoded_to_yuv)
+			trace_mem_decoded_to_yuv((unsigned char*) it->address, expected_length);
+		trace_mem(it->fd, it->offset, it->type, it->index, it->bytesused, it->address);
+		ctx_trace.decode_order.erase(ctx_trace.decode_order.begin());
+		ctx_trace.buffers_by_display_order.erase(idx);
+		it->display_order = -1;
 	}
-	json_object_object_add(ext_controls_obj, "controls", controls_obj);
-
-	json_object_object_add(ioctl_args, "v4l2_ext_controls", ext_controls_obj);
 }
 
-void trace_v4l2_decoder_cmd(void *arg, json_object *ioctl_args)
+/*
+ * Store the ioctl argument as the bytes of it and of the memory it points to,
+ * see RAW_ARGS_ALIGN, together with the layout id needed to render it as json
+ * later. Ioctls without a known layout are traced as json right away.
+ */
+json_object *trace_ioctl_args_raw(unsigned long cmd, void *arg)
 {
-	json_object *v4l2_decoder_cmd_obj = json_object_new_object();
-	struct v4l2_decoder_cmd *ptr = static_cast<struct v4l2_decoder_cmd*>(arg);
-
-	json_object_object_add(v4l2_decoder_cmd_obj, "cmd",
-	                       json_object_new_string(val2s(ptr->cmd, decoder_cmd_val_def).c_str()));
-
-	std::string flags;
-
-	switch (ptr->cmd) {
-	case V4L2_DEC_CMD_START: {
-		flags = fl2s(ptr->flags, v4l2_decoder_cmd_start_flag_def);
-		/* struct start */
-		json_object *start_obj = json_object_new_object();
-		json_object_object_add(start_obj, "speed", json_object_new_int(ptr->start.speed));
-
-		std::string format;
-		/* possible values V4L2_DEC_START_FMT_NONE, V4L2_DEC_START_FMT_GOP */
-		if (ptr->start.format == V4L2_DEC_START_FMT_GOP)
-			format = "V4L2_DEC_START_FMT_GOP";
-		else if (ptr->start.format == V4L2_DEC_START_FMT_NONE)
-			format = "V4L2_DEC_START_FMT_NONE";
-		json_object_object_add(start_obj, "format", json_object_new_string(format.c_str()));
-
-		json_object_object_add(v4l2_decoder_cmd_obj, "start", start_obj);
-		break;
-	}
-	case V4L2_DEC_CMD_STOP: {
-		flags = fl2s(ptr->flags, v4l2_decoder_cmd_stop_flag_def);
-		json_object *stop_obj = json_object_new_object();
-		json_object_object_add(stop_obj, "pts", json_object_new_uint64(ptr->stop.pts));
-
-		json_object_object_add(v4l2_decoder_cmd_obj, "stop", stop_obj);
-		break;
-	}
-
-	case V4L2_DEC_CMD_PAUSE: {
-		flags = fl2s(ptr->flags, v4l2_decoder_cmd_pause_flag_def);
-		break;
-	}
-	case V4L2_DEC_CMD_RESUME:
-	case V4L2_DEC_CMD_FLUSH:
-	default:
-		break;
-	}
-	json_object_object_add(v4l2_decoder_cmd_obj, "flags", json_object_new_string(flags.c_str()));
+	__u32 schema = ioctl_schema(cmd);
+	if (!schema || !_IOC_SIZE(cmd))
+		return trace_ioctl_args(cmd, arg);
 
-	json_object_object_add(ioctl_args, "v4l2_decoder_cmd", v4l2_decoder_cmd_obj);
-}
+	std::vector<unsigned char> data;
+	auto add_data = [&data](const void *ptr, size_t size) {
+		size_t offset = raw_args_align(data.size());
+		data.resize(offset + size);
+		memcpy(data.data() + offset, ptr, size);
+	};
 
-json_object *trace_ioctl_args(unsigned long cmd, void *arg)
-{
-	json_object *ioctl_args = json_object_new_object();
+	json_object *raw_obj = json_object_new_object();
+	json_object_object_add(raw_obj, "schema", json_object_new_int64(schema));
+	add_data(arg, _IOC_SIZE(cmd));
 
 	switch (cmd) {
-	case VIDIOC_QUERYCAP:
-		trace_v4l2_capability_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_ENUM_FMT:
-		trace_v4l2_fmtdesc_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_FMT:
-	case VIDIOC_TRY_FMT:
-	case VIDIOC_S_FMT:
-		trace_v4l2_format_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_REQBUFS:
-		trace_v4l2_requestbuffers_gen(arg, ioctl_args);
+	case VIDIOC_G_EXT_CTRLS:
+	case VIDIOC_TRY_EXT_CTRLS:
+	case VIDIOC_S_EXT_CTRLS: {
+		struct v4l2_ext_controls *ext_controls = static_cast<struct v4l2_ext_controls*>(arg);
+		json_object_object_add(raw_obj, "ctrl_schema", json_object_new_int64(ctrl_schema_id));
+		if (ext_controls->controls == nullptr)
+			break;
+		add_data(ext_controls->controls, ext_controls->count * sizeof(struct v4l2_ext_control));
+		/* With ENOSPC the sizes are those the driver needs, not those of the payloads. */
+		if (errno == ENOSPC)
+			break;
+		for (__u32 i = 0; i < ext_controls->count; i++) {
+			struct v4l2_ext_control *ctrl = &ext_controls->controls[i];
+			if (ctrl->size && ctrl->ptr != nullptr)
+				add_data(ctrl->ptr, ctrl->size);
+		}
 		break;
+	}
 	case VIDIOC_PREPARE_BUF:
 	case VIDIOC_QUERYBUF:
 	case VIDIOC_QBUF:
-	case VIDIOC_DQBUF:
-		trace_v4l2_buffer(arg, ioctl_args);
-		break;
-	case VIDIOC_EXPBUF:
-		trace_v4l2_exportbuffer_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_STREAMON:
-	case VIDIOC_STREAMOFF:
-		trace_vidioc_stream(arg, ioctl_args);
-		break;
-	case VIDIOC_G_PARM:
-	case VIDIOC_S_PARM:
-		trace_v4l2_streamparm(arg, ioctl_args);
-		break;
-	case VIDIOC_ENUMINPUT:
-		trace_v4l2_input_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_CTRL:
-	case VIDIOC_S_CTRL:
-		trace_v4l2_control_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_TUNER:
-	case VIDIOC_S_TUNER:
-		trace_v4l2_tuner_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_QUERYCTRL:
-		trace_v4l2_queryctrl_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_INPUT:
-	case VIDIOC_S_INPUT: {
-		int *input = static_cast<int*>(arg);
-		json_object_object_add(ioctl_args, "input", json_object_new_int(*input));
-		break;
-	}
-	case VIDIOC_G_OUTPUT:
-	case VIDIOC_S_OUTPUT: {
-		int *output = static_cast<int*>(arg);
-		json_object_object_add(ioctl_args, "output", json_object_new_int(*output));
-		break;
-	}
-	case VIDIOC_ENUMOUTPUT:
-		trace_v4l2_output_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_CROP:
-	case VIDIOC_S_CROP:
-		trace_v4l2_crop_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_EXT_CTRLS:
-	case VIDIOC_TRY_EXT_CTRLS:
-	case VIDIOC_S_EXT_CTRLS:
-		trace_v4l2_ext_controls(arg, ioctl_args);
-		break;
-	case VIDIOC_ENUM_FRAMESIZES:
-		trace_v4l2_frmsizeenum_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_ENUM_FRAMEINTERVALS:
-		trace_v4l2_frmivalenum_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_TRY_ENCODER_CMD:
-	case VIDIOC_ENCODER_CMD:
-		trace_v4l2_encoder_cmd_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_DQEVENT:
-		trace_v4l2_event_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_SUBSCRIBE_EVENT:
-	case VIDIOC_UNSUBSCRIBE_EVENT:
-		trace_v4l2_event_subscription_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_CREATE_BUFS:
-		trace_v4l2_create_buffers_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_G_SELECTION:
-	case VIDIOC_S_SELECTION:
-		trace_v4l2_selection_gen(arg, ioctl_args);
-		break;
-	case VIDIOC_TRY_DECODER_CMD:
-	case VIDIOC_DECODER_CMD:
-		trace_v4l2_decoder_cmd(arg, ioctl_args);
-		break;
-	case VIDIOC_QUERY_EXT_CTRL:
-		trace_v4l2_query_ext_ctrl_gen(arg, ioctl_args);
-		break;
-	case MEDIA_IOC_REQUEST_ALLOC: {
-		__s32 *request_fd = static_cast<__s32*>(arg);
-		json_object_object_add(ioctl_args, "request_fd", json_object_new_int(*request_fd));
+	case VIDIOC_DQBUF: {
+		struct v4l2_buffer *buf = static_cast<struct v4l2_buffer*>(arg);
+		if ((buf->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ||
+		     buf->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) && buf->m.planes != nullptr)
+			add_data(buf->m.planes,
+			         std::min(buf->length, (__u32) VIDEO_MAX_PLANES) * sizeof(struct v4l2_plane));
 		break;
 	}
 	default:
 		break;
 	}
 
-	return ioctl_args;
+	json_object_object_add(raw_obj, "raw_size", json_object_new_uint64(data.size()));
+	if (ctx_trace.options.binary)
+		trace_buffer_binary(raw_obj, data.data(), data.size());
+	else
+		json_object_object_add(raw_obj, "mem_array", trace_buffer(data.data(), data.size()));
+
+	return raw_obj;
 }
@@ -8,6 +8,8 @@
 
 #include "v4l2-tracer-common.h"
 #include "trace-gen.h"
+#include <set>
+#include <unordered_set>
 
 struct buffer_trace {
 	int fd;
@@ -19,13 +21,41 @@ struct buffer_trace {
 	unsigned long address;
 };
 
+/* A buffer payload in the --binary side-car file */
+struct mem_blob {
+	__u64 offset;
+	__u32 size;
+	__u32 length;
+	bool compressed;
+};
+
 struct h264_info {
 	int pic_order_cnt_lsb;
 	int max_pic_order_cnt_lsb;
 };
 
+/* The V4L2_TRACER_OPTION_* environment, looked up once at init. */
+struct trace_options {
+	bool binary;
+	bool compact;
+	bool hash_decoded;
+	bool raw_args;
+	bool trace_userspace_arg;
+	bool write_decoded_to_json;
+	bool write_decoded_to_yuv;
+	std::string trace_id;
+	std::unordered_set<unsigned long> ioctls; /* empty: trace all ioctls */
+	std::vector<std::string> paths; /* empty: trace all video and media devices */
+	__u32 payload_bytes; /* 0: dump the whole payload */
+	unsigned payload_every; /* dump the payload of every Nth buffer */
+	unsigned flight_recorder_s; /* 0: write all records to the trace file */
+};
+
+/* Size of the bitmap of the fds known to the tracer, higher fds always take the slow path. */
+#define TRACE_FDS_MAX 4096
+#define TRACE_FDS_BITS_PER_LONG (8 * sizeof(unsigned long))
+
 struct trace_context {
-	__u32 elems;
 	__u32 width;
 	__u32 height;
 	FILE *trace_file;
@@ -36,9 +66,29 @@ struct trace_context {
 		struct h264_info h264;
 	} fmt;
 	std::string trace_filename;
-	std::list<long> decode_order;
+	/* Display order of the decoded frames not traced yet, the first one is displayed next */
+	std::set<long> decode_order;
+	/* Display orders in the order they were added to decode_order, see get_decode_order() */
+	std::vector<long> decode_order_history;
 	std::list<struct buffer_trace> buffers;
+	/*
+	 * Indexes into buffers, keyed by buffer_key(fd, offset), buffer_key(type, index), address
+	 * and display_order
+	 */
+	std::unordered_map<__u64, std::list<struct buffer_trace>::iterator> buffers_by_fd_offset;
+	std::unordered_map<__u64, std::list<struct buffer_trace>::iterator> buffers_by_type_index;
+	std::unordered_map<unsigned long, std::list<struct buffer_trace>::iterator> buffers_by_address;
+	std::unordered_map<long, std::list<struct buffer_trace>::iterator> buffers_by_display_order;
 	std::unordered_map<int, std::string> devices; /* key:fd, value: path of the device */
+	/* The device and buffer fds below TRACE_FDS_MAX, see fd_may_be_traced() */
+	unsigned long fds[TRACE_FDS_MAX / TRACE_FDS_BITS_PER_LONG];
+	struct trace_options options;
+	FILE *mem_file;
+	std::string mem_filename;
+	std::unordered_map<__u64, struct mem_blob> mem_blobs; /* key: hash of the payload */
+	FILE *yuv_file; /* V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE */
+	std::string yuv_filename;
+	unsigned long payloads; /* number of payloads that could have been dumped */
 };
 
 void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64);
@@ -46,10 +96,16 @@ void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t o
 void trace_mem(int fd, __u32 offset, __u32 type, int index, __u32 bytesused, unsigned long start);
 void trace_mem_encoded(int fd, __u32 offset);
 void trace_mem_decoded(void);
-json_object *trace_ioctl_args(unsigned long cmd, void *arg);
+json_object *trace_ioctl_args_raw(unsigned long cmd, void *arg);
 
 bool is_video_or_media_device(const char *path);
+bool trace_path_selected(const char *path);
+bool trace_fd_selected(int fd);
+bool trace_ioctl_selected(unsigned long cmd);
+bool trace_payload_selected(void);
 void add_device(int fd, std::string path);
+void add_traced_fd(int fd);
+void remove_traced_fd(int fd);
 std::string get_device(int fd);
 void print_devices(void);
 bool buffer_in_trace_context(int fd, __u32 offset = 0);
@@ -68,7 +124,9 @@ void g_fmt_setup_trace(struct v4l2_format *format);
 void s_fmt_setup(struct v4l2_format *format);
 void expbuf_setup(struct v4l2_exportbuffer *export_buffer);
 void querybuf_setup(int fd, struct v4l2_buffer *buf);
-void query_ext_ctrl_setup(int fd, struct v4l2_query_ext_ctrl *ptr);
+void trace_options_init(void);
+void trace_init(void);
+void add_call_timing(json_object *jobj, __u64 start_ns);
 void write_json_object_to_json_file(json_object *jobj);
 void close_json_file(void);
 
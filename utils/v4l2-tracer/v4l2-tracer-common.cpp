@@ -18,6 +18,33 @@ bool is_verbose(void)
 	return (getenv("V4L2_TRACER_OPTION_VERBOSE") != nullptr);
 }
 
+/* CLOCK_MONOTONIC in ns, for the timestamp_ns of the traced calls. */
+__u64 get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* FNV-1a on 64-bit words, with a shift to mix the upper bits back in. */
+__u64 hash_buffer(const unsigned char *buffer_pointer, __u32 bytesused)
+{
+	const __u64 fnv_prime = 0x100000001b3ULL;
+	__u64 hash = 0xcbf29ce484222325ULL;
+	__u32 i = 0;
+
+	for (; i + sizeof(__u64) <= bytesused; i += sizeof(__u64)) {
+		__u64 word;
+		memcpy(&word, buffer_pointer + i, sizeof(word));
+		hash = (hash ^ word) * fnv_prime;
+		hash ^= hash >> 32;
+	}
+	for (; i < bytesused; i++)
+		hash = (hash ^ buffer_pointer[i]) * fnv_prime;
+	return hash ^ bytesused;
+}
+
 void print_v4l2_tracer_info(void)
 {
 	fprintf(stderr, "v4l2-tracer %s%s\n", PACKAGE_VERSION, STRING(GIT_COMMIT_CNT));
@@ -30,9 +57,12 @@ void print_usage(void)
 	print_v4l2_tracer_info();
 	fprintf(stderr, "Usage:\n\tv4l2-tracer [options] trace <tracee>\n"
 	        "\tv4l2-tracer [options] retrace <trace_file>.json\n"
-	        "\tv4l2-tracer clean <trace_file>.json\n\n"
+	        "\tv4l2-tracer clean <trace_file>.json\n"
+	        "\tv4l2-tracer [options] dump <trace_file>.json\n\n"
 
 	        "\tCommon options:\n"
+	        "\t\t-b, --binary      Write video frame data to a binary file next to the\n"
+	        "\t\t                  JSON file, each distinct frame only once.\n"
 	        "\t\t-c, --compact     Write minimal whitespace in JSON file.\n"
 	        "\t\t-g, --debug       Turn on verbose reporting plus additional debug info.\n"
 	        "\t\t-h, --help        Display this message.\n"
@@ -41,13 +71,36 @@ void print_usage(void)
 	        "\t\t-v, --verbose     Turn on verbose reporting.\n"
 	        "\t\t-y, --yuv         Write decoded video frame data to yuv file.\n\n"
 
+	        "\tTrace options:\n"
+	        "\t\t-a, --raw_args             Store the ioctl arguments as bytes, to be\n"
+	        "\t\t                           rendered as JSON by dump or retrace.\n"
+	        "\t\t-k, --hash                 Store a hash of each decoded frame, which\n"
+	        "\t\t                           retrace checks its decoded frames against.\n"
+	        "\t\t-i, --ioctls <ioctl>[,<ioctl>...]\n"
+	        "\t\t                           Only trace these ioctls, e.g. QBUF,DQBUF.\n"
+	        "\t\t-p, --paths <path>[,<path>...]\n"
+	        "\t\t                           Only trace the devices whose path starts with\n"
+	        "\t\t                           one of these, e.g. /dev/video0,/dev/media.\n"
+	        "\t\t-n, --payload_bytes <n>    Only dump the first <n> bytes of each payload.\n"
+	        "\t\t-e, --payload_every <n>    Only dump the payload of every <n>th buffer.\n"
+	        "\t\t-f, --flight_recorder <s>  Keep the ioctls and payloads of the last <s>\n"
+	        "\t\t                           seconds in memory, and write them to the trace\n"
+	        "\t\t                           file when the tracee gets a SIGUSR1.\n"
+	        "\t\t                           Filtered traces may not be retraceable.\n\n"
+
 	        "\tRetrace options:\n"
 	        "\t\t-d, --video_device <dev>   Retrace with a specific video device.\n"
 	        "\t\t                           <dev> must be a digit corresponding to\n"
 	        "\t\t                           /dev/video<dev> \n\n"
 	        "\t\t-m, --media_device <dev>   Retrace with a specific media device.\n"
 	        "\t\t                           <dev> must be a digit corresponding to\n"
-	        "\t\t                           /dev/media<dev> \n\n");
+	        "\t\t                           /dev/media<dev> \n\n"
+	        "\t\t-s, --speed <factor>       Replay with the timing of the trace, <factor>\n"
+	        "\t\t                           times as fast (e.g. 1, 2 or 0.5), and report\n"
+	        "\t\t                           the replay lag and the ioctl latencies.\n"
+	        "\t\t-t, --threads              Replay the calls on each device on its own\n"
+	        "\t\t                           thread, keeping the order of the buffer and\n"
+	        "\t\t                           request handoffs between the devices.\n\n");
 }
 
 void add_separator(std::string &str)
@@ -83,6 +136,14 @@ std::string number2s_oct(long num)
 	return stream.str();
 }
 
+/* Convert a hash_buffer() result to the fixed width hex string stored in the trace. */
+std::string hash2s(__u64 hash)
+{
+	std::stringstream stream;
+	stream << std::setfill('0') << std::setw(16) << std::hex << hash;
+	return stream.str();
+}
+
 /* Convert a number to a hex string. If num is 0, return an empty string. */
 std::string number2s(long num)
 {
@@ -240,6 +301,20 @@ long s2val(const char *char_str, const val_def *def)
 	return s2number(char_str);
 }
 
+/* Return the layout id of the argument of the ioctl, or 0 if it is unknown. */
+__u32 ioctl_schema(unsigned long cmd)
+{
+	static const std::unordered_map<unsigned long, __u32> schemas = [] {
+		std::unordered_map<unsigned long, __u32> map;
+		for (const schema_def *def = ioctl_schema_def; def->val != -1; def++)
+			map[def->val] = def->id;
+		return map;
+	}();
+
+	auto it = schemas.find(cmd);
+	return it == schemas.end() ? 0 : it->second;
+}
+
 unsigned long s2flags(const char *char_str, const flag_def *def)
 {
 	if (char_str == nullptr)
@@ -27,6 +27,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -56,16 +57,44 @@
 			line_info(fmt, ##args);	\
 	} while (0)				\
 
+/* Key for the hashed buffer lookups by (fd, offset) and by (type, index). */
+static inline __u64 buffer_key(__u32 a, __u32 b)
+{
+	return ((__u64) a << 32) | b;
+}
+
 struct val_def {
 	__s64 val;
 	const char *str;
 };
 
+/* The layout id of the argument of an ioctl, see ioctl_schema_def */
+struct schema_def {
+	__s64 val;
+	__u32 id;
+};
+
+/*
+ * With --raw_args an ioctl argument is stored as its bytes, followed by the
+ * memory it points to: the controls of a struct v4l2_ext_controls and then the
+ * payload of each control with a size, or the planes of a multiplanar struct
+ * v4l2_buffer. Each of these starts at a multiple of RAW_ARGS_ALIGN bytes.
+ */
+#define RAW_ARGS_ALIGN 8
+
+static inline size_t raw_args_align(size_t size)
+{
+	return (size + RAW_ARGS_ALIGN - 1) & ~(size_t) (RAW_ARGS_ALIGN - 1);
+}
+
 bool is_debug(void);
+__u64 get_time_ns(void);
+__u64 hash_buffer(const unsigned char *buffer_pointer, __u32 bytesused);
 bool is_verbose(void);
 void print_v4l2_tracer_info(void);
 void print_usage(void);
 std::string ver2s(unsigned int version);
+std::string hash2s(__u64 hash);
 std::string number2s_oct(long num);
 std::string number2s(long num);
 std::string val2s(long val, const val_def *def);
@@ -81,6 +110,8 @@ std::string which2s(unsigned long which);
 std::string get_path_media(std::string driver);
 std::string get_path_video(int media_fd, std::list<std::string> linked_entities);
 std::list<std::string> get_linked_entities(int media_fd, std::string path_video);
+__u32 ioctl_schema(unsigned long cmd);
+json_object *trace_ioctl_args(unsigned long cmd, void *arg);
 
 constexpr val_def which_val_def[] = {
 	{ V4L2_CTRL_WHICH_CUR_VAL,	"V4L2_CTRL_WHICH_CUR_VAL" },
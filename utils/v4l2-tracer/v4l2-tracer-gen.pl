@@ -164,6 +164,42 @@ sub clean_up_line {
 	return $line;
 }
 
+# Add a line of the struct being generated to its layout, unlike clean_up_line()
+# this keeps the reserved members.
+sub schema_add_line {
+	my $line = shift;
+	$line =~ s/\/\*.*?\*\///g; # remove comments /* */ inside the line
+	$line =~ s/\s*\/[\/\*].*//; # remove comments that continue after the line
+	return if $line =~ /^\s*\*/; # comment lines
+	return if $line !~ /[;{}]/;
+	$line =~ s/\s+/ /g;
+	$line =~ s/^ | $//g;
+	$schema_text{$struct_name} .= "$line\n";
+}
+
+sub fnv1a {
+	my $hash = 0x811c9dc5;
+	foreach my $c (unpack("C*", shift)) {
+		$hash = (($hash ^ $c) * 0x01000193) & 0xffffffff;
+	}
+	return $hash;
+}
+
+# The layout id of a struct hashes its members and the layout ids of the structs
+# it uses, so it changes when anything changes in the memory it describes.
+sub schema_id {
+	my $name = shift;
+	return $schema_id{$name} if defined $schema_id{$name};
+	$schema_id{$name} = 0; # for structs that point to themselves
+	my $text = $schema_text{$name};
+	foreach my $used ($schema_text{$name} =~ /struct (\w+)/g) {
+		next if $used eq $name || !defined $schema_text{$used};
+		$text .= sprintf("%08x\n", schema_id($used));
+	}
+	$schema_id{$name} = fnv1a($text);
+	return $schema_id{$name};
+}
+
 sub get_val_def_name {
 	my $member = shift;
 	my $struct_name = shift;
@@ -446,8 +482,10 @@ sub struct_gen {
 
 	$suppress_union = false;
 	$suppress_struct = false;
+	$schema_text{$struct_name} = "";
 	while ($line = <>) {
 		chomp($line);
+		schema_add_line($line);
 		$member = "";
 		if ($line =~ /}.*;/) {
 			if ($suppress_struct eq true) {
@@ -656,8 +694,11 @@ sub struct_gen_ctrl {
 	printf $fh_retrace_cpp "\tif (!json_object_object_get_ex(ctrl_obj, \"%s\", &%s_obj))\n", $struct_name, $struct_name;
 	printf $fh_retrace_cpp "\t\t%s_obj = ctrl_obj;\n", $struct_name;
 
+	$schema_text{$struct_name} = "";
+	push (@ctrl_structs, $struct_name);
 	while ($line = <>) {
 		chomp($line);
+		schema_add_line($line);
 		last if $line =~ /};/;
 		$line = clean_up_line($line);
 		next if $line =~ /^\s*$/; # ignore blank lines
@@ -1065,6 +1106,26 @@ foreach (@ioctls) {
 }
 printf $fh_common_info_h "\t{ -1, \"\" }\n};\n";
 
+printf $fh_common_info_h "constexpr schema_def ioctl_schema_def[] = {\n";
+foreach (@ioctls) {
+	($ioctl, $type) = ($_) =~ /^#define\s*(\w+)\s*_IO\w*\s*\(\s*'.'\s*,\s*[^,]+,\s*(.+?)\s*\)/;
+	next if $type eq "";
+	if ($type =~ /^struct (\w+)$/ && defined $schema_text{$1}) {
+		$id = schema_id($1);
+	} else {
+		$id = fnv1a($type);
+	}
+	printf $fh_common_info_h "\t{ %s,\t0x%08x },\n", $ioctl, $id;
+}
+printf $fh_common_info_h "\t{ -1, 0 }\n};\n";
+
+# The payloads of the compound controls are stored with the layout id of all of them.
+$ctrl_structs_text = "";
+foreach (@ctrl_structs) {
+	$ctrl_structs_text .= sprintf("%08x\n", schema_id($_));
+}
+printf $fh_common_info_h "constexpr __u32 ctrl_schema_id = 0x%08x;\n", fnv1a($ctrl_structs_text);
+
 
 printf $fh_trace_h "\n#endif\n";
 close $fh_trace_h;
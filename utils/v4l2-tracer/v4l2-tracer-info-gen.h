@@ -2417,5 +2417,97 @@ constexpr val_def ioctl_val_def[] = {
 	{ MEDIA_REQUEST_IOC_REINIT,	"MEDIA_REQUEST_IOC_REINIT" },
 	{ -1, "" }
 };
+constexpr schema_def ioctl_schema_def[] = {
+	{ VIDIOC_QUERYCAP,	0xd78c25a4 },
+	{ VIDIOC_ENUM_FMT,	0x161f636c },
+	{ VIDIOC_G_FMT,	0x9c81d46d },
+	{ VIDIOC_S_FMT,	0x9c81d46d },
+	{ VIDIOC_REQBUFS,	0x1c4a4c43 },
+	{ VIDIOC_QUERYBUF,	0x180617ce },
+	{ VIDIOC_G_FBUF,	0x3d250de9 },
+	{ VIDIOC_S_FBUF,	0x3d250de9 },
+	{ VIDIOC_OVERLAY,	0x95e97e5e },
+	{ VIDIOC_QBUF,	0x180617ce },
+	{ VIDIOC_EXPBUF,	0xef89aafa },
+	{ VIDIOC_DQBUF,	0x180617ce },
+	{ VIDIOC_STREAMON,	0x95e97e5e },
+	{ VIDIOC_STREAMOFF,	0x95e97e5e },
+	{ VIDIOC_G_PARM,	0xda77e5dd },
+	{ VIDIOC_S_PARM,	0xda77e5dd },
+	{ VIDIOC_G_STD,	0x4bee03c9 },
+	{ VIDIOC_S_STD,	0x4bee03c9 },
+	{ VIDIOC_ENUMSTD,	0xd0688995 },
+	{ VIDIOC_ENUMINPUT,	0x752e90c7 },
+	{ VIDIOC_G_CTRL,	0xa5be07fd },
+	{ VIDIOC_S_CTRL,	0xa5be07fd },
+	{ VIDIOC_G_TUNER,	0x01860935 },
+	{ VIDIOC_S_TUNER,	0x01860935 },
+	{ VIDIOC_G_AUDIO,	0xfa2da8be },
+	{ VIDIOC_S_AUDIO,	0xfa2da8be },
+	{ VIDIOC_QUERYCTRL,	0x895ef10e },
+	{ VIDIOC_QUERYMENU,	0x4a1746a8 },
+	{ VIDIOC_G_INPUT,	0x95e97e5e },
+	{ VIDIOC_S_INPUT,	0x95e97e5e },
+	{ VIDIOC_G_EDID,	0xc2cf4525 },
+	{ VIDIOC_S_EDID,	0xc2cf4525 },
+	{ VIDIOC_G_OUTPUT,	0x95e97e5e },
+	{ VIDIOC_S_OUTPUT,	0x95e97e5e },
+	{ VIDIOC_ENUMOUTPUT,	0xeb1213d7 },
+	{ VIDIOC_G_AUDOUT,	0xfa2da8be },
+	{ VIDIOC_S_AUDOUT,	0xfa2da8be },
+	{ VIDIOC_G_MODULATOR,	0x7c51413a },
+	{ VIDIOC_S_MODULATOR,	0x7c51413a },
+	{ VIDIOC_G_FREQUENCY,	0xa7b61105 },
+	{ VIDIOC_S_FREQUENCY,	0xa7b61105 },
+	{ VIDIOC_CROPCAP,	0x1fe0697c },
+	{ VIDIOC_G_CROP,	0xc6508355 },
+	{ VIDIOC_S_CROP,	0xc6508355 },
+	{ VIDIOC_G_JPEGCOMP,	0x57383b02 },
+	{ VIDIOC_S_JPEGCOMP,	0x57383b02 },
+	{ VIDIOC_QUERYSTD,	0x4bee03c9 },
+	{ VIDIOC_TRY_FMT,	0x9c81d46d },
+	{ VIDIOC_ENUMAUDIO,	0xfa2da8be },
+	{ VIDIOC_ENUMAUDOUT,	0xfa2da8be },
+	{ VIDIOC_G_PRIORITY,	0x49389aa3 },
+	{ VIDIOC_S_PRIORITY,	0x49389aa3 },
+	{ VIDIOC_G_SLICED_VBI_CAP,	0x4a0b6e5f },
+	{ VIDIOC_G_EXT_CTRLS,	0x8d74a659 },
+	{ VIDIOC_S_EXT_CTRLS,	0x8d74a659 },
+	{ VIDIOC_TRY_EXT_CTRLS,	0x8d74a659 },
+	{ VIDIOC_ENUM_FRAMESIZES,	0x327cb8c4 },
+	{ VIDIOC_ENUM_FRAMEINTERVALS,	0xadc3d56d },
+	{ VIDIOC_G_ENC_INDEX,	0x61e4ce41 },
+	{ VIDIOC_ENCODER_CMD,	0x5b03907b },
+	{ VIDIOC_TRY_ENCODER_CMD,	0x5b03907b },
+	{ VIDIOC_DBG_S_REGISTER,	0xaf53804a },
+	{ VIDIOC_DBG_G_REGISTER,	0xaf53804a },
+	{ VIDIOC_S_HW_FREQ_SEEK,	0x82ce1b6b },
+	{ VIDIOC_S_DV_TIMINGS,	0xc4dc9083 },
+	{ VIDIOC_G_DV_TIMINGS,	0xc4dc9083 },
+	{ VIDIOC_DQEVENT,	0xd7b34700 },
+	{ VIDIOC_SUBSCRIBE_EVENT,	0xd690d482 },
+	{ VIDIOC_UNSUBSCRIBE_EVENT,	0xd690d482 },
+	{ VIDIOC_CREATE_BUFS,	0x20152c49 },
+	{ VIDIOC_PREPARE_BUF,	0x180617ce },
+	{ VIDIOC_G_SELECTION,	0x5f2d3684 },
+	{ VIDIOC_S_SELECTION,	0x5f2d3684 },
+	{ VIDIOC_DECODER_CMD,	0x24e2c6ff },
+	{ VIDIOC_TRY_DECODER_CMD,	0x24e2c6ff },
+	{ VIDIOC_ENUM_DV_TIMINGS,	0x6b939565 },
+	{ VIDIOC_QUERY_DV_TIMINGS,	0xc4dc9083 },
+	{ VIDIOC_DV_TIMINGS_CAP,	0x225b4616 },
+	{ VIDIOC_ENUM_FREQ_BANDS,	0x912aea0a },
+	{ VIDIOC_DBG_G_CHIP_INFO,	0xb4c27e1c },
+	{ VIDIOC_QUERY_EXT_CTRL,	0x51d10c87 },
+	{ VIDIOC_REMOVE_BUFS,	0x450cde6a },
+	{ MEDIA_IOC_DEVICE_INFO,	0x9e332575 },
+	{ MEDIA_IOC_ENUM_ENTITIES,	0x330b3563 },
+	{ MEDIA_IOC_ENUM_LINKS,	0x33b22afd },
+	{ MEDIA_IOC_SETUP_LINK,	0xd2436eb8 },
+	{ MEDIA_IOC_G_TOPOLOGY,	0x40e0c6db },
+	{ MEDIA_IOC_REQUEST_ALLOC,	0x95e97e5e },
+	{ -1, 0 }
+};
+constexpr __u32 ctrl_schema_id = 0xbff9a284;
 
 #endif
@@ -25,24 +25,44 @@ void v4l2_tracer_sig_handler(int signum)
 }
 
 enum Options {
+	V4l2TracerOptRawArgs = 'a',
+	V4l2TracerOptBinary = 'b',
 	V4l2TracerOptCompactPrint = 'c',
 	V4l2TracerOptSetVideoDevice = 'd',
+	V4l2TracerOptPayloadEvery = 'e',
+	V4l2TracerOptFlightRecorder = 'f',
 	V4l2TracerOptDebug = 'g',
 	V4l2TracerOptHelp = 'h',
+	V4l2TracerOptIoctls = 'i',
+	V4l2TracerOptHashDecoded = 'k',
 	V4l2TracerOptSetMediaDevice = 'm',
+	V4l2TracerOptPayloadBytes = 'n',
+	V4l2TracerOptPaths = 'p',
 	V4l2TracerOptWriteDecodedToJson = 'r',
+	V4l2TracerOptSpeed = 's',
+	V4l2TracerOptThreads = 't',
 	V4l2TracerOptTraceUserspaceArg = 'u',
 	V4l2TracerOptVerbose = 'v',
 	V4l2TracerOptWriteDecodedToYUVFile = 'y',
 };
 
 const static struct option long_options[] = {
+	{ "raw_args", no_argument, nullptr, V4l2TracerOptRawArgs },
+	{ "binary", no_argument, nullptr, V4l2TracerOptBinary },
 	{ "compact", no_argument, nullptr, V4l2TracerOptCompactPrint },
 	{ "video_device", required_argument, nullptr, V4l2TracerOptSetVideoDevice },
+	{ "payload_every", required_argument, nullptr, V4l2TracerOptPayloadEvery },
+	{ "flight_recorder", required_argument, nullptr, V4l2TracerOptFlightRecorder },
 	{ "debug", no_argument, nullptr, V4l2TracerOptDebug },
 	{ "help", no_argument, nullptr, V4l2TracerOptHelp },
+	{ "ioctls", required_argument, nullptr, V4l2TracerOptIoctls },
+	{ "hash", no_argument, nullptr, V4l2TracerOptHashDecoded },
 	{ "media_device", required_argument, nullptr, V4l2TracerOptSetMediaDevice },
+	{ "payload_bytes", required_argument, nullptr, V4l2TracerOptPayloadBytes },
+	{ "paths", required_argument, nullptr, V4l2TracerOptPaths },
 	{ "raw", no_argument, nullptr, V4l2TracerOptWriteDecodedToJson },
+	{ "speed", required_argument, nullptr, V4l2TracerOptSpeed },
+	{ "threads", no_argument, nullptr, V4l2TracerOptThreads },
 	{ "userspace", no_argument, nullptr, V4l2TracerOptTraceUserspaceArg},
 	{ "verbose", no_argument, nullptr, V4l2TracerOptVerbose },
 	{ "yuv", no_argument, nullptr, V4l2TracerOptWriteDecodedToYUVFile },
@@ -50,17 +70,35 @@ const static struct option long_options[] = {
 };
 
 const char short_options[] = {
+	V4l2TracerOptRawArgs,
+	V4l2TracerOptBinary,
 	V4l2TracerOptCompactPrint,
 	V4l2TracerOptSetVideoDevice, ':',
+	V4l2TracerOptPayloadEvery, ':',
+	V4l2TracerOptFlightRecorder, ':',
 	V4l2TracerOptDebug,
 	V4l2TracerOptHelp,
+	V4l2TracerOptIoctls, ':',
+	V4l2TracerOptHashDecoded,
 	V4l2TracerOptSetMediaDevice, ':',
+	V4l2TracerOptPayloadBytes, ':',
+	V4l2TracerOptPaths, ':',
 	V4l2TracerOptWriteDecodedToJson,
+	V4l2TracerOptSpeed, ':',
+	V4l2TracerOptThreads,
 	V4l2TracerOptTraceUserspaceArg,
 	V4l2TracerOptVerbose,
 	V4l2TracerOptWriteDecodedToYUVFile
 };
 
+static bool is_number(const char *str)
+{
+	char *end;
+
+	strtoul(str, &end, 0);
+	return *str >= '0' && *str <= '9' && *end == '\0';
+}
+
 int get_options(int argc, char *argv[])
 {
 	int option = 0;
@@ -78,6 +116,12 @@ int get_options(int argc, char *argv[])
 
 		option = getopt_long(argc, argv, short_options, long_options, NULL);
 		switch (option) {
+		case V4l2TracerOptRawArgs:
+			setenv("V4L2_TRACER_OPTION_RAW_ARGS", "true", 0);
+			break;
+		case V4l2TracerOptBinary:
+			setenv("V4L2_TRACER_OPTION_BINARY", "true", 0);
+			break;
 		case V4l2TracerOptCompactPrint: {
 			setenv("V4L2_TRACER_OPTION_COMPACT_PRINT", "true", 0);
 			break;
@@ -100,6 +144,20 @@ int get_options(int argc, char *argv[])
 			}
 			break;
 		}
+		case V4l2TracerOptPayloadEvery:
+			if (!is_number(optarg) || !strtoul(optarg, nullptr, 0)) {
+				line_info("\n\tCan't dump the payload of every \'%s\' buffer", optarg);
+				return -1;
+			}
+			setenv("V4L2_TRACER_OPTION_PAYLOAD_EVERY", optarg, 0);
+			break;
+		case V4l2TracerOptFlightRecorder:
+			if (!is_number(optarg) || !strtoul(optarg, nullptr, 0)) {
+				line_info("\n\tCan't keep the last \'%s\' seconds", optarg);
+				return -1;
+			}
+			setenv("V4L2_TRACER_OPTION_FLIGHT_RECORDER", optarg, 0);
+			break;
 		case V4l2TracerOptDebug:
 			setenv("V4L2_TRACER_OPTION_VERBOSE", "true", 0);
 			setenv("V4L2_TRACER_OPTION_DEBUG", "true", 0);
@@ -125,9 +183,38 @@ int get_options(int argc, char *argv[])
 			}
 			break;
 		}
+		case V4l2TracerOptIoctls:
+			setenv("V4L2_TRACER_OPTION_IOCTLS", optarg, 0);
+			break;
+		case V4l2TracerOptHashDecoded:
+			setenv("V4L2_TRACER_OPTION_HASH_DECODED", "true", 0);
+			break;
+		case V4l2TracerOptPayloadBytes:
+			if (!is_number(optarg)) {
+				line_info("\n\tCan't dump \'%s\' bytes of the payload", optarg);
+				return -1;
+			}
+			setenv("V4L2_TRACER_OPTION_PAYLOAD_BYTES", optarg, 0);
+			break;
+		case V4l2TracerOptPaths:
+			setenv("V4L2_TRACER_OPTION_PATHS", optarg, 0);
+			break;
 		case V4l2TracerOptWriteDecodedToJson:
 			setenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_JSON_FILE", "true", 0);
 			break;
+		case V4l2TracerOptSpeed: {
+			char *end;
+			double speed = strtod(optarg, &end);
+			if (*end != '\0' || !(speed > 0)) {
+				line_info("\n\tCan't use speed \'%s\'", optarg);
+				return -1;
+			}
+			setenv("V4L2_TRACER_OPTION_SPEED", optarg, 0);
+			break;
+		}
+		case V4l2TracerOptThreads:
+			setenv("V4L2_TRACER_OPTION_THREADS", "true", 0);
+			break;
 		case V4l2TracerOptTraceUserspaceArg:
 			setenv("V4L2_TRACER_OPTION_TRACE_USERSPACE_ARG", "true", 0);
 			break;
@@ -185,6 +272,11 @@ int clean(std::string trace_filename)
 			count_lines_removed++;
 			continue;
 		}
+		if (line.find("timestamp_ns") != std::string::npos ||
+		    line.find("duration_ns") != std::string::npos) {
+			count_lines_removed++;
+			continue;
+		}
 		if (line.find("fildes") != std::string::npos) {
 			count_lines_removed++;
 			continue;
@@ -343,7 +435,7 @@ int tracer(int argc, char *argv[], bool retrace)
 	wait(&exec_result);
 
 	if (WIFEXITED(exec_result))
-		WEXITSTATUS(exec_result);
+		exec_result = WEXITSTATUS(exec_result);
 
 	fprintf(stderr, "Tracee exited with status: %d\n", exec_result);
 
@@ -411,6 +503,8 @@ int main(int argc, char *argv[])
 		ret = retrace(argv[optind]);
 	} else if (command == "clean") {
 		ret = clean (argv[optind]);
+	} else if (command == "dump") {
+		ret = dump(argv[optind]);
 	} else {
 		if (is_debug()) {
 			line_info("Invalid command");